@@ -1,6 +1,8 @@
 #include "common.hpp"
 
+#include <algorithm>
 #include <map>
+#include <vector>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
@@ -23,8 +25,6 @@ std::map<int, const char*> sEnumMap;
 std::map<int, const char*> sDrawEnumMap;
 std::map<int, const char*> sEglEnumMap;
 
-bool sInitedEnumMap = false;
-
 #define InsertEnumString(e) \
     sEnumMap.insert(std::pair<int, const char*>((e), (#e)))
 #define InsertDrawEnumString(e) \
@@ -1753,25 +1753,63 @@ void InitEnumMap()
     InsertEnumString(GL_PROGRAM_PIPELINE);
     InsertEnumString(GL_SAMPLER);
 
-    sInitedEnumMap = true;
 }
 
+// The maps flattened to arrays sorted by enum, which are quicker to search, made once by
+// whichever thread asks first
+struct EnumTable
+{
+    typedef std::pair<int, const char*> Entry;
+    std::vector<Entry> entries;
+
+    explicit EnumTable(const std::map<int, const char*>& map) : entries(map.begin(), map.end()) {}
+
+    const char * find(int e) const
+    {
+        const auto it = std::lower_bound(entries.begin(), entries.end(), Entry(e, NULL),
+            [](const Entry& a, const Entry& b) { return a.first < b.first; });
+        return (it != entries.end() && it->first == e) ? it->second : NULL;
+    }
+};
+
+struct EnumTables
+{
+    EnumTables() : gl((InitEnumMap(), sEnumMap)), draw(sDrawEnumMap), egl(sEglEnumMap) {}
+    EnumTable gl;
+    EnumTable draw;
+    EnumTable egl;
+};
+
+const EnumTables& enumTables()
+{
+    static const EnumTables tables;
+    return tables;
 }
 
-const char * EnumString(unsigned int enumToFind, const std::string &funName)
+}
+
+EnumContext::EnumContext(const std::string &funName)
+    : egl(funName.compare(0, 3, "egl") == 0)
+    , blend(funName.find("glBlend") != std::string::npos)
+    , texParameter(funName.find("glTexParameter") != std::string::npos)
+    , draw(funName.find("glDraw") != std::string::npos)
+    , getError(funName == "glGetError")
+{
+}
+
+const char * EnumString(unsigned int enumToFind, const EnumContext &context)
 {
-    if ( !sInitedEnumMap ) InitEnumMap();
+    const EnumTables& tables = enumTables();
 
-    if (funName.compare(0, 3, "egl") == 0)
+    if (context.egl)
     {
-        const auto& citer = sEglEnumMap.find(enumToFind);
-        if (citer != sEglEnumMap.end())
+        if (const char *name = tables.egl.find(enumToFind))
         {
-            return citer->second;
+            return name;
         }
     }
 
-    if (funName.find("glBlend") != std::string::npos) // needs special handling
+    if (context.blend) // needs special handling
     {
         if (enumToFind == GL_ZERO)
         {
@@ -1783,7 +1821,7 @@ const char * EnumString(unsigned int enumToFind, const std::string &funName)
         }
     }
 
-    if (funName.find("glTexParameter") != std::string::npos) // texturing, needs special handling
+    if (context.texParameter) // texturing, needs special handling
     {
         if (enumToFind == GL_NONE)
         {
@@ -1791,27 +1829,25 @@ const char * EnumString(unsigned int enumToFind, const std::string &funName)
         }
     }
 
-    if (funName.find("glDraw") != std::string::npos)
+    if (context.draw)
     {
-        const auto& citer = sDrawEnumMap.find(enumToFind);
-        if (citer != sDrawEnumMap.end())
+        if (const char *name = tables.draw.find(enumToFind))
         {
-            return citer->second;
+            return name;
         }
     }
 
-    if (funName == "glGetError")
+    if (context.getError)
     {
         return "GL_NO_ERROR";
     }
 
-    const auto& citer = sEnumMap.find(enumToFind);
-    if (citer != sEnumMap.end())
-    {
-        return citer->second;
-    }
+    return tables.gl.find(enumToFind);
+}
 
-    return NULL;
+const char * EnumString(unsigned int enumToFind, const std::string &funName)
+{
+    return EnumString(enumToFind, EnumContext(funName));
 }
 
 const std::string Cube2D::asString() const
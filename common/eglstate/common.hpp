@@ -27,6 +27,19 @@
 // it means GL_NONE.
 const char * EnumString(unsigned int e, const std::string &funName = std::string());
 
+// Which of the special cases above apply to a function, worked out once from its name for
+// looking up many enums of its calls
+struct EnumContext
+{
+    explicit EnumContext(const std::string &funName = std::string());
+    bool egl;
+    bool blend;
+    bool texParameter;
+    bool draw;
+    bool getError;
+};
+const char * EnumString(unsigned int e, const EnumContext &context);
+
 struct Cube2D
 {
     Cube2D()
@@ -99,11 +99,20 @@ void FrameRecorder::Clear()
     PostDrawCall();
 }
 
+void FrameRecorder::RequestStateDump(unsigned int frameIndex, unsigned int drawCallIndex)
+{
+    _stateDumps.insert(std::make_pair(frameIndex, drawCallIndex));
+}
+
 void FrameRecorder::PreDrawCall()
 {
+    if (_stateDumps.empty())
+    {
+        return;
+    }
     const unsigned int frameIndex = _frames.size();
     const unsigned int drawcallIndex = _drawCallIndex;
-    if (frameIndex == 521 && drawcallIndex == 25)
+    if (_stateDumps.count(std::make_pair(frameIndex, drawcallIndex)))
     {
         char buffer[256];
         sprintf(buffer, "frame%d_drawcall%d.json", frameIndex, drawcallIndex);
@@ -1,6 +1,8 @@
 #ifndef _FRAME_RECORDER_HPP_
 #define _FRAME_RECORDER_HPP_
 
+#include <set>
+#include <utility>
 #include <vector>
 
 namespace record
@@ -35,6 +37,10 @@ public:
     void DrawArrays(unsigned int mode, unsigned int first, unsigned int count);
     void DrawElements(unsigned int mode, unsigned int count, unsigned int type, const void *indices);
 
+    // Dump the whole state to frame<F>_drawcall<D>.json before that draw call. Nothing else is
+    // captured per draw call besides the framebuffer it renders to.
+    void RequestStateDump(unsigned int frameIndex, unsigned int drawCallIndex);
+
 private:
     void PreDrawCall();
     void PostDrawCall();
@@ -43,6 +49,7 @@ private:
 
     unsigned int _drawCallIndex; // draw call index in a frame
     std::vector<Frame *> _frames;
+    std::set<std::pair<unsigned int, unsigned int> > _stateDumps; // frame and draw call indices
 };
 
 } // namespace record
@@ -5,6 +5,7 @@
 
 #include "image.hpp"
 #include "image_compression.hpp"
+#include "image_convert.hpp"
 
 namespace
 {
@@ -285,7 +286,7 @@ bool BGRAToRGBA(Image &input, Image &output)
 {
     const UInt32 format = input.Format();
     const UInt32 type = input.Type();
-    if (format != GL_BGRA_EXT && type != GL_UNSIGNED_BYTE)
+    if (format != GL_BGRA_EXT || type != GL_UNSIGNED_BYTE)
     {
         PAT_DEBUG_LOG("Unexpected format-type pair : 0x%X 0x%X\n", format, type);
         return false;
@@ -294,20 +295,7 @@ bool BGRAToRGBA(Image &input, Image &output)
     UInt8 *newData = new UInt8[input.DataSize()];
     const UInt32 width = input.Width();
     const UInt32 height = input.Height();
-    const UInt8 *oldData = input.Data();
-    UInt8 *p = newData;
-    for (UInt32 j = 0; j < height; j++)
-    {
-        for (UInt32 i = 0; i < width; i++)
-        {
-            p[0] = oldData[2];
-            p[1] = oldData[1];
-            p[2] = oldData[0];
-            p[3] = oldData[3];
-            oldData += 4; 
-            p += 4;
-        }
-    }
+    SwapRedBlue8(input.Data(), newData, width * height);
 
     output.Set(width, height, GL_RGBA, GL_UNSIGNED_BYTE, input.DataSize(), newData, false, true);
     return true;
@@ -364,16 +352,7 @@ bool ConvertToRGB8(const Image &input, Image &output)
     
     if (format == GL_LUMINANCE && type == GL_UNSIGNED_BYTE)
     {
-        for (UInt32 j = 0; j < height; ++j)
-        {
-            for (UInt32 i = 0; i < width; ++i)
-            {
-                *(op++) = *ip;
-                *(op++) = *ip;
-                *(op++) = *ip;
-                ip++;
-            }
-        }
+        GrayToRGB8(ip, op, width * height);
         output.Set(width, height, GL_RGB, GL_UNSIGNED_BYTE, outputSize, outputData, false, true);
         return true;
     }
@@ -383,6 +362,18 @@ bool ConvertToRGB8(const Image &input, Image &output)
         output.Set(width, height, GL_RGB, GL_UNSIGNED_BYTE, outputSize, outputData, false, true);
         return true;
     }
+    else if (format == GL_RGBA && type == GL_UNSIGNED_BYTE)
+    {
+        RGBA8ToRGB8(ip, op, width * height);
+        output.Set(width, height, GL_RGB, GL_UNSIGNED_BYTE, outputSize, outputData, false, true);
+        return true;
+    }
+    else if (format == GL_RGB && type == GL_UNSIGNED_SHORT_5_6_5)
+    {
+        RGB565ToRGB8((const UInt16 *)ip, op, width * height);
+        output.Set(width, height, GL_RGB, GL_UNSIGNED_BYTE, outputSize, outputData, false, true);
+        return true;
+    }
     else
     {
         delete []outputData;
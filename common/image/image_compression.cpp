@@ -1,3 +1,7 @@
+#include <atomic>
+#include <cstdio>
+#include <unistd.h>
+
 #include "image_compression.hpp"
 #include "image.hpp"
 
@@ -106,6 +110,14 @@ bool CanCompressAs(UInt32 format, UInt32 type, const std::string &option)
     }
 }
 
+std::string TemporaryImagePath()
+{
+    static std::atomic<UInt32> counter(0);
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "/tmp/texture_%d_%u", (int)getpid(), (unsigned int)counter++);
+    return buffer;
+}
+
 bool IsImageCompression(UInt32 format)
 {
     return IsETC1Compression(format) ||
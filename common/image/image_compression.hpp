@@ -41,6 +41,9 @@ bool IsValidCompressionOption(const std::string &option);
 bool CheckCompressionOptionSupport(const std::string &option);
 
 bool CanCompressAs(UInt32 format, UInt32 type, const std::string &option);
+// Path without extension under /tmp for the files that images are handed to the external tools
+// in, unique to each call so that several images can be compressed at the same time
+std::string TemporaryImagePath();
 bool Uncompress(const Image &input, Image &output);
 bool Compress(const Image &input, Image &output, const std::string &option);
 
@@ -63,8 +66,8 @@ bool CanCompressAsETC1(UInt32 format, UInt32 type);
 bool CanCompressAsETC2(UInt32 format, UInt32 type);
 
 bool CompressAsETC1(const Image &input, Image &output);
-// Uncompress to GL_RGB & GL_UNSIGNED_BYTE
-bool UncompressFromETC1(const Image &input, Image &output);
+// Uncompress to GL_RGB & GL_UNSIGNED_BYTE, large images on several threads; 0 threads means one per core
+bool UncompressFromETC1(const Image &input, Image &output, unsigned int threads = 0);
 
 // only support alpha depth to be 1 or 8
 bool CompressAsETC2(const Image &input, Image &output, UInt32 alphaDepth);
@@ -82,6 +85,12 @@ bool IsASTCCompression(UInt32 format);
 // whether this format & type combination is supported
 bool CanCompressAsASTC(UInt32 format, UInt32 type);
 
+// Encoder preset passed to astcenc: veryfast, fast, medium, thorough (the default) or exhaustive
+bool SetASTCQuality(const std::string &preset);
+// Number of threads astcenc encodes the blocks of each image on, 0 to leave it to astcenc.
+// Set both before compressing, they are not meant to change while images are compressed.
+void SetASTCThreads(UInt32 threads);
+
 bool CompressAsASTC(const Image &input, Image &output, UInt8 bx, UInt8 by);
 bool UncompressFromASTC(const Image &input, Image &output);
 
@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
@@ -9,9 +10,22 @@
 namespace
 {
 
-const char *DEFAULT_KTX_FILENAME = "/tmp/texture.ktx";
-const char *DEFAULT_ASTC_FILENAME = "/tmp/texture.astc";
-    
+const char *QUALITY_PRESETS[] = { "veryfast", "fast", "medium", "thorough", "exhaustive" };
+
+std::string quality = "thorough";
+UInt32 encoderThreads = 0;
+
+// The astcenc options for the preset and the number of threads
+std::string EncoderOptions()
+{
+    std::string options = "-" + quality;
+    if (encoderThreads > 0)
+    {
+        options += " -j " + std::to_string(encoderThreads);
+    }
+    return options;
+}
+
 }
 
 namespace pat
@@ -19,6 +33,25 @@ namespace pat
 
 const char *ASTC_COMPRESSION_TOOL = "astcenc";
 
+bool SetASTCQuality(const std::string &preset)
+{
+    for (const char *name : QUALITY_PRESETS)
+    {
+        if (preset == name)
+        {
+            quality = preset;
+            return true;
+        }
+    }
+    PAT_DEBUG_LOG("Unknown ASTC quality preset : %s\n", preset.c_str());
+    return false;
+}
+
+void SetASTCThreads(UInt32 threads)
+{
+    encoderThreads = threads;
+}
+
 bool SupportASTCCompression()
 {
     //std::string path;
@@ -69,23 +102,30 @@ bool CompressAsASTC(const Image &input, Image &output, UInt8 bx, UInt8 by)
         return true;
     }
 
-    if (WriteKTX(input, DEFAULT_KTX_FILENAME, false) == false)
+    const std::string path = TemporaryImagePath();
+    const std::string ktxFilename = path + ".ktx";
+    const std::string astcFilename = path + ".astc";
+    if (WriteKTX(input, ktxFilename.c_str(), false) == false)
     {
-        PAT_DEBUG_LOG("Failed to write to file : %s\n", DEFAULT_KTX_FILENAME);
+        PAT_DEBUG_LOG("Failed to write to file : %s\n", ktxFilename.c_str());
         return false;
     }
 
     char buffer[512];
-    sprintf(buffer, "%s -c %s %s %dx%d -thorough -silentmode", ASTC_COMPRESSION_TOOL, DEFAULT_KTX_FILENAME, DEFAULT_ASTC_FILENAME, bx, by);
-    if (system(buffer) == -1)
+    sprintf(buffer, "%s -c %s %s %dx%d %s -silentmode", ASTC_COMPRESSION_TOOL, ktxFilename.c_str(), astcFilename.c_str(), bx, by, EncoderOptions().c_str());
+    const bool converted = system(buffer) != -1;
+    remove(ktxFilename.c_str());
+    if (!converted)
     {
         PAT_DEBUG_LOG("Failed to convert image. Is the ASTC Evaluation Codec (astcenc) under your $PATH? If not, please download it from www.malideveloper.com.\n");
         return false;
     }
 
-    if (ReadASTC(output, DEFAULT_ASTC_FILENAME) == false)
+    const bool read = ReadASTC(output, astcFilename.c_str());
+    remove(astcFilename.c_str());
+    if (read == false)
     {
-        PAT_DEBUG_LOG("Failed to read from file : %s\n", DEFAULT_ASTC_FILENAME);
+        PAT_DEBUG_LOG("Failed to read from file : %s\n", astcFilename.c_str());
         return false;
     }
 
@@ -107,23 +147,30 @@ bool UncompressFromASTC(const Image &input, Image &output)
         return true;
     }
 
-    if (WriteASTC(input, DEFAULT_ASTC_FILENAME, false) == false)
+    const std::string path = TemporaryImagePath();
+    const std::string ktxFilename = path + ".ktx";
+    const std::string astcFilename = path + ".astc";
+    if (WriteASTC(input, astcFilename.c_str(), false) == false)
     {
-        PAT_DEBUG_LOG("Failed to write to file : %s\n", DEFAULT_ASTC_FILENAME);
+        PAT_DEBUG_LOG("Failed to write to file : %s\n", astcFilename.c_str());
         return false;
     }
 
     char buffer[512];
-    sprintf(buffer, "%s -ds %s %s -thorough -silentmode", ASTC_COMPRESSION_TOOL, DEFAULT_ASTC_FILENAME, DEFAULT_KTX_FILENAME);
-    if (system(buffer) == -1)
+    sprintf(buffer, "%s -ds %s %s -thorough -silentmode", ASTC_COMPRESSION_TOOL, astcFilename.c_str(), ktxFilename.c_str());
+    const bool converted = system(buffer) != -1;
+    remove(astcFilename.c_str());
+    if (!converted)
     {
         PAT_DEBUG_LOG("Failed to convert image. Is the ASTC Evaluation Codec (astcenc) under your $PATH? If not, please download it from www.malideveloper.com.\n");
         return false;
     }
 
-    if (ReadKTX(output, DEFAULT_KTX_FILENAME) == false)
+    const bool read = ReadKTX(output, ktxFilename.c_str());
+    remove(ktxFilename.c_str());
+    if (read == false)
     {
-        PAT_DEBUG_LOG("Failed to read from file : %s\n", DEFAULT_KTX_FILENAME);
+        PAT_DEBUG_LOG("Failed to read from file : %s\n", ktxFilename.c_str());
         return false;
     }
 
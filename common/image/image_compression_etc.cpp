@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
+#include <thread>
+#include <vector>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
@@ -7,6 +11,12 @@
 #include "image_compression.hpp"
 #include "system/environment_variable.hpp"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 namespace
 {
 
@@ -25,34 +35,6 @@ const unsigned char ModifierIndexTable[] = {
     2, 3, 1, 0,
 };
 
-const unsigned char PixelXOffset[] = {
-    0, 0, 0, 0,
-    1, 1, 1, 1,
-    2, 2, 2, 2,
-    3, 3, 3, 3,
-};
-
-const unsigned char PixelYOffset[] = {
-    0, 1, 2, 3,
-    0, 1, 2, 3,
-    0, 1, 2, 3,
-    0, 1, 2, 3,
-};
-
-const unsigned char FlipTable1[] = {
-    0, 0, 0, 0,
-    0, 0, 0, 0,
-    1, 1, 1, 1,
-    1, 1, 1, 1,
-};
-
-const unsigned char FlipTable2[] = {
-    0, 0, 1, 1,
-    0, 0, 1, 1,
-    0, 0, 1, 1,
-    0, 0, 1, 1,
-};
-
 // Convert 3-bit two-complement number to signed byte
 char ToSignedGLubyte(unsigned char input)
 {
@@ -72,9 +54,9 @@ unsigned char Extend4to8Bits(unsigned char input)
     return (input << 4) + input;
 }
 
-unsigned char Clamp(unsigned char a, int b)
+#if !defined(__SSE2__) && !defined(__ARM_NEON)
+unsigned char Clamp(int c)
 {
-    int c = a + b;
     if (c < 0)
         return 0;
     else if (c > 0xFF)
@@ -82,25 +64,12 @@ unsigned char Clamp(unsigned char a, int b)
     else
         return static_cast<unsigned char>(c);
 }
+#endif
 
-void SetPixel(unsigned char *dest, unsigned char r, unsigned char g, unsigned char b, int modifier, int x, int y, int width, int height)
+// The four colours that the pixels of each half of a block can take, as RGBX
+void DecodePalette(const unsigned char *buffer, unsigned char palette[2][16])
 {
-    if (x >= width || y >= height)
-        return;
-
-    dest += (width * y + x) * 3;
-    dest[0] = Clamp(r, modifier);
-    dest[1] = Clamp(g, modifier);
-    dest[2] = Clamp(b, modifier);
-}
-
-void DecodeBlock(const unsigned char *src, unsigned char *dest, int x, int y, int width, int height)
-{
-    unsigned char buffer[8];
-    memcpy(buffer, src, sizeof(unsigned char) * 8);
-
     const bool diffbit = buffer[3] & 0x02;
-    const bool flipbit = buffer[3] & 0x01;
 
     unsigned char R[2], G[2], B[2];
     if (diffbit)
@@ -128,48 +97,104 @@ void DecodeBlock(const unsigned char *src, unsigned char *dest, int x, int y, in
         const unsigned char _G1 = (buffer[1] & 0xF0) >> 4;
         const unsigned char _G2 = buffer[1] & 0x0F;
         const unsigned char _B1 = (buffer[2] & 0xF0) >> 4;
-        const unsigned char _B2 = buffer[2] & 0x0F; 
+        const unsigned char _B2 = buffer[2] & 0x0F;
         R[0] = Extend4to8Bits(_R1);
         R[1] = Extend4to8Bits(_R2);
         G[0] = Extend4to8Bits(_G1);
         G[1] = Extend4to8Bits(_G2);
         B[0] = Extend4to8Bits(_B1);
-        B[1] = Extend4to8Bits(_B2);       
+        B[1] = Extend4to8Bits(_B2);
     }
 
-    unsigned char codeWord1 = buffer[3] >> 5;
-    unsigned char codeWord2 = (buffer[3] & 0x1C) >> 2;
-    const int *modifierTable1 = ModifierTable + 4 * codeWord1;
-    const int *modifierTable2 = ModifierTable + 4 * codeWord2;
-
-    x = x << 2;
-    y = y << 2;
-
-    for (int i = 0; i < 16; ++i)
+    const unsigned char codeWords[2] = { (unsigned char)(buffer[3] >> 5), (unsigned char)((buffer[3] & 0x1C) >> 2) };
+    for (int part = 0; part < 2; ++part)
     {
-        unsigned char index = 0;
-        if (i < 8)
+        const int *modifiers = ModifierTable + 4 * codeWords[part];
+#if defined(__SSE2__)
+        // base + modifier for two colours per register, saturated to 0..255 by the pack
+        const __m128i base = _mm_setr_epi16(R[part], G[part], B[part], 0, R[part], G[part], B[part], 0);
+        const __m128i mod01 = _mm_setr_epi16(modifiers[0], modifiers[0], modifiers[0], 0, modifiers[1], modifiers[1], modifiers[1], 0);
+        const __m128i mod23 = _mm_setr_epi16(modifiers[2], modifiers[2], modifiers[2], 0, modifiers[3], modifiers[3], modifiers[3], 0);
+        _mm_storeu_si128((__m128i *)palette[part], _mm_packus_epi16(_mm_add_epi16(base, mod01), _mm_add_epi16(base, mod23)));
+#elif defined(__ARM_NEON)
+        const int16_t baseLanes[8] = { R[part], G[part], B[part], 0, R[part], G[part], B[part], 0 };
+        const int16_t mod01Lanes[8] = { (int16_t)modifiers[0], (int16_t)modifiers[0], (int16_t)modifiers[0], 0, (int16_t)modifiers[1], (int16_t)modifiers[1], (int16_t)modifiers[1], 0 };
+        const int16_t mod23Lanes[8] = { (int16_t)modifiers[2], (int16_t)modifiers[2], (int16_t)modifiers[2], 0, (int16_t)modifiers[3], (int16_t)modifiers[3], (int16_t)modifiers[3], 0 };
+        const int16x8_t base = vld1q_s16(baseLanes);
+        vst1_u8(palette[part], vqmovun_s16(vaddq_s16(base, vld1q_s16(mod01Lanes))));
+        vst1_u8(palette[part] + 8, vqmovun_s16(vaddq_s16(base, vld1q_s16(mod23Lanes))));
+#else
+        for (int i = 0; i < 4; ++i)
         {
-            index = ((buffer[5] >> i) & 0x01) << 1;
-            index += ((buffer[7] >> i) & 0x01);
+            palette[part][i * 4 + 0] = Clamp(R[part] + modifiers[i]);
+            palette[part][i * 4 + 1] = Clamp(G[part] + modifiers[i]);
+            palette[part][i * 4 + 2] = Clamp(B[part] + modifiers[i]);
+            palette[part][i * 4 + 3] = 0;
         }
-        else
+#endif
+    }
+}
+
+// Decode the 4x4 pixels of a block to RGB rows that are stride bytes apart
+void DecodeBlock(const unsigned char *src, unsigned char *dest, size_t stride)
+{
+    unsigned char palette[2][16];
+    DecodePalette(src, palette);
+
+    const bool flipbit = src[3] & 0x01;
+    // bit i of these is the most and least significant bit of the index of pixel i, which
+    // is at x = i / 4 and y = i % 4
+    const unsigned int msb = (src[4] << 8) | src[5];
+    const unsigned int lsb = (src[6] << 8) | src[7];
+    for (int y = 0; y < 4; ++y)
+    {
+        unsigned char *row = dest + stride * y;
+        for (int x = 0; x < 4; ++x)
         {
-            index = ((buffer[4] >> (i - 8)) & 0x01) << 1;
-            index += ((buffer[6] >> (i - 8)) & 0x01);
+            const int i = x * 4 + y;
+            const unsigned char index = ModifierIndexTable[(((msb >> i) & 0x01) << 1) | ((lsb >> i) & 0x01)];
+            const int partIndex = (!flipbit) ? (x >> 1) : (y >> 1);
+            memcpy(row + x * 3, palette[partIndex] + index * 4, 3);
         }
+    }
+}
 
-        index = ModifierIndexTable[index];
-        const unsigned char partIndex = (!flipbit) ? FlipTable1[i] : FlipTable2[i];
-        const int modifier = (partIndex == 0) ? modifierTable1[index] :
-            modifierTable2[index];
-
-        SetPixel(dest, R[partIndex], G[partIndex], B[partIndex],
-                 modifier, x + PixelXOffset[i],
-                 y + PixelYOffset[i], width, height);
+// Decode the block rows from firstRow up to lastRow. Blocks that lie wholly inside the image are
+// decoded straight into it, those on the right and bottom edges through a buffer of their own.
+void DecodeBlockRows(const unsigned char *srcData, unsigned char *destData, unsigned int width, unsigned int height,
+                     unsigned int firstRow, unsigned int lastRow)
+{
+    const unsigned int blockCountX = (width + 3) / 4;
+    const size_t stride = width * 3;
+    srcData += (size_t)firstRow * blockCountX * 8;
+    for (unsigned int j = firstRow; j < lastRow; ++j)
+    {
+        const unsigned int rows = std::min(4u, height - j * 4);
+        for (unsigned int i = 0; i < blockCountX; ++i)
+        {
+            unsigned char *dest = destData + stride * j * 4 + i * 12;
+            const unsigned int columns = std::min(4u, width - i * 4);
+            if (rows == 4 && columns == 4)
+            {
+                DecodeBlock(srcData, dest, stride);
+            }
+            else
+            {
+                unsigned char block[4 * 12];
+                DecodeBlock(srcData, block, 12);
+                for (unsigned int y = 0; y < rows; ++y)
+                {
+                    memcpy(dest + stride * y, block + 12 * y, columns * 3);
+                }
+            }
+            srcData += 8;
+        }
     }
 }
 
+// Fewest blocks to give each decoding thread, 256x256 pixels
+const unsigned int ETC1_BLOCKS_PER_THREAD = 64 * 64;
+
 } // unnamed namespace
 
 namespace pat
@@ -218,7 +243,7 @@ bool CanCompressAsETC2(UInt32 format, UInt32 type)
         type == GL_UNSIGNED_BYTE;
 }
 
-bool UncompressFromETC1(const Image &input, Image &output)
+bool UncompressFromETC1(const Image &input, Image &output, unsigned int threads)
 {
     const UInt32 format = input.Format();
     PAT_DEBUG_ASSERT(IsETC1Compression(format), "Unexpected format for ETC1 uncompress : %d\n", format);
@@ -227,8 +252,8 @@ bool UncompressFromETC1(const Image &input, Image &output)
 
     const unsigned int width = input.Width();
     const unsigned int height = input.Height();
-    const int blockCountX = (width + 3) / 4;
-    const int blockCountY = (height + 3) / 4;
+    const unsigned int blockCountX = (width + 3) / 4;
+    const unsigned int blockCountY = (height + 3) / 4;
     const unsigned char *srcData = input.Data();
     unsigned int destSize = 0;
     unsigned char *destData = NULL;
@@ -236,12 +261,29 @@ bool UncompressFromETC1(const Image &input, Image &output)
     {
         destSize = width * height * 3;
         destData = new unsigned char[destSize];
-        for (int j = 0; j < blockCountY; ++j)
+        // Large images are decoded by several threads, each taking a range of block rows. Small
+        // ones are not worth starting a thread for.
+        if (threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threads = std::min<unsigned int>(threads, (unsigned int)blockCountX * blockCountY / ETC1_BLOCKS_PER_THREAD);
+        if (threads <= 1)
         {
-            for (int i = 0; i < blockCountX; ++i)
+            DecodeBlockRows(srcData, destData, width, height, 0, blockCountY);
+        }
+        else
+        {
+            std::vector<std::thread> workers;
+            for (unsigned int t = 0; t < threads; ++t)
+            {
+                const unsigned int firstRow = blockCountY * t / threads;
+                const unsigned int lastRow = blockCountY * (t + 1) / threads;
+                workers.push_back(std::thread(DecodeBlockRows, srcData, destData, width, height, firstRow, lastRow));
+            }
+            for (std::thread &worker : workers)
             {
-                DecodeBlock(srcData, destData, i, j, width, height); 
-                srcData += 8;
+                worker.join();
             }
         }
     }
@@ -268,27 +310,33 @@ bool CompressAsETC1(const Image &input, Image &output)
         return true;
     }
 
-    const char *DEFAULT_PPM_FILENAME = "/tmp/texture.ppm";
+    // etcpack names the KTX file after the input, in the given directory
+    const std::string path = TemporaryImagePath();
+    const std::string ppmFilename = path + ".ppm";
+    const std::string ktxFilename = path + ".ktx";
     const char *DEFAULT_KTX_DIRNAME = "/tmp";
-    const char *DEFAULT_KTX_FILENAME = "/tmp/texture.ktx";
 
-    if (WritePNM(input, DEFAULT_PPM_FILENAME, false) == false)
+    if (WritePNM(input, ppmFilename.c_str(), false) == false)
     {
-        PAT_DEBUG_LOG("Failed to write to file : %s\n", DEFAULT_PPM_FILENAME);
+        PAT_DEBUG_LOG("Failed to write to file : %s\n", ppmFilename.c_str());
         return false;
     }
 
     char buffer[512];
-    sprintf(buffer, "%s %s %s -c etc1 -ktx -quiet", ETC_COMPRESSION_TOOL, DEFAULT_PPM_FILENAME, DEFAULT_KTX_DIRNAME);
-    if (system(buffer) == -1)
+    sprintf(buffer, "%s %s %s -c etc1 -ktx -quiet", ETC_COMPRESSION_TOOL, ppmFilename.c_str(), DEFAULT_KTX_DIRNAME);
+    const bool converted = system(buffer) != -1;
+    remove(ppmFilename.c_str());
+    if (!converted)
     {
         PAT_DEBUG_LOG("Failed to convert image. Is the ASTC Evaluation Codec (astcenc) under your $PATH? If not, please download it from www.malideveloper.com.\n");
         return false;
     }
 
-    if (ReadKTX(output, DEFAULT_KTX_FILENAME) == false)
+    const bool read = ReadKTX(output, ktxFilename.c_str());
+    remove(ktxFilename.c_str());
+    if (read == false)
     {
-        PAT_DEBUG_LOG("Failed to read from file : %s\n", DEFAULT_KTX_FILENAME);
+        PAT_DEBUG_LOG("Failed to read from file : %s\n", ktxFilename.c_str());
         return false;
     }
 
@@ -340,27 +388,32 @@ bool CompressAsETC2(const Image &input, Image &output, UInt32 alphaDepth)
         return true;
     }
 
-    const char *DEFAULT_PNG_FILENAME = "/tmp/texture.png";
+    const std::string path = TemporaryImagePath();
+    const std::string pngFilename = path + ".png";
+    const std::string ktxFilename = path + ".ktx";
     const char *DEFAULT_KTX_DIRNAME = "/tmp";
-    const char *DEFAULT_KTX_FILENAME = "/tmp/texture.ktx";
 
-    if (WritePNG(input, DEFAULT_PNG_FILENAME, false) == false)
+    if (WritePNG(input, pngFilename.c_str(), false) == false)
     {
-        PAT_DEBUG_LOG("Failed to write to file : %s\n", DEFAULT_PNG_FILENAME);
+        PAT_DEBUG_LOG("Failed to write to file : %s\n", pngFilename.c_str());
         return false;
     }
 
     char buffer[512];
-    sprintf(buffer, "%s %s %s -c etc2 -ktx -quiet -f %s", ETC_COMPRESSION_TOOL, DEFAULT_PNG_FILENAME, DEFAULT_KTX_DIRNAME, formatOption);
-    if (system(buffer) == -1)
+    sprintf(buffer, "%s %s %s -c etc2 -ktx -quiet -f %s", ETC_COMPRESSION_TOOL, pngFilename.c_str(), DEFAULT_KTX_DIRNAME, formatOption);
+    const bool converted = system(buffer) != -1;
+    remove(pngFilename.c_str());
+    if (!converted)
     {
         PAT_DEBUG_LOG("Failed to convert image. Is the ASTC Evaluation Codec (astcenc) under your $PATH? If not, please download it from www.malideveloper.com.\n");
         return false;
     }
 
-    if (ReadKTX(output, DEFAULT_KTX_FILENAME) == false)
+    const bool read = ReadKTX(output, ktxFilename.c_str());
+    remove(ktxFilename.c_str());
+    if (read == false)
     {
-        PAT_DEBUG_LOG("Failed to read from file : %s\n", DEFAULT_KTX_FILENAME);
+        PAT_DEBUG_LOG("Failed to read from file : %s\n", ktxFilename.c_str());
         return false;
     }
 
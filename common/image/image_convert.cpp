@@ -0,0 +1,646 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "image.hpp"
+#include "image_convert.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+using namespace pat;
+
+// Half floats are converted to floats in blocks of this many before they are normalized
+const UInt32 HALF_BLOCK = 256;
+
+// 2^112, which rebiases the exponent of a half shifted into place in a float
+const UInt32 HALF_MAGIC = (254 - 15) << 23;
+const UInt32 HALF_INF_NAN = 0x7bff; // largest finite half, without its sign
+const UInt32 FLOAT_INF_NAN = 255 << 23;
+
+inline UInt8 Widen5(UInt32 v) { return (v << 3) | (v >> 2); }
+inline UInt8 Widen6(UInt32 v) { return (v << 2) | (v >> 4); }
+inline UInt8 Widen4(UInt32 v) { return v * 17; }
+
+inline float FromBits(UInt32 bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline UInt32 ToBits(float f)
+{
+    UInt32 bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+inline float Half(UInt16 h)
+{
+    const UInt32 expmant = h & 0x7fff;
+    const UInt32 sign = (h ^ expmant) << 16;
+    const float scaled = FromBits(expmant << 13) * FromBits(HALF_MAGIC);
+    return FromBits(ToBits(scaled) | sign | (expmant > HALF_INF_NAN ? FLOAT_INF_NAN : 0));
+}
+
+inline UInt8 UNorm8(float f)
+{
+    // written so that NaN fails the first test, as in the SIMD paths
+    f = f > 0.0f ? f : 0.0f;
+    f = f < 1.0f ? f : 1.0f;
+    return (UInt8)(int)(f * 255.0f + 0.5f);
+}
+
+struct SRGBTables
+{
+    SRGBTables()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            const double c = i / 255.0;
+            const double linear = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+            const double srgb = c <= 0.0031308 ? c * 12.92 : 1.055 * std::pow(c, 1 / 2.4) - 0.055;
+            toLinear[i] = (UInt8)(linear * 255.0 + 0.5);
+            toSRGB[i] = (UInt8)(srgb * 255.0 + 0.5);
+        }
+    }
+
+    UInt8 toLinear[256];
+    UInt8 toSRGB[256];
+};
+
+const SRGBTables &GetSRGBTables()
+{
+    static const SRGBTables tables;
+    return tables;
+}
+
+void LookUp(const UInt8 *table, const UInt8 *src, UInt8 *dst, UInt32 count, bool withAlpha)
+{
+    if (!withAlpha)
+    {
+        for (UInt32 i = 0; i < count; ++i)
+            dst[i] = table[src[i]];
+        return;
+    }
+    UInt32 i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        dst[i] = table[src[i]];
+        dst[i + 1] = table[src[i + 1]];
+        dst[i + 2] = table[src[i + 2]];
+        dst[i + 3] = src[i + 3];
+    }
+    for (; i < count; ++i)
+        dst[i] = table[src[i]];
+}
+
+#if defined(__SSE2__)
+
+// Store the low three bytes of each 32 bit lane as 12 bytes, writing two bytes past them
+inline void StoreRGB(__m128i rgbx, UInt8 *dst)
+{
+    const __m128i even = _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff);
+    const __m128i odd = _mm_set_epi32(0x00ffffff, 0, 0x00ffffff, 0);
+    const __m128i packed = _mm_or_si128(_mm_and_si128(rgbx, even), _mm_srli_epi64(_mm_and_si128(rgbx, odd), 8));
+    _mm_storel_epi64((__m128i *)dst, packed);
+    _mm_storel_epi64((__m128i *)(dst + 6), _mm_srli_si128(packed, 8));
+}
+
+// Bytes of 16 bit lanes lo | hi << 8, interleaved with those of 16 bit lanes lo2 | hi2 << 8,
+// as the four bytes of eight pixels
+inline void StorePixels(__m128i lohi, __m128i lohi2, UInt8 *dst)
+{
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(lohi, lohi2));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(lohi, lohi2));
+}
+
+inline __m128i Widen5(__m128i v) { return _mm_or_si128(_mm_slli_epi16(v, 3), _mm_srli_epi16(v, 2)); }
+inline __m128i Widen6(__m128i v) { return _mm_or_si128(_mm_slli_epi16(v, 2), _mm_srli_epi16(v, 4)); }
+
+inline __m128 Half(__m128i h)
+{
+    const __m128i expmant = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+    const __m128i sign = _mm_slli_epi32(_mm_xor_si128(h, expmant), 16);
+    const __m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expmant, 13)), _mm_castsi128_ps(_mm_set1_epi32(HALF_MAGIC)));
+    const __m128i infNan = _mm_and_si128(_mm_cmpgt_epi32(expmant, _mm_set1_epi32(HALF_INF_NAN)), _mm_set1_epi32(FLOAT_INF_NAN));
+    return _mm_or_ps(scaled, _mm_castsi128_ps(_mm_or_si128(sign, infNan)));
+}
+
+inline __m128i UNorm8(__m128 f)
+{
+    // max returns its second operand when the first is NaN
+    f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+}
+
+#elif defined(__ARM_NEON)
+
+inline uint16x8_t Widen5(uint16x8_t v) { return vorrq_u16(vshlq_n_u16(v, 3), vshrq_n_u16(v, 2)); }
+inline uint16x8_t Widen6(uint16x8_t v) { return vorrq_u16(vshlq_n_u16(v, 2), vshrq_n_u16(v, 4)); }
+
+inline float32x4_t Half(uint32x4_t h)
+{
+    const uint32x4_t expmant = vandq_u32(h, vdupq_n_u32(0x7fff));
+    const uint32x4_t sign = vshlq_n_u32(veorq_u32(h, expmant), 16);
+    const float32x4_t scaled = vmulq_f32(vreinterpretq_f32_u32(vshlq_n_u32(expmant, 13)), vreinterpretq_f32_u32(vdupq_n_u32(HALF_MAGIC)));
+    const uint32x4_t infNan = vandq_u32(vcgtq_u32(expmant, vdupq_n_u32(HALF_INF_NAN)), vdupq_n_u32(FLOAT_INF_NAN));
+    return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(scaled), vorrq_u32(sign, infNan)));
+}
+
+inline uint32x4_t UNorm8(float32x4_t f)
+{
+    // select rather than max, as NaN would come through vmaxq
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    f = vbslq_f32(vcgtq_f32(f, zero), f, zero);
+    f = vminq_f32(f, vdupq_n_f32(1.0f));
+    return vcvtq_u32_f32(vaddq_f32(vmulq_f32(f, vdupq_n_f32(255.0f)), vdupq_n_f32(0.5f)));
+}
+
+#endif
+
+// Output channels of ConvertToUByte for a format, 0 if it is not handled
+UInt32 OutputChannels(UInt32 format)
+{
+    switch (format)
+    {
+    case GL_ALPHA:
+    case GL_LUMINANCE:
+    case GL_DEPTH_COMPONENT:
+    case GL_DEPTH_STENCIL_OES:
+        return 1;
+    case GL_LUMINANCE_ALPHA:
+        return 2;
+    case GL_RGB:
+        return 3;
+    case GL_RGBA:
+    case GL_BGRA_EXT:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+UInt32 OutputFormat(UInt32 format)
+{
+    switch (format)
+    {
+    case GL_DEPTH_COMPONENT:
+    case GL_DEPTH_STENCIL_OES:
+        return GL_LUMINANCE;
+    case GL_BGRA_EXT:
+        return GL_RGBA;
+    default:
+        return format;
+    }
+}
+
+// Convert one row of width pixels
+void ConvertRow(UInt32 format, UInt32 type, const UInt8 *src, UInt8 *dst, UInt32 width)
+{
+    const UInt32 channels = OutputChannels(format);
+    const bool depth = format == GL_DEPTH_COMPONENT || format == GL_DEPTH_STENCIL_OES;
+    switch (type)
+    {
+    case GL_UNSIGNED_BYTE:
+        if (format == GL_BGRA_EXT)
+            SwapRedBlue8(src, dst, width);
+        else
+            memcpy(dst, src, width * channels);
+        break;
+    case GL_UNSIGNED_SHORT_5_6_5:
+        RGB565ToRGB8((const UInt16 *)src, dst, width);
+        break;
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+        RGBA4444ToRGBA8((const UInt16 *)src, dst, width);
+        break;
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+        RGBA5551ToRGBA8((const UInt16 *)src, dst, width);
+        break;
+    case GL_HALF_FLOAT:
+    case GL_HALF_FLOAT_OES:
+        HalfToUNorm8((const UInt16 *)src, dst, width * channels);
+        break;
+    case GL_FLOAT:
+        FloatToUNorm8((const float *)src, dst, width * channels);
+        break;
+    case GL_UNSIGNED_SHORT:
+        if (depth)
+            Depth16ToGray8((const UInt16 *)src, dst, width);
+        break;
+    case GL_UNSIGNED_INT:
+    case GL_UNSIGNED_INT_24_8_OES:
+        if (depth)
+            Depth32ToGray8((const UInt32 *)src, dst, width);
+        break;
+    }
+}
+
+} // unnamed namespace
+
+namespace pat
+{
+
+void RGB565ToRGB8(const UInt16 *src, UInt8 *dst, UInt32 count)
+{
+    UInt32 i = 0;
+#if defined(__SSE2__)
+    const __m128i mask5 = _mm_set1_epi16(0x1f), mask6 = _mm_set1_epi16(0x3f);
+    // one pixel more than converted, for the bytes StoreRGB writes past the end
+    for (; i + 8 < count; i += 8)
+    {
+        const __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+        const __m128i r = Widen5(_mm_srli_epi16(p, 11));
+        const __m128i g = Widen6(_mm_and_si128(_mm_srli_epi16(p, 5), mask6));
+        const __m128i b = Widen5(_mm_and_si128(p, mask5));
+        const __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        StoreRGB(_mm_unpacklo_epi16(rg, b), dst + i * 3);
+        StoreRGB(_mm_unpackhi_epi16(rg, b), dst + i * 3 + 12);
+    }
+#elif defined(__ARM_NEON)
+    const uint16x8_t mask5 = vdupq_n_u16(0x1f), mask6 = vdupq_n_u16(0x3f);
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint16x8_t p = vld1q_u16(src + i);
+        uint8x8x3_t rgb;
+        rgb.val[0] = vmovn_u16(Widen5(vshrq_n_u16(p, 11)));
+        rgb.val[1] = vmovn_u16(Widen6(vandq_u16(vshrq_n_u16(p, 5), mask6)));
+        rgb.val[2] = vmovn_u16(Widen5(vandq_u16(p, mask5)));
+        vst3_u8(dst + i * 3, rgb);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        const UInt32 p = src[i];
+        dst[i * 3] = Widen5(p >> 11);
+        dst[i * 3 + 1] = Widen6((p >> 5) & 0x3f);
+        dst[i * 3 + 2] = Widen5(p & 0x1f);
+    }
+}
+
+void RGBA4444ToRGBA8(const UInt16 *src, UInt8 *dst, UInt32 count)
+{
+    UInt32 i = 0;
+#if defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi16(0xf), seventeen = _mm_set1_epi16(17);
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+        const __m128i r = _mm_mullo_epi16(_mm_srli_epi16(p, 12), seventeen);
+        const __m128i g = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(p, 8), mask), seventeen);
+        const __m128i b = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(p, 4), mask), seventeen);
+        const __m128i a = _mm_mullo_epi16(_mm_and_si128(p, mask), seventeen);
+        StorePixels(_mm_or_si128(r, _mm_slli_epi16(g, 8)), _mm_or_si128(b, _mm_slli_epi16(a, 8)), dst + i * 4);
+    }
+#elif defined(__ARM_NEON)
+    const uint16x8_t mask = vdupq_n_u16(0xf);
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint16x8_t p = vld1q_u16(src + i);
+        uint8x8x4_t rgba;
+        rgba.val[0] = vmovn_u16(vmulq_n_u16(vshrq_n_u16(p, 12), 17));
+        rgba.val[1] = vmovn_u16(vmulq_n_u16(vandq_u16(vshrq_n_u16(p, 8), mask), 17));
+        rgba.val[2] = vmovn_u16(vmulq_n_u16(vandq_u16(vshrq_n_u16(p, 4), mask), 17));
+        rgba.val[3] = vmovn_u16(vmulq_n_u16(vandq_u16(p, mask), 17));
+        vst4_u8(dst + i * 4, rgba);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        const UInt32 p = src[i];
+        dst[i * 4] = Widen4(p >> 12);
+        dst[i * 4 + 1] = Widen4((p >> 8) & 0xf);
+        dst[i * 4 + 2] = Widen4((p >> 4) & 0xf);
+        dst[i * 4 + 3] = Widen4(p & 0xf);
+    }
+}
+
+void RGBA5551ToRGBA8(const UInt16 *src, UInt8 *dst, UInt32 count)
+{
+    UInt32 i = 0;
+#if defined(__SSE2__)
+    const __m128i mask5 = _mm_set1_epi16(0x1f), one = _mm_set1_epi16(1), alpha = _mm_set1_epi16(255);
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+        const __m128i r = Widen5(_mm_srli_epi16(p, 11));
+        const __m128i g = Widen5(_mm_and_si128(_mm_srli_epi16(p, 6), mask5));
+        const __m128i b = Widen5(_mm_and_si128(_mm_srli_epi16(p, 1), mask5));
+        const __m128i a = _mm_mullo_epi16(_mm_and_si128(p, one), alpha);
+        StorePixels(_mm_or_si128(r, _mm_slli_epi16(g, 8)), _mm_or_si128(b, _mm_slli_epi16(a, 8)), dst + i * 4);
+    }
+#elif defined(__ARM_NEON)
+    const uint16x8_t mask5 = vdupq_n_u16(0x1f), one = vdupq_n_u16(1);
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint16x8_t p = vld1q_u16(src + i);
+        uint8x8x4_t rgba;
+        rgba.val[0] = vmovn_u16(Widen5(vshrq_n_u16(p, 11)));
+        rgba.val[1] = vmovn_u16(Widen5(vandq_u16(vshrq_n_u16(p, 6), mask5)));
+        rgba.val[2] = vmovn_u16(Widen5(vandq_u16(vshrq_n_u16(p, 1), mask5)));
+        rgba.val[3] = vmovn_u16(vmulq_n_u16(vandq_u16(p, one), 255));
+        vst4_u8(dst + i * 4, rgba);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        const UInt32 p = src[i];
+        dst[i * 4] = Widen5(p >> 11);
+        dst[i * 4 + 1] = Widen5((p >> 6) & 0x1f);
+        dst[i * 4 + 2] = Widen5((p >> 1) & 0x1f);
+        dst[i * 4 + 3] = (p & 1) * 255;
+    }
+}
+
+void SwapRedBlue8(const UInt8 *src, UInt8 *dst, UInt32 count)
+{
+    UInt32 i = 0;
+#if defined(__SSE2__)
+    const __m128i maskGA = _mm_set1_epi32(0xff00ff00), maskRB = _mm_set1_epi32(0x00ff00ff);
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i p = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        const __m128i rb = _mm_and_si128(p, maskRB);
+        const __m128i br = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_or_si128(_mm_and_si128(p, maskGA), br));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8)
+    {
+        uint8x8x4_t p = vld4_u8(src + i * 4);
+        const uint8x8_t r = p.val[0];
+        p.val[0] = p.val[2];
+        p.val[2] = r;
+        vst4_u8(dst + i * 4, p);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        const UInt8 r = src[i * 4];
+        dst[i * 4] = src[i * 4 + 2];
+        dst[i * 4 + 1] = src[i * 4 + 1];
+        dst[i * 4 + 2] = r;
+        dst[i * 4 + 3] = src[i * 4 + 3];
+    }
+}
+
+void GrayToRGB8(const UInt8 *src, UInt8 *dst, UInt32 count)
+{
+    UInt32 i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 < count; i += 16)
+    {
+        const __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+        const __m128i p16[2] = { _mm_unpacklo_epi8(p, zero), _mm_unpackhi_epi8(p, zero) };
+        for (int h = 0; h < 2; ++h)
+        {
+            const __m128i p32[2] = { _mm_unpacklo_epi16(p16[h], zero), _mm_unpackhi_epi16(p16[h], zero) };
+            for (int q = 0; q < 2; ++q)
+            {
+                const __m128i g = p32[q];
+                const __m128i rgbx = _mm_or_si128(g, _mm_or_si128(_mm_slli_epi32(g, 8), _mm_slli_epi32(g, 16)));
+                StoreRGB(rgbx, dst + (i + h * 8 + q * 4) * 3);
+            }
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= count; i += 16)
+    {
+        const uint8x16_t p = vld1q_u8(src + i);
+        const uint8x16x3_t rgb = { { p, p, p } };
+        vst3q_u8(dst + i * 3, rgb);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        dst[i * 3] = dst[i * 3 + 1] = dst[i * 3 + 2] = src[i];
+    }
+}
+
+void RGBA8ToRGB8(const UInt8 *src, UInt8 *dst, UInt32 count)
+{
+    UInt32 i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 < count; i += 4)
+    {
+        StoreRGB(_mm_loadu_si128((const __m128i *)(src + i * 4)), dst + i * 3);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= count; i += 16)
+    {
+        const uint8x16x4_t p = vld4q_u8(src + i * 4);
+        const uint8x16x3_t rgb = { { p.val[0], p.val[1], p.val[2] } };
+        vst3q_u8(dst + i * 3, rgb);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        dst[i * 3] = src[i * 4];
+        dst[i * 3 + 1] = src[i * 4 + 1];
+        dst[i * 3 + 2] = src[i * 4 + 2];
+    }
+}
+
+void HalfToFloat(const UInt16 *src, float *dst, UInt32 count)
+{
+    UInt32 i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i h = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_ps(dst + i, Half(_mm_unpacklo_epi16(h, zero)));
+        _mm_storeu_ps(dst + i + 4, Half(_mm_unpackhi_epi16(h, zero)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint16x8_t h = vld1q_u16(src + i);
+        vst1q_f32(dst + i, Half(vmovl_u16(vget_low_u16(h))));
+        vst1q_f32(dst + i + 4, Half(vmovl_u16(vget_high_u16(h))));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        dst[i] = Half(src[i]);
+    }
+}
+
+void FloatToUNorm8(const float *src, UInt8 *dst, UInt32 count)
+{
+    UInt32 i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i lo = _mm_packs_epi32(UNorm8(_mm_loadu_ps(src + i)), UNorm8(_mm_loadu_ps(src + i + 4)));
+        const __m128i hi = _mm_packs_epi32(UNorm8(_mm_loadu_ps(src + i + 8)), UNorm8(_mm_loadu_ps(src + i + 12)));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint16x8_t v = vcombine_u16(vmovn_u32(UNorm8(vld1q_f32(src + i))), vmovn_u32(UNorm8(vld1q_f32(src + i + 4))));
+        vst1_u8(dst + i, vmovn_u16(v));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        dst[i] = UNorm8(src[i]);
+    }
+}
+
+void HalfToUNorm8(const UInt16 *src, UInt8 *dst, UInt32 count)
+{
+    float block[HALF_BLOCK];
+    for (UInt32 i = 0; i < count; i += HALF_BLOCK)
+    {
+        const UInt32 n = std::min(HALF_BLOCK, count - i);
+        HalfToFloat(src + i, block, n);
+        FloatToUNorm8(block, dst + i, n);
+    }
+}
+
+void SRGB8ToLinear8(const UInt8 *src, UInt8 *dst, UInt32 count, bool withAlpha)
+{
+    LookUp(GetSRGBTables().toLinear, src, dst, count, withAlpha);
+}
+
+void Linear8ToSRGB8(const UInt8 *src, UInt8 *dst, UInt32 count, bool withAlpha)
+{
+    LookUp(GetSRGBTables().toSRGB, src, dst, count, withAlpha);
+}
+
+void Depth16ToGray8(const UInt16 *src, UInt8 *dst, UInt32 count)
+{
+    UInt32 i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i lo = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + i)), 8);
+        const __m128i hi = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + i + 8)), 8);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8)
+    {
+        vst1_u8(dst + i, vshrn_n_u16(vld1q_u16(src + i), 8));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        dst[i] = src[i] >> 8;
+    }
+}
+
+void Depth32ToGray8(const UInt32 *src, UInt8 *dst, UInt32 count)
+{
+    UInt32 i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i d[4];
+        for (int q = 0; q < 4; ++q)
+        {
+            d[q] = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + i + q * 4)), 24);
+        }
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(_mm_packs_epi32(d[0], d[1]), _mm_packs_epi32(d[2], d[3])));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint16x8_t d = vcombine_u16(vshrn_n_u32(vld1q_u32(src + i), 16), vshrn_n_u32(vld1q_u32(src + i + 4), 16));
+        vst1_u8(dst + i, vshrn_n_u16(d, 8));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        dst[i] = src[i] >> 24;
+    }
+}
+
+void FlipRows(UInt8 *data, UInt32 rowSize, UInt32 height)
+{
+    std::vector<UInt8> row(rowSize);
+    for (UInt32 top = 0, bottom = height - 1; top < bottom; ++top, --bottom)
+    {
+        UInt8 *a = data + (size_t)top * rowSize;
+        UInt8 *b = data + (size_t)bottom * rowSize;
+        memcpy(row.data(), a, rowSize);
+        memcpy(a, b, rowSize);
+        memcpy(b, row.data(), rowSize);
+    }
+}
+
+bool CanConvertToUByte(UInt32 format, UInt32 type)
+{
+    const bool color = format == GL_ALPHA || format == GL_LUMINANCE || format == GL_LUMINANCE_ALPHA
+        || format == GL_RGB || format == GL_RGBA;
+    switch (type)
+    {
+    case GL_UNSIGNED_BYTE:
+        return color || format == GL_BGRA_EXT;
+    case GL_HALF_FLOAT:
+    case GL_HALF_FLOAT_OES:
+        return color;
+    case GL_FLOAT:
+        return color || format == GL_DEPTH_COMPONENT;
+    case GL_UNSIGNED_SHORT_5_6_5:
+        return format == GL_RGB;
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+        return format == GL_RGBA;
+    case GL_UNSIGNED_SHORT:
+    case GL_UNSIGNED_INT:
+        return format == GL_DEPTH_COMPONENT;
+    case GL_UNSIGNED_INT_24_8_OES:
+        return format == GL_DEPTH_STENCIL_OES;
+    default:
+        return false;
+    }
+}
+
+bool ConvertToUByte(const Image &input, Image &output, bool flip)
+{
+    const UInt32 width = input.Width();
+    const UInt32 height = input.Height();
+    const UInt32 format = input.Format();
+    const UInt32 type = input.Type();
+    if (!CanConvertToUByte(format, type))
+    {
+        PAT_DEBUG_LOG("Unexpected format & type pair : 0x%X 0x%X\n", format, type);
+        return false;
+    }
+
+    const UInt8 *ip = input.Data();
+    const UInt32 inputRowSize = GetImagePixelSize(format, type) * width;
+    if (!ip || input.DataSize() < inputRowSize * height)
+        return false;
+
+    const UInt32 outputRowSize = OutputChannels(format) * width;
+    const UInt32 outputSize = outputRowSize * height;
+    UInt8 *outputData = new UInt8[outputSize];
+    PAT_DEBUG_ASSERT_NEW(outputData);
+    if (!outputData) return false;
+
+    for (UInt32 y = 0; y < height; ++y)
+    {
+        const UInt32 sy = flip ? height - 1 - y : y;
+        ConvertRow(format, type, ip + (size_t)sy * inputRowSize, outputData + (size_t)y * outputRowSize, width);
+    }
+
+    output.Set(width, height, OutputFormat(format), GL_UNSIGNED_BYTE, outputSize, outputData, false, true);
+    return true;
+}
+
+} // namespace pat
@@ -0,0 +1,56 @@
+#ifndef _INCLUDE_IMAGE_CONVERT_HPP_
+#define _INCLUDE_IMAGE_CONVERT_HPP_
+
+#include "base/base.hpp"
+
+namespace pat
+{
+
+class Image;
+
+// Conversion of count tightly packed pixels from one format to another. SSE2 or NEON converts
+// the bulk of the pixels and the rest use the same arithmetic, so that every path gives the
+// same bytes. Packed 16 bit formats are native endian, as GL returns them, and their channels
+// are widened by replicating the top bits into the low ones, so that 0 and the largest value
+// map to 0 and 255.
+
+void RGB565ToRGB8(const UInt16 *src, UInt8 *dst, UInt32 count);
+void RGBA4444ToRGBA8(const UInt16 *src, UInt8 *dst, UInt32 count);
+void RGBA5551ToRGBA8(const UInt16 *src, UInt8 *dst, UInt32 count);
+
+// Swap red and blue of RGBA8 or BGRA8 pixels. src and dst may be the same.
+void SwapRedBlue8(const UInt8 *src, UInt8 *dst, UInt32 count);
+void GrayToRGB8(const UInt8 *src, UInt8 *dst, UInt32 count);
+void RGBA8ToRGB8(const UInt8 *src, UInt8 *dst, UInt32 count);
+
+// Half floats to floats, denormals, infinities and NaNs included
+void HalfToFloat(const UInt16 *src, float *dst, UInt32 count);
+// Floats clamped to [0, 1] to 8 bit normalized, rounded to nearest, with NaN as 0. These two
+// convert count values rather than pixels.
+void FloatToUNorm8(const float *src, UInt8 *dst, UInt32 count);
+void HalfToUNorm8(const UInt16 *src, UInt8 *dst, UInt32 count);
+
+// sRGB encoded color to linear and back, in 8 bits, leaving every fourth value, the alpha of
+// RGBA8, alone if withAlpha. src and dst may be the same.
+void SRGB8ToLinear8(const UInt8 *src, UInt8 *dst, UInt32 count, bool withAlpha);
+void Linear8ToSRGB8(const UInt8 *src, UInt8 *dst, UInt32 count, bool withAlpha);
+
+// The top 8 bits of depth, for viewing depth buffers as grey. Depth32ToGray8 takes
+// GL_UNSIGNED_INT and GL_UNSIGNED_INT_24_8 alike, as the stencil is in the low bits.
+void Depth16ToGray8(const UInt16 *src, UInt8 *dst, UInt32 count);
+void Depth32ToGray8(const UInt32 *src, UInt8 *dst, UInt32 count);
+
+// Reverse the order of height rows of rowSize bytes, in place
+void FlipRows(UInt8 *data, UInt32 rowSize, UInt32 height);
+
+// Whether ConvertToUByte handles the format and type pair
+bool CanConvertToUByte(UInt32 format, UInt32 type);
+
+// Convert an uncompressed image to 8 bits per channel, flipping it vertically if flip. Colour
+// keeps its channels, with BGRA turned into RGBA, and depth becomes GL_LUMINANCE. Images that
+// are already GL_UNSIGNED_BYTE are copied.
+bool ConvertToUByte(const Image &input, Image &output, bool flip);
+
+} // namespace pat
+
+#endif // _INCLUDE_IMAGE_CONVERT_HPP_
@@ -6,6 +6,7 @@
 #include "libpng/png.h"
 #include "image.hpp"
 #include "image_io.hpp"
+#include "image_convert.hpp"
 #include "image_compression.hpp"
 
 namespace pat
@@ -13,12 +14,7 @@ namespace pat
 
 bool CanWriteAsPNG(UInt32 format, UInt32 type)
 {
-    if ((format == GL_LUMINANCE || format == GL_ALPHA ||
-         format == GL_RGB || format == GL_RGBA)
-         && type == GL_UNSIGNED_BYTE)
-         return true;
-    else
-        return false;
+    return CanConvertToUByte(format, type);
 }
 
 bool WritePNG(const Image &image, const char *filename, bool flip)
@@ -32,53 +28,18 @@ bool WritePNG(const Image &image, const char *filename, bool flip)
     unsigned int format = image.Format();
     unsigned int type = image.Type();
 
-    unsigned char *output_data = NULL;
-    if ((format == GL_LUMINANCE || format == GL_ALPHA ||
+    const unsigned char *output_data = data;
+    Image converted;
+    if ((format == GL_LUMINANCE || format == GL_ALPHA || format == GL_LUMINANCE_ALPHA ||
          format == GL_RGB || format == GL_RGBA)
          && type == GL_UNSIGNED_BYTE)
     {
         // no procession needed
-        output_data = const_cast<unsigned char *>(data);
     }
-    else if (format == GL_RGB && type == GL_UNSIGNED_SHORT_5_6_5)
+    else if (ConvertToUByte(image, converted, false))
     {
-        // convert to RGB888
-        output_data = new unsigned char[3 * width * height];
-        unsigned char *op = output_data;
-        const unsigned char *input_data = static_cast<const unsigned char *>(data);
-        for (unsigned int j = 0; j < height; j++)
-        {
-            for (unsigned int i = 0; i < width; i++)
-            {
-                unsigned short buffer = ((*input_data) << 8) | (*(input_data + 1));
-                *(op) = (buffer & 0xF800) >> 11;
-                *(op + 1) = (buffer & 0x07E0) >> 5;
-                *(op + 2) = (buffer & 0x001F);
-                op += 3;
-                input_data += 2;
-            }
-        }
-        type = GL_UNSIGNED_BYTE;
-    }
-    else if (format == GL_BGRA_EXT && type == GL_UNSIGNED_BYTE)
-    {
-        // convert to BGRA888
-        output_data = new unsigned char[4 * width * height];
-        unsigned char *op = output_data;
-        const unsigned char *input_data = data;
-        for (unsigned int j = 0; j < height; j++)
-        {
-            for (unsigned int i = 0; i < width; i++)
-            {
-                *(op) = *(input_data + 2);
-                *(op + 1) = *(input_data + 1);
-                *(op + 2) = *(input_data);
-                *(op + 3) = *(input_data + 3);
-                input_data += 4;
-                op += 4;
-            }
-        }
-        format = GL_RGBA;
+        output_data = converted.Data();
+        format = converted.Format();
     }
     else
     {
@@ -154,9 +115,6 @@ bool WritePNG(const Image &image, const char *filename, bool flip)
         }
     }
 
-    if (output_data != data)
-        delete [] output_data;
-
     png_write_end(png_ptr, info_ptr);
     png_destroy_write_struct(&png_ptr, &info_ptr);
     fclose(fp);
@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "image_yuv.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+// BT.601 full range in 15 bit fixed point. The luma coefficients add up to exactly 1 and the
+// chroma ones to 0, so that white stays 255 and greys have no colour, and all fit the 16 bit
+// multiplies of the SIMD paths.
+const int YR = 9798, YG = 19235, YB = 3735;
+const int UR = -5538, UG = -10846, UB = 16384;
+const int VR = 16384, VG = -13730, VB = -2654;
+const int CHROMA_OFFSET = 128 << 15;
+
+// Fewest pixels to give each converting thread, 512x512
+const unsigned int YUV_PIXELS_PER_THREAD = 512 * 512;
+
+const int INTERLEAVED = 2;
+
+unsigned char Clamp(int c)
+{
+    if (c < 0)
+        return 0;
+    else if (c > 255)
+        return 255;
+    return c;
+}
+
+unsigned int AlignTo16(unsigned int value)
+{
+    return (value + 15) / 16 * 16;
+}
+
+#if defined(__SSE2__)
+
+// Dot products of the r, g and b of four RGBA pixels with the coefficients, as 32 bit lanes
+inline __m128i Dot(__m128i rb, __m128i ga, int cr, int cg, int cb)
+{
+    const __m128i crb = _mm_set_epi16(cb, cr, cb, cr, cb, cr, cb, cr);
+    const __m128i cga = _mm_set_epi16(0, cg, 0, cg, 0, cg, 0, cg);
+    return _mm_add_epi32(_mm_madd_epi16(rb, crb), _mm_madd_epi16(ga, cga));
+}
+
+// Split four RGBA pixels into 16 bit pairs of r and b, and of g and a
+inline void Split(__m128i pixels, __m128i &rb, __m128i &ga)
+{
+    const __m128i mask = _mm_set1_epi32(0x00ff00ff);
+    rb = _mm_and_si128(pixels, mask);
+    ga = _mm_and_si128(_mm_srli_epi32(pixels, 8), mask);
+}
+
+inline __m128i Luma(__m128i pixels)
+{
+    __m128i rb, ga;
+    Split(pixels, rb, ga);
+    return _mm_srai_epi32(Dot(rb, ga, YR, YG, YB), 15);
+}
+
+// The chroma of eight pixels, as the low eight bytes
+inline __m128i Chroma(__m128i rb0, __m128i ga0, __m128i rb1, __m128i ga1, int cr, int cg, int cb)
+{
+    const __m128i offset = _mm_set1_epi32(CHROMA_OFFSET);
+    const __m128i c0 = _mm_srai_epi32(_mm_add_epi32(Dot(rb0, ga0, cr, cg, cb), offset), 15);
+    const __m128i c1 = _mm_srai_epi32(_mm_add_epi32(Dot(rb1, ga1, cr, cg, cb), offset), 15);
+    const __m128i c = _mm_packs_epi32(c0, c1);
+    return _mm_packus_epi16(c, c);
+}
+
+// Every other pixel of two vectors of four
+inline __m128i EvenPixels(__m128i p0, __m128i p1)
+{
+    return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(p0), _mm_castsi128_ps(p1), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+#elif defined(__ARM_NEON)
+
+inline uint16x4_t Luma(uint16x4_t r, uint16x4_t g, uint16x4_t b)
+{
+    uint32x4_t acc = vmull_n_u16(r, YR);
+    acc = vmlal_n_u16(acc, g, YG);
+    acc = vmlal_n_u16(acc, b, YB);
+    return vshrn_n_u32(acc, 15);
+}
+
+inline uint8x8_t Luma(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+    const uint16x8_t r16 = vmovl_u8(r), g16 = vmovl_u8(g), b16 = vmovl_u8(b);
+    const uint16x4_t low = Luma(vget_low_u16(r16), vget_low_u16(g16), vget_low_u16(b16));
+    const uint16x4_t high = Luma(vget_high_u16(r16), vget_high_u16(g16), vget_high_u16(b16));
+    return vqmovn_u16(vcombine_u16(low, high));
+}
+
+inline int16x4_t Chroma(int16x4_t r, int16x4_t g, int16x4_t b, int cr, int cg, int cb)
+{
+    int32x4_t acc = vdupq_n_s32(CHROMA_OFFSET);
+    acc = vmlal_n_s16(acc, r, cr);
+    acc = vmlal_n_s16(acc, g, cg);
+    acc = vmlal_n_s16(acc, b, cb);
+    return vshrn_n_s32(acc, 15);
+}
+
+inline uint8x8_t Chroma(int16x8_t r, int16x8_t g, int16x8_t b, int cr, int cg, int cb)
+{
+    const int16x4_t low = Chroma(vget_low_s16(r), vget_low_s16(g), vget_low_s16(b), cr, cg, cb);
+    const int16x4_t high = Chroma(vget_high_s16(r), vget_high_s16(g), vget_high_s16(b), cr, cg, cb);
+    return vqmovun_s16(vcombine_s16(low, high));
+}
+
+// Every other lane of 16, widened to signed 16 bit
+inline int16x8_t EvenLanes(uint8x16_t channel)
+{
+    const uint8x8_t even = vuzp_u8(vget_low_u8(channel), vget_high_u8(channel)).val[0];
+    return vreinterpretq_s16_u16(vmovl_u8(even));
+}
+
+#endif
+
+// Convert a row of pixels to luma and, unless u is NULL, every other pixel to chroma. With
+// chromaStep INTERLEAVED, u and v are interleaved and v is u + 1.
+void ConvertRow(const unsigned char *rgba, unsigned int width, unsigned char *y, unsigned char *u, unsigned char *v, int chromaStep)
+{
+    unsigned int x = 0;
+#if defined(__SSE2__)
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i *src = reinterpret_cast<const __m128i *>(rgba + x * 4);
+        const __m128i p0 = _mm_loadu_si128(src), p1 = _mm_loadu_si128(src + 1);
+        const __m128i p2 = _mm_loadu_si128(src + 2), p3 = _mm_loadu_si128(src + 3);
+        const __m128i low = _mm_packs_epi32(Luma(p0), Luma(p1));
+        const __m128i high = _mm_packs_epi32(Luma(p2), Luma(p3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y + x), _mm_packus_epi16(low, high));
+        if (u)
+        {
+            __m128i rb0, ga0, rb1, ga1;
+            Split(EvenPixels(p0, p1), rb0, ga0);
+            Split(EvenPixels(p2, p3), rb1, ga1);
+            const __m128i u8 = Chroma(rb0, ga0, rb1, ga1, UR, UG, UB);
+            const __m128i v8 = Chroma(rb0, ga0, rb1, ga1, VR, VG, VB);
+            if (chromaStep == INTERLEAVED)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(u + x), _mm_unpacklo_epi8(u8, v8));
+            }
+            else
+            {
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(u + x / 2), u8);
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(v + x / 2), v8);
+            }
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8x16x4_t p = vld4q_u8(rgba + x * 4);
+        const uint8x8_t low = Luma(vget_low_u8(p.val[0]), vget_low_u8(p.val[1]), vget_low_u8(p.val[2]));
+        const uint8x8_t high = Luma(vget_high_u8(p.val[0]), vget_high_u8(p.val[1]), vget_high_u8(p.val[2]));
+        vst1q_u8(y + x, vcombine_u8(low, high));
+        if (u)
+        {
+            const int16x8_t r = EvenLanes(p.val[0]), g = EvenLanes(p.val[1]), b = EvenLanes(p.val[2]);
+            uint8x8x2_t uv;
+            uv.val[0] = Chroma(r, g, b, UR, UG, UB);
+            uv.val[1] = Chroma(r, g, b, VR, VG, VB);
+            if (chromaStep == INTERLEAVED)
+            {
+                vst2_u8(u + x, uv);
+            }
+            else
+            {
+                vst1_u8(u + x / 2, uv.val[0]);
+                vst1_u8(v + x / 2, uv.val[1]);
+            }
+        }
+    }
+#endif
+    for (; x < width; ++x)
+    {
+        const int r = rgba[x * 4], g = rgba[x * 4 + 1], b = rgba[x * 4 + 2];
+        y[x] = (YR * r + YG * g + YB * b) >> 15;
+        if (u && (x & 0x1) == 0)
+        {
+            u[x / 2 * chromaStep] = Clamp((UR * r + UG * g + UB * b + CHROMA_OFFSET) >> 15);
+            v[x / 2 * chromaStep] = Clamp((VR * r + VG * g + VB * b + CHROMA_OFFSET) >> 15);
+        }
+    }
+}
+
+struct Planes
+{
+    unsigned char *y;
+    unsigned char *u;
+    unsigned char *v;
+    unsigned int yStride;
+    unsigned int chromaStride;
+    int chromaStep;
+};
+
+// Convert the pairs of rows from firstPair to lastPair. The chroma of a last row without a
+// pair below it is left out, as it has no room in the chroma planes.
+void ConvertRowPairs(const unsigned char *rgba, unsigned int width, unsigned int height, const Planes &planes, unsigned int firstPair, unsigned int lastPair)
+{
+    const unsigned int yPadding = planes.yStride - width;
+    for (unsigned int pair = firstPair; pair < lastPair; ++pair)
+    {
+        const unsigned int row = pair * 2;
+        const bool chroma = row + 1 < height;
+        unsigned char *y = planes.y + row * planes.yStride;
+        ConvertRow(rgba + row * width * 4, width, y,
+                   chroma ? planes.u + pair * planes.chromaStride : NULL,
+                   chroma ? planes.v + pair * planes.chromaStride : NULL, planes.chromaStep);
+        memset(y + width, 0, yPadding);
+        if (chroma)
+        {
+            ConvertRow(rgba + (row + 1) * width * 4, width, y + planes.yStride, NULL, NULL, planes.chromaStep);
+            memset(y + planes.yStride + width, 0, yPadding);
+            const unsigned int chromaWidth = (width + 1) / 2 * planes.chromaStep;
+            const unsigned int chromaPadding = planes.chromaStride - chromaWidth;
+            memset(planes.u + pair * planes.chromaStride + chromaWidth, 0, chromaPadding);
+            if (planes.chromaStep != INTERLEAVED)
+            {
+                memset(planes.v + pair * planes.chromaStride + chromaWidth, 0, chromaPadding);
+            }
+        }
+    }
+}
+
+void Convert(const unsigned char *rgba, unsigned int width, unsigned int height, const Planes &planes, unsigned int threads)
+{
+    const unsigned int pairs = (height + 1) / 2;
+    // Large images are converted by several threads, each taking a strip of row pairs. Small
+    // ones are not worth starting a thread for.
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min<unsigned int>(threads, (unsigned long long)width * height / YUV_PIXELS_PER_THREAD);
+    if (threads <= 1)
+    {
+        ConvertRowPairs(rgba, width, height, planes, 0, pairs);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < threads; ++t)
+    {
+        const unsigned int firstPair = pairs * t / threads;
+        const unsigned int lastPair = pairs * (t + 1) / threads;
+        workers.push_back(std::thread(ConvertRowPairs, rgba, width, height, std::cref(planes), firstPair, lastPair));
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+} // unnamed namespace
+
+namespace pat
+{
+
+UInt32 YV12Size(UInt32 width, UInt32 height)
+{
+    const UInt32 yStride = AlignTo16(width);
+    const UInt32 cStride = AlignTo16(yStride / 2);
+    return yStride * height + cStride * height / 2 * 2;
+}
+
+UInt32 RGBAToYV12(const unsigned char *rgba, unsigned char *yv12, UInt32 width, UInt32 height, unsigned int threads)
+{
+    const UInt32 yStride = AlignTo16(width);
+    const UInt32 cStride = AlignTo16(yStride / 2);
+    const UInt32 cSize = cStride * height / 2;
+    Planes planes;
+    planes.y = yv12;
+    planes.v = yv12 + yStride * height;
+    planes.u = planes.v + cSize;
+    planes.yStride = yStride;
+    planes.chromaStride = cStride;
+    planes.chromaStep = 1;
+    Convert(rgba, width, height, planes, threads);
+    return yStride * height + cSize * 2;
+}
+
+UInt32 NV12Size(UInt32 width, UInt32 height)
+{
+    const UInt32 yStride = AlignTo16(width);
+    return yStride * height + yStride * height / 2;
+}
+
+UInt32 RGBAToNV12(const unsigned char *rgba, unsigned char *nv12, UInt32 width, UInt32 height, unsigned int threads)
+{
+    const UInt32 yStride = AlignTo16(width);
+    Planes planes;
+    planes.y = nv12;
+    planes.u = nv12 + yStride * height;
+    planes.v = planes.u + 1;
+    planes.yStride = yStride;
+    planes.chromaStride = yStride;
+    planes.chromaStep = INTERLEAVED;
+    Convert(rgba, width, height, planes, threads);
+    return yStride * height + yStride * height / 2;
+}
+
+}
@@ -0,0 +1,25 @@
+#ifndef _INCLUDE_IMAGE_YUV_HPP_
+#define _INCLUDE_IMAGE_YUV_HPP_
+
+#include "base/base.hpp"
+
+namespace pat
+{
+
+// Conversion of tightly packed RGBA8 pixels to the YUV layouts of Android graphic buffers, with
+// BT.601 full range coefficients. The chroma of each 2x2 block is that of its top left pixel.
+// The Y stride is the width rounded up to 16, and the padding at the end of each row is zeroed.
+// Large images are converted by several threads, each taking a strip of rows; threads = 0 means
+// one per core.
+
+// Y plane, then V and U planes with strides of half the Y stride rounded up to 16
+UInt32 YV12Size(UInt32 width, UInt32 height);
+UInt32 RGBAToYV12(const unsigned char *rgba, unsigned char *yv12, UInt32 width, UInt32 height, unsigned int threads = 0);
+
+// Y plane, then one plane of interleaved U and V with the stride of the Y plane
+UInt32 NV12Size(UInt32 width, UInt32 height);
+UInt32 RGBAToNV12(const unsigned char *rgba, unsigned char *nv12, UInt32 width, UInt32 height, unsigned int threads = 0);
+
+}
+
+#endif // _INCLUDE_IMAGE_YUV_HPP_
@@ -1,6 +1,20 @@
+#include <deque>
+#include <fstream>
+#include <future>
+#include <map>
+#include <thread>
+#include <tuple>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "image/image.hpp"
+#include "image/image_compression.hpp"
+#include "image/image_io.hpp"
 #include "eglstate/context.hpp"
+#include "system/path.hpp"
 #include "tool/trace_interface.hpp"
 #include "tool/config.hpp"
+#include "common/memory.hpp"
 using namespace pat;
 
 extern "C"
@@ -97,6 +111,155 @@ private:
     BufferThreadMap gContexts;
 };
 
+namespace
+{
+
+// Write image to path, with the extension of the file type added, as PNG if it can be, else
+// as KTX. Compressed images are decoded first where that needs no external tool. Returns the
+// name of the file written, empty if it failed.
+std::string DumpImage(const pat::ImagePtr &image, const std::string &path)
+{
+    const pat::Image *output = image.get();
+    pat::Image uncompressed;
+    const UInt32 format = image->Format();
+    // others are a single image at a time, so decode them on this thread only
+    if ((pat::IsETC1Compression(format) && pat::UncompressFromETC1(*image, uncompressed, 1)) ||
+        (pat::IsASTCCompression(format) && pat::SupportASTCUncompression() && pat::Uncompress(*image, uncompressed)))
+    {
+        output = &uncompressed;
+    }
+
+    if (!pat::IsImageCompression(output->Format()) && pat::CanWriteAsPNG(output->Format(), output->Type()) &&
+        pat::WritePNG(*output, (path + ".png").c_str(), false))
+    {
+        return path + ".png";
+    }
+    if (pat::WriteKTX(*image, (path + ".ktx").c_str(), false))
+    {
+        return path + ".ktx";
+    }
+    PAT_DEBUG_LOG("Error : failed to write %s\n", path.c_str());
+    return std::string();
+}
+
+// For -uploads: every texture upload in the trace, rather than the textures as they are at
+// the end. Uploads are read in order on the main thread and copied out of their calls, and
+// identical ones, with the same size, format and contents, are written once. The rest are
+// decoded and written on up to threads worker threads while the trace is read on. A manifest
+// lists each upload with the file that holds its contents.
+class UploadDumper
+{
+public:
+    UploadDumper(const std::string &directory, unsigned int threads)
+        : _directory(directory), _threads(threads)
+    {
+    }
+
+    void Add(CallInterface *call, UInt32 target, UInt32 level, UInt32 xoffset, UInt32 yoffset,
+             UInt32 width, UInt32 height, UInt32 format, UInt32 type, UInt32 size, const UInt8 *pixels)
+    {
+        if (!pixels || size == 0)
+            return;
+
+        Upload upload;
+        upload.callNo = call->GetNumber();
+        upload.thread = call->GetThreadID();
+        upload.function = call->GetName();
+        upload.target = target;
+        upload.level = level;
+        upload.xoffset = xoffset;
+        upload.yoffset = yoffset;
+        upload.width = width;
+        upload.height = height;
+        upload.format = format;
+        upload.type = type;
+        upload.size = size;
+
+        const ContentKey key(width, height, format, type, size, common::ContentDigest(pixels, size));
+        const auto found = _files.find(key);
+        if (found != _files.end())
+        {
+            upload.file = found->second;
+            _uploads.push_back(upload);
+            return;
+        }
+
+        // the call frees its data once the input moves on, so the job keeps a copy
+        pat::ImagePtr image(new pat::Image(width, height, format, type, size, const_cast<UInt8 *>(pixels), true));
+        char name[64];
+        sprintf(name, "texture_call%08u", upload.callNo);
+        const std::string path = _directory + Path::Sep + name;
+
+        while (_running.size() >= _threads)
+        {
+            _running.front().wait();
+            _running.pop_front();
+        }
+        std::shared_future<std::string> file = std::async(std::launch::async, [image, path]() {
+            return DumpImage(image, path);
+        }).share();
+        _running.push_back(file);
+        _files.emplace(key, file);
+        upload.file = file;
+        _uploads.push_back(upload);
+    }
+
+    // Wait for the files and write the manifest, false if anything failed
+    bool Finish()
+    {
+        const std::string manifest = _directory + Path::Sep + "TextureUploads.csv";
+        std::ofstream of(manifest.c_str());
+        of << "callNum,thread,function,target,level,xoffset,yoffset,width,height,format,type,dataSize,file" << std::endl;
+        bool ok = of.is_open();
+        for (auto &upload : _uploads)
+        {
+            const std::string file = upload.file.get();
+            ok = ok && !file.empty();
+            const char *format = EnumString(upload.format);
+            const char *type = EnumString(upload.type);
+            of << upload.callNo << "," << upload.thread << "," << upload.function << ","
+               << EnumString(upload.target) << "," << upload.level << ","
+               << upload.xoffset << "," << upload.yoffset << "," << upload.width << "," << upload.height << ","
+               << (format ? format : "") << "," << (type ? type : "") << "," << upload.size << ","
+               << file.substr(file.find_last_of(Path::Sep) + 1) << std::endl;
+        }
+        _running.clear();
+        printf("Dumped %u texture uploads to %u files, listed in %s\n",
+               (unsigned int)_uploads.size(), (unsigned int)_files.size(), manifest.c_str());
+        return ok;
+    }
+
+private:
+    struct Upload
+    {
+        UInt32 callNo, thread;
+        std::string function;
+        UInt32 target, level, xoffset, yoffset, width, height, format, type, size;
+        std::shared_future<std::string> file;
+    };
+
+    typedef std::tuple<UInt32, UInt32, UInt32, UInt32, UInt32, common::ContentDigest> ContentKey;
+
+    std::string _directory;
+    unsigned int _threads;
+    std::vector<Upload> _uploads; // in call order
+    std::map<ContentKey, std::shared_future<std::string>> _files; // first upload of each content
+    std::deque<std::shared_future<std::string>> _running; // jobs that may not have finished
+};
+
+void PrintHelp(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [OPTIONS] <trace file>\n\n", argv0);
+    fprintf(stderr, " -h output this help text\n");
+    fprintf(stderr, " -v output the version\n");
+    fprintf(stderr, " -uploads dump every texture upload in the trace, with a manifest, instead of the textures at the end\n");
+    fprintf(stderr, " -j THREADS number of uploads to write at once with -uploads, 0 for one per core (default)\n");
+    fprintf(stderr, " -o DIR directory to write the uploads to with -uploads (default: current directory)\n");
+    fprintf(stderr, "\nDumps the textures in a trace file.\n");
+}
+
+} // unnamed namespace
+
 int main(int argc, char **argv)
 {
     if (argc < 2)
@@ -105,21 +268,58 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    if(!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
-        fprintf(stderr, "Usage: %s <trace file>\n\n", argv[0]);
-        fprintf(stderr, " -h output this help text\n");
-        fprintf(stderr, " -v output the version\n");
-        fprintf(stderr, "\nDumps the textures in a trace file.\n");
-        exit(0);
+    bool uploads = false;
+    unsigned int threads = 0;
+    std::string directory = ".";
+    int argIndex = 1;
+    for (; argIndex < argc && argv[argIndex][0] == '-'; ++argIndex)
+    {
+        const char *arg = argv[argIndex];
+        if (!strcmp(arg, "-h") || !strcmp(arg, "--help"))
+        {
+            PrintHelp(argv[0]);
+            exit(0);
+        }
+        else if (!strcmp(arg, "-v") || !strcmp(arg, "--version"))
+        {
+            fprintf(stderr, "Version: " PATRACE_VERSION);
+            exit(0);
+        }
+        else if (!strcmp(arg, "-uploads"))
+        {
+            uploads = true;
+        }
+        else if (!strcmp(arg, "-j") && argIndex + 1 < argc)
+        {
+            threads = atoi(argv[++argIndex]);
+        }
+        else if (!strcmp(arg, "-o") && argIndex + 1 < argc)
+        {
+            directory = argv[++argIndex];
+        }
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", arg);
+            PrintHelp(argv[0]);
+            exit(1);
+        }
     }
-
-    if(!strcmp(argv[1], "-v") || !strcmp(argv[1], "--version"))
+    if (argIndex >= argc)
+    {
+        PrintHelp(argv[0]);
+        exit(1);
+    }
+    if (uploads && !Path::IsDirectory(directory))
+    {
+        fprintf(stderr, "Error: %s is not a directory\n", directory.c_str());
+        exit(1);
+    }
+    if (threads == 0)
     {
-        fprintf(stderr, "Version: " PATRACE_VERSION);
-        exit(0);
+        threads = std::max(1u, std::thread::hardware_concurrency());
     }
 
-    const char *trace_filename = argv[1];
+    const char *trace_filename = argv[argIndex];
 
     std::shared_ptr<InputFileInterface> inputFile(GenerateInputFile());
     if (!inputFile->open(trace_filename))
@@ -129,6 +329,7 @@ int main(int argc, char **argv)
     }
 
     BufferMangerForThread bufferManagerForThread;
+    std::unique_ptr<UploadDumper> uploadDumper(uploads ? new UploadDumper(directory, threads) : NULL);
     CallInterface *call = NULL;
     while ((call = inputFile->next_call()))
     {
@@ -169,7 +370,19 @@ int main(int argc, char **argv)
             const unsigned int type = call->arg_to_uint(7);
             bool bufferObject = false;
             unsigned char *pixels = call->arg_to_pointer(8, &bufferObject);
-            context->SetTexImage(target, level, format, type, width, height, pixels);
+            if (uploadDumper)
+            {
+                if (bufferObject)
+                {
+                    pixels = _bufferSaver->queryBufferData(_bufferSaver->getActiveBuffer());
+                }
+                uploadDumper->Add(call, target, level, 0, 0, width, height, format, type,
+                                  GetImageDataSize(width, height, format, type), pixels);
+            }
+            else
+            {
+                context->SetTexImage(target, level, format, type, width, height, pixels);
+            }
         }
         else if (strcmp(call->GetName(), "glTexSubImage2D") == 0)
         {
@@ -187,7 +400,15 @@ int main(int argc, char **argv)
             {
                 pixels = _bufferSaver->queryBufferData(_bufferSaver->getActiveBuffer());
             }
-            context->SetTexSubImage(target, level, format, type, xoffset, yoffset, width, height, pixels);
+            if (uploadDumper)
+            {
+                uploadDumper->Add(call, target, level, xoffset, yoffset, width, height, format, type,
+                                  GetImageDataSize(width, height, format, type), pixels);
+            }
+            else
+            {
+                context->SetTexSubImage(target, level, format, type, xoffset, yoffset, width, height, pixels);
+            }
         }
         else if (strcmp(call->GetName(), "glCompressedTexImage2D") == 0)
         {
@@ -199,7 +420,18 @@ int main(int argc, char **argv)
             const unsigned int dataSize = call->arg_to_uint(6);
             bool bufferObject = false;
             unsigned char *pixels = call->arg_to_pointer(7, &bufferObject);
-            context->SetCompressedTexImage(target, level, format, width, height, dataSize, pixels);
+            if (uploadDumper)
+            {
+                if (bufferObject)
+                {
+                    pixels = _bufferSaver->queryBufferData(_bufferSaver->getActiveBuffer());
+                }
+                uploadDumper->Add(call, target, level, 0, 0, width, height, format, GL_NONE, dataSize, pixels);
+            }
+            else
+            {
+                context->SetCompressedTexImage(target, level, format, width, height, dataSize, pixels);
+            }
         }
         else if (strcmp(call->GetName(), "glBindBuffer") == 0)
         {
@@ -221,6 +453,11 @@ int main(int argc, char **argv)
     }
     inputFile->close();
 
+    if (uploadDumper)
+    {
+        return uploadDumper->Finish() ? 0 : 1;
+    }
+
     const pat::ContextPtrList contexts = pat::GetAllContexts();
     pat::ContextPtrList::const_iterator citer = contexts.begin();
     for (; citer != contexts.end(); ++citer)
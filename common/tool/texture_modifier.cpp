@@ -1,3 +1,7 @@
+#include <chrono>
+#include <deque>
+#include <future>
+#include <thread>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
@@ -94,6 +98,49 @@ bool ImageToCall(const pat::Image &image, CallInterface *call)
     }
 }
 
+/// What processing a texture call came to, applied and printed when the call is written out
+struct TextureResult
+{
+    pat::ImagePtr image; // replaces the texture of the call, if set
+    std::string log; // counted as a processed call and printed with the progress
+    std::string message; // printed as it is
+    bool failed = false; // stop with an error
+};
+
+/// A call read from the input that is waiting for the texture calls before it to be done
+struct PendingCall
+{
+    CallInterface *call = NULL;
+    std::future<TextureResult> result; // only for texture calls
+    bool async = false; // whether the result is worked out on a thread of its own
+};
+
+// Calls read ahead of the oldest texture call still being processed, at most
+const size_t MAX_PENDING_CALLS = 100000;
+
+std::string Describe(CallInterface *call)
+{
+    return "call no." + std::to_string(call->GetNumber()) + "(" + call->GetName() + ")";
+}
+
+std::future<TextureResult> Logged(const std::string &log)
+{
+    return std::async(std::launch::deferred, [log]() {
+        TextureResult result;
+        result.log = log;
+        return result;
+    });
+}
+
+std::future<TextureResult> Message(const std::string &message)
+{
+    return std::async(std::launch::deferred, [message]() {
+        TextureResult result;
+        result.message = message;
+        return result;
+    });
+}
+
 void printHelp()
 {
     std::cout <<
@@ -106,6 +153,8 @@ void printHelp()
         "     INPUT         Only compress the textures already compressed in the input trace\n"
         "     NOALPHA       Compress as much textures as possible, but ignore the ones with alpha channels\n"
         "     COMPLETE      Compress as much textures as possible\n"
+        "  -j THREADS    number of textures to process at once, 0 for one per core (default)\n"
+        "  -quality PRESET  ASTC encoder preset: veryfast, fast, medium, thorough (default) or exhaustive\n"
         "  -com FORMAT   compress as specific texture compression format\n"
         "    Supported formats:\n";
     const char **optionList = NULL;
@@ -129,6 +178,7 @@ int main(int argc, char **argv)
 {
     std::string encode_format;
     std::string mode = "INPUT";
+    unsigned int threads = 0;
 
     int argIndex = 1;
     for (; argIndex < argc; ++argIndex)
@@ -156,6 +206,18 @@ int main(int argc, char **argv)
         {
             encode_format = argv[++argIndex];
         }
+        else if (!strcmp(arg, "-j") && argIndex + 1 < argc)
+        {
+            threads = atoi(argv[++argIndex]);
+        }
+        else if (!strcmp(arg, "-quality") && argIndex + 1 < argc)
+        {
+            if (!pat::SetASTCQuality(argv[++argIndex]))
+            {
+                printHelp();
+                return 1;
+            }
+        }
         else
         {
             printf("Error: Unknow option %s\n", arg);
@@ -185,6 +247,17 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    if (threads == 0)
+    {
+        threads = cores;
+    }
+    if (threads > 1)
+    {
+        // share the cores between the textures compressed at the same time
+        pat::SetASTCThreads(std::max(1u, cores / threads));
+    }
+
     // First pass: find the textures using glGenerateMipmap & glTexSubImage2D & glFramebufferTexture2D
     UInt32 texImageCallNumber = 0;
     UInt32 compressedTexImageCallNumber = 0;
@@ -290,12 +363,63 @@ int main(int argc, char **argv)
     std::string json_header = inputFile->json_header();
     unsigned int compressCompleted = 0;
 
+    Json::Value inputHeader;
+    Json::Reader headerReader;
+    headerReader.parse(json_header, inputHeader);
+    const UInt32 defaultTid = inputHeader.get("defaultTid", 0).asUInt();
+
+    // Texture calls are processed on threads of their own, up to threads of them at a time,
+    // while the calls after them are read. The calls are still written out in order, each one
+    // waiting in pending for the texture calls before it.
+    std::deque<PendingCall> pending;
+    unsigned int running = 0; // texture calls in pending that are processed on a thread
+    // Write out the call at the front of pending, false if processing it failed
+    auto writeFront = [&]() -> bool
+    {
+        PendingCall &front = pending.front();
+        if (front.result.valid())
+        {
+            const TextureResult result = front.result.get();
+            if (front.async)
+            {
+                --running;
+            }
+            if (!result.message.empty())
+            {
+                printf("%s\n", result.message.c_str());
+            }
+            if (result.failed)
+            {
+                return false;
+            }
+            if (result.image)
+            {
+                if (ImageToCall(*result.image, front.call) == false)
+                {
+                    printf("Error : Failed to convert image to %s\n", Describe(front.call).c_str());
+                    return false;
+                }
+                ++compressCompleted;
+            }
+            if (!result.log.empty())
+            {
+                printf("LOG [%d/%d]: %s\n", ++finishedCall, totalCall, result.log.c_str());
+            }
+        }
+        outputFile->write(front.call);
+        delete front.call;
+        pending.pop_front();
+        return true;
+    };
+
     while ((call = inputFile->next_call()))
     {
         const UInt32 callNo = call->GetNumber();
         const UInt32 thread = call->GetThreadID();
         pat::ContextPtr context = pat::GetStateMangerForThread(thread);
         context->SetCurrentCallNumber(callNo);
+        PendingCall entry;
+        entry.call = call;
 
         if (strcmp(call->GetName(), "glBindTexture") == 0) // record the state of bound texture
         {
@@ -312,114 +436,132 @@ int main(int argc, char **argv)
                 (mode == "COMPLETE" || (mode == "NOALPHA" && !pat::WithAlphaChannel(call->arg_to_uint(6)))))
         {
             const unsigned int target = call->arg_to_uint(0);
+            const std::string name = Describe(call);
 
             pat::TextureObjectPtr boundTex = context->GetBoundTextureObject(context->GetActiveTextureUnit(), target);
             if (boundTex)
             {
                 if (boundTex->UsedAsRenderTarget())
                 {
-                    printf("LOG [%d/%d]: Process call no.%d(%s) can't be compressed since the bound texture object is used as render target\n", ++finishedCall, totalCall, callNo, call->GetName());
+                    entry.result = Logged("Process " + name + " can't be compressed since the bound texture object is used as render target");
                 }
                 else if (boundTex->HaveSetSubImage())
                 {
-                    printf("LOG [%d/%d]: Process call no.%d(%s) can't be compressed since the bound texture object is set with sub image\n", ++finishedCall, totalCall, callNo, call->GetName());
+                    entry.result = Logged("Process " + name + " can't be compressed since the bound texture object is set with sub image");
                 }
                 else if (boundTex->HaveGeneratedMipmap())
                 {
-                    printf("LOG [%d/%d]: Process call no.%d(%s) can't be compressed since the bound texture object generates mipmap\n", ++finishedCall, totalCall, callNo, call->GetName());
+                    entry.result = Logged("Process " + name + " can't be compressed since the bound texture object generates mipmap");
                 }
                 else
                 {
-                    pat::Image uncompressed, compressed;
-                    if (CallToImage(call, uncompressed) == false)
+                    // the image points into the call, which is kept until the result is written
+                    pat::ImagePtr uncompressed(new pat::Image);
+                    if (CallToImage(call, *uncompressed) == false)
                     {
                         printf("Error : Failed to convert call to image no.%d(%s)\n", callNo, call->GetName());
                         return -1;
                     }
 
-                    if (pat::CanCompressAs(uncompressed.Format(), uncompressed.Type(), encode_format))
+                    if (pat::CanCompressAs(uncompressed->Format(), uncompressed->Type(), encode_format))
                     {
-                        if (pat::Compress(uncompressed, compressed, encode_format))
-                        {
-                            if (ImageToCall(compressed, call) == false)
+                        entry.result = std::async(std::launch::async, [uncompressed, name, encode_format]() {
+                            TextureResult result;
+                            pat::ImagePtr compressed(new pat::Image);
+                            if (pat::Compress(*uncompressed, *compressed, encode_format))
                             {
-                                printf("Error : Failed to convert image to call no.%d(%s)\n", callNo, call->GetName());
-                                return -1;
+                                result.image = compressed;
+                                result.log = "Processed " + name;
                             }
                             else
                             {
-                                printf("LOG [%d/%d]: Processed call no.%d(%s)\n", ++finishedCall, totalCall, callNo, call->GetName());
-                                ++compressCompleted;
+                                result.message = "Error : Failed to compress " + name;
+                                result.failed = true;
                             }
-                        }
-                        else
-                        {
-                            printf("Error : Failed to compress call no.%d(%s)\n", callNo, call->GetName());
-                            return -1;
-                        }
+                            return result;
+                        });
+                        entry.async = true;
                     }
                     else
                     {
-                        const char *format_str = EnumString(uncompressed.Format());
-                        const char *type_str = EnumString(uncompressed.Type());
-                        printf("LOG [%d/%d]: For call no.%d(%s), compression as %s doesn't support input format(%s) and type(%s) combination\n", ++finishedCall, totalCall, callNo, call->GetName(), encode_format.c_str(), format_str, type_str);
+                        const char *format_str = EnumString(uncompressed->Format());
+                        const char *type_str = EnumString(uncompressed->Type());
+                        entry.result = Logged("For " + name + ", compression as " + encode_format + " doesn't support input format(" +
+                                              (format_str ? format_str : "") + ") and type(" + (type_str ? type_str : "") + ") combination");
                     }
                 }
             }
             else
             {
-                printf("No texture object is bound no.%d(%s)\n", callNo, call->GetName());
+                entry.result = Message("No texture object is bound no." + std::to_string(callNo) + "(" + call->GetName() + ")");
             }
         }
         else if (strcmp(call->GetName(), "glCompressedTexImage2D") == 0)
         {
-            pat::Image oldCompressed, uncompressed, newCompressed;
-            if (CallToImage(call, oldCompressed) == false)
+            const std::string name = Describe(call);
+            pat::ImagePtr oldCompressed(new pat::Image);
+            if (CallToImage(call, *oldCompressed) == false)
             {
                 printf("Error : Failed to convert call to image no.%d(%s)\n", callNo, call->GetName());
                 return -1;
             }
 
-            if (pat::Uncompress(oldCompressed, uncompressed))
-            {
-                if (encode_format == "UNCOMPRESSED")
+            entry.result = std::async(std::launch::async, [oldCompressed, name, encode_format]() {
+                TextureResult result;
+                pat::ImagePtr uncompressed(new pat::Image);
+                if (pat::Uncompress(*oldCompressed, *uncompressed) == false)
                 {
-                    if (ImageToCall(uncompressed, call) == false)
-                    {
-                        printf("Error : Failed to convert image to call no.%d(%s)\n", callNo, call->GetName());
-                        return -1;
-                    }
-                    printf("LOG [%d/%d]: Processed call no.%d(%s)\n", ++finishedCall, totalCall, callNo, call->GetName());
-                    ++compressCompleted;
+                    result.message = "Error : Failed to uncompress " + name + " and keep the call as it was.";
+                }
+                else if (encode_format == "UNCOMPRESSED")
+                {
+                    result.image = uncompressed;
+                    result.log = "Processed " + name;
                 }
-                else if (pat::CanCompressAs(uncompressed.Format(), uncompressed.Type(), encode_format))
+                else if (pat::CanCompressAs(uncompressed->Format(), uncompressed->Type(), encode_format))
                 {
-                    if (pat::Compress(uncompressed, newCompressed, encode_format))
+                    pat::ImagePtr newCompressed(new pat::Image);
+                    if (pat::Compress(*uncompressed, *newCompressed, encode_format))
                     {
-                        if (ImageToCall(newCompressed, call) == false)
-                        {
-                            printf("Error : Failed to convert image to call no.%d(%s)\n", callNo, call->GetName());
-                            return -1;
-                        }
-                        printf("LOG [%d/%d]: Processed call no.%d(%s)\n", ++finishedCall, totalCall, callNo, call->GetName());
-                        ++compressCompleted;
+                        result.image = newCompressed;
+                        result.log = "Processed " + name;
                     }
                     else
                     {
-                        printf("Error : Failed to compress call no.%d(%s)\n", callNo, call->GetName());
-                        return -1;
+                        result.message = "Error : Failed to compress " + name;
+                        result.failed = true;
                     }
                 }
-            }
-            else
+                return result;
+            });
+            entry.async = true;
+        }
+
+        if (entry.async)
+        {
+            ++running;
+        }
+        pending.push_back(std::move(entry));
+
+        // The input frees the calls of a frame when it moves on to the next one, so everything
+        // has to be written out by the end of each frame of the default thread.
+        const bool frameEnd = thread == defaultTid && (strcmp(call->GetName(), "eglSwapBuffers") == 0 ||
+                                                       strcmp(call->GetName(), "eglSwapBuffersWithDamageKHR") == 0);
+        while (!pending.empty() && (frameEnd || running >= threads || pending.size() > MAX_PENDING_CALLS || !pending.front().async ||
+                                    pending.front().result.wait_for(std::chrono::seconds(0)) == std::future_status::ready))
+        {
+            if (!writeFront())
             {
-                printf("Error : Failed to uncompress call no.%d(%s) and keep the call as it was.\n", callNo, call->GetName());
+                return -1;
             }
         }
-
-        outputFile->write(call);
-
-        delete call;
+    }
+    while (!pending.empty())
+    {
+        if (!writeFront())
+        {
+            return -1;
+        }
     }
 
     printf("Summary : In total, %d calls have been compressed.\n", compressCompleted);
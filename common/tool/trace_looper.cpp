@@ -36,10 +36,12 @@ TraceLooper::TraceLooper(int argc, char* argv[]) {
 
 
 TraceLooper::~TraceLooper() {
-    for (auto call_ptr : calls) {
-        if (call_ptr) {
-            delete call_ptr;
-        }
+    for (auto call_ptr : frame_calls) {
+        delete call_ptr;
+    }
+
+    for (auto call_ptr : range_calls) {
+        delete call_ptr;
     }
 }
 
@@ -63,11 +65,38 @@ void TraceLooper::load() {
 
     ILOG("Main thread ID set to: " + std::to_string(main_thread_ID));
 
+    // Only the calls to loop are kept, the rest is counted here and streamed again by save()
+    const int target_frame = int_args["target_frame"];
+    const int start_call_index = int_args["start_call_index"];
+    const int end_call_index = int_args["end_call_index"];
+    const bool range_selected = bool_args["loop_range_selected"];
+    const bool reset_loop_state = bool_args["reset_loop_state"];
+
     common::CallTM* current_call = trace_file.NextCall();
     int call_index = 0;
 
     while (current_call) {
-        add_call(current_call);
+        const int frame = frame_ranges.size() - 1;
+
+        if (frame == target_frame) {
+            add_call(current_call, frame_calls);
+        } else if (frame < target_frame) {
+            if (!call_is_swap(current_call)) {
+                pre_frame_call_count += 1;
+            }
+
+            if (reset_loop_state && call_index > 0 && call_is_state_changer(current_call)) {
+                pre_frame_state_names.insert(current_call->Name());
+            }
+        }
+
+        if (range_selected) {
+            if (call_index >= start_call_index && call_index <= end_call_index) {
+                add_call(current_call, range_calls);
+            } else if (call_index < start_call_index - 1 && !call_is_swap(current_call)) {
+                pre_range_call_count += 1;
+            }
+        }
 
         if (call_is_swap(current_call) && ((long)current_call->mTid == main_thread_ID)) {
             frame_ranges[frame_ranges.size() - 1].second = call_index;
@@ -79,12 +108,23 @@ void TraceLooper::load() {
     }
 
     frame_ranges[frame_ranges.size() - 1].second = call_index;
+    num_calls = call_index;
 
     trace_file.Close();
 
     ILOG("Num frames in trace: " + std::to_string(frame_ranges.size()));
 
-    ILOG("Num calls in trace: " + std::to_string(calls.size()));
+    ILOG("Num calls in trace: " + std::to_string(num_calls));
+
+    if (bool_args["loop_frame_selected"] && target_frame >= static_cast<int>(frame_ranges.size())) {
+        ELOG("Target frame " + std::to_string(target_frame) + " is past the last frame of the trace");
+        exit(1);
+    }
+
+    if (range_selected && end_call_index >= num_calls) {
+        ELOG("Range loop end " + std::to_string(end_call_index) + " is past the last call of the trace");
+        exit(1);
+    }
 }
 
 
@@ -117,7 +157,7 @@ void TraceLooper::get_frame_loop_header(std::string& out_string, const std::stri
     common::TraceFileTM trace_file(str_args["trace_file"].c_str(), false);
     Json::Value json_header = trace_file.mpInFileRA->getJSONHeader();
 
-    json_header["callCnt"] = static_cast<unsigned int>(frame_loop_call_writelist.size());
+    json_header["callCnt"] = static_cast<unsigned int>(frame_loop_call_count);
     json_header["frameCnt"] = int_args["num_loops"];
 
     if (!(json_header.isMember("conversions") && json_header["conversions"].isArray())) {
@@ -153,7 +193,7 @@ void TraceLooper::get_range_loop_header(std::string& out_string, const std::stri
     common::TraceFileTM trace_file(str_args["trace_file"].c_str(), false);
     Json::Value json_header = trace_file.mpInFileRA->getJSONHeader();
 
-    json_header["callCnt"] = static_cast<unsigned int>(range_loop_call_writelist.size());
+    json_header["callCnt"] = static_cast<unsigned int>(range_loop_call_count);
     json_header["frameCnt"] = 0;
 
     if (!(json_header.isMember("conversions") && json_header["conversions"].isArray())) {
@@ -189,24 +229,84 @@ void TraceLooper::get_range_loop_header(std::string& out_string, const std::stri
 
 
 std::string TraceLooper::calc_trace_md5() {
-    std::ifstream infile(str_args["trace_file"].c_str(), std::ios::binary | std::ios::ate);
-    std::streamsize size = infile.tellg();
-    infile.seekg(0, std::ios::beg);
-
-    std::vector<char> data(size);
-    if (infile.read(data.data(), size)) {
-        common::MD5Digest trace_mdh = common::MD5Digest(reinterpret_cast<void*>(data.data()), data.size());
-        return trace_mdh.text_lower();
+    std::ifstream infile(str_args["trace_file"].c_str(), std::ios::binary);
+
+    if (!infile) {
+        return "(failed to generate MD5)";
+    }
+
+    common::MD5Hasher hasher;
+    hasher.init();
+
+    std::vector<char> data(4 * 1024 * 1024);
+    while (infile.read(data.data(), data.size()) || infile.gcount() > 0) {
+        hasher.append(data.data(), infile.gcount());
+    }
+
+    if (infile.bad()) {
+        return "(failed to generate MD5)";
+    }
+
+    common::MD5Digest trace_mdh;
+    hasher.finish(trace_mdh);
+    return trace_mdh.text_lower();
+}
+
+
+void TraceLooper::write_calls(common::OutFile& outfile, const std::vector<common::CallTM*>& calls) {
+    for (auto call : calls) {
+        call->Serialize(outfile);
+    }
+}
+
+
+void TraceLooper::write_looped_trace(
+    common::OutFile& outfile,
+    int pre_end_index,
+    const std::vector<common::CallTM*>& reset_calls,
+    const std::vector<common::CallTM*>& loop_calls,
+    const std::vector<common::CallTM*>& last_calls,
+    int tail_start_index
+) {
+    common::TraceFileTM trace_file(str_args["trace_file"].c_str(), false);
+
+    common::CallTM* current_call = trace_file.NextCall();
+    int call_index = 0;
+
+    for (; current_call && call_index < pre_end_index; ++call_index) {
+        if (!call_is_swap(current_call)) {
+            current_call->Serialize(outfile);
+        }
+
+        current_call = trace_file.NextCall();
     }
 
-    return "(failed to generate MD5)";
+    for (int i = 0; i < int_args["num_loops"]; ++i) {
+        write_calls(outfile, reset_calls);
+        write_calls(outfile, loop_calls);
+    }
+
+    write_calls(outfile, reset_calls);
+    write_calls(outfile, last_calls);
+
+    if (bool_args["include_tail"]) {
+        for (; current_call; ++call_index) {
+            if (call_index >= tail_start_index) {
+                current_call->Serialize(outfile);
+            }
+
+            current_call = trace_file.NextCall();
+        }
+    }
+
+    trace_file.Close();
 }
 
 
 void TraceLooper::save() {
     std::string trace_md5 = calc_trace_md5();
 
-    if (frame_loop_call_writelist.size() > 0) {
+    if (bool_args["loop_frame_selected"]) {
         build_output_file_path();
 
         ILOG("Saving output frame looping trace as: " + str_args["output_filepath"]);
@@ -218,20 +318,20 @@ void TraceLooper::save() {
 
         outfile.WriteHeader(string_header.c_str(), string_header.size());
 
-        for (auto call : frame_loop_call_writelist) {
-            const unsigned int WRITE_BUF_LEN = 100 * 1024 * 1024;
-            static char buffer[WRITE_BUF_LEN];
-            char *dest = buffer;
-            dest = call->Serialize(dest);
-            outfile.Write(buffer, dest - buffer);
-        }
+        write_looped_trace(
+            outfile,
+            frame_ranges[int_args["target_frame"]].first,
+            prestate_calls,
+            loop_frame_calls,
+            frame_calls,
+            frame_ranges[int_args["target_frame"]].first + frame_calls.size());
 
         outfile.Close();
 
         OKLOG("Frame looping trace saved as: " + str_args["output_filepath"]);
     }
 
-    if (range_loop_call_writelist.size() > 0) {
+    if (bool_args["loop_range_selected"]) {
         build_output_file_path_range_trace();
 
         ILOG("Saving output range looping trace as: " + str_args["output_filepath_range_trace"]);
@@ -243,13 +343,13 @@ void TraceLooper::save() {
 
         range_outfile.WriteHeader(string_header.c_str(), string_header.size());
 
-        for (auto call : range_loop_call_writelist) {
-            const unsigned int WRITE_BUF_LEN = 100 * 1024 * 1024;
-            static char buffer[WRITE_BUF_LEN];
-            char *dest = buffer;
-            dest = call->Serialize(dest);
-            range_outfile.Write(buffer, dest - buffer);
-        }
+        write_looped_trace(
+            range_outfile,
+            int_args["start_call_index"] - 1,
+            std::vector<common::CallTM*>(),
+            range_calls,
+            range_calls,
+            int_args["end_call_index"] + 1);
 
         range_outfile.Close();
 
@@ -283,7 +383,7 @@ void TraceLooper::print_trace_info() {
 }
 
 
-void TraceLooper::add_call(const common::CallTM* incall) {
+void TraceLooper::add_call(const common::CallTM* incall, std::vector<common::CallTM*>& calls) {
     common::CallTM* outcall = new common::CallTM(incall->mCallName.c_str());
 
     outcall->mReadPos = incall->mReadPos;
@@ -326,7 +426,7 @@ void TraceLooper::build_output_file_path() {
         trace_tokens.push_back("rstate");
     }
 
-    if (bool_args["clean_trace"]) {
+    if (bool_args["clean_calls"]) {
         trace_tokens.push_back("clean");
     }
 
@@ -378,13 +478,12 @@ bool TraceLooper::call_is_swap(const common::CallTM* call) {
 void TraceLooper::extract_pre_frame_state_calls() {
     ILOG("Extracting preframe state...");
 
-    int frame_start_index = frame_ranges[int_args["target_frame"]].first;
-    int frame_end_index = frame_ranges[int_args["target_frame"]].second;
+    int frame_end_index = frame_calls.size() - 1;
 
-    int curr_index = frame_start_index;
+    int curr_index = 0;
 
-    for (int i = frame_start_index; i <= frame_end_index; ++i) {
-        if (call_is_draw(calls[i])) {
+    for (int i = 0; i <= frame_end_index; ++i) {
+        if (call_is_draw(frame_calls[i])) {
             curr_index = i + 1;
             break;
         }
@@ -395,36 +494,33 @@ void TraceLooper::extract_pre_frame_state_calls() {
         return;
     }
 
-    bool found_pre_frame_call = false;
+    // A state call is reset if its nearest earlier call of the same name is before the frame
+    std::unordered_set<std::string> frame_state_names;
+
+    for (int i = 0; i < curr_index; ++i) {
+        frame_state_names.insert(frame_calls[i]->Name());
+    }
 
     for (int i = curr_index; i <= frame_end_index; ++i) {
-        if (!call_is_state_changer(calls[i])) {
-            continue;
-        }
+        const std::string& name = frame_calls[i]->Name();
 
-        for (int y = i - 1; y > 0; --y) {
-            if (!call_is_state_changer(calls[i])) {
-                continue;
-            } else if (calls[i]->Name() == calls[y]->Name()) {
-                if (y >= frame_start_index) {
-                    found_pre_frame_call = true;
-                    break;
-                } else {
-                    prestate_calls.push_back(calls[i]);
-                    pre_state_calls.push_back(calls[i]->Name());
-                    found_pre_frame_call = true;
-                    break;
-                }
-            }
+        if (!call_is_state_changer(frame_calls[i])) {
+            frame_state_names.insert(name);
+            continue;
         }
 
-        if (!found_pre_frame_call) {
-            WLOG("Failed to find pre frame setup for state call: " + calls[i]->Name() \
+        if (frame_state_names.count(name) > 0) {
+            // set up again within the frame
+        } else if (pre_frame_state_names.count(name) > 0) {
+            prestate_calls.push_back(frame_calls[i]);
+            pre_state_calls.push_back(name);
+        } else {
+            WLOG("Failed to find pre frame setup for state call: " + name \
                 + ", trace possibly relies on default state." \
                 + " Update the trace_looper to reflect this case!");
-        } else {
-            found_pre_frame_call = false;
         }
+
+        frame_state_names.insert(name);
     }
 
     ILOG("Extracted: " + std::to_string(prestate_calls.size()) + " pre state calls");
@@ -435,87 +531,33 @@ void TraceLooper::add_frame_loop_calls(int target_frame, int num_loops, bool res
     ILOG("Adding frame loop calls...");
 
     int start_call_index = frame_ranges[target_frame].first;
-    int end_call_index = frame_ranges[target_frame].second;
+    int end_call_index = start_call_index + frame_calls.size() - 1;
 
     ILOG("Looping call range: " + std::to_string(start_call_index) + "-" + std::to_string(end_call_index) + " (frame number " + std::to_string(target_frame) + ")");
 
-    std::vector<common::CallTM*> pre_frame_calls;
-
-    if (target_frame > 0) {
-        pre_frame_calls.reserve(frame_ranges[target_frame - 1].second);
-
-        for (int i = 0; i < frame_ranges[target_frame - 1].second; ++i) {
-            if (!call_is_swap(calls[i])) {
-                pre_frame_calls.push_back(calls[i]);
-            }
-        }
-    }
-
-    ILOG("Number of pre frame calls: " + std::to_string(pre_frame_calls.size()));
-
-    std::vector<common::CallTM*> frame_calls;
-    frame_calls.reserve(end_call_index - start_call_index + 1);
-
-    for (int i = start_call_index; i <= end_call_index; ++i) {
-        frame_calls.push_back(calls[i]);
-    }
+    ILOG("Number of pre frame calls: " + std::to_string(pre_frame_call_count));
 
     ILOG("Number of target frame calls: " + std::to_string(frame_calls.size()));
 
-    std::vector<common::CallTM*> cleaned_frame_calls;
-
-    if (bool_args["clean_trace"]) {
-        clean_loop_frame_calls(&frame_calls, &cleaned_frame_calls);
+    if (bool_args["clean_calls"]) {
+        clean_loop_frame_calls(&frame_calls, &loop_frame_calls);
     } else {
-        cleaned_frame_calls = frame_calls;
+        loop_frame_calls = frame_calls;
     }
 
-    int total_calls = pre_frame_calls.size() + cleaned_frame_calls.size() * num_loops + frame_calls.size();
+    int reset_calls = reset_loop_state ? prestate_calls.size() : 0;
 
-    frame_loop_call_writelist.reserve(total_calls);
-
-    frame_loop_call_writelist.insert(
-        frame_loop_call_writelist.end(),
-        pre_frame_calls.begin(),
-        pre_frame_calls.end());
-
-    for (int i = 0; i < num_loops; ++i) {
-        if (bool_args["reset_loop_state"]) {
-            frame_loop_call_writelist.insert(
-                frame_loop_call_writelist.end(),
-                prestate_calls.begin(),
-                prestate_calls.end());
-        }
-
-        frame_loop_call_writelist.insert(
-            frame_loop_call_writelist.end(),
-            cleaned_frame_calls.begin(),
-            cleaned_frame_calls.end());
-    }
-
-    if (bool_args["reset_loop_state"]) {
-        frame_loop_call_writelist.insert(
-            frame_loop_call_writelist.end(),
-            prestate_calls.begin(),
-            prestate_calls.end());
-    }
-
-    frame_loop_call_writelist.insert(
-        frame_loop_call_writelist.end(),
-        frame_calls.begin(),
-        frame_calls.end());
+    frame_loop_call_count = pre_frame_call_count + (reset_calls + loop_frame_calls.size()) * num_loops + reset_calls + frame_calls.size();
 
     if (bool_args["include_tail"]) {
-        ILOG("Adding trace tail...");
+        int tail_calls = num_calls - end_call_index - 1;
 
-        for (size_t i = end_call_index + 1; i < calls.size(); ++i) {
-            frame_loop_call_writelist.push_back(calls[i]);
-        }
+        frame_loop_call_count += tail_calls;
 
-        ILOG("Tail calls added: " + std::to_string(frame_loop_call_writelist.size()));
+        ILOG("Tail calls added: " + std::to_string(tail_calls));
     }
 
-    ILOG("Total number of calls in frame looping trace queued for writeout: " + std::to_string(frame_loop_call_writelist.size()));
+    ILOG("Total number of calls in frame looping trace queued for writeout: " + std::to_string(frame_loop_call_count));
 }
 
 
@@ -523,61 +565,21 @@ void TraceLooper::add_range_loop_calls(int start_call_index, int end_call_index,
     ILOG("Adding range loop calls...");
     ILOG("Looping call range: " + std::to_string(start_call_index) + "-" + std::to_string(end_call_index));
 
-    std::vector<common::CallTM*> pre_range_calls;
-
-    if (start_call_index > 0) {
-        pre_range_calls.reserve(start_call_index);
-
-        for (int i = 0; i < start_call_index - 1; ++i) {
-            if (!call_is_swap(calls[i])) {
-                pre_range_calls.push_back(calls[i]);
-            }
-        }
-    }
-
-    ILOG("Number of pre range calls: " + std::to_string(pre_range_calls.size()));
-
-    std::vector<common::CallTM*> range_calls;
-    range_calls.reserve(end_call_index - start_call_index + 1);
-
-    for (int i = start_call_index; i <= end_call_index; ++i) {
-        range_calls.push_back(calls[i]);
-    }
+    ILOG("Number of pre range calls: " + std::to_string(pre_range_call_count));
 
     ILOG("Number of target range calls: " + std::to_string(range_calls.size()));
 
-    int total_calls = pre_range_calls.size() + range_calls.size() * num_loops + range_calls.size();
-
-    range_loop_call_writelist.reserve(total_calls);
-
-    range_loop_call_writelist.insert(
-        range_loop_call_writelist.end(),
-        pre_range_calls.begin(),
-        pre_range_calls.end());
-
-    for (int i = 0; i < num_loops; ++i) {
-        range_loop_call_writelist.insert(
-            range_loop_call_writelist.end(),
-            range_calls.begin(),
-            range_calls.end());
-    }
-
-    range_loop_call_writelist.insert(
-        range_loop_call_writelist.end(),
-        range_calls.begin(),
-        range_calls.end());
+    range_loop_call_count = pre_range_call_count + range_calls.size() * num_loops + range_calls.size();
 
     if (bool_args["include_tail"]) {
-        ILOG("Adding trace tail...");
+        int tail_calls = num_calls - end_call_index - 1;
 
-        for (size_t i = end_call_index + 1; i < calls.size(); ++i) {
-            range_loop_call_writelist.push_back(calls[i]);
-        }
+        range_loop_call_count += tail_calls;
 
-        ILOG("Tail calls added: " + std::to_string(range_loop_call_writelist.size()));
+        ILOG("Tail calls added: " + std::to_string(tail_calls));
     }
 
-    ILOG("Total number of calls in range looping trace queued for writeout: " + std::to_string(range_loop_call_writelist.size()));
+    ILOG("Total number of calls in range looping trace queued for writeout: " + std::to_string(range_loop_call_count));
 }
 
 
@@ -605,7 +607,7 @@ void TraceLooper::clean_loop_frame_calls(
 
     if (last_draw_index == -1) {
         ELOG("No draws in frame, not cleaning");
-        clean_calls = raw_calls;
+        *clean_calls = *raw_calls;
         return;
     }
 
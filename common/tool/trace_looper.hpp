@@ -51,7 +51,7 @@ class TraceLooper {
     void process();
     void save();
 
-    void add_call(const common::CallTM* incall);
+    void add_call(const common::CallTM* incall, std::vector<common::CallTM*>& calls);
     void add_frame_loop_calls(int target_frame, int num_loops, bool reset_loop_state);
     void add_range_loop_calls(int start_call, int end_call, int num_loops);
 
@@ -78,10 +78,20 @@ class TraceLooper {
     std::unordered_map<std::string, bool> bool_args;
 
     std::vector<std::pair<int, int>> frame_ranges;
-    std::vector<common::CallTM*> calls;
+    int num_calls = 0;
+
+    // Only the target frame and call range are held in memory, everything before and after
+    // them is streamed from the input trace again when saving
+    std::vector<common::CallTM*> frame_calls;
+    std::vector<common::CallTM*> range_calls;
+    std::vector<common::CallTM*> loop_frame_calls;
     std::vector<common::CallTM*> prestate_calls;
-    std::vector<common::CallTM*> frame_loop_call_writelist;
-    std::vector<common::CallTM*> range_loop_call_writelist;
+    std::unordered_set<std::string> pre_frame_state_names;
+
+    int pre_frame_call_count = 0;
+    int pre_range_call_count = 0;
+    int frame_loop_call_count = 0;
+    int range_loop_call_count = 0;
 
     std::vector<std::string> cleaned_calls;
     std::vector<std::string> pre_state_calls;
@@ -104,6 +114,14 @@ class TraceLooper {
     bool args_are_valid();
 
     std::string calc_trace_md5();
+    void write_calls(common::OutFile& outfile, const std::vector<common::CallTM*>& calls);
+    void write_looped_trace(
+        common::OutFile& outfile,
+        int pre_end_index,
+        const std::vector<common::CallTM*>& reset_calls,
+        const std::vector<common::CallTM*>& loop_calls,
+        const std::vector<common::CallTM*>& last_calls,
+        int tail_start_index);
     void get_range_loop_header(std::string& out_string, const std::string& md5_string);
     void get_frame_loop_header(std::string& out_string, const std::string& md5_string);
 };
@@ -161,6 +161,13 @@ LOCAL_SRC_FILES     := \
     common/api_info.cpp \
     common/in_file_mt.cpp \
     common/in_file_ra.cpp \
+    common/blob_store.cpp \
+    common/chunk_codec.cpp \
+    common/file_writer.cpp \
+    common/json_stream.cpp \
+    common/state_log.cpp \
+    common/trace_index.cpp \
+    common/thread_pool.cpp \
     common/in_file.cpp \
     common/out_file.cpp \
     common/memoryinfo.cpp \
@@ -169,6 +176,8 @@ LOCAL_SRC_FILES     := \
     common/image_bmp.cpp \
     common/image_png.cpp \
     common/image_pnm.cpp \
+    common/image_qoi.cpp \
+    common/image_hash.cpp \
     common/base64.cpp \
     common/gl_extension_supported.cpp \
     common/library.cpp
@@ -228,6 +237,35 @@ LOCAL_SRC_FILES     := \
     dispatch/eglproc_retrace.cpp \
     dispatch/eglproc_auto.cpp \
     retracer/retracer.cpp \
+    retracer/shader_cache.cpp \
+    retracer/snapshot_queue.cpp \
+    retracer/thumbnail_writer.cpp \
+    retracer/buffer_dump_queue.cpp \
+    retracer/graphic_buffer_pool.cpp \
+    retracer/snapshot_compare.cpp \
+    retracer/snapshot_hash.cpp \
+    retracer/gpu_timer.cpp \
+    retracer/counter_sampler.cpp \
+    retracer/timeline.cpp \
+    retracer/call_stats.cpp \
+    retracer/loop_stats.cpp \
+    retracer/frame_pacer.cpp \
+    retracer/present_feedback.cpp \
+    retracer/present_timer.cpp \
+    retracer/upload_ring.cpp \
+    retracer/state_filter.cpp \
+    retracer/state_shadow.cpp \
+    retracer/uniform_batch.cpp \
+    retracer/memory_timeline.cpp \
+    retracer/thread_placement.cpp \
+    retracer/frame_limiter.cpp \
+    retracer/shader_stats.cpp \
+    retracer/frame_phases.cpp \
+    retracer/perf_sampler.cpp \
+    retracer/loop_checkpoint.cpp \
+    retracer/fast_seek.cpp \
+    retracer/invalidation_injector.cpp \
+    retracer/texture_transcoder.cpp \
     retracer/retrace_api.cpp \
     retracer/retrace_gles_auto.cpp \
     retracer/retrace_egl.cpp \
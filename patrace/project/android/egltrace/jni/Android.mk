@@ -113,11 +113,20 @@ LOCAL_SRC_FILES     := \
     common/api_info.cpp \
     common/in_file_mt.cpp \
     common/in_file_ra.cpp \
+    common/blob_store.cpp \
+    common/chunk_codec.cpp \
+    common/file_writer.cpp \
+    common/state_log.cpp \
+    common/base64.cpp \
+    common/trace_index.cpp \
+    common/thread_pool.cpp \
     common/out_file.cpp \
     common/image.cpp \
     common/image_bmp.cpp \
     common/image_png.cpp \
     common/image_pnm.cpp \
+    common/image_qoi.cpp \
+    common/image_hash.cpp \
     common/gl_extension_supported.cpp \
     common/library.cpp
 
@@ -175,9 +184,14 @@ LOCAL_SRC_FILES 	:= \
     tracer/egltrace.cpp \
     tracer/egltrace_auto.cpp \
     tracer/tracerparams.cpp \
+    tracer/overhead.cpp \
+    tracer/flight_recorder.cpp \
     tracer/interactivecmd.cpp \
     tracer/glstate_images.cpp \
     tracer/path.cpp \
+    tracer/program_cache.cpp \
+    tracer/write_tracker.cpp \
+    retracer/shader_cache.cpp \
     helper/paramsize.cpp \
     dispatch/eglproc_trace.cpp \
     dispatch/eglproc_auto.cpp \
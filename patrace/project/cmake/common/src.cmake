@@ -15,11 +15,21 @@ set(SRC_COMMON
     ${SRC_ROOT}/common/in_file.cpp
     ${SRC_ROOT}/common/in_file_mt.cpp
     ${SRC_ROOT}/common/in_file_ra.cpp
+    ${SRC_ROOT}/common/blob_store.cpp
+    ${SRC_ROOT}/common/chunk_codec.cpp
+    ${SRC_ROOT}/common/file_writer.cpp
+    ${SRC_ROOT}/common/json_stream.cpp
+    ${SRC_ROOT}/common/state_log.cpp
+    ${SRC_ROOT}/common/trace_index.cpp
+    ${SRC_ROOT}/common/trace_stats.cpp
+    ${SRC_ROOT}/common/thread_pool.cpp
     ${SRC_ROOT}/common/out_file.cpp
     ${SRC_ROOT}/common/image.cpp
     ${SRC_ROOT}/common/image_png.cpp
     ${SRC_ROOT}/common/image_bmp.cpp
     ${SRC_ROOT}/common/image_pnm.cpp
+    ${SRC_ROOT}/common/image_qoi.cpp
+    ${SRC_ROOT}/common/image_hash.cpp
     ${SRC_ROOT}/common/base64.cpp
     ${SRC_ROOT}/common/library.cpp
     ${SRC_ROOT}/common/gl_extension_supported.cpp
@@ -28,9 +28,14 @@ set(SRC_EGLTRACE
     ${SRC_ROOT}/tracer/egltrace.cpp
     ${SRC_ROOT}/tracer/egltrace_auto.cpp
     ${SRC_ROOT}/tracer/tracerparams.cpp
+    ${SRC_ROOT}/tracer/overhead.cpp
+    ${SRC_ROOT}/tracer/flight_recorder.cpp
     ${SRC_ROOT}/tracer/interactivecmd.cpp
     ${SRC_ROOT}/tracer/glstate_images.cpp
     ${SRC_ROOT}/tracer/path.cpp
+    ${SRC_ROOT}/tracer/program_cache.cpp
+    ${SRC_ROOT}/tracer/write_tracker.cpp
+    ${SRC_ROOT}/retracer/shader_cache.cpp
 )
 
 set_source_files_properties (
@@ -14,6 +14,35 @@ set(SRC_FASTFORWARD
     ${SRC_ROOT}/dispatch/eglproc_retrace.cpp
     ${SRC_ROOT}/fastforwarder/fastforwarder.cpp
     ${SRC_ROOT}/retracer/retracer.cpp
+    ${SRC_ROOT}/retracer/shader_cache.cpp
+    ${SRC_ROOT}/retracer/snapshot_queue.cpp
+    ${SRC_ROOT}/retracer/thumbnail_writer.cpp
+    ${SRC_ROOT}/retracer/buffer_dump_queue.cpp
+    ${SRC_ROOT}/retracer/graphic_buffer_pool.cpp
+    ${SRC_ROOT}/retracer/snapshot_compare.cpp
+    ${SRC_ROOT}/retracer/snapshot_hash.cpp
+    ${SRC_ROOT}/retracer/gpu_timer.cpp
+    ${SRC_ROOT}/retracer/counter_sampler.cpp
+    ${SRC_ROOT}/retracer/timeline.cpp
+    ${SRC_ROOT}/retracer/call_stats.cpp
+    ${SRC_ROOT}/retracer/loop_stats.cpp
+    ${SRC_ROOT}/retracer/frame_pacer.cpp
+    ${SRC_ROOT}/retracer/present_feedback.cpp
+    ${SRC_ROOT}/retracer/present_timer.cpp
+    ${SRC_ROOT}/retracer/upload_ring.cpp
+    ${SRC_ROOT}/retracer/state_filter.cpp
+    ${SRC_ROOT}/retracer/state_shadow.cpp
+    ${SRC_ROOT}/retracer/uniform_batch.cpp
+    ${SRC_ROOT}/retracer/memory_timeline.cpp
+    ${SRC_ROOT}/retracer/thread_placement.cpp
+    ${SRC_ROOT}/retracer/frame_limiter.cpp
+    ${SRC_ROOT}/retracer/shader_stats.cpp
+    ${SRC_ROOT}/retracer/frame_phases.cpp
+    ${SRC_ROOT}/retracer/perf_sampler.cpp
+    ${SRC_ROOT}/retracer/loop_checkpoint.cpp
+    ${SRC_ROOT}/retracer/fast_seek.cpp
+    ${SRC_ROOT}/retracer/invalidation_injector.cpp
+    ${SRC_ROOT}/retracer/texture_transcoder.cpp
     ${SRC_ROOT}/retracer/retrace_api.cpp
     ${SRC_ROOT}/retracer/retrace_gles_auto.cpp
     ${SRC_ROOT}/retracer/retrace_egl.cpp
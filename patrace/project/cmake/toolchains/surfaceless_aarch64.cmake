@@ -0,0 +1,8 @@
+SET(CMAKE_SYSTEM_NAME Linux)
+
+SET(CMAKE_C_COMPILER aarch64-linux-gnu-gcc)
+SET(CMAKE_CXX_COMPILER aarch64-linux-gnu-g++)
+SET(WINDOWSYSTEM surfaceless)
+SET(ARCH aarch64)
+
+set(CC_HOST "aarch64-linux-gnu")
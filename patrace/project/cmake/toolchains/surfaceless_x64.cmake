@@ -0,0 +1,9 @@
+SET(CMAKE_SYSTEM_NAME Linux)
+SET(WINDOWSYSTEM surfaceless)
+SET(ARCH x64)
+
+SET(ENABLE_TOOLS TRUE)
+SET(ENABLE_PYTHON_TOOLS FALSE)
+SET(ENABLE_TESTS FALSE)
+
+set(CC_CFLAGS "-m64")
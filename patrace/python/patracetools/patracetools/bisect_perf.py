@@ -0,0 +1,285 @@
+#!/usr/bin/env python2
+"""
+Narrows a performance regression between two setups, such as two driver
+versions, down to the frames, render passes, draws and functions that got
+slower, instead of bisecting frame ranges by hand.
+
+First the whole trace is replayed on both setups with -perframe, or the
+frame times are read from result files of earlier runs, which may also have
+been made with -drawtime. Frames where the candidate is slower than the
+baseline by more than the threshold, after a running median over a few frames
+to leave out single slow frames, are put together into regions. The regions
+that lost the most time are then replayed again on both setups from
+fastforward traces that start at them, as pat-shard-replay does, with
+-drawtime and -callstats. Their render passes and draws are matched by their
+order in each frame, and the ones that lost the most time are listed in
+report.json, together with the functions whose CPU time grew the most.
+
+By default each setup is replayed with paretrace on this machine.
+--baseline-command and --candidate-command replace the paretrace command
+line, with {parameters}, {result} and {dir} filled in, to run it on another
+device or with another driver. callstats.csv must end up in {dir}.
+"""
+from __future__ import print_function
+import argparse
+import csv
+import json
+import os
+import subprocess
+import sys
+
+import headerparser
+import shard_replay
+
+SETUPS = ('baseline', 'candidate')
+
+
+def run(cmd, log, cwd):
+    with open(log, 'a') as f:
+        f.write(' '.join(cmd) + '\n')
+        f.flush()
+        return subprocess.call(cmd, stdout=f, stderr=subprocess.STDOUT, cwd=cwd)
+
+
+def replay(setup, params, directory, args):
+    """ Replay with the given -jsonParameters on one setup, and return its result file, or None """
+    if not os.path.exists(directory):
+        os.makedirs(directory)
+    param_file = os.path.join(directory, 'parameters.json')
+    with open(param_file, 'w') as f:
+        json.dump(params, f, indent=2, sort_keys=True)
+    result = os.path.join(directory, 'result.json')
+    command = getattr(args, setup + '_command')
+    if command:
+        cmd = command.format(parameters=param_file, result=result, dir=directory).split()
+    else:
+        cmd = [args.retracer, '-jsonParameters', param_file, result, '.']
+    if run(cmd, os.path.join(directory, 'retrace.log'), directory) != 0 or not os.path.exists(result):
+        print('Replay on the {0} failed, see {1}'.format(setup, directory), file=sys.stderr)
+        return None
+    return result
+
+
+def load_result(filename):
+    with open(filename) as f:
+        root = json.load(f)
+    # Result files hold a list of results, one per run
+    results = root.get('result', [])
+    return results[0] if results else root
+
+
+def frame_times(result, offset=0):
+    """ Seconds of each frame, by original frame number, as analyze_trace -c reads them """
+    seconds = {}
+    if 'gpu_timing' in result:
+        for p in result['gpu_timing'].get('renderpasses', []):
+            if 'time' in p:
+                frame = p['frame'] + offset
+                seconds[frame] = seconds.get(frame, 0.0) + p['time']
+    elif 'frame_phases' in result:
+        phases = result['frame_phases']
+        frames = phases.get('frame', [])
+        for name, values in phases.items():
+            if name == 'frame':
+                continue
+            for frame, value in zip(frames, values):
+                seconds[frame + offset] = seconds.get(frame + offset, 0.0) + value
+    return seconds
+
+
+def median(values):
+    values = sorted(values)
+    return values[len(values) // 2]
+
+
+def find_regions(base, cand, window, threshold, count):
+    """ Ranges [begin, end) of frames that are slower on the candidate, the count that lost the most time first """
+    frames = sorted(set(base) & set(cand))
+    half = window // 2
+    slow = []
+    for i, frame in enumerate(frames):
+        near = frames[max(0, i - half):i + half + 1]
+        ratio = median([cand[f] / base[f] for f in near if base[f] > 0.0] or [1.0])
+        if ratio > 1.0 + threshold:
+            slow.append(frame)
+
+    regions = []
+    for frame in slow:
+        if regions and frame - regions[-1][1] <= window:
+            regions[-1][1] = frame + 1  # close enough to be one region
+        else:
+            regions.append([frame, frame + 1])
+    ranked = []
+    for begin, end in regions:
+        lost = sum(cand[f] - base[f] for f in frames if begin <= f < end)
+        ranked.append({'begin': begin, 'end': end, 'frames': end - begin, 'lost_time': lost,
+                       'baseline_time': sum(base[f] for f in frames if begin <= f < end),
+                       'candidate_time': sum(cand[f] for f in frames if begin <= f < end)})
+    ranked.sort(key=lambda r: -r['lost_time'])
+    return ranked[:count]
+
+
+def by_order(items, offset):
+    """ Key the render passes or draws of gpu_timing by original frame and their order in it """
+    keyed = {}
+    counts = {}
+    for item in items:
+        frame = item['frame'] + offset
+        index = counts.get(frame, 0)
+        counts[frame] = index + 1
+        keyed[(frame, index)] = item
+    return keyed
+
+
+def compare_timing(base, cand, key, offset, top):
+    """ The render passes or draws that lost the most GPU time """
+    base_items = by_order(base.get('gpu_timing', {}).get(key, []), offset)
+    cand_items = by_order(cand.get('gpu_timing', {}).get(key, []), offset)
+    rows = []
+    for k in set(base_items) & set(cand_items):
+        b, c = base_items[k], cand_items[k]
+        if 'time' not in b or 'time' not in c:
+            continue
+        row = dict(c)
+        row.pop('time')
+        row['frame'] = k[0]
+        row['index_in_frame'] = k[1]
+        row['baseline_time'] = b['time']
+        row['candidate_time'] = c['time']
+        row['lost_time'] = c['time'] - b['time']
+        rows.append(row)
+    rows.sort(key=lambda r: -r['lost_time'])
+    return rows[:top]
+
+
+def load_callstats(filename):
+    """ Total nanoseconds spent in each function """
+    times = {}
+    if not os.path.exists(filename):
+        return times
+    with open(filename) as f:
+        for row in csv.DictReader(f):
+            try:
+                times[row['Function']] = int(row['Time'])
+            except (KeyError, ValueError):
+                pass
+    return times
+
+
+def compare_callstats(base_dir, cand_dir, top):
+    base = load_callstats(os.path.join(base_dir, 'callstats.csv'))
+    cand = load_callstats(os.path.join(cand_dir, 'callstats.csv'))
+    rows = [{'function': name, 'baseline_time': base[name] / 1e9, 'candidate_time': cand[name] / 1e9,
+             'lost_time': (cand[name] - base[name]) / 1e9} for name in set(base) & set(cand)]
+    rows.sort(key=lambda r: -r['lost_time'])
+    return rows[:top]
+
+
+def drill_down(index, region, args, base_params, outdir):
+    """ Replay one region on both setups from a fastforward trace, with draws and calls timed """
+    segment = shard_replay.Segment(index, region['begin'], region['end'], outdir)
+    segment.dir = os.path.join(outdir, 'region_{0:03d}'.format(index))
+    if not os.path.exists(segment.dir):
+        os.makedirs(segment.dir)
+    if not shard_replay.checkpoint(segment, args):
+        region['error'] = segment.error
+        return
+    params = dict(base_params)
+    params['file'] = segment.trace
+    params['frames'] = '{0}-{1}'.format(segment.begin - segment.offset, segment.end - segment.offset)
+    params['drawTime'] = True
+    params['callStats'] = True
+    results = {}
+    for setup in SETUPS:
+        result = replay(setup, params, os.path.join(segment.dir, setup), args)
+        if result is None:
+            region['error'] = 'replay on the {0} failed'.format(setup)
+            return
+        results[setup] = load_result(result)
+    base, cand = results['baseline'], results['candidate']
+    region['renderpasses'] = compare_timing(base, cand, 'renderpasses', segment.offset, args.top)
+    region['draws'] = compare_timing(base, cand, 'draws', segment.offset, args.top)
+    region['functions'] = compare_callstats(os.path.join(segment.dir, 'baseline'), os.path.join(segment.dir, 'candidate'), args.top)
+    region['trace'] = segment.trace
+    if not region['renderpasses']:
+        region['error'] = 'no draws were timed, the setups may lack timer queries'
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Find the frames, render passes, draws and functions that are slower on a candidate setup than on a baseline.')
+    parser.add_argument('trace', help='Path to the .pat trace file')
+    parser.add_argument('outdir', help='Directory for the results, fastforward traces and report')
+    parser.add_argument('--baseline', help='Result file of the baseline replayed with -perframe or -drawtime, instead of replaying it')
+    parser.add_argument('--candidate', help='Result file of the candidate replayed with -perframe or -drawtime, instead of replaying it')
+    parser.add_argument('--baseline-command', help='Replay command for the baseline, with {parameters}, {result} and {dir} filled in')
+    parser.add_argument('--candidate-command', help='Replay command for the candidate, with {parameters}, {result} and {dir} filled in')
+    parser.add_argument('--parameters', help='JSON file with the -jsonParameters options for every replay')
+    parser.add_argument('--first', type=int, default=1, help='First frame to compare, frame 0 is usually loading')
+    parser.add_argument('--threshold', type=float, default=5.0, help='Percentage that frames must be slower by to be a regression')
+    parser.add_argument('--window', type=int, default=5, help='Frames in the running median of the slowdown')
+    parser.add_argument('--regions', type=int, default=3, help='Number of slower regions to replay again in detail')
+    parser.add_argument('--top', type=int, default=20, help='Number of render passes, draws and functions to list per region')
+    parser.add_argument('--noscreen', action='store_true', help='Make the fastforward traces without a window')
+    parser.add_argument('--regenerate', action='store_true', help='Make the fastforward traces again even if they exist')
+    parser.add_argument('--fastforward', default='fastforward', help='Path to the fastforward binary')
+    parser.add_argument('--retracer', default='paretrace', help='Path to the paretrace binary')
+    args = parser.parse_args()
+
+    header = headerparser.read_json_header(args.trace)
+    frames = header.get('frameCnt', 0)
+    if frames <= args.first:
+        print('{0} has only {1} frames'.format(args.trace, frames), file=sys.stderr)
+        return 1
+
+    base_params = {}
+    if args.parameters:
+        with open(args.parameters) as f:
+            base_params = json.load(f)
+
+    outdir = os.path.abspath(args.outdir)
+    if not os.path.exists(outdir):
+        os.makedirs(outdir)
+    times = {}
+    for setup in SETUPS:
+        result = getattr(args, setup)
+        if not result:
+            params = dict(base_params)
+            params['file'] = os.path.abspath(args.trace)
+            params['frames'] = '{0}-{1}'.format(args.first, frames)
+            params['measurePerFrame'] = True
+            print('Replaying the whole trace on the {0}'.format(setup))
+            result = replay(setup, params, os.path.join(outdir, setup), args)
+            if result is None:
+                return 1
+        times[setup] = frame_times(load_result(result))
+        if not times[setup]:
+            print('{0} has no frame times, replay with -perframe or -drawtime'.format(result), file=sys.stderr)
+            return 1
+
+    base, cand = times['baseline'], times['candidate']
+    compared = sorted(f for f in set(base) & set(cand) if f >= args.first)
+    report = {
+        'frames': len(compared),
+        'baseline_time': sum(base[f] for f in compared),
+        'candidate_time': sum(cand[f] for f in compared),
+        'threshold': args.threshold,
+        'window': args.window,
+    }
+    regions = find_regions(dict((f, base[f]) for f in compared), dict((f, cand[f]) for f in compared),
+                           max(1, args.window), args.threshold / 100.0, args.regions)
+    for i, region in enumerate(regions):
+        print('Region {0}: frames {1}-{2} lost {3:.3f} s, replaying it in detail'.format(i, region['begin'], region['end'] - 1, region['lost_time']))
+        drill_down(i, region, args, base_params, outdir)
+        if 'error' in region:
+            print('Region {0}: {1}'.format(i, region['error']), file=sys.stderr)
+    report['regions'] = regions
+
+    filename = os.path.join(outdir, 'report.json')
+    with open(filename, 'w') as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+    print('Candidate took {0:.3f} s against {1:.3f} s over {2} frames, {3} slower regions, report in {4}'.format(
+        report['candidate_time'], report['baseline_time'], report['frames'], len(regions), filename))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
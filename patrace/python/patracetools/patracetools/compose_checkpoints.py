@@ -0,0 +1,101 @@
+#!/usr/bin/env python2
+
+from __future__ import print_function
+import argparse
+import datetime
+import json
+import os
+import sys
+
+try:
+    from patrace import InputFile, OutputFile
+except ImportError:
+    print('patrace (Python interface of PATrace SDK) is required.')
+
+import patracetools.version
+
+
+def fastforward_info(header):
+    """The info of the last fastforward conversion of a trace, or None"""
+    for conversion in reversed(header.get('conversions', [])):
+        if conversion.get('tool') == 'fastforward':
+            return conversion.get('info', {})
+    return None
+
+
+class Composer:
+    """Chains a fastforward trace and the deltas on it that fastforward --deltas wrote into
+    one trace that restores the state at the target frame of the last delta.
+
+    Each trace but the last is copied up to the first swap of its default thread, which is
+    the one right after its restore, and the last one is copied as it is. The calls of each
+    delta then carry on from where the restore of the one before left off, and its restore
+    only holds what changed since."""
+
+    def __init__(self, args):
+        self.args = args
+        self.num_calls = 0
+
+    def check(self, headers):
+        previous = None
+        for path, header in zip(self.args.files, headers):
+            info = fastforward_info(header)
+            if info is None:
+                raise ValueError('{f} is not a fastforward trace'.format(f=path))
+            if previous is None:
+                if 'deltaFrom' in info:
+                    raise ValueError('{f} is a delta on frame {d}, the chain has to start with a full fastforward trace'.format(
+                        f=path, d=info['deltaFrom']))
+            elif info.get('deltaFrom') != previous.get('originalFrame'):
+                raise ValueError('{f} is not a delta on frame {d}'.format(f=path, d=previous.get('originalFrame')))
+            previous = info
+
+    def run(self, output):
+        headers = []
+        for path in self.args.files:
+            with InputFile(path) as input:
+                headers.append(json.loads(input.jsonHeader))
+        self.check(headers)
+
+        header = headers[-1]
+        info = fastforward_info(header)
+        info.pop('deltaFrom', None)
+        info.pop('deltaOf', None)
+        header['conversions'].append({
+            'type': 'composeCheckpoints',
+            'timestamp': datetime.datetime.utcnow().isoformat(),
+            'patraceVersion': patracetools.version.version_full,
+            'input': [{'file': os.path.abspath(path)} for path in self.args.files],
+        })
+        output.jsonHeader = json.dumps(header)
+
+        for i, path in enumerate(self.args.files):
+            last = (i + 1 == len(self.args.files))
+            with InputFile(path) as input:
+                tid = json.loads(input.jsonHeader).get('defaultTid', 0)
+                for call in input.Calls():
+                    if not last and call.name == 'eglSwapBuffers' and call.thread_id == tid:
+                        break
+                    output.WriteCall(call)
+                    self.num_calls = self.num_calls + 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Chain a fastforward trace and the deltas on it written by fastforward --deltas into one fastforward trace')
+    parser.add_argument('files', nargs='+', help='The full fastforward trace followed by the deltas on it, in order of their target frames')
+    parser.add_argument('--output', default='trace_out.pat', help='Specifies the path to the output trace file')
+
+    args = parser.parse_args()
+    composer = Composer(args)
+
+    try:
+        with OutputFile(args.output) as output:
+            composer.run(output)
+    except ValueError as e:
+        print('Error: {e}'.format(e=e))
+        sys.exit(1)
+
+    print('Number of calls in trace {num}'.format(num=composer.num_calls))
+
+if __name__ == '__main__':
+    main()
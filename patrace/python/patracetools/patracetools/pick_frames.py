@@ -0,0 +1,222 @@
+#!/usr/bin/env python2
+"""
+Proposes frame ranges for benchmarks that are shorter than the whole trace
+but do the same work per frame. Frames are described by the per-frame
+statistics of analyze_trace -o <basename>, by the predicted frame times of
+analyze_trace -m or -c, if there are any, and optionally by the frame times
+that one paretrace -perframe or -drawtime run measured.
+
+A range matches when the mean of each of these per frame over the range is
+within the tolerance of the mean over all frames. The shortest matching
+contiguous range is proposed first. If there is none, frames are clustered
+by their workload, and one range is proposed for each cluster, to be run as
+separate benchmarks and weighted by the share of the frames in the cluster.
+"""
+from __future__ import print_function
+import argparse
+import csv
+import json
+import os
+import sys
+
+import headerparser
+
+# Columns of the per-frame CSV that the work of a frame is told by
+COLUMNS = ['Calls', 'Draw:Total', 'Vertices', 'Primitives', 'Clears', 'Compute', 'Framebuffers',
+           'Texture binding calls', 'Program binding calls', 'Uniform calls']
+
+
+def load_stats(basename, first_frame):
+    """ Per-frame statistics of analyze_trace, as a dict of column name to list of values by frame """
+    stats = {}
+    with open(basename + '.std.csv') as f:
+        rows = list(csv.DictReader(f))
+    for column in COLUMNS:
+        if rows and column in rows[0]:
+            stats[column] = [float(row[column]) for row in rows]
+    frames = [first_frame + int(row['Index']) for row in rows]
+    return frames, stats
+
+
+def load_cost(filename):
+    """ Predicted time of each frame in an analyze_trace cost report """
+    with open(filename) as f:
+        report = json.load(f)
+    return dict((v['frame'], v['predicted_time']) for v in report.get('frames', []))
+
+
+def load_measured(filename):
+    """ Measured time of each frame in a paretrace result file, as analyze_trace -c reads them """
+    with open(filename) as f:
+        root = json.load(f)
+    result = root['result'][0] if root.get('result') else root
+    times = {}
+    if 'gpu_timing' in result:
+        for rp in result['gpu_timing'].get('renderpasses', []):
+            if 'time' in rp:
+                times[rp['frame']] = times.get(rp['frame'], 0.0) + rp['time']
+    elif 'frame_phases' in result:
+        phases = result['frame_phases']
+        for name, column in phases.items():
+            if name == 'frame':
+                continue
+            for frame, t in zip(phases['frame'], column):
+                times[frame] = times.get(frame, 0.0) + t
+    return times
+
+
+def normalize(signature):
+    """ Scale every column to a mean of 1, dropping the ones that are always zero """
+    scaled = {}
+    for name, values in signature.items():
+        mean = sum(values) / float(len(values))
+        if mean > 0:
+            scaled[name] = [v / mean for v in values]
+    return scaled
+
+
+class Prefix(object):
+    """ Prefix sums of the normalized columns, for the mean of any range in constant time """
+    def __init__(self, columns):
+        self.sums = {}
+        for name, values in columns.items():
+            s = [0.0]
+            for v in values:
+                s.append(s[-1] + v)
+            self.sums[name] = s
+
+    def deviation(self, begin, end):
+        """ Largest relative difference of a column mean over [begin, end) from the mean of all frames """
+        n = float(end - begin)
+        return max(abs((s[end] - s[begin]) / n - 1.0) for s in self.sums.values())
+
+
+def shortest_range(columns, count, tolerance, min_frames, max_frames):
+    """ Shortest [begin, end) whose column means are all within tolerance, or None """
+    prefix = Prefix(columns)
+    for length in range(max(1, min_frames), min(max_frames, count) + 1):
+        best = None
+        for begin in range(0, count - length + 1):
+            d = prefix.deviation(begin, begin + length)
+            if d <= tolerance and (best is None or d < best[2]):
+                best = (begin, begin + length, d)
+        if best:
+            return best
+    return None
+
+
+def kmeans(columns, count, k, iterations=50):
+    """ Cluster frames by their normalized columns, returning the cluster of each frame """
+    names = sorted(columns.keys())
+    points = [[columns[name][i] for name in names] for i in range(count)]
+    # Seed with frames spread over the order of their total work, so that runs are repeatable
+    order = sorted(range(count), key=lambda i: sum(points[i]))
+    k = max(1, min(k, count))
+    centers = [list(points[order[(2 * j + 1) * count // (2 * k)]]) for j in range(k)]
+    labels = [0] * count
+    for _ in range(iterations):
+        changed = False
+        for i, p in enumerate(points):
+            best = min(range(k), key=lambda j: sum((a - b) ** 2 for a, b in zip(p, centers[j])))
+            if best != labels[i]:
+                labels[i] = best
+                changed = True
+        for j in range(k):
+            members = [points[i] for i in range(count) if labels[i] == j]
+            if members:
+                centers[j] = [sum(c) / float(len(members)) for c in zip(*members)]
+        if not changed:
+            break
+    return labels
+
+
+def cluster_ranges(columns, count, labels, min_frames):
+    """ One range per cluster: the window of mostly its frames whose mean is closest to the cluster's """
+    ranges = []
+    for cluster in sorted(set(labels)):
+        members = [i for i in range(count) if labels[i] == cluster]
+        share = len(members) / float(count)
+        mean = dict((name, sum(values[i] for i in members) / len(members)) for name, values in columns.items())
+        length = max(1, min(min_frames, len(members)))
+        best = None
+        for begin in range(0, count - length + 1):
+            inside = sum(1 for i in range(begin, begin + length) if labels[i] == cluster)
+            if inside < 0.9 * length:
+                continue
+            d = max(abs(sum(values[begin:begin + length]) / length - mean[name]) / mean[name]
+                    for name, values in columns.items() if mean[name] > 0) if mean else 0.0
+            if best is None or d < best[2]:
+                best = (begin, begin + length, d)
+        if best:
+            ranges.append({'cluster': cluster, 'begin': best[0], 'end': best[1], 'weight': share, 'deviation': best[2]})
+    return ranges
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Propose representative frame ranges for benchmarks from analyze_trace statistics.')
+    parser.add_argument('basename', help='Base name that analyze_trace -o wrote its output to')
+    parser.add_argument('--trace', help='Trace file, to check that the statistics cover all of its frames')
+    parser.add_argument('--first-frame', type=int, default=0, help='First frame that analyze_trace was run on, its -f')
+    parser.add_argument('--skip', type=int, default=1, help='Frames at the start to leave out, such as loading')
+    parser.add_argument('--cost', help='Cost report of analyze_trace -m or -c, by default <basename>_cost.json if it exists')
+    parser.add_argument('--result', help='paretrace result file with measured frame times, from -perframe or -drawtime')
+    parser.add_argument('-t', '--tolerance', type=float, default=0.05, help='Largest relative difference of any mean from that of all frames')
+    parser.add_argument('--min-frames', type=int, default=10, help='Shortest range to propose')
+    parser.add_argument('--max-frames', type=int, default=300, help='Longest contiguous range to consider before falling back to clusters')
+    parser.add_argument('-k', '--clusters', type=int, default=4, help='Number of workload clusters')
+    parser.add_argument('-o', '--output', help='Write the proposal as JSON to this file')
+    args = parser.parse_args()
+
+    frames, stats = load_stats(args.basename, args.first_frame)
+    cost = args.cost or (args.basename + '_cost.json')
+    if os.path.exists(cost):
+        predicted = load_cost(cost)
+        stats['predicted_time'] = [predicted.get(f, 0.0) for f in frames]
+    if args.result:
+        measured = load_measured(args.result)
+        missing = [f for f in frames if f not in measured]
+        if missing:
+            print('{0} has no times for {1} of the frames, leaving them out'.format(args.result, len(missing)), file=sys.stderr)
+        stats['measured_time'] = [measured.get(f, 0.0) for f in frames]
+    if args.trace:
+        total = headerparser.read_json_header(args.trace).get('frameCnt', 0)
+        if frames and frames[-1] + 1 < total:
+            print('The statistics end at frame {0} of {1}'.format(frames[-1], total), file=sys.stderr)
+
+    keep = [i for i in range(len(frames)) if frames[i] >= args.first_frame + args.skip
+            and ('measured_time' not in stats or stats['measured_time'][i] > 0)]
+    frames = [frames[i] for i in keep]
+    columns = normalize(dict((name, [values[i] for i in keep]) for name, values in stats.items()))
+    count = len(frames)
+    if count == 0 or not columns:
+        print('No frames with statistics to pick from', file=sys.stderr)
+        return 1
+
+    proposal = {'frames': count, 'first': frames[0], 'last': frames[-1], 'tolerance': args.tolerance,
+                'columns': sorted(columns.keys())}
+    found = shortest_range(columns, count, args.tolerance, args.min_frames, args.max_frames)
+    if found:
+        begin, end, deviation = found
+        proposal['range'] = {'first': frames[begin], 'last': frames[end - 1], 'deviation': deviation}
+        print('Frames {0} to {1} ({2} of {3}) are within {4:.1%} of the whole trace, use -framerange {0} {5}'.format(
+            frames[begin], frames[end - 1], end - begin, count, deviation, frames[end - 1] + 1))
+    else:
+        labels = kmeans(columns, count, args.clusters)
+        ranges = cluster_ranges(columns, count, labels, args.min_frames)
+        for r in ranges:
+            r['first'] = frames[r.pop('begin')]
+            r['last'] = frames[r.pop('end') - 1]
+        proposal['ranges'] = ranges
+        print('No range of up to {0} frames is within {1:.1%} of the whole trace, weighted ranges by workload cluster:'.format(
+            args.max_frames, args.tolerance))
+        for r in ranges:
+            print('  frames {0} to {1}, weight {2:.3f}, within {3:.1%} of its cluster'.format(
+                r['first'], r['last'], r['weight'], r['deviation']))
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(proposal, f, indent=4, sort_keys=True)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
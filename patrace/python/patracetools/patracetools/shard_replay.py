@@ -0,0 +1,227 @@
+#!/usr/bin/env python2
+"""
+Replays a long trace as K segments in parallel. A fastforward trace is made
+for the start of every segment but the first, so each segment can be replayed
+on its own, and the results and frame snapshots of all segments are merged
+back into one report in frame order.
+
+A fastforward trace starting at original frame T has one frame that restores
+the state, and then frames T, T+1, ... as its frames 1, 2, ... Segments are
+replayed with -jsonParameters, so by default each worker runs paretrace on
+this machine. --command lets the replay go elsewhere instead, such as through
+ssh or adb, as long as the files it reads and writes end up in the output
+directory.
+"""
+from __future__ import print_function
+import argparse
+import glob
+import json
+import os
+import shutil
+import subprocess
+import sys
+import threading
+
+try:
+    import Queue as queue
+except ImportError:
+    import queue
+
+import headerparser
+
+
+def make_segments(frames, count, first):
+    """ Cut original frames [first, frames) into count [begin, end) ranges """
+    count = max(1, min(count, frames - first))
+    length = (frames - first) // count
+    segments = []
+    for i in range(count):
+        begin = first + i * length
+        end = frames if i == count - 1 else begin + length
+        segments.append((begin, end))
+    return segments
+
+
+class Segment(object):
+    def __init__(self, index, begin, end, outdir):
+        self.index = index
+        self.begin = begin
+        self.end = end
+        self.dir = os.path.join(outdir, 'segment_{0:03d}'.format(index))
+        self.trace = None
+        self.offset = 0  # original frame number minus the frame number in self.trace
+        self.result = os.path.join(self.dir, 'result.json')
+        self.error = None
+        self.made = False  # fastforward trace made by make_checkpoints() in this run
+
+
+def run(cmd, log):
+    with open(log, 'a') as f:
+        f.write(' '.join(cmd) + '\n')
+        f.flush()
+        return subprocess.call(cmd, stdout=f, stderr=subprocess.STDOUT)
+
+
+def checkpoint(segment, args):
+    """ Make the fastforward trace the segment is replayed from """
+    if segment.begin <= 1:
+        # Frame 0 is where the original trace starts anyway
+        segment.trace = os.path.abspath(args.trace)
+        return True
+
+    segment.trace = os.path.join(segment.dir, 'checkpoint.pat')
+    segment.offset = segment.begin - 1
+    if os.path.exists(segment.trace) and (segment.made or not args.regenerate):
+        return True
+    cmd = [args.fastforward, '--input', args.trace, '--output', segment.trace,
+           '--targetFrame', str(segment.begin), '--endFrame', str(segment.end)]
+    if args.noscreen:
+        cmd.append('--noscreen')
+    if run(cmd, os.path.join(segment.dir, 'fastforward.log')) != 0 or not os.path.exists(segment.trace):
+        segment.error = 'fastforward to frame {0} failed'.format(segment.begin)
+        return False
+    return True
+
+
+def make_checkpoints(segments, args, outdir):
+    """ Make the fastforward traces of all segments with one pass over the trace. Segments
+    whose trace is still missing afterwards make their own in checkpoint(). """
+    todo = [s for s in segments if s.begin > 1 and (args.regenerate or not os.path.exists(os.path.join(s.dir, 'checkpoint.pat')))]
+    if len(todo) < 2:
+        return
+    output = os.path.join(outdir, 'checkpoint.pat')
+    cmd = [args.fastforward, '--input', args.trace, '--output', output,
+           '--targetFrames', ','.join(str(s.begin) for s in todo), '--segmented', '--endFrame', str(todo[-1].end)]
+    if args.noscreen:
+        cmd.append('--noscreen')
+    print('Making {0} fastforward traces in one pass'.format(len(todo)))
+    run(cmd, os.path.join(outdir, 'fastforward.log'))
+    for s in todo:
+        made = os.path.join(outdir, 'checkpoint_{0}.pat'.format(s.begin))
+        if os.path.exists(made):
+            shutil.move(made, os.path.join(s.dir, 'checkpoint.pat'))
+            s.made = True
+
+
+def replay(segment, args, base):
+    params = dict(base)
+    params['file'] = segment.trace
+    params['frames'] = '{0}-{1}'.format(segment.begin - segment.offset, segment.end - segment.offset)
+    if args.snapshot:
+        params['snapshotCallset'] = '{0}-{1}/frame'.format(segment.begin - segment.offset, segment.end - segment.offset - 1)
+        params['snapshotPrefix'] = os.path.join(segment.dir, 'snap_')
+        params['snapshotFrameNames'] = True
+    param_file = os.path.join(segment.dir, 'parameters.json')
+    with open(param_file, 'w') as f:
+        json.dump(params, f, indent=2, sort_keys=True)
+
+    if args.command:
+        cmd = args.command.format(parameters=param_file, result=segment.result, dir=segment.dir).split()
+    else:
+        cmd = [args.retracer, '-jsonParameters', param_file, segment.result, '.']
+    if run(cmd, os.path.join(segment.dir, 'retrace.log')) != 0 or not os.path.exists(segment.result):
+        segment.error = 'replay of frames {0}-{1} failed'.format(segment.begin, segment.end)
+
+
+def worker(jobs, args, base):
+    while True:
+        try:
+            segment = jobs.get_nowait()
+        except queue.Empty:
+            return
+        print('Segment {0}: frames {1}-{2}'.format(segment.index, segment.begin, segment.end))
+        if checkpoint(segment, args):
+            replay(segment, args, base)
+        if segment.error:
+            print('Segment {0}: {1}, see {2}'.format(segment.index, segment.error, segment.dir), file=sys.stderr)
+
+
+def merge(segments, outdir):
+    """ Put the segment results and snapshots together, in original frame numbers """
+    report = {'segments': [], 'frames': 0, 'time': 0.0}
+    snapdir = os.path.join(outdir, 'snapshots')
+    if not os.path.exists(snapdir):
+        os.makedirs(snapdir)
+
+    for segment in segments:
+        entry = {'index': segment.index, 'begin': segment.begin, 'end': segment.end}
+        if segment.error:
+            entry['error'] = segment.error
+        else:
+            with open(segment.result) as f:
+                result = json.load(f)
+            entry['result'] = result
+            for r in result.get('result', []):
+                report['frames'] += r.get('frames', 0)
+                report['time'] += r.get('time', 0.0)
+            if 'error' in result:
+                entry['error'] = result['error']
+
+        # Snapshots are named <prefix><frame, at least 4 digits>[_l<loop>].png
+        for snap in glob.glob(os.path.join(segment.dir, 'snap_*.png')):
+            name = os.path.basename(snap)[len('snap_'):-len('.png')].split('_')[0]
+            if name.isdigit():
+                frame = int(name) + segment.offset
+                shutil.copy(snap, os.path.join(snapdir, 'frame_{0:06d}.png'.format(frame)))
+        report['segments'].append(entry)
+
+    report['fps'] = report['frames'] / report['time'] if report['time'] > 0.0 else 0.0
+    report['failed'] = sum(1 for e in report['segments'] if 'error' in e)
+    with open(os.path.join(outdir, 'report.json'), 'w') as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+    return report
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Replay a trace as segments in parallel, each one from its own fastforward trace, and merge the results.')
+    parser.add_argument('trace', help='Path to the .pat trace file')
+    parser.add_argument('outdir', help='Directory for the fastforward traces, results and snapshots')
+    parser.add_argument('-k', '--segments', type=int, default=4, help='Number of segments to cut the trace into')
+    parser.add_argument('-j', '--jobs', type=int, default=1, help='Number of segments to work on at once')
+    parser.add_argument('--first', type=int, default=1, help='First frame to replay, frame 0 is usually loading')
+    parser.add_argument('--parameters', help='JSON file with the -jsonParameters options for every segment')
+    parser.add_argument('--snapshot', action='store_true', help='Take a snapshot of every frame')
+    parser.add_argument('--noscreen', action='store_true', help='Make the fastforward traces without a window')
+    parser.add_argument('--regenerate', action='store_true', help='Make the fastforward traces again even if they exist')
+    parser.add_argument('--fastforward', default='fastforward', help='Path to the fastforward binary')
+    parser.add_argument('--retracer', default='paretrace', help='Path to the paretrace binary')
+    parser.add_argument('--command', help='Replay command to run instead of paretrace, with {parameters}, {result} and {dir} filled in for each segment')
+    args = parser.parse_args()
+
+    header = headerparser.read_json_header(args.trace)
+    frames = header.get('frameCnt', 0)
+    if frames <= args.first:
+        print('{0} has only {1} frames'.format(args.trace, frames), file=sys.stderr)
+        return 1
+
+    base = {}
+    if args.parameters:
+        with open(args.parameters) as f:
+            base = json.load(f)
+
+    outdir = os.path.abspath(args.outdir)
+    segments = []
+    for i, (begin, end) in enumerate(make_segments(frames, args.segments, args.first)):
+        segment = Segment(i, begin, end, outdir)
+        if not os.path.exists(segment.dir):
+            os.makedirs(segment.dir)
+        segments.append(segment)
+
+    make_checkpoints(segments, args, outdir)
+
+    jobs = queue.Queue()
+    for segment in segments:
+        jobs.put(segment)
+    threads = [threading.Thread(target=worker, args=(jobs, args, base)) for _ in range(max(1, args.jobs))]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    report = merge(segments, outdir)
+    print('{0} frames in {1} segments, {2} failed, report in {3}'.format(
+        report['frames'], len(segments), report['failed'], os.path.join(outdir, 'report.json')))
+    return 1 if report['failed'] else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -129,6 +129,10 @@ setup(
             'pat-edit-header=patracetools.edit_header:main',
             'pat-dump-textures=patracetools.dump_textures:main',
             'pat-get-call-numbers=patracetools.get_call_numbers:main',
+            'pat-shard-replay=patracetools.shard_replay:main',
+            'pat-bisect-perf=patracetools.bisect_perf:main',
+            'pat-compose-checkpoints=patracetools.compose_checkpoints:main',
+            'pat-pick-frames=patracetools.pick_frames:main',
         ],
     },
 )
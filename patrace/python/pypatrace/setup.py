@@ -73,8 +73,15 @@ patrace_extension = setuptools.Extension(
         'src/common/api_info.cpp',
         'src/common/in_file.cpp',
         'src/common/in_file_ra.cpp',
+        'src/common/chunk_codec.cpp',
+        'src/common/file_writer.cpp',
+        'src/common/base64.cpp',
+        'src/common/trace_index.cpp',
         'src/common/out_file.cpp',
         'src/common/os_posix.cpp',
+        'src/common/blob_store.cpp',
+        'src/common/image_qoi.cpp',
+        'src/common/thread_pool.cpp',
 
         'common/eglstate/common.cpp',
 
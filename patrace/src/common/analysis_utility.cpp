@@ -82,3 +82,125 @@ const std::string shader_extension(GLenum type)
         return ".unknown";
     }
 }
+
+/// Block size in texels and bytes of a compressed format, false if it is not one
+static bool compressedBlock(GLenum format, int& width, int& height, int& depth, int& bytes)
+{
+    // ASTC footprints in the order of their enums
+    static const int astc2D[14][2] = { {4, 4}, {5, 4}, {5, 5}, {6, 5}, {6, 6}, {8, 5}, {8, 6}, {8, 8}, {10, 5}, {10, 6}, {10, 8}, {10, 10}, {12, 10}, {12, 12} };
+    static const int astc3D[10][3] = { {3, 3, 3}, {4, 3, 3}, {4, 4, 3}, {4, 4, 4}, {5, 4, 4}, {5, 5, 4}, {5, 5, 5}, {6, 5, 5}, {6, 6, 5}, {6, 6, 6} };
+    width = height = 4;
+    depth = 1;
+    bytes = 16;
+    if (format >= GL_COMPRESSED_RGBA_ASTC_4x4 && format <= GL_COMPRESSED_RGBA_ASTC_12x12)
+    {
+        width = astc2D[format - GL_COMPRESSED_RGBA_ASTC_4x4][0];
+        height = astc2D[format - GL_COMPRESSED_RGBA_ASTC_4x4][1];
+        return true;
+    }
+    if (format >= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4 && format <= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12)
+    {
+        width = astc2D[format - GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4][0];
+        height = astc2D[format - GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4][1];
+        return true;
+    }
+    if (format >= GL_COMPRESSED_RGBA_ASTC_3x3x3_OES && format <= GL_COMPRESSED_RGBA_ASTC_6x6x6_OES)
+    {
+        width = astc3D[format - GL_COMPRESSED_RGBA_ASTC_3x3x3_OES][0];
+        height = astc3D[format - GL_COMPRESSED_RGBA_ASTC_3x3x3_OES][1];
+        depth = astc3D[format - GL_COMPRESSED_RGBA_ASTC_3x3x3_OES][2];
+        return true;
+    }
+    if (format >= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_3x3x3_OES && format <= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_6x6x6_OES)
+    {
+        width = astc3D[format - GL_COMPRESSED_SRGB8_ALPHA8_ASTC_3x3x3_OES][0];
+        height = astc3D[format - GL_COMPRESSED_SRGB8_ALPHA8_ASTC_3x3x3_OES][1];
+        depth = astc3D[format - GL_COMPRESSED_SRGB8_ALPHA8_ASTC_3x3x3_OES][2];
+        return true;
+    }
+    switch (format)
+    {
+    case GL_ETC1_RGB8_OES:
+    case GL_COMPRESSED_R11_EAC:
+    case GL_COMPRESSED_SIGNED_R11_EAC:
+    case GL_COMPRESSED_RGB8_ETC2:
+    case GL_COMPRESSED_SRGB8_ETC2:
+    case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+    case GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        bytes = 8;
+        return true;
+    case GL_COMPRESSED_RG11_EAC:
+    case GL_COMPRESSED_SIGNED_RG11_EAC:
+    case GL_COMPRESSED_RGBA8_ETC2_EAC:
+    case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static unsigned bytesPerTexel(GLenum internalformat, GLenum format, GLenum type)
+{
+    switch (internalformat)
+    {
+    case GL_R8: case GL_R8_SNORM: case GL_R8I: case GL_R8UI: case GL_STENCIL_INDEX8:
+        return 1;
+    case GL_RG8: case GL_RG8_SNORM: case GL_RG8I: case GL_RG8UI: case GL_R16F: case GL_R16I: case GL_R16UI: case GL_R16_EXT:
+    case GL_RGB565: case GL_RGBA4: case GL_RGB5_A1: case GL_DEPTH_COMPONENT16: case GL_LUMINANCE8_ALPHA8_EXT:
+        return 2;
+    case GL_RGB8: case GL_SRGB8: case GL_RGB8_SNORM: case GL_RGB8I: case GL_RGB8UI:
+    case GL_RGBA8: case GL_SRGB8_ALPHA8: case GL_RGBA8_SNORM: case GL_RGBA8I: case GL_RGBA8UI: case GL_BGRA8_EXT:
+    case GL_RGB10_A2: case GL_RGB10_A2UI: case GL_R11F_G11F_B10F: case GL_RGB9_E5:
+    case GL_RG16F: case GL_RG16I: case GL_RG16UI: case GL_R32F: case GL_R32I: case GL_R32UI:
+    case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F: case GL_DEPTH24_STENCIL8:
+        return 4;
+    case GL_RGB16F: case GL_RGB16I: case GL_RGB16UI: case GL_RGB16_EXT:
+    case GL_RGBA16F: case GL_RGBA16I: case GL_RGBA16UI: case GL_RGBA16_EXT:
+    case GL_RG32F: case GL_RG32I: case GL_RG32UI: case GL_DEPTH32F_STENCIL8:
+        return 8;
+    case GL_RGB32F: case GL_RGB32I: case GL_RGB32UI: case GL_RGBA32F: case GL_RGBA32I: case GL_RGBA32UI:
+        return 16;
+    default:
+        break;
+    }
+    // unsized, such as GL_RGBA with GL_UNSIGNED_BYTE
+    switch (type)
+    {
+    case GL_UNSIGNED_SHORT_5_6_5: case GL_UNSIGNED_SHORT_4_4_4_4: case GL_UNSIGNED_SHORT_5_5_5_1:
+        return 2;
+    case GL_UNSIGNED_INT_24_8: case GL_UNSIGNED_INT_2_10_10_10_REV: case GL_UNSIGNED_INT_10F_11F_11F_REV: case GL_UNSIGNED_INT_5_9_9_9_REV:
+        return 4;
+    default:
+        break;
+    }
+    const unsigned component = (type == GL_FLOAT || type == GL_UNSIGNED_INT || type == GL_INT) ? 4
+                             : (type == GL_HALF_FLOAT || type == GL_HALF_FLOAT_OES || type == GL_UNSIGNED_SHORT || type == GL_SHORT) ? 2 : 1;
+    switch (format)
+    {
+    case GL_ALPHA: case GL_LUMINANCE: case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: case GL_STENCIL_INDEX:
+        return component;
+    case GL_LUMINANCE_ALPHA: case GL_RG: case GL_RG_INTEGER:
+        return 2 * component;
+    case GL_NONE:
+        return 4; // format not known, such as for renderbuffers of unknown internal formats
+    default:
+        return 4 * component; // RGB is stored as RGBA
+    }
+}
+
+uint64_t textureImageBytes(GLenum internalformat, GLenum format, GLenum type, GLsizei width, GLsizei height, GLsizei depth)
+{
+    width = std::max(width, 1);
+    height = std::max(height, 1);
+    depth = std::max(depth, 1);
+    int bw, bh, bd, bytes;
+    if (compressedBlock(internalformat, bw, bh, bd, bytes))
+    {
+        return (uint64_t)((width + bw - 1) / bw) * ((height + bh - 1) / bh) * ((depth + bd - 1) / bd) * bytes;
+    }
+    return (uint64_t)width * height * depth * bytesPerTexel(internalformat, format, type);
+}
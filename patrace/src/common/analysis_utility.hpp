@@ -1,74 +1,125 @@
 #pragma once
 
-#include <unordered_map>
+#include <algorithm>
 #include <string>
-#include <list>
+#include <vector>
+#include <stdint.h>
 
 #include <GLES3/gl32.h>
 
 // This file contains helper that do not call any GL functions. Used for example for static analysis tools.
 
-// Very simple LRU cache implementation, for simulating and testing cache behaviours.
-template<typename K, typename V>
-class LRU_Cache
+// Simulator of the post-transform vertex cache of a GPU, fed with the indices of a draw in order.
+// The entries live in a small array, so that an access costs at most the size of the cache,
+// however long the index buffer is.
+class VertexCacheSim
 {
 public:
-    typedef typename std::pair<K, V> pair_t;
-    typedef typename std::list<pair_t> list_t;
-    typedef typename list_t::iterator list_iterator_t;
+    enum Policy { FIFO, LRU };
 
-    LRU_Cache(int size) : mSize(size) {}
+    explicit VertexCacheSim(unsigned size = 32, Policy policy = FIFO) : mEntries(size), mPolicy(policy) {}
 
-    void put(const K& key, const V& value)
+    // Looks up a vertex and brings it in on a miss, returns whether it hit
+    bool access(uint32_t vertex)
     {
-        auto it = mCacheMap.find(key);
-        mCacheList.push_front(pair_t(key, value));
-        if (it != mCacheMap.end()) // already exists, remove duplicate
+        for (unsigned i = 0; i < mUsed; i++)
         {
-            mCacheList.erase(it->second);
-            mCacheMap.erase(it);
+            if (mEntries[i] == vertex)
+            {
+                if (mPolicy == LRU) // entries are kept most recently used first
+                {
+                    std::copy_backward(mEntries.begin(), mEntries.begin() + i, mEntries.begin() + i + 1);
+                    mEntries[0] = vertex;
+                }
+                mHits++;
+                return true;
+            }
         }
-        mCacheMap[key] = mCacheList.begin();
-        if (mCacheMap.size() > mSize) // evict something from cache
+        mMisses++;
+        if (mPolicy == LRU)
         {
-            mCacheMap.erase(mCacheList.back().first);
-            mCacheList.pop_back();
+            const unsigned keep = std::min<unsigned>(mUsed, mEntries.size() - 1);
+            std::copy_backward(mEntries.begin(), mEntries.begin() + keep, mEntries.begin() + keep + 1);
+            mEntries[0] = vertex;
         }
+        else
+        {
+            mEntries[mHead] = vertex;
+            mHead = (mHead + 1) % mEntries.size();
+        }
+        mUsed = std::min<unsigned>(mUsed + 1, mEntries.size());
+        return false;
     }
 
-    const V& get(const K& key)
-    {
-        auto it = mCacheMap.find(key);
-        mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
-        return it->second->second;
-    }
+    void reset() { mUsed = mHead = 0; mHits = mMisses = 0; }
 
-    bool exists(const K& key) const
-    {
-        return mCacheMap.find(key) != mCacheMap.end();
-    }
+    unsigned long hits() const { return mHits; }
+    unsigned long misses() const { return mMisses; } // the vertices that are shaded
 
-    int age(const K& key) const // returns age of entry; if not found, returns size of cache
+private:
+    std::vector<uint32_t> mEntries;
+    Policy mPolicy;
+    unsigned mUsed = 0;
+    unsigned mHead = 0; // next to replace, for FIFO
+    unsigned long mHits = 0;
+    unsigned long mMisses = 0;
+};
+
+// Set associative LRU cache of fixed size lines, to estimate how much memory traffic a stream of
+// addresses causes. Addresses can be bytes, such as those of vertex attributes, or the index of
+// a tile of texels, with a line size of one.
+class TileCacheSim
+{
+public:
+    TileCacheSim(unsigned sizeBytes = 16 * 1024, unsigned lineBytes = 64, unsigned ways = 4)
+        : mLineBytes(lineBytes), mWays(ways), mSets(std::max(1u, sizeBytes / lineBytes / ways)), mTags(mSets * ways), mValid(mSets, 0) {}
+
+    // Returns whether the line of the address was in the cache
+    bool access(uint64_t address)
     {
-        int i = 0;
-        for (const auto& v : mCacheList)
+        const uint64_t line = address / mLineBytes;
+        uint64_t *set = &mTags[(line % mSets) * mWays];
+        unsigned &valid = mValid[line % mSets];
+        for (unsigned i = 0; i < valid; i++)
         {
-            if (v.first == key)
+            if (set[i] == line)
             {
-                return i;
+                std::copy_backward(set, set + i, set + i + 1);
+                set[0] = line;
+                mHits++;
+                return true;
             }
-            i++;
         }
-        return mSize;
+        const unsigned keep = std::min(valid, mWays - 1);
+        std::copy_backward(set, set + keep, set + keep + 1);
+        set[0] = line;
+        valid = std::min(valid + 1, mWays);
+        mMisses++;
+        return false;
     }
 
+    void reset() { std::fill(mValid.begin(), mValid.end(), 0); mHits = mMisses = 0; }
+
+    unsigned long hits() const { return mHits; }
+    unsigned long misses() const { return mMisses; }
+    uint64_t fetchedBytes() const { return (uint64_t)mMisses * mLineBytes; }
+
 private:
-    unsigned mSize = 0;
-    list_t mCacheList;
-    std::unordered_map<K, list_iterator_t> mCacheMap;
+    unsigned mLineBytes;
+    unsigned mWays;
+    unsigned mSets;
+    std::vector<uint64_t> mTags; // by set, most recently used first
+    std::vector<unsigned> mValid; // entries in use, by set
+    unsigned long mHits = 0;
+    unsigned long mMisses = 0;
 };
 
 const std::string shader_extension(GLenum type);
 long calculate_primitives(GLenum mode, long vertices, GLuint patchSize);
 GLenum interpret_texture_target(GLenum target);
 bool isUniformSamplerType(GLenum type);
+
+/// Bytes of GPU memory an image of the given size takes in the given internal format, as far as
+/// the format tells: compressed formats are counted in whole blocks, and three component formats
+/// as four, as GPUs store them. Unsized internal formats go by format and type, as for glTexImage*.
+uint64_t textureImageBytes(GLenum internalformat, GLenum format, GLenum type, GLsizei width, GLsizei height, GLsizei depth);
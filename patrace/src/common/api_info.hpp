@@ -52,22 +52,40 @@ public:
     static const char*      IdToNameArr[];
     static int              IdToLenArr[];
 
+    // 32 bit FNV-1a of a function name. It differs for every function of the API, which
+    // api_info.py checks, so that tools can switch on it with case labels of
+    // NameHash("glDrawArrays") and the like instead of comparing names one after another.
+    static constexpr uint32_t NameHash(const char* name, uint32_t hash = 2166136261u)
+    {
+        return *name ? NameHash(name + 1, (hash ^ (unsigned char)*name) * 16777619u) : hash;
+    }
+
+    // Perfect hash of the names to their ids, see nameHashBook() in api_info.py: the
+    // displacement of the bucket of a name moves it to a slot that no other name has
+    static const unsigned       NameSlotShift;
+    static const unsigned       NameDispCount;
+    static const unsigned short NameDispArr[];
+    static const unsigned short NameSlotArr[];
+
     inline unsigned short NameToId(const char* name)
     {
         if (name == NULL)
             return 0;
 
-        for (unsigned short id = 1; id <= MaxSigId; ++id)
-        {
-            if (!IdToNameArr[id])
-                continue;
-            if (strcmp(IdToNameArr[id], name) == 0)
-                return id;
-        }
+        const uint32_t hash = NameHash(name);
+        const uint32_t slot = ((hash ^ NameDispArr[hash & (NameDispCount - 1)]) * 0x9e3779b1u) >> NameSlotShift;
+        const unsigned short id = NameSlotArr[slot];
+        if (id && strcmp(IdToNameArr[id], name) == 0)
+            return id;
 
         return 0;
     }
 
+    void* IdToFptr(unsigned short id)
+    {
+        return (mIdToFptrArr && id) ? mIdToFptrArr[id] : NULL;
+    }
+
 private:
     void** mIdToFptrArr;
 };
@@ -111,6 +111,66 @@ def funcLenBook(functions):
     print '};'
     print
 
+def nameHash(name):
+    """ 32 bit FNV-1a, as ApiInfo::NameHash() """
+    h = 2166136261
+    for c in name:
+        h = ((h ^ ord(c)) * 16777619) & 0xffffffff
+    return h
+
+def nameHashBook(functions):
+    """ Perfect hash of the function names to their ids for ApiInfo::NameToId(). The names are
+    put in buckets by their hash, and for each bucket, from the fullest, a displacement is
+    searched for that moves its names into slots no other name took. """
+    ids = {}
+    for id in sorted(gIdToFunc.keys()):
+        ids.setdefault(gIdToFunc[id].name, id) # the first id of a name, as the linear search found
+    hashes = {}
+    for name in ids:
+        h = nameHash(name)
+        if h in hashes:
+            raise Exception('%s and %s have the same name hash, switching on it would not tell them apart' % (name, hashes[h]))
+        hashes[h] = name
+
+    bits = 1
+    while (1 << bits) < len(ids) * 5 / 4:
+        bits += 1
+    slotCount = 1 << bits
+    bucketCount = slotCount / 4
+    slotOf = lambda h, disp: (((h ^ disp) * 0x9e3779b1) & 0xffffffff) >> (32 - bits)
+
+    buckets = [[] for i in xrange(bucketCount)]
+    for h in hashes:
+        buckets[h & (bucketCount - 1)].append(h)
+    disps = [0] * bucketCount
+    slots = [0] * slotCount
+    for b in sorted(xrange(bucketCount), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            break
+        for disp in xrange(0x10000):
+            taken = [slotOf(h, disp) for h in buckets[b]]
+            if len(set(taken)) == len(taken) and not any(slots[slot] for slot in taken):
+                break
+        else:
+            raise Exception('No displacement found for bucket %d of the name hash' % b)
+        disps[b] = disp
+        for h, slot in zip(buckets[b], taken):
+            slots[slot] = ids[hashes[h]]
+
+    print 'const unsigned ApiInfo::NameSlotShift = %d;' % (32 - bits)
+    print 'const unsigned ApiInfo::NameDispCount = %d;' % bucketCount
+    print
+    print 'const unsigned short ApiInfo::NameDispArr[%d] = {' % bucketCount
+    for i in xrange(0, bucketCount, 16):
+        print '    %s,' % ', '.join(str(d) for d in disps[i:i + 16])
+    print '};'
+    print
+    print 'const unsigned short ApiInfo::NameSlotArr[%d] = {' % slotCount
+    for i in xrange(0, slotCount, 16):
+        print '    %s,' % ', '.join(str(id) for id in slots[i:i + 16])
+    print '};'
+    print
+
 if __name__ == '__main__':
 
     api.addApi(gles12api.glesapi)
@@ -130,5 +190,6 @@ if __name__ == '__main__':
     print
     sigBook(api.functions)
     funcLenBook(api.functions)
+    nameHashBook(api.functions)
     print '} // namespace common'
     print
@@ -50,4 +50,50 @@ char *base64_encode(const char *data,
     return output_data;
 }
 
+static int decode_char(char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+bool base64_decode(const char *data,
+        size_t input_length,
+        std::vector<char>& output)
+{
+    output.clear();
+    if (input_length % 4 != 0)
+        return false;
+    output.reserve(input_length / 4 * 3);
+
+    for (size_t i = 0; i < input_length; i += 4)
+    {
+        uint32_t triple = 0;
+        int padding = 0;
+        for (size_t k = 0; k < 4; k++)
+        {
+            const char c = data[i + k];
+            int v = 0;
+            if (c == '=' && i + 4 == input_length && k >= 2)
+            {
+                padding++;
+            }
+            else if (padding > 0 || (v = decode_char(c)) < 0)
+            {
+                return false;
+            }
+            triple = (triple << 6) | v;
+        }
+
+        output.push_back((triple >> 2 * 8) & 0xFF);
+        if (padding < 2) output.push_back((triple >> 1 * 8) & 0xFF);
+        if (padding < 1) output.push_back((triple >> 0 * 8) & 0xFF);
+    }
+
+    return true;
+}
+
 }
@@ -2,6 +2,7 @@
 #define _COMMON_BASE64_HPP_
 
 #include <stddef.h>
+#include <vector>
 
 namespace common 
 {
@@ -9,6 +10,11 @@ namespace common
     char* base64_encode(const char *data, 
                         size_t input_length, 
                         size_t *output_length);
+
+    /* returns false if data is not valid base64 */
+    bool base64_decode(const char *data,
+                       size_t input_length,
+                       std::vector<char>& output);
 }
 
 #endif
@@ -0,0 +1,197 @@
+#include "common/blob_store.hpp"
+#include "common/image.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace common {
+
+namespace {
+
+ChunkCodec generalCodec(BlobCodec codec)
+{
+    return codec == BLOB_CODEC_LZ4 ? CHUNK_CODEC_LZ4 : CHUNK_CODEC_SNAPPY;
+}
+
+size_t encodePixels(const char* src, size_t length, unsigned channels, char* dst)
+{
+    const unsigned char* p = (const unsigned char*)src;
+    const size_t pixelCount = length / channels;
+    image::QoiEncoder encoder((unsigned char*)dst);
+    for (size_t i = 0; i < pixelCount; i++, p += channels)
+    {
+        encoder.push(p[0] | (p[1] << 8) | (p[2] << 16) | (channels == 4 ? (uint32_t)p[3] << 24 : 0xff000000));
+    }
+    char* end = (char*)encoder.finish();
+    const size_t rest = length - pixelCount * channels;
+    memcpy(end, p, rest);
+    return end + rest - dst;
+}
+
+bool decodePixels(const char* src, size_t length, unsigned channels, char* dst, size_t dstLength)
+{
+    const size_t pixelCount = dstLength / channels;
+    const size_t rest = dstLength - pixelCount * channels;
+    if (length < rest)
+    {
+        return false;
+    }
+    memcpy(dst + pixelCount * channels, src + length - rest, rest);
+    return image::qoiDecode((const unsigned char*)src, length - rest, channels, (unsigned char*)dst, pixelCount);
+}
+
+}
+
+void encodeBlob(char* header, BlobCodec codec, ChunkBuffer& scratch)
+{
+    unsigned int length;
+    ReadFixed(header + 2 * sizeof(unsigned int), length);
+    char* blob = header + BLOB_ENCODED_HEADER_SIZE;
+
+    size_t encoded = length;
+    if (codec == BLOB_CODEC_QOI_RGB || codec == BLOB_CODEC_QOI_RGBA)
+    {
+        const unsigned channels = codec == BLOB_CODEC_QOI_RGB ? 3 : 4;
+        scratch.resize(length / channels * (channels + 1) + channels);
+        encoded = encodePixels(blob, length, channels, scratch.data());
+    }
+    if (encoded >= length)
+    {
+        // not pixels, or not ones QOI can do anything with
+        codec = chunkCodecAvailable(CHUNK_CODEC_LZ4) ? BLOB_CODEC_LZ4 : BLOB_CODEC_SNAPPY;
+        scratch.resize(chunkMaxCompressedLength(generalCodec(codec), length));
+        encoded = chunkCompress(generalCodec(codec), blob, length, scratch.data());
+    }
+    if (encoded == 0 || encoded >= length)
+    {
+        return;
+    }
+    memcpy(blob, scratch.data(), encoded);
+    memset(blob + encoded, 0, length - encoded);
+    WriteFixed<unsigned int>(header + sizeof(unsigned int), codec);
+    WriteFixed<unsigned int>(header + 3 * sizeof(unsigned int), encoded);
+}
+
+std::string BlobStore::externalPath(const std::string& dir, const unsigned char* md5)
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string name;
+    for (int i = 0; i < 16; i++)
+    {
+        name += hex[md5[i] >> 4];
+        name += hex[md5[i] & 0xf];
+    }
+    return dir + "/" + name.substr(0, 2) + "/" + name;
+}
+
+char* BlobStore::readExternal(char* src, Array<char>& arr)
+{
+    unsigned int len;
+    src = ReadFixed(src, len);
+    const unsigned char* md5 = (const unsigned char*)src;
+    src += 16;
+
+    arr.cnt = 0;
+    arr.v = NULL;
+    const std::string key((const char*)md5, 16);
+    auto it = mMapped.find(key);
+    if (it == mMapped.end())
+    {
+        Mapping mapping = { NULL, 0 };
+        const std::string path = externalPath(mExternalDir.empty() ? "." : mExternalDir, md5);
+        const int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            DBG_LOG("Failed to open blob %s of the external blob store: %s\n", path.c_str(), strerror(errno));
+        }
+        else if ((size_t)st.st_size != len)
+        {
+            DBG_LOG("Blob %s of the external blob store has %lu bytes instead of %u\n", path.c_str(), (unsigned long)st.st_size, len);
+        }
+        else if (len > 0)
+        {
+            // writable like the chunks blobs otherwise point into, copied on write
+            void* data = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                DBG_LOG("Failed to mmap %s: %s\n", path.c_str(), strerror(errno));
+            }
+            else
+            {
+                mapping.data = (char*)data;
+                mapping.size = len;
+            }
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        it = mMapped.insert(std::make_pair(key, mapping)).first;
+    }
+    if (it->second.data)
+    {
+        arr.cnt = it->second.size;
+        arr.v = it->second.data;
+    }
+    return src;
+}
+
+char* BlobStore::readEncoded(char* src, Array<char>& arr)
+{
+    unsigned int codec, len, encodedLen;
+    src = ReadFixed(src, codec);
+    src = ReadFixed(src, len);
+    src = ReadFixed(src, encodedLen);
+    char* encoded = src;
+    src = PTR_PADDING(src + len, 4);
+
+    arr.cnt = len;
+    arr.v = encoded;
+    if (codec == BLOB_CODEC_NONE)
+    {
+        return src;
+    }
+    mDecoded.resize(len);
+    bool ok = false;
+    if (codec == BLOB_CODEC_QOI_RGB || codec == BLOB_CODEC_QOI_RGBA)
+    {
+        ok = decodePixels(encoded, encodedLen, codec == BLOB_CODEC_QOI_RGB ? 3 : 4, mDecoded.data(), len);
+    }
+    else if (codec == BLOB_CODEC_LZ4 || codec == BLOB_CODEC_SNAPPY)
+    {
+        size_t decodedLen = 0;
+        ok = chunkUncompressedLength(generalCodec((BlobCodec)codec), encoded, encodedLen, &decodedLen) && decodedLen == len
+             && chunkUncompress(generalCodec((BlobCodec)codec), encoded, encodedLen, mDecoded.data());
+    }
+    if (!ok)
+    {
+        DBG_LOG("Failed to decode a blob of %u bytes with codec %u\n", len, codec);
+        arr.cnt = 0;
+        arr.v = NULL;
+        return src;
+    }
+    arr.v = mDecoded.data();
+    return src;
+}
+
+void BlobStore::clear()
+{
+    mBlobs.clear();
+    mBytes = 0;
+    std::vector<char>().swap(mDecoded);
+    for (auto& pair : mMapped)
+    {
+        if (pair.second.data)
+        {
+            munmap(pair.second.data, pair.second.size);
+        }
+    }
+    mMapped.clear();
+}
+
+}
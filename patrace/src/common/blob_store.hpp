@@ -0,0 +1,123 @@
+#ifndef _COMMON_BLOB_STORE_HPP_
+#define _COMMON_BLOB_STORE_HPP_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <common/chunk_codec.hpp>
+#include <common/file_format.hpp>
+#include <common/os.hpp>
+
+namespace common {
+
+/// How an encoded blob (see BLOB_ENCODED) is compressed
+enum BlobCodec
+{
+    BLOB_CODEC_NONE = 0, ///< as it is
+    BLOB_CODEC_QOI_RGB = 1, ///< QOI of 3 byte pixels, any bytes left over as they are
+    BLOB_CODEC_QOI_RGBA = 2, ///< QOI of 4 byte pixels, any bytes left over as they are
+    BLOB_CODEC_LZ4 = 3,
+    BLOB_CODEC_SNAPPY = 4
+};
+
+/// Encode a blob behind a BLOB_ENCODED header with codec 0 in place, with codec, or with LZ4 if
+/// that does not make it smaller, or snappy where LZ4 is not available. Leaves it as it is if
+/// neither does. scratch is for the encoding.
+void encodeBlob(char* header, BlobCodec codec, ChunkBuffer& scratch);
+
+/// Blobs defined in the call stream (see BLOB_STORE_DEFINE), kept around so that later calls
+/// can refer to them. A definition is copied once when it is read, since the chunk it came
+/// from is recycled; references just point into the copy.
+///
+/// Blobs of thin traces (see BLOB_STORE_EXTERNAL) are memory mapped from the external store
+/// the first time a call refers to them, and stay mapped until clear().
+///
+/// Encoded blobs (see BLOB_ENCODED) are decoded into a buffer of their own, which is only valid
+/// until the next one is read.
+class BlobStore
+{
+public:
+    BlobStore() {}
+    ~BlobStore() { clear(); }
+
+    /// Drop-in replacement for Read1DArray() on blobs. The returned array stays valid until
+    /// clear() is called.
+    inline char* read(char* src, Array<char>& arr)
+    {
+        unsigned int marker;
+        PeekFixed(src, marker);
+        if (marker < BLOB_ENCODED)
+        {
+            return Read1DArray(src, arr);
+        }
+        if (marker == BLOB_ENCODED)
+        {
+            return readEncoded(src + sizeof(marker), arr);
+        }
+        if (marker == BLOB_STORE_EXTERNAL)
+        {
+            return readExternal(src + sizeof(marker), arr);
+        }
+
+        unsigned int id;
+        src = ReadFixed(src + sizeof(marker), id);
+        if (marker == BLOB_STORE_DEFINE)
+        {
+            PeekFixed(src, marker);
+            src = marker == BLOB_ENCODED ? readEncoded(src + sizeof(marker), arr) : Read1DArray(src, arr);
+            std::vector<char>& blob = mBlobs[id];
+            if (blob.empty() && arr.cnt > 0)
+            {
+                blob.assign(arr.v, arr.v + arr.cnt);
+                mBytes += arr.cnt;
+            }
+        }
+        const auto it = mBlobs.find(id);
+        if (it == mBlobs.end() || it->second.empty())
+        {
+            DBG_LOG("Reference to unknown blob %u\n", id);
+            arr.cnt = 0;
+            arr.v = NULL;
+            return src;
+        }
+        arr.cnt = it->second.size();
+        arr.v = it->second.data();
+        return src;
+    }
+
+    void clear();
+
+    /// Memory held by stored blobs
+    size_t bytes() const { return mBytes; }
+
+    /// Directory of the external blob store
+    void setExternalDir(const std::string& dir) { mExternalDir = dir; }
+    const std::string& externalDir() const { return mExternalDir; }
+
+    /// Where a blob is kept in the external store at dir
+    static std::string externalPath(const std::string& dir, const unsigned char* md5);
+
+private:
+    BlobStore(const BlobStore&) = delete;
+    BlobStore& operator=(const BlobStore&) = delete;
+
+    char* readExternal(char* src, Array<char>& arr);
+    char* readEncoded(char* src, Array<char>& arr);
+
+    struct Mapping
+    {
+        char* data;
+        size_t size;
+    };
+
+    std::unordered_map<unsigned int, std::vector<char>> mBlobs;
+    size_t mBytes = 0;
+    std::vector<char> mDecoded; ///< the last encoded blob read
+    std::string mExternalDir;
+    std::unordered_map<std::string, Mapping> mMapped; ///< by MD5, null data if it could not be mapped
+};
+
+}
+
+#endif
@@ -120,10 +120,13 @@ class ParseVisitor(stdapi.Visitor):
         print '    }'
     def visitBlob(self, blob, arg, name, func):
         print '    Array<char> %s; // blob' % (name)
-        print '    _src = Read1DArray(_src, %s);' % (name)
+        print '    _src = infile.blobStore().read(_src, %s);' % (name)
         print '    pValueTM->mType = Blob_Type;'
         print '    pValueTM->mBlobLen = %s.cnt;' % name
-        print '    if (pValueTM->mBlobLen) {'
+        print '    if (pValueTM->mBlobLen && callTM.mBorrowBlobs) {'
+        print '        pValueTM->mBlob = %s.v;' % name
+        print '        pValueTM->mBlobBorrowed = true;'
+        print '    } else if (pValueTM->mBlobLen) {'
         print '        pValueTM->mBlob = new char[pValueTM->mBlobLen];'
         print '        memcpy(pValueTM->mBlob, %s.v, pValueTM->mBlobLen);' % name
         print '    } else {'
@@ -239,10 +242,8 @@ class CallParser(object):
         for arg in func.args:
             print '    // %s' % arg.name
             print '    {'
-            print '    pValueTM = new ValueTM;'
-            print '    pValueTM->mName = "%s";' % arg.name
+            print '    pValueTM = callTM.AddArg("%s");' % arg.name
             ParseVisitor().visit(arg.type, arg, arg.name, func)
-            print '    callTM.mArgs.push_back(pValueTM);'
             print '    }'
             print
         print
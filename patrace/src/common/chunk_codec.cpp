@@ -0,0 +1,589 @@
+#include <common/chunk_codec.hpp>
+#include <common/file_format.hpp>
+
+#include <snappy.h>
+#include <string.h>
+#include <vector>
+#ifdef ENABLE_LZ4
+#include <lz4.h>
+#endif
+#ifdef ENABLE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#include <mutex>
+#include <unordered_map>
+#endif
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace common {
+
+static const char* codecNames[CHUNK_CODEC_COUNT] = { "snappy", "lz4", "zstd" };
+
+const char* chunkCodecName(ChunkCodec codec)
+{
+    if (codec == CHUNK_CODEC_COLUMNAR) return "columnar";
+    return codec < CHUNK_CODEC_COUNT ? codecNames[codec] : "unknown";
+}
+
+bool chunkCodecFromName(const std::string& name, ChunkCodec& codec)
+{
+    for (int i = 0; i < CHUNK_CODEC_COUNT; i++)
+    {
+        if (name == codecNames[i])
+        {
+            codec = (ChunkCodec)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool chunkCodecAvailable(ChunkCodec codec)
+{
+    switch (codec)
+    {
+    case CHUNK_CODEC_SNAPPY: return true;
+    case CHUNK_CODEC_COLUMNAR: return true;
+#ifdef ENABLE_LZ4
+    case CHUNK_CODEC_LZ4: return true;
+#endif
+#ifdef ENABLE_ZSTD
+    case CHUNK_CODEC_ZSTD: return true;
+#endif
+    default: return false;
+    }
+}
+
+size_t chunkMaxCompressedLength(ChunkCodec codec, size_t length)
+{
+    switch (codec)
+    {
+#ifdef ENABLE_LZ4
+    case CHUNK_CODEC_LZ4: return sizeof(uint32_t) + LZ4_compressBound(length);
+#endif
+#ifdef ENABLE_ZSTD
+    case CHUNK_CODEC_ZSTD: return sizeof(uint32_t) + ZSTD_compressBound(length);
+#endif
+    default: return snappy::MaxCompressedLength(length);
+    }
+}
+
+#ifdef ENABLE_ZSTD
+struct ZstdDictionary
+{
+    ZSTD_CDict* cdict;
+    ZSTD_DDict* ddict;
+};
+
+// Never freed, traces can share the same dictionary and chunks can be decompressed at any time
+static std::mutex dictionaryMutex;
+static std::unordered_map<unsigned, ZstdDictionary> dictionaries;
+
+static bool findDictionary(unsigned id, ZstdDictionary& dictionary)
+{
+    std::lock_guard<std::mutex> lock(dictionaryMutex);
+    const auto it = dictionaries.find(id);
+    if (it == dictionaries.end())
+    {
+        return false;
+    }
+    dictionary = it->second;
+    return true;
+}
+
+struct ZstdContexts
+{
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    ~ZstdContexts() { ZSTD_freeCCtx(cctx); ZSTD_freeDCtx(dctx); }
+};
+static thread_local ZstdContexts zstdContexts;
+#endif
+
+bool chunkTrainDictionary(const char* samples, size_t sampleSize, unsigned count, std::string& dictionary)
+{
+#ifdef ENABLE_ZSTD
+    std::vector<size_t> sizes(count, sampleSize);
+    std::vector<char> buffer(CHUNK_DICTIONARY_MAX_SIZE);
+    const size_t size = ZDICT_trainFromBuffer(buffer.data(), buffer.size(), samples, sizes.data(), count);
+    if (ZDICT_isError(size))
+    {
+        DBG_LOG("Could not train a chunk dictionary: %s\n", ZDICT_getErrorName(size));
+        return false;
+    }
+    dictionary.assign(buffer.data(), size);
+    return true;
+#else
+    (void)samples; (void)sampleSize; (void)count; (void)dictionary;
+    return false;
+#endif
+}
+
+unsigned chunkRegisterDictionary(const std::string& dictionary)
+{
+#ifdef ENABLE_ZSTD
+    const unsigned id = ZDICT_getDictID(dictionary.data(), dictionary.size());
+    if (id == 0)
+    {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(dictionaryMutex);
+    if (dictionaries.count(id) == 0)
+    {
+        ZstdDictionary d;
+        d.cdict = ZSTD_createCDict(dictionary.data(), dictionary.size(), ZSTD_CLEVEL_DEFAULT);
+        d.ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+        if (!d.cdict || !d.ddict)
+        {
+            ZSTD_freeCDict(d.cdict);
+            ZSTD_freeDDict(d.ddict);
+            return 0;
+        }
+        dictionaries[id] = d;
+    }
+    return id;
+#else
+    (void)dictionary;
+    return 0;
+#endif
+}
+
+size_t chunkCompress(ChunkCodec codec, const char* src, size_t length, char* dst, unsigned dictionaryId)
+{
+    size_t compressedLength = 0;
+    switch (codec)
+    {
+#ifdef ENABLE_LZ4
+    case CHUNK_CODEC_LZ4:
+    {
+        *(uint32_t*)dst = length;
+        const int result = LZ4_compress_default(src, dst + sizeof(uint32_t), length, LZ4_compressBound(length));
+        if (result <= 0)
+        {
+            DBG_LOG("LZ4 failed to compress a chunk of %u bytes\n", (unsigned)length);
+            return 0;
+        }
+        compressedLength = sizeof(uint32_t) + result;
+        break;
+    }
+#endif
+#ifdef ENABLE_ZSTD
+    case CHUNK_CODEC_ZSTD:
+    {
+        *(uint32_t*)dst = length;
+        ZstdDictionary dictionary;
+        size_t result;
+        if (dictionaryId != 0 && findDictionary(dictionaryId, dictionary))
+        {
+            result = ZSTD_compress_usingCDict(zstdContexts.cctx, dst + sizeof(uint32_t), ZSTD_compressBound(length),
+                                              src, length, dictionary.cdict);
+        }
+        else
+        {
+            result = ZSTD_compress(dst + sizeof(uint32_t), ZSTD_compressBound(length), src, length, ZSTD_CLEVEL_DEFAULT);
+        }
+        if (ZSTD_isError(result))
+        {
+            DBG_LOG("zstd failed to compress a chunk of %u bytes: %s\n", (unsigned)length, ZSTD_getErrorName(result));
+            return 0;
+        }
+        compressedLength = sizeof(uint32_t) + result;
+        break;
+    }
+#endif
+    default:
+        snappy::RawCompress(src, length, dst, &compressedLength);
+        break;
+    }
+    return compressedLength;
+}
+
+bool chunkUncompressedLength(ChunkCodec codec, const char* src, size_t length, size_t* result)
+{
+    if (codec == CHUNK_CODEC_SNAPPY)
+    {
+        return snappy::GetUncompressedLength(src, length, result);
+    }
+    if (!chunkCodecAvailable(codec) || length < sizeof(uint32_t))
+    {
+        return false;
+    }
+    *result = *(const uint32_t*)src;
+    return true;
+}
+
+static bool chunkUncompressColumnar(const char* src, size_t length, char* dst, const int* callLengths, int maxCallId);
+
+bool chunkUncompress(ChunkCodec codec, const char* src, size_t length, char* dst, const int* callLengths, int maxCallId)
+{
+    switch (codec)
+    {
+    case CHUNK_CODEC_SNAPPY:
+        return snappy::RawUncompress(src, length, dst);
+    case CHUNK_CODEC_COLUMNAR:
+        return chunkUncompressColumnar(src, length, dst, callLengths, maxCallId);
+#ifdef ENABLE_LZ4
+    case CHUNK_CODEC_LZ4:
+    {
+        if (length < sizeof(uint32_t)) return false;
+        const int uncompressedLength = *(const uint32_t*)src;
+        return LZ4_decompress_safe(src + sizeof(uint32_t), dst, length - sizeof(uint32_t), uncompressedLength) == uncompressedLength;
+    }
+#endif
+#ifdef ENABLE_ZSTD
+    case CHUNK_CODEC_ZSTD:
+    {
+        if (length < sizeof(uint32_t)) return false;
+        const size_t uncompressedLength = *(const uint32_t*)src;
+        const unsigned dictionaryId = ZSTD_getDictID_fromFrame(src + sizeof(uint32_t), length - sizeof(uint32_t));
+        if (dictionaryId != 0)
+        {
+            ZstdDictionary dictionary;
+            if (!findDictionary(dictionaryId, dictionary))
+            {
+                DBG_LOG("Chunk needs dictionary %u, which is not in the trace header\n", dictionaryId);
+                return false;
+            }
+            return ZSTD_decompress_usingDDict(zstdContexts.dctx, dst, uncompressedLength, src + sizeof(uint32_t), length - sizeof(uint32_t),
+                                              dictionary.ddict) == uncompressedLength;
+        }
+        return ZSTD_decompress(dst, uncompressedLength, src + sizeof(uint32_t), length - sizeof(uint32_t)) == uncompressedLength;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+// Columnar chunks
+
+enum ColumnarStream
+{
+    COLUMN_FUNC_IDS, ///< 2 bytes per call
+    COLUMN_THREADS, ///< tid and error byte, 2 bytes per call
+    COLUMN_LENGTHS, ///< toNext of each variable length call
+    COLUMN_ARGS,
+    COLUMN_BLOBS,
+    COLUMN_COUNT
+};
+
+/// Codec of a stream that is stored as it is
+#define COLUMN_STORED 0xffu
+
+struct ColumnHeader
+{
+    uint32_t codec;
+    uint32_t length;
+    uint32_t storedLength;
+};
+
+static const size_t columnarHeaderSize = 2 * sizeof(uint32_t) + COLUMN_COUNT * sizeof(ColumnHeader);
+
+size_t chunkMaxColumnarLength(ChunkCodec codec, size_t length)
+{
+    // the streams add up to the chunk, and compressing each adds at most a small constant to
+    // the bound of compressing them together
+    return columnarHeaderSize + chunkMaxCompressedLength(codec, length) + COLUMN_COUNT * 128;
+}
+
+static inline void append(std::vector<char>& column, const char* src, size_t length)
+{
+    column.insert(column.end(), src, src + length);
+}
+
+size_t chunkCompressColumnar(ChunkCodec codec, const char* src, size_t length, const int* callLengths, int maxCallId, char* dst)
+{
+    if (!callLengths || codec >= CHUNK_CODEC_COUNT)
+    {
+        return 0;
+    }
+
+    // kept per compression thread, so that they only grow once
+    thread_local std::vector<char> columns[COLUMN_COUNT];
+    for (std::vector<char>& column : columns)
+    {
+        column.clear();
+    }
+
+    const char* p = src;
+    const char* end = src + length;
+    uint32_t calls = 0;
+    while (p < end)
+    {
+        if ((size_t)(end - p) < sizeof(BCall))
+        {
+            return 0;
+        }
+        BCall call;
+        memcpy(&call, p, sizeof(call));
+        if (call.funcId == 0 || call.funcId > maxCallId)
+        {
+            return 0;
+        }
+        size_t callLength = callLengths[call.funcId];
+        size_t headerLength = sizeof(BCall);
+        if (callLength == 0)
+        {
+            if ((size_t)(end - p) < sizeof(BCall_vlen))
+            {
+                return 0;
+            }
+            uint32_t toNext;
+            memcpy(&toNext, p + sizeof(BCall), sizeof(toNext));
+            callLength = toNext;
+            headerLength = sizeof(BCall_vlen);
+            append(columns[COLUMN_LENGTHS], (const char*)&toNext, sizeof(toNext));
+        }
+        if (callLength < headerLength || callLength > (size_t)(end - p))
+        {
+            return 0;
+        }
+        append(columns[COLUMN_FUNC_IDS], p, sizeof(call.funcId));
+        append(columns[COLUMN_THREADS], p + sizeof(call.funcId), sizeof(BCall) - sizeof(call.funcId));
+        const size_t argsLength = callLength - headerLength;
+        append(columns[argsLength >= COLUMNAR_BLOB_MIN_SIZE ? COLUMN_BLOBS : COLUMN_ARGS], p + headerLength, argsLength);
+        p += callLength;
+        calls++;
+    }
+
+    uint32_t* header = (uint32_t*)dst;
+    header[0] = length;
+    header[1] = calls;
+    ColumnHeader* columnHeaders = (ColumnHeader*)(header + 2);
+    char* out = dst + columnarHeaderSize;
+    for (int i = 0; i < COLUMN_COUNT; i++)
+    {
+        const std::vector<char>& column = columns[i];
+        ColumnHeader h = { (uint32_t)codec, (uint32_t)column.size(), 0 };
+        if (!column.empty())
+        {
+            h.storedLength = chunkCompress(codec, column.data(), column.size(), out);
+        }
+        // not worth decompressing, most likely already compressed texture data, or the codec failed
+        if (h.storedLength == 0 || h.storedLength >= column.size() - column.size() / 8)
+        {
+            h.codec = COLUMN_STORED;
+            h.storedLength = column.size();
+            if (!column.empty())
+            {
+                memcpy(out, column.data(), column.size());
+            }
+        }
+        memcpy(&columnHeaders[i], &h, sizeof(h));
+        out += h.storedLength;
+    }
+    return out - dst;
+}
+
+static bool chunkUncompressColumnar(const char* src, size_t length, char* dst, const int* callLengths, int maxCallId)
+{
+    if (!callLengths || length < columnarHeaderSize)
+    {
+        return false;
+    }
+
+    // Uncompress the streams. Those stored as they are are read in place.
+    thread_local std::vector<char> buffers[COLUMN_COUNT];
+    const char* columns[COLUMN_COUNT];
+    const char* columnEnds[COLUMN_COUNT];
+    uint32_t header[2];
+    memcpy(header, src, sizeof(header));
+    const size_t uncompressedLength = header[0];
+    const uint32_t calls = header[1];
+    const char* in = src + columnarHeaderSize;
+    const char* end = src + length;
+    for (int i = 0; i < COLUMN_COUNT; i++)
+    {
+        ColumnHeader h;
+        memcpy(&h, src + 2 * sizeof(uint32_t) + i * sizeof(ColumnHeader), sizeof(h));
+        if (h.storedLength > (size_t)(end - in))
+        {
+            return false;
+        }
+        if (h.codec == COLUMN_STORED)
+        {
+            columns[i] = in;
+        }
+        else
+        {
+            size_t columnLength = 0;
+            if (h.codec >= CHUNK_CODEC_COUNT || !chunkCodecAvailable((ChunkCodec)h.codec)
+                || !chunkUncompressedLength((ChunkCodec)h.codec, in, h.storedLength, &columnLength) || columnLength != h.length)
+            {
+                return false;
+            }
+            buffers[i].resize(h.length);
+            if (!chunkUncompress((ChunkCodec)h.codec, in, h.storedLength, buffers[i].data()))
+            {
+                return false;
+            }
+            columns[i] = buffers[i].data();
+        }
+        columnEnds[i] = columns[i] + h.length;
+        in += h.storedLength;
+    }
+
+    // Interleave them back into call records
+    char* out = dst;
+    char* outEnd = dst + uncompressedLength;
+    for (uint32_t c = 0; c < calls; c++)
+    {
+        if (columnEnds[COLUMN_FUNC_IDS] - columns[COLUMN_FUNC_IDS] < 2 || columnEnds[COLUMN_THREADS] - columns[COLUMN_THREADS] < 2)
+        {
+            return false;
+        }
+        unsigned short funcId;
+        memcpy(&funcId, columns[COLUMN_FUNC_IDS], sizeof(funcId));
+        if (funcId == 0 || funcId > maxCallId)
+        {
+            return false;
+        }
+        size_t callLength = callLengths[funcId];
+        size_t headerLength = sizeof(BCall);
+        if (callLength == 0)
+        {
+            if (columnEnds[COLUMN_LENGTHS] - columns[COLUMN_LENGTHS] < (ptrdiff_t)sizeof(uint32_t))
+            {
+                return false;
+            }
+            uint32_t toNext;
+            memcpy(&toNext, columns[COLUMN_LENGTHS], sizeof(toNext));
+            columns[COLUMN_LENGTHS] += sizeof(toNext);
+            callLength = toNext;
+            headerLength = sizeof(BCall_vlen);
+        }
+        if (callLength < headerLength || callLength > (size_t)(outEnd - out))
+        {
+            return false;
+        }
+        const size_t argsLength = callLength - headerLength;
+        const int argsColumn = argsLength >= COLUMNAR_BLOB_MIN_SIZE ? COLUMN_BLOBS : COLUMN_ARGS;
+        if ((size_t)(columnEnds[argsColumn] - columns[argsColumn]) < argsLength)
+        {
+            return false;
+        }
+        memcpy(out, columns[COLUMN_FUNC_IDS], 2);
+        memcpy(out + 2, columns[COLUMN_THREADS], 2);
+        if (headerLength == sizeof(BCall_vlen))
+        {
+            memcpy(out + sizeof(BCall), columns[COLUMN_LENGTHS] - sizeof(uint32_t), sizeof(uint32_t));
+        }
+        memcpy(out + headerLength, columns[argsColumn], argsLength);
+        columns[COLUMN_FUNC_IDS] += 2;
+        columns[COLUMN_THREADS] += 2;
+        columns[argsColumn] += argsLength;
+        out += callLength;
+    }
+    return out == outEnd;
+}
+
+// CRC32C (Castagnoli), eight bytes at a time with the table below when there are no CRC instructions
+static const uint32_t CRC32C_POLY = 0x82f63b78;
+
+struct Crc32cTable
+{
+    uint32_t t[8][256];
+    Crc32cTable()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            for (int s = 1; s < 8; s++) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+        }
+    }
+};
+
+static uint32_t crc32cSoftware(const unsigned char* p, size_t length, uint32_t crc)
+{
+    static const Crc32cTable table;
+    const uint32_t (*t)[256] = table.t;
+    while (length >= 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+            ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while (length--)
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Built for SSE 4.2 on its own, so that the rest does not need it, and only called when the CPU has it
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(const unsigned char* p, size_t length, uint32_t crc)
+{
+    uint64_t crc64 = crc;
+    while (length >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (length--)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+static bool crc32cHasHardware()
+{
+    static const bool has = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.2"));
+    return has;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32cHardware(const unsigned char* p, size_t length, uint32_t crc)
+{
+    while (length >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        length -= 8;
+    }
+    while (length--)
+    {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+static bool crc32cHasHardware() { return true; }
+#endif
+
+uint32_t chunkChecksum(const char* data, size_t length, uint32_t crc)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    crc = ~crc;
+#if defined(__x86_64__) || defined(__ARM_FEATURE_CRC32)
+    if (crc32cHasHardware())
+    {
+        return ~crc32cHardware(p, length, crc);
+    }
+#endif
+    return ~crc32cSoftware(p, length, crc);
+}
+
+}
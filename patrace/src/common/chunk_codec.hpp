@@ -0,0 +1,135 @@
+#ifndef _COMMON_CHUNK_CODEC_HPP_
+#define _COMMON_CHUNK_CODEC_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+
+namespace common {
+
+/// Compression used for a chunk of the call stream. Every chunk is stored behind a 4 byte
+/// word holding the compressed length in the low bits and the codec in the top bits, so
+/// snappy chunks (codec 0) look exactly like they always have.
+///
+/// LZ4 and zstd need ENABLE_LZ4 / ENABLE_ZSTD at build time. Their chunk payload starts with
+/// the uncompressed length as a 4 byte word, since the raw formats do not carry it.
+enum ChunkCodec
+{
+    CHUNK_CODEC_SNAPPY = 0,
+    CHUNK_CODEC_LZ4 = 1,
+    CHUNK_CODEC_ZSTD = 2,
+    CHUNK_CODEC_COUNT,
+    /// Not a codec of its own: the calls of the chunk are split into streams, each compressed
+    /// with one of the codecs above. See chunkCompressColumnar().
+    CHUNK_CODEC_COLUMNAR = CHUNK_CODEC_COUNT
+};
+
+#define CHUNK_CODEC_SHIFT 30
+#define CHUNK_LENGTH_MASK ((1u << CHUNK_CODEC_SHIFT) - 1)
+
+inline uint32_t chunkPrefix(ChunkCodec codec, uint32_t compressedLength) { return ((uint32_t)codec << CHUNK_CODEC_SHIFT) | compressedLength; }
+inline ChunkCodec chunkPrefixCodec(uint32_t prefix) { return (ChunkCodec)(prefix >> CHUNK_CODEC_SHIFT); }
+inline uint32_t chunkPrefixLength(uint32_t prefix) { return prefix & CHUNK_LENGTH_MASK; }
+/// Prefix in place of a chunk that marks the end of the chunks, with the frame table of the
+/// trace behind it (see BFrameTableFooter). No chunk is this long.
+#define CHUNK_TRAILER_PREFIX 0xffffffffu
+
+const char* chunkCodecName(ChunkCodec codec);
+/// Parse "snappy", "lz4" or "zstd". Returns false for unknown names.
+bool chunkCodecFromName(const std::string& name, ChunkCodec& codec);
+/// Whether this build can read and write the codec.
+bool chunkCodecAvailable(ChunkCodec codec);
+
+size_t chunkMaxCompressedLength(ChunkCodec codec, size_t length);
+/// Returns the size of the compressed payload written to dst, which must hold
+/// chunkMaxCompressedLength() bytes, or 0 if lz4 or zstd failed. snappy does not fail, so
+/// callers can store the chunk with it instead. zstd chunks can be compressed with a
+/// registered dictionary, see chunkRegisterDictionary().
+size_t chunkCompress(ChunkCodec codec, const char* src, size_t length, char* dst, unsigned dictionaryId = 0);
+/// Only needs the first few bytes of the payload.
+bool chunkUncompressedLength(ChunkCodec codec, const char* src, size_t length, size_t* result);
+/// dst must hold chunkUncompressedLength() bytes. Columnar chunks need the size of each call
+/// of fixed size by function id, as in InFileBase::ExIdToLen(), up to maxCallId.
+bool chunkUncompress(ChunkCodec codec, const char* src, size_t length, char* dst, const int* callLengths = nullptr, int maxCallId = -1);
+
+/// zstd dictionaries make small chunks compress about as well as large ones, since what the
+/// calls of a trace have in common no longer has to be learnt anew in every chunk. The
+/// dictionary of a trace is stored in its header, and each zstd chunk compressed with it names
+/// it by its id, so chunks with and without it can be mixed. Need ENABLE_ZSTD.
+#define CHUNK_DICTIONARY_MAX_SIZE (110 * 1024)
+
+/// Train a dictionary of at most CHUNK_DICTIONARY_MAX_SIZE bytes from samples of calls, given
+/// as count pieces of sampleSize bytes. Returns false if there is too little to go by.
+bool chunkTrainDictionary(const char* samples, size_t sampleSize, unsigned count, std::string& dictionary);
+/// Make a dictionary available for compressing and decompressing chunks, for as long as the
+/// process runs. Returns its id, or 0 if it is not a valid zstd dictionary.
+unsigned chunkRegisterDictionary(const std::string& dictionary);
+
+/// Columnar chunks hold the same calls as a plain chunk, but split into streams of function
+/// ids, thread ids and error codes, lengths of variable length calls, call arguments and the
+/// arguments of calls with at least COLUMNAR_BLOB_MIN_SIZE bytes of them. Like values then sit
+/// next to each other, which compresses the many small calls much better than the interleaved
+/// records. Blobs that do not compress, like compressed textures, are stored as they are.
+///
+/// The payload starts with the uncompressed length and the number of calls, followed by the
+/// codec, length and stored length of each stream as 4 byte words, and then the streams.
+#define COLUMNAR_BLOB_MIN_SIZE 4096
+
+size_t chunkMaxColumnarLength(ChunkCodec codec, size_t length);
+/// Compress a chunk of calls into dst, which must hold chunkMaxColumnarLength() bytes, with
+/// codec for its streams. Returns 0 if the chunk is not a sequence of whole calls known to
+/// callLengths, like the chunk of the signature book, which must then be compressed as usual.
+size_t chunkCompressColumnar(ChunkCodec codec, const char* src, size_t length, const int* callLengths, int maxCallId, char* dst);
+
+/// CRC32C of a chunk as it is stored, length prefix included, continuing from crc to check a
+/// chunk in pieces. Uses the CRC32 instructions of SSE 4.2 or ARMv8 where the CPU has them.
+uint32_t chunkChecksum(const char* data, size_t length, uint32_t crc = 0);
+
+/// Chunks are written with up to this many bytes of calls, unless a single call is larger.
+#define CHUNK_BUFFER_MIN_CAPACITY (1024 * 1024)
+
+/// Storage for one chunk. Unlike std::vector<char>, resize() never initializes memory and never
+/// gives it back, so a buffer that is reused for chunk after chunk only allocates once. The
+/// contents are not preserved when the buffer has to grow.
+class ChunkBuffer
+{
+public:
+    char* data() { return mData.get(); }
+    const char* data() const { return mData.get(); }
+    size_t size() const { return mSize; }
+
+    void resize(size_t size)
+    {
+        if (size > mCapacity)
+        {
+            mCapacity = std::max<size_t>(size, CHUNK_BUFFER_MIN_CAPACITY);
+            mData.reset(new char[mCapacity]);
+        }
+        mSize = size;
+    }
+
+    void swap(ChunkBuffer& other)
+    {
+        std::swap(mData, other.mData);
+        std::swap(mSize, other.mSize);
+        std::swap(mCapacity, other.mCapacity);
+    }
+
+    /// Free the storage
+    void release()
+    {
+        mData.reset();
+        mSize = mCapacity = 0;
+    }
+
+private:
+    std::unique_ptr<char[]> mData;
+    size_t mSize = 0;
+    size_t mCapacity = 0;
+};
+
+}
+
+#endif
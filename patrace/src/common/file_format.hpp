@@ -35,18 +35,32 @@ struct Array {
 };
 
 #ifdef PLATFORM_64BIT
-// This spesialization owns the pointer it is assigned.
+// This spesialization owns the pointer it is assigned. Short arrays, such as the sources of
+// a shader, are kept in place, so that reading them allocates nothing.
 template <>
 struct Array<const char*> {
+    static const unsigned int INLINE_COUNT = 8;
+
     unsigned int cnt;
     const char** v;
+    const char* inlineV[INLINE_COUNT];
 
     operator const char** () {
         return v;
     }
 
     Array():v(NULL) {}
-    ~Array() {delete [] v;}
+    ~Array() { if (v != inlineV) delete [] v; }
+    Array(const Array&) = delete;
+    Array& operator=(const Array&) = delete;
+
+    /// Room for count pointers, set to NULL
+    const char** allocate(unsigned int count) {
+        if (v != inlineV) delete [] v;
+        v = count <= INLINE_COUNT ? inlineV : new const char*[count];
+        memset(v, 0, sizeof(const char*) * count);
+        return v;
+    }
 };
 #endif
 
@@ -157,6 +171,88 @@ public:
     }
 };
 
+// Binary copy of what is needed from the json header to start replaying a trace, in the last
+// bytes of the space reserved for the json header. It lets readers leave the json unparsed
+// until something else in it is asked for. It is only valid while jsonLength and jsonHash
+// match the json, so tools that edit the json in place simply make readers parse it again.
+#define HEADER_SUMMARY_MAGIC 0x50415348u // "HSAP"
+
+struct BHeaderSummaryThread {
+    int id;
+    unsigned int winW, winH;
+    int clientSideBufferSize;
+    int red, green, blue, alpha, depth, stencil, msaaSamples; // EGLConfig
+};
+
+struct BHeaderSummary {
+    enum Flags {
+        HAS_MULTI_THREAD = 1 << 0, ///< the member is there, and its value is in the flag below
+        MULTI_THREAD = 1 << 1,
+        HAS_FORCE_SINGLE_WINDOW = 1 << 2,
+        FORCE_SINGLE_WINDOW = 1 << 3,
+        HAS_SINGLE_SURFACE = 1 << 4, ///< its value is in singleSurface
+    };
+
+    unsigned int magic;
+    unsigned int size;          // sizeof(BHeaderSummary)
+    unsigned int jsonLength;
+    unsigned long long jsonHash; // see HeaderSummaryHash()
+    int defaultTid;
+    int glesVersion;
+    unsigned int frameCnt;
+    unsigned long long callCnt;
+    unsigned int flags;
+    int singleSurface;
+    unsigned int threadCnt;
+    BHeaderSummaryThread threads[MAX_RETRACE_THREADS];
+    char tracer[64];            // null-terminated, cut short if need be
+};
+
+/// FNV-1a of the json header, to tell whether the summary still matches it
+inline unsigned long long HeaderSummaryHash(const char* json, unsigned int len) {
+    unsigned long long hash = 0xcbf29ce484222325ull;
+    for (unsigned int i = 0; i < len; ++i) {
+        hash = (hash ^ (unsigned char)json[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Frame table written by the tracer, in the layout of a TraceIndex without its file checks: the
+// file offset and stream position of each chunk, then the stream position, size, first call and
+// call count of each frame, and then the CRC32C of each chunk if it was written with them. It
+// sits right in front of the header summary if it fits there, and otherwise after the last
+// chunk, behind a CHUNK_TRAILER_PREFIX that tells chunk readers where the chunks end, and behind
+// any other sections written there (see OutFile::WriteSection), with one of its own. Either way
+// it ends with this footer. The hash keeps a table that was partly overwritten, like by a longer
+// json header, from being used.
+#define FRAME_TABLE_MAGIC 0x4d524650u // "PFRM"
+
+struct BFrameTableFooter {
+    unsigned long long size;    // of the table in front of the footer
+    unsigned long long hash;    // HeaderSummaryHash() of the table
+    unsigned int magic;
+    unsigned int reserved;
+};
+
+// Program binaries embedded in a trace by embed_program_binaries, which the retracer loads in
+// place of compiling the shaders when it runs on the driver that built them (see -shadercache).
+// They are a section of their own after the last chunk, behind a CHUNK_TRAILER_PREFIX, and the
+// programBinaries member of the JSON header gives its offset and size. The section is this
+// header followed by count entries, each a BProgramBinary followed by the binary itself.
+#define PROGRAM_BINARIES_MAGIC 0x42475050u // "PPGB"
+
+struct BProgramBinariesHeader {
+    unsigned int magic;
+    unsigned int count;
+};
+
+struct BProgramBinary {
+    char md5[32];               // of the shader sources of the program, as text
+    char driver[32];            // MD5 of the GL vendor, renderer and version strings, as text
+    unsigned int format;        // binary format for glProgramBinary
+    unsigned int size;          // of the binary after it
+};
+
 
 enum CALL_ERROR_NO {
     CALL_GL_NO_ERROR = 0,
@@ -234,6 +330,54 @@ inline char* Write1DArray(char* dest, unsigned int len, const T* array) {
     return padwrite(dest+byLen);
 }
 
+// Blobs that are uploaded over and over (see the BlobStoreMinSize tracer parameter) are only
+// stored once. Instead of a length, their first word is one of these markers, followed by the
+// id of the blob. A definition is then followed by the blob as written by Write1DArray, and
+// later calls only carry the reference. See BlobStore for the reading side.
+#define BLOB_STORE_DEFINE 0xfffffffeu
+#define BLOB_STORE_REFERENCE 0xffffffffu
+
+inline char* WriteBlobDefinition(char* dest, unsigned int id, unsigned int len, const char* blob) {
+    dest = WriteFixed<unsigned int>(dest, BLOB_STORE_DEFINE);
+    dest = WriteFixed<unsigned int>(dest, id);
+    return Write1DArray<char>(dest, len, blob);
+}
+
+inline char* WriteBlobReference(char* dest, unsigned int id) {
+    dest = WriteFixed<unsigned int>(dest, BLOB_STORE_REFERENCE);
+    return WriteFixed<unsigned int>(dest, id);
+}
+
+// Blobs of thin traces (see pack_trace) are kept in a blob store outside of the trace, shared
+// by all traces packed into it, as <store>/<first two hex digits>/<MD5 in hex>. In place of
+// their length they have this marker, followed by the length and the 16 byte MD5 of the blob.
+// The store is named by the blobStore member of the JSON header.
+#define BLOB_STORE_EXTERNAL 0xfffffffdu
+#define BLOB_EXTERNAL_SIZE (2 * sizeof(unsigned int) + 16)
+
+inline char* WriteBlobExternal(char* dest, unsigned int len, const unsigned char* md5) {
+    dest = WriteFixed<unsigned int>(dest, BLOB_STORE_EXTERNAL);
+    dest = WriteFixed<unsigned int>(dest, len);
+    memcpy(dest, md5, 16);
+    return dest + 16;
+}
+
+// Large uncompressed texture uploads (see the TextureCompressMinSize tracer parameter) are
+// compressed on their own by the threads that compress the chunks, with a codec suited to them.
+// In place of their length they have this marker, followed by the codec (see BlobCodec), the
+// length and the encoded length, and then the encoded blob. It is padded with zeros to take as
+// much space as the blob would, so encoding does not move anything else in the call stream, and
+// the padding is all but free in the compressed chunk. With codec 0 the blob is as it is.
+#define BLOB_ENCODED 0xfffffffcu
+#define BLOB_ENCODED_HEADER_SIZE (4 * sizeof(unsigned int))
+
+inline char* WriteBlobEncodedHeader(char* dest, unsigned int len) {
+    dest = WriteFixed<unsigned int>(dest, BLOB_ENCODED);
+    dest = WriteFixed<unsigned int>(dest, 0);
+    dest = WriteFixed<unsigned int>(dest, len);
+    return WriteFixed<unsigned int>(dest, len);
+}
+
 // null-terminated
 inline char* WriteString(char* dest, const char* src) {
     unsigned int byLen = src ? strlen(src)+1 : 0;
@@ -286,6 +430,16 @@ inline char* WriteStringArray(char* dest, int cnt, const char* const* strv, cons
     return dest;
 }
 
+/// Upper bound of what WriteStringArray() writes
+inline size_t StringArraySize(int cnt, const char* const* strv, const int* lenv = NULL) {
+    size_t size = 2 * sizeof(unsigned int) + cnt * sizeof(unsigned int);
+    for (int i = 0; i < cnt; ++i) {
+        const size_t len = lenv ? lenv[i] : (strv[i] ? strlen(strv[i]) + 1 : 0);
+        size += sizeof(unsigned int) + len + 3;
+    }
+    return size;
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Read functions
 template <class T>
@@ -319,6 +473,20 @@ inline char* ReadFixed(char* src, T& val) {
     return PTR_PADDING(src+sizeof(T), 4);
 }
 
+// A fixed size argument as ReadFixed() reads it, padded to a multiple of 4 bytes. A struct of
+// these has the layout of a run of such arguments in a call, so retrace.py reads the arguments
+// of calls that only have fixed size ones with a single copy.
+template <class T>
+struct FixedWord {
+    char bytes[(sizeof(T) + 3) & ~3];
+
+    T get() const {
+        T val;
+        memcpy(&val, bytes, sizeof(T));
+        return val;
+    }
+};
+
 template <class T>
 inline char* Read1DArray(char* src, Array<T>& arr) {
 #if VERBOSE_FILE
@@ -364,11 +532,8 @@ inline char* ReadStringArray(char* src, Array<const char*>& arr) {
     return src;
 }
 #else
-// For 64 bits system, we allocate an array and later deallocate it
-// It's not so efficient, but only happens on desktop, which we don't care so much.
-    
-// Update 13 June 2014: also happens on 64bit iOS systems, but probably rarely enough
-// (e.g. during glShaderSource) that it isn't a large issue.
+// For 64 bits system, the 32 bit offsets in the file are turned into pointers of their own,
+// in place for short arrays and in an allocated array for long ones (see Array<const char*>).
 inline char* ReadStringArray(char* src, Array<const char*>& arr) {
     unsigned int byLen;
     src = ReadFixed(src, byLen);
@@ -376,8 +541,7 @@ inline char* ReadStringArray(char* src, Array<const char*>& arr) {
 
     // arr.v = byLen ? (const char**)src : NULL;
     if (byLen) {
-        arr.v = new const char*[arr.cnt];
-        memset(arr.v, 0, sizeof(const char*)*arr.cnt);
+        arr.allocate(arr.cnt);
     } else
         arr.v = NULL;
 
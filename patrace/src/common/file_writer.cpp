@@ -0,0 +1,921 @@
+#include <common/file_writer.hpp>
+#include <common/os.hpp>
+#include <common/os_time.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#define HAVE_MMAP_WRITER
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register) && defined(O_DIRECT)
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+namespace common {
+
+static const char* writerNames[] = { "stdio", "uring", "uring-direct", "mmap", "socket" };
+
+bool fileWriterFromName(const std::string& name, FileWriterKind& kind)
+{
+    for (int i = 0; i <= FILE_WRITER_MMAP; i++)
+    {
+        if (name == writerNames[i])
+        {
+            kind = (FileWriterKind)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* fileWriterName(FileWriterKind kind)
+{
+    return kind <= FILE_WRITER_SOCKET ? writerNames[kind] : "unknown";
+}
+
+FileWriterKind defaultFileWriterKind()
+{
+    FileWriterKind kind = FILE_WRITER_STDIO;
+    const char* name = getenv("PATRACE_FILE_WRITER");
+    if (name && !fileWriterFromName(name, kind))
+    {
+        DBG_LOG("Unknown PATRACE_FILE_WRITER %s, using stdio\n", name);
+    }
+    return kind;
+}
+
+class StdioWriter : public FileWriter
+{
+public:
+    explicit StdioWriter(FILE* file) : mFile(file) {}
+    ~StdioWriter() { close(); }
+
+    bool append(const void* data, size_t size) override
+    {
+        if (!write(data, size))
+            return false;
+        mSize += size;
+        return true;
+    }
+
+    bool commit() override { return flush(); }
+
+    bool writeAt(uint64_t offset, const void* data, size_t size) override
+    {
+        if (fseeko(mFile, offset, SEEK_SET) != 0 || !write(data, size) || fseeko(mFile, mSize, SEEK_SET) != 0)
+        {
+            if (mError == 0) mError = errno;
+            return false;
+        }
+        return true;
+    }
+
+    bool flush() override
+    {
+        if (fflush(mFile) != 0)
+        {
+            if (mError == 0) mError = errno;
+            return false;
+        }
+        return mError == 0;
+    }
+
+    bool close() override
+    {
+        if (!mFile)
+            return mError == 0;
+        flush();
+        fclose(mFile);
+        mFile = nullptr;
+        return mError == 0;
+    }
+
+    FileWriterKind kind() const override { return FILE_WRITER_STDIO; }
+
+private:
+    bool write(const void* data, size_t size)
+    {
+        const char* ptr = (const char*)data;
+        int err = 0;
+        do {
+            const size_t written = fwrite(ptr, 1, size, mFile);
+            ptr += written;
+            size -= written;
+            err = 0;
+            if (size > 0 && ferror(mFile))
+            {
+                err = errno;
+                clearerr(mFile);
+            }
+        } while (size > 0 && (err == EAGAIN || err == EWOULDBLOCK || err == EINTR));
+        if (size > 0)
+        {
+            if (mError == 0) mError = err ? err : EIO;
+            return false;
+        }
+        return true;
+    }
+
+    FILE* mFile;
+};
+
+#ifdef HAVE_IO_URING
+
+/// Writes in flight at a time, each from a buffer of its own
+#define URING_BUFFER_COUNT 8
+#define URING_BUFFER_SIZE (1024 * 1024)
+/// Alignment of the offset, length and memory of O_DIRECT writes
+#define URING_BLOCK_SIZE 4096
+
+/// The ring is driven with the raw system calls, so that liburing is not needed. Appends fill the
+/// current buffer, which is written once it is full or committed while the next one is filled.
+/// Each buffer has at most one write in flight, so the rings never overflow. Bytes rewritten with
+/// writeAt() go through the page cache with pwrite(), after the writes in flight are done.
+class UringWriter : public FileWriter
+{
+public:
+    UringWriter(int fd, int dataFd, bool direct) : mFd(fd), mDataFd(dataFd), mDirect(direct) {}
+    ~UringWriter() { close(); }
+
+    /// Set up the ring and the buffers. Returns false if the kernel does not let us.
+    bool init()
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        mRing = syscall(__NR_io_uring_setup, URING_BUFFER_COUNT, &p);
+        if (mRing < 0)
+        {
+            mError = errno;
+            return false;
+        }
+        mSqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        mCqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+        singleMap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#endif
+        if (singleMap)
+        {
+            mSqSize = mCqSize = std::max(mSqSize, mCqSize);
+        }
+        mSq = (char*)mmap(nullptr, mSqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRing, IORING_OFF_SQ_RING);
+        mCq = singleMap ? mSq : (char*)mmap(nullptr, mCqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRing, IORING_OFF_CQ_RING);
+        mSqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        mSqes = (io_uring_sqe*)mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRing, IORING_OFF_SQES);
+        if (mSq == MAP_FAILED || mCq == MAP_FAILED || (void*)mSqes == MAP_FAILED)
+        {
+            mError = errno;
+            return false;
+        }
+        mSqTail = (unsigned*)(mSq + p.sq_off.tail);
+        mSqMask = (unsigned*)(mSq + p.sq_off.ring_mask);
+        mSqArray = (unsigned*)(mSq + p.sq_off.array);
+        mCqHead = (unsigned*)(mCq + p.cq_off.head);
+        mCqTail = (unsigned*)(mCq + p.cq_off.tail);
+        mCqMask = (unsigned*)(mCq + p.cq_off.ring_mask);
+        mCqes = (io_uring_cqe*)(mCq + p.cq_off.cqes);
+
+        iovec iovs[URING_BUFFER_COUNT];
+        for (unsigned i = 0; i < URING_BUFFER_COUNT; i++)
+        {
+            void* data = nullptr;
+            if (posix_memalign(&data, URING_BLOCK_SIZE, URING_BUFFER_SIZE) != 0)
+            {
+                mError = ENOMEM;
+                return false;
+            }
+            mBuffers[i].data = (char*)data;
+            iovs[i].iov_base = data;
+            iovs[i].iov_len = URING_BUFFER_SIZE;
+        }
+        // registered buffers save the kernel from mapping them for every write, but count
+        // against RLIMIT_MEMLOCK, which is tiny on older kernels
+        mFixed = syscall(__NR_io_uring_register, mRing, IORING_REGISTER_BUFFERS, iovs, URING_BUFFER_COUNT) == 0;
+        return true;
+    }
+
+    bool append(const void* data, size_t size) override
+    {
+        const char* src = (const char*)data;
+        mSize += size;
+        while (size > 0)
+        {
+            Buffer& b = mBuffers[mCurrent];
+            const size_t n = std::min<size_t>(size, URING_BUFFER_SIZE - b.used);
+            memcpy(b.data + b.used, src, n);
+            b.used += n;
+            src += n;
+            size -= n;
+            if (b.used == URING_BUFFER_SIZE && !submit())
+                return false;
+        }
+        return mError == 0;
+    }
+
+    bool commit() override
+    {
+        return submit();
+    }
+
+    bool writeAt(uint64_t offset, const void* data, size_t size) override
+    {
+        waitAll();
+        // what is still in the current buffer gets written from there
+        const char* src = (const char*)data;
+        const Buffer& b = mBuffers[mCurrent];
+        const uint64_t end = offset + size;
+        if (end > b.offset && offset < b.offset + b.used)
+        {
+            const uint64_t from = std::max(offset, b.offset);
+            const uint64_t to = std::min(end, b.offset + b.used);
+            memcpy(b.data + (from - b.offset), src + (from - offset), to - from);
+        }
+        for (uint64_t pos = offset; pos < std::min(end, b.offset);)
+        {
+            const ssize_t written = pwrite(mFd, src + (pos - offset), std::min(end, b.offset) - pos, pos);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+            {
+                if (mError == 0) mError = written < 0 ? errno : EIO;
+                return false;
+            }
+            pos += written;
+        }
+        return mError == 0;
+    }
+
+    bool flush() override
+    {
+        submit();
+        waitAll();
+        return mError == 0;
+    }
+
+    bool close() override
+    {
+        if (mRing >= 0 && mSqes != MAP_FAILED && mBuffers[URING_BUFFER_COUNT - 1].data)
+        {
+            flush();
+            Buffer& b = mBuffers[mCurrent];
+            if (b.used > 0)
+            {
+                // the partial block left by O_DIRECT, padded and then cut off again
+                const size_t len = (b.used + URING_BLOCK_SIZE - 1) & ~(size_t)(URING_BLOCK_SIZE - 1);
+                memset(b.data + b.used, 0, len - b.used);
+                b.writeBegin = 0;
+                b.writeEnd = len;
+                issue(mCurrent);
+                waitAll();
+                if (ftruncate(mFd, mSize) != 0 && mError == 0)
+                    mError = errno;
+                b.used = 0;
+            }
+        }
+        if (mSqes != MAP_FAILED) munmap(mSqes, mSqesSize);
+        if (mCq != MAP_FAILED && mCq != mSq) munmap(mCq, mCqSize);
+        if (mSq != MAP_FAILED) munmap(mSq, mSqSize);
+        mSqes = (io_uring_sqe*)MAP_FAILED;
+        mSq = mCq = (char*)MAP_FAILED;
+        if (mRing >= 0) ::close(mRing);
+        mRing = -1;
+        for (Buffer& b : mBuffers)
+        {
+            free(b.data);
+            b.data = nullptr;
+        }
+        if (mDataFd >= 0 && mDataFd != mFd) ::close(mDataFd);
+        if (mFd >= 0) ::close(mFd);
+        mFd = mDataFd = -1;
+        return mError == 0;
+    }
+
+    FileWriterKind kind() const override { return mDirect ? FILE_WRITER_URING_DIRECT : FILE_WRITER_URING; }
+
+private:
+    struct Buffer
+    {
+        char* data = nullptr;
+        size_t used = 0; ///< bytes appended to it
+        uint64_t offset = 0; ///< in the file, of data[0]
+        size_t writeBegin = 0; ///< what is left of its write in flight
+        size_t writeEnd = 0;
+        iovec iov;
+        bool inFlight = false;
+    };
+
+    /// Write the current buffer, only whole blocks of it with O_DIRECT, and continue in the next one
+    bool submit()
+    {
+        Buffer& b = mBuffers[mCurrent];
+        size_t len = b.used;
+        if (mDirect)
+            len &= ~(size_t)(URING_BLOCK_SIZE - 1);
+        if (len == 0 || mError != 0)
+            return mError == 0;
+        b.writeBegin = 0;
+        b.writeEnd = len;
+        issue(mCurrent);
+        const unsigned next = (mCurrent + 1) % URING_BUFFER_COUNT;
+        while (mBuffers[next].inFlight && reap(true)) {}
+        if (mBuffers[next].inFlight)
+            return false;
+        Buffer& n = mBuffers[next];
+        n.offset = b.offset + len;
+        n.used = b.used - len;
+        memcpy(n.data, b.data + len, n.used);
+        mCurrent = next;
+        reap(false);
+        return mError == 0;
+    }
+
+    void issue(unsigned index)
+    {
+        Buffer& b = mBuffers[index];
+        const unsigned tail = *mSqTail;
+        const unsigned slot = tail & *mSqMask;
+        io_uring_sqe* sqe = &mSqes[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = mDataFd;
+        sqe->off = b.offset + b.writeBegin;
+        sqe->user_data = index;
+        if (mFixed)
+        {
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->addr = (uintptr_t)(b.data + b.writeBegin);
+            sqe->len = b.writeEnd - b.writeBegin;
+            sqe->buf_index = index;
+        }
+        else
+        {
+            b.iov.iov_base = b.data + b.writeBegin;
+            b.iov.iov_len = b.writeEnd - b.writeBegin;
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->addr = (uintptr_t)&b.iov;
+            sqe->len = 1;
+        }
+        mSqArray[slot] = slot;
+        __atomic_store_n(mSqTail, tail + 1, __ATOMIC_RELEASE);
+        b.inFlight = true;
+        if (enter(1, 0, 0) < 0)
+        {
+            b.inFlight = false;
+        }
+    }
+
+    int enter(unsigned submit, unsigned wait, unsigned flags)
+    {
+        int ret;
+        do {
+            ret = syscall(__NR_io_uring_enter, mRing, submit, wait, flags, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0 && mError == 0)
+            mError = errno;
+        return ret;
+    }
+
+    /// Handle the completed writes, waiting for one if wait is set. Returns false on errors.
+    bool reap(bool wait)
+    {
+        for (;;)
+        {
+            unsigned head = *mCqHead;
+            const unsigned tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+            if (head == tail)
+            {
+                if (!wait)
+                    return mError == 0;
+                if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+                    return false;
+                continue;
+            }
+            for (; head != tail; head++)
+            {
+                const io_uring_cqe& cqe = mCqes[head & *mCqMask];
+                complete(cqe.user_data, cqe.res);
+            }
+            __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+            return mError == 0;
+        }
+    }
+
+    void complete(unsigned index, int res)
+    {
+        Buffer& b = mBuffers[index];
+        b.inFlight = false;
+        if (res == -EINTR || res == -EAGAIN)
+        {
+            issue(index);
+        }
+        else if (res <= 0)
+        {
+            if (mError == 0) mError = res < 0 ? -res : EIO;
+        }
+        else if (b.writeBegin + res < b.writeEnd)
+        {
+            // short write, like when the disk is nearly full
+            b.writeBegin += res;
+            issue(index);
+        }
+    }
+
+    void waitAll()
+    {
+        for (const Buffer& b : mBuffers)
+        {
+            while (b.inFlight && reap(true)) {}
+        }
+    }
+
+    int mFd; ///< buffered, for writeAt()
+    int mDataFd; ///< for the buffers, O_DIRECT if mDirect
+    bool mDirect;
+    bool mFixed = false;
+    int mRing = -1;
+    char* mSq = (char*)MAP_FAILED;
+    char* mCq = (char*)MAP_FAILED;
+    io_uring_sqe* mSqes = (io_uring_sqe*)MAP_FAILED;
+    size_t mSqSize = 0;
+    size_t mCqSize = 0;
+    size_t mSqesSize = 0;
+    unsigned* mSqTail = nullptr;
+    unsigned* mSqMask = nullptr;
+    unsigned* mSqArray = nullptr;
+    unsigned* mCqHead = nullptr;
+    unsigned* mCqTail = nullptr;
+    unsigned* mCqMask = nullptr;
+    io_uring_cqe* mCqes = nullptr;
+    Buffer mBuffers[URING_BUFFER_COUNT];
+    unsigned mCurrent = 0;
+};
+
+#endif
+
+#ifdef HAVE_MMAP_WRITER
+
+/// Bytes of the file mapped at a time, which is also how far ahead of the appends it is allocated
+#define MMAP_WINDOW_SIZE (64 * 1024 * 1024)
+/// Bytes appended before the kernel is told to start writing them back
+#define MMAP_WRITEBACK_SIZE (8 * 1024 * 1024)
+
+/// Appends are copied into a window of the file mapped into memory, which is moved on when it is
+/// full. The window is allocated with fallocate() before it is mapped, so that a full disk is an
+/// error from fallocate() rather than a SIGBUS when the mapping is written. Bytes rewritten with
+/// writeAt() before the window go through the page cache with pwrite().
+class MmapWriter : public FileWriter
+{
+public:
+    explicit MmapWriter(int fd) : mFd(fd) {}
+    ~MmapWriter() { close(); }
+
+    /// Map the first window. Returns false if the file cannot be allocated or mapped.
+    bool init()
+    {
+        return map(0);
+    }
+
+    bool append(const void* data, size_t size) override
+    {
+        const char* src = (const char*)data;
+        while (size > 0 && mError == 0)
+        {
+            if (mSize == mWindowOffset + MMAP_WINDOW_SIZE && !map(mSize))
+                return false;
+            const size_t n = std::min<size_t>(size, mWindowOffset + MMAP_WINDOW_SIZE - mSize);
+            memcpy(mWindow + (mSize - mWindowOffset), src, n);
+            mSize += n;
+            src += n;
+            size -= n;
+        }
+        return mError == 0;
+    }
+
+    bool commit() override
+    {
+        // start writing back what was appended, so that dirty pages do not pile up
+        if (mSize - mWrittenBack >= MMAP_WRITEBACK_SIZE)
+        {
+            sync_file_range(mFd, mWrittenBack, mSize - mWrittenBack, SYNC_FILE_RANGE_WRITE);
+            mWrittenBack = mSize;
+        }
+        return mError == 0;
+    }
+
+    bool writeAt(uint64_t offset, const void* data, size_t size) override
+    {
+        const char* src = (const char*)data;
+        const uint64_t end = offset + size;
+        if (end > mWindowOffset && mWindow)
+        {
+            const uint64_t from = std::max(offset, mWindowOffset);
+            memcpy(mWindow + (from - mWindowOffset), src + (from - offset), end - from);
+        }
+        for (uint64_t pos = offset; pos < std::min(end, mWindowOffset);)
+        {
+            const ssize_t written = pwrite(mFd, src + (pos - offset), std::min(end, mWindowOffset) - pos, pos);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+            {
+                if (mError == 0) mError = written < 0 ? errno : EIO;
+                return false;
+            }
+            pos += written;
+        }
+        return mError == 0;
+    }
+
+    bool flush() override
+    {
+        // the mapping is the page cache, so it is already in the kernel's hands
+        return mError == 0;
+    }
+
+    bool close() override
+    {
+        if (mFd < 0)
+            return mError == 0;
+        unmap();
+        if (ftruncate(mFd, mSize) != 0 && mError == 0)
+            mError = errno;
+        ::close(mFd);
+        mFd = -1;
+        return mError == 0;
+    }
+
+    FileWriterKind kind() const override { return FILE_WRITER_MMAP; }
+
+private:
+    bool map(uint64_t offset)
+    {
+        unmap();
+        int err = 0;
+        do {
+            err = fallocate(mFd, 0, offset, MMAP_WINDOW_SIZE) == 0 ? 0 : errno;
+        } while (err == EINTR);
+        if (err != 0)
+        {
+            if (mError == 0) mError = err;
+            return false;
+        }
+        void* window = mmap(nullptr, MMAP_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, offset);
+        if (window == MAP_FAILED)
+        {
+            if (mError == 0) mError = errno;
+            return false;
+        }
+        mWindow = (char*)window;
+        mWindowOffset = offset;
+        return true;
+    }
+
+    void unmap()
+    {
+        if (mWindow)
+        {
+            munmap(mWindow, MMAP_WINDOW_SIZE);
+            mWindow = nullptr;
+        }
+    }
+
+    int mFd;
+    char* mWindow = nullptr;
+    uint64_t mWindowOffset = 0; ///< in the file, of mWindow[0]
+    uint64_t mWrittenBack = 0; ///< where the kernel was last told to start writing back
+};
+
+#endif
+
+bool isSocketName(const char* name)
+{
+    return strncmp(name, "tcp://", 6) == 0;
+}
+
+/// Streams the file to trace_receiver. append() and writeAt() queue messages, coalescing
+/// appends, which a thread of its own sends in order. When the queue holds the whole buffer,
+/// they wait for the network, and the waits are reported when the file is closed.
+class SocketWriter : public FileWriter
+{
+public:
+    SocketWriter(int fd, size_t capacity) : mFd(fd), mCapacity(std::max<size_t>(capacity, SOCKET_MESSAGE_SIZE)) {}
+    ~SocketWriter() { close(); }
+
+    bool init()
+    {
+        if (!sendAll(SOCKET_STREAM_MAGIC, strlen(SOCKET_STREAM_MAGIC)))
+        {
+            mError = errno;
+            return false;
+        }
+        mSender = std::thread(&SocketWriter::run, this);
+        return true;
+    }
+
+    bool append(const void* data, size_t size) override
+    {
+        const char* ptr = (const char*)data;
+        while (size > 0)
+        {
+            const size_t part = std::min(size, SOCKET_MESSAGE_SIZE);
+            if (!queue(SocketMessage::APPEND, 0, ptr, part))
+                return false;
+            ptr += part;
+            size -= part;
+            mSize += part;
+        }
+        return true;
+    }
+
+    bool commit() override { return mError == 0; } // the sender never waits for more
+
+    bool writeAt(uint64_t offset, const void* data, size_t size) override
+    {
+        const char* ptr = (const char*)data;
+        while (size > 0)
+        {
+            const size_t part = std::min(size, SOCKET_MESSAGE_SIZE);
+            if (!queue(SocketMessage::WRITE_AT, offset, ptr, part))
+                return false;
+            ptr += part;
+            offset += part;
+            size -= part;
+        }
+        return true;
+    }
+
+    bool flush() override
+    {
+        std::unique_lock<std::mutex> lk(mMutex);
+        mChanged.wait(lk, [&]{ return (mQueue.empty() && !mSending) || mError != 0; });
+        return mError == 0;
+    }
+
+    bool close() override
+    {
+        if (mFd < 0)
+            return mError == 0;
+        if (!mSender.joinable()) // never started
+        {
+            ::close(mFd);
+            mFd = -1;
+            return mError == 0;
+        }
+        flush();
+        {
+            std::lock_guard<std::mutex> lk(mMutex);
+            mStop = true;
+        }
+        mChanged.notify_all();
+        mSender.join();
+        if (mError == 0)
+        {
+            // the receiver answers once it has written everything
+            const SocketMessage end = { SocketMessage::CLOSE, 0, 0 };
+            char ok = 0;
+            if (!sendAll(&end, sizeof(end)) || recv(mFd, &ok, 1, MSG_WAITALL) != 1 || ok != 1)
+                mError = EIO;
+        }
+        ::close(mFd);
+        mFd = -1;
+        DBG_LOG("Streamed %llu MB, waited %lld ms for the network %u times\n", (unsigned long long)(mSent >> 20),
+                mStallTime * 1000 / os::timeFrequency, mStalls);
+        if (mError != 0)
+            DBG_LOG("The receiver did not write the whole file\n");
+        return mError == 0;
+    }
+
+    FileWriterKind kind() const override { return FILE_WRITER_SOCKET; }
+
+private:
+    struct Message
+    {
+        SocketMessage header;
+        std::vector<char> data;
+    };
+
+    bool queue(uint32_t type, uint64_t offset, const char* data, size_t size)
+    {
+        std::unique_lock<std::mutex> lk(mMutex);
+        if (mQueued + size > mCapacity && mError == 0)
+        {
+            // backpressure, the capture waits for the network
+            if (mStalls++ == 0)
+                DBG_LOG("Stream buffer of %u MB is full, waiting for the network\n", (unsigned)(mCapacity >> 20));
+            const long long begin = os::getTime();
+            mChanged.wait(lk, [&]{ return mQueued + size <= mCapacity || mError != 0; });
+            mStallTime += os::getTime() - begin;
+        }
+        if (mError != 0)
+            return false;
+        if (type == SocketMessage::APPEND && !mQueue.empty() && mQueue.back().header.type == SocketMessage::APPEND
+            && mQueue.back().data.size() + size <= SOCKET_MESSAGE_SIZE)
+        {
+            mQueue.back().data.insert(mQueue.back().data.end(), data, data + size);
+        }
+        else
+        {
+            mQueue.push_back(Message());
+            mQueue.back().header = { type, 0, offset };
+            mQueue.back().data.reserve(type == SocketMessage::APPEND ? SOCKET_MESSAGE_SIZE : size);
+            mQueue.back().data.assign(data, data + size);
+        }
+        mQueued += size;
+        lk.unlock();
+        mChanged.notify_all();
+        return true;
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lk(mMutex);
+        while (true)
+        {
+            mChanged.wait(lk, [&]{ return mStop || !mQueue.empty(); });
+            if (mQueue.empty())
+                return; // stopped
+            Message message = std::move(mQueue.front());
+            mQueue.pop_front();
+            mSending = true;
+            lk.unlock();
+
+            message.header.size = message.data.size();
+            const bool sent = sendAll(&message.header, sizeof(message.header)) && sendAll(message.data.data(), message.data.size());
+
+            lk.lock();
+            mSending = false;
+            mQueued -= message.data.size();
+            mSent += message.data.size();
+            if (!sent && mError == 0)
+            {
+                DBG_LOG("Failed to stream the trace: %s\n", strerror(errno));
+                mError = errno ? errno : EPIPE;
+            }
+            mChanged.notify_all();
+            if (!sent)
+                return;
+        }
+    }
+
+    bool sendAll(const void* data, size_t size)
+    {
+        const char* ptr = (const char*)data;
+        while (size > 0)
+        {
+            const ssize_t n = send(mFd, ptr, size, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            ptr += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    int mFd;
+    size_t mCapacity;
+    std::thread mSender;
+    std::mutex mMutex;
+    std::condition_variable mChanged;
+    std::deque<Message> mQueue;
+    size_t mQueued = 0; ///< bytes of data in mQueue and being sent
+    bool mSending = false;
+    bool mStop = false;
+    uint64_t mSent = 0;
+    unsigned mStalls = 0;
+    long long mStallTime = 0;
+};
+
+/// Connect to tcp://HOST:PORT
+static int connectSocket(const char* name)
+{
+    const std::string address = name + 6;
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+    {
+        DBG_LOG("Expected tcp://HOST:PORT, got %s\n", name);
+        errno = EINVAL;
+        return -1;
+    }
+    const std::string host = address.substr(0, colon);
+    const std::string port = address.substr(colon + 1);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *result = nullptr;
+    const int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+    if (err != 0)
+    {
+        DBG_LOG("Failed to resolve %s: %s\n", address.c_str(), gai_strerror(err));
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai && fd == -1; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1)
+        {
+            const int e = errno;
+            ::close(fd);
+            errno = e;
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+std::unique_ptr<FileWriter> createFileWriter(const char* name, FileWriterKind kind, size_t streamBuffer)
+{
+    if (isSocketName(name))
+    {
+        const int fd = connectSocket(name);
+        if (fd < 0)
+            return nullptr;
+        std::unique_ptr<SocketWriter> writer(new SocketWriter(fd, streamBuffer));
+        if (!writer->init())
+            return nullptr;
+        return std::unique_ptr<FileWriter>(writer.release());
+    }
+    struct stat st;
+    if (kind != FILE_WRITER_STDIO && stat(name, &st) == 0 && !S_ISREG(st.st_mode))
+    {
+        DBG_LOG("%s is not a regular file, writing it with stdio\n", name);
+        kind = FILE_WRITER_STDIO;
+    }
+#ifdef HAVE_MMAP_WRITER
+    if (kind == FILE_WRITER_MMAP)
+    {
+        const int fd = open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0)
+            return nullptr;
+        std::unique_ptr<MmapWriter> writer(new MmapWriter(fd));
+        if (writer->init())
+            return std::unique_ptr<FileWriter>(writer.release());
+        DBG_LOG("%s cannot be allocated and mapped (%s), writing it with stdio\n", name, strerror(writer->error()));
+    }
+#else
+    if (kind == FILE_WRITER_MMAP)
+    {
+        DBG_LOG("mmap writing is not supported by this build, writing %s with stdio\n", name);
+    }
+#endif
+#ifdef HAVE_IO_URING
+    if (kind == FILE_WRITER_URING || kind == FILE_WRITER_URING_DIRECT)
+    {
+        const int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0)
+            return nullptr;
+        int dataFd = fd;
+        if (kind == FILE_WRITER_URING_DIRECT)
+        {
+            dataFd = open(name, O_WRONLY | O_DIRECT | O_CLOEXEC);
+            if (dataFd < 0)
+            {
+                DBG_LOG("%s cannot be written with O_DIRECT (%s), writing it through the page cache\n", name, strerror(errno));
+                dataFd = fd;
+            }
+        }
+        std::unique_ptr<UringWriter> writer(new UringWriter(fd, dataFd, dataFd != fd));
+        if (writer->init())
+            return std::unique_ptr<FileWriter>(writer.release());
+        DBG_LOG("io_uring is not available (%s), writing %s with stdio\n", strerror(writer->error()), name);
+    }
+#else
+    if (kind == FILE_WRITER_URING || kind == FILE_WRITER_URING_DIRECT)
+    {
+        DBG_LOG("io_uring is not supported by this build, writing %s with stdio\n", name);
+    }
+#endif
+    FILE* file = fopen(name, "wb");
+    if (!file)
+        return nullptr;
+    return std::unique_ptr<FileWriter>(new StdioWriter(file));
+}
+
+}
@@ -0,0 +1,104 @@
+#ifndef _COMMON_FILE_WRITER_HPP_
+#define _COMMON_FILE_WRITER_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+namespace common {
+
+/// How a trace file gets written
+enum FileWriterKind
+{
+    /// Buffered stdio, works for any file
+    FILE_WRITER_STDIO,
+    /// Linux io_uring. Appended bytes are copied into a few registered buffers that the kernel
+    /// writes while the caller carries on, so writing only waits for the disk when every
+    /// buffer is still in flight.
+    FILE_WRITER_URING,
+    /// As above, with the appended data written with O_DIRECT so that it does not fill the
+    /// page cache. The last partial block is only written when the file is closed.
+    FILE_WRITER_URING_DIRECT,
+    /// Linux mmap. Appended bytes are copied straight into the file mapped into memory, a window
+    /// at a time, with no system call per write and no stdio buffer in between. The file is
+    /// allocated ahead of the window with fallocate(), and cut to size when it is closed.
+    FILE_WRITER_MMAP,
+    /// TCP. The file is streamed to a host, where trace_receiver writes it out, for devices with
+    /// little or slow storage. Appended bytes are queued in memory and sent by a thread of its
+    /// own, so writing only waits for the network when the queue is full. Used for names of the
+    /// form tcp://HOST:PORT, whatever kind is asked for.
+    FILE_WRITER_SOCKET
+};
+
+/// Bytes a FILE_WRITER_SOCKET writer queues by default before appending waits for the network
+#define SOCKET_WRITER_BUFFER (64 * 1024 * 1024)
+/// Largest message of a FILE_WRITER_SOCKET stream, appends are coalesced up to it
+#define SOCKET_MESSAGE_SIZE ((size_t)1024 * 1024)
+/// Start of a stream to trace_receiver, followed by messages that each start with a SocketMessage
+#define SOCKET_STREAM_MAGIC "PATSTRM1"
+
+/// Header of a message of a FILE_WRITER_SOCKET stream, in little endian, followed by size bytes
+/// of data. The receiver answers SOCKET_CLOSE with a single byte, 1 if the whole file was written.
+struct SocketMessage
+{
+    enum Type : uint32_t
+    {
+        APPEND = 1, ///< data goes at the end of the file
+        WRITE_AT = 2, ///< data overwrites the file at offset
+        CLOSE = 3 ///< the file is complete
+    };
+    uint32_t type;
+    uint32_t size;
+    uint64_t offset;
+};
+
+/// Whether name is of the form tcp://HOST:PORT, for FILE_WRITER_SOCKET
+bool isSocketName(const char* name);
+
+/// Parse "stdio", "uring", "uring-direct" or "mmap". Returns false for unknown names.
+bool fileWriterFromName(const std::string& name, FileWriterKind& kind);
+const char* fileWriterName(FileWriterKind kind);
+/// The writer named by the PATRACE_FILE_WRITER environment variable, stdio if it is not set.
+/// Lets the offline tools write their traces with io_uring.
+FileWriterKind defaultFileWriterKind();
+
+/// A file that is written from front to back, apart from some bytes before the end that are
+/// filled in later, like the header of a trace. Not thread safe.
+class FileWriter
+{
+public:
+    virtual ~FileWriter() {}
+
+    /// Add to the end of the file. The data can be reused once this returns.
+    virtual bool append(const void* data, size_t size) = 0;
+    /// Start writing what was appended so far, without waiting for it
+    virtual bool commit() = 0;
+    /// Overwrite bytes before the end of the file
+    virtual bool writeAt(uint64_t offset, const void* data, size_t size) = 0;
+    /// Wait until what was appended so far has been handed to the kernel
+    virtual bool flush() = 0;
+    /// Flush and close the file
+    virtual bool close() = 0;
+
+    virtual FileWriterKind kind() const = 0;
+    /// Size of the file, with everything appended
+    uint64_t size() const { return mSize; }
+    /// errno of the first write that failed, or 0
+    int error() const { return mError; }
+
+protected:
+    uint64_t mSize = 0;
+    int mError = 0;
+};
+
+/// Create name, or truncate it if it exists. Falls back to stdio where io_uring, O_DIRECT or
+/// fallocate() is not available, or when name is not a regular file, like a pipe that a trace is
+/// streamed through. Names for which isSocketName() holds are connected to instead, with a queue
+/// of streamBuffer bytes.
+/// Returns nullptr with errno set if the file cannot be opened.
+std::unique_ptr<FileWriter> createFileWriter(const char* name, FileWriterKind kind, size_t streamBuffer = SOCKET_WRITER_BUFFER);
+
+}
+
+#endif
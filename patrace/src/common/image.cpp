@@ -30,12 +30,23 @@
 
 #include <algorithm>
 #include <fstream>
+#include <string.h>
 
 #include "image.hpp"
 
 
 namespace image {
 
+bool Image::write(const char *filename) const
+{
+    const size_t length = strlen(filename);
+    if (length >= 4 && strcmp(filename + length - 4, ".qoi") == 0)
+    {
+        return writeQOI(filename);
+    }
+    return writePNG(filename);
+}
+
 void Image::writePixelData(const char* filename)
 {
     std::ofstream file;
@@ -32,11 +32,28 @@
 
 
 #include <fstream>
+#include <stdint.h>
 
 
 namespace image {
 
 
+/// How writePNG compresses
+struct PNGOptions {
+    int level = 1; ///< zlib level, from 0 (stored) to 9
+    int filter = -1; ///< PNG filter of every row, from 0 (none) to 4 (paeth), or -1 to pick one for each row
+    unsigned threads = 1; ///< compress large images as this many strips at once
+};
+
+/// Set how every following writePNG compresses. Set it before any image is written.
+void setPNGOptions(const PNGOptions &options);
+
+const PNGOptions &getPNGOptions();
+
+/// Parse none, sub, up, average, paeth or adaptive into a PNGOptions filter
+bool parsePNGFilter(const char *name, int &filter);
+
+
 class Image {
 public:
     unsigned width;
@@ -98,14 +115,53 @@ public:
 
     bool writePNG(const char *filename) const;
 
+    /// Write the lossless QOI format, which is several times faster to write than PNG
+    bool writeQOI(const char *filename) const;
+
+    /// Write QOI if the filename ends in .qoi, and PNG otherwise
+    bool write(const char *filename) const;
+
     /*
      * Writes the raw contents of an image (texture) to a file, byte-by-byte
      * Useful when the texture format used is not storable as a PNG
     */
     void writePixelData(const char* filename);
     double compare(Image &ref);
+
+    /// 64 bit difference hash of the image from the top row down, which changes in few bits
+    /// for small changes to the image, see hashDistance()
+    uint64_t perceptualHash() const;
+
+    /// CRC-32 of the pixels from the top row down
+    uint32_t checksum() const;
 };
 
+/// Number of bits in which two perceptual hashes differ
+unsigned hashDistance(uint64_t a, uint64_t b);
+
+/// Encoder of the chunks of a QOI image, without its header and end marker, a pixel at a time
+class QoiEncoder {
+public:
+    /// dst must hold 5 bytes for every pixel pushed
+    explicit QoiEncoder(unsigned char *dst) : p(dst) {}
+
+    /// Pixel as r, g, b, a from the lowest byte up
+    void push(uint32_t px);
+
+    /// End of what was written
+    unsigned char *finish();
+
+private:
+    unsigned char *p;
+    uint32_t index[64] = {};
+    uint32_t prev = 0xff000000;
+    unsigned run = 0;
+};
+
+/// Decode pixelCount pixels of 3 or 4 channels from the chunks QoiEncoder writes. Returns false if
+/// src runs out before that.
+bool qoiDecode(const unsigned char *src, size_t length, unsigned channels, unsigned char *dst, size_t pixelCount);
+
 bool writePixelsToBuffer(unsigned char *pixels,
                          unsigned w, unsigned h, unsigned numChannels,
                          bool flipped,
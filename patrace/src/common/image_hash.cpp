@@ -0,0 +1,129 @@
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <zlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "image.hpp"
+
+
+namespace image {
+
+static const unsigned HASH_COLUMNS = 9; ///< one more than the bits of a row, as each bit compares two cells
+static const unsigned HASH_ROWS = 8;
+
+/**
+ * Sum of the red, green and blue of count RGBA pixels.
+ */
+static uint64_t
+sumRGB(const unsigned char *p, unsigned count) {
+    uint64_t sum = 0;
+    unsigned i = 0;
+#if defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi32(0x00ffffff);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(p + i * 4)), mask);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    sum = (uint64_t)_mm_cvtsi128_si32(acc) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#elif defined(__ARM_NEON)
+    const uint8x16_t mask = vreinterpretq_u8_u32(vdupq_n_u32(0x00ffffff));
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 4 <= count; i += 4) {
+        const uint8x16_t v = vandq_u8(vld1q_u8(p + i * 4), mask);
+        acc = vpadalq_u16(acc, vpaddlq_u8(v));
+    }
+    const uint64x2_t acc64 = vpaddlq_u32(acc);
+    sum = vgetq_lane_u64(acc64, 0) + vgetq_lane_u64(acc64, 1);
+#endif
+    for (; i < count; ++i) {
+        sum += p[i * 4] + p[i * 4 + 1] + p[i * 4 + 2];
+    }
+    return sum;
+}
+
+/**
+ * The image is split into a grid of 9x8 cells, and each bit, from the top bit down, tells
+ * whether a cell is brighter than the one to its right, row by row from the top. Brightness
+ * is the mean of red, green and blue, or of the gray channel.
+ */
+uint64_t
+Image::perceptualHash() const {
+    if (width == 0 || height == 0 || channels == 0) {
+        return 0;
+    }
+    unsigned columnStart[HASH_COLUMNS + 1];
+    for (unsigned cx = 0; cx <= HASH_COLUMNS; ++cx) {
+        columnStart[cx] = (unsigned)((uint64_t)cx * width / HASH_COLUMNS);
+    }
+    uint64_t sums[HASH_ROWS][HASH_COLUMNS] = {};
+    unsigned rows[HASH_ROWS] = {};
+    const unsigned colorChannels = channels >= 3 ? 3 : 1;
+
+    const unsigned char *row = start();
+    for (unsigned y = 0; y < height; ++y, row += stride()) {
+        const unsigned cy = (unsigned)((uint64_t)y * HASH_ROWS / height);
+        rows[cy]++;
+        for (unsigned cx = 0; cx < HASH_COLUMNS; ++cx) {
+            const unsigned x0 = columnStart[cx];
+            const unsigned x1 = columnStart[cx + 1];
+            if (channels == 4) {
+                sums[cy][cx] += sumRGB(row + x0 * 4, x1 - x0);
+                continue;
+            }
+            uint64_t sum = 0;
+            for (unsigned x = x0; x < x1; ++x) {
+                const unsigned char *p = row + x * channels;
+                for (unsigned c = 0; c < colorChannels; ++c) {
+                    sum += p[c];
+                }
+            }
+            sums[cy][cx] += sum;
+        }
+    }
+
+    // compare means, as cells may differ in size by a row or a column
+    uint64_t hash = 0;
+    for (unsigned cy = 0; cy < HASH_ROWS; ++cy) {
+        for (unsigned cx = 0; cx + 1 < HASH_COLUMNS; ++cx) {
+            const uint64_t left = (uint64_t)rows[cy] * (columnStart[cx + 1] - columnStart[cx]);
+            const uint64_t right = (uint64_t)rows[cy] * (columnStart[cx + 2] - columnStart[cx + 1]);
+            hash <<= 1;
+            if (left && right && sums[cy][cx] * right > sums[cy][cx + 1] * left) {
+                hash |= 1;
+            }
+        }
+    }
+    return hash;
+}
+
+uint32_t
+Image::checksum() const {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    const unsigned char *row = start();
+    for (unsigned y = 0; y < height; ++y, row += stride()) {
+        crc = crc32(crc, row, width * channels);
+    }
+    return (uint32_t)crc;
+}
+
+unsigned
+hashDistance(uint64_t a, uint64_t b) {
+    uint64_t x = a ^ b;
+    unsigned bits = 0;
+    while (x) {
+        x &= x - 1;
+        ++bits;
+    }
+    return bits;
+}
+
+} /* namespace image */
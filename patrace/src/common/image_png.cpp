@@ -33,19 +33,278 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <algorithm>
 #include <fstream>
+#include <vector>
 
 #include "image.hpp"
 #include "os.hpp"
+#include "thread_pool.hpp"
 
 namespace image {
 
 
-static const int png_compression_level = Z_BEST_SPEED;
+static PNGOptions png_options;
+
+/// Smallest strip that writePNG compresses as a task of its own
+static const size_t PNG_STRIP_MIN_BYTES = 256 * 1024;
+
+/// Deflate window that each strip is primed with from the rows in front of it
+static const size_t PNG_WINDOW_SIZE = 32 * 1024;
+
+
+void setPNGOptions(const PNGOptions &options)
+{
+    png_options = options;
+    if (png_options.level < 0 || png_options.level > 9)
+        png_options.level = Z_BEST_SPEED;
+    if (png_options.filter < -1 || png_options.filter > 4)
+        png_options.filter = -1;
+    if (png_options.threads == 0)
+        png_options.threads = 1;
+}
+
+const PNGOptions &getPNGOptions()
+{
+    return png_options;
+}
+
+bool parsePNGFilter(const char *name, int &filter)
+{
+    static const char *names[] = { "none", "sub", "up", "average", "paeth" };
+    for (int i = 0; i < 5; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            filter = i;
+            return true;
+        }
+    }
+    if (strcmp(name, "adaptive") == 0) {
+        filter = -1;
+        return true;
+    }
+    return false;
+}
+
+/// The libpng filter flags for a PNGOptions filter
+static int filterFlags(int filter)
+{
+    return filter < 0 ? PNG_ALL_FILTERS : PNG_FILTER_NONE << filter;
+}
+
+
+static inline unsigned char paethPredictor(int a, int b, int c)
+{
+    const int p = a + b - c;
+    const int pa = abs(p - a);
+    const int pb = abs(p - b);
+    const int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+/// Filter a row of size bytes into out, behind its filter type byte. prev is the row above,
+/// or NULL for the first row.
+static void filterRow(int type, const unsigned char *row, const unsigned char *prev,
+                      unsigned bpp, size_t size, unsigned char *out)
+{
+    *out++ = type;
+    switch (type) {
+    case 0:
+        memcpy(out, row, size);
+        break;
+    case 1:
+        for (size_t i = 0; i < size; i++)
+            out[i] = row[i] - (i >= bpp ? row[i - bpp] : 0);
+        break;
+    case 2:
+        for (size_t i = 0; i < size; i++)
+            out[i] = row[i] - (prev ? prev[i] : 0);
+        break;
+    case 3:
+        for (size_t i = 0; i < size; i++)
+            out[i] = row[i] - (((i >= bpp ? row[i - bpp] : 0) + (prev ? prev[i] : 0)) >> 1);
+        break;
+    case 4:
+        for (size_t i = 0; i < size; i++) {
+            const int left = i >= bpp ? row[i - bpp] : 0;
+            const int up = prev ? prev[i] : 0;
+            const int upLeft = prev && i >= bpp ? prev[i - bpp] : 0;
+            out[i] = row[i] - paethPredictor(left, up, upLeft);
+        }
+        break;
+    }
+}
+
+/// Filter a row with the given filter, or with the one that leaves the smallest sum of
+/// absolute differences, as libpng does when it picks, if filter is -1
+static void filterRow(int filter, const unsigned char *row, const unsigned char *prev,
+                      unsigned bpp, size_t size, unsigned char *out, std::vector<unsigned char> &scratch)
+{
+    if (filter >= 0) {
+        filterRow(filter, row, prev, bpp, size, out);
+        return;
+    }
+    scratch.resize(size + 1);
+    unsigned long bestCost = ~0ul;
+    for (int type = 0; type < 5; type++) {
+        unsigned char *candidate = type == 0 ? out : scratch.data();
+        filterRow(type, row, prev, bpp, size, candidate);
+        unsigned long cost = 0;
+        for (size_t i = 1; i <= size && cost < bestCost; i++)
+            cost += abs((signed char)candidate[i]);
+        if (cost < bestCost) {
+            bestCost = cost;
+            if (candidate != out)
+                memcpy(out, candidate, size + 1);
+        }
+    }
+}
+
+/// A run of rows, filtered and deflated by a thread of its own, after a zlib header for the
+/// first strip, and before the adler32 of the whole image for the last one
+struct PNGStrip
+{
+    unsigned first;
+    unsigned last;
+    std::vector<unsigned char> data;
+    size_t size = 0;
+    uLong adler = 0;
+    uLong length = 0; ///< filtered bytes
+    bool ok = false;
+};
+
+static void deflateStrip(const Image &image, PNGStrip &strip, bool isLast)
+{
+    const size_t rowBytes = (size_t)image.width * image.channels;
+    const unsigned char *start = image.start();
+    const signed stride = image.stride();
+
+    // Filter the rows in front of the strip that the deflate window reaches back to as well, as
+    // the strip in front filters them, to compress the strip as one stream would
+    const unsigned windowRows = (PNG_WINDOW_SIZE + rowBytes) / (rowBytes + 1);
+    const unsigned from = strip.first > windowRows ? strip.first - windowRows : 0;
+    std::vector<unsigned char> filtered((size_t)(strip.last - from) * (rowBytes + 1));
+    std::vector<unsigned char> scratch;
+    for (unsigned y = from; y < strip.last; y++) {
+        const unsigned char *row = start + (ptrdiff_t)y * stride;
+        filterRow(png_options.filter, row, y > 0 ? row - stride : NULL, image.channels, rowBytes,
+                  filtered.data() + (size_t)(y - from) * (rowBytes + 1), scratch);
+    }
+    const size_t dictionarySize = std::min((size_t)(strip.first - from) * (rowBytes + 1), PNG_WINDOW_SIZE);
+    const unsigned char *input = filtered.data() + (size_t)(strip.first - from) * (rowBytes + 1);
+    strip.length = (size_t)(strip.last - strip.first) * (rowBytes + 1);
+    strip.adler = adler32(adler32(0, NULL, 0), input, strip.length);
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, png_options.level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+    if (dictionarySize > 0)
+        deflateSetDictionary(&strm, input - dictionarySize, dictionarySize);
+
+    // The bound is for a whole stream, so a single call does, with room for the flush marker,
+    // the zlib header in front and the adler32 behind
+    const size_t header = strip.first == 0 ? 2 : 0;
+    strip.data.resize(header + deflateBound(&strm, strip.length) + 16);
+    strm.next_in = const_cast<Bytef *>(input);
+    strm.avail_in = strip.length;
+    strm.next_out = strip.data.data() + header;
+    strm.avail_out = strip.data.size() - header - 4;
+    // Every strip but the last ends byte aligned on an empty stored block, so that the next one
+    // can carry on from there
+    const int ret = deflate(&strm, isLast ? Z_FINISH : Z_SYNC_FLUSH);
+    strip.ok = isLast ? ret == Z_STREAM_END : (ret == Z_OK && strm.avail_in == 0 && strm.avail_out > 0);
+    strip.size = strip.data.size() - 4 - strm.avail_out;
+    deflateEnd(&strm);
+}
+
+static bool writeChunk(FILE *fp, const char *type, const unsigned char *data, size_t size)
+{
+    const unsigned char length[4] = {
+        (unsigned char)(size >> 24), (unsigned char)(size >> 16), (unsigned char)(size >> 8), (unsigned char)size };
+    uLong crc = crc32(0, (const Bytef *)type, 4);
+    if (size > 0)
+        crc = crc32(crc, data, size);
+    const unsigned char crcBytes[4] = {
+        (unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc };
+    return fwrite(length, 4, 1, fp) == 1 && fwrite(type, 4, 1, fp) == 1 &&
+           (size == 0 || fwrite(data, size, 1, fp) == 1) && fwrite(crcBytes, 4, 1, fp) == 1;
+}
+
+/// Write a PNG as libpng would, but with strips of rows deflated as tasks of the shared pool, each
+/// primed with the end of the strip in front of it, and chained into one zlib stream the way
+/// pigz does
+static bool writePNGStrips(const Image &image, const char *filename, unsigned count)
+{
+    static const unsigned char colorTypes[] = { 0, 0, 4, 2, 6 };
+    if (image.channels < 1 || image.channels > 4)
+        return false;
+
+    std::vector<PNGStrip> strips(count);
+    common::TaskGroup tasks;
+    for (unsigned i = 0; i < count; i++) {
+        strips[i].first = (unsigned)((uint64_t)image.height * i / count);
+        strips[i].last = (unsigned)((uint64_t)image.height * (i + 1) / count);
+        PNGStrip &strip = strips[i];
+        const bool isLast = i + 1 == count;
+        tasks.run([&image, &strip, isLast]() { deflateStrip(image, strip, isLast); });
+    }
+    tasks.wait();
+    uLong adler = adler32(0, NULL, 0);
+    bool ok = true;
+    for (unsigned i = 0; i < count; i++) {
+        ok = ok && strips[i].ok;
+        adler = adler32_combine(adler, strips[i].adler, strips[i].length);
+    }
+    if (!ok) {
+        DBG_LOG("Failed to compress %s\n", filename);
+        return false;
+    }
+
+    // zlib header, with the compression level hint that zlib would give it
+    const int level = png_options.level;
+    const unsigned char cmf = 0x78;
+    unsigned char flg = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+    flg += 31 - ((cmf << 8) + flg) % 31;
+    strips.front().data[0] = cmf;
+    strips.front().data[1] = flg;
+    PNGStrip &last = strips.back();
+    for (int shift = 24; shift >= 0; shift -= 8)
+        last.data[last.size++] = (unsigned char)(adler >> shift);
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        DBG_LOG("Failed to open %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    const unsigned char ihdr[13] = {
+        (unsigned char)(image.width >> 24), (unsigned char)(image.width >> 16),
+        (unsigned char)(image.width >> 8), (unsigned char)image.width,
+        (unsigned char)(image.height >> 24), (unsigned char)(image.height >> 16),
+        (unsigned char)(image.height >> 8), (unsigned char)image.height,
+        8, colorTypes[image.channels], 0, 0, 0 };
+    ok = fwrite(signature, sizeof(signature), 1, fp) == 1 && writeChunk(fp, "IHDR", ihdr, sizeof(ihdr));
+    for (unsigned i = 0; i < count && ok; i++)
+        ok = writeChunk(fp, "IDAT", strips[i].data.data(), strips[i].size);
+    ok = ok && writeChunk(fp, "IEND", NULL, 0);
+    if (fclose(fp) != 0 || !ok) {
+        DBG_LOG("Failed to write %s\n", filename);
+        unlink(filename);
+        return false;
+    }
+    return true;
+}
 
 
 bool Image::writePNG(const char *filename) const
 {
+    const size_t bytes = (size_t)width * height * channels;
+    const unsigned strips = std::min<size_t>(png_options.threads, bytes / PNG_STRIP_MIN_BYTES);
+    if (strips > 1)
+        return writePNGStrips(*this, filename, strips);
+
     FILE *fp;
     png_structp png_ptr;
     png_infop info_ptr;
@@ -96,7 +355,8 @@ bool Image::writePNG(const char *filename) const
     png_set_IHDR(png_ptr, info_ptr, width, height, 8, color_type,
         PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
 
-    png_set_compression_level(png_ptr, png_compression_level);
+    png_set_compression_level(png_ptr, png_options.level);
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filterFlags(png_options.filter));
 
     png_write_info(png_ptr, info_ptr);
 
@@ -187,6 +447,10 @@ readPNG(const char *filename)
         png_set_tRNS_to_alpha(png_ptr);
     if (bit_depth == 16)
         png_set_strip_16(png_ptr);
+    if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png_ptr);
+    if (!(color_type & PNG_COLOR_MASK_ALPHA))
+        png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER); // not applied if tRNS gave it alpha
 
     for (unsigned y = 0; y < height; ++y) {
         png_bytep row = (png_bytep)(image->pixels + y*width*4);
@@ -284,7 +548,8 @@ bool writePixelsToBuffer(unsigned char *pixels,
                  type, PNG_INTERLACE_NONE,
                  PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
 
-    png_set_compression_level(png_ptr, png_compression_level);
+    png_set_compression_level(png_ptr, png_options.level);
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filterFlags(png_options.filter));
 
     png_write_info(png_ptr, info_ptr);
 
@@ -0,0 +1,187 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "image.hpp"
+#include "os.hpp"
+
+
+namespace image {
+
+void
+QoiEncoder::push(uint32_t px) {
+    if (px == prev) {
+        if (++run == 62) {
+            *p++ = 0xc0 | (run - 1); // QOI_OP_RUN
+            run = 0;
+        }
+        return;
+    }
+    if (run > 0) {
+        *p++ = 0xc0 | (run - 1);
+        run = 0;
+    }
+
+    const unsigned r = px & 0xff;
+    const unsigned g = (px >> 8) & 0xff;
+    const unsigned b = (px >> 16) & 0xff;
+    const unsigned a = px >> 24;
+    const unsigned hash = (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+    if (index[hash] == px) {
+        *p++ = hash; // QOI_OP_INDEX
+    } else {
+        index[hash] = px;
+        if (a == prev >> 24) {
+            const int dr = (signed char)(r - (prev & 0xff));
+            const int dg = (signed char)(g - ((prev >> 8) & 0xff));
+            const int db = (signed char)(b - ((prev >> 16) & 0xff));
+            const int drg = dr - dg;
+            const int dbg = db - dg;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                *p++ = 0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2); // QOI_OP_DIFF
+            } else if (drg >= -8 && drg <= 7 && dg >= -32 && dg <= 31 && dbg >= -8 && dbg <= 7) {
+                *p++ = 0x80 | (dg + 32); // QOI_OP_LUMA
+                *p++ = ((drg + 8) << 4) | (dbg + 8);
+            } else {
+                *p++ = 0xfe; // QOI_OP_RGB
+                *p++ = r;
+                *p++ = g;
+                *p++ = b;
+            }
+        } else {
+            *p++ = 0xff; // QOI_OP_RGBA
+            *p++ = r;
+            *p++ = g;
+            *p++ = b;
+            *p++ = a;
+        }
+    }
+    prev = px;
+}
+
+unsigned char *
+QoiEncoder::finish() {
+    if (run > 0) {
+        *p++ = 0xc0 | (run - 1);
+        run = 0;
+    }
+    return p;
+}
+
+bool
+qoiDecode(const unsigned char *src, size_t length, unsigned channels, unsigned char *dst, size_t pixelCount) {
+    const unsigned char *end = src + length;
+    uint32_t index[64] = {};
+    uint32_t px = 0xff000000;
+    unsigned run = 0;
+    for (size_t i = 0; i < pixelCount; ++i, dst += channels) {
+        if (run > 0) {
+            --run;
+        } else {
+            if (src >= end) {
+                return false;
+            }
+            const unsigned op = *src++;
+            if (op == 0xfe || op == 0xff) {
+                const unsigned bytes = op == 0xfe ? 3 : 4;
+                if ((size_t)(end - src) < bytes) {
+                    return false;
+                }
+                px = (px & 0xff000000) | src[0] | (src[1] << 8) | (src[2] << 16);
+                if (op == 0xff) {
+                    px = (px & 0x00ffffff) | ((uint32_t)src[3] << 24);
+                }
+                src += bytes;
+            } else if ((op & 0xc0) == 0x00) {
+                px = index[op];
+            } else if ((op & 0xc0) == 0x40) {
+                const unsigned r = (px + ((op >> 4) & 3) - 2) & 0xff;
+                const unsigned g = ((px >> 8) + ((op >> 2) & 3) - 2) & 0xff;
+                const unsigned b = ((px >> 16) + (op & 3) - 2) & 0xff;
+                px = (px & 0xff000000) | r | (g << 8) | (b << 16);
+            } else if ((op & 0xc0) == 0x80) {
+                if (src >= end) {
+                    return false;
+                }
+                const int dg = (int)(op & 0x3f) - 32;
+                const int drg = (int)(*src >> 4) - 8;
+                const int dbg = (int)(*src & 0xf) - 8;
+                ++src;
+                const unsigned r = (px + dg + drg) & 0xff;
+                const unsigned g = ((px >> 8) + dg) & 0xff;
+                const unsigned b = ((px >> 16) + dg + dbg) & 0xff;
+                px = (px & 0xff000000) | r | (g << 8) | (b << 16);
+            } else {
+                run = op & 0x3f; // QOI_OP_RUN of run + 1 pixels, this one included
+            }
+            const unsigned hash = ((px & 0xff) * 3 + ((px >> 8) & 0xff) * 5 + ((px >> 16) & 0xff) * 7 + (px >> 24) * 11) % 64;
+            index[hash] = px;
+        }
+        dst[0] = px & 0xff;
+        dst[1] = (px >> 8) & 0xff;
+        dst[2] = (px >> 16) & 0xff;
+        if (channels == 4) {
+            dst[3] = px >> 24;
+        }
+    }
+    return true;
+}
+
+/**
+ * https://qoiformat.org/qoi-specification.pdf
+ *
+ * Gray images are written as RGB and gray with alpha as RGBA, as QOI has no gray formats.
+ */
+bool
+Image::writeQOI(const char *filename) const {
+    if (channels < 1 || channels > 4) {
+        return false;
+    }
+    const unsigned outChannels = (channels == 2 || channels == 4) ? 4 : 3;
+    const size_t pixelCount = (size_t)width * height;
+    std::vector<unsigned char> out(14 + pixelCount * (outChannels + 1) + 8);
+    unsigned char *p = out.data();
+
+    memcpy(p, "qoif", 4);
+    p += 4;
+    for (unsigned value : { width, height }) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            *p++ = (unsigned char)(value >> shift);
+        }
+    }
+    *p++ = outChannels;
+    *p++ = 0; // sRGB with linear alpha
+
+    QoiEncoder encoder(p);
+    for (const unsigned char *row = start(); row != end(); row += stride()) {
+        for (unsigned x = 0; x < width; ++x) {
+            const unsigned char *src = row + x * channels;
+            const unsigned r = src[0];
+            const unsigned g = channels >= 3 ? src[1] : r;
+            const unsigned b = channels >= 3 ? src[2] : r;
+            const unsigned a = channels == 4 ? src[3] : channels == 2 ? src[1] : 255;
+            encoder.push(r | (g << 8) | (b << 16) | (a << 24));
+        }
+    }
+    p = encoder.finish();
+    static const unsigned char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    memcpy(p, padding, sizeof(padding));
+    p += sizeof(padding);
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        DBG_LOG("Failed to open %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    const bool written = fwrite(out.data(), p - out.data(), 1, fp) == 1;
+    if (fclose(fp) != 0 || !written) {
+        DBG_LOG("Failed to write %s\n", filename);
+        remove(filename);
+        return false;
+    }
+    return true;
+}
+
+} /* namespace image */
@@ -1,4 +1,11 @@
 #include <common/in_file.hpp>
+#include <common/base64.hpp>
+#include <common/chunk_codec.hpp>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 namespace common {
 
@@ -131,27 +138,189 @@ bool InFileBase::parseHeader(BHeaderV3 hdrV3, Json::Value &jsonRoot)
     return false; // unreachable
 }
 
+bool InFileBase::readJsonHeader(const BHeaderV3& hdr, const char* base, size_t size, const char* parseEnd)
+{
+    mJsonText.clear();
+    mJsonParsed = true;
+    mHasSummary = false;
+    const char* json = base + hdr.jsonFileBegin;
+    if (hdr.jsonFileEnd >= hdr.jsonFileBegin + (long long)sizeof(BHeaderSummary) && (uint64_t)hdr.jsonFileEnd <= size
+        && hdr.jsonLength <= hdr.jsonFileEnd - hdr.jsonFileBegin - sizeof(BHeaderSummary))
+    {
+        memcpy(&mSummary, base + hdr.jsonFileEnd - sizeof(BHeaderSummary), sizeof(BHeaderSummary));
+        if (mSummary.magic == HEADER_SUMMARY_MAGIC && mSummary.size == sizeof(BHeaderSummary)
+            && mSummary.jsonLength == hdr.jsonLength && mSummary.threadCnt <= (unsigned)MAX_RETRACE_THREADS
+            && mSummary.jsonHash == HeaderSummaryHash(json, hdr.jsonLength))
+        {
+            mSummary.tracer[sizeof(mSummary.tracer) - 1] = '\0';
+            mJsonText.assign(json, hdr.jsonLength);
+            mJsonParsed = false;
+            mHasSummary = true;
+            return true;
+        }
+    }
+
+    Json::Reader reader;
+    return reader.parse(json, parseEnd, mJsonHeader) && checkJsonMembers(mJsonHeader);
+}
+
+const Json::Value& InFileBase::getJSONHeader() const
+{
+    if (!mJsonParsed)
+    {
+        Json::Reader reader;
+        if (!reader.parse(mJsonText.data(), mJsonText.data() + mJsonText.size(), mJsonHeader))
+        {
+            DBG_LOG("Failed to parse the JSON header\n");
+        }
+        mJsonParsed = true;
+    }
+    return mJsonHeader;
+}
+
+// Skip the JSON string at json[i], which is a '"'
+static size_t skipJsonString(const std::string& json, size_t i)
+{
+    for (i++; i < json.size() && json[i] != '"'; i++)
+    {
+        if (json[i] == '\\') i++;
+    }
+    return i + 1;
+}
+
+// Skip the JSON value at json[i]
+static size_t skipJsonValue(const std::string& json, size_t i)
+{
+    int depth = 0;
+    while (i < json.size())
+    {
+        const char c = json[i];
+        if (c == '"')
+        {
+            i = skipJsonString(json, i);
+            if (depth == 0) return i;
+            continue;
+        }
+        if (c == '{' || c == '[')
+        {
+            depth++;
+        }
+        else if (c == '}' || c == ']')
+        {
+            if (depth == 0) return i;
+            if (--depth == 0) return i + 1;
+        }
+        else if (c == ',' && depth == 0)
+        {
+            return i;
+        }
+        i++;
+    }
+    return i;
+}
+
+static size_t skipJsonSpace(const std::string& json, size_t i)
+{
+    while (i < json.size() && isspace((unsigned char)json[i])) i++;
+    return i;
+}
+
+Json::Value InFileBase::getJSONHeaderMember(const char* name) const
+{
+    if (mJsonParsed)
+    {
+        return mJsonHeader.get(name, Json::Value());
+    }
+
+    if (mHasSummary)
+    {
+        if (!strcmp(name, "defaultTid")) return mSummary.defaultTid;
+        if (!strcmp(name, "glesVersion")) return mSummary.glesVersion;
+        if (!strcmp(name, "frameCnt")) return mSummary.frameCnt;
+        if (!strcmp(name, "callCnt")) return (Json::Value::UInt64)mSummary.callCnt;
+        if (!strcmp(name, "tracer")) return mSummary.tracer[0] ? Json::Value(mSummary.tracer) : Json::Value();
+        if (!strcmp(name, "multiThread"))
+            return (mSummary.flags & BHeaderSummary::HAS_MULTI_THREAD) ? Json::Value((mSummary.flags & BHeaderSummary::MULTI_THREAD) != 0) : Json::Value();
+        if (!strcmp(name, "forceSingleWindow"))
+            return (mSummary.flags & BHeaderSummary::HAS_FORCE_SINGLE_WINDOW) ? Json::Value((mSummary.flags & BHeaderSummary::FORCE_SINGLE_WINDOW) != 0) : Json::Value();
+        if (!strcmp(name, "singleSurface"))
+            return (mSummary.flags & BHeaderSummary::HAS_SINGLE_SURFACE) ? Json::Value(mSummary.singleSurface) : Json::Value();
+    }
+
+    // Walk the members of the top level object, and only parse the one asked for
+    const size_t nameLength = strlen(name);
+    size_t i = skipJsonSpace(mJsonText, 0);
+    if (i >= mJsonText.size() || mJsonText[i] != '{') return getJSONHeader().get(name, Json::Value());
+    i++;
+    while (true)
+    {
+        i = skipJsonSpace(mJsonText, i);
+        if (i >= mJsonText.size() || mJsonText[i] != '"') break;
+        const size_t keyEnd = skipJsonString(mJsonText, i);
+        const bool match = keyEnd - i - 2 == nameLength && mJsonText.compare(i + 1, nameLength, name) == 0;
+        i = skipJsonSpace(mJsonText, keyEnd);
+        if (i >= mJsonText.size() || mJsonText[i] != ':') break;
+        const size_t valueBegin = skipJsonSpace(mJsonText, i + 1);
+        i = skipJsonValue(mJsonText, valueBegin);
+        if (match)
+        {
+            Json::Value value;
+            Json::Reader reader;
+            if (!reader.parse(mJsonText.data() + valueBegin, mJsonText.data() + i, value)) break;
+            return value;
+        }
+        i = skipJsonSpace(mJsonText, i);
+        if (i >= mJsonText.size() || mJsonText[i] != ',') return Json::Value(); // end of the object
+        i++;
+    }
+    return getJSONHeader().get(name, Json::Value()); // not the JSON expected, let the parser decide
+}
+
 const std::string InFileBase::getJSONHeaderAsString(bool prettyPrint)
 {
     if (prettyPrint) {
         Json::StyledWriter writer;
-        return writer.write( mJsonHeader );
+        return writer.write( getJSONHeader() );
     } else {
         Json::FastWriter writer;
-        return writer.write( mJsonHeader );
+        return writer.write( getJSONHeader() );
     }
     return ""; // unreachable
 }
 
 int InFileBase::getDefaultThreadID() const
 {
-    return mJsonHeader.get("defaultTid", 0).asInt();
+    return getJSONHeaderMember("defaultTid").asInt();
 }
 
 const Json::Value InFileBase::getJSONThreadById(int id) const
 {
-    const Json::Value threadArray = mJsonHeader["threads"];
-    for (const auto& i : threadArray) if (i["id"].asInt() == id) return i;
+    if (!mJsonParsed && mHasSummary)
+    {
+        for (unsigned i = 0; i < mSummary.threadCnt; i++)
+        {
+            const BHeaderSummaryThread& t = mSummary.threads[i];
+            if (t.id != id) continue;
+            Json::Value v;
+            v["id"] = t.id;
+            v["winW"] = t.winW;
+            v["winH"] = t.winH;
+            v["clientSideBufferSize"] = t.clientSideBufferSize;
+            v["EGLConfig"]["red"] = t.red;
+            v["EGLConfig"]["green"] = t.green;
+            v["EGLConfig"]["blue"] = t.blue;
+            v["EGLConfig"]["alpha"] = t.alpha;
+            v["EGLConfig"]["depth"] = t.depth;
+            v["EGLConfig"]["stencil"] = t.stencil;
+            v["EGLConfig"]["msaaSamples"] = t.msaaSamples;
+            return v;
+        }
+    }
+    else
+    {
+        const Json::Value& threadArray = getJSONHeader()["threads"];
+        for (const auto& i : threadArray) if (i["id"].asInt() == id) return i;
+    }
     DBG_LOG("Could not find thread id %d in json value\n", id);
     return Json::Value();
 }
@@ -163,7 +332,7 @@ HeaderVersion InFileBase::getHeaderVersion() const
 
 void InFileBase::printHeaderInfo()
 {
-    const int tid = mJsonHeader.get("defaultTid", 0).asInt();
+    const int tid = getDefaultThreadID();
     Json::Value defaultThread = getJSONThreadById(tid);
     Json::Value defaultEGL = defaultThread["EGLConfig"];
     printf("default tid  %d\n", defaultThread["id"].asInt() );
@@ -177,9 +346,114 @@ void InFileBase::printHeaderInfo()
     printf("winWidth     %d\n", defaultThread["winW"].asInt() );
     printf("winHeight    %d\n", defaultThread["winH"].asInt() );
     printf("texCompress  %d\n", defaultThread["texCompress"].asInt() );
-    printf("frame count  %d\n", mJsonHeader["frameCnt"].asInt() );
-    printf("GLES version %d\n", mJsonHeader["glesVersion"].asInt() );
-    printf("tracer       %s\n", mJsonHeader["tracer"].asString().c_str());
+    printf("frame count  %d\n", getJSONHeaderMember("frameCnt").asInt() );
+    printf("GLES version %d\n", getJSONHeaderMember("glesVersion").asInt() );
+    printf("tracer       %s\n", getJSONHeaderMember("tracer").asString().c_str());
+}
+
+static bool isUniformSetter(const char* name)
+{
+    const size_t len = strlen(name);
+    if (len > 3 && strcmp(name + len - 3, "EXT") == 0)
+        return false;
+    if (strncmp(name, "glProgramUniform", strlen("glProgramUniform")) == 0)
+        name += strlen("glProgramUniform");
+    else if (strncmp(name, "glUniform", strlen("glUniform")) == 0)
+        name += strlen("glUniform");
+    else
+        return false;
+    return (name[0] >= '1' && name[0] <= '4') || strncmp(name, "Matrix", strlen("Matrix")) == 0;
+}
+
+void InFileBase::buildExIdTables()
+{
+    mNameToExId.clear();
+    mExIdToCallFlags.assign(mExIdToName.size(), FREQUENCY_NONE);
+    mExIdToProps.assign(mExIdToName.size(), 0);
+    for (unsigned id = 1; id < mExIdToName.size(); ++id)
+    {
+        const char* name = mExIdToName[id].c_str();
+        mNameToExId.emplace(mExIdToName[id], id); // keeps the first id if a name is repeated
+        mExIdToCallFlags[id] = GetCallFlags(name);
+
+        unsigned props = 0;
+        if (strncmp(name, "eglSwapBuffers", strlen("eglSwapBuffers")) == 0)
+            props |= CALL_PROP_SWAP | CALL_PROP_DISCARDS_FRAMEBUFFER;
+        else if (strncmp(name, "glDraw", strlen("glDraw")) == 0 && strcmp(name, "glDrawBuffers") != 0 && strcmp(name, "glDrawBuffersEXT") != 0)
+            props |= CALL_PROP_DRAW;
+        else if (strcmp(name, "glDispatchCompute") == 0 || strcmp(name, "glDispatchComputeIndirect") == 0)
+            props |= CALL_PROP_DISPATCH;
+        else if (strcmp(name, "glReadPixels") == 0 || strcmp(name, "glFlush") == 0 || strcmp(name, "glFinish") == 0
+                 || strcmp(name, "glBindFramebuffer") == 0)
+            props |= CALL_PROP_DISCARDS_FRAMEBUFFER;
+        else if (isUniformSetter(name))
+            props |= CALL_PROP_UNIFORM;
+        mExIdToProps[id] = props;
+    }
+}
+
+void InFileBase::loadChunkDictionary()
+{
+    const Json::Value member = getJSONHeaderMember("chunkDictionary");
+    if (member.isNull())
+    {
+        return;
+    }
+    const std::string encoded = member.asString();
+    std::vector<char> dictionary;
+    if (!base64_decode(encoded.data(), encoded.size(), dictionary)
+        || chunkRegisterDictionary(std::string(dictionary.begin(), dictionary.end())) == 0)
+    {
+        DBG_LOG("Failed to load the chunk dictionary of the trace, chunks compressed with it cannot be read\n");
+    }
+}
+
+void InFileBase::findExternalBlobStore()
+{
+    const char* env = getenv("PATRACE_BLOB_STORE");
+    if (env && *env)
+    {
+        mBlobStore.setExternalDir(env);
+        return;
+    }
+    const Json::Value member = getJSONHeaderMember("blobStore");
+    if (!member.isString())
+    {
+        return;
+    }
+    std::string dir = member.asString();
+    const size_t slash = mFileName.rfind('/');
+    if (!dir.empty() && dir[0] != '/' && slash != std::string::npos)
+    {
+        dir = mFileName.substr(0, slash + 1) + dir;
+    }
+    mBlobStore.setExternalDir(dir);
+}
+
+bool InFileBase::readSection(const char* member, std::vector<char>& data) const
+{
+    const Json::Value section = getJSONHeaderMember(member);
+    if (!section.isObject() || !section.isMember("offset") || !section.isMember("size"))
+    {
+        return false;
+    }
+    const uint64_t offset = section["offset"].asUInt64();
+    const size_t size = section["size"].asUInt64();
+    FILE* fp = fopen(mFileName.c_str(), "rb");
+    if (!fp)
+    {
+        DBG_LOG("Failed to open %s: %s\n", mFileName.c_str(), strerror(errno));
+        return false;
+    }
+    data.resize(size);
+    const bool ok = fseeko(fp, offset, SEEK_SET) == 0 && fread(data.data(), 1, size, fp) == size;
+    fclose(fp);
+    if (!ok)
+    {
+        DBG_LOG("Failed to read the %s section of %s\n", member, mFileName.c_str());
+        data.clear();
+    }
+    return ok;
 }
 
 void InFileBase::setFrameRange(unsigned startFrame, unsigned endFrame, int tid, bool preload, bool keep_all)
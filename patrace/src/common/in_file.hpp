@@ -3,20 +3,37 @@
 
 #include <fstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <jsoncpp/include/json/writer.h>
 #include <jsoncpp/include/json/reader.h>
 
+#include <common/blob_store.hpp>
 #include <common/file_format.hpp>
+#include <common/trace_callset.hpp>
 
 namespace common {
 
+/// Properties of a traced function, see InFileBase::ExIdToProps()
+enum CallProps
+{
+    CALL_PROP_SWAP = 1 << 0, ///< eglSwapBuffers and its variants
+    CALL_PROP_DRAW = 1 << 1, ///< glDraw* calls that draw something
+    CALL_PROP_DISPATCH = 1 << 2, ///< glDispatchCompute and glDispatchComputeIndirect
+    CALL_PROP_DISCARDS_FRAMEBUFFER = 1 << 3, ///< framebuffers can be discarded here when skipping work
+    CALL_PROP_UNIFORM = 1 << 4, ///< glUniform* and glProgramUniform* calls that set values, but not their EXT variants
+};
+
 class InFileBase
 {
 public:
     void printHeaderInfo();
     const std::string getJSONHeaderAsString(bool prettyPrint=false);
-    const Json::Value getJSONHeader() const { return mJsonHeader; }
+    /// The whole JSON header. If the trace has a header summary, it is only parsed now.
+    const Json::Value& getJSONHeader() const;
+    /// A member of the top level of the JSON header, or null if there is none. Taken from the
+    /// header summary or parsed on its own where possible, to leave the rest of the header be.
+    Json::Value getJSONHeaderMember(const char* name) const;
     const Json::Value getJSONThreadById(int id) const;
     HeaderVersion getHeaderVersion() const;
 
@@ -26,32 +43,64 @@ public:
 
     inline unsigned short NameToExId(const char* str) const
     {
-        for (int id = 1; id <= mMaxSigId; ++id)
-        {
-            if (strcmp(ExIdToName(id), str) == 0) return id;
-        }
-        return 0;
+        const auto it = mNameToExId.find(str);
+        return it != mNameToExId.end() ? it->second : 0;
     }
 
+    // Per function lookups, valid for ids up to the largest one in the signature book
+    CallFlags ExIdToCallFlags(unsigned short id) const { return mExIdToCallFlags[id]; }
+    unsigned ExIdToProps(unsigned short id) const { return mExIdToProps[id]; }
+    /// Size of every call of the function, or 0 if each call stores its own (BCall_vlen)
+    int ExIdToLen(unsigned short id) const { return mExIdToLen[id]; }
+    int getMaxSigId() const { return mMaxSigId; }
+
     void setFrameRange(unsigned startFrame, unsigned endFrame, int tid, bool preload, bool keep_all = false);
 
+    /// Blobs stored once in the trace, needed to parse the calls referring to them. Parsing a
+    /// call fills it in, so it can be used through a const reader.
+    BlobStore& blobStore() const { return mBlobStore; }
+
+    /// Read a section written after the chunks by OutFile::WriteSection(), such as the program
+    /// binaries, from where the given member of the JSON header says it is. Returns false if the
+    /// trace has no such section or it could not be read.
+    bool readSection(const char* member, std::vector<char>& data) const;
+
 protected:
     bool parseHeader(BHeaderV1 hdrV1, Json::Value &value);
     bool parseHeader(BHeaderV2 hdrV2, Json::Value &value);
     bool parseHeader(BHeaderV3 hdrV3, Json::Value &value);
     bool checkJsonMembers(Json::Value &root);
+    /// Take the JSON header of a V3 or V4 trace from the size bytes at base, the start of the
+    /// file. If the header summary matches it, it is kept as text to be parsed when needed,
+    /// otherwise the text up to parseEnd is parsed right away.
+    bool readJsonHeader(const BHeaderV3& hdr, const char* base, size_t size, const char* parseEnd);
+    /// Fill the lookup tables from mExIdToName, once the signature book is read
+    void buildExIdTables();
+    /// Register the zstd dictionary of the chunks named in the JSON header, if there is one
+    void loadChunkDictionary();
+    /// Point the blob store at the external blobs of a thin trace: the PATRACE_BLOB_STORE
+    /// environment variable if it is set, such as for a local copy on a device, or else the
+    /// blobStore member of the JSON header, taken from the directory of the trace if relative
+    void findExternalBlobStore();
 
     bool                mIsOpen = false;
     std::fstream        mStream;
     std::string         mFileName;
     bool mKeepAll = false;
 
-    Json::Value mJsonHeader;
+    mutable Json::Value mJsonHeader;
+    mutable bool mJsonParsed = true; ///< false while mJsonHeader is only in mJsonText
+    std::string mJsonText;
+    BHeaderSummary mSummary;
+    bool mHasSummary = false;
     bool mHeaderParseComplete = false;
     char *mDataPtr = nullptr;
     std::vector<std::string> mExIdToName;
     int *mExIdToLen = nullptr;
     void **mExIdToFunc = nullptr;
+    std::unordered_map<std::string, unsigned short> mNameToExId;
+    std::vector<CallFlags> mExIdToCallFlags;
+    std::vector<unsigned> mExIdToProps;
 
     int mMaxSigId = -1;
     int mBeginFrame = -1;
@@ -60,6 +109,7 @@ protected:
     int eglSwapBuffers_id = -1;
     int eglSwapBuffersWithDamage_id = -1;
     bool mPreload = false;
+    mutable BlobStore mBlobStore;
 
     HeaderVersion mHeaderVer = HEADER_VERSION_1;
 };
@@ -11,9 +11,26 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <algorithm>
 
 namespace common {
 
+// Read exactly len bytes from a pipe or socket. Fails at the end of the stream.
+static bool readFully(int fd, char* buf, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t got = read(fd, buf, len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        buf += got;
+        len -= got;
+    }
+    return true;
+}
+
 void InFile::rollback()
 {
     if (mCheckpointOffset == -1)
@@ -21,78 +38,500 @@ void InFile::rollback()
         DBG_LOG("No checkpoint set - not able to rollback!\n");
         abort();
     }
-    mPreloadedChunks.push_front(mCurrentChunk);
-    while (mFreeChunks.size())
+    mPtr = mArena + mCheckpointOffset;
+    mChunkEnd = mArena + mArenaSize;
+    mFrameNo = mBeginFrame;
+    mTapePos = 0;
+    mBlobCursor = nullptr;
+    mBlobCursorCalls = 0;
+    mBlobTapeCursor = 0;
+}
+
+void InFile::setStreamWindow(size_t bytes)
+{
+    if (mStreaming && bytes > 0)
     {
-        mCurrentChunk = mFreeChunks.back();
-        mFreeChunks.pop_back();
-        mPreloadedChunks.push_front(mCurrentChunk);
+        DBG_LOG("Ignoring the stream window, %s is already read as a stream\n", mFileName.c_str());
+        return;
+    }
+    // The prefetch workers move the window while they hold mSourceMutex
+    std::lock_guard<std::mutex> lk(mSourceMutex);
+    mStreamWindow = bytes;
+    mReleasedEnd = 0;
+    mReadaheadEnd = mCompressedSource - mCompressedBuffer;
+    if (mStreamWindow > 0)
+    {
+        madvise(mCompressedBuffer, mCompressedSize, MADV_NORMAL); // we do our own readahead
+        updateStreamWindow(mReadaheadEnd);
+        DBG_LOG("Streaming trace file with a %.1f MB window\n", bytes / (1024.0 * 1024.0));
     }
-    mCurrentChunk = mPreloadedChunks.front();
-    mPreloadedChunks.pop_front();
-    mPtr = mCurrentChunk->data() + mCheckpointOffset;
-    mFrameNo = mBeginFrame;
 }
 
-// Read another uncompressed memory chunk from the memory mapped file
-bool InFile::readChunk(std::vector<char> *buf)
+// Release what we have read of the compressed file and read ahead of us. A quarter of the
+// window is kept behind the chunk being read, since prefetch workers may still be decompressing
+// older chunks. Released pages that are touched again are simply faulted back in.
+void InFile::updateStreamWindow(int64_t pos)
 {
+    if (mStreamWindow == 0) return;
+    const int64_t behind = mStreamWindow / 4;
+    if (pos + (int64_t)mStreamWindow / 2 < mReadaheadEnd) return; // still well inside the window
+
+    const int64_t releaseEnd = (pos - behind) & ~(int64_t)(sysconf(_SC_PAGESIZE) - 1);
+    if (releaseEnd > mReleasedEnd)
+    {
+        madvise(mCompressedBuffer + mReleasedEnd, releaseEnd - mReleasedEnd, MADV_DONTNEED);
+        posix_fadvise(mFd, mReleasedEnd, releaseEnd - mReleasedEnd, POSIX_FADV_DONTNEED);
+        mReleasedEnd = releaseEnd;
+    }
+    const int64_t readaheadBegin = std::max(pos, mReadaheadEnd);
+    const int64_t readaheadEnd = std::min<int64_t>(pos + mStreamWindow - behind, mCompressedSize);
+    if (readaheadEnd > readaheadBegin)
+    {
+        posix_fadvise(mFd, readaheadBegin, readaheadEnd - readaheadBegin, POSIX_FADV_WILLNEED);
+    }
+    mReadaheadEnd = readaheadEnd;
+}
+
+// Find the next compressed chunk in the memory mapped file, or read it into 'staging' when
+// the trace is a stream. Not thread safe.
+bool InFile::nextCompressedChunk(const char*& src, size_t& len, ChunkCodec& codec, ChunkBuffer *staging)
+{
+    if (mStreaming)
+    {
+        uint32_t prefix;
+        if (!readFully(mFd, (char*)&prefix, sizeof(prefix))) return false;
+        if (prefix == CHUNK_TRAILER_PREFIX) return false; // only the frame table is left
+        len = chunkPrefixLength(prefix);
+        codec = chunkPrefixCodec(prefix);
+        staging->resize(len);
+        if (!readFully(mFd, staging->data(), len))
+        {
+            DBG_LOG("Trace stream ended in the middle of a chunk!\n");
+            return false;
+        }
+        src = staging->data();
+        return true;
+    }
     if (mCompressedRemaining < 4) { return false; }
-    size_t compressedLength = *(unsigned*)mCompressedSource;
+    const unsigned prefix = *(unsigned*)mCompressedSource;
+    if (prefix == CHUNK_TRAILER_PREFIX) { return false; }
+    const size_t compressedLength = chunkPrefixLength(prefix);
+    codec = chunkPrefixCodec(prefix);
     mCompressedRemaining -= 4;
     mCompressedSource += 4;
     if ((int64_t)compressedLength <= mCompressedRemaining)
     {
-        size_t uncompressedLength = 0;
-        if (!snappy::GetUncompressedLength(mCompressedSource, compressedLength, &uncompressedLength))
-        {
-            DBG_LOG("Failed to parse chunk of size %u - file is corrupt - aborting!\n", (unsigned)compressedLength);
-            abort();
-        }
-        buf->resize(uncompressedLength);
-        if (!snappy::RawUncompress(mCompressedSource, compressedLength, buf->data()))
-        {
-            DBG_LOG("Failed to decompress chunk of size %u - file is corrupt - aborting!\n", (unsigned)compressedLength);
-            abort();
-        }
+        src = mCompressedSource;
+        len = compressedLength;
         mCompressedSource += compressedLength;
         mCompressedRemaining -= compressedLength;
+        updateStreamWindow(src - mCompressedBuffer);
         return true;
     }
     return false;
 }
 
+void InFile::decompressChunk(ChunkCodec codec, const char* src, size_t compressedLength, ChunkBuffer *buf) const
+{
+    size_t uncompressedLength = 0;
+    if (!chunkCodecAvailable(codec))
+    {
+        DBG_LOG("Trace uses %s compression, which this build does not support - aborting!\n", chunkCodecName(codec));
+        abort();
+    }
+    if (!chunkUncompressedLength(codec, src, compressedLength, &uncompressedLength))
+    {
+        DBG_LOG("Failed to parse chunk of size %u - file is corrupt - aborting!\n", (unsigned)compressedLength);
+        abort();
+    }
+    buf->resize(uncompressedLength);
+    if (!chunkUncompress(codec, src, compressedLength, buf->data(), mExIdToLen, mMaxSigId))
+    {
+        DBG_LOG("Failed to decompress chunk of size %u - file is corrupt - aborting!\n", (unsigned)compressedLength);
+        abort();
+    }
+}
+
+// Check a chunk of the memory mapped file against its checksum, if the trace has one for it
+void InFile::verifyChunk(const char* src, size_t len) const
+{
+    const std::vector<TraceIndex::Chunk>& chunks = mChecksumTable.mChunks;
+    if (mChecksumTable.mChecksums.empty() || mStreaming) return;
+    const uint64_t filePos = src - 4 - mCompressedBuffer;
+    auto it = std::lower_bound(chunks.begin(), chunks.end(), filePos,
+                               [](const TraceIndex::Chunk& c, uint64_t pos) { return c.filePos < pos; });
+    if (it == chunks.end() || it->filePos != filePos) return; // written after the table
+    if (chunkChecksum(src - 4, len + 4) != mChecksumTable.mChecksums[it - chunks.begin()])
+    {
+        DBG_LOG("Chunk at offset %llu does not match its checksum - file is corrupt - aborting!\n", (unsigned long long)filePos);
+        abort();
+    }
+}
+
+// Read another uncompressed memory chunk from the memory mapped file
+bool InFile::readChunk(ChunkBuffer *buf)
+{
+    const char *src = nullptr;
+    size_t len = 0;
+    ChunkCodec codec;
+    if (!nextCompressedChunk(src, len, codec, &mStreamChunk)) return false;
+    decompressChunk(codec, src, len, buf);
+    return true;
+}
+
+// Get the next chunk, either from the prefetch ring or by decompressing it ourselves.
+// The storage previously held by 'buf' is recycled by the prefetch workers.
+bool InFile::fetchChunk(ChunkBuffer *buf)
+{
+    if (mPrefetchThreads.empty()) return readChunk(buf);
+
+    std::unique_lock<std::mutex> lk(mPrefetchMutex);
+    PrefetchSlot& slot = mPrefetchSlots[mPrefetchReadSeq % mPrefetchSlots.size()];
+    mPrefetchProduced.wait(lk, [&]{ return slot.ready || (mPrefetchEndSeq != -1 && mPrefetchReadSeq >= mPrefetchEndSeq); });
+    if (!slot.ready) return false; // end of file
+    buf->swap(slot.data);
+    slot.ready = false;
+    mPrefetchReadSeq++;
+    lk.unlock();
+    mPrefetchConsumed.notify_all();
+    return true;
+}
+
+void InFile::prefetchWorker()
+{
+    std::unique_lock<std::mutex> lk(mPrefetchMutex);
+    while (true)
+    {
+        mPrefetchConsumed.wait(lk, [&]{ return mPrefetchStop || mPrefetchEndSeq != -1
+                                        || mPrefetchClaimSeq < mPrefetchReadSeq + (int64_t)mPrefetchSlots.size(); });
+        if (mPrefetchStop || mPrefetchEndSeq != -1) break;
+        const int64_t seq = mPrefetchClaimSeq++;
+        PrefetchSlot& slot = mPrefetchSlots[seq % mPrefetchSlots.size()];
+        lk.unlock();
+
+        // Chunks are taken from the file strictly in order. Reading a stream may block, so
+        // this happens outside of mPrefetchMutex to not hold up the reader.
+        const char *src = nullptr;
+        size_t len = 0;
+        ChunkCodec codec;
+        bool found;
+        {
+            std::unique_lock<std::mutex> sk(mSourceMutex);
+            mSourceTurn.wait(sk, [&]{ return mSourceSeq == seq || mSourceStop; });
+            found = !mSourceStop && nextCompressedChunk(src, len, codec, &slot.compressed);
+            mSourceSeq++;
+        }
+        mSourceTurn.notify_all();
+        if (found)
+        {
+            verifyChunk(src, len);
+            decompressChunk(codec, src, len, &slot.data);
+        }
+
+        lk.lock();
+        if (!found)
+        {
+            if (mPrefetchEndSeq == -1 || seq < mPrefetchEndSeq) mPrefetchEndSeq = seq;
+            break;
+        }
+        slot.ready = true;
+        mPrefetchProduced.notify_all();
+    }
+    lk.unlock();
+    mPrefetchProduced.notify_all();
+    mPrefetchConsumed.notify_all(); // let the other workers see the end too
+}
+
+void InFile::setPrefetch(int chunks, int threads)
+{
+    stopPrefetch();
+    if (chunks <= 0 || threads <= 0) return;
+    if (threads > chunks) threads = chunks; // no point in having idle workers
+    if (!mStreaming && mChecksumTable.mChecksums.empty() && mChecksumTable.loadFromTrace(mFileName) && !mChecksumTable.mChecksums.empty())
+    {
+        DBG_LOG("Checking %u chunk checksums while prefetching\n", (unsigned)mChecksumTable.mChecksums.size());
+    }
+    mPrefetchSlots.resize(chunks);
+    mPrefetchStop = false;
+    mPrefetchClaimSeq = mPrefetchReadSeq = 0;
+    mPrefetchEndSeq = -1;
+    mSourceSeq = 0;
+    mSourceStop = false;
+    for (int i = 0; i < threads; i++)
+    {
+        mPrefetchThreads.emplace_back(&InFile::prefetchWorker, this);
+    }
+    DBG_LOG("Prefetching %d chunks ahead on %d threads\n", chunks, threads);
+}
+
+void InFile::stopPrefetch()
+{
+    {
+        std::lock_guard<std::mutex> lk(mPrefetchMutex);
+        mPrefetchStop = true;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mSourceMutex);
+        mSourceStop = true;
+    }
+    mPrefetchConsumed.notify_all();
+    mSourceTurn.notify_all();
+    for (std::thread& t : mPrefetchThreads) t.join();
+    mPrefetchThreads.clear();
+    mPrefetchSlots.clear();
+}
+
+void InFile::setBlobPrefetch(unsigned calls, size_t minBytes)
+{
+    stopBlobPrefetch();
+    if (calls == 0) return;
+    mBlobLookahead = calls;
+    mBlobMinBytes = minBytes;
+    mBlobStop = false;
+    mBlobThread = std::thread(&InFile::blobPrefetchWorker, this);
+    DBG_LOG("Prefetching the data of preloaded calls of at least %llu bytes up to %u calls ahead\n", (unsigned long long)minBytes, calls);
+}
+
+void InFile::stopBlobPrefetch()
+{
+    mBlobLookahead = 0;
+    mBlobCursor = nullptr;
+    mBlobCursorCalls = 0;
+    mBlobTapeCursor = 0;
+    if (!mBlobThread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lk(mBlobMutex);
+        mBlobStop = true;
+    }
+    mBlobQueued.notify_all();
+    mBlobThread.join();
+    mBlobQueue.clear();
+    if (mBlobsTouched > 0)
+    {
+        DBG_LOG("Prefetched the data of %llu calls, %.1f MB\n", (unsigned long long)mBlobsTouched, mBlobBytesTouched / (1024.0 * 1024.0));
+    }
+    mBlobsTouched = mBlobBytesTouched = 0;
+}
+
+// Queue the preloaded calls of at least mBlobMinBytes up to mBlobLookahead calls ahead of the
+// reader. Called once for every call read, so the cursor moves by about one call each time.
+void InFile::lookAhead()
+{
+    if (!mTape.empty())
+    {
+        if (mTapePos >= mTape.size()) return; // past the preloaded range
+        const size_t end = std::min<size_t>(mTapePos + mBlobLookahead, mTape.size());
+        for (mBlobTapeCursor = std::max(mBlobTapeCursor, mTapePos); mBlobTapeCursor < end; mBlobTapeCursor++)
+        {
+            const TapeEntry& entry = mTape[mBlobTapeCursor];
+            if (mExIdToLen[entry.call.funcId] == 0 && entry.call.toNext >= mBlobMinBytes)
+            {
+                std::lock_guard<std::mutex> lk(mBlobMutex);
+                mBlobQueue.emplace_back(entry.src - sizeof(common::BCall_vlen), entry.call.toNext);
+                mBlobQueued.notify_one();
+            }
+        }
+        return;
+    }
+
+    const char *arenaEnd = mArena + mArenaSize;
+    if (!mArena || mPtr < mArena || mPtr >= arenaEnd) return;
+    if (mBlobCursor < mPtr)
+    {
+        mBlobCursor = mPtr; // just preloaded or rolled back
+        mBlobCursorCalls = 0;
+    }
+    else if (mBlobCursorCalls > 0)
+    {
+        mBlobCursorCalls--; // the reader just moved past one
+    }
+    for (; mBlobCursorCalls < mBlobLookahead && mBlobCursor < arenaEnd; mBlobCursorCalls++)
+    {
+        const common::BCall& call = *(const common::BCall*)mBlobCursor;
+        const unsigned int callLen = mExIdToLen[call.funcId];
+        const unsigned int len = callLen ? callLen : reinterpret_cast<const common::BCall_vlen*>(mBlobCursor)->toNext;
+        if (callLen == 0 && len >= mBlobMinBytes)
+        {
+            std::lock_guard<std::mutex> lk(mBlobMutex);
+            mBlobQueue.emplace_back(mBlobCursor, len);
+            mBlobQueued.notify_one();
+        }
+        mBlobCursor += len;
+    }
+}
+
+void InFile::blobPrefetchWorker()
+{
+    static const size_t cacheLine = 64;
+    const uintptr_t pageMask = ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+    std::vector<std::pair<const char*, size_t>> work;
+    std::unique_lock<std::mutex> lk(mBlobMutex);
+    while (true)
+    {
+        mBlobQueued.wait(lk, [&]{ return mBlobStop || !mBlobQueue.empty(); });
+        if (mBlobStop) break;
+        work.swap(mBlobQueue);
+        lk.unlock();
+
+        for (const auto& blob : work)
+        {
+            // Have the kernel read in pages that were swapped out, then fault in the rest and
+            // pull the data towards the caches by reading a byte of every cache line
+            const uintptr_t begin = (uintptr_t)blob.first & pageMask;
+            madvise((void*)begin, (uintptr_t)blob.first + blob.second - begin, MADV_WILLNEED);
+            const volatile char *p = blob.first;
+            char sink = 0;
+            for (size_t offset = 0; offset < blob.second; offset += cacheLine)
+            {
+                sink ^= p[offset];
+            }
+            (void)sink;
+        }
+
+        lk.lock();
+        for (const auto& blob : work)
+        {
+            mBlobsTouched++;
+            mBlobBytesTouched += blob.second;
+        }
+        work.clear();
+    }
+}
+
+// Connect to a trace server given as host:port
+static int connectTrace(const std::string& address)
+{
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+    {
+        DBG_LOG("Expected host:port, got %s\n", address.c_str());
+        return -1;
+    }
+    const std::string host = address.substr(0, colon);
+    const std::string port = address.substr(colon + 1);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *result = nullptr;
+    const int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+    if (err != 0)
+    {
+        DBG_LOG("Failed to resolve %s: %s\n", address.c_str(), gai_strerror(err));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai && fd == -1; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if (fd == -1)
+    {
+        DBG_LOG("Failed to connect to %s: %s\n", address.c_str(), strerror(errno));
+    }
+    return fd;
+}
+
+// Read the headers of a trace that is not a regular file, up to the start of the call stream
+bool InFile::readStreamHeader(std::vector<char>& header)
+{
+    // toNext, magicNo and version are at the start of every header version
+    const size_t common = 3 * sizeof(unsigned int);
+    header.resize(common);
+    if (!readFully(mFd, header.data(), header.size())) return false;
+    const unsigned int version = ((const unsigned int*)header.data())[2];
+    size_t size = common;
+    if (version == HEADER_VERSION_1) size = sizeof(BHeaderV1);
+    else if (version == HEADER_VERSION_2) size = sizeof(BHeaderV2);
+    else if (version == HEADER_VERSION_3 || version == HEADER_VERSION_4) size = sizeof(BHeaderV3);
+    header.resize(size);
+    if (!readFully(mFd, header.data() + common, size - common)) return false;
+    if (version == HEADER_VERSION_3 || version == HEADER_VERSION_4)
+    {
+        const BHeaderV3 hdr = *(const BHeaderV3*)header.data();
+        if (hdr.jsonFileEnd < (long long)size || hdr.jsonFileBegin + hdr.jsonLength > hdr.jsonFileEnd)
+        {
+            DBG_LOG("Error: %s has a corrupt header!\n", mFileName.c_str());
+            return false;
+        }
+        header.resize(hdr.jsonFileEnd);
+        if (!readFully(mFd, header.data() + size, header.size() - size)) return false;
+    }
+    return true;
+}
+
 bool InFile::Open(const char* name, bool readHeaderAndExit)
 {
     mFileName = name;
     mIsOpen = true;
 
-    // Memory map file
-    mFd = open(mFileName.c_str(), O_RDONLY);
-    if (mFd == -1)
+    // Traces that are not regular files are read as a stream instead of being mapped
+    mStreaming = true;
+    if (mFileName == "-")
     {
-        DBG_LOG("Failed to open %s: %s\n", mFileName.c_str(), strerror(errno));
-        return false;
+        mFd = STDIN_FILENO;
     }
-    struct stat sb;
-    if (fstat(mFd, &sb) == -1)
+    else if (mFileName.compare(0, 6, "tcp://") == 0)
     {
-        DBG_LOG("Failed to stat %s: %s\n", mFileName.c_str(), strerror(errno));
-        close(mFd);
-        return false;
+        mFd = connectTrace(mFileName.substr(6));
+        if (mFd == -1) return false;
     }
-    mCompressedSize = mCompressedRemaining = sb.st_size;
-    mCompressedBuffer = (char*)mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, mFd, 0);
-    if (mCompressedBuffer == MAP_FAILED)
+    else
     {
-        DBG_LOG("Failed to mmap %s: %s\n", mFileName.c_str(), strerror(errno));
-        close(mFd);
-        return false;
+        mFd = open(mFileName.c_str(), O_RDONLY);
+        if (mFd == -1)
+        {
+            DBG_LOG("Failed to open %s: %s\n", mFileName.c_str(), strerror(errno));
+            return false;
+        }
+        struct stat sb;
+        if (fstat(mFd, &sb) == -1)
+        {
+            DBG_LOG("Failed to stat %s: %s\n", mFileName.c_str(), strerror(errno));
+            close(mFd);
+            return false;
+        }
+        mStreaming = !S_ISREG(sb.st_mode);
+        mCompressedSize = mCompressedRemaining = sb.st_size;
+    }
+
+    std::vector<char> streamHeader;
+    const char *base;
+    if (mStreaming)
+    {
+        mCompressedSize = mCompressedRemaining = 0;
+        if (!readStreamHeader(streamHeader))
+        {
+            DBG_LOG("Failed to read the header of %s\n", mFileName.c_str());
+            close(mFd);
+            return false;
+        }
+        base = streamHeader.data();
+        DBG_LOG("Reading %s as a stream\n", mFileName.c_str());
+    }
+    else
+    {
+        // Memory map file
+        mCompressedBuffer = (char*)mmap(nullptr, mCompressedSize, PROT_READ, MAP_PRIVATE, mFd, 0);
+        if (mCompressedBuffer == MAP_FAILED)
+        {
+            DBG_LOG("Failed to mmap %s: %s\n", mFileName.c_str(), strerror(errno));
+            mCompressedBuffer = nullptr;
+            close(mFd);
+            return false;
+        }
+        madvise(mCompressedBuffer, mCompressedSize, MADV_SEQUENTIAL);
+        base = mCompressedBuffer;
     }
-    madvise(mCompressedBuffer, sb.st_size, MADV_SEQUENTIAL);
 
     // Read Base Header that is common for all header versions
-    common::BHeader* header = (common::BHeader*)mCompressedBuffer;
+    const common::BHeader* header = (const common::BHeader*)base;
     if (header->magicNo != 0x20122012)
     {
         DBG_LOG("Error: %s seems to be an invalid trace file!\n", mFileName.c_str());
@@ -102,28 +541,30 @@ bool InFile::Open(const char* name, bool readHeaderAndExit)
     mHeaderVer = static_cast<HeaderVersion>(header->version);
     DBG_LOG("### .pat file format Version %d ###\n", header->version - HEADER_VERSION_1 + 1);
 
+    const int64_t parseBegin = os::getTime();
+    size_t dataBegin;
     if (header->version == HEADER_VERSION_1)
     {
-        if (!parseHeader(*(BHeaderV1*)mCompressedBuffer, mJsonHeader)) return false;
-        mCompressedSource = mCompressedBuffer + sizeof(BHeaderV1);
+        if (!parseHeader(*(const BHeaderV1*)base, mJsonHeader)) return false;
+        dataBegin = sizeof(BHeaderV1);
     }
     else if (header->version == HEADER_VERSION_2)
     {
-        if (!parseHeader(*(BHeaderV2*)mCompressedBuffer, mJsonHeader)) return false;
-        mCompressedSource = mCompressedBuffer + sizeof(BHeaderV2);
+        if (!parseHeader(*(const BHeaderV2*)base, mJsonHeader)) return false;
+        dataBegin = sizeof(BHeaderV2);
     }
     else if (header->version == HEADER_VERSION_3 || header->version == HEADER_VERSION_4)
     {
-        BHeaderV3 *hdr = (BHeaderV3*)mCompressedBuffer;
-        Json::Reader reader;
-        if (!reader.parse(mCompressedBuffer + hdr->jsonFileBegin, mCompressedBuffer + hdr->jsonFileEnd, mJsonHeader)
-            || !checkJsonMembers(mJsonHeader))
+        const BHeaderV3 *hdr = (const BHeaderV3*)base;
+        if (!readJsonHeader(*hdr, base, hdr->jsonFileEnd, base + hdr->jsonFileEnd))
         {
             DBG_LOG("Error: %s seems to have an invalid JSON header!\n", mFileName.c_str());
             close(mFd);
             return false;
         }
-        mCompressedSource = mCompressedBuffer + hdr->jsonFileEnd;
+        loadChunkDictionary();
+        findExternalBlobStore();
+        dataBegin = hdr->jsonFileEnd;
     }
     else
     {
@@ -131,7 +572,12 @@ bool InFile::Open(const char* name, bool readHeaderAndExit)
         close(mFd);
         return false;
     }
-    mCompressedRemaining -= mCompressedSource - mCompressedBuffer;
+    mHeaderParseTime = os::getTime() - parseBegin;
+    if (!mStreaming)
+    {
+        mCompressedSource = mCompressedBuffer + dataBegin;
+        mCompressedRemaining -= dataBegin;
+    }
 
     // when we only wanted to use -info to see header contents, no playback
     if (readHeaderAndExit)
@@ -141,8 +587,6 @@ bool InFile::Open(const char* name, bool readHeaderAndExit)
     }
 
     // Read first chunk
-    mCurrentChunk = new std::vector<char>;
-    mPrevChunk = new std::vector<char>;
     if (!readChunk(mCurrentChunk))
     {
         DBG_LOG("Failed to read first chunk!\n");
@@ -151,64 +595,141 @@ bool InFile::Open(const char* name, bool readHeaderAndExit)
     mPtr = mCurrentChunk->data();
     mChunkEnd = mCurrentChunk->data() + mCurrentChunk->size();
 
+    const int64_t sigBookBegin = os::getTime();
     ReadSigBook();
+    mSigBookTime = os::getTime() - sigBookBegin;
     return true;
 }
 
-void InFile::PreloadFrames(int frames_to_read, int tid)
+int InFile::countFrames(const char* ptr, const char* end, int tid) const
 {
-    int frames_read = 0;
-    std::vector<char> *newchunk = new std::vector<char>;
-    mCheckpointOffset = mPtr - mCurrentChunk->data();
-    while (readChunk(newchunk) && frames_read < frames_to_read)
+    int frames = 0;
+    while (ptr < end)
     {
-        mPreloadedChunks.push_back(newchunk);
+        const common::BCall& call = *(const common::BCall*)ptr;
+        if (call.tid == tid && (call.funcId == eglSwapBuffers_id || call.funcId == eglSwapBuffersWithDamage_id)) frames++;
+        const unsigned int callLen = mExIdToLen[call.funcId];
+        ptr += callLen ? callLen : reinterpret_cast<const common::BCall_vlen*>(ptr)->toNext;
+    }
+    return frames;
+}
 
-        // Count the number of frames in the chunk
-        char *ptr = newchunk->data();
-        while (ptr < newchunk->data() + newchunk->size())
+bool InFile::arenaAppend(const char* src, size_t len)
+{
+    if (mArenaSize + len > mArenaCapacity)
+    {
+        size_t capacity;
+        if (mPreloadBudget > 0)
         {
-            const common::BCall& call = *(common::BCall*)ptr;
-            if (call.tid == tid && (call.funcId == eglSwapBuffers_id || call.funcId == eglSwapBuffersWithDamage_id)) frames_read++;
-            unsigned int callLen = mExIdToLen[call.funcId];
-            if (callLen == 0)
-            {
-                ptr += reinterpret_cast<common::BCall_vlen*>(ptr)->toNext;
-            } else {
-                ptr += callLen;
-            }
-       }
+            if (mArena || mArenaSize + len > mPreloadBudget) return false;
+            capacity = mPreloadBudget; // reserve it all up front, only touched pages use memory
+        }
+        else
+        {
+            capacity = std::max<size_t>(std::max<size_t>(mArenaCapacity * 2, mArenaSize + len), 64 * 1024 * 1024);
+        }
+        char *arena = (char*)mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (arena == MAP_FAILED)
+        {
+            DBG_LOG("Failed to allocate %llu bytes for preloading: %s\n", (unsigned long long)capacity, strerror(errno));
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        if (mPreloadHugepages) madvise(arena, capacity, MADV_HUGEPAGE);
+#endif
+        if (mArena)
+        {
+            memcpy(arena, mArena, mArenaSize);
+            munmap(mArena, mArenaCapacity);
+        }
+        mArena = arena;
+        mArenaCapacity = capacity;
+    }
+    memcpy(mArena + mArenaSize, src, len);
+    mArenaSize += len;
+    return true;
+}
 
-       newchunk = new std::vector<char>;
-   }
-   delete newchunk; // we always make one in excess
-   mPreload = false;
+void InFile::arenaFree()
+{
+    if (mArena) munmap(mArena, mArenaCapacity);
+    mArena = nullptr;
+    mArenaSize = mArenaCapacity = 0;
 }
 
-bool InFile::GetNextCall(void*& fptr, common::BCall_vlen& call, char*& src)
+bool InFile::PreloadFrames(int frames_to_read, int tid)
 {
-    if (mPtr >= mChunkEnd) // read more data?
+    // Start with what is left of the current chunk. The current call still points into
+    // the chunk itself, so keep that around until we move past the arena.
+    int frames_read = countFrames(mPtr, (char*)mChunkEnd, tid);
+    if (!arenaAppend(mPtr, (char*)mChunkEnd - mPtr)) return false;
+
+    ChunkBuffer chunk;
+    while (frames_read < frames_to_read && fetchChunk(&chunk))
+    {
+        frames_read += countFrames(chunk.data(), chunk.data() + chunk.size(), tid);
+        if (!arenaAppend(chunk.data(), chunk.size())) return false;
+    }
+
+    mCheckpointOffset = 0;
+    mPtr = mArena;
+    mChunkEnd = mArena + mArenaSize;
+    mPreload = false;
+    DBG_LOG("Preloaded %d frames using %.1f MB\n", std::min(frames_read, frames_to_read), mArenaSize / (1024.0 * 1024.0));
+    if (mCallTape) buildCallTape();
+    return true;
+}
+
+void InFile::buildCallTape()
+{
+    mTape.clear();
+    mTapePos = 0;
+    for (char *ptr = mArena; ptr < mArena + mArenaSize; )
     {
-        if (mPreloadedChunks.size() > 0)
+        TapeEntry entry;
+        entry.call = *(common::BCall*)ptr;
+        if (unlikely(entry.call.funcId > mMaxSigId || entry.call.funcId == 0))
         {
-            if (mKeepAll)
-            {
-                mFreeChunks.push_back(mCurrentChunk);
-                mCurrentChunk = mPreloadedChunks.front();
-            }
-            else
-            {
-                delete mPrevChunk;
-                std::swap(mPrevChunk, mCurrentChunk);
-                mPrevChunk = mPreloadedChunks.front();
-            }
-            mPreloadedChunks.pop_front();
+            DBG_LOG("funcId %d is out of range (%d max)!\n", (int)entry.call.funcId, mMaxSigId);
+            ::abort();
+        }
+        const unsigned callLen = mExIdToLen[entry.call.funcId];
+        if (callLen == 0)
+        {
+            entry.call = *(common::BCall_vlen*)ptr;
+            entry.src = ptr + sizeof(common::BCall_vlen);
+            ptr += entry.call.toNext;
         }
         else
         {
-            if (!readChunk(mPrevChunk)) return false;
-            std::swap(mPrevChunk, mCurrentChunk);
+            entry.src = ptr + sizeof(common::BCall);
+            ptr += callLen;
         }
+        entry.fptr = mExIdToFunc[entry.call.funcId];
+        entry.frameEnd = entry.call.tid == mTraceTid && (entry.call.funcId == eglSwapBuffers_id || entry.call.funcId == eglSwapBuffersWithDamage_id);
+        mTape.push_back(entry);
+    }
+    DBG_LOG("Call tape holds %u calls using %.1f MB\n", (unsigned)mTape.size(), mTape.size() * sizeof(TapeEntry) / (1024.0 * 1024.0));
+}
+
+bool InFile::GetNextCall(void*& fptr, common::BCall_vlen& call, char*& src)
+{
+    if (mTapePos < mTape.size())
+    {
+        const TapeEntry& entry = mTape[mTapePos++];
+        call = entry.call;
+        mDataPtr = src = entry.src;
+        fptr = entry.fptr;
+        if (mTapePos == mTape.size()) mPtr = (char*)mChunkEnd; // carry on after the preloaded range
+        if (unlikely(mBlobLookahead > 0)) lookAhead();
+        if (entry.frameEnd && ++mFrameNo > mEndFrame) return false; // we're done!
+        return true;
+    }
+
+    if (mPtr >= mChunkEnd) // read more data?
+    {
+        if (!fetchChunk(mPrevChunk)) return false;
+        std::swap(mPrevChunk, mCurrentChunk);
         mPtr = mCurrentChunk->data();
         mChunkEnd = mCurrentChunk->data() + mCurrentChunk->size();
     }
@@ -237,6 +758,7 @@ bool InFile::GetNextCall(void*& fptr, common::BCall_vlen& call, char*& src)
     }
 
     fptr = mExIdToFunc[call.funcId];
+    if (unlikely(mBlobLookahead > 0)) lookAhead();
 
     // Count frames and check if we are done or need to start preloading
     if (tmp.tid == mTraceTid && (tmp.funcId == eglSwapBuffers_id || tmp.funcId == eglSwapBuffersWithDamage_id))
@@ -245,9 +767,23 @@ bool InFile::GetNextCall(void*& fptr, common::BCall_vlen& call, char*& src)
         if (mFrameNo > mEndFrame) return false; // we're done!
         if (mFrameNo >= mBeginFrame && mPreload)
         {
-            // The below count does not include frames still remaining to be read in the current chunk, so we might possibly
-            // be reading more chunks than we need here. Still room to optimize more.
-            PreloadFrames(mEndFrame - mBeginFrame, mTraceTid);
+            if (!PreloadFrames(mEndFrame - mBeginFrame, mTraceTid))
+            {
+                if (mPreloadBudget > 0)
+                {
+                    DBG_LOG("Preloading frames %d to %d needs more than the preload budget of %.1f MB!\n", mBeginFrame, mEndFrame,
+                            mPreloadBudget / (1024.0 * 1024.0));
+                }
+                else
+                {
+                    DBG_LOG("Not enough memory to preload frames %d to %d!\n", mBeginFrame, mEndFrame);
+                }
+#ifndef __APPLE__
+                exit(EXIT_FAILURE);
+#else
+                os::abort();
+#endif
+            }
         }
     }
     return true;
@@ -256,16 +792,24 @@ bool InFile::GetNextCall(void*& fptr, common::BCall_vlen& call, char*& src)
 void InFile::Close()
 {
     if (!mIsOpen) return;
-    munmap(mCompressedBuffer, mCompressedSize);
-    close(mFd); mFd = 0;
+    stopPrefetch();
+    stopBlobPrefetch(); // before the arena it reads goes
+    mStreamWindow = 0;
+    if (mCompressedBuffer) munmap(mCompressedBuffer, mCompressedSize);
+    mCompressedBuffer = nullptr;
+    if (mFd != STDIN_FILENO) close(mFd);
+    mFd = 0;
+    mStreaming = false;
+    mStreamChunk.release();
+    mChecksumTable = TraceIndex();
     mIsOpen = false;
     mPreload = false;
-    for (auto* b : mPreloadedChunks) delete b;
-    for (auto* b : mFreeChunks) delete b;
-    mPreloadedChunks.clear();
-    mFreeChunks.clear();
-    delete mCurrentChunk; mCurrentChunk = nullptr;
-    delete mPrevChunk; mPrevChunk = nullptr;
+    arenaFree();
+    mTape.clear();
+    mTapePos = 0;
+    mBlobStore.clear();
+    mCurrentChunk->release();
+    mPrevChunk->release();
     mExIdToName.clear();
     delete [] mExIdToLen; mExIdToLen = nullptr;
     delete [] mExIdToFunc; mExIdToFunc = nullptr;
@@ -305,10 +849,11 @@ void InFile::ReadSigBook()
     mExIdToFunc[0] = 0;
     for (int id = 1; id <= mMaxSigId; ++id)
     {
-        const char* name = mExIdToName.at(id).c_str();
-        mExIdToLen[id] = gApiInfo.NameToLen(name);
-        mExIdToFunc[id] = gApiInfo.NameToFptr(name);
+        const unsigned short apiId = gApiInfo.NameToId(mExIdToName.at(id).c_str());
+        mExIdToLen[id] = ApiInfo::IdToLenArr[apiId]; // 0 for functions it does not know
+        mExIdToFunc[id] = gApiInfo.IdToFptr(apiId);
     }
+    buildExIdTables();
 }
 
 } // namespace
@@ -5,9 +5,14 @@
 #include <common/api_info.hpp>
 #include <common/os_time.hpp>
 #include <common/in_file.hpp>
+#include <common/trace_index.hpp>
+#include <common/chunk_codec.hpp>
 
 #include <snappy.h>
-#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace common {
 
@@ -15,30 +20,106 @@ class InFile : public InFileBase
 {
 public:
     InFile() { Close(); }
-    ~InFile() {}
+    ~InFile() { stopPrefetch(); stopBlobPrefetch(); }
 
+    /// Besides regular files, the trace can be "-" for stdin, a FIFO or "tcp://host:port".
+    /// Those are read as a stream, which rules out setStreamWindow().
     bool Open(const char *name, bool readHeaderAndExit = false);
     void Close();
     bool GetNextCall(void*& fptr, common::BCall_vlen& call, char*& src);
+    /// Whether the calls returned so far stay valid over the next GetNextCall(). They do not
+    /// when it has to move on to another chunk.
+    bool nextCallKeepsData() const { return mTapePos < mTape.size() || mPtr < mChunkEnd; }
 
     void rollback();
 
+    /// Decompress up to 'chunks' chunks ahead of the reader on 'threads' background
+    /// threads. The reading thread then only swaps in already decompressed chunks.
+    /// When the trace has chunk checksums, the threads check each chunk against its
+    /// checksum before decompressing it.
+    /// Must be called after Open() and before the first call to GetNextCall().
+    void setPrefetch(int chunks, int threads = 1);
+
+    /// Look up to 'calls' calls ahead of the reader in the preloaded frames, and have a background
+    /// thread fault in and touch the data of those of at least 'minBytes', such as big texture
+    /// and buffer uploads, before they are replayed. Only the call headers are read to find them.
+    /// 0 calls turns it off.
+    void setBlobPrefetch(unsigned calls, size_t minBytes);
+
+    /// Streaming mode. Only keep about 'bytes' of the compressed file resident: pages behind
+    /// the read position are released and the next 'bytes' are read ahead. 0 turns it off.
+    void setStreamWindow(size_t bytes);
+
+    /// Limit the memory used for preloading to 'bytes', or 0 for no limit. The preloaded
+    /// range can be backed by transparent hugepages where the kernel supports it.
+    void setPreloadBudget(uint64_t bytes, bool hugepages = false) { mPreloadBudget = bytes; mPreloadHugepages = hugepages; }
+    /// Size of the preloaded call data, once preloading is done.
+    uint64_t getPreloadedBytes() const { return mArenaSize; }
+    /// Whether the given call data is preloaded, and so stays valid until the file is closed
+    bool isPreloaded(const void* data, size_t len) const
+    {
+        return mArena && data >= mArena && static_cast<const char*>(data) + len <= mArena + mArenaSize;
+    }
+
+    /// Decode the preloaded frames once into a tape of calls with their function and argument
+    /// pointers resolved. Every pass over the preloaded range, including after rollback(), then
+    /// replays the tape instead of walking the call stream again. Must be set before preloading.
+    void setCallTape(bool enable) { mCallTape = enable; }
+
+    /// Time the last Open() spent parsing the header and reading the sigbook, in os::getTime() ticks
+    int64_t getHeaderParseTime() const { return mHeaderParseTime; }
+    int64_t getSigBookTime() const { return mSigBookTime; }
+
 private:
     void ReadSigBook();
-    void PreloadFrames(int frames_to_read, int tid);
-    bool readChunk(std::vector<char> *buf);
-
-    std::deque<std::vector<char>*> mPreloadedChunks;
-    /// The free list is used for loop tracing.
-    std::deque<std::vector<char>*> mFreeChunks;
-    std::vector<char> *mCurrentChunk = nullptr;
-    /// We cannot immediately free the previous chunk since pointers may still be pointing
+    bool readStreamHeader(std::vector<char>& header);
+    bool PreloadFrames(int frames_to_read, int tid);
+    int countFrames(const char* ptr, const char* end, int tid) const;
+    bool arenaAppend(const char* src, size_t len);
+    void buildCallTape();
+    void arenaFree();
+    bool readChunk(ChunkBuffer *buf);
+    bool fetchChunk(ChunkBuffer *buf);
+    bool nextCompressedChunk(const char*& src, size_t& len, ChunkCodec& codec, ChunkBuffer *staging);
+    void decompressChunk(ChunkCodec codec, const char* src, size_t len, ChunkBuffer *buf) const;
+    void verifyChunk(const char* src, size_t len) const;
+    void prefetchWorker();
+    void updateStreamWindow(int64_t pos);
+    void stopPrefetch();
+    void lookAhead();
+    void blobPrefetchWorker();
+    void stopBlobPrefetch();
+
+    /// Decompressed chunks cycle through these two buffers, and through the prefetch slots
+    /// when prefetching, so no chunk allocates memory of its own.
+    ChunkBuffer mChunkBuffers[2];
+    ChunkBuffer *mCurrentChunk = &mChunkBuffers[0];
+    /// We cannot immediately reuse the previous chunk since pointers may still be pointing
     /// into its memory area which are consumed by calls in the next.
-    std::vector<char> *mPrevChunk = nullptr;
+    ChunkBuffer *mPrevChunk = &mChunkBuffers[1];
 
     /// Offset into first packet that we should start a rollback at
     intptr_t mCheckpointOffset = -1;
 
+    /// Preloaded frames are decompressed back to back into one arena. Calls never cross a
+    /// chunk boundary, so the reader can then walk the whole range as if it was one chunk.
+    char *mArena = nullptr;
+    size_t mArenaSize = 0;
+    size_t mArenaCapacity = 0;
+    uint64_t mPreloadBudget = 0;
+    bool mPreloadHugepages = false;
+
+    struct TapeEntry
+    {
+        void *fptr;
+        char *src;
+        common::BCall_vlen call;
+        bool frameEnd;
+    };
+    bool mCallTape = false;
+    std::vector<TapeEntry> mTape;
+    size_t mTapePos = 0; // next entry to replay, mTape.size() when reading the stream
+
     char *mPtr = nullptr;
     void *mChunkEnd = nullptr;
     int64_t mCompressedRemaining = 0;
@@ -47,6 +128,58 @@ private:
     char *mCompressedSource = nullptr;
     int mFrameNo = 0;
     int mFd = 0;
+    int64_t mHeaderParseTime = 0;
+    int64_t mSigBookTime = 0;
+
+    /// Reading from a pipe or socket. Compressed chunks are then read into a buffer and
+    /// decompressed from there, instead of from the file mapping.
+    bool mStreaming = false;
+    ChunkBuffer mStreamChunk;
+
+    /// Streaming mode: compressed file offsets up to which pages were released and read ahead
+    size_t mStreamWindow = 0;
+    int64_t mReleasedEnd = 0;
+    int64_t mReadaheadEnd = 0;
+
+    /// Chunk prefetching. Chunk number 'seq' is decompressed into slot seq % size by
+    /// whichever worker claims it, and handed over to the reader strictly in order.
+    struct PrefetchSlot
+    {
+        ChunkBuffer data;
+        ChunkBuffer compressed; // chunk read from a stream
+        bool ready = false;
+    };
+    std::vector<PrefetchSlot> mPrefetchSlots;
+    TraceIndex mChecksumTable; ///< only loaded for prefetching, when the trace has checksums
+    std::vector<std::thread> mPrefetchThreads;
+    std::mutex mPrefetchMutex;
+    std::condition_variable mPrefetchProduced;
+    std::condition_variable mPrefetchConsumed;
+    int64_t mPrefetchClaimSeq = 0; // next chunk to be claimed by a worker
+    int64_t mPrefetchReadSeq = 0; // next chunk to be handed to the reader
+    int64_t mPrefetchEndSeq = -1; // number of chunks in the file, once known
+    bool mPrefetchStop = false;
+    /// Workers take their chunks from the file in claim order, one at a time
+    std::mutex mSourceMutex;
+    std::condition_variable mSourceTurn;
+    int64_t mSourceSeq = 0; // next chunk to be taken from the file
+    bool mSourceStop = false;
+
+    /// Blob prefetching. The reader walks the headers of the preloaded calls up to
+    /// mBlobLookahead calls ahead of itself and queues the big ones for the worker. The
+    /// arena does not move until the file is closed, so the worker can touch it at any time.
+    unsigned mBlobLookahead = 0;
+    size_t mBlobMinBytes = 0;
+    const char *mBlobCursor = nullptr; // next call to look at, when reading the arena
+    unsigned mBlobCursorCalls = 0; // calls between the reader and mBlobCursor
+    size_t mBlobTapeCursor = 0; // same, when replaying the call tape
+    std::thread mBlobThread;
+    std::mutex mBlobMutex;
+    std::condition_variable mBlobQueued;
+    std::vector<std::pair<const char*, size_t>> mBlobQueue;
+    bool mBlobStop = false;
+    uint64_t mBlobsTouched = 0;
+    uint64_t mBlobBytesTouched = 0;
 };
 
 }
@@ -1,6 +1,12 @@
 #include <common/in_file_ra.hpp>
-#include <libgen.h> // basename()
-#include <sstream>
+#include <common/chunk_codec.hpp>
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 namespace common {
 
@@ -21,56 +27,84 @@ static bool StrEndWith(const char* str, const char* substr)
 bool InFileRA::Open(const char *name, bool readHeaderAndExit)
 {
     mFileName = name;
+    mUncompressed = StrEndWith(name, "ra");
 
-    // generate RA (random access) file if needed
-    if (!StrEndWith(name, "ra"))
+    // only write out a RA (random access) file if asked to, we can read the .pat directly
+    if (!mUncompressed && !mTarget.empty())
     {
         if (!CreateRAFile(name, mTarget))
             return false;
+        mUncompressed = true;
     }
 
-    std::ios_base::openmode fmode = std::fstream::binary | std::fstream::in;
-    mStream.open(mFileName, fmode);
-    if (!mStream.is_open() || !mStream.good())
+    mFd = open(mFileName.c_str(), O_RDONLY);
+    if (mFd == -1)
+    {
+        DBG_LOG("Failed to open %s: %s\n", mFileName.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat sb;
+    if (fstat(mFd, &sb) == -1)
     {
-        DBG_LOG("Failed to open file %s\n", mFileName.c_str());
-        mStream.close();
+        DBG_LOG("Failed to stat %s: %s\n", mFileName.c_str(), strerror(errno));
+        Close();
+        return false;
+    }
+    mMapSize = sb.st_size;
+    if (mMapSize < sizeof(BHeaderV1))
+    {
+        DBG_LOG("Warning: %s seems to be an invalid trace file!\n", mFileName.c_str());
+        Close();
+        return false;
+    }
+    // private writable mapping, since a .ra file is parsed in place
+    mMap = (char*)mmap(nullptr, mMapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, mFd, 0);
+    if (mMap == MAP_FAILED)
+    {
+        DBG_LOG("Failed to mmap %s: %s\n", mFileName.c_str(), strerror(errno));
+        mMap = nullptr;
+        Close();
         return false;
     }
 
     // Read Base Header that is common for all header versions
-    common::BHeader bHeader;
-    mStream.read((char*)&bHeader, sizeof(bHeader));
+    const common::BHeader& bHeader = *(const common::BHeader*)mMap;
     if (bHeader.magicNo != 0x20122012)
     {
         DBG_LOG("Warning: %s seems to be an invalid trace file!\n", mFileName.c_str());
         return false;
     }
 
-    mStream.seekg(0, std::ios_base::beg); // rewind to beginning of file
     mHeaderVer = static_cast<HeaderVersion>(bHeader.version);
 
     DBG_LOG("### .pat file format Version %d ###\n", bHeader.version - HEADER_VERSION_1 + 1);
 
     if (bHeader.version == HEADER_VERSION_1) {
-        BHeaderV1 hdr;
-        mStream.read((char*)&hdr, sizeof(hdr));
-        mHeaderParseComplete = parseHeader(hdr, mJsonHeader);
-    } else if (bHeader.version == HEADER_VERSION_2) {
-        BHeaderV2 hdr;
-        mStream.read((char*)&hdr, sizeof(hdr));
-        mHeaderParseComplete = parseHeader(hdr, mJsonHeader);
-    } else if (bHeader.version >= HEADER_VERSION_3 && bHeader.version <= HEADER_VERSION_4) {
-        BHeaderV3 hdr;
-        mStream.read((char*)&hdr, sizeof(hdr));
-        mHeaderParseComplete = parseHeader(hdr, mJsonHeader);
-        mStream.seekg(hdr.jsonFileEnd, std::ios_base::beg);
+        mHeaderParseComplete = parseHeader(*(BHeaderV1*)mMap, mJsonHeader);
+        mDataBegin = sizeof(BHeaderV1);
+    } else if (bHeader.version == HEADER_VERSION_2 && mMapSize >= sizeof(BHeaderV2)) {
+        mHeaderParseComplete = parseHeader(*(BHeaderV2*)mMap, mJsonHeader);
+        mDataBegin = sizeof(BHeaderV2);
+    } else if (bHeader.version >= HEADER_VERSION_3 && bHeader.version <= HEADER_VERSION_4 && mMapSize >= sizeof(BHeaderV3)) {
+        const BHeaderV3& hdr = *(const BHeaderV3*)mMap;
+        mHeaderParseComplete = hdr.jsonLength > 0 && (uint64_t)(hdr.jsonFileBegin + hdr.jsonLength) <= mMapSize
+                               && readJsonHeader(hdr, mMap, mMapSize, mMap + hdr.jsonFileBegin + hdr.jsonLength);
+        if (!mHeaderParseComplete)
+        {
+            DBG_LOG("parse json failed\n");
+        }
+        else
+        {
+            loadChunkDictionary();
+            findExternalBlobStore();
+        }
+        mDataBegin = hdr.jsonFileEnd;
     } else {
         DBG_LOG("Unsupported file format version: %d\n", bHeader.version - HEADER_VERSION_1 + 1);
         return false;
     }
 
-    if (!mHeaderParseComplete)
+    if (!mHeaderParseComplete || (uint64_t)mDataBegin > mMapSize)
     {
         return false;
     }
@@ -80,6 +114,15 @@ bool InFileRA::Open(const char *name, bool readHeaderAndExit)
     {
         return true;
     }
+
+    if (mUncompressed)
+    {
+        mStreamSize = mMapSize - mDataBegin;
+    }
+    else if (!ScanChunks())
+    {
+        return false;
+    }
     mIsOpen = true;
 
     // read signature book
@@ -88,7 +131,193 @@ bool InFileRA::Open(const char *name, bool readHeaderAndExit)
     return true;
 }
 
-unsigned int InFileRA::ReadCompressedLength(std::fstream& inStream)
+void InFileRA::Close()
+{
+    if (mMap)
+    {
+        munmap(mMap, mMapSize);
+        mMap = nullptr;
+    }
+    if (mFd != -1)
+    {
+        close(mFd);
+        mFd = -1;
+    }
+    mMapSize = 0;
+    mIndex.mChunks.clear();
+    mStreamSize = 0;
+    mBlobStore.clear();
+    for (CachedChunk& c : mCache)
+    {
+        c.index = SIZE_MAX;
+        c.data.release();
+    }
+    mChunkData = nullptr;
+    mChunkBegin = mChunkEnd = 0;
+    mIsOpen = false;
+}
+
+bool InFileRA::ScanChunks()
+{
+    // The frame table of the tracer has the chunks already, if it was written after the last of them
+    TraceIndex table;
+    if (table.loadFromTrace(mFileName))
+    {
+        const uint64_t lastPos = table.mChunks.back().filePos;
+        const uint32_t prefix = lastPos + 4 <= mMapSize ? *(const uint32_t*)(mMap + lastPos) : 0;
+        const uint64_t end = lastPos + 4 + chunkPrefixLength(prefix);
+        size_t uncompressedLength = 0;
+        if (prefix != 0 && prefix != CHUNK_TRAILER_PREFIX && end <= mMapSize
+            && (end == mMapSize || (end + 4 <= mMapSize && *(const uint32_t*)(mMap + end) == CHUNK_TRAILER_PREFIX))
+            && chunkUncompressedLength(chunkPrefixCodec(prefix), mMap + lastPos + 4, chunkPrefixLength(prefix), &uncompressedLength))
+        {
+            mIndex.mChunks.swap(table.mChunks);
+            mStreamSize = mIndex.mChunks.back().streamPos + uncompressedLength;
+            return true;
+        }
+    }
+
+    // Only the chunk prefixes and the start of each payload get touched here. The chunks
+    // themselves are decompressed when a call in them is read.
+    uint64_t filePos = mDataBegin;
+    uint64_t streamPos = 0;
+    while (filePos + 4 <= mMapSize)
+    {
+        const uint32_t prefix = *(const uint32_t*)(mMap + filePos);
+        if (prefix == CHUNK_TRAILER_PREFIX)
+        {
+            break; // the frame table the tracer left behind the chunks
+        }
+        const uint32_t compressedLength = chunkPrefixLength(prefix);
+        const ChunkCodec codec = chunkPrefixCodec(prefix);
+        size_t uncompressedLength = 0;
+        if (!chunkCodecAvailable(codec))
+        {
+            DBG_LOG("Trace uses %s compression, which this build does not support!\n", chunkCodecName(codec));
+            return false;
+        }
+        if (filePos + 4 + compressedLength > mMapSize
+            || (compressedLength > 0 && !chunkUncompressedLength(codec, mMap + filePos + 4, compressedLength, &uncompressedLength)))
+        {
+            DBG_LOG("Failed to parse chunk at offset %llu - file corrupt!\n", (unsigned long long)filePos);
+            return false;
+        }
+        if (uncompressedLength > 0)
+        {
+            mIndex.mChunks.push_back({ filePos, streamPos });
+        }
+        filePos += 4 + compressedLength;
+        streamPos += uncompressedLength;
+    }
+    mStreamSize = streamPos;
+    return true;
+}
+
+bool InFileRA::LoadChunk(uint64_t pos)
+{
+    if (pos >= mStreamSize)
+    {
+        return false;
+    }
+    if (mUncompressed)
+    {
+        mChunkData = mMap + mDataBegin;
+        mChunkBegin = 0;
+        mChunkEnd = mStreamSize;
+        return true;
+    }
+
+    const TraceIndex::Chunk* chunk = mIndex.findChunk(pos);
+    if (!chunk)
+    {
+        return false;
+    }
+    const size_t index = chunk - mIndex.mChunks.data();
+    const uint64_t chunkEnd = index + 1 < mIndex.mChunks.size() ? mIndex.mChunks[index + 1].streamPos : mStreamSize;
+
+    CachedChunk* slot = &mCache[0];
+    for (CachedChunk& c : mCache)
+    {
+        if (c.index == index)
+        {
+            slot = &c;
+            break;
+        }
+        if (c.lastUse < slot->lastUse)
+        {
+            slot = &c;
+        }
+    }
+
+    if (slot->index != index)
+    {
+        const char* src = mMap + chunk->filePos + 4;
+        const uint32_t prefix = *(const uint32_t*)(mMap + chunk->filePos);
+        slot->data.resize(chunkEnd - chunk->streamPos);
+        if (!chunkUncompress(chunkPrefixCodec(prefix), src, chunkPrefixLength(prefix), slot->data.data(), mExIdToLen, mMaxSigId))
+        {
+            DBG_LOG("Failed to decompress chunk at offset %llu - file corrupt!\n", (unsigned long long)chunk->filePos);
+            slot->index = SIZE_MAX;
+            return false;
+        }
+        slot->index = index;
+    }
+    slot->lastUse = ++mUseCount;
+
+    mChunkData = slot->data.data();
+    mChunkBegin = chunk->streamPos;
+    mChunkEnd = chunkEnd;
+    return true;
+}
+
+bool InFileRA::GetRawChunk(std::streamoff pos, std::streamoff& begin, std::streamoff& end, const char*& data, size_t& size) const
+{
+    if (mUncompressed || pos < mDataBegin)
+    {
+        return false;
+    }
+    const TraceIndex::Chunk* chunk = mIndex.findChunk(pos - mDataBegin);
+    if (!chunk)
+    {
+        return false;
+    }
+    const size_t index = chunk - mIndex.mChunks.data();
+    begin = mDataBegin + chunk->streamPos;
+    end = mDataBegin + (index + 1 < mIndex.mChunks.size() ? mIndex.mChunks[index + 1].streamPos : mStreamSize);
+    data = mMap + chunk->filePos;
+    size = 4 + chunkPrefixLength(*(const uint32_t*)data);
+    return true;
+}
+
+bool InFileRA::ReadChunk(size_t index, ChunkBuffer& buf, const char*& data, size_t& size, std::streamoff& begin) const
+{
+    if (mUncompressed)
+    {
+        data = mMap + mDataBegin;
+        size = mStreamSize;
+        begin = mDataBegin;
+        return index == 0;
+    }
+    if (index >= mIndex.mChunks.size())
+    {
+        return false;
+    }
+    const TraceIndex::Chunk& chunk = mIndex.mChunks[index];
+    const uint64_t chunkEnd = index + 1 < mIndex.mChunks.size() ? mIndex.mChunks[index + 1].streamPos : mStreamSize;
+    const uint32_t prefix = *(const uint32_t*)(mMap + chunk.filePos);
+    buf.resize(chunkEnd - chunk.streamPos);
+    if (!chunkUncompress(chunkPrefixCodec(prefix), mMap + chunk.filePos + 4, chunkPrefixLength(prefix), buf.data(), mExIdToLen, mMaxSigId))
+    {
+        DBG_LOG("Failed to decompress chunk at offset %llu - file corrupt!\n", (unsigned long long)chunk.filePos);
+        return false;
+    }
+    data = buf.data();
+    size = buf.size();
+    begin = mDataBegin + chunk.streamPos;
+    return true;
+}
+
+static unsigned int ReadCompressedLength(std::fstream& inStream)
 {
     unsigned char buf[4];
     unsigned int length;
@@ -133,24 +362,8 @@ bool InFileRA::CreateRAFile(const char* name, const std::string& target)
         return false;
     }
 
-    if (target.empty())
-    {
-        // Extract filename from path (on copy because basename() might modify input)
-        char* nameCopy = strdup(name);
-        {
-            // Construct RA filename. Will be created in current working dir.
-            std::stringstream ss;
-            ss << basename(nameCopy) << ".ra";
-            mFileName = ss.str();
-        }
-        free(nameCopy); // basename() might use/modify input, so this needs to be kept alive until done
-
-        DBG_LOG("Creating temporary random access file %s\n", mFileName.c_str());
-    }
-    else
-    {
-        mFileName = target;
-    }
+    mFileName = target;
+    DBG_LOG("Creating random access file %s\n", mFileName.c_str());
 
     outStream.open(mFileName.c_str(), std::fstream::binary | std::fstream::out | std::fstream::trunc);
 
@@ -209,8 +422,19 @@ bool InFileRA::CreateRAFile(const char* name, const std::string& target)
 
     while ( !inStream.eof() )
     {
-        unsigned int compressedLength = ReadCompressedLength(inStream);
+        const unsigned int prefix = ReadCompressedLength(inStream);
+        if (prefix == CHUNK_TRAILER_PREFIX)
+        {
+            break;
+        }
+        const unsigned int compressedLength = chunkPrefixLength(prefix);
+        const ChunkCodec codec = chunkPrefixCodec(prefix);
         size_t uncompressedLength = 0;
+        if (!chunkCodecAvailable(codec))
+        {
+            DBG_LOG("Trace uses %s compression, which this build does not support - aborting!\n", chunkCodecName(codec));
+            os::abort();
+        }
         if (compressedLength)
         {
             if (compressedCacheLen < compressedLength)
@@ -222,7 +446,7 @@ bool InFileRA::CreateRAFile(const char* name, const std::string& target)
         }
 
         inStream.read(compressedCache, compressedLength);
-        if (!snappy::GetUncompressedLength(compressedCache, (size_t)compressedLength, &uncompressedLength) && compressedLength > 0)
+        if (!chunkUncompressedLength(codec, compressedCache, (size_t)compressedLength, &uncompressedLength) && compressedLength > 0)
         {
             DBG_LOG("Failed to parse chunk of size %u - file corrupt - aborting!\n", compressedLength);
             os::abort();
@@ -233,7 +457,7 @@ bool InFileRA::CreateRAFile(const char* name, const std::string& target)
             unCompressedCacheLen = uncompressedLength;
             unCompressedCache = new char [unCompressedCacheLen];
         }
-        if (!snappy::RawUncompress(compressedCache, compressedLength, unCompressedCache) && compressedLength > 0)
+        if (!chunkUncompress(codec, compressedCache, compressedLength, unCompressedCache, mExIdToLen, mMaxSigId) && compressedLength > 0)
         {
             DBG_LOG("Failed to decompress chunk of size %u - file is corrupt - aborting!\n", compressedLength);
             os::abort();
@@ -252,11 +476,17 @@ bool InFileRA::CreateRAFile(const char* name, const std::string& target)
 
 void InFileRA::ReadSigBook()
 {
-    unsigned int toNext;
-    mStream.read((char*)&toNext, sizeof(toNext));
-    this->ReadChunk(toNext - sizeof(toNext));
+    mPos = mDataBegin;
+    unsigned int toNext = 0;
+    if (!LoadChunk(0) || mChunkEnd < sizeof(toNext)
+        || (toNext = *(const unsigned int*)mChunkData) < sizeof(toNext) || toNext > mChunkEnd)
+    {
+        DBG_LOG("Failed to read the signature book of %s\n", mFileName.c_str());
+        os::abort();
+    }
+    mPos += toNext;
 
-    char* src = mCache;
+    char* src = mChunkData + sizeof(toNext);
     src = ReadFixed(src, mMaxSigId);
 
     if (mMaxSigId > ApiInfo::MaxSigId) {
@@ -288,10 +518,11 @@ void InFileRA::ReadSigBook()
     mExIdToFunc[0] = 0;
     for (unsigned short id = 1; id <= mMaxSigId; ++id)
     {
-        const char* name = mExIdToName.at(id).c_str();
-        mExIdToLen[id] = gApiInfo.NameToLen(name);
-        mExIdToFunc[id] = gApiInfo.NameToFptr(name);
+        const unsigned short apiId = gApiInfo.NameToId(mExIdToName.at(id).c_str());
+        mExIdToLen[id] = ApiInfo::IdToLenArr[apiId]; // 0 for functions it does not know
+        mExIdToFunc[id] = gApiInfo.IdToFptr(apiId);
     }
+    buildExIdTables();
 }
 
 void InFileRA::copySigBook(std::vector<std::string> &sigbook)
@@ -3,102 +3,177 @@
 
 #include <common/api_info.hpp>
 #include <common/in_file.hpp>
+#include <common/trace_index.hpp>
+#include <common/chunk_codec.hpp>
 
-#include <snappy.h>
+#include <vector>
 
 namespace common {
 
+/// Random access reader for .pat files.
+///
+/// The trace is memory mapped and chunks are decompressed on demand into a small LRU cache,
+/// so GetNextCall() only has to hand out pointers into a decoded chunk. Read positions are
+/// offsets into the uncompressed layout of the trace (headers followed by the call stream),
+/// which is what a .ra file contains, so positions are the same whether the reader was given
+/// a .pat or a .ra file.
 class InFileRA : public InFileBase {
 public:
-    InFileRA()
-     :InFileBase()
-     ,mCacheLen(1024)
-     ,mCache(new char[mCacheLen])
-    {
-    }
+    InFileRA() : InFileBase() {}
 
     ~InFileRA()
     {
+        Close();
         delete [] mExIdToFunc;
         delete [] mExIdToLen;
         mExIdToName.clear();
-        delete [] mCache;
     }
 
+    /// Write the decompressed trace to this .ra file when opening a .pat file, and read from
+    /// that instead. Without a target, the .pat file is read directly.
     void setTarget(const std::string& target) { mTarget = target; }
     bool Open(const char *name, bool readHeaderAndExit = false);
-    void Close() { mStream.close(); }
+    void Close();
 
     std::streamoff GetReadPos()
     {
-        return mStream.tellg();
+        return mPos;
     }
 
     void SetReadPos(std::streamoff pos)
     {
-        mStream.seekg(pos, std::ios_base::beg);
+        mPos = pos;
     }
 
+    /// Read position of the first byte of the call stream (the signature book), which is
+    /// where stream position 0 of a TraceIndex maps to.
+    std::streamoff GetDataBegin() const
+    {
+        return mDataBegin;
+    }
+
+    /// The returned src points into a cached chunk. It stays valid until the reader has to
+    /// decode a different chunk, so it must be parsed before the next call is read.
     bool GetNextCall(void*& fptr, common::BCall_vlen& call, char*& src)
     {
-        mStream.read(mCache, sizeof(common::BCall));
-        if (mStream.fail())
+        if (mPos < mDataBegin)
+        {
+            return false;
+        }
+        const uint64_t pos = mPos - mDataBegin;
+        if (pos < mChunkBegin || pos >= mChunkEnd)
+        {
+            if (!LoadChunk(pos))
+            {
+                return false;
+            }
+        }
+
+        char* ptr = mChunkData + (pos - mChunkBegin);
+        const uint64_t avail = mChunkEnd - pos;
+        if (avail < sizeof(common::BCall))
         {
-            mStream.clear();
             return false;
         }
 
-        common::BCall tmpCall;
-        tmpCall = *(common::BCall*)mCache;
+        const common::BCall& tmpCall = *(const common::BCall*)ptr;
         unsigned int callLen = mExIdToLen[tmpCall.funcId];
-        unsigned int contentLen;
+        unsigned int headerLen;
         if (callLen == 0)
         {
-            mStream.read((char*)&callLen, sizeof(unsigned int));
-            contentLen = callLen - sizeof(common::BCall_vlen);
-            call = *(common::BCall_vlen*)mCache;
+            if (avail < sizeof(common::BCall_vlen))
+            {
+                return false;
+            }
+            call = *(const common::BCall_vlen*)ptr;
+            callLen = call.toNext;
+            headerLen = sizeof(common::BCall_vlen);
         }
         else
         {
-            contentLen = callLen - sizeof(common::BCall);
             call = tmpCall;
+            headerLen = sizeof(common::BCall);
         }
 
-        if (!this->ReadChunk(contentLen))
+        // calls never span chunks
+        if (callLen < headerLen || callLen > avail)
         {
-            mStream.clear();
             return false;
         }
 
-        mDataPtr = src = mCache;
+        mPos += callLen;
+        mDataPtr = src = ptr + headerLen;
         fptr = mExIdToFunc[call.funcId];
 
         return true;
     }
 
-    void copySigBook(std::vector<std::string> &sigbook);
-
-private:
-    inline bool ReadChunk(unsigned int len)
+    /// Like GetNextCall(), but hands out the call as it is stored, header included, with the
+    /// same lifetime as the src of GetNextCall()
+    bool GetNextRawCall(const char*& data, unsigned int& length)
     {
-        if (mCacheLen < len) {
-            mCacheLen = len * 2;
-            delete [] mCache;
-            mCache = new char[mCacheLen];
-        }
-        mStream.read(mCache, len);
-        if (mStream.fail())
+        const std::streamoff begin = mPos;
+        void* fptr = nullptr;
+        common::BCall_vlen call;
+        char* src = nullptr;
+        if (!GetNextCall(fptr, call, src))
+        {
             return false;
+        }
+        length = mPos - begin;
+        data = mChunkData + (begin - mDataBegin - mChunkBegin);
         return true;
     }
 
-    unsigned int ReadCompressedLength(std::fstream& inStream);
+    /// The compressed chunk holding the given read position, as stored in the file with its
+    /// length prefix, and the read positions [begin, end) of its calls. Fails for .ra files,
+    /// which have no chunks.
+    bool GetRawChunk(std::streamoff pos, std::streamoff& begin, std::streamoff& end, const char*& data, size_t& size) const;
+
+    void copySigBook(std::vector<std::string> &sigbook);
+
+    /// Number of chunks in the call stream, for ReadChunk(). A .ra file is one chunk.
+    size_t GetChunkCount() const { return mUncompressed ? 1 : mIndex.mChunks.size(); }
+
+    /// Decompress a chunk into buf, bypassing the chunk cache, so that several threads may
+    /// read chunks of the same reader at once. The calls of the chunk are [data, data + size),
+    /// and begin is the read position of data. For a .ra file data points into the file.
+    bool ReadChunk(size_t index, ChunkBuffer& buf, const char*& data, size_t& size, std::streamoff& begin) const;
+
+private:
+    struct CachedChunk
+    {
+        size_t index = SIZE_MAX;
+        uint64_t lastUse = 0;
+        ChunkBuffer data;
+    };
+
+    /// Make the chunk holding the given stream position current.
+    bool LoadChunk(uint64_t pos);
+    bool ScanChunks();
     bool CreateRAFile(const char* name, const std::string& target);
     void ReadSigBook();
 
-    unsigned int mCacheLen;
-    char *mCache;
     std::string mTarget;
+    std::streamoff mDataBegin = 0;
+    std::streamoff mPos = 0;
+
+    int mFd = -1;
+    char* mMap = nullptr;
+    uint64_t mMapSize = 0;
+    bool mUncompressed = false; ///< reading a .ra file, the call stream is used in place
+
+    TraceIndex mIndex; ///< only the chunk table is used
+    uint64_t mStreamSize = 0;
+
+    // the current chunk, as [mChunkBegin, mChunkEnd) of the call stream
+    char* mChunkData = nullptr;
+    uint64_t mChunkBegin = 0;
+    uint64_t mChunkEnd = 0;
+
+    static const int CHUNK_CACHE_SIZE = 4;
+    CachedChunk mCache[CHUNK_CACHE_SIZE];
+    uint64_t mUseCount = 0;
 };
 
 }
@@ -0,0 +1,253 @@
+#include "common/json_stream.hpp"
+
+#include <jsoncpp/include/json/writer.h>
+
+#include <algorithm>
+#include <string.h>
+
+namespace common {
+
+JsonStream::JsonStream(FILE* fp)
+    : mFile(fp)
+{
+    mBuffer.reserve(BUFFER_SIZE);
+}
+
+void JsonStream::value(const Json::Value& value, const JsonColumns* columns)
+{
+    const std::string root;
+    writeTree(value, columns ? &root : nullptr, columns);
+    if (mLevels.empty())
+    {
+        put("\n");
+    }
+}
+
+void JsonStream::beginObject()
+{
+    next();
+    put("{");
+    const Level level = { true, false, 0 };
+    mLevels.push_back(level);
+}
+
+void JsonStream::endObject()
+{
+    const Level level = mLevels.back();
+    mLevels.pop_back();
+    if (level.count > 0)
+    {
+        newline();
+    }
+    put(mLevels.empty() ? "}\n" : "}");
+}
+
+void JsonStream::beginArray()
+{
+    next();
+    put("[");
+    const Level level = { false, false, 0 };
+    mLevels.push_back(level);
+}
+
+void JsonStream::endArray()
+{
+    const Level level = mLevels.back();
+    mLevels.pop_back();
+    if (level.inline_ && level.count > 0)
+    {
+        put(" ");
+    }
+    else if (level.count > 0)
+    {
+        newline();
+    }
+    put(mLevels.empty() ? "]\n" : "]");
+}
+
+void JsonStream::key(const std::string& name)
+{
+    Level& level = mLevels.back();
+    if (level.count++ > 0)
+    {
+        put(",");
+    }
+    newline();
+    put(Json::valueToQuotedString(name.c_str()));
+    put(" : ");
+    mHasKey = true;
+}
+
+void JsonStream::next()
+{
+    if (mHasKey)
+    {
+        mHasKey = false; // the value goes after its key, which is already counted
+        return;
+    }
+    if (mLevels.empty())
+    {
+        return;
+    }
+    Level& level = mLevels.back();
+    if (level.count++ > 0)
+    {
+        put(",");
+    }
+    if (level.inline_)
+    {
+        put(" ");
+    }
+    else
+    {
+        newline();
+    }
+}
+
+void JsonStream::writeTree(const Json::Value& value, const std::string* path, const JsonColumns* columns)
+{
+    if (value.isArray())
+    {
+        bool scalars = value.size() > 0;
+        for (Json::ArrayIndex i = 0; i < value.size() && scalars; i++)
+        {
+            scalars = !value[i].isArray() && !value[i].isObject();
+        }
+        beginArray();
+        mLevels.back().inline_ = scalars;
+        for (Json::ArrayIndex i = 0; i < value.size(); i++)
+        {
+            writeTree(value[i], nullptr, columns);
+        }
+        endArray();
+    }
+    else if (value.isObject())
+    {
+        std::vector<std::string> names = value.getMemberNames();
+        std::vector<const JsonColumns::Column*> found;
+        if (path)
+        {
+            for (const JsonColumns::Column& column : columns->mColumns)
+            {
+                if (column.object == *path)
+                {
+                    found.push_back(&column);
+                    if (!value.isMember(column.name))
+                    {
+                        names.push_back(column.name);
+                    }
+                }
+            }
+            std::sort(names.begin(), names.end());
+        }
+        beginObject();
+        for (const std::string& name : names)
+        {
+            key(name);
+            const JsonColumns::Column* column = nullptr;
+            for (const JsonColumns::Column* c : found)
+            {
+                if (c->name == name) column = c;
+            }
+            if (column)
+            {
+                writeColumn(*column);
+            }
+            else if (path)
+            {
+                const std::string child = path->empty() ? name : *path + "/" + name;
+                writeTree(value[name], &child, columns);
+            }
+            else
+            {
+                writeTree(value[name], nullptr, columns);
+            }
+        }
+        endObject();
+    }
+    else
+    {
+        next();
+        writeScalar(value);
+    }
+}
+
+void JsonStream::writeColumn(const JsonColumns::Column& column)
+{
+    next();
+    put("[");
+    char text[32];
+    for (size_t i = 0; i < column.count; i++)
+    {
+        put(i > 0 ? ", " : " ");
+        const char* element = column.first + i * column.stride;
+        switch (column.type)
+        {
+        case JsonColumns::INT32: { int32_t v; memcpy(&v, element, sizeof(v)); snprintf(text, sizeof(text), "%d", (int)v); put(text); break; }
+        case JsonColumns::UINT32: { uint32_t v; memcpy(&v, element, sizeof(v)); snprintf(text, sizeof(text), "%u", (unsigned)v); put(text); break; }
+        case JsonColumns::INT64: { int64_t v; memcpy(&v, element, sizeof(v)); snprintf(text, sizeof(text), "%lld", (long long)v); put(text); break; }
+        case JsonColumns::UINT64: { uint64_t v; memcpy(&v, element, sizeof(v)); snprintf(text, sizeof(text), "%llu", (unsigned long long)v); put(text); break; }
+        case JsonColumns::FLOAT: { float v; memcpy(&v, element, sizeof(v)); writeNumber(v); break; }
+        case JsonColumns::DOUBLE: { double v; memcpy(&v, element, sizeof(v)); writeNumber(v); break; }
+        }
+    }
+    put(column.count > 0 ? " ]" : "]");
+}
+
+void JsonStream::writeScalar(const Json::Value& value)
+{
+    switch (value.type())
+    {
+    case Json::nullValue: put("null"); break;
+    case Json::intValue: put(Json::valueToString(value.asLargestInt())); break;
+    case Json::uintValue: put(Json::valueToString(value.asLargestUInt())); break;
+    case Json::realValue: writeNumber(value.asDouble()); break;
+    case Json::stringValue: put(Json::valueToQuotedString(value.asCString())); break;
+    case Json::booleanValue: put(value.asBool() ? "true" : "false"); break;
+    default: break;
+    }
+}
+
+// As Json::valueToString(double) does, without making a string of each
+void JsonStream::writeNumber(double value)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%.16g", value);
+    for (char* c = text; *c; c++)
+    {
+        if (*c == ',') *c = '.'; // in locales with decimal commas
+    }
+    put(text);
+}
+
+void JsonStream::newline()
+{
+    put("\n");
+    mBuffer.append(mLevels.size() * 3, ' ');
+}
+
+void JsonStream::put(const char* text, size_t size)
+{
+    mBuffer.append(text, size);
+    if (mBuffer.size() >= BUFFER_SIZE)
+    {
+        flush();
+    }
+}
+
+void JsonStream::put(const char* text)
+{
+    put(text, strlen(text));
+}
+
+bool JsonStream::flush()
+{
+    if (!mBuffer.empty() && !mFailed)
+    {
+        mFailed = fwrite(mBuffer.data(), mBuffer.size(), 1, mFile) != 1;
+    }
+    mBuffer.clear();
+    return !mFailed;
+}
+
+}
@@ -0,0 +1,120 @@
+#ifndef _COMMON_JSON_STREAM_HPP_
+#define _COMMON_JSON_STREAM_HPP_
+
+#include <jsoncpp/include/json/value.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+namespace common {
+
+/// Arrays of numbers to write as members of a JSON tree straight from the buffers they were
+/// collected in, so that per-frame data never has to be turned into Json::Values. A column is
+/// added to the object found by following the member names in object, separated by '/', from
+/// the root of the tree that is written, or to the root itself for "". That object must be in
+/// the tree, and the buffers must be kept until the tree has been written.
+class JsonColumns
+{
+public:
+    template<typename T>
+    void add(const std::string& object, const std::string& name, const std::vector<T>& data)
+    {
+        add(object, name, data.data(), data.size(), sizeof(T));
+    }
+
+    /// Add a column of count values, each stride bytes after the one before, such as one member
+    /// of an array of structs
+    template<typename T>
+    void add(const std::string& object, const std::string& name, const T* first, size_t count, size_t stride)
+    {
+        const Column column = { object, name, typeOf(first), (const char*)first, count, stride };
+        mColumns.push_back(column);
+    }
+
+    bool empty() const { return mColumns.empty(); }
+    void clear() { mColumns.clear(); }
+
+private:
+    friend class JsonStream;
+
+    enum Type { INT32, UINT32, INT64, UINT64, FLOAT, DOUBLE };
+
+    static Type typeOf(const int32_t*) { return INT32; }
+    static Type typeOf(const uint32_t*) { return UINT32; }
+    static Type typeOf(const int64_t*) { return INT64; }
+    static Type typeOf(const uint64_t*) { return UINT64; }
+    static Type typeOf(const float*) { return FLOAT; }
+    static Type typeOf(const double*) { return DOUBLE; }
+
+    struct Column
+    {
+        std::string object;
+        std::string name;
+        Type type;
+        const char* first;
+        size_t count;
+        size_t stride;
+    };
+
+    std::vector<Column> mColumns;
+};
+
+/// Writes JSON to a file as it goes, laid out like Json::StyledWriter does, except that arrays of
+/// numbers, strings and booleans are always kept on one line. Nothing is put together in memory
+/// besides a small write buffer, so a result of hundreds of megabytes costs no more than its tree,
+/// and nothing at all for the parts given as JsonColumns.
+class JsonStream
+{
+public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    explicit JsonStream(FILE* fp);
+    ~JsonStream() { flush(); }
+
+    /// Write a whole tree as the next value, with the columns that belong in its objects
+    void value(const Json::Value& value, const JsonColumns* columns = nullptr);
+
+    // To write the containers around trees by hand
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    /// Name the next value written into the current object
+    void key(const std::string& name);
+
+    /// Write out what is buffered. Returns false if any write failed so far.
+    bool flush();
+    bool failed() const { return mFailed; }
+
+private:
+    struct Level
+    {
+        bool object;
+        bool inline_; ///< elements are kept on the line of the opening bracket
+        unsigned count;
+    };
+
+    /// Start a new value in the current container
+    void next();
+    void writeTree(const Json::Value& value, const std::string* path, const JsonColumns* columns);
+    void writeColumn(const JsonColumns::Column& column);
+    void writeScalar(const Json::Value& value);
+    void writeNumber(double value);
+    void newline();
+    void put(const char* text, size_t size);
+    void put(const std::string& text) { put(text.data(), text.size()); }
+    void put(const char* text);
+
+    FILE* mFile;
+    std::string mBuffer;
+    std::vector<Level> mLevels;
+    bool mHasKey = false; ///< key() was just written, so the value goes after it
+    bool mFailed = false;
+};
+
+}
+
+#endif
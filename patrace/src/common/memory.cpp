@@ -3,6 +3,11 @@
 
 #include <cstdio>
 #include <cassert>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace common
 {
@@ -22,29 +27,166 @@ void PrintMemory(const void *mem, size_t len)
     printf("\nMEMORY PRINT END : %d <<<<<<<<<<<<< }\n", (int)len);
 }
 
-void * ClientSideBufferObject::extend(const void *p, ptrdiff_t s)
+static inline uint64_t rotl64(uint64_t x, int r)
 {
-    const void *new_base_address = PTR_DIFF(base_address, p) > (ptrdiff_t)(0) ? p : base_address;
-    const ptrdiff_t size1 = PTR_DIFF(PTR_MOVE(p, s), new_base_address);
-    const ptrdiff_t size2 = PTR_DIFF(PTR_MOVE(base_address, size), new_base_address);
-    base_address = const_cast<void*>(new_base_address);
-    size = size1 > size2 ? size1 : size2;
-    return base_address;
+    return (x << r) | (x >> (64 - r));
 }
 
-VertexAttributeMemoryMerger::~VertexAttributeMemoryMerger()
+static inline uint64_t fmix64(uint64_t k)
 {
-    for (unsigned int i = 0; i < _memory_ranges.size(); ++i)
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static const uint64_t MURMUR_C1 = 0x87c37b91114253d5ULL;
+static const uint64_t MURMUR_C2 = 0x4cf5ad432745937fULL;
+
+void FastHasher::block(const unsigned char* p)
+{
+    uint64_t k1, k2;
+    memcpy(&k1, p, sizeof(k1));
+    memcpy(&k2, p + 8, sizeof(k2));
+
+    k1 *= MURMUR_C1; k1 = rotl64(k1, 31); k1 *= MURMUR_C2; mH1 ^= k1;
+    mH1 = rotl64(mH1, 27); mH1 += mH2; mH1 = mH1 * 5 + 0x52dce729;
+    k2 *= MURMUR_C2; k2 = rotl64(k2, 33); k2 *= MURMUR_C1; mH2 ^= k2;
+    mH2 = rotl64(mH2, 31); mH2 += mH1; mH2 = mH2 * 5 + 0x38495ab5;
+}
+
+void FastHasher::append(const void* data, size_t length)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    mLength += length;
+    if (mTailLength)
     {
-        delete _memory_ranges[i];
+        const size_t n = std::min(length, (size_t)(BLOCK_LEN - mTailLength));
+        memcpy(mTail + mTailLength, p, n);
+        mTailLength += n;
+        p += n;
+        length -= n;
+        if (mTailLength < BLOCK_LEN)
+        {
+            return;
+        }
+        block(mTail);
+        mTailLength = 0;
     }
-    _memory_ranges.clear();
+    for (; length >= BLOCK_LEN; p += BLOCK_LEN, length -= BLOCK_LEN)
+    {
+        block(p);
+    }
+    memcpy(mTail, p, length);
+    mTailLength = length;
+}
 
-    for (unsigned int i = 0; i < _attributes.size(); ++i)
+void FastHasher::finish(unsigned char* digest)
+{
+    uint64_t k1 = 0, k2 = 0;
+    for (unsigned i = mTailLength; i > 8; --i)
     {
-        delete _attributes[i];
+        k2 = (k2 << 8) | mTail[i - 1];
     }
-    _attributes.clear();
+    for (unsigned i = std::min(mTailLength, 8u); i > 0; --i)
+    {
+        k1 = (k1 << 8) | mTail[i - 1];
+    }
+    if (mTailLength > 8)
+    {
+        k2 *= MURMUR_C2; k2 = rotl64(k2, 33); k2 *= MURMUR_C1; mH2 ^= k2;
+    }
+    if (mTailLength > 0)
+    {
+        k1 *= MURMUR_C1; k1 = rotl64(k1, 31); k1 *= MURMUR_C2; mH1 ^= k1;
+    }
+
+    mH1 ^= mLength;
+    mH2 ^= mLength;
+    mH1 += mH2;
+    mH2 += mH1;
+    mH1 = fmix64(mH1);
+    mH2 = fmix64(mH2);
+    mH1 += mH2;
+    mH2 += mH1;
+
+    memcpy(digest, &mH1, sizeof(mH1));
+    memcpy(digest + 8, &mH2, sizeof(mH2));
+}
+
+static inline bool blockEqual(const unsigned char* a, const unsigned char* b)
+{
+#if defined(__SSE2__)
+    __m128i diff = _mm_xor_si128(_mm_loadu_si128((const __m128i*)a), _mm_loadu_si128((const __m128i*)b));
+    for (int i = 16; i < CSB_PATCH_BLOCK_SIZE; i += 16)
+    {
+        diff = _mm_or_si128(diff, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xffff;
+#elif defined(__ARM_NEON)
+    uint8x16_t diff = veorq_u8(vld1q_u8(a), vld1q_u8(b));
+    for (int i = 16; i < CSB_PATCH_BLOCK_SIZE; i += 16)
+    {
+        diff = vorrq_u8(diff, veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+    const uint64x2_t wide = vreinterpretq_u64_u8(diff);
+    return (vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1)) == 0;
+#else
+    return memcmp(a, b, CSB_PATCH_BLOCK_SIZE) == 0;
+#endif
+}
+
+bool findDirtySpans(const void* oldData, const void* newData, unsigned int length,
+                    unsigned int maxDirtyBytes, std::vector<CSBPatch>& patches)
+{
+    const unsigned char* oldPtr = static_cast<const unsigned char*>(oldData);
+    const unsigned char* newPtr = static_cast<const unsigned char*>(newData);
+    const unsigned int blockEnd = length - length % CSB_PATCH_BLOCK_SIZE;
+    unsigned int dirtyBytes = 0;
+    bool inSpan = false;
+
+    for (unsigned int offset = 0; offset < length; offset += CSB_PATCH_BLOCK_SIZE)
+    {
+        const unsigned int size = offset < blockEnd ? CSB_PATCH_BLOCK_SIZE : length - offset;
+        const bool equal = size == CSB_PATCH_BLOCK_SIZE ? blockEqual(oldPtr + offset, newPtr + offset)
+                                                        : memcmp(oldPtr + offset, newPtr + offset, size) == 0;
+        if (equal)
+        {
+            inSpan = false;
+            continue;
+        }
+
+        dirtyBytes += size;
+        if (dirtyBytes > maxDirtyBytes)
+        {
+            return false;
+        }
+        if (inSpan)
+        {
+            patches.back().length += size;
+        }
+        else
+        {
+            CSBPatch patch;
+            patch.offset = offset;
+            patch.length = size;
+            patches.push_back(patch);
+            inSpan = true;
+        }
+    }
+    return true;
+}
+
+void * ClientSideBufferObject::extend(const void *p, ptrdiff_t s)
+{
+    const void *new_base_address = PTR_DIFF(base_address, p) > (ptrdiff_t)(0) ? p : base_address;
+    const ptrdiff_t size1 = PTR_DIFF(PTR_MOVE(p, s), new_base_address);
+    const ptrdiff_t size2 = PTR_DIFF(PTR_MOVE(base_address, size), new_base_address);
+    base_address = const_cast<void*>(new_base_address);
+    size = size1 > size2 ? size1 : size2;
+    return base_address;
 }
 
 void VertexAttributeMemoryMerger::add_attribute(
@@ -56,36 +198,51 @@ void VertexAttributeMemoryMerger::add_attribute(
     bool            normalized,
     size_t          stride)
 {
-#if 0
-    DBG_LOG("VertexAttributeMemoryMerger::add_attribute()\n");
-    DBG_LOG("    index=%d\n", index);
-    DBG_LOG("    ptr=%p\n", ptr);
-    DBG_LOG("    data_size=%d\n", data_size);
-    DBG_LOG("    size=%d\n", size);
-    DBG_LOG("    type=%d\n", type);
-    DBG_LOG("    normalized=%s\n", normalized?"true":"false");
-    DBG_LOG("    stride=%d\n", stride);
-#endif
+    const Span span = { static_cast<const char*>(ptr), static_cast<const char*>(ptr) + data_size, _attributes.size() };
+    _spans.push_back(span);
+    _attributes.push_back(AttributeInfo(index, ptr, 0, size, type, normalized, stride));
+    _merged = false;
+}
+
+void VertexAttributeMemoryMerger::clear()
+{
+    _memory_ranges.clear();
+    _attributes.clear();
+    _spans.clear();
+    _merged = true;
+}
+
+void VertexAttributeMemoryMerger::merge() const
+{
+    if (_merged)
+    {
+        return;
+    }
+    _merged = true;
+    _memory_ranges.clear();
+    // reserved up front, as copying a range when the vector grows would hash it again
+    _memory_ranges.reserve(_spans.size());
 
-    // Loop over available memory blocks, checking for interleaved attributes
-    for (unsigned int i = 0; i < _memory_ranges.size(); ++i)
+    // a draw has a handful of attributes, sorting them is cheaper than any index
+    std::sort(_spans.begin(), _spans.end());
+    size_t first = 0;
+    while (first < _spans.size())
     {
-        if (_memory_ranges[i]->overlap(ptr, data_size))
+        // ranges overlap when they share a byte, ranges that only touch stay apart
+        const char *begin = _spans[first].begin;
+        const char *end = _spans[first].end;
+        size_t last = first + 1;
+        for (; last < _spans.size() && _spans[last].begin < end && begin < _spans[last].end; ++last)
         {
-            const void * orig_base_address = _memory_ranges[i]->base_address;
-            const void * new_base_address = _memory_ranges[i]->extend(ptr, data_size);
-            for (unsigned int j = 0; j < _attributes.size(); ++j)
-            {
-                if (_attributes[j]->base_address == orig_base_address)
-                    _attributes[j]->update(new_base_address);
-            }
-
-            _attributes.push_back(new AttributeInfo(index, new_base_address, PTR_DIFF(ptr, new_base_address), size, type, normalized, stride));
-            return;
+            end = std::max(end, _spans[last].end);
+        }
+        for (size_t i = first; i < last; ++i)
+        {
+            _attributes[_spans[i].attribute].update(begin);
         }
+        _memory_ranges.emplace_back(begin, end - begin);
+        first = last;
     }
-    _memory_ranges.push_back(new ClientSideBufferObject(ptr, data_size));
-    _attributes.push_back(new AttributeInfo(index, ptr, 0, size, type, normalized, stride));
 }
 
 } // namespace common
@@ -1,8 +1,10 @@
 #ifndef _INCLUDE_MEMORY_
 #define _INCLUDE_MEMORY_
 
+#include <algorithm>
 #include <cstddef>
 #include <cstring>
+#include <stdint.h>
 #include <vector>
 #include <unordered_map>
 #include <map>
@@ -29,57 +31,131 @@ void PrintMemory(const void *mem, size_t len);
 
 typedef unsigned int ClientSideBufferObjectName;
 
-struct MD5Digest
+// Hashers for BasicDigest: init(), append(data, length) and finish(digest) with a
+// DIGEST_LEN byte digest.
+
+// MD5, for digests that are written out or compared across runs, such as shader cache keys,
+// state logs and md5sums.
+struct MD5Hasher
 {
-public:
     enum { DIGEST_LEN = 16 };
 
-    MD5Digest()
+    void init() { md5_init(&mState); }
+    void append(const void* data, size_t length) { md5_append(&mState, static_cast<const unsigned char*>(data), length); }
+    void finish(unsigned char* digest) { md5_finish(&mState, digest); }
+
+private:
+    md5_state_t mState;
+};
+
+// MurmurHash3 x64 128, several times as fast as MD5 and as well distributed, for telling
+// contents apart in memory. It is not cryptographic and not meant to be stable between
+// versions, so it must not end up in files.
+struct FastHasher
+{
+    enum { DIGEST_LEN = 16 };
+
+    void init()
+    {
+        mH1 = mH2 = 0;
+        mLength = 0;
+        mTailLength = 0;
+    }
+    void append(const void* data, size_t length);
+    void finish(unsigned char* digest);
+
+private:
+    enum { BLOCK_LEN = 16 };
+
+    void block(const unsigned char* p);
+
+    uint64_t mH1, mH2;
+    uint64_t mLength;
+    unsigned char mTail[BLOCK_LEN]; // bytes of an unfinished block
+    unsigned mTailLength;
+};
+
+// Number of bytes strided elements are gathered into before they are hashed
+static const int DIGEST_GATHER_LEN = 4096;
+
+template<class Hasher>
+struct BasicDigest
+{
+public:
+    enum { DIGEST_LEN = Hasher::DIGEST_LEN };
+
+    BasicDigest()
     {
         memset(_digest, 0, DIGEST_LEN);
     }
 
-    MD5Digest(const void* str, int length)
+    BasicDigest(const void* str, int length)
     {
-        md5_state_t mdContext;
-        md5_init(&mdContext);
+        Hasher hasher;
+        hasher.init();
         if (str)
-            md5_append(&mdContext, static_cast<const unsigned char*>(str), length);
-        md5_finish(&mdContext, _digest);
+            hasher.append(str, length);
+        hasher.finish(_digest);
     }
 
-    MD5Digest(const std::string& str) : MD5Digest(str.c_str(), str.size()) {}
+    BasicDigest(const std::string& str) : BasicDigest(str.c_str(), str.size()) {}
 
-    MD5Digest(const std::vector<std::string>& strlist)
+    BasicDigest(const std::vector<std::string>& strlist)
     {
-        md5_state_t mdContext;
-        md5_init(&mdContext);
+        Hasher hasher;
+        hasher.init();
         for (unsigned i = 0; i < strlist.size(); ++i)
         {
-             md5_append(&mdContext, (const unsigned char*)strlist[i].c_str(), strlist[i].size());
+             hasher.append(strlist[i].c_str(), strlist[i].size());
         }
-        md5_finish(&mdContext, _digest);
+        hasher.finish(_digest);
     }
 
-    MD5Digest(void* ptr, int stride, int sizePerElem, int count)
+    // The digest of count elements of sizePerElem bytes, stride bytes apart. Elements are
+    // gathered into blocks first, as appending them one by one costs more than hashing them.
+    BasicDigest(void* ptr, int stride, int sizePerElem, int count)
     {
-        md5_state_t mdContext;
-        md5_init(&mdContext);
+        Hasher hasher;
+        hasher.init();
 
         if (!stride)
         {
             stride = sizePerElem;
         }
 
-        unsigned char* charPtr = static_cast<unsigned char*>(ptr);
-        unsigned char* charPtrEnd = charPtr + stride * count;
-
-        for (unsigned char* p = charPtr; p != charPtrEnd; p += stride)
+        const unsigned char* charPtr = static_cast<const unsigned char*>(ptr);
+        if (stride == sizePerElem || sizePerElem > DIGEST_GATHER_LEN / 2)
         {
-            md5_append(&mdContext, p, sizePerElem);
+            if (stride == sizePerElem)
+            {
+                hasher.append(charPtr, (size_t)sizePerElem * count);
+            }
+            else
+            {
+                for (int i = 0; i < count; ++i, charPtr += stride)
+                {
+                    hasher.append(charPtr, sizePerElem);
+                }
+            }
+        }
+        else
+        {
+            unsigned char block[DIGEST_GATHER_LEN];
+            const int perBlock = DIGEST_GATHER_LEN / sizePerElem;
+            for (int i = 0; i < count; )
+            {
+                const int n = std::min(perBlock, count - i);
+                unsigned char* dst = block;
+                for (int j = 0; j < n; ++j, charPtr += stride, dst += sizePerElem)
+                {
+                    memcpy(dst, charPtr, sizePerElem);
+                }
+                hasher.append(block, dst - block);
+                i += n;
+            }
         }
 
-        md5_finish(&mdContext, _digest);
+        hasher.finish(_digest);
     }
 
     const char *data() { return (const char *)_digest; }
@@ -111,15 +187,15 @@ public:
     operator unsigned char *() { return _digest; }
     operator const unsigned char *() const { return _digest; }
 
-    bool operator==(const MD5Digest &other) const
+    bool operator==(const BasicDigest &other) const
     {
         return memcmp(_digest, other._digest, DIGEST_LEN) == 0;
     }
-    bool operator!=(const MD5Digest &other) const
+    bool operator!=(const BasicDigest &other) const
     {
         return memcmp(_digest, other._digest, DIGEST_LEN) != 0;
     }
-    bool operator<(const MD5Digest &other) const
+    bool operator<(const BasicDigest &other) const
     {
         return memcmp(_digest, other._digest, DIGEST_LEN) < 0;
     }
@@ -128,11 +204,12 @@ private:
     unsigned char _digest[DIGEST_LEN];
 };
 
-inline std::ostream& operator<<(std::ostream& o, const MD5Digest& md)
+template<class Hasher>
+inline std::ostream& operator<<(std::ostream& o, const BasicDigest<Hasher>& md)
 {
     std::ios::fmtflags f = std::cout.flags();
 
-    for (int i = 0; i < MD5Digest::DIGEST_LEN; ++i)
+    for (int i = 0; i < BasicDigest<Hasher>::DIGEST_LEN; ++i)
     {
         o << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(md[i]);
     }
@@ -141,6 +218,11 @@ inline std::ostream& operator<<(std::ostream& o, const MD5Digest& md)
     return o;
 }
 
+typedef BasicDigest<MD5Hasher> MD5Digest;
+// Digest of contents that are only compared in memory, such as client-side buffers and
+// deduplicated blobs
+typedef BasicDigest<FastHasher> ContentDigest;
+
 struct CSBPatch
 {
     unsigned int offset;
@@ -152,6 +234,15 @@ struct CSBPatchList
     unsigned int count;
 };
 
+/// Granularity of the spans found by findDirtySpans()
+#define CSB_PATCH_BLOCK_SIZE 64
+
+/// Compare two copies of a buffer in CSB_PATCH_BLOCK_SIZE blocks and append the ranges that
+/// differ to patches, with adjacent dirty blocks merged into one patch. Gives up and returns
+/// false as soon as more than maxDirtyBytes differ.
+bool findDirtySpans(const void* oldData, const void* newData, unsigned int length,
+                    unsigned int maxDirtyBytes, std::vector<CSBPatch>& patches);
+
 // Represents a contiguous memory range
 class ClientSideBufferObject
 {
@@ -194,7 +285,7 @@ public:
 
     bool operator==(const ClientSideBufferObject &other) const
     {
-        return size == other.size && md5_digest() == other.md5_digest();
+        return size == other.size && digest() == other.digest();
     }
 
     void set_data(const void *p, ptrdiff_t s, bool copy = false)
@@ -229,23 +320,45 @@ public:
             base_address = const_cast<void *>(p);
         }
         size = s;
-        _dirty_md5_digest = true;
+        _dirty_digest = true;
 
         if (!_own_memory)
         {
             // If we don't own the memory referenced, meaning we also don't
-            // control the lifetime of it, we calculate the MD5 digest now as
+            // control the lifetime of it, we calculate the digest now as
             // the referenced memory might be invalidated at any time.
-            calculate_md5_digest();
+            calculate_digest();
+        }
+    }
+
+    // Refer to memory that stays valid for as long as this object uses it, such as preloaded
+    // trace data, instead of copying it. It is only copied if sub-data is set later.
+    void set_reference(const void *p, ptrdiff_t s)
+    {
+        if (base_address && _own_memory)
+        {
+            delete [](static_cast<char *>(base_address));
+            _own_memory = false;
         }
+        base_address = const_cast<void *>(p);
+        size = s;
+        _dirty_digest = true;
     }
 
     void set_subdata(const void *p, ptrdiff_t offset, ptrdiff_t s)
     {
         if (_own_memory == false)
         {
-            DBG_LOG("Can not set the sub-data of a client-side buffer object which does not own its memory.\n");
-            return;
+            if (!base_address)
+            {
+                DBG_LOG("Can not set the sub-data of a client-side buffer object without memory.\n");
+                return;
+            }
+            // copy on write, the memory referenced is not ours to change
+            char* buf = new char[size];
+            memcpy(buf, base_address, size);
+            base_address = buf;
+            _own_memory = true;
         }
 
         if (offset + s > size)
@@ -258,7 +371,7 @@ public:
         {
             memcpy(static_cast<char*>(base_address) + offset, p, s);
         }
-        _dirty_md5_digest = true;
+        _dirty_digest = true;
     }
 
     // Whether these two contiguous memory regions overlap
@@ -267,10 +380,10 @@ public:
     // Extend this memory region to contain another contiguous memory region, and return the new base address
     void * extend(const void *p, ptrdiff_t size);
 
-    const MD5Digest md5_digest() const
+    const ContentDigest digest() const
     {
-        if (_dirty_md5_digest) calculate_md5_digest();
-        return _md5_digest;
+        if (_dirty_digest) calculate_digest();
+        return _digest;
     }
 
     void * translate_address(ptrdiff_t offset) const
@@ -302,22 +415,24 @@ private:
     // If own its memory, should delete it in the destructor
     bool _own_memory;
 
-    // Cached MD5 digest
-    mutable bool _dirty_md5_digest = true;
-    mutable MD5Digest _md5_digest;
+    // Cached digest of the contents
+    mutable bool _dirty_digest = true;
+    mutable ContentDigest _digest;
 
     // If != 0, this will be used as destination by set_data
     // This is used by the glReadMapBufferRange, and glUnmapBuffer functiosn.
     void* _destinationAddress;
 
-    void calculate_md5_digest() const
+    void calculate_digest() const
     {
-        _md5_digest = MD5Digest(base_address, size);
-        _dirty_md5_digest = false;
+        _digest = ContentDigest(base_address, size);
+        _dirty_digest = false;
     }
 };
 
-// Try to merge memory range of multiple vertex attributes for one draw call into a contiguous memory region
+// Try to merge memory range of multiple vertex attributes for one draw call into a contiguous memory region.
+// Attributes and ranges are kept by value, and clear() keeps their storage, so that a merger reused
+// from draw to draw does not allocate once it has seen the largest draw.
 class VertexAttributeMemoryMerger
 {
 public:
@@ -346,19 +461,34 @@ public:
         ClientSideBufferObjectName obj_name;
     };
 
-    VertexAttributeMemoryMerger() {}
-    ~VertexAttributeMemoryMerger();
-
-    unsigned int memory_range_count() const { return _memory_ranges.size(); }
-    const ClientSideBufferObject* memory_range(size_t i) const { return _memory_ranges[i]; }
+    unsigned int memory_range_count() const { merge(); return _memory_ranges.size(); }
+    const ClientSideBufferObject* memory_range(size_t i) const { merge(); return &_memory_ranges[i]; }
     unsigned int attribute_count() const { return _attributes.size(); }
-    const AttributeInfo *attribute(size_t i) const { return _attributes[i]; }
+    const AttributeInfo *attribute(size_t i) const { merge(); return &_attributes[i]; }
 
     void add_attribute(unsigned int index, const void *ptr, ptrdiff_t data_size, int size, unsigned int type, bool normalized, size_t stride);
 
+    // Forget the attributes of the last draw
+    void clear();
+
 private:
-    std::vector<ClientSideBufferObject *> _memory_ranges;
-    std::vector<AttributeInfo *> _attributes;
+    struct Span
+    {
+        const char *begin;
+        const char *end;
+        size_t attribute;
+
+        bool operator<(const Span &other) const { return begin < other.begin; }
+    };
+
+    // Overlapping spans are only merged into ranges, and the ranges hashed, once all the
+    // attributes are known, so that a range is never hashed before it is complete
+    void merge() const;
+
+    mutable std::vector<ClientSideBufferObject> _memory_ranges;
+    mutable std::vector<AttributeInfo> _attributes;
+    mutable std::vector<Span> _spans; ///< of each attribute, sorted by merge()
+    mutable bool _merged = true;
 };
 
 class ClientSideBufferObjectSetPerThread
@@ -367,6 +497,9 @@ public:
     ClientSideBufferObjectSetPerThread()
     {
         _objects.emplace(0, new ClientSideBufferObject);   // a sentinel for being compatible with old traces
+#ifndef RETRACE
+        index_add(0);
+#endif
     }
 
     ~ClientSideBufferObjectSetPerThread()
@@ -385,8 +518,10 @@ public:
 #else
     ClientSideBufferObjectName create_object()
     {
-        _objects.emplace(_objects.size() + 1, new ClientSideBufferObject);
-        return _objects.size();
+        const ClientSideBufferObjectName name = _objects.size() + 1;
+        _objects.emplace(name, new ClientSideBufferObject);
+        index_add(name);
+        return name;
     }
 #endif
 
@@ -395,6 +530,9 @@ public:
         ClientSideBufferObjectList::iterator iter = _objects.find(name);
         if (iter != _objects.end())
         {
+#ifndef RETRACE
+            index_remove(name);
+#endif
             delete _objects.at(name);
             _objects.at(name) = NULL;
             return;
@@ -410,7 +548,35 @@ public:
         {
             _objects.emplace(name, new ClientSideBufferObject);
         }
+#ifndef RETRACE
+        else
+        {
+            index_remove(name);
+        }
+#endif
         _objects[name]->set_data(data, size, copy);
+#ifndef RETRACE
+        index_add(name);
+#endif
+    }
+
+    void object_reference(ClientSideBufferObjectName name, int size, const void *data)
+    {
+        ClientSideBufferObjectList::iterator iter = _objects.find(name);
+        if (iter == _objects.end())
+        {
+            _objects.emplace(name, new ClientSideBufferObject);
+        }
+#ifndef RETRACE
+        else
+        {
+            index_remove(name);
+        }
+#endif
+        _objects[name]->set_reference(data, size);
+#ifndef RETRACE
+        index_add(name);
+#endif
     }
 
     void object_subdata(ClientSideBufferObjectName name, int offset, int size, const void* data)
@@ -420,7 +586,16 @@ public:
         {
             DBG_LOG("Invalid client-side buffer name to set sub-data : %d\n", name);
         }
+#ifndef RETRACE
+        else
+        {
+            index_remove(name);
+        }
+#endif
         _objects[name]->set_subdata(data, offset, size);
+#ifndef RETRACE
+        index_add(name);
+#endif
     }
 
     ClientSideBufferObject *get_object(ClientSideBufferObjectName name) const
@@ -435,6 +610,18 @@ public:
 
     bool find(const ClientSideBufferObject &obj, ClientSideBufferObjectName &name) const
     {
+#ifndef RETRACE
+        const auto range = _index.equal_range(ContentKey(obj));
+        for (auto iter = range.first; iter != range.second; ++iter)
+        {
+            const ClientSideBufferObject *candidate = get_object(iter->second);
+            if (candidate && *candidate == obj)
+            {
+                name = iter->second;
+                return true;
+            }
+        }
+#else
         ClientSideBufferObjectList::const_iterator iter;
         for (iter = _objects.begin(); iter != _objects.end(); iter++)
         {
@@ -444,6 +631,7 @@ public:
                 return true;
             }
         }
+#endif
         return false;
     }
 
@@ -464,6 +652,61 @@ public:
 private:
     typedef std::unordered_map<unsigned int, ClientSideBufferObject*> ClientSideBufferObjectList;
     ClientSideBufferObjectList _objects;
+
+#ifndef RETRACE
+    // Index from content to object names, so that find() does not have to compare against
+    // every object. The tracer never keeps the contents themselves around, so the content is
+    // identified by its size and digest, the same as ClientSideBufferObject::operator==.
+    struct ContentKey
+    {
+        explicit ContentKey(const ClientSideBufferObject &obj) : size(obj.size), digest(obj.digest()) {}
+        bool operator==(const ContentKey &other) const { return size == other.size && digest == other.digest; }
+
+        ptrdiff_t size;
+        ContentDigest digest;
+    };
+
+    struct ContentKeyHash
+    {
+        size_t operator()(const ContentKey &key) const
+        {
+            // the digest is already well mixed
+            size_t hash;
+            memcpy(&hash, static_cast<const unsigned char*>(key.digest), sizeof(hash));
+            return hash ^ static_cast<size_t>(key.size);
+        }
+    };
+
+    typedef std::unordered_multimap<ContentKey, ClientSideBufferObjectName, ContentKeyHash> ContentIndex;
+    ContentIndex _index;
+    // key each object is indexed under, so that it can be removed after its contents changed
+    std::unordered_map<ClientSideBufferObjectName, ContentKey> _indexed;
+
+    void index_add(ClientSideBufferObjectName name)
+    {
+        const ContentKey key(*_objects.at(name));
+        _index.emplace(key, name);
+        _indexed.emplace(name, key);
+    }
+
+    void index_remove(ClientSideBufferObjectName name)
+    {
+        auto iter = _indexed.find(name);
+        if (iter == _indexed.end())
+            return;
+
+        const auto range = _index.equal_range(iter->second);
+        for (auto entry = range.first; entry != range.second; ++entry)
+        {
+            if (entry->second == name)
+            {
+                _index.erase(entry);
+                break;
+            }
+        }
+        _indexed.erase(iter);
+    }
+#endif
 };
 
 class ClientSideBufferObjectSet
@@ -498,6 +741,14 @@ public:
         _per_threads[tid].object_data(name, size, data, copy);
     }
 
+    // For thread N, make the object with the specific name refer to a memory range that
+    // outlives it, without copying
+    void object_reference(unsigned int tid, ClientSideBufferObjectName name,
+        int size, const void *data)
+    {
+        _per_threads[tid].object_reference(name, size, data);
+    }
+
     // For thread N, set the sub-data of the object with the specific name
     void object_subdata(unsigned int tid, ClientSideBufferObjectName name,
         int offset, int size, const void* data)
@@ -109,3 +109,28 @@ unsigned long MemoryInfo::getFreeMemoryRaw()
 #endif
     return free_mem;
 }
+
+unsigned long MemoryInfo::getResidentMemory()
+{
+    unsigned long rss = 0;
+#if defined(ANDROID) || defined(__linux__)
+    // Second field of statm, in pages. Cheap enough to read every frame.
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file) {
+        unsigned long size = 0;
+        if (fscanf(file, "%lu %lu", &size, &rss) != 2) {
+            rss = 0;
+        }
+        fclose(file);
+    }
+    rss *= sysconf(_SC_PAGESIZE);
+#elif __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+    {
+        rss = info.resident_size;
+    }
+#endif
+    return rss;
+}
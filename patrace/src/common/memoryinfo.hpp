@@ -7,6 +7,8 @@ class MemoryInfo
         static void reserveAndReleaseMemory(unsigned long reserve_mem);
         static unsigned long getFreeMemory();
         static unsigned long getFreeMemoryRaw();
+        /* Resident set size of this process in bytes, zero where it is not known */
+        static unsigned long getResidentMemory();
 };
 
 #endif
@@ -1,11 +1,17 @@
 #include <common/out_file.hpp>
 
+#include <algorithm>
 #include <vector>
 #include <common/os.hpp>
 #include <common/api_info.hpp>
 #include <common/pa_exception.h>
+#include <common/thread_pool.hpp>
+#include <jsoncpp/include/json/reader.h>
+#include <jsoncpp/include/json/writer.h>
 
-#include <snappy.h> // Compression
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
 
 namespace common {
 
@@ -15,8 +21,6 @@ OutFile::OutFile()
  , mCache(NULL)
  , mCacheLen(0)
  , mCacheP(NULL)
- , mCompressedCache(NULL)
- , mCompressedCacheLen(0)
  , mFileName()
 {}
 
@@ -26,8 +30,6 @@ OutFile::OutFile(const char *name)
  , mCache(NULL)
  , mCacheLen(0)
  , mCacheP(NULL)
- , mCompressedCache(NULL)
- , mCompressedCacheLen(0)
  , mFileName()
 {
     Open(name);
@@ -46,30 +48,37 @@ bool OutFile::Open(const char* name, bool writeSigBook, const std::vector<std::s
         name = autogenFileName;
     }
 
-    if (mStream)
+    if (mIsOpen)
     {
-        fclose(mStream);
-        mStream = nullptr;
+        Close();
     }
 
-    mStream = fopen(name, "wb");
-    if (!mStream) {
+    mWriter = createFileWriter(name, mWriterKind, mStreamBuffer);
+    if (!mWriter) {
         DBG_LOG("Failed to open file %s: %s\n", name, strerror(errno));
         return false;
     } else {
         DBG_LOG("Successfully open file %s\n", name);
     }
+    if (mWriter->kind() != FILE_WRITER_STDIO)
+    {
+        DBG_LOG("Writing with %s\n", fileWriterName(mWriter->kind()));
+    }
 
     mFileName = name;
     mIsOpen = true;
 
     // It will be re-written before the file is closed.
+    mHeader.jsonFileEnd = sizeof(BHeaderV3) + mHeader.jsonMaxLength + mHeaderPadding;
     filewrite((char*)&mHeader, sizeof(BHeaderV3));
-    mHeader.jsonFileBegin = ftell(mStream);
-    // reserve 512k at beginning of file for json data
-    std::vector<char> zerobuf(mHeader.jsonMaxLength);
-    filewrite(zerobuf.data(), zerobuf.size());
-    long long jsonEnd = (long long)ftell(mStream);
+    mHeader.jsonFileBegin = mWriter->size();
+    // reserve 512k at beginning of file for json data, and the padding asked for
+    std::vector<char> zerobuf(std::min<size_t>(mHeader.jsonMaxLength + mHeaderPadding, SNAPPY_CHUNK_SIZE));
+    for (size_t left = mHeader.jsonMaxLength + mHeaderPadding; left > 0; left -= std::min(left, zerobuf.size()))
+    {
+        filewrite(zerobuf.data(), std::min(left, zerobuf.size()));
+    }
+    long long jsonEnd = (long long)mWriter->size();
     if (mHeader.jsonFileEnd == jsonEnd) {
         DBG_LOG("json file end calculated correctly, endoffs: %lld\n", jsonEnd );
     } else {
@@ -77,13 +86,71 @@ bool OutFile::Open(const char* name, bool writeSigBook, const std::vector<std::s
         mHeader.jsonFileEnd = jsonEnd; // is this more robust than calculating it beforehand, assuming all bytes we have is header+jsonMaxLength?
     }
 
-    CreateCache(SNAPPY_CHUNK_SIZE);
+    if (!chunkCodecAvailable(mCodec))
+    {
+        DBG_LOG("%s compression is not supported by this build, using snappy\n", chunkCodecName(mCodec));
+        mCodec = CHUNK_CODEC_SNAPPY;
+    }
+    int threads = mCompressionThreads;
+    if (threads <= 0)
+    {
+        threads = std::min<int>(common::concurrencyBudget(), OUT_FILE_MAX_COMPRESSION_THREADS);
+    }
+    mChunks = std::vector<Chunk>(threads + 2);
+    mFreeChunks.clear();
+    mQueuedChunks.clear();
+    for (size_t i = 1; i < mChunks.size(); i++)
+    {
+        mFreeChunks.push_back(&mChunks[i]);
+    }
+    mCurrent = &mChunks[0];
+    mCacheLen = 0;
+    CreateCache(mChunkSize);
+
+    mDictionaryId = 0;
+    mSamples.clear();
+    if ((!mDictionary.empty() || mTrainingBytes > 0) && mCodec != CHUNK_CODEC_ZSTD)
+    {
+        DBG_LOG("Chunk dictionaries need zstd compression, not using one\n");
+        mDictionary.clear();
+        mTrainingBytes = 0;
+    }
+    if (!mDictionary.empty())
+    {
+        mDictionaryId = chunkRegisterDictionary(mDictionary);
+        if (mDictionaryId == 0)
+        {
+            DBG_LOG("Invalid chunk dictionary, not using it\n");
+            mDictionary.clear();
+        }
+        mTrainingBytes = 0;
+    }
+    mStopWorkers = false;
+    mWriting = false;
+    mCallLengths.clear();
+    mStreamPos = 0;
+    mFilePos = mHeader.jsonFileEnd;
+    mInTrailer = false;
+    mFramesBegin = 0;
+    mIndexChunks.clear();
+    mIndexChecksums.clear();
+    mFrameMarks.clear();
+    mTableCallCount = 0;
+    mTableTid = 0;
+    mTableChunks = 0;
+    mTableFrameMarks = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        mWorkers.push_back(std::thread(&OutFile::CompressionThread, this));
+    }
+
     if (writeSigBook)
     {
         if (sigbook)
             WriteSigBook(sigbook);
         else
             WriteSigBook(NULL);
+        mFramesBegin = StreamPos();
     }
 
     return true;
@@ -95,43 +162,375 @@ void OutFile::Close()
         return;
 
     Flush();
-    fseek(mStream, 0, SEEK_SET);
-    filewrite((char*)&mHeader, sizeof(BHeaderV3));
+    if (mTrainer.joinable())
+    {
+        mTrainer.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mQueueMutex);
+        mStopWorkers = true;
+    }
+    mQueueCond.notify_all();
+    for (std::thread& worker : mWorkers)
+    {
+        worker.join();
+    }
+    mWorkers.clear();
+
+    if ((!mFrameMarks.empty() || mChecksums) && (mIndexChunks.size() != mTableChunks || mFrameMarks.size() != mTableFrameMarks))
+    {
+        WriteFrameTable(true);
+    }
+
+    filewriteAt(0, (char*)&mHeader, sizeof(BHeaderV3));
 
     mIsOpen = false;
-    fclose(mStream);
+    if (!mWriter->close())
+    {
+        DBG_LOG("Failed to write: %s\n", strerror(mWriter->error()));
+        os::abort();
+    }
+    mWriter.reset();
     DBG_LOG("Close trace file %s\n", mFileName.c_str());
 
-    delete [] mCache;
+    mChunks.clear();
+    mFreeChunks.clear();
+    mCurrent = NULL;
     mCache = NULL;
     mCacheLen = 0;
     mCacheP = NULL;
-    delete [] mCompressedCache;
-    mCompressedCache = NULL;
-    mCompressedCacheLen = 0;
 }
 
 void OutFile::Flush()
+{
+    SubmitCache();
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+    mDoneCond.wait(lock, [this]{ return mQueuedChunks.empty(); });
+    lock.unlock();
+    if (mIsOpen)
+    {
+        fileflush();
+    }
+}
+
+void OutFile::fileflush()
+{
+    if (!mWriter->flush())
+    {
+        DBG_LOG("Failed to write: %s\n", strerror(mWriter->error()));
+        os::abort();
+    }
+}
+
+void OutFile::WriteRawChunk(const char* chunk, size_t size)
+{
+    if (!mIsOpen)
+        return;
+
+    // the workers are idle once everything before it is in the file
+    Flush();
+    size_t uncompressedLength = 0;
+    if (size > 4)
+    {
+        chunkUncompressedLength(chunkPrefixCodec(*(const uint32_t*)chunk), chunk + 4, size - 4, &uncompressedLength);
+    }
+    mIndexChunks.push_back({ mFilePos, mStreamPos });
+    if (mChecksums)
+    {
+        mIndexChecksums.push_back(chunkChecksum(chunk, size));
+    }
+    filewrite(chunk, size);
+    mFilePos += size;
+    mStreamPos += uncompressedLength;
+}
+
+uint64_t OutFile::WriteSection(const void* data, size_t size)
+{
+    if (!mIsOpen)
+        return 0;
+
+    Flush();
+    if (!mInTrailer)
+    {
+        WriteCompressedLength(CHUNK_TRAILER_PREFIX);
+        mFilePos += 4;
+        mInTrailer = true;
+    }
+    const uint64_t offset = mFilePos;
+    filewrite((const char*)data, size);
+    mFilePos += size;
+    fileflush();
+    return offset;
+}
+
+void OutFile::SubmitCache()
 {
     unsigned int len = UsedSize();
     if (len == 0)
         return;
 
-    size_t compressedLen;
-    ::snappy::RawCompress(mCache, len, mCompressedCache, &compressedLen);
-    WriteCompressedLength((unsigned int)compressedLen);
-    filewrite(mCompressedCache, compressedLen);
-    fflush(mStream);
-    mCacheP = mCache;
+    mCurrent->data.resize(len);
+    mCurrent->streamPos = mStreamPos;
+    mStreamPos += len;
+    if (mTrainingBytes > 0 && !mTrainer.joinable())
+    {
+        const size_t take = std::min<size_t>(len, mTrainingBytes - mSamples.size());
+        mSamples.insert(mSamples.end(), mCache, mCache + take);
+        if (mSamples.size() >= mTrainingBytes)
+        {
+            mTrainer = std::thread(&OutFile::TrainDictionary, this);
+        }
+    }
+    mCurrent->claimed = false;
+    mCurrent->ready = false;
+    {
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        mQueuedChunks.push_back(mCurrent);
+        mQueueCond.notify_one();
+        mDoneCond.wait(lock, [this]{ return !mFreeChunks.empty(); });
+        mCurrent = mFreeChunks.back();
+        mFreeChunks.pop_back();
+    }
+    mCacheLen = 0;
+    CreateCache(mChunkSize);
+}
+
+void OutFile::TrainDictionary()
+{
+    // many small samples, like the calls they are made of
+    const size_t sampleSize = 4096;
+    std::string dictionary;
+    if (!chunkTrainDictionary(mSamples.data(), sampleSize, mSamples.size() / sampleSize, dictionary))
+    {
+        return;
+    }
+    const unsigned id = chunkRegisterDictionary(dictionary);
+    DBG_LOG("Trained a chunk dictionary of %u bytes from %u bytes of calls\n", (unsigned)dictionary.size(), (unsigned)mSamples.size());
+    std::lock_guard<std::mutex> lock(mQueueMutex);
+    mDictionary.swap(dictionary);
+    mDictionaryId = id;
+    std::vector<char>().swap(mSamples);
+}
+
+std::string OutFile::getDictionary()
+{
+    std::lock_guard<std::mutex> lock(mQueueMutex);
+    return mDictionary;
+}
+
+void OutFile::CompressionThread()
+{
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+    while (true)
+    {
+        Chunk* chunk = nullptr;
+        mQueueCond.wait(lock, [this, &chunk]{
+            for (Chunk* c : mQueuedChunks)
+            {
+                if (!c->claimed)
+                {
+                    chunk = c;
+                    return true;
+                }
+            }
+            return mStopWorkers;
+        });
+        if (!chunk)
+            return;
+
+        chunk->claimed = true;
+        const unsigned dictionaryId = mDictionaryId;
+        lock.unlock();
+        for (const Chunk::Blob& blob : chunk->blobs)
+        {
+            encodeBlob(chunk->data.data() + blob.offset, blob.codec, chunk->compressed);
+        }
+        chunk->blobs.clear();
+        chunk->compressedLength = 0;
+        if (!mCallLengths.empty())
+        {
+            chunk->compressed.resize(chunkMaxColumnarLength(mCodec, chunk->data.size()));
+            chunk->compressedLength = chunkCompressColumnar(mCodec, chunk->data.data(), chunk->data.size(),
+                                                            mCallLengths.data(), mCallLengths.size() - 1, chunk->compressed.data());
+            chunk->codec = CHUNK_CODEC_COLUMNAR;
+        }
+        if (chunk->compressedLength == 0)
+        {
+            chunk->compressed.resize(chunkMaxCompressedLength(mCodec, chunk->data.size()));
+            chunk->compressedLength = chunkCompress(mCodec, chunk->data.data(), chunk->data.size(), chunk->compressed.data(), dictionaryId);
+            chunk->codec = mCodec;
+        }
+        if (chunk->compressedLength == 0)
+        {
+            // the codec is stored with each chunk, so this one can be snappy
+            chunk->compressed.resize(chunkMaxCompressedLength(CHUNK_CODEC_SNAPPY, chunk->data.size()));
+            chunk->compressedLength = chunkCompress(CHUNK_CODEC_SNAPPY, chunk->data.data(), chunk->data.size(), chunk->compressed.data());
+            chunk->codec = CHUNK_CODEC_SNAPPY;
+        }
+        if (mChecksums)
+        {
+            const uint32_t prefix = chunkPrefix(chunk->codec, chunk->compressedLength);
+            chunk->checksum = chunkChecksum(chunk->compressed.data(), chunk->compressedLength, chunkChecksum((const char*)&prefix, sizeof(prefix)));
+        }
+        lock.lock();
+        chunk->ready = true;
+
+        // Chunks must reach the file in the order they were queued. Whoever finds the front of
+        // the queue compressed writes it, along with any compressed chunks right behind it.
+        while (!mWriting && !mQueuedChunks.empty() && mQueuedChunks.front()->ready)
+        {
+            Chunk* front = mQueuedChunks.front();
+            mWriting = true;
+            lock.unlock();
+            WriteChunk(*front);
+            if (front->data.size() > std::max<size_t>(mChunkSize, SNAPPY_CHUNK_SIZE))
+            {
+                // grown for a single large call, don't keep that much memory around
+                front->data.release();
+                front->compressed.release();
+            }
+            lock.lock();
+            mWriting = false;
+            mQueuedChunks.pop_front();
+            mFreeChunks.push_back(front);
+            mDoneCond.notify_all();
+        }
+    }
+}
+
+void OutFile::WriteChunk(const Chunk& chunk)
+{
+    if (chunk.compressedLength >= CHUNK_LENGTH_MASK)
+    {
+        DBG_LOG("Compressed chunk of %u bytes is too large for the trace format!\n", (unsigned)chunk.compressedLength);
+        os::abort();
+    }
+    mIndexChunks.push_back({ mFilePos, chunk.streamPos });
+    if (mChecksums)
+    {
+        mIndexChecksums.push_back(chunk.checksum);
+    }
+    WriteCompressedLength(chunkPrefix(chunk.codec, chunk.compressedLength));
+    filewrite(chunk.compressed.data(), chunk.compressedLength);
+    // hand it to the file now, without waiting for it
+    if (!mWriter->commit())
+    {
+        DBG_LOG("Failed to write: %s\n", strerror(mWriter->error()));
+        os::abort();
+    }
+    mFilePos += 4 + chunk.compressedLength;
+}
+
+void OutFile::WriteFrameTable(bool closing)
+{
+    // frames end at the swaps of the thread that is replayed, like when readers count them
+    TraceIndex index;
+    index.mChunks = mIndexChunks;
+    index.mChecksums = mIndexChecksums;
+    uint64_t begin = mFramesBegin;
+    unsigned firstCall = 0;
+    for (const FrameMark& mark : mFrameMarks)
+    {
+        if (mark.tid == mTableTid)
+        {
+            index.mFrames.push_back({ begin, mark.streamPos - begin, firstCall, mark.callCount - firstCall });
+            begin = mark.streamPos;
+            firstCall = mark.callCount;
+        }
+    }
+    if (mTableCallCount > firstCall && mStreamPos > begin)
+    {
+        index.mFrames.push_back({ begin, mStreamPos - begin, firstCall, mTableCallCount - firstCall });
+    }
+    std::vector<char> table;
+    index.writeTable(table);
+
+    BFrameTableFooter footer;
+    footer.size = table.size();
+    footer.hash = HeaderSummaryHash(table.data(), table.size());
+    footer.magic = FRAME_TABLE_MAGIC;
+    footer.reserved = 0;
+    const long long footerPos = mHeader.jsonFileEnd - sizeof(BHeaderSummary) - sizeof(footer);
+    if (mHeader.jsonFileBegin + mHeader.jsonLength + (long long)table.size() <= footerPos)
+    {
+        filewriteAt(footerPos - table.size(), table.data(), table.size());
+        filewriteAt(footerPos, (char*)&footer, sizeof(footer));
+    }
+    else
+    {
+        // drop the one written before, which the json may have grown into
+        BFrameTableFooter none;
+        memset(&none, 0, sizeof(none));
+        filewriteAt(footerPos, (char*)&none, sizeof(none));
+        if (!closing)
+        {
+            fileflush();
+            mTableChunks = SIZE_MAX; // no table in the file now, append one when closing
+            return;
+        }
+        WriteCompressedLength(CHUNK_TRAILER_PREFIX);
+        filewrite(table.data(), table.size());
+        filewrite((char*)&footer, sizeof(footer));
+        DBG_LOG("Frame table of %u frames does not fit in the header, appended it to the trace\n", (unsigned)index.mFrames.size());
+    }
+    fileflush();
+    mTableChunks = mIndexChunks.size();
+    mTableFrameMarks = mFrameMarks.size();
 }
 
 void OutFile::FlushHeader()
 {
-    long curP = ftell(mStream);
-    fseek(mStream, 0, SEEK_SET);
-    filewrite((char*)&mHeader, sizeof(BHeaderV3));
-    fseek(mStream, curP, SEEK_SET);
-    fflush(mStream);
+    filewriteAt(0, (char*)&mHeader, sizeof(BHeaderV3));
+    fileflush();
+}
+
+// Fill in the header summary, if the json has everything it needs
+static bool MakeHeaderSummary(const char* buf, unsigned int len, BHeaderSummary& summary)
+{
+    Json::Value json;
+    Json::Reader reader;
+    if (!reader.parse(buf, buf + len, json) || !json.isObject() || !json.isMember("defaultTid") || !json.isMember("glesVersion")
+        || !json.isMember("frameCnt") || !json.isMember("callCnt") || !json["threads"].isArray() || json["threads"].size() > MAX_RETRACE_THREADS)
+    {
+        return false;
+    }
+
+    memset(&summary, 0, sizeof(summary));
+    summary.magic = HEADER_SUMMARY_MAGIC;
+    summary.size = sizeof(summary);
+    summary.jsonLength = len;
+    summary.jsonHash = HeaderSummaryHash(buf, len);
+    summary.defaultTid = json["defaultTid"].asInt();
+    summary.glesVersion = json["glesVersion"].asInt();
+    summary.frameCnt = json["frameCnt"].asUInt();
+    summary.callCnt = json["callCnt"].asUInt64();
+    if (json.isMember("multiThread"))
+        summary.flags |= BHeaderSummary::HAS_MULTI_THREAD | (json["multiThread"].asBool() ? BHeaderSummary::MULTI_THREAD : 0);
+    if (json.isMember("forceSingleWindow"))
+        summary.flags |= BHeaderSummary::HAS_FORCE_SINGLE_WINDOW | (json["forceSingleWindow"].asBool() ? BHeaderSummary::FORCE_SINGLE_WINDOW : 0);
+    if (json.isMember("singleSurface"))
+    {
+        summary.flags |= BHeaderSummary::HAS_SINGLE_SURFACE;
+        summary.singleSurface = json["singleSurface"].asInt();
+    }
+    for (const Json::Value& thread : json["threads"])
+    {
+        BHeaderSummaryThread& t = summary.threads[summary.threadCnt++];
+        const Json::Value& config = thread["EGLConfig"];
+        t.id = thread["id"].asInt();
+        t.winW = thread["winW"].asUInt();
+        t.winH = thread["winH"].asUInt();
+        t.clientSideBufferSize = thread["clientSideBufferSize"].asInt();
+        t.red = config["red"].asInt();
+        t.green = config["green"].asInt();
+        t.blue = config["blue"].asInt();
+        t.alpha = config["alpha"].asInt();
+        t.depth = config["depth"].asInt();
+        t.stencil = config["stencil"].asInt();
+        t.msaaSamples = config["msaaSamples"].asInt();
+    }
+    strncpy(summary.tracer, json["tracer"].asString().c_str(), sizeof(summary.tracer) - 1);
+    return true;
 }
 
 void OutFile::WriteHeader(const char* buf, unsigned int len, bool verbose)
@@ -143,19 +542,26 @@ void OutFile::WriteHeader(const char* buf, unsigned int len, bool verbose)
 
     // write variable length header to beginning of file, then seek back to previous file put position
     Flush(); // flush last compressed part
-    if ( len > mHeader.jsonMaxLength ) {
-        DBG_LOG("Error: json file too long for header, %d > %d\n", len, mHeader.jsonMaxLength);
+    const long long reserved = mHeader.jsonFileEnd - mHeader.jsonFileBegin;
+    if ( len > reserved ) {
+        DBG_LOG("Error: json file too long for header, %d > %lld\n", len, reserved);
         os::abort();
     } else {
-        long oldP = ftell(mStream);
-        fseek(mStream, mHeader.jsonFileBegin, SEEK_SET);
-        filewrite(buf, len);
+        filewriteAt(mHeader.jsonFileBegin, buf, len);
         mHeader.jsonLength = len;
+        BHeaderSummary summary;
+        if (len + sizeof(summary) <= (unsigned long long)reserved && MakeHeaderSummary(buf, len, summary))
+        {
+            filewriteAt(mHeader.jsonFileEnd - sizeof(summary), (char*)&summary, sizeof(summary));
+        }
         if (verbose)
         {
             DBG_LOG("wrote json header, length=%d\n", mHeader.jsonLength);
         }
-        fseek(mStream, oldP, SEEK_SET);
+        if (!mFrameMarks.empty() || mChecksums)
+        {
+            WriteFrameTable(false);
+        }
 
         FlushHeader();
     }
@@ -166,14 +572,11 @@ void OutFile::CreateCache(int len)
     if (len <= mCacheLen)
         return;
 
-    delete [] mCache;
-    delete [] mCompressedCache;
-
+    // only called while the cache is empty, so nothing needs to be kept
+    mCurrent->data.resize(len);
     mCacheLen = len;
-    mCompressedCacheLen = snappy::MaxCompressedLength(mCacheLen);
-    mCache = new char[mCacheLen];
+    mCache = mCurrent->data.data();
     mCacheP = mCache;
-    mCompressedCache = new char[mCompressedCacheLen];
 }
 
 void OutFile::WriteSigBook(const std::vector<std::string> *sigbook)
@@ -207,6 +610,24 @@ void OutFile::WriteSigBook(const std::vector<std::string> *sigbook)
     Write(buf, dest-buf);
 
     delete [] buf;
+
+    if (mColumnar)
+    {
+        // the signature book goes in a plain chunk of its own, the chunks after it only hold calls
+        Flush();
+        std::vector<int> callLengths(1, 0);
+        if (sigbook)
+        {
+            for (unsigned short id = 1; id <= sigbook->size() - 1; ++id)
+                callLengths.push_back(gApiInfo.NameToLen(sigbook->at(id).c_str()));
+        }
+        else
+        {
+            for (unsigned short id = 1; id <= ApiInfo::MaxSigId; ++id)
+                callLengths.push_back(ApiInfo::IdToLenArr[id]);
+        }
+        mCallLengths.swap(callLengths); // the workers are idle
+    }
 }
 
 os::String OutFile::AutogenTraceFileName()
@@ -245,4 +666,183 @@ std::string OutFile::getFileName() const
     return mFileName;
 }
 
+// Header patching
+
+static bool readAt(int fd, void* buf, size_t len, off_t offset)
+{
+    return pread(fd, buf, len, offset) == (ssize_t)len;
+}
+
+static bool writeAt(int fd, const void* buf, size_t len, off_t offset)
+{
+    const char* p = (const char*)buf;
+    while (len > 0)
+    {
+        const ssize_t written = pwrite(fd, p, len, offset);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        p += written;
+        offset += written;
+        len -= written;
+    }
+    return true;
+}
+
+// Room for the json in the space reserved for the header: up to the frame table kept there, if
+// there is one, or else up to the header summary
+static long long JsonHeaderRoom(int fd, const BHeaderV3& hdr)
+{
+    long long end = hdr.jsonFileEnd - sizeof(BHeaderSummary);
+    BFrameTableFooter footer;
+    if (end - (long long)sizeof(footer) >= hdr.jsonFileBegin && readAt(fd, &footer, sizeof(footer), end - sizeof(footer))
+        && footer.magic == FRAME_TABLE_MAGIC && footer.size <= (unsigned long long)(end - sizeof(footer) - hdr.jsonFileBegin))
+    {
+        end -= sizeof(footer) + footer.size;
+    }
+    return end - hdr.jsonFileBegin;
+}
+
+// Write the trace again with more room for the header, to a file next to it that then replaces it
+static bool RewriteWithHeader(int fd, const std::string& fileName, BHeaderV3 hdr, const std::string& json, size_t padding)
+{
+    Json::Value value;
+    Json::Reader reader;
+    if (!reader.parse(json, value) || !value.isObject())
+    {
+        DBG_LOG("Failed to parse the new json header\n");
+        return false;
+    }
+    TraceIndex index;
+    const bool hasTable = index.loadFromTrace(fileName);
+    std::vector<char> table;
+    index.writeTable(table); // only its size for now, which does not depend on the offsets
+
+    // with slack for the section offsets below getting longer
+    const long long oldEnd = hdr.jsonFileEnd;
+    long long reserved = json.size() + 1024 + (hasTable ? table.size() + sizeof(BFrameTableFooter) : 0) + sizeof(BHeaderSummary) + padding;
+    reserved = std::max(reserved, oldEnd - hdr.jsonFileBegin);
+    reserved = (reserved + 4095) & ~4095ll;
+    hdr.jsonFileEnd = hdr.jsonFileBegin + reserved;
+    const long long delta = hdr.jsonFileEnd - oldEnd;
+
+    // sections written after the chunks move with them
+    std::string newJson = json;
+    bool moved = false;
+    for (const std::string& member : value.getMemberNames())
+    {
+        Json::Value& section = value[member];
+        if (section.isObject() && section.isMember("offset") && section.isMember("size") && section["offset"].asInt64() >= oldEnd)
+        {
+            section["offset"] = (Json::UInt64)(section["offset"].asUInt64() + delta);
+            moved = true;
+        }
+    }
+    if (moved)
+    {
+        Json::FastWriter writer;
+        newJson = writer.write(value);
+    }
+    hdr.jsonLength = newJson.size();
+
+    std::vector<char> area(hdr.jsonFileEnd, 0);
+    memcpy(area.data(), &hdr, sizeof(hdr));
+    memcpy(area.data() + hdr.jsonFileBegin, newJson.data(), newJson.size());
+    BHeaderSummary summary;
+    if (MakeHeaderSummary(newJson.data(), newJson.size(), summary))
+    {
+        memcpy(area.data() + hdr.jsonFileEnd - sizeof(summary), &summary, sizeof(summary));
+    }
+    if (hasTable)
+    {
+        for (TraceIndex::Chunk& chunk : index.mChunks)
+        {
+            chunk.filePos += delta;
+        }
+        index.writeTable(table);
+        BFrameTableFooter footer;
+        footer.size = table.size();
+        footer.hash = HeaderSummaryHash(table.data(), table.size());
+        footer.magic = FRAME_TABLE_MAGIC;
+        footer.reserved = 0;
+        const long long footerPos = hdr.jsonFileEnd - sizeof(BHeaderSummary) - sizeof(footer);
+        memcpy(area.data() + footerPos - table.size(), table.data(), table.size());
+        memcpy(area.data() + footerPos, &footer, sizeof(footer));
+    }
+
+    const std::string tempName = fileName + ".header";
+    const int out = open(tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        DBG_LOG("Failed to create %s: %s\n", tempName.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = writeAt(out, area.data(), area.size(), 0);
+    std::vector<char> buf(16 * 1024 * 1024);
+    off_t from = oldEnd, to = hdr.jsonFileEnd;
+    while (ok)
+    {
+        const ssize_t got = pread(fd, buf.data(), buf.size(), from);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0)
+        {
+            ok = got == 0;
+            break;
+        }
+        ok = writeAt(out, buf.data(), got, to);
+        from += got;
+        to += got;
+    }
+    ok = close(out) == 0 && ok;
+    if (!ok || rename(tempName.c_str(), fileName.c_str()) != 0)
+    {
+        DBG_LOG("Failed to rewrite %s: %s\n", fileName.c_str(), strerror(errno));
+        remove(tempName.c_str());
+        return false;
+    }
+    DBG_LOG("Rewrote %s with %lld bytes reserved for the json header\n", fileName.c_str(), reserved);
+    return true;
+}
+
+bool PatchJsonHeader(const std::string& fileName, const std::string& json, size_t padding)
+{
+    const int fd = open(fileName.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        DBG_LOG("Failed to open %s: %s\n", fileName.c_str(), strerror(errno));
+        return false;
+    }
+    BHeaderV3 hdr;
+    if (!readAt(fd, &hdr, sizeof(hdr), 0) || hdr.magicNo != 0x20122012 || (hdr.version != HEADER_VERSION_3 && hdr.version != HEADER_VERSION_4)
+        || hdr.jsonFileEnd < hdr.jsonFileBegin)
+    {
+        DBG_LOG("%s is not a trace with a json header\n", fileName.c_str());
+        close(fd);
+        return false;
+    }
+
+    bool ok;
+    if ((long long)json.size() <= JsonHeaderRoom(fd, hdr))
+    {
+        // an old summary left behind no longer matches the json, so readers ignore it
+        hdr.jsonLength = json.size();
+        BHeaderSummary summary;
+        ok = writeAt(fd, json.data(), json.size(), hdr.jsonFileBegin);
+        if (ok && MakeHeaderSummary(json.data(), json.size(), summary))
+        {
+            ok = writeAt(fd, &summary, sizeof(summary), hdr.jsonFileEnd - sizeof(summary));
+        }
+        ok = ok && writeAt(fd, &hdr, sizeof(hdr), 0);
+        if (ok)
+        {
+            DBG_LOG("Wrote the json header of %s in place\n", fileName.c_str());
+        }
+    }
+    else
+    {
+        ok = RewriteWithHeader(fd, fileName, hdr, json, padding);
+    }
+    close(fd);
+    return ok;
+}
+
 }
@@ -3,15 +3,32 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <common/file_format.hpp>
+#include <common/blob_store.hpp>
+#include <common/chunk_codec.hpp>
+#include <common/file_writer.hpp>
 #include <common/os_string.hpp>
+#include <common/trace_index.hpp>
 
 namespace common {
 
 #define SNAPPY_CHUNK_SIZE (1*1024*1024)
+/// Upper limit for the default number of compression threads
+#define OUT_FILE_MAX_COMPRESSION_THREADS 16
+/// Room reserved for the json header beyond what it needs when PatchJsonHeader() has to rewrite a trace
+#define HEADER_PATCH_PADDING (256 * 1024)
 
+/// Chunked, compressed trace output. Full chunks are compressed in parallel by a pool of
+/// threads and written to the file in order, so Write() only blocks when every chunk buffer
+/// is still waiting to be written. The class itself is not thread safe; use it from one
+/// thread at a time.
 class OutFile {
 public:
     OutFile();
@@ -20,8 +37,11 @@ public:
 
     bool Open(const char* name = NULL, bool writeSigBook = true, const std::vector<std::string> *sigbook = NULL);
     void Close();
+    /// Write out everything written so far and wait until it has reached the file
     void Flush();
     void WriteHeader(const char* buf, unsigned int len, bool verbose = true);
+    /// Bytes reserved for the json header once the file is open, WriteHeader() aborts on more
+    size_t HeaderSpace() const { return mHeader.jsonFileEnd - mHeader.jsonFileBegin; }
 
     inline void Write(const void* buf, unsigned int len) {
         if (len == 0 || !mIsOpen)
@@ -33,9 +53,9 @@ public:
         } else if (FreeSize() == len) {
             memcpy(mCacheP, buf, len);
             mCacheP += len;
-            Flush();
+            SubmitCache();
         } else {
-            Flush();
+            SubmitCache();
             if (mCacheLen < int(len))
                 CreateCache(len);
             memcpy(mCacheP, buf, len);
@@ -43,12 +63,136 @@ public:
         }
     }
 
+    /// Make sure the next len bytes end up in the same chunk, when they are written with
+    /// several calls to Write()
+    inline void Reserve(unsigned int len) {
+        if (!mIsOpen || FreeSize() >= len)
+            return;
+
+        SubmitCache();
+        if (mCacheLen < int(len))
+            CreateCache(len);
+    }
+
+    /// Room for len bytes in the current chunk, to be filled in place and then handed back
+    /// with Commit(), instead of building them in a buffer of their own and copying them with
+    /// Write(). Returns NULL if the file is not open.
+    inline char* Claim(unsigned int len) {
+        if (!mIsOpen)
+            return NULL;
+
+        Reserve(len);
+        return mCacheP;
+    }
+
+    /// End of what was written since Claim()
+    inline void Commit(char* end) {
+        mCacheP = end;
+        if (FreeSize() == 0)
+            SubmitCache();
+    }
+
+    /// The next len bytes written are a blob behind a BLOB_ENCODED header with codec 0, for the
+    /// compression threads to encode with codec, see encodeBlob(). Reserve() them together with
+    /// the header, which must have been written right before.
+    inline void EncodeNext(unsigned int len, BlobCodec codec) {
+        if (mIsOpen && FreeSize() >= len)
+            mCurrent->blobs.push_back({ UsedSize() - (unsigned)BLOB_ENCODED_HEADER_SIZE, codec });
+    }
+
+    /// Write a chunk as it is stored in another trace, length prefix included, after what has
+    /// been written so far. Its calls keep the function ids of that trace, so the file must
+    /// have been opened with the signature book of that trace.
+    void WriteRawChunk(const char* chunk, size_t size);
+
+    /// The calls written so far end a frame of thread tid, and callCount calls have been written.
+    /// Frames are kept in a frame table written with the header, see BFrameTableFooter.
+    void MarkFrame(unsigned tid, unsigned callCount) {
+        mFrameMarks.push_back({ StreamPos(), callCount, tid });
+    }
+    /// As MarkFrame(), for a frame that ended at streamPos in the call stream, like within a
+    /// chunk written with WriteRawChunk()
+    void MarkFrameAt(unsigned tid, unsigned callCount, uint64_t streamPos) {
+        mFrameMarks.push_back({ streamPos, callCount, tid });
+    }
+    /// Position in the call stream of the next byte written
+    uint64_t GetStreamPos() const { return StreamPos(); }
+    /// The number of calls written so far, and the thread whose frames go in the frame table,
+    /// for the frame table written by the next WriteHeader() or Close()
+    void SetFrameTableInfo(unsigned callCount, unsigned tid) {
+        mTableCallCount = callCount;
+        mTableTid = tid;
+    }
+
+    /// Append a section that is not calls after the last chunk, such as embedded program
+    /// binaries, and return its file offset, to be named in the JSON header. Chunk readers
+    /// stop at the CHUNK_TRAILER_PREFIX in front of the first section, so no calls may be
+    /// written after it.
+    uint64_t WriteSection(const void* data, size_t size);
+
     std::string getFileName() const;
 
+    /// Compression for the chunks written from now on. Call before Open().
+    void setCodec(ChunkCodec codec) { mCodec = codec; }
+    ChunkCodec getCodec() const { return mCodec; }
+    /// Write chunks of calls as columnar chunks, with the codec above for each stream. Only
+    /// takes effect when the signature book is written by Open(). Call before Open().
+    void setColumnar(bool columnar) { mColumnar = columnar; }
+    bool getColumnar() const { return mColumnar; }
+    /// Number of threads compressing chunks, 0 for one per core. Call before Open().
+    void setCompressionThreads(int threads) { mCompressionThreads = threads; }
+    /// Bytes of calls per chunk, smaller for less latency when the trace is streamed. Call before Open().
+    void setChunkSize(unsigned size) { mChunkSize = size > 0 ? size : SNAPPY_CHUNK_SIZE; }
+    /// Compress zstd chunks with this dictionary, see chunkRegisterDictionary(). Call before Open().
+    void setDictionary(const std::string& dictionary) { mDictionary = dictionary; }
+    /// Train a zstd dictionary from the first sampleBytes of the trace on a thread of its own,
+    /// and compress the chunks after it with the dictionary. Call before Open().
+    void setDictionaryTraining(size_t sampleBytes) { mTrainingBytes = sampleBytes; }
+    /// The dictionary in use, to be stored in the trace header, or empty if none is
+    std::string getDictionary();
+    /// Store a CRC32C of every chunk in the frame table, see TraceIndex::verifyChunks(). Call before Open().
+    void setChecksums(bool checksums) { mChecksums = checksums; }
+    bool getChecksums() const { return mChecksums; }
+    /// How the file is written, see FileWriterKind. Defaults to defaultFileWriterKind(). Call before Open().
+    void setWriter(FileWriterKind kind) { mWriterKind = kind; }
+    FileWriterKind getWriter() const { return mWriterKind; }
+    /// Bytes queued in memory when the file is streamed to a tcp:// name, see FILE_WRITER_SOCKET.
+    /// Call before Open().
+    void setStreamBuffer(size_t bytes) { mStreamBuffer = bytes; }
+    /// Reserve this many bytes for the json header on top of BHeaderV3::jsonMaxLength, so that
+    /// tools can grow the header in place later, see PatchJsonHeader(). Call before Open().
+    void setHeaderPadding(size_t bytes) { mHeaderPadding = bytes; }
+
     common::BHeaderV3   mHeader;
 
 private:
+    struct Chunk
+    {
+        ChunkBuffer data;
+        ChunkBuffer compressed;
+        size_t compressedLength = 0;
+        ChunkCodec codec = CHUNK_CODEC_SNAPPY;
+        uint64_t streamPos = 0; ///< of its first byte in the call stream
+        uint32_t checksum = 0;
+        bool claimed = false; ///< a worker is compressing it
+        bool ready = false; ///< compressed and waiting to be written
+        struct Blob
+        {
+            size_t offset; ///< of its BLOB_ENCODED header
+            BlobCodec codec;
+        };
+        std::vector<Blob> blobs; ///< to be encoded before it is compressed
+    };
+
     void CreateCache(int len);
+    /// Queue the filled cache for compression and continue in a free chunk buffer
+    void SubmitCache();
+    void CompressionThread();
+    void TrainDictionary();
+    void WriteChunk(const Chunk& chunk);
+    /// Write the frame table in front of the header summary, or at the end of the file if it does
+    /// not fit there and the file is about to be closed
+    void WriteFrameTable(bool closing);
 
     inline unsigned int UsedSize() const {
         return mCacheP - mCache;
@@ -58,23 +202,32 @@ private:
         return mCacheLen - UsedSize();
     }
 
+    /// Position in the call stream of the next byte written
+    inline uint64_t StreamPos() const {
+        return mStreamPos + UsedSize();
+    }
+
     inline void filewrite(const char* ptr, size_t size)
     {
-        size_t written = 0;
-        int err = 0;
-        do {
-            written = fwrite(ptr, 1, size, mStream);
-            ptr += written;
-            size -= written;
-            err = ferror(mStream);
-        } while (size > 0 && (err == EAGAIN || err == EWOULDBLOCK || err == EINTR));
-        if (err)
+        if (!mWriter->append(ptr, size))
         {
-            DBG_LOG("Failed to write: %s\n", strerror(err));
+            DBG_LOG("Failed to write: %s\n", strerror(mWriter->error()));
             os::abort();
         }
     }
 
+    /// Overwrite what was written at offset before
+    inline void filewriteAt(uint64_t offset, const char* ptr, size_t size)
+    {
+        if (!mWriter->writeAt(offset, ptr, size))
+        {
+            DBG_LOG("Failed to write: %s\n", strerror(mWriter->error()));
+            os::abort();
+        }
+    }
+
+    void fileflush();
+
     void WriteCompressedLength(unsigned int len) {
         unsigned char buf[4];
         buf[0] = len & 0xff; len >>= 8;
@@ -91,17 +244,70 @@ private:
     os::String AutogenTraceFileName();
 
     bool                mIsOpen;
-    FILE*               mStream = nullptr;
+    std::unique_ptr<FileWriter> mWriter;
+    FileWriterKind      mWriterKind = defaultFileWriterKind();
+    size_t              mStreamBuffer = SOCKET_WRITER_BUFFER;
 
+    // The chunk currently filled by Write()
+    Chunk*              mCurrent = nullptr;
     char*               mCache;
     int                 mCacheLen;
     char*               mCacheP;
-    char*               mCompressedCache;
-    int                 mCompressedCacheLen;
+
+    // One chunk per worker, plus the one being filled and one more so that Write() can
+    // continue while the workers are busy.
+    std::vector<Chunk>  mChunks;
+    std::vector<Chunk*> mFreeChunks;
+    std::deque<Chunk*>  mQueuedChunks; ///< in file order
+    std::mutex          mQueueMutex;
+    std::condition_variable mQueueCond; ///< signals the workers
+    std::condition_variable mDoneCond; ///< signals that a chunk was written
+    bool                mStopWorkers = false;
+    bool                mWriting = false; ///< a worker is writing the front of the queue
+    std::vector<std::thread> mWorkers;
+    int                 mCompressionThreads = 0;
 
     std::string         mFileName;
+    ChunkCodec          mCodec = CHUNK_CODEC_SNAPPY;
+    bool                mColumnar = false;
+    std::vector<int>    mCallLengths; ///< by function id, for columnar chunks
+    unsigned            mChunkSize = SNAPPY_CHUNK_SIZE;
+    size_t              mHeaderPadding = 0;
+
+    // Dictionary of zstd chunks, set by the training thread under mQueueMutex
+    std::string         mDictionary;
+    unsigned            mDictionaryId = 0;
+    size_t              mTrainingBytes = 0;
+    std::vector<char>   mSamples;
+    std::thread         mTrainer;
+
+    // Frame table. The chunks are added by whoever writes them to the file.
+    struct FrameMark
+    {
+        uint64_t streamPos; ///< end of the frame
+        unsigned callCount;
+        unsigned tid;
+    };
+    uint64_t            mStreamPos = 0; ///< of the start of the cache
+    uint64_t            mFilePos = 0; ///< where the next chunk goes
+    bool                mInTrailer = false; ///< sections were written after the chunks
+    uint64_t            mFramesBegin = 0; ///< stream position of the first call
+    std::vector<TraceIndex::Chunk> mIndexChunks;
+    std::vector<uint32_t> mIndexChecksums;
+    bool                mChecksums = false;
+    std::vector<FrameMark> mFrameMarks;
+    unsigned            mTableCallCount = 0;
+    unsigned            mTableTid = 0;
+    size_t              mTableChunks = 0; ///< chunks and frame marks in the last table written
+    size_t              mTableFrameMarks = 0;
 };
 
+/// Replace the json header of a V3 or V4 trace. When it fits in the space reserved for the
+/// header, in front of the frame table and header summary kept there, it is written in place.
+/// Otherwise the trace is rewritten with room for the header and padding bytes more, its chunks
+/// copied as they are, and the frame table and the offsets of the sections moved with them.
+bool PatchJsonHeader(const std::string& fileName, const std::string& json, size_t padding = HEADER_PATCH_PADDING);
+
 }
 
 #endif
@@ -0,0 +1,264 @@
+#include <common/state_log.hpp>
+#include <common/chunk_codec.hpp>
+#include <common/os.hpp>
+
+#include <errno.h>
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+
+namespace common {
+
+/// Batches are handed to the thread once they hold this much
+#define STATE_LOG_BATCH_SIZE CHUNK_BUFFER_MIN_CAPACITY
+/// Loggers wait for the thread when it falls this many batches behind
+#define STATE_LOG_MAX_QUEUED 16
+/// How long a batch that is not full waits for more records before the thread takes it
+#define STATE_LOG_MAX_DELAY_MS 200
+
+StateLogWriter::StateLogWriter()
+    : mFile(NULL)
+    , mWriting(false)
+    , mStop(false)
+{
+}
+
+StateLogWriter::~StateLogWriter()
+{
+    close();
+}
+
+bool StateLogWriter::open(const std::string& fileName)
+{
+    close();
+    mFile = fopen(fileName.c_str(), "wb");
+    if (!mFile)
+    {
+        DBG_LOG("Failed to open state log %s: %s\n", fileName.c_str(), strerror(errno));
+        return false;
+    }
+    const uint32_t header[2] = { STATE_LOG_MAGIC, STATE_LOG_VERSION };
+    fwrite(header, sizeof(header), 1, mFile);
+    mBatch.reserve(STATE_LOG_BATCH_SIZE);
+    mThread = std::thread(&StateLogWriter::writerThread, this);
+    return true;
+}
+
+void StateLogWriter::close()
+{
+    if (!mFile)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mQueueChanged.notify_all();
+    mThread.join();
+    fclose(mFile);
+    mFile = NULL;
+    mStop = false;
+    mNameIds.clear();
+}
+
+void StateLogWriter::function(unsigned char tid, const char* name, unsigned callNo, unsigned drawNo, unsigned frameNo)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto it = mNameIds.find(name);
+    if (it == mNameIds.end())
+    {
+        const uint32_t id = mNameIds.size();
+        it = mNameIds.emplace(name, id).first;
+        append(lock, STATE_LOG_NAME, tid, &id, sizeof(id), name, strlen(name));
+    }
+    const uint32_t fields[4] = { it->second, callNo, drawNo, frameNo };
+    append(lock, STATE_LOG_FUNCTION, tid, fields, sizeof(fields));
+}
+
+void StateLogWriter::text(unsigned char tid, const std::string& text)
+{
+    if (text.empty())
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mMutex);
+    append(lock, STATE_LOG_TEXT, tid, text.data(), text.size());
+}
+
+void StateLogWriter::append(std::unique_lock<std::mutex>& lock, StateLogRecordType type, unsigned char tid, const void* head, size_t headSize, const void* data, size_t size)
+{
+    const StateLogRecord record = { (uint8_t)type, tid, (uint32_t)(headSize + size) };
+    const size_t recordSize = sizeof(record) + headSize + size;
+    if (!mBatch.empty() && mBatch.size() + recordSize > STATE_LOG_BATCH_SIZE)
+    {
+        mQueueChanged.wait(lock, [this]() { return mQueue.size() < STATE_LOG_MAX_QUEUED; });
+        mQueue.push_back(std::move(mBatch));
+        mBatch.clear();
+        mBatch.reserve(STATE_LOG_BATCH_SIZE);
+        mQueueChanged.notify_all();
+    }
+    mBatch.insert(mBatch.end(), (const char*)&record, (const char*)&record + sizeof(record));
+    mBatch.insert(mBatch.end(), (const char*)head, (const char*)head + headSize);
+    if (size)
+    {
+        mBatch.insert(mBatch.end(), (const char*)data, (const char*)data + size);
+    }
+}
+
+void StateLogWriter::flush()
+{
+    if (!mFile)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (!mBatch.empty())
+    {
+        mQueue.push_back(std::move(mBatch));
+        mBatch.clear();
+        mQueueChanged.notify_all();
+    }
+    mQueueChanged.wait(lock, [this]() { return mQueue.empty() && !mWriting; });
+}
+
+void StateLogWriter::writerThread()
+{
+    std::vector<char> compressed;
+    bool failed = false;
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true)
+    {
+        if (mQueue.empty() && !mStop)
+        {
+            mQueueChanged.wait_for(lock, std::chrono::milliseconds(STATE_LOG_MAX_DELAY_MS), [this]() { return !mQueue.empty() || mStop; });
+        }
+        if (mQueue.empty())
+        {
+            if (mBatch.empty())
+            {
+                if (mStop)
+                {
+                    break;
+                }
+                continue;
+            }
+            mQueue.push_back(std::move(mBatch));
+            mBatch.clear();
+        }
+
+        std::vector<char> batch = std::move(mQueue.front());
+        mQueue.pop_front();
+        mWriting = true;
+        mQueueChanged.notify_all();
+        lock.unlock();
+
+        compressed.resize(4 + chunkMaxCompressedLength(CHUNK_CODEC_SNAPPY, batch.size()));
+        const size_t length = chunkCompress(CHUNK_CODEC_SNAPPY, batch.data(), batch.size(), compressed.data() + 4);
+        const uint32_t prefix = chunkPrefix(CHUNK_CODEC_SNAPPY, length);
+        memcpy(compressed.data(), &prefix, sizeof(prefix));
+        if ((fwrite(compressed.data(), 4 + length, 1, mFile) != 1 || fflush(mFile) != 0) && !failed)
+        {
+            DBG_LOG("Failed to write the state log: %s\n", strerror(errno));
+            failed = true;
+        }
+
+        lock.lock();
+        mWriting = false;
+        mQueueChanged.notify_all();
+    }
+}
+
+bool renderStateLog(const std::string& fileName, std::ostream& out)
+{
+    FILE* file = fopen(fileName.c_str(), "rb");
+    if (!file)
+    {
+        DBG_LOG("Failed to open %s: %s\n", fileName.c_str(), strerror(errno));
+        return false;
+    }
+    std::unique_ptr<FILE, int(*)(FILE*)> closer(file, fclose);
+
+    uint32_t header[2];
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != STATE_LOG_MAGIC)
+    {
+        DBG_LOG("%s is not a state log\n", fileName.c_str());
+        return false;
+    }
+    if (header[1] > STATE_LOG_VERSION)
+    {
+        DBG_LOG("%s is a state log of version %u, this build reads up to version %u\n", fileName.c_str(), header[1], STATE_LOG_VERSION);
+        return false;
+    }
+
+    // Calls are numbered per thread and function, as by the state logger of old
+    std::vector<std::string> names;
+    const std::string unknown;
+    std::vector<std::unordered_map<std::string, unsigned>> callCounts(256);
+    std::vector<char> compressed;
+    std::vector<char> batch;
+    uint32_t prefix;
+    while (fread(&prefix, sizeof(prefix), 1, file) == 1)
+    {
+        const ChunkCodec codec = chunkPrefixCodec(prefix);
+        compressed.resize(chunkPrefixLength(prefix));
+        size_t length = 0;
+        if (fread(compressed.data(), compressed.size(), 1, file) != 1
+            || !chunkUncompressedLength(codec, compressed.data(), compressed.size(), &length))
+        {
+            DBG_LOG("%s is cut short\n", fileName.c_str());
+            return false;
+        }
+        batch.resize(length);
+        if (!chunkUncompress(codec, compressed.data(), compressed.size(), batch.data()))
+        {
+            DBG_LOG("Failed to decompress a chunk of %s\n", fileName.c_str());
+            return false;
+        }
+
+        size_t pos = 0;
+        while (pos + sizeof(StateLogRecord) <= batch.size())
+        {
+            StateLogRecord record;
+            memcpy(&record, batch.data() + pos, sizeof(record));
+            const char* payload = batch.data() + pos + sizeof(record);
+            pos += sizeof(record) + record.size;
+            if (pos > batch.size())
+            {
+                break;
+            }
+
+            if (record.type == STATE_LOG_NAME && record.size >= 4)
+            {
+                uint32_t id;
+                memcpy(&id, payload, sizeof(id));
+                if (names.size() <= id)
+                {
+                    names.resize(id + 1);
+                }
+                names[id].assign(payload + 4, record.size - 4);
+            }
+            else if (record.type == STATE_LOG_FUNCTION && record.size >= 16)
+            {
+                uint32_t fields[4];
+                memcpy(fields, payload, sizeof(fields));
+                const std::string& name = fields[0] < names.size() ? names[fields[0]] : unknown;
+                out << "@F: [" << (int)record.tid << "] " << name << " " << callCounts[record.tid][name]++
+                    << " call=" << fields[1] << " draw=" << fields[2] << " frame=" << fields[3] << "\n";
+            }
+            else if (record.type == STATE_LOG_TEXT)
+            {
+                out.write(payload, record.size);
+            }
+        }
+        if (pos != batch.size())
+        {
+            DBG_LOG("A chunk of %s ends in the middle of a record\n", fileName.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+}
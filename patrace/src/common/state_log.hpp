@@ -0,0 +1,87 @@
+#ifndef _COMMON_STATE_LOG_HPP_
+#define _COMMON_STATE_LOG_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace common {
+
+/// State logs (the .tracelog of the tracer and the .retracelog of paretrace -statelog) are
+/// binary. The file starts with STATE_LOG_MAGIC and STATE_LOG_VERSION as 4 byte words, followed
+/// by snappy chunks stored as in a trace file. The chunks hold records of a StateLogRecord header
+/// and size bytes of payload; no record is split between chunks. The statelog_to_txt tool turns
+/// them into the text the state logger used to write.
+#define STATE_LOG_MAGIC 0x4c534150u // "PASL"
+#define STATE_LOG_VERSION 1
+
+enum StateLogRecordType
+{
+    /// 4 byte id followed by the function name it stands for in later STATE_LOG_FUNCTION records
+    STATE_LOG_NAME = 1,
+    /// A call that the state after it is logged for, as 4 byte words: name id, call, draw and frame
+    STATE_LOG_FUNCTION = 2,
+    /// Lines of state, as they appear in the text log
+    STATE_LOG_TEXT = 3
+};
+
+#pragma pack(push, 1)
+struct StateLogRecord
+{
+    uint8_t type;
+    uint8_t tid;
+    uint32_t size;
+};
+#pragma pack(pop)
+
+/// Writes a state log on a thread of its own. Logging a record only copies it into a batch;
+/// the thread compresses batches and writes them, so that the GL thread never waits for the
+/// disk unless it logs faster than the disk takes it. What is logged reaches the file within
+/// a fraction of a second, to not lose much when the process crashes. Thread safe.
+class StateLogWriter
+{
+public:
+    StateLogWriter();
+    ~StateLogWriter();
+
+    /// Create fileName, or truncate it if it exists, and start the thread
+    bool open(const std::string& fileName);
+    /// Write what was logged and close the file
+    void close();
+    bool isOpen() const { return mFile != NULL; }
+
+    /// Log a call of the function. Names are compared by address, which suits string literals.
+    void function(unsigned char tid, const char* name, unsigned callNo, unsigned drawNo, unsigned frameNo);
+    void text(unsigned char tid, const std::string& text);
+    /// Wait until what was logged so far is in the file
+    void flush();
+
+private:
+    void append(std::unique_lock<std::mutex>& lock, StateLogRecordType type, unsigned char tid, const void* head, size_t headSize, const void* data = NULL, size_t size = 0);
+    void writerThread();
+
+    FILE* mFile;
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mQueueChanged; ///< woken on new batches and on batches written
+    std::vector<char> mBatch; ///< being filled by the loggers
+    std::deque<std::vector<char>> mQueue; ///< full batches for the thread
+    bool mWriting; ///< the thread has taken a batch that is not written yet
+    bool mStop;
+    std::unordered_map<const char*, uint32_t> mNameIds;
+};
+
+/// Write the state log in fileName to out as text. Returns false if it is not a state log, or
+/// if it is cut short; what could be read is written all the same.
+bool renderStateLog(const std::string& fileName, std::ostream& out);
+
+}
+
+#endif
@@ -0,0 +1,259 @@
+#include "common/thread_pool.hpp"
+
+#include "common/os.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace common {
+
+static std::mutex gBudgetMutex;
+static unsigned gThreadsTaken = 0;
+
+static thread_local ThreadPool* tPool = nullptr; ///< of the worker running on this thread
+static thread_local unsigned tQueue = 0;
+
+unsigned concurrencyBudget()
+{
+    static const unsigned budget = []() -> unsigned
+    {
+        const char* env = getenv("PATRACE_THREADS");
+        if (env && atoi(env) > 0)
+        {
+            return atoi(env);
+        }
+#ifdef __linux__
+        cpu_set_t available;
+        if (sched_getaffinity(0, sizeof(available), &available) == 0 && CPU_COUNT(&available) > 0)
+        {
+            return CPU_COUNT(&available);
+        }
+#endif
+        return std::max(1u, std::thread::hardware_concurrency());
+    }();
+    return budget;
+}
+
+unsigned long coreSize(unsigned cpu)
+{
+    const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    unsigned long size = 0;
+    std::ifstream capacity(base + "/cpu_capacity");
+    if (capacity >> size)
+    {
+        return size;
+    }
+    std::ifstream freq(base + "/cpufreq/cpuinfo_max_freq");
+    if (freq >> size)
+    {
+        return size;
+    }
+    return 0;
+}
+
+#ifdef __linux__
+/// The biggest or smallest of the cores the process may run on. Returns false if they are all
+/// alike or their sizes are not known.
+static bool clusterMask(bool big, cpu_set_t& mask)
+{
+    cpu_set_t available;
+    if (sched_getaffinity(0, sizeof(available), &available) != 0)
+    {
+        return false;
+    }
+    std::map<unsigned long, std::vector<unsigned>> clusters;
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &available))
+        {
+            continue;
+        }
+        const unsigned long size = coreSize(cpu);
+        if (size == 0)
+        {
+            return false;
+        }
+        clusters[size].push_back(cpu);
+    }
+    if (clusters.size() < 2)
+    {
+        return false;
+    }
+    CPU_ZERO(&mask);
+    for (unsigned cpu : big ? clusters.rbegin()->second : clusters.begin()->second)
+    {
+        CPU_SET(cpu, &mask);
+    }
+    return true;
+}
+#endif
+
+ThreadPool::ThreadPool(unsigned threads, Cores cores)
+    : mNextQueue(0)
+    , mQueued(0)
+{
+    {
+        std::lock_guard<std::mutex> lock(gBudgetMutex);
+        const unsigned left = concurrencyBudget() > gThreadsTaken ? concurrencyBudget() - gThreadsTaken : 0;
+        threads = std::max(1u, (threads == 0) ? left : std::min(threads, left));
+        gThreadsTaken += threads;
+    }
+
+#ifdef __linux__
+    cpu_set_t mask;
+    const bool pinned = cores != ANY && clusterMask(cores == BIG, mask);
+#endif
+    for (unsigned i = 0; i < threads; i++)
+    {
+        mQueues.emplace_back(new Queue);
+    }
+    for (unsigned i = 0; i < threads; i++)
+    {
+        mWorkers.emplace_back([=]
+        {
+#ifdef __linux__
+            if (pinned && sched_setaffinity(0, sizeof(mask), &mask) != 0)
+            {
+                DBG_LOG("Failed to place a worker thread on the %s cores\n", cores == BIG ? "big" : "little");
+            }
+#endif
+            work(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWake.notify_all();
+    for (std::thread& t : mWorkers)
+    {
+        t.join();
+    }
+    std::lock_guard<std::mutex> lock(gBudgetMutex);
+    gThreadsTaken -= mWorkers.size();
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    const unsigned index = (tPool == this) ? tQueue : mNextQueue++ % mQueues.size();
+    {
+        std::lock_guard<std::mutex> lock(mQueues[index]->mutex);
+        mQueues[index]->tasks.push_back(std::move(task));
+    }
+    mQueued++;
+    {
+        std::lock_guard<std::mutex> lock(mMutex); // not to miss a worker about to wait
+    }
+    mWake.notify_one();
+}
+
+bool ThreadPool::take(unsigned first, std::function<void()>& task)
+{
+    if (mQueued.load() == 0)
+    {
+        return false;
+    }
+    for (unsigned i = 0; i < mQueues.size(); i++)
+    {
+        Queue& queue = *mQueues[(first + i) % mQueues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            continue;
+        }
+        // the newest of our own, the oldest of anyone else's
+        if (i == 0 && tPool == this)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        mQueued--;
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::runOne()
+{
+    std::function<void()> task;
+    if (!take(tPool == this ? tQueue : 0, task))
+    {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::work(unsigned index)
+{
+    tPool = this;
+    tQueue = index;
+    std::function<void()> task;
+    for (;;)
+    {
+        if (take(index, task))
+        {
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWake.wait(lock, [this]{ return mStop || mQueued.load() > 0; });
+        if (mStop && mQueued.load() == 0)
+        {
+            return;
+        }
+    }
+}
+
+void TaskGroup::run(std::function<void()> task)
+{
+    mPending++;
+    mPool.submit([this, task]
+    {
+        task();
+        std::lock_guard<std::mutex> lock(mMutex); // held, so that the group outlives the notify
+        if (--mPending == 0)
+        {
+            mDone.notify_all();
+        }
+    });
+}
+
+void TaskGroup::wait()
+{
+    while (mPending.load() > 0)
+    {
+        if (mPool.runOne())
+        {
+            continue;
+        }
+        // ours may queue more for us to help with, so look again now and then
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait_for(lock, std::chrono::milliseconds(1), [this]{ return mPending.load() == 0; });
+    }
+    std::lock_guard<std::mutex> lock(mMutex); // until the last task is done with the group
+}
+
+}
@@ -0,0 +1,159 @@
+#ifndef _COMMON_THREAD_POOL_HPP_
+#define _COMMON_THREAD_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace common {
+
+/// The number of threads the tools run work on by default: the PATRACE_THREADS environment
+/// variable if it is set, or else the number of cores the process is allowed to run on. All
+/// thread pools together never start more worker threads than this.
+unsigned concurrencyBudget();
+
+/// Capacity of the core, or failing that its highest frequency, zero if neither is known
+unsigned long coreSize(unsigned cpu);
+
+/// Worker threads that run tasks. Each worker has a queue of its own, and takes the tasks queued
+/// last from it first, so that tasks queued by a task run while their data is still in the cache.
+/// Workers that run out of tasks steal the oldest ones from the other queues.
+///
+/// The workers are taken out of the concurrencyBudget(), and given back when the pool is
+/// destroyed. A pool gets at least one worker however many other pools have taken.
+class ThreadPool
+{
+public:
+    /// Which cores the workers run on. BIG and LITTLE are the biggest and smallest cores as told
+    /// by coreSize(), and are the same as ANY where all cores are alike or their sizes are not known.
+    enum Cores { ANY, BIG, LITTLE };
+
+    /// Up to threads workers, or as many as the budget has left for 0
+    explicit ThreadPool(unsigned threads = 0, Cores cores = ANY);
+    /// Runs the tasks still queued before returning
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return mQueues.size(); }
+
+    /// Queue a task, on the queue of the calling worker if it is one of ours
+    void submit(std::function<void()> task);
+
+    /// Run one queued task on the calling thread, if there is one. Returns false if there was not.
+    bool runOne();
+
+    /// The pool shared by everything that does not need one of its own, started on first use
+    /// with what is left of the budget then
+    static ThreadPool& shared();
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool take(unsigned first, std::function<void()>& task);
+    void work(unsigned index);
+
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    std::vector<std::thread> mWorkers;
+    std::atomic<unsigned> mNextQueue;
+    std::atomic<size_t> mQueued;
+    std::mutex mMutex;
+    std::condition_variable mWake; ///< signals the workers that a task was queued
+    bool mStop = false;
+};
+
+/// Tasks run on a pool that can be waited for together, without waiting for those of anyone
+/// else that uses the same pool
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool& pool = ThreadPool::shared()) : mPool(pool), mPending(0) {}
+    ~TaskGroup() { wait(); }
+
+    void run(std::function<void()> task);
+
+    /// Wait for all tasks run so far to finish, running queued tasks meanwhile
+    void wait();
+
+private:
+    ThreadPool& mPool;
+    std::atomic<size_t> mPending;
+    std::mutex mMutex;
+    std::condition_variable mDone;
+};
+
+/// Passes the results of tasks that finish in any order on to a sink in the order they were
+/// started, such as chunks compressed on a pool that must be written to a file in sequence.
+/// Every result gets a sequence number from next() before its task starts, and is handed in
+/// with put() once it is done. The sink is called on whichever thread puts the result that is
+/// next in sequence, for that one and any that were waiting for it, one at a time.
+template <class T>
+class OrderedOutput
+{
+public:
+    explicit OrderedOutput(std::function<void(T&)> sink) : mSink(sink) {}
+
+    /// Sequence number of the next result
+    uint64_t next() { return mIssued++; }
+
+    void put(uint64_t seq, T value)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWaiting.emplace(seq, std::move(value));
+        if (mDraining)
+        {
+            return; // the thread draining picks it up
+        }
+        mDraining = true;
+        while (!mWaiting.empty() && mWaiting.begin()->first == mNext)
+        {
+            T ready = std::move(mWaiting.begin()->second);
+            mWaiting.erase(mWaiting.begin());
+            lock.unlock();
+            mSink(ready);
+            lock.lock();
+            mNext++;
+        }
+        mDraining = false;
+        mCond.notify_all();
+    }
+
+    /// Wait until every result numbered so far has gone to the sink
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCond.wait(lock, [this]{ return mNext == mIssued.load() && !mDraining; });
+    }
+
+    /// Number of results that are done but wait for earlier ones
+    size_t waiting()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mWaiting.size();
+    }
+
+private:
+    std::function<void(T&)> mSink;
+    std::atomic<uint64_t> mIssued{0};
+    uint64_t mNext = 0;
+    bool mDraining = false;
+    std::map<uint64_t, T> mWaiting;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+};
+
+}
+
+#endif
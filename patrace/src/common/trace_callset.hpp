@@ -47,8 +47,10 @@
 #ifndef _TRACE_CALLSET_HPP_
 #define _TRACE_CALLSET_HPP_
 
+#include <algorithm>
 #include <cstring> // for strcmp
-#include <list>
+#include <stdint.h>
+#include <vector>
 
 namespace common {
 
@@ -111,16 +113,15 @@ namespace common {
         {}
 
         bool contains(CallNo callNo, const char *funcName) const {
+            return contains(callNo, freq == FREQUENCY_ALL ? FREQUENCY_ALL : GetCallFlags(funcName));
+        }
+
+        // flags as returned by GetCallFlags() for the function
+        bool contains(CallNo callNo, CallFlags flags) const {
             if (callNo >= start && callNo <= stop &&
                 ((callNo - start) % step) == 0)
             {
-                if (freq == FREQUENCY_ALL)
-                    return true;
-                else
-                {
-                    CallFlags flag = GetCallFlags(funcName);
-                    return (flag & freq) != 0;
-                }
+                return freq == FREQUENCY_ALL || (flags & freq) != 0;
             }
 
             return false;
@@ -129,6 +130,10 @@ namespace common {
 
 
     // A collection of call ranges
+    //
+    // Lookups use a compiled form of the ranges that is built on first use after a change:
+    // a map of the flags of every call when the set covers a small enough span of calls,
+    // otherwise a binary search over the ranges sorted by start.
     class CallSet
     {
     public:
@@ -149,23 +154,36 @@ namespace common {
             if (range.start <= range.stop &&
                 range.freq != FREQUENCY_NONE) {
 
-                RangeList::iterator it = ranges.begin();
-                while (it != ranges.end() && it->start < range.start) {
-                    ++it;
-                }
-
+                RangeList::iterator it = std::lower_bound(ranges.begin(), ranges.end(), range, startsBefore);
                 ranges.insert(it, range);
+                compiled = false;
             }
         }
 
         inline bool
         contains(CallNo callNo, const char *funcName) const {
+            return contains(callNo, GetCallFlags(funcName));
+        }
+
+        // Faster variant for when the flags of the function are known, see InFileBase::ExIdToCallFlags()
+        inline bool
+        contains(CallNo callNo, CallFlags flags) const {
             if (empty()) {
                 return false;
             }
-            RangeList::const_iterator it;
-            for (it = ranges.begin(); it != ranges.end() && it->start <= callNo; ++it) {
-                if (it->contains(callNo, funcName)) {
+            if (!compiled) {
+                compile();
+            }
+            if (callNo < first || callNo > last) {
+                return false;
+            }
+            if (!callFlags.empty()) {
+                return (callFlags[callNo - first] & flags) != 0;
+            }
+            // ranges before 'it' start at or before callNo, look back until none of them reaches it
+            const RangeList::const_iterator it = std::upper_bound(ranges.begin(), ranges.end(), CallRange(callNo), startsBefore);
+            for (size_t i = it - ranges.begin(); i-- > 0 && maxStop[i] >= callNo; ) {
+                if (ranges[i].contains(callNo, flags)) {
                     return true;
                 }
             }
@@ -173,9 +191,44 @@ namespace common {
         }
 
     private:
-        // TODO: use binary tree to speed up lookups
-        typedef std::list< CallRange > RangeList;
+        // Largest span of calls that gets a flag map, one byte per call
+        static const CallNo MAX_FLAG_MAP_SPAN = 16 * 1024 * 1024;
+
+        static bool startsBefore(const CallRange& a, const CallRange& b) { return a.start < b.start; }
+
+        void compile() const {
+            first = ranges.front().start;
+            last = 0;
+            maxStop.resize(ranges.size());
+            uint64_t work = 0;
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                last = std::max(last, ranges[i].stop);
+                maxStop[i] = last;
+                work += ((uint64_t)ranges[i].stop - ranges[i].start) / std::max<CallNo>(ranges[i].step, 1) + 1;
+            }
+
+            callFlags.clear();
+            if (last - first < MAX_FLAG_MAP_SPAN && work <= 4 * (uint64_t)MAX_FLAG_MAP_SPAN) {
+                callFlags.assign((size_t)(last - first) + 1, 0);
+                for (const CallRange& range : ranges) {
+                    // the flags returned by GetCallFlags() all fit in the low byte
+                    const unsigned char mask = range.freq == FREQUENCY_ALL ? 0xff : (unsigned char)range.freq;
+                    for (uint64_t callNo = range.start; callNo <= range.stop; callNo += std::max<CallNo>(range.step, 1)) {
+                        callFlags[callNo - first] |= mask;
+                    }
+                }
+            }
+            compiled = true;
+        }
+
+        typedef std::vector< CallRange > RangeList;
         RangeList ranges;
+
+        mutable bool compiled = false;
+        mutable CallNo first = 0;
+        mutable CallNo last = 0;
+        mutable std::vector<CallNo> maxStop; // largest stop of the ranges up to each index
+        mutable std::vector<unsigned char> callFlags; // flags of the ranges containing each call from first to last
     };
 
     CallSet parse(const char *string);
@@ -0,0 +1,384 @@
+#include <common/trace_index.hpp>
+#include <common/file_format.hpp>
+#include <common/os.hpp>
+#include <common/chunk_codec.hpp>
+#include <common/thread_pool.hpp>
+
+#include <algorithm>
+#include <errno.h>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+namespace common {
+
+static const uint32_t TRACE_INDEX_MAGIC = 0x58444950; // "PIDX"
+static const uint32_t TRACE_INDEX_VERSION = 2;
+static const uint64_t TRACE_HASH_SPAN = 64 * 1024;
+
+static uint64_t fileSize(const std::string& name)
+{
+    std::ifstream in(name.c_str(), std::ios::binary | std::ios::ate);
+    if (!in.is_open()) return 0;
+    return (uint64_t)in.tellg();
+}
+
+uint64_t TraceIndex::hashFile(const std::string& traceName, uint64_t size)
+{
+    std::ifstream in(traceName.c_str(), std::ios::binary);
+    if (!in.is_open()) return 0;
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull ^ size;
+    std::vector<char> buf(std::min(size, TRACE_HASH_SPAN));
+    const uint64_t offsets[2] = { 0, size - buf.size() };
+    for (uint64_t offset : offsets)
+    {
+        in.seekg(offset, std::ios_base::beg);
+        in.read(buf.data(), buf.size());
+        for (char c : buf)
+        {
+            hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+template<class T>
+static bool readVector(std::istream& in, std::vector<T>& v)
+{
+    uint32_t count = 0;
+    in.read((char*)&count, sizeof(count));
+    if (in.fail()) return false;
+    v.resize(count);
+    in.read((char*)v.data(), count * sizeof(T));
+    return !in.fail();
+}
+
+template<class T>
+static void writeVector(std::ostream& out, const std::vector<T>& v)
+{
+    const uint32_t count = v.size();
+    out.write((const char*)&count, sizeof(count));
+    out.write((const char*)v.data(), count * sizeof(T));
+}
+
+bool TraceIndex::load(const std::string& traceName)
+{
+    return loadSidecar(traceName) || loadFromTrace(traceName);
+}
+
+bool TraceIndex::loadSidecar(const std::string& traceName)
+{
+    std::ifstream in(pathFor(traceName).c_str(), std::ios::binary);
+    if (!in.is_open()) return false;
+
+    uint32_t magic = 0, version = 0;
+    in.read((char*)&magic, sizeof(magic));
+    in.read((char*)&version, sizeof(version));
+    in.read((char*)&mTraceSize, sizeof(mTraceSize));
+    in.read((char*)&mTraceHash, sizeof(mTraceHash));
+    if (in.fail() || magic != TRACE_INDEX_MAGIC || version != TRACE_INDEX_VERSION)
+    {
+        DBG_LOG("Ignoring invalid trace index %s\n", pathFor(traceName).c_str());
+        return false;
+    }
+    if (mTraceSize != fileSize(traceName) || mTraceHash != hashFile(traceName, mTraceSize))
+    {
+        DBG_LOG("Ignoring stale trace index %s\n", pathFor(traceName).c_str());
+        return false;
+    }
+    if (!readVector(in, mChunks) || !readVector(in, mFrames))
+    {
+        DBG_LOG("Ignoring truncated trace index %s\n", pathFor(traceName).c_str());
+        mChunks.clear();
+        mFrames.clear();
+        return false;
+    }
+    return true;
+}
+
+template<class T>
+static void appendVector(std::vector<char>& out, const std::vector<T>& v)
+{
+    const uint32_t count = v.size();
+    out.insert(out.end(), (const char*)&count, (const char*)&count + sizeof(count));
+    out.insert(out.end(), (const char*)v.data(), (const char*)(v.data() + v.size()));
+}
+
+template<class T>
+static bool parseVector(const char*& data, const char* end, std::vector<T>& v)
+{
+    uint32_t count = 0;
+    if (end - data < (ptrdiff_t)sizeof(count)) return false;
+    memcpy(&count, data, sizeof(count));
+    data += sizeof(count);
+    if ((uint64_t)(end - data) < (uint64_t)count * sizeof(T)) return false;
+    v.resize(count);
+    memcpy(v.data(), data, count * sizeof(T));
+    data += count * sizeof(T);
+    return true;
+}
+
+void TraceIndex::writeTable(std::vector<char>& out) const
+{
+    out.clear();
+    appendVector(out, mChunks);
+    appendVector(out, mFrames);
+    if (!mChecksums.empty())
+    {
+        appendVector(out, mChecksums);
+    }
+}
+
+bool TraceIndex::readTable(const char* data, size_t size)
+{
+    const char* end = data + size;
+    mChecksums.clear();
+    if (!parseVector(data, end, mChunks) || !parseVector(data, end, mFrames)
+        || (data != end && (!parseVector(data, end, mChecksums) || mChecksums.size() != mChunks.size())) || data != end)
+    {
+        mChunks.clear();
+        mFrames.clear();
+        mChecksums.clear();
+        return false;
+    }
+    return true;
+}
+
+// Read the table in front of the footer at the given position, if there is one
+static bool readFrameTable(std::ifstream& in, uint64_t footerPos, uint64_t tableBegin, std::vector<char>& table)
+{
+    BFrameTableFooter footer;
+    in.seekg(footerPos, std::ios_base::beg);
+    in.read((char*)&footer, sizeof(footer));
+    if (in.fail() || footer.magic != FRAME_TABLE_MAGIC || footer.size > footerPos - tableBegin)
+    {
+        in.clear();
+        return false;
+    }
+    table.resize(footer.size);
+    in.seekg(footerPos - footer.size, std::ios_base::beg);
+    in.read(table.data(), table.size());
+    if (in.fail() || HeaderSummaryHash(table.data(), table.size()) != footer.hash)
+    {
+        in.clear();
+        return false;
+    }
+    return true;
+}
+
+bool TraceIndex::loadFromTrace(const std::string& traceName)
+{
+    std::ifstream in(traceName.c_str(), std::ios::binary);
+    if (!in.is_open()) return false;
+
+    BHeaderV3 header;
+    in.read((char*)&header, sizeof(header));
+    if (in.fail() || header.magicNo != 0x20122012 || (header.version != HEADER_VERSION_3 && header.version != HEADER_VERSION_4))
+    {
+        return false;
+    }
+
+    // in the space reserved for the json header, or else behind the chunks
+    const uint64_t size = fileSize(traceName);
+    const uint64_t headerFooterPos = header.jsonFileEnd - sizeof(BHeaderSummary) - sizeof(BFrameTableFooter);
+    std::vector<char> table;
+    bool found = header.jsonFileEnd - header.jsonFileBegin >= (long long)(sizeof(BHeaderSummary) + sizeof(BFrameTableFooter))
+                 && (uint64_t)header.jsonFileEnd <= size
+                 && readFrameTable(in, headerFooterPos, header.jsonFileBegin + header.jsonLength, table);
+    if (!found && size >= header.jsonFileEnd + sizeof(uint32_t) + sizeof(BFrameTableFooter))
+    {
+        const uint64_t trailerFooterPos = size - sizeof(BFrameTableFooter);
+        uint32_t prefix = 0;
+        found = readFrameTable(in, trailerFooterPos, header.jsonFileEnd + sizeof(prefix), table);
+        if (found)
+        {
+            in.seekg(trailerFooterPos - table.size() - sizeof(prefix), std::ios_base::beg);
+            in.read((char*)&prefix, sizeof(prefix));
+            found = !in.fail() && prefix == CHUNK_TRAILER_PREFIX;
+        }
+    }
+    if (!found || !readTable(table.data(), table.size()))
+    {
+        return false;
+    }
+    if (mChunks.empty() || mChunks[0].filePos != (uint64_t)header.jsonFileEnd)
+    {
+        DBG_LOG("Ignoring invalid frame table in %s\n", traceName.c_str());
+        mChunks.clear();
+        mFrames.clear();
+        mChecksums.clear();
+        return false;
+    }
+    mTraceSize = size;
+    mTraceHash = hashFile(traceName, size);
+    return true;
+}
+
+bool TraceIndex::save(const std::string& traceName) const
+{
+    errno = 0;
+    std::ofstream out(pathFor(traceName).c_str(), std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+        // Traces are often read from directories we cannot write to, which is not worth a warning
+        if (errno != EACCES && errno != EROFS && errno != EPERM)
+        {
+            DBG_LOG("Failed to create trace index %s: %s\n", pathFor(traceName).c_str(), strerror(errno));
+        }
+        return false;
+    }
+    out.write((const char*)&TRACE_INDEX_MAGIC, sizeof(TRACE_INDEX_MAGIC));
+    out.write((const char*)&TRACE_INDEX_VERSION, sizeof(TRACE_INDEX_VERSION));
+    out.write((const char*)&mTraceSize, sizeof(mTraceSize));
+    out.write((const char*)&mTraceHash, sizeof(mTraceHash));
+    writeVector(out, mChunks);
+    writeVector(out, mFrames);
+    return !out.fail();
+}
+
+bool TraceIndex::scanChunks(const std::string& traceName)
+{
+    std::ifstream in(traceName.c_str(), std::ios::binary);
+    if (!in.is_open())
+    {
+        DBG_LOG("Failed to open %s\n", traceName.c_str());
+        return false;
+    }
+
+    BHeader header;
+    in.read((char*)&header, sizeof(header));
+    uint64_t pos;
+    if (in.fail() || header.magicNo != 0x20122012)
+    {
+        DBG_LOG("%s seems to be an invalid trace file!\n", traceName.c_str());
+        return false;
+    }
+    else if (header.version == HEADER_VERSION_1)
+    {
+        pos = sizeof(BHeaderV1);
+    }
+    else if (header.version == HEADER_VERSION_2)
+    {
+        pos = sizeof(BHeaderV2);
+    }
+    else if (header.version == HEADER_VERSION_3 || header.version == HEADER_VERSION_4)
+    {
+        BHeaderV3 hdr;
+        in.seekg(0, std::ios_base::beg);
+        in.read((char*)&hdr, sizeof(hdr));
+        pos = hdr.jsonFileEnd;
+    }
+    else
+    {
+        DBG_LOG("Unsupported file format version: %d\n", header.version - HEADER_VERSION_1 + 1);
+        return false;
+    }
+
+    mTraceSize = fileSize(traceName);
+    mTraceHash = hashFile(traceName, mTraceSize);
+    mChunks.clear();
+    uint64_t streamPos = 0;
+    while (pos + 4 <= mTraceSize)
+    {
+        // enough of the chunk to hold its uncompressed length
+        char buf[4 + 5];
+        in.seekg(pos, std::ios_base::beg);
+        in.read(buf, sizeof(buf));
+        const size_t got = in.gcount();
+        in.clear();
+        if (got >= 4 && *(uint32_t*)buf == CHUNK_TRAILER_PREFIX)
+        {
+            break; // the frame table the tracer left behind the chunks
+        }
+        const uint32_t compressedLength = chunkPrefixLength(*(uint32_t*)buf);
+        size_t uncompressedLength = 0;
+        if (pos + 4 + compressedLength > mTraceSize
+            || !chunkUncompressedLength(chunkPrefixCodec(*(uint32_t*)buf), buf + 4, std::min<size_t>(compressedLength, got - 4), &uncompressedLength))
+        {
+            DBG_LOG("Failed to parse chunk at offset %llu of %s\n", (unsigned long long)pos, traceName.c_str());
+            return false;
+        }
+        mChunks.push_back({ pos, streamPos });
+        pos += 4 + compressedLength;
+        streamPos += uncompressedLength;
+    }
+    return true;
+}
+
+const TraceIndex::Chunk* TraceIndex::findChunk(uint64_t streamPos) const
+{
+    auto it = std::upper_bound(mChunks.begin(), mChunks.end(), streamPos,
+                               [](uint64_t p, const Chunk& c) { return p < c.streamPos; });
+    if (it == mChunks.begin()) return nullptr;
+    return &*(it - 1);
+}
+
+unsigned TraceIndex::verifyChunks(const std::string& traceName, int threads) const
+{
+    if (threads <= 0)
+    {
+        threads = common::concurrencyBudget();
+    }
+    threads = std::min<int>(threads, mChecksums.size());
+    const uint64_t size = fileSize(traceName);
+    std::atomic<size_t> next(0);
+    std::atomic<unsigned> failed(0);
+    std::mutex logMutex;
+    auto verify = [&]()
+    {
+        std::ifstream in(traceName.c_str(), std::ios::binary);
+        std::vector<char> buf;
+        for (size_t i = next++; i < mChecksums.size(); i = next++)
+        {
+            const uint64_t pos = mChunks[i].filePos;
+            // the chunk must end where the next one starts, which also catches a cut off file
+            const uint64_t end = i + 1 < mChunks.size() ? mChunks[i + 1].filePos : size;
+            uint32_t prefix = 0;
+            in.seekg(pos, std::ios_base::beg);
+            in.read((char*)&prefix, sizeof(prefix));
+            const uint64_t length = chunkPrefixLength(prefix);
+            const char* problem = nullptr;
+            if (in.fail() || pos + 4 + length > end || (i + 1 < mChunks.size() && pos + 4 + length != end))
+            {
+                problem = "has a broken length";
+            }
+            else
+            {
+                buf.resize(length);
+                in.read(buf.data(), buf.size());
+                if (in.fail())
+                {
+                    problem = "is cut off";
+                }
+                else if (chunkChecksum(buf.data(), buf.size(), chunkChecksum((const char*)&prefix, sizeof(prefix))) != mChecksums[i])
+                {
+                    problem = "does not match its checksum";
+                }
+            }
+            if (problem)
+            {
+                in.clear();
+                failed++;
+                std::lock_guard<std::mutex> lock(logMutex);
+                DBG_LOG("Chunk %u at offset %llu of %s %s\n", (unsigned)i, (unsigned long long)pos, traceName.c_str(), problem);
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++)
+    {
+        workers.emplace_back(verify);
+    }
+    verify();
+    for (std::thread& t : workers)
+    {
+        t.join();
+    }
+    return failed;
+}
+
+}
@@ -0,0 +1,80 @@
+#ifndef _COMMON_TRACE_INDEX_HPP_
+#define _COMMON_TRACE_INDEX_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace common {
+
+/// Seek index for a .pat file, kept in a sidecar file next to the trace (see pathFor()), or in
+/// the frame table the tracer stores in the trace itself (see BFrameTableFooter).
+///
+/// Positions are given in the decompressed call stream, where position 0 is the first byte
+/// of the first chunk (the signature book). In a .ra file the call stream immediately follows
+/// the headers, so the same positions work there too. The chunk table maps stream positions
+/// back to compressed chunks, which never split a call.
+class TraceIndex
+{
+public:
+    struct Chunk
+    {
+        uint64_t filePos; ///< file offset of the chunk's 4 byte length prefix
+        uint64_t streamPos; ///< stream position of the chunk's first byte
+    };
+
+    struct Frame
+    {
+        uint64_t streamPos; ///< stream position of the frame's first call
+        uint64_t bytes; ///< size of the frame's calls in the stream
+        uint32_t firstCall;
+        uint32_t callCount;
+    };
+
+    static std::string pathFor(const std::string& traceName) { return traceName + ".idx"; }
+
+    /// Load the index belonging to the given trace, from its sidecar file or else from the
+    /// frame table in the trace. Fails if there is neither, or if the sidecar file does not match
+    /// the trace (different file size or hash, see hashFile()).
+    bool load(const std::string& traceName);
+    bool save(const std::string& traceName) const;
+
+    /// Load the frame table the tracer stored in the trace, which needs no further checks since
+    /// it comes with the trace. Fails if there is none.
+    bool loadFromTrace(const std::string& traceName);
+    /// The chunk and frame tables, in the form they are stored in a trace
+    void writeTable(std::vector<char>& out) const;
+    bool readTable(const char* data, size_t size);
+
+    /// Fill the chunk table by walking the chunk length prefixes of the trace. This only
+    /// reads the start of each chunk, so it is cheap compared to decompressing the file.
+    bool scanChunks(const std::string& traceName);
+
+    /// Find the chunk holding the given stream position, or nullptr.
+    const Chunk* findChunk(uint64_t streamPos) const;
+
+    /// Check every chunk against its checksum, reading the chunks on the given number of threads,
+    /// 0 for one per core. Needs the checksums of a table loaded with loadFromTrace(). Returns
+    /// the number of chunks that fail, each of which is logged.
+    unsigned verifyChunks(const std::string& traceName, int threads = 0) const;
+
+    /// Hash of the first and last 64 KiB of the trace, which hold the header and the end of
+    /// the call stream. Hashing all of a multi-gigabyte trace would take about as long as
+    /// indexing it again.
+    static uint64_t hashFile(const std::string& traceName, uint64_t size);
+
+    uint64_t mTraceSize = 0;
+    uint64_t mTraceHash = 0;
+    std::vector<Chunk> mChunks;
+    std::vector<Frame> mFrames;
+    /// CRC32C of each chunk, see chunkChecksum(), if the trace was written with them. They are
+    /// only stored in the trace, never in the sidecar file.
+    std::vector<uint32_t> mChecksums;
+
+private:
+    bool loadSidecar(const std::string& traceName);
+};
+
+}
+
+#endif
@@ -3,11 +3,16 @@
 #include <common/parse_api.hpp>
 #include <common/api_info.hpp>
 #include <common/file_format.hpp>
+#include <common/trace_index.hpp>
 
 #include <eglstate/common.hpp>
 
 #include <GLES3/gl32.h>
 #include <cmath>
+#include <cstdio>
+#include <stdint.h>
+#include <stdlib.h>
+#include <type_traits>
 #include <vector>
 #include <list>
 #include <string>
@@ -109,6 +114,7 @@ void ValueTM::CopyFrom(const ValueTM &other)
         mBlobLen = other.mBlobLen;
         mBlob = new char[mBlobLen];
         memcpy(mBlob, other.mBlob, mBlobLen);
+        mBlobExternal = other.mBlobExternal;
     }
     else if (other.mType == Array_Type)
     {
@@ -155,9 +161,12 @@ void ValueTM::Reset()
 {
     switch (mType) {
     case Blob_Type:
-        delete [] mBlob;
+        if (!mBlobBorrowed)
+            delete [] mBlob;
         mBlob = NULL;
         mBlobLen = 0;
+        mBlobBorrowed = false;
+        mBlobExternal = nullptr;
         break;
     case Array_Type:
         delete [] mArray;
@@ -181,7 +190,7 @@ void ValueTM::Reset()
         break;
     };
     mType = Void_Type;
-    mName = std::string();
+    mName.clear();
 }
 
 bool ValueTM::IsVoid() const
@@ -479,7 +488,8 @@ void ValueTM::SetAsBlob(const std::string & value)
 {
     if (mType == Opaque_Type && mOpaqueType == BlobType)
     {
-        delete [] mOpaqueIns->mBlob;
+        mOpaqueIns->Reset();
+        mOpaqueIns->mType = Blob_Type;
         mOpaqueIns->mBlob = NULL;
         mOpaqueIns->mBlobLen = 0;
         if (value.size())
@@ -578,174 +588,261 @@ void ValueTM::ResizeArray(unsigned int size)
 
 std::string ValueTM::ToStr(const CallTM *call, int maxLen)
 {
-    std::stringstream sstream;
+    std::string str;
+    AppendStr(str, call, maxLen);
+    return str;
+}
 
-    if (mName.size())
-        sstream<<mName<<"=";
+std::string ValueTM::ToC(const CallTM *call, bool asSourceCode)
+{
+    std::string str;
+    AppendC(str, call, asSourceCode);
+    return str;
+}
 
-    sstream << ToC(call, false);
+namespace
+{
 
-    if (maxLen != 0 && int(sstream.str().length()) > maxLen)
-        return sstream.str().substr(0, maxLen)+"...";
+template <typename T>
+void appendUnsigned(std::string& out, T value)
+{
+    char buffer[24];
+    char *end = buffer + sizeof(buffer);
+    char *p = end;
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    out.append(p, end);
+}
+
+template <typename T>
+void appendSigned(std::string& out, T value)
+{
+    typedef typename std::make_unsigned<T>::type U;
+    if (value < 0)
+    {
+        out += '-';
+        appendUnsigned(out, U(U(0) - U(value)));
+    }
     else
-        return sstream.str();
+    {
+        appendUnsigned(out, U(value));
+    }
 }
 
-std::string ValueTM::ToC(const CallTM *call, bool asSourceCode)
+void appendHex(std::string& out, unsigned long long value, bool upper)
 {
-    const std::string &funcName = call->mCallName;
-    std::stringstream sstream;
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char buffer[16];
+    char *end = buffer + sizeof(buffer);
+    char *p = end;
+    do
+    {
+        *--p = digits[value & 0xf];
+        value >>= 4;
+    } while (value);
+    out += "0x";
+    out.append(p, end);
+}
 
-    const char * enumTmp = NULL;
-    std::string strTmp;
+// the same as streaming the float
+void appendFloat(std::string& out, float value)
+{
+    char buffer[32];
+    const int len = snprintf(buffer, sizeof(buffer), "%g", value);
+    out.append(buffer, std::max(0, std::min(len, int(sizeof(buffer)) - 1)));
+}
+
+bool isTexParameterLevel(GLenum pname)
+{
+    return pname == GL_TEXTURE_MAX_LOD || pname == GL_TEXTURE_MIN_LOD || pname == GL_TEXTURE_BASE_LEVEL
+        || pname == GL_TEXTURE_MAX_LEVEL;
+}
+
+}
+
+void ValueTM::AppendStr(std::string& out, const CallTM *call, int maxLen) const
+{
+    const size_t start = out.size();
+
+    if (mName.size())
+    {
+        out += mName;
+        out += '=';
+    }
+
+    AppendC(out, call, false);
+
+    if (maxLen != 0 && out.size() - start > size_t(maxLen))
+    {
+        out.resize(start + maxLen);
+        out += "...";
+    }
+}
+
+void ValueTM::AppendC(std::string& out, const CallTM *call, bool asSourceCode) const
+{
+    const std::string &funcName = call->mCallName;
 
     switch (mType) {
     case Void_Type:
-        return "void";
+        out += "void";
+        break;
     case Int8_Type:
-        sstream<<(int)mInt8;
+        appendSigned(out, (int)mInt8);
         break;
     case Int_Type:
         if (funcName == "glSamplerParameteri" || funcName == "glTexParameteri" ||
             funcName == "glTexEnvx" || funcName == "glTexParameterx") // special case this
         {
-            GLenum pname = call->mArgs[1]->GetAsUInt();
-            if (pname != GL_TEXTURE_MAX_LOD && pname != GL_TEXTURE_MIN_LOD && pname != GL_TEXTURE_BASE_LEVEL
-                && pname != GL_TEXTURE_MAX_LEVEL)
+            if (!isTexParameterLevel(call->mArgs[1]->GetAsUInt()))
             {
                 const char *str = EnumString(mInt, funcName);
                 if (str)
                 {
-                    sstream << str;
-                    return sstream.str();
+                    out += str;
+                    break;
                 }
             }
         }
-        sstream<<mInt;
+        appendSigned(out, mInt);
         break;
     case Int64_Type:
-        sstream<<mInt64;
+        appendSigned(out, mInt64);
         break;
     case Uint64_Type:
-        sstream<<mUint64;
+        appendUnsigned(out, mUint64);
         break;
     case Int16_Type:
-        sstream<<mInt16;
+        appendSigned(out, mInt16);
         break;
     case Uint16_Type:
-        sstream<<mUint16;
+        appendUnsigned(out, mUint16);
         break;
     case Uint8_Type:
-        sstream<<(int)mUint8;
-        if (asSourceCode) sstream<<'u';
+        appendUnsigned(out, (unsigned)mUint8);
+        if (asSourceCode) out += 'u';
         break;
     case Uint_Type:
         if (funcName == "glClear")          // special case
         {
-            sstream << std::hex << "0x" << mUint << "=(";
-            bool firstEnum = true;
-            if (mUint & GL_COLOR_BUFFER_BIT)
+            appendHex(out, mUint, false);
+            out += "=(";
+            const char *separator = "";
+            unsigned int rest = mUint;
+            if (rest & GL_COLOR_BUFFER_BIT)
             {
-                firstEnum = false;
-                sstream << "GL_COLOR_BUFFER_BIT";
-                mUint -= GL_COLOR_BUFFER_BIT;
+                out += "GL_COLOR_BUFFER_BIT";
+                separator = " | ";
+                rest -= GL_COLOR_BUFFER_BIT;
             }
-            if (mUint & GL_DEPTH_BUFFER_BIT)
+            if (rest & GL_DEPTH_BUFFER_BIT)
             {
-                if (!firstEnum)
-                    sstream << " | ";
-                firstEnum = false;
-                sstream << "GL_DEPTH_BUFFER_BIT";
-                mUint -= GL_DEPTH_BUFFER_BIT;
+                out += separator;
+                out += "GL_DEPTH_BUFFER_BIT";
+                separator = " | ";
+                rest -= GL_DEPTH_BUFFER_BIT;
             }
-            if (mUint & GL_STENCIL_BUFFER_BIT)
+            if (rest & GL_STENCIL_BUFFER_BIT)
             {
-                if (!firstEnum)
-                    sstream << " | ";
-                firstEnum = false;
-                sstream << "GL_STENCIL_BUFFER_BIT";
-                mUint -= GL_STENCIL_BUFFER_BIT;
+                out += separator;
+                out += "GL_STENCIL_BUFFER_BIT";
+                separator = " | ";
+                rest -= GL_STENCIL_BUFFER_BIT;
             }
-            if (mUint)      // still some other bits, problematic
+            if (rest)      // still some other bits, problematic
             {
-                if (!firstEnum)
-                    sstream << " | ";
-                firstEnum = false;
-                sstream << std::hex << "0x" << mUint;
+                out += separator;
+                appendHex(out, rest, false);
             }
-            sstream << ")";
+            out += ")";
         }
         else
         {
-            sstream<<mUint;
-            if (asSourceCode) sstream<<'u';
+            appendUnsigned(out, mUint);
+            if (asSourceCode) out += 'u';
         }
         break;
     case Enum_Type:
-        enumTmp = EnumString(mEnum, funcName);
-        if (enumTmp == NULL) {
-            sstream << "0x" << std::hex << std::uppercase << mEnum;
-            //DBG_LOG("enum %s in %s not found\n", sstream.str().c_str(), funcName.c_str());
-        } else {
-            sstream<<enumTmp;
+        if (const char *str = EnumString(mEnum, funcName))
+        {
+            out += str;
+        }
+        else
+        {
+            appendHex(out, mEnum, true);
         }
         break;
     case Float_Type:
         if (funcName == "glSamplerParameterf" || funcName == "glTexParameterf") // special case this
         {
-            GLenum pname = call->mArgs[1]->GetAsUInt();
-            if (pname != GL_TEXTURE_MAX_LOD && pname != GL_TEXTURE_MIN_LOD && pname != GL_TEXTURE_BASE_LEVEL
-                && pname != GL_TEXTURE_MAX_LEVEL)
+            if (!isTexParameterLevel(call->mArgs[1]->GetAsUInt()))
             {
-                sstream << EnumString(mFloat, funcName);
-                return sstream.str();
+                if (const char *str = EnumString(mFloat, funcName))
+                {
+                    out += str;
+                }
+                break;
             }
         }
-        if (asSourceCode){
-            // check float is not NaN or inf
-            if( std::isfinite(mFloat)) {
-                sstream<<mFloat;
-            } else {
-                sstream<<-1; // could define a special "bad float" variable, but, just output -1 for now.
-            }
-        } else{
-            sstream<<mFloat;
+        // check float is not NaN or inf
+        if (asSourceCode && !std::isfinite(mFloat))
+        {
+            out += "-1"; // could define a special "bad float" variable, but, just output -1 for now.
+        }
+        else
+        {
+            appendFloat(out, mFloat);
         }
         break;
     case String_Type:
-        strTmp = std::string(mStr);
-        replaceString(strTmp, "\"", "\\\""); // escape quotes
-        sstream << "\"" << strTmp << "\""; //surround with quotes
+        out += '"'; // surround with quotes
+        for (char c : mStr)
+        {
+            if (c == '"') out += '\\'; // escape quotes
+            out += c;
+        }
+        out += '"';
         break;
     case Array_Type:
         if (mArrayLen) {
-            sstream << "{";
-            for (unsigned int i = 0; i < mArrayLen-1; ++i) {
-                sstream << mArray[i].ToC(call) << ", ";
+            out += '{';
+            for (unsigned int i = 0; i < mArrayLen; ++i) {
+                if (i) out += ", ";
+                mArray[i].AppendC(out, call);
             }
-            sstream << mArray[mArrayLen-1].ToC(call);
-            sstream << "}";
-        } else if (mArrayLen == 0) {
-            sstream<<"NULL";
+            out += '}';
         } else {
-            sstream<<"badptr";
+            out += "NULL";
         }
         break;
     case MemRef_Type:
-        sstream<<mClientSideBufferName<<" + "<<mClientSideBufferOffset;
+        appendUnsigned(out, mClientSideBufferName);
+        out += " + ";
+        appendUnsigned(out, mClientSideBufferOffset);
         break;
     case Opaque_Type:
         // output an enum, the struct containing Opaque variables must be declared before call is output as c-code
         switch (mOpaqueType)
         {
             case BufferObjectReferenceType:
-                sstream << "common::BufferObjectReferenceType/*" << mOpaqueIns->mUint << "*/";
+                out += "common::BufferObjectReferenceType/*";
+                appendUnsigned(out, mOpaqueIns->mUint);
+                out += "*/";
                 break;
             case BlobType:
-                sstream << "common::BlobType/*BlobSize:" << mOpaqueIns->mBlobLen << "*/";
+                out += "common::BlobType/*BlobSize:";
+                appendUnsigned(out, mOpaqueIns->mBlobLen);
+                out += "*/";
                 break;
             case ClientSideBufferObjectReferenceType:
-                sstream << "common::ClientSideBufferObjectReferenceType(" << mOpaqueIns->mClientSideBufferName << ", " << mOpaqueIns->mClientSideBufferOffset << ")";
+                out += "common::ClientSideBufferObjectReferenceType(";
+                appendUnsigned(out, mOpaqueIns->mClientSideBufferName);
+                out += ", ";
+                appendUnsigned(out, mOpaqueIns->mClientSideBufferOffset);
+                out += ")";
                 break;
             case NoopType:
                 break;
@@ -753,25 +850,30 @@ std::string ValueTM::ToC(const CallTM *call, bool asSourceCode)
         break;
     case Pointer_Type:
         if (mPointer)
-            sstream << mPointer->ToStr(call);
+            mPointer->AppendStr(out, call);
         else
-            sstream<<"NULL";
+            out += "NULL";
         break;
     case Unused_Pointer_Type:
-        sstream << mUnusedPointer;
+        // as streamed
+        if (mUnusedPointer)
+            appendHex(out, reinterpret_cast<uintptr_t>(mUnusedPointer), false);
+        else
+            out += '0';
         break;
     case Blob_Type:
         if (mBlobLen) {
-            if (asSourceCode) {sstream << "(GLubyte*)";}
-            sstream << "_binary_blob_" << mId << "_bin_start";
-            sstream << "/*BlobSize" << mBlobLen << "*/";
+            if (asSourceCode) out += "(GLubyte*)";
+            out += "_binary_blob_";
+            appendUnsigned(out, mId);
+            out += "_bin_start/*BlobSize";
+            appendUnsigned(out, mBlobLen);
+            out += "*/";
         } else {
-            sstream << "NULL";
+            out += "NULL";
         }
         break;
     };
-
-    return sstream.str();
 }
 
 
@@ -878,7 +980,10 @@ char* ValueTM::Serialize(char* dest, bool doPadding)
         }
         break;
     case Blob_Type:
-        dest = Write1DArray<char>(dest, mBlobLen, mBlob);
+        if (mBlobExternal)
+            dest = WriteBlobExternal(dest, mBlobLen, mBlobExternal);
+        else
+            dest = Write1DArray<char>(dest, mBlobLen, mBlob);
         break;
     case Opaque_Type:
         dest = WriteFixed<unsigned int>(dest, mOpaqueType);
@@ -904,6 +1009,58 @@ char* ValueTM::Serialize(char* dest, bool doPadding)
     return dest;
 }
 
+static inline size_t padded(size_t size)
+{
+    return (size + 3) & ~size_t(3);
+}
+
+size_t ValueTM::SerializedSize(bool doPadding) const
+{
+    switch (mType) {
+    case Int8_Type:
+    case Int_Type:
+    case Uint8_Type:
+    case Uint_Type:
+    case Int16_Type:
+    case Uint16_Type:
+    case Int64_Type:
+    case Uint64_Type:
+    case Enum_Type:
+    case Float_Type:
+        return doPadding ? padded(gValueTypeSize[mType]) : gValueTypeSize[mType];
+    case String_Type:
+        return sizeof(unsigned int) + padded(strlen(mStr.c_str()) + 1);
+    case Array_Type:
+        if (mEleType != String_Type) {
+            size_t size = 0;
+            for (unsigned int i = 0; i < mArrayLen; ++i)
+                size += mArray[i].SerializedSize(false);
+            return sizeof(unsigned int) + padded(size);
+        } else {
+            size_t size = sizeof(unsigned int);
+            if (mArrayLen > 0)
+                size += (mArrayLen + 1) * sizeof(unsigned int);
+            for (unsigned int i = 0; i < mArrayLen; ++i)
+                size += sizeof(unsigned int) + padded(strlen(mArray[i].mStr.c_str()) + 1);
+            return size;
+        }
+    case Blob_Type:
+        if (mBlobExternal)
+            return BLOB_EXTERNAL_SIZE;
+        return sizeof(unsigned int) + (mBlob ? padded(mBlobLen) : 0);
+    case Opaque_Type:
+        return sizeof(unsigned int) + (mOpaqueIns ? mOpaqueIns->SerializedSize(true) : 0);
+    case Pointer_Type:
+        return sizeof(unsigned int) + (mPointer ? mPointer->SerializedSize(true) : 0);
+    case Unused_Pointer_Type:
+        return doPadding ? padded(sizeof(void*)) : sizeof(void*);
+    case MemRef_Type:
+        return sizeof(mClientSideBufferName) + sizeof(mClientSideBufferOffset);
+    default:
+        return 0;
+    };
+}
+
 ValueTM* CreateEnumValue(unsigned int value)
 {
     ValueTM *enum_value = new ValueTM;
@@ -1032,15 +1189,47 @@ CallTM::CallTM(InFileRA &infile, unsigned callNo, const BCall_vlen &call)
 }
 
 CallTM::CallTM(InFile &infile, unsigned callNo, const BCall_vlen &call)
- : mCallNo(callNo), mTid(call.tid), mCallId(call.funcId), mBkColor(0xffffffff), mTxtColor(0x000000ff)
 {
-    const std::string name = infile.ExIdToName(mCallId);
-    const void *fptr = parse_callbacks.at(name);
+    Reload(infile, callNo, call);
+}
+
+void CallTM::Reload(InFile &infile, unsigned callNo, const BCall_vlen &call, bool borrowBlobs)
+{
+    ClearArguments();
+    mRet.Reset();
+    mRet.mStr.clear();
     mRet.mName = "ret";
+    mCallNo = callNo;
+    mTid = call.tid;
+    mCallId = call.funcId;
     mCallErrNo = static_cast<CALL_ERROR_NO>(call.errNo);
+    mBkColor = 0xffffffff;
+    mTxtColor = 0x000000ff;
     mReadPos = 0;
+    const void *fptr = parse_callbacks.at(infile.ExIdToName(mCallId));
     char *src = infile.dataPointer();
+    mBorrowBlobs = borrowBlobs;
     (*(ParseFunc)fptr)(src, *this, infile);
+    mBorrowBlobs = false;
+}
+
+ValueTM* CallTM::AddArg(const char *name)
+{
+    ValueTM *value = NULL;
+    if (mSpareArgs.empty())
+    {
+        value = new ValueTM;
+    }
+    else
+    {
+        value = mSpareArgs.back();
+        mSpareArgs.pop_back();
+        value->mStr.clear();
+        value->mId = 0;
+    }
+    value->mName = name;
+    mArgs.push_back(value);
+    return value;
 }
 
 bool CallTM::Load(InFileRA *infile)
@@ -1049,6 +1238,12 @@ bool CallTM::Load(InFileRA *infile)
     common::BCall_vlen curCall;
     char *src = nullptr;
 
+    // the call may be reused, see Reload()
+    ClearArguments();
+    mRet.Reset();
+    mRet.mStr.clear();
+    mRet.mName = "ret";
+
     mReadPos = infile->GetReadPos();
     if (!infile->GetNextCall(fptr, curCall, src)) {
         DBG_LOG("File inconsistent!\n");
@@ -1074,36 +1269,43 @@ bool CallTM::Load(InFileRA *infile)
 
 std::string CallTM::ToStr(bool isAbbreviate)
 {
-    std::string strArgs;
+    std::string str;
+    AppendStr(str, isAbbreviate);
+    return str;
+}
+
+void CallTM::AppendStr(std::string& out, bool isAbbreviate) const
+{
+    const int maxLen = isAbbreviate ? 32 : 0;
+    mRet.AppendStr(out, this, maxLen);
+    out += ' ';
+    out += mCallName;
+    out += '(';
     for (unsigned int i = 0; i < mArgs.size(); ++i) {
-        strArgs += mArgs[i]->ToStr(this, isAbbreviate ? 32 : 0);
-        if (i != mArgs.size()-1)
-            strArgs += ", ";
+        if (i) out += ", ";
+        mArgs[i]->AppendStr(out, this, maxLen);
     }
+    out += ')';
 
-    std::string strErr;
-    if (mCallErrNo != CALL_GL_NO_ERROR) {
-        switch (mCallErrNo) {
-        case CALL_GL_INVALID_ENUM:
-            strErr = " ERR: GL_INVALID_ENUM";
-            break;
-        case CALL_GL_INVALID_VALUE:
-            strErr = " ERR: GL_INVALID_VALUE";
-            break;
-        case CALL_GL_INVALID_OPERATION:
-            strErr = " ERR: GL_INVALID_OPERATION";
-            break;
-        case CALL_GL_INVALID_FRAMEBUFFER_OPERATION:
-            strErr = " ERR: GL_INVALID_FRAMEBUFFER_OPERATION";
-            break;
-        case CALL_GL_OUT_OF_MEMORY:
-            strErr = " ERR: GL_OUT_OF_MEMORY";
-            break;
-        default:
-            break;
-        }
+    switch (mCallErrNo) {
+    case CALL_GL_INVALID_ENUM:
+        out += " ERR: GL_INVALID_ENUM";
+        break;
+    case CALL_GL_INVALID_VALUE:
+        out += " ERR: GL_INVALID_VALUE";
+        break;
+    case CALL_GL_INVALID_OPERATION:
+        out += " ERR: GL_INVALID_OPERATION";
+        break;
+    case CALL_GL_INVALID_FRAMEBUFFER_OPERATION:
+        out += " ERR: GL_INVALID_FRAMEBUFFER_OPERATION";
+        break;
+    case CALL_GL_OUT_OF_MEMORY:
+        out += " ERR: GL_OUT_OF_MEMORY";
+        break;
+    default:
+        break;
     }
-    return mRet.ToStr(this, isAbbreviate ? 32 : 0) + " " + mCallName + "(" + strArgs + ")" + strErr;
 }
 
 char* CallTM::Serialize(char* dest, int overrideID)
@@ -1148,6 +1350,43 @@ char* CallTM::Serialize(char* dest, int overrideID)
     return dest;
 }
 
+size_t CallTM::SerializedSize() const
+{
+    if (mCallId == 0)
+        return 0;
+
+    size_t size = gApiInfo.IdToLenArr[mCallId] ? sizeof(BCall) : sizeof(BCall_vlen);
+    for (unsigned int i = 0; i < mArgs.size(); ++i)
+        size += mArgs[i]->SerializedSize(true);
+    if (mRet.mType != Void_Type)
+        size += mRet.SerializedSize(true);
+    return size;
+}
+
+void CallTM::Serialize(OutFile& out, int overrideID)
+{
+    // A call is never split between chunks, so one larger than a chunk gets a chunk of its own
+    const size_t size = SerializedSize();
+    char* dest = out.Claim(size);
+    if (!dest)
+        return;
+    if (PTR_OFFSET(dest, 4) != 0)
+    {
+        // padding is relative to the address, so go through an aligned buffer instead
+        std::vector<char> buffer(size);
+        char* end = Serialize(buffer.data(), overrideID);
+        out.Write(buffer.data(), end - buffer.data());
+        return;
+    }
+    char* end = Serialize(dest, overrideID);
+    if ((size_t)(end - dest) != size)
+    {
+        DBG_LOG("Call %s serialized to %d bytes instead of %d\n", mCallName.c_str(), (int)(end - dest), (int)size);
+        os::abort();
+    }
+    out.Commit(end);
+}
+
 void CallTM::Stylize()
 {
     static const string strDraw = "glDraw";
@@ -1376,7 +1615,8 @@ TraceFileTM::TraceFileTM()
   mCurFrameIndex(0),
   mCurCallIndexInFrame(0),
   mLoadQueryCalls(false),
-  mLoadFilterStr(DEFAULT_LOAD_FILTER_STRING)
+  mLoadFilterStr(DEFAULT_LOAD_FILTER_STRING),
+  mStopIndexing(false)
 {
 }
 
@@ -1388,6 +1628,7 @@ TraceFileTM::~TraceFileTM() {
 
 void TraceFileTM::Close()
 {
+    StopIndexing();
     mpInFileRA->Close();
 }
 
@@ -1396,16 +1637,74 @@ TraceFileTM::TraceFileTM(const char *name, bool readHeaderAndExit)
   mCurFrameIndex(0),
   mCurCallIndexInFrame(0),
   mLoadQueryCalls(false),
-  mLoadFilterStr(DEFAULT_LOAD_FILTER_STRING)
+  mLoadFilterStr(DEFAULT_LOAD_FILTER_STRING),
+  mStopIndexing(false)
 {
     Open(name, readHeaderAndExit);
 }
 
 void TraceFileTM::Clear()
 {
+    StopIndexing();
     for (unsigned int i = 0; i < mFrames.size(); ++i)
         delete mFrames[i];
     mFrames.clear();
+    mLoadedFrames.clear();
+    mCurFrameIndex = 0;
+    mCurCallIndexInFrame = 0;
+}
+
+void TraceFileTM::StopIndexing()
+{
+    if (mIndexThread.joinable())
+    {
+        mStopIndexing = true;
+        mIndexThread.join();
+        mStopIndexing = false;
+    }
+}
+
+void TraceFileTM::AddFrame(FrameTM* frame)
+{
+    std::lock_guard<std::mutex> lock(mFramesMutex);
+    mFrames.push_back(frame);
+    mFramesCond.notify_all();
+}
+
+FrameTM* TraceFileTM::GetFrame(unsigned int frameIndex) const
+{
+    std::unique_lock<std::mutex> lock(mFramesMutex);
+    mFramesCond.wait(lock, [this, frameIndex]{ return frameIndex < mFrames.size() || mIndexComplete; });
+    return frameIndex < mFrames.size() ? mFrames[frameIndex] : NULL;
+}
+
+bool TraceFileTM::IsIndexComplete() const
+{
+    std::lock_guard<std::mutex> lock(mFramesMutex);
+    return mIndexComplete;
+}
+
+void TraceFileTM::WaitForIndex() const
+{
+    std::unique_lock<std::mutex> lock(mFramesMutex);
+    mFramesCond.wait(lock, [this]{ return mIndexComplete; });
+}
+
+FrameTM* TraceFileTM::LoadFrame(unsigned int frameIndex)
+{
+    FrameTM* frame = GetFrame(frameIndex);
+    if (!frame)
+        return NULL;
+
+    mLoadedFrames.remove(frameIndex);
+    mLoadedFrames.push_front(frameIndex);
+    frame->LoadCalls(mpInFileRA, mLoadQueryCalls, mLoadFilterStr);
+    while (mLoadedFrameLimit > 0 && mLoadedFrames.size() > mLoadedFrameLimit)
+    {
+        GetFrame(mLoadedFrames.back())->UnloadCalls();
+        mLoadedFrames.pop_back();
+    }
+    return frame;
 }
 
 bool TraceFileTM::Open(const char* name, bool readHeaderAndExit, const std::string& ra_target)
@@ -1426,8 +1725,51 @@ bool TraceFileTM::Open(const char* name, bool readHeaderAndExit, const std::stri
     if (readHeaderAndExit)
         return true;
 
-    unsigned short eglSwapBuffers_id = mpInFileRA->NameToExId("eglSwapBuffers");
-    unsigned short eglSwapBuffersWithDamage_id = mpInFileRA->NameToExId("eglSwapBuffersWithDamageKHR");
+    // Use the seek index if the trace has one, which saves us from scanning every call.
+    // A .ra file is never indexed itself, only the .pat it was made from.
+    const std::string traceName = name;
+    const bool indexable = traceName.size() < 3 || traceName.compare(traceName.size() - 3, 3, ".ra") != 0;
+    TraceIndex index;
+    if (indexable && index.load(traceName) && !index.mFrames.empty())
+    {
+        for (const TraceIndex::Frame& f : index.mFrames)
+        {
+            FrameTM* frame = new FrameTM;
+            frame->mReadPos = mpInFileRA->GetDataBegin() + f.streamPos;
+            frame->mFirstCallOfThisFrame = f.firstCall;
+            frame->SetCallCount(f.callCount);
+            frame->mBytes = f.bytes;
+            mFrames.push_back(frame);
+        }
+        return true;
+    }
+
+    if (!mBackgroundIndexing || !ra_target.empty())
+    {
+        ScanFrames(*mpInFileRA, traceName, indexable);
+        return true;
+    }
+
+    // The scan reads the trace through a file of its own, so that frames that are already
+    // indexed can be loaded meanwhile
+    mIndexComplete = false;
+    mIndexThread = std::thread([this, traceName, indexable]() {
+        InFileRA in;
+        if (in.Open(traceName.c_str()))
+        {
+            ScanFrames(in, traceName, indexable);
+        }
+        std::lock_guard<std::mutex> lock(mFramesMutex);
+        mIndexComplete = true;
+        mFramesCond.notify_all();
+    });
+    return true;
+}
+
+void TraceFileTM::ScanFrames(InFileRA& in, const std::string& traceName, bool indexable)
+{
+    unsigned short eglSwapBuffers_id = in.NameToExId("eglSwapBuffers");
+    unsigned short eglSwapBuffersWithDamage_id = in.NameToExId("eglSwapBuffersWithDamageKHR");
 
     void *fptr = nullptr;
     common::BCall_vlen curCall;
@@ -1435,14 +1777,14 @@ bool TraceFileTM::Open(const char* name, bool readHeaderAndExit, const std::stri
     unsigned callNo = 0;
 
     FrameTM*            newFrame = new FrameTM;
-    newFrame->mReadPos = mpInFileRA->GetReadPos();
+    newFrame->mReadPos = in.GetReadPos();
     newFrame->mFirstCallOfThisFrame = 0;
-    const int tid = mpInFileRA->getDefaultThreadID();
+    const int tid = in.getDefaultThreadID();
 
     std::streamoff lastReadPos = 0;
 
     // scan file for every single call, divide into frames
-    while (mpInFileRA->GetNextCall(fptr, curCall, src))
+    while (in.GetNextCall(fptr, curCall, src))
     {
         // separate into frames according to eglSwapBuffers or
         // eglDestroySurface call of retraced thread
@@ -1450,17 +1792,23 @@ bool TraceFileTM::Open(const char* name, bool readHeaderAndExit, const std::stri
             (curCall.funcId == eglSwapBuffers_id ||
              curCall.funcId == eglSwapBuffersWithDamage_id)) {
                 newFrame->SetCallCount(callNo-newFrame->mFirstCallOfThisFrame+1);
-                newFrame->mBytes = mpInFileRA->GetReadPos() - newFrame->mReadPos;
-                mFrames.push_back(newFrame);
+                newFrame->mBytes = in.GetReadPos() - newFrame->mReadPos;
+                AddFrame(newFrame);
 
                 newFrame = new FrameTM;
-                newFrame->mReadPos = mpInFileRA->GetReadPos();
+                newFrame->mReadPos = in.GetReadPos();
                 newFrame->mFirstCallOfThisFrame = callNo+1;
         }
 
         // Save the position after each successful call reading
-        lastReadPos = mpInFileRA->GetReadPos();
+        lastReadPos = in.GetReadPos();
         callNo++;
+
+        if (mStopIndexing)
+        {
+            delete newFrame;
+            return;
+        }
     }
 
     // if current created frame is valid calculate number of calls and megabytes of calls in it.
@@ -1468,7 +1816,7 @@ bool TraceFileTM::Open(const char* name, bool readHeaderAndExit, const std::stri
     {
         newFrame->SetCallCount(callNo-newFrame->mFirstCallOfThisFrame);
         newFrame->mBytes = lastReadPos - newFrame->mReadPos;
-        mFrames.push_back(newFrame);
+        AddFrame(newFrame);
     }
     else // frame contains zero calls?
     {
@@ -1476,15 +1824,29 @@ bool TraceFileTM::Open(const char* name, bool readHeaderAndExit, const std::stri
         newFrame = 0x0;
     }
 
-    return true;
+    TraceIndex index;
+    // only on request, since the trace may be in a directory that is not ours
+    const bool writeIndex = getenv("PATRACE_TRACE_INDEX") != NULL;
+    if (indexable && writeIndex && index.scanChunks(traceName))
+    {
+        for (const FrameTM* frame : mFrames)
+        {
+            index.mFrames.push_back({ (uint64_t)(frame->mReadPos - in.GetDataBegin()), frame->mBytes,
+                                      frame->mFirstCallOfThisFrame, frame->GetCallCount() });
+        }
+        if (index.save(traceName))
+        {
+            DBG_LOG("Wrote trace index %s\n", TraceIndex::pathFor(traceName).c_str());
+        }
+    }
 }
 
 CallTM *TraceFileTM::NextCall() const
 {
-    if (mFrames.size() == 0)
+    FrameTM *curFrame = GetFrame(mCurFrameIndex);
+    if (!curFrame)
         return NULL;
 
-    FrameTM *curFrame = mFrames[mCurFrameIndex];
     curFrame->LoadCalls(mpInFileRA);
     if (mCurCallIndexInFrame >= curFrame->GetLoadedCallCount())
     {
@@ -1492,26 +1854,26 @@ CallTM *TraceFileTM::NextCall() const
         mCurCallIndexInFrame = 0;
 
         ++mCurFrameIndex;
-        if (mCurFrameIndex >= mFrames.size())
+        curFrame = GetFrame(mCurFrameIndex);
+        if (!curFrame)
         {
             // reset to the first frame
             mCurFrameIndex = 0;
-            mFrames[mCurFrameIndex]->LoadCalls(mpInFileRA);
+            GetFrame(mCurFrameIndex)->LoadCalls(mpInFileRA);
             return NULL;
         }
 
-        mFrames[mCurFrameIndex]->LoadCalls(mpInFileRA);
-        curFrame = mFrames[mCurFrameIndex];
+        curFrame->LoadCalls(mpInFileRA);
     }
     return curFrame->mCalls[mCurCallIndexInFrame++];
 }
 
 CallTM *TraceFileTM::NextCallInFrame(unsigned int frameIndex) const
 {
-    if (mFrames.size() == 0 || mFrames.size() <= frameIndex)
+    FrameTM *curFrame = GetFrame(frameIndex);
+    if (!curFrame)
         return NULL;
 
-    FrameTM *curFrame = mFrames[frameIndex];
     curFrame->LoadCalls(mpInFileRA);
     if (mCurCallIndexInFrame >= curFrame->GetLoadedCallCount())
     {
@@ -1528,8 +1890,8 @@ unsigned int TraceFileTM::FindNext(unsigned int callNo, const char* name)
     if (fr == -1)
         return callNo;
 
-    for (; fr < int(mFrames.size()); ++fr) {
-        FrameTM& frTM = *mFrames[fr];
+    for (FrameTM* frame; (frame = GetFrame(fr)) != NULL; ++fr) {
+        FrameTM& frTM = *frame;
         bool needToUnload = false;
         if (frTM.IsLoaded() == false)
         {
@@ -1561,7 +1923,7 @@ unsigned int TraceFileTM::FindPrevious(unsigned int callNo, const char* name)
         return callNo;
 
     for (; fr >= 0; --fr) {
-        FrameTM& frTM = *mFrames[fr];
+        FrameTM& frTM = *GetFrame(fr);
         bool needToUnload = false;
         if (frTM.IsLoaded() == false)
         {
@@ -1591,13 +1953,103 @@ unsigned int TraceFileTM::FindPrevious(unsigned int callNo, const char* name)
 
 int TraceFileTM::GetFrameIdx(unsigned int callNo) {
     unsigned int fr = 0;
-    for (; fr < mFrames.size(); ++fr) {
-        FrameTM& frTM = *mFrames[fr];
+    for (FrameTM* frame; (frame = GetFrame(fr)) != NULL; ++fr) {
+        FrameTM& frTM = *frame;
         if (callNo >= frTM.mFirstCallOfThisFrame &&
             callNo < frTM.mFirstCallOfThisFrame + frTM.GetCallCount())
-            break;
+            return fr;
+    }
+    return -1;
+}
+
+// Read position of a call, from that of the frame holding it, or of the end of the last frame
+static bool callReadPos(TraceFileTM& trace, unsigned int callNo, std::streamoff& pos)
+{
+    const int fr = trace.GetFrameIdx(callNo);
+    if (fr < 0)
+    {
+        const FrameTM* last = trace.mFrames.empty() ? NULL : trace.mFrames.back();
+        pos = last ? last->mReadPos + last->mBytes : trace.mpInFileRA->GetDataBegin();
+        return true;
+    }
+    InFileRA& in = *trace.mpInFileRA;
+    in.SetReadPos(trace.mFrames[fr]->mReadPos);
+    const char* data = NULL;
+    unsigned int length = 0;
+    for (unsigned int i = trace.mFrames[fr]->mFirstCallOfThisFrame; i < callNo; ++i)
+    {
+        if (!in.GetNextRawCall(data, length))
+        {
+            return false;
+        }
+    }
+    pos = in.GetReadPos();
+    return true;
+}
+
+CallTM *TraceFileTM::LoadCall(unsigned int callNo)
+{
+    std::streamoff pos = 0;
+    WaitForIndex();
+    if (GetFrameIdx(callNo) < 0 || !callReadPos(*this, callNo, pos))
+    {
+        return NULL;
+    }
+    mpInFileRA->SetReadPos(pos);
+    CallTM *call = new CallTM;
+    if (!call->Load(mpInFileRA))
+    {
+        delete call;
+        return NULL;
+    }
+    call->mCallNo = callNo;
+    return call;
+}
+
+int TraceFileTM::CopyCalls(unsigned int beginCall, unsigned int endCall, OutFile& out)
+{
+    std::streamoff pos = 0, end = 0;
+    if (beginCall >= endCall)
+    {
+        return 0;
+    }
+    WaitForIndex();
+    if (!callReadPos(*this, beginCall, pos) || !callReadPos(*this, endCall, end))
+    {
+        return -1;
+    }
+
+    InFileRA& in = *mpInFileRA;
+    int copied = 0;
+    while (pos < end)
+    {
+        std::streamoff chunkBegin = 0, chunkEnd = 0;
+        const char* data = NULL;
+        size_t size = 0;
+        if (in.GetRawChunk(pos, chunkBegin, chunkEnd, data, size) && chunkBegin == pos && chunkEnd <= end)
+        {
+            out.WriteRawChunk(data, size);
+            pos = chunkEnd;
+            copied++;
+            continue;
+        }
+
+        // Only part of the chunk is in the range, copy its calls one by one up to the end of
+        // the chunk or of the range
+        const std::streamoff stop = (chunkEnd > pos) ? std::min(chunkEnd, end) : end;
+        in.SetReadPos(pos);
+        while (in.GetReadPos() < stop)
+        {
+            unsigned int length = 0;
+            if (!in.GetNextRawCall(data, length))
+            {
+                return -1;
+            }
+            out.Write(data, length);
+        }
+        pos = in.GetReadPos();
     }
-    return (fr == mFrames.size()) ? -1 : fr;
+    return copied;
 }
 
 
@@ -12,11 +12,17 @@
 
 #include <common/in_file_ra.hpp>
 #include <common/in_file_mt.hpp>
+#include <common/out_file.hpp>
 
 #include <string>
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
 
 #define RED_COM(x)      (((x)&0xff000000)>>24)
 #define GREEN_COM(x)    (((x)&0x00ff0000)>>16)
@@ -77,6 +83,8 @@ public:
     // can be string or enum name
     std::string     mStr;   // string
     unsigned int    mId; //used by tracetoc for array and blob id, not saved to file
+    bool            mBlobBorrowed = false; // mBlob points into the chunk it was decoded from, and is not ours to free
+    const unsigned char* mBlobExternal = nullptr; // MD5 of the blob, to be serialized as a reference into an external blob store (see BLOB_STORE_EXTERNAL), not ours to free
 
     union {
         char                    mInt8;
@@ -175,8 +183,14 @@ public:
     // 'maxLen == 0' means no limitation
     std::string ToStr(const CallTM *call, int maxLen=32);
     std::string ToC(const CallTM *call, bool asSourceCode=false);
+    // Like ToStr() and ToC(), but appending to out, which a caller that formats many values
+    // can reuse so that it does not allocate a string for each of them
+    void AppendStr(std::string& out, const CallTM *call, int maxLen=32) const;
+    void AppendC(std::string& out, const CallTM *call, bool asSourceCode=false) const;
     std::string TypeNameToStr();
     char* Serialize(char* dest, bool doPadding);
+    /// Number of bytes Serialize() writes, starting at a 4 byte aligned address
+    size_t SerializedSize(bool doPadding) const;
 
     ValueTM(const ValueTM &other);
     ValueTM &operator =(const ValueTM &other);
@@ -263,14 +277,30 @@ public:
 
     ~CallTM() {
         ClearArguments();
+        for (unsigned int i = 0; i < mSpareArgs.size(); ++i)
+            delete mSpareArgs[i];
     }
 
+    // Decode the call at the read position of infile, reusing the values of the arguments
+    // this call had like Reload() does
     bool Load(InFileRA *infile);
+    // Decode another call into this one. The values of the arguments it had are reused,
+    // along with the memory of their names and strings, so that a tool that decodes one call
+    // after another does not allocate them all anew for every call. With borrowBlobs the
+    // blobs point into the chunk that infile decoded them into instead of being copied, so
+    // they are only valid until infile moves on past the next chunk.
+    void Reload(InFile &infile, unsigned callNo, const BCall_vlen &call, bool borrowBlobs = false);
+    // The cleared values are kept for AddArg() to reuse
     void ClearArguments(unsigned int from = 0) {
         for (unsigned int i = from; i < mArgs.size(); ++i)
-            delete mArgs[i];
+        {
+            mArgs[i]->Reset();
+            mSpareArgs.push_back(mArgs[i]);
+        }
         mArgs.resize(from);
     }
+    // Append an argument value, for the call parsers
+    ValueTM* AddArg(const char *name);
 
     const std::string Name() const { return mCallName; }
 
@@ -287,8 +317,15 @@ public:
     unsigned int            mBkColor;
     unsigned int            mTxtColor;
 
+    bool                    mBorrowBlobs = false; // only while Reload() decodes
+
     std::string ToStr(bool isAbbreviate = true);
+    // Like ToStr(), but appending to out, see ValueTM::AppendStr()
+    void AppendStr(std::string& out, bool isAbbreviate = true) const;
     char* Serialize(char* dest, int overrideID = -1);
+    /// Serialize straight into the chunk buffer of the output file
+    void Serialize(OutFile& out, int overrideID = -1);
+    size_t SerializedSize() const;
     void Stylize();
 
     std::string ToCppCall();
@@ -296,6 +333,8 @@ public:
 private:
     CallTM(const CallTM &);
     CallTM &operator =(const CallTM &);
+
+    std::vector<ValueTM*>   mSpareArgs;
 };
 
 class FrameTM
@@ -354,9 +393,35 @@ public:
     // return -1 if failed to find the corresponding frame
     int GetFrameIdx(unsigned int callNo);
 
+    // Copy the calls [beginCall, endCall) into out as they are stored, without parsing them.
+    // Chunks that lie entirely inside the range are copied still compressed, only the calls
+    // of the chunks at its ends are read out. out must have been opened with the signature
+    // book of this trace (see InFileRA::copySigBook). Returns the number of chunks copied
+    // compressed, or -1 if the calls could not be read.
+    int CopyCalls(unsigned int beginCall, unsigned int endCall, OutFile& out);
+
+    // Decode a single call, reading from the start of the frame holding it and skipping the
+    // calls before it without parsing them. The caller owns the call. Returns NULL if there
+    // is no such call.
+    CallTM *LoadCall(unsigned int callNo);
+
     unsigned int FindNext(unsigned int callNo, const char* name);
     unsigned int FindPrevious(unsigned int callNo, const char* name);
 
+    // Build the frame list on a background thread when the trace has no saved index, so that
+    // Open() returns once the header is read. Frames become available in order through
+    // GetFrame(), while mFrames must not be used before WaitForIndex(). Call before Open().
+    void SetBackgroundIndexing(bool v) { mBackgroundIndexing = v; }
+    // Wait until the frame has been indexed. Returns NULL if the trace has fewer frames.
+    FrameTM* GetFrame(unsigned int frameIndex) const;
+    bool IsIndexComplete() const;
+    void WaitForIndex() const;
+
+    // Load the calls of a frame on demand, unloading the least recently loaded frame once
+    // more than the limit (0 for none) are loaded through this function
+    FrameTM* LoadFrame(unsigned int frameIndex);
+    void SetLoadedFrameLimit(unsigned int limit) { mLoadedFrameLimit = limit; }
+
     bool GetLoadQueryCalls() const { return mLoadQueryCalls; }
     void SetLoadQueryCalls(bool v) { mLoadQueryCalls = v; }
     void SetLoadFilter(const std::string &str) { mLoadFilterStr = str; }
@@ -374,9 +439,22 @@ private:
     mutable unsigned int mCurCallIndexInFrame;
 
     void Clear();
+    void ScanFrames(InFileRA& in, const std::string& traceName, bool indexable);
+    void AddFrame(FrameTM* frame);
+    void StopIndexing();
 
     bool mLoadQueryCalls;
     std::string mLoadFilterStr;
+
+    bool mBackgroundIndexing = false;
+    std::thread mIndexThread;
+    std::atomic<bool> mStopIndexing;
+    bool mIndexComplete = true;
+    mutable std::mutex mFramesMutex; // guards mFrames while it is being built
+    mutable std::condition_variable mFramesCond;
+
+    std::list<unsigned int> mLoadedFrames; // by LoadFrame(), most recently loaded first
+    unsigned int mLoadedFrameLimit = 16;
 };
 
 }
@@ -16,114 +16,64 @@ GLvoid* getBufferPointer(common::ValueTM *value)
 
 GLvoid* drawCallIndexPtr(const common::CallTM *call)
 {
-    if (call->mCallName == "glDrawElementsIndirect")
+    using common::ApiInfo;
+    switch (ApiInfo::NameHash(call->mCallName.c_str()))
     {
+    case ApiInfo::NameHash("glDrawElementsIndirect"):
         return getBufferPointer(call->mArgs[2]);
-    }
-    else if (call->mCallName == "glDrawElementsInstanced")
-    {
-        return getBufferPointer(call->mArgs[3]);
-    }
-    else if (call->mCallName == "glDrawElementsInstancedBaseVertex")
-    {
-        return getBufferPointer(call->mArgs[3]);
-    }
-    else if (call->mCallName == "glDrawElements")
-    {
+    case ApiInfo::NameHash("glDrawElementsInstanced"):
+    case ApiInfo::NameHash("glDrawElementsInstancedBaseVertex"):
+    case ApiInfo::NameHash("glDrawElements"):
+    case ApiInfo::NameHash("glDrawElementsBaseVertex"):
         return getBufferPointer(call->mArgs[3]);
-    }
-    else if (call->mCallName == "glDrawElementsBaseVertex")
-    {
-        return getBufferPointer(call->mArgs[3]);
-    }
-    else if (call->mCallName == "glDrawRangeElements")
-    {
+    case ApiInfo::NameHash("glDrawRangeElements"):
+    case ApiInfo::NameHash("glDrawRangeElementsBaseVertex"):
         return getBufferPointer(call->mArgs[5]);
+    default:
+        return NULL;
     }
-    else if (call->mCallName == "glDrawRangeElementsBaseVertex")
-    {
-        return getBufferPointer(call->mArgs[5]);
-    }
-    return NULL;
 }
 
 GLenum drawCallIndexType(const common::CallTM *call)
 {
-    if (call->mCallName == "glDrawElementsIndirect")
+    using common::ApiInfo;
+    switch (ApiInfo::NameHash(call->mCallName.c_str()))
     {
+    case ApiInfo::NameHash("glDrawElementsIndirect"):
         return call->mArgs[1]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawElementsInstanced")
-    {
-        return call->mArgs[2]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawElementsInstancedBaseVertex")
-    {
-        return call->mArgs[2]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawElements")
-    {
+    case ApiInfo::NameHash("glDrawElementsInstanced"):
+    case ApiInfo::NameHash("glDrawElementsInstancedBaseVertex"):
+    case ApiInfo::NameHash("glDrawElements"):
+    case ApiInfo::NameHash("glDrawElementsBaseVertex"):
         return call->mArgs[2]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawElementsBaseVertex")
-    {
-        return call->mArgs[2]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawRangeElements")
-    {
+    case ApiInfo::NameHash("glDrawRangeElements"):
+    case ApiInfo::NameHash("glDrawRangeElementsBaseVertex"):
         return call->mArgs[4]->GetAsUInt();
+    default:
+        return GL_NONE;
     }
-    else if (call->mCallName == "glDrawRangeElementsBaseVertex")
-    {
-        return call->mArgs[4]->GetAsUInt();
-    }
-    return GL_NONE;
 }
 
 int drawCallCount(const common::CallTM *call)
 {
-    if (call->mCallName == "glDrawArraysIndirect")
-    {
-        return 0;
-    }
-    else if (call->mCallName == "glDrawElementsIndirect")
+    using common::ApiInfo;
+    switch (ApiInfo::NameHash(call->mCallName.c_str()))
     {
+    case ApiInfo::NameHash("glDrawArraysIndirect"):
+    case ApiInfo::NameHash("glDrawElementsIndirect"):
         return 0;
-    }
-    else if (call->mCallName == "glDrawElementsInstanced")
-    {
+    case ApiInfo::NameHash("glDrawElementsInstanced"):
+    case ApiInfo::NameHash("glDrawElementsInstancedBaseVertex"):
+    case ApiInfo::NameHash("glDrawElements"):
+    case ApiInfo::NameHash("glDrawElementsBaseVertex"):
         return call->mArgs[1]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawElementsInstancedBaseVertex")
-    {
-        return call->mArgs[1]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawArraysInstanced")
-    {
+    case ApiInfo::NameHash("glDrawArraysInstanced"):
+    case ApiInfo::NameHash("glDrawArrays"):
         return call->mArgs[2]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawElements")
-    {
-        return call->mArgs[1]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawElementsBaseVertex")
-    {
-        return call->mArgs[1]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawArrays")
-    {
-        return call->mArgs[2]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawRangeElements")
-    {
+    case ApiInfo::NameHash("glDrawRangeElements"):
+    case ApiInfo::NameHash("glDrawRangeElementsBaseVertex"):
         return call->mArgs[3]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawRangeElementsBaseVertex")
-    {
-        return call->mArgs[3]->GetAsUInt();
-    }
-    else
-    {
+    default:
         std::cerr << "Unhandled draw call type: " << call->mCallName << std::endl;
         abort();
     }
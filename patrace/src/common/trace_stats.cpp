@@ -0,0 +1,186 @@
+#include <common/trace_stats.hpp>
+#include <common/in_file_ra.hpp>
+#include <common/os.hpp>
+#include <common/thread_pool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <sys/stat.h>
+
+namespace common {
+
+namespace {
+
+/// The part of the statistics that depends on where a chunk is in the trace. The rest is
+/// added up per thread, in any order.
+struct ChunkStats
+{
+    std::vector<TraceStats::Frame> segments; ///< calls up to and including each swap, then the rest
+    bool ok = false;
+};
+
+struct ThreadStats
+{
+    std::vector<uint64_t> functions; ///< by function id of the trace
+    std::map<unsigned, uint64_t> threads;
+};
+
+}
+
+// Walk the calls of [ptr, end) by their headers alone
+static bool walkCalls(const InFileRA& in, const char* ptr, const char* end, int defaultTid, ChunkStats& chunk, ThreadStats& total)
+{
+    const int maxSigId = in.getMaxSigId();
+    TraceStats::Frame* segment = &chunk.segments.back();
+    unsigned lastTid = UINT32_MAX;
+    uint64_t* lastTidCount = nullptr;
+    while (ptr < end)
+    {
+        if ((size_t)(end - ptr) < sizeof(BCall))
+        {
+            return false;
+        }
+        const BCall& call = *(const BCall*)ptr;
+        if (call.funcId == 0 || call.funcId > maxSigId)
+        {
+            DBG_LOG("funcId %d is out of range (%d max)!\n", (int)call.funcId, maxSigId);
+            return false;
+        }
+        unsigned len = in.ExIdToLen(call.funcId);
+        if (len == 0)
+        {
+            if ((size_t)(end - ptr) < sizeof(BCall_vlen))
+            {
+                return false;
+            }
+            len = ((const BCall_vlen*)ptr)->toNext;
+        }
+        if (len < sizeof(BCall) || len > (size_t)(end - ptr))
+        {
+            return false;
+        }
+        ptr += len;
+
+        total.functions[call.funcId]++;
+        // calls mostly come in long runs of the same thread
+        if (call.tid != lastTid)
+        {
+            lastTid = call.tid;
+            lastTidCount = &total.threads[call.tid];
+        }
+        (*lastTidCount)++;
+        segment->calls++;
+        segment->bytes += len;
+        if ((int)call.tid == defaultTid && (in.ExIdToProps(call.funcId) & CALL_PROP_SWAP))
+        {
+            chunk.segments.emplace_back();
+            segment = &chunk.segments.back();
+        }
+    }
+    return true;
+}
+
+bool scanTraceStats(const std::string& traceName, TraceStats& stats, unsigned threads)
+{
+    InFileRA in;
+    if (!in.Open(traceName.c_str()))
+    {
+        return false;
+    }
+    stats = TraceStats();
+    stats.defaultTid = in.getDefaultThreadID();
+    stats.chunks = in.GetChunkCount();
+    struct stat sb;
+    if (stat(traceName.c_str(), &sb) == 0)
+    {
+        stats.fileSize = sb.st_size;
+    }
+    const std::streamoff callsBegin = in.GetReadPos(); // past the signature book
+
+    if (threads == 0)
+    {
+        threads = common::concurrencyBudget();
+    }
+    threads = std::max<unsigned>(1, std::min<uint64_t>(threads, stats.chunks));
+
+    std::vector<ChunkStats> chunks(stats.chunks);
+    std::vector<ThreadStats> totals(threads);
+    std::atomic<size_t> next(0);
+    auto work = [&](ThreadStats& total)
+    {
+        total.functions.assign(in.getMaxSigId() + 1, 0);
+        ChunkBuffer buf;
+        for (size_t i = next++; i < chunks.size(); i = next++)
+        {
+            const char* data = nullptr;
+            size_t size = 0;
+            std::streamoff begin = 0;
+            if (!in.ReadChunk(i, buf, data, size, begin))
+            {
+                break;
+            }
+            if (begin < callsBegin)
+            {
+                const size_t skip = std::min<size_t>(callsBegin - begin, size);
+                data += skip;
+                size -= skip;
+            }
+            chunks[i].segments.emplace_back();
+            chunks[i].ok = walkCalls(in, data, data + size, stats.defaultTid, chunks[i], total);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++)
+    {
+        workers.emplace_back(work, std::ref(totals[i]));
+    }
+    work(totals[0]);
+    for (std::thread& t : workers)
+    {
+        t.join();
+    }
+
+    TraceStats::Frame frame;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        if (!chunks[i].ok)
+        {
+            DBG_LOG("Failed to walk the calls of chunk %u of %s\n", (unsigned)i, traceName.c_str());
+            return false;
+        }
+        const std::vector<TraceStats::Frame>& segments = chunks[i].segments;
+        for (size_t s = 0; s < segments.size(); s++)
+        {
+            frame.calls += segments[s].calls;
+            frame.bytes += segments[s].bytes;
+            stats.calls += segments[s].calls;
+            stats.bytes += segments[s].bytes;
+            if (s + 1 < segments.size()) // ended by a swap
+            {
+                stats.frames.push_back(frame);
+                frame = TraceStats::Frame();
+            }
+        }
+    }
+    stats.tail = frame;
+
+    for (const ThreadStats& total : totals)
+    {
+        for (size_t id = 1; id < total.functions.size(); id++)
+        {
+            if (total.functions[id] > 0)
+            {
+                stats.functions[in.ExIdToName(id)] += total.functions[id];
+            }
+        }
+        for (const auto& pair : total.threads)
+        {
+            stats.threads[pair.first] += pair.second;
+        }
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef _COMMON_TRACE_STATS_HPP_
+#define _COMMON_TRACE_STATS_HPP_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace common {
+
+/// What is in a trace, as far as the call headers tell. No argument is decoded, so this only
+/// takes as long as decompressing the trace, which is spread over several threads.
+struct TraceStats
+{
+    struct Frame
+    {
+        uint64_t calls = 0;
+        uint64_t bytes = 0; ///< size of the calls in the uncompressed call stream
+    };
+
+    uint64_t fileSize = 0;
+    uint64_t chunks = 0;
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    int defaultTid = 0;
+    std::map<std::string, uint64_t> functions; ///< calls of each function
+    std::map<unsigned, uint64_t> threads; ///< calls of each thread
+    std::vector<Frame> frames; ///< each ended by a swap of the default thread
+    Frame tail; ///< the calls after the last swap
+};
+
+/// Collect the statistics of a trace on the given number of threads, 0 for one per core.
+/// Returns false if the trace could not be read.
+bool scanTraceStats(const std::string& traceName, TraceStats& stats, unsigned threads = 0);
+
+}
+
+#endif
@@ -28,6 +28,7 @@
 #include "eglproc_auto.hpp"
 #include "os.hpp"
 #include "common/library.hpp"
+#include "common/os_time.hpp"
 #include "os_string.hpp"
 #include <string>
 #include <unordered_set>
@@ -102,6 +103,9 @@ namespace {
     DLL_HANDLE gGLES2Handle = 0;
     DLL_HANDLE gGLES1Handle = 0;
     int gGLESVersion = 0;
+    unsigned gLookups = 0;
+    long long gLookupTime = 0;
+    long long gLibraryTime = 0;
 };
 
 void ResetGLFuncPtrs();
@@ -173,15 +177,20 @@ DLL_HANDLE OpenDllByType(enum DLLType t, const char *reqFunc)
     ret = OpenDll(lib_filename.c_str(), reqFunc);
 #else // (desktop/embedded Linux)
     switch(t) {
+        // Without their own path, EGL and GLES1 come from the GLES2 library, for single library drivers
         case LibEGL:
-            if( !gCommandLineSettings.libGLESv2_path.empty() ) {
+            if( !gCommandLineSettings.libEGL_path.empty() ) {
+                lib_filename = gCommandLineSettings.libEGL_path.c_str();
+            } else if( !gCommandLineSettings.libGLESv2_path.empty() ) {
                 lib_filename = gCommandLineSettings.libGLESv2_path.c_str();
             } else {
                 lib_filename = EGL_LIB_NAME;
             }
             break;
         case LibGLESv1:
-            if( !gCommandLineSettings.libGLESv2_path.empty() ) {
+            if( !gCommandLineSettings.libGLESv1_path.empty() ) {
+                lib_filename = gCommandLineSettings.libGLESv1_path.c_str();
+            } else if( !gCommandLineSettings.libGLESv2_path.empty() ) {
                 lib_filename = gCommandLineSettings.libGLESv2_path.c_str();
             } else {
                 lib_filename = GLES1_LIB_NAME;
@@ -219,6 +228,7 @@ static std::unordered_set<std::string> complained;
 void* _getProcAddress(const char* procName)
 {
     void* retValue = NULL;
+    const long long begin = os::getTime();
 
     if (gEGLHandle == NULL || gGLES2Handle == NULL)
     {
@@ -226,11 +236,14 @@ void* _getProcAddress(const char* procName)
         // is defined in libGLESv2, therefore, load libGLESv2 first
         gGLES2Handle = OpenDllByType(LibGLESv2, "glGetString");
         gEGLHandle = OpenDllByType(LibEGL, "eglInitialize");
+        gLibraryTime += os::getTime() - begin;
     }
 
     if (gGLESVersion == 1 && gGLES1Handle == NULL)
     {
+        const long long libraryBegin = os::getTime();
         gGLES1Handle = OpenDllByType(LibGLESv1, "glGetString");
+        gLibraryTime += os::getTime() - libraryBegin;
     }
 
     if (procName && procName[0]=='e')
@@ -259,5 +272,14 @@ void* _getProcAddress(const char* procName)
         DBG_LOG("Cannot find the function pointer of %s\n", procName);
         complained.insert(procName);
     }
+    gLookups++;
+    gLookupTime += os::getTime() - begin;
     return retValue;
 }
+
+void GetProcAddressStats(unsigned& lookups, long long& lookupTime, long long& libraryTime)
+{
+    lookups = gLookups;
+    lookupTime = gLookupTime;
+    libraryTime = gLibraryTime;
+}
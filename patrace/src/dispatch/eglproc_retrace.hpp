@@ -6,4 +6,8 @@ extern void SetCommandLineEGLPath(const std::string& libEGL_path);
 extern void SetCommandLineGLES1Path(const std::string& libGLESv1_path);
 extern void SetCommandLineGLES2Path(const std::string& libGLESv2_path);
 
+/// Entry points are looked up on their first call. These are the number of lookups so far,
+/// the time they took and the part of it spent opening the libraries, in os::getTime() ticks.
+extern void GetProcAddressStats(unsigned& lookups, long long& lookupTime, long long& libraryTime);
+
 #endif
@@ -5,9 +5,11 @@
 #include <ctime>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <map>
 #include <set>
 
 #include "common/image.hpp"
+#include "common/thread_pool.hpp"
 #include "common/trace_model.hpp"
 #include "eglstate/common.hpp"
 #include "base/base.hpp"
@@ -44,6 +46,7 @@ static std::vector<GLuint> colorAttachments;
 static std::set<GLuint> textures2d; // texture units (as retraced) that are actually in use
 static std::set<GLuint> textures_cubemap;
 // TBD separate sets for other texture types
+static common::TaskGroup* encoders = nullptr; // writes the images and JSON of the draws dumped
 
 struct ProgramState
 {
@@ -108,6 +111,10 @@ struct TextureInfo
     GLint mWrapR;
 };
 
+// Texture info by retraced texture id and target, kept until a call changes any texture, so that
+// the textures used by many of the draws of a range are only queried once
+static std::map<std::pair<GLuint, GLenum>, TextureInfo> textureInfoCache;
+
 static inline const std::string TexEnumString(unsigned int enumToFind)
 {
     return SafeEnumString(enumToFind, "glTexParameter");
@@ -366,7 +373,12 @@ static Json::Value saveTexture(retracer::Context& mRetracerContext, int mThreadI
     }
 
     Json::Value result;
-    TextureInfo texInfo = getTextureInfo(target);
+    auto cached = textureInfoCache.find(std::make_pair(retraceTextureId, target));
+    if (cached == textureInfoCache.end())
+    {
+        cached = textureInfoCache.emplace(std::make_pair(retraceTextureId, target), getTextureInfo(target)).first;
+    }
+    const TextureInfo& texInfo = cached->second;
 
     result["id"] = traceTextureId;
     result["unit"] = textureUnit;
@@ -475,7 +487,7 @@ static Json::Value saveTexture(retracer::Context& mRetracerContext, int mThreadI
         result["filenames"] = Json::arrayValue;
         for (int i = 0; i < 6; i++) //For each face
         {
-            std::vector<std::string> filenames = glstate::dumpTexture(cubemap, drawCall, faces[i], i, &indices[0]);
+            std::vector<std::string> filenames = glstate::dumpTexture(cubemap, drawCall, faces[i], i, &indices[0], encoders);
             for (const std::string& f : filenames)
             {
                 result["filenames"].append(f);
@@ -491,7 +503,7 @@ static Json::Value saveTexture(retracer::Context& mRetracerContext, int mThreadI
         Texture texture;
         texture.handle = traceTextureId;
         result["filenames"] = Json::arrayValue;
-        std::vector<std::string> filenames = glstate::dumpTexture(texture, drawCall, &vertices[0]);
+        std::vector<std::string> filenames = glstate::dumpTexture(texture, drawCall, &vertices[0], 0, 0, encoders);
         for (const std::string& f : filenames)
         {
             result["filenames"].append(f);
@@ -873,6 +885,39 @@ static void saveProgramInfo(GLuint id)
     }
 }
 
+// Write a copy of the result JSON as it is now to the output directory, on the encoders
+static void writeResult()
+{
+    const std::string jsonfilename = outputdir + "/result.json";
+    const Json::Value value = result;
+    encoders->run([jsonfilename, value]
+    {
+        std::string output_data = value.toStyledString();
+        FILE *fp = fopen(jsonfilename.c_str(), "w");
+        if (!fp)
+        {
+            DBG_LOG("Failed to open %s: %s\n", jsonfilename.c_str(), strerror(errno));
+            abort();
+        }
+        fwrite(output_data.data(), output_data.size(), 1, fp);
+        fclose(fp);
+    });
+}
+
+// Whether a call may change the info of a texture
+static bool modifiesTextures(const char *funcName)
+{
+    static const char *prefixes[] = { "glTex", "glCompressedTex", "glCopyTex", "glGenerateMipmap", "glDeleteTextures", "glEGLImageTargetTexture" };
+    for (const char *prefix : prefixes)
+    {
+        if (strncmp(funcName, prefix, strlen(prefix)) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void drawCallExtraInfo(const common::CallTM *call, Json::Value &stmt)
 {
     if (call->mCallName == "glDrawElementsInstanced")
@@ -1062,17 +1107,7 @@ static bool retrace()
                 }
             }
             drawCallExtraInfo(&mCall, result["draw"]); // add any as-of-yet unhandled parameters to the json
-
-            std::string output_data = result.toStyledString();
-            std::string jsonfilename = outputdir + "/result.json";
-            FILE *fp = fopen(jsonfilename.c_str(), "w");
-            if (!fp)
-            {
-                DBG_LOG("Failed to open %s: %s\n", jsonfilename.c_str(), strerror(errno));
-                abort();
-            }
-            fwrite(output_data.data(), output_data.size(), 1, fp);
-            fclose(fp);
+            writeResult();
 
             DBG_LOG("Done saving GL state\n");
             // No more calls.
@@ -1121,10 +1156,11 @@ static bool retraceRange()
         }
 
         unsigned int callId = retracer.GetCurCallId();
-        common::CallTM mCall(retracer.mFile, callId, retracer.mCurCall);
-        common::CallTM *call = &mCall; // analyze tool style
-        if (callId >= startCall && callId <= endCall && call->mCallName.find("glDraw") != std::string::npos)
+        const char *funcName = retracer.mFile.ExIdToName(retracer.mCurCall.funcId);
+        if (callId >= startCall && callId <= endCall && strncmp(funcName, "glDraw", 6) == 0)
         {
+            common::CallTM mCall(retracer.mFile, callId, retracer.mCurCall); // only parsed for the draws dumped
+            common::CallTM *call = &mCall; // analyze tool style
             checkError("begin");
 
             // Sync
@@ -1156,6 +1192,7 @@ static bool retraceRange()
             result["program_id"] = program;
 
             // Save program resources
+            colorAttachments.clear();
             saveProgramInfo(program);
 
             // Save framebuffer color attachments
@@ -1238,17 +1275,7 @@ static bool retraceRange()
                 }
             }
             drawCallExtraInfo(&mCall, result["draw"]); // add any as-of-yet unhandled parameters to the json
-
-            std::string output_data = result.toStyledString();
-            std::string jsonfilename = outputdir + "/result.json";
-            FILE *fp = fopen(jsonfilename.c_str(), "w");
-            if (!fp)
-            {
-                DBG_LOG("Failed to open %s: %s\n", jsonfilename.c_str(), strerror(errno));
-                abort();
-            }
-            fwrite(output_data.data(), output_data.size(), 1, fp);
-            fclose(fp);
+            writeResult();
 
             if (callId == endCall)
             {
@@ -1266,8 +1293,12 @@ static bool retraceRange()
             continue; // we're skipping calls from out file here, too; probably what user wants?
         }
 
+        if (modifiesTextures(funcName))
+        {
+            textureInfoCache.clear();
+        }
+
         // Call function
-        const char *funcName = retracer.mFile.ExIdToName(retracer.mCurCall.funcId);
         if (fptr && strcmp(funcName, "glDetachShader") != 0)
         {
             (*(RetraceFunc)fptr)(src); // increments src to point to end of parameter block
@@ -1392,6 +1423,8 @@ int main(int argc, char** argv)
     // 3. init egl and gles, using final combination of settings (header + override)
     GLWS::instance().Init(gRetracer.mOptions.mApiVersion);
 
+    common::TaskGroup encoding;
+    encoders = &encoding;
     if (startCall != 0 && endCall != 0)
     {
         retraceRange();
@@ -1400,6 +1433,8 @@ int main(int argc, char** argv)
     {
         retrace();
     }
+    encoding.wait();
+    encoders = nullptr;
 
     // Close and cleanup
     GLWS::instance().Cleanup();
@@ -3,10 +3,22 @@
 #include <fstream>
 #include <unistd.h>
 #include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "common/out_file.hpp"
 #include "common/image.hpp"
 #include "common/trace_model.hpp"
+#include "common/memory.hpp"
 
 #include "dispatch/eglproc_auto.hpp"
 #include "helper/eglsize.hpp"
@@ -58,27 +70,48 @@ enum FastForwardOptionFlags
 {
     FASTFORWARD_RESTORE_TEXTURES  = 1 << 0,
     FASTFORWARD_RESTORE_DEFAUTL_FBO= 1 << 1,
+    FASTFORWARD_SKIP_DRAWS        = 1 << 2,
+    FASTFORWARD_PRUNE_RESTORE     = 1 << 3,
+    FASTFORWARD_KEEP_UPLOADS      = 1 << 4,
+    FASTFORWARD_DELTAS            = 1 << 5,
 };
 
 struct FastForwardOptions
 {
     std::string mOutputFileName;
     std::string mComment;
-    unsigned int mTargetFrame;
+    std::vector<unsigned int> mTargetFrames; // in increasing order, one output trace for each
     unsigned int mTargetDrawCallNo;
     unsigned int mEndFrame;
     unsigned int mFlags;
+    bool mSegmented; // each output trace ends at the target frame of the next one
+    std::string mCacheDir; // where fastforward traces made before are kept, see --cache
 
     FastForwardOptions()
         : mOutputFileName("fastforward.pat")
         , mComment("")
-        , mTargetFrame(0)
+        , mTargetFrames()
         , mTargetDrawCallNo(0)
         , mEndFrame(UINT32_MAX)
         , mFlags(FASTFORWARD_RESTORE_TEXTURES)
+        , mSegmented(false)
     {}
 };
 
+// One fastforward trace written by the pass, which restores the state at its target. With
+// several target frames the source trace is replayed once and every output is written as
+// the replay goes, instead of replaying it from the start for each target.
+struct FastForwardOutput
+{
+    unsigned int mTargetFrame; // 0 when fastforwarding to a draw call
+    unsigned int mStartFrame; // with --deltas, the target frame of the output this one is a delta on
+    unsigned int mEndFrame;
+    std::string mFileName;
+    std::string mCacheKey; // empty when not using --cache
+    std::unique_ptr<common::OutFile> mOut;
+    Json::Value mJson;
+};
+
 namespace RetraceAndTrim
 {
 class ScratchBuffer
@@ -110,6 +143,50 @@ private:
     std::vector<char> mVector;
 };
 
+// Calls emitted into memory, one at a time so that they can be written out whole
+struct CallMemory
+{
+    std::vector<char> data;
+    std::vector<unsigned int> sizes;
+
+    void writeTo(common::OutFile& outFile) const
+    {
+        const char* call = data.data();
+        for (const unsigned int size : sizes)
+        {
+            outFile.Write(call, size);
+            call += size;
+        }
+    }
+};
+
+// Where emitted commands go: straight into the output trace, or into memory when the state of
+// a share group is saved on another thread, to be written into the output trace after
+class CallSink
+{
+public:
+    CallSink(common::OutFile& outFile) : mOutFile(&outFile), mMemory(NULL) {}
+    CallSink(CallMemory& memory) : mOutFile(NULL), mMemory(&memory) {}
+
+    // Each write is one whole call
+    void Write(const void* buf, unsigned int len)
+    {
+        if (mOutFile)
+        {
+            mOutFile->Write(buf, len);
+        }
+        else
+        {
+            mMemory->data.insert(mMemory->data.end(), (const char*)buf, (const char*)buf + len);
+            mMemory->sizes.push_back(len);
+        }
+    }
+
+private:
+    common::OutFile* mOutFile;
+    CallMemory* mMemory;
+};
+
 // NOTE: This emits commands in the _V4_ trace file format!
 class TraceCommandEmitter
 {
@@ -118,7 +195,7 @@ public:
         Tex2D,
         Tex3D
     };
-    TraceCommandEmitter(common::OutFile& outFile, int threadId)
+    TraceCommandEmitter(CallSink outFile, int threadId)
         : mScratchBuff(0)
         , mOutFile(outFile)
         , mThreadId(threadId)
@@ -127,6 +204,7 @@ public:
         , mGlDeleteBuffersId(getId("glDeleteBuffers"))
         , mGlBufferDataId(getId("glBufferData"))
         , mGlBindBufferId(getId("glBindBuffer"))
+        , mGlCopyBufferSubDataId(getId("glCopyBufferSubData"))
         , mGlBindVertexArrayId(getId("glBindVertexArray"))
         , mGlVertexAttribPointerId(getId("glVertexAttribPointer"))
         , mGlVertexAttribIPointerId(getId("glVertexAttribIPointer"))
@@ -236,15 +314,32 @@ public:
         mOutFile.Write(bufStart, toNext);
     }
 
+    void emitCopyBufferSubData(GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 5);
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlCopyBufferSubDataId);
+        dest = common::WriteFixed<int>(dest, readTarget); // enum
+        dest = common::WriteFixed<int>(dest, writeTarget); // enum
+        dest = common::WriteFixed<int>(dest, readOffset); // literal
+        dest = common::WriteFixed<int>(dest, writeOffset); // literal
+        dest = common::WriteFixed<int>(dest, size); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
     void emitTexSubImage(TexDimension dimension, GLenum target, GLint level,
                          GLint xoffset, GLint yoffset, GLint zoffset,
                          GLsizei width, GLsizei height, GLsizei depth,
-                         GLenum format, GLenum type, unsigned int textureSize, const char* data)
+                         GLenum format, GLenum type, unsigned int textureSize, const char* data,
+                         unsigned int blobMarker = 0, unsigned int blobId = 0) // see BLOB_STORE_DEFINE
     {
         if (dimension == Tex2D)
-            mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 9 + textureSize + 32);
-        else if (dimension == Tex3D)
             mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 11 + textureSize + 32);
+        else if (dimension == Tex3D)
+            mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 13 + textureSize + 32);
 
         char* const bufStart = mScratchBuff.bufferPtr();
         char* dest = bufStart;
@@ -265,7 +360,12 @@ public:
         dest = common::WriteFixed<int>(dest, format); // enum format
         dest = common::WriteFixed<int>(dest, type); // enum type
         dest = common::WriteFixed<unsigned int>(dest, common::BlobType);
-        dest = common::Write1DArray<char>(dest, textureSize, data);
+        if (blobMarker == BLOB_STORE_REFERENCE)
+            dest = common::WriteBlobReference(dest, blobId);
+        else if (blobMarker == BLOB_STORE_DEFINE)
+            dest = common::WriteBlobDefinition(dest, blobId, textureSize, data);
+        else
+            dest = common::Write1DArray<char>(dest, textureSize, data);
 
         // NOTE: written to bufStart, not dest
         int toNext = dest - bufStart;
@@ -806,12 +906,13 @@ public:
 
 private:
     ScratchBuffer mScratchBuff;
-    common::OutFile& mOutFile;
+    CallSink mOutFile;
     int mThreadId;
     int mGlGenBuffersId;
     int mGlDeleteBuffersId;
     int mGlBufferDataId;
     int mGlBindBufferId;
+    int mGlCopyBufferSubDataId;
     int mGlBindVertexArrayId;
     int mGlVertexAttribPointerId;
     int mGlVertexAttribIPointerId;
@@ -890,13 +991,421 @@ private:
     }
 };
 
+// --prunerestore: only restore the textures and buffers that the output trace can still use.
+// A pass over the trace before replaying it finds the names that the calls in the frame
+// range of each output refer to, and at the checkpoint the names that the GL state reaches
+// without a call naming them are added: those bound to texture units, image units and buffer
+// targets, attached to framebuffers, or used by vertex arrays. What neither reaches is never
+// used again, so its contents do not matter. Names can be reused after they are deleted,
+// which only keeps more alive than needed.
+class ResourceLiveness
+{
+public:
+    enum Kind { TEXTURE, BUFFER, KIND_COUNT };
+
+    ResourceLiveness()
+        : mCurrent(-1)
+    {
+        for (int kind = 0; kind < KIND_COUNT; kind++)
+        {
+            mPrune[kind] = false;
+            mPruned[kind] = 0;
+        }
+    }
+
+    // The pass over the trace, for the outputs of the given target and end frames. Returns
+    // false if nothing can be pruned.
+    bool scan(const std::string& fileName, const std::vector<std::pair<unsigned int, unsigned int> >& ranges, int retraceTid)
+    {
+        common::InFile file;
+        if (ranges.empty() || ranges.front().first == 0 || !file.Open(fileName.c_str()))
+        {
+            DBG_LOG("The restore is only pruned when fastforwarding to a target frame\n");
+            return false;
+        }
+        mRanges = ranges;
+        mLive.assign(ranges.size(), std::vector<std::unordered_set<unsigned int> >(KIND_COUNT));
+        unsigned int lastFrame = 0;
+        for (const auto& range : ranges)
+        {
+            lastFrame = std::max(lastFrame, range.second);
+        }
+        for (int kind = 0; kind < KIND_COUNT; kind++)
+        {
+            mPrune[kind] = true;
+        }
+
+        std::vector<Ref> refs; // for each function id, see refOf()
+        void* fptr = NULL;
+        common::BCall_vlen call;
+        char* src = NULL;
+        unsigned int frame = 0;
+        while (frame <= lastFrame && file.GetNextCall(fptr, call, src))
+        {
+            if (call.funcId >= refs.size())
+            {
+                refs.resize(call.funcId + 1, Ref(UNKNOWN));
+            }
+            Ref& ref = refs[call.funcId];
+            if (ref.type == UNKNOWN)
+            {
+                ref = refOf(file.ExIdToName(call.funcId));
+            }
+            const unsigned int* args = reinterpret_cast<const unsigned int*>(src);
+            switch (ref.type)
+            {
+            case SWAP:
+                if (call.tid == retraceTid)
+                {
+                    frame++;
+                }
+                break;
+            case TEXTURE_REF:
+            case BUFFER_REF:
+                use(ref.type == TEXTURE_REF ? TEXTURE : BUFFER, frame, args[ref.arg]);
+                if (ref.arg2 >= 0)
+                {
+                    use(TEXTURE, frame, args[ref.arg2]);
+                }
+                break;
+            case TEXTURE_BUFFER:
+                // Drawing with the texture reads the buffer without naming it
+                mAlways[BUFFER].insert(args[ref.arg]);
+                break;
+            case IMAGE:
+                // A texture can be the source of an image that other textures are made from
+                if (mPrune[TEXTURE])
+                {
+                    DBG_LOG("Not pruning textures, the trace calls %s\n", file.ExIdToName(call.funcId));
+                }
+                mPrune[TEXTURE] = false;
+                break;
+            case FEEDBACK:
+                // Transform feedback objects keep buffer bindings that the checkpoint does not see
+                if (mPrune[BUFFER])
+                {
+                    DBG_LOG("Not pruning buffers, the trace calls %s\n", file.ExIdToName(call.funcId));
+                }
+                mPrune[BUFFER] = false;
+                break;
+            default:
+                break;
+            }
+        }
+        file.Close();
+        return mPrune[TEXTURE] || mPrune[BUFFER];
+    }
+
+    bool enabled() const { return !mRanges.empty() && (mPrune[TEXTURE] || mPrune[BUFFER]); }
+
+    // Called when the state of the output of the given range is saved, see live()
+    void checkpoint(retracer::Context& context, unsigned int targetFrame, unsigned int endFrame)
+    {
+        mCurrent = -1;
+        for (size_t i = 0; i < mRanges.size(); i++)
+        {
+            if (mRanges[i].first == targetFrame && mRanges[i].second == endFrame)
+            {
+                mCurrent = i;
+            }
+        }
+        for (int kind = 0; kind < KIND_COUNT; kind++)
+        {
+            mReachable[kind].clear();
+        }
+        if (mCurrent < 0)
+        {
+            return;
+        }
+
+        int major = 3, minor = 0;
+        sscanf((const char*)_glGetString(GL_VERSION), "OpenGL ES %d.%d", &major, &minor);
+        const int version = major * 10 + minor;
+
+        // Texture units
+        static const GLenum textureBindings[] = { GL_TEXTURE_BINDING_2D, GL_TEXTURE_BINDING_CUBE_MAP, GL_TEXTURE_BINDING_3D,
+            GL_TEXTURE_BINDING_2D_ARRAY, GL_TEXTURE_BINDING_EXTERNAL_OES, GL_TEXTURE_BINDING_2D_MULTISAMPLE,
+            GL_TEXTURE_BINDING_CUBE_MAP_ARRAY, GL_TEXTURE_BINDING_2D_MULTISAMPLE_ARRAY_OES, GL_TEXTURE_BINDING_BUFFER_EXT };
+        GLint activeTexture = GL_TEXTURE0;
+        GLint units = 0;
+        _glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+        _glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &units);
+        for (GLint unit = 0; unit < units; unit++)
+        {
+            _glActiveTexture(GL_TEXTURE0 + unit);
+            for (GLenum binding : textureBindings)
+            {
+                addBinding(context, TEXTURE, binding);
+            }
+        }
+        _glActiveTexture(activeTexture);
+        if (version >= 31)
+        {
+            addIndexedBindings(context, TEXTURE, GL_IMAGE_BINDING_NAME, GL_MAX_IMAGE_UNITS);
+        }
+
+        // Framebuffer attachments
+        GLint readFramebuffer = 0;
+        GLint colorAttachments = 0;
+        _glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+        _glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &colorAttachments);
+        std::vector<GLenum> attachments = { GL_DEPTH_ATTACHMENT, GL_STENCIL_ATTACHMENT };
+        for (GLint i = 0; i < colorAttachments; i++)
+        {
+            attachments.push_back(GL_COLOR_ATTACHMENT0 + i);
+        }
+        for (const auto& pair : context.getFramebufferMap())
+        {
+            if (pair.first == 0 || pair.second == 0)
+            {
+                continue;
+            }
+            _glBindFramebuffer(GL_READ_FRAMEBUFFER, pair.second);
+            for (GLenum attachment : attachments)
+            {
+                GLint type = GL_NONE;
+                _glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+                if (type == GL_TEXTURE)
+                {
+                    GLint name = 0;
+                    _glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &name);
+                    add(context, TEXTURE, name);
+                }
+            }
+        }
+        _glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+
+        // Buffer targets
+        static const GLenum bufferBindings[] = { GL_ARRAY_BUFFER_BINDING, GL_COPY_READ_BUFFER_BINDING, GL_COPY_WRITE_BUFFER_BINDING,
+            GL_PIXEL_PACK_BUFFER_BINDING, GL_PIXEL_UNPACK_BUFFER_BINDING, GL_TRANSFORM_FEEDBACK_BUFFER_BINDING, GL_UNIFORM_BUFFER_BINDING };
+        static const GLenum bufferBindings31[] = { GL_DRAW_INDIRECT_BUFFER_BINDING, GL_DISPATCH_INDIRECT_BUFFER_BINDING,
+            GL_ATOMIC_COUNTER_BUFFER_BINDING, GL_SHADER_STORAGE_BUFFER_BINDING, GL_TEXTURE_BUFFER_BINDING_EXT };
+        for (GLenum binding : bufferBindings)
+        {
+            addBinding(context, BUFFER, binding);
+        }
+        addIndexedBindings(context, BUFFER, GL_UNIFORM_BUFFER_BINDING, GL_MAX_UNIFORM_BUFFER_BINDINGS);
+        addIndexedBindings(context, BUFFER, GL_TRANSFORM_FEEDBACK_BUFFER_BINDING, GL_MAX_TRANSFORM_FEEDBACK_SEPARATE_ATTRIBS);
+        if (version >= 31)
+        {
+            for (GLenum binding : bufferBindings31)
+            {
+                addBinding(context, BUFFER, binding);
+            }
+            addIndexedBindings(context, BUFFER, GL_ATOMIC_COUNTER_BUFFER_BINDING, GL_MAX_ATOMIC_COUNTER_BUFFER_BINDINGS);
+            addIndexedBindings(context, BUFFER, GL_SHADER_STORAGE_BUFFER_BINDING, GL_MAX_SHADER_STORAGE_BUFFER_BINDINGS);
+        }
+
+        // Vertex arrays, the default one included
+        GLint vertexArray = 0;
+        GLint attribs = 0;
+        _glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vertexArray);
+        _glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &attribs);
+        for (const auto& pair : context._array_map)
+        {
+            if (pair.first != 0 && pair.second == 0)
+            {
+                continue;
+            }
+            _glBindVertexArray(pair.second);
+            addBinding(context, BUFFER, GL_ELEMENT_ARRAY_BUFFER_BINDING);
+            for (GLint i = 0; i < attribs; i++)
+            {
+                GLint name = 0;
+                _glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &name);
+                add(context, BUFFER, name);
+            }
+            if (version >= 31)
+            {
+                addIndexedBindings(context, BUFFER, GL_VERTEX_BINDING_BUFFER, GL_MAX_VERTEX_ATTRIB_BINDINGS);
+            }
+        }
+        _glBindVertexArray(vertexArray);
+
+        // Bindings that the implementation does not have are errors, which are of no interest
+        while (glGetError() != GL_NO_ERROR) {}
+    }
+
+    // Whether the contents of the object with the given trace name have to be restored for
+    // the output of the last checkpoint
+    bool live(Kind kind, unsigned int name)
+    {
+        if (mCurrent < 0 || !mPrune[kind] || mLive[mCurrent][kind].count(name) > 0
+            || mReachable[kind].count(name) > 0 || mAlways[kind].count(name) > 0)
+        {
+            return true;
+        }
+        mPruned[kind]++;
+        return false;
+    }
+
+    unsigned long long pruned(Kind kind) const { return mPruned[kind]; }
+
+private:
+    enum Type { UNKNOWN = -1, OTHER, SWAP, TEXTURE_REF, BUFFER_REF, TEXTURE_BUFFER, IMAGE, FEEDBACK };
+
+    struct Ref
+    {
+        Ref(signed char _type, signed char _arg = -1, signed char _arg2 = -1)
+            : type(_type), arg(_arg), arg2(_arg2)
+        {}
+        signed char type;
+        signed char arg; // which of the leading 32 bit arguments is the name
+        signed char arg2; // another texture name, or -1
+    };
+
+    static Ref refOf(const char* name)
+    {
+        if (strncmp(name, "eglSwapBuffers", 14) == 0)
+        {
+            return Ref(SWAP);
+        }
+        if (strncmp(name, "eglCreateImage", 14) == 0)
+        {
+            return Ref(IMAGE);
+        }
+        if (strcmp(name, "glBindTransformFeedback") == 0)
+        {
+            return Ref(FEEDBACK);
+        }
+        if (strcmp(name, "glBindTexture") == 0 || strcmp(name, "glBindImageTexture") == 0)
+        {
+            return Ref(TEXTURE_REF, 1);
+        }
+        if (strncmp(name, "glFramebufferTexture2D", 22) == 0 || strncmp(name, "glFramebufferTexture3D", 22) == 0)
+        {
+            return Ref(TEXTURE_REF, 3);
+        }
+        if (strncmp(name, "glFramebufferTexture", 20) == 0) // Layer, Multiview and the ES 3.2 one
+        {
+            return Ref(TEXTURE_REF, 2);
+        }
+        if (strncmp(name, "glCopyImageSubData", 18) == 0)
+        {
+            return Ref(TEXTURE_REF, 0, 6); // or renderbuffers, which only keeps more alive
+        }
+        if (strncmp(name, "glTextureView", 13) == 0)
+        {
+            return Ref(TEXTURE_REF, 0, 2);
+        }
+        if (strcmp(name, "glBindBuffer") == 0 || strcmp(name, "glBindVertexBuffer") == 0)
+        {
+            return Ref(BUFFER_REF, 1);
+        }
+        if (strcmp(name, "glBindBufferBase") == 0 || strcmp(name, "glBindBufferRange") == 0)
+        {
+            return Ref(BUFFER_REF, 2);
+        }
+        if (strncmp(name, "glTexBuffer", 11) == 0) // and glTexBufferRange
+        {
+            return Ref(TEXTURE_BUFFER, 2);
+        }
+        return Ref(OTHER);
+    }
+
+    void use(Kind kind, unsigned int frame, unsigned int name)
+    {
+        for (size_t i = 0; i < mRanges.size(); i++)
+        {
+            if (frame >= mRanges[i].first && frame <= mRanges[i].second)
+            {
+                mLive[i][kind].insert(name);
+            }
+        }
+    }
+
+    void add(retracer::Context& context, Kind kind, GLint name)
+    {
+        if (name != 0)
+        {
+            mReachable[kind].insert(kind == TEXTURE ? context.getTextureRevMap().RValue(name) : context.getBufferRevMap().RValue(name));
+        }
+    }
+
+    void addBinding(retracer::Context& context, Kind kind, GLenum binding)
+    {
+        GLint name = 0;
+        _glGetIntegerv(binding, &name);
+        add(context, kind, name);
+    }
+
+    void addIndexedBindings(retracer::Context& context, Kind kind, GLenum binding, GLenum maxBindings)
+    {
+        GLint count = 0;
+        _glGetIntegerv(maxBindings, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint name = 0;
+            _glGetIntegeri_v(binding, i, &name);
+            add(context, kind, name);
+        }
+    }
+
+    std::vector<std::pair<unsigned int, unsigned int> > mRanges; // target and end frame of each output
+    std::vector<std::vector<std::unordered_set<unsigned int> > > mLive; // for each range and kind, the names its calls refer to
+    std::unordered_set<unsigned int> mAlways[KIND_COUNT];
+    std::unordered_set<unsigned int> mReachable[KIND_COUNT]; // from the state at the last checkpoint
+    bool mPrune[KIND_COUNT];
+    int mCurrent; // range of the last checkpoint
+    unsigned long long mPruned[KIND_COUNT];
+};
+
+// For --deltas: the digests of the buffer and texture level contents saved at the previous
+// checkpoint, so that a delta checkpoint only saves what has changed since. Every checkpoint
+// records what it reads, and what it does not read, because it was pruned or left to its
+// uploads, has no digest at the next one and is saved again if it is read there.
+class CheckpointDigests
+{
+public:
+    // Key of a buffer, or of a level or layer of a texture
+    typedef std::tuple<unsigned int, unsigned int, int, int> Key;
+
+    static Key bufferKey(unsigned int name) { return Key(name, 0, -1, 0); }
+    static Key levelKey(unsigned int name, GLenum target, int level, int zoffset) { return Key(name, target, level, zoffset); }
+
+    // Starts a checkpoint, a delta one compares what it reads with the previous one
+    void begin(bool delta)
+    {
+        mPrevious.clear();
+        if (delta)
+        {
+            mPrevious.swap(mCurrent);
+        }
+        mCurrent.clear();
+        mUnchanged = 0;
+    }
+
+    // Records the contents read for the key, returns false if the previous checkpoint read the same
+    bool changed(const Key& key, size_t size, const common::ContentDigest& digest)
+    {
+        mCurrent[key] = std::make_pair(size, digest);
+        const auto found = mPrevious.find(key);
+        if (found != mPrevious.end() && found->second.first == size && found->second.second == digest)
+        {
+            mUnchanged++;
+            return false;
+        }
+        return true;
+    }
+
+    unsigned int unchanged() const { return mUnchanged; }
+
+private:
+    std::map<Key, std::pair<size_t, common::ContentDigest>> mPrevious;
+    std::map<Key, std::pair<size_t, common::ContentDigest>> mCurrent;
+    unsigned int mUnchanged = 0;
+};
+
 class BufferSaver
 {
 public:
-    static void run(retracer::Context& retracerContext, common::OutFile& outFile, int threadId)
+    // With a liveness, buffers that it finds dead are left out. With dedup, a buffer with the
+    // same contents as one saved before is copied from that one with glCopyBufferSubData. With
+    // digests, a buffer that has not changed since the previous checkpoint is left out.
+    static void run(retracer::Context& retracerContext, CallSink outFile, int threadId, ResourceLiveness* liveness, bool dedup,
+                    CheckpointDigests* digests)
     {
-        const auto buffers = retracerContext.getBufferMap().GetCopy();
-        const auto revBuffers = retracerContext.getBufferRevMap().GetCopy();
+        const retracer::hmap<unsigned int>& buffers = retracerContext.getBufferMap();
 
         // Create helper which adds command to tracefile
         TraceCommandEmitter traceCommandEmitter(outFile, threadId);
@@ -908,16 +1417,22 @@ public:
 
         // Find the corresponding trace-buffer-id as well (to rebind
         // when done in trace)
-        GLint oldBoundBufferTrace = 0;
-        auto search = revBuffers.find(oldBoundBuffer);
-        if (search != revBuffers.end())
-            oldBoundBufferTrace = search->second;
+        GLint oldBoundBufferTrace = retracerContext.getBufferRevMap().RValue(oldBoundBuffer);
+
+        // Contents saved so far, to the trace name that holds them
+        std::map<std::pair<GLint64, common::ContentDigest>, unsigned int> saved;
+        unsigned int copies = 0;
 
         for (const auto it : buffers)
         {
             const unsigned int traceBufferId = it.first;
             const unsigned int retraceBufferId = it.second;
 
+            if (liveness && !liveness->live(ResourceLiveness::BUFFER, traceBufferId))
+            {
+                DBG_LOG("Not saving buffer %d, it is not used after the target\n", traceBufferId);
+                continue;
+            }
             DBG_LOG("Saving buffer %d\n", traceBufferId);
 
             // Output glBindBuffer(GL_ARRAY_BUFFER, traceBufferId) to new
@@ -964,8 +1479,41 @@ public:
                         os::abort();
                     }
 
-                    // Emit glBufferData(GL_ARRAY_BUFFER, len, data, usage);
-                    traceCommandEmitter.emitBufferData(GL_ARRAY_BUFFER, buffLength, data, buffUsage);
+                    unsigned int sameAs = 0;
+                    const common::ContentDigest digest = (dedup || digests) ? common::ContentDigest(data, buffLength) : common::ContentDigest();
+                    const bool unchanged = digests && !digests->changed(CheckpointDigests::bufferKey(traceBufferId), buffLength, digest);
+                    if (dedup)
+                    {
+                        const auto key = std::make_pair(buffLength, digest);
+                        const auto found = saved.find(key);
+                        if (found != saved.end())
+                        {
+                            sameAs = found->second;
+                        }
+                        else
+                        {
+                            saved[key] = traceBufferId;
+                        }
+                    }
+
+                    if (unchanged)
+                    {
+                        // It still holds these contents from the checkpoint that this one is a delta on
+                        DBG_LOG("Buffer %d has not changed since the previous checkpoint\n", traceBufferId);
+                    }
+                    else if (sameAs != 0)
+                    {
+                        // Emit glBufferData(GL_ARRAY_BUFFER, len, NULL, usage) and copy the contents on the GPU
+                        traceCommandEmitter.emitBufferData(GL_ARRAY_BUFFER, buffLength, NULL, buffUsage);
+                        traceCommandEmitter.emitBindBuffer(GL_COPY_READ_BUFFER, sameAs);
+                        traceCommandEmitter.emitCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, 0, buffLength);
+                        copies++;
+                    }
+                    else
+                    {
+                        // Emit glBufferData(GL_ARRAY_BUFFER, len, data, usage);
+                        traceCommandEmitter.emitBufferData(GL_ARRAY_BUFFER, buffLength, data, buffUsage);
+                    }
                 }
                 _glUnmapBuffer(GL_ARRAY_BUFFER);
                 if (pre_mapped)
@@ -978,6 +1526,13 @@ public:
         // Rebind previously bound buffer in trace:
         // output glBindBuffer(GL_ARRAY_BUFFER, oldBoundBufferTrace)
         traceCommandEmitter.emitBindBuffer(GL_ARRAY_BUFFER, oldBoundBufferTrace);
+        if (copies > 0)
+        {
+            GLint oldCopyReadBuffer = 0;
+            _glGetIntegerv(GL_COPY_READ_BUFFER_BINDING, &oldCopyReadBuffer);
+            traceCommandEmitter.emitBindBuffer(GL_COPY_READ_BUFFER, retracerContext.getBufferRevMap().RValue(oldCopyReadBuffer));
+            DBG_LOG("Copied %u buffers from others with the same contents\n", copies);
+        }
 
         // Bind previously bound buffer locally
         _glBindBuffer(GL_ARRAY_BUFFER, oldBoundBuffer);
@@ -998,50 +1553,201 @@ bool checkError(const std::string &msg)
     return true;
 }
 
-class TextureSaver
+// --keepuploads: the fastforward trace keeps every upload from before the target, so a
+// texture whose contents only ever came from uploads is already as it should be when the
+// restore runs. This follows the replay and marks the textures that get contents some other
+// way: by being attached to a framebuffer or bound as an image, which draws, blits and
+// dispatches before the target write into and the fastforward trace leaves out, by copies
+// and views on the GPU, by EGL images, and by uploads from a pixel unpack buffer, which may
+// have been written on the GPU. Only the marked textures are restored. Real compressed
+// textures are never restored, since they cannot be rendered into.
+class UploadTracker
 {
 public:
-    TextureSaver(retracer::Context& retracerContext, common::OutFile& outFile, int threadId)
-        : mRetracerContext(retracerContext), mOutFile(outFile), mThreadId(threadId), mScratchBuff()
-    {
-        TexTypeInfo info2d("2D", GL_TEXTURE_2D, GL_TEXTURE_BINDING_2D, TraceCommandEmitter::Tex2D);
-        TexTypeInfo info2dArray("2D_Array", GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BINDING_2D_ARRAY, TraceCommandEmitter::Tex3D);
-        TexTypeInfo infoCubemap("Cubemap", GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BINDING_CUBE_MAP, TraceCommandEmitter::Tex2D);
-        TexTypeInfo infoCubemapArray("Cubemap_Array", GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_BINDING_CUBE_MAP_ARRAY, TraceCommandEmitter::Tex3D);
-        texTypeToInfo[DepthDumper::Tex2D] = info2d;
-        texTypeToInfo[DepthDumper::Tex2DArray] = info2dArray;
-        texTypeToInfo[DepthDumper::TexCubemap] = infoCubemap;
-        texTypeToInfo[DepthDumper::TexCubemapArray] = infoCubemapArray;
-
-        depthDumper.initializeDepthCopyer();
-    }
+    UploadTracker()
+        : mEnabled(false)
+        , mImages(false)
+    {}
 
-    ~TextureSaver()
-    {
-    }
+    void enable() { mEnabled = true; }
+    bool enabled() const { return mEnabled; }
 
-    void run()
+    // Called before each call is replayed
+    void call(retracer::Context& context, int funcId, const char* funcName, const char* src)
     {
-        checkError("TextureSaver::run begin");
-
-        TraceCommandEmitter traceCommandEmitter(mOutFile, mThreadId);
-
-        const auto textures = mRetracerContext.getTextureMap().GetCopy();
-        const auto revTextures = mRetracerContext.getTextureRevMap().GetCopy();
-        const auto revBuffers = mRetracerContext.getBufferRevMap().GetCopy();
-
-        // To download textures, we need GL_PIXEL_PACK_BUFFER to be unbound.
-        // To upload textures in the trace, we need GL_PIXEL_UNPACK_BUFFER to be unbound.
-
-        // Find currently bound GL_PIXEL_UNPACK_BUFFER in the tracefile
-        GLint oldUnpackBuffer = 0;
-        _glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &oldUnpackBuffer);
-
+        if (funcId >= (int)mKinds.size())
+        {
+            mKinds.resize(funcId + 1, Ref(UNKNOWN));
+        }
+        Ref& ref = mKinds[funcId];
+        if (ref.type == UNKNOWN)
+        {
+            ref = refOf(funcName);
+        }
+        const unsigned int* args = reinterpret_cast<const unsigned int*>(src);
+        switch (ref.type)
+        {
+        case NAMED:
+            mWritten.insert(args[ref.arg]);
+            break;
+        case BOUND:
+            markBound(context, args[ref.arg]);
+            break;
+        case UPLOAD:
+            {
+                GLint unpackBuffer = 0;
+                _glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &unpackBuffer);
+                if (unpackBuffer != 0)
+                {
+                    markBound(context, args[ref.arg]);
+                }
+            }
+            break;
+        case IMAGE:
+            if (!mImages)
+            {
+                DBG_LOG("Restoring all textures, the trace calls %s\n", funcName);
+            }
+            mImages = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Whether the texture with the given trace name only has contents from uploads
+    bool uploadedOnly(unsigned int name) const
+    {
+        return mEnabled && !mImages && mWritten.count(name) == 0;
+    }
+
+private:
+    enum Type { UNKNOWN = -1, OTHER, NAMED, BOUND, UPLOAD, IMAGE };
+
+    struct Ref
+    {
+        Ref(signed char _type, signed char _arg = 0)
+            : type(_type), arg(_arg)
+        {}
+        signed char type;
+        signed char arg; // which of the leading 32 bit arguments is the texture name or target
+    };
+
+    static Ref refOf(const char* name)
+    {
+        if (strncmp(name, "eglCreateImage", 14) == 0)
+        {
+            return Ref(IMAGE); // a texture that is the source of one can be written through the others
+        }
+        if (strncmp(name, "glFramebufferTexture2D", 22) == 0 || strncmp(name, "glFramebufferTexture3D", 22) == 0)
+        {
+            return Ref(NAMED, 3);
+        }
+        if (strncmp(name, "glFramebufferTexture", 20) == 0)
+        {
+            return Ref(NAMED, 2);
+        }
+        if (strcmp(name, "glBindImageTexture") == 0)
+        {
+            return Ref(NAMED, 1);
+        }
+        if (strncmp(name, "glCopyImageSubData", 18) == 0)
+        {
+            return Ref(NAMED, 6);
+        }
+        if (strncmp(name, "glTextureView", 13) == 0)
+        {
+            return Ref(NAMED, 0);
+        }
+        if (strncmp(name, "glCopyTex", 9) == 0 || strncmp(name, "glEGLImageTargetTex", 19) == 0)
+        {
+            return Ref(BOUND, 0);
+        }
+        if (strncmp(name, "glTexImage", 10) == 0 || strncmp(name, "glTexSubImage", 13) == 0
+            || strncmp(name, "glCompressedTex", 15) == 0)
+        {
+            return Ref(UPLOAD, 0);
+        }
+        return Ref(OTHER);
+    }
+
+    void markBound(retracer::Context& context, GLenum target)
+    {
+        GLenum binding = GL_NONE;
+        switch (target)
+        {
+        case GL_TEXTURE_2D: binding = GL_TEXTURE_BINDING_2D; break;
+        case GL_TEXTURE_3D: binding = GL_TEXTURE_BINDING_3D; break;
+        case GL_TEXTURE_2D_ARRAY: binding = GL_TEXTURE_BINDING_2D_ARRAY; break;
+        case GL_TEXTURE_CUBE_MAP_ARRAY: binding = GL_TEXTURE_BINDING_CUBE_MAP_ARRAY; break;
+        case GL_TEXTURE_EXTERNAL_OES: binding = GL_TEXTURE_BINDING_EXTERNAL_OES; break;
+        default:
+            if (target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z)
+            {
+                binding = GL_TEXTURE_BINDING_CUBE_MAP;
+            }
+            break;
+        }
+        GLint texture = 0;
+        if (binding != GL_NONE)
+        {
+            _glGetIntegerv(binding, &texture);
+        }
+        mWritten.insert(context.getTextureRevMap().RValue(texture));
+    }
+
+    bool mEnabled;
+    bool mImages; // the trace makes EGL images, every texture has to be restored
+    std::vector<Ref> mKinds; // for each function id, see refOf()
+    std::unordered_set<unsigned int> mWritten; // trace names of textures with contents from elsewhere
+};
+
+class TextureSaver
+{
+public:
+    // With a liveness, textures that it finds dead are left out. With dedup, level contents
+    // that repeat are only written once, see writeBlob(). With an upload tracker, textures that
+    // the fastforward trace uploads as they are are left out. With digests, levels that have not
+    // changed since the previous checkpoint are left out.
+    TextureSaver(retracer::Context& retracerContext, CallSink outFile, int threadId, ResourceLiveness* liveness, bool dedup,
+                 const UploadTracker* uploads, CheckpointDigests* digests)
+        : mRetracerContext(retracerContext), mOutFile(outFile), mThreadId(threadId), mScratchBuff(), mLiveness(liveness), mDedup(dedup)
+        , mUploads(uploads), mDigests(digests)
+    {
+        TexTypeInfo info2d("2D", GL_TEXTURE_2D, GL_TEXTURE_BINDING_2D, TraceCommandEmitter::Tex2D);
+        TexTypeInfo info2dArray("2D_Array", GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BINDING_2D_ARRAY, TraceCommandEmitter::Tex3D);
+        TexTypeInfo infoCubemap("Cubemap", GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BINDING_CUBE_MAP, TraceCommandEmitter::Tex2D);
+        TexTypeInfo infoCubemapArray("Cubemap_Array", GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_BINDING_CUBE_MAP_ARRAY, TraceCommandEmitter::Tex3D);
+        texTypeToInfo[DepthDumper::Tex2D] = info2d;
+        texTypeToInfo[DepthDumper::Tex2DArray] = info2dArray;
+        texTypeToInfo[DepthDumper::TexCubemap] = infoCubemap;
+        texTypeToInfo[DepthDumper::TexCubemapArray] = infoCubemapArray;
+
+        depthDumper.initializeDepthCopyer();
+    }
+
+    ~TextureSaver()
+    {
+    }
+
+    void run()
+    {
+        checkError("TextureSaver::run begin");
+
+        TraceCommandEmitter traceCommandEmitter(mOutFile, mThreadId);
+
+        const retracer::hmap<unsigned int>& textures = mRetracerContext.getTextureMap();
+        retracer::hmap<unsigned int>& revTextures = mRetracerContext.getTextureRevMap();
+
+        // To download textures, we need GL_PIXEL_PACK_BUFFER to be unbound.
+        // To upload textures in the trace, we need GL_PIXEL_UNPACK_BUFFER to be unbound.
+
+        // Find currently bound GL_PIXEL_UNPACK_BUFFER in the tracefile
+        GLint oldUnpackBuffer = 0;
+        _glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &oldUnpackBuffer);
+
         // Find corresponding buffer-id in the trace-file
-        GLint oldUnpackBufferTrace = 0;
-        auto search = revBuffers.find(oldUnpackBuffer);
-        if (search != revBuffers.end())
-            oldUnpackBufferTrace = search->second;
+        GLint oldUnpackBufferTrace = mRetracerContext.getBufferRevMap().RValue(oldUnpackBuffer);
         // Emit command to clear the binding. We restore it when done below.
         traceCommandEmitter.emitBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
@@ -1104,11 +1810,22 @@ public:
             {
                 continue;
             }
+            if (mLiveness && !mLiveness->live(ResourceLiveness::TEXTURE, traceTextureId))
+            {
+                DBG_LOG("Not saving texture %d, it is not used after the target\n", traceTextureId);
+                continue;
+            }
+            if (mUploads && mUploads->uploadedOnly(traceTextureId))
+            {
+                DBG_LOG("Not saving texture %d, it only has contents from uploads that are kept\n", traceTextureId);
+                mUploadedOnly++;
+                continue;
+            }
 
             //assert(revTextures[retraceTextureId] == traceTextureId);
-            if (revTextures.at(retraceTextureId) != traceTextureId)
+            if (revTextures.RValue(retraceTextureId) != traceTextureId)
             {
-                DBG_LOG("WARNING: Reverse texture lookup failed: retrace-ID %d's rev. was %d, but should be %d.\n", retraceTextureId, revTextures.at(retraceTextureId), traceTextureId);
+                DBG_LOG("WARNING: Reverse texture lookup failed: retrace-ID %d's rev. was %d, but should be %d.\n", retraceTextureId, revTextures.RValue(retraceTextureId), traceTextureId);
             }
 
             bool ok = false;
@@ -1131,6 +1848,20 @@ public:
             }
         }
 
+        // Write out the readbacks still in flight and release their buffers
+        flushPending(true);
+        _glDeleteBuffers(mBuffers.size(), mBuffers.data());
+        mBuffers.clear();
+        mFreeBuffers.clear();
+        if (mUploadedOnly > 0)
+        {
+            DBG_LOG("Kept the uploads of %u textures instead of saving them\n", mUploadedOnly);
+        }
+        if (mBlobsStored > 0)
+        {
+            DBG_LOG("Wrote %u texture levels as references to others with the same contents\n", mBlobsStored);
+        }
+
         // Restore values
         for (unsigned int i = 0; i < sizeof(storeParams)/sizeof(storeParams[0]); i++)
         {
@@ -1361,6 +2092,188 @@ private:
         return false;
     }
 
+    // The texture data is read back into pixel pack buffers, and the commands that go into the
+    // trace are queued behind the readbacks, so that the GPU copies out the next layers and
+    // levels while the earlier ones are mapped and written out. The queue is written out in
+    // order, so the trace gets the same commands as if every readback waited for its data.
+    struct PendingCommand
+    {
+        std::function<void(const char*)> emit; // given the data read back, if there is any
+        GLuint buffer; // pixel pack buffer of the readback, 0 for commands without one
+        size_t size;
+    };
+
+    static const size_t MAX_PENDING_READBACKS = 8;
+    static const size_t MAX_PENDING_BYTES = 256 * 1024 * 1024;
+
+    void queue(const std::function<void(const char*)>& emit)
+    {
+        if (mPending.empty())
+        {
+            emit(nullptr);
+            return;
+        }
+        PendingCommand command = { emit, 0, 0 };
+        mPending.push_back(command);
+    }
+
+    void queueBindTexture(TraceCommandEmitter& traceCommandEmitter, GLenum target, GLuint texture)
+    {
+        queue([&traceCommandEmitter, target, texture](const char*) { traceCommandEmitter.emitBindTexture(target, texture); });
+    }
+
+    // Depth of GL_DEPTH_COMPONENT16 and 24 textures comes from depthDumper as floats, but goes
+    // into the trace as GL_UNSIGNED_INT
+    static void depthToUnsigned(char* data, size_t texels)
+    {
+        float *fp = (float*)data;
+        unsigned int *ip = (unsigned int *)data;
+        for (size_t i = 0; i < texels; ++i) {
+            unsigned int factor = 0xFFFFFFFFu;
+            ip[i] = (double)fp[i] * factor;
+        }
+    }
+
+    // A pack buffer of the given size for a readback
+    GLuint takeBuffer(size_t size)
+    {
+        GLuint buffer = 0;
+        if (mFreeBuffers.empty())
+        {
+            _glGenBuffers(1, &buffer);
+            mBuffers.push_back(buffer);
+        }
+        else
+        {
+            buffer = mFreeBuffers.back();
+            mFreeBuffers.pop_back();
+        }
+        _glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        _glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        _glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return buffer;
+    }
+
+    // Reads from the current read framebuffer into a pixel pack buffer and queues emit to be
+    // called with the data once it is needed. Returns false if glReadPixels failed.
+    bool readPixelsAsync(GLsizei width, GLsizei height, GLenum format, GLenum type, size_t size, const std::function<void(const char*)>& emit)
+    {
+        const GLuint buffer = takeBuffer(size);
+
+        checkError("_glReadPixels begin");
+        DBG_LOG("ReadPixels: w=%d, h=%d, format=0x%X=%s, type=0x%X=%s, pack buffer=%u\n", width, height, format, EnumString(format), type, EnumString(type), buffer);
+        _glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        _glReadPixels(0, 0, width, height, format, type, 0);
+        _glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (checkError("_glReadPixels end"))
+        {
+            mFreeBuffers.push_back(buffer);
+            return false;
+        }
+        queueReadback(buffer, size, emit);
+        return true;
+    }
+
+    // Like readPixelsAsync(), but packs the depth of a level, and its layer or face, of a depth
+    // texture with depthDumper's compute shader, so that the textures of a checkpoint are
+    // packed one after the other without waiting for any of them. Returns false if that cannot
+    // be done, and get_depth_texture_image() has to be used.
+    bool packDepthAsync(GLuint texture, GLsizei width, GLsizei height, GLint level, GLint internalFormat, DepthDumper::TexType texType, int layer,
+                        size_t size, const std::function<void(const char*)>& emit)
+    {
+        const GLuint buffer = takeBuffer(size);
+        checkError("packDepth begin");
+        if (!depthDumper.pack_depth_texture(texture, width, height, level, buffer, internalFormat, texType, layer) || checkError("packDepth end"))
+        {
+            mFreeBuffers.push_back(buffer);
+            return false;
+        }
+        DBG_LOG("depth pack: w=%d, h=%d, level=%d, layer=%d, internalFormat=0x%X, pack buffer=%u\n", width, height, level, layer, internalFormat, buffer);
+        queueReadback(buffer, size, emit);
+        return true;
+    }
+
+    void queueReadback(GLuint buffer, size_t size, const std::function<void(const char*)>& emit)
+    {
+        PendingCommand command = { emit, buffer, size };
+        mPending.push_back(command);
+        mPendingReadbacks++;
+        mPendingBytes += size;
+        while (mPendingReadbacks > MAX_PENDING_READBACKS || mPendingBytes > MAX_PENDING_BYTES)
+        {
+            flushPending(false);
+        }
+    }
+
+    // Level contents that repeat are written like the tracer does with BlobStoreMinSize: the
+    // first time as they are, the second time as a definition of a blob and after that as
+    // references to it, so that the retracer only keeps those that repeat. The ids are kept
+    // clear of those of the tracer, which may still be referred to after the target, and of
+    // those of earlier checkpoints, which --deltas chains into one trace.
+    static const unsigned int MIN_BLOB_SIZE = 1024;
+    static const unsigned int FIRST_BLOB_ID = 0x80000000u;
+
+    void writeBlob(unsigned int size, const common::ContentDigest& digest, unsigned int& marker, unsigned int& id)
+    {
+        static std::atomic<unsigned int> blobsDefined(0);
+        if (!mDedup || size < MIN_BLOB_SIZE)
+        {
+            return;
+        }
+        const auto result = mBlobs.insert(std::make_pair(std::make_pair(size, digest), 0u));
+        unsigned int& blob = result.first->second;
+        if (result.second)
+        {
+            return;
+        }
+        if (blob == 0)
+        {
+            blob = FIRST_BLOB_ID + blobsDefined++;
+            marker = BLOB_STORE_DEFINE;
+        }
+        else
+        {
+            marker = BLOB_STORE_REFERENCE;
+            mBlobsStored++;
+        }
+        id = blob;
+    }
+
+    // Writes out the queued commands up to and including the oldest readback, or all of them
+    void flushPending(bool all)
+    {
+        while (!mPending.empty())
+        {
+            const PendingCommand command = mPending.front();
+            mPending.pop_front();
+            if (command.buffer == 0)
+            {
+                command.emit(nullptr);
+                continue;
+            }
+
+            _glBindBuffer(GL_PIXEL_PACK_BUFFER, command.buffer);
+            const char* data = static_cast<const char*>(_glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, command.size, GL_MAP_READ_BIT));
+            if (data)
+            {
+                command.emit(data);
+                _glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            else
+            {
+                DBG_LOG("---->> Failed to save the texture because its pack buffer could not be mapped. <<-----\n");
+            }
+            _glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            mFreeBuffers.push_back(command.buffer);
+            mPendingReadbacks--;
+            mPendingBytes -= command.size;
+            if (!all)
+            {
+                break;
+            }
+        }
+    }
+
     // Returns TRUE if the texture is a texture of the type we want (even if the function failed to save it), and FALSE if it isn't
     bool saveTexture(DepthDumper::TexType texType, TraceCommandEmitter& traceCommandEmitter, unsigned int traceTextureId, unsigned int retraceTextureId)
     {
@@ -1425,7 +2338,7 @@ private:
         DBG_LOG("Texture has internalformat: %s (0x%x)\n", EnumString(texInfo.mInternalFormat), texInfo.mInternalFormat);
 
         // Write BindTexture
-        traceCommandEmitter.emitBindTexture(typeInfo.target, traceTextureId);
+        queueBindTexture(traceCommandEmitter, typeInfo.target, traceTextureId);
 
         // Save each mipmap level
         const int numMipmapLevels = texInfo.mMipmapSizes.size();
@@ -1450,7 +2363,7 @@ private:
                         "its internalformat is %s. It cannot be bound to a FBO. "
                         "(Assumption: it can't be changed after upload.)\n",
                         traceTextureId, retraceTextureId, EnumString(texInfo.mInternalFormat));
-                traceCommandEmitter.emitBindTexture(typeInfo.target, traceRestoreTexture);
+                queueBindTexture(traceCommandEmitter, typeInfo.target, traceRestoreTexture);
                 _glBindTexture(typeInfo.target, retraceRestoreTexure);
                 return retval;
             }
@@ -1569,7 +2482,7 @@ private:
                 {
                     DBG_LOG("Couldn't figure out format to use for internalformat 0x%x\n", texInfo.mInternalFormat);
                     DBG_LOG("Querying the texture determined it wasn't RGB(A) (using glGetTexLevelParameteriv with GL_TEXTURE_X_TYPE), and those cases aren't handled yet.\n");
-                    traceCommandEmitter.emitBindTexture(GL_TEXTURE_2D, traceRestoreTexture);
+                    queueBindTexture(traceCommandEmitter, GL_TEXTURE_2D, traceRestoreTexture);
                     _glBindTexture(GL_TEXTURE_2D, retraceRestoreTexure);
                     return retval;
                 }
@@ -1601,7 +2514,6 @@ private:
             }
 #endif
 
-            ScratchBuffer texData(textureSize);
             bool readError = false;
 
             // Read texture data
@@ -1623,9 +2535,68 @@ private:
             int textureNum = isCubemap ? 6 : mipmapSize.depth;
             for (int i = 0; i < textureNum; ++i)          // all layers of array texture
             {
+                GLenum target = 0;
+                int zoffset = 0, depth = 0;
+                switch (texType) {
+                case DepthDumper::Tex2D:
+                    target = GL_TEXTURE_2D;
+                    zoffset = 0;
+                    depth = 0;
+                    break;
+                case DepthDumper::Tex2DArray:
+                    target = GL_TEXTURE_2D_ARRAY;
+                    zoffset = i;
+                    depth = 1;
+                    break;
+                case DepthDumper::TexCubemap:
+                    target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + i;
+                    zoffset = 0;
+                    depth = 0;
+                    break;
+                case DepthDumper::TexCubemapArray:
+                    target = GL_TEXTURE_CUBE_MAP_ARRAY;
+                    zoffset = i;
+                    depth = 1;
+                    break;
+                default:
+                    break;
+                }
+
+                // Write glTexSubImage2D for this level once its data has been read back
+                const TraceCommandEmitter::TexDimension dimension = typeInfo.texDimension;
+                const GLsizei width = mipmapSize.width;
+                const GLsizei height = mipmapSize.height;
+                const GLenum format = readTexFormat;
+                const GLenum type = readTexType;
+                std::function<void(const char*)> emitLevel = [this, &traceCommandEmitter, traceTextureId, dimension, target, curMipmapLevel, zoffset, width, height, depth, format, type, textureSize](const char* data)
+                {
+                    const common::ContentDigest digest = (mDedup || mDigests) ? common::ContentDigest(data, textureSize) : common::ContentDigest();
+                    if (mDigests && !mDigests->changed(CheckpointDigests::levelKey(traceTextureId, target, curMipmapLevel, zoffset), textureSize, digest))
+                    {
+                        return; // it still holds these contents from the checkpoint that this one is a delta on
+                    }
+                    unsigned int blobMarker = 0;
+                    unsigned int blobId = 0;
+                    writeBlob(textureSize, digest, blobMarker, blobId);
+                    traceCommandEmitter.emitTexSubImage(dimension, // dimension
+                        target,             // target
+                        curMipmapLevel,     // level
+                        0,                  // xoffset
+                        0,                  // yoffset
+                        zoffset,            // zoffset
+                        width,              // width
+                        height,             // height
+                        depth,              // depth
+                        format,             // format
+                        type,               // type
+                        textureSize,
+                        data,
+                        blobMarker,
+                        blobId);
+                };
+
                 _glGenFramebuffers(1, &fbo);
                 _glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
-
                 if (readTexFormat == GL_DEPTH_COMPONENT || readTexFormat == GL_DEPTH_STENCIL) {
 #ifdef ENABLE_X11
                     if (isArray) {
@@ -1676,87 +2647,53 @@ private:
 // And it passed the test of GFXbench 5 Aztec whose depth texture internalFormat is GL_DEPTH_COMPONENT24.
 #ifdef ENABLE_X11
                 _glReadBuffer(GL_COLOR_ATTACHMENT0);
-
-                checkError("_glReadPixels begin");
+                if (!readError)
                 {
-                    DBG_LOG("ReadPixels: w=%d, h=%d, format=0x%X=%s, type=0x%X=%s, data=%p\n", mipmapSize.width, mipmapSize.height, readTexFormat, EnumString(readTexFormat), readTexType, EnumString(readTexType), texData.bufferPtr());
-                    _glReadPixels(0, 0, mipmapSize.width, mipmapSize.height, readTexFormat, readTexType, texData.bufferPtr());
+                    readError |= !readPixelsAsync(width, height, format, type, textureSize, emitLevel);
                 }
-                readError |= checkError("_glReadPixels end");
 #else   // ENABLE_X11 not being defined
                 if (readTexFormat == GL_DEPTH_COMPONENT || readTexFormat == GL_DEPTH_STENCIL) {
-                    depthDumper.get_depth_texture_image(retraceTextureId, mipmapSize.width, mipmapSize.height, texData.bufferPtr(), texInfo.mInternalFormat, texType, i);
-                    if (texInfo.mInternalFormat == GL_DEPTH_COMPONENT16 || texInfo.mInternalFormat == GL_DEPTH_COMPONENT24) {
-                        float *fp = (float*)texData.bufferPtr();
-                        unsigned int *ip = (unsigned int *)texData.bufferPtr();
-                        for (int i = 0; i < mipmapSize.width * mipmapSize.height; ++i) {
-                            unsigned int factor = 0xFFFFFFFFu;
-                            ip[i] = (double)fp[i] * factor;
-                        }
-                    }
-                    else if (texInfo.mInternalFormat == GL_DEPTH_COMPONENT32F) {
+                    const bool toUnsigned = texInfo.mInternalFormat == GL_DEPTH_COMPONENT16 || texInfo.mInternalFormat == GL_DEPTH_COMPONENT24;
+                    if (texInfo.mInternalFormat == GL_DEPTH_COMPONENT32F) {
                         DBG_LOG("WARNING: The texture of internalFormat GL_DEPTH_COMPONENT32F was never tested before. So there might be some problems!\n");
                     }
-                    DBG_LOG("depth dump: w=%d, h=%d, format=0x%X=%s, type=0x%X=%s, data=%p\n", mipmapSize.width, mipmapSize.height, readTexFormat, EnumString(readTexFormat), readTexType, EnumString(readTexType), texData.bufferPtr());
+                    std::function<void(const char*)> emitDepth = emitLevel;
+                    if (toUnsigned) {
+                        emitDepth = [emitLevel, textureSize](const char* data)
+                        {
+                            std::vector<char> texels(data, data + textureSize);
+                            depthToUnsigned(texels.data(), textureSize / 4);
+                            emitLevel(texels.data());
+                        };
+                    }
+                    if (!readError && packDepthAsync(retraceTextureId, width, height, curMipmapLevel, texInfo.mInternalFormat, texType, i, textureSize, emitDepth)) {
+                        _glDeleteFramebuffers(1, &fbo);
+                        checkError("Read texture data end");
+                        continue;
+                    }
+                    std::shared_ptr<ScratchBuffer> texData = std::make_shared<ScratchBuffer>(textureSize);
+                    depthDumper.get_depth_texture_image(retraceTextureId, mipmapSize.width, mipmapSize.height, texData->bufferPtr(), texInfo.mInternalFormat, texType, i);
+                    if (toUnsigned) {
+                        depthToUnsigned(texData->bufferPtr(), mipmapSize.width * mipmapSize.height);
+                    }
+                    DBG_LOG("depth dump: w=%d, h=%d, format=0x%X=%s, type=0x%X=%s, data=%p\n", mipmapSize.width, mipmapSize.height, readTexFormat, EnumString(readTexFormat), readTexType, EnumString(readTexType), texData->bufferPtr());
+                    if (!readError)
+                    {
+                        queue([texData, emitLevel](const char*) { emitLevel((const char*)texData->bufferPtr()); });
+                    }
                 }
                 else {
                     _glReadBuffer(GL_COLOR_ATTACHMENT0);
-
-                    checkError("_glReadPixels begin");
+                    if (!readError)
                     {
-                        DBG_LOG("ReadPixels: w=%d, h=%d, format=0x%X=%s, type=0x%X=%s, data=%p\n", mipmapSize.width, mipmapSize.height, readTexFormat, EnumString(readTexFormat), readTexType, EnumString(readTexType), texData.bufferPtr());
-                        _glReadPixels(0, 0, mipmapSize.width, mipmapSize.height, readTexFormat, readTexType, texData.bufferPtr());
+                        readError |= !readPixelsAsync(width, height, format, type, textureSize, emitLevel);
                     }
-                    readError |= checkError("_glReadPixels end");
                 }
 #endif  // ENABLE_X11 end
                 _glDeleteFramebuffers(1, &fbo);
                 checkError("Read texture data end");
 
-                // Write glTexSubImage2D for this level
-                if(!readError)
-                {
-                    GLenum target = 0;
-                    int zoffset = 0, depth = 0;
-                    switch (texType) {
-                    case DepthDumper::Tex2D:
-                        target = GL_TEXTURE_2D;
-                        zoffset = 0;
-                        depth = 0;
-                        break;
-                    case DepthDumper::Tex2DArray:
-                        target = GL_TEXTURE_2D_ARRAY;
-                        zoffset = i;
-                        depth = 1;
-                        break;
-                    case DepthDumper::TexCubemap:
-                        target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + i;
-                        zoffset = 0;
-                        depth = 0;
-                        break;
-                    case DepthDumper::TexCubemapArray:
-                        target = GL_TEXTURE_CUBE_MAP_ARRAY;
-                        zoffset = i;
-                        depth = 1;
-                        break;
-                    default:
-                        break;
-                    }
-                    traceCommandEmitter.emitTexSubImage(typeInfo.texDimension, // dimension
-                        target,             // target
-                        curMipmapLevel,     // level
-                        0,                  // xoffset
-                        0,                  // yoffset
-                        zoffset,            // zoffset
-                        mipmapSize.width,   // width
-                        mipmapSize.height,  // height
-                        depth,              // depth
-                        readTexFormat,      // format
-                        readTexType,        // type
-                        textureSize,
-                        (const char*) texData.bufferPtr());
-                }
-                else
+                if (readError)
                 {
                     DBG_LOG("---->> Failed to save the texture because glReadPixels failed. <<-----\n");
                 }
@@ -1768,7 +2705,7 @@ private:
         }
 
         // Restore old tex in trace
-        traceCommandEmitter.emitBindTexture(typeInfo.target, traceRestoreTexture);
+        queueBindTexture(traceCommandEmitter, typeInfo.target, traceRestoreTexture);
 
         // Restore previously bound texture
         _glBindTexture(typeInfo.target, retraceRestoreTexure);
@@ -1778,9 +2715,21 @@ private:
     }
 private:
     retracer::Context& mRetracerContext;
-    common::OutFile& mOutFile;
+    CallSink mOutFile;
     int mThreadId;
     ScratchBuffer mScratchBuff;
+    std::deque<PendingCommand> mPending;
+    std::vector<GLuint> mBuffers;
+    std::vector<GLuint> mFreeBuffers;
+    size_t mPendingReadbacks = 0;
+    size_t mPendingBytes = 0;
+    ResourceLiveness* mLiveness;
+    bool mDedup;
+    std::map<std::pair<unsigned int, common::ContentDigest>, unsigned int> mBlobs; // blob id of contents seen before, 0 if seen once
+    unsigned int mBlobsStored = 0;
+    const UploadTracker* mUploads;
+    unsigned int mUploadedOnly = 0;
+    CheckpointDigests* mDigests;
 };
 
 class DefaultFboSaver
@@ -2002,7 +2951,7 @@ private:
     }
 
     template <class T>
-    T getObjectMaxId(std::unordered_map<T, T> &ObjectMap)
+    T getObjectMaxId(const retracer::hmap<T> &ObjectMap)
     {
         T maxId = 0;
         for (const auto it: ObjectMap)
@@ -2368,7 +3317,7 @@ private:
             v_TexCoordinate = a_Position * 0.5 + vec2(0.5, 0.5);\n\
             gl_Position = vec4(a_Position, 0.0f, 1.0f);\n\
             }";
-        auto shaders = mRetracerContext.getShaderMap().GetCopy();
+        const retracer::hmap<unsigned int>& shaders = mRetracerContext.getShaderMap();
         vs = getObjectMaxId(shaders) + 1;
         mCmdEmitter.emitCreateShader(GL_VERTEX_SHADER, vs);
         mCmdEmitter.emitShaderSource(vs, 1, &VsCode, 0);
@@ -2390,7 +3339,7 @@ private:
         mCmdEmitter.emitCompileShader(fs);
 
         _glGetIntegerv(GL_CURRENT_PROGRAM, (GLint*)&mProgram);
-        auto programs = mRetracerContext.getProgramMap().GetCopy();
+        const retracer::hmap<unsigned int>& programs = mRetracerContext.getProgramMap();
         mProgram = mRetracerContext.getProgramRevMap().RValue(mProgram);
 
         mRenderProgram = getObjectMaxId(programs) + 1;
@@ -2416,7 +3365,7 @@ private:
         _glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &mTex2DMaxFilter);
         _glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, &mTex2DCompareMode);
 
-        auto textures = mRetracerContext.getTextureMap().GetCopy();
+        const retracer::hmap<unsigned int>& textures = mRetracerContext.getTextureMap();
         mFbo0Tex = getObjectMaxId(textures)+1;
         mCmdEmitter.emitActiveTexture(GL_TEXTURE0);
         mCmdEmitter.emitGenTextures(1, &mFbo0Tex);
@@ -2445,7 +3394,7 @@ private:
         mArrayBuffer = mRetracerContext.getBufferRevMap().RValue(mArrayBuffer);
 
         GLfloat v[] = {1.0, 1.0, -1.0, 1.0, -1.0, -1.0, 1.0, -1.0};
-        auto buffers = mRetracerContext.getBufferMap().GetCopy();
+        const retracer::hmap<unsigned int>& buffers = mRetracerContext.getBufferMap();
         mVB = getObjectMaxId(buffers) + 1;
 
         mCmdEmitter.emitGenBuffers(1, &mVB);
@@ -2686,6 +3635,224 @@ private:
     TraceCommandEmitter mCmdEmitter;
 };
 
+// Skips draws and clears into the default framebuffer before the last target frame, for
+// --skipdraws. Their results only show on screen: the default framebuffer is undefined after
+// each swap, and the fastforward trace clears it or saves it at the target. So they can be
+// skipped in every frame that does not read the default framebuffer back, which a dependency
+// pass over the trace finds before replaying it. Draws into framebuffer objects are still run,
+// since render-to-texture results may be used later, and so are draws with other side
+// effects: with transform feedback or queries active, or with a program that writes buffers
+// or images. Dispatches are always run, their outputs cannot be told apart from their inputs.
+class DrawSkipper
+{
+public:
+    DrawSkipper()
+        : mLastFrame(0)
+        , mContext(NULL)
+        , mVersion(0)
+        , mSkipped(0)
+    {}
+
+    // The dependency pass: find the frames that read the default framebuffer back, up to the
+    // last target frame. Returns false if draws cannot be skipped in this trace at all.
+    bool scan(const std::string& fileName, const std::vector<unsigned int>& targets, bool restoreFbo0, int retraceTid)
+    {
+        mLastFrame = 0;
+        common::InFile file;
+        if (targets.empty() || !file.Open(fileName.c_str()))
+        {
+            DBG_LOG("Draws are only skipped when fastforwarding to a target frame\n");
+            return false;
+        }
+
+        std::vector<signed char> kinds; // for each function id, see kindOf()
+        void* fptr = NULL;
+        common::BCall_vlen call;
+        char* src = NULL;
+        unsigned int frame = 0;
+        while (frame < targets.back() && file.GetNextCall(fptr, call, src))
+        {
+            if (call.funcId >= kinds.size())
+            {
+                kinds.resize(call.funcId + 1, UNKNOWN);
+            }
+            signed char& kind = kinds[call.funcId];
+            if (kind == UNKNOWN)
+            {
+                kind = kindOf(file.ExIdToName(call.funcId));
+            }
+            if (kind == SURFACE_READER)
+            {
+                // Surfaces that are read as textures or copied, or that keep their contents
+                // over swaps, make every draw into them count
+                DBG_LOG("Not skipping draws, the trace calls %s in frame %u\n", file.ExIdToName(call.funcId), frame);
+                return false;
+            }
+            if (kind == FRAMEBUFFER_READER)
+            {
+                mReadFrames.insert(frame);
+            }
+            else if (kind == SWAP && call.tid == retraceTid)
+            {
+                frame++;
+            }
+        }
+        file.Close();
+
+        if (restoreFbo0)
+        {
+            // The default framebuffer is saved at the end of the frame before each target
+            for (unsigned int target : targets)
+            {
+                mReadFrames.insert(target - 1);
+            }
+        }
+        mLastFrame = targets.back();
+        DBG_LOG("Skipping draws into the default framebuffer in frames before %u, except in %u frames that read it\n", mLastFrame, (unsigned)mReadFrames.size());
+        return true;
+    }
+
+    bool enabled() const { return mLastFrame > 0; }
+
+    // Whether the call can be left out. Only called for draws, clears and blits.
+    bool skip(retracer::Context& context, const char* funcName, unsigned int frame)
+    {
+        if (frame >= mLastFrame || mReadFrames.count(frame) > 0)
+        {
+            return false;
+        }
+        if (&context != mContext)
+        {
+            // Program names are only unique within a share group, and ES 2 has none of the side effects
+            mPrograms.clear();
+            mContext = &context;
+            int major = 2, minor = 0;
+            sscanf((const char*)_glGetString(GL_VERSION), "OpenGL ES %d.%d", &major, &minor);
+            mVersion = major * 10 + minor;
+        }
+
+        // In offscreen mode the default framebuffer is an object of the retracer, which has no trace name either
+        GLint drawFramebuffer = 0;
+        _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+        if (drawFramebuffer != 0 && context.getFramebufferRevMap().RValue(drawFramebuffer) != 0)
+        {
+            return false;
+        }
+
+        if (strncmp(funcName, "glDraw", 6) == 0 && mVersion >= 30)
+        {
+            GLboolean feedback = GL_FALSE;
+            _glGetBooleanv(GL_TRANSFORM_FEEDBACK_ACTIVE, &feedback);
+            if (feedback || queryActive() || !programWithoutSideEffects())
+            {
+                return false;
+            }
+        }
+        mSkipped++;
+        return true;
+    }
+
+    // A program can be linked again with other shaders
+    void forgetPrograms() { mPrograms.clear(); }
+
+    unsigned long long skipped() const { return mSkipped; }
+
+private:
+    enum Kind { UNKNOWN = -1, OTHER, SWAP, FRAMEBUFFER_READER, SURFACE_READER };
+
+    static signed char kindOf(const char* name)
+    {
+        if (strncmp(name, "eglSwapBuffers", 14) == 0)
+        {
+            return SWAP;
+        }
+        if (strcmp(name, "eglBindTexImage") == 0 || strcmp(name, "eglCopyBuffers") == 0 || strcmp(name, "eglSurfaceAttrib") == 0)
+        {
+            return SURFACE_READER;
+        }
+        if (strncmp(name, "glReadPixels", 12) == 0 || strncmp(name, "glReadnPixels", 13) == 0
+            || strncmp(name, "glCopyTex", 9) == 0 || strcmp(name, "glBlitFramebuffer") == 0)
+        {
+            return FRAMEBUFFER_READER;
+        }
+        return OTHER;
+    }
+
+    static bool queryActive()
+    {
+        static const GLenum targets[] = { GL_ANY_SAMPLES_PASSED, GL_ANY_SAMPLES_PASSED_CONSERVATIVE, GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN };
+        for (GLenum target : targets)
+        {
+            GLint query = 0;
+            _glGetQueryiv(target, GL_CURRENT_QUERY, &query);
+            if (query != 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool programWithoutSideEffects()
+    {
+        GLint program = 0;
+        _glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+        if (program == 0)
+        {
+            return false; // a program pipeline, or nothing to draw with
+        }
+        auto it = mPrograms.find(program);
+        if (it == mPrograms.end())
+        {
+            static const GLenum interfaces[] = { GL_SHADER_STORAGE_BLOCK, GL_ATOMIC_COUNTER_BUFFER };
+            bool none = true;
+            for (GLenum iface : interfaces)
+            {
+                GLint count = 0;
+                if (mVersion >= 31)
+                {
+                    _glGetProgramInterfaceiv(program, iface, GL_ACTIVE_RESOURCES, &count);
+                }
+                none = none && count == 0;
+            }
+            GLint uniforms = 0;
+            _glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniforms);
+            for (GLint i = 0; i < uniforms && none; i++)
+            {
+                GLint size = 0;
+                GLenum type = GL_NONE;
+                char name[1];
+                _glGetActiveUniform(program, i, sizeof(name), NULL, &size, &type, name);
+                none = !isImageType(type);
+            }
+            it = mPrograms.insert(std::make_pair(program, none)).first;
+        }
+        return it->second;
+    }
+
+    static bool isImageType(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_IMAGE_2D: case GL_IMAGE_3D: case GL_IMAGE_CUBE: case GL_IMAGE_2D_ARRAY:
+        case GL_INT_IMAGE_2D: case GL_INT_IMAGE_3D: case GL_INT_IMAGE_CUBE: case GL_INT_IMAGE_2D_ARRAY:
+        case GL_UNSIGNED_INT_IMAGE_2D: case GL_UNSIGNED_INT_IMAGE_3D: case GL_UNSIGNED_INT_IMAGE_CUBE: case GL_UNSIGNED_INT_IMAGE_2D_ARRAY:
+        case GL_IMAGE_BUFFER_EXT: case GL_INT_IMAGE_BUFFER_EXT: case GL_UNSIGNED_INT_IMAGE_BUFFER_EXT:
+        case GL_IMAGE_CUBE_MAP_ARRAY_EXT: case GL_INT_IMAGE_CUBE_MAP_ARRAY_EXT: case GL_UNSIGNED_INT_IMAGE_CUBE_MAP_ARRAY_EXT:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    unsigned int mLastFrame; // 0 when not skipping
+    std::unordered_set<unsigned int> mReadFrames;
+    std::unordered_map<GLint, bool> mPrograms; // whether the program has no side effects
+    retracer::Context* mContext;
+    int mVersion; // of the context, major * 10 + minor
+    unsigned long long mSkipped;
+};
+
 } // End RetraceAndTrim namespace
 
 static void injectClear(retracer::Context& retracerContext, common::OutFile& out, retracer::Retracer& retracer)
@@ -2693,11 +3860,7 @@ static void injectClear(retracer::Context& retracerContext, common::OutFile& out
     // Save state
     GLint oldBoundFramebuffer = 0;
     _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &oldBoundFramebuffer);
-    const auto revFramebuffers = retracerContext.getFramebufferRevMap().GetCopy();
-    GLint oldBoundFramebufferTrace = 0;
-    auto search = revFramebuffers.find(oldBoundFramebufferTrace);
-    if (search != revFramebuffers.end())
-        oldBoundFramebufferTrace = search->second;
+    GLint oldBoundFramebufferTrace = retracerContext.getFramebufferRevMap().RValue(oldBoundFramebuffer);
     GLint oldColors[4];
     GLboolean oldColorMask[4];
     GLboolean stencil;
@@ -2741,9 +3904,93 @@ static void injectClear(retracer::Context& retracerContext, common::OutFile& out
 
 using namespace retracer;
 
-static void saveData(common::OutFile &out, unsigned int flags, Json::Value& ffJson)
+static RetraceAndTrim::ResourceLiveness gResourceLiveness;
+static RetraceAndTrim::UploadTracker gUploadTracker;
+static RetraceAndTrim::CheckpointDigests gCheckpointDigests;
+
+// The buffers and textures of a share group that another thread than the retrace thread has
+// current at a checkpoint, which that thread saves into memory while the retrace thread saves
+// its own. The pruning, delta and upload tracking state is that of the retrace thread, so they
+// are saved in full.
+struct GroupCheckpoint
+{
+    int tid;
+    unsigned int flags;
+    RetraceAndTrim::CallMemory calls;
+};
+
+static std::deque<std::atomic<GroupCheckpoint*> > gGroupCheckpoints; // what each replay thread is to save, if anything
+static std::mutex gGroupMutex;
+static std::condition_variable gGroupDone;
+static unsigned int gGroupsPending = 0;
+
+// Runs on the thread that has the share group current
+static void saveGroup(GroupCheckpoint& group)
+{
+    retracer::Context& context = *gRetracer.mState.mThreadArr[group.tid].getContext();
+    _glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    _glFinish();
+
+    const bool dedup = (group.flags & FASTFORWARD_PRUNE_RESTORE) != 0;
+    RetraceAndTrim::BufferSaver::run(context, group.calls, group.tid, NULL, dedup, NULL);
+    if (group.flags & FASTFORWARD_RESTORE_TEXTURES)
+    {
+        RetraceAndTrim::TextureSaver ts(context, group.calls, group.tid, NULL, dedup, NULL, NULL);
+        ts.run();
+    }
+
+    std::lock_guard<std::mutex> lock(gGroupMutex);
+    gGroupsPending--;
+    gGroupDone.notify_all();
+}
+
+// Hands each share group that other threads have current, other than that of the retrace
+// thread, to the first of them by trace thread id, so that the output is the same every run
+static void startGroups(std::vector<std::unique_ptr<GroupCheckpoint> >& groups, unsigned int flags)
+{
+    retracer::Retracer& retracer = gRetracer;
+    std::vector<std::pair<int, int> > threads(retracer.thread_remapping.begin(), retracer.thread_remapping.end());
+    std::sort(threads.begin(), threads.end());
+    std::unordered_set<const retracer::Context*> seen;
+    seen.insert(retracer.getCurrentContext().getShareGroup());
+    for (const auto& thread : threads)
+    {
+        const int tid = thread.first;
+        const retracer::Context* context = (tid >= 0 && tid < (int)retracer.mState.mThreadArr.size()) ? retracer.mState.mThreadArr[tid].getContext() : NULL;
+        if (tid == retracer.getCurTid() || context == NULL || !seen.insert(context->getShareGroup()).second)
+        {
+            continue;
+        }
+        DBG_LOG("Saving the share group current on thread %d on that thread\n", tid);
+        groups.emplace_back(new GroupCheckpoint{ tid, flags, RetraceAndTrim::CallMemory() });
+        {
+            std::lock_guard<std::mutex> lock(gGroupMutex);
+            gGroupsPending++;
+        }
+        gGroupCheckpoints.at(thread.second).store(groups.back().get());
+        retracer.handoffs.at(thread.second).wake();
+    }
+}
+
+// Waits for the other threads, then writes what they saved after the restore of the retrace thread
+static void finishGroups(const std::vector<std::unique_ptr<GroupCheckpoint> >& groups, common::OutFile& out)
+{
+    {
+        std::unique_lock<std::mutex> lock(gGroupMutex);
+        gGroupDone.wait(lock, []{ return gGroupsPending == 0; });
+    }
+    for (const auto& group : groups)
+    {
+        group->calls.writeTo(out);
+        DBG_LOG("Wrote %u calls restoring the share group of thread %d\n", (unsigned int)group->calls.sizes.size(), group->tid);
+    }
+}
+
+static void saveData(FastForwardOutput& output, unsigned int flags)
 {
     retracer::Retracer& retracer = gRetracer;
+    common::OutFile& out = *output.mOut;
+    Json::Value& ffJson = output.mJson;
 
     RetraceAndTrim::checkError("RetraceAndTrim state-saving begin");
 
@@ -2753,21 +4000,44 @@ static void saveData(common::OutFile &out, unsigned int flags, Json::Value& ffJs
     ffJson["GL_VENDOR"]   = (char*) _glGetString(GL_VENDOR);
     ffJson["GL_RENDERER"] = (char*) _glGetString(GL_RENDERER);
 
+    // Other share groups are saved on their own threads meanwhile
+    std::vector<std::unique_ptr<GroupCheckpoint> > groups;
+    startGroups(groups, flags);
+
     // Sync
     _glMemoryBarrier(GL_ALL_BARRIER_BITS);
     _glFinish();
 
+    const bool prune = (flags & FASTFORWARD_PRUNE_RESTORE) != 0;
+    RetraceAndTrim::ResourceLiveness* liveness = NULL;
+    if (prune && gResourceLiveness.enabled())
+    {
+        gResourceLiveness.checkpoint(retracer.getCurrentContext(), output.mTargetFrame, output.mEndFrame);
+        liveness = &gResourceLiveness;
+    }
+    RetraceAndTrim::CheckpointDigests* digests = NULL;
+    if (flags & FASTFORWARD_DELTAS)
+    {
+        gCheckpointDigests.begin(output.mStartFrame != 0);
+        digests = &gCheckpointDigests;
+    }
+
     // Save buffers
     {
-    RetraceAndTrim::BufferSaver::run(retracer.getCurrentContext(), out, retracer.getCurTid());
+    RetraceAndTrim::BufferSaver::run(retracer.getCurrentContext(), out, retracer.getCurTid(), liveness, prune, digests);
     }
 
     // Save texture
     if (flags & FASTFORWARD_RESTORE_TEXTURES)
     {
-        RetraceAndTrim::TextureSaver ts(retracer.getCurrentContext(), out, retracer.getCurTid());
+        RetraceAndTrim::TextureSaver ts(retracer.getCurrentContext(), out, retracer.getCurTid(), liveness, prune,
+                                        gUploadTracker.enabled() ? &gUploadTracker : NULL, digests);
         ts.run();
     }
+    if (digests && digests->unchanged() > 0)
+    {
+        DBG_LOG("Left out %u buffers and texture levels that have not changed since frame %u\n", digests->unchanged(), output.mStartFrame);
+    }
 
     if (flags & FASTFORWARD_RESTORE_DEFAUTL_FBO)
     {
@@ -2779,14 +4049,36 @@ static void saveData(common::OutFile &out, unsigned int flags, Json::Value& ffJs
         injectClear(retracer.getCurrentContext(), out, retracer);
     }
 
+    finishGroups(groups, out);
+
     RetraceAndTrim::checkError("RetraceAndTrim state-saving end");
 }
 
-static void replay_thread(common::OutFile &out, const int threadidx, const int our_tid, const FastForwardOptions& ffOptions, Json::Value& ffJson)
+// Only one replay thread runs at a time, so they can share it
+static RetraceAndTrim::DrawSkipper gDrawSkipper;
+
+static void replay_thread(std::vector<FastForwardOutput>& outputs, const int threadidx, const int our_tid, const FastForwardOptions& ffOptions,
+                          std::atomic<GroupCheckpoint*>& groupCheckpoint)
 {
-    std::unique_lock<std::mutex> lk(gRetracer.mConditionMutex);
     RetraceAndTrim::ScratchBuffer buffer;
     retracer::Retracer& retracer = gRetracer;
+    const auto ourTurn = [&]{ return our_tid == retracer.latest_call_tid.load() || retracer.mFinish.load(); };
+    const auto ready = [&]{ return ourTurn() || groupCheckpoint.load() != NULL; };
+    // While waiting for its turn, the thread saves the state of its share group for checkpoints
+    const auto waitTurn = [&]
+    {
+        for (;;)
+        {
+            retracer.handoffs.at(threadidx).wait(ready);
+            GroupCheckpoint* group = groupCheckpoint.exchange(NULL);
+            if (group == NULL)
+            {
+                break;
+            }
+            saveGroup(*group);
+        }
+    };
+    waitTurn(); // new threads are created before they are handed over to
 
     if (retracer.getFileFormatVersion() <= common::HEADER_VERSION_3)
     {
@@ -2806,97 +4098,127 @@ static void replay_thread(common::OutFile &out, const int threadidx, const int o
     }
 
     unsigned int curDrawCallNo = 0;
-    const bool isFrameTarget = (0 != ffOptions.mTargetFrame);
-    bool arriveTarget = false;
+    const bool isFrameTarget = !ffOptions.mTargetFrames.empty();
 
     for (;;)
     {
         const char *funcName = retracer.mFile.ExIdToName(retracer.mCurCall.funcId);
         const bool isSwapBuffers = (retracer.mCurCall.funcId == retracer.mFile.NameToExId("eglSwapBuffers") ||
                                     retracer.mCurCall.funcId == retracer.mFile.NameToExId("eglSwapBuffersWithDamageKHR"));
-        const bool isDrawCall = (common::FREQUENCY_RENDER == common::GetCallFlags(funcName));
+        const bool isDrawCall = (common::FREQUENCY_RENDER == retracer.mFile.ExIdToCallFlags(retracer.mCurCall.funcId));
 
-        const bool shouldSaveData = isFrameTarget ? (retracer.GetCurFrameId() == ffOptions.mTargetFrame - 1) && isSwapBuffers : curDrawCallNo == ffOptions.mTargetDrawCallNo;
-        if (retracer.mCurCall.tid == retracer.mOptions.mRetraceTid && shouldSaveData)
+        for (FastForwardOutput& output : outputs)
         {
-            DBG_LOG("Started saving GL state\n");
-            saveData(out, ffOptions.mFlags, ffJson);
-            DBG_LOG("Done saving GL state\n");
+            const bool shouldSaveData = isFrameTarget ? (retracer.GetCurFrameId() == output.mTargetFrame - 1) && isSwapBuffers : curDrawCallNo == ffOptions.mTargetDrawCallNo;
+            if (retracer.mCurCall.tid == retracer.mOptions.mRetraceTid && shouldSaveData)
+            {
+                DBG_LOG("Started saving GL state into %s\n", output.mOut->getFileName().c_str());
+                saveData(output, ffOptions.mFlags);
+                DBG_LOG("Done saving GL state\n");
+            }
         }
 
+        const bool isRendering = (strstr(funcName, "glDraw") && strcmp(funcName, "glDrawBuffers") != 0) // By excluding glDrawBuffers, glDraw* matches all drawing funcs.
+            || (strstr(funcName, "glClearBuffer")) // Matches glClearBuffer*
+            || (strcmp(funcName, "glBlitFramebuffer") == 0) // NOTE: strCMP == 0
+            || (strcmp(funcName, "glClear") == 0); // NOTE: strCMP == 0
+
         // Save calls.
         // Calling the function might modify what's pointed to by src (e.g. ReadStringArray does this),
         // so it's important that we copy the call before actually calling the function.
         if (true)
         {
             bool shouldSkip = (strstr(funcName, "SwapBuffers"))
-                || (strstr(funcName, "glDraw") && strcmp(funcName, "glDrawBuffers") != 0) // By excluding glDrawBuffers, glDraw* matches all drawing funcs.
-                || (strstr(funcName, "glDispatchCompute")) // Matches glDispatchCompute*
-                || (strstr(funcName, "glClearBuffer")) // Matches glClearBuffer*
-                || (strcmp(funcName, "glBlitFramebuffer") == 0) // NOTE: strCMP == 0
-                || (strcmp(funcName, "glClear") == 0); // NOTE: strCMP == 0
-
-            if (isFrameTarget)
+                || isRendering
+                || (strstr(funcName, "glDispatchCompute")); // Matches glDispatchCompute*
+
+            // Until the target frame, output everything but skipped calls. After that, output
+            // everything until the end frame of the output.
+            bool copied = false;
+            size_t copiedSize = 0;
+            for (FastForwardOutput& output : outputs)
             {
-                arriveTarget = (retracer.GetCurFrameId() >= ffOptions.mTargetFrame);
-                if (strstr(funcName, "SwapBuffers") && (retracer.GetCurFrameId() + 1 == ffOptions.mTargetFrame))
+                bool arriveTarget = false;
+                if (isFrameTarget)
                 {
-                    // We save the call before the call is executed, and GetCurFrameId() isn't
-                    // updated until the call (SwapBuffers) is made. This handles the case where this
-                    // is the last swap before the target frame, so that it isn't wrongly skipped.
-                    // (I.e., this swap marks the start of the target frame -- or equivalently, the end
-                    // of frame 0.)
-                    arriveTarget = true;
+                    arriveTarget = (retracer.GetCurFrameId() >= output.mTargetFrame);
+                    if (strstr(funcName, "SwapBuffers") && (retracer.GetCurFrameId() + 1 == output.mTargetFrame))
+                    {
+                        // We save the call before the call is executed, and GetCurFrameId() isn't
+                        // updated until the call (SwapBuffers) is made. This handles the case where this
+                        // is the last swap before the target frame, so that it isn't wrongly skipped.
+                        // (I.e., this swap marks the start of the target frame -- or equivalently, the end
+                        // of frame 0.)
+                        arriveTarget = true;
+                    }
+                }
+                else
+                {
+                    arriveTarget = (curDrawCallNo >= ffOptions.mTargetDrawCallNo);
                 }
-            }
-            else
-            {
-                arriveTarget = (curDrawCallNo >= ffOptions.mTargetDrawCallNo);
-            }
-
-            // Until the target frame, output everything but skipped calls. After that, output everything.
-            if (arriveTarget || !shouldSkip)
-            {
-                // Translate funcId for call to id in current sigbook.
-                unsigned short newId = common::gApiInfo.NameToId(funcName);
 
-                common::BCall_vlen outBCall = retracer.mCurCall;
-                outBCall.funcId = newId;
+                if ((!arriveTarget && shouldSkip) || retracer.GetCurFrameId() < output.mStartFrame || retracer.GetCurFrameId() > output.mEndFrame)
+                {
+                    continue;
+                }
 
-                if (outBCall.toNext == 0)
+                if (!copied)
                 {
-                    // It's really a BCall-struct, so only copy the BCall part of it
-                    buffer.resizeToFit(sizeof(common::BCall) + common::gApiInfo.IdToLenArr[newId]);
+                    // Translate funcId for call to id in current sigbook.
+                    unsigned short newId = common::gApiInfo.NameToId(funcName);
 
-                    char* curScratch = buffer.bufferPtr();
+                    common::BCall_vlen outBCall = retracer.mCurCall;
+                    outBCall.funcId = newId;
 
-                    memcpy(curScratch, &outBCall, sizeof(common::BCall));
-                    curScratch += sizeof(common::BCall);
+                    if (outBCall.toNext == 0)
+                    {
+                        // It's really a BCall-struct, so only copy the BCall part of it
+                        buffer.resizeToFit(sizeof(common::BCall) + common::gApiInfo.IdToLenArr[newId]);
 
-                    memcpy(curScratch, retracer.src, common::gApiInfo.IdToLenArr[newId] - sizeof(common::BCall));
-                    curScratch += common::gApiInfo.IdToLenArr[newId] - sizeof(common::BCall);
+                        char* curScratch = buffer.bufferPtr();
 
-                    out.Write(buffer.bufferPtr(), curScratch - buffer.bufferPtr());
-                }
-                else
-                {
-                    // It's a BCall_vlen
-                    buffer.resizeToFit(sizeof(outBCall) + outBCall.toNext);
+                        memcpy(curScratch, &outBCall, sizeof(common::BCall));
+                        curScratch += sizeof(common::BCall);
 
-                    char* curScratch = buffer.bufferPtr();
-                    memcpy(curScratch, &outBCall, sizeof(outBCall));
-                    curScratch += sizeof(outBCall);
+                        memcpy(curScratch, retracer.src, common::gApiInfo.IdToLenArr[newId] - sizeof(common::BCall));
+                        curScratch += common::gApiInfo.IdToLenArr[newId] - sizeof(common::BCall);
 
-                    memcpy(curScratch, retracer.src, outBCall.toNext - sizeof(outBCall));
-                    curScratch += outBCall.toNext - sizeof(outBCall);
+                        copiedSize = curScratch - buffer.bufferPtr();
+                    }
+                    else
+                    {
+                        // It's a BCall_vlen
+                        buffer.resizeToFit(sizeof(outBCall) + outBCall.toNext);
+
+                        char* curScratch = buffer.bufferPtr();
+                        memcpy(curScratch, &outBCall, sizeof(outBCall));
+                        curScratch += sizeof(outBCall);
 
-                    out.Write(buffer.bufferPtr(), curScratch - buffer.bufferPtr());
+                        memcpy(curScratch, retracer.src, outBCall.toNext - sizeof(outBCall));
+                        curScratch += outBCall.toNext - sizeof(outBCall);
+
+                        copiedSize = curScratch - buffer.bufferPtr();
+                    }
+                    copied = true;
                 }
+                output.mOut->Write(buffer.bufferPtr(), copiedSize);
             }
         }
 
+        if (gDrawSkipper.enabled() && (strncmp(funcName, "glLinkProgram", 13) == 0 || strncmp(funcName, "glProgramBinary", 15) == 0
+            || strcmp(funcName, "glDeleteProgram") == 0 || strcmp(funcName, "glCreateShaderProgramv") == 0))
+        {
+            gDrawSkipper.forgetPrograms();
+        }
+        if (gUploadTracker.enabled() && retracer.hasCurrentContext())
+        {
+            gUploadTracker.call(retracer.getCurrentContext(), retracer.mCurCall.funcId, funcName, retracer.src);
+        }
+        const bool skipCall = isRendering && gDrawSkipper.enabled() && retracer.hasCurrentContext()
+            && gDrawSkipper.skip(retracer.getCurrentContext(), funcName, retracer.GetCurFrameId());
+
         // Call function
-        if (retracer.fptr)
+        if (retracer.fptr && !skipCall)
         {
             (*(RetraceFunc)retracer.fptr)(retracer.src); // increments src to point to end of parameter block
             if (isSwapBuffers && retracer.mCurCall.tid == retracer.mOptions.mRetraceTid)
@@ -2912,7 +4234,10 @@ static void replay_thread(common::OutFile &out, const int threadidx, const int o
 
         if (retracer.GetCurFrameId() > ffOptions.mEndFrame)
         {
+            // Every output has all of its frames, no need to replay the rest
             retracer.mFinish = true;
+            for (auto &h : retracer.handoffs) h.wake(); // Wake up all other threads
+            break;
         }
 
         // ---------------------------------------------------------------------------
@@ -2922,7 +4247,7 @@ skip_call:
         if (!retracer.mFile.GetNextCall(retracer.fptr, retracer.mCurCall, retracer.src))
         {
             retracer.mFinish = true;
-            for (auto &cv : retracer.conditions) cv.notify_one(); // Wake up all other threads
+            for (auto &h : retracer.handoffs) h.wake(); // Wake up all other threads
             break;
         }
         // Skip call because it is on an ignored thread?
@@ -2933,31 +4258,26 @@ skip_call:
         // Need to switch active thread?
         if (our_tid != retracer.mCurCall.tid)
         {
-            retracer.latest_call_tid = retracer.mCurCall.tid; // need to use an atomic member copy of this here
             // Do we need to make this thread?
             if (retracer.thread_remapping.count(retracer.mCurCall.tid) == 0)
             {
                 retracer.thread_remapping[retracer.mCurCall.tid] = retracer.threads.size();
                 int newthreadidx = retracer.threads.size();
-                retracer.conditions.emplace_back();
-                retracer.threads.emplace_back(replay_thread, std::ref(out), newthreadidx, (int)retracer.mCurCall.tid, std::ref(ffOptions), std::ref(ffJson));
-            }
-            else // Wake up existing thread
-            {
-                const int otheridx = retracer.thread_remapping.at(retracer.mCurCall.tid);
-                retracer.conditions.at(otheridx).notify_one();
+                retracer.handoffs.emplace_back();
+                gGroupCheckpoints.emplace_back(nullptr);
+                retracer.threads.emplace_back(replay_thread, std::ref(outputs), newthreadidx, (int)retracer.mCurCall.tid, std::ref(ffOptions),
+                                              std::ref(gGroupCheckpoints.back()));
             }
-            // Now we go to sleep. However, there is a race condition, since the thread we woke up above might already have told us
-            // to wake up again, so keep waking up to check if that is indeed the case.
-            bool success = false;
-            do {
-                success = retracer.conditions.at(threadidx).wait_for(lk, std::chrono::milliseconds(50), [&]{ return our_tid == retracer.latest_call_tid || retracer.mFinish; });
-            } while (!success);
+            ThreadHandoff& other = retracer.handoffs.at(retracer.thread_remapping.at(retracer.mCurCall.tid));
+            retracer.latest_call_tid.store(retracer.mCurCall.tid); // the other thread may run from here on
+            other.wake();
+            waitTurn();
+            if (retracer.mFinish) break;
         }
     }
 }
 
-static bool retraceAndTrim(common::OutFile &out, const FastForwardOptions& ffOptions, Json::Value& ffJson)
+static bool retraceAndTrim(std::vector<FastForwardOutput>& outputs, const FastForwardOptions& ffOptions)
 {
     retracer::Retracer& retracer = gRetracer;
 
@@ -2978,19 +4298,144 @@ static bool retraceAndTrim(common::OutFile &out, const FastForwardOptions& ffOpt
         os::abort();
     }
 
+    if ((ffOptions.mFlags & FASTFORWARD_SKIP_DRAWS) && !gDrawSkipper.scan(retracer.mOptions.mFileName, ffOptions.mTargetFrames,
+                                                                         ffOptions.mFlags & FASTFORWARD_RESTORE_DEFAUTL_FBO, retracer.mOptions.mRetraceTid))
+    {
+        DBG_LOG("Running all draws\n");
+    }
+    if (ffOptions.mFlags & FASTFORWARD_KEEP_UPLOADS)
+    {
+        gUploadTracker.enable();
+    }
+    if (ffOptions.mFlags & FASTFORWARD_PRUNE_RESTORE)
+    {
+        std::vector<std::pair<unsigned int, unsigned int> > ranges;
+        for (const FastForwardOutput& output : outputs)
+        {
+            ranges.push_back(std::make_pair(output.mTargetFrame, output.mEndFrame));
+        }
+        if (!gResourceLiveness.scan(retracer.mOptions.mFileName, ranges, retracer.mOptions.mRetraceTid))
+        {
+            DBG_LOG("Restoring all textures and buffers\n");
+        }
+    }
+
     gRetracer.threads.resize(1);
-    gRetracer.conditions.resize(1);
+    gRetracer.handoffs.resize(1);
+    gGroupCheckpoints.emplace_back(nullptr);
     retracer.mFile.GetNextCall(retracer.fptr, retracer.mCurCall, retracer.src);
-    replay_thread(out, 0, gRetracer.mCurCall.tid, ffOptions, ffJson);
+    retracer.latest_call_tid = retracer.mCurCall.tid;
+    retracer.thread_remapping[retracer.mCurCall.tid] = 0;
+    replay_thread(outputs, 0, gRetracer.mCurCall.tid, ffOptions, gGroupCheckpoints.front());
     for (std::thread &t : gRetracer.threads)
     {
         if (t.joinable()) t.join();
     }
+    if (gDrawSkipper.enabled())
+    {
+        DBG_LOG("Skipped %llu draws and clears into the default framebuffer\n", gDrawSkipper.skipped());
+    }
+    if (gResourceLiveness.enabled())
+    {
+        DBG_LOG("Left out %llu textures and %llu buffers that are not used after the target\n",
+                gResourceLiveness.pruned(RetraceAndTrim::ResourceLiveness::TEXTURE), gResourceLiveness.pruned(RetraceAndTrim::ResourceLiveness::BUFFER));
+    }
     GLWS::instance().Cleanup();
     gRetracer.CloseTraceFile();
     return true;
 }
 
+// The name of the output for a target frame when there are several of them: "name_frame.pat"
+static std::string outputFileName(const std::string& name, unsigned int frame)
+{
+    const size_t dot = name.rfind('.');
+    const size_t slash = name.find_last_of("/\\");
+    const size_t at = (dot == std::string::npos || (slash != std::string::npos && dot < slash)) ? name.size() : dot;
+    return name.substr(0, at) + "_" + std::to_string(frame) + name.substr(at);
+}
+
+// For --cache: identifies the source trace without reading all of it, which can take minutes
+// for big traces on a network filesystem. It takes the size and the MD5 of the start, which
+// holds the header, the end, and blocks spread evenly over the rest. An edit that keeps the
+// size and avoids all of those is not noticed, but the tools that edit traces update the header.
+static std::string traceFingerprint(const std::string& fileName)
+{
+    static const long long EDGE_SIZE = 1024 * 1024;
+    static const long long BLOCK_SIZE = 64 * 1024;
+    static const int BLOCKS = 64;
+
+    FILE* fp = fopen(fileName.c_str(), "rb");
+    if (!fp)
+    {
+        DBG_LOG("Failed to open %s to look it up in the cache: %s\n", fileName.c_str(), strerror(errno));
+        return "";
+    }
+    fseeko(fp, 0, SEEK_END);
+    const long long size = ftello(fp);
+
+    std::vector<std::string> parts(1, std::to_string(size));
+    const auto read = [&](long long offset, long long length)
+    {
+        std::string part(length, '\0');
+        fseeko(fp, offset, SEEK_SET);
+        part.resize(fread(&part[0], 1, length, fp));
+        parts.push_back(part);
+    };
+    read(0, EDGE_SIZE);
+    for (int i = 1; i < BLOCKS; i++)
+    {
+        read(size / BLOCKS * i, BLOCK_SIZE);
+    }
+    read(std::max(0LL, size - EDGE_SIZE), EDGE_SIZE);
+    const bool ok = !ferror(fp);
+    fclose(fp);
+    return ok ? common::MD5Digest(parts).text_lower() : "";
+}
+
+// What an output is made from, anything that changes its contents
+static std::string cacheKey(const std::string& fingerprint, const FastForwardOptions& ffOptions, const RetraceOptions& cmdOpts,
+                            const FastForwardOutput& output)
+{
+    std::stringstream ss;
+    ss << fastforwarderVersionString() << " " << PATRACE_VERSION << " " << fingerprint
+       << " target " << output.mTargetFrame << " " << ffOptions.mTargetDrawCallNo
+       << " frames " << output.mStartFrame << "-" << output.mEndFrame
+       << " flags " << ffOptions.mFlags
+       << " multithread " << cmdOpts.mMultiThread << " offscreen " << cmdOpts.mForceOffscreen << " noscreen " << cmdOpts.mPbufferRendering
+       << " comment " << ffOptions.mComment;
+    return common::MD5Digest(ss.str()).text_lower();
+}
+
+static bool copyFile(const std::string& from, const std::string& to)
+{
+    std::ifstream in(from.c_str(), std::ios::binary);
+    std::ofstream out(to.c_str(), std::ios::binary | std::ios::trunc);
+    if (!in || !out)
+    {
+        return false;
+    }
+    out << in.rdbuf();
+    out.close();
+    return !in.bad() && !out.fail();
+}
+
+// Cached traces are written next to where they go and renamed into place, so that several
+// machines can share a cache on a network filesystem without seeing half-written traces
+static void storeInCache(const std::string& dir, const FastForwardOutput& output)
+{
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    const std::string path = dir + "/" + output.mCacheKey + ".pat";
+    const std::string tmpPath = path + "." + host + "." + std::to_string(getpid());
+    if (!copyFile(output.mFileName, tmpPath) || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        DBG_LOG("Failed to store %s in the cache as %s: %s\n", output.mFileName.c_str(), path.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        return;
+    }
+    DBG_LOG("Stored %s in the cache as %s\n", output.mFileName.c_str(), path.c_str());
+}
+
 static void
 usage(const char *argv0)
 {
@@ -3001,6 +4446,9 @@ usage(const char *argv0)
         "  --input <input_trace> Target frame to fastforward [REQUIRED]\n"
         "  --output <output_file_name> Where to write fastforwarded trace file [REQUIRED]\n"
         "  --targetFrame <target> The frame number that should be fastforwarded to [REQUIRED]\n"
+        "  --targetFrames <t1,t2,...> Write a fastforward trace for each of these frame numbers in one pass, named after the output file with _<frame> added\n"
+        "  --segmented With --targetFrames, end each fastforward trace at the next target frame, and the last one at the end frame\n"
+        "  --deltas With --targetFrames, write each fastforward trace after the first as a delta on the one before, with only the calls since its target frame and the contents that have changed since, to be chained with pat-compose-checkpoints\n"
         "  --targetDrawCallNo <target> The draw call number that should be fastforwarded to [REQUIRED]\n"
         "  --endFrame <end> The frame number that should be ended (by default fastforward to the last frame)\n"
         "  --multithread Run in multithread mode\n"
@@ -3009,6 +4457,10 @@ usage(const char *argv0)
         "  --norestoretex When generating a fastforward trace, don't inject commands to restore the contents of textures to what the would've been when retracing the original. (NOTE: NOT RECOMMEND)\n"
         "  --version Output the version of this program\n"
         "  --restorefbo0 Inject a draw call commands to restore the last default FBO when generate a fast forward trace\n"
+        "  --skipdraws Before the target frame, don't run draws and clears into the default FBO in frames that don't read it back\n"
+        "  --prunerestore Don't restore textures and buffers that are not used after the target frame, and restore identical contents only once\n"
+        "  --keepuploads Only restore textures that got contents other than from uploads, the fastforward trace does the uploads anyway\n"
+        "  --cache <dir> Copy the fastforward traces out of this directory if they were made before from the same trace with the same options, and store them there otherwise\n"
         "\n"
         , argv0);
 }
@@ -3074,9 +4526,30 @@ static bool ParseCommandLine(int argc, char** argv, FastForwardOptions& ffOption
         }
         else if (!strcmp(arg, "--targetFrame"))
         {
-            ffOptions.mTargetFrame = readValidValue(argv[++i]);
+            ffOptions.mTargetFrames.assign(1, readValidValue(argv[++i]));
             gotTargetFrame = true;
         }
+        else if (!strcmp(arg, "--targetFrames"))
+        {
+            ffOptions.mTargetFrames.clear();
+            std::stringstream ss(argv[++i]);
+            std::string item;
+            while (std::getline(ss, item, ','))
+            {
+                ffOptions.mTargetFrames.push_back(readValidValue(item.c_str()));
+            }
+            std::sort(ffOptions.mTargetFrames.begin(), ffOptions.mTargetFrames.end());
+            ffOptions.mTargetFrames.erase(std::unique(ffOptions.mTargetFrames.begin(), ffOptions.mTargetFrames.end()), ffOptions.mTargetFrames.end());
+            gotTargetFrame = !ffOptions.mTargetFrames.empty();
+        }
+        else if (!strcmp(arg, "--segmented"))
+        {
+            ffOptions.mSegmented = true;
+        }
+        else if (!strcmp(arg, "--deltas"))
+        {
+            ffOptions.mFlags |= FASTFORWARD_DELTAS;
+        }
         else if (!strcmp(arg, "--targetDrawCallNo"))
         {
             ffOptions.mTargetDrawCallNo = readValidValue(argv[++i]);
@@ -3086,11 +4559,6 @@ static bool ParseCommandLine(int argc, char** argv, FastForwardOptions& ffOption
         else if (!strcmp(arg, "--endFrame"))
         {
             ffOptions.mEndFrame = readValidValue(argv[++i]);
-            if (ffOptions.mEndFrame < ffOptions.mTargetFrame)
-            {
-                DBG_LOG("WARNING: the endFrame is less than targetFrame! Set endFrame to default to fastforward to the last frame.\n");
-                ffOptions.mEndFrame = UINT32_MAX;
-            }
         }
         else if (!strcmp(arg, "--norestoretex"))
         {
@@ -3100,6 +4568,22 @@ static bool ParseCommandLine(int argc, char** argv, FastForwardOptions& ffOption
         {
             ffOptions.mFlags |= FASTFORWARD_RESTORE_DEFAUTL_FBO;
         }
+        else if (!strcmp(arg, "--skipdraws"))
+        {
+            ffOptions.mFlags |= FASTFORWARD_SKIP_DRAWS;
+        }
+        else if (!strcmp(arg, "--prunerestore"))
+        {
+            ffOptions.mFlags |= FASTFORWARD_PRUNE_RESTORE;
+        }
+        else if (!strcmp(arg, "--keepuploads"))
+        {
+            ffOptions.mFlags |= FASTFORWARD_KEEP_UPLOADS;
+        }
+        else if (!strcmp(arg, "--cache"))
+        {
+            ffOptions.mCacheDir = argv[++i];
+        }
         else if (!strcmp(arg, "--version"))
         {
             std::cout << "Version:" << std::endl;
@@ -3135,6 +4619,18 @@ static bool ParseCommandLine(int argc, char** argv, FastForwardOptions& ffOption
         DBG_LOG("error: please either indicate target frame number or draw call number\n");
     }
 
+    if (gotTargetFrame && ffOptions.mEndFrame < ffOptions.mTargetFrames.back())
+    {
+        DBG_LOG("WARNING: the endFrame is less than targetFrame! Set endFrame to default to fastforward to the last frame.\n");
+        ffOptions.mEndFrame = UINT32_MAX;
+    }
+
+    if ((ffOptions.mFlags & FASTFORWARD_DELTAS) && ffOptions.mTargetFrames.size() < 2)
+    {
+        DBG_LOG("WARNING: --deltas needs several target frames from --targetFrames, writing a full fastforward trace.\n");
+        ffOptions.mFlags &= ~FASTFORWARD_DELTAS;
+    }
+
     bool success = gotOutput && gotInput && (gotTargetFrame ^ gotTargetDrawCallNo);
     if (!success)
     {
@@ -3159,6 +4655,42 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    // One output for each target frame
+    std::vector<FastForwardOutput> outputs(std::max<size_t>(ffOptions.mTargetFrames.size(), 1));
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        FastForwardOutput& output = outputs[i];
+        output.mTargetFrame = ffOptions.mTargetFrames.empty() ? 0 : ffOptions.mTargetFrames[i];
+        output.mStartFrame = ((ffOptions.mFlags & FASTFORWARD_DELTAS) && i > 0) ? ffOptions.mTargetFrames[i - 1] : 0;
+        output.mEndFrame = (ffOptions.mSegmented && i + 1 < outputs.size()) ? ffOptions.mTargetFrames[i + 1] : ffOptions.mEndFrame;
+        output.mFileName = (outputs.size() > 1) ? outputFileName(ffOptions.mOutputFileName, output.mTargetFrame) : ffOptions.mOutputFileName;
+    }
+
+    // Only replay the source trace if the cache does not have every output
+    if (!ffOptions.mCacheDir.empty())
+    {
+        const std::string fingerprint = traceFingerprint(gRetracer.mOptions.mFileName);
+        bool cached = !fingerprint.empty();
+        for (FastForwardOutput& output : outputs)
+        {
+            if (!fingerprint.empty())
+            {
+                output.mCacheKey = cacheKey(fingerprint, ffOptions, gRetracer.mOptions, output);
+            }
+            cached = cached && access((ffOptions.mCacheDir + "/" + output.mCacheKey + ".pat").c_str(), R_OK) == 0;
+        }
+        for (size_t i = 0; cached && i < outputs.size(); i++)
+        {
+            const std::string path = ffOptions.mCacheDir + "/" + outputs[i].mCacheKey + ".pat";
+            cached = copyFile(path, outputs[i].mFileName);
+            DBG_LOG("%s %s from the cache\n", cached ? "Copied" : "Failed to copy", outputs[i].mFileName.c_str());
+        }
+        if (cached)
+        {
+            return 0;
+        }
+    }
+
     // Register Entries before opening tracefile as sigbook is read there
     common::gApiInfo.RegisterEntries(gles_callbacks);
     common::gApiInfo.RegisterEntries(egl_callbacks);
@@ -3178,13 +4710,8 @@ int main(int argc, char** argv)
 
     // Prepare ffJson
     {
-        // Target frame
-        ffJson["originalFrame"] = ffOptions.mTargetFrame;
         // Target draw call no
         ffJson["targetDrawCallNo"] = ffOptions.mTargetDrawCallNo;
-        // End Frame if not 0
-        if (ffOptions.mEndFrame != UINT32_MAX)
-            ffJson["endFrame"] = ffOptions.mEndFrame;
 
         // Misc.
         std::stringstream cmdlineSS;
@@ -3201,6 +4728,10 @@ int main(int argc, char** argv)
         ffRestoreInfoJson["textures"] = (ffOptions.mFlags & FASTFORWARD_RESTORE_TEXTURES) ? true : false;
         ffRestoreInfoJson["buffers"]  = true;
         ffRestoreInfoJson["fbo0"] = (ffOptions.mFlags & FASTFORWARD_RESTORE_DEFAUTL_FBO) ? true:false;
+        ffRestoreInfoJson["skipDraws"] = (ffOptions.mFlags & FASTFORWARD_SKIP_DRAWS) ? true : false;
+        ffRestoreInfoJson["prune"] = (ffOptions.mFlags & FASTFORWARD_PRUNE_RESTORE) ? true : false;
+        ffRestoreInfoJson["keepUploads"] = (ffOptions.mFlags & FASTFORWARD_KEEP_UPLOADS) ? true : false;
+        ffRestoreInfoJson["deltas"] = (ffOptions.mFlags & FASTFORWARD_DELTAS) ? true : false;
         ffJson["restoreOptions"] = ffRestoreInfoJson;
 
         // Version of fastforwarder and retracer
@@ -3210,29 +4741,54 @@ int main(int argc, char** argv)
         ffJson["versions"] = ffVersions;
     }
 
-    // Open output file
-    common::OutFile out(ffOptions.mOutputFileName.c_str());
+    // Open output files, one for each target frame
+    for (FastForwardOutput& output : outputs)
+    {
+        output.mOut.reset(new common::OutFile(output.mFileName.c_str()));
+
+        output.mJson = ffJson;
+        // Target frame
+        output.mJson["originalFrame"] = output.mTargetFrame;
+        // End Frame if not 0
+        if (output.mEndFrame != UINT32_MAX)
+            output.mJson["endFrame"] = output.mEndFrame;
+        // The output this one is a delta on
+        if (output.mStartFrame != 0)
+        {
+            output.mJson["deltaFrom"] = output.mStartFrame;
+            output.mJson["deltaOf"] = outputFileName(ffOptions.mOutputFileName, output.mStartFrame);
+        }
+    }
 
     // Get existing header
     Json::Value jsonRoot = gRetracer.mFile.getJSONHeader();
     gRetracer.mOptions.mMultiThread = jsonRoot.get("multiThread", gRetracer.mOptions.mMultiThread).asBool();
     DBG_LOG("Multi-threading is %s\n", gRetracer.mOptions.mMultiThread ? "ON" : "OFF");
 
-    // Do fastforwarding: pass ffJson in case we want to add anything
-    retraceAndTrim(out, ffOptions, ffJson);
+    // Do fastforwarding: each output has its ffJson in case we want to add anything
+    retraceAndTrim(outputs, ffOptions);
+
+    for (FastForwardOutput& output : outputs)
+    {
+        // Add our conversion to the list
+        Json::Value outputRoot = jsonRoot;
+        addConversionEntry(outputRoot, "fastforward", gRetracer.mOptions.mFileName, output.mJson);
 
-    // Add our conversion to the list
-    addConversionEntry(jsonRoot, "fastforward", gRetracer.mOptions.mFileName, ffJson);
+        // Serialize header
+        Json::FastWriter writer;
+        std::string jsonData = writer.write(outputRoot);
 
-    // Serialize header
-    Json::FastWriter writer;
-    std::string jsonData = writer.write(jsonRoot);
+        // Write header to file
+        output.mOut->WriteHeader(jsonData.c_str(), jsonData.length());
 
-    // Write header to file
-    out.WriteHeader(jsonData.c_str(), jsonData.length());
+        // Close
+        output.mOut->Close();
 
-    // Close and cleanup
-    out.Close();
+        if (!output.mCacheKey.empty())
+        {
+            storeInCache(ffOptions.mCacheDir, output);
+        }
+    }
     GLWS::instance().Cleanup();
 
     return 0;
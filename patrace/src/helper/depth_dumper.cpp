@@ -3,6 +3,9 @@
 #include "dispatch/eglproc_auto.hpp"
 #include "helper/shaderutility.hpp"
 
+#include <string>
+#include <string.h>
+
 const GLchar *DepthDumper::depthCopyVSCode =
 "#version 310 es\n\
  in highp vec2 a_Position;\n\
@@ -91,6 +94,46 @@ const GLchar *DepthDumper::depthCopyCubeFSCode =
      fragColor = texture(u_Texture, texCoord).x;\n\
  }";
 
+// Preceded by the definitions of SAMPLER and FETCH for the texture type, and STENCIL for the
+// stencil pass, which fills in the low 8 bits that the depth pass of D24S8 leaves clear
+const GLchar *DepthDumper::depthPackCSCode =
+" layout(local_size_x = 8, local_size_y = 8) in;\n\
+ uniform highp SAMPLER u_Texture;\n\
+ uniform highp ivec2 u_Size;\n\
+ uniform highp int u_Level;\n\
+ uniform highp int u_Layer;\n\
+ uniform bool u_Packed;\n\
+ layout(std430, binding = 0) buffer Packed {\n\
+     highp uint texels[];\n\
+ };\n\
+ highp vec3 cubeDirection(highp ivec2 p) {\n\
+     highp vec2 c = (vec2(p) + 0.5) / vec2(u_Size) * 2.0 - 1.0;\n\
+     switch(u_Layer) {\n\
+         case 0: return vec3(1.0, -c.y, -c.x);\n\
+         case 1: return vec3(-1.0, -c.y, c.x);\n\
+         case 2: return vec3(c.x, 1.0, c.y);\n\
+         case 3: return vec3(c.x, -1.0, -c.y);\n\
+         case 4: return vec3(c.x, -c.y, 1.0);\n\
+         default: return vec3(-c.x, -c.y, -1.0);\n\
+     }\n\
+ }\n\
+ void main() {\n\
+     highp ivec2 p = ivec2(gl_GlobalInvocationID.xy);\n\
+     if (p.x >= u_Size.x || p.y >= u_Size.y) return;\n\
+     highp uint i = uint(p.y * u_Size.x + p.x);\n\
+ #ifdef STENCIL\n\
+     texels[i] = (texels[i] & 0xffffff00u) | (FETCH(p).r & 0xffu);\n\
+ #else\n\
+     highp float depth = FETCH(p).r;\n\
+     if (u_Packed) {\n\
+         const highp float max24int = 256.0 * 256.0 * 256.0 - 1.0;\n\
+         texels[i] = uint(int(clamp(depth, 0.0, 1.0) * max24int)) << 8;\n\
+     } else {\n\
+         texels[i] = floatBitsToUint(depth);\n\
+     }\n\
+ #endif\n\
+ }";
+
 DepthDumper::~DepthDumper()
 {
     _glDeleteShader(depthCopyVS);
@@ -104,6 +147,13 @@ DepthDumper::~DepthDumper()
     _glDeleteProgram(depthDSCopyProgram);
     _glDeleteProgram(stencilDSCopyProgram);
     _glDeleteFramebuffers(1, &depthFBO);
+    for (int i = 0; i < TexEnd; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            if (depthPackPrograms[i][j]) _glDeleteProgram(depthPackPrograms[i][j]);
+        }
+    }
 }
 
 void DepthDumper::initializeDepthCopyer()
@@ -436,3 +486,183 @@ void DepthDumper::get_depth_texture_image(GLuint sourceTexture, int width, int h
 
     _glBindVertexArray(pre_va);
 }
+
+GLuint DepthDumper::depthPackProgram(TexType texType, bool stencil)
+{
+    if (!depthPackTried)
+    {
+        depthPackTried = true;
+        GLint major = 0, minor = 0;
+        _glGetIntegerv(GL_MAJOR_VERSION, &major);
+        _glGetIntegerv(GL_MINOR_VERSION, &minor);
+        depthPackSupported = major > 3 || (major == 3 && minor >= 1);
+    }
+    if (!depthPackSupported || texType == TexCubemapArray) // cube map arrays need GLES 3.2
+    {
+        return 0;
+    }
+    GLuint& program = depthPackPrograms[texType][stencil ? 1 : 0];
+    if (program)
+    {
+        return program;
+    }
+
+    static const GLchar *samplers[TexCubemapArray][2] = {
+        { "#define SAMPLER sampler2D\n", "#define SAMPLER usampler2D\n" },
+        { "#define SAMPLER sampler2DArray\n", "#define SAMPLER usampler2DArray\n" },
+        { "#define SAMPLER samplerCube\n", "#define SAMPLER usamplerCube\n" },
+    };
+    static const GLchar *fetches[TexCubemapArray] = {
+        "#define FETCH(p) texelFetch(u_Texture, p, u_Level)\n",
+        "#define FETCH(p) texelFetch(u_Texture, ivec3(p, u_Layer), u_Level)\n",
+        "#define FETCH(p) textureLod(u_Texture, cubeDirection(p), float(u_Level))\n",
+    };
+    std::string source = "#version 310 es\n";
+    source += stencil ? "#define STENCIL\n" : "";
+    source += samplers[texType][stencil ? 1 : 0];
+    source += fetches[texType];
+    const GLchar *sources[2] = { source.c_str(), depthPackCSCode };
+
+    GLuint shader = _glCreateShader(GL_COMPUTE_SHADER);
+    _glShaderSource(shader, 2, sources, 0);
+    _glCompileShader(shader);
+    GLint status = GL_FALSE;
+    _glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status == GL_FALSE)
+    {
+        printShaderInfoLog(shader, "depthPack compute shader");
+        _glDeleteShader(shader);
+        depthPackSupported = false;
+        return 0;
+    }
+    program = _glCreateProgram();
+    _glAttachShader(program, shader);
+    _glLinkProgram(program);
+    _glDeleteShader(shader);
+    _glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE)
+    {
+        printProgramInfoLog(program, "depthPack program");
+        _glDeleteProgram(program);
+        program = 0;
+        depthPackSupported = false;
+    }
+    return program;
+}
+
+bool DepthDumper::pack_depth_texture(GLuint sourceTexture, int width, int height, int level, GLuint buffer, GLint internalFormat, TexType texType, int id)
+{
+    const bool withStencil = internalFormat == GL_DEPTH24_STENCIL8;
+    const GLuint depthProgram = depthPackProgram(texType, false);
+    const GLuint stencilProgram = withStencil ? depthPackProgram(texType, true) : 0;
+    if (!depthProgram || (withStencil && !stencilProgram))
+    {
+        return false;
+    }
+    GLenum target = GL_TEXTURE_2D;
+    if (texType == Tex2DArray) {
+        target = GL_TEXTURE_2D_ARRAY;
+    }
+    else if (texType == TexCubemap) {
+        target = GL_TEXTURE_CUBE_MAP;
+    }
+    GLenum binding = GL_TEXTURE_BINDING_2D;
+    if (texType == Tex2DArray) {
+        binding = GL_TEXTURE_BINDING_2D_ARRAY;
+    }
+    else if (texType == TexCubemap) {
+        binding = GL_TEXTURE_BINDING_CUBE_MAP;
+    }
+
+    GLint act, prev_texture, prev_sampler, prev_program_id, prev_storage_buffer, prev_storage_binding;
+    GLint64 prev_storage_start = 0, prev_storage_size = 0;
+    _glGetIntegerv(GL_ACTIVE_TEXTURE, &act);
+    _glActiveTexture(GL_TEXTURE0);
+    _glGetIntegerv(binding, &prev_texture);
+    _glGetIntegerv(GL_SAMPLER_BINDING, &prev_sampler);
+    _glGetIntegerv(GL_CURRENT_PROGRAM, &prev_program_id);
+    _glGetIntegerv(GL_SHADER_STORAGE_BUFFER_BINDING, &prev_storage_buffer);
+    _glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, 0, &prev_storage_binding);
+    _glGetInteger64i_v(GL_SHADER_STORAGE_BUFFER_START, 0, &prev_storage_start);
+    _glGetInteger64i_v(GL_SHADER_STORAGE_BUFFER_SIZE, 0, &prev_storage_size);
+
+    _glBindTexture(target, sourceTexture);
+    _glBindSampler(0, 0);
+    GLint prev_compare_mode = 0, prev_min_filter = 0, prev_mag_filter = 0, prev_depth_stencil_mode = 0;
+    _glGetTexParameteriv(target, GL_TEXTURE_COMPARE_MODE, &prev_compare_mode);
+    _glGetTexParameteriv(target, GL_TEXTURE_MIN_FILTER, &prev_min_filter);
+    _glGetTexParameteriv(target, GL_TEXTURE_MAG_FILTER, &prev_mag_filter);
+    _glGetTexParameteriv(target, GL_DEPTH_STENCIL_TEXTURE_MODE, &prev_depth_stencil_mode);
+    _glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    // a mipmap filter for levels above the base would make textures without mipmaps incomplete
+    _glTexParameteri(target, GL_TEXTURE_MIN_FILTER, level > 0 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST);
+    _glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    _glTexParameteri(target, GL_DEPTH_STENCIL_TEXTURE_MODE, GL_DEPTH_COMPONENT);
+    _glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, buffer, 0, (GLsizeiptr)width * height * 4);
+
+    const GLuint groupsX = (width + 7) / 8;
+    const GLuint groupsY = (height + 7) / 8;
+    for (int pass = 0; pass < (withStencil ? 2 : 1); pass++)
+    {
+        const GLuint program = pass ? stencilProgram : depthProgram;
+        _glUseProgram(program);
+        _glUniform1i(_glGetUniformLocation(program, "u_Texture"), 0);
+        _glUniform2i(_glGetUniformLocation(program, "u_Size"), width, height);
+        _glUniform1i(_glGetUniformLocation(program, "u_Level"), level);
+        _glUniform1i(_glGetUniformLocation(program, "u_Layer"), id);
+        _glUniform1i(_glGetUniformLocation(program, "u_Packed"), withStencil);
+        if (pass)
+        {
+            _glTexParameteri(target, GL_DEPTH_STENCIL_TEXTURE_MODE, GL_STENCIL_INDEX);
+            _glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT); // the stencil goes into the depth pass's texels
+        }
+        _glDispatchCompute(groupsX, groupsY, 1);
+    }
+    _glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+
+    // restore state
+    _glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, prev_compare_mode);
+    _glTexParameteri(target, GL_TEXTURE_MIN_FILTER, prev_min_filter);
+    _glTexParameteri(target, GL_TEXTURE_MAG_FILTER, prev_mag_filter);
+    _glTexParameteri(target, GL_DEPTH_STENCIL_TEXTURE_MODE, prev_depth_stencil_mode);
+    _glBindTexture(target, prev_texture);
+    _glBindSampler(0, prev_sampler);
+    _glActiveTexture(act);
+    _glUseProgram(prev_program_id);
+    if (prev_storage_size > 0)
+    {
+        _glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, prev_storage_binding, prev_storage_start, prev_storage_size);
+    }
+    else
+    {
+        _glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, prev_storage_binding);
+    }
+    _glBindBuffer(GL_SHADER_STORAGE_BUFFER, prev_storage_buffer);
+    return true;
+}
+
+bool DepthDumper::read_depth_texture_image(GLuint sourceTexture, int width, int height, GLvoid *pixels, GLint internalFormat, TexType texType, int id)
+{
+    const GLsizeiptr size = (GLsizeiptr)width * height * 4;
+    GLint prev_storage_buffer = 0;
+    _glGetIntegerv(GL_SHADER_STORAGE_BUFFER_BINDING, &prev_storage_buffer);
+    GLuint buffer = 0;
+    _glGenBuffers(1, &buffer);
+    _glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    _glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_STREAM_READ);
+    bool ok = pack_depth_texture(sourceTexture, width, height, 0, buffer, internalFormat, texType, id);
+    if (ok)
+    {
+        _glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        const void *data = _glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, GL_MAP_READ_BIT);
+        if (data)
+        {
+            memcpy(pixels, data, size);
+            _glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        }
+        ok = data != NULL;
+    }
+    _glBindBuffer(GL_SHADER_STORAGE_BUFFER, prev_storage_buffer);
+    _glDeleteBuffers(1, &buffer);
+    return ok;
+}
@@ -27,7 +27,22 @@ public:
     GLuint depthFBO, depthTexture;
     GLuint depthVertexBuf, depthIndexBuf;
     GLint cubemapIdLocation;
+    static const GLchar *depthPackCSCode;
+    GLuint depthPackPrograms[TexEnd][2] = {}; // by texture type, for depth and for stencil
+    bool depthPackTried = false, depthPackSupported = false;
 
     void initializeDepthCopyer();
     void get_depth_texture_image(GLuint sourceTexture, int width, int height, GLvoid *pixels, GLint internalFormat, TexType texType, int id);
+
+    // Pack level of sourceTexture, or its face or layer id, into buffer with one compute dispatch, two for
+    // GL_DEPTH24_STENCIL8, in the layout that get_depth_texture_image() reads it in: a float per
+    // texel, or the depth in the top 24 bits and the stencil in the low 8. Nothing waits for the
+    // GPU, so that buffer can be mapped once more textures have been packed. Returns false
+    // without GLES 3.1, and for cube map arrays, where get_depth_texture_image() has to be used.
+    bool pack_depth_texture(GLuint sourceTexture, int width, int height, int level, GLuint buffer, GLint internalFormat, TexType texType, int id);
+    // Like get_depth_texture_image(), through pack_depth_texture(), returns false where that does
+    bool read_depth_texture_image(GLuint sourceTexture, int width, int height, GLvoid *pixels, GLint internalFormat, TexType texType, int id);
+
+private:
+    GLuint depthPackProgram(TexType texType, bool stencil);
 };
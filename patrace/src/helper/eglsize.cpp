@@ -1,7 +1,14 @@
 #include "eglsize.hpp"
 #include "shaderutility.hpp"
+#include <cstring>
 #include <string>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 static int bisect_val(int min, int max, bool is_valid_val(int val))
 {
     bool valid;
@@ -344,3 +351,134 @@ void _EGLImageKHR_free_image_info(struct image_info *info)
     delete info;
 }
 
+
+// The restart index is the largest value of the type, so adding one to every index before
+// taking the maximum wraps it around to zero, where it can never win. Without primitive
+// restart the bias is zero and this is a plain maximum.
+template <typename T>
+static T max_biased_scalar(const T* p, size_t begin, size_t count, T bias, T acc)
+{
+    for (size_t i = begin; i < count; ++i)
+    {
+        const T v = T(p[i] + bias);
+        if (v > acc)
+        {
+            acc = v;
+        }
+    }
+    return acc;
+}
+
+template <typename T, typename V>
+static T max_lanes(V v)
+{
+    T lanes[sizeof(V) / sizeof(T)];
+    memcpy(lanes, &v, sizeof(lanes));
+    return max_biased_scalar<T>(lanes, 0, sizeof(V) / sizeof(T), 0, 0);
+}
+
+static GLuint max_biased_u8(const GLubyte* p, size_t count, GLubyte bias)
+{
+    size_t i = 0;
+    GLubyte acc = 0;
+#if defined(__SSE2__)
+    const __m128i b = _mm_set1_epi8((char)bias);
+    __m128i m = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        m = _mm_max_epu8(m, _mm_add_epi8(_mm_loadu_si128((const __m128i*)(p + i)), b));
+    }
+    acc = max_lanes<GLubyte>(m);
+#elif defined(__ARM_NEON)
+    const uint8x16_t b = vdupq_n_u8(bias);
+    uint8x16_t m = vdupq_n_u8(0);
+    for (; i + 16 <= count; i += 16)
+    {
+        m = vmaxq_u8(m, vaddq_u8(vld1q_u8(p + i), b));
+    }
+    acc = max_lanes<GLubyte>(m);
+#endif
+    return max_biased_scalar<GLubyte>(p, i, count, bias, acc);
+}
+
+static GLuint max_biased_u16(const GLushort* p, size_t count, GLushort bias)
+{
+    size_t i = 0;
+    GLushort acc = 0;
+#if defined(__SSE2__)
+    // SSE2 only has a signed 16-bit maximum, so compare with the sign bit flipped
+    const __m128i sign = _mm_set1_epi16((short)0x8000);
+    const __m128i b = _mm_set1_epi16((short)bias);
+    __m128i m = sign;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i v = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(p + i)), b);
+        m = _mm_max_epi16(m, _mm_xor_si128(v, sign));
+    }
+    acc = max_lanes<GLushort>(_mm_xor_si128(m, sign));
+#elif defined(__ARM_NEON)
+    const uint16x8_t b = vdupq_n_u16(bias);
+    uint16x8_t m = vdupq_n_u16(0);
+    for (; i + 8 <= count; i += 8)
+    {
+        m = vmaxq_u16(m, vaddq_u16(vld1q_u16(p + i), b));
+    }
+    acc = max_lanes<GLushort>(m);
+#endif
+    return max_biased_scalar<GLushort>(p, i, count, bias, acc);
+}
+
+static GLuint max_biased_u32(const GLuint* p, size_t count, GLuint bias)
+{
+    size_t i = 0;
+    GLuint acc = 0;
+#if defined(__SSE2__)
+    // no 32-bit maximum in SSE2, select with a signed compare of the sign-flipped values
+    const __m128i sign = _mm_set1_epi32((int)0x80000000);
+    const __m128i b = _mm_set1_epi32((int)bias);
+    __m128i m = sign;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i v = _mm_xor_si128(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(p + i)), b), sign);
+        const __m128i gt = _mm_cmpgt_epi32(v, m);
+        m = _mm_or_si128(_mm_and_si128(gt, v), _mm_andnot_si128(gt, m));
+    }
+    acc = max_lanes<GLuint>(_mm_xor_si128(m, sign));
+#elif defined(__ARM_NEON)
+    const uint32x4_t b = vdupq_n_u32(bias);
+    uint32x4_t m = vdupq_n_u32(0);
+    for (; i + 4 <= count; i += 4)
+    {
+        m = vmaxq_u32(m, vaddq_u32(vld1q_u32(p + i), b));
+    }
+    acc = max_lanes<GLuint>(m);
+#endif
+    return max_biased_scalar<GLuint>(p, i, count, bias, acc);
+}
+
+GLuint _max_index(GLenum type, const void* indices, GLsizei count, bool restart)
+{
+    if (!indices || count <= 0)
+    {
+        return 0;
+    }
+    const unsigned bias = restart ? 1 : 0;
+    GLuint biased = 0;
+    switch (type)
+    {
+    case GL_UNSIGNED_BYTE:
+        biased = max_biased_u8(static_cast<const GLubyte*>(indices), count, bias);
+        break;
+    case GL_UNSIGNED_SHORT:
+        biased = max_biased_u16(static_cast<const GLushort*>(indices), count, bias);
+        break;
+    case GL_UNSIGNED_INT:
+        biased = max_biased_u32(static_cast<const GLuint*>(indices), count, bias);
+        break;
+    default:
+        DBG_LOG("ERROR: Unhandled GLenum 0x%04x\n", type);
+        return 0;
+    }
+    // zero when every index was the restart index
+    return biased ? biased - bias : 0;
+}
@@ -210,6 +210,8 @@ _gl_uniform_size(GLenum type, GLenum &elemType, GLint &numElems) {
 
 size_t _gl_param_size(GLenum pname);
 size_t paramSizeGlGetActiveUniformBlockiv(GLuint program, GLuint uniformBlockIndex, GLenum pname);
+/// Largest of count indices of type, not counting the restart index if restart is set
+GLuint _max_index(GLenum type, const void* indices, GLsizei count, bool restart);
 
 static inline unsigned
 _gl_format_channels(GLenum format) {
@@ -517,32 +519,7 @@ static inline GLuint _glDrawElementsBaseVertex_count(GLsizei count, GLenum type,
     GLboolean restart_enabled = _glIsEnabled(GL_PRIMITIVE_RESTART_FIXED_INDEX);
     while ((_glGetError() == GL_INVALID_ENUM)) ;
 
-    GLuint maxindex = 0;
-    GLsizei i;
-    if (type == GL_UNSIGNED_BYTE) {
-        const GLubyte *p = (const GLubyte *)indices;
-        for (i = 0; i < count; ++i) {
-            if (p[i] > maxindex && !(restart_enabled && p[i] == UINT8_MAX)) {
-                maxindex = p[i];
-            }
-        }
-    } else if (type == GL_UNSIGNED_SHORT) {
-        const unsigned short *p = (const unsigned short *)indices;
-        for (i = 0; i < count; ++i) {
-            if (p[i] > maxindex && !(restart_enabled && p[i] == UINT16_MAX)) {
-                maxindex = p[i];
-            }
-        }
-    } else if (type == GL_UNSIGNED_INT) {
-        const GLuint *p = (const GLuint *)indices;
-        for (i = 0; i < count; ++i) {
-            if (p[i] > maxindex && !(restart_enabled && p[i] == UINT32_MAX)) {
-                maxindex = p[i];
-            }
-        }
-    } else {
-        DBG_LOG("ERROR: Unhandled GLenum 0x%04x\n", type);
-    }
+    GLuint maxindex = _max_index(type, indices, count, restart_enabled);
 
     if (element_array_buffer) {
         _glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
@@ -570,7 +547,7 @@ static inline GLuint _glDrawRangeElementsBaseVertex_count(GLuint start, GLuint e
 #define _glDrawElementsInstancedBaseVertexOES_count(count, type, indices, primcount, basevertex) _glDrawElementsBaseVertex_count(count, type, indices, basevertex)
 #define _glDrawElementsInstancedBaseVertexEXT_count(count, type, indices, primcount, basevertex) _glDrawElementsBaseVertex_count(count, type, indices, basevertex)
 #define _glDrawArraysInstanced_count(first, count, primcount) _glDrawArrays_count(first, count)
-#define _glDrawElements_count(count, type, indices) _glDrawElementsBaseVertex_count(count, type, indices, 0);
+#define _glDrawElements_count(count, type, indices) _glDrawElementsBaseVertex_count(count, type, indices, 0)
 #define _glDrawRangeElements_count(start, end, count, type, indices) _glDrawRangeElementsBaseVertex_count(start, end, count, type, indices, 0)
 #define _glDrawElementsInstanced_count(count, type, indices, primcount) _glDrawElements_count(count, type, indices)
 #define _glDrawArraysInstancedBaseInstanceEXT_count(first, count, instancecount, baseinstance) _glDrawArrays_count(first, count)
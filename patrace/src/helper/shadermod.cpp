@@ -4,6 +4,7 @@
 #include "jsoncpp/include/json/value.h"
 #include "common/pa_exception.h"
 #include <sstream>
+#include <unordered_set>
 
 ShaderMod::ShaderMod(retracer::Retracer& retracer, int programName, Json::Value& result, retracer::hmap<unsigned int>& shaderRevMap)
     : mRetracer(retracer)
@@ -47,22 +48,16 @@ std::vector<VertexArrayInfo> ShaderMod::getUnusedAttributes(const Json::Value& o
     std::vector<VertexArrayInfo> unusedAttributes;
     Json::Value unusedAttributeNames(Json::arrayValue);
 
-    // TODO: O(n*m) complexity
+    std::unordered_set<std::string> traced;
+    for (Json::Value::const_iterator it = originalAttributes.begin(); it != originalAttributes.end(); ++it)
+    {
+        traced.insert((*it).asString());
+    }
+
     for (int i = 0; i < mProgram.activeAttributes; ++i)
     {
         VertexArrayInfo vai = mProgram.getActiveAttribute(i);
-        bool found = false;
-        for (Json::Value::iterator it = originalAttributes.begin(); it != originalAttributes.end(); ++it)
-        {
-            //DBG_LOG("TESTING: %s == %s\n", (*it).asString().c_str(), vai.name.c_str());
-            if ((*it).asString() == vai.name)
-            {
-                found = true;
-                break;
-            }
-        }
-
-        if (!found)
+        if (traced.count(vai.name) == 0)
         {
             // I.e. active attribute found, that was not active during tracing
             unusedAttributes.push_back(vai);
@@ -100,8 +95,18 @@ void ShaderMod::removeAttributes(const std::vector<VertexArrayInfo>& vai)
             std::string id = idSS.str();
 
             std::string origSource = shader.getSource();
-            std::string newShader = changeAttributesToConstants(origSource, vai);
-            shader.setSource(newShader);
+            std::stringstream keySS;
+            keySS << common::MD5Digest(origSource).text();
+            for (const VertexArrayInfo& attribute : vai)
+            {
+                keySS << ' ' << attribute.name << ':' << attribute.type;
+            }
+            auto rewritten = mRetracer.mRewrittenShaders.find(keySS.str());
+            if (rewritten == mRetracer.mRewrittenShaders.end())
+            {
+                rewritten = mRetracer.mRewrittenShaders.emplace(keySS.str(), changeAttributesToConstants(origSource, vai)).first;
+            }
+            shader.setSource(rewritten->second);
             shader.compile();
 
             mResult["shaders"][id]["newCompileStatus"] = shader.compileStatus;
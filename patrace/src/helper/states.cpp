@@ -1215,8 +1215,7 @@ void memory(std::ostream& o, GLenum elementType, int realStride, int elementSize
 
 
 StateLogger::StateLogger()
-    : mPerThreadCallCount(16)
-    , mLogOpen(false)
+    : mLogOpen(false)
     , mLog()
 {
 }
@@ -1233,39 +1232,26 @@ void StateLogger::close()
         return;
     }
     mLog.close();
-    for (auto it = mPerThreadCallCount.begin(); it != mPerThreadCallCount.end(); ++it)
-    {
-        it->clear();
-    }
+    mLogOpen = false;
 }
 
 void StateLogger::checkIfOpen()
 {
     if (!mLogOpen) {
         DBG_LOG("State logging started. The state log file name is : %s\n", mFileName.c_str());
-        mLog.open(mFileName.c_str(), std::ofstream::out | std::ofstream::trunc);
+        mLog.open(mFileName);
         mLogOpen = true;
     }
 }
 
-void StateLogger::logFunction(unsigned char tid, const std::string& functionName, unsigned callNo, unsigned drawNo)
+void StateLogger::logFunction(unsigned char tid, const char* functionName, unsigned callNo, unsigned drawNo)
 {
     if (!call_in_range())
     {
         return; // not the call we want
     }
 
-    FunctionCountMap_t& funcMap = mPerThreadCallCount[tid];
-    FunctionCountMap_t::iterator it = funcMap.find(functionName);
-
-    // If function not found
-    if (it == funcMap.end())
-    {
-        funcMap[functionName] = 0;
-    }
-
-    int& callCount = funcMap[functionName];
-    int frameNo = frameNumber;
+    unsigned frameNo = frameNumber;
 
     if (!PRINT_CALLNO) // creates noise for retracer <-> tracer state comparisons
     {
@@ -1274,8 +1260,9 @@ void StateLogger::logFunction(unsigned char tid, const std::string& functionName
         frameNo = 0;
     }
 
+    // Numbered per thread and function by statelog_to_txt
     checkIfOpen();
-    mLog << "@F: [" << static_cast<int>(tid) << "] " << functionName << " " << callCount++ << " call=" << callNo << " draw=" << drawNo << " frame=" << frameNo << std::endl;
+    mLog.function(tid, functionName, callNo, drawNo, frameNo);
 }
 
 void StateLogger::_logState(std::stringstream& ss, unsigned char tid, GLsizei instancecount, const IndexList_t& indices, uint64_t flags)
@@ -1602,7 +1589,7 @@ void StateLogger::_logState(std::stringstream& ss, unsigned char tid, GLsizei in
 #endif
     // Write to log file
     checkIfOpen();
-    mLog << ss.str() << std::flush;
+    mLog.text(tid, ss.str());
 }
 
 void StateLogger::logState(unsigned char tid, GLint first, GLsizei count, GLsizei instancecount)
@@ -1740,7 +1727,7 @@ void StateLogger::logCompute(unsigned char tid, GLuint x, GLuint y, GLuint z)
 
     // Write to log file
     checkIfOpen();
-    mLog << ss.str() << std::flush;
+    mLog.text(tid, ss.str());
 }
 
 void StateLogger::logState(unsigned char tid, GLsizei count, GLenum indexType, const GLvoid* indices, GLsizei instancecount)
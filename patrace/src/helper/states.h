@@ -2,6 +2,7 @@
 #define STATES_H
 #include "dispatch/eglimports.hpp"
 #include "dispatch/eglproc_auto.hpp"
+#include "common/state_log.hpp"
 
 #include <ostream>
 #include <sstream>
@@ -22,8 +23,6 @@ namespace Json
 /// ugly global for higher performance
 extern bool stateLoggingEnabled;
 
-typedef std::map<std::string, int> FunctionCountMap_t;
-
 const char* bufferName(GLenum target);
 GLint getBoundBuffer(GLenum target);
 GLint getCurrentProgram();
@@ -32,11 +31,14 @@ int getMaxVertexAttribs();
 
 typedef std::vector<GLuint> IndexList_t;
 
+/// Logs state of draw calls and compute dispatches. The GL queries are made on the calling
+/// thread, while the log is written by a thread of its own in the binary format of
+/// common/state_log.hpp; see the statelog_to_txt tool.
 class StateLogger
 {
 public:
     StateLogger();
-    void logFunction(unsigned char tid, const std::string& functionName, unsigned callNo, unsigned drawNo);
+    void logFunction(unsigned char tid, const char* functionName, unsigned callNo, unsigned drawNo);
     void logState(unsigned char tid, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instancecount);
     void logState(unsigned char tid, GLint first, GLsizei count, GLsizei instancecount);
     void logState(unsigned char tid);
@@ -51,11 +53,9 @@ public:
 private:
     void checkIfOpen();
     void _logState(std::stringstream& ss, unsigned char tid, GLsizei instancecount, const IndexList_t& indices, uint64_t flags);
-    // Function call count
-    std::vector<FunctionCountMap_t> mPerThreadCallCount;
     bool mLogOpen;
     std::string mFileName;
-    std::ofstream mLog;
+    common::StateLogWriter mLog;
 };
 
 struct VertexArrayInfo
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+
+###
+# Check the frame times of perf_test.sh replays against the baseline of a device
+
+import argparse
+import json
+import os
+import sys
+
+
+def summarize(results):
+    """Sum up the loops of one replay: the mean FPS and how much frame times vary within and between loops."""
+    loops = results['result'][0]['loops']
+    fps = [l['fps'] for l in loops]
+    cv = [l['frame_time_stddev'] / l['frame_time_mean'] for l in loops if l['frame_time_mean'] > 0]
+    tail = [l['frame_time_p99'] / l['frame_time_p50'] for l in loops if l['frame_time_p50'] > 0]
+    mean_fps = sum(fps) / len(fps) if fps else 0.0
+    loop_spread = (max(fps) - min(fps)) / mean_fps if mean_fps > 0 else 0.0
+    return {
+        'loops': len(loops),
+        'fps': mean_fps,
+        'fps_loop_spread': loop_spread,  # between loops, relative to the mean
+        'frame_time_cv': sum(cv) / len(cv) if cv else 0.0,  # within loops, stddev over mean
+        'frame_time_p99_over_p50': max(tail) if tail else 0.0,
+        'stutters': sum(l['stutters'] for l in loops),
+    }
+
+
+def check(current, baseline, args):
+    """Return the list of thresholds the current summary breaks compared to the baseline."""
+    failures = []
+    if current['fps'] < baseline['fps'] * (1.0 - args.fps_drop):
+        failures.append('fps %.1f is more than %d%% below the baseline %.1f' % (current['fps'], args.fps_drop * 100, baseline['fps']))
+    if current['frame_time_cv'] > baseline['frame_time_cv'] * args.variance_growth + args.variance_slack:
+        failures.append('frame time variation %.3f is above the baseline %.3f' % (current['frame_time_cv'], baseline['frame_time_cv']))
+    if current['fps_loop_spread'] > baseline['fps_loop_spread'] * args.variance_growth + args.variance_slack:
+        failures.append('fps spread between loops %.3f is above the baseline %.3f' % (current['fps_loop_spread'], baseline['fps_loop_spread']))
+    return failures
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Check perf_test.sh replays against the frame time baseline of a device')
+    parser.add_argument('resultdir', help='directory with one paretrace result file TEST.json per test')
+    parser.add_argument('tests', nargs='+', help='names of the tests')
+    parser.add_argument('--device', required=True, help='name of the device, which selects the baseline')
+    parser.add_argument('--baseline-dir', default='perf_baselines', help='directory with a DEVICE.json baseline per device')
+    parser.add_argument('--output', default='perf_results.json', help='file to write the results and verdicts to')
+    parser.add_argument('--update', action='store_true', help='store the results as the new baseline of the device instead of checking')
+    parser.add_argument('--fps-drop', type=float, default=0.05, help='largest allowed FPS drop, as a fraction of the baseline (default 0.05)')
+    parser.add_argument('--variance-growth', type=float, default=1.5, help='largest allowed growth of frame time variation, as a factor of the baseline (default 1.5)')
+    parser.add_argument('--variance-slack', type=float, default=0.02, help='variation allowed on top of that, for baselines close to zero (default 0.02)')
+    args = parser.parse_args()
+
+    baseline_file = os.path.join(args.baseline_dir, '%s.json' % args.device)
+    baseline = {}
+    if not args.update:
+        if not os.path.exists(baseline_file):
+            print('No baseline for %s in %s, run with --update to create one' % (args.device, baseline_file))
+            sys.exit(1)
+        with open(baseline_file) as f:
+            baseline = json.load(f)['tests']
+
+    report = {'device': args.device, 'tests': {}}
+    failed = False
+    for test in args.tests:
+        path = os.path.join(args.resultdir, '%s.json' % test)
+        if not os.path.exists(path):
+            print('%s: no result file %s' % (test, path))
+            report['tests'][test] = {'failures': ['no result']}
+            failed = True
+            continue
+        with open(path) as f:
+            current = summarize(json.load(f))
+        entry = dict(current)
+        if not args.update:
+            if test in baseline:
+                entry['baseline'] = baseline[test]
+                entry['failures'] = check(current, baseline[test], args)
+            else:
+                entry['failures'] = []
+                print('%s: not in the baseline, not checked' % test)
+            failed = failed or len(entry['failures']) > 0
+            for failure in entry['failures']:
+                print('%s: %s' % (test, failure))
+        print('%-16s fps %8.1f  variation %.3f  loop spread %.3f  p99/p50 %.2f' % (
+            test, current['fps'], current['frame_time_cv'], current['fps_loop_spread'], current['frame_time_p99_over_p50']))
+        report['tests'][test] = entry
+
+    with open(args.output, 'w') as f:
+        json.dump(report, f, indent=2)
+
+    if args.update and not failed:
+        if not os.path.exists(args.baseline_dir):
+            os.makedirs(args.baseline_dir)
+        with open(baseline_file, 'w') as f:
+            json.dump({'device': args.device, 'tests': report['tests']}, f, indent=2)
+        print('Stored baseline for %s in %s' % (args.device, baseline_file))
+
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# Frame time stability tests (from tests directory by default).
+#
+# Each test is traced, and its trace replayed LOOPS times over the same frames with -loop.
+# The loops of every test are then checked against the stored baseline of this device by
+# perf_check.py, which writes the report to perf_results.json and fails on a regression.
+# Run with UPDATE_BASELINE=1 to store the results as the new baseline instead.
+
+set -e
+
+PATRACE_ROOT=${PARETRACE_PATH:-".."}
+PATRACE_LIB="${PATRACE_ROOT}/lib"
+PATRACE_EXE="${PATRACE_ROOT}/bin"
+DDK_PATH=${DDK_PATH:-"/usr/lib"}
+FRAMES=${FRAMES:-100}
+LOOPS=${LOOPS:-10}
+DEVICE=${DEVICE:-$(uname -n)}
+BASELINE_DIR=${BASELINE_DIR:-"perf_baselines"}
+RESULT=${RESULT:-"perf_results.json"}
+TESTS=${TESTS:-"compute_1 compute_2 compute_3 directdraw_1 directdraw_2 drawrange_1 drawrange_2 indirectdraw_1 indirectdraw_2 imagetex_1 multisample_1 vertexbuffer_1"}
+
+rm -rf perffiles
+mkdir -p perffiles
+
+function trace() {
+	echo
+	echo "-- tracing $1 --"
+	PADEMO_FRAMES=$FRAMES OUT_TRACE_FILE=perffiles/$1 LD_PRELOAD=$PATRACE_LIB/libegltrace.so INTERCEPTOR_LIB=$PATRACE_LIB/libegltrace.so TRACE_LIBEGL=$DDK_PATH/libEGL.so TRACE_LIBGLES1=$DDK_PATH/libGLESv1_CM.so TRACE_LIBGLES2=$DDK_PATH/libGLESv2.so ./$1
+}
+
+# The first frame has all the setup, so loop the frames after it
+function replay() {
+	echo
+	echo "-- replaying $1 $LOOPS times --"
+	( cd perffiles ; ${PATRACE_EXE}/paretrace -preload 1 $FRAMES -loop $LOOPS $1.1.pat && mv results.json $1.json )
+}
+
+for t in $TESTS; do
+	trace $t
+	replay $t
+done
+
+CHECK_ARGS=""
+if [ -n "$UPDATE_BASELINE" ]; then
+	CHECK_ARGS="--update"
+fi
+python3 ./perf_check.py $CHECK_ARGS --device "$DEVICE" --baseline-dir "$BASELINE_DIR" --output "$RESULT" perffiles $TESTS
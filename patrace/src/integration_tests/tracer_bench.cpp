@@ -0,0 +1,445 @@
+// Synthetic GL workload for measuring the CPU cost the tracer adds to each call.
+//
+// The workload is selected with TRACER_BENCH_PATTERN:
+//   draw        - many small indexed draws from buffer objects
+//   uniform     - many glUniform* updates per draw
+//   clientarray - draws sourcing vertex data from client-side arrays
+//   map         - glMapBufferRange / write / glUnmapBuffer of a dynamic buffer
+//   threads     - the draw pattern issued from TRACER_BENCH_THREADS threads at once
+//
+// Only the calls issued inside the frame callback are timed and counted, so that
+// setup cost does not dilute the per-call number. The result is printed and, if
+// TRACER_BENCH_RESULT is set, written there as JSON. Run this once natively and
+// once with egltrace preloaded; tracer_bench.sh does that and compares the two.
+
+#include "pa_demo.h"
+
+#include <time.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+const char *vertex_shader_source[] = GLSL_VS(
+	in vec4 a_v4Position;
+	in vec4 a_v4FillColor;
+	uniform vec4 u_offset;
+	uniform vec4 u_scale;
+	uniform mat4 u_transform;
+	out vec4 v_v4FillColor;
+	void main()
+	{
+		v_v4FillColor = a_v4FillColor * u_scale;
+		gl_Position = u_transform * a_v4Position + u_offset;
+	}
+);
+
+const char *fragment_shader_source[] = GLSL_FS(
+	in vec4 v_v4FillColor;
+	out vec4 fragColor;
+	void main()
+	{
+		fragColor = v_v4FillColor;
+	}
+);
+
+static const float triangleVertices[] =
+{
+	0.0f,  0.5f, 0.0f,
+	-0.5f, -0.5f, 0.0f,
+	0.5f, -0.5f, 0.0f,
+};
+
+static const float triangleColors[] =
+{
+	1.0, 0.0, 0.0, 1.0,
+	0.0, 1.0, 0.0, 1.0,
+	0.0, 0.0, 1.0, 1.0,
+};
+
+static const GLushort indices[] =
+{
+	0, 1, 2
+};
+
+static const float identity[16] =
+{
+	1.0f, 0.0f, 0.0f, 0.0f,
+	0.0f, 1.0f, 0.0f, 0.0f,
+	0.0f, 0.0f, 1.0f, 0.0f,
+	0.0f, 0.0f, 0.0f, 1.0f,
+};
+
+enum Pattern
+{
+	PATTERN_DRAW,
+	PATTERN_UNIFORM,
+	PATTERN_CLIENTARRAY,
+	PATTERN_MAP,
+	PATTERN_THREADS
+};
+
+static const char *pattern_names[] = { "draw", "uniform", "clientarray", "map", "threads" };
+
+// Objects used by one context. The main context and every worker thread has its own.
+struct BenchContext
+{
+	GLuint program = 0;
+	GLuint vs = 0;
+	GLuint fs = 0;
+	GLuint vao = 0;
+	GLuint vbo[2] = { 0, 0 };
+	GLuint ibo = 0;
+	GLuint dynamic_buffer = 0;
+	GLint loc_position = -1;
+	GLint loc_color = -1;
+	GLint loc_offset = -1;
+	GLint loc_scale = -1;
+	GLint loc_transform = -1;
+	EGLContext context = EGL_NO_CONTEXT;
+	EGLSurface surface = EGL_NO_SURFACE;
+	long calls = 0;
+};
+
+static Pattern pattern = PATTERN_DRAW;
+static int iterations = 1000; // inner loop count per frame
+static int thread_count = 4;
+static BenchContext main_ctx;
+static std::vector<BenchContext> worker_ctx;
+static std::vector<std::thread> workers;
+static long long total_ns = 0;
+static long total_calls = 0;
+static int timed_frames = 0;
+
+// A reusable barrier for starting and finishing the threaded frame
+static std::mutex frame_mutex;
+static std::condition_variable frame_cv;
+static int frame_generation = 0;
+static int frames_done = 0;
+static bool quit = false;
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int get_env_int(const char *name, int fallback)
+{
+	const char *tmpstr = getenv(name);
+	return tmpstr ? atoi(tmpstr) : fallback;
+}
+
+static void setup_context(BenchContext &ctx)
+{
+	ctx.program = glCreateProgram();
+	ctx.vs = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(ctx.vs, 1, vertex_shader_source, NULL);
+	compile("vertex_shader_source", ctx.vs);
+	ctx.fs = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(ctx.fs, 1, fragment_shader_source, NULL);
+	compile("fragment_shader_source", ctx.fs);
+	glAttachShader(ctx.program, ctx.vs);
+	glAttachShader(ctx.program, ctx.fs);
+	link_shader("draw_program", ctx.program);
+	glUseProgram(ctx.program);
+
+	ctx.loc_position = glGetAttribLocation(ctx.program, "a_v4Position");
+	ctx.loc_color = glGetAttribLocation(ctx.program, "a_v4FillColor");
+	ctx.loc_offset = glGetUniformLocation(ctx.program, "u_offset");
+	ctx.loc_scale = glGetUniformLocation(ctx.program, "u_scale");
+	ctx.loc_transform = glGetUniformLocation(ctx.program, "u_transform");
+	glUniform4f(ctx.loc_offset, 0.0f, 0.0f, 0.0f, 0.0f);
+	glUniform4f(ctx.loc_scale, 1.0f, 1.0f, 1.0f, 1.0f);
+	glUniformMatrix4fv(ctx.loc_transform, 1, GL_FALSE, identity);
+
+	glGenVertexArrays(1, &ctx.vao);
+	glBindVertexArray(ctx.vao);
+	glGenBuffers(2, ctx.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, ctx.vbo[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(triangleVertices), triangleVertices, GL_STATIC_DRAW);
+	glVertexAttribPointer(ctx.loc_position, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, ctx.vbo[1]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(triangleColors), triangleColors, GL_STATIC_DRAW);
+	glVertexAttribPointer(ctx.loc_color, 4, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(ctx.loc_position);
+	glEnableVertexAttribArray(ctx.loc_color);
+	glGenBuffers(1, &ctx.ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ctx.ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &ctx.dynamic_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ctx.dynamic_buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, 64 * 1024, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+static void cleanup_context(BenchContext &ctx)
+{
+	glDeleteVertexArrays(1, &ctx.vao);
+	glDeleteBuffers(2, ctx.vbo);
+	glDeleteBuffers(1, &ctx.ibo);
+	glDeleteBuffers(1, &ctx.dynamic_buffer);
+	glDeleteShader(ctx.vs);
+	glDeleteShader(ctx.fs);
+	glDeleteProgram(ctx.program);
+}
+
+static void run_draw(BenchContext &ctx)
+{
+	glUseProgram(ctx.program);
+	glBindVertexArray(ctx.vao);
+	ctx.calls += 2;
+	for (int i = 0; i < iterations; i++)
+	{
+		glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_SHORT, 0);
+	}
+	ctx.calls += iterations;
+}
+
+static void run_uniform(BenchContext &ctx)
+{
+	glUseProgram(ctx.program);
+	glBindVertexArray(ctx.vao);
+	ctx.calls += 2;
+	for (int i = 0; i < iterations; i++)
+	{
+		const float f = (float)(i % 100) / 100.0f;
+		glUniform4f(ctx.loc_offset, f, 0.0f, 0.0f, 0.0f);
+		glUniform4f(ctx.loc_scale, 1.0f, f, 1.0f, 1.0f);
+		glUniformMatrix4fv(ctx.loc_transform, 1, GL_FALSE, identity);
+		glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_SHORT, 0);
+	}
+	ctx.calls += iterations * 4;
+}
+
+static void run_clientarray(BenchContext &ctx)
+{
+	// client side arrays need the default vertex array object
+	glUseProgram(ctx.program);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnableVertexAttribArray(ctx.loc_position);
+	glEnableVertexAttribArray(ctx.loc_color);
+	ctx.calls += 5;
+	for (int i = 0; i < iterations; i++)
+	{
+		glVertexAttribPointer(ctx.loc_position, 3, GL_FLOAT, GL_FALSE, 0, triangleVertices);
+		glVertexAttribPointer(ctx.loc_color, 4, GL_FLOAT, GL_FALSE, 0, triangleColors);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+	ctx.calls += iterations * 3;
+}
+
+static void run_map(BenchContext &ctx)
+{
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ctx.dynamic_buffer);
+	ctx.calls++;
+	for (int i = 0; i < iterations; i++)
+	{
+		const GLintptr offset = (i % 64) * 1024;
+		void *ptr = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, 1024, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		if (ptr)
+		{
+			memset(ptr, i & 0xff, 1024);
+		}
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	ctx.calls += iterations * 2 + 1;
+}
+
+static void worker_main(int idx, EGLDisplay display)
+{
+	BenchContext &ctx = worker_ctx[idx];
+	if (!eglMakeCurrent(display, ctx.surface, ctx.surface, ctx.context))
+	{
+		PALOGE("eglMakeCurrent() failed in worker %d\n", idx);
+		abort();
+	}
+	setup_context(ctx);
+	ctx.calls = 0;
+
+	int seen = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(frame_mutex);
+			frame_cv.wait(lock, [&]{ return quit || frame_generation != seen; });
+			if (quit) break;
+			seen = frame_generation;
+		}
+		run_draw(ctx);
+		glFlush();
+		ctx.calls++;
+		{
+			std::unique_lock<std::mutex> lock(frame_mutex);
+			frames_done++;
+		}
+		frame_cv.notify_all();
+	}
+
+	cleanup_context(ctx);
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+static int setupGraphics(PADEMO *handle, int w, int h, void *user_data)
+{
+	const char *name = getenv("TRACER_BENCH_PATTERN");
+	if (name)
+	{
+		bool found = false;
+		for (int i = 0; i <= PATTERN_THREADS; i++)
+		{
+			if (strcmp(name, pattern_names[i]) == 0)
+			{
+				pattern = (Pattern)i;
+				found = true;
+			}
+		}
+		if (!found)
+		{
+			PALOGE("Unknown TRACER_BENCH_PATTERN %s\n", name);
+			return 1;
+		}
+	}
+	iterations = get_env_int("TRACER_BENCH_ITERATIONS", iterations);
+	thread_count = get_env_int("TRACER_BENCH_THREADS", thread_count);
+
+	glViewport(0, 0, handle->width, handle->height);
+	glClearColor(0.0f, 0.0f, 0.5f, 1.0f);
+	setup_context(main_ctx);
+
+	if (pattern == PATTERN_THREADS)
+	{
+		EGLint config_attribs[] = {
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RED_SIZE, 8,
+			EGL_GREEN_SIZE, 8,
+			EGL_BLUE_SIZE, 8,
+			EGL_NONE,
+		};
+		EGLint context_attribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 3,
+			EGL_CONTEXT_MINOR_VERSION, 1,
+			EGL_NONE,
+		};
+		EGLint pbuffer_attribs[] = {
+			EGL_WIDTH, 64,
+			EGL_HEIGHT, 64,
+			EGL_NONE,
+		};
+		EGLConfig config;
+		EGLint num_configs = 0;
+		if (!eglChooseConfig(handle->display, config_attribs, &config, 1, &num_configs) || num_configs == 0)
+		{
+			PALOGE("No pbuffer capable EGL config found\n");
+			return 1;
+		}
+		worker_ctx.resize(thread_count);
+		for (BenchContext &ctx : worker_ctx)
+		{
+			ctx.surface = eglCreatePbufferSurface(handle->display, config, pbuffer_attribs);
+			ctx.context = eglCreateContext(handle->display, config, EGL_NO_CONTEXT, context_attribs);
+			if (ctx.surface == EGL_NO_SURFACE || ctx.context == EGL_NO_CONTEXT)
+			{
+				PALOGE("Failed to create worker context\n");
+				return 1;
+			}
+		}
+		for (int i = 0; i < thread_count; i++)
+		{
+			workers.emplace_back(worker_main, i, handle->display);
+		}
+	}
+
+	main_ctx.calls = 0;
+	return 0;
+}
+
+static void callback_draw(PADEMO *handle, void *user_data)
+{
+	const long calls_before = main_ctx.calls;
+	long worker_calls_before = 0;
+	for (const BenchContext &ctx : worker_ctx) worker_calls_before += ctx.calls;
+
+	const long long start = now_ns();
+	switch (pattern)
+	{
+	case PATTERN_DRAW: run_draw(main_ctx); break;
+	case PATTERN_UNIFORM: run_uniform(main_ctx); break;
+	case PATTERN_CLIENTARRAY: run_clientarray(main_ctx); break;
+	case PATTERN_MAP: run_map(main_ctx); break;
+	case PATTERN_THREADS:
+		{
+			std::unique_lock<std::mutex> lock(frame_mutex);
+			frames_done = 0;
+			frame_generation++;
+			frame_cv.notify_all();
+			frame_cv.wait(lock, []{ return frames_done == thread_count; });
+		}
+		break;
+	}
+	const long long end = now_ns();
+
+	long worker_calls = 0;
+	for (const BenchContext &ctx : worker_ctx) worker_calls += ctx.calls;
+
+	// the first frame warms up caches and lazy driver state, so keep it out of the result
+	if (handle->current_frame > 0)
+	{
+		total_ns += end - start;
+		total_calls += (main_ctx.calls - calls_before) + (worker_calls - worker_calls_before);
+		timed_frames++;
+	}
+}
+
+static void test_cleanup(PADEMO *handle, void *user_data)
+{
+	if (!workers.empty())
+	{
+		{
+			std::unique_lock<std::mutex> lock(frame_mutex);
+			quit = true;
+		}
+		frame_cv.notify_all();
+		for (std::thread &t : workers) t.join();
+		for (BenchContext &ctx : worker_ctx)
+		{
+			eglDestroyContext(handle->display, ctx.context);
+			eglDestroySurface(handle->display, ctx.surface);
+		}
+	}
+	cleanup_context(main_ctx);
+
+	const double ns_per_call = total_calls ? (double)total_ns / total_calls : 0.0;
+	PALOGI("%s: %d frames, %ld calls, %lld ns, %.1f ns/call\n", pattern_names[pattern], timed_frames, total_calls, total_ns, ns_per_call);
+
+	const char *path = getenv("TRACER_BENCH_RESULT");
+	if (path)
+	{
+		FILE *fp = fopen(path, "w");
+		if (!fp)
+		{
+			PALOGE("Failed to open %s for writing\n", path);
+			return;
+		}
+		fprintf(fp, "{\n");
+		fprintf(fp, "  \"pattern\": \"%s\",\n", pattern_names[pattern]);
+		fprintf(fp, "  \"threads\": %d,\n", pattern == PATTERN_THREADS ? thread_count : 1);
+		fprintf(fp, "  \"frames\": %d,\n", timed_frames);
+		fprintf(fp, "  \"calls\": %ld,\n", total_calls);
+		fprintf(fp, "  \"ns\": %lld,\n", total_ns);
+		fprintf(fp, "  \"ns_per_call\": %.3f\n", ns_per_call);
+		fprintf(fp, "}\n");
+		fclose(fp);
+	}
+}
+
+int main()
+{
+	return init("tracer_bench", callback_draw, setupGraphics, test_cleanup);
+}
@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# Measure the CPU overhead egltrace adds to each GL call (from tests directory by default).
+#
+# Every tracer_bench pattern is run once without the tracer and once with egltrace
+# preloaded, and the difference in ns per call is reported together with the number
+# of trace bytes written per call. A run with no frames is traced as well so that the
+# header and setup calls can be subtracted from the trace size.
+
+set -e
+
+PATRACE_ROOT=${PARETRACE_PATH:-".."}
+PATRACE_LIB="${PATRACE_ROOT}/lib"
+DDK_PATH=${DDK_PATH:-"/usr/lib"}
+FRAMES=${FRAMES:-20}
+PATTERNS=${PATTERNS:-"draw uniform clientarray map threads"}
+RESULT=${RESULT:-"tracer_bench.json"}
+
+rm -rf benchfiles
+mkdir -p benchfiles
+
+function native() {
+	PADEMO_FRAMES=$2 TRACER_BENCH_PATTERN=$1 TRACER_BENCH_RESULT=benchfiles/$1_native.json LD_LIBRARY_PATH=$DDK_PATH:. ./tracer_bench > /dev/null
+}
+
+function traced() {
+	PADEMO_FRAMES=$2 TRACER_BENCH_PATTERN=$1 TRACER_BENCH_RESULT=benchfiles/$3.json OUT_TRACE_FILE=benchfiles/$3 LD_PRELOAD=$PATRACE_LIB/libegltrace.so INTERCEPTOR_LIB=$PATRACE_LIB/libegltrace.so TRACE_LIBEGL=$DDK_PATH/libEGL.so TRACE_LIBGLES1=$DDK_PATH/libGLESv1_CM.so TRACE_LIBGLES2=$DDK_PATH/libGLESv2.so ./tracer_bench > /dev/null
+}
+
+for p in $PATTERNS; do
+	echo "-- benchmarking $p --"
+	native $p $FRAMES
+	traced $p $FRAMES ${p}_traced
+	traced $p 0 ${p}_empty
+done
+
+python3 - "$RESULT" $PATTERNS <<'EOF'
+import json, os, sys
+
+def size(name):
+    files = [f for f in os.listdir('benchfiles') if f.startswith(name + '.') and f.endswith('.pat')]
+    return os.path.getsize(os.path.join('benchfiles', files[0])) if files else 0
+
+results = []
+for p in sys.argv[2:]:
+    native = json.load(open('benchfiles/%s_native.json' % p))
+    traced = json.load(open('benchfiles/%s_traced.json' % p))
+    calls = traced['calls']
+    r = {
+        'pattern': p,
+        'calls': calls,
+        'native_ns_per_call': native['ns_per_call'],
+        'traced_ns_per_call': traced['ns_per_call'],
+        'overhead_ns_per_call': traced['ns_per_call'] - native['ns_per_call'],
+        'trace_bytes_per_call': float(size(p + '_traced') - size(p + '_empty')) / calls if calls else 0.0,
+    }
+    print('%-12s native %8.1f ns/call  traced %8.1f ns/call  overhead %8.1f ns/call  %6.1f bytes/call' % (
+        p, r['native_ns_per_call'], r['traced_ns_per_call'], r['overhead_ns_per_call'], r['trace_bytes_per_call']))
+    results.append(r)
+
+with open(sys.argv[1], 'w') as f:
+    json.dump({'results': results}, f, indent=2)
+EOF
@@ -0,0 +1,239 @@
+#include "retracer/batch_scheduler.hpp"
+
+#include "common/in_file_mt.hpp"
+#include "common/os.hpp"
+#include "common/os_time.hpp"
+#include "jsoncpp/include/json/writer.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+
+namespace retracer {
+
+BatchScheduler::BatchScheduler(int workers, int devices, uint64_t memoryBudget)
+    : mWorkers(workers > 0 ? workers : 1)
+    , mDevices(devices)
+    , mMemoryBudget(memoryBudget)
+{
+}
+
+uint64_t BatchScheduler::estimateMemory(const Json::Value& entry, const std::string& traceFile)
+{
+    if (entry.isMember("memoryEstimate"))
+    {
+        return entry["memoryEstimate"].asUInt64() * 1024 * 1024;
+    }
+    struct stat st;
+    if (stat(traceFile.c_str(), &st) != 0)
+    {
+        return 0; // fails quickly when run
+    }
+    // Most of a trace is texture and buffer data, which is compressed about in half in the file
+    // and then held by the driver once uploaded
+    uint64_t memory = (uint64_t)st.st_size * 2;
+    common::InFile file;
+    if (file.Open(traceFile.c_str(), true))
+    {
+        for (const Json::Value& thread : file.getJSONHeaderMember("threads"))
+        {
+            // color, depth and stencil, and a back buffer
+            memory += (uint64_t)thread["winW"].asUInt() * thread["winH"].asUInt() * 4 * 3;
+            memory += thread["clientSideBufferSize"].asUInt64();
+        }
+        file.Close();
+    }
+    return memory;
+}
+
+bool BatchScheduler::start(Slot& slot, int device, const RunFunc& runJob)
+{
+    fflush(stdout);
+    fflush(stderr);
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        DBG_LOG("Failed to start a worker for batch entry %u: %s\n", slot.job.index, strerror(errno));
+        return false;
+    }
+    if (pid == 0)
+    {
+        // The worker: nothing of the parent is torn down on the way out
+        if (mStartBarrier)
+        {
+            close(mReadyPipe[0]);
+            close(mStartPipe[1]); // or it would hold itself back
+        }
+        _exit(runJob(slot.job, device));
+    }
+    slot.pid = pid;
+    slot.begin = os::getTime();
+    DBG_LOG("Batch entry %u started in worker %d on %s: %s, estimated %llu MB\n", slot.job.index, pid,
+            device >= 0 ? ("device " + std::to_string(device)).c_str() : "the default device",
+            slot.job.traceFile.c_str(), (unsigned long long)(slot.job.memory >> 20));
+    return true;
+}
+
+void BatchScheduler::waitForStart()
+{
+    if (!mStartBarrier || mReadyPipe[1] < 0)
+    {
+        return;
+    }
+    const char ready = 1;
+    while (write(mReadyPipe[1], &ready, 1) < 0 && errno == EINTR) {}
+    close(mReadyPipe[1]);
+    mReadyPipe[1] = -1;
+    char go;
+    while (read(mStartPipe[0], &go, 1) < 0 && errno == EINTR) {} // returns once it is closed
+    close(mStartPipe[0]);
+    mStartPipe[0] = -1;
+}
+
+void BatchScheduler::releaseStart(unsigned workers)
+{
+    close(mReadyPipe[1]); // only the workers have it now
+    unsigned ready = 0;
+    while (ready < workers)
+    {
+        pollfd pfd = { mReadyPipe[0], POLLIN, 0 };
+        if (poll(&pfd, 1, 100) > 0)
+        {
+            char buffer[64];
+            const ssize_t n = read(mReadyPipe[0], buffer, sizeof(buffer));
+            if (n == 0)
+            {
+                break; // every worker has ended or is ready
+            }
+            ready += n > 0 ? n : 0;
+            continue;
+        }
+        // a worker that ended before it was ready would hold the others back for good
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid != 0)
+        {
+            DBG_LOG("Worker %d ended before it was ready, starting the others\n", (int)info.si_pid);
+            break;
+        }
+    }
+    close(mReadyPipe[0]);
+    close(mStartPipe[0]);
+    close(mStartPipe[1]); // lets the workers go
+    mReadyPipe[0] = mReadyPipe[1] = mStartPipe[0] = mStartPipe[1] = -1;
+    DBG_LOG("%u of %u workers ready, starting them together\n", ready, workers);
+}
+
+int BatchScheduler::run(const RunFunc& runJob, const std::string& logFile)
+{
+    std::ofstream log(logFile, std::ios::app);
+    if (!log)
+    {
+        DBG_LOG("Failed to open %s, the batch is not logged\n", logFile.c_str());
+    }
+    Json::FastWriter writer;
+    if (mStartBarrier && (pipe(mReadyPipe) != 0 || pipe(mStartPipe) != 0))
+    {
+        DBG_LOG("Failed to make the start barrier: %s\n", strerror(errno));
+        return mPending.size();
+    }
+    std::vector<Slot> slots(mStartBarrier ? std::max<size_t>(mPending.size(), 1) : mWorkers);
+    unsigned running = 0;
+    uint64_t memoryInUse = 0;
+    int failed = 0;
+    const size_t total = mPending.size();
+    size_t done = 0;
+
+    while (!mPending.empty() || running > 0)
+    {
+        // Start what fits, in order
+        for (size_t i = 0; i < mPending.size() && running < slots.size(); )
+        {
+            const Job& job = mPending[i];
+            const bool fits = mStartBarrier || mMemoryBudget == 0 || memoryInUse + job.memory <= mMemoryBudget || running == 0;
+            if (!fits)
+            {
+                i++;
+                continue;
+            }
+            size_t s = 0;
+            while (slots[s].pid != 0) s++;
+            slots[s].job = job;
+            mPending.erase(mPending.begin() + i);
+            if (start(slots[s], mDevices > 0 ? (int)(s % mDevices) : -1, runJob))
+            {
+                running++;
+                memoryInUse += slots[s].job.memory;
+            }
+            else
+            {
+                failed++;
+                done++;
+            }
+        }
+        if (mStartBarrier && mReadyPipe[0] >= 0)
+        {
+            releaseStart(running);
+        }
+        if (running == 0)
+        {
+            continue; // nothing could be started, and nothing to wait for
+        }
+
+        int status = 0;
+        const pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR) continue;
+            DBG_LOG("Failed to wait for the batch workers: %s\n", strerror(errno));
+            break;
+        }
+        for (size_t s = 0; s < slots.size(); s++)
+        {
+            Slot& slot = slots[s];
+            if (slot.pid != pid)
+            {
+                continue;
+            }
+            const bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            Json::Value line;
+            line["index"] = slot.job.index;
+            line["file"] = slot.job.traceFile;
+            line["resultFile"] = slot.job.resultFile;
+            line["device"] = mDevices > 0 ? (int)(s % mDevices) : -1;
+            line["seconds"] = (os::getTime() - slot.begin) / (double)os::timeFrequency;
+            line["memoryEstimate"] = (Json::Value::UInt64)(slot.job.memory >> 20);
+            if (WIFSIGNALED(status))
+            {
+                line["status"] = "crashed";
+                line["signal"] = WTERMSIG(status);
+            }
+            else
+            {
+                line["status"] = ok ? "ok" : "failed";
+                line["exitCode"] = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            }
+            if (log)
+            {
+                log << writer.write(line);
+                log.flush();
+            }
+            done++;
+            DBG_LOG("Batch entry %u %s, %u of %u done\n", slot.job.index, line["status"].asCString(), (unsigned)done, (unsigned)total);
+            failed += !ok;
+            running--;
+            memoryInUse -= slot.job.memory;
+            slot.pid = 0;
+        }
+    }
+    return failed;
+}
+
+}
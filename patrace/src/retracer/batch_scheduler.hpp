@@ -0,0 +1,82 @@
+#ifndef _RETRACER_BATCH_SCHEDULER_HPP_
+#define _RETRACER_BATCH_SCHEDULER_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace retracer {
+
+/// Replays the entries of a -jsonBatch list in parallel for -jobs, each in a process of its own,
+/// so that several GPUs or devices of a host are kept busy, and a trace that crashes or aborts
+/// only loses its own result. Each worker slot is pinned to an EGL device when devices are given.
+///
+/// Jobs are started in the order of the list, skipping over the ones that would not fit in the
+/// memory left in the budget, going by what the jobs running already are estimated to need. A
+/// job that does not fit in the whole budget is run on its own. Each job is appended to a log as
+/// a line of JSON as soon as it ends, so that results can be picked up while the batch runs.
+///
+/// With a start barrier, all the jobs are started at once instead, and held back until each of
+/// them is ready to replay, so that they share the GPU for as much of their runs as possible.
+class BatchScheduler
+{
+public:
+    struct Job
+    {
+        Json::ArrayIndex index; ///< in the batch list
+        std::string traceFile;
+        std::string resultFile;
+        uint64_t memory; ///< estimated, in bytes
+    };
+
+    /// Run job in the worker process, on the given device or -1, returning its exit status
+    typedef std::function<int(const Job& job, int device)> RunFunc;
+
+    /// memoryBudget is in bytes, zero for none. devices is the number of EGL devices to spread
+    /// the workers over, zero to leave them all on the default one.
+    BatchScheduler(int workers, int devices, uint64_t memoryBudget);
+
+    /// What replaying the trace is estimated to need, from the "memoryEstimate" of the entry in
+    /// MB, or else from the size of the trace file and the window sizes and client side buffers
+    /// in its header
+    static uint64_t estimateMemory(const Json::Value& entry, const std::string& traceFile);
+
+    void add(const Job& job) { mPending.push_back(job); }
+
+    /// Start every job at once, each in a worker of its own, and hold them back until all of them
+    /// have called waitForStart(). The memory budget does not apply then.
+    void setStartBarrier(bool enabled) { mStartBarrier = enabled; }
+    /// In a worker: tell the scheduler it is ready, and wait for the others, if there is a start
+    /// barrier. Each worker must call it once, even if its job fails before it gets to replay.
+    void waitForStart();
+
+    /// Run all the jobs added, logging each to logFile, returns the number that failed
+    int run(const RunFunc& runJob, const std::string& logFile);
+
+private:
+    struct Slot
+    {
+        int pid = 0; ///< of the worker running a job in it, 0 if free
+        Job job;
+        int64_t begin = 0;
+    };
+
+    bool start(Slot& slot, int device, const RunFunc& runJob);
+    /// Wait until the workers are ready, or one of them ended before it was, and let them go
+    void releaseStart(unsigned workers);
+
+    int mWorkers;
+    int mDevices;
+    uint64_t mMemoryBudget;
+    std::vector<Job> mPending;
+    bool mStartBarrier = false;
+    int mReadyPipe[2] = { -1, -1 }; ///< a byte from each worker that is ready
+    int mStartPipe[2] = { -1, -1 }; ///< closed by the scheduler to let the workers go
+};
+
+}
+
+#endif
@@ -0,0 +1,211 @@
+#include "retracer/buffer_dump_queue.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "retracer/retracer.hpp"
+#include "retracer/timeline.hpp"
+
+#include "common/os.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace retracer {
+
+BufferDumpQueue::~BufferDumpQueue()
+{
+    {
+        std::lock_guard<std::mutex> lk(mMutex);
+        mStop = true;
+    }
+    mQueueChanged.notify_all();
+    if (mWriter.joinable())
+    {
+        mWriter.join();
+    }
+    // staging buffers and fences went with their context
+}
+
+bool BufferDumpQueue::read(GLuint buffer, GLint size, const std::string& filename, unsigned callNo)
+{
+    Context* context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    if (!context || context->_profile < PROFILE_ES3 || size <= 0)
+    {
+        return false;
+    }
+    if (context != mContext)
+    {
+        if (mContext)
+        {
+            DBG_LOG("Buffer dump staging buffers of another context are still in use, dropping them\n");
+            mPending.clear();
+            mFree.clear();
+        }
+        mContext = context;
+    }
+
+    poll();
+    if (mPending.size() >= MAX_PENDING)
+    {
+        complete(true); // the GPU is far behind, this is where replay has to wait
+    }
+
+    // Reuse the smallest free staging buffer that fits, or grow the last one
+    Staging staging;
+    size_t best = mFree.size();
+    for (size_t i = 0; i < mFree.size(); i++)
+    {
+        if (mFree[i].capacity >= size && (best == mFree.size() || mFree[i].capacity < mFree[best].capacity))
+        {
+            best = i;
+        }
+    }
+    if (best == mFree.size() && !mFree.empty())
+    {
+        best = mFree.size() - 1;
+    }
+    if (best < mFree.size())
+    {
+        staging = mFree[best];
+        mFree.erase(mFree.begin() + best);
+    }
+
+    GLint oldReadBuffer = 0, oldWriteBuffer = 0;
+    _glGetIntegerv(GL_COPY_READ_BUFFER_BINDING, &oldReadBuffer);
+    _glGetIntegerv(GL_COPY_WRITE_BUFFER_BINDING, &oldWriteBuffer);
+    if (staging.buffer == 0)
+    {
+        _glGenBuffers(1, &staging.buffer);
+    }
+    _glBindBuffer(GL_COPY_WRITE_BUFFER, staging.buffer);
+    if (staging.capacity < size)
+    {
+        _glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_READ);
+        staging.capacity = size;
+    }
+    _glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    _glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+    _glBindBuffer(GL_COPY_READ_BUFFER, oldReadBuffer);
+    _glBindBuffer(GL_COPY_WRITE_BUFFER, oldWriteBuffer);
+
+    Copy copy;
+    copy.staging = staging;
+    copy.size = size;
+    copy.fence = _glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    copy.filename = filename;
+    copy.callNo = callNo;
+    mPending.push_back(copy);
+    return true;
+}
+
+bool BufferDumpQueue::complete(bool wait)
+{
+    Copy& copy = mPending.front();
+    GLenum result = _glClientWaitSync(copy.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (result == GL_TIMEOUT_EXPIRED && !wait)
+    {
+        return false;
+    }
+    while (result == GL_TIMEOUT_EXPIRED)
+    {
+        result = _glClientWaitSync(copy.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100 * 1000 * 1000);
+    }
+    _glDeleteSync(copy.fence);
+
+    Job job;
+    job.filename = copy.filename;
+    job.callNo = copy.callNo;
+    GLint oldWriteBuffer = 0;
+    _glGetIntegerv(GL_COPY_WRITE_BUFFER_BINDING, &oldWriteBuffer);
+    _glBindBuffer(GL_COPY_WRITE_BUFFER, copy.staging.buffer);
+    const void* data = (result != GL_WAIT_FAILED) ? _glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, copy.size, GL_MAP_READ_BIT) : nullptr;
+    if (data)
+    {
+        job.data.assign((const char*)data, (const char*)data + copy.size);
+        _glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    }
+    _glBindBuffer(GL_COPY_WRITE_BUFFER, oldWriteBuffer);
+    mFree.push_back(copy.staging);
+    mPending.pop_front();
+
+    if (!data)
+    {
+        DBG_LOG("Couldn't map the copy of buffer for %s\n", job.filename.c_str());
+        return true;
+    }
+    enqueue(std::move(job));
+    return true;
+}
+
+void BufferDumpQueue::flush()
+{
+    while (!mPending.empty())
+    {
+        complete(true);
+    }
+    for (const Staging& staging : mFree)
+    {
+        _glDeleteBuffers(1, &staging.buffer);
+    }
+    mFree.clear();
+    mContext = nullptr;
+}
+
+void BufferDumpQueue::finish()
+{
+    std::unique_lock<std::mutex> lk(mMutex);
+    mQueueChanged.wait(lk, [&]{ return mJobs.empty() && !mBusy; });
+}
+
+void BufferDumpQueue::enqueue(Job&& job)
+{
+    std::unique_lock<std::mutex> lk(mMutex);
+    if (!mWriter.joinable())
+    {
+        mWriter = std::thread(&BufferDumpQueue::run, this);
+    }
+    mQueueChanged.wait(lk, [&]{ return mJobs.size() < MAX_QUEUED; });
+    mJobs.push_back(std::move(job));
+    lk.unlock();
+    mQueueChanged.notify_all();
+}
+
+void BufferDumpQueue::run()
+{
+    gTimeline.nameThread("buffer dump writer");
+    std::unique_lock<std::mutex> lk(mMutex);
+    while (true)
+    {
+        mQueueChanged.wait(lk, [&]{ return mStop || !mJobs.empty(); });
+        if (mJobs.empty())
+        {
+            return; // stopped
+        }
+        Job job = std::move(mJobs.front());
+        mJobs.pop_front();
+        mBusy = true;
+        lk.unlock();
+        mQueueChanged.notify_all();
+
+        {
+            TimelineScope scope("snapshot", "write buffer", job.callNo);
+            FILE* fd = fopen(job.filename.c_str(), "wb");
+            if (!fd)
+            {
+                DBG_LOG("Unable to open %s\n", job.filename.c_str());
+            }
+            else
+            {
+                fwrite(job.data.data(), 1, job.data.size(), fd);
+                fclose(fd);
+                DBG_LOG("Wrote %s\n", job.filename.c_str());
+            }
+        }
+
+        lk.lock();
+        mBusy = false;
+        mQueueChanged.notify_all();
+    }
+}
+
+}
@@ -0,0 +1,89 @@
+#ifndef _RETRACER_BUFFER_DUMP_QUEUE_HPP_
+#define _RETRACER_BUFFER_DUMP_QUEUE_HPP_
+
+#include "dispatch/eglimports.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace retracer {
+
+class Context;
+
+/// Dumps the contents of buffers (RETRACE_DUMP_BUFFERS) without stalling the replay. Each
+/// buffer is copied on the GPU into a staging buffer, with a fence behind it. The staging buffer
+/// is mapped once the fence has passed, usually some calls later, or when too many copies are in
+/// flight, and the contents are written out on a thread of their own. This keeps dumping at
+/// every draw call affordable.
+///
+/// Everything but the writing must be done on the thread and context that dumped the buffers,
+/// so flush() must be called before that context stops being current.
+class BufferDumpQueue
+{
+public:
+    static const unsigned MAX_PENDING = 64; ///< copies in flight before replay waits for the GPU
+    static const unsigned MAX_QUEUED = 64; ///< dumps waiting to be written
+
+    ~BufferDumpQueue();
+
+    /// Start copying size bytes of buffer, which must not be mapped, to be written to filename.
+    /// Returns false if it has to be read the usual way.
+    bool read(GLuint buffer, GLint size, const std::string& filename, unsigned callNo);
+
+    /// Pass on the dumps that the GPU is done with, without waiting
+    void poll() { while (!mPending.empty() && complete(false)) {} }
+
+    /// Pass on all dumps and free the staging buffers, while their context is still current
+    void flush();
+
+    /// Wait until all dumps passed on have been written
+    void finish();
+
+private:
+    struct Staging
+    {
+        GLuint buffer = 0;
+        GLint capacity = 0;
+    };
+
+    struct Copy
+    {
+        Staging staging;
+        GLint size;
+        GLsync fence;
+        std::string filename;
+        unsigned callNo;
+    };
+
+    struct Job
+    {
+        std::vector<char> data;
+        std::string filename;
+        unsigned callNo;
+    };
+
+    /// Map the oldest copy and queue it for writing. Returns false if wait is false and the
+    /// GPU is not done with it yet.
+    bool complete(bool wait);
+    void enqueue(Job&& job);
+    void run();
+
+    std::deque<Copy> mPending;
+    std::vector<Staging> mFree;
+    Context* mContext = nullptr; ///< owner of the staging buffers
+
+    std::mutex mMutex;
+    std::condition_variable mQueueChanged;
+    std::deque<Job> mJobs;
+    bool mBusy = false; ///< a job is being written
+    bool mStop = false;
+    std::thread mWriter;
+};
+
+}
+
+#endif
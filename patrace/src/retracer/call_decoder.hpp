@@ -0,0 +1,125 @@
+#ifndef _RETRACER_CALL_DECODER_HPP_
+#define _RETRACER_CALL_DECODER_HPP_
+
+#include "common/in_file_mt.hpp"
+#include "retracer/thread_handoff.hpp"
+#include "retracer/timeline.hpp"
+
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace retracer {
+
+/// Reads calls from the trace on a thread of its own, ahead of the replay threads, for
+/// -multithread mode. Calls are still replayed one at a time in trace order, so they go into
+/// one queue that is taken from by whichever replay thread has the turn (see
+/// Retracer::RetraceThread). That thread then only has to look at the tid of the next call to
+/// know whether to hand over, and the decoder wakes it if it had to wait for the call.
+///
+/// Call data points into the chunks of the trace reader, so before the reader moves on to
+/// another chunk the decoder waits until the calls read so far have been replayed. It does
+/// the same after every swap, since that is where the replay may rewind the trace reader.
+class CallDecoder
+{
+public:
+    static const unsigned QUEUE_SIZE = 1024;
+
+    CallDecoder(common::InFile& file, const std::atomic_bool& finish, unsigned swapId, unsigned swapWithDamageId)
+        : mFile(file)
+        , mFinish(finish)
+        , mSwapId(swapId)
+        , mSwapWithDamageId(swapWithDamageId)
+        , mQueue(QUEUE_SIZE)
+    {}
+
+    ~CallDecoder() { join(); }
+
+    /// Start reading after the call that was last returned by the trace reader
+    void start() { mThread = std::thread(&CallDecoder::run, this); }
+
+    /// Wait for the decoder to stop, which it does at the end of the trace or once finish is set
+    void join()
+    {
+        if (!mThread.joinable()) return;
+        wake();
+        mThread.join();
+    }
+
+    /// Call after setting finish
+    void wake()
+    {
+        mProducer.wake();
+        mConsumer.wake();
+    }
+
+    /// Replacement for InFile::GetNextCall(). Replay threads must only call this when they have
+    /// the turn. Calls returned earlier must not be used afterwards.
+    bool GetNextCall(void*& fptr, common::BCall_vlen& call, char*& src)
+    {
+        const uint64_t seq = mRequested.load(std::memory_order_relaxed);
+        mRequested.store(seq + 1); // tells the decoder that everything before seq has been replayed
+        mProducer.wake();
+        mConsumer.wait([&]{ return mDecoded.load() > seq || mFinish.load(); });
+        if (mDecoded.load() <= seq) return false;
+
+        const Entry& entry = mQueue[seq % QUEUE_SIZE];
+        fptr = entry.fptr;
+        call = entry.call;
+        src = entry.src;
+        return !entry.end;
+    }
+
+private:
+    struct Entry
+    {
+        void* fptr = nullptr;
+        common::BCall_vlen call;
+        char* src = nullptr;
+        bool end = false;
+    };
+
+    void run()
+    {
+        uint64_t decoded = 0;
+        bool sync = false;
+        gTimeline.nameThread("decoder");
+        while (!mFinish.load())
+        {
+            sync = sync || !mFile.nextCallKeepsData();
+            mProducer.wait([&]{
+                const uint64_t requested = mRequested.load();
+                // entry decoded - QUEUE_SIZE was taken before requested - 1 was asked for
+                return mFinish.load() || (sync ? requested > decoded : decoded + 1 < requested + QUEUE_SIZE);
+            });
+            if (mFinish.load()) break;
+
+            Entry& entry = mQueue[decoded % QUEUE_SIZE];
+            {
+                TimelineScope scope("decode", "decode call");
+                entry.end = !mFile.GetNextCall(entry.fptr, entry.call, entry.src);
+            }
+            sync = (entry.call.funcId == mSwapId || entry.call.funcId == mSwapWithDamageId);
+            mDecoded.store(++decoded);
+            mConsumer.wake();
+            if (entry.end) break;
+        }
+    }
+
+    common::InFile& mFile;
+    const std::atomic_bool& mFinish;
+    const unsigned mSwapId;
+    const unsigned mSwapWithDamageId;
+
+    std::vector<Entry> mQueue;
+    std::atomic<uint64_t> mDecoded{0}; ///< calls put into the queue
+    std::atomic<uint64_t> mRequested{0}; ///< calls asked for by the replay threads
+    ThreadHandoff mProducer; ///< where the decoder waits
+    ThreadHandoff mConsumer; ///< where the replay thread with the turn waits
+    std::thread mThread;
+};
+
+}
+
+#endif
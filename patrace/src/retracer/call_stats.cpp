@@ -0,0 +1,122 @@
+#include "retracer/call_stats.hpp"
+
+#include "common/in_file.hpp"
+#include "common/os.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+
+namespace retracer {
+
+__attribute__ ((noinline)) static int noop(int a)
+{
+    return a + 1;
+}
+
+uint64_t CallStats::Stat::percentile(double fraction) const
+{
+    const uint64_t wanted = (uint64_t)(fraction * count + 0.5);
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < BUCKETS; b++)
+    {
+        seen += histogram[b];
+        if (seen >= wanted && seen > 0)
+        {
+            if (b < 4) return b;
+            const unsigned msb = b / 4;
+            const uint64_t step = 1ull << (msb - 2);
+            return std::min(max, (4 + b % 4) * step + step - 1);
+        }
+    }
+    return max;
+}
+
+double CallStats::ticksPerSecond()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static double frequency = 0.0;
+    if (frequency == 0.0)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t startTicks = ticks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        const uint64_t endTicks = ticks();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        frequency = (endTicks - startTicks) / seconds;
+    }
+    return frequency;
+#elif defined(__aarch64__)
+    uint64_t frequency;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    return (double)frequency;
+#else
+    return 1e9;
+#endif
+}
+
+void CallStats::measureBaseline()
+{
+    int c = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        const uint64_t pre = ticks();
+        c = noop(c);
+        mBaseline.add(ticks() - pre);
+        usleep(c % 2); // just to use c for something, to make 100% sure it is not optimized away
+    }
+}
+
+bool CallStats::writeRow(FILE* fp, const char* name, const Stat& stat, double nsPerTick)
+{
+    return fprintf(fp, "%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", name, stat.count,
+                   (uint64_t)(stat.ticks * nsPerTick), (uint64_t)(stat.percentile(0.5) * nsPerTick),
+                   (uint64_t)(stat.percentile(0.99) * nsPerTick), (uint64_t)(stat.max * nsPerTick)) > 0;
+}
+
+bool CallStats::write(const char* filename, const common::InFileBase& file)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        DBG_LOG("Failed to open output callstats in %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    const double nsPerTick = 1e9 / ticksPerSecond();
+    bool ok = fprintf(fp, "Function,Calls,Time,P50,P99,Max\n") > 0;
+    if (mBaseline.count)
+    {
+        ok = ok && writeRow(fp, "NO-OP", mBaseline, nsPerTick);
+    }
+    if (mDecode.count)
+    {
+        ok = ok && writeRow(fp, "DECODE", mDecode, nsPerTick);
+    }
+    for (unsigned id = 0; id < mStats.size(); id++)
+    {
+        if (mStats[id].count)
+        {
+            ok = ok && writeRow(fp, file.ExIdToName(id), mStats[id], nsPerTick);
+        }
+    }
+    fsync(fileno(fp));
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok)
+    {
+        DBG_LOG("Failed to write callstats to %s\n", filename);
+    }
+    return ok;
+}
+
+void CallStats::clear()
+{
+    mStats.clear();
+    mBaseline = Stat();
+    mDecode = Stat();
+}
+
+}
@@ -0,0 +1,107 @@
+#ifndef _RETRACER_CALL_STATS_HPP_
+#define _RETRACER_CALL_STATS_HPP_
+
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace common {
+class InFileBase;
+}
+
+namespace retracer {
+
+/// Per function statistics for -callstats, kept in a table indexed by function id. Calls are
+/// timed with the cheapest counter the CPU has: the time stamp counter on x86, the generic
+/// timer on AArch64 (typically tens of nanoseconds per tick, so only averages over many calls
+/// are accurate there), CLOCK_MONOTONIC elsewhere. Each function has a histogram of call times
+/// with four buckets per power of two, good for percentiles to within about 20%.
+class CallStats
+{
+public:
+    static const unsigned BUCKETS = 64 * 4;
+
+    static inline uint64_t ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t value;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+        return value;
+#else
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+#endif
+    }
+
+    inline void add(unsigned short id, uint64_t ticks)
+    {
+        if (id >= mStats.size()) mStats.resize(id + 1);
+        mStats[id].add(ticks);
+    }
+
+    /// Time spent fetching and decoding the next call, which is not part of any function's row
+    inline void addDecode(uint64_t ticks)
+    {
+        mDecode.add(ticks);
+    }
+
+    /// Rate of ticks(), measured once on x86
+    static double ticksPerSecond();
+
+    /// Time an empty function, as a baseline for the cost of timing itself
+    void measureBaseline();
+
+    /// Write the statistics as CSV, before the trace file is closed since it has the function names
+    bool write(const char* filename, const common::InFileBase& file);
+
+    void clear();
+
+private:
+    struct Stat
+    {
+        uint64_t count = 0;
+        uint64_t ticks = 0;
+        uint64_t max = 0;
+        std::unique_ptr<uint32_t[]> histogram; ///< BUCKETS counters
+
+        void add(uint64_t t)
+        {
+            if (!histogram)
+            {
+                histogram.reset(new uint32_t[BUCKETS]());
+            }
+            count++;
+            ticks += t;
+            if (t > max) max = t;
+            histogram[bucket(t)]++;
+        }
+        /// Upper bound of the bucket that the given fraction of calls fall into or below
+        uint64_t percentile(double fraction) const;
+    };
+
+    static inline unsigned bucket(uint64_t t)
+    {
+        if (t < 4) return t;
+        const unsigned msb = 63 - __builtin_clzll(t);
+        return msb * 4 + ((t >> (msb - 2)) & 3); // top bit and the two below it
+    }
+
+    bool writeRow(FILE* fp, const char* name, const Stat& stat, double nsPerTick);
+
+    std::vector<Stat> mStats;
+    Stat mBaseline;
+    Stat mDecode;
+};
+
+}
+
+#endif
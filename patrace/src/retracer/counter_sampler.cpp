@@ -0,0 +1,155 @@
+#include "retracer/counter_sampler.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "common/os.hpp"
+#include "libcollector/interface.hpp"
+
+namespace retracer {
+
+/// Add the counts of span, by collector and metric, to those of total
+static void accumulate(Json::Value& total, const Json::Value& span)
+{
+    for (const std::string& collector : span.getMemberNames())
+    {
+        const Json::Value& values = span[collector];
+        Json::Value& sums = total[collector];
+        for (const std::string& metric : values.getMemberNames())
+        {
+            const Json::Value& v = values[metric];
+            if (!sums.isMember(metric))
+            {
+                sums[metric] = v;
+            }
+            else if (v.type() == Json::realValue)
+            {
+                sums[metric] = sums[metric].asDouble() + v.asDouble();
+            }
+            else if (v.type() == Json::uintValue)
+            {
+                sums[metric] = sums[metric].asUInt64() + v.asUInt64();
+            }
+            else
+            {
+                sums[metric] = sums[metric].asInt64() + v.asInt64();
+            }
+        }
+    }
+}
+
+void CounterSampler::setup(Collection* collectors, bool renderPasses, const std::shared_ptr<common::CallSet>& calls)
+{
+    mRenderPasses = renderPasses;
+    mCalls = calls;
+    mCollectors = (renderPasses || calls) ? collectors : nullptr;
+    mPassOpen = false;
+    if ((renderPasses || calls) && !collectors)
+    {
+        DBG_LOG("Counters of render passes and draws need -collect or collectors in the JSON parameters\n");
+    }
+}
+
+Json::Value CounterSampler::sample()
+{
+    _glFinish();
+    return mCollectors->collectSpan();
+}
+
+void CounterSampler::endPass(const Json::Value& span)
+{
+    accumulate(mPass["counters"], span);
+    mPasses.append(mPass);
+    mPassOpen = false;
+}
+
+bool CounterSampler::before(unsigned callNo, unsigned frameNo, const char* funcName, unsigned framebuffer, common::CallFlags callFlags)
+{
+    const bool draw = mCalls && mCalls->contains(callNo, callFlags);
+    const bool newPass = mRenderPasses && (!mPassOpen || framebuffer != mPass["framebuffer"].asUInt());
+    if (!draw && !newPass)
+    {
+        if (mPassOpen)
+        {
+            mPass["last_call"] = callNo;
+            mPass["draws"] = mPass["draws"].asUInt() + 1;
+        }
+        return false;
+    }
+
+    // what came before belongs to the open pass, or to no one
+    const Json::Value span = sample();
+    if (newPass)
+    {
+        if (mPassOpen)
+        {
+            endPass(span);
+        }
+        mPass = Json::Value();
+        mPass["frame"] = frameNo;
+        mPass["framebuffer"] = framebuffer;
+        mPass["first_call"] = callNo;
+        mPass["draws"] = 0;
+        mPass["counters"] = Json::objectValue;
+        mPassOpen = true;
+    }
+    else if (mPassOpen)
+    {
+        accumulate(mPass["counters"], span);
+    }
+    if (mPassOpen)
+    {
+        mPass["last_call"] = callNo;
+        mPass["draws"] = mPass["draws"].asUInt() + 1;
+    }
+    if (draw)
+    {
+        mDraw = Json::Value();
+        mDraw["call"] = callNo;
+        mDraw["frame"] = frameNo;
+        mDraw["function"] = funcName;
+        if (mPassOpen)
+        {
+            mDraw["renderpass"] = mPasses.size();
+        }
+    }
+    return draw;
+}
+
+void CounterSampler::after()
+{
+    const Json::Value span = sample();
+    if (mPassOpen)
+    {
+        accumulate(mPass["counters"], span);
+    }
+    mDraw["counters"] = span;
+    mDraws.append(mDraw);
+}
+
+void CounterSampler::endFrame()
+{
+    if (mPassOpen)
+    {
+        endPass(sample());
+    }
+}
+
+void CounterSampler::store(Json::Value& result) const
+{
+    if (mPasses.empty() && mDraws.empty())
+    {
+        return;
+    }
+    Json::Value spans;
+    if (mRenderPasses)
+    {
+        spans["renderpasses"] = mPasses;
+    }
+    if (mCalls)
+    {
+        spans["draws"] = mDraws;
+    }
+    result["counter_spans"] = spans;
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef _RETRACER_COUNTER_SAMPLER_HPP_
+#define _RETRACER_COUNTER_SAMPLER_HPP_
+
+#include "common/trace_callset.hpp"
+#include "jsoncpp/include/json/value.h"
+
+#include <memory>
+
+class Collection;
+
+namespace retracer {
+
+/// Hardware counters of render passes and of chosen draws, for -counterpasses and -countercalls,
+/// from the collectors that count since they were last read, such as perf and malicounters. A
+/// render pass is taken to be the draws between two changes of the draw framebuffer, as for
+/// -drawtime. At each boundary the GPU is finished before the counters are read, so that a
+/// pass or draw only gets what it did, which is why there are no boundaries where sampling is
+/// off. The frames still get their full counts in frame_data.
+class CounterSampler
+{
+public:
+    void setup(Collection* collectors, bool renderPasses, const std::shared_ptr<common::CallSet>& calls);
+    bool enabled() const { return mCollectors != nullptr; }
+
+    /// Before a draw or dispatch. Returns whether after() must be called once it is done.
+    bool before(unsigned callNo, unsigned frameNo, const char* funcName, unsigned framebuffer, common::CallFlags callFlags);
+    /// After a draw that before() chose to sample
+    void after();
+    /// Before the swap, which ends the render pass
+    void endFrame();
+    /// Add the results as "counter_spans" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    /// Finish the GPU and take the counts since the previous boundary
+    Json::Value sample();
+    void endPass(const Json::Value& span);
+
+    Collection* mCollectors = nullptr; ///< started, if sampling
+    bool mRenderPasses = false;
+    std::shared_ptr<common::CallSet> mCalls;
+
+    bool mPassOpen = false;
+    Json::Value mPass; ///< the open render pass
+    Json::Value mDraw; ///< the draw to take after() for
+    Json::Value mPasses = Json::arrayValue;
+    Json::Value mDraws = Json::arrayValue;
+};
+
+}
+
+#endif
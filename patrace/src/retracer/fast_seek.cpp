@@ -0,0 +1,837 @@
+#include "retracer/fast_seek.hpp"
+
+#include "common/in_file_mt.hpp"
+#include "common/os.hpp"
+#include "common/os_time.hpp"
+#include "dispatch/eglimports.hpp"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace retracer {
+
+namespace {
+
+enum CallKind : unsigned char
+{
+    OTHER,
+    MAKE_CURRENT,
+    SWAP,
+    DRAW,
+    DISPATCH,
+    CLEAR,
+    CLEAR_BUFFER,
+    BLIT,
+    BIND_FRAMEBUFFER,
+    FRAMEBUFFER_TEXTURE_2D, ///< texture is the fourth argument
+    FRAMEBUFFER_TEXTURE, ///< texture is the third argument
+    FRAMEBUFFER_RENDERBUFFER,
+    DRAW_BUFFERS,
+    INVALIDATE,
+    ACTIVE_TEXTURE,
+    BIND_TEXTURE,
+    BIND_IMAGE_TEXTURE,
+    BIND_BUFFER_INDEXED,
+    BEGIN_FEEDBACK,
+    END_FEEDBACK,
+    ENABLE,
+    DISABLE,
+    COLOR_MASK,
+    COLOR_MASK_INDEXED,
+    DEPTH_MASK,
+    STENCIL_MASK,
+    STENCIL_MASK_SEPARATE,
+    READ_FRAMEBUFFER, ///< glReadPixels and the copies into textures
+    COPY_IMAGE,
+    GENERATE_MIPMAP,
+    DELETE_FRAMEBUFFERS,
+    DELETE_TEXTURES,
+    DELETE_RENDERBUFFERS,
+};
+
+const struct { const char* name; CallKind kind; } callKinds[] = {
+    { "eglMakeCurrent", MAKE_CURRENT },
+    { "glClear", CLEAR },
+    { "glClearBufferiv", CLEAR_BUFFER },
+    { "glClearBufferuiv", CLEAR_BUFFER },
+    { "glClearBufferfv", CLEAR_BUFFER },
+    { "glClearBufferfi", CLEAR_BUFFER },
+    { "glBlitFramebuffer", BLIT },
+    { "glBindFramebuffer", BIND_FRAMEBUFFER },
+    { "glFramebufferTexture2D", FRAMEBUFFER_TEXTURE_2D },
+    { "glFramebufferTexture2DMultisampleEXT", FRAMEBUFFER_TEXTURE_2D },
+    { "glFramebufferTexture3DOES", FRAMEBUFFER_TEXTURE_2D },
+    { "glFramebufferTexture", FRAMEBUFFER_TEXTURE },
+    { "glFramebufferTextureEXT", FRAMEBUFFER_TEXTURE },
+    { "glFramebufferTextureOES", FRAMEBUFFER_TEXTURE },
+    { "glFramebufferTextureLayer", FRAMEBUFFER_TEXTURE },
+    { "glFramebufferTextureMultiviewOVR", FRAMEBUFFER_TEXTURE },
+    { "glFramebufferTextureMultisampleMultiviewOVR", FRAMEBUFFER_TEXTURE },
+    { "glFramebufferRenderbuffer", FRAMEBUFFER_RENDERBUFFER },
+    { "glDrawBuffers", DRAW_BUFFERS },
+    { "glInvalidateFramebuffer", INVALIDATE },
+    { "glDiscardFramebufferEXT", INVALIDATE },
+    { "glActiveTexture", ACTIVE_TEXTURE },
+    { "glBindTexture", BIND_TEXTURE },
+    { "glBindImageTexture", BIND_IMAGE_TEXTURE },
+    { "glBindBufferBase", BIND_BUFFER_INDEXED },
+    { "glBindBufferRange", BIND_BUFFER_INDEXED },
+    { "glBeginTransformFeedback", BEGIN_FEEDBACK },
+    { "glEndTransformFeedback", END_FEEDBACK },
+    { "glEnable", ENABLE },
+    { "glDisable", DISABLE },
+    { "glColorMask", COLOR_MASK },
+    { "glColorMaski", COLOR_MASK_INDEXED },
+    { "glColorMaskiEXT", COLOR_MASK_INDEXED },
+    { "glColorMaskiOES", COLOR_MASK_INDEXED },
+    { "glDepthMask", DEPTH_MASK },
+    { "glStencilMask", STENCIL_MASK },
+    { "glStencilMaskSeparate", STENCIL_MASK_SEPARATE },
+    { "glReadPixels", READ_FRAMEBUFFER },
+    { "glReadnPixels", READ_FRAMEBUFFER },
+    { "glReadnPixelsEXT", READ_FRAMEBUFFER },
+    { "glCopyTexImage2D", READ_FRAMEBUFFER },
+    { "glCopyTexSubImage2D", READ_FRAMEBUFFER },
+    { "glCopyTexSubImage3D", READ_FRAMEBUFFER },
+    { "glCopyImageSubData", COPY_IMAGE },
+    { "glCopyImageSubDataEXT", COPY_IMAGE },
+    { "glCopyImageSubDataOES", COPY_IMAGE },
+    { "glGenerateMipmap", GENERATE_MIPMAP },
+    { "glDeleteFramebuffers", DELETE_FRAMEBUFFERS },
+    { "glDeleteTextures", DELETE_TEXTURES },
+    { "glDeleteRenderbuffers", DELETE_RENDERBUFFERS },
+};
+
+/// What can be rendered into, by the kind in the upper half and the name in the lower
+enum TargetKind : uint64_t { TARGET_TEXTURE = 1, TARGET_RENDERBUFFER = 2, TARGET_SURFACE = 3 };
+
+inline uint64_t targetKey(TargetKind kind, unsigned name)
+{
+    return (kind << 32) | name;
+}
+
+struct Framebuffer
+{
+    std::map<GLenum, uint64_t> attachments; ///< target by attachment point
+    std::vector<GLenum> drawBuffers = { GL_COLOR_ATTACHMENT0 };
+};
+
+struct ContextState
+{
+    unsigned drawSurface = 0;
+    unsigned readSurface = 0;
+    GLuint drawFramebuffer = 0;
+    GLuint readFramebuffer = 0;
+    GLenum activeTexture = GL_TEXTURE0;
+    std::unordered_map<uint64_t, GLuint> textures; ///< by texture unit and target
+    std::unordered_map<GLuint, std::pair<GLuint, GLenum>> images; ///< texture and access by image unit
+    std::unordered_map<uint64_t, GLuint> storage; ///< shader storage and atomic counter buffers by binding
+    std::unordered_map<GLuint, Framebuffer> framebuffers;
+    bool feedback = false;
+    bool scissor = false;
+    bool colorMask = true; ///< whether all channels of all draw buffers are written
+    bool depthMask = true;
+    bool stencilMask = true;
+
+    /// Whether draws and dispatches can write to something that is not tracked
+    bool untracked() const
+    {
+        if (feedback) return true;
+        for (const auto& pair : storage)
+        {
+            if (pair.second != 0) return true;
+        }
+        return false;
+    }
+};
+
+/// Follows what is rendered into and read through the calls of a trace, see FastSeek
+class Scanner
+{
+public:
+    explicit Scanner(unsigned beginFrame) : mBeginFrame(beginFrame) {}
+
+    /// Go through one call, which is in the given frame
+    void call(CallKind kind, unsigned tid, char* src, unsigned callNo, unsigned frame);
+    /// The contents of the window surface are not kept over a swap
+    void swap(char* src);
+    /// Whether nothing rendered before the frame range could be read any more
+    bool settled() const { return std::find(mPending.begin(), mPending.end(), true) == mPending.end(); }
+    /// Find what is needed, and append the calls that only render into what is not to calls
+    void finish(std::vector<unsigned>& calls);
+
+    unsigned targets() const { return mPending.size(); }
+    unsigned needed() const { return std::count(mNeeded.begin(), mNeeded.end(), true); }
+    uint64_t candidates() const { return mOps.size(); }
+
+private:
+    unsigned target(uint64_t key);
+    /// Mark target as needed if it still has contents rendered before the frame range
+    void read(unsigned target);
+    /// A draw, dispatch, clear or blit, of which reinit lists the targets it overwrites entirely
+    void render(unsigned callNo, bool before, bool keep, const std::vector<unsigned>& writes,
+                const std::vector<unsigned>& reads, const std::vector<unsigned>& reinit);
+
+    /// Targets of the attachment points in mask of the bound draw or read framebuffer, or of the
+    /// surface for framebuffer 0
+    void attachments(ContextState& context, bool read, GLbitfield mask, std::vector<unsigned>& targets);
+    void boundTextures(ContextState& context, std::vector<unsigned>& reads, std::vector<unsigned>& writes);
+    /// Forget a deleted texture or renderbuffer, so that a new one with its name starts afresh
+    void deleted(ContextState& context, uint64_t key);
+    Framebuffer& framebuffer(ContextState& context, GLenum target);
+
+    const unsigned mBeginFrame;
+    std::unordered_map<unsigned, unsigned> mCurrentContext; ///< by thread
+    std::unordered_map<unsigned, ContextState> mContexts;
+
+    std::unordered_map<uint64_t, unsigned> mTargets; ///< index by key
+    std::vector<bool> mPending; ///< by target, has contents rendered before the frame range
+    std::vector<bool> mNeeded; ///< by target
+    std::unordered_set<uint64_t> mEdges; ///< target rendered into, in the upper half, from target read
+
+    std::map<std::vector<unsigned>, unsigned> mWriteSetIds;
+    std::vector<std::vector<unsigned>> mWriteSets;
+    std::vector<std::pair<unsigned, unsigned>> mOps; ///< call number and write set of what can be skipped
+
+    std::vector<unsigned> mWrites;
+    std::vector<unsigned> mReads;
+    std::vector<unsigned> mReinit;
+};
+
+unsigned Scanner::target(uint64_t key)
+{
+    const auto it = mTargets.find(key);
+    if (it != mTargets.end())
+    {
+        return it->second;
+    }
+    const unsigned index = mPending.size();
+    mTargets[key] = index;
+    mPending.push_back(false);
+    mNeeded.push_back(false);
+    return index;
+}
+
+void Scanner::read(unsigned target)
+{
+    if (mPending[target])
+    {
+        mNeeded[target] = true;
+    }
+}
+
+void Scanner::render(unsigned callNo, bool before, bool keep, const std::vector<unsigned>& writes,
+                     const std::vector<unsigned>& reads, const std::vector<unsigned>& reinit)
+{
+    if (!before || keep)
+    {
+        for (unsigned t : reads) read(t);
+        if (!before)
+        {
+            for (unsigned t : reinit) mPending[t] = false;
+        }
+        return;
+    }
+
+    for (unsigned t : writes)
+    {
+        for (unsigned s : reads)
+        {
+            if (s != t && mPending[s])
+            {
+                mEdges.insert(((uint64_t)t << 32) | s);
+            }
+        }
+    }
+    for (unsigned t : writes)
+    {
+        mPending[t] = true;
+    }
+    std::vector<unsigned> set(writes);
+    std::sort(set.begin(), set.end());
+    set.erase(std::unique(set.begin(), set.end()), set.end());
+    const auto it = mWriteSetIds.emplace(set, (unsigned)mWriteSets.size());
+    if (it.second)
+    {
+        mWriteSets.push_back(set);
+    }
+    mOps.emplace_back(callNo, it.first->second);
+}
+
+void Scanner::deleted(ContextState& context, uint64_t key)
+{
+    // What it was attached to or bound as goes, and nothing can read its contents any more
+    for (auto& pair : context.framebuffers)
+    {
+        std::map<GLenum, uint64_t>& attached = pair.second.attachments;
+        for (auto it = attached.begin(); it != attached.end();)
+        {
+            it = (it->second == key) ? attached.erase(it) : std::next(it);
+        }
+    }
+    if ((key >> 32) == TARGET_TEXTURE)
+    {
+        const GLuint name = key & 0xffffffff;
+        for (auto& pair : context.textures)
+        {
+            if (pair.second == name) pair.second = 0;
+        }
+        for (auto& pair : context.images)
+        {
+            if (pair.second.first == name) pair.second.first = 0;
+        }
+    }
+    const auto it = mTargets.find(key);
+    if (it != mTargets.end())
+    {
+        mPending[it->second] = false;
+    }
+}
+
+Framebuffer& Scanner::framebuffer(ContextState& context, GLenum target)
+{
+    return context.framebuffers[target == GL_READ_FRAMEBUFFER ? context.readFramebuffer : context.drawFramebuffer];
+}
+
+void Scanner::attachments(ContextState& context, bool read, GLbitfield mask, std::vector<unsigned>& targets)
+{
+    const GLuint framebuffer = read ? context.readFramebuffer : context.drawFramebuffer;
+    if (framebuffer == 0)
+    {
+        const unsigned surface = read ? context.readSurface : context.drawSurface;
+        if (surface != 0)
+        {
+            targets.push_back(target(targetKey(TARGET_SURFACE, surface)));
+        }
+        return;
+    }
+    for (const auto& pair : context.framebuffers[framebuffer].attachments)
+    {
+        const GLenum point = pair.first;
+        const bool written = (point == GL_DEPTH_ATTACHMENT) ? (mask & GL_DEPTH_BUFFER_BIT)
+                           : (point == GL_STENCIL_ATTACHMENT) ? (mask & GL_STENCIL_BUFFER_BIT)
+                           : (point == GL_DEPTH_STENCIL_ATTACHMENT) ? (mask & (GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT))
+                           : (mask & GL_COLOR_BUFFER_BIT);
+        if (written)
+        {
+            targets.push_back(target(pair.second));
+        }
+    }
+}
+
+void Scanner::boundTextures(ContextState& context, std::vector<unsigned>& reads, std::vector<unsigned>& writes)
+{
+    for (const auto& pair : context.textures)
+    {
+        if (pair.second != 0)
+        {
+            reads.push_back(target(targetKey(TARGET_TEXTURE, pair.second)));
+        }
+    }
+    for (const auto& pair : context.images)
+    {
+        if (pair.second.first == 0)
+        {
+            continue;
+        }
+        const unsigned t = target(targetKey(TARGET_TEXTURE, pair.second.first));
+        if (pair.second.second != GL_WRITE_ONLY)
+        {
+            reads.push_back(t);
+        }
+        if (pair.second.second != GL_READ_ONLY)
+        {
+            writes.push_back(t);
+        }
+    }
+}
+
+void Scanner::swap(char* src)
+{
+    int dpy, surface;
+    src = common::ReadFixed(src, dpy);
+    src = common::ReadFixed(src, surface);
+    const auto it = mTargets.find(targetKey(TARGET_SURFACE, surface));
+    if (it != mTargets.end())
+    {
+        mPending[it->second] = false;
+    }
+}
+
+void Scanner::call(CallKind kind, unsigned tid, char* src, unsigned callNo, unsigned frame)
+{
+    if (kind == MAKE_CURRENT)
+    {
+        int dpy, draw, read, ctx;
+        src = common::ReadFixed(src, dpy);
+        src = common::ReadFixed(src, draw);
+        src = common::ReadFixed(src, read);
+        src = common::ReadFixed(src, ctx);
+        mCurrentContext[tid] = ctx;
+        if (ctx != 0)
+        {
+            ContextState& context = mContexts[ctx];
+            context.drawSurface = draw;
+            context.readSurface = read;
+        }
+        return;
+    }
+    const auto current = mCurrentContext.find(tid);
+    if (current == mCurrentContext.end() || current->second == 0)
+    {
+        return;
+    }
+    ContextState& context = mContexts[current->second];
+    const bool before = frame < mBeginFrame;
+    mWrites.clear();
+    mReads.clear();
+    mReinit.clear();
+
+    switch (kind)
+    {
+    case DRAW:
+    case DISPATCH:
+        if (kind == DRAW)
+        {
+            attachments(context, false, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, mWrites);
+        }
+        boundTextures(context, mReads, mWrites);
+        render(callNo, before, context.untracked(), mWrites, mReads, mReinit);
+        break;
+    case CLEAR:
+    {
+        GLbitfield mask;
+        src = common::ReadFixed(src, mask);
+        attachments(context, false, mask, mWrites);
+        if (!context.scissor)
+        {
+            if (context.drawFramebuffer == 0)
+            {
+                const GLbitfield all = GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+                if ((mask & all) == all && context.colorMask && context.depthMask && context.stencilMask)
+                {
+                    mReinit = mWrites;
+                }
+            }
+            else
+            {
+                // A target is overwritten if every attachment point it is at is cleared entirely
+                Framebuffer& fb = context.framebuffers[context.drawFramebuffer];
+                std::map<uint64_t, bool> cleared;
+                for (const auto& pair : fb.attachments)
+                {
+                    const GLenum point = pair.first;
+                    bool all;
+                    if (point == GL_DEPTH_ATTACHMENT)
+                        all = (mask & GL_DEPTH_BUFFER_BIT) && context.depthMask;
+                    else if (point == GL_STENCIL_ATTACHMENT)
+                        all = (mask & GL_STENCIL_BUFFER_BIT) && context.stencilMask;
+                    else if (point == GL_DEPTH_STENCIL_ATTACHMENT)
+                        all = (mask & GL_DEPTH_BUFFER_BIT) && (mask & GL_STENCIL_BUFFER_BIT) && context.depthMask && context.stencilMask;
+                    else
+                        all = (mask & GL_COLOR_BUFFER_BIT) && context.colorMask
+                              && std::find(fb.drawBuffers.begin(), fb.drawBuffers.end(), point) != fb.drawBuffers.end();
+                    const auto it = cleared.emplace(pair.second, all);
+                    it.first->second = it.first->second && all;
+                }
+                for (const auto& pair : cleared)
+                {
+                    if (pair.second) mReinit.push_back(target(pair.first));
+                }
+            }
+        }
+        render(callNo, before, false, mWrites, mReads, mReinit);
+        break;
+    }
+    case CLEAR_BUFFER:
+    {
+        int buffer, drawbuffer;
+        src = common::ReadFixed(src, buffer);
+        src = common::ReadFixed(src, drawbuffer);
+        if (context.drawFramebuffer == 0)
+        {
+            attachments(context, false, GL_COLOR_BUFFER_BIT, mWrites);
+        }
+        else
+        {
+            const Framebuffer& fb = context.framebuffers[context.drawFramebuffer];
+            for (const auto& pair : fb.attachments)
+            {
+                const GLenum point = pair.first;
+                const bool depth = (point == GL_DEPTH_ATTACHMENT || point == GL_DEPTH_STENCIL_ATTACHMENT);
+                const bool stencil = (point == GL_STENCIL_ATTACHMENT || point == GL_DEPTH_STENCIL_ATTACHMENT);
+                if ((buffer == GL_COLOR && point == (GLenum)(GL_COLOR_ATTACHMENT0 + drawbuffer))
+                    || ((buffer == GL_DEPTH || buffer == GL_DEPTH_STENCIL) && depth)
+                    || ((buffer == GL_STENCIL || buffer == GL_DEPTH_STENCIL) && stencil))
+                {
+                    mWrites.push_back(target(pair.second));
+                }
+            }
+        }
+        render(callNo, before, false, mWrites, mReads, mReinit);
+        break;
+    }
+    case BLIT:
+    {
+        int coords[8];
+        GLbitfield mask;
+        for (int& c : coords) src = common::ReadFixed(src, c);
+        src = common::ReadFixed(src, mask);
+        attachments(context, false, mask, mWrites);
+        attachments(context, true, mask, mReads);
+        render(callNo, before, false, mWrites, mReads, mReinit);
+        break;
+    }
+    case READ_FRAMEBUFFER:
+        attachments(context, true, GL_COLOR_BUFFER_BIT, mReads);
+        for (unsigned t : mReads) read(t);
+        break;
+    case COPY_IMAGE:
+    {
+        unsigned name;
+        int target;
+        src = common::ReadFixed(src, name);
+        src = common::ReadFixed(src, target);
+        const auto it = mTargets.find(targetKey(target == GL_RENDERBUFFER ? TARGET_RENDERBUFFER : TARGET_TEXTURE, name));
+        if (it != mTargets.end()) read(it->second);
+        break;
+    }
+    case GENERATE_MIPMAP:
+    {
+        int target;
+        src = common::ReadFixed(src, target);
+        const auto texture = context.textures.find(((uint64_t)context.activeTexture << 32) | (unsigned)target);
+        if (texture != context.textures.end() && texture->second != 0)
+        {
+            read(this->target(targetKey(TARGET_TEXTURE, texture->second)));
+        }
+        break;
+    }
+    case BIND_FRAMEBUFFER:
+    {
+        int target;
+        unsigned name;
+        src = common::ReadFixed(src, target);
+        src = common::ReadFixed(src, name);
+        if (target != GL_READ_FRAMEBUFFER) context.drawFramebuffer = name;
+        if (target != GL_DRAW_FRAMEBUFFER) context.readFramebuffer = name;
+        break;
+    }
+    case FRAMEBUFFER_TEXTURE_2D:
+    case FRAMEBUFFER_TEXTURE:
+    case FRAMEBUFFER_RENDERBUFFER:
+    {
+        int target, attachment, textarget;
+        unsigned name;
+        src = common::ReadFixed(src, target);
+        src = common::ReadFixed(src, attachment);
+        if (kind != FRAMEBUFFER_TEXTURE)
+        {
+            src = common::ReadFixed(src, textarget);
+        }
+        src = common::ReadFixed(src, name);
+        Framebuffer& fb = framebuffer(context, target);
+        if (name == 0)
+        {
+            fb.attachments.erase(attachment);
+        }
+        else
+        {
+            fb.attachments[attachment] = targetKey(kind == FRAMEBUFFER_RENDERBUFFER ? TARGET_RENDERBUFFER : TARGET_TEXTURE, name);
+        }
+        break;
+    }
+    case DELETE_FRAMEBUFFERS:
+    case DELETE_TEXTURES:
+    case DELETE_RENDERBUFFERS:
+    {
+        int n;
+        common::Array<unsigned int> names;
+        src = common::ReadFixed(src, n);
+        src = common::Read1DArray(src, names);
+        for (unsigned i = 0; i < names.cnt; i++)
+        {
+            if (names.v[i] == 0)
+            {
+                continue;
+            }
+            if (kind == DELETE_FRAMEBUFFERS)
+            {
+                // a framebuffer made later with the same name has no attachments
+                context.framebuffers.erase(names.v[i]);
+                if (context.drawFramebuffer == names.v[i]) context.drawFramebuffer = 0;
+                if (context.readFramebuffer == names.v[i]) context.readFramebuffer = 0;
+            }
+            else
+            {
+                deleted(context, targetKey(kind == DELETE_TEXTURES ? TARGET_TEXTURE : TARGET_RENDERBUFFER, names.v[i]));
+            }
+        }
+        break;
+    }
+    case DRAW_BUFFERS:
+    {
+        int n;
+        common::Array<unsigned int> bufs;
+        src = common::ReadFixed(src, n);
+        src = common::Read1DArray(src, bufs);
+        if (context.drawFramebuffer != 0)
+        {
+            context.framebuffers[context.drawFramebuffer].drawBuffers.assign(bufs.v, bufs.v + bufs.cnt);
+        }
+        break;
+    }
+    case INVALIDATE:
+    {
+        int target, count;
+        common::Array<unsigned int> points;
+        src = common::ReadFixed(src, target);
+        src = common::ReadFixed(src, count);
+        src = common::Read1DArray(src, points);
+        const GLuint name = (target == GL_READ_FRAMEBUFFER) ? context.readFramebuffer : context.drawFramebuffer;
+        if (name == 0)
+        {
+            // only when all of the surface is
+            const auto has = [&](GLenum point) { return std::find(points.v, points.v + points.cnt, point) != points.v + points.cnt; };
+            if (has(GL_COLOR) && has(GL_DEPTH) && has(GL_STENCIL))
+            {
+                attachments(context, target == GL_READ_FRAMEBUFFER, GL_COLOR_BUFFER_BIT, mReinit);
+            }
+        }
+        else
+        {
+            std::map<uint64_t, bool> invalidated;
+            for (const auto& pair : context.framebuffers[name].attachments)
+            {
+                const bool all = std::find(points.v, points.v + points.cnt, pair.first) != points.v + points.cnt;
+                const auto it = invalidated.emplace(pair.second, all);
+                it.first->second = it.first->second && all;
+            }
+            for (const auto& pair : invalidated)
+            {
+                if (pair.second) mReinit.push_back(this->target(pair.first));
+            }
+        }
+        for (unsigned t : mReinit) mPending[t] = false;
+        break;
+    }
+    case ACTIVE_TEXTURE:
+    {
+        int unit;
+        src = common::ReadFixed(src, unit);
+        context.activeTexture = unit;
+        break;
+    }
+    case BIND_TEXTURE:
+    {
+        int target;
+        unsigned name;
+        src = common::ReadFixed(src, target);
+        src = common::ReadFixed(src, name);
+        context.textures[((uint64_t)context.activeTexture << 32) | (unsigned)target] = name;
+        break;
+    }
+    case BIND_IMAGE_TEXTURE:
+    {
+        unsigned unit, name;
+        int level, layered, layer, access;
+        src = common::ReadFixed(src, unit);
+        src = common::ReadFixed(src, name);
+        src = common::ReadFixed(src, level);
+        src = common::ReadFixed(src, layered);
+        src = common::ReadFixed(src, layer);
+        src = common::ReadFixed(src, access);
+        context.images[unit] = std::make_pair(name, (GLenum)access);
+        break;
+    }
+    case BIND_BUFFER_INDEXED:
+    {
+        int target;
+        unsigned index, buffer;
+        src = common::ReadFixed(src, target);
+        src = common::ReadFixed(src, index);
+        src = common::ReadFixed(src, buffer);
+        if (target == GL_SHADER_STORAGE_BUFFER || target == GL_ATOMIC_COUNTER_BUFFER)
+        {
+            context.storage[((uint64_t)target << 32) | index] = buffer;
+        }
+        break;
+    }
+    case BEGIN_FEEDBACK:
+    case END_FEEDBACK:
+        context.feedback = (kind == BEGIN_FEEDBACK);
+        break;
+    case ENABLE:
+    case DISABLE:
+    {
+        int cap;
+        src = common::ReadFixed(src, cap);
+        if (cap == GL_SCISSOR_TEST) context.scissor = (kind == ENABLE);
+        break;
+    }
+    case COLOR_MASK:
+    {
+        unsigned char r, g, b, a;
+        src = common::ReadFixed(src, r);
+        src = common::ReadFixed(src, g);
+        src = common::ReadFixed(src, b);
+        src = common::ReadFixed(src, a);
+        context.colorMask = r && g && b && a;
+        break;
+    }
+    case COLOR_MASK_INDEXED:
+        context.colorMask = false; // until glColorMask sets all of them again
+        break;
+    case DEPTH_MASK:
+    {
+        unsigned char flag;
+        src = common::ReadFixed(src, flag);
+        context.depthMask = flag;
+        break;
+    }
+    case STENCIL_MASK:
+    case STENCIL_MASK_SEPARATE:
+    {
+        int face = GL_FRONT_AND_BACK;
+        unsigned mask;
+        if (kind == STENCIL_MASK_SEPARATE)
+        {
+            src = common::ReadFixed(src, face);
+        }
+        src = common::ReadFixed(src, mask);
+        context.stencilMask = face == GL_FRONT_AND_BACK && (mask & 0xff) == 0xff;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void Scanner::finish(std::vector<unsigned>& calls)
+{
+    std::unordered_multimap<unsigned, unsigned> sources;
+    for (uint64_t edge : mEdges)
+    {
+        sources.emplace(edge >> 32, edge & 0xffffffff);
+    }
+    std::vector<unsigned> work;
+    for (unsigned t = 0; t < mNeeded.size(); t++)
+    {
+        if (mNeeded[t]) work.push_back(t);
+    }
+    while (!work.empty())
+    {
+        const unsigned t = work.back();
+        work.pop_back();
+        const auto range = sources.equal_range(t);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (!mNeeded[it->second])
+            {
+                mNeeded[it->second] = true;
+                work.push_back(it->second);
+            }
+        }
+    }
+
+    std::vector<bool> skippable(mWriteSets.size());
+    for (unsigned i = 0; i < mWriteSets.size(); i++)
+    {
+        skippable[i] = std::none_of(mWriteSets[i].begin(), mWriteSets[i].end(), [&](unsigned t) { return mNeeded[t]; });
+    }
+    for (const auto& op : mOps)
+    {
+        if (skippable[op.second])
+        {
+            calls.push_back(op.first);
+        }
+    }
+}
+
+} // namespace
+
+bool FastSeek::scan(const std::string& fileName, unsigned beginFrame, unsigned endFrame, int tid)
+{
+    struct stat st;
+    if (stat(fileName.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        DBG_LOG("Fast seek needs to read %s twice, which it cannot as it is not a regular file\n", fileName.c_str());
+        return false;
+    }
+    const int64_t begin = os::getTime();
+    common::InFile file;
+    if (!file.Open(fileName.c_str()))
+    {
+        return false;
+    }
+
+    std::vector<CallKind> kinds(file.getMaxSigId() + 1, OTHER);
+    for (const auto& entry : callKinds)
+    {
+        const unsigned short id = file.NameToExId(entry.name);
+        if (id != 0) kinds[id] = entry.kind;
+    }
+    for (int id = 1; id <= file.getMaxSigId(); id++)
+    {
+        const unsigned props = file.ExIdToProps(id);
+        if (props & common::CALL_PROP_SWAP) kinds[id] = SWAP;
+        else if (props & common::CALL_PROP_DRAW) kinds[id] = DRAW;
+        else if (props & common::CALL_PROP_DISPATCH) kinds[id] = DISPATCH;
+    }
+
+    Scanner scanner(beginFrame);
+    void* fptr;
+    common::BCall_vlen call;
+    char* src;
+    unsigned frame = 0;
+    for (unsigned callNo = 0; frame < endFrame && file.GetNextCall(fptr, call, src); callNo++)
+    {
+        const CallKind kind = kinds[call.funcId];
+        if (kind == SWAP)
+        {
+            scanner.swap(src);
+            if (call.tid == tid && ++frame >= beginFrame && scanner.settled())
+            {
+                break; // the rest of the frame range cannot depend on anything before it
+            }
+        }
+        else if (kind != OTHER)
+        {
+            scanner.call(kind, call.tid, src, callNo, frame);
+        }
+    }
+    file.Close();
+
+    mCalls.clear();
+    mNext = 0;
+    scanner.finish(mCalls);
+    mCandidates = scanner.candidates();
+    mTargets = scanner.targets();
+    mNeeded = scanner.needed();
+    mScanTime = (double)(os::getTime() - begin) / os::timeFrequency;
+    DBG_LOG("Fast seek: %u of %llu draws, dispatches, clears and blits before frame %u can be skipped, %u of %u render targets are needed (scanned in %.3f s)\n",
+            (unsigned)mCalls.size(), (unsigned long long)mCandidates, beginFrame, mNeeded, mTargets, mScanTime);
+    return true;
+}
+
+void FastSeek::store(Json::Value& result) const
+{
+    if (mCandidates == 0)
+    {
+        return;
+    }
+    Json::Value v;
+    v["candidates"] = (Json::Value::UInt64)mCandidates;
+    v["skippable"] = (Json::Value::UInt64)mCalls.size();
+    v["skipped"] = (Json::Value::UInt64)mSkipped;
+    v["targets"] = mTargets;
+    v["targets_needed"] = mNeeded;
+    v["scan_time"] = mScanTime;
+    result["fast_seek"] = v;
+}
+
+} // namespace retracer
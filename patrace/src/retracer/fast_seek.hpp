@@ -0,0 +1,65 @@
+#ifndef _RETRACER_FAST_SEEK_HPP_
+#define _RETRACER_FAST_SEEK_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace retracer {
+
+/// Skips GPU work before the measured frames that they do not depend on, for -fastseek, to get
+/// to the first measured frame of a long trace sooner without making a fastforward trace of it.
+/// Before replaying, the trace is scanned once up to the end of the frame range for what each
+/// draw, dispatch, clear and blit before it renders into: the attachments of the framebuffer
+/// it draws to and the images it writes. One of those is needed when its contents are read,
+/// before being cleared or invalidated in the frame range, by a texture or image bound, a blit,
+/// copy or glReadPixels of it, or by the rendering of another one that is needed. The calls
+/// that only render into ones that are not needed are then skipped. Everything else, such as
+/// uploads, state and object creation, is replayed as it is.
+///
+/// The scan is conservative where it cannot tell: draws and dispatches are kept whenever a
+/// shader storage buffer, atomic counter buffer or transform feedback is bound, since what they
+/// write there is not tracked, and so is what they read. It assumes that the contents of window
+/// surfaces are not preserved over swaps, and that all contexts share their textures.
+class FastSeek
+{
+public:
+    /// Scan fileName for the calls of the frames before beginFrame that can be skipped, counting
+    /// frames by the swaps of tid. Returns false if the trace cannot be read a second time, such
+    /// as when it is a stream.
+    bool scan(const std::string& fileName, unsigned beginFrame, unsigned endFrame, int tid);
+
+    /// Whether any calls are to be skipped
+    bool active() const { return !mCalls.empty(); }
+
+    /// Whether call number callNo can be skipped. Calls must be asked about in increasing order.
+    bool skip(unsigned callNo)
+    {
+        while (mNext < mCalls.size() && mCalls[mNext] < callNo) mNext++;
+        if (mNext < mCalls.size() && mCalls[mNext] == callNo)
+        {
+            mSkipped++;
+            return true;
+        }
+        return false;
+    }
+
+    /// Add what was scanned and skipped as "fast_seek" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    std::vector<unsigned> mCalls; ///< call numbers to skip, in increasing order
+    size_t mNext = 0;
+    uint64_t mSkipped = 0;
+    uint64_t mCandidates = 0; ///< draws, dispatches, clears and blits before the frame range
+    unsigned mTargets = 0;
+    unsigned mNeeded = 0;
+    double mScanTime = 0.0;
+};
+
+} // namespace retracer
+
+#endif
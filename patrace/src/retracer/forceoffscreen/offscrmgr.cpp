@@ -44,7 +44,7 @@ OffscreenManager::OffscreenManager(
         int onscrSampleNumX, int onscrSampleNumY,
         int colorBitsRed, int colorBitsGreen, int colorBitsBlue, int colorBitsAlpha,
         int depthBits, int stencilBits, int msaaSamples,
-        int glesVer)
+        int glesVer, int ringSize)
  : mConfig()
  , mOffscrFboW(fboWidth)
  , mOffscrFboH(fboHeight)
@@ -62,13 +62,16 @@ OffscreenManager::OffscreenManager(
  , mMosaicIdx(0)
  , mMosaicX(0)
  , mMosaicY(0)
+ , mRingSize(ringSize < 2 ? 2 : ringSize)
+ , mOffscreenIdx(0)
+ , mCurMosaic(0)
  , mOwnsGLObjects(true)
- , mStencilBuffer()
- , mOffscreenTex()
- , mDepthBuffer()
- , mOffscreenFBO()
- , mMosaicFBO(0)
- , mMosaicTex(0)
+ , mStencilBuffer(mRingSize, 0)
+ , mOffscreenTex(mRingSize, 0)
+ , mDepthBuffer(mRingSize, 0)
+ , mOffscreenFBO(mRingSize, 0)
+ , mMosaicFBO(mRingSize > 2 ? 2 : 1, 0)
+ , mMosaicTex(mMosaicFBO.size(), 0)
  , mOnscrSampleW(onscrSampleW)
  , mOnscrSampleH(onscrSampleH)
  , mOnscrSampleNumX(onscrSampleNumX)
@@ -87,13 +90,6 @@ OffscreenManager::OffscreenManager(
     mConfig.offscreen_depth_size = depthBits;
     mConfig.offscreen_stencil_size = stencilBits;
 
-    mOffscreenTex[0] = 0;
-    mOffscreenTex[1] = 0;
-    mDepthBuffer[0] = 0;
-    mDepthBuffer[1] = 0;
-    mOffscreenFBO[0] = 0;
-    mOffscreenFBO[1] = 0;
-
     last_non_zero_draw = 0;
     last_non_zero_ctx = 0;
     last_tid = -1;
@@ -239,11 +235,11 @@ void OffscreenManager::Init()
         mRenderbufferStorage_depth_format = GL_DEPTH24_STENCIL8_OES;
     }
 
-    DBG_LOG("Offscreen FBO using %d%d%d%d color, %d depth, %d stencil, %d msaaSamples .\n",
+    DBG_LOG("Offscreen FBO using %d%d%d%d color, %d depth, %d stencil, %d msaaSamples, ring of %d FBOs and %d mosaics.\n",
             mConfig.offscreen_red_size, mConfig.offscreen_green_size,
             mConfig.offscreen_blue_size, mConfig.offscreen_alpha_size,
             mConfig.offscreen_depth_size, mConfig.offscreen_stencil_size,
-            mMsaaSamples);
+            mMsaaSamples, mRingSize, (int)mMosaicFBO.size());
 
     CreateFBOs();
 }
@@ -255,17 +251,15 @@ OffscreenManager::~OffscreenManager()
 
 bool OffscreenManager::BindOffscreenFBO(GLenum target)
 {
-    //DBG_LOG("BindOffscreenFBO %d", (mMosaicIdx%2)==0 ? mOffscreenFBO[0] : mOffscreenFBO[1]);
-    glBindFramebuffer12(target,
-        (mMosaicIdx%2)==0 ? mOffscreenFBO[0] : mOffscreenFBO[1]);
+    //DBG_LOG("BindOffscreenFBO %d", mOffscreenFBO[mOffscreenIdx]);
+    glBindFramebuffer12(target, mOffscreenFBO[mOffscreenIdx]);
     return true;
 }
 
 bool OffscreenManager::BindOffscreenReadFBO()
 {
-    //DBG_LOG("BindOffscreenReadFBO %d", (mMosaicIdx%2)==0 ? mOffscreenFBO[0] : mOffscreenFBO[1]);
-    glBindFramebuffer12(GL_READ_FRAMEBUFFER,
-        (mMosaicIdx%2)==0 ? mOffscreenFBO[0] : mOffscreenFBO[1]);
+    //DBG_LOG("BindOffscreenReadFBO %d", mOffscreenFBO[mOffscreenIdx]);
+    glBindFramebuffer12(GL_READ_FRAMEBUFFER, mOffscreenFBO[mOffscreenIdx]);
     return true;
 }
 
@@ -308,7 +302,7 @@ void OffscreenManager::OffscreenToMosaic()
     GLboolean oCullFace = _glIsEnabled(GL_CULL_FACE);
 
     // 2. Draw a texture into the fbo
-    glBindFramebuffer12(GL_FRAMEBUFFER, mMosaicFBO);
+    glBindFramebuffer12(GL_FRAMEBUFFER, mMosaicFBO[mCurMosaic]);
 
     int x = mMosaicIdx % mOnscrSampleNumX;
     int y = mMosaicIdx / mOnscrSampleNumX;
@@ -325,8 +319,7 @@ void OffscreenManager::OffscreenToMosaic()
 
     _glViewport(x * mOnscrSampleW, y * mOnscrSampleH, mOnscrSampleW, mOnscrSampleH);
 
-    int texId = (mMosaicIdx%2)==0 ? mOffscreenTex[0] : mOffscreenTex[1];
-    mQuad.DrawTex(texId);
+    mQuad.DrawTex(mOffscreenTex[mOffscreenIdx]);
 
 #ifdef _DEBUG_EGLRETRACE_
     if (no < 10)
@@ -347,6 +340,10 @@ void OffscreenManager::OffscreenToMosaic()
 
     ++mMosaicIdx;
     mMosaicIdx %= mOnscrSampleC;
+    // Counted apart from the tiles, so that a mosaic of one tile, or of an odd number of them,
+    // does not render two frames in a row into the same target
+    ++mOffscreenIdx;
+    mOffscreenIdx %= mRingSize;
 }
 
 bool OffscreenManager::MosaicToScreenIfNeeded(bool forceFlush)
@@ -376,7 +373,13 @@ bool OffscreenManager::MosaicToScreenIfNeeded(bool forceFlush)
 
     _glViewport(mMosaicX, mMosaicY, mOnscrMosaicWidth, mOnscrMosaicHeight);
     _glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    mQuad.DrawTex(mMosaicTex);
+    mQuad.DrawTex(mMosaicTex[mCurMosaic]);
+    if (mMosaicIdx == 0)
+    {
+        // full, so the next tiles go into the other mosaic while this one is on its way to the screen
+        ++mCurMosaic;
+        mCurMosaic %= mMosaicFBO.size();
+    }
 
     // 3. Restore the original render state
     _glViewport(oVp[0], oVp[1], oVp[2], oVp[3]);
@@ -395,35 +398,38 @@ void OffscreenManager::CreateFBOs()
     mOwnsGLObjects = true;
 
     // 1. offscreen texture/depth/framebuffer
-    glGenFramebuffers12(2, mOffscreenFBO);
-    _glGenTextures(2, mOffscreenTex);
+    glGenFramebuffers12(mRingSize, mOffscreenFBO.data());
+    _glGenTextures(mRingSize, mOffscreenTex.data());
     if (mDepth)
     {
-        glGenRenderbuffers12(2, mDepthBuffer);
+        glGenRenderbuffers12(mRingSize, mDepthBuffer.data());
     }
     if (mStencil && !mDepthStencil)
     {
-        glGenRenderbuffers12(2, mStencilBuffer);
+        glGenRenderbuffers12(mRingSize, mStencilBuffer.data());
     }
 
     framebufferTexture(mOffscrFboW, mOffscrFboH);
 
     // 2. mosaic texture/framebuffer
-    glGenFramebuffers12(1, &mMosaicFBO);
-    _glGenTextures(1, &mMosaicTex);
-    glBindFramebuffer12(GL_FRAMEBUFFER, mMosaicFBO);
-    _glBindTexture(GL_TEXTURE_2D, mMosaicTex);
-    _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    _glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, mOnscrMosaicWidth, mOnscrMosaicHeight, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, NULL);
-    glFramebufferTexture2D12(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mMosaicTex, 0);
-    int status = glCheckFramebufferStatus12(GL_FRAMEBUFFER);
-    if (status != GL_FRAMEBUFFER_COMPLETE)
+    glGenFramebuffers12(mMosaicFBO.size(), mMosaicFBO.data());
+    _glGenTextures(mMosaicTex.size(), mMosaicTex.data());
+    for (size_t i = 0; i < mMosaicFBO.size(); ++i)
     {
-        gRetracer.reportAndAbort("OnScrMosaic Framebuffer incomplete: FBO%d, %d x %d, color_mode=%x, depth_mode=%d, status=%04X\n",
-                                 mMosaicFBO, mOnscrMosaicWidth, mOnscrMosaicHeight, GL_UNSIGNED_SHORT_5_6_5, 0, status);
+        glBindFramebuffer12(GL_FRAMEBUFFER, mMosaicFBO[i]);
+        _glBindTexture(GL_TEXTURE_2D, mMosaicTex[i]);
+        _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        _glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, mOnscrMosaicWidth, mOnscrMosaicHeight, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, NULL);
+        glFramebufferTexture2D12(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mMosaicTex[i], 0);
+        int status = glCheckFramebufferStatus12(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            gRetracer.reportAndAbort("OnScrMosaic Framebuffer incomplete: FBO%d, %d x %d, color_mode=%x, depth_mode=%d, status=%04X\n",
+                                     mMosaicFBO[i], mOnscrMosaicWidth, mOnscrMosaicHeight, GL_UNSIGNED_SHORT_5_6_5, 0, status);
+        }
     }
     glBindFramebuffer12(GL_FRAMEBUFFER, ON_SCREEN_FBO);
 }
@@ -445,7 +451,7 @@ void OffscreenManager::framebufferTexture(int w, int h)
     _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFboId);
 
     // framebufferTexture
-    for (int i = 0; i < 2; ++i)
+    for (int i = 0; i < mRingSize; ++i)
     {
         glBindFramebuffer12(GL_FRAMEBUFFER, mOffscreenFBO[i]);
 
@@ -512,15 +518,15 @@ void OffscreenManager::DeleteFBOs()
 {
     if (mOwnsGLObjects)
     {
-        glDeleteFramebuffers12(2, mOffscreenFBO);
-        _glDeleteTextures(2, mOffscreenTex);
+        glDeleteFramebuffers12(mRingSize, mOffscreenFBO.data());
+        _glDeleteTextures(mRingSize, mOffscreenTex.data());
         if (mDepth)
-            glDeleteRenderbuffers12(2, mDepthBuffer);
+            glDeleteRenderbuffers12(mRingSize, mDepthBuffer.data());
         if (mStencil && !mDepthStencil)
-            glDeleteRenderbuffers12(2, mStencilBuffer);
+            glDeleteRenderbuffers12(mRingSize, mStencilBuffer.data());
 
-        glDeleteFramebuffers12(1, &mMosaicFBO);
-        _glDeleteTextures(1, &mMosaicTex);
+        glDeleteFramebuffers12(mMosaicFBO.size(), mMosaicFBO.data());
+        _glDeleteTextures(mMosaicTex.size(), mMosaicTex.data());
     }
 }
 
@@ -3,6 +3,8 @@
 
 #include "quad.h"
 
+#include <vector>
+
 typedef int             GLint;
 typedef unsigned int    GLuint;
 typedef int             GLsizei;
@@ -29,12 +31,14 @@ public:
             int onscrSampleNumX, int onscrSampleNumY,
             int colorBitsRed, int colorBitsGreen, int colorBitsBlue, int colorBitsAlpha,
             int depthBits, int stencilBits, int msaaSamples,
-            int glesVer);
+            int glesVer, int ringSize = 2);
     ~OffscreenManager();
 
     void Init();
     bool BindOffscreenFBO(GLenum target);
     bool BindOffscreenReadFBO();
+    /// The framebuffer BindOffscreenFBO() binds
+    GLuint OffscreenFBO() const { return mOffscreenFBO[mOffscreenIdx]; }
     void OffscreenToMosaic();
     bool MosaicToScreenIfNeeded(bool forceFlush = false);
     void ReleaseOwnershipOfGLObjects();
@@ -77,13 +81,19 @@ private:
     int             mMosaicX;
     int             mMosaicY;
 
+    // Frames are rendered into a ring of offscreen targets, so that a frame does not have to
+    // wait for the previous one to be drawn into the mosaic. With more than two targets there
+    // are two mosaics as well, one filling up while the other is drawn to the screen.
+    int          mRingSize;
+    int          mOffscreenIdx;
+    int          mCurMosaic;
     bool         mOwnsGLObjects;
-    unsigned int mStencilBuffer[2];
-    unsigned int mOffscreenTex[2];
-    unsigned int mDepthBuffer[2];
-    unsigned int mOffscreenFBO[2];
-    unsigned int mMosaicFBO;
-    unsigned int mMosaicTex;
+    std::vector<unsigned int> mStencilBuffer;
+    std::vector<unsigned int> mOffscreenTex;
+    std::vector<unsigned int> mDepthBuffer;
+    std::vector<unsigned int> mOffscreenFBO;
+    std::vector<unsigned int> mMosaicFBO;
+    std::vector<unsigned int> mMosaicTex;
     unsigned int mOnscrSampleW;
     unsigned int mOnscrSampleH;
     unsigned int mOnscrSampleNumX;
@@ -0,0 +1,102 @@
+#include "retracer/frame_limiter.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "retracer/retracer.hpp"
+
+#include "common/os.hpp"
+#include "common/os_time.hpp"
+
+#include <algorithm>
+
+namespace retracer {
+
+void FrameLimiter::complete(const Frame& frame, int64_t now, int64_t waited)
+{
+    _glDeleteSync(frame.fence);
+    if (frame.measured)
+    {
+        mGpuLatency.push_back(now - frame.submitted);
+        mCpuWait.push_back(waited);
+        mWaits += (waited > 0);
+    }
+}
+
+void FrameLimiter::swapped(bool measured)
+{
+    if (!mChecked)
+    {
+        mChecked = true;
+        mSupported = (gRetracer.mOptions.mApiVersion >= PROFILE_ES3); // for fence sync objects
+        if (!mSupported)
+        {
+            DBG_LOG("Frames in flight are only limited in GLES3 contexts\n");
+        }
+    }
+    if (!mSupported)
+    {
+        return;
+    }
+    Frame frame = { _glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), os::getTime(), measured };
+    mPending.push_back(frame);
+
+    // Collect the frames that are done without waiting, then wait for the ones over the limit
+    while (!mPending.empty())
+    {
+        const bool over = (mPending.size() > mLimit);
+        const int64_t begin = os::getTime();
+        GLenum result = _glClientWaitSync(mPending.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (result == GL_TIMEOUT_EXPIRED && !over)
+        {
+            break;
+        }
+        while (result == GL_TIMEOUT_EXPIRED)
+        {
+            result = _glClientWaitSync(mPending.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100 * 1000 * 1000);
+        }
+        const int64_t now = os::getTime();
+        complete(mPending.front(), now, result == GL_CONDITION_SATISFIED ? now - begin : 0);
+        mPending.pop_front();
+    }
+}
+
+void FrameLimiter::flush()
+{
+    for (const Frame& frame : mPending)
+    {
+        _glDeleteSync(frame.fence); // not measured, as the context may not have its work done for a while
+    }
+    mPending.clear();
+    mChecked = false;
+}
+
+static Json::Value latencyStats(std::vector<int64_t> ticks)
+{
+    Json::Value v;
+    std::sort(ticks.begin(), ticks.end());
+    int64_t total = 0;
+    for (const int64_t t : ticks) total += t;
+    const double f = os::timeFrequency;
+    v["mean"] = total / f / ticks.size();
+    v["median"] = ticks[ticks.size() / 2] / f;
+    v["p99"] = ticks[std::min(ticks.size() - 1, ticks.size() * 99 / 100)] / f;
+    v["max"] = ticks.back() / f;
+    return v;
+}
+
+void FrameLimiter::store(Json::Value& result) const
+{
+    if (mGpuLatency.empty())
+    {
+        return;
+    }
+    Json::Value v;
+    v["limit"] = mLimit;
+    v["frames"] = (unsigned)mGpuLatency.size();
+    v["waits"] = mWaits;
+    v["gpu_latency"] = latencyStats(mGpuLatency);
+    v["cpu_wait"] = latencyStats(mCpuWait);
+    result["frames_in_flight"] = v;
+}
+
+}
@@ -0,0 +1,61 @@
+#ifndef _RETRACER_FRAME_LIMITER_HPP_
+#define _RETRACER_FRAME_LIMITER_HPP_
+
+#include "dispatch/eglimports.hpp"
+#include "jsoncpp/include/json/value.h"
+
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+namespace retracer {
+
+/// Keeps at most N frames in flight for -framesinflight, with a fence after each swap of the
+/// retraced thread, waiting for the fence N frames back before the next frame starts. Unlike
+/// -finishbeforeswap, the CPU can run ahead of the GPU by N frames, but the driver cannot queue
+/// up more than that, which would otherwise make frame times depend on how deep its queue is.
+///
+/// For each frame, how long it took the GPU to complete the frame after it was submitted, and
+/// how long the CPU was held back waiting for it, are kept. The completion time of a fence that
+/// had already signalled when it was checked is when it was checked, so short GPU latencies
+/// are rounded up to the next swap.
+///
+/// Fences are not shared between contexts that are not in the same share group, so flush()
+/// must be called before the current context changes.
+class FrameLimiter
+{
+public:
+    /// Frames in flight, where zero turns the limiter off
+    void setLimit(unsigned frames) { mLimit = frames; }
+    bool enabled() const { return mLimit > 0; }
+
+    /// Right after a swap, with measured set if the frame is in the measured range
+    void swapped(bool measured);
+    /// Forget the pending fences, while their context is still current
+    void flush();
+
+    /// Add the latencies as "frames_in_flight" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    struct Frame
+    {
+        GLsync fence;
+        int64_t submitted; ///< os::getTime() just after the swap
+        bool measured;
+    };
+
+    void complete(const Frame& frame, int64_t now, int64_t waited);
+
+    unsigned mLimit = 0;
+    bool mSupported = false;
+    bool mChecked = false;
+    std::deque<Frame> mPending;
+    std::vector<int64_t> mGpuLatency; ///< from swap to fence signalled, per measured frame
+    std::vector<int64_t> mCpuWait; ///< time the CPU waited for the frame, per measured frame
+    unsigned mWaits = 0; ///< measured frames the CPU had to wait for
+};
+
+}
+
+#endif
@@ -0,0 +1,108 @@
+#include "retracer/frame_pacer.hpp"
+
+#include "common/os.hpp"
+#include "common/os_time.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace retracer {
+
+void FramePacer::setFps(int fps)
+{
+    mIntervals.clear();
+    mInterval = os::timeFrequency / fps;
+    mEnabled = true;
+    DBG_LOG("Pacing frames to %d fps\n", fps);
+}
+
+bool FramePacer::setIntervals(const Json::Value& intervals)
+{
+    mIntervals.clear();
+    mIntervals.reserve(intervals.size());
+    int64_t sum = 0;
+    unsigned count = 0;
+    for (const Json::Value& v : intervals)
+    {
+        const int64_t us = v.asInt64();
+        mIntervals.push_back(us * os::timeFrequency / 1000000);
+        sum += mIntervals.back();
+        count += (us > 0);
+    }
+    if (count == 0)
+    {
+        DBG_LOG("Trace has no recorded frame intervals, not pacing\n");
+        return false;
+    }
+    mInterval = sum / count; // frames past the recorded ones keep the average rate
+    mEnabled = true;
+    DBG_LOG("Pacing frames to the %u frame intervals recorded in the trace, %.2f fps on average\n", count, (double)os::timeFrequency / mInterval);
+    return true;
+}
+
+void FramePacer::wait(unsigned frameNo)
+{
+    const int64_t interval = (frameNo < mIntervals.size() && mIntervals[frameNo] > 0) ? mIntervals[frameNo] : mInterval;
+    int64_t now = os::getTime();
+    if (mTarget == 0)
+    {
+        mTarget = now; // first frame, nothing to pace from yet
+        return;
+    }
+    mTarget += interval;
+    mFrames++;
+    if (now >= mTarget)
+    {
+        mMissed++;
+        mTarget = now;
+        return;
+    }
+    const int64_t spin = SPIN_US * os::timeFrequency / 1000000;
+    if (mTarget - now > spin)
+    {
+        const int64_t ticks = mTarget - spin - now;
+        std::this_thread::sleep_for(std::chrono::microseconds(ticks * 1000000 / os::timeFrequency));
+    }
+    while (os::getTime() < mTarget) {}
+}
+
+void FramePacer::presented()
+{
+    if (mFrames > mLatency.size())
+    {
+        mLatency.push_back(os::getTime() - mTarget);
+    }
+    else if (mFrames == 0 && mTarget)
+    {
+        mTarget = os::getTime(); // pace the second frame from when the first was presented
+    }
+}
+
+void FramePacer::store(Json::Value& result) const
+{
+    if (!mEnabled)
+    {
+        return;
+    }
+    Json::Value v;
+    v["frames"] = mFrames;
+    v["missed"] = mMissed;
+    v["recorded_intervals"] = !mIntervals.empty();
+    v["target_interval"] = (double)mInterval / os::timeFrequency; // the average one for recorded intervals
+    if (!mLatency.empty())
+    {
+        std::vector<int64_t> sorted(mLatency);
+        std::sort(sorted.begin(), sorted.end());
+        int64_t sum = 0;
+        for (const int64_t t : sorted) sum += t;
+        const double tick = 1.0 / os::timeFrequency;
+        v["latency_mean"] = sum * tick / sorted.size();
+        v["latency_p50"] = sorted[sorted.size() / 2] * tick;
+        v["latency_p99"] = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)] * tick;
+        v["latency_max"] = sorted.back() * tick;
+    }
+    result["pacing"] = v;
+}
+
+}
@@ -0,0 +1,48 @@
+#ifndef _RETRACER_FRAME_PACER_HPP_
+#define _RETRACER_FRAME_PACER_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace retracer {
+
+/// Holds back each eglSwapBuffers of the retraced thread for -pace, so that frames are presented
+/// at a fixed rate or at the intervals the tracer recorded, instead of as fast as possible. It
+/// sleeps until shortly before the target time and spins for the rest. A frame that is already
+/// late does not wait, and the frames after it are paced from when it was presented, rather
+/// than rushed to catch up.
+class FramePacer
+{
+public:
+    /// How long before the target time sleeping turns into spinning, in microseconds
+    static const int SPIN_US = 1000;
+
+    /// Pace every frame to the given rate
+    void setFps(int fps);
+    /// Pace each frame to the interval recorded for it in the trace header, in microseconds
+    bool setIntervals(const Json::Value& intervals);
+    bool enabled() const { return mEnabled; }
+
+    /// Wait until the given frame is due, just before it is swapped
+    void wait(unsigned frameNo);
+    /// The frame has been swapped
+    void presented();
+
+    /// Add how close frames came to their target times as "pacing" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    bool mEnabled = false;
+    std::vector<int64_t> mIntervals; ///< per frame, in os::getTime() ticks, zero where not recorded
+    int64_t mInterval = 0; ///< for frames without a recorded interval
+    int64_t mTarget = 0; ///< when the current frame is due
+    unsigned mFrames = 0;
+    unsigned mMissed = 0; ///< frames that were already late before waiting
+    std::vector<int64_t> mLatency; ///< from target time to end of swap for each paced frame
+};
+
+}
+
+#endif
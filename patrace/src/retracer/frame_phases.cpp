@@ -0,0 +1,50 @@
+#include "retracer/frame_phases.hpp"
+
+#include "common/os_time.hpp"
+
+namespace retracer {
+
+// Indexed by Phase; RETRACE_CALLS keeps the name "retrace" in the results
+static const char* phaseNames[FramePhases::PHASE_COUNT] = { "decode", "retrace", "driver", "swap", "instrumentation", "handoff" };
+
+void FramePhases::addOsTime(Phase phase, int64_t osTicks)
+{
+    if (!mEnabled || osTicks <= 0) return;
+    const uint64_t t = (uint64_t)(osTicks * (CallStats::ticksPerSecond() / os::timeFrequency));
+    mCurrent[phase] += t;
+    mNested += t;
+}
+
+void FramePhases::frame(unsigned frameNo, bool measured)
+{
+    if (!mEnabled) return;
+    if (measured)
+    {
+        const double secondsPerTick = 1.0 / CallStats::ticksPerSecond();
+        mFrames.push_back(frameNo);
+        for (int p = 0; p < PHASE_COUNT; p++)
+        {
+            mColumns[p].push_back(mCurrent[p] * secondsPerTick);
+        }
+    }
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        mCurrent[p] = 0;
+    }
+}
+
+void FramePhases::store(Json::Value& result, common::JsonColumns& columns) const
+{
+    if (!mEnabled || mFrames.empty())
+    {
+        return;
+    }
+    result["frame_phases"] = Json::objectValue;
+    columns.add("frame_phases", "frame", mFrames);
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        columns.add("frame_phases", phaseNames[p], mColumns[p]);
+    }
+}
+
+}
@@ -0,0 +1,80 @@
+#ifndef _RETRACER_FRAME_PHASES_HPP_
+#define _RETRACER_FRAME_PHASES_HPP_
+
+#include "retracer/call_stats.hpp"
+#include "common/json_stream.hpp"
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace retracer {
+
+/// Splits the time of each measured frame into phases for -perframe, to tell whether a slow frame
+/// is spent in the retracer, the driver or the GPU:
+///   decode - fetching and decoding calls from the trace, or waiting for the decoder thread
+///   retrace - the retrace functions themselves, without the time of anything below
+///   driver - inside the GL calls of the generated retrace functions
+///   swap - the swap calls, mostly waiting for the frame to be presented
+///   instrumentation - snapshots and collectors
+///   handoff - waking up the next thread in -multithread mode
+/// Time is taken with the CallStats counter. Phases can nest: the time of a phase is taken out of
+/// the phase it happens inside of, so that the phases of a frame add up to at most its frame time.
+/// Replay threads take turns, so no locking is needed.
+class FramePhases
+{
+public:
+    enum Phase { DECODE, RETRACE_CALLS, DRIVER, SWAP, INSTRUMENTATION, HANDOFF, PHASE_COUNT };
+
+    void setEnabled(bool enabled) { mEnabled = enabled; }
+    bool enabled() const { return mEnabled; }
+
+    /// Counter to pass to end(), or zero if not enabled
+    inline uint64_t begin() const
+    {
+        return mEnabled ? CallStats::ticks() : 0;
+    }
+
+    /// The phase started at begin is done
+    inline void end(Phase phase, uint64_t begin)
+    {
+        if (begin == 0) return;
+        const uint64_t t = CallStats::ticks() - begin;
+        mCurrent[phase] += t;
+        mNested += t;
+    }
+
+    /// Everything timed so far, to pass to endOuter() for a phase that other phases nest in
+    inline uint64_t nested() const { return mNested; }
+
+    /// The phase started at begin is done, less what other phases took within it since nested was read
+    inline void endOuter(Phase phase, uint64_t begin, uint64_t nested)
+    {
+        if (begin == 0) return;
+        const uint64_t t = CallStats::ticks() - begin;
+        const uint64_t inner = mNested - nested;
+        mCurrent[phase] += t > inner ? t - inner : 0;
+        mNested += t > inner ? t - inner : 0;
+    }
+
+    /// Add time measured in os::getTime() ticks elsewhere
+    void addOsTime(Phase phase, int64_t osTicks);
+
+    /// Close the current frame, keeping it if it is in the measured range and dropping it if not
+    void frame(unsigned frameNo, bool measured);
+
+    /// Add the phases as "frame_phases" to the result JSON, one array per phase in seconds, written
+    /// from the columns kept here as the result is
+    void store(Json::Value& result, common::JsonColumns& columns) const;
+
+private:
+    bool mEnabled = false;
+    uint64_t mCurrent[PHASE_COUNT] = {};
+    uint64_t mNested = 0;
+    std::vector<unsigned> mFrames;
+    std::vector<float> mColumns[PHASE_COUNT];
+};
+
+}
+
+#endif
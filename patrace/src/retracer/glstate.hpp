@@ -9,12 +9,23 @@
 namespace image {
     class Image;
 }
+namespace common {
+    class TaskGroup;
+}
 struct Texture;
 
 namespace glstate {
 
 image::Image* getDrawBufferImage(int attachment=0, int _width=0, int _height=0, GLenum format=GL_RGBA, GLenum type=GL_UNSIGNED_BYTE, int bytes_per_pixel=4, int channel = 4);
-std::vector<std::string> dumpTexture(Texture& tex, unsigned int callNo, GLfloat* vertices, int face=-1, GLuint* cm_indices=0); // face=-1 if not cube map
+// Like getDrawBufferImage(), but only starts reading into pbo, and the returned image gets its pixels
+// from there once the read is done. Returns NULL if the attachment cannot be read like this.
+image::Image* readDrawBufferAsync(int attachment, GLuint pbo);
+// Size of the given color attachment of the draw framebuffer, and whether it holds 8 bit RGB or RGBA
+// that getDrawBufferImage() reads as such, with 3 or 4 channels.
+bool getColorAttachmentSize(int attachment, int& width, int& height, int& channels);
+// face=-1 if not cube map. The images are encoded and written on encoders if given, which must be
+// waited for before the files are used, or else before this returns.
+std::vector<std::string> dumpTexture(Texture& tex, unsigned int callNo, GLfloat* vertices, int face=-1, GLuint* cm_indices=0, common::TaskGroup* encoders=0);
 GLint getMaxColorAttachments();
 GLint getMaxDrawBuffers();
 GLint getColorAttachment(GLint drawBuffer);
@@ -36,6 +36,7 @@
 #include "retracer/retracer.hpp"
 
 #include "common/image.hpp"
+#include "common/thread_pool.hpp"
 #include "helper/shaderutility.hpp"
 #include "helper/depth_dumper.hpp"
 
@@ -47,29 +48,20 @@ static std::string cube_faces[6] = { "up", "down", "right", "left", "forward", "
 
 GLint getMaxColorAttachments()
 {
-    GLint maxAttachments = 1;
-    const Context *context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
-    if(context && context->_profile >= PROFILE_ES3)
-        _glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &maxAttachments);
-    return maxAttachments;
+    Context *context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    return context ? context->_shadow.maxColorAttachments() : 1;
 }
 
 GLint getMaxDrawBuffers()
 {
-    GLint maxDrawBuffers = 1;
-    const Context *context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
-    if(context && context->_profile >= PROFILE_ES3)
-        _glGetIntegerv(GL_MAX_DRAW_BUFFERS, &maxDrawBuffers);
-    return maxDrawBuffers;
+    Context *context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    return context ? context->_shadow.maxDrawBuffers() : 1;
 }
 
 GLint getColorAttachment(GLint drawBuffer)
 {
-    GLint attachment = GL_COLOR_ATTACHMENT0;
-    const Context *context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
-    if(context && context->_profile >= PROFILE_ES3)
-        _glGetIntegerv(GL_DRAW_BUFFER0+drawBuffer, &attachment);
-    return attachment;
+    Context *context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    return context ? context->_shadow.drawBuffer(drawBuffer) : GL_COLOR_ATTACHMENT0;
 }
 
 GLint getDepthAttachment()
@@ -133,7 +125,10 @@ void getDepth(int width, int height, GLvoid *pixels, DepthDumper &depthDumper, G
     _glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
                        GL_DEPTH_BUFFER_BIT, GL_NEAREST);
 
-    depthDumper.get_depth_texture_image(tex, width, height, pixels, internalFormat, DepthDumper::Tex2D, 0);
+    if (!depthDumper.read_depth_texture_image(tex, width, height, pixels, internalFormat, DepthDumper::Tex2D, 0))
+    {
+        depthDumper.get_depth_texture_image(tex, width, height, pixels, internalFormat, DepthDumper::Tex2D, 0);
+    }
 
     // recover state machine
     _glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_read_fbo);
@@ -431,7 +426,132 @@ image::Image* getDrawBufferImage(int attachment, int _width, int _height, GLenum
     return image;
 }
 
-std::vector<std::string> dumpTexture(Texture& texture, unsigned int callNo, GLfloat* vertices, int face, GLuint* cm_indices)
+image::Image* readDrawBufferAsync(int attachment, GLuint pbo)
+{
+    const Context* context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    if (!context || context->_profile < PROFILE_ES3)
+    {
+        return NULL;
+    }
+    GLint draw_framebuffer = 0;
+    _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+
+    int width = 0;
+    int height = 0;
+    GLenum format = GL_RGBA;
+    GLenum type = GL_UNSIGNED_BYTE;
+    int bytes_per_pixel = 4;
+    int channel = 4;
+    GLint internalFormat;
+    getDimensions(draw_framebuffer, attachment, width, height, format, type, bytes_per_pixel, channel, internalFormat);
+    if (isDepth) // needs getDepth()
+    {
+        isDepth = false;
+        return NULL;
+    }
+
+    int width_multiplier = bytes_per_pixel / channel;
+    image::Image *image = new image::Image(width * width_multiplier, height, channel, true);
+
+    while (glGetError() != GL_NO_ERROR) {}
+
+    GLint oldReadBuffer;
+    _glGetIntegerv(GL_READ_BUFFER, &oldReadBuffer);
+    if (draw_framebuffer != 0)
+    {
+        _glReadBuffer(attachment);
+    }
+    GLint oldPackBuffer = 0;
+    _glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &oldPackBuffer);
+    _glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    GLint pboSize = 0;
+    _glGetBufferParameteriv(GL_PIXEL_PACK_BUFFER, GL_BUFFER_SIZE, &pboSize);
+    if ((unsigned)pboSize < image->size())
+    {
+        _glBufferData(GL_PIXEL_PACK_BUFFER, image->size(), NULL, GL_STREAM_READ);
+    }
+
+    int oldAlignment = 4;
+    _glGetIntegerv(GL_PACK_ALIGNMENT, &oldAlignment);
+    _glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    _glReadPixels(0, 0, width, height, format, type, 0);
+    _glPixelStorei(GL_PACK_ALIGNMENT, oldAlignment);
+
+    _glBindBuffer(GL_PIXEL_PACK_BUFFER, oldPackBuffer);
+    _glReadBuffer(oldReadBuffer);
+
+    GLenum error = _glGetError();
+    if (error != GL_NO_ERROR) {
+        do {
+            DBG_LOG("warning: 0x%x while reading snapshot into buffer\n", error);
+            error = _glGetError();
+        } while(error != GL_NO_ERROR);
+        delete image;
+        return NULL;
+    }
+
+    return image;
+}
+
+bool getColorAttachmentSize(int attachment, int& width, int& height, int& channels)
+{
+    GLint draw_framebuffer = 0;
+    _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+
+    GLenum format = GL_RGBA;
+    GLenum type = GL_UNSIGNED_BYTE;
+    int bytes_per_pixel = 4;
+    GLint internalFormat = 0;
+    width = height = 0;
+    channels = 4;
+    getDimensions(draw_framebuffer, attachment, width, height, format, type, bytes_per_pixel, channels, internalFormat);
+    if (isDepth)
+    {
+        isDepth = false;
+        return false;
+    }
+    if (draw_framebuffer != 0)
+    {
+        GLint encoding = GL_LINEAR;
+        _glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING, &encoding);
+        if (encoding == GL_SRGB) // would be linearized when copied
+        {
+            return false;
+        }
+    }
+    return type == GL_UNSIGNED_BYTE && (format == GL_RGBA || format == GL_RGB) && width > 0 && height > 0;
+}
+
+// Write image as raw pixel data or PNG, on encoders if given, and delete it
+static void writeImage(image::Image* image, const std::string& fileName, bool raw, common::TaskGroup* encoders)
+{
+    if (!image)
+    {
+        return;
+    }
+    auto write = [=]
+    {
+        if (raw)
+        {
+            image->writePixelData(fileName.c_str());
+        }
+        else
+        {
+            image->writePNG(fileName.c_str());
+        }
+        delete image;
+    };
+    if (encoders)
+    {
+        encoders->run(write);
+    }
+    else
+    {
+        write();
+    }
+}
+
+std::vector<std::string> dumpTexture(Texture& texture, unsigned int callNo, GLfloat* vertices, int face, GLuint* cm_indices, common::TaskGroup* encoders)
 {
     // Using a simple frag shader, dump the attached texture
 #define STRINGIZE(x) #x
@@ -812,18 +932,16 @@ std::vector<std::string> dumpTexture(Texture& texture, unsigned int callNo, GLfl
             fileName << "cube_" << face << ".raw";
             bytes_per_pixel = 16;
             image = getDrawBufferImage(GL_COLOR_ATTACHMENT0, texture.width, texture.height, pixel_format, out_type, bytes_per_pixel);
-            image->writePixelData(fileName.str().c_str());
+            writeImage(image, fileName.str(), true, encoders);
         }
         else
         {
             fileName << "cube_" << cube_faces[face] << ".png";
             bytes_per_pixel = 4;
             image = getDrawBufferImage(GL_COLOR_ATTACHMENT0, texture.width, texture.height, pixel_format, out_type, bytes_per_pixel);
-            image->writePNG(fileName.str().c_str());
+            writeImage(image, fileName.str(), false, encoders);
         }
 
-        delete image;
-
         DBG_LOG("Wrote cubemap %i's %s face to %s\n", texture.handle, cube_faces[face].c_str(), fileName.str().c_str());
         results.push_back(fileName.str());
     }
@@ -860,18 +978,16 @@ std::vector<std::string> dumpTexture(Texture& texture, unsigned int callNo, GLfl
                 fileName << ".raw";
                 bytes_per_pixel = 16;
                 image = getDrawBufferImage(GL_COLOR_ATTACHMENT0, texture.width, texture.height, pixel_format, out_type, bytes_per_pixel);
-                image->writePixelData(fileName.str().c_str());
+                writeImage(image, fileName.str(), true, encoders);
             }
             else
             {
                 fileName << ".png";
                 bytes_per_pixel = 4;
                 image = getDrawBufferImage(GL_COLOR_ATTACHMENT0, texture.width, texture.height, pixel_format, out_type, bytes_per_pixel);
-                image->writePNG(fileName.str().c_str());
+                writeImage(image, fileName.str(), false, encoders);
             }
 
-            delete image;
-
             DBG_LOG("Wrote texture %d to %s\n", texture.handle, fileName.str().c_str());
             results.push_back(fileName.str());
         }
@@ -16,6 +16,9 @@ public:
     virtual void show();
     virtual bool resize(int w, int h);
     virtual EGLNativeWindowType getHandle() const { return mHandle; }
+    /// Just before a frame of the retraced thread is swapped with -presentfeedback, to collect the
+    /// presentation feedback of earlier frames and ask for it for this one
+    virtual void beforeSwap() {}
 
     void setWidth(int width) { mWidth = width; }
     void setHeight(int height) { mHeight = height; }
@@ -3,8 +3,15 @@
 #include "retracer/glws_egl.hpp"
 #include "retracer/retracer.hpp"
 #include "dispatch/eglproc_auto.hpp"
+#include "common/gl_extension_supported.hpp"
 #include "forceoffscreen/offscrmgr.h"
 
+#include <string.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
 using namespace retracer;
 
 EglDrawable::EglDrawable(int w, int h, EGLDisplay eglDisplay, EGLConfig eglConfig, NativeWindow* nativeWindow, EGLint const* attribList)
@@ -114,6 +121,7 @@ void EglDrawable::resize(int w, int h)
 
 void EglDrawable::swapBuffers()
 {
+    _beforeSwap();
     eglSwapBuffers(mEglDisplay, mSurface);
 }
 
@@ -127,14 +135,31 @@ void EglDrawable::swapBuffersWithDamage(int *rects, int n_rects)
         return;
     }
 
+    _beforeSwap();
     if (!eglSwapBuffersWithDamageKHR(mEglDisplay, mSurface, rects, n_rects))
     {
         DBG_LOG("WARNING: eglSwapBuffersWithDamageKHR() may not be suppported, fallback to eglSwapBuffers()\n");
-        swapBuffers();
+        eglSwapBuffers(mEglDisplay, mSurface);
         notSupported = true;
     }
 }
 
+void EglDrawable::_beforeSwap()
+{
+    if (gRetracer.getCurTid() != gRetracer.mOptions.mRetraceTid)
+    {
+        return; // only the frames of the retraced thread are timed
+    }
+    if (gRetracer.mPresentTimer.enabled())
+    {
+        gRetracer.mPresentTimer.beforeSwap(mEglDisplay, mSurface, gRetracer.GetCurFrameId());
+    }
+    if (gRetracer.mPresentFeedback.enabled() && mNativeWindow)
+    {
+        mNativeWindow->beforeSwap();
+    }
+}
+
 EGLSurface EglDrawable::_createWindowSurface()
 {
     EGLNativeWindowType handle = mNativeWindow->getHandle();
@@ -158,9 +183,19 @@ EglPbufferDrawable::EglPbufferDrawable(EGLDisplay eglDisplay, EGLConfig eglConfi
     }
 }
 
+EglPbufferDrawable::EglPbufferDrawable(EGLDisplay eglDisplay, EGLint const* attribList)
+    : PbufferDrawable(attribList)
+    , mEglDisplay(eglDisplay)
+    , mSurface(EGL_NO_SURFACE)
+{
+}
+
 EglPbufferDrawable::~EglPbufferDrawable()
 {
-    eglDestroySurface(mEglDisplay, mSurface);
+    if (mSurface != EGL_NO_SURFACE)
+    {
+        eglDestroySurface(mEglDisplay, mSurface);
+    }
 }
 
 
@@ -221,6 +256,7 @@ EglContext::~EglContext()
     // delete all dma buffers
     for (auto iter2 : mGraphicBuffers) {
         if (iter2 != NULL) {
+            gRetracer.mGraphicBufferPool.forget(iter2);
             unmap_fixture_memory_bufs(iter2);
             delete iter2;
         }
@@ -235,6 +271,10 @@ GlwsEgl::GlwsEgl()
     , mEglConfig(0)
     , mEglDisplay(EGL_NO_DISPLAY)
     , mNativeVisualId(0)
+    , mSurfaceless(false)
+    , mDisplayHeadless(false)
+    , mDisplayPbuffer(false)
+    , mDisplayDevice(-1)
 {
 }
 
@@ -242,13 +282,24 @@ GlwsEgl::~GlwsEgl()
 {
 }
 
-void GlwsEgl::Init(Profile /*profile*/)
+void GlwsEgl::initDisplay()
 {
     mEglNativeDisplay = getNativeDisplay();
-    if (gRetracer.mOptions.mPbufferRendering)
+    mEglDisplay = EGL_NO_DISPLAY;
+    const char* clientExtensions = gRetracer.mOptions.mHeadless ? eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS) : NULL;
+    const int device = gRetracer.mOptions.mEglDevice;
+    if (clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless") && device < 0)
+    {
+        // No window system or device needed at all
+        PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (eglGetPlatformDisplayEXT)
+        {
+            mEglDisplay = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+            DBG_LOG("Using the surfaceless platform for headless rendering\n");
+        }
+    }
+    if (mEglDisplay == EGL_NO_DISPLAY && (gRetracer.mOptions.mPbufferRendering || (device >= 0 && gRetracer.mOptions.mHeadless)))
     {
-        mEglDisplay = EGL_NO_DISPLAY;
-
         PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
         if (eglQueryDevicesEXT)
         {
@@ -258,11 +309,19 @@ void GlwsEgl::Init(Profile /*profile*/)
 
             if (eglQueryDevicesEXT(MAX_DEVICES, eglDevs, &numDevices) == EGL_TRUE)
             {
-                DBG_LOG("Detected %d devices -- choosing the first\n", numDevices);
+                const int chosen = (device >= 0 && device < numDevices) ? device : 0;
+                if (device >= numDevices)
+                {
+                    DBG_LOG("Detected %d devices, there is no device %d -- choosing the first\n", numDevices, device);
+                }
+                else
+                {
+                    DBG_LOG("Detected %d devices -- choosing device %d\n", numDevices, chosen);
+                }
                 PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
                 if (eglGetPlatformDisplayEXT)
                 {
-                    mEglDisplay = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, eglDevs[0], 0);
+                    mEglDisplay = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, eglDevs[chosen], 0);
                 }
             }
             else
@@ -277,11 +336,10 @@ void GlwsEgl::Init(Profile /*profile*/)
             mEglDisplay = eglGetDisplay(mEglNativeDisplay);
         }
     }
-    else
+    else if (mEglDisplay == EGL_NO_DISPLAY)
     {
         mEglDisplay = eglGetDisplay(mEglNativeDisplay);
     }
-    gRetracer.mState.mEglDisplay = mEglDisplay;
 
     if (mEglDisplay == EGL_NO_DISPLAY)
     {
@@ -300,6 +358,37 @@ void GlwsEgl::Init(Profile /*profile*/)
     }
     DBG_LOG("eglInitialize %d.%d\n", major, minor);
 
+    if (gRetracer.mOptions.mHeadless)
+    {
+        const char* extensions = eglQueryString(mEglDisplay, EGL_EXTENSIONS);
+        mSurfaceless = extensions && strstr(extensions, "EGL_KHR_surfaceless_context");
+        DBG_LOG("Headless rendering %s\n", mSurfaceless ? "without surfaces" : "to pbuffers, since EGL_KHR_surfaceless_context is not supported");
+    }
+}
+
+void GlwsEgl::Init(Profile /*profile*/)
+{
+    const bool headless = gRetracer.mOptions.mHeadless;
+    const bool pbuffer = gRetracer.mOptions.mPbufferRendering;
+    const int device = gRetracer.mOptions.mEglDevice;
+    if (mEglDisplay != EGL_NO_DISPLAY && (headless != mDisplayHeadless || pbuffer != mDisplayPbuffer || device != mDisplayDevice))
+    {
+        DBG_LOG("The previous trace of the batch used another kind of display, terminating it\n");
+        Cleanup(); // the native display is kept, windows made for it may still be in use
+    }
+    if (mEglDisplay == EGL_NO_DISPLAY)
+    {
+        initDisplay();
+        mDisplayHeadless = headless;
+        mDisplayPbuffer = pbuffer;
+        mDisplayDevice = device;
+    }
+    else
+    {
+        DBG_LOG("Reusing the EGL display of the previous trace\n");
+    }
+    gRetracer.mState.mEglDisplay = mEglDisplay;
+
     RetraceOptions& o = gRetracer.mOptions;
     EGLint samples = o.mOnscreenConfig.msaa_samples;
     if(samples == -1)
@@ -312,7 +401,7 @@ void GlwsEgl::Init(Profile /*profile*/)
     const EGLint attribs[] = {
         EGL_SAMPLE_BUFFERS, o.mOnscreenConfig.msaa_samples ? 1 : 0,
         EGL_SAMPLES, o.mOnscreenConfig.msaa_samples,
-        EGL_SURFACE_TYPE, gRetracer.mOptions.mPbufferRendering ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
+        EGL_SURFACE_TYPE, mSurfaceless ? 0 : gRetracer.mOptions.mPbufferRendering ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
         EGL_RED_SIZE, o.mOnscreenConfig.red,
         EGL_GREEN_SIZE, o.mOnscreenConfig.green,
         EGL_BLUE_SIZE, o.mOnscreenConfig.blue,
@@ -395,7 +484,14 @@ void GlwsEgl::Init(Profile /*profile*/)
 Drawable* GlwsEgl::CreatePbufferDrawable(EGLint const* attribList)
 {
     Drawable* handler;
-    handler = new EglPbufferDrawable(mEglDisplay, mEglConfig, attribList);
+    if (mSurfaceless)
+    {
+        handler = new EglPbufferDrawable(mEglDisplay, attribList);
+    }
+    else
+    {
+        handler = new EglPbufferDrawable(mEglDisplay, mEglConfig, attribList);
+    }
     return handler;
 }
 
@@ -403,6 +499,7 @@ Context* GlwsEgl::CreateContext(Context* shareContext, Profile profile)
 {
     EGLint attribs[] = {
         EGL_CONTEXT_MAJOR_VERSION, profile, EGL_CONTEXT_MINOR_VERSION, 0,
+        EGL_NONE, EGL_NONE, // for the priority
         EGL_NONE
     };
 
@@ -417,6 +514,23 @@ Context* GlwsEgl::CreateContext(Context* shareContext, Profile profile)
         attribs[3] = 2;
     }
 
+    const std::string& priority = gRetracer.mOptions.mContextPriority;
+    if (!priority.empty())
+    {
+        static const bool supported = isEglExtensionSupported(mEglDisplay, "EGL_IMG_context_priority");
+        const EGLint level = priority == "high" ? EGL_CONTEXT_PRIORITY_HIGH_IMG : priority == "medium" ? EGL_CONTEXT_PRIORITY_MEDIUM_IMG
+                           : priority == "low" ? EGL_CONTEXT_PRIORITY_LOW_IMG : EGL_NONE;
+        if (!supported || level == EGL_NONE)
+        {
+            DBG_LOG("Cannot create contexts with priority %s, creating them with the default one\n", priority.c_str());
+        }
+        else
+        {
+            attribs[4] = EGL_CONTEXT_PRIORITY_LEVEL_IMG;
+            attribs[5] = level;
+        }
+    }
+
     EGLContext eglShareContext = EGL_NO_CONTEXT;
     if (shareContext)
     {
@@ -37,11 +37,18 @@ public:
     void setNativeWindow(EGLNativeWindowType window);
 
 protected:
+    /// Get and initialize mEglDisplay, which is kept between the traces of a batch
+    void initDisplay();
+
     EGLNativeDisplayType mEglNativeDisplay;
     EGLNativeWindowType mEglNativeWindow;
     EGLConfig mEglConfig;
     EGLDisplay mEglDisplay;
     EGLint mNativeVisualId;
+    bool mSurfaceless; ///< headless, and contexts can be made current without a surface
+    bool mDisplayHeadless; ///< options mEglDisplay was made for
+    bool mDisplayPbuffer;
+    int mDisplayDevice;
     WinNameToNativeWindowMap_t gWinNameToNativeWindowMap;
 };
 
@@ -73,6 +80,8 @@ public:
 
 private:
     EGLSurface _createWindowSurface();
+    /// Let the present timing of the retraced thread know about the swap
+    void _beforeSwap();
 
     EGLDisplay mEglDisplay;
     EGLConfig mEglConfig;
@@ -85,6 +94,8 @@ class EglPbufferDrawable : public PbufferDrawable
 {
 public:
     EglPbufferDrawable(EGLDisplay eglDisplay, EGLConfig eglConfig, EGLint const* attribList);
+    /// Without a surface, for EGL_KHR_surfaceless_context
+    EglPbufferDrawable(EGLDisplay eglDisplay, EGLint const* attribList);
     virtual ~EglPbufferDrawable();
 
     virtual void swapBuffers(void) {}
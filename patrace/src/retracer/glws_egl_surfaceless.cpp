@@ -0,0 +1,40 @@
+#include "retracer/glws_egl_surfaceless.hpp"
+#include "retracer/retracer.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+namespace retracer
+{
+
+GlwsEglSurfaceless::GlwsEglSurfaceless()
+    : GlwsEgl()
+{
+}
+
+GlwsEglSurfaceless::~GlwsEglSurfaceless()
+{
+}
+
+void GlwsEglSurfaceless::Init(Profile profile)
+{
+    if (!gRetracer.mOptions.mHeadless)
+    {
+        gRetracer.reportAndAbort("This build has no window system and can only retrace headless");
+    }
+    GlwsEgl::Init(profile);
+}
+
+Drawable* GlwsEglSurfaceless::CreateDrawable(int width, int height, int /*win*/, EGLint const* /*attribList*/)
+{
+    // Window surfaces are created as pbuffers in headless mode, this is only reached if that changes
+    EGLint const attribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE, EGL_NONE };
+    return CreatePbufferDrawable(attribs);
+}
+
+GLWS& GLWS::instance()
+{
+    static GlwsEglSurfaceless g;
+    return g;
+}
+
+} // namespace retracer
@@ -0,0 +1,22 @@
+#if !defined(GLWS_EGL_SURFACELESS_HPP)
+#define GLWS_EGL_SURFACELESS_HPP
+
+#include "retracer/glws_egl.hpp"
+
+namespace retracer {
+
+/// Window system for GPUs without a display, such as in server farms. There are no native
+/// windows, so every surface is rendered headless, to the offscreen FBO.
+class GlwsEglSurfaceless : public GlwsEgl
+{
+public:
+    GlwsEglSurfaceless();
+    ~GlwsEglSurfaceless();
+
+    virtual void Init(Profile profile = PROFILE_ES2) override;
+    virtual Drawable* CreateDrawable(int width, int height, int win, EGLint const* attribList) override;
+};
+
+}
+
+#endif // !defined(GLWS_EGL_SURFACELESS_HPP)
@@ -7,6 +7,8 @@
 #include <cmath>
 #include <sstream>
 #include <linux/input.h>
+#include <poll.h>
+#include <time.h>
 
 namespace retracer
 {
@@ -34,14 +36,115 @@ static const struct wl_shell_surface_listener shellListener = {
 	shsurf_handle_popup_done
 };
 
+/* The client side of the presentation-time protocol, as wayland-scanner would generate it */
+extern const struct wl_interface wp_presentation_feedback_interface_pa;
+
+static const struct wl_interface *presentation_time_types[] = {
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	&wl_surface_interface,
+	&wp_presentation_feedback_interface_pa,
+	&wl_output_interface,
+};
+
+static const struct wl_message wp_presentation_requests[] = {
+	{ "destroy", "", presentation_time_types + 0 },
+	{ "feedback", "on", presentation_time_types + 7 },
+};
+
+static const struct wl_message wp_presentation_events[] = {
+	{ "clock_id", "u", presentation_time_types + 0 },
+};
+
+const struct wl_interface wp_presentation_interface_pa = {
+	"wp_presentation", 1,
+	2, wp_presentation_requests,
+	1, wp_presentation_events,
+};
+
+static const struct wl_message wp_presentation_feedback_events[] = {
+	{ "sync_output", "o", presentation_time_types + 9 },
+	{ "presented", "uuuuuuu", presentation_time_types + 0 },
+	{ "discarded", "", presentation_time_types + 0 },
+};
+
+const struct wl_interface wp_presentation_feedback_interface_pa = {
+	"wp_presentation_feedback", 1,
+	0, NULL,
+	3, wp_presentation_feedback_events,
+};
+
+#define WP_PRESENTATION_DESTROY 0
+#define WP_PRESENTATION_FEEDBACK 1
+#define WP_PRESENTATION_FEEDBACK_KIND_VSYNC 0x1
+
+struct wp_presentation_listener {
+	void (*clock_id)(void *data, struct wp_presentation *wp_presentation, uint32_t clk_id);
+};
+
+struct wp_presentation_feedback_listener {
+	void (*sync_output)(void *data, struct wp_presentation_feedback *feedback, struct wl_output *output);
+	void (*presented)(void *data, struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+		uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags);
+	void (*discarded)(void *data, struct wp_presentation_feedback *feedback);
+};
+
+static void presentation_handle_clock_id(void *data, struct wp_presentation *wp_presentation, uint32_t clk_id)
+{
+    struct presentation_state *state = (struct presentation_state *)data;
+    state->clock = (clockid_t)clk_id;
+}
+
+static void feedback_handle_sync_output(void *data, struct wp_presentation_feedback *feedback, struct wl_output *output)
+{
+}
+
+static void feedback_handle_presented(void *data, struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+	uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags)
+{
+    const int64_t time = (int64_t)(((uint64_t)tv_sec_hi << 32) | tv_sec_lo) * 1000000000LL + tv_nsec;
+    const uint64_t msc = (flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC) ? (((uint64_t)seq_hi << 32) | seq_lo) : 0;
+    gRetracer.mPresentFeedback.presented((unsigned)(uintptr_t)data, time, msc, refresh);
+    wl_proxy_destroy((struct wl_proxy *)feedback);
+}
+
+static void feedback_handle_discarded(void *data, struct wp_presentation_feedback *feedback)
+{
+    gRetracer.mPresentFeedback.discarded((unsigned)(uintptr_t)data);
+    wl_proxy_destroy((struct wl_proxy *)feedback);
+}
+
+static const struct wp_presentation_feedback_listener feedbackListener = {
+	feedback_handle_sync_output,
+	feedback_handle_presented,
+	feedback_handle_discarded
+};
+
+/* Dispatch the feedback that has come so far, without waiting for more */
+static void dispatch_feedback(struct wl_display *display, struct wl_event_queue *queue)
+{
+    while (wl_display_prepare_read_queue(display, queue) != 0) {
+        wl_display_dispatch_queue_pending(display, queue);
+    }
+    wl_display_flush(display);
+
+    struct pollfd pfd = { wl_display_get_fd(display), POLLIN, 0 };
+    if (poll(&pfd, 1, 0) > 0) {
+        wl_display_read_events(display);
+    } else {
+        wl_display_cancel_read(display);
+    }
+    wl_display_dispatch_queue_pending(display, queue);
+}
+
 class WaylandWindow : public NativeWindow
 {
     public:
         WaylandWindow(int width, int height, const std::string& title, struct wl_display *display,
                 struct wl_compositor *compositor, struct wl_shell *shell, struct wl_output *output,
-                int fs_width, int fs_height)
+                int fs_width, int fs_height, const struct presentation_state *presentation)
             : NativeWindow(width, height, title)
                 , mDisplay(display), mOutput(output), mFSWidth(fs_width), mFSHeight(fs_height)
+                , mPresentation(presentation)
         {
             mSurface = wl_compositor_create_surface(compositor);
             if (!mSurface) {
@@ -124,6 +227,26 @@ class WaylandWindow : public NativeWindow
             return false;
         }
 
+        virtual void beforeSwap()
+        {
+            if (!mPresentation->presentation) {
+                return;
+            }
+            dispatch_feedback(mDisplay, mPresentation->queue);
+
+            /* The feedback is for the next commit of the surface, which eglSwapBuffers makes */
+            struct timespec now;
+            clock_gettime(mPresentation->clock, &now);
+            const unsigned id = gRetracer.mPresentFeedback.swapped(gRetracer.GetCurFrameId(), now.tv_sec * 1000000000LL + now.tv_nsec);
+            struct wp_presentation_feedback *feedback = (struct wp_presentation_feedback *)wl_proxy_marshal_constructor(
+                (struct wl_proxy *)mPresentation->presentation, WP_PRESENTATION_FEEDBACK, &wp_presentation_feedback_interface_pa, mSurface, NULL);
+            if (!feedback) {
+                return;
+            }
+            wl_proxy_set_queue((struct wl_proxy *)feedback, mPresentation->queue);
+            wl_proxy_add_listener((struct wl_proxy *)feedback, (void (**)(void))&feedbackListener, (void *)(uintptr_t)id);
+        }
+
     private:
         struct wl_display* mDisplay;
         struct wl_output* mOutput;
@@ -132,12 +255,16 @@ class WaylandWindow : public NativeWindow
         struct wl_surface* mSurface;
         struct wl_shell_surface* mShellSurface;
         bool mVisible;
+        const struct presentation_state* mPresentation;
 };
 
 
 GlwsEglWayland::GlwsEglWayland()
     : GlwsEgl()
 {
+    mPresentation.presentation = NULL;
+    mPresentation.queue = NULL;
+    mPresentation.clock = CLOCK_MONOTONIC;
 }
 
 GlwsEglWayland::~GlwsEglWayland()
@@ -189,6 +316,7 @@ struct registry_data {
     struct wl_shell**      shell;
     struct wl_output**     output;
     struct wl_seat**       seat;
+    struct wp_presentation** presentation;
 };
 
 static void registry_handler(void *data, struct wl_registry *wl_registry, uint32_t name,
@@ -209,6 +337,8 @@ static void registry_handler(void *data, struct wl_registry *wl_registry, uint32
     } else if (!strcmp(interface, "wl_seat") && !(*ptrs_out->seat)) {
         uint32_t bind_ver = std::min(version, 1u);
         *(ptrs_out->seat) = (wl_seat*)wl_registry_bind(wl_registry, name, &wl_seat_interface, bind_ver);
+    } else if (!strcmp(interface, "wp_presentation") && gRetracer.mOptions.mPresentFeedback) {
+        *(ptrs_out->presentation) = (wp_presentation*)wl_registry_bind(wl_registry, name, &wp_presentation_interface_pa, 1);
     }
 }
 
@@ -327,7 +457,8 @@ EGLNativeDisplayType GlwsEglWayland::getNativeDisplay()
         &mCompositor,
         &mShell,
         &mOutputProps.output,
-        &mSeat
+        &mSeat,
+        &mPresentation.presentation
     };
 
     int res = wl_registry_add_listener(registry, &listener, &interface_ptrs);
@@ -371,6 +502,17 @@ EGLNativeDisplayType GlwsEglWayland::getNativeDisplay()
         display_handle_scale
     };
 
+    if (mPresentation.presentation) {
+        static const struct wp_presentation_listener presentation_listener = {
+            presentation_handle_clock_id
+        };
+        mPresentation.clock = CLOCK_MONOTONIC;
+        wl_proxy_add_listener((struct wl_proxy *)mPresentation.presentation, (void (**)(void))&presentation_listener, &mPresentation);
+        mPresentation.queue = wl_display_create_queue(display);
+    } else if (gRetracer.mOptions.mPresentFeedback) {
+        DBG_LOG("The compositor has no wp_presentation, frames get no presentation feedback\n");
+    }
+
     mOutputProps.width = 0;
     mOutputProps.height = 0;
     mOutputProps.scale = 1;
@@ -454,6 +596,12 @@ void GlwsEglWayland::releaseNativeDisplay(EGLNativeDisplayType display)
         wl_seat_destroy(mSeat);
     }
     wl_event_queue_destroy(mKBQueue);
+    if (mPresentation.presentation) {
+        wl_proxy_marshal((struct wl_proxy *)mPresentation.presentation, WP_PRESENTATION_DESTROY);
+        wl_proxy_destroy((struct wl_proxy *)mPresentation.presentation);
+        wl_event_queue_destroy(mPresentation.queue);
+        mPresentation.presentation = NULL;
+    }
     struct key_press *key_press, *next;
     wl_list_for_each_reverse_safe(key_press, next, &mKeysPressed, link) {
         wl_list_remove(&key_press->link);
@@ -504,7 +652,7 @@ Drawable* GlwsEglWayland::CreateDrawable(int width, int height, int win, EGLint
 
         // TODO: Delete
         window = new WaylandWindow(width, height, title.str(), (struct wl_display *)mEglNativeDisplay,
-                                   mCompositor, mShell, mOutput, mOutputWidth, mOutputHeight);
+                                   mCompositor, mShell, mOutput, mOutputWidth, mOutputHeight, &mPresentation);
         gWinNameToNativeWindowMap[win] = window;
     }
 
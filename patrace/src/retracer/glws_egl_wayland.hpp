@@ -8,6 +8,7 @@
 
 #include <wayland-client.h>
 #include <wayland-egl.h>
+#include <time.h>
 
 #include <wayland-server-protocol.h> // for enum wl_output_transform
 // in case the above include does not include it
@@ -42,6 +43,16 @@ struct keyboard_state {
      * key presses when they affect the right window... */
 };
 
+/* wp_presentation of the presentation-time protocol, for -presentfeedback */
+struct wp_presentation;
+struct wp_presentation_feedback;
+
+struct presentation_state {
+    struct wp_presentation *presentation; /* NULL if the compositor has none */
+    struct wl_event_queue  *queue; /* the feedback events are dispatched from this queue */
+    clockid_t               clock; /* the presentation clock of the compositor */
+};
+
 struct output_size_properties {
     struct wl_output *output;
     int width;
@@ -75,6 +86,7 @@ protected:
     struct output_size_properties
                               mOutputProps;
     struct wl_surface*        mKBFocus;
+    struct presentation_state mPresentation;
     int                       mOutputWidth;
     int                       mOutputHeight;
 };
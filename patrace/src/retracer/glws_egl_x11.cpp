@@ -4,7 +4,13 @@
 #include "dispatch/eglproc_auto.hpp"
 
 #include <cmath>
+#include <deque>
 #include <sstream>
+#include <time.h>
+
+#ifdef ENABLE_XPRESENT
+#include <X11/extensions/Xpresent.h>
+#endif
 
 namespace retracer
 {
@@ -15,6 +21,7 @@ public:
     X11Window(int width, int height, const std::string& title, EGLNativeDisplayType display, EGLint eglNativeVisualId)
         : NativeWindow(width, height, title)
           , mDisplay(display)
+          , mPresentOpcode(0)
     {
         Window root = RootWindow(mDisplay, DefaultScreen(mDisplay));
 
@@ -92,6 +99,69 @@ public:
         return false;
     }
 
+    virtual void beforeSwap()
+    {
+#ifdef ENABLE_XPRESENT
+        if (mPresentOpcode == 0)
+        {
+            int event, error;
+            if (XPresentQueryExtension(mDisplay, &mPresentOpcode, &event, &error))
+            {
+                XPresentSelectInput(mDisplay, mHandle, PresentCompleteNotifyMask);
+            }
+            else
+            {
+                DBG_LOG("The X server has no Present extension, frames get no presentation feedback\n");
+                mPresentOpcode = -1;
+            }
+        }
+        if (mPresentOpcode < 0)
+        {
+            return;
+        }
+
+        // EGL presents each swap with the Present extension, and the server tells every client
+        // that selected the window when it is done, in the order of the swaps
+        XEvent event;
+        while (XCheckTypedEvent(mDisplay, GenericEvent, &event))
+        {
+            if (event.xcookie.extension != mPresentOpcode || !XGetEventData(mDisplay, &event.xcookie))
+            {
+                continue;
+            }
+            const XPresentCompleteNotifyEvent* complete = (const XPresentCompleteNotifyEvent*)event.xcookie.data;
+            if (event.xcookie.evtype == PresentCompleteNotify && complete->kind == PresentCompleteKindPixmap && !mPresentIds.empty())
+            {
+                const unsigned id = mPresentIds.front();
+                mPresentIds.pop_front();
+                if (complete->mode == PresentCompleteModeSkip)
+                {
+                    gRetracer.mPresentFeedback.discarded(id);
+                }
+                else
+                {
+                    gRetracer.mPresentFeedback.presented(id, complete->ust * 1000, complete->msc, 0); // ust is in microseconds
+                }
+            }
+            XFreeEventData(mDisplay, &event.xcookie);
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        mPresentIds.push_back(gRetracer.mPresentFeedback.swapped(gRetracer.GetCurFrameId(), now.tv_sec * 1000000000LL + now.tv_nsec));
+        if (mPresentIds.size() > PresentFeedback::MAX_PENDING)
+        {
+            mPresentIds.pop_front(); // given up on by mPresentFeedback as well
+        }
+#else
+        if (mPresentOpcode == 0)
+        {
+            DBG_LOG("Built without libXpresent, frames get no presentation feedback\n");
+            mPresentOpcode = -1;
+        }
+#endif
+    }
+
 private:
     void waitForEvent(int type)
     {
@@ -104,6 +174,8 @@ private:
     }
 
     EGLNativeDisplayType mDisplay;
+    int mPresentOpcode; ///< of the Present extension, 0 before the first swap and -1 without it
+    std::deque<unsigned> mPresentIds; ///< PresentFeedback ids of the swaps not completed yet
 };
 
 
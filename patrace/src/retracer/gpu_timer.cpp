@@ -0,0 +1,198 @@
+#include "retracer/gpu_timer.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "retracer/retracer.hpp"
+
+#include "common/gl_extension_supported.hpp"
+#include "common/os.hpp"
+
+namespace retracer {
+
+GLuint GpuTimer::getQuery()
+{
+    if (mFree.empty())
+    {
+        const size_t count = 64;
+        mFree.resize(count);
+        _glGenQueriesEXT(count, mFree.data());
+    }
+    const GLuint query = mFree.back();
+    mFree.pop_back();
+    return query;
+}
+
+void GpuTimer::freeQueries()
+{
+    if (!mFree.empty())
+    {
+        _glDeleteQueriesEXT(mFree.size(), mFree.data());
+    }
+    mFree.clear();
+}
+
+bool GpuTimer::begin(unsigned callNo, unsigned frameNo, const char* funcName)
+{
+    Context* context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    if (!context)
+    {
+        return false;
+    }
+    if (context != mContext)
+    {
+        if (mContext)
+        {
+            DBG_LOG("GPU timer queries of another context are still in use, dropping them\n");
+            mPending.clear();
+            mFree.clear();
+        }
+        mContext = context;
+        GLint bits = 0;
+        if (isGlesExtensionSupported("GL_EXT_disjoint_timer_query"))
+        {
+            _glGetQueryivEXT(GL_TIMESTAMP_EXT, GL_QUERY_COUNTER_BITS_EXT, &bits);
+        }
+        mSupported = (bits > 0);
+        if (!mSupported)
+        {
+            DBG_LOG("GPU timestamps not supported in this context, draws are not timed\n");
+        }
+        mPassOpen = false;
+    }
+    if (!mSupported)
+    {
+        return false;
+    }
+
+    if (mPending.size() >= MAX_PENDING)
+    {
+        poll(false);
+        while (mPending.size() >= MAX_PENDING)
+        {
+            poll(true); // the GPU is far behind, this is where replay has to wait
+        }
+    }
+
+    const unsigned framebuffer = context->_current_framebuffer;
+    if (!mPassOpen || framebuffer != mLastFramebuffer)
+    {
+        const RenderPass pass = { frameNo, framebuffer, mDraws.size(), mDraws.size() };
+        mRenderPasses.push_back(pass);
+        mPassOpen = true;
+        mLastFramebuffer = framebuffer;
+    }
+    mRenderPasses.back().lastDraw = mDraws.size();
+
+    Draw draw;
+    draw.callNo = callNo;
+    draw.frameNo = frameNo;
+    draw.funcName = funcName;
+    draw.renderPass = mRenderPasses.size() - 1;
+    mDraws.push_back(draw);
+
+    const Pending pending = { getQuery(), getQuery(), mDraws.size() - 1 };
+    _glQueryCounterEXT(pending.begin, GL_TIMESTAMP_EXT);
+    mPending.push_back(pending);
+    return true;
+}
+
+void GpuTimer::end()
+{
+    _glQueryCounterEXT(mPending.back().end, GL_TIMESTAMP_EXT);
+}
+
+void GpuTimer::poll(bool wait)
+{
+    size_t done = 0;
+    while (done < mPending.size())
+    {
+        const Pending& pending = mPending.at(done);
+        GLuint available = GL_FALSE;
+        _glGetQueryObjectuivEXT(pending.end, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if (!available && !(wait && done == 0))
+        {
+            break;
+        }
+        Draw& draw = mDraws.at(pending.draw);
+        GLuint64 begin = 0, end = 0;
+        _glGetQueryObjectui64vEXT(pending.begin, GL_QUERY_RESULT_EXT, &begin);
+        _glGetQueryObjectui64vEXT(pending.end, GL_QUERY_RESULT_EXT, &end);
+        draw.begin = begin;
+        draw.end = end;
+        draw.valid = (end >= begin);
+        mFree.push_back(pending.begin);
+        mFree.push_back(pending.end);
+        done++;
+    }
+    if (done == 0)
+    {
+        return;
+    }
+
+    // A disjoint event means timestamps read since the last check cannot be trusted
+    GLint disjoint = GL_FALSE;
+    _glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    for (size_t i = 0; i < done; i++)
+    {
+        if (disjoint)
+        {
+            mDraws.at(mPending.front().draw).valid = false;
+            mDisjoint++;
+        }
+        mPending.pop_front();
+    }
+}
+
+void GpuTimer::flush()
+{
+    while (!mPending.empty())
+    {
+        poll(true);
+    }
+    freeQueries();
+    mContext = nullptr;
+}
+
+void GpuTimer::store(Json::Value& result) const
+{
+    if (mDraws.empty())
+    {
+        return;
+    }
+    Json::Value timing;
+    Json::Value draws = Json::arrayValue;
+    for (const Draw& draw : mDraws)
+    {
+        if (!draw.valid) continue;
+        Json::Value v;
+        v["call"] = draw.callNo;
+        v["frame"] = draw.frameNo;
+        v["function"] = draw.funcName;
+        v["renderpass"] = draw.renderPass;
+        v["time"] = (double)(draw.end - draw.begin) / 1e9;
+        draws.append(v);
+    }
+    Json::Value passes = Json::arrayValue;
+    for (const RenderPass& pass : mRenderPasses)
+    {
+        const Draw& first = mDraws.at(pass.firstDraw);
+        const Draw& last = mDraws.at(pass.lastDraw);
+        Json::Value v;
+        v["frame"] = pass.frameNo;
+        v["framebuffer"] = pass.framebuffer;
+        v["first_call"] = first.callNo;
+        v["last_call"] = last.callNo;
+        v["draws"] = (unsigned)(pass.lastDraw - pass.firstDraw + 1);
+        if (first.valid && last.valid && last.end >= first.begin)
+        {
+            v["time"] = (double)(last.end - first.begin) / 1e9;
+        }
+        passes.append(v);
+    }
+    timing["draws"] = draws;
+    timing["renderpasses"] = passes;
+    timing["disjoint"] = mDisjoint;
+    result["gpu_timing"] = timing;
+}
+
+}
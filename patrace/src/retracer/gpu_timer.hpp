@@ -0,0 +1,84 @@
+#ifndef _RETRACER_GPU_TIMER_HPP_
+#define _RETRACER_GPU_TIMER_HPP_
+
+#include "dispatch/eglimports.hpp"
+#include "jsoncpp/include/json/value.h"
+
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+namespace retracer {
+
+class Context;
+
+/// GPU time of draws and dispatches for -drawtime, from GL_EXT_disjoint_timer_query timestamps
+/// written before and after each of them. Results are read once the GPU has written them, so
+/// replay does not wait for the GPU unless too many are still in flight. A render pass is taken
+/// to be the draws between two changes of the draw framebuffer, and its time is from the first
+/// timestamp of its first draw to the last of its last draw.
+///
+/// Query objects are not shared between contexts, so flush() must be called before the current
+/// context changes.
+class GpuTimer
+{
+public:
+    static const unsigned MAX_PENDING = 512; ///< timed calls in flight before replay waits for results
+
+    /// Write the timestamp before a call. Returns false if the current context cannot do that.
+    bool begin(unsigned callNo, unsigned frameNo, const char* funcName);
+    /// Write the timestamp after the call
+    void end();
+    /// Read the results that are available, waiting for the oldest one if wait is set
+    void poll(bool wait = false);
+    /// Draws after this start a new render pass
+    void endFrame() { mPassOpen = false; }
+    /// Read all results and free the query objects, while their context is still current
+    void flush();
+    /// Add the results as "gpu_timing" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    struct Draw
+    {
+        unsigned callNo;
+        unsigned frameNo;
+        const char* funcName;
+        unsigned renderPass;
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        bool valid = false;
+    };
+
+    struct RenderPass
+    {
+        unsigned frameNo;
+        unsigned framebuffer;
+        size_t firstDraw;
+        size_t lastDraw;
+    };
+
+    struct Pending
+    {
+        GLuint begin;
+        GLuint end;
+        size_t draw;
+    };
+
+    GLuint getQuery();
+    void freeQueries();
+
+    Context* mContext = nullptr; ///< owner of the queries
+    bool mSupported = false;
+    std::vector<GLuint> mFree;
+    std::deque<Pending> mPending;
+    std::vector<Draw> mDraws;
+    std::vector<RenderPass> mRenderPasses;
+    bool mPassOpen = false;
+    unsigned mLastFramebuffer = 0;
+    unsigned mDisjoint = 0; ///< results dropped because the GPU timer was disturbed
+};
+
+}
+
+#endif
@@ -0,0 +1,38 @@
+#include "retracer/graphic_buffer_pool.hpp"
+
+#include "retracer/glws.hpp"
+#include "retracer/retracer.hpp"
+
+#include "dma_buffer/dma_buffer.hpp"
+#include "graphic_buffer/GraphicBuffer.hpp"
+
+namespace retracer {
+
+#ifdef ANDROID
+void destroyGraphicBuffer(GraphicBuffer* buffer)
+{
+    delete buffer;
+}
+
+void destroyGraphicBuffer(HardwareBuffer* buffer)
+{
+    delete buffer;
+}
+#else
+void destroyGraphicBuffer(egl_image_fixture* buffer)
+{
+    unmap_fixture_memory_bufs(buffer);
+    close_fixture_memory_bufs(buffer);
+    delete buffer;
+}
+#endif
+
+void destroyGraphicBufferImage(EGLImageKHR image)
+{
+    if (!gRetracer.mState.IsInEGLImageMap(image))
+    {
+        GLWS::instance().destroyImageKHR(image);
+    }
+}
+
+}
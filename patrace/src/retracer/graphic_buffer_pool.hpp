@@ -0,0 +1,181 @@
+#ifndef _RETRACER_GRAPHIC_BUFFER_POOL_HPP_
+#define _RETRACER_GRAPHIC_BUFFER_POOL_HPP_
+
+#include "dispatch/eglimports.hpp"
+
+#include <deque>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+struct egl_image_fixture;
+class GraphicBuffer;
+class HardwareBuffer;
+
+namespace retracer {
+
+/// What a native buffer of glGenGraphicBuffer_ARM was made with
+struct GraphicBufferKey
+{
+    unsigned width;
+    unsigned height;
+    int format;
+    unsigned usage;
+
+    bool operator<(const GraphicBufferKey& rhs) const
+    {
+        return std::tie(width, height, format, usage) < std::tie(rhs.width, rhs.height, rhs.format, rhs.usage);
+    }
+};
+
+/// Free a native buffer, and its memory mappings
+void destroyGraphicBuffer(egl_image_fixture* buffer);
+void destroyGraphicBuffer(GraphicBuffer* buffer);
+void destroyGraphicBuffer(HardwareBuffer* buffer);
+/// Destroy an EGLImage of a buffer that is destroyed, unless the trace still refers to it
+void destroyGraphicBufferImage(EGLImageKHR image);
+
+/// Native buffers of glGenGraphicBuffer_ARM for -bufferpool. Video and camera frames come in
+/// buffers that the app creates and deletes every frame, each with an EGLImage made from it.
+/// Deleted buffers are kept instead, and handed out again for the next buffer of the same size,
+/// format and usage, along with their EGLImage, so that replay does not allocate, map and
+/// import new memory every frame. Their contents are overwritten by glGraphicBufferData_ARM.
+///
+/// Buffers are not tied to a context, so one pool serves all of them.
+template<typename Buffer>
+class GraphicBufferPool
+{
+public:
+    static const unsigned MAX_FREE = 8; ///< free buffers kept of each key
+
+    /// A free buffer made with key, or nullptr if a new one has to be made and add()ed
+    Buffer* acquire(const GraphicBufferKey& key)
+    {
+        auto it = mFree.find(key);
+        if (it == mFree.end() || it->second.empty())
+        {
+            return nullptr;
+        }
+        Buffer* buffer = it->second.back();
+        it->second.pop_back();
+        mReused++;
+        return buffer;
+    }
+
+    void add(Buffer* buffer, const GraphicBufferKey& key)
+    {
+        Entry& entry = mEntries[buffer];
+        entry.key = key;
+        mCreated++;
+    }
+
+    /// Keep a buffer that the trace deleted, or destroy it if enough of its kind are kept already
+    void release(Buffer* buffer)
+    {
+        auto it = mEntries.find(buffer);
+        if (it == mEntries.end())
+        {
+            destroyGraphicBuffer(buffer);
+            return;
+        }
+        std::deque<Buffer*>& free = mFree[it->second.key];
+        free.push_back(buffer);
+        if (free.size() > MAX_FREE)
+        {
+            destroy(free.front());
+            free.pop_front();
+        }
+    }
+
+    /// Stop tracking a buffer that is destroyed elsewhere
+    void forget(Buffer* buffer)
+    {
+        mEntries.erase(buffer);
+    }
+
+    /// The EGLImage made from buffer with attribs (ending with EGL_NONE) before, if any
+    EGLImageKHR image(Buffer* buffer, const EGLint* attribs) const
+    {
+        auto it = mEntries.find(buffer);
+        if (it == mEntries.end() || it->second.image == EGL_NO_IMAGE_KHR || it->second.attribs != attribList(attribs))
+        {
+            return EGL_NO_IMAGE_KHR;
+        }
+        return it->second.image;
+    }
+
+    /// Keep the EGLImage made from buffer, to be used again when it is handed out again
+    void setImage(Buffer* buffer, EGLImageKHR image, const EGLint* attribs)
+    {
+        auto it = mEntries.find(buffer);
+        if (it == mEntries.end())
+        {
+            return;
+        }
+        if (it->second.image != EGL_NO_IMAGE_KHR && it->second.image != image)
+        {
+            destroyGraphicBufferImage(it->second.image);
+        }
+        it->second.image = image;
+        it->second.attribs = attribList(attribs);
+    }
+
+    /// Destroy the free buffers
+    void clear()
+    {
+        for (auto& pair : mFree)
+        {
+            for (Buffer* buffer : pair.second)
+            {
+                destroy(buffer);
+            }
+        }
+        mFree.clear();
+    }
+
+    unsigned created() const { return mCreated; }
+    unsigned reused() const { return mReused; }
+
+private:
+    struct Entry
+    {
+        GraphicBufferKey key;
+        EGLImageKHR image = EGL_NO_IMAGE_KHR;
+        std::vector<EGLint> attribs;
+    };
+
+    static std::vector<EGLint> attribList(const EGLint* attribs)
+    {
+        std::vector<EGLint> list;
+        for (; attribs && *attribs != EGL_NONE; attribs += 2)
+        {
+            list.push_back(attribs[0]);
+            list.push_back(attribs[1]);
+        }
+        return list;
+    }
+
+    void destroy(Buffer* buffer)
+    {
+        auto it = mEntries.find(buffer);
+        if (it != mEntries.end())
+        {
+            if (it->second.image != EGL_NO_IMAGE_KHR)
+            {
+                destroyGraphicBufferImage(it->second.image);
+            }
+            mEntries.erase(it);
+        }
+        destroyGraphicBuffer(buffer);
+    }
+
+    std::unordered_map<Buffer*, Entry> mEntries; ///< buffers made for the pool, in use or free
+    std::map<GraphicBufferKey, std::deque<Buffer*>> mFree;
+    unsigned mCreated = 0;
+    unsigned mReused = 0;
+};
+
+}
+
+#endif
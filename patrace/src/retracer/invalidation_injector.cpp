@@ -0,0 +1,89 @@
+#include "retracer/invalidation_injector.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "common/os.hpp"
+#include "jsoncpp/include/json/reader.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace retracer {
+
+bool InvalidationInjector::load(const std::string& fileName)
+{
+    mEntries.clear();
+    mNext = 0;
+    std::ifstream in(fileName);
+    Json::Value value;
+    Json::Reader reader;
+    if (!in || !reader.parse(in, value) || !value.isObject() || !value["invalidate"].isArray())
+    {
+        DBG_LOG("Failed to read the invalidates to add from %s\n", fileName.c_str());
+        return false;
+    }
+    for (const Json::Value& v : value["invalidate"])
+    {
+        Entry e;
+        e.call = v.get("call", 0).asUInt();
+        e.after = v.get("after", false).asBool();
+        e.framebuffer = v.get("framebuffer", 0).asUInt();
+        for (const Json::Value& a : v["attachments"])
+        {
+            e.attachments.push_back(a.asUInt());
+        }
+        if (!e.attachments.empty())
+        {
+            mEntries.push_back(e);
+        }
+    }
+    std::stable_sort(mEntries.begin(), mEntries.end(), [](const Entry& a, const Entry& b) {
+        return a.call < b.call || (a.call == b.call && !a.after && b.after);
+    });
+    DBG_LOG("Adding %u invalidates from %s\n", (unsigned)mEntries.size(), fileName.c_str());
+    return true;
+}
+
+void InvalidationInjector::inject(unsigned callNo, bool after, unsigned framebuffer)
+{
+    while (mNext < mEntries.size() && (mEntries[mNext].call < callNo || (mEntries[mNext].call == callNo && !mEntries[mNext].after && after)))
+    {
+        mNext++; // missed, such as when no context was current
+    }
+    for (; mNext < mEntries.size() && mEntries[mNext].call == callNo && mEntries[mNext].after == after; mNext++)
+    {
+        const Entry& e = mEntries[mNext];
+        if (e.framebuffer != framebuffer)
+        {
+            mUnbound++;
+            continue;
+        }
+        // The window surface may be replayed into a framebuffer object, as with -offscreen
+        GLint bound = 0;
+        _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &bound);
+        std::vector<GLenum> attachments = e.attachments;
+        for (GLenum& a : attachments)
+        {
+            if (bound != 0 && a == GL_COLOR) a = GL_COLOR_ATTACHMENT0;
+            else if (bound != 0 && a == GL_DEPTH) a = GL_DEPTH_ATTACHMENT;
+            else if (bound != 0 && a == GL_STENCIL) a = GL_STENCIL_ATTACHMENT;
+        }
+        _glInvalidateFramebuffer(GL_DRAW_FRAMEBUFFER, attachments.size(), attachments.data());
+        mInjected++;
+    }
+}
+
+void InvalidationInjector::store(Json::Value& result) const
+{
+    if (mEntries.empty())
+    {
+        return;
+    }
+    Json::Value v;
+    v["invalidates"] = (Json::Value::UInt64)mEntries.size();
+    v["injected"] = (Json::Value::UInt64)mInjected;
+    v["framebuffer_not_bound"] = (Json::Value::UInt64)mUnbound;
+    result["invalidation"] = v;
+}
+
+} // namespace retracer
@@ -0,0 +1,56 @@
+#ifndef _RETRACER_INVALIDATION_INJECTOR_HPP_
+#define _RETRACER_INVALIDATION_INJECTOR_HPP_
+
+#include "dispatch/eglimports.hpp"
+#include "jsoncpp/include/json/value.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace retracer {
+
+/// Adds the glInvalidateFramebuffer calls that the trace lacks, for -invalidate, to measure what
+/// they would gain in frame time and bandwidth. They are read from the "invalidate" list that
+/// analyze_trace -I writes: each invalidates some attachments of a framebuffer either before the
+/// call that ends a render pass, so that they are not stored, or after the call that starts one,
+/// so that they are not loaded. An invalidate is only done if the framebuffer is still bound for
+/// drawing when it is due, since replay may have taken another path than the analysis did.
+class InvalidationInjector
+{
+public:
+    /// Read the invalidates to add from fileName. Returns false if it cannot be read.
+    bool load(const std::string& fileName);
+
+    /// Whether there are invalidates to add
+    bool active() const { return !mEntries.empty(); }
+
+    /// Whether an invalidate is due at or before call number callNo
+    bool due(unsigned callNo) const { return mNext < mEntries.size() && mEntries[mNext].call <= callNo; }
+
+    /// Do the invalidates due before call number callNo, or after it if after is true, given the
+    /// trace ID of the draw framebuffer bound. Calls must be given in increasing order.
+    void inject(unsigned callNo, bool after, unsigned framebuffer);
+
+    /// Add how many were done as "invalidation" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    struct Entry
+    {
+        unsigned call;
+        bool after;
+        unsigned framebuffer; ///< trace ID, zero for the window surface
+        std::vector<GLenum> attachments;
+    };
+
+    std::vector<Entry> mEntries; ///< by call, and those before a call first
+    size_t mNext = 0;
+    uint64_t mInjected = 0;
+    uint64_t mUnbound = 0; ///< not done because another framebuffer was bound
+};
+
+} // namespace retracer
+
+#endif
@@ -0,0 +1,178 @@
+#include "retracer/loop_checkpoint.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "retracer/state.hpp"
+
+#include "common/os.hpp"
+
+namespace retracer {
+
+static const char* kindNames[] = { "textures", "buffers", "framebuffers", "renderbuffers", "samplers", "programs",
+                                   "shaders", "queries", "vertex_arrays", "transform_feedbacks", "program_pipelines" };
+
+static hmap<unsigned int>& forwardMap(Context& context, LoopCheckpoint::Kind kind)
+{
+    switch (kind)
+    {
+    case LoopCheckpoint::TEXTURE: return context.getTextureMap();
+    case LoopCheckpoint::BUFFER: return context.getBufferMap();
+    case LoopCheckpoint::FRAMEBUFFER: return context.getFramebufferMap();
+    case LoopCheckpoint::RENDERBUFFER: return context.getRenderbufferMap();
+    case LoopCheckpoint::SAMPLER: return context.getSamplerMap();
+    case LoopCheckpoint::PROGRAM: return context.getProgramMap();
+    case LoopCheckpoint::SHADER: return context.getShaderMap();
+    case LoopCheckpoint::QUERY: return context._query_map;
+    case LoopCheckpoint::ARRAY: return context._array_map;
+    case LoopCheckpoint::FEEDBACK: return context._feedback_map;
+    default: return context._pipeline_map;
+    }
+}
+
+static hmap<unsigned int>& reverseMap(Context& context, LoopCheckpoint::Kind kind)
+{
+    switch (kind)
+    {
+    case LoopCheckpoint::TEXTURE: return context.getTextureRevMap();
+    case LoopCheckpoint::BUFFER: return context.getBufferRevMap();
+    case LoopCheckpoint::FRAMEBUFFER: return context.getFramebufferRevMap();
+    case LoopCheckpoint::RENDERBUFFER: return context.getRenderbufferRevMap();
+    case LoopCheckpoint::SAMPLER: return context.getSamplerRevMap();
+    case LoopCheckpoint::PROGRAM: return context.getProgramRevMap();
+    case LoopCheckpoint::SHADER: return context.getShaderRevMap();
+    case LoopCheckpoint::QUERY: return context._query_rev_map;
+    case LoopCheckpoint::ARRAY: return context._array_rev_map;
+    case LoopCheckpoint::FEEDBACK: return context._feedback_rev_map;
+    default: return context._pipeline_rev_map;
+    }
+}
+
+void LoopCheckpoint::capture(Context& context)
+{
+    mContext = &context;
+    for (int kind = 0; kind < KIND_COUNT; kind++)
+    {
+        mNames[kind].clear();
+        for (const auto& pair : forwardMap(context, (Kind)kind))
+        {
+            mNames[kind].insert(pair.first);
+        }
+    }
+
+    Bindings& b = mBindings;
+    b.vertexArray = 0;
+    b.drawFramebuffer = b.readFramebuffer = 0;
+    _glGetIntegerv(GL_CURRENT_PROGRAM, &b.program);
+    _glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &b.arrayBuffer);
+    _glGetIntegerv(GL_ACTIVE_TEXTURE, &b.activeTexture);
+    if (context._profile >= PROFILE_ES3)
+    {
+        _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &b.drawFramebuffer);
+        _glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &b.readFramebuffer);
+        _glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &b.vertexArray);
+    }
+    else
+    {
+        _glGetIntegerv(GL_FRAMEBUFFER_BINDING, &b.drawFramebuffer);
+        b.readFramebuffer = b.drawFramebuffer;
+    }
+    b.traceProgram = context._current_program;
+    b.traceFramebuffer = context._current_framebuffer;
+}
+
+void LoopCheckpoint::remove(Context& context, Kind kind, unsigned name)
+{
+    switch (kind)
+    {
+    case TEXTURE: _glDeleteTextures(1, &name); break;
+    case BUFFER:
+        _glDeleteBuffers(1, &name);
+        context._bufferToData_map.erase(name);
+        break;
+    case FRAMEBUFFER: _glDeleteFramebuffers(1, &name); break;
+    case RENDERBUFFER: _glDeleteRenderbuffers(1, &name); break;
+    case SAMPLER: _glDeleteSamplers(1, &name); break;
+    case PROGRAM:
+        _glDeleteProgram(name);
+        context.deleteShaderIDs(name);
+        context.getPendingLinks().erase(name);
+        break;
+    case SHADER:
+        _glDeleteShader(name);
+        context.deleteShader(name);
+        break;
+    case QUERY: _glDeleteQueries(1, &name); break;
+    case ARRAY: _glDeleteVertexArrays(1, &name); break;
+    case FEEDBACK: _glDeleteTransformFeedbacks(1, &name); break;
+    default: _glDeleteProgramPipelines(1, &name); break;
+    }
+}
+
+void LoopCheckpoint::restore(Context& context)
+{
+    if (&context != mContext)
+    {
+        DBG_LOG("The loop ends in another context than it starts in, not resetting its state\n");
+        return;
+    }
+    mRestores++;
+
+    for (int kind = 0; kind < KIND_COUNT; kind++)
+    {
+        hmap<unsigned int>& map = forwardMap(context, (Kind)kind);
+        hmap<unsigned int>& rev = reverseMap(context, (Kind)kind);
+        for (const auto& pair : map) // zeroing values does not add keys, so it can go on
+        {
+            // Name 0 is the default object in every map, and framebuffer 0 maps onto the screen
+            if (pair.first == 0 || mNames[kind].count(pair.first) > 0)
+            {
+                continue;
+            }
+            remove(context, (Kind)kind, pair.second);
+            map.RValue(pair.first) = 0;
+            rev.LValue(pair.second) = 0;
+            mDeleted[kind]++;
+        }
+    }
+
+    const Bindings& b = mBindings;
+    _glUseProgram((b.program == 0 || _glIsProgram(b.program)) ? b.program : 0);
+    context._current_program = b.traceProgram;
+    context.getUniformLocations(b.program);
+    if (context._profile >= PROFILE_ES3)
+    {
+        _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, b.drawFramebuffer);
+        _glBindFramebuffer(GL_READ_FRAMEBUFFER, b.readFramebuffer);
+        if (b.vertexArray == 0 || _glIsVertexArray(b.vertexArray))
+        {
+            _glBindVertexArray(b.vertexArray);
+        }
+    }
+    else
+    {
+        _glBindFramebuffer(GL_FRAMEBUFFER, b.drawFramebuffer);
+    }
+    context._current_framebuffer = b.traceFramebuffer;
+    if (b.arrayBuffer == 0 || _glIsBuffer(b.arrayBuffer))
+    {
+        _glBindBuffer(GL_ARRAY_BUFFER, b.arrayBuffer);
+    }
+    _glActiveTexture(b.activeTexture);
+}
+
+void LoopCheckpoint::store(Json::Value& result) const
+{
+    if (mRestores == 0)
+    {
+        return;
+    }
+    Json::Value v;
+    v["restores"] = mRestores;
+    for (int kind = 0; kind < KIND_COUNT; kind++)
+    {
+        v[kindNames[kind]] = (Json::Value::UInt64)mDeleted[kind];
+    }
+    result["loop_reset"] = v;
+}
+
+}
@@ -0,0 +1,62 @@
+#ifndef _RETRACER_LOOP_CHECKPOINT_HPP_
+#define _RETRACER_LOOP_CHECKPOINT_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <unordered_set>
+
+namespace retracer {
+
+class Context;
+
+/// Brings the GL objects and bindings back to where they were at the first measured frame
+/// before each -loop iteration, for -loopreset, so that every iteration starts from the same
+/// state instead of from wherever the previous one left it. Objects that the frame range
+/// created are deleted, so that their names are generated again by the next iteration
+/// instead of piling up, and the program, framebuffer, vertex array, array buffer and active
+/// texture bindings are restored.
+///
+/// The contents of the objects that already existed are not restored, which would take a
+/// copy of every texture and buffer, so a frame range that uploads into objects that it does
+/// not create still sees the uploads of the previous iteration.
+class LoopCheckpoint
+{
+public:
+    enum Kind { TEXTURE, BUFFER, FRAMEBUFFER, RENDERBUFFER, SAMPLER, PROGRAM, SHADER, QUERY, ARRAY, FEEDBACK, PIPELINE, KIND_COUNT };
+
+    /// Remember which names are alive in the context now
+    void capture(Context& context);
+    bool captured() const { return mContext != nullptr; }
+
+    /// Delete the objects created since the capture and rebind what was bound then
+    void restore(Context& context);
+
+    /// Add how many objects of each kind the restores deleted as "loop_reset" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    struct Bindings
+    {
+        int program;
+        int drawFramebuffer;
+        int readFramebuffer;
+        int vertexArray;
+        int arrayBuffer;
+        int activeTexture;
+        unsigned traceProgram; ///< trace names, as the context keeps them
+        unsigned traceFramebuffer;
+    };
+
+    void remove(Context& context, Kind kind, unsigned name);
+
+    Context* mContext = nullptr;
+    std::unordered_set<unsigned> mNames[KIND_COUNT]; ///< trace names alive at the capture
+    Bindings mBindings;
+    uint64_t mDeleted[KIND_COUNT] = {};
+    unsigned mRestores = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "retracer/loop_stats.hpp"
+
+#include "common/os_time.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+namespace retracer {
+
+void LoopStats::begin(int64_t now, size_t frames)
+{
+    mFrameTimes.clear();
+    mFrameTimes.reserve(std::min(frames, MAX_RESERVED_FRAMES));
+    mLast = now;
+}
+
+void LoopStats::end()
+{
+    Loop loop;
+    loop.frames = mFrameTimes.size();
+    if (!mFrameTimes.empty())
+    {
+        std::vector<int64_t> sorted(mFrameTimes);
+        std::sort(sorted.begin(), sorted.end());
+        const double tick = 1.0 / os::timeFrequency;
+        const auto percentile = [&](double fraction) {
+            const size_t index = std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()));
+            return sorted[index] * tick;
+        };
+        double sum = 0.0;
+        for (const int64_t t : sorted) sum += t * tick;
+        loop.mean = sum / sorted.size();
+        double squares = 0.0;
+        for (const int64_t t : sorted) squares += (t * tick - loop.mean) * (t * tick - loop.mean);
+        loop.stddev = sqrt(squares / sorted.size());
+        loop.p50 = percentile(0.5);
+        loop.p90 = percentile(0.9);
+        loop.p99 = percentile(0.99);
+        loop.max = sorted.back() * tick;
+        for (const int64_t t : sorted) loop.stutters += (t * tick > 2.0 * loop.p50);
+    }
+    mLoops.push_back(loop);
+    mFrameTimes.clear();
+    mLast = 0;
+}
+
+Json::Value LoopStats::toJson() const
+{
+    Json::Value loops = Json::arrayValue;
+    for (const Loop& loop : mLoops)
+    {
+        Json::Value v;
+        v["frames"] = loop.frames;
+        v["fps"] = loop.mean > 0.0 ? 1.0 / loop.mean : 0.0;
+        v["frame_time_mean"] = loop.mean;
+        v["frame_time_stddev"] = loop.stddev;
+        v["frame_time_p50"] = loop.p50;
+        v["frame_time_p90"] = loop.p90;
+        v["frame_time_p99"] = loop.p99;
+        v["frame_time_max"] = loop.max;
+        v["stutters"] = loop.stutters;
+        loops.append(v);
+    }
+    return loops;
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef _RETRACER_LOOP_STATS_HPP_
+#define _RETRACER_LOOP_STATS_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace retracer {
+
+/// Frame times of the measured frame range, kept for every loop of -loop and -looptime (or the
+/// one run without them), and summed up per loop in the result file.
+class LoopStats
+{
+public:
+    /// Frames a loop can hold without reallocating, whatever the frame range says
+    static const size_t MAX_RESERVED_FRAMES = 1 << 20;
+
+    /// Start a loop at the given time, in os::getTime() ticks
+    void begin(int64_t now, size_t frames);
+    /// A frame ended at the given time
+    inline void frame(int64_t now)
+    {
+        if (mLast)
+        {
+            mFrameTimes.push_back(now - mLast);
+        }
+        mLast = now;
+    }
+    /// Close the current loop and sum it up
+    void end();
+    /// Forget all loops, like the warm-up ones
+    void clear() { mLoops.clear(); }
+
+    /// Mean frame time of the last closed loop, in seconds
+    double lastMean() const { return mLoops.empty() ? 0.0 : mLoops.back().mean; }
+
+    Json::Value toJson() const;
+
+private:
+    struct Loop
+    {
+        unsigned frames = 0;
+        double mean = 0.0; ///< frame times in seconds
+        double stddev = 0.0;
+        double p50 = 0.0;
+        double p90 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+        unsigned stutters = 0; ///< frames that took more than twice the median
+    };
+
+    std::vector<int64_t> mFrameTimes; ///< of the current loop, in os::getTime() ticks
+    int64_t mLast = 0;
+    std::vector<Loop> mLoops;
+};
+
+}
+
+#endif
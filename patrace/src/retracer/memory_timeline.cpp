@@ -0,0 +1,89 @@
+#include "retracer/memory_timeline.hpp"
+
+#include "retracer/state.hpp"
+
+#include "common/memoryinfo.hpp"
+#include "common/os_time.hpp"
+
+namespace retracer {
+
+void MemoryTimeline::reserve(unsigned frames)
+{
+    mSamples.clear();
+    mSamples.reserve(frames);
+    for (uint64_t& last : mLast)
+    {
+        last = 0;
+    }
+    mLastTime = os::getTime();
+    mDropped = 0;
+}
+
+void MemoryTimeline::sample(unsigned frame, int64_t now, const uint64_t counters[4], Context* context, const StateMgr& state)
+{
+    if (mSamples.size() == mSamples.capacity())
+    {
+        mDropped++; // more frames than the header said, rather than allocating mid-frame
+        return;
+    }
+    Sample s;
+    s.frame = frame;
+    s.duration = (now - mLastTime) / (float)os::timeFrequency;
+    mLastTime = now;
+    for (int i = 0; i < 4; i++)
+    {
+        s.uploaded[i] = counters[i] - mLast[i];
+        mLast[i] = counters[i];
+    }
+    s.resident = MemoryInfo::getResidentMemory();
+    for (uint32_t& count : s.objects)
+    {
+        count = 0;
+    }
+    if (context)
+    {
+        // Name 0 maps to itself in every map, so it is not counted
+        s.objects[0] = context->getTextureMap().Count();
+        s.objects[1] = context->getBufferMap().Count();
+        s.objects[2] = context->getProgramMap().Count();
+        s.objects[3] = context->getShaderMap().Count();
+        s.objects[4] = context->getFramebufferMap().Count();
+        s.objects[5] = context->getRenderbufferMap().Count();
+    }
+    s.contexts = state.ContextCount();
+    s.surfaces = state.DrawableCount();
+    mSamples.push_back(s);
+}
+
+void MemoryTimeline::store(Json::Value& result, common::JsonColumns& columns) const
+{
+    if (mSamples.empty())
+    {
+        return;
+    }
+    static const char* uploadNames[4] = { "buffer_bytes", "texture_bytes", "compressed_texture_bytes", "client_side_bytes" };
+    static const char* objectNames[6] = { "textures", "buffers", "programs", "shaders", "framebuffers", "renderbuffers" };
+    const Sample* first = mSamples.data();
+    const size_t count = mSamples.size();
+    columns.add("memory_timeline", "frame", &first->frame, count, sizeof(Sample));
+    columns.add("memory_timeline", "frame_time", &first->duration, count, sizeof(Sample));
+    for (int i = 0; i < 4; i++)
+    {
+        columns.add("memory_timeline", uploadNames[i], &first->uploaded[i], count, sizeof(Sample));
+    }
+    columns.add("memory_timeline", "resident_bytes", &first->resident, count, sizeof(Sample));
+    for (int i = 0; i < 6; i++)
+    {
+        columns.add("memory_timeline", objectNames[i], &first->objects[i], count, sizeof(Sample));
+    }
+    columns.add("memory_timeline", "contexts", &first->contexts, count, sizeof(Sample));
+    columns.add("memory_timeline", "surfaces", &first->surfaces, count, sizeof(Sample));
+    Json::Value v = Json::objectValue;
+    if (mDropped)
+    {
+        v["dropped_frames"] = mDropped;
+    }
+    result["memory_timeline"] = v;
+}
+
+}
@@ -0,0 +1,53 @@
+#ifndef _RETRACER_MEMORY_TIMELINE_HPP_
+#define _RETRACER_MEMORY_TIMELINE_HPP_
+
+#include "common/json_stream.hpp"
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace retracer {
+
+class Context;
+class StateMgr;
+
+/// Samples memory use once per frame for -memtimeline: how much buffer, texture and client
+/// side data the frame uploaded, the resident memory of the process, and how many GL objects
+/// and EGL contexts and surfaces were alive at the end of it. The samples go into a buffer
+/// allocated up front for the number of frames in the trace, so taking them does not allocate.
+class MemoryTimeline
+{
+public:
+    /// Allocate room for the given number of frames, past which samples are dropped
+    void reserve(unsigned frames);
+    bool enabled() const { return mSamples.capacity() > 0; }
+
+    /// Sample the frame that just ended, at os::getTime() now, from the retracer upload counters
+    void sample(unsigned frame, int64_t now, const uint64_t counters[4], Context* context, const StateMgr& state);
+
+    /// Add the samples as "memory_timeline" to the result JSON, one array for each value, written
+    /// from the samples as the result is
+    void store(Json::Value& result, common::JsonColumns& columns) const;
+
+private:
+    struct Sample
+    {
+        unsigned frame;
+        float duration; ///< in seconds
+        uint64_t uploaded[4]; ///< buffer, texture, compressed texture and client side data, in bytes
+        uint64_t resident; ///< in bytes
+        uint32_t objects[6]; ///< textures, buffers, programs, shaders, framebuffers and renderbuffers
+        uint32_t contexts;
+        uint32_t surfaces;
+    };
+
+    std::vector<Sample> mSamples;
+    uint64_t mLast[4] = { 0, 0, 0, 0 }; ///< counters at the end of the previous frame
+    int64_t mLastTime = 0;
+    unsigned mDropped = 0;
+};
+
+}
+
+#endif
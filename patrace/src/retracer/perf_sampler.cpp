@@ -0,0 +1,258 @@
+#include "retracer/perf_sampler.hpp"
+
+#include "common/os.hpp"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if !defined(ANDROID)
+#include <linux/perf_event.h>
+#else
+#include "libcollector/collectors/perf_event.h"
+#endif
+
+namespace retracer {
+
+static const size_t RING_PAGES = 32; // data pages for each thread, a power of two
+
+static long perf_event_open(struct perf_event_attr* attr, pid_t pid, int cpu, int group_fd, unsigned long flags)
+{
+    attr->size = sizeof(*attr);
+    return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+int PerfSampler::open(int tid, int cpu, bool hardware, bool user)
+{
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.type = hardware ? PERF_TYPE_HARDWARE : PERF_TYPE_SOFTWARE;
+    pe.config = hardware ? (uint64_t)PERF_COUNT_HW_CPU_CYCLES : (uint64_t)PERF_COUNT_SW_CPU_CLOCK;
+    pe.sample_freq = mFrequency;
+    pe.freq = 1;
+    pe.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_PERIOD;
+    pe.inherit = 1; // threads created later write into the ring buffer of the event they inherit from
+    pe.exclude_kernel = user ? 1 : 0;
+    pe.exclude_hv = 1;
+    return perf_event_open(&pe, tid, cpu, -1, 0);
+}
+
+bool PerfSampler::start(unsigned frequency, const std::string& path)
+{
+    stop();
+    mFrequency = frequency;
+    mLost = 0;
+    mFrames.clear();
+
+    std::vector<int> tids;
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir)
+    {
+        DBG_LOG("Failed to list the threads to sample: %s\n", strerror(errno));
+        return false;
+    }
+    while (struct dirent* entry = readdir(dir))
+    {
+        if (entry->d_name[0] != '.')
+        {
+            tids.push_back(atoi(entry->d_name));
+        }
+    }
+    closedir(dir);
+
+    // Fall back to user space only, where the kernel is not to be sampled, and then to CPU time
+    int fd = -1;
+    bool user = false;
+    for (int attempt = 0; attempt < 4 && fd < 0; attempt++)
+    {
+        mCycles = attempt < 2;
+        user = attempt % 2 == 1;
+        fd = open(tids.at(0), 0, mCycles, user);
+    }
+    if (fd < 0)
+    {
+        DBG_LOG("Failed to open perf event for sampling: %s\n", strerror(errno));
+        return false;
+    }
+    ::close(fd);
+
+    // Inherited events can only be mapped for one CPU, and events can only share a ring buffer
+    // on the same CPU, so there is an event for each thread on each CPU and a buffer for each CPU
+    mRingSize = (RING_PAGES + 1) * sysconf(_SC_PAGESIZE);
+    const int cpus = sysconf(_SC_NPROCESSORS_CONF);
+    for (int cpu = 0; cpu < cpus; cpu++)
+    {
+        int owner = -1;
+        for (const int tid : tids)
+        {
+            Event event = { open(tid, cpu, mCycles, user), nullptr };
+            if (event.fd < 0)
+            {
+                continue; // the thread may have exited, or the CPU be offline
+            }
+            if (owner < 0)
+            {
+                event.ring = mmap(nullptr, mRingSize, PROT_READ | PROT_WRITE, MAP_SHARED, event.fd, 0);
+                if (event.ring == MAP_FAILED)
+                {
+                    DBG_LOG("Failed to map perf sample buffer of CPU %d: %s\n", cpu, strerror(errno));
+                    ::close(event.fd);
+                    close();
+                    return false;
+                }
+                owner = event.fd;
+            }
+            else if (ioctl(event.fd, PERF_EVENT_IOC_SET_OUTPUT, owner) == -1)
+            {
+                DBG_LOG("Failed to redirect perf samples of thread %d: %s\n", tid, strerror(errno));
+            }
+            mEvents.push_back(event);
+        }
+    }
+
+    mPath = path;
+    mFile = fopen(path.c_str(), "wb");
+    if (!mFile)
+    {
+        DBG_LOG("Failed to open %s for perf samples: %s\n", path.c_str(), strerror(errno));
+        close();
+        return false;
+    }
+    const FileHeader header = { { 'P', 'A', 'S', 'A', 'M', 'P', 'L', 'E' }, 1, mCycles ? 0u : 1u, mFrequency, 0 };
+    fwrite(&header, sizeof(header), 1, mFile);
+    DBG_LOG("Sampling %s of %d threads at %u Hz%s into %s\n", mCycles ? "CPU cycles" : "CPU time", (int)tids.size(),
+            mFrequency, user ? " in user space" : "", path.c_str());
+    return true;
+}
+
+void PerfSampler::frame(unsigned frame)
+{
+    if (!mFile)
+    {
+        return;
+    }
+    Frame f = { frame, 0, 0 };
+    for (const Event& event : mEvents)
+    {
+        if (event.ring)
+        {
+            read(event, f);
+        }
+    }
+    if (f.samples > 0)
+    {
+        mFrames.push_back(f);
+    }
+}
+
+void PerfSampler::read(const Event& event, Frame& f)
+{
+    struct perf_event_mmap_page* meta = static_cast<struct perf_event_mmap_page*>(event.ring);
+    const char* data = static_cast<const char*>(event.ring) + sysconf(_SC_PAGESIZE);
+    const uint64_t size = mRingSize - sysconf(_SC_PAGESIZE);
+    const uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = meta->data_tail;
+
+    char record[256];
+    while (tail < head)
+    {
+        struct perf_event_header header;
+        for (size_t i = 0; i < sizeof(header); i++)
+        {
+            ((char*)&header)[i] = data[(tail + i) % size];
+        }
+        if (header.size < sizeof(header) || header.size > sizeof(record))
+        {
+            break; // broken record, give up on the rest
+        }
+        for (size_t i = 0; i < header.size; i++)
+        {
+            record[i] = data[(tail + i) % size];
+        }
+        tail += header.size;
+
+        const uint64_t* values = reinterpret_cast<const uint64_t*>(record + sizeof(header));
+        if (header.type == PERF_RECORD_SAMPLE)
+        {
+            // In sample_type bit order: ip, pid and tid, time, period
+            const Sample sample = { values[2], values[0], values[3], (uint32_t)(values[1] >> 32), f.frame };
+            fwrite(&sample, sizeof(sample), 1, mFile);
+            f.samples++;
+            f.period += sample.period;
+        }
+        else if (header.type == PERF_RECORD_LOST)
+        {
+            mLost += values[1];
+        }
+    }
+    __atomic_store_n(&meta->data_tail, head, __ATOMIC_RELEASE);
+}
+
+void PerfSampler::stop()
+{
+    if (!mFile)
+    {
+        return;
+    }
+    for (const Event& event : mEvents)
+    {
+        ioctl(event.fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+    fclose(mFile);
+    mFile = nullptr;
+
+    std::ifstream maps("/proc/self/maps");
+    std::ofstream out(mPath + ".maps");
+    out << maps.rdbuf();
+    if (mLost > 0)
+    {
+        DBG_LOG("Lost %llu perf samples, the sample buffer filled up within a frame\n", (unsigned long long)mLost);
+    }
+    close();
+}
+
+void PerfSampler::close()
+{
+    for (const Event& event : mEvents)
+    {
+        if (event.ring)
+        {
+            munmap(event.ring, mRingSize);
+        }
+        ::close(event.fd);
+    }
+    mEvents.clear();
+}
+
+void PerfSampler::store(Json::Value& result) const
+{
+    if (mFrames.empty())
+    {
+        return;
+    }
+    Json::Value v;
+    v["event"] = mCycles ? "cycles" : "cpu-clock";
+    v["frequency"] = mFrequency;
+    v["file"] = mPath;
+    v["lost"] = (Json::Value::UInt64)mLost;
+    Json::Value frames = Json::arrayValue;
+    Json::Value samples = Json::arrayValue;
+    Json::Value period = Json::arrayValue;
+    for (const Frame& f : mFrames)
+    {
+        frames.append(f.frame);
+        samples.append(f.samples);
+        period.append((Json::Value::UInt64)f.period);
+    }
+    v["frames"] = frames;
+    v["samples"] = samples;
+    v["period"] = period;
+    result["perf_samples"] = v;
+}
+
+}
@@ -0,0 +1,86 @@
+#ifndef _RETRACER_PERF_SAMPLER_HPP_
+#define _RETRACER_PERF_SAMPLER_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace retracer {
+
+/// Samples where the retracer process spends its CPU time for -perf, with perf_event_open
+/// in the process itself instead of running the perf tool. It samples CPU cycles, or CPU time
+/// where there are no hardware counters, on every thread of the process, including threads
+/// created later. At each swap the samples taken since the previous one are read out of the
+/// ring buffers and written to the output file tagged with the frame that just ended.
+///
+/// The file starts with a FileHeader and has a Sample for each sample after it. The memory map
+/// of the process is written beside it with ".maps" appended to the name, to resolve the
+/// instruction pointers to symbols, including those of the driver.
+class PerfSampler
+{
+public:
+    struct FileHeader
+    {
+        char magic[8]; ///< "PASAMPLE"
+        uint32_t version;
+        uint32_t event; ///< 0 for CPU cycles, 1 for CPU time in nanoseconds
+        uint32_t frequency; ///< samples per second asked for on each thread
+        uint32_t reserved;
+    };
+
+    struct Sample
+    {
+        uint64_t time; ///< in nanoseconds, from the perf clock of the kernel
+        uint64_t ip;
+        uint64_t period; ///< cycles or nanoseconds since the previous sample of the thread
+        uint32_t tid;
+        uint32_t frame;
+    };
+
+    ~PerfSampler() { stop(); }
+
+    /// Returns false if sampling could not be set up, in which case nothing is sampled
+    bool start(unsigned frequency, const std::string& path);
+    bool running() const { return mFile != nullptr; }
+
+    /// Write out the samples taken since the last call, as samples of the given frame
+    void frame(unsigned frame);
+    void stop();
+
+    /// Add the sample counts of each frame as "perf_samples" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    struct Frame
+    {
+        unsigned frame;
+        uint32_t samples;
+        uint64_t period;
+    };
+
+    struct Event
+    {
+        int fd;
+        void* ring; ///< of the first event on each CPU, which the others on it write into
+    };
+
+    int open(int tid, int cpu, bool hardware, bool user);
+    void read(const Event& event, Frame& frame);
+    void close();
+
+    std::vector<Event> mEvents; ///< for each thread there was at the start on each CPU
+    size_t mRingSize = 0;
+    FILE* mFile = nullptr;
+    std::string mPath;
+    bool mCycles = true;
+    unsigned mFrequency = 0;
+    uint64_t mLost = 0;
+    std::vector<Frame> mFrames;
+};
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include "retracer/present_feedback.hpp"
+
+#include <algorithm>
+
+namespace retracer {
+
+unsigned PresentFeedback::swapped(unsigned frameNo, int64_t time)
+{
+    mPending.push_back({ frameNo, time, 0, 0, false, false });
+    if (mPending.size() > MAX_PENDING)
+    {
+        mPending.pop_front();
+        mFirstId++;
+        mUnanswered++;
+        retire(); // the frames after it may have been waiting for it
+    }
+    return mFirstId + mPending.size() - 1;
+}
+
+PresentFeedback::Frame* PresentFeedback::find(unsigned id)
+{
+    if (id < mFirstId || id - mFirstId >= mPending.size())
+    {
+        return nullptr; // given up on already
+    }
+    return &mPending[id - mFirstId];
+}
+
+void PresentFeedback::presented(unsigned id, int64_t time, uint64_t msc, int64_t refresh)
+{
+    Frame* frame = find(id);
+    if (!frame)
+    {
+        return;
+    }
+    frame->present = time;
+    frame->msc = msc;
+    frame->done = true;
+    if (refresh > 0)
+    {
+        mRefresh = refresh;
+    }
+    retire();
+}
+
+void PresentFeedback::discarded(unsigned id)
+{
+    Frame* frame = find(id);
+    if (!frame)
+    {
+        return;
+    }
+    frame->discarded = true;
+    frame->done = true;
+    retire();
+}
+
+void PresentFeedback::retire()
+{
+    while (!mPending.empty() && mPending.front().done)
+    {
+        const Frame& frame = mPending.front();
+        if (frame.discarded)
+        {
+            mDiscarded++;
+        }
+        else
+        {
+            if (frame.msc > 0 && mLastMsc > 0 && frame.msc > mLastMsc + 1)
+            {
+                mMissedVblanks += frame.msc - mLastMsc - 1;
+            }
+            mLastMsc = frame.msc;
+            mFrames.push_back(frame.frameNo);
+            mPresentTime.push_back(frame.present);
+            mPresent.push_back((frame.present - frame.swap) / 1000000000.0f);
+            mMsc.push_back(frame.msc);
+        }
+        mPending.pop_front();
+        mFirstId++;
+    }
+}
+
+void PresentFeedback::store(Json::Value& result) const
+{
+    if (!mEnabled)
+    {
+        return;
+    }
+    Json::Value v;
+    v["frames"] = (unsigned)mFrames.size();
+    v["discarded"] = mDiscarded;
+    v["unanswered"] = mUnanswered + (unsigned)mPending.size();
+    v["missed_vblanks"] = (Json::Value::UInt64)mMissedVblanks;
+    v["refresh"] = mRefresh / 1000000000.0;
+    Json::Value frames = Json::arrayValue;
+    Json::Value present = Json::arrayValue;
+    Json::Value msc = Json::arrayValue;
+    std::vector<int64_t> intervals;
+    for (size_t i = 0; i < mFrames.size(); i++)
+    {
+        frames.append(mFrames[i]);
+        present.append(mPresent[i]);
+        msc.append((Json::Value::UInt64)mMsc[i]);
+        if (i > 0)
+        {
+            intervals.push_back(mPresentTime[i] - mPresentTime[i - 1]);
+        }
+    }
+    v["frame"] = frames;
+    v["present"] = present;
+    v["msc"] = msc;
+    if (!intervals.empty())
+    {
+        std::sort(intervals.begin(), intervals.end());
+        int64_t sum = 0;
+        for (const int64_t t : intervals) sum += t;
+        v["present_interval_mean"] = sum / 1000000000.0 / intervals.size();
+        v["present_interval_p50"] = intervals[intervals.size() / 2] / 1000000000.0;
+        v["present_interval_p99"] = intervals[std::min(intervals.size() - 1, intervals.size() * 99 / 100)] / 1000000000.0;
+        v["present_interval_max"] = intervals.back() / 1000000000.0;
+    }
+    result["present_feedback"] = v;
+}
+
+}
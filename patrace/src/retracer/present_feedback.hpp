@@ -0,0 +1,75 @@
+#ifndef _RETRACER_PRESENT_FEEDBACK_HPP_
+#define _RETRACER_PRESENT_FEEDBACK_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+namespace retracer {
+
+/// Collects the presentation feedback of the window system for the frames of the retraced thread
+/// for -presentfeedback: wp_presentation on Wayland and the Present extension on X11. The GLWS
+/// windows report each swap and, a few frames later, when the frame was presented and at which
+/// vblank, or that the compositor discarded it without showing it. From that come the frames that
+/// were never shown and the vblanks a frame stayed on screen for longer than one, which the CPU
+/// side frame times cannot tell.
+///
+/// Feedback may come in any order, but frames are retired in the order they were swapped. Times
+/// are in nanoseconds of the clock the window system presents with, which the windows also take
+/// the swap times from.
+class PresentFeedback
+{
+public:
+    /// Frames waiting for feedback before the oldest are given up on
+    static const size_t MAX_PENDING = 64;
+
+    void setEnabled(bool enabled) { mEnabled = enabled; }
+    bool enabled() const { return mEnabled; }
+
+    /// The frame is about to be swapped, returns the id to report its feedback with
+    unsigned swapped(unsigned frameNo, int64_t time);
+    /// The frame was presented at the given time and vblank counter, msc being zero if the window
+    /// system does not count vblanks. refresh is the display refresh interval, or zero if unknown.
+    void presented(unsigned id, int64_t time, uint64_t msc, int64_t refresh);
+    /// The frame was never shown
+    void discarded(unsigned id);
+
+    /// Add the present times of the frames, in seconds from their swaps, and the discarded frames
+    /// and missed vblanks as "present_feedback" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    struct Frame
+    {
+        unsigned frameNo;
+        int64_t swap;
+        int64_t present;
+        uint64_t msc;
+        bool done;
+        bool discarded;
+    };
+
+    Frame* find(unsigned id);
+    /// Move the frames at the front of mPending that have their feedback to the columns
+    void retire();
+
+    bool mEnabled = false;
+    std::deque<Frame> mPending;
+    unsigned mFirstId = 0; ///< of mPending.front()
+    uint64_t mLastMsc = 0; ///< of the last frame retired
+    int64_t mRefresh = 0;
+
+    unsigned mDiscarded = 0;
+    unsigned mUnanswered = 0; ///< given up on without feedback
+    uint64_t mMissedVblanks = 0; ///< vblanks a frame was shown for beyond the first
+    std::vector<unsigned> mFrames;
+    std::vector<int64_t> mPresentTime; ///< for the intervals between frames
+    std::vector<float> mPresent; ///< in seconds from the swap
+    std::vector<uint64_t> mMsc;
+};
+
+}
+
+#endif
@@ -0,0 +1,212 @@
+#include "retracer/present_timer.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "common/os.hpp"
+
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+// EGL_ANDROID_get_frame_timestamps and EGL_ANDROID_presentation_time, for EGL headers without them
+#ifndef EGL_TIMESTAMPS_ANDROID
+#define EGL_TIMESTAMPS_ANDROID 0x3430
+#define EGL_COMPOSITE_DEADLINE_ANDROID 0x3431
+#define EGL_COMPOSITE_INTERVAL_ANDROID 0x3432
+#define EGL_COMPOSITE_TO_PRESENT_LATENCY_ANDROID 0x3433
+#define EGL_RENDERING_COMPLETE_TIME_ANDROID 0x3435
+#define EGL_COMPOSITION_LATCH_TIME_ANDROID 0x3436
+#define EGL_DISPLAY_PRESENT_TIME_ANDROID 0x343A
+#define EGL_TIMESTAMP_PENDING_ANDROID (-2)
+#define EGL_TIMESTAMP_INVALID_ANDROID (-1)
+#endif
+
+namespace retracer {
+
+namespace {
+
+typedef EGLBoolean (EGLAPIENTRYP GetNextFrameIdProc)(EGLDisplay dpy, EGLSurface surface, uint64_t* frameId);
+typedef EGLBoolean (EGLAPIENTRYP GetCompositorTimingProc)(EGLDisplay dpy, EGLSurface surface, EGLint numTimestamps, const EGLint* names, int64_t* values);
+typedef EGLBoolean (EGLAPIENTRYP GetFrameTimestampsProc)(EGLDisplay dpy, EGLSurface surface, uint64_t frameId, EGLint numTimestamps, const EGLint* timestamps, int64_t* values);
+typedef EGLBoolean (EGLAPIENTRYP PresentationTimeProc)(EGLDisplay dpy, EGLSurface surface, int64_t time);
+
+GetNextFrameIdProc getNextFrameId = nullptr;
+GetCompositorTimingProc getCompositorTiming = nullptr;
+GetFrameTimestampsProc getFrameTimestamps = nullptr;
+PresentationTimeProc presentationTime = nullptr;
+
+const EGLint frameTimestamps[] = { EGL_RENDERING_COMPLETE_TIME_ANDROID, EGL_COMPOSITION_LATCH_TIME_ANDROID, EGL_DISPLAY_PRESENT_TIME_ANDROID };
+const EGLint compositorTiming[] = { EGL_COMPOSITE_DEADLINE_ANDROID, EGL_COMPOSITE_INTERVAL_ANDROID, EGL_COMPOSITE_TO_PRESENT_LATENCY_ANDROID };
+
+int64_t monotonicNs()
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * 1000000000LL + tp.tv_nsec;
+}
+
+float sinceSwap(int64_t t, int64_t swap)
+{
+    return t > 0 ? (t - swap) / 1000000000.0f : -1.0f;
+}
+
+}
+
+void PresentTimer::beforeSwap(EGLDisplay display, EGLSurface surface, unsigned frameNo)
+{
+    if (display != mDisplay)
+    {
+        const char* extensions = _eglQueryString(display, EGL_EXTENSIONS);
+        const bool timestamps = extensions && strstr(extensions, "EGL_ANDROID_get_frame_timestamps");
+        const bool presentation = extensions && strstr(extensions, "EGL_ANDROID_presentation_time");
+        if (timestamps)
+        {
+            getNextFrameId = (GetNextFrameIdProc)_eglGetProcAddress("eglGetNextFrameIdANDROID");
+            getCompositorTiming = (GetCompositorTimingProc)_eglGetProcAddress("eglGetCompositorTimingANDROID");
+            getFrameTimestamps = (GetFrameTimestampsProc)_eglGetProcAddress("eglGetFrameTimestampsANDROID");
+        }
+        if (presentation)
+        {
+            presentationTime = (PresentationTimeProc)_eglGetProcAddress("eglPresentationTimeANDROID");
+        }
+        if (!getNextFrameId || !getCompositorTiming || !getFrameTimestamps)
+        {
+            DBG_LOG("EGL_ANDROID_get_frame_timestamps is not supported, present times are not recorded\n");
+            mEnabled = false;
+            return;
+        }
+        if (mVsync && !presentationTime)
+        {
+            DBG_LOG("EGL_ANDROID_presentation_time is not supported, frames are not given vsync aligned presentation times\n");
+            mVsync = false;
+        }
+        mDisplay = display;
+        mSurface = EGL_NO_SURFACE;
+    }
+    if (surface != mSurface)
+    {
+        // the frames of the previous surface cannot be queried any more once it is destroyed
+        poll(true);
+        if (!_eglSurfaceAttrib(display, surface, EGL_TIMESTAMPS_ANDROID, EGL_TRUE))
+        {
+            DBG_LOG("Failed to enable frame timestamps on the surface: 0x%04x\n", _eglGetError());
+            mEnabled = false;
+            return;
+        }
+        mSurface = surface;
+        mLastTarget = 0;
+    }
+
+    poll(false);
+
+    Frame frame;
+    frame.frameNo = frameNo;
+    frame.target = 0;
+    if (!getNextFrameId(mDisplay, mSurface, &frame.id))
+    {
+        return;
+    }
+    int64_t timing[3] = {};
+    if (getCompositorTiming(mDisplay, mSurface, 3, compositorTiming, timing))
+    {
+        mVsyncInterval = timing[1];
+        if (mVsync && timing[0] > 0 && timing[1] > 0)
+        {
+            frame.target = std::max(timing[0] + timing[2], mLastTarget + timing[1]);
+            presentationTime(mDisplay, mSurface, frame.target);
+            mLastTarget = frame.target;
+        }
+    }
+    frame.swap = monotonicNs();
+    mPending.push_back(frame);
+    if (mPending.size() > MAX_PENDING)
+    {
+        mPending.pop_front();
+        mDropped++;
+    }
+}
+
+void PresentTimer::poll(bool all)
+{
+    while (!mPending.empty())
+    {
+        const Frame& frame = mPending.front();
+        int64_t t[3] = {};
+        if (getFrameTimestamps(mDisplay, mSurface, frame.id, 3, frameTimestamps, t))
+        {
+            const bool pending = (t[0] == EGL_TIMESTAMP_PENDING_ANDROID || t[1] == EGL_TIMESTAMP_PENDING_ANDROID || t[2] == EGL_TIMESTAMP_PENDING_ANDROID);
+            if (pending && !all)
+            {
+                return; // frames are presented in order, so the later ones are not ready either
+            }
+            if (!pending)
+            {
+                mFrames.push_back(frame.frameNo);
+                mPresentTime.push_back(t[2]);
+                mGpuComplete.push_back(sinceSwap(t[0], frame.swap));
+                mLatch.push_back(sinceSwap(t[1], frame.swap));
+                mPresent.push_back(sinceSwap(t[2], frame.swap));
+                mLate += (frame.target > 0 && t[2] > frame.target + mVsyncInterval / 2); // not presented at all counts as late too
+                mPending.pop_front();
+                continue;
+            }
+        }
+        mPending.pop_front(); // too old, surface gone, or given up on at the end
+        mDropped++;
+    }
+}
+
+void PresentTimer::store(Json::Value& result)
+{
+    if (mDisplay == EGL_NO_DISPLAY)
+    {
+        return;
+    }
+    if (mEnabled && mSurface != EGL_NO_SURFACE)
+    {
+        poll(true);
+    }
+    Json::Value v;
+    v["frames"] = (unsigned)mFrames.size();
+    v["dropped"] = mDropped;
+    v["vsync"] = mVsync;
+    v["vsync_interval"] = mVsyncInterval / 1000000000.0;
+    if (mVsync)
+    {
+        v["late"] = mLate;
+    }
+    Json::Value frames = Json::arrayValue;
+    Json::Value gpuComplete = Json::arrayValue;
+    Json::Value latch = Json::arrayValue;
+    Json::Value present = Json::arrayValue;
+    std::vector<int64_t> intervals;
+    for (size_t i = 0; i < mFrames.size(); i++)
+    {
+        frames.append(mFrames[i]);
+        gpuComplete.append(mGpuComplete[i]);
+        latch.append(mLatch[i]);
+        present.append(mPresent[i]);
+        if (i > 0 && mPresentTime[i] > 0 && mPresentTime[i - 1] > 0)
+        {
+            intervals.push_back(mPresentTime[i] - mPresentTime[i - 1]);
+        }
+    }
+    v["frame"] = frames;
+    v["gpu_complete"] = gpuComplete;
+    v["latch"] = latch;
+    v["present"] = present;
+    if (!intervals.empty())
+    {
+        std::sort(intervals.begin(), intervals.end());
+        int64_t sum = 0;
+        for (const int64_t t : intervals) sum += t;
+        v["present_interval_mean"] = sum / 1000000000.0 / intervals.size();
+        v["present_interval_p50"] = intervals[intervals.size() / 2] / 1000000000.0;
+        v["present_interval_p99"] = intervals[std::min(intervals.size() - 1, intervals.size() * 99 / 100)] / 1000000000.0;
+        v["present_interval_max"] = intervals.back() / 1000000000.0;
+    }
+    result["present_timing"] = v;
+}
+
+}
@@ -0,0 +1,76 @@
+#ifndef _RETRACER_PRESENT_TIMER_HPP_
+#define _RETRACER_PRESENT_TIMER_HPP_
+
+#include "dispatch/eglimports.hpp"
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+namespace retracer {
+
+/// Records when the compositor actually latched and presented each frame of the retraced thread
+/// for -presenttimes, and when the GPU finished rendering it, with EGL_ANDROID_get_frame_timestamps.
+/// Frame times taken on the CPU around eglSwapBuffers do not show what the compositor did with the
+/// frames, such as frames presented late or dropped. The timestamps of a frame only become
+/// available a few frames after its swap, so pending frames are polled before every swap and once
+/// more when the results are stored.
+///
+/// With -presentvsync, each frame is also given a presentation time with
+/// EGL_ANDROID_presentation_time: the first vsync the compositor can still make, going by its own
+/// deadline and latency, and never the same vsync as the frame before. The display then shows
+/// every frame for at least a vsync, and queueing buffers paces the replay to vsync.
+///
+/// Times are kept in CLOCK_MONOTONIC nanoseconds, as the extensions report them, and stored in seconds.
+class PresentTimer
+{
+public:
+    /// Frames waiting for their timestamps before the oldest are given up on
+    static const size_t MAX_PENDING = 64;
+
+    /// Record the frames from now on, and give them presentation times if vsync is set
+    void setEnabled(bool vsync) { mEnabled = true; mVsync = vsync; }
+    bool enabled() const { return mEnabled; }
+
+    /// Just before the given frame is swapped on the surface. Disables itself if the display does
+    /// not support the extensions.
+    void beforeSwap(EGLDisplay display, EGLSurface surface, unsigned frameNo);
+
+    /// Add the timestamps of each frame, in seconds from its swap, and a summary of them as
+    /// "present_timing" to the result JSON
+    void store(Json::Value& result);
+
+private:
+    struct Frame
+    {
+        unsigned frameNo;
+        uint64_t id; ///< from eglGetNextFrameIdANDROID
+        int64_t swap; ///< when eglSwapBuffers was called
+        int64_t target; ///< presentation time given to it, or zero
+    };
+
+    /// Move the frames whose timestamps have come from mPending to the columns. With all, the
+    /// frames still pending are given up on.
+    void poll(bool all);
+
+    bool mEnabled = false;
+    bool mVsync = false;
+    EGLDisplay mDisplay = EGL_NO_DISPLAY;
+    EGLSurface mSurface = EGL_NO_SURFACE; ///< timestamps are enabled on this surface
+    std::deque<Frame> mPending;
+    int64_t mLastTarget = 0; ///< presentation time given to the previous frame
+    int64_t mVsyncInterval = 0; ///< as the compositor last reported it
+
+    unsigned mDropped = 0; ///< frames whose timestamps never came, or were invalid
+    unsigned mLate = 0; ///< with -presentvsync, frames presented after the time they were given
+    std::vector<unsigned> mFrames;
+    std::vector<int64_t> mPresentTime; ///< for the intervals between frames
+    std::vector<float> mGpuComplete; ///< the columns, in seconds from the swap, -1 where the driver had no time
+    std::vector<float> mLatch;
+    std::vector<float> mPresent;
+};
+
+}
+
+#endif
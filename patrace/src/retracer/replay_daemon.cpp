@@ -0,0 +1,279 @@
+#include "retracer/replay_daemon.hpp"
+
+#include "common/os.hpp"
+#include "common/os_time.hpp"
+#include "jsoncpp/include/json/reader.h"
+#include "jsoncpp/include/json/writer.h"
+
+#include <errno.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+
+namespace retracer {
+
+namespace {
+
+bool sendLine(int fd, const std::string& line)
+{
+    size_t sent = 0;
+    while (sent < line.size())
+    {
+        // no SIGPIPE if the client went away, that only ends its connection
+        const ssize_t n = send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool validResultName(const std::string& name)
+{
+    return !name.empty() && name.find('/') == std::string::npos && name.find("..") == std::string::npos;
+}
+
+Json::Value error(const std::string& message)
+{
+    Json::Value reply;
+    reply["status"] = "error";
+    reply["error"] = message;
+    return reply;
+}
+
+}
+
+ReplayDaemon::ReplayDaemon(const std::string& traceDir, const std::string& resultDir)
+    : mTraceDir(traceDir)
+    , mResultDir(resultDir)
+{
+}
+
+ReplayDaemon::~ReplayDaemon()
+{
+    while (!mWarm.empty())
+    {
+        drop(mWarm.begin()->first);
+    }
+    if (mListenFd >= 0)
+    {
+        close(mListenFd);
+    }
+}
+
+bool ReplayDaemon::listen(const std::string& address, int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+    {
+        DBG_LOG("Not an IPv4 address to listen on: %s\n", address.c_str());
+        return false;
+    }
+    mListenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (mListenFd < 0)
+    {
+        DBG_LOG("Failed to create the daemon socket: %s\n", strerror(errno));
+        return false;
+    }
+    const int reuse = 1;
+    setsockopt(mListenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(mListenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(mListenFd, 1) != 0)
+    {
+        DBG_LOG("Failed to listen on %s port %d: %s\n", address.c_str(), port, strerror(errno));
+        close(mListenFd);
+        mListenFd = -1;
+        return false;
+    }
+    DBG_LOG("Waiting for replay requests on %s port %d\n", address.c_str(), port);
+    return true;
+}
+
+std::string ReplayDaemon::tracePath(const std::string& file) const
+{
+    return (!file.empty() && file[0] == '/') ? file : mTraceDir + "/" + file;
+}
+
+bool ReplayDaemon::warm(const std::string& path, std::string& error)
+{
+    if (mWarm.count(path))
+    {
+        return true;
+    }
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        error = "Failed to open " + path;
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    // The mapping holds on to the pages the replay reads the trace through, and asks for all
+    // of them to be read ahead now rather than when the replay gets to them
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        error = "Failed to map " + path + ": " + strerror(errno);
+        return false;
+    }
+    madvise(data, st.st_size, MADV_WILLNEED);
+    mWarm[path] = { data, (size_t)st.st_size };
+    DBG_LOG("Keeping %s warm, %llu MB\n", path.c_str(), (unsigned long long)(st.st_size >> 20));
+    return true;
+}
+
+void ReplayDaemon::drop(const std::string& path)
+{
+    auto it = mWarm.find(path);
+    if (it != mWarm.end())
+    {
+        munmap(it->second.data, it->second.size);
+        mWarm.erase(it);
+    }
+}
+
+bool ReplayDaemon::handle(const std::string& line, const RunFunc& run, Json::Value& reply)
+{
+    Json::Value request;
+    Json::Reader reader;
+    if (!reader.parse(line, request) || !request.isObject())
+    {
+        reply = error("Not a JSON object: " + reader.getFormattedErrorMessages());
+        return true;
+    }
+
+    const std::string command = request.get("command", "").asString();
+    std::string message;
+    if (command == "quit")
+    {
+        reply["status"] = "ok";
+        return false;
+    }
+    else if (command == "status")
+    {
+        reply["status"] = "ok";
+        reply["requests"] = mRequests;
+        Json::Value traces = Json::arrayValue;
+        for (const auto& warmTrace : mWarm)
+        {
+            traces.append(warmTrace.first);
+        }
+        reply["warm"] = traces;
+    }
+    else if (command == "warm")
+    {
+        if (warm(tracePath(request.get("file", "").asString()), message))
+        {
+            reply["status"] = "ok";
+        }
+        else
+        {
+            reply = error(message);
+        }
+    }
+    else if (command == "drop")
+    {
+        drop(tracePath(request.get("file", "").asString()));
+        reply["status"] = "ok";
+    }
+    else if (!command.empty())
+    {
+        reply = error("Unknown command " + command);
+    }
+    else if (!request.isMember("file"))
+    {
+        reply = error("No trace file given");
+    }
+    else if (request.isMember("resultFile") && !validResultName(request["resultFile"].asString()))
+    {
+        // Clients may only write into the result directory
+        reply = error("The result file must be a file name in the result directory: " + request["resultFile"].asString());
+    }
+    else
+    {
+        // Mapping fails for the same reasons opening does, which the replay reports itself
+        warm(tracePath(request["file"].asString()), message);
+        const std::string resultFile = mResultDir + "/" + request.get("resultFile", "daemon_" + std::to_string(mRequests) + ".json").asString();
+        mRequests++;
+        const int64_t begin = os::getTime();
+        const bool ok = run(request, resultFile);
+        const double seconds = (os::getTime() - begin) / (double)os::timeFrequency;
+
+        Json::Value result;
+        std::ifstream in(resultFile);
+        if (!in || !reader.parse(in, result))
+        {
+            reply = error("No result in " + resultFile);
+        }
+        else if (!ok || result.isMember("error_description"))
+        {
+            reply = error(result.get("error_description", Json::arrayValue).get(0u, "Failed").asString());
+            reply["result"] = result;
+        }
+        else
+        {
+            reply["status"] = "ok";
+            reply["result"] = result;
+        }
+        reply["seconds"] = seconds;
+        reply["resultFile"] = resultFile;
+    }
+    return true;
+}
+
+void ReplayDaemon::serve(const RunFunc& run)
+{
+    Json::FastWriter writer;
+    bool quit = false;
+    while (!quit)
+    {
+        const int fd = accept(mListenFd, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno == EINTR) continue;
+            DBG_LOG("Failed to accept a client: %s\n", strerror(errno));
+            return;
+        }
+        DBG_LOG("Client connected\n");
+        std::string buffer;
+        char chunk[4096];
+        while (!quit)
+        {
+            const size_t eol = buffer.find('\n');
+            if (eol == std::string::npos)
+            {
+                const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                buffer.append(chunk, n);
+                continue;
+            }
+            const std::string line = buffer.substr(0, eol);
+            buffer.erase(0, eol + 1);
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue;
+            }
+            Json::Value reply;
+            quit = !handle(line, run, reply);
+            if (!sendLine(fd, writer.write(reply)))
+            {
+                break;
+            }
+        }
+        close(fd);
+        DBG_LOG("Client disconnected\n");
+    }
+}
+
+}
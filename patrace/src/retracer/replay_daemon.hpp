@@ -0,0 +1,65 @@
+#ifndef _RETRACER_REPLAY_DAEMON_HPP_
+#define _RETRACER_REPLAY_DAEMON_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace retracer {
+
+/// Serves replay requests from a socket for -daemon, so that a test harness can run trace after
+/// trace without paying for starting the retracer, registering the entry points, creating the
+/// display and loading the shader cache every time. Calls still have to be replayed from the
+/// start of a trace, but the traces asked for are kept mapped so that their pages stay cached.
+///
+/// One client is served at a time. Requests and replies are lines of JSON. A request is either
+/// the parameters of a replay, as for -jsonParameters, or a command:
+///   {"command": "warm", "file": ...}  map a trace ahead of replaying it
+///   {"command": "drop", "file": ...}  unmap a trace
+///   {"command": "status"}             list the traces that are mapped
+///   {"command": "quit"}               stop serving
+/// A replay is answered with {"status": "ok", "seconds": ..., "result": ...}, the result being
+/// what was written to its result file, and a failure with {"status": "error", "error": ...}.
+class ReplayDaemon
+{
+public:
+    /// Replay with the given parameters, writing the result to resultFile. Returns false if the
+    /// trace could not be opened.
+    typedef std::function<bool(const Json::Value& request, const std::string& resultFile)> RunFunc;
+
+    ReplayDaemon(const std::string& traceDir, const std::string& resultDir);
+    ~ReplayDaemon();
+
+    /// Listen on the TCP port of the given IPv4 address. Requests are not authenticated, so this
+    /// should stay the loopback address unless the network is trusted.
+    bool listen(const std::string& address, int port);
+
+    /// Serve clients until one sends quit
+    void serve(const RunFunc& run);
+
+private:
+    struct WarmTrace
+    {
+        void* data;
+        size_t size;
+    };
+
+    /// Handle one request line, returns false on quit
+    bool handle(const std::string& line, const RunFunc& run, Json::Value& reply);
+    std::string tracePath(const std::string& file) const;
+    bool warm(const std::string& path, std::string& error);
+    void drop(const std::string& path);
+
+    std::string mTraceDir;
+    std::string mResultDir;
+    int mListenFd = -1;
+    unsigned mRequests = 0;
+    std::map<std::string, WarmTrace> mWarm; ///< by path
+};
+
+}
+
+#endif
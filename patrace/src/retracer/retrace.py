@@ -1,4 +1,5 @@
 import os.path
+import re
 import sys
 import argparse
 
@@ -49,6 +50,45 @@ shadercache_funcs = [
     'glCompileShader', 'glAttachShader', 'glShaderSource', 'glGetShaderInfoLog', 'glGetShaderiv'
 ]
 
+# Uniform setters that -filterstate skips when they would not change the value
+uniform_setter = re.compile(r'^gl(Program)?Uniform([1-4](f|i|ui)v?|Matrix[2-4](x[2-4])?fv)(EXT)?$')
+
+
+def stateFilterCall(func):
+    """ The StateFilter call that tells if func can be skipped, or None if it is never filtered """
+    if func.name == 'glActiveTexture':
+        return 'activeTexture(texture)'
+    elif func.name == 'glBindTexture':
+        return 'bindTexture(target, textureNew)'
+    elif func.name == 'glUseProgram':
+        return 'useProgram(programNew)'
+    elif func.name in ['glEnable', 'glDisable']:
+        return 'enable(cap, %s)' % ('true' if func.name == 'glEnable' else 'false')
+    elif uniform_setter.match(func.name):
+        values = func.args[-1].name
+        transpose = ', transpose' if 'transpose' in func.argNames() else ''
+        if func.name.endswith('v') or func.name.endswith('vEXT'):
+            return 'uniform("%s", programNew, locationNew, %s, %s.cnt * sizeof(*%s.v)%s)' % (func.name, values, values, values, transpose)
+        return 'uniform("%s", programNew, locationNew, _values, sizeof(_values))' % func.name
+    return None
+
+def uniformBatchCall(func):
+    """ The UniformBatch call that collects func for -batchuniforms, or None if it is not a uniform setter """
+    m = uniform_setter.match(func.name)
+    if not m or m.group(5):
+        return None # the EXT variants are left alone, since they are applied without them
+    body = m.group(2)
+    if body.startswith('Matrix'):
+        kind = 'MAT' + body[len('Matrix'):-len('fv')].upper()
+    else:
+        kind = {'f': 'FLOAT', 'i': 'INT', 'ui': 'UINT'}[m.group(3)] + body[0]
+    program = 'programNew' if m.group(1) else '0'
+    transpose = 'transpose' if 'transpose' in func.argNames() else 'GL_FALSE'
+    if body.endswith('v'):
+        values = func.args[-1].name
+        return 'add(UniformBatch::%s, %s, locationNew, count, %s, %s, %s.cnt * sizeof(*%s.v))' % (kind, program, transpose, values, values, values)
+    return 'add(UniformBatch::%s, %s, locationNew, 1, %s, _values, sizeof(_values))' % (kind, program, transpose)
+
 # Filled out in main()
 reverse_lookup_maps = set(["program", "shader" ,"pipeline", "texture", "buffer"])
 
@@ -90,6 +130,9 @@ def _lookupHandle(handle, value, function, member):
 
 
 def lookupHandle(handle, value, function):
+    if handle.name == 'uniformLocation':
+        key_name, key_type = handle.key
+        return "context.getUniformLocations(%s).%s(%s)" % (key_name + 'New', function, value)
     if handle.name in maps_with_getters:
         member = 'get{name}Map()'.format(name=handle.name.capitalize())
     else:
@@ -111,6 +154,37 @@ def reverseLookupHandle(handle, value, function):
     return _lookupHandle(handle, value, function, member)
 
 
+def fixedType(ty):
+    """ The type that DeserializeVisitor reads a fixed size argument of type ty into, or None """
+    if isinstance(ty, (stdapi.Const, stdapi.Alias, stdapi.Handle, stdapi.Bitmask)):
+        return fixedType(ty.type)
+    elif isinstance(ty, stdapi.Enum):
+        return 'int'
+    elif isinstance(ty, stdapi.Literal):
+        return str(ty)
+    return None
+
+
+def fixedArgs(func):
+    """ (type, name) of every argument and the return value of func if they are all of fixed
+    size, so that they can be read at once, or None """
+    if (func.name in stdapi.compressed_texture_function_names or
+        func.name in stdapi.compressed_sub_texture_function_names):
+        return None
+    fixed = []
+    for arg in func.args:
+        ty = fixedType(arg.type)
+        if arg.output or ty is None:
+            return None
+        fixed.append((ty, arg.name))
+    if func.type is not stdapi.Void:
+        ty = fixedType(func.type)
+        if ty is None:
+            return None
+        fixed.append((ty, 'old_ret'))
+    return fixed if len(fixed) > 1 else None
+
+
 class DeserializeVisitor(stdapi.Visitor):
     def visitVoid(self, void, arg, name, func):
         pass
@@ -149,7 +223,7 @@ class DeserializeVisitor(stdapi.Visitor):
 
     def visitBlob(self, blob, arg, name, func, indent=4):
         print ' ' * indent + 'Array<char> %s; // blob' % (name)
-        print ' ' * indent + '_src = Read1DArray(_src, %s);' % (name)
+        print ' ' * indent + '_src = gRetracer.mFile.blobStore().read(_src, %s);' % (name)
 
     def visitEnum(self, enum, arg, name, func):
         print '    int %s; // enum' % (name)
@@ -200,6 +274,7 @@ class DeserializeVisitor(stdapi.Visitor):
         if func.name in stdapi.texture_function_names:
             print '    GLvoid* %s = NULL;' % (name)
             print '    Array<char> %sBlob;' % (name)
+            print '    bool %sFromBlob = false;' % (name)
             print '    if (gRetracer.getFileFormatVersion() <= HEADER_VERSION_3)'
             print '    {'
             print '        _src = Read1DArray(_src, %sBlob);' % (name)
@@ -212,8 +287,9 @@ class DeserializeVisitor(stdapi.Visitor):
             print '        switch (_opaque_type)'
             print '        {'
             print '        case BlobType:'
-            print '            _src = Read1DArray(_src, %sBlob);' % (name)
+            print '            _src = gRetracer.mFile.blobStore().read(_src, %sBlob);' % (name)
             print '            %s = %sBlob.v;' % (name, name)
+            print '            %sFromBlob = true;' % (name)
             print '            break;'
             print '        case BufferObjectReferenceType:'
             print '            unsigned int bufferOffset = 0;'
@@ -514,6 +590,16 @@ class Retracer(object):
         #    print '    unsigned int retSkip;'
         #else:
         #    print "    %s ret;" % (func.type.mutable())
+        fixed = fixedArgs(func)
+        if fixed:
+            for arg in func.args:
+                arg.has_new_value = False
+            print '    struct { %s } _args; // fixed size only' % ' '.join('FixedWord<%s> %s;' % f for f in fixed)
+            print '    memcpy(&_args, _src, sizeof(_args));'
+            print '    _src += sizeof(_args);'
+            for ty, name in fixed:
+                print '    %s %s = _args.%s.get();' % (ty, name, name)
+            return
         for arg in func.args:
             #arg_type = arg.type.mutable()
             #print '    %s %s;' % (arg_type, arg.name)
@@ -713,13 +799,40 @@ class Retracer(object):
         print '    // ------------- pre retrace ------------------'
         if func.name == 'glUseProgram':
             print '    gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext()->_current_program = programNew;'
+            print '    gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext()->getUniformLocations(programNew);'
+        if func.name in ['glUseProgram', 'glDeleteProgram', 'glProgramBinary']:
+            print '    finish_glLinkProgram(programNew);'
+        if func.name in ['glEnablei', 'glDisablei', 'glEnableiEXT', 'glDisableiEXT', 'glEnableiOES', 'glDisableiOES']:
+            print '    if (gRetracer.mFilteringState) gRetracer.mStateFilter.enablei(target);'
+        elif func.name == 'glDeleteTextures':
+            print '    if (gRetracer.mFilteringState) gRetracer.mStateFilter.deleteTextures();'
+        elif func.name in ['glLinkProgram', 'glLinkProgram2', 'glProgramBinary', 'glProgramBinaryOES']:
+            print '    if (gRetracer.mFilteringState) gRetracer.mStateFilter.linkProgram(programNew);'
+        elif func.name == 'glDeleteProgram':
+            print '    if (gRetracer.mFilteringState) gRetracer.mStateFilter.deleteProgram(programNew);'
+        # keep the state shadow of the context, which features read instead of glGet*
+        if func.name in ['glEnable', 'glDisable']:
+            print '    gRetracer.getCurrentContext()._shadow.enable(cap, %s);' % ('true' if func.name == 'glEnable' else 'false')
+        elif func.name in ['glEnablei', 'glDisablei', 'glEnableiEXT', 'glDisableiEXT', 'glEnableiOES', 'glDisableiOES']:
+            print '    gRetracer.getCurrentContext()._shadow.enablei(target);'
+        elif func.name in ['glDrawBuffers', 'glDrawBuffersEXT', 'glDrawBuffersNV']:
+            print '    gRetracer.getCurrentContext()._shadow.drawBuffers(n, bufs);'
+        elif func.name == 'glDrawBuffersIndexedEXT':
+            print '    gRetracer.getCurrentContext()._shadow.invalidate();'
         if func.name == 'glViewport':  # record viewport size to get the size of texture bound to FBO
             print '    gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurAppVP.x = x;'
             print '    gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurAppVP.y = y;'
             print '    gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurAppVP.w = width;'
             print '    gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurAppVP.h = height;'
+        if func.name in ['glEnable', 'glDisable']:
+            print '    if (cap == GL_SCISSOR_TEST && gRetracer.mOptions.mSurfaceAtlasWidth > 0)'
+            print '    {'
+            print '        // applied by pre_glDraw(), which keeps it on while drawing to a tile of the surface atlas'
+            print '        gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurAppScissorTest = %s;' % ('true' if func.name == 'glEnable' else 'false')
+            print '        return;'
+            print '    }'
         if func.name == 'glScissor':
-            print '    if (gRetracer.mOptions.mDoOverrideResolution)'
+            print '    if (gRetracer.mOptions.mDoOverrideResolution || gRetracer.mOptions.mSurfaceAtlasWidth > 0)'
             print '    {'
             print '        gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurAppSR.x = x;'
             print '        gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurAppSR.y = y;'
@@ -762,23 +875,15 @@ class Retracer(object):
         if is_draw_array or is_draw_elements or func.name == 'glClear':
             print '    pre_glDraw();'
 
-        # sum up the data size of VBO, texture and client-side buffer
+        # sum up the data size of VBO, texture and client-side buffer, for the -memtimeline upload counts
         if func.name == 'glBufferData' or func.name == 'glBufferSubData':
-            print '#ifndef NDEBUG'
             print '    gRetracer.mVBODataSize += size;'
-            print '#endif'
         elif func.name.startswith('glCompressedTex'):
-            print '#ifndef NDEBUG'
             print '    gRetracer.mCompressedTextureDataSize += imageSize;'
-            print '#endif'
         elif func.name == 'glTexImage2D' or func.name == 'glTexSubImage2D':
-            print '#ifndef NDEBUG'
             print '    gRetracer.mTextureDataSize += _gl_image_size(format, type, width, height, 1);'
-            print '#endif'
-        elif func.name == 'glTexImage3DOES' or func.name == 'glTexSubImage3DOES':
-            print '#ifndef NDEBUG'
+        elif func.name in ['glTexImage3D', 'glTexSubImage3D', 'glTexImage3DOES', 'glTexSubImage3DOES']:
             print '    gRetracer.mTextureDataSize += _gl_image_size(format, type, width, height, depth);'
-            print '#endif'
         elif func.name in ['glUnmapBuffer', 'glUnmapBufferOES']:
             print '    GLuint bufferId = getBoundBuffer(target);'
             print '    gRetracer.getCurrentContext()._bufferToData_map.erase(bufferId);'
@@ -856,7 +961,7 @@ class Retracer(object):
             print '    }'
             return
         if func.name in ['glViewport']:
-            print '    if (!gRetracer.mOptions.mDoOverrideResolution)'
+            print '    if (!gRetracer.mOptions.mDoOverrideResolution && gRetracer.mOptions.mSurfaceAtlasWidth == 0)'
             print '    {'
             indent = '    '
         if func.name == 'glDiscardFramebufferEXT' or func.name == 'glInvalidateFramebuffer':
@@ -878,14 +983,17 @@ class Retracer(object):
         if func.name == 'glLinkProgram2' or func.name == 'glLinkProgram':
             if func.name == 'glLinkProgram':
                 print '    const int status = -1;'
-            print '    if (gRetracer.mOptions.mShaderCacheFile.size() > 0)'
+            print '    finish_glLinkProgram(programNew);'
+            print '    if (gRetracer.shaderCache.isOpen())'
             print '    {'
             print '        load_from_shadercache(programNew, program, status);'
             print '    }'
             print '    else'
             print '    {'
+            print '        const int64_t _shaderBegin = gRetracer.mShaderStats.begin();'
             print '        _glLinkProgram(programNew);'
             print '        post_glLinkProgram(programNew, program, (int)status);'
+            print '        end_shader_timing(ShaderStats::LINK, _shaderBegin, programNew);'
             print '    }'
             return
 
@@ -894,12 +1002,46 @@ class Retracer(object):
         elif func.name in ['glTexParameterfv', 'glTexParameteriv', 'glSamplerParameterfv', 'glSamplerParameteriv']:
             print '    if (*params > 1 && pname == GL_TEXTURE_MAX_ANISOTROPY_EXT && gRetracer.mOptions.mForceAnisotropicLevel != -1) *params = gRetracer.mOptions.mForceAnisotropicLevel;'
 
+        if func.name in ['glBufferData', 'glBufferSubData']:
+            staged_call = {'glBufferData': 'bufferData(target, size, data, usage)',
+                           'glBufferSubData': 'bufferSubData(target, offset, size, data)'}[func.name]
+            print '    if (!gRetracer.mStagedUploads || !gRetracer.mUploadRing.%s)' % staged_call
+            print '    {'
+            indent = '    '
+        transcoded_call = {'glCompressedTexImage2D': 'compressedTexImage2D(target, level, internalformat, width, height, border, imageSize, dataFromBlob ? data : NULL)',
+                           'glCompressedTexSubImage2D': 'compressedTexSubImage2D(target, level, xoffset, yoffset, width, height, format, imageSize, dataFromBlob ? data : NULL)',
+                           'glTexStorage2D': 'texStorage2D(target, levels, internalformat, width, height)'}.get(func.name)
+        if transcoded_call:
+            print '    if (unlikely(gRetracer.mTranscoder.isOpen()) && gRetracer.mTranscoder.%s)' % transcoded_call
+            print '    {'
+            print '        return;'
+            print '    }'
+        if func.name in stdapi.texture_function_names:
+            pixels = func.args[-1].name
+            print '    bool _staged = false;'
+            print '    if (gRetracer.mStagedUploads && %sFromBlob)' % pixels
+            print '    {'
+            print '        %s = const_cast<GLvoid*>(gRetracer.mUploadRing.beginPixels(%s, %sBlob.cnt));' % (pixels, pixels, pixels)
+            print '        _staged = (%s != %sBlob.v);' % (pixels, pixels)
+            print '    }'
+
+        filtered = stateFilterCall(func)
+        if filtered:
+            if filtered.endswith('_values, sizeof(_values))'):
+                scalars = [arg for arg in func.args if arg.name not in ['program', 'location']]
+                print '    const %s _values[] = { %s };' % (scalars[0].type, ', '.join(arg.name for arg in scalars))
+            print '    if (!gRetracer.mFilteringState || !gRetracer.mStateFilter.%s)' % filtered
+            print '    {'
+            indent = '    '
+
         args = [arg.name + "New" if arg.has_new_value else arg.name
                 for arg in func.args]
         arg_names = ", ".join(args)
 
+        if func.name == 'glCompileShader':
+            print '    const int64_t _shaderBegin = gRetracer.mShaderStats.begin();'
         if func.name in shadercache_funcs:
-            print '    if (gRetracer.mOptions.mShaderCacheFile.size() == 0)'
+            print '    if (!gRetracer.shaderCache.isOpen())'
             print '    {'
             print '        {name}({args});'.format(name=func.name, args=arg_names)
             print '    }'
@@ -914,27 +1056,46 @@ class Retracer(object):
                 print '        post_glShaderSource(shaderNew, shader, count, string, length);'
                 print '    }'
         elif func.type is not stdapi.Void:
+            print '    %sconst uint64_t _driverBegin = gRetracer.mFramePhases.begin();' % indent
             print '    %sret = %s(%s);' % (indent, func.name, arg_names)
+            print '    %sgRetracer.mFramePhases.end(FramePhases::DRIVER, _driverBegin);' % indent
         else:
+            batched = uniformBatchCall(func)
+            if batched:
+                print '    %sif (gRetracer.mBatchingUniforms)' % indent
+                print '    %s{' % indent
+                print '    %s    gRetracer.mUniformBatch.%s;' % (indent, batched)
+                print '    %s}' % indent
+                print '    %selse' % indent
+                print '    %s{' % indent
+                indent += '    '
+            print '    %sconst uint64_t _driverBegin = gRetracer.mFramePhases.begin();' % indent
             print '    %s%s(%s);' % (indent, func.name, arg_names)
+            print '    %sgRetracer.mFramePhases.end(FramePhases::DRIVER, _driverBegin);' % indent
+            if batched:
+                indent = indent[:-4]
+                print '    %s}' % indent
 
-        if func.name in ['glViewport', 'glScissor']:
+        if func.name in ['glViewport', 'glScissor', 'glBufferData', 'glBufferSubData'] or filtered:
             print '    }'
+        if func.name in stdapi.texture_function_names:
+            print '    if (_staged) gRetracer.mUploadRing.endPixels();'
 
 
         if func.name == 'glCompileShader':
-            print '    if (gRetracer.mOptions.mShaderCacheFile.size() == 0)'
+            print '    if (!gRetracer.shaderCache.isOpen())'
             print '    {'
             print '        post_glCompileShader(shaderNew, shader);'
+            print '        end_shader_timing(ShaderStats::COMPILE, _shaderBegin);'
             print '    }'
 
         if func.name == 'glDeleteShader':
-            print '    if (gRetracer.mOptions.mShaderCacheFile.size() > 0)'
+            print '    if (gRetracer.shaderCache.isOpen())'
             print '    {'
             print '        gRetracer.getCurrentContext().deleteShader(shaderNew);'
             print '    }'
         if func.name == 'glDeleteProgram':
-            print '    if (gRetracer.mOptions.mShaderCacheFile.size() > 0)'
+            print '    if (gRetracer.shaderCache.isOpen())'
             print '    {'
             print '        gRetracer.getCurrentContext().deleteShaderIDs(programNew);'
             print '    }'
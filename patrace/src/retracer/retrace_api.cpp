@@ -82,16 +82,19 @@ void glPatchClientSideBuffer(GLenum target, int _size, const char* _data)
 }
 
 void glClientSideBufferData(unsigned int _name, int _size, const char* _data) {
-#ifndef NDEBUG
     gRetracer.mClientSideMemoryDataSize += _size;
-#endif
-    gRetracer.mCSBuffers.object_data(gRetracer.getCurTid(), _name, _size, _data, true);
+    if (gRetracer.mFile.isPreloaded(_data, _size))
+    {
+        gRetracer.mCSBuffers.object_reference(gRetracer.getCurTid(), _name, _size, _data);
+    }
+    else
+    {
+        gRetracer.mCSBuffers.object_data(gRetracer.getCurTid(), _name, _size, _data, true); // the chunk is recycled
+    }
 }
 
 void glClientSideBufferSubData(unsigned int _name, int _offset, int _size, const char* _data) {
-#ifndef NDEBUG
     gRetracer.mClientSideMemoryDataSize += _size;
-#endif
     gRetracer.mCSBuffers.object_subdata(gRetracer.getCurTid(), _name, _offset, _size, _data);
 }
 
@@ -105,16 +108,28 @@ void glDeleteClientSideBuffer(unsigned int _name) {
 
 unsigned int glGenGraphicBuffer_ARM(unsigned int _width, unsigned int _height, int _pix_format, unsigned int _usage) {
     Context& context = gRetracer.getCurrentContext();
+    const bool pooled = gRetracer.mOptions.mBufferPool;
+    const GraphicBufferKey key = { _width, _height, _pix_format, _usage };
 #ifdef ANDROID
     if (useGraphicBuffer)
     {
-        GraphicBuffer *graphicBuffer = new GraphicBuffer(_width, _height, (PixelFormat)_pix_format, _usage);
+        GraphicBuffer *graphicBuffer = pooled ? gRetracer.mGraphicBufferPool.acquire(key) : NULL;
+        if (!graphicBuffer)
+        {
+            graphicBuffer = new GraphicBuffer(_width, _height, (PixelFormat)_pix_format, _usage);
+            if (pooled) gRetracer.mGraphicBufferPool.add(graphicBuffer, key);
+        }
         context.mGraphicBuffers.push_back(graphicBuffer);
         return context.mGraphicBuffers.size() - 1;
     }
     else if (useHardwareBuffer)
     {
-        HardwareBuffer *hardwareBuffer = new HardwareBuffer(_width, _height, _pix_format, _usage);
+        HardwareBuffer *hardwareBuffer = pooled ? gRetracer.mHardwareBufferPool.acquire(key) : NULL;
+        if (!hardwareBuffer)
+        {
+            hardwareBuffer = new HardwareBuffer(_width, _height, _pix_format, _usage);
+            if (pooled) gRetracer.mHardwareBufferPool.add(hardwareBuffer, key);
+        }
         context.mHardwareBuffers.push_back(hardwareBuffer);
         return context.mHardwareBuffers.size() - 1;
     }
@@ -124,6 +139,12 @@ unsigned int glGenGraphicBuffer_ARM(unsigned int _width, unsigned int _height, i
 
     return 0;
 #else
+    egl_image_fixture *fix = pooled ? gRetracer.mGraphicBufferPool.acquire(key) : NULL;
+    if (fix)
+    {
+        context.mGraphicBuffers.push_back(fix);
+        return context.mGraphicBuffers.size() - 1;
+    }
     auto iter = context.mAndroidToLinuxPixelMap.find(static_cast<PixelFormat>(_pix_format));
     if (iter == context.mAndroidToLinuxPixelMap.end()) {
         gRetracer.reportAndAbort("Cannot find the corresponding PixelFormat of %x\n", _pix_format);
@@ -150,8 +171,9 @@ unsigned int glGenGraphicBuffer_ARM(unsigned int _width, unsigned int _height, i
         gRetracer.reportAndAbort("glGenGraphicBuffer_ARM doesn't support format=0x%x, aborting...\n", _pix_format);
         break;
     }
-    egl_image_fixture *fix = new egl_image_fixture(format);
+    fix = new egl_image_fixture(format);
     fill_image_attributes(fix, format, linux_pix_format, _width, _height, gRetracer.mOptions.dmaSharedMemory, fix->attrib_size, fix->attribs);
+    if (pooled) gRetracer.mGraphicBufferPool.add(fix, key);
     context.mGraphicBuffers.push_back(fix);
 
     return context.mGraphicBuffers.size() - 1;
@@ -191,18 +213,40 @@ void glGraphicBufferData_ARM(unsigned int _name, int _size, const char * _data)
 }
 
 void glDeleteGraphicBuffer_ARM(unsigned int _name) {
-#ifndef ANDROID
     Context& context = gRetracer.getCurrentContext();
     int id = context.getGraphicBufferMap().RValue(_name);
+#ifdef ANDROID
+    // Kept until the end of replay, unless they can be used again
+    if (gRetracer.mOptions.mBufferPool)
+    {
+        if (useGraphicBuffer && context.mGraphicBuffers[id])
+        {
+            gRetracer.mGraphicBufferPool.release(context.mGraphicBuffers[id]);
+            context.mGraphicBuffers[id] = NULL;
+        }
+        else if (useHardwareBuffer && context.mHardwareBuffers[id])
+        {
+            gRetracer.mHardwareBufferPool.release(context.mHardwareBuffers[id]);
+            context.mHardwareBuffers[id] = NULL;
+        }
+    }
+#else
     egl_image_fixture *fix = context.mGraphicBuffers[id];
-    unmap_fixture_memory_bufs(fix);
-    close_fixture_memory_bufs(fix);
-    delete fix;
+    if (gRetracer.mOptions.mBufferPool)
+    {
+        gRetracer.mGraphicBufferPool.release(fix);
+    }
+    else
+    {
+        unmap_fixture_memory_bufs(fix);
+        close_fixture_memory_bufs(fix);
+        delete fix;
+    }
     context.mGraphicBuffers[id] = NULL;
 #endif
 }
 
-void paMandatoryExtensions(int count, Array<const char*> string)
+void paMandatoryExtensions(int count, Array<const char*>& string)
 {
     for (int i=0; i<count; i++) {
         const char* ext = string[i];
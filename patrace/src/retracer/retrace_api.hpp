@@ -26,6 +26,6 @@ void glDeleteClientSideBuffer(unsigned int _name);
 unsigned int glGenGraphicBuffer_ARM(unsigned int _width, unsigned int _height, int _pix_format, unsigned int _usage);
 void glGraphicBufferData_ARM(unsigned int _name, int _size, const char * _data);
 void glDeleteGraphicBuffer_ARM(unsigned int _name);
-void paMandatoryExtensions(int count, common::Array<const char*> string);
+void paMandatoryExtensions(int count, common::Array<const char*>& string);
 
 #endif
@@ -18,7 +18,10 @@ using namespace retracer;
 static void callback(unsigned int source, unsigned int type, unsigned int id, unsigned int severity, int length, const char* message, const void* userParam)
 {
     if (type == GL_DEBUG_TYPE_PERFORMANCE) return; // too much
-    DBG_LOG("%s::%s::%s (call=%u frame=%u) %s: %s\n", cbsource(source), cbtype(type), cbseverity(severity), gRetracer.GetCurCallId(), gRetracer.GetCurFrameId(), gRetracer.GetCurCallName(), message);
+    // Output is asynchronous unless -debugsync is given, so the call may be a later one then
+    const bool sync = gRetracer.mOptions.mDebugSync;
+    if (sync && type == GL_DEBUG_TYPE_ERROR) gRetracer.mDebugErrorPending = true;
+    DBG_LOG("%s::%s::%s (%s=%u frame=%u) %s: %s\n", cbsource(source), cbtype(type), cbseverity(severity), sync ? "call" : "near call", gRetracer.GetCurCallId(), gRetracer.GetCurFrameId(), gRetracer.GetCurCallName(), message);
 }
 
 void getSurfaceDimensions(int* width, int* height)
@@ -43,6 +46,46 @@ void getSurfaceDimensions(int* width, int* height)
     }
 }
 
+/// Place a window surface into the surface atlas, creating the window of the atlas with the
+/// first of them. Returns false if it does not fit, for it to get a window of its own.
+static bool placeInSurfaceAtlas(int surface, int win, common::Array<int>& attrib_list, int width, int height, int winWidth, int winHeight)
+{
+    const RetraceOptions& opt = gRetracer.mOptions;
+    StateMgr& s = gRetracer.mState;
+    SurfaceAtlas& atlas = s.mSurfaceAtlas;
+    if (!atlas.mDrawable)
+    {
+        atlas.mWidth = opt.mSurfaceAtlasWidth;
+        atlas.mHeight = opt.mSurfaceAtlasHeight;
+    }
+    if (!atlas.Place(surface, width, height, winWidth, winHeight))
+    {
+        DBG_LOG("Surface %d of %dx%d does not fit into the %dx%d surface atlas, creating a window for it\n", surface, width, height, atlas.mWidth, atlas.mHeight);
+        return false;
+    }
+    if (!atlas.mDrawable)
+    {
+        DBG_LOG("Creating drawable for the surface atlas: w=%d, h=%d...\n", atlas.mWidth, atlas.mHeight);
+        if (opt.mPbufferRendering)
+        {
+            EGLint const attribs[] = { EGL_WIDTH, atlas.mWidth, EGL_HEIGHT, atlas.mHeight, EGL_NONE, EGL_NONE };
+            atlas.mDrawable = GLWS::instance().CreatePbufferDrawable(attribs);
+        }
+        else
+        {
+            atlas.mDrawable = GLWS::instance().CreateDrawable(atlas.mWidth, atlas.mHeight, win, attrib_list);
+        }
+        atlas.mDrawable->winWidth = winWidth;
+        atlas.mDrawable->winHeight = winHeight;
+        gRetracer.mSurfaceCount++;
+    }
+    const AtlasTile* tile = atlas.Find(surface);
+    DBG_LOG("Placing surface %d into the surface atlas: x=%d, y=%d, w=%d, h=%d\n", surface, tile->rect.x, tile->rect.y, width, height);
+    s.InsertDrawableMap(surface, atlas.mDrawable);
+    s.InsertDrawableToWinMap(surface, win);
+    return true;
+}
+
 void retrace_eglCreateWindowSurface(char* src)
 {
     // ------- ret & params definition --------
@@ -104,6 +147,11 @@ void retrace_eglCreateWindowSurface(char* src)
     int height = 0;
     getSurfaceDimensions(&width, &height);
 
+    if (opt.mSurfaceAtlasWidth > 0 && placeInSurfaceAtlas(ret, win, attrib_list, width, height, opt.mWindowWidth, opt.mWindowHeight))
+    {
+        return;
+    }
+
     DBG_LOG("Creating drawable for surface %d: w=%d, h=%d...\n", ret, width, height);
     retracer::Drawable* d;
     if (gRetracer.mOptions.mPbufferRendering || (gRetracer.mOptions.mSingleSurface != -1 && gRetracer.mOptions.mSingleSurface != gRetracer.mSurfaceCount))
@@ -208,6 +256,11 @@ static void retrace_eglCreateWindowSurface2(char* src)
         getSurfaceDimensions(&surfWidth, &surfHeight);
     }
 
+    if (opt.mSurfaceAtlasWidth > 0 && placeInSurfaceAtlas(ret, win, attrib_list, surfWidth, surfHeight, winWidth, winHeight))
+    {
+        return;
+    }
+
     DBG_LOG("Creating drawable for surface %d: x=%d, y=%d, w=%d, h=%d...\n", ret, x, y, surfWidth, surfHeight);
     retracer::Drawable* d;
     if (gRetracer.mOptions.mPbufferRendering || (gRetracer.mOptions.mSingleSurface != -1 && gRetracer.mOptions.mSingleSurface != gRetracer.mSurfaceCount))
@@ -293,10 +346,15 @@ static void retrace_eglDestroySurface(char* src)
     }
 
     s.RemoveDrawableMap(surface);
+    s.mSurfaceAtlas.Remove(surface);
 
     if (toBeDel != NULL && toBeDel != s.mThreadArr[gRetracer.getCurTid()].getDrawable()
         && !s.IsInDrawableMap(toBeDel))
     {
+        if (toBeDel == s.mSurfaceAtlas.mDrawable)
+        {
+            s.mSurfaceAtlas.mDrawable = NULL;
+        }
         toBeDel->release();
         toBeDel = 0;
         s.mSingleSurface = 0;
@@ -388,6 +446,7 @@ void retrace_eglCreateContext(char* src)
     {
         gRetracer.reportAndAbort("Failed to create GLES (%d) context", profile);
     }
+    context->reserveNames(gRetracer.mFile.getJSONHeaderMember("nameRanges"));
 
     gRetracer.mState.InsertContextMap(ret, context);
 }
@@ -483,16 +542,39 @@ void retrace_eglMakeCurrent(char* src)
 
     retracer::Context *context = gRetracer.mState.GetContext(ctx);
 
+    if (gRetracer.mOptions.mSurfaceAtlasWidth > 0)
+    {
+        // switching between surfaces of the atlas only moves where pre_glDraw() draws to
+        GLESThread& thread = gRetracer.mState.mThreadArr[gRetracer.getCurTid()];
+        const AtlasTile* tile = s.mSurfaceAtlas.Find(draw);
+        thread.mAtlasTile = tile ? *tile : AtlasTile();
+        thread.mCurDrvVP.w = -1;
+        thread.mCurDrvSR.w = -1;
+        if (tile)
+        {
+            drawable->winWidth = tile->winWidth;
+            drawable->winHeight = tile->winHeight;
+        }
+    }
+
     if (drawable == gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getDrawable() &&
         context == gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext())
     {
         return;
     }
 
-    if (gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getDrawable() &&
-        gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext()) {
+    // with -collapsethreads, what is current on this thread may be another trace thread's
+    const bool collapsed = gRetracer.mOptions.mCollapseThreads;
+    retracer::Drawable* oldDrawable = collapsed ? gRetracer.mCollapsedDrawable : gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getDrawable();
+    retracer::Context* oldContext = collapsed ? gRetracer.mCollapsedContext : gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    if (oldDrawable && oldContext) {
+        if (context != oldContext)
+        {
+            gRetracer.FlushContextWork();
+        }
         glFlush();
     }
+    gRetracer.mStateFilter.reset(); // state is not shadowed across contexts and surfaces
 
     bool ok = GLWS::instance().MakeCurrent(drawable, context);
     if (!ok)
@@ -500,6 +582,11 @@ void retrace_eglMakeCurrent(char* src)
         DBG_LOG("Warning: retrace_eglMakeCurrent failed,(0x%x) \n", eglGetError());
         return;
     }
+    if (collapsed)
+    {
+        gRetracer.mCollapsedDrawable = drawable;
+        gRetracer.mCollapsedContext = context;
+    }
 
     if (drawable && context)
     {
@@ -535,6 +622,31 @@ void retrace_eglMakeCurrent(char* src)
                 _glEnable(GL_DEBUG_OUTPUT_KHR);
                 // disable notifications -- they generate too much spam on some systems
                 _glDebugMessageControlKHR(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION_KHR, 0, NULL, GL_FALSE);
+                if (gRetracer.mOptions.mDebugSync)
+                {
+                    _glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
+                }
+                context->_debugOutput = _glIsEnabled(GL_DEBUG_OUTPUT_KHR) && (!gRetracer.mOptions.mDebugSync || _glIsEnabled(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR));
+                if (!context->_debugOutput)
+                {
+                    _glGetError(); // from the failed glEnable
+                    DBG_LOG("No%s KHR_debug output, checking for errors after every call\n", gRetracer.mOptions.mDebugSync ? " synchronous" : "");
+                }
+            }
+
+            if (gRetracer.mOptions.mParallelShaderCompile)
+            {
+                typedef void (GL_APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+                PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)eglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+                if (isGlesExtensionSupported("GL_KHR_parallel_shader_compile") && maxShaderCompilerThreads)
+                {
+                    maxShaderCompilerThreads(0xFFFFFFFF); // as many as the driver likes
+                    context->_parallelShaderCompile = true;
+                }
+                else
+                {
+                    DBG_LOG("GL_KHR_parallel_shader_compile not supported, shaders are compiled and checked one by one\n");
+                }
             }
         }
 
@@ -587,7 +699,8 @@ void retrace_eglMakeCurrent(char* src)
                 o.mOffscreenConfig.depth,
                 o.mOffscreenConfig.stencil,
                 o.mOffscreenConfig.msaa_samples,
-                context->_profile);
+                context->_profile,
+                o.mOffscreenRing);
             context->_offscrMgr->Init();
             context->_offscrMgr->BindOffscreenFBO(GL_FRAMEBUFFER);
         }
@@ -595,11 +708,32 @@ void retrace_eglMakeCurrent(char* src)
         if (!gRetracer.mpOffscrMgr || gRetracer.getCurTid() == gRetracer.mOptions.mRetraceTid)
             gRetracer.mpOffscrMgr = context->_offscrMgr;
     }
+    if (context && context->_offscrMgr)
+    {
+        context->_shadow.invalidate(); // the offscreen manager binds framebuffers of its own
+    }
 
     gRetracer.mState.mThreadArr[gRetracer.getCurTid()].setDrawable(drawable);
     gRetracer.mState.mThreadArr[gRetracer.getCurTid()].setContext(context);
 }
 
+/// With -bufferpool, use the EGLImage made from a recycled buffer before, unless the trace still uses it
+template<typename Buffer>
+static EGLImageKHR createPooledImage(retracer::GraphicBufferPool<Buffer>& pool, Buffer* buffer, retracer::Context* context, EGLenum tgt, uintptr_t buffer_new, const EGLint* attribs)
+{
+    EGLImageKHR image = pool.image(buffer, attribs);
+    if (image != EGL_NO_IMAGE_KHR && !gRetracer.mState.IsInEGLImageMap(image))
+    {
+        return image;
+    }
+    image = GLWS::instance().createImageKHR(context, tgt, buffer_new, attribs);
+    if (image != EGL_NO_IMAGE_KHR)
+    {
+        pool.setImage(buffer, image, attribs);
+    }
+    return image;
+}
+
 static void retrace_eglCreateImageKHR(char* src)
 {
     // ------- ret & params definition --------
@@ -652,6 +786,8 @@ static void retrace_eglCreateImageKHR(char* src)
         }
     }
     uintptr_t buffer_new = 0;
+    EGLImageKHR image = EGL_NO_IMAGE_KHR;
+    bool pooled = false;
     retracer::Context* context = gRetracer.mState.GetContext(ctx);
     if (tgt == EGL_GL_TEXTURE_2D_KHR)
         buffer_new = context->getTextureMap().RValue(buffer);
@@ -672,6 +808,11 @@ static void retrace_eglCreateImageKHR(char* src)
                 goto retrace;
             }
             buffer_new = reinterpret_cast<uintptr_t>(graphicBuffer->getNativeBuffer());
+            if (gRetracer.mOptions.mBufferPool)
+            {
+                image = createPooledImage(gRetracer.mGraphicBufferPool, graphicBuffer, context, tgt, buffer_new, &attrib_list2[0]);
+                pooled = true;
+            }
         }
         else if (useHardwareBuffer)
         {
@@ -691,6 +832,11 @@ static void retrace_eglCreateImageKHR(char* src)
                 (PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC)eglGetProcAddress("eglGetNativeClientBufferANDROID");
 
             buffer_new = reinterpret_cast<uintptr_t>(hardwareBuffer->eglGetNativeClientBufferANDROID((void *)__eglGetNativeClientBufferANDROID));
+            if (gRetracer.mOptions.mBufferPool)
+            {
+                image = createPooledImage(gRetracer.mHardwareBufferPool, hardwareBuffer, context, tgt, buffer_new, &attrib_list2[0]);
+                pooled = true;
+            }
         }
 #else
         tgt = EGL_LINUX_DMA_BUF_EXT;        // need to be adjusted
@@ -706,6 +852,11 @@ static void retrace_eglCreateImageKHR(char* src)
         }
         attrib_list.cnt = fix->attrib_size;
         attrib_list.v = fix->attribs;
+        if (gRetracer.mOptions.mBufferPool)
+        {
+            image = createPooledImage(gRetracer.mGraphicBufferPool, fix, context, tgt, buffer_new, fix->attribs);
+            pooled = true;
+        }
 #endif
     }
     else
@@ -715,15 +866,16 @@ static void retrace_eglCreateImageKHR(char* src)
 
     //  ------------- retrace ---------------
 retrace:
-    EGLImageKHR image;
-
-    if (tgt == EGL_LINUX_DMA_BUF_EXT)
+    if (!pooled)
     {
-        image = GLWS::instance().createImageKHR(context, tgt, buffer_new, attrib_list);
-    }
-    else
-    {
-        image = GLWS::instance().createImageKHR(context, tgt, buffer_new, &attrib_list2[0]);
+        if (tgt == EGL_LINUX_DMA_BUF_EXT)
+        {
+            image = GLWS::instance().createImageKHR(context, tgt, buffer_new, attrib_list);
+        }
+        else
+        {
+            image = GLWS::instance().createImageKHR(context, tgt, buffer_new, &attrib_list2[0]);
+        }
     }
 
     if (image == NULL) {
@@ -819,12 +971,24 @@ static void swapBuffersCommon(char* src, bool withDamage)
         return;
     }
 
+    gRetracer.mStateFilter.reset(); // offscreen mosaics below change state behind its back
+
+    retracer::Context* pCurContext = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    if (pCurContext && gRetracer.mOptions.mForceOffscreen)
+    {
+        pCurContext->_shadow.invalidate(); // and so do they behind the back of the shadow
+    }
+    if (pCurContext && pCurContext->_parallelShaderCompile)
+    {
+        poll_glLinkProgram();
+    }
+
     // Hmm... why is always the current drawable used as the surface to be
     // swapped? Why do we not use the incoming surface parameter? The
     // following code block tests if this is an issue. / Joakim
+    int surface;
     {
         int dpy;
-        int surface;
         int ret;
 
         // --------- read ret & params ----------
@@ -870,38 +1034,62 @@ static void swapBuffersCommon(char* src, bool withDamage)
             }
         }
 
-        gRetracer.mpOffscrMgr->OffscreenToMosaic();
-
-        retracer::Context *pContext = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
-        if (pContext != NULL && pDrawable != NULL) {
-            int ctx = gRetracer.mState.GetCtx(pContext);
-            int draw = gRetracer.mState.GetDraw(pDrawable);
-            gRetracer.mpOffscrMgr->last_non_zero_ctx = ctx;
-            gRetracer.mpOffscrMgr->last_non_zero_draw = draw;
-            gRetracer.mpOffscrMgr->last_tid = gRetracer.getCurTid();
-        }
-
-        if (gRetracer.mpOffscrMgr->MosaicToScreenIfNeeded())
+        if (gRetracer.mOptions.mHeadless)
         {
-            pDrawable->swapBuffers();
-            gRetracer.mMosaicNeedToBeFlushed = false;
+            glFlush(); // nothing is shown, so there is no mosaic to copy the frame into
         }
         else
         {
-            glFlush();
-            gRetracer.mMosaicNeedToBeFlushed = true;
+            gRetracer.mpOffscrMgr->OffscreenToMosaic();
+
+            retracer::Context *pContext = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+            if (pContext != NULL && pDrawable != NULL) {
+                int ctx = gRetracer.mState.GetCtx(pContext);
+                int draw = gRetracer.mState.GetDraw(pDrawable);
+                gRetracer.mpOffscrMgr->last_non_zero_ctx = ctx;
+                gRetracer.mpOffscrMgr->last_non_zero_draw = draw;
+                gRetracer.mpOffscrMgr->last_tid = gRetracer.getCurTid();
+            }
+
+            if (gRetracer.mpOffscrMgr->MosaicToScreenIfNeeded())
+            {
+                pDrawable->swapBuffers();
+                gRetracer.mMosaicNeedToBeFlushed = false;
+            }
+            else
+            {
+                glFlush();
+                gRetracer.mMosaicNeedToBeFlushed = true;
+            }
         }
 
         gRetracer.OnNewFrame();
-        if (gRetracer.getCurrentContext()._current_framebuffer != ON_SCREEN_FBO)
+        Context& context = gRetracer.getCurrentContext();
+        if (context._current_framebuffer != ON_SCREEN_FBO)
         {
-            glBindFramebuffer(GL_FRAMEBUFFER, gRetracer.getCurrentContext()._current_framebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, context._current_framebuffer);
+            context._shadow.bindFramebuffer(GL_FRAMEBUFFER, context._current_framebuffer);
         }
         else
         {
             // bind the offscreen target for the next frame
             gRetracer.mpOffscrMgr->BindOffscreenFBO(GL_FRAMEBUFFER);
+            context._shadow.bindFramebuffer(GL_FRAMEBUFFER, gRetracer.mpOffscrMgr->OffscreenFBO());
+        }
+    }
+    else if (gRetracer.mState.mSurfaceAtlas.Find(surface))
+    {
+        // the atlas is presented once a frame, when its oldest surface is swapped, with no
+        // damage, which would have to be moved to the tile
+        if (gRetracer.mState.mSurfaceAtlas.Presents(surface))
+        {
+            pDrawable->swapBuffers();
+        }
+        else
+        {
+            glFlush();
         }
+        gRetracer.OnNewFrame();
     }
     else
     {
@@ -3,9 +3,12 @@
 #include <retracer/retracer.hpp>
 #include <retracer/glws.hpp>
 #include <retracer/trace_executor.hpp>
+#include <retracer/batch_scheduler.hpp>
+#include <retracer/replay_daemon.hpp>
 #include <retracer/retrace_api.hpp>
 #include <retracer/config.hpp>
 #include <dispatch/eglproc_retrace.hpp>
+#include <common/trace_index.hpp>
 
 #include "libcollector/interface.hpp"
 
@@ -15,56 +18,131 @@ using namespace retracer;
 
 static bool printHeaderInfo = false;
 static bool printHeaderJson = false;
+static bool verifyTrace = false;
+static const char* jsonBatchFile = NULL;
+static std::string jsonBatchResultDir;
+static std::string jsonBatchTraceDir;
+static int batchJobs = 0;
+static bool batchConcurrent = false;
+static int batchJobDevices = 0;
+static int batchJobMemory = 0; // MB
+static int daemonPort = 0;
+static std::string daemonResultDir;
+static std::string daemonTraceDir;
+static std::string daemonAddress = "127.0.0.1";
+static bool commandLineCollectors = false; // -collect or -collect_streamline
+static bool streamlineCollector = false;
 
 static void
 usage(const char *argv0) {
     fprintf(stderr,
         "Usage: %s [OPTION] <path_to_trace_file>\n"
         "Version: " PATRACE_VERSION "\n"
-        "Replay TRACE.\n"
+        "Replay TRACE. Use - to read the trace from stdin, or tcp://HOST:PORT to read it from a socket.\n"
         "\n"
         "  -tid THREADID the function calls invoked by thread <THREADID> will be retraced\n"
         "  -s CALL_SET take snapshot for the calls in the specific call set. Please try to post process the captured snapshot with imagemagick to turn off alpha value if it shows black.\n"
         "  -snapshotprefix PREFIX Prepend this label to every snapshot. Useful for automation.\n"
+        "  -snapshotlevel LEVEL zlib compression level of PNG snapshots and image dumps, from 0 (fastest) to 9 (smallest, default 1)\n"
+        "  -snapshotfilter FILTER PNG row filter: none, sub, up, average, paeth or adaptive (default adaptive)\n"
+        "  -snapshotthreads THREADS compress each large PNG snapshot in strips on THREADS threads (default 1)\n"
+        "  -snapshotqoi write snapshots in the lossless QOI format, which is much faster to write than PNG\n"
+        "  -snapshotcompare DIR compare snapshots on the GPU with the PNG snapshots of the same name in DIR, and only write those that differ (needs GLES 3.1)\n"
+        "  -snapshottolerance N largest difference in a color channel that -snapshotcompare still counts as matching (default 0)\n"
+        "  -snapshothash FILE write a perceptual hash and a checksum of each snapshot to FILE instead of the snapshot\n"
+        "  -snapshothashref FILE with -snapshothash, also write the snapshots whose hash differs from its reference in FILE, from an earlier -snapshothash\n"
+        "  -snapshothashdistance N number of bits in which a perceptual hash may differ from its reference (default 0)\n"
         "  -step use F1-F4 to step forward frame by frame, F5-F8 to step forward draw call by draw call (not supported on all platforms)\n"
         "  -ores W H override the resolution of the final onscreen rendering (FBOs used in earlier renderpasses are not affected!)\n"
         "  -msaa SAMPLES enable multi sample anti alias\n"
         "  -preload START STOP preload the trace file frames from START to STOP. START must be greater than zero.\n"
+        "  -preloadbudget SIZE fail early instead of preloading more than SIZE bytes (suffixes K, M and G allowed)\n"
+        "  -preloadhugepages back the preloaded frames with transparent hugepages\n"
+        "  -calltape decode the preloaded frames once and replay the decoded calls on every loop\n"
+        "  -prefetch CHUNKS decompress up to CHUNKS trace chunks ahead of replay on a background thread\n"
+        "  -prefetchthreads THREADS number of background threads used by -prefetch (default 1)\n"
+        "  -prefetchblobs CALLS fault in the data of big preloaded calls up to CALLS calls ahead of replay on a background thread\n"
+        "  -prefetchblobsize SIZE smallest call prefetched by -prefetchblobs (suffixes K, M and G allowed, default 64K)\n"
+        "  -streamwindow SIZE keep only about SIZE bytes of the trace file in memory, reading ahead and releasing behind replay\n"
         "  -framerange FRAME_START FRAME_END start fps timer at frame start (inclusive), stop timer and playback before frame end (exclusive).\n"
         "  -loop TIMES repeat the preloaded frames at least the given number of times\n"
         "  -looptime SECONDS repeat the preloaded frames at least the given number of seconds\n"
+        "  -loopwarmup PERCENT loop the preloaded frames until the mean frame time of a loop is within PERCENT of the previous one before measuring\n"
+        "  -loopreset delete the objects created by the frame range and restore the main bindings before each loop\n"
+        "  -pace FPS|capture hold back each swap so that frames are presented at FPS, or at the frame intervals recorded in the trace\n"
+        "  -presenttimes record when the GPU finished each frame and when it was latched and presented, with EGL_ANDROID_get_frame_timestamps\n"
+        "  -presentvsync as -presenttimes, and give each frame the next vsync the compositor can make as its presentation time\n"
+        "  -presentfeedback record when each frame was presented and which were dropped, with wp_presentation on Wayland or the Present extension on X11\n"
         "  -jsonParameters FILE RESULT_FILE TRACE_DIR path to a JSON file containing the parameters, the output result file and base trace path\n"
+        "  -jsonBatch FILE RESULT_DIR TRACE_DIR replay each entry of a JSON list of -jsonParameters objects in turn, keeping the display and shader cache between them\n"
+        "  -jobs N with -jsonBatch, replay the entries in up to N worker processes at once, logging each to RESULT_DIR/batch.jsonl when it ends\n"
+        "  -jobdevices N with -jobs, pin the workers to EGL devices 0 to N-1 in turn, see -device\n"
+        "  -jobmemory MB with -jobs, only start entries while the memory they are estimated to need fits in MB\n"
+        "  -contextpriority high|medium|low create the contexts with this priority, where EGL_IMG_context_priority is supported\n"
+        "  -concurrent with -jsonBatch, replay all the entries at the same time, each in a worker process, and report how they shared the GPU in RESULT_DIR/concurrent.json\n"
+        "  -daemon PORT RESULT_DIR TRACE_DIR serve replay requests, lines of -jsonParameters objects, on a TCP port, keeping the display, shader cache and traces warm between them\n"
+        "  -daemonbind ADDRESS with -daemon, listen on this IPv4 address instead of 127.0.0.1, such as 0.0.0.0 for every interface. Requests are not authenticated.\n"
         "  -info Show default EGL Config for playback (stored in trace file header). Do not play trace.\n"
         "  -instr Output the supported instrumentation modes as a JSON file. Do not play trace.\n"
+        "  -verify Check every chunk of the trace against its checksum on all cores, then exit with 1 if any of them fails\n"
         "  -offscreen Run in offscreen mode\n"
         "  -singlewindow Force everything to render in a single window\n"
         "  -singleframe Draw only one frame for each buffer swap (offscreen only)\n"
+        "  -offscreenring N Render frames into a ring of N offscreen targets, and two mosaics if N is more than 2 (offscreen only, default 2)\n"
         "  -skipwork WARMUP_FRAMES Discard GPU work outside frame range with given number of warmup frames. Requires GLES3.\n"
+        "  -fastseek Skip the draws, dispatches, clears and blits before the frame range whose results it does not depend on\n"
+        "  -invalidate FILE Add the glInvalidateFramebuffer calls that analyze_trace -I found missing and wrote to FILE\n"
         "  -debug output debug messages\n"
         "  -debugfull output all of the current invoked gl functions, with callNo, frameNo and skipped or discarded information\n"
+        "  -debugsync with -debug, make KHR_debug report errors from within the call that raised them, which is slower, to find that call\n"
         "  -infojson Dump the header of the trace file in json format, then exit\n"
         "  -callstats output call statistics to callstats.csv on disk, including the calling number and running time\n"
+        "  -stubdriver replay headless against the no-op egl_stub, gles1_stub and gles2_stub libraries with -callstats, to measure the cost of the retracer alone\n"
+        "  -drawtime measure the GPU time of draws, dispatches and render passes with timer queries, and add it to the results\n"
+        "  -counterpasses with -collect, also read the counters of collectors such as perf and malicounters at every render pass, finishing the GPU in between\n"
+        "  -countercalls CALL_SET with -collect, also read the counters of collectors such as perf and malicounters around each draw in CALL_SET, finishing the GPU in between\n"
+        "  -stageuploads MB stage buffer and texture uploads of 64 KB or more through a ring buffer of MB megabytes\n"
+        "  -filterstate skip texture binds, program, enable/disable and uniform calls that do not change any state, and count them\n"
+        "  -batchuniforms apply each run of uniform calls at once before the next other call, and count and time them\n"
+        "  -bufferpool recycle the native buffers and EGLImages of video and camera frames instead of allocating new ones\n"
+        "  -snapshotahb (Android only) read snapshots by blitting them into hardware buffers instead of with glReadPixels\n"
+        "  -thumbnails FILE take snapshots as thumbnails scaled down on the GPU, all written to FILE\n"
+        "  -thumbnailwidth PIXELS width of the thumbnails of -thumbnails, 256 by default\n"
+        "  -transcode DIR upload ETC1 and ASTC textures that the driver does not support decoded, keeping the decoded texels in DIR for the next replay\n"
+        "  -memtimeline record uploaded bytes, resident memory and live GL objects of every frame in the result file\n"
+        "  -timeline FILE write a Chrome JSON trace of what the replay threads spend their time on to FILE\n"
         "  -overrideEGL Red Green Blue Alpha Depth Stencil, example: overrideEGL 5 6 5 0 16 8, for 16 bit color and 16 bit depth and 8 bit stencil\n"
         "  -strict Use strict EGL mode (fail unless the specified EGL configuration is valid)\n"
         "  -strictcolor Same as -strict, but only checks color channels (RGBA). Useful for dumping when we want to be sure returned EGL is same as requested\n"
         "  -skip CALL_SET skip calls in the specific call set\n"
         "  -collect Collect performance counters\n"
+        "  -collectstream FILE with -collect, also write the collected values of every frame to FILE as they come, one JSON object per line, keeping only averages in memory\n"
         "  -perfmon Collect performance counters in the built-in perfmon interface\n"
         "  -flush Before starting running the defined measurement range, make sure we flush all pending driver work\n"
         "  -multithread Run all threads in the trace\n"
+        "  -collapsethreads Run all threads in the trace on one thread, in trace order, making the context of each current as its calls come up\n"
         "  -shadercache FILENAME Save and load shaders to this cache FILE. Will add .bin and .idx to the given file name.\n"
         "  -strictshadercache Abort if a wanted shader was not found in the shader cache file.\n"
+        "  -noprogrambinaries Compile the shaders even if the trace has program binaries for this driver embedded in it.\n"
+        "  -parallelcompile Let the driver compile and link shaders in the background, if it supports GL_KHR_parallel_shader_compile.\n"
 #ifndef __APPLE__
-        "  -perf START END run Linux perf on selected frame range and save it to disk\n"
-        "  -perfpath PATH Set path to perf binary\n"
+        "  -perf START END Sample CPU time in the selected frame range and save the samples to disk\n"
+        "  -perfpath PATH Run the perf binary at PATH for -perf instead of sampling in process\n"
         "  -perffreq FREQ Set frequency for perf\n"
         "  -perfout FILENAME Set output filename for perf\n"
 #endif
         "  -forceanisolevel LEVEL force all anisotropic filtering levels above 1 to this level\n"
         "  -noscreen Render without visual output (using pbuffer render target)\n"
+        "  -headless Render only to offscreen FBOs, without any surface or mosaic, for GPUs without a display\n"
+        "  -device N With -headless or -noscreen, render on the Nth EGL device of EGL_EXT_device_enumeration instead of the default one\n"
         "  -singlesurface SURFACE Render all surfaces except the given one to pbuffer render targets instead\n"
+        "  -surfaceatlas WIDTH HEIGHT Render all window surfaces into tiles of one window of this size, presenting it once a frame\n"
         "  -flushonswap Call explicit flush before every call to swap the backbuffer\n"
+        "  -framesinflight N Wait for the GPU to complete frames so that at most N frames are in flight, and report the latencies\n"
+        "  -perframe split the time of each measured frame into decode, retrace, driver, swap, instrumentation and handoff, and add it to the results\n"
+        "  -shaderstats Time shader compiles, links and shader cache loads for each frame, and report the slowest programs\n"
         "  -cpumask Set explicit CPU mask (written as a string of ones and zeroes)\n"
+        "  -threadaffinity auto|ROLE=MASK[,ROLE=MASK...] Place the main, replay, tidN, decode, prefetch and collector threads on their own cores\n"
         "  -libEGL_path=<path.to.libEGL.so>\n"
         "  -libGLESv1_path=<path.to.libGLESv1_CM.so>\n"
         "  -libGLESv2_path=<path.to.libGLESv2.so>\n"
@@ -93,6 +171,32 @@ int readValidValue(char* v)
     return val;
 }
 
+// Parse a byte count like "512M" or "1.5G"
+static uint64_t readValidSize(const char* v)
+{
+    char* endptr;
+    errno = 0;
+    double val = strtod(v, &endptr);
+    if (errno || endptr == v || val < 0)
+    {
+        fprintf(stderr, "Invalid size value: %s\n", v);
+        exit(1);
+    }
+    switch (*endptr)
+    {
+    case 'G': case 'g': val *= 1024.0; // fall through
+    case 'M': case 'm': val *= 1024.0; // fall through
+    case 'K': case 'k': val *= 1024.0; endptr++; break;
+    default: break;
+    }
+    if (*endptr != '\0')
+    {
+        fprintf(stderr, "Invalid size value: %s\n", v);
+        exit(1);
+    }
+    return (uint64_t)val;
+}
+
 static bool printInstr()
 {
     Json::Value input;
@@ -107,17 +211,39 @@ static bool printInstr()
     return true;
 }
 
-bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
+/// Initialize the collectors asked for with -collect or -collect_streamline
+static void initCommandLineCollectors()
 {
-    bool streamline_collector = false;
+    std::vector<std::string> collectors = gRetracer.mCollectors->available();
+    std::vector<std::string> filtered;
+    for (const std::string& s : collectors)
+    {
+        if (s == "rusage" || s == "gpufreq" || s == "procfs" || s == "cpufreq" || s == "perf")
+        {
+            filtered.push_back(s);
+        }
+        else if (s == "streamline" && streamlineCollector)
+        {
+            filtered.push_back(s);
+            DBG_LOG("Streamline integration support enabled\n");
+        }
+    }
+    if (!gRetracer.mCollectors->initialize(filtered))
+    {
+        fprintf(stderr, "Failed to initialize collectors\n");
+    }
+    else DBG_LOG("libcollector instrumentation enabled through cmd line.\n");
+}
 
+bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
+{
     // Parse all except first (executable name)
     for (int i = 1; i < argc; ++i)
     {
         const char *arg = argv[i];
 
         // Assume last arg is filename
-        if (i==argc-1 && arg[0] != '-') {
+        if (i==argc-1 && (arg[0] != '-' || !strcmp(arg, "-"))) {
             mOptions.mFileName = arg;
             break;
         }
@@ -151,23 +277,94 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
             mOptions.mOverrideConfig.msaa_samples = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-skipwork")) {
             mOptions.mSkipWork = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-fastseek")) {
+            mOptions.mFastSeek = true;
+        } else if (!strcmp(arg, "-invalidate")) {
+            mOptions.mInvalidateFile = argv[++i];
         } else if (!strcmp(arg, "-callstats")) {
             mOptions.mCallStats = true;
+        } else if (!strcmp(arg, "-stubdriver")) {
+            mOptions.mStubDriver = true;
+            mOptions.mHeadless = true;
+            mOptions.mCallStats = true;
+            SetCommandLineEGLPath("libegl_stub.so");
+            SetCommandLineGLES1Path("libgles1_stub.so");
+            SetCommandLineGLES2Path("libgles2_stub.so");
+        } else if (!strcmp(arg, "-drawtime")) {
+            mOptions.mDrawTime = true;
+        } else if (!strcmp(arg, "-counterpasses")) {
+            mOptions.mCounterPasses = true;
+        } else if (!strcmp(arg, "-countercalls")) {
+            mOptions.mCounterCallSet.reset(new common::CallSet(argv[++i]));
+        } else if (!strcmp(arg, "-stageuploads")) {
+            mOptions.mStageUploads = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-filterstate")) {
+            mOptions.mFilterState = true;
+        } else if (!strcmp(arg, "-batchuniforms")) {
+            mOptions.mBatchUniforms = true;
+        } else if (!strcmp(arg, "-bufferpool")) {
+            mOptions.mBufferPool = true;
+        } else if (!strcmp(arg, "-snapshotahb")) {
+            mOptions.mSnapshotHardwareBuffers = true;
+        } else if (!strcmp(arg, "-thumbnails")) {
+            mOptions.mThumbnailFile = argv[++i];
+        } else if (!strcmp(arg, "-thumbnailwidth")) {
+            mOptions.mThumbnailWidth = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-transcode")) {
+            mOptions.mTranscodeDir = argv[++i];
+        } else if (!strcmp(arg, "-memtimeline")) {
+            mOptions.mMemoryTimeline = true;
+        } else if (!strcmp(arg, "-timeline")) {
+            mOptions.mTimelineFile = argv[++i];
         } else if (!strcmp(arg, "-perf")) {
             mOptions.mPerfStart = readValidValue(argv[++i]);
             mOptions.mPerfStop = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-perfpath")) {
             mOptions.mPerfPath = argv[++i];
+            mOptions.mPerfExternal = true;
         } else if (!strcmp(arg, "-perfout")) {
             mOptions.mPerfOut = argv[++i];
         } else if (!strcmp(arg, "-perffreq")) {
             mOptions.mPerfFreq = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-s")) {
-            mOptions.mSnapshotCallSet = new common::CallSet(argv[++i]);
+            mOptions.mSnapshotCallSet.reset(new common::CallSet(argv[++i]));
         } else if (!strcmp(arg, "-framenamesnaps")) {
             mOptions.mSnapshotFrameNames = true;
         } else if (!strcmp(arg, "-snapshotprefix")) {
             mOptions.mSnapshotPrefix = argv[++i];
+        } else if (!strcmp(arg, "-snapshotlevel")) {
+            mOptions.mSnapshotPNG.level = readValidValue(argv[++i]);
+            if (mOptions.mSnapshotPNG.level < 0 || mOptions.mSnapshotPNG.level > 9) {
+                DBG_LOG("Invalid PNG compression level %d\n", mOptions.mSnapshotPNG.level);
+                usage(argv[0]);
+                return false;
+            }
+        } else if (!strcmp(arg, "-snapshotfilter")) {
+            if (!image::parsePNGFilter(argv[++i], mOptions.mSnapshotPNG.filter)) {
+                DBG_LOG("Unknown PNG filter %s\n", argv[i]);
+                usage(argv[0]);
+                return false;
+            }
+        } else if (!strcmp(arg, "-snapshotthreads")) {
+            mOptions.mSnapshotPNG.threads = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-snapshotqoi")) {
+            mOptions.mSnapshotQOI = true;
+        } else if (!strcmp(arg, "-snapshotcompare")) {
+            mOptions.mSnapshotCompare = argv[++i];
+        } else if (!strcmp(arg, "-snapshottolerance")) {
+            const int tolerance = readValidValue(argv[++i]);
+            if (tolerance < 0 || tolerance > 255) {
+                DBG_LOG("Invalid snapshot tolerance %d\n", tolerance);
+                usage(argv[0]);
+                return false;
+            }
+            mOptions.mSnapshotTolerance = tolerance;
+        } else if (!strcmp(arg, "-snapshothash")) {
+            mOptions.mSnapshotHash = argv[++i];
+        } else if (!strcmp(arg, "-snapshothashref")) {
+            mOptions.mSnapshotHashReference = argv[++i];
+        } else if (!strcmp(arg, "-snapshothashdistance")) {
+            mOptions.mSnapshotHashDistance = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-forceanisolevel")) {
             mOptions.mForceAnisotropicLevel = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-step")) {
@@ -177,10 +374,29 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
             return false;
         } else if (!strcmp(arg, "-cpumask")) {
             mOptions.mCpuMask = argv[++i];
+        } else if (!strcmp(arg, "-threadaffinity")) {
+            mOptions.mThreadAffinity = argv[++i];
         } else if (!strcmp(arg, "-loop")) {
             mOptions.mLoopTimes = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-looptime")) {
             mOptions.mLoopSeconds = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-loopwarmup")) {
+            mOptions.mLoopWarmup = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-loopreset")) {
+            mOptions.mLoopReset = true;
+        } else if (!strcmp(arg, "-pace")) {
+            if (!strcmp(argv[++i], "capture")) {
+                mOptions.mPaceCapture = true;
+            } else {
+                mOptions.mPaceFps = readValidValue(argv[i]);
+            }
+        } else if (!strcmp(arg, "-presenttimes")) {
+            mOptions.mPresentTimes = true;
+        } else if (!strcmp(arg, "-presentfeedback")) {
+            mOptions.mPresentFeedback = true;
+        } else if (!strcmp(arg, "-presentvsync")) {
+            mOptions.mPresentTimes = true;
+            mOptions.mPresentVsync = true;
         } else if (!strcmp(arg, "-framerange")) {
             mOptions.mBeginMeasureFrame = readValidValue(argv[++i]);
             mOptions.mEndMeasureFrame = readValidValue(argv[++i]);
@@ -198,6 +414,27 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
                 DBG_LOG("Start frame must be lower than end frame. (End frame is never played.)\n");
                 return false;
             }
+        } else if (!strcmp(arg, "-preloadbudget")) {
+            mOptions.mPreloadBudget = readValidSize(argv[++i]);
+        } else if (!strcmp(arg, "-preloadhugepages")) {
+            mOptions.mPreloadHugepages = true;
+        } else if (!strcmp(arg, "-calltape")) {
+            mOptions.mCallTape = true;
+        } else if (!strcmp(arg, "-prefetch")) {
+            mOptions.mPrefetchChunks = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-prefetchthreads")) {
+            mOptions.mPrefetchThreads = readValidValue(argv[++i]);
+            if (mOptions.mPrefetchThreads < 1)
+            {
+                DBG_LOG("Number of prefetch threads must be at least one.\n");
+                return false;
+            }
+        } else if (!strcmp(arg, "-prefetchblobs")) {
+            mOptions.mPrefetchBlobCalls = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-prefetchblobsize")) {
+            mOptions.mPrefetchBlobSize = readValidSize(argv[++i]);
+        } else if (!strcmp(arg, "-streamwindow")) {
+            mOptions.mStreamWindow = readValidSize(argv[++i]);
         } else if (!strcmp(arg, "-jsonParameters")) {
             const char *jsonParameters = argv[++i];
             const char *resultFile = argv[++i];
@@ -205,27 +442,69 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
             std::ifstream t(jsonParameters);
             std::string str((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
             TraceExecutor::initFromJson(str, traceDir, resultFile);
+        } else if (!strcmp(arg, "-jsonBatch")) {
+            jsonBatchFile = argv[++i];
+            jsonBatchResultDir = argv[++i];
+            jsonBatchTraceDir = argv[++i];
+        } else if (!strcmp(arg, "-jobs")) {
+            batchJobs = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-jobdevices")) {
+            batchJobDevices = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-jobmemory")) {
+            batchJobMemory = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-concurrent")) {
+            batchConcurrent = true;
+        } else if (!strcmp(arg, "-daemon")) {
+            daemonPort = readValidValue(argv[++i]);
+            daemonResultDir = argv[++i];
+            daemonTraceDir = argv[++i];
+        } else if (!strcmp(arg, "-daemonbind")) {
+            daemonAddress = argv[++i];
         } else if (!strcmp(arg, "-info")) {
             printHeaderInfo = true;
+        } else if (!strcmp(arg, "-verify")) {
+            verifyTrace = true;
         } else if (!strcmp(arg, "-debug")) {
             mOptions.mDebug = 1;
         } else if (!strcmp(arg, "-debugfull")) {
             mOptions.mDebug = 2;
+        } else if (!strcmp(arg, "-debugsync")) {
+            mOptions.mDebugSync = true;
+            if (!mOptions.mDebug) mOptions.mDebug = 1;
         } else if (!strcmp(arg, "-statelog")) {
             mOptions.mStateLogging = true;
         } else if (!strcmp(arg, "-noscreen")) {
             mOptions.mPbufferRendering = true;
+        } else if (!strcmp(arg, "-headless")) {
+            mOptions.mHeadless = true;
+        } else if (!strcmp(arg, "-contextpriority")) {
+            mOptions.mContextPriority = argv[++i];
+        } else if (!strcmp(arg, "-device")) {
+            mOptions.mEglDevice = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-singlesurface")) {
             mOptions.mSingleSurface = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-surfaceatlas")) {
+            mOptions.mSurfaceAtlasWidth = readValidValue(argv[++i]);
+            mOptions.mSurfaceAtlasHeight = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-perfmon")) {
             mOptions.mPerfmon = true;
         } else if (!strcmp(arg, "-collect")) {
             if (!gRetracer.mCollectors) gRetracer.mCollectors = new Collection(Json::Value());
+            commandLineCollectors = true;
+        } else if (!strcmp(arg, "-collectstream")) {
+            mOptions.mCollectorStream = argv[++i];
         } else if (!strcmp(arg, "-collect_streamline")) {
             if (!gRetracer.mCollectors) gRetracer.mCollectors = new Collection(Json::Value());
-            streamline_collector = true;
+            commandLineCollectors = true;
+            streamlineCollector = true;
         } else if (!strcmp(arg, "-flushonswap")) {
             mOptions.mFinishBeforeSwap = true;
+        } else if (!strcmp(arg, "-framesinflight")) {
+            mOptions.mFramesInFlight = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-perframe")) {
+            mOptions.mMeasurePerFrame = true;
+        } else if (!strcmp(arg, "-shaderstats")) {
+            mOptions.mShaderStats = true;
         } else if (!strcmp(arg, "-flush")) {
             mOptions.mFlushWork = true;
         } else if (!strcmp(arg, "-infojson")) {
@@ -239,10 +518,17 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
             mOptions.mForceSingleWindow = true;
         } else if (!strcmp(arg, "-multithread")) {
             mOptions.mMultiThread = true;
+        } else if (!strcmp(arg, "-collapsethreads")) {
+            mOptions.mMultiThread = true;
+            mOptions.mCollapseThreads = true;
         } else if (!strcmp(arg, "-shadercache")) {
             mOptions.mShaderCacheFile = argv[++i];
         } else if(!strcmp(arg, "-strictshadercache")) {
             mOptions.mShaderCacheRequired = true;
+        } else if (!strcmp(arg, "-noprogrambinaries")) {
+            mOptions.mEmbeddedProgramBinaries = false;
+        } else if (!strcmp(arg, "-parallelcompile")) {
+            mOptions.mParallelShaderCompile = true;
         } else if (!strcmp(arg, "-insequence")) {
             // nothing, this is always the case now
         } else if (!strcmp(arg, "-singleframe")) {
@@ -251,6 +537,8 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
             mOptions.mOnscrSampleW *= 10;
             mOptions.mOnscrSampleNumX = 1;
             mOptions.mOnscrSampleNumY = 1;
+        } else if (!strcmp(arg, "-offscreenring")) {
+            mOptions.mOffscreenRing = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-overrideEGL")) {
             mOptions.mOverrideConfig.red = readValidValue(argv[++i]);
             mOptions.mOverrideConfig.green = readValidValue(argv[++i]);
@@ -263,7 +551,7 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
         } else if (!strcmp(arg, "-strictcolor")) {
             mOptions.mStrictColorMode = true;
         } else if (!strcmp(arg, "-skip")) {
-            mOptions.mSkipCallSet = new common::CallSet(argv[++i]);
+            mOptions.mSkipCallSet.reset(new common::CallSet(argv[++i]));
         } else if (strstr(arg, "-lib")) {
             const char* strEGL = "-libEGL_path=";
             const char* strGLES1 = "-libGLESv1_path=";
@@ -274,7 +562,7 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
                 SetCommandLineEGLPath(libPath);
             } else if (strstr(arg, strGLES1)) {
                 std::string libPath = std::string(arg).substr( strlen(strGLES1), strlen(arg) - strlen(strGLES1) );
-                SetCommandLineGLES2Path(libPath);
+                SetCommandLineGLES1Path(libPath);
             } else if (strstr(arg, strGLES2)) {
                 std::string libPath = std::string(arg).substr( strlen(strGLES2), strlen(arg) - strlen(strGLES2) );
                 SetCommandLineGLES2Path(libPath);
@@ -303,45 +591,227 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
         DBG_LOG("Single surface and single window options cannot be combined!\n");
         return false;
     }
-    if (mOptions.mLoopTimes && !mOptions.mPreload)
+    if (mOptions.mSurfaceAtlasWidth > 0 && (mOptions.mSingleSurface != -1 || mOptions.mForceSingleWindow || mOptions.mForceOffscreen || mOptions.mMultiThread))
+    {
+        DBG_LOG("Surface atlas cannot be combined with the single surface, single window, offscreen or multithread options!\n");
+        return false;
+    }
+    if ((mOptions.mLoopTimes || mOptions.mLoopWarmup) && !mOptions.mPreload)
     {
         DBG_LOG("Loop option requires preload\n");
         return false;
     }
+    if (mOptions.mPrefetchBlobCalls > 0 && !mOptions.mPreload)
+    {
+        DBG_LOG("Prefetchblobs option requires preload\n");
+        return false;
+    }
 
     if (gRetracer.mCollectors)
     {
-        std::vector<std::string> collectors = gRetracer.mCollectors->available();
-        std::vector<std::string> filtered;
-        for (const std::string& s : collectors)
+        initCommandLineCollectors();
+    }
+    return true;
+}
+
+/// Replay one -jsonBatch or -daemon entry, starting from the base options. Returns false if the
+/// trace could not be opened, with the error written to the result file. ready is called once the
+/// trace is open and the display set up, right before the replay, or when it fails to open.
+static bool retraceEntry(const Json::Value& entry, const RetraceOptions& base, const std::string& traceDir, const std::string& resultFile,
+                         const std::function<void()>& ready = nullptr)
+{
+    gRetracer.mOptions = base;
+    gRetracer.mStartupBegin = os::getTime();
+    // Collectors start afresh for every entry, from its parameters or else from the command line,
+    // rather than carry on with what the previous entry collected
+    delete gRetracer.mCollectors;
+    gRetracer.mCollectors = nullptr;
+    if (commandLineCollectors)
+    {
+        gRetracer.mCollectors = new Collection(Json::Value());
+        initCommandLineCollectors();
+    }
+    TraceExecutor::clearResult();
+    TraceExecutor::initFromJson(entry, traceDir, resultFile);
+    DBG_LOG("Replaying %s\n", gRetracer.mOptions.mFileName.c_str());
+    if (!gRetracer.OpenTraceFile(gRetracer.mOptions.mFileName.c_str()))
+    {
+        TraceExecutor::writeError(TRACE_ERROR_FILE_NOT_FOUND, "Failed to open " + gRetracer.mOptions.mFileName);
+        if (ready) ready();
+        return false;
+    }
+    const int64_t begin = os::getTime();
+    GLWS::instance().Init(gRetracer.mOptions.mApiVersion);
+    gRetracer.addStartupTime("egl_init", begin);
+    if (ready) ready();
+    gRetracer.Retrace();
+    return true;
+}
+
+static void registerEntries()
+{
+    const int64_t begin = os::getTime();
+    common::gApiInfo.RegisterEntries(gles_callbacks);
+    common::gApiInfo.RegisterEntries(egl_callbacks);
+    DBG_LOG("Registered the entry points in %.3f s\n", (os::getTime() - begin) / (float)os::timeFrequency);
+}
+
+/// Gather what the entries of a -concurrent batch achieved while they all ran, from their result files
+static void summarizeConcurrent(const Json::Value& batch, const std::vector<std::string>& resultFiles, const std::string& summaryFile)
+{
+    Json::Value summary;
+    Json::Value& traces = summary["traces"] = Json::arrayValue;
+    double overlapBegin = 0.0;
+    double overlapEnd = 0.0;
+    double combinedFps = 0.0;
+    bool first = true;
+    for (Json::ArrayIndex i = 0; i < batch.size(); i++)
+    {
+        Json::Value trace;
+        trace["file"] = batch[i].get("file", "").asString();
+        trace["resultFile"] = resultFiles[i];
+        trace["contextPriority"] = batch[i].get("contextPriority", "").asString();
+        std::ifstream in(resultFiles[i]);
+        Json::Value result;
+        Json::Reader reader;
+        // results are a list of one result per run
+        if (!in || !reader.parse(in, result) || !result["result"].isArray() || result["result"].empty() || !result["result"][0].isMember("fps"))
         {
-            if (s == "rusage" || s == "gpufreq" || s == "procfs" || s == "cpufreq" || s == "perf")
-            {
-                filtered.push_back(s);
-            }
-            else if (s == "streamline" && streamline_collector)
-            {
-                filtered.push_back(s);
-                DBG_LOG("Streamline integration support enabled\n");
-            }
+            trace["status"] = "failed";
+            traces.append(trace);
+            continue;
         }
-        if (!gRetracer.mCollectors->initialize(filtered))
+        const Json::Value& r = result["result"][0];
+        trace["status"] = "ok";
+        trace["fps"] = r["fps"];
+        trace["frames"] = r["frames"];
+        trace["time"] = r["time"];
+        trace["frame_time"] = r["frames"].asUInt() ? r["time"].asDouble() / r["frames"].asUInt() : 0.0;
+        trace["start_time"] = r["start_time"];
+        trace["end_time"] = r["end_time"];
+        traces.append(trace);
+
+        // monotonic time stamps, so comparable between the workers
+        const double begin = r["start_time"].asDouble();
+        const double end = r["end_time"].asDouble();
+        overlapBegin = first ? begin : std::max(overlapBegin, begin);
+        overlapEnd = first ? end : std::min(overlapEnd, end);
+        combinedFps += r["fps"].asDouble();
+        first = false;
+    }
+    summary["combined_fps"] = combinedFps;
+    summary["overlap_time"] = std::max(0.0, overlapEnd - overlapBegin); // that all of them ran for at once
+    std::ofstream out(summaryFile);
+    Json::StyledStreamWriter writer;
+    writer.write(out, summary);
+    DBG_LOG("Replayed %u traces at once, %.2f frames per second together, all of them running for %.2f s\n",
+            batch.size(), combinedFps, summary["overlap_time"].asDouble());
+}
+
+static int retraceBatch()
+{
+    std::ifstream t(jsonBatchFile);
+    Json::Value batch;
+    Json::Reader reader;
+    if (!t || !reader.parse(t, batch) || !batch.isArray())
+    {
+        DBG_LOG("%s is not a JSON list of parameters: %s\n", jsonBatchFile, reader.getFormattedErrorMessages().c_str());
+        return 1;
+    }
+
+    registerEntries();
+
+    if (batchJobs > 1 || batchConcurrent)
+    {
+        // Every entry runs in a worker process of its own, started from the command line options.
+        // The retracer state is global, so concurrent traces need processes of their own too.
+        const RetraceOptions base = gRetracer.mOptions;
+        BatchScheduler scheduler(batchJobs, batchJobDevices, (uint64_t)batchJobMemory * 1024 * 1024);
+        scheduler.setStartBarrier(batchConcurrent);
+        std::vector<std::string> resultFiles;
+        for (Json::ArrayIndex i = 0; i < batch.size(); i++)
         {
-            fprintf(stderr, "Failed to initialize collectors\n");
+            const Json::Value& entry = batch[i];
+            const std::string file = entry.get("file", "").asString();
+            BatchScheduler::Job job;
+            job.index = i;
+            job.traceFile = (!file.empty() && file[0] == '/') ? file : jsonBatchTraceDir + "/" + file;
+            job.resultFile = jsonBatchResultDir + "/" + entry.get("resultFile", "result_" + std::to_string(i) + ".json").asString();
+            job.memory = BatchScheduler::estimateMemory(entry, job.traceFile);
+            scheduler.add(job);
+            resultFiles.push_back(job.resultFile);
         }
-        else DBG_LOG("libcollector instrumentation enabled through cmd line.\n");
+        const int failed = scheduler.run([&](const BatchScheduler::Job& job, int device)
+        {
+            RetraceOptions options = base;
+            if (device >= 0) options.mEglDevice = device;
+            return retraceEntry(batch[job.index], options, jsonBatchTraceDir, job.resultFile, [&]{ scheduler.waitForStart(); }) ? 0 : 1;
+        }, jsonBatchResultDir + "/batch.jsonl");
+        if (batchConcurrent)
+        {
+            summarizeConcurrent(batch, resultFiles, jsonBatchResultDir + "/concurrent.json");
+        }
+        DBG_LOG("Replayed %u traces in %d workers, %d failed\n", batch.size(), batchConcurrent ? (int)batch.size() : batchJobs, failed);
+        return failed ? 1 : 0;
     }
-    return true;
+
+    // Every entry starts from the command line options, and the display, its windows and the
+    // shader cache are kept for the next one. An abort still ends the whole batch.
+    const RetraceOptions base = gRetracer.mOptions;
+    gRetracer.mKeepDisplay = true;
+    int failed = 0;
+    for (Json::ArrayIndex i = 0; i < batch.size(); i++)
+    {
+        const Json::Value& entry = batch[i];
+        const std::string resultFile = jsonBatchResultDir + "/" + entry.get("resultFile", "result_" + std::to_string(i) + ".json").asString();
+        DBG_LOG("Batch entry %u of %u\n", i + 1, batch.size());
+        failed += !retraceEntry(entry, base, jsonBatchTraceDir, resultFile);
+    }
+    GLWS::instance().Cleanup();
+    DBG_LOG("Replayed %u traces, %d could not be opened\n", batch.size() - failed, failed);
+    return failed ? 1 : 0;
+}
+
+static int retraceDaemon()
+{
+    ReplayDaemon daemon(daemonTraceDir, daemonResultDir);
+    if (!daemon.listen(daemonAddress, daemonPort))
+    {
+        return 1;
+    }
+    registerEntries();
+
+    // As for -jsonBatch, every request starts from the command line options, and the display
+    // and shader cache are kept for the next one. An abort still ends the daemon.
+    const RetraceOptions base = gRetracer.mOptions;
+    gRetracer.mKeepDisplay = true;
+    daemon.serve([&](const Json::Value& request, const std::string& resultFile)
+    {
+        return retraceEntry(request, base, daemonTraceDir, resultFile);
+    });
+    GLWS::instance().Cleanup();
+    return 0;
 }
 
 extern "C"
 int main(int argc, char** argv)
 {
+    gRetracer.mStartupBegin = os::getTime();
     if (!ParseCommandLine(argc, argv, gRetracer.mOptions))
     {
         return 1;
     }
 
+    if (jsonBatchFile)
+    {
+        return retraceBatch();
+    }
+
+    if (daemonPort > 0)
+    {
+        return retraceDaemon();
+    }
+
     if (gRetracer.mOptions.mFileName.empty())
     {
         std::cerr << "No trace file name specified.\n";
@@ -371,9 +841,29 @@ int main(int argc, char** argv)
         return 0;
     }
 
+    if (verifyTrace)
+    {
+        const std::string& name = gRetracer.mOptions.mFileName;
+        common::TraceIndex index;
+        if (!index.loadFromTrace(name) || index.mChecksums.empty())
+        {
+            // all that can be checked then is that the chunks follow each other up to the end of the file
+            const bool ok = index.scanChunks(name);
+            printf("%s has no chunk checksums, its chunks %s\n", name.c_str(), ok ? "are complete" : "are broken");
+            return ok ? 0 : 1;
+        }
+        const int64_t begin = os::getTime();
+        const unsigned failed = index.verifyChunks(name);
+        printf("%u of %u chunks of %s failed their checksums (%.2f s)\n", failed, (unsigned)index.mChecksums.size(), name.c_str(),
+               (os::getTime() - begin) / (double)os::timeFrequency);
+        return failed ? 1 : 0;
+    }
+
     // Register Entries before opening tracefile as sigbook is read there
+    int64_t begin = os::getTime();
     common::gApiInfo.RegisterEntries(gles_callbacks);
     common::gApiInfo.RegisterEntries(egl_callbacks);
+    gRetracer.addStartupTime("register_entries", begin);
 
     if (!gRetracer.OpenTraceFile(gRetracer.mOptions.mFileName.c_str()))
     {
@@ -382,7 +872,9 @@ int main(int argc, char** argv)
     }
 
     // 3. init egl and gles, using final combination of settings (header + override)
+    begin = os::getTime();
     GLWS::instance().Init(gRetracer.mOptions.mApiVersion);
+    gRetracer.addStartupTime("egl_init", begin);
 
     if (gRetracer.mOptions.mStepMode)
     {
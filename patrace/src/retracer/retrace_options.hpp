@@ -1,8 +1,10 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 #include "retracer/eglconfiginfo.hpp"
+#include "common/image.hpp"
 #include "common/trace_callset.hpp"
 
 namespace retracer
@@ -25,23 +27,32 @@ struct RetraceOptions
         , mOverrideConfig(-1, -1, -1, -1, -1, -1, -1, -1)
     {}
 
-    ~RetraceOptions()
-    {
-        delete mSnapshotCallSet;
-        delete mSkipCallSet;
-    }
-
     std::string         mFileName;
     int                 mRetraceTid = -1;
     bool                mForceOffscreen = false;
     bool                mDoOverrideWinSize = false;
     bool                mDoOverrideResolution = false;
     bool                mPreload = false;
+    uint64_t            mPreloadBudget = 0;
+    bool                mPreloadHugepages = false;
+    bool                mCallTape = false;
+    int                 mPrefetchChunks = 0;
+    int                 mPrefetchThreads = 1;
+    unsigned            mPrefetchBlobCalls = 0;
+    uint64_t            mPrefetchBlobSize = 64 * 1024;
+    uint64_t            mStreamWindow = 0;
     bool                mStepMode = false;
     unsigned int        mBeginMeasureFrame = 1;
     unsigned int        mEndMeasureFrame = INT32_MAX;
     int                 mLoopTimes = 0;
     int                 mLoopSeconds = 0;
+    int                 mLoopWarmup = 0; ///< tolerance in percent, loop until frame times settle within it
+    bool                mLoopReset = false; ///< delete objects made by the frame range and rebind before each loop
+    int                 mPaceFps = 0; ///< present frames at this rate instead of as fast as possible
+    bool                mPaceCapture = false; ///< present frames at the intervals recorded in the trace
+    bool                mPresentTimes = false; ///< record when frames were latched and presented, see PresentTimer
+    bool                mPresentVsync = false; ///< also give each frame its own vsync to be presented at
+    bool                mPresentFeedback = false; ///< collect the presentation feedback of Wayland or X11, see PresentFeedback
 
     int                 mWindowWidth = 0;
     int                 mWindowHeight = 0;
@@ -51,12 +62,20 @@ struct RetraceOptions
     float               mOverrideResRatioH = 0.0f;
 
     std::string         mSnapshotPrefix;
-    common::CallSet*    mSnapshotCallSet = nullptr;
+    std::shared_ptr<common::CallSet> mSnapshotCallSet; ///< shared by copies, never changed once parsed
     bool                mUploadSnapshots = false;
+    image::PNGOptions   mSnapshotPNG; ///< how snapshots and image dumps are compressed
+    bool                mSnapshotQOI = false; ///< write snapshots as QOI rather than PNG
+    std::string         mSnapshotCompare; ///< directory of reference snapshots to compare with instead of writing
+    unsigned            mSnapshotTolerance = 0; ///< largest difference in a channel that still matches
+    std::string         mSnapshotHash; ///< file of snapshot hashes to write instead of the snapshots
+    std::string         mSnapshotHashReference; ///< snapshot hashes of an earlier run to compare with
+    unsigned            mSnapshotHashDistance = 0; ///< bits that a perceptual hash may differ from its reference
     bool                mFailOnShaderError = false;
     int                 mDebug = 0;
+    bool                mDebugSync = false; ///< KHR_debug errors are reported from within the call that raised them
     bool                mStateLogging = false;
-    common::CallSet*    mSkipCallSet = nullptr;
+    std::shared_ptr<common::CallSet> mSkipCallSet;
 
     EglConfigInfo mOnscreenConfig;
     EglConfigInfo mOffscreenConfig;
@@ -75,15 +94,43 @@ struct RetraceOptions
     unsigned int        mOnscrSampleH = 27;
     unsigned int        mOnscrSampleNumX = 10;
     unsigned int        mOnscrSampleNumY = 10;
+    int                 mOffscreenRing = 2; ///< offscreen targets frames are rendered into in turn
     int                 mForceAnisotropicLevel = -1;
 
     bool                mForceSingleWindow = false;
     bool                mMultiThread = false;
+    bool                mCollapseThreads = false; ///< replay the calls of all threads on one thread, switching contexts between them
     int                 mSkipWork = -1;
+    bool                mFastSeek = false; ///< skip rendering before the frame range that it does not depend on, see FastSeek
+    std::string         mInvalidateFile; ///< invalidates to add to the replay, see InvalidationInjector
     bool                mCallStats = false;
+    bool                mStubDriver = false; ///< replay against the no-op egl_stub and gles2_stub libraries
+    bool                mDrawTime = false;
+    bool                mCounterPasses = false; ///< hardware counters of every render pass, see CounterSampler
+    std::string         mCollectorStream; ///< file to stream the collected values of every frame to
+    std::shared_ptr<common::CallSet> mCounterCallSet; ///< draws to take hardware counters of
+    int                 mStageUploads = 0; ///< size of the upload ring in MB, zero to upload directly
+    bool                mFilterState = false; ///< skip calls that do not change state, see StateFilter
+    bool                mBatchUniforms = false; ///< apply runs of uniform calls at once, see UniformBatch
+    bool                mBufferPool = false; ///< recycle the buffers of glGenGraphicBuffer_ARM, see GraphicBufferPool
+    bool                mSnapshotHardwareBuffers = false; ///< read snapshots through AHardwareBuffers, see SnapshotQueue
+    std::string         mThumbnailFile; ///< take thumbnails instead of snapshots into this file, see ThumbnailWriter
+    unsigned            mThumbnailWidth = 256;
+    std::string         mTranscodeDir; ///< decode compressed textures the driver lacks and keep them here, see TextureTranscoder
+    bool                mMemoryTimeline = false; ///< sample memory use every frame, see MemoryTimeline
+    std::string         mTimelineFile;
 
     bool                mPbufferRendering = false;
+    int                 mEglDevice = -1; ///< EGL device to render headless or to pbuffers on, -1 for the default one
+    std::string         mContextPriority; ///< "high", "medium" or "low" with EGL_IMG_context_priority, empty to leave it to EGL
+#if defined(ENABLE_SURFACELESS)
+    bool                mHeadless = true; ///< there is no window system to render to in this build
+#else
+    bool                mHeadless = false;
+#endif
     int                 mSingleSurface = -1;
+    int                 mSurfaceAtlasWidth = 0; ///< size of the one window that -surfaceatlas draws all window surfaces into, zero without it
+    int                 mSurfaceAtlasHeight = 0;
 
     bool                mFlushWork = false;
 
@@ -92,26 +139,27 @@ struct RetraceOptions
     int                 mPerfFreq = 1000;
 
     bool                mFinishBeforeSwap = false;
+    unsigned            mFramesInFlight = 0; ///< zero for no limit, see FrameLimiter
+    bool                mShaderStats = false;
     bool                mPerfmon = false;
 
     std::vector<unsigned int> mLinkErrorWhiteListCallNum;
+    bool                mPerfExternal = false; ///< run the perf tool for -perf instead of sampling in process
 #if __ANDROID__
     std::string         mPerfPath = "/system/bin/perf";
-    std::string         mPerfOut = "/sdcard/perf.data";
 #else
     std::string         mPerfPath = "/usr/bin/perf";
-    std::string         mPerfOut = "perf.data";
 #endif
+    std::string         mPerfOut; ///< empty for the default of the -perf mode
 
     std::string         mCpuMask;
+    std::string         mThreadAffinity; ///< see ThreadPlacement
 
     bool                dmaSharedMemory = false;
     std::string         mShaderCacheFile;
     bool                mShaderCacheRequired = false;
-private:
-    // Noncopyable because of owned CallSet pointer members
-    RetraceOptions(const RetraceOptions&);
-    RetraceOptions& operator=(const RetraceOptions&);
+    bool                mEmbeddedProgramBinaries = true; ///< use those in the trace when there is no mShaderCacheFile
+    bool                mParallelShaderCompile = false;
 };
 
 }
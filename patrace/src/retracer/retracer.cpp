@@ -16,11 +16,13 @@
 #include "helper/shadermod.hpp"
 
 #include "dispatch/eglproc_auto.hpp"
+#include "dispatch/eglproc_retrace.hpp"
 
 #include "common/image.hpp"
 #include "common/os_string.hpp"
 #include "common/pa_exception.h"
 #include "common/gl_extension_supported.hpp"
+#include "common/trace_index.hpp"
 
 #include "hwcpipe/hwcpipe.h"
 
@@ -29,6 +31,7 @@
 
 #include <chrono>
 #include <errno.h>
+#include <math.h>
 #include <algorithm> // for std::min/max
 #include <string>
 #include <sstream>
@@ -58,17 +61,6 @@ namespace retracer {
 
 Retracer gRetracer;
 
-static inline uint64_t gettime()
-{
-    struct timespec t;
-    // CLOCK_MONOTONIC_COARSE is much more light-weight, but resolution is quite poor.
-    // CLOCK_PROCESS_CPUTIME_ID is another possibility, it ignores rest of system, but costs more,
-    // and also on some CPUs process migration between cores can screw up such measurements.
-    // CLOCK_MONOTONIC is therefore a reasonable and portable compromise.
-    clock_gettime(CLOCK_MONOTONIC, &t);
-    return ((uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec);
-}
-
 /// -- Mali HWCPipe support
 
 struct mali_hwc
@@ -454,21 +446,33 @@ Retracer::~Retracer()
     delete mCollectors;
 
 #ifndef NDEBUG
-    if (mVBODataSize) DBG_LOG("VBO data size : %d\n", mVBODataSize);
-    if (mTextureDataSize) DBG_LOG("Uncompressed texture data size : %d\n", mTextureDataSize);
-    if (mCompressedTextureDataSize) DBG_LOG("Compressed texture data size : %d\n", mCompressedTextureDataSize);
-    if (mClientSideMemoryDataSize) DBG_LOG("Client-side memory data size : %d\n", mClientSideMemoryDataSize);
+    if (mVBODataSize) DBG_LOG("VBO data size : %" PRIu64 "\n", mVBODataSize);
+    if (mTextureDataSize) DBG_LOG("Uncompressed texture data size : %" PRIu64 "\n", mTextureDataSize);
+    if (mCompressedTextureDataSize) DBG_LOG("Compressed texture data size : %" PRIu64 "\n", mCompressedTextureDataSize);
+    if (mClientSideMemoryDataSize) DBG_LOG("Client-side memory data size : %" PRIu64 "\n", mClientSideMemoryDataSize);
 #endif
 }
 
+void Retracer::addStartupTime(const char* phase, int64_t begin)
+{
+    mStartupTimes[phase] = ticksToSeconds(os::getTime() - begin);
+}
+
 bool Retracer::OpenTraceFile(const char* filename)
 {
+    int64_t begin = os::getTime();
     if (!mFile.Open(filename))
         return false;
 
+    resetTraceState();
+    addStartupTime("open_trace", begin);
+    mStartupTimes["header_parse"] = ticksToSeconds(mFile.getHeaderParseTime());
+    mStartupTimes["sigbook"] = ticksToSeconds(mFile.getSigBookTime());
     mFileFormatVersion = mFile.getHeaderVersion();
     mStateLogger.open(std::string(filename) + ".retracelog");
+    begin = os::getTime();
     loadRetraceOptionsFromHeader();
+    addStartupTime("header_options", begin);
     mExIdEglSwapBuffers = mFile.NameToExId("eglSwapBuffers");
     mExIdEglSwapBuffersWithDamage = mFile.NameToExId("eglSwapBuffersWithDamageKHR");
     mFinish.store(false);
@@ -478,61 +482,32 @@ bool Retracer::OpenTraceFile(const char* filename)
     return true;
 }
 
-__attribute__ ((noinline)) static int noop(int a)
-{
-    return a + 1;
-}
-
 void Retracer::CloseTraceFile() {
-    mFile.Close();
-    mFileFormatVersion = INVALID_VERSION;
-    mStateLogger.close();
-
     if (mOptions.mCallStats)
     {
         // First generate some info on no-op calls as a baseline
-        int c = 0;
-        for (int i = 0; i < 1000; i++)
-        {
-            auto pre = gettime();
-            c = noop(c);
-            auto post = gettime();
-            mCallStats["NO-OP"].count++;
-            mCallStats["NO-OP"].time += post - pre;
-            usleep(c); // just to use c for something, to make 100% sure it is not optimized away
-        }
+        mCallStats.measureBaseline();
 #if ANDROID
         const char *filename = "/sdcard/callstats.csv";
 #else
         const char *filename = "callstats.csv";
 #endif
         DBG_LOG("Writing callstats to %s\n", filename);
-        FILE *fp = fopen(filename, "w");
-        if (fp)
-        {
-            fprintf(fp, "Function,Calls,Time\n");
-            for (const auto& pair : mCallStats)
-            {
-                fprintf(fp, "%s,%" PRIu64 ",%" PRIu64 "\n", pair.first.c_str(), pair.second.count, pair.second.time);
-            }
-            fsync(fileno(fp));
-            fclose(fp);
-        }
-        else
-        {
-            DBG_LOG("Failed to open output callstats in %s: %s\n", filename, strerror(errno));
-        }
+        mCallStats.write(filename, mFile); // needs the function names of the trace
         mCallStats.clear();
     }
 
+    mFile.Close();
+    mFileFormatVersion = INVALID_VERSION;
+    mStateLogger.close();
+
     mState.Reset();
     mCSBuffers.clear();
     mSnapshotPaths.clear();
 
-    if (shaderCacheFile)
+    if (!mKeepDisplay)
     {
-        fclose(shaderCacheFile);
-        shaderCacheFile = NULL;
+        shaderCache.close();
     }
 }
 
@@ -554,16 +529,25 @@ bool Retracer::loadRetraceOptionsByThreadId(int tid)
 void Retracer::loadRetraceOptionsFromHeader()
 {
     // Load values from headers first, then any valid commandline parameters override the header defaults.
-    const Json::Value jsHeader = mFile.getJSONHeader();
-    if (mOptions.mRetraceTid == -1) mOptions.mRetraceTid = jsHeader.get("defaultTid", -1).asInt();
+    // Only the members needed are looked up, so that the whole header is not parsed.
+    const Json::Value defaultTid = mFile.getJSONHeaderMember("defaultTid");
+    const Json::Value forceSingleWindow = mFile.getJSONHeaderMember("forceSingleWindow");
+    const Json::Value singleSurface = mFile.getJSONHeaderMember("singleSurface");
+    const Json::Value multiThread = mFile.getJSONHeaderMember("multiThread");
+    if (mOptions.mRetraceTid == -1 && !defaultTid.isNull()) mOptions.mRetraceTid = defaultTid.asInt();
     if (mOptions.mRetraceTid == -1) reportAndAbort("No thread ID set!\n");
-    if (jsHeader.isMember("forceSingleWindow")) mOptions.mForceSingleWindow = jsHeader.get("forceSingleWindow", false).asBool();
-    if (jsHeader.isMember("singleSurface")) mOptions.mSingleSurface = jsHeader.get("singleSurface", false).asInt();
+    if (!forceSingleWindow.isNull()) mOptions.mForceSingleWindow = forceSingleWindow.asBool();
+    if (!singleSurface.isNull()) mOptions.mSingleSurface = singleSurface.asInt();
     if (mOptions.mForceSingleWindow && mOptions.mSingleSurface != -1) reportAndAbort("forceSingleWindow and singleSurface cannot be used together");
     if (mOptions.mForceSingleWindow) DBG_LOG("Enabling force single window option\n");
-    if (jsHeader.isMember("multiThread")) mOptions.mMultiThread = jsHeader.get("multiThread", false).asBool();
-    if (mOptions.mMultiThread) DBG_LOG("Enabling multiple thread option\n");
-    switch (jsHeader["glesVersion"].asInt())
+    if (!multiThread.isNull()) mOptions.mMultiThread = multiThread.asBool();
+    if (mOptions.mCollapseThreads) mOptions.mMultiThread = true; // all threads are replayed, only not on threads of their own
+    if (mOptions.mMultiThread) DBG_LOG("Enabling multiple thread option%s\n", mOptions.mCollapseThreads ? ", on one thread" : "");
+    if (mOptions.mSurfaceAtlasWidth > 0 && (mOptions.mForceSingleWindow || mOptions.mSingleSurface != -1 || mOptions.mForceOffscreen || mOptions.mMultiThread))
+    {
+        reportAndAbort("surfaceAtlas cannot be used with forceSingleWindow, singleSurface, offscreen or multiThread");
+    }
+    switch (mFile.getJSONHeaderMember("glesVersion").asInt())
     {
     case 1: mOptions.mApiVersion = PROFILE_ES1; break;
     case 2: mOptions.mApiVersion = PROFILE_ES2; break;
@@ -571,11 +555,17 @@ void Retracer::loadRetraceOptionsFromHeader()
     default: DBG_LOG("Error: Invalid glesVersion parameter\n"); break;
     }
     loadRetraceOptionsByThreadId(mOptions.mRetraceTid);
-    const Json::Value& linkErrorWhiteListCallNum = jsHeader["linkErrorWhiteListCallNum"];
+    const Json::Value linkErrorWhiteListCallNum = mFile.getJSONHeaderMember("linkErrorWhiteListCallNum");
     for(unsigned int i=0; i<linkErrorWhiteListCallNum.size(); i++)
     {
         mOptions.mLinkErrorWhiteListCallNum.push_back(linkErrorWhiteListCallNum[i].asUInt());
     }
+    if (mOptions.mHeadless)
+    {
+        // Render to the offscreen FBO, with surfaceless contexts or else pbuffers behind it
+        mOptions.mForceOffscreen = true;
+        mOptions.mPbufferRendering = true;
+    }
     if (mOptions.mForceOffscreen)
     {
         // When running offscreen, force onscreen EGL to most compatible mode known: 5650 00
@@ -648,6 +638,15 @@ void Retracer::dumpUniformBuffers(unsigned int callNo)
         {
             glUnmapBuffer(GL_UNIFORM_BUFFER);
         }
+        if (mAsyncSnapshots)
+        {
+            std::stringstream ss;
+            ss << mOptions.mSnapshotPrefix << std::setw(10) << std::setfill('0') << callNo << "_b" << ubName << ".bin";
+            if (mBufferDumpQueue.read(ubNameNew, size, ss.str(), callNo))
+            {
+                continue; // written by mBufferDumpQueue
+            }
+        }
         char* bufferdata = (char*)glMapBufferRange(GL_UNIFORM_BUFFER,
                                                    0,
                                                    size,
@@ -668,10 +667,12 @@ void Retracer::dumpUniformBuffers(unsigned int callNo)
         if (!fd)
         {
             DBG_LOG("Unable to open %s\n", ss.str().c_str());
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
             continue;
         }
         fwrite(bufferdata, 1, size, fd);
         fclose(fd);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
         DBG_LOG("Wrote %s\n", ss.str().c_str());
     }
 }
@@ -728,12 +729,15 @@ void Retracer::StepShot(unsigned int callNo, unsigned int frameNo, const char *f
 
 void Retracer::TakeSnapshot(unsigned int callNo, unsigned int frameNo, const char *filename)
 {
+    TimelineScope scope("snapshot", "TakeSnapshot", callNo);
+    const char *extension = mOptions.mSnapshotQOI ? ".qoi" : ".png";
     // Only take snapshots inside the measurement range
     const bool inRange = mOptions.mBeginMeasureFrame <= frameNo && frameNo <= mOptions.mEndMeasureFrame;
     if (mOptions.mUploadSnapshots && !inRange)
     {
         return;
     }
+    mStateFilter.reset(); // snapshots bind textures and programs of their own
     // Add state log dumps, if these are enabled, at the same time
     if (mOptions.mStateLogging)
     {
@@ -749,30 +753,14 @@ void Retracer::TakeSnapshot(unsigned int callNo, unsigned int frameNo, const cha
         if(colorAttachment != GL_NONE)
         {
             colorAttach = true;
-            int readFboId = 0, drawFboId = 0;
-            _glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFboId);
-            _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFboId);
+            // bound again as they were below, so that the shadow stays right
+            const GLuint readFboId = getCurrentContext()._shadow.readFramebuffer();
+            const GLuint drawFboId = getCurrentContext()._shadow.drawFramebuffer();
 #if TARGET_OS_IPHONE || TARGET_IPHONE_SIMULATOR
             const unsigned int ON_SCREEN_FBO = 1;
 #else
             const unsigned int ON_SCREEN_FBO = 0;
 #endif
-            if (gRetracer.mOptions.mForceOffscreen) {
-                _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ON_SCREEN_FBO);
-                gRetracer.mpOffscrMgr->BindOffscreenReadFBO();
-            }
-            else {
-                _glBindFramebuffer(GL_READ_FRAMEBUFFER, drawFboId);
-            }
-            image::Image *src = getDrawBufferImage(colorAttachment);
-            _glBindFramebuffer(GL_READ_FRAMEBUFFER, readFboId);
-            _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFboId);
-            if (src == NULL)
-            {
-                DBG_LOG("Failed to take snapshot for call no: %d\n", callNo);
-                return;
-            }
-
             std::string filenameToBeUsed;
             if (filename)
             {
@@ -790,16 +778,58 @@ void Retracer::TakeSnapshot(unsigned int callNo, unsigned int frameNo, const cha
                 std::stringstream ss;
                 if (mOptions.mSnapshotFrameNames || mOptions.mLoopTimes > 0 || mOptions.mLoopSeconds > 0)
                 {
-                    ss << mOptions.mSnapshotPrefix << std::setw(4) << std::setfill('0') << frameNo << "_l" << mLoopTimes << ".png";
+                    ss << mOptions.mSnapshotPrefix << std::setw(4) << std::setfill('0') << frameNo << "_l" << mLoopTimes << extension;
                 }
                 else // use classic weird name
                 {
-                    ss << mOptions.mSnapshotPrefix << std::setw(10) << std::setfill('0') << callNo << "_c" << attachmentIndex << ".png";
+                    ss << mOptions.mSnapshotPrefix << std::setw(10) << std::setfill('0') << callNo << "_c" << attachmentIndex << extension;
                 }
                 filenameToBeUsed = ss.str();
             }
 
-            if (src->writePNG(filenameToBeUsed.c_str()))
+            if (gRetracer.mOptions.mForceOffscreen) {
+                _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ON_SCREEN_FBO);
+                gRetracer.mpOffscrMgr->BindOffscreenReadFBO();
+            }
+            else {
+                _glBindFramebuffer(GL_READ_FRAMEBUFFER, drawFboId);
+            }
+            if (mThumbnails.isOpen())
+            {
+                if (!mThumbnails.read(colorAttachment, frameNo, callNo))
+                {
+                    DBG_LOG("Failed to take thumbnail for call no: %d\n", callNo);
+                }
+                _glBindFramebuffer(GL_READ_FRAMEBUFFER, readFboId);
+                _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFboId);
+                break; // of the first color attachment only
+            }
+            const bool matched = mSnapshotComparer.enabled() &&
+                                 mSnapshotComparer.compare(colorAttachment, filenameToBeUsed, frameNo, callNo) == SnapshotComparer::MATCH;
+            const bool queued = !matched && mAsyncSnapshots && mSnapshotQueue.read(colorAttachment, filenameToBeUsed, frameNo, callNo);
+            image::Image *src = (queued || matched) ? NULL : getDrawBufferImage(colorAttachment);
+            _glBindFramebuffer(GL_READ_FRAMEBUFFER, readFboId);
+            _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFboId);
+            if (matched)
+            {
+                continue; // only written when it differs from its reference
+            }
+            if (queued)
+            {
+                continue; // written by mSnapshotQueue
+            }
+            if (src == NULL)
+            {
+                DBG_LOG("Failed to take snapshot for call no: %d\n", callNo);
+                return;
+            }
+            if (mSnapshotHashes.enabled() && !mSnapshotHashes.record(*src, filenameToBeUsed, frameNo, callNo))
+            {
+                delete src;
+                continue; // only its hashes are kept
+            }
+
+            if (src->write(filenameToBeUsed.c_str()))
             {
                 DBG_LOG("Snapshot (frame %d, call %d) : %s\n", frameNo, callNo, filenameToBeUsed.c_str());
 
@@ -820,9 +850,8 @@ void Retracer::TakeSnapshot(unsigned int callNo, unsigned int frameNo, const cha
     if (!colorAttach)   // no color attachment, there might be a depth attachment
     {
         DBG_LOG("no color attachment, there might be a depth attachment\n");
-        int readFboId = 0, drawFboId = 0;
-        _glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFboId);
-        _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFboId);
+        const GLuint readFboId = getCurrentContext()._shadow.readFramebuffer();
+        const GLuint drawFboId = getCurrentContext()._shadow.drawFramebuffer();
 #if TARGET_OS_IPHONE || TARGET_IPHONE_SIMULATOR
         const unsigned int ON_SCREEN_FBO = 1;
 #else
@@ -854,16 +883,16 @@ void Retracer::TakeSnapshot(unsigned int callNo, unsigned int frameNo, const cha
             std::stringstream ss;
             if (mOptions.mSnapshotFrameNames)
             {
-                ss << mOptions.mSnapshotPrefix << std::setw(4) << std::setfill('0') << frameNo << ".png";
+                ss << mOptions.mSnapshotPrefix << std::setw(4) << std::setfill('0') << frameNo << extension;
             }
             else
             {
-                ss << mOptions.mSnapshotPrefix << std::setw(10) << std::setfill('0') << callNo << "_depth.png";
+                ss << mOptions.mSnapshotPrefix << std::setw(10) << std::setfill('0') << callNo << "_depth" << extension;
             }
             filenameToBeUsed = ss.str();
         }
 
-        if (src->writePNG(filenameToBeUsed.c_str()))
+        if (src->write(filenameToBeUsed.c_str()))
         {
             DBG_LOG("Snapshot (frame %d, call %d) : %s\n", frameNo, callNo, filenameToBeUsed.c_str());
 
@@ -1131,35 +1160,21 @@ void forceRenderMosaicToScreen()
 static void report_cpu_mask()
 {
     cpu_set_t mask;
-    std::string descr;
     int retval = sched_getaffinity(0, sizeof(mask), &mask);
     if (retval != 0)
     {
         DBG_LOG("Failed to get CPU mask: %s\n", strerror(errno));
     }
-    for (unsigned i = 0; i < sizeof(mask) / CPU_ALLOC_SIZE(1); i++)
-    {
-        descr += CPU_ISSET(i, &mask) ? "1" : "0";
-    }
-    while (descr.back() == '0') descr.pop_back(); // on Android, string will be very long otherwise
-    DBG_LOG("Current CPU mask: %s\n", descr.c_str());
+    DBG_LOG("Current CPU mask: %s\n", cpuMaskToString(mask).c_str());
 }
 
 static void set_cpu_mask(const std::string& descr)
 {
     cpu_set_t mask;
-    CPU_ZERO(&mask);
-    for (unsigned i = 0; i < descr.size(); i++)
+    if (!parseCpuMask(descr, mask))
     {
-        if (descr.at(i) == '1')
-        {
-            CPU_SET(i, &mask);
-        }
-        else if (descr.at(i) != '0')
-        {
-            DBG_LOG("Invalid CPU mask: %s!\n", descr.c_str());
-            return;
-        }
+        DBG_LOG("Invalid CPU mask: %s!\n", descr.c_str());
+        return;
     }
     int retval = sched_setaffinity(0, sizeof(mask), &mask);
     if (retval != 0)
@@ -1174,76 +1189,216 @@ void Retracer::perfMonInit()
     delayedPerfmonInit = false;
 }
 
-// Only one thread runs at a time, so no need for mutexing etc. except for when we go to sleep.
-void Retracer::RetraceThread(const int threadidx, const int our_tid)
+void Retracer::setupCallLoop()
 {
-    std::unique_lock<std::mutex> lk(mConditionMutex);
-    thread_result r;
-    r.our_tid = our_tid;
+    mLoop.features = 0;
+    if (mOptions.mSnapshotCallSet) mLoop.features |= CALL_SNAPSHOT;
+    if (mOptions.mSkipCallSet || mFastSeek.active() || mOptions.mSkipWork >= 0) mLoop.features |= CALL_SKIP;
+    if (mBatchingUniforms) mLoop.features |= CALL_UNIFORM_BATCH;
+    if (mGpuTiming) mLoop.features |= CALL_GPU_TIMING;
+    if (mCounterSampling) mLoop.features |= CALL_COUNTERS;
+    if (gTimeline.enabled()) mLoop.features |= CALL_TIMELINE;
+    if (mFramePhases.enabled()) mLoop.features |= CALL_PHASES;
+    if (mOptions.mCallStats) mLoop.features |= CALL_STATS;
+    if (mOptions.mDebug) mLoop.features |= CALL_DEBUG;
+    if (mOptions.mStepMode) mLoop.features |= CALL_STEP;
+    if (mInvalidation.active()) mLoop.features |= CALL_INVALIDATE;
+    mLoop.beginMeasureFrame = mOptions.mBeginMeasureFrame;
+    mLoop.endMeasureFrame = mOptions.mEndMeasureFrame;
+    mLoop.retraceTid = mOptions.mRetraceTid;
+    mLoop.multiThread = mOptions.mMultiThread;
+    mLoop.collapseThreads = mOptions.mCollapseThreads;
+    mLoop.swapBuffersId = mExIdEglSwapBuffers;
+    mLoop.swapBuffersWithDamageId = mExIdEglSwapBuffersWithDamage;
+}
+
+// The GL objects of these belong to the current context, so they must be done with before another is made current
+void Retracer::FlushContextWork()
+{
+    mSnapshotQueue.flush(); // its buffers belong to the old context
+    mThumbnails.flush(); // as do those of the thumbnails
+    mBufferDumpQueue.flush(); // as do the staging buffers of buffer dumps
+    mSnapshotComparer.flush(); // and so do the snapshot references
+    mGpuTimer.flush(); // and so do its queries
+    mUploadRing.flush(); // and its upload ring
+    mFrameLimiter.flush(); // and its fences, unless shared
+}
+
+// With -collapsethreads, make the surface and context of the thread of the current call current,
+// as a thread of its own would have them. Threads without a context leave the last one current,
+// since all they make are EGL calls that need none.
+void Retracer::SwitchCollapsedThread(thread_result& r)
+{
+    GLESThread& thread = mState.mThreadArr[mCurCall.tid];
+    if (!thread.getContext() || (thread.getContext() == mCollapsedContext && thread.getDrawable() == mCollapsedDrawable))
+    {
+        return;
+    }
+    if (mCollapsedContext)
+    {
+        if (thread.getContext() != mCollapsedContext)
+        {
+            FlushContextWork();
+        }
+        glFlush();
+    }
+    mStateFilter.reset();
+    if (!GLWS::instance().MakeCurrent(thread.getDrawable(), thread.getContext()))
+    {
+        DBG_LOG("Warning: failed to make the context of thread %d current (0x%x)\n", mCurCall.tid, eglGetError());
+    }
+    mCollapsedDrawable = thread.getDrawable();
+    mCollapsedContext = thread.getContext();
+    r.contextSwitches++;
+}
+
+// Replay calls until the trace ends or another thread's call comes up, unless
+// -collapsethreads replays those here too. Features is either 0, for
+// a replay that does nothing per call besides replaying it, or CALL_ALL, where each per-call
+// feature is checked as the call is replayed; the checks of the first are compiled out.
+template <unsigned Features>
+void Retracer::RetraceLoop(thread_result& r, ThreadHandoff& handoff, const int our_tid)
+{
+    const auto ourTurn = [&]{ return our_tid == latest_call_tid.load() || mFinish.load(); };
+    int collapsedTid = our_tid; // with -collapsethreads, the thread of the last call replayed
     while (!mFinish.load(std::memory_order_consume))
     {
         // ---------------------------------------------------------------------------
         // Handle all packet details
-        const bool doFrameTakeSnapshot = mOptions.mSnapshotCallSet && (mOptions.mSnapshotCallSet->contains(mCurFrameNo, mFile.ExIdToName(mCurCall.funcId)));
-        const bool isSwapBuffers = (mCurCall.funcId == mExIdEglSwapBuffers || mCurCall.funcId == mExIdEglSwapBuffersWithDamage);
+        const common::CallFlags callFlags = mFile.ExIdToCallFlags(mCurCall.funcId);
+        const bool doFrameTakeSnapshot = (Features & CALL_SNAPSHOT) && mOptions.mSnapshotCallSet && (mOptions.mSnapshotCallSet->contains(mCurFrameNo, callFlags));
+        const bool isSwapBuffers = (mCurCall.funcId == mLoop.swapBuffersId || mCurCall.funcId == mLoop.swapBuffersWithDamageId);
+        const bool measured = mCurFrameNo >= mLoop.beginMeasureFrame && mCurFrameNo < mLoop.endMeasureFrame;
 
         if (doFrameTakeSnapshot && isSwapBuffers)
         {
+            const uint64_t phaseBegin = mFramePhases.begin();
             TakeSnapshot(curCallNo - 1, mCurFrameNo);
+            mFramePhases.end(FramePhases::INSTRUMENTATION, phaseBegin);
         }
 
         if (fptr)
         {
-            bool doSkip = mOptions.mSkipCallSet && (mOptions.mSkipCallSet->contains(curCallNo, mFile.ExIdToName(mCurCall.funcId)));
-            // discard work if skipwork enabled and outside measured frame range
-            if (mOptions.mSkipWork >= 0 && (mCurFrameNo + mOptions.mSkipWork < mOptions.mBeginMeasureFrame || mCurFrameNo >= mOptions.mEndMeasureFrame))
+            bool doSkip = false;
+            if (Features & CALL_SKIP)
             {
-                const char *funcName = mFile.ExIdToName(mCurCall.funcId);
-                if (strncmp(funcName, "eglSwapBuffers", strlen("eglSwapBuffers")) == 0 || strcmp(funcName, "glReadPixels") == 0 || strcmp(funcName, "glFlush") == 0
-                    || strcmp(funcName, "glFinish") == 0 || strcmp(funcName, "glBindFramebuffer") == 0)
-                {
-                    DiscardFramebuffers();
-                }
-                else if (strcmp(funcName, "glDispatchCompute") == 0 || strcmp(funcName, "glDispatchComputeIndirect") == 0)
+                doSkip = mOptions.mSkipCallSet && (mOptions.mSkipCallSet->contains(curCallNo, callFlags));
+                // rendering before the frame range that nothing after it depends on
+                doSkip = doSkip || (mCurFrameNo < mLoop.beginMeasureFrame && mFastSeek.skip(curCallNo));
+                // discard work if skipwork enabled and outside measured frame range
+                if (mOptions.mSkipWork >= 0 && (mCurFrameNo + mOptions.mSkipWork < mLoop.beginMeasureFrame || mCurFrameNo >= mLoop.endMeasureFrame))
                 {
-                    doSkip = true;
+                    const unsigned props = mFile.ExIdToProps(mCurCall.funcId);
+                    if (props & common::CALL_PROP_DISCARDS_FRAMEBUFFER)
+                    {
+                        DiscardFramebuffers();
+                    }
+                    else if (props & common::CALL_PROP_DISPATCH)
+                    {
+                        doSkip = true;
+                    }
                 }
             }
 
             r.total++;
             if (!doSkip)
             {
+                if ((Features & CALL_UNIFORM_BATCH) && mBatchingUniforms && !mUniformBatch.empty() && !(mFile.ExIdToProps(mCurCall.funcId) & common::CALL_PROP_UNIFORM))
+                {
+                    const uint64_t phaseBegin = mFramePhases.begin();
+                    mUniformBatch.flush();
+                    mFramePhases.end(FramePhases::DRIVER, phaseBegin);
+                }
                 if (isSwapBuffers && mOptions.mFinishBeforeSwap)
                 {
                     _glFinish();
                 }
-                if (mOptions.mCallStats && mCurFrameNo >= mOptions.mBeginMeasureFrame && mCurFrameNo < mOptions.mEndMeasureFrame)
+                const bool timed = (Features & CALL_GPU_TIMING) && mGpuTiming && measured
+                                   && (mFile.ExIdToProps(mCurCall.funcId) & (common::CALL_PROP_DRAW | common::CALL_PROP_DISPATCH))
+                                   && mGpuTimer.begin(curCallNo, mCurFrameNo, mFile.ExIdToName(mCurCall.funcId));
+                const bool sampled = (Features & CALL_COUNTERS) && mCounterSampling && measured
+                                     && (mFile.ExIdToProps(mCurCall.funcId) & (common::CALL_PROP_DRAW | common::CALL_PROP_DISPATCH))
+                                     && hasCurrentContext()
+                                     && mCounterSampler.before(curCallNo, mCurFrameNo, mFile.ExIdToName(mCurCall.funcId),
+                                                               getCurrentContext()._current_framebuffer, callFlags);
+                if ((Features & CALL_COUNTERS) && isSwapBuffers && mCounterSampling)
+                {
+                    mCounterSampler.endFrame();
+                }
+                if ((Features & CALL_INVALIDATE) && mInvalidation.due(curCallNo) && hasCurrentContext())
+                {
+                    mInvalidation.inject(curCallNo, false, getCurrentContext()._current_framebuffer);
+                }
+                const uint64_t timelineBegin = ((Features & CALL_TIMELINE) && gTimeline.enabled()) ? Timeline::now() : 0;
+                const uint64_t phaseBegin = (Features & CALL_PHASES) ? mFramePhases.begin() : 0;
+                const uint64_t phaseNested = (Features & CALL_PHASES) ? mFramePhases.nested() : 0;
+                if ((Features & CALL_STATS) && mOptions.mCallStats && measured)
                 {
-                    const char *funcName = mFile.ExIdToName(mCurCall.funcId);
-                    uint64_t pre = gettime();
+                    const uint64_t pre = CallStats::ticks();
                     (*(RetraceFunc)fptr)(src);
-                    uint64_t post = gettime();
-                    mCallStats[funcName].count++;
-                    mCallStats[funcName].time += post - pre;
+                    mCallStats.add(mCurCall.funcId, CallStats::ticks() - pre);
                 }
                 else
                 {
                     (*(RetraceFunc)fptr)(src);
                 }
-                // Error Check
-                if (mOptions.mDebug && hasCurrentContext())
+                mFramePhases.endOuter(isSwapBuffers ? FramePhases::SWAP : FramePhases::RETRACE_CALLS, phaseBegin, phaseNested);
+                if ((Features & CALL_INVALIDATE) && mInvalidation.due(curCallNo) && hasCurrentContext())
                 {
+                    mInvalidation.inject(curCallNo, true, getCurrentContext()._current_framebuffer);
+                }
+                if (isSwapBuffers && mCurCall.tid == mLoop.retraceTid && mFramePhases.enabled())
+                {
+                    // the swap has moved on to the next frame, and the one it ended is complete
+                    const unsigned ended = mCurFrameNo - 1;
+                    mFramePhases.frame(ended, ended >= mLoop.beginMeasureFrame && ended < mLoop.endMeasureFrame);
+                }
+                if (timed)
+                {
+                    mGpuTimer.end();
+                }
+                if (sampled)
+                {
+                    mCounterSampler.after();
+                }
+                if (timelineBegin)
+                {
+                    gTimeline.add(isSwapBuffers ? "swap" : "call", mFile.ExIdToName(mCurCall.funcId), timelineBegin, Timeline::now(), curCallNo);
+                }
+                // Error Check. Where KHR_debug reports errors, glGetError is only called after the calls
+                // it reported, with -debugsync, and at swaps, to clear what was reported later.
+                if ((Features & CALL_DEBUG) && mOptions.mDebug && hasCurrentContext() && (!getCurrentContext()._debugOutput || mDebugErrorPending || isSwapBuffers))
+                {
+                    mDebugErrorPending = false;
                     CheckGlError();
                 }
-                if (isSwapBuffers && mCurCall.tid == mOptions.mRetraceTid)
+                if (isSwapBuffers && mCurCall.tid == mLoop.retraceTid)
                 {
                     if (mOptions.mPerfmon) perfmon_frame();
+                    if (mFrameLimiter.enabled())
+                    {
+                        TimelineScope scope("swap", "frames in flight", curCallNo);
+                        mFrameLimiter.swapped(mCurFrameNo >= mLoop.beginMeasureFrame && mCurFrameNo < mLoop.endMeasureFrame);
+                    }
+                }
+                if (isSwapBuffers)
+                {
+                    const uint64_t phaseBegin = mFramePhases.begin();
+                    mSnapshotQueue.poll();
+                    mThumbnails.poll();
+                    mBufferDumpQueue.poll();
+                    mFramePhases.end(FramePhases::INSTRUMENTATION, phaseBegin);
+                    if (mGpuTiming)
+                    {
+                        mGpuTimer.endFrame();
+                        mGpuTimer.poll();
+                    }
                 }
                 r.swaps += (int)isSwapBuffers;
             }
             else r.skipped++;
         }
-        else if (mOptions.mDebug)
+        else if ((Features & CALL_DEBUG) && mOptions.mDebug)
         {
             const char *funcName = mFile.ExIdToName(mCurCall.funcId);
             DBG_LOG("    Unsupported function : %s, call no: %d\n", funcName, curCallNo);
@@ -1261,13 +1416,19 @@ void Retracer::RetraceThread(const int threadidx, const int our_tid)
             }
 
             const int secs = (os::getTime() - mTimerBeginTime) / os::timeFrequency;
-            if (mCurFrameNo >= mOptions.mEndMeasureFrame && (mOptions.mLoopTimes > mLoopTimes || (mOptions.mLoopSeconds > 0 && secs < mOptions.mLoopSeconds)))
+            if (mCurFrameNo >= mLoop.endMeasureFrame && (mWarmingUp || mOptions.mLoopTimes > mLoopTimes || (mOptions.mLoopSeconds > 0 && secs < mOptions.mLoopSeconds)))
             {
                 DBG_LOG("Executing rollback %d / %d times - %d / %d secs\n", mLoopTimes, mOptions.mLoopTimes, secs, mOptions.mLoopSeconds);
                 if (mCollectors) mCollectors->summarize();
                 mFile.rollback();
-                unsigned numOfFrames = mCurFrameNo - mOptions.mBeginMeasureFrame;
-                mCurFrameNo = mOptions.mBeginMeasureFrame;
+                if (mLoopCheckpoint.captured() && hasCurrentContext())
+                {
+                    mLoopCheckpoint.restore(getCurrentContext());
+                    mStateFilter.reset(); // the bindings it shadows have changed
+                    getCurrentContext()._shadow.invalidate();
+                }
+                unsigned numOfFrames = mCurFrameNo - mLoop.beginMeasureFrame;
+                mCurFrameNo = mLoop.beginMeasureFrame;
                 curCallNo = mRollbackCallNo;
                 int64_t endTime;
                 const float duration = getDuration(mLoopBeginTime, &endTime);
@@ -1275,22 +1436,28 @@ void Retracer::RetraceThread(const int threadidx, const int our_tid)
                 mLoopResults.push_back(fps);
                 mLoopBeginTime = os::getTime();
                 mLoopTimes++;
+                mLoopStats.end();
+                if (mWarmingUp) CheckWarmup();
+                mLoopStats.begin(mLoopBeginTime, mLoop.endMeasureFrame - mLoop.beginMeasureFrame);
             }
         }
-        else if (mOptions.mSnapshotCallSet && (mOptions.mSnapshotCallSet->contains(curCallNo, mFile.ExIdToName(mCurCall.funcId))))
+        else if ((Features & CALL_SNAPSHOT) && mOptions.mSnapshotCallSet && (mOptions.mSnapshotCallSet->contains(curCallNo, callFlags)))
         {
+            const uint64_t phaseBegin = mFramePhases.begin();
             TakeSnapshot(curCallNo, mCurFrameNo);
+            mFramePhases.end(FramePhases::INSTRUMENTATION, phaseBegin);
         }
 
         // End conditions
         if (mFailedToLinkShaderProgram)
         {
             mFinish.store(true);
-            for (auto &cv : conditions) cv.notify_one(); // Wake up all other threads
+            for (auto &h : handoffs) h.wake(); // Wake up all other threads
+            if (mDecoder) mDecoder->wake();
             break;
         }
 
-        while (frameBudget <= 0 && drawBudget <= 0) // Step mode
+        while ((Features & CALL_STEP) && frameBudget <= 0 && drawBudget <= 0) // Step mode
         {
             frameBudget = 0;
             drawBudget = 0;
@@ -1303,56 +1470,148 @@ void Retracer::RetraceThread(const int threadidx, const int our_tid)
 skip_call:
         curCallNo++;
 
-        if (!mFile.GetNextCall(fptr, mCurCall, src))
+        bool gotCall;
+        {
+            TimelineScope scope("decode", mDecoder ? "wait for decoder" : "decode call", curCallNo);
+            const bool decodeStats = (Features & CALL_STATS) && mOptions.mCallStats && mCurFrameNo >= mLoop.beginMeasureFrame && mCurFrameNo < mLoop.endMeasureFrame;
+            const uint64_t pre = decodeStats ? CallStats::ticks() : 0;
+            const uint64_t phaseBegin = (Features & CALL_PHASES) ? mFramePhases.begin() : 0;
+            gotCall = mDecoder ? mDecoder->GetNextCall(fptr, mCurCall, src) : mFile.GetNextCall(fptr, mCurCall, src);
+            mFramePhases.end(FramePhases::DECODE, phaseBegin);
+            if (decodeStats) mCallStats.addDecode(CallStats::ticks() - pre);
+        }
+        if (!gotCall)
         {
             mFinish.store(true);
-            for (auto &cv : conditions) cv.notify_one(); // Wake up all other threads
+            for (auto &h : handoffs) h.wake(); // Wake up all other threads
+            if (mDecoder) mDecoder->wake();
             break;
         }
         // Skip call because it is on an ignored thread?
-        if (!mOptions.mMultiThread && mCurCall.tid != mOptions.mRetraceTid)
+        if (!mLoop.multiThread && mCurCall.tid != mLoop.retraceTid)
         {
             r.skipped++;
             goto skip_call;
         }
+        // Replay the other threads' calls here, in trace order, instead of handing them over
+        if (mLoop.collapseThreads)
+        {
+            if (mCurCall.tid != collapsedTid)
+            {
+                collapsedTid = mCurCall.tid;
+                SwitchCollapsedThread(r);
+            }
+        }
         // Need to switch active thread?
-        if (our_tid != mCurCall.tid)
+        else if (our_tid != mCurCall.tid)
         {
-            latest_call_tid = mCurCall.tid; // need to use an atomic member copy of this here
             // Do we need to make this thread?
             if (thread_remapping.count(mCurCall.tid) == 0)
             {
                 thread_remapping[mCurCall.tid] = threads.size();
                 int newthreadidx = threads.size();
-                conditions.emplace_back();
+                handoffs.emplace_back();
                 results.emplace_back();
                 threads.emplace_back(&Retracer::RetraceThread, this, (int)newthreadidx, (int)mCurCall.tid);
             }
-            else // Wake up existing thread
-            {
-                const int otheridx = thread_remapping.at(mCurCall.tid);
-                conditions.at(otheridx).notify_one();
-            }
+            ThreadHandoff& other = handoffs.at(thread_remapping.at(mCurCall.tid));
             r.handovers++;
-            bool success = false;
-            do {
-                success = conditions.at(threadidx).wait_for(lk, std::chrono::milliseconds(50), [&]{ return our_tid == latest_call_tid || mFinish.load(std::memory_order_consume); });
-                if (!success) r.timeouts++; else r.wakeups++;
-            } while (!success);
+            handoff_begin.store(os::getTime(), std::memory_order_relaxed);
+            latest_call_tid.store(mCurCall.tid); // the other thread may run from here on
+            other.wake();
+            const uint64_t timelineBegin = gTimeline.enabled() ? Timeline::now() : 0;
+            const bool parked = handoff.wait(ourTurn);
+            if (timelineBegin) gTimeline.add("handoff", parked ? "wait for turn (parked)" : "wait for turn", timelineBegin, Timeline::now(), curCallNo);
+            if (mFinish.load()) break;
+            if (parked) r.wakeups++; else r.spins++;
+            const long long handoffTime = os::getTime() - handoff_begin.load(std::memory_order_relaxed);
+            r.handoffTime += handoffTime;
+            mFramePhases.addOsTime(FramePhases::HANDOFF, handoffTime);
+            r.maxHandoffTime = std::max(r.maxHandoffTime, handoffTime);
         }
     }
+}
+
+// Only one thread runs at a time, the one whose tid is in latest_call_tid, so no need for mutexing etc.
+// Changing latest_call_tid with a sequentially consistent store passes on everything done so far to the
+// new thread, so a thread must not touch shared state after that until its turn comes again.
+void Retracer::RetraceThread(const int threadidx, const int our_tid)
+{
+    thread_result r;
+    r.our_tid = our_tid;
+    ThreadHandoff& handoff = handoffs.at(threadidx);
+    gTimeline.nameThread("replay tid " + std::to_string(our_tid));
+    mThreadPlacement.apply(threadidx == 0 ? ThreadPlacement::MAIN : ThreadPlacement::REPLAY, our_tid);
+    handoff.wait([&]{ return our_tid == latest_call_tid.load() || mFinish.load(); }); // new threads are created before they are handed over to
+    if (mLoop.features == 0)
+    {
+        RetraceLoop<0>(r, handoff, our_tid);
+    }
+    else
+    {
+        RetraceLoop<CALL_ALL>(r, handoff, our_tid);
+    }
     results[threadidx] = r;
 }
 
+// With a seek index we know up front whether the preloaded range fits, so fail before replaying anything.
+void Retracer::CheckPreloadBudget()
+{
+    common::TraceIndex index;
+    if (mOptions.mPreloadBudget == 0 || !index.load(mOptions.mFileName)) return;
+    uint64_t bytes = 0;
+    for (unsigned frame = mOptions.mBeginMeasureFrame; frame < mOptions.mEndMeasureFrame && frame < index.mFrames.size(); frame++)
+    {
+        bytes += index.mFrames[frame].bytes;
+    }
+    if (bytes > mOptions.mPreloadBudget)
+    {
+        reportAndAbort("Preloading frames %u to %u needs at least %.1f MB, more than the preload budget of %.1f MB",
+                       mOptions.mBeginMeasureFrame, mOptions.mEndMeasureFrame, bytes / (1024.0 * 1024.0), mOptions.mPreloadBudget / (1024.0 * 1024.0));
+    }
+}
+
 void Retracer::Retrace()
 {
     if (!mOptions.mCpuMask.empty()) set_cpu_mask(mOptions.mCpuMask);
     report_cpu_mask();
+    if (!mThreadPlacement.configure(mOptions.mThreadAffinity))
+    {
+        DBG_LOG("Thread affinity not set\n");
+    }
 
     // open shader cache file if needed
+    const int64_t cacheBegin = os::getTime();
     OpenShaderCacheFile();
+    addStartupTime("shader_cache", cacheBegin);
+
+    if (!mOptions.mTimelineFile.empty())
+    {
+        gTimeline.enable();
+    }
 
     mFile.setFrameRange(mOptions.mBeginMeasureFrame, mOptions.mEndMeasureFrame, mOptions.mRetraceTid, mOptions.mPreload, mOptions.mLoopTimes != -1);
+    if (mOptions.mPreload)
+    {
+        mFile.setPreloadBudget(mOptions.mPreloadBudget, mOptions.mPreloadHugepages);
+        mFile.setCallTape(mOptions.mCallTape);
+        CheckPreloadBudget();
+    }
+    // Before the prefetch workers start, since they move the window as they take chunks
+    if (mOptions.mStreamWindow > 0)
+    {
+        mFile.setStreamWindow(mOptions.mStreamWindow);
+    }
+    if (mOptions.mPrefetchChunks > 0)
+    {
+        ThreadPlacement::Inherit placed(mThreadPlacement, ThreadPlacement::PREFETCH);
+        mFile.setPrefetch(mOptions.mPrefetchChunks, mOptions.mPrefetchThreads);
+    }
+    if (mOptions.mPrefetchBlobCalls > 0 && mOptions.mPreload)
+    {
+        ThreadPlacement::Inherit placed(mThreadPlacement, ThreadPlacement::PREFETCH);
+        mFile.setBlobPrefetch(mOptions.mPrefetchBlobCalls, mOptions.mPrefetchBlobSize);
+    }
 
     if (mOptions.mBeginMeasureFrame == 0 && mCurFrameNo == 0)
     {
@@ -1365,17 +1624,130 @@ void Retracer::Retrace()
     {
         reportAndAbort("Empty trace file!");
     }
+    if (mStartupBegin)
+    {
+        addStartupTime("first_call", mStartupBegin);
+        DBG_LOG("Time to first call: %.3f s\n", mStartupTimes["first_call"].asFloat());
+    }
     threads.resize(1);
-    conditions.resize(1);
+    handoffs.resize(1);
     results.resize(1);
+    latest_call_tid = mCurCall.tid;
     thread_remapping[mCurCall.tid] = 0;
     results[0].our_tid = mCurCall.tid;
+    if (mOptions.mMultiThread)
+    {
+        mDecoder.reset(new CallDecoder(mFile, mFinish, mExIdEglSwapBuffers, mExIdEglSwapBuffersWithDamage));
+        ThreadPlacement::Inherit placed(mThreadPlacement, ThreadPlacement::DECODE);
+        mDecoder->start();
+    }
+    // readbacks must be mapped on the thread that made them, which is only sure to be current in single thread mode
+    mAsyncSnapshots = !mOptions.mMultiThread;
+    image::setPNGOptions(mOptions.mSnapshotPNG);
+    mSnapshotComparer.setReferences(mOptions.mSnapshotCompare, mOptions.mSnapshotTolerance);
+    if (!mSnapshotHashes.open(mOptions.mSnapshotHash, mOptions.mSnapshotHashReference, mOptions.mSnapshotHashDistance))
+    {
+        reportAndAbort("Failed to start the snapshot hash file %s", mOptions.mSnapshotHash.c_str());
+    }
+    mGpuTiming = mOptions.mDrawTime && !mOptions.mMultiThread; // same for timer queries
+    if (mOptions.mDrawTime && mOptions.mMultiThread)
+    {
+        DBG_LOG("Draws are not timed in -multithread mode\n");
+    }
+    mStagedUploads = (mOptions.mStageUploads > 0) && !mOptions.mMultiThread; // and for the upload ring
+    mUploadRing.setCapacity((GLsizeiptr)mOptions.mStageUploads << 20);
+    if (mOptions.mStageUploads > 0 && mOptions.mMultiThread)
+    {
+        DBG_LOG("Uploads are not staged in -multithread mode\n");
+    }
+    mSnapshotQueue.setUploadList(mOptions.mUploadSnapshots ? &mSnapshotPaths : nullptr);
+    mSnapshotQueue.setHashes(mSnapshotHashes.enabled() ? &mSnapshotHashes : nullptr);
+    mSnapshotQueue.setHardwareBuffers(mOptions.mSnapshotHardwareBuffers);
+    if (!mOptions.mThumbnailFile.empty() && mOptions.mMultiThread)
+    {
+        DBG_LOG("Thumbnails are not taken in -multithread mode, taking full snapshots\n");
+    }
+    else if (!mOptions.mThumbnailFile.empty() && !mThumbnails.open(mOptions.mThumbnailFile, mOptions.mThumbnailWidth))
+    {
+        reportAndAbort("Failed to start the thumbnail file %s", mOptions.mThumbnailFile.c_str());
+    }
+    mTranscoder.close(); // left open by the previous trace of a batch
+    if (!mOptions.mTranscodeDir.empty() && !mTranscoder.open(mOptions.mTranscodeDir))
+    {
+        reportAndAbort("Failed to start decoding textures into %s", mOptions.mTranscodeDir.c_str());
+    }
+    mStateFilter = StateFilter();
+    mFilteringState = mOptions.mFilterState && !mOptions.mMultiThread; // and for the shadowed state
+    if (mOptions.mFilterState && mOptions.mMultiThread)
+    {
+        DBG_LOG("Redundant state is not filtered in -multithread mode\n");
+    }
+    mUniformBatch = UniformBatch();
+    mBatchingUniforms = mOptions.mBatchUniforms && !mOptions.mMultiThread; // runs would mix the calls of threads
+    if (mOptions.mBatchUniforms && mOptions.mMultiThread)
+    {
+        DBG_LOG("Uniform calls are not batched in -multithread mode\n");
+    }
+    mFrameLimiter = FrameLimiter();
+    mFrameLimiter.setLimit(mOptions.mMultiThread ? 0 : mOptions.mFramesInFlight); // and for the fences
+    if (mOptions.mFramesInFlight > 0 && mOptions.mMultiThread)
+    {
+        DBG_LOG("Frames in flight are not limited in -multithread mode\n");
+    }
+    mFramePhases = FramePhases();
+    mFramePhases.setEnabled(mOptions.mMeasurePerFrame); // threads take turns, so this works with -multithread too
+    mShaderStats = ShaderStats();
+    mShaderStats.setEnabled(mOptions.mShaderStats && !mOptions.mMultiThread); // and for the frame totals
+    if (mOptions.mShaderStats && mOptions.mMultiThread)
+    {
+        DBG_LOG("Shader stalls are not timed in -multithread mode\n");
+    }
+    mLoopCheckpoint = LoopCheckpoint();
+    mFastSeek = FastSeek();
+    if (mOptions.mFastSeek && mOptions.mBeginMeasureFrame > 0)
+    {
+        const int64_t seekBegin = os::getTime();
+        mFastSeek.scan(mOptions.mFileName, mOptions.mBeginMeasureFrame, mOptions.mEndMeasureFrame, mOptions.mRetraceTid);
+        addStartupTime("fast_seek", seekBegin);
+    }
+    mInvalidation = InvalidationInjector();
+    if (!mOptions.mInvalidateFile.empty() && !mInvalidation.load(mOptions.mInvalidateFile))
+    {
+        reportAndAbort("Failed to read the invalidates to add from %s", mOptions.mInvalidateFile.c_str());
+    }
+    if (mOptions.mLoopReset && mOptions.mMultiThread)
+    {
+        DBG_LOG("Loop state is not reset in -multithread mode\n"); // objects may belong to other threads' contexts
+    }
+    mMemoryTimeline = MemoryTimeline();
+    if (mOptions.mMemoryTimeline)
+    {
+        mMemoryTimeline.reserve(std::max(mFile.getJSONHeaderMember("frameCnt").asUInt(), 1u) + 1);
+    }
+    mFramePacer = FramePacer();
+    if (mOptions.mPaceCapture)
+    {
+        mFramePacer.setIntervals(mFile.getJSONHeaderMember("frameIntervals"));
+    }
+    else if (mOptions.mPaceFps > 0)
+    {
+        mFramePacer.setFps(mOptions.mPaceFps);
+    }
+    mPresentTimer = PresentTimer();
+    if (mOptions.mPresentTimes)
+    {
+        mPresentTimer.setEnabled(mOptions.mPresentVsync);
+    }
+    mPresentFeedback = PresentFeedback();
+    mPresentFeedback.setEnabled(mOptions.mPresentFeedback);
+    setupCallLoop();
     RetraceThread(0, mCurCall.tid); // run the first thread on this thread
 
     for (std::thread &t : threads)
     {
         if (t.joinable()) t.join();
     }
+    mDecoder.reset();
 
     // When we get here, we're all done
     if (mOptions.mForceOffscreen)
@@ -1389,7 +1761,34 @@ void Retracer::Retrace()
                                      gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext());
         _glFinish();
     }
+    mSnapshotQueue.flush();
+    mSnapshotQueue.finish();
+    mThumbnails.flush();
+    mThumbnails.close();
+    mBufferDumpQueue.flush();
+    mBufferDumpQueue.finish();
+    mSnapshotHashes.close();
+    mSnapshotComparer.flush();
+    mAsyncSnapshots = false;
+    mGpuTimer.flush();
+    mGpuTiming = false;
+    mCounterSampling = false;
+    mUploadRing.flush();
+    mStagedUploads = false;
+    mFrameLimiter.flush();
+    mPerfSampler.stop();
+    mFilteringState = false;
+    mUniformBatch.clear(); // left over after the last draw
+    mBatchingUniforms = false;
+    mGraphicBufferPool.clear();
+#ifdef ANDROID
+    mHardwareBufferPool.clear();
+#endif
     saveResult();
+    if (gTimeline.enabled())
+    {
+        gTimeline.write(mOptions.mTimelineFile);
+    }
 
     if (mOptions.mDebug)
     {
@@ -1401,12 +1800,20 @@ void Retracer::Retrace()
             DBG_LOG("\tSkipped calls: %d\n", r.skipped);
             DBG_LOG("\tSwapbuffer calls: %d\n", r.swaps);
             DBG_LOG("\tHandovers: %d\n", r.handovers);
+            DBG_LOG("\tSpins: %d\n", r.spins);
             DBG_LOG("\tWakeups: %d\n", r.wakeups);
-            DBG_LOG("\tTimeouts: %d\n", r.timeouts);
+            if (mOptions.mCollapseThreads) DBG_LOG("\tContext switches: %d\n", r.contextSwitches);
         }
     }
 
-    GLWS::instance().Cleanup();
+    if (mKeepDisplay)
+    {
+        GLWS::instance().MakeCurrent(NULL, NULL); // the contexts and surfaces are destroyed with the trace state
+    }
+    else
+    {
+        GLWS::instance().Cleanup();
+    }
     CloseTraceFile();
 #if ANDROID
     if (!mOptions.mForceSingleWindow)
@@ -1452,6 +1859,11 @@ void Retracer::OnFrameComplete()
         {
             getDuration(mEndFrameTime, &mFinishSwapTime);
         }
+        if (mFramePacer.enabled())
+        {
+            TimelineScope scope("swap", "pacing", curCallNo);
+            mFramePacer.wait(mCurFrameNo);
+        }
     }
 }
 
@@ -1459,18 +1871,78 @@ void Retracer::StartMeasuring()
 {
     if (mCollectors)
     {
+        ThreadPlacement::Inherit placed(mThreadPlacement, ThreadPlacement::COLLECTOR);
+        // preallocate the per frame results, so that collecting them does not allocate in measured frames
+        const unsigned frameCount = mFile.getJSONHeaderMember("frameCnt").asUInt();
+        const unsigned lastFrame = std::min(frameCount, mOptions.mEndMeasureFrame);
+        mCollectors->reserve(lastFrame > mOptions.mBeginMeasureFrame ? lastFrame - mOptions.mBeginMeasureFrame + 1 : 0);
+        if (!mOptions.mCollectorStream.empty())
+        {
+            mCollectors->setStream(mOptions.mCollectorStream);
+        }
         mCollectors->start();
     }
+    if (mOptions.mCounterPasses || mOptions.mCounterCallSet)
+    {
+        // the counters are read on the replay thread, between its calls
+        mCounterSampler.setup(mOptions.mMultiThread ? nullptr : mCollectors, mOptions.mCounterPasses, mOptions.mCounterCallSet);
+        mCounterSampling = mCounterSampler.enabled();
+        if (mOptions.mMultiThread)
+        {
+            DBG_LOG("Counters of render passes and draws are not sampled in -multithread mode\n");
+        }
+    }
     mRollbackCallNo = curCallNo;
+    if (mOptions.mLoopReset && !mOptions.mMultiThread && hasCurrentContext())
+    {
+        mLoopCheckpoint.capture(getCurrentContext());
+    }
     DBG_LOG("================== Start timer (Frame: %u) ==================\n", mCurFrameNo);
     mTimerBeginTime = mLoopBeginTime = os::getTime();
     mEndFrameTime = mTimerBeginTime;
+    mWarmingUp = (mOptions.mLoopWarmup > 0);
+    mWarmupLoops = 0;
+    mLoopStats.begin(mTimerBeginTime, mOptions.mEndMeasureFrame - mOptions.mBeginMeasureFrame);
+}
+
+void Retracer::CheckWarmup()
+{
+    const double mean = mLoopStats.lastMean();
+    const double tolerance = mOptions.mLoopWarmup / 100.0;
+    const bool stable = (mWarmupLoops > 0 && fabs(mean - mWarmupMean) <= tolerance * mWarmupMean);
+    mWarmupLoops++;
+    mWarmupMean = mean;
+    if (!stable && mWarmupLoops < MAX_WARMUP_LOOPS)
+    {
+        return;
+    }
+    if (stable)
+    {
+        DBG_LOG("Frame times stable within %d%% after %d warm-up loops, starting measurement\n", mOptions.mLoopWarmup, mWarmupLoops);
+    }
+    else
+    {
+        DBG_LOG("Frame times not stable within %d%% after %d warm-up loops, starting measurement anyway\n", mOptions.mLoopWarmup, mWarmupLoops);
+    }
+    // Throw the warm-up loops away, and measure as if they never happened
+    mWarmingUp = false;
+    mLoopStats.clear();
+    mLoopResults.clear();
+    mLoopTimes = 0;
+    mTimerBeginTime = mLoopBeginTime;
 }
 
 void Retracer::OnNewFrame()
 {
     if (getCurTid() == mOptions.mRetraceTid)
     {
+        if (mFramePacer.enabled()) mFramePacer.presented();
+        if (mMemoryTimeline.enabled())
+        {
+            const uint64_t counters[4] = { mVBODataSize, mTextureDataSize, mCompressedTextureDataSize, mClientSideMemoryDataSize };
+            mMemoryTimeline.sample(mCurFrameNo, os::getTime(), counters, mState.mThreadArr[getCurTid()].getContext(), mState);
+        }
+        if (mPerfSampler.running()) mPerfSampler.frame(mCurFrameNo);
         IncCurFrameId();
 
         if (mCurFrameNo == mOptions.mBeginMeasureFrame)
@@ -1479,7 +1951,7 @@ void Retracer::OnNewFrame()
             {
                 // First try to flush all the work we can
                 _glFlush(); // force all GPU work to complete before this point
-                const auto programs = gRetracer.getCurrentContext().getProgramMap().GetCopy();
+                const hmap<unsigned int>& programs = gRetracer.getCurrentContext().getProgramMap();
                 for (const auto program : programs) // force all compiler work to complete before this point
                 {
                     GLint size = 0;
@@ -1491,15 +1963,31 @@ void Retracer::OnNewFrame()
             if (mOptions.mPerfmon) perfmon_init();
         }
         // Per frame measurement
-        if (mCollectors && mCurFrameNo > mOptions.mBeginMeasureFrame && mCurFrameNo <= mOptions.mEndMeasureFrame)
+        if (mCurFrameNo > mOptions.mBeginMeasureFrame && mCurFrameNo <= mOptions.mEndMeasureFrame)
         {
-            mCollectors->collect();
+            mLoopStats.frame(os::getTime());
+            if (mCollectors)
+            {
+                const uint64_t phaseBegin = mFramePhases.begin();
+                mCollectors->collect();
+                mFramePhases.end(FramePhases::INSTRUMENTATION, phaseBegin);
+            }
         }
     }
 }
 
 void Retracer::PerfStart()
 {
+    if (!mOptions.mPerfExternal)
+    {
+#if ANDROID
+        const std::string path = mOptions.mPerfOut.empty() ? "/sdcard/perf_samples.bin" : mOptions.mPerfOut;
+#else
+        const std::string path = mOptions.mPerfOut.empty() ? "perf_samples.bin" : mOptions.mPerfOut;
+#endif
+        mPerfSampler.start(mOptions.mPerfFreq, path);
+        return;
+    }
     pid_t parent = getpid();
     child = fork();
     if (child == -1)
@@ -1510,7 +1998,11 @@ void Retracer::PerfStart()
     {
         std::string freqopt = "--freq=" + _to_string(mOptions.mPerfFreq);
         std::string mypid = "--pid=" + _to_string(parent);
-        std::string myfilename = mOptions.mPerfOut;
+#if ANDROID
+        std::string myfilename = mOptions.mPerfOut.empty() ? "/sdcard/perf.data" : mOptions.mPerfOut;
+#else
+        std::string myfilename = mOptions.mPerfOut.empty() ? "perf.data" : mOptions.mPerfOut;
+#endif
         std::string myfilearg = "--output=" + myfilename;
         const char* args[7] = { mOptions.mPerfPath.c_str(), "record", "-g", freqopt.c_str(), mypid.c_str(), myfilearg.c_str(), nullptr };
         DBG_LOG("Perf tracing %ld from process %ld with freq %ld and output in %s\n", (long)parent, (long)getpid(), (long)mOptions.mPerfFreq, myfilename.c_str());
@@ -1528,7 +2020,8 @@ void Retracer::PerfStart()
 
 void Retracer::PerfEnd()
 {
-    if(child == -1)
+    mPerfSampler.stop();
+    if (child <= 0) // not started, or sampling in process
         return;
     DBG_LOG("Killing instrumented process %ld\n", (long)child);
     if (kill(child, SIGINT) == -1)
@@ -1592,6 +2085,7 @@ void Retracer::saveResult()
         DBG_LOG("Frame cnt = %d, FPS = %f\n", numOfFrames, fps);
         result["fps"] = fps;
         mLoopResults.push_back(loopFps);
+        mLoopStats.end();
     } else {
         DBG_LOG("Never rendered anything.\n");
         numOfFrames = 0;
@@ -1601,23 +2095,95 @@ void Retracer::saveResult()
 
     result["loopFPS"] = Json::arrayValue;
     for (const auto fps : mLoopResults) result["loopFPS"].append(fps);
+    result["loops"] = mLoopStats.toJson();
+    if (mOptions.mLoopWarmup > 0)
+    {
+        result["warmup_loops"] = mWarmupLoops;
+    }
     result["time"] = duration;
     result["frames"] = numOfFrames;
     result["start_time"] = ((double)mTimerBeginTime) / os::timeFrequency;
     result["end_time"] = ((double)endTime) / os::timeFrequency;
     result["patrace_version"] = PATRACE_VERSION;
+    if (mOptions.mStubDriver)
+    {
+        result["stub_driver"] = true; // the numbers are retracer overhead only, not comparable to device results
+    }
     if (mOptions.mPerfmon) perfmon_end(result);
+    if (mOptions.mDrawTime) mGpuTimer.store(result);
+    mCounterSampler.store(result);
+    mFramePacer.store(result);
+    mPresentTimer.store(result);
+    mPresentFeedback.store(result);
+    mStateFilter.store(result);
+    mFastSeek.store(result);
+    mInvalidation.store(result);
+    mUniformBatch.store(result);
+    if (mOptions.mBufferPool)
+    {
+        unsigned created = mGraphicBufferPool.created(), reused = mGraphicBufferPool.reused();
+#ifdef ANDROID
+        created += mHardwareBufferPool.created();
+        reused += mHardwareBufferPool.reused();
+#endif
+        result["buffer_pool"]["created"] = created;
+        result["buffer_pool"]["reused"] = reused;
+    }
+    common::JsonColumns columns; // per-frame results, written from where they were collected
+    mMemoryTimeline.store(result, columns);
+    mThreadPlacement.store(result);
+    mFrameLimiter.store(result);
+    mShaderStats.store(result);
+    mFramePhases.store(result, columns);
+    mSnapshotComparer.store(result);
+    mSnapshotHashes.store(result);
+    mPerfSampler.store(result);
+    mLoopCheckpoint.store(result);
+    unsigned lookups = 0;
+    long long lookupTime = 0, libraryTime = 0;
+    GetProcAddressStats(lookups, lookupTime, libraryTime);
+    mStartupTimes["entry_point_lookups"] = lookups;
+    mStartupTimes["entry_point_lookup_time"] = ticksToSeconds(lookupTime);
+    mStartupTimes["library_open_time"] = ticksToSeconds(libraryTime);
+    result["startup"] = mStartupTimes;
+    mStartupTimes = Json::Value();
+    if (results.size() > 1)
+    {
+        int handovers = 0, spins = 0, wakeups = 0;
+        long long handoffTime = 0, maxHandoffTime = 0;
+        for (const thread_result& r : results)
+        {
+            handovers += r.handovers;
+            spins += r.spins;
+            wakeups += r.wakeups;
+            handoffTime += r.handoffTime;
+            maxHandoffTime = std::max(maxHandoffTime, r.maxHandoffTime);
+        }
+        Json::Value handoff;
+        handoff["handovers"] = handovers;
+        handoff["spins"] = spins;
+        handoff["wakeups"] = wakeups;
+        handoff["total_time"] = ((double)handoffTime) / os::timeFrequency;
+        handoff["average_time"] = (spins + wakeups) ? ((double)handoffTime) / os::timeFrequency / (spins + wakeups) : 0.0;
+        handoff["max_time"] = ((double)maxHandoffTime) / os::timeFrequency;
+        result["thread_handoff"] = handoff;
+    }
+    else if (mOptions.mCollapseThreads && !results.empty())
+    {
+        result["thread_collapse"]["context_switches"] = results[0].contextSwitches;
+    }
 
     if (mCollectors)
     {
         mCollectors->stop();
     }
     DBG_LOG("Saving results...\n");
-    if (!TraceExecutor::writeData(result, numOfFrames, duration))
+    if (!TraceExecutor::writeData(result, numOfFrames, duration, &columns))
     {
         reportAndAbort("Error writing result file!");
     }
     mLoopResults.clear();
+    mLoopStats.clear();
     TraceExecutor::clearResult();
 }
 
@@ -1626,22 +2192,55 @@ void Retracer::initializeCallCounter()
     mCallCounter["glLinkProgram"] = 0;
 }
 
+// Everything a previous trace may have left behind, for -jsonBatch
+void Retracer::resetTraceState()
+{
+    mFailedToLinkShaderProgram = false;
+    mMosaicNeedToBeFlushed = false;
+    delayedPerfmonInit = false;
+    mSurfaceCount = 0;
+    frameBudget = INT64_MAX;
+    drawBudget = INT64_MAX;
+    curCallNo = 0;
+    mCurDrawNo = 0;
+    mCurFrameNo = 0;
+    mRollbackCallNo = 0;
+    mEndFrameTime = 0;
+    mTimerBeginTime = 0;
+    mFinishSwapTime = 0;
+    mLoopTimes = 0;
+    mLoopBeginTime = 0;
+    mWarmingUp = false;
+    mWarmupLoops = 0;
+    mWarmupMean = 0.0;
+    mLoopResults.clear();
+    mLoopStats.clear();
+    mCallCounter.clear();
+    handoffs.clear();
+    threads.clear();
+    results.clear();
+    thread_remapping.clear();
+}
+
 void pre_glDraw()
 {
-    if (!gRetracer.mOptions.mDoOverrideResolution)
+    const bool atlas = gRetracer.mOptions.mSurfaceAtlasWidth > 0;
+    if (!gRetracer.mOptions.mDoOverrideResolution && !atlas)
     {
         return;
     }
 
     Context& context = gRetracer.getCurrentContext();
+    GLESThread& thread = gRetracer.mState.mThreadArr[gRetracer.getCurTid()];
 
     GLuint curFB = context._current_framebuffer;
-    Rectangle& curAppVP = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurAppVP;
-    Rectangle& curAppSR = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurAppSR;
-    Rectangle& curDrvVP = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurDrvVP;
-    Rectangle& curDrvSR = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].mCurDrvSR;
+    Rectangle& curAppVP = thread.mCurAppVP;
+    Rectangle& curAppSR = thread.mCurAppSR;
+    Rectangle& curDrvVP = thread.mCurDrvVP;
+    Rectangle& curDrvSR = thread.mCurDrvSR;
+    bool scissorTest = thread.mCurAppScissorTest;
 
-    retracer::Drawable * curDrawable = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getDrawable();
+    retracer::Drawable * curDrawable = thread.getDrawable();
 
 #if TARGET_OS_IPHONE || TARGET_IPHONE_SIMULATOR
     if (curFB > 1)
@@ -1661,23 +2260,62 @@ void pre_glDraw()
             glScissor(curDrvSR.x, curDrvSR.y, curDrvSR.w, curDrvSR.h);
         }
     }
+    else if (thread.mAtlasTile.rect.w > 0)
+    {
+        // on-screen framebuffer is a tile of the surface atlas, which nothing may be drawn or
+        // cleared outside of
+
+        const AtlasTile& tile = thread.mAtlasTile;
+        const Rectangle drvVP = curAppVP.Stretch(tile.ratioW, tile.ratioH).Offset(tile.rect.x, tile.rect.y);
+        const Rectangle drvSR = scissorTest ? curAppSR.Stretch(tile.ratioW, tile.ratioH).Offset(tile.rect.x, tile.rect.y).Intersect(tile.rect) : tile.rect;
+        scissorTest = true;
+
+        if (curDrvVP != drvVP) {
+            curDrvVP = drvVP;
+            glViewport(curDrvVP.x, curDrvVP.y, curDrvVP.w, curDrvVP.h);
+        }
+        if (curDrvSR != drvSR) {
+            curDrvSR = drvSR;
+            glScissor(curDrvSR.x, curDrvSR.y, curDrvSR.w, curDrvSR.h);
+        }
+    }
     else
     {
         // on-screen framebuffer is "bound"
 
-        if (curDrvVP != curAppVP.Stretch(curDrawable->mOverrideResRatioW, curDrawable->mOverrideResRatioH)) {
-            curDrvVP = curAppVP.Stretch(curDrawable->mOverrideResRatioW, curDrawable->mOverrideResRatioH);
+        const float ratioW = gRetracer.mOptions.mDoOverrideResolution ? curDrawable->mOverrideResRatioW : 1.0f;
+        const float ratioH = gRetracer.mOptions.mDoOverrideResolution ? curDrawable->mOverrideResRatioH : 1.0f;
+
+        if (curDrvVP != curAppVP.Stretch(ratioW, ratioH)) {
+            curDrvVP = curAppVP.Stretch(ratioW, ratioH);
             glViewport(curDrvVP.x, curDrvVP.y, curDrvVP.w, curDrvVP.h);
         }
-        if (curDrvSR != curAppSR.Stretch(curDrawable->mOverrideResRatioW, curDrawable->mOverrideResRatioH)) {
-            curDrvSR = curAppSR.Stretch(curDrawable->mOverrideResRatioW, curDrawable->mOverrideResRatioH);
+        if (curDrvSR != curAppSR.Stretch(ratioW, ratioH)) {
+            curDrvSR = curAppSR.Stretch(ratioW, ratioH);
             glScissor(curDrvSR.x, curDrvSR.y, curDrvSR.w, curDrvSR.h);
         }
     }
+
+    if (atlas && thread.mCurDrvScissorTest != (int)scissorTest)
+    {
+        thread.mCurDrvScissorTest = scissorTest;
+        if (scissorTest)
+        {
+            glEnable(GL_SCISSOR_TEST);
+        }
+        else
+        {
+            glDisable(GL_SCISSOR_TEST);
+        }
+    }
 }
 
 void post_glCompileShader(GLuint shader, GLuint originalShaderName)
 {
+    if (gRetracer.getCurrentContext()._parallelShaderCompile)
+    {
+        return; // asking would wait for the compile, errors show up in the link log instead
+    }
     GLint rvalue;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &rvalue);
     if (rvalue == GL_FALSE)
@@ -1697,7 +2335,7 @@ void post_glCompileShader(GLuint shader, GLuint originalShaderName)
 
 void post_glShaderSource(GLuint shader, GLuint originalShaderName, GLsizei count, const GLchar **string, const GLint *length)
 {
-    if (gRetracer.mOptions.mShaderCacheFile.size() > 0 && string && count)
+    if (gRetracer.shaderCache.isOpen() && string && count)
     {
         std::string cat;
         for (int i = 0; i < count; i++)
@@ -1711,75 +2349,49 @@ void post_glShaderSource(GLuint shader, GLuint originalShaderName, GLsizei count
 
 void OpenShaderCacheFile()
 {
-    if (!gRetracer.shaderCacheFile && gRetracer.mOptions.mShaderCacheFile.size() > 0)
+    if (gRetracer.shaderCache.isOpen() && (gRetracer.shaderCache.isEmbedded() || gRetracer.shaderCache.name() != gRetracer.mOptions.mShaderCacheFile))
+    {
+        gRetracer.shaderCache.close(); // left open by the previous trace of a batch
+    }
+    if (!gRetracer.shaderCache.isOpen() && gRetracer.mOptions.mShaderCacheFile.size() > 0)
     {
-        const std::string bpath = gRetracer.mOptions.mShaderCacheFile + ".bin";
-        gRetracer.shaderCacheFile = fopen(bpath.c_str(), "ab+");
-        if (!gRetracer.shaderCacheFile)
+        if (!gRetracer.shaderCache.open(gRetracer.mOptions.mShaderCacheFile))
         {
-            gRetracer.reportAndAbort("Failed to open shader cache file %s: %s", bpath.c_str(), strerror(errno));
+            gRetracer.reportAndAbort("Failed to open shader cache %s", gRetracer.mOptions.mShaderCacheFile.c_str());
         }
-
-        const std::string ipath = gRetracer.mOptions.mShaderCacheFile + ".idx";
-        FILE *idx = fopen(ipath.c_str(), "rb");
-        if (idx)
+    }
+    else if (!gRetracer.shaderCache.isOpen() && gRetracer.mOptions.mEmbeddedProgramBinaries)
+    {
+        // program binaries that embed_program_binaries put in the trace, used if they are of this driver
+        std::vector<char> section;
+        if (gRetracer.mFile.readSection("programBinaries", section)
+            && gRetracer.shaderCache.openEmbedded(gRetracer.mOptions.mFileName, section))
         {
-            uint32_t size = 0;
-            int r = fread(&size, sizeof(size), 1, idx);
-            if (r != 1)
-            {
-                gRetracer.reportAndAbort("Failed to read shader cache index size: %s", ipath.c_str(), strerror(ferror(idx)));
-            }
-            for (unsigned i = 0; i < size; i++)
-            {
-                std::vector<char> md5;
-                uint64_t offset = 0;
-                std::string md5_str;
-                md5.resize(MD5Digest::DIGEST_LEN * 2);
-                r = fread(md5.data(), md5.size(), 1, idx);
-                r += fread(&offset, sizeof(offset), 1, idx);
-                if (r != 2)
-                {
-                    gRetracer.reportAndAbort("Failed to read shader cache index: %s", ipath.c_str(), strerror(ferror(idx)));
-                }
-                md5_str = std::string(md5.data(), md5.size());
-                gRetracer.shaderCacheIndex[md5_str] = offset;
-
-                GLenum binaryFormat = GL_NONE;
-                uint32_t size = 0;
-
-                if (fseek(gRetracer.shaderCacheFile, offset, SEEK_SET) != 0)
-                {
-                    gRetracer.reportAndAbort("Could not seek to desired cache item at %ld", offset);
-                }
-                if (fread(&binaryFormat, sizeof(binaryFormat), 1, gRetracer.shaderCacheFile) != 1 || fread(&size, sizeof(size), 1, gRetracer.shaderCacheFile) != 1)
-                {
-                    gRetracer.reportAndAbort("Failed to read data from cache at %ld as %s: %s", offset, md5_str.c_str(), strerror(ferror(gRetracer.shaderCacheFile)));
-                }
-                if (binaryFormat == GL_NONE || size == 0)
-                {
-                    gRetracer.reportAndAbort("Invalid cache metadata at %ld for %s", offset, md5_str.c_str());
-                }
-
-                gRetracer.shaderCache[md5_str].format = binaryFormat;
-                gRetracer.shaderCache[md5_str].buffer.resize(size);
-                if (fread(gRetracer.shaderCache[md5_str].buffer.data(), gRetracer.shaderCache[md5_str].buffer.size(), 1, gRetracer.shaderCacheFile) != 1)
-                {
-                    gRetracer.reportAndAbort("Failed to read %d bytes of data from cache as %s: %s", size, md5_str.c_str(), strerror(ferror(gRetracer.shaderCacheFile)));
-                }
-            }
-            fclose(idx);
-            DBG_LOG("Found shader cache index file, loaded %d cache entries\n", (int)size);
+            DBG_LOG("Using the program binaries embedded in the trace\n");
         }
-        else
+    }
+}
+
+// Program binaries only work with the driver that made them
+static const std::string& shaderCacheDriver()
+{
+    static std::string driver;
+    if (driver.empty())
+    {
+        std::vector<std::string> strings;
+        for (const GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
         {
-            DBG_LOG("No existing shader cache index file found -- making new one\n");
+            const char* str = (const char*)_glGetString(name);
+            strings.push_back(str ? str : "");
         }
+        driver = MD5Digest(strings).text();
     }
+    return driver;
 }
 
 bool load_from_shadercache(GLuint program, GLuint originalProgramName, int status)
 {
+    TimelineScope scope("shader", "load_from_shadercache", gRetracer.GetCurCallId());
     // check this particular shader
     std::vector<std::string> shaders;
     for (const GLuint shader_id : gRetracer.getCurrentContext().getShaderIDs(program))
@@ -1789,10 +2401,18 @@ bool load_from_shadercache(GLuint program, GLuint originalProgramName, int statu
 
     MD5Digest cached_md5(shaders);
     const std::string md5 = cached_md5.text();
-    if (gRetracer.shaderCacheIndex.count(md5) > 0)
+    uint32_t format = GL_NONE;
+    const char* binary = nullptr;
+    uint32_t size = 0;
+    if (gRetracer.shaderCache.find(md5, shaderCacheDriver(), format, binary, size))
     {
         _glGetError(); // clear
-        _glProgramBinary(program, gRetracer.shaderCache[md5].format, gRetracer.shaderCache[md5].buffer.data(), gRetracer.shaderCache[md5].buffer.size());
+        const int64_t begin = gRetracer.mShaderStats.begin();
+        _glProgramBinary(program, format, binary, size);
+        if (begin)
+        {
+            gRetracer.mShaderStats.end(ShaderStats::CACHE_LOAD, begin, gRetracer.GetCurFrameId(), gRetracer.GetCurCallId(), md5);
+        }
         GLenum err = _glGetError();
         if (err != GL_NO_ERROR)
         {
@@ -1816,18 +2436,117 @@ bool load_from_shadercache(GLuint program, GLuint originalProgramName, int statu
         GLchar* cstr = (GLchar*)shadersrc.c_str();
         GLint len = shadersrc.size();
         _glShaderSource(s, 1, &cstr, &len);
+        const int64_t begin = gRetracer.mShaderStats.begin();
         _glCompileShader(s);
         post_glCompileShader(s, gRetracer.getCurrentContext().getShaderRevMap().RValue(s));
+        end_shader_timing(ShaderStats::COMPILE, begin);
         _glAttachShader(program, s);
     }
+    const int64_t begin = gRetracer.mShaderStats.begin();
     _glLinkProgram(program);
     post_glLinkProgram(program, originalProgramName, status);
+    if (begin)
+    {
+        gRetracer.mShaderStats.end(ShaderStats::LINK, begin, gRetracer.GetCurFrameId(), gRetracer.GetCurCallId(), md5);
+    }
 
     return false;
 }
 
+void end_shader_timing(ShaderStats::Kind kind, int64_t begin, GLuint program)
+{
+    if (begin == 0)
+    {
+        return;
+    }
+    std::string md5;
+    if (program != 0)
+    {
+        // Same key as the shader cache, from the sources of the attached shaders
+        GLint count = 0;
+        _glGetProgramiv(program, GL_ATTACHED_SHADERS, &count);
+        std::vector<GLuint> ids(count);
+        if (count > 0)
+        {
+            _glGetAttachedShaders(program, count, &count, ids.data());
+        }
+        std::vector<std::string> shaders;
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint len = 0;
+            _glGetShaderiv(ids[i], GL_SHADER_SOURCE_LENGTH, &len);
+            std::vector<GLchar> source(len + 1, 0);
+            if (len > 0)
+            {
+                _glGetShaderSource(ids[i], len + 1, nullptr, source.data());
+            }
+            shaders.push_back(source.data());
+        }
+        md5 = MD5Digest(shaders).text();
+    }
+    gRetracer.mShaderStats.end(kind, begin, gRetracer.GetCurFrameId(), gRetracer.GetCurCallId(), md5);
+}
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+static void checkLinkedProgram(GLuint program, GLuint originalProgramName, int status, unsigned callNo);
+
 void post_glLinkProgram(GLuint program, GLuint originalProgramName, int status)
 {
+    Context& context = gRetracer.getCurrentContext();
+    if (context._parallelShaderCompile && !(gRetracer.mOptions.mStoreProgramInformation || gRetracer.mOptions.mRemoveUnusedVertexAttributes))
+    {
+        // Checking now would wait for the driver to finish linking. Do it when the program is
+        // first used instead, or at a swap if it is done by then.
+        const Context::PendingLink pending = { originalProgramName, status, gRetracer.GetCurCallId() };
+        context.getPendingLinks()[program] = pending;
+        return;
+    }
+    checkLinkedProgram(program, originalProgramName, status, gRetracer.GetCurCallId());
+}
+
+void finish_glLinkProgram(GLuint program)
+{
+    std::unordered_map<GLuint, Context::PendingLink>& pendingLinks = gRetracer.getCurrentContext().getPendingLinks();
+    if (pendingLinks.empty())
+    {
+        return;
+    }
+    const auto it = pendingLinks.find(program);
+    if (it != pendingLinks.end())
+    {
+        const Context::PendingLink pending = it->second;
+        pendingLinks.erase(it);
+        checkLinkedProgram(program, pending.originalName, pending.status, pending.callNo);
+    }
+}
+
+void poll_glLinkProgram()
+{
+    std::unordered_map<GLuint, Context::PendingLink>& pendingLinks = gRetracer.getCurrentContext().getPendingLinks();
+    for (auto it = pendingLinks.begin(); it != pendingLinks.end(); )
+    {
+        GLint done = GL_FALSE;
+        _glGetProgramiv(it->first, GL_COMPLETION_STATUS_KHR, &done);
+        if (done == GL_TRUE)
+        {
+            const GLuint program = it->first;
+            const Context::PendingLink pending = it->second;
+            it = pendingLinks.erase(it);
+            checkLinkedProgram(program, pending.originalName, pending.status, pending.callNo);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+static void checkLinkedProgram(GLuint program, GLuint originalProgramName, int status, unsigned callNo)
+{
+    TimelineScope scope("shader", "check linked program", callNo);
     GLint linkStatus;
     _glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
     if (linkStatus == GL_TRUE && status == 0)
@@ -1848,7 +2567,7 @@ void post_glLinkProgram(GLuint program, GLuint originalProgramName, int status)
             infoLog = (char *)malloc(infoLogLength);
             glGetProgramInfoLog(program, infoLogLength, &len, infoLog);
         }
-        vector<unsigned int>::iterator result = find(gRetracer.mOptions.mLinkErrorWhiteListCallNum.begin(), gRetracer.mOptions.mLinkErrorWhiteListCallNum.end(), gRetracer.GetCurCallId());
+        vector<unsigned int>::iterator result = find(gRetracer.mOptions.mLinkErrorWhiteListCallNum.begin(), gRetracer.mOptions.mLinkErrorWhiteListCallNum.end(), callNo);
         if(result != gRetracer.mOptions.mLinkErrorWhiteListCallNum.end())
         {
             DBG_LOG("Error in linking program %d: %s. But this call has already been added to whitelist. So ignore this error and continue retracing.\n", originalProgramName, infoLog ? infoLog : "(n/a)");
@@ -1860,8 +2579,6 @@ void post_glLinkProgram(GLuint program, GLuint originalProgramName, int status)
         free(infoLog);
     }
 
-    static std::unordered_map<std::string, uint64_t> shaderCacheIndex;
-
     if (gRetracer.mOptions.mShaderCacheFile.size() > 0 && !gRetracer.mOptions.mShaderCacheRequired)
     {
         std::vector<std::string> shaders;
@@ -1871,7 +2588,10 @@ void post_glLinkProgram(GLuint program, GLuint originalProgramName, int status)
         }
 
         MD5Digest cached_md5(shaders);
-        if (shaderCacheIndex.count(cached_md5.text()) == 0)
+        uint32_t cachedFormat;
+        const char* cachedBinary;
+        uint32_t cachedSize;
+        if (!gRetracer.shaderCache.find(cached_md5.text(), shaderCacheDriver(), cachedFormat, cachedBinary, cachedSize))
         {
             // save and write binary to disk
             GLint len = 0;
@@ -1881,40 +2601,14 @@ void post_glLinkProgram(GLuint program, GLuint originalProgramName, int status)
             GLenum binaryFormat = GL_NONE;
             _glGetProgramBinary(program, len, NULL, &binaryFormat, (void*)buffer.data());
 
-            uint32_t size = len;
-            long offset = ftell(gRetracer.shaderCacheFile);
-            if (fwrite(&binaryFormat, sizeof(GLenum), 1, gRetracer.shaderCacheFile) != 1
-                || fwrite(&size, sizeof(size), 1, gRetracer.shaderCacheFile) != 1
-                || fwrite(buffer.data(), buffer.size(), 1, gRetracer.shaderCacheFile) != 1)
-            {
-                gRetracer.reportAndAbort("Failed to write data to shader cache file: %s\n", strerror(ferror(gRetracer.shaderCacheFile)));
-            }
-
-            shaderCacheIndex[cached_md5.text()] = offset;
-            // Overwrite index on disk
-            const std::string ipath = gRetracer.mOptions.mShaderCacheFile + ".idx";
             if (gRetracer.mOptions.mDebug)
             {
-                DBG_LOG("Saving program%d(traceProgram%d) to shader cache as %s{.idx|.bin} with offset=%ld size=%ld\n", (int)program, (int)originalProgramName, gRetracer.mOptions.mShaderCacheFile.c_str(), offset, (long)size);
-            }
-            FILE *fp = fopen(ipath.c_str(), "wb");
-            if (!fp)
-            {
-                gRetracer.reportAndAbort("Failed to open index file %s for writing: %s\n", ipath.c_str(), strerror(errno));
+                DBG_LOG("Saving program%d(traceProgram%d) to shader cache as %s{.idx|.bin} with size=%ld\n", (int)program, (int)originalProgramName, gRetracer.mOptions.mShaderCacheFile.c_str(), (long)len);
             }
-            uint32_t entries = shaderCacheIndex.size();
-            if (fwrite(&entries, sizeof(entries), 1, fp) != 1)
+            if (len > 0 && binaryFormat != GL_NONE && !gRetracer.shaderCache.save(cached_md5.text(), shaderCacheDriver(), binaryFormat, buffer.data(), len))
             {
-                gRetracer.reportAndAbort("Failed to write first data to shader cache index: %s\n", strerror(ferror(gRetracer.shaderCacheFile)));
+                gRetracer.reportAndAbort("Failed to save program %d to shader cache %s", (int)program, gRetracer.mOptions.mShaderCacheFile.c_str());
             }
-            for (const auto &pair : shaderCacheIndex)
-            {
-                if (fwrite(pair.first.c_str(), pair.first.size(), 1, fp) != 1 || fwrite(&pair.second, sizeof(pair.second), 1, fp) != 1)
-                {
-                    gRetracer.reportAndAbort("Failed to write data to shader cache index: %s\n", strerror(ferror(gRetracer.shaderCacheFile)));
-                }
-            }
-            fclose(fp);
         }
     }
 
@@ -1946,7 +2640,8 @@ void post_glLinkProgram(GLuint program, GLuint originalProgramName, int status)
 
 void hardcode_glBindFramebuffer(int target, unsigned int framebuffer)
 {
-    gRetracer.getCurrentContext()._current_framebuffer = framebuffer;
+    Context& context = gRetracer.getCurrentContext();
+    context._current_framebuffer = framebuffer;
 
 #if TARGET_OS_IPHONE || TARGET_IPHONE_SIMULATOR
     const unsigned int ON_SCREEN_FBO = 1;
@@ -1957,10 +2652,12 @@ void hardcode_glBindFramebuffer(int target, unsigned int framebuffer)
     if (gRetracer.mOptions.mForceOffscreen && framebuffer == ON_SCREEN_FBO)
     {
         gRetracer.mpOffscrMgr->BindOffscreenFBO(target);
+        context._shadow.bindFramebuffer(target, gRetracer.mpOffscrMgr->OffscreenFBO());
     }
     else
     {
         glBindFramebuffer(target, framebuffer);
+        context._shadow.bindFramebuffer(target, framebuffer);
     }
 }
 
@@ -1990,23 +2687,23 @@ void hardcode_glDeleteFramebuffers(int n, unsigned int* oldIds)
         unsigned int oldId = oldIds[i];
         unsigned int newId = idMap.RValue(oldId);
 
-        GLint preReadFboId, preDrawFboId;
-        _glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &preReadFboId);
-        _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &preDrawFboId);
+        const GLuint preReadFboId = context._shadow.readFramebuffer();
+        const GLuint preDrawFboId = context._shadow.drawFramebuffer();
 
         glDeleteFramebuffers(1, &newId);
         idMap.LValue(oldId) = 0;
+        context._shadow.deleteFramebuffer(newId);
 
-        if (gRetracer.mOptions.mForceOffscreen &&
-            (newId == (unsigned int)preReadFboId || newId == (unsigned int)preDrawFboId))
+        if (gRetracer.mOptions.mForceOffscreen && (newId == preReadFboId || newId == preDrawFboId))
         {
 #if TARGET_OS_IPHONE || TARGET_IPHONE_SIMULATOR
             const unsigned int ON_SCREEN_FBO = 1;
 #else
             const unsigned int ON_SCREEN_FBO = 0;
 #endif
-            gRetracer.getCurrentContext()._current_framebuffer = ON_SCREEN_FBO;
+            context._current_framebuffer = ON_SCREEN_FBO;
             gRetracer.mpOffscrMgr->BindOffscreenFBO(GL_FRAMEBUFFER);
+            context._shadow.bindFramebuffer(GL_FRAMEBUFFER, gRetracer.mpOffscrMgr->OffscreenFBO());
         }
     }
 }
@@ -4,6 +4,36 @@
 #include "retracer/retrace_options.hpp"
 #include "retracer/state.hpp"
 #include "retracer/texture.hpp"
+#include "retracer/thread_handoff.hpp"
+#include "retracer/call_decoder.hpp"
+#include "retracer/shader_cache.hpp"
+#include "retracer/snapshot_queue.hpp"
+#include "retracer/thumbnail_writer.hpp"
+#include "retracer/buffer_dump_queue.hpp"
+#include "retracer/graphic_buffer_pool.hpp"
+#include "retracer/snapshot_compare.hpp"
+#include "retracer/snapshot_hash.hpp"
+#include "retracer/gpu_timer.hpp"
+#include "retracer/counter_sampler.hpp"
+#include "retracer/timeline.hpp"
+#include "retracer/call_stats.hpp"
+#include "retracer/loop_stats.hpp"
+#include "retracer/frame_pacer.hpp"
+#include "retracer/present_feedback.hpp"
+#include "retracer/present_timer.hpp"
+#include "retracer/upload_ring.hpp"
+#include "retracer/state_filter.hpp"
+#include "retracer/uniform_batch.hpp"
+#include "retracer/memory_timeline.hpp"
+#include "retracer/thread_placement.hpp"
+#include "retracer/frame_limiter.hpp"
+#include "retracer/shader_stats.hpp"
+#include "retracer/frame_phases.hpp"
+#include "retracer/perf_sampler.hpp"
+#include "retracer/loop_checkpoint.hpp"
+#include "retracer/fast_seek.hpp"
+#include "retracer/invalidation_injector.hpp"
+#include "retracer/texture_transcoder.hpp"
 #include "helper/states.h"
 #include "graphic_buffer/GraphicBuffer.hpp"
 #include "dma_buffer/dma_buffer.hpp"
@@ -42,9 +72,12 @@ struct thread_result // internal counters
     int total = 0;
     int skipped = 0;
     int handovers = 0;
-    int wakeups = 0;
-    int timeouts = 0;
+    int spins = 0; ///< handovers back to us that came without parking
+    int wakeups = 0; ///< handovers back to us that came after parking
     int swaps = 0;
+    long long handoffTime = 0; ///< from handing over to us until we run, in os::getTime() ticks
+    long long maxHandoffTime = 0;
+    int contextSwitches = 0; ///< -collapsethreads: contexts made current for another thread's calls
 };
 
 class Retracer
@@ -68,6 +101,7 @@ public:
     void OnFrameComplete();
     void OnNewFrame();
     void StartMeasuring();
+    void CheckWarmup();
 
     StateLogger& getStateLogger() { return mStateLogger; }
 
@@ -92,21 +126,70 @@ public:
     void PerfStart();
     void PerfEnd();
 
+    // Read and written on every call, kept on the same cache lines as the copy of the options
+    // that the replay loop reads (see mLoop)
+    alignas(64) common::BCall_vlen mCurCall;
+    void* fptr = nullptr;
+    char* src = nullptr;
+    unsigned curCallNo = 0;
+    int64_t frameBudget = INT64_MAX;
+    int64_t drawBudget = INT64_MAX;
+
+private:
+    /// Work that can be asked for on every call. The replay loop is compiled once for none of
+    /// it, which most replays ask for, and once for any (see RetraceLoop()).
+    enum CallFeature
+    {
+        CALL_SNAPSHOT = 1 << 0, ///< snapshot call set
+        CALL_SKIP = 1 << 1, ///< skip call set, fast seek and skipwork
+        CALL_UNIFORM_BATCH = 1 << 2,
+        CALL_GPU_TIMING = 1 << 3,
+        CALL_COUNTERS = 1 << 4,
+        CALL_TIMELINE = 1 << 5,
+        CALL_PHASES = 1 << 6,
+        CALL_STATS = 1 << 7,
+        CALL_DEBUG = 1 << 8,
+        CALL_STEP = 1 << 9,
+        CALL_INVALIDATE = 1 << 10, ///< invalidates added with -invalidate
+        CALL_ALL = ~0u
+    };
+
+    /// What the replay loop needs of the options on every call, set once replay starts
+    struct CallLoopState
+    {
+        unsigned features = 0; ///< CallFeature bits
+        unsigned beginMeasureFrame = 0;
+        unsigned endMeasureFrame = 0;
+        int retraceTid = -1;
+        unsigned short swapBuffersId = 0;
+        unsigned short swapBuffersWithDamageId = 0;
+        bool multiThread = false;
+        bool collapseThreads = false;
+    };
+    CallLoopState mLoop;
+
+    void setupCallLoop();
+    template <unsigned Features> void RetraceLoop(thread_result& r, ThreadHandoff& handoff, int our_tid);
+    void SwitchCollapsedThread(thread_result& r);
+
+public:
     common::InFile mFile;
     RetraceOptions mOptions;
     StateMgr mState;
-    common::BCall_vlen mCurCall;
     bool mFailedToLinkShaderProgram = false;
     std::atomic_bool mFinish;
     OffscreenManager *mpOffscrMgr = nullptr;
     common::ClientSideBufferObjectSet mCSBuffers;
     Quad *mpQuad = nullptr;
 
-    unsigned mVBODataSize = 0;
-    unsigned mTextureDataSize = 0;
-    unsigned mCompressedTextureDataSize = 0;
-    unsigned mClientSideMemoryDataSize = 0;
+    uint64_t mVBODataSize = 0;
+    uint64_t mTextureDataSize = 0;
+    uint64_t mCompressedTextureDataSize = 0;
+    uint64_t mClientSideMemoryDataSize = 0;
     std::unordered_map<std::string, int> mCallCounter;
+    /// -removeUnusedVertexAttributes: vertex shader sources with attributes made constants, by the
+    /// MD5 of the source and the attributes, since many programs share their vertex shaders
+    std::unordered_map<std::string, std::string> mRewrittenShaders;
 
     Collection *mCollectors = nullptr;
 
@@ -114,27 +197,58 @@ public:
     bool delayedPerfmonInit = false;
     void perfMonInit();
     int mSurfaceCount = 0;
+    bool mDebugErrorPending = false; ///< synchronous KHR_debug output reported an error in the current call
+    bool mKeepDisplay = false; ///< -jsonBatch reuses the EGL display and shader cache for the next trace
+    int64_t mStartupBegin = 0; ///< when main() started on this trace, zero if not known
 
-    struct ProgramCache
-    {
-        GLenum format;
-        std::vector<char> buffer;
-    };
-    FILE *shaderCacheFile = NULL;
-    std::unordered_map<std::string, uint64_t> shaderCacheIndex; // md5 of shader source to offset of cache file
-    std::unordered_map<std::string, ProgramCache> shaderCache; // md5 of shader source to cache struct in mem
-    int64_t frameBudget = INT64_MAX;
-    int64_t drawBudget = INT64_MAX;
-
-    unsigned curCallNo = 0;
+    /// Record the time since begin as a startup phase, for the "startup" part of the result
+    void addStartupTime(const char* phase, int64_t begin);
 
-    void* fptr = nullptr;
-    char* src = nullptr;
-    std::deque<std::condition_variable> conditions;
+    ShaderCache shaderCache;
+    std::deque<ThreadHandoff> handoffs;
     std::deque<std::thread> threads;
     std::unordered_map<int, int> thread_remapping;
     std::atomic_int latest_call_tid;
-    std::mutex mConditionMutex;
+    std::atomic<long long> handoff_begin; ///< when latest_call_tid was last changed
+    std::unique_ptr<CallDecoder> mDecoder; ///< reads ahead in -multithread mode
+
+    /// With -collapsethreads, the surface and context current on the one replay thread, which may
+    /// be those of another trace thread than the current call's
+    Drawable* mCollapsedDrawable = nullptr;
+    Context* mCollapsedContext = nullptr;
+
+    // Per-context GL objects, flushed by eglMakeCurrent when the context changes
+    void FlushContextWork();
+    SnapshotQueue mSnapshotQueue;
+    ThumbnailWriter mThumbnails; ///< with -thumbnails
+    BufferDumpQueue mBufferDumpQueue;
+    SnapshotComparer mSnapshotComparer;
+    GpuTimer mGpuTimer;
+    UploadRing mUploadRing;
+    TextureTranscoder mTranscoder; ///< with -transcode
+    bool mStagedUploads = false; ///< large uploads go through mUploadRing
+    StateFilter mStateFilter;
+    bool mFilteringState = false; ///< calls that do not change state are skipped by mStateFilter
+    UniformBatch mUniformBatch;
+    bool mBatchingUniforms = false; ///< uniform calls are collected by mUniformBatch
+    PresentTimer mPresentTimer; ///< used by the drawables of the GLWS when swapping
+    PresentFeedback mPresentFeedback; ///< fed by the windows of the GLWS
+    MemoryTimeline mMemoryTimeline;
+    ThreadPlacement mThreadPlacement;
+    FrameLimiter mFrameLimiter;
+    ShaderStats mShaderStats;
+    FramePhases mFramePhases;
+    PerfSampler mPerfSampler;
+    CounterSampler mCounterSampler;
+    LoopCheckpoint mLoopCheckpoint;
+    FastSeek mFastSeek;
+    InvalidationInjector mInvalidation;
+#ifdef ANDROID
+    GraphicBufferPool<GraphicBuffer> mGraphicBufferPool;
+    GraphicBufferPool<HardwareBuffer> mHardwareBufferPool;
+#else
+    GraphicBufferPool<egl_image_fixture> mGraphicBufferPool;
+#endif
 
 private:
     bool loadRetraceOptionsByThreadId(int tid);
@@ -142,6 +256,8 @@ private:
     float getDuration(int64_t lastTime, int64_t* thisTime) const;
     float ticksToSeconds(long long t) const;
     void initializeCallCounter();
+    void resetTraceState();
+    void CheckPreloadBudget();
 
 #ifndef _WIN32
     bool addMaliRegisterInformation();
@@ -159,19 +275,27 @@ private:
     StateLogger mStateLogger;
     common::HeaderVersion mFileFormatVersion = common::INVALID_VERSION;
     std::vector<std::string> mSnapshotPaths;
+    SnapshotHashes mSnapshotHashes;
+    bool mAsyncSnapshots = false; ///< color snapshots go through mSnapshotQueue, buffer dumps through mBufferDumpQueue
+    bool mGpuTiming = false; ///< draws are timed by mGpuTimer
+    bool mCounterSampling = false; ///< render passes or draws get their own counters from mCounterSampler
 
-    struct CallStat
-    {
-        uint64_t count = 0;
-        uint64_t time = 0;
-    };
-    std::unordered_map<std::string, CallStat> mCallStats;
+    CallStats mCallStats;
 
     pid_t child = 0;
 
     int mLoopTimes = 0;
     std::vector<float> mLoopResults;
+    Json::Value mStartupTimes; ///< seconds spent in each startup phase
     int64_t mLoopBeginTime = 0;
+    LoopStats mLoopStats;
+    FramePacer mFramePacer;
+
+    /// Loops run with -loopwarmup before giving up on frame times settling down
+    static const int MAX_WARMUP_LOOPS = 10;
+    bool mWarmingUp = false;
+    int mWarmupLoops = 0;
+    double mWarmupMean = 0.0; ///< mean frame time of the previous warm-up loop
 
     unsigned mCurDrawNo = 0;
     unsigned mCurFrameNo = 0;
@@ -198,8 +322,11 @@ void pre_glDraw();
 void post_glLinkProgram(GLuint shader, GLuint originalShaderName, int status);
 void post_glCompileShader(GLuint program, GLuint originalProgramName);
 void post_glShaderSource(GLuint shader, GLuint originalshaderName, GLsizei count, const GLchar **string, const GLint *length);
+void finish_glLinkProgram(GLuint program);
+void poll_glLinkProgram();
 void OpenShaderCacheFile();
 bool load_from_shadercache(GLuint program, GLuint originalProgramName, int status);
+void end_shader_timing(ShaderStats::Kind kind, int64_t begin, GLuint program = 0);
 void hardcode_glBindFramebuffer(int target, unsigned int framebuffer);
 void hardcode_glDeleteBuffers(int n, unsigned int* oldBuffers);
 void hardcode_glDeleteFramebuffers(int n, unsigned int* oldBuffers);
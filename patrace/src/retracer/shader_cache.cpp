@@ -0,0 +1,329 @@
+#include "retracer/shader_cache.hpp"
+
+#include "common/file_format.hpp"
+#include "common/os.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace retracer {
+
+// Index files used to be a count followed by {md5, offset} entries. Now they start with this
+// and have {md5, driver, offset} entries.
+static const uint32_t INDEX_MAGIC = 0x32435350; // "PSC2"
+static const size_t KEY_LEN = 32; // MD5 as text
+
+struct ProgramHeader
+{
+    uint32_t format;
+    uint32_t size;
+};
+
+namespace {
+
+// Exclusive lock on the cache for as long as it lives
+class FileLock
+{
+public:
+    FileLock(int fd) : mFd(fd) { while (flock(mFd, LOCK_EX) != 0 && errno == EINTR) {} }
+    ~FileLock() { flock(mFd, LOCK_UN); }
+
+private:
+    int mFd;
+};
+
+std::string readKey(FILE* fp, bool& ok)
+{
+    char key[KEY_LEN];
+    ok = ok && fread(key, sizeof(key), 1, fp) == 1;
+    return std::string(key, strnlen(key, sizeof(key)));
+}
+
+bool writeKey(FILE* fp, const std::string& str)
+{
+    char key[KEY_LEN] = {};
+    memcpy(key, str.data(), std::min(str.size(), sizeof(key)));
+    return fwrite(key, sizeof(key), 1, fp) == 1;
+}
+
+}
+
+bool ShaderCache::open(const std::string& name)
+{
+    close();
+    const std::string bpath = name + ".bin";
+    mFd = ::open(bpath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (mFd == -1)
+    {
+        DBG_LOG("Failed to open shader cache file %s: %s\n", bpath.c_str(), strerror(errno));
+        return false;
+    }
+    mName = name;
+    return true;
+}
+
+bool ShaderCache::openEmbedded(const std::string& name, std::vector<char>& section)
+{
+    close();
+    const common::BProgramBinariesHeader* header = (const common::BProgramBinariesHeader*)section.data();
+    if (section.size() < sizeof(*header) || header->magic != PROGRAM_BINARIES_MAGIC)
+    {
+        DBG_LOG("Invalid program binaries in %s\n", name.c_str());
+        return false;
+    }
+    mEmbedded.swap(section);
+    mName = name;
+    return true;
+}
+
+void ShaderCache::close()
+{
+    if (mMapping) munmap(mMapping, mMappingSize);
+    for (const auto& old : mOldMappings) munmap(old.first, old.second);
+    mOldMappings.clear();
+    mMapping = nullptr;
+    mMappingSize = 0;
+    if (mFd != -1) ::close(mFd);
+    mFd = -1;
+    mEmbedded.clear();
+    mIndex.clear();
+    mIndexLoaded = false;
+}
+
+bool ShaderCache::readIndex(Index& index) const
+{
+    if (!mEmbedded.empty())
+    {
+        // entries point at the format and size of a BProgramBinary, laid out like a ProgramHeader
+        const common::BProgramBinariesHeader* header = (const common::BProgramBinariesHeader*)mEmbedded.data();
+        size_t pos = sizeof(*header);
+        for (uint32_t i = 0; i < header->count; i++)
+        {
+            const common::BProgramBinary* program = (const common::BProgramBinary*)(mEmbedded.data() + pos);
+            if (pos + sizeof(*program) > mEmbedded.size() || pos + sizeof(*program) + program->size > mEmbedded.size())
+            {
+                DBG_LOG("Program binaries of %s are cut short after %u entries\n", mName.c_str(), i);
+                return false;
+            }
+            Entry entry;
+            entry.offset = pos + offsetof(common::BProgramBinary, format);
+            entry.driver = std::string(program->driver, strnlen(program->driver, sizeof(program->driver)));
+            index[std::string(program->md5, strnlen(program->md5, sizeof(program->md5))) + entry.driver] = entry;
+            pos += sizeof(*program) + program->size;
+        }
+        return true;
+    }
+    const std::string ipath = mName + ".idx";
+    FILE* fp = fopen(ipath.c_str(), "rb");
+    if (!fp)
+    {
+        return true; // no cache yet
+    }
+    uint32_t count = 0;
+    bool ok = fread(&count, sizeof(count), 1, fp) == 1;
+    const bool legacy = (count != INDEX_MAGIC);
+    if (ok && !legacy)
+    {
+        ok = fread(&count, sizeof(count), 1, fp) == 1;
+    }
+    for (uint32_t i = 0; ok && i < count; i++)
+    {
+        const std::string md5 = readKey(fp, ok);
+        Entry entry;
+        if (!legacy)
+        {
+            entry.driver = readKey(fp, ok);
+        }
+        ok = ok && fread(&entry.offset, sizeof(entry.offset), 1, fp) == 1;
+        if (ok)
+        {
+            index[md5 + entry.driver] = entry;
+        }
+    }
+    if (!ok)
+    {
+        DBG_LOG("Failed to read shader cache index %s\n", ipath.c_str());
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool ShaderCache::writeIndex(const Index& index) const
+{
+    // written next to the index and renamed over it, so readers never see half an index
+    const std::string ipath = mName + ".idx";
+    const std::string tmppath = ipath + "." + std::to_string(getpid());
+    FILE* fp = fopen(tmppath.c_str(), "wb");
+    if (!fp)
+    {
+        DBG_LOG("Failed to open index file %s for writing: %s\n", tmppath.c_str(), strerror(errno));
+        return false;
+    }
+    const uint32_t count = index.size();
+    bool ok = fwrite(&INDEX_MAGIC, sizeof(INDEX_MAGIC), 1, fp) == 1 && fwrite(&count, sizeof(count), 1, fp) == 1;
+    for (const auto& pair : index)
+    {
+        const Entry& entry = pair.second;
+        ok = ok && writeKey(fp, pair.first.substr(0, pair.first.size() - entry.driver.size())) && writeKey(fp, entry.driver)
+             && fwrite(&entry.offset, sizeof(entry.offset), 1, fp) == 1;
+    }
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmppath.c_str(), ipath.c_str()) != 0)
+    {
+        DBG_LOG("Failed to write shader cache index %s: %s\n", ipath.c_str(), strerror(errno));
+        unlink(tmppath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ShaderCache::loadIndex(const std::string& driver)
+{
+    if (mIndexLoaded && driver == mDriver)
+    {
+        return true;
+    }
+    Index index;
+    if (!readIndex(index))
+    {
+        return false;
+    }
+    mIndex.clear();
+    for (const auto& pair : index)
+    {
+        if (pair.second.driver.empty() || pair.second.driver == driver)
+        {
+            mIndex.insert(pair);
+        }
+    }
+    DBG_LOG("Found shader cache index with %d entries, %d of them usable\n", (int)index.size(), (int)mIndex.size());
+    mDriver = driver;
+    mIndexLoaded = true;
+    return true;
+}
+
+const char* ShaderCache::map(uint64_t offset, size_t size)
+{
+    if (!mEmbedded.empty())
+    {
+        return offset + size <= mEmbedded.size() ? mEmbedded.data() + offset : nullptr;
+    }
+    if (offset + size > mMappingSize)
+    {
+        struct stat st;
+        if (fstat(mFd, &st) != 0 || offset + size > (uint64_t)st.st_size)
+        {
+            return nullptr;
+        }
+        // mappings made earlier stay valid, since we hand out pointers into them
+        void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, mFd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            DBG_LOG("Failed to map shader cache file %s.bin: %s\n", mName.c_str(), strerror(errno));
+            return nullptr;
+        }
+        if (mMapping) mOldMappings.push_back(std::make_pair(mMapping, mMappingSize));
+        mMapping = (char*)mapping;
+        mMappingSize = st.st_size;
+    }
+    return mMapping + offset;
+}
+
+bool ShaderCache::find(const std::string& md5, const std::string& driver, uint32_t& format, const char*& data, uint32_t& size)
+{
+    if (!isOpen() || !loadIndex(driver))
+    {
+        return false;
+    }
+    auto it = mIndex.find(md5 + driver);
+    if (it == mIndex.end())
+    {
+        it = mIndex.find(md5);
+    }
+    if (it == mIndex.end())
+    {
+        return false;
+    }
+    const uint64_t offset = it->second.offset;
+    const ProgramHeader* header = (const ProgramHeader*)map(offset, sizeof(ProgramHeader));
+    if (!header || header->format == 0 || header->size == 0 || !map(offset + sizeof(ProgramHeader), header->size))
+    {
+        DBG_LOG("Invalid shader cache entry at %lu for %s\n", (unsigned long)offset, md5.c_str());
+        mIndex.erase(it);
+        return false;
+    }
+    format = header->format;
+    size = header->size;
+    data = (const char*)(header + 1);
+    return true;
+}
+
+bool ShaderCache::forEach(const std::function<void(const std::string&, const std::string&, uint32_t, const char*, uint32_t)>& f)
+{
+    Index index;
+    if (!isOpen() || !readIndex(index))
+    {
+        return false;
+    }
+    for (const auto& pair : index)
+    {
+        const uint64_t offset = pair.second.offset;
+        const ProgramHeader* header = (const ProgramHeader*)map(offset, sizeof(ProgramHeader));
+        if (!header || header->format == 0 || header->size == 0 || !map(offset + sizeof(ProgramHeader), header->size))
+        {
+            DBG_LOG("Invalid shader cache entry at %lu\n", (unsigned long)offset);
+            continue;
+        }
+        f(pair.first.substr(0, pair.first.size() - pair.second.driver.size()), pair.second.driver, header->format, (const char*)(header + 1), header->size);
+    }
+    return true;
+}
+
+bool ShaderCache::save(const std::string& md5, const std::string& driver, uint32_t format, const char* data, uint32_t size)
+{
+    if (mFd == -1 || !loadIndex(driver))
+    {
+        return false;
+    }
+    FileLock lock(mFd);
+
+    const off_t offset = lseek(mFd, 0, SEEK_END);
+    const ProgramHeader header = { format, size };
+    if (offset == (off_t)-1 || write(mFd, &header, sizeof(header)) != (ssize_t)sizeof(header) || write(mFd, data, size) != (ssize_t)size)
+    {
+        DBG_LOG("Failed to write data to shader cache file: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Other replays, also with other drivers, may have added entries since we loaded the index.
+    // They all stay in the file, only ours are kept in memory.
+    Index index;
+    readIndex(index);
+    Entry& entry = index[md5 + driver];
+    entry.offset = offset;
+    entry.driver = driver;
+    if (!writeIndex(index))
+    {
+        return false;
+    }
+    mIndex.clear();
+    for (const auto& pair : index)
+    {
+        if (pair.second.driver.empty() || pair.second.driver == driver)
+        {
+            mIndex.insert(pair);
+        }
+    }
+    return true;
+}
+
+}
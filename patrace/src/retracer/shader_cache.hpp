@@ -0,0 +1,83 @@
+#ifndef _RETRACER_SHADER_CACHE_HPP_
+#define _RETRACER_SHADER_CACHE_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace retracer {
+
+/// Program binaries keyed by the MD5 of their shader sources, kept in name.bin with an index
+/// in name.idx (see -shadercache).
+///
+/// Nothing is read up front. The index is loaded on first use, and binaries are looked up in a
+/// read-only mapping of name.bin, so a large cache only costs what a replay actually uses.
+/// Several replays can share one cache: saving takes an exclusive lock on name.bin, appends to
+/// it and merges the index on disk into a new one, which replaces the old one atomically.
+///
+/// Entries are tagged with the driver that built them. Binaries of other drivers are never
+/// used, and their index entries are dropped when the index is rewritten. Entries of old index
+/// files have no driver and are used by any driver.
+///
+/// A cache can also be the program binaries embedded in a trace (see BProgramBinariesHeader),
+/// which is read only.
+class ShaderCache
+{
+public:
+    ShaderCache() {}
+    ~ShaderCache() { close(); }
+    ShaderCache(const ShaderCache&) = delete;
+    ShaderCache& operator=(const ShaderCache&) = delete;
+
+    /// Use name.bin and name.idx from now on. Only checks that name.bin can be opened.
+    bool open(const std::string& name);
+    /// Use the program binaries section of a trace from now on, taking over its data
+    bool openEmbedded(const std::string& name, std::vector<char>& section);
+    void close();
+    bool isOpen() const { return mFd != -1 || !mEmbedded.empty(); }
+    bool isEmbedded() const { return !mEmbedded.empty(); }
+    const std::string& name() const { return mName; }
+
+    /// Find the binary of a program. The data stays valid until the cache is closed.
+    bool find(const std::string& md5, const std::string& driver, uint32_t& format, const char*& data, uint32_t& size);
+    /// Add the binary of a program. Returns false if the files could not be written.
+    bool save(const std::string& md5, const std::string& driver, uint32_t format, const char* data, uint32_t size);
+
+    /// Call f(md5, driver, format, data, size) for every entry, whichever driver built it
+    bool forEach(const std::function<void(const std::string&, const std::string&, uint32_t, const char*, uint32_t)>& f);
+
+    /// Number of usable entries, after the index has been loaded
+    size_t size() const { return mIndex.size(); }
+
+private:
+    struct Entry
+    {
+        uint64_t offset;
+        std::string driver;
+    };
+    typedef std::unordered_map<std::string, Entry> Index; // md5 + driver to entry
+
+    bool readIndex(Index& index) const;
+    bool writeIndex(const Index& index) const;
+    bool loadIndex(const std::string& driver);
+    /// size bytes of name.bin at offset, mapping more of the file if it has grown
+    const char* map(uint64_t offset, size_t size);
+
+    std::string mName;
+    int mFd = -1; ///< name.bin
+    std::string mDriver; ///< driver that the loaded index was filtered for
+    bool mIndexLoaded = false;
+    Index mIndex;
+    char* mMapping = nullptr;
+    size_t mMappingSize = 0;
+    std::vector<std::pair<char*, size_t>> mOldMappings; ///< replaced when name.bin grew
+    std::vector<char> mEmbedded; ///< program binaries section, in place of name.bin and name.idx
+};
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+#include "retracer/shader_stats.hpp"
+
+#include "common/os_time.hpp"
+
+#include <algorithm>
+
+namespace retracer {
+
+static const char* kindNames[ShaderStats::KIND_COUNT] = { "compile", "link", "cache_load" };
+
+int64_t ShaderStats::begin() const
+{
+    return mEnabled ? os::getTime() : 0;
+}
+
+void ShaderStats::end(Kind kind, int64_t begin, unsigned frame, unsigned callNo, const std::string& md5)
+{
+    if (begin == 0)
+    {
+        return;
+    }
+    const int64_t time = os::getTime() - begin;
+    if (mFrames.empty() || mFrames.back().frame != frame)
+    {
+        const Frame f = { frame, { 0, 0, 0 }, { 0, 0, 0 } };
+        mFrames.push_back(f);
+    }
+    mFrames.back().count[kind]++;
+    mFrames.back().time[kind] += time;
+
+    if (kind == COMPILE || (mWorst.size() == WORST && time <= mWorst.back().time))
+    {
+        return; // programs are told apart by their sources, single shaders are not kept
+    }
+    const Event event = { kind, frame, callNo, time, md5 };
+    const auto it = std::upper_bound(mWorst.begin(), mWorst.end(), event, [](const Event& a, const Event& b) { return a.time > b.time; });
+    mWorst.insert(it, event);
+    if (mWorst.size() > WORST)
+    {
+        mWorst.pop_back();
+    }
+}
+
+void ShaderStats::store(Json::Value& result) const
+{
+    if (!mEnabled || mFrames.empty())
+    {
+        return;
+    }
+    const double f = os::timeFrequency;
+    Json::Value v;
+    unsigned totalCount[KIND_COUNT] = { 0, 0, 0 };
+    int64_t totalTime[KIND_COUNT] = { 0, 0, 0 };
+    Json::Value frames = Json::arrayValue;
+    for (const Frame& frame : mFrames)
+    {
+        Json::Value e;
+        e["frame"] = frame.frame;
+        int64_t time = 0;
+        for (int k = 0; k < KIND_COUNT; k++)
+        {
+            if (frame.count[k])
+            {
+                e[std::string(kindNames[k]) + "s"] = frame.count[k];
+                e[std::string(kindNames[k]) + "_time"] = frame.time[k] / f;
+            }
+            time += frame.time[k];
+            totalCount[k] += frame.count[k];
+            totalTime[k] += frame.time[k];
+        }
+        e["time"] = time / f;
+        frames.append(e);
+    }
+    v["frames"] = frames;
+    for (int k = 0; k < KIND_COUNT; k++)
+    {
+        v[std::string(kindNames[k]) + "s"] = totalCount[k];
+        v[std::string(kindNames[k]) + "_time"] = totalTime[k] / f;
+    }
+    Json::Value worst = Json::arrayValue;
+    for (const Event& event : mWorst)
+    {
+        Json::Value e;
+        e["kind"] = kindNames[event.kind];
+        e["frame"] = event.frame;
+        e["call"] = event.callNo;
+        e["time"] = event.time / f;
+        e["md5"] = event.md5;
+        worst.append(e);
+    }
+    v["worst"] = worst;
+    result["shader_stats"] = v;
+}
+
+}
@@ -0,0 +1,58 @@
+#ifndef _RETRACER_SHADER_STATS_HPP_
+#define _RETRACER_SHADER_STATS_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace retracer {
+
+/// Time spent compiling and linking shaders and loading programs from the shader cache, for
+/// -shaderstats, totalled for each frame that had any, with the slowest links and cache loads
+/// kept along with the MD5 of their shader sources, the same as in the shader cache. A compile
+/// or link is timed including the status check after it, which waits for the driver to finish,
+/// except with -parallelcompile, where only the time to start it is seen.
+class ShaderStats
+{
+public:
+    enum Kind { COMPILE, LINK, CACHE_LOAD, KIND_COUNT };
+    static const unsigned WORST = 10;
+
+    void setEnabled(bool enabled) { mEnabled = enabled; }
+    bool enabled() const { return mEnabled; }
+
+    /// os::getTime() to pass to end(), or zero if not enabled
+    int64_t begin() const;
+    /// The work started at begin is done, in the given frame and call
+    void end(Kind kind, int64_t begin, unsigned frame, unsigned callNo, const std::string& md5 = std::string());
+
+    /// Add the results as "shader_stats" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    struct Frame
+    {
+        unsigned frame;
+        unsigned count[KIND_COUNT];
+        int64_t time[KIND_COUNT];
+    };
+
+    struct Event
+    {
+        Kind kind;
+        unsigned frame;
+        unsigned callNo;
+        int64_t time;
+        std::string md5;
+    };
+
+    bool mEnabled = false;
+    std::vector<Frame> mFrames; ///< in frame order, only frames with shader work
+    std::vector<Event> mWorst; ///< slowest first
+};
+
+}
+
+#endif
@@ -0,0 +1,430 @@
+#include "retracer/snapshot_compare.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "retracer/glstate.hpp"
+#include "retracer/retracer.hpp"
+#include "retracer/timeline.hpp"
+
+#include "common/image.hpp"
+#include "common/os.hpp"
+#include "helper/shaderutility.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace retracer {
+
+const double SnapshotComparer::MAX_PSNR = 100.0;
+
+static const GLuint GROUP_SIZE = 16; ///< work groups are GROUP_SIZE x GROUP_SIZE pixels
+static const GLsizeiptr HEADER_SIZE = 2 * sizeof(GLuint); ///< maxDiff and mismatches
+
+// The framebuffer copy has its rows bottom up, the reference top down like the PNG it came from
+static const GLchar *compareCSCode =
+"#version 310 es\n\
+ layout(local_size_x = 16, local_size_y = 16) in;\n\
+ uniform highp sampler2D u_Framebuffer;\n\
+ uniform highp sampler2D u_Reference;\n\
+ uniform highp ivec2 u_Size;\n\
+ uniform highp int u_Channels;\n\
+ uniform highp uint u_Tolerance;\n\
+ layout(std430, binding = 0) buffer Result {\n\
+     highp uint maxDiff;\n\
+     highp uint mismatches;\n\
+     highp uint squares[];\n\
+ };\n\
+ shared highp uint groupSquares;\n\
+ shared highp uint groupMax;\n\
+ shared highp uint groupMismatches;\n\
+ void main() {\n\
+     if (gl_LocalInvocationIndex == 0u) {\n\
+         groupSquares = 0u;\n\
+         groupMax = 0u;\n\
+         groupMismatches = 0u;\n\
+     }\n\
+     memoryBarrierShared();\n\
+     barrier();\n\
+     highp ivec2 p = ivec2(gl_GlobalInvocationID.xy);\n\
+     if (p.x < u_Size.x && p.y < u_Size.y) {\n\
+         highp ivec4 a = ivec4(texelFetch(u_Framebuffer, p, 0) * 255.0 + 0.5);\n\
+         highp ivec4 b = ivec4(texelFetch(u_Reference, ivec2(p.x, u_Size.y - 1 - p.y), 0) * 255.0 + 0.5);\n\
+         highp uvec4 d = uvec4(abs(a - b));\n\
+         if (u_Channels == 3) d.a = 0u;\n\
+         highp uint m = max(max(d.r, d.g), max(d.b, d.a));\n\
+         atomicAdd(groupSquares, d.r * d.r + d.g * d.g + d.b * d.b + d.a * d.a);\n\
+         atomicMax(groupMax, m);\n\
+         if (m > u_Tolerance) atomicAdd(groupMismatches, 1u);\n\
+     }\n\
+     memoryBarrierShared();\n\
+     barrier();\n\
+     if (gl_LocalInvocationIndex == 0u) {\n\
+         squares[gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x] = groupSquares;\n\
+         atomicMax(maxDiff, groupMax);\n\
+         atomicAdd(mismatches, groupMismatches);\n\
+     }\n\
+ }";
+
+static std::string baseName(const std::string& filename)
+{
+    const size_t slash = filename.find_last_of("/\\");
+    return (slash == std::string::npos) ? filename : filename.substr(slash + 1);
+}
+
+void SnapshotComparer::setReferences(const std::string& directory, unsigned tolerance)
+{
+    mDirectory = directory;
+    mTolerance = tolerance;
+    mResults.clear();
+    mMissing.clear();
+}
+
+bool SnapshotComparer::build()
+{
+    GLuint shader = _glCreateShader(GL_COMPUTE_SHADER);
+    _glShaderSource(shader, 1, &compareCSCode, 0);
+    _glCompileShader(shader);
+    GLint status = GL_FALSE;
+    _glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status == GL_FALSE)
+    {
+        printShaderInfoLog(shader, "snapshot compare compute shader");
+        _glDeleteShader(shader);
+        return false;
+    }
+
+    mProgram = _glCreateProgram();
+    _glAttachShader(mProgram, shader);
+    _glLinkProgram(mProgram);
+    _glDeleteShader(shader);
+    _glGetProgramiv(mProgram, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE)
+    {
+        printProgramInfoLog(mProgram, "snapshot compare program");
+        _glDeleteProgram(mProgram);
+        mProgram = 0;
+        return false;
+    }
+
+    GLint oldProgram = 0;
+    _glGetIntegerv(GL_CURRENT_PROGRAM, &oldProgram);
+    _glUseProgram(mProgram);
+    _glUniform1i(getUniLoc(mProgram, "u_Framebuffer"), 0);
+    _glUniform1i(getUniLoc(mProgram, "u_Reference"), 1);
+    _glUseProgram(oldProgram);
+
+    _glGenFramebuffers(1, &mFramebuffer);
+    _glGenBuffers(1, &mBuffer);
+    return true;
+}
+
+const SnapshotComparer::Reference* SnapshotComparer::reference(const std::string& name)
+{
+    auto it = mReferences.find(name);
+    if (it != mReferences.end())
+    {
+        return &it->second;
+    }
+    if (mMissing.count(name))
+    {
+        return nullptr;
+    }
+
+    // references are PNG snapshots, whatever format the snapshots are written in
+    std::string path = mDirectory + "/" + name;
+    const size_t dot = path.find_last_of('.');
+    if (dot != std::string::npos && dot > path.find_last_of('/'))
+    {
+        path.resize(dot);
+    }
+    path += ".png";
+    image::Image* image = image::readPNG(path.c_str());
+    if (!image)
+    {
+        DBG_LOG("No reference image %s, the snapshot is written instead\n", path.c_str());
+        mMissing.insert(name);
+        return nullptr;
+    }
+
+    Reference reference;
+    reference.width = image->width;
+    reference.height = image->height;
+
+    GLint oldTexture = 0, oldUnpackBuffer = 0, oldAlignment = 4, oldRowLength = 0, oldSkipRows = 0, oldSkipPixels = 0;
+    _glGetIntegerv(GL_TEXTURE_BINDING_2D, &oldTexture);
+    _glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &oldUnpackBuffer);
+    _glGetIntegerv(GL_UNPACK_ALIGNMENT, &oldAlignment);
+    _glGetIntegerv(GL_UNPACK_ROW_LENGTH, &oldRowLength);
+    _glGetIntegerv(GL_UNPACK_SKIP_ROWS, &oldSkipRows);
+    _glGetIntegerv(GL_UNPACK_SKIP_PIXELS, &oldSkipPixels);
+    _glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    _glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    _glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    _glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    _glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+
+    _glGenTextures(1, &reference.texture);
+    _glBindTexture(GL_TEXTURE_2D, reference.texture);
+    _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    _glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, reference.width, reference.height);
+    _glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, reference.width, reference.height, GL_RGBA, GL_UNSIGNED_BYTE, image->pixels);
+    delete image;
+
+    _glPixelStorei(GL_UNPACK_SKIP_PIXELS, oldSkipPixels);
+    _glPixelStorei(GL_UNPACK_SKIP_ROWS, oldSkipRows);
+    _glPixelStorei(GL_UNPACK_ROW_LENGTH, oldRowLength);
+    _glPixelStorei(GL_UNPACK_ALIGNMENT, oldAlignment);
+    _glBindBuffer(GL_PIXEL_UNPACK_BUFFER, oldUnpackBuffer);
+    _glBindTexture(GL_TEXTURE_2D, oldTexture);
+
+    return &(mReferences[name] = reference);
+}
+
+SnapshotComparer::Outcome SnapshotComparer::compare(GLenum attachment, const std::string& filename, unsigned frameNo, unsigned callNo)
+{
+    Context* context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    if (!context || mUnsupported)
+    {
+        return NOT_COMPARED;
+    }
+    if (context->_profile < PROFILE_ES31)
+    {
+        DBG_LOG("Snapshots are only compared on GLES 3.1 and later contexts\n");
+        mUnsupported = true;
+        return NOT_COMPARED;
+    }
+    if (context != mContext)
+    {
+        if (mContext)
+        {
+            DBG_LOG("Snapshot references of another context are still in use, dropping them\n");
+            release();
+        }
+        mContext = context;
+    }
+    if (!mProgram && !build())
+    {
+        DBG_LOG("Failed to build the snapshot compare shader, snapshots are written instead\n");
+        mUnsupported = true;
+        return NOT_COMPARED;
+    }
+
+    int width = 0, height = 0, channels = 4;
+    if (!glstate::getColorAttachmentSize(attachment, width, height, channels))
+    {
+        return NOT_COMPARED;
+    }
+    while (_glGetError() != GL_NO_ERROR) {}
+
+    const std::string name = baseName(filename);
+    const Reference* reference = this->reference(name);
+    if (!reference)
+    {
+        return NOT_COMPARED;
+    }
+    TimelineScope scope("snapshot", "compare", callNo);
+    Result result = { name, frameNo, callNo, 0.0, 255, (unsigned)(width * height) };
+    if (reference->width != width || reference->height != height)
+    {
+        DBG_LOG("Snapshot (frame %u, call %u) is %dx%d, but its reference is %dx%d\n", frameNo, callNo, width, height, reference->width, reference->height);
+        record(result);
+        return MISMATCH;
+    }
+
+    GLint readFbo = 0, drawFbo = 0, oldReadBuffer = GL_BACK, oldProgram = 0, oldActiveTexture = GL_TEXTURE0;
+    GLint oldTexture[2] = { 0, 0 }, oldStorageBuffer = 0, oldStorageBinding = 0;
+    GLint64 oldStorageStart = 0, oldStorageSize = 0;
+    _glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFbo);
+    _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFbo);
+    _glGetIntegerv(GL_READ_BUFFER, &oldReadBuffer);
+    _glGetIntegerv(GL_CURRENT_PROGRAM, &oldProgram);
+    _glGetIntegerv(GL_ACTIVE_TEXTURE, &oldActiveTexture);
+    _glGetIntegerv(GL_SHADER_STORAGE_BUFFER_BINDING, &oldStorageBuffer);
+    _glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, 0, &oldStorageBinding);
+    _glGetInteger64i_v(GL_SHADER_STORAGE_BUFFER_START, 0, &oldStorageStart);
+    _glGetInteger64i_v(GL_SHADER_STORAGE_BUFFER_SIZE, 0, &oldStorageSize);
+    for (int i = 0; i < 2; i++)
+    {
+        _glActiveTexture(GL_TEXTURE0 + i);
+        _glGetIntegerv(GL_TEXTURE_BINDING_2D, &oldTexture[i]);
+    }
+    const bool scissor = gRetracer.getCurrentContext()._shadow.isEnabled(GL_SCISSOR_TEST);
+
+    // copy the attachment, resolving it if multisampled
+    if (mTexture && (mTextureWidth != width || mTextureHeight != height))
+    {
+        _glDeleteTextures(1, &mTexture);
+        mTexture = 0;
+    }
+    _glActiveTexture(GL_TEXTURE0);
+    if (!mTexture)
+    {
+        _glGenTextures(1, &mTexture);
+        _glBindTexture(GL_TEXTURE_2D, mTexture);
+        _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        _glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+        mTextureWidth = width;
+        mTextureHeight = height;
+        _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFramebuffer);
+        _glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mTexture, 0);
+    }
+    _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFramebuffer);
+    if (readFbo != 0)
+    {
+        _glReadBuffer(attachment);
+    }
+    if (scissor) _glDisable(GL_SCISSOR_TEST);
+    _glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    if (scissor) _glEnable(GL_SCISSOR_TEST);
+    _glReadBuffer(oldReadBuffer);
+    _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFbo);
+
+    const GLuint groupsX = (width + GROUP_SIZE - 1) / GROUP_SIZE;
+    const GLuint groupsY = (height + GROUP_SIZE - 1) / GROUP_SIZE;
+    const GLsizeiptr size = HEADER_SIZE + groupsX * groupsY * sizeof(GLuint);
+    _glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBuffer);
+    if (mBufferSize < size)
+    {
+        _glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_DYNAMIC_READ);
+        mBufferSize = size;
+    }
+    const GLuint zero[2] = { 0, 0 };
+    _glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, HEADER_SIZE, zero);
+    _glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mBuffer);
+
+    _glBindTexture(GL_TEXTURE_2D, mTexture);
+    _glActiveTexture(GL_TEXTURE1);
+    _glBindTexture(GL_TEXTURE_2D, reference->texture);
+    _glUseProgram(mProgram);
+    _glUniform2i(getUniLoc(mProgram, "u_Size"), width, height);
+    _glUniform1i(getUniLoc(mProgram, "u_Channels"), channels);
+    _glUniform1ui(getUniLoc(mProgram, "u_Tolerance"), mTolerance);
+    _glDispatchCompute(groupsX, groupsY, 1);
+    _glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // only the metrics are read back
+    const GLuint* metrics = (const GLuint*)_glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, GL_MAP_READ_BIT);
+    bool compared = false;
+    if (metrics)
+    {
+        uint64_t squares = 0;
+        const GLuint* groups = metrics + HEADER_SIZE / sizeof(GLuint);
+        for (GLuint i = 0; i < groupsX * groupsY; i++)
+        {
+            squares += groups[i];
+        }
+        result.maxDiff = metrics[0];
+        result.mismatches = metrics[1];
+        _glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        const double mse = (double)squares / ((double)width * height * channels);
+        result.psnr = (mse > 0.0) ? std::min(MAX_PSNR, 10.0 * log10(255.0 * 255.0 / mse)) : MAX_PSNR;
+        compared = true;
+    }
+
+    _glUseProgram(oldProgram);
+    for (int i = 0; i < 2; i++)
+    {
+        _glActiveTexture(GL_TEXTURE0 + i);
+        _glBindTexture(GL_TEXTURE_2D, oldTexture[i]);
+    }
+    _glActiveTexture(oldActiveTexture);
+    if (oldStorageSize > 0)
+    {
+        _glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, oldStorageBinding, oldStorageStart, oldStorageSize);
+    }
+    else
+    {
+        _glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, oldStorageBinding);
+    }
+    _glBindBuffer(GL_SHADER_STORAGE_BUFFER, oldStorageBuffer);
+
+    GLenum error = _glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        do {
+            DBG_LOG("warning: 0x%x while comparing snapshot\n", error);
+            error = _glGetError();
+        } while (error != GL_NO_ERROR);
+        compared = false;
+    }
+    if (!compared)
+    {
+        return NOT_COMPARED;
+    }
+
+    record(result);
+    return (result.mismatches > 0) ? MISMATCH : MATCH;
+}
+
+void SnapshotComparer::record(const Result& result)
+{
+    DBG_LOG("Snapshot (frame %u, call %u) %s : %s, PSNR %.2f dB, max difference %u, %u pixels differ by more than %u\n",
+            result.frameNo, result.callNo, result.name.c_str(), result.mismatches ? "MISMATCH" : "match",
+            result.psnr, result.maxDiff, result.mismatches, mTolerance);
+    mResults.push_back(result);
+}
+
+void SnapshotComparer::release()
+{
+    // without a current context, the objects went with it
+    const bool current = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext() == mContext;
+    if (current)
+    {
+        for (const auto& it : mReferences)
+        {
+            _glDeleteTextures(1, &it.second.texture);
+        }
+        if (mTexture) _glDeleteTextures(1, &mTexture);
+        if (mFramebuffer) _glDeleteFramebuffers(1, &mFramebuffer);
+        if (mBuffer) _glDeleteBuffers(1, &mBuffer);
+        if (mProgram) _glDeleteProgram(mProgram);
+    }
+    mReferences.clear();
+    mTexture = mFramebuffer = mBuffer = mProgram = 0;
+    mTextureWidth = mTextureHeight = 0;
+    mBufferSize = 0;
+}
+
+void SnapshotComparer::flush()
+{
+    if (mContext)
+    {
+        release();
+    }
+    mContext = nullptr;
+}
+
+void SnapshotComparer::store(Json::Value& result) const
+{
+    if (!enabled())
+    {
+        return;
+    }
+    Json::Value v;
+    Json::Value snapshots = Json::arrayValue;
+    unsigned mismatched = 0;
+    for (const Result& r : mResults)
+    {
+        Json::Value e;
+        e["name"] = r.name;
+        e["frame"] = r.frameNo;
+        e["call"] = r.callNo;
+        e["psnr"] = r.psnr;
+        e["max_diff"] = r.maxDiff;
+        e["mismatches"] = r.mismatches;
+        snapshots.append(e);
+        if (r.mismatches > 0) mismatched++;
+    }
+    v["snapshots"] = snapshots;
+    v["compared"] = (unsigned)mResults.size();
+    v["mismatched"] = mismatched;
+    v["missing_references"] = (unsigned)mMissing.size();
+    v["tolerance"] = mTolerance;
+    result["snapshot_compare"] = v;
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef _RETRACER_SNAPSHOT_COMPARE_HPP_
+#define _RETRACER_SNAPSHOT_COMPARE_HPP_
+
+#include "dispatch/eglimports.hpp"
+#include "jsoncpp/include/json/value.h"
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace retracer {
+
+class Context;
+
+/// Checks snapshots against the PNG snapshots of an earlier run, for -snapshotcompare, without
+/// reading back or writing out the framebuffer. The reference with the same file name is loaded
+/// the first time it is needed and kept as a texture. The color attachment is copied into a
+/// texture of its own and compared with the reference by a compute shader, so that only the
+/// sum of squared differences of each work group, the largest difference and the number of
+/// pixels differing by more than the tolerance are read back. Snapshots that do not match are
+/// written out as usual, and so are those that cannot be compared: no reference, another size,
+/// no GLES 3.1, or a format other than 8 bit RGB or RGBA.
+///
+/// The GL objects belong to the context that compared the snapshots, so flush() must be called
+/// before that context stops being current.
+class SnapshotComparer
+{
+public:
+    enum Outcome { NOT_COMPARED, MATCH, MISMATCH };
+
+    /// Compare against the references in directory, allowing a difference of tolerance in each
+    /// channel. An empty directory turns comparison off.
+    void setReferences(const std::string& directory, unsigned tolerance);
+    bool enabled() const { return !mDirectory.empty(); }
+
+    /// Compare the given color attachment of the read framebuffer against the reference for
+    /// filename, the name the snapshot would be written to
+    Outcome compare(GLenum attachment, const std::string& filename, unsigned frameNo, unsigned callNo);
+
+    /// Free the GL objects, while their context is still current
+    void flush();
+
+    /// Add the results to the result file
+    void store(Json::Value& result) const;
+
+private:
+    struct Reference
+    {
+        GLuint texture = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+    struct Result
+    {
+        std::string name;
+        unsigned frameNo;
+        unsigned callNo;
+        double psnr; ///< in dB, capped at MAX_PSNR for identical images
+        unsigned maxDiff;
+        unsigned mismatches; ///< pixels differing by more than the tolerance
+    };
+
+    static const double MAX_PSNR;
+
+    bool build();
+    const Reference* reference(const std::string& name);
+    void release();
+    void record(const Result& result);
+
+    std::string mDirectory;
+    unsigned mTolerance = 0;
+    Context* mContext = nullptr; ///< owner of the GL objects
+    GLuint mProgram = 0;
+    GLuint mFramebuffer = 0;
+    GLuint mTexture = 0; ///< copy of the color attachment
+    int mTextureWidth = 0;
+    int mTextureHeight = 0;
+    GLuint mBuffer = 0; ///< results of the compute shader
+    GLsizeiptr mBufferSize = 0;
+    bool mUnsupported = false; ///< the compute shader could not be built
+    std::unordered_map<std::string, Reference> mReferences;
+    std::set<std::string> mMissing; ///< references that could not be loaded
+    std::vector<Result> mResults;
+};
+
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include "retracer/snapshot_hash.hpp"
+
+#include "common/image.hpp"
+#include "common/os.hpp"
+
+#include <inttypes.h>
+
+namespace retracer {
+
+static std::string hashName(const std::string& filename)
+{
+    const size_t slash = filename.find_last_of("/\\");
+    std::string name = (slash == std::string::npos) ? filename : filename.substr(slash + 1);
+    const size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos)
+    {
+        name.resize(dot);
+    }
+    return name;
+}
+
+bool SnapshotHashes::loadReference(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f)
+    {
+        DBG_LOG("Failed to open snapshot hash reference %s\n", path.c_str());
+        return false;
+    }
+    char line[1024];
+    char name[512];
+    uint64_t hash = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (line[0] == '#')
+        {
+            continue;
+        }
+        if (sscanf(line, "%511s %" SCNx64, name, &hash) == 2)
+        {
+            mReference[name] = hash;
+        }
+    }
+    fclose(f);
+    DBG_LOG("Loaded %u snapshot hashes from %s\n", (unsigned)mReference.size(), path.c_str());
+    return true;
+}
+
+bool SnapshotHashes::open(const std::string& path, const std::string& reference, unsigned distance)
+{
+    close();
+    mReference.clear();
+    mCompare = !reference.empty();
+    mDistance = distance;
+    mHashed = mDeviated = mMissing = 0;
+    mPath.clear();
+    if (path.empty())
+    {
+        return true; // off
+    }
+    if (mCompare && !loadReference(reference))
+    {
+        return false;
+    }
+    mFile = fopen(path.c_str(), "w");
+    if (!mFile)
+    {
+        DBG_LOG("Failed to open snapshot hash file %s\n", path.c_str());
+        return false;
+    }
+    mPath = path;
+    fprintf(mFile, "# name phash crc32 frame call\n");
+    return true;
+}
+
+void SnapshotHashes::close()
+{
+    std::lock_guard<std::mutex> lk(mMutex);
+    if (mFile)
+    {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+}
+
+bool SnapshotHashes::record(const image::Image& image, const std::string& filename, unsigned frameNo, unsigned callNo)
+{
+    const uint64_t hash = image.perceptualHash();
+    const uint32_t crc = image.checksum();
+    const std::string name = hashName(filename);
+
+    std::lock_guard<std::mutex> lk(mMutex);
+    if (!mFile)
+    {
+        return true;
+    }
+    fprintf(mFile, "%s %016" PRIx64 " %08" PRIx32 " %u %u\n", name.c_str(), hash, crc, frameNo, callNo);
+    fflush(mFile); // so that a run that does not finish still leaves its hashes
+    mHashed++;
+    if (!mCompare)
+    {
+        return false;
+    }
+    const auto it = mReference.find(name);
+    if (it == mReference.end())
+    {
+        DBG_LOG("Snapshot (frame %u, call %u) %s has no reference hash\n", frameNo, callNo, name.c_str());
+        mMissing++;
+        return true;
+    }
+    const unsigned distance = image::hashDistance(hash, it->second);
+    if (distance > mDistance)
+    {
+        DBG_LOG("Snapshot (frame %u, call %u) %s is %u bits from its reference hash\n", frameNo, callNo, name.c_str(), distance);
+        mDeviated++;
+        return true;
+    }
+    return false;
+}
+
+void SnapshotHashes::store(Json::Value& result) const
+{
+    std::lock_guard<std::mutex> lk(mMutex);
+    if (mPath.empty())
+    {
+        return;
+    }
+    Json::Value v;
+    v["file"] = mPath;
+    v["hashed"] = mHashed;
+    if (mCompare)
+    {
+        v["deviated"] = mDeviated;
+        v["missing_references"] = mMissing;
+        v["distance"] = mDistance;
+    }
+    result["snapshot_hash"] = v;
+}
+
+}
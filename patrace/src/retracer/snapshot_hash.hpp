@@ -0,0 +1,62 @@
+#ifndef _RETRACER_SNAPSHOT_HASH_HPP_
+#define _RETRACER_SNAPSHOT_HASH_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+
+namespace image {
+    class Image;
+}
+
+namespace retracer {
+
+/// A perceptual hash and a CRC-32 of every snapshot instead of the snapshot itself, for
+/// -snapshothash. Each is written to the hash file as soon as it is taken, as a line of
+///
+///     name phash crc32 frame call
+///
+/// where name is the snapshot file name without its extension, and the hashes are in hex.
+/// Given the hash file of an earlier run as reference, the snapshots whose perceptual hash
+/// is more than the allowed number of bits from that of the same name, or that have no
+/// reference, are written out as well. Snapshots are hashed on the snapshot writer threads
+/// too, so everything but open() and close() may be called from any thread.
+class SnapshotHashes
+{
+public:
+    ~SnapshotHashes() { close(); }
+
+    /// Start a hash file at path, with reference, if not empty, to compare with. An empty path
+    /// turns hashing off.
+    bool open(const std::string& path, const std::string& reference, unsigned distance);
+    void close();
+    bool enabled() const { return mFile != nullptr; }
+
+    /// Add the hashes of image, which was to be written to filename. Returns whether it still
+    /// needs to be written.
+    bool record(const image::Image& image, const std::string& filename, unsigned frameNo, unsigned callNo);
+
+    /// Add the counts to the result file
+    void store(Json::Value& result) const;
+
+private:
+    bool loadReference(const std::string& path);
+
+    mutable std::mutex mMutex;
+    FILE* mFile = nullptr;
+    std::string mPath;
+    std::unordered_map<std::string, uint64_t> mReference; ///< perceptual hash by name
+    bool mCompare = false;
+    unsigned mDistance = 0;
+    unsigned mHashed = 0;
+    unsigned mDeviated = 0; ///< snapshots written as they differ from the reference
+    unsigned mMissing = 0; ///< snapshots written as they have no reference
+};
+
+}
+
+#endif
@@ -0,0 +1,449 @@
+#include "retracer/snapshot_queue.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "retracer/glstate.hpp"
+#include "retracer/glws.hpp"
+#include "retracer/retracer.hpp"
+#include "retracer/snapshot_hash.hpp"
+#include "retracer/timeline.hpp"
+
+#include "common/gl_extension_supported.hpp"
+#include "common/image.hpp"
+#include "common/os.hpp"
+#include "common/thread_pool.hpp"
+
+#ifdef ANDROID
+#include "graphic_buffer/GraphicBuffer.hpp"
+#endif
+
+#include <algorithm>
+#include <string.h>
+
+namespace retracer {
+
+#ifdef ANDROID
+// from android/hardware_buffer.h, which older NDKs do not have
+static const uint32_t AHB_FORMAT_R8G8B8A8_UNORM = 1;
+static const uint64_t AHB_USAGE_CPU_READ_OFTEN = 3;
+static const uint64_t AHB_USAGE_GPU_SAMPLED_IMAGE = 1 << 8;
+static const uint64_t AHB_USAGE_GPU_COLOR_OUTPUT = 1 << 9;
+#endif
+
+SnapshotQueue::~SnapshotQueue()
+{
+    {
+        std::lock_guard<std::mutex> lk(mMutex);
+        mStop = true;
+    }
+    mQueueChanged.notify_all();
+    for (std::thread& t : mWorkers)
+    {
+        t.join();
+    }
+    for (const Job& job : mJobs)
+    {
+        delete job.image;
+    }
+    for (const Readback& readback : mRing)
+    {
+        delete readback.image; // buffers and fences went with their context
+    }
+#ifdef ANDROID
+    for (const HardwareReadback& readback : mHardwareRing)
+    {
+        delete readback.buffer;
+    }
+#endif
+}
+
+bool SnapshotQueue::read(GLenum attachment, const std::string& filename, unsigned frameNo, unsigned callNo)
+{
+    Context* context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    if (!context)
+    {
+        return false;
+    }
+    if (context != mContext)
+    {
+        if (mContext)
+        {
+            DBG_LOG("Snapshot buffers of another context are still in use, dropping them\n");
+            for (Readback& readback : mRing)
+            {
+                delete readback.image;
+                readback = Readback();
+            }
+            mPending = 0;
+            for (HardwareReadback& readback : mHardwareRing)
+            {
+                releaseHardware(readback, false);
+            }
+        }
+        mContext = context;
+    }
+    if (mUseHardwareBuffers && readHardware(attachment, filename, frameNo, callNo))
+    {
+        return true;
+    }
+
+    Readback& readback = mRing[mNext];
+    if (mPending == RING_SIZE)
+    {
+        complete(readback, true); // the ring is full, this is where replay has to wait
+    }
+    if (readback.pbo == 0)
+    {
+        _glGenBuffers(1, &readback.pbo);
+    }
+    readback.image = glstate::readDrawBufferAsync(attachment, readback.pbo);
+    if (!readback.image)
+    {
+        return false;
+    }
+    readback.fence = _glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.filename = filename;
+    readback.frameNo = frameNo;
+    readback.callNo = callNo;
+    mNext = (mNext + 1) % RING_SIZE;
+    mPending++;
+    return true;
+}
+
+bool SnapshotQueue::complete(Readback& readback, bool wait)
+{
+    GLenum result = _glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (result == GL_TIMEOUT_EXPIRED && !wait)
+    {
+        return false;
+    }
+    while (result == GL_TIMEOUT_EXPIRED)
+    {
+        result = _glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100 * 1000 * 1000);
+    }
+    _glDeleteSync(readback.fence);
+    readback.fence = 0;
+    mPending--;
+
+    image::Image* image = readback.image;
+    readback.image = nullptr;
+    GLint oldPackBuffer = 0;
+    _glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &oldPackBuffer);
+    _glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+    const void* pixels = (result != GL_WAIT_FAILED) ? _glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, image->size(), GL_MAP_READ_BIT) : nullptr;
+    if (pixels)
+    {
+        memcpy(image->pixels, pixels, image->size());
+        _glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    _glBindBuffer(GL_PIXEL_PACK_BUFFER, oldPackBuffer);
+    if (!pixels)
+    {
+        DBG_LOG("Failed to take snapshot for call no: %u\n", readback.callNo);
+        delete image;
+        return true;
+    }
+
+    Job job = { image, readback.filename, readback.frameNo, readback.callNo, nullptr, -1 };
+    enqueue(job);
+    return true;
+}
+
+void SnapshotQueue::flush()
+{
+    while (mPending > 0)
+    {
+        complete(oldest(), true);
+    }
+    for (Readback& readback : mRing)
+    {
+        if (readback.pbo) _glDeleteBuffers(1, &readback.pbo);
+        readback.pbo = 0;
+    }
+    for (HardwareReadback& readback : mHardwareRing)
+    {
+        releaseHardware(readback, true);
+    }
+    mContext = nullptr;
+}
+
+bool SnapshotQueue::readHardware(GLenum attachment, const std::string& filename, unsigned frameNo, unsigned callNo)
+{
+#ifdef ANDROID
+    static PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC getNativeClientBuffer =
+        (PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC)eglGetProcAddress("eglGetNativeClientBufferANDROID");
+    static PFNEGLCREATESYNCKHRPROC createSync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+    static PFNEGLDESTROYSYNCKHRPROC destroySync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+    static PFNEGLDUPNATIVEFENCEFDANDROIDPROC dupNativeFence =
+        (PFNEGLDUPNATIVEFENCEFDANDROIDPROC)eglGetProcAddress("eglDupNativeFenceFDANDROID");
+    const EGLDisplay display = gRetracer.mState.mEglDisplay;
+    static const bool supported = useHardwareBuffer && getNativeClientBuffer && createSync && destroySync && dupNativeFence
+        && isEglExtensionSupported(display, "EGL_ANDROID_native_fence_sync");
+    if (!supported || mContext->_profile < PROFILE_ES3)
+    {
+        return false;
+    }
+
+    int width = 0;
+    int height = 0;
+    int channels = 4;
+    if (!glstate::getColorAttachmentSize(attachment, width, height, channels))
+    {
+        return false;
+    }
+
+    HardwareReadback& readback = mHardwareRing[mNextHardware];
+    {
+        // the replay only waits here, when every buffer of the ring is still being read
+        std::unique_lock<std::mutex> lk(mMutex);
+        mQueueChanged.wait(lk, [&]{ return !readback.busy; });
+    }
+    if (readback.buffer && (readback.width != width || readback.height != height))
+    {
+        releaseHardware(readback, true);
+    }
+
+    GLint drawFramebuffer = 0;
+    _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+    if (!readback.buffer)
+    {
+        readback.buffer = new HardwareBuffer(width, height, AHB_FORMAT_R8G8B8A8_UNORM,
+            AHB_USAGE_CPU_READ_OFTEN | AHB_USAGE_GPU_SAMPLED_IMAGE | AHB_USAGE_GPU_COLOR_OUTPUT);
+        const EGLClientBuffer clientBuffer = readback.buffer->getImpl() ? readback.buffer->eglGetNativeClientBufferANDROID((void *)getNativeClientBuffer) : NULL;
+        const EGLint attribs[] = { EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE };
+        readback.eglImage = clientBuffer ? GLWS::instance().createImageKHR(NULL, EGL_NATIVE_BUFFER_ANDROID, reinterpret_cast<uintptr_t>(clientBuffer), attribs) : EGL_NO_IMAGE_KHR;
+        if (readback.eglImage == EGL_NO_IMAGE_KHR)
+        {
+            DBG_LOG("Cannot make a hardware buffer to read snapshots into, reading them the usual way\n");
+            releaseHardware(readback, true);
+            mUseHardwareBuffers = false;
+            return false;
+        }
+        GLint oldTexture = 0;
+        _glGetIntegerv(GL_TEXTURE_BINDING_2D, &oldTexture);
+        _glGenTextures(1, &readback.texture);
+        _glBindTexture(GL_TEXTURE_2D, readback.texture);
+        _glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, readback.eglImage);
+        _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        _glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        _glBindTexture(GL_TEXTURE_2D, oldTexture);
+        _glGenFramebuffers(1, &readback.framebuffer);
+        _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, readback.framebuffer);
+        _glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, readback.texture, 0);
+        const GLenum status = _glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+        _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            DBG_LOG("Cannot render to a hardware buffer (0x%x), reading snapshots the usual way\n", status);
+            releaseHardware(readback, true);
+            mUseHardwareBuffers = false;
+            return false;
+        }
+        readback.width = width;
+        readback.height = height;
+    }
+
+    // the same as readDrawBufferAsync(), but blitted, which is not affected by pack state
+    GLint oldReadBuffer = GL_BACK;
+    _glGetIntegerv(GL_READ_BUFFER, &oldReadBuffer);
+    if (drawFramebuffer != 0)
+    {
+        _glReadBuffer(attachment);
+    }
+    const bool scissor = mContext->_shadow.isEnabled(GL_SCISSOR_TEST);
+    _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, readback.framebuffer);
+    if (scissor) _glDisable(GL_SCISSOR_TEST);
+    _glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    if (scissor) _glEnable(GL_SCISSOR_TEST);
+    _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+    _glReadBuffer(oldReadBuffer);
+
+    // the fence only gets a file descriptor once it has been flushed
+    const EGLint syncAttribs[] = { EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID, EGL_NONE };
+    const EGLSyncKHR sync = createSync(display, EGL_SYNC_NATIVE_FENCE_ANDROID, syncAttribs);
+    _glFlush();
+    int fence = -1;
+    if (sync != EGL_NO_SYNC_KHR)
+    {
+        fence = dupNativeFence(display, sync);
+        destroySync(display, sync);
+    }
+    if (fence < 0)
+    {
+        _glFinish(); // nothing for the worker to wait on
+        fence = -1;
+    }
+
+    readback.busy = true; // no worker has it, so no need to lock
+    Job job = { new image::Image(width, height, channels, true), filename, frameNo, callNo, &readback, fence };
+    enqueue(job);
+    mNextHardware = (mNextHardware + 1) % RING_SIZE;
+    return true;
+#else
+    (void)attachment; (void)filename; (void)frameNo; (void)callNo;
+    return false;
+#endif
+}
+
+bool SnapshotQueue::copyHardware(const Job& job)
+{
+#ifdef ANDROID
+    HardwareBuffer* buffer = job.source->buffer;
+    AHardwareBuffer_Desc desc;
+    buffer->describe(&desc);
+    void* pixels = nullptr;
+    // takes over the fence
+    if (buffer->lock(AHB_USAGE_CPU_READ_OFTEN, job.fence, NULL, &pixels) != 0 || !pixels)
+    {
+        return false;
+    }
+    // rows are in the order glReadPixels returns them, so the image is flipped like its images
+    image::Image* image = job.image;
+    const size_t rowSize = image->width * image->channels;
+    for (unsigned y = 0; y < image->height; y++)
+    {
+        const unsigned char* src = static_cast<const unsigned char*>(pixels) + (size_t)y * desc.stride * 4;
+        unsigned char* dst = image->pixels + y * rowSize;
+        if (image->channels == 4)
+        {
+            memcpy(dst, src, rowSize);
+            continue;
+        }
+        for (unsigned x = 0; x < image->width; x++, src += 4, dst += 3)
+        {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+        }
+    }
+    buffer->unlock(NULL);
+    return true;
+#else
+    (void)job;
+    return false;
+#endif
+}
+
+void SnapshotQueue::releaseHardware(HardwareReadback& readback, bool current)
+{
+#ifdef ANDROID
+    {
+        std::unique_lock<std::mutex> lk(mMutex);
+        mQueueChanged.wait(lk, [&]{ return !readback.busy; });
+    }
+    if (current)
+    {
+        if (readback.framebuffer) _glDeleteFramebuffers(1, &readback.framebuffer);
+        if (readback.texture) _glDeleteTextures(1, &readback.texture);
+    }
+    if (readback.eglImage != EGL_NO_IMAGE_KHR)
+    {
+        GLWS::instance().destroyImageKHR(readback.eglImage);
+    }
+    delete readback.buffer;
+#else
+    (void)current;
+#endif
+    readback = HardwareReadback();
+}
+
+void SnapshotQueue::finish()
+{
+    std::unique_lock<std::mutex> lk(mMutex);
+    mQueueChanged.wait(lk, [&]{ return mJobs.empty() && mBusy == 0; });
+}
+
+void SnapshotQueue::enqueue(const Job& job)
+{
+    std::unique_lock<std::mutex> lk(mMutex);
+    if (mWorkers.empty())
+    {
+        const unsigned cores = common::concurrencyBudget();
+        const unsigned count = std::max(1u, std::min(4u, cores > 1 ? cores - 1 : 1));
+        for (unsigned i = 0; i < count; i++)
+        {
+            mWorkers.emplace_back(&SnapshotQueue::run, this);
+        }
+    }
+    mQueueChanged.wait(lk, [&]{ return mJobs.size() < MAX_QUEUED; });
+    mJobs.push_back(job);
+    lk.unlock();
+    mQueueChanged.notify_all();
+}
+
+void SnapshotQueue::run()
+{
+    gTimeline.nameThread("snapshot writer");
+    std::unique_lock<std::mutex> lk(mMutex);
+    while (true)
+    {
+        mQueueChanged.wait(lk, [&]{ return mStop || !mJobs.empty(); });
+        if (mJobs.empty())
+        {
+            return; // stopped
+        }
+        const Job job = mJobs.front();
+        mJobs.pop_front();
+        mBusy++;
+        lk.unlock();
+        mQueueChanged.notify_all();
+
+        if (job.source)
+        {
+            bool copied;
+            {
+                TimelineScope scope("snapshot", "read hardware buffer", job.callNo);
+                copied = copyHardware(job);
+            }
+            lk.lock();
+            job.source->busy = false;
+            if (!copied)
+            {
+                DBG_LOG("Failed to take snapshot for call no: %u\n", job.callNo);
+                delete job.image;
+                mBusy--;
+                mQueueChanged.notify_all();
+                continue;
+            }
+            lk.unlock();
+            mQueueChanged.notify_all();
+        }
+
+        if (mHashes)
+        {
+            TimelineScope scope("snapshot", "hash image", job.callNo);
+            if (!mHashes->record(*job.image, job.filename, job.frameNo, job.callNo))
+            {
+                delete job.image; // only its hashes are kept
+                lk.lock();
+                mBusy--;
+                mQueueChanged.notify_all();
+                continue;
+            }
+        }
+        bool written;
+        {
+            TimelineScope scope("snapshot", "write image", job.callNo);
+            written = job.image->write(job.filename.c_str());
+        }
+        delete job.image;
+        if (written)
+        {
+            DBG_LOG("Snapshot (frame %u, call %u) : %s\n", job.frameNo, job.callNo, job.filename.c_str());
+        }
+        else
+        {
+            DBG_LOG("Failed to write snapshot : %s\n", job.filename.c_str());
+        }
+
+        lk.lock();
+        if (written && mUploads)
+        {
+            mUploads->push_back(job.filename);
+        }
+        mBusy--;
+        mQueueChanged.notify_all();
+    }
+}
+
+}
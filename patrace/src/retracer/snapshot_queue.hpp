@@ -0,0 +1,130 @@
+#ifndef _RETRACER_SNAPSHOT_QUEUE_HPP_
+#define _RETRACER_SNAPSHOT_QUEUE_HPP_
+
+#include "dispatch/eglimports.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace image {
+    class Image;
+}
+class HardwareBuffer;
+
+namespace retracer {
+
+class Context;
+class SnapshotHashes;
+
+/// Takes snapshots without stalling the replay. The framebuffer is read into one of a ring of
+/// pixel pack buffers, with a fence behind it. The buffer is mapped once the fence has passed or
+/// the ring wraps around, and the image written out on a pool of worker threads. Replay only
+/// waits when all buffers of the ring, or all queued images, are still in use.
+///
+/// With setHardwareBuffers() on Android, the framebuffer is instead blitted into a texture backed
+/// by an AHardwareBuffer, with a native fence behind it. A worker waits on the fence and locks
+/// the buffer to copy the pixels out, so neither glReadPixels nor a mapping is on the replay
+/// thread. Attachments that cannot be blitted as they are still go through the ring.
+///
+/// Everything but the writing must be done on the thread and context that took the
+/// snapshots, so flush() must be called before that context stops being current.
+class SnapshotQueue
+{
+public:
+    static const unsigned RING_SIZE = 3;
+    static const unsigned MAX_QUEUED = 8; ///< images waiting to be written
+
+    SnapshotQueue() : mRing(RING_SIZE), mHardwareRing(RING_SIZE) {}
+    ~SnapshotQueue();
+
+    /// Start reading the given color attachment of the read framebuffer, to be written to
+    /// filename. Returns false if it has to be read the usual way.
+    bool read(GLenum attachment, const std::string& filename, unsigned frameNo, unsigned callNo);
+
+    /// Pass on the snapshots that the GPU is done with, without waiting
+    void poll() { while (mPending > 0 && complete(oldest(), false)) {} }
+
+    /// Pass on all snapshots and free the buffers, while their context is still current
+    void flush();
+
+    /// Wait until all snapshots passed on have been written
+    void finish();
+
+    void setUploadList(std::vector<std::string>* uploads) { mUploads = uploads; }
+    /// Hash the images before writing them, and only write those that it says still need to be
+    void setHashes(SnapshotHashes* hashes) { mHashes = hashes; }
+    /// Read through hardware buffers where that is possible, see -snapshotahb
+    void setHardwareBuffers(bool enabled) { mUseHardwareBuffers = enabled; }
+
+private:
+    struct Readback
+    {
+        GLuint pbo = 0;
+        GLsync fence = 0;
+        image::Image* image = nullptr;
+        std::string filename;
+        unsigned frameNo = 0;
+        unsigned callNo = 0;
+    };
+
+    struct HardwareReadback
+    {
+        HardwareBuffer* buffer = nullptr;
+        EGLImageKHR eglImage = EGL_NO_IMAGE_KHR;
+        GLuint texture = 0;
+        GLuint framebuffer = 0; ///< with texture attached, to blit into
+        int width = 0;
+        int height = 0;
+        bool busy = false; ///< a worker has yet to copy the pixels out, guarded by mMutex
+    };
+
+    struct Job
+    {
+        image::Image* image;
+        std::string filename;
+        unsigned frameNo;
+        unsigned callNo;
+        HardwareReadback* source; ///< to copy the image from first, or nullptr
+        int fence; ///< native fence to wait on before reading source, or -1
+    };
+
+    Readback& oldest() { return mRing[(mNext + RING_SIZE - mPending) % RING_SIZE]; }
+    /// Map the oldest readback and queue it for writing. Returns false if wait is false and
+    /// the GPU is not done with it yet.
+    bool complete(Readback& readback, bool wait);
+    /// Blit the attachment into the next hardware buffer and queue it. Returns false if it
+    /// cannot be read like this.
+    bool readHardware(GLenum attachment, const std::string& filename, unsigned frameNo, unsigned callNo);
+    /// On a worker, fill the image of the job from its hardware buffer
+    bool copyHardware(const Job& job);
+    /// Wait for the worker to be done with the buffer, and free it along with its EGLImage,
+    /// and, if the context is still current, its texture and framebuffer
+    void releaseHardware(HardwareReadback& readback, bool current);
+    void enqueue(const Job& job);
+    void run();
+
+    std::vector<Readback> mRing;
+    unsigned mNext = 0; ///< slot of the next readback
+    unsigned mPending = 0; ///< readbacks in the ring, ending before mNext
+    Context* mContext = nullptr; ///< owner of the buffers
+    std::vector<HardwareReadback> mHardwareRing;
+    unsigned mNextHardware = 0;
+    bool mUseHardwareBuffers = false;
+
+    std::mutex mMutex;
+    std::condition_variable mQueueChanged;
+    std::deque<Job> mJobs;
+    unsigned mBusy = 0; ///< jobs being written
+    bool mStop = false;
+    std::vector<std::thread> mWorkers;
+    std::vector<std::string>* mUploads = nullptr; ///< written files are added here, see snapshotUpload
+    SnapshotHashes* mHashes = nullptr;
+};
+
+}
+
+#endif
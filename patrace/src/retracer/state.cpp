@@ -27,6 +27,117 @@ void deleteUnique(std::unordered_map<K, V>& map)
     toBeDeleted.clear();
 }
 
+void Context::reserveNames(const Json::Value& ranges)
+{
+    const struct { const char* name; hmap<unsigned int>* map; hmap<unsigned int>* revMap; bool shared; } maps[] = {
+        { "texture", &_texture_map, &_texture_rev_map, true },
+        { "buffer", &_buffer_map, &_buffer_rev_map, true },
+        { "program", &_program_map, &_program_rev_map, true },
+        { "shader", &_shader_map, &_shader_rev_map, true },
+        { "renderbuffer", &_renderbuffer_map, &_renderbuffer_rev_map, true },
+        { "sampler", &_sampler_map, &_sampler_rev_map, true },
+        { "framebuffer", &_framebuffer_map, &_framebuffer_rev_map, true }, // shared through getFramebufferMap()
+        { "query", &_query_map, &_query_rev_map, false },
+        { "array", &_array_map, &_array_rev_map, false },
+        { "feedback", &_feedback_map, &_feedback_rev_map, false },
+        { "pipeline", &_pipeline_map, &_pipeline_rev_map, false },
+    };
+    for (const auto& m : maps)
+    {
+        if ((m.shared && _shareContext) || !ranges.isMember(m.name))
+        {
+            continue;
+        }
+        const unsigned count = ranges[m.name].get("count", 0).asUInt();
+        m.map->Reserve(ranges[m.name].get("max", 0).asUInt(), count);
+        // The driver names are not known, but drivers tend to hand them out in order
+        m.revMap->Reserve(count, count);
+    }
+    if (!_shareContext && ranges.isMember("program"))
+    {
+        _uniformLocation_map.reserve(ranges["program"].get("count", 0).asUInt());
+    }
+}
+
+void SurfaceAtlas::Reset()
+{
+    mDrawable = NULL;
+    mWidth = 0;
+    mHeight = 0;
+    mTiles.clear();
+    mOrder.clear();
+    mFree.clear();
+    mRowX = 0;
+    mRowY = 0;
+    mRowHeight = 0;
+}
+
+bool SurfaceAtlas::Place(int surface, int width, int height, int winWidth, int winHeight)
+{
+    AtlasTile tile;
+    tile.winWidth = winWidth;
+    tile.winHeight = winHeight;
+    tile.ratioW = width / (float) winWidth;
+    tile.ratioH = height / (float) winHeight;
+
+    // the smallest free tile it fits in, or a new one at the end of the row, or of a new row
+    std::vector<Rectangle>::iterator best = mFree.end();
+    for (std::vector<Rectangle>::iterator it = mFree.begin(); it != mFree.end(); ++it)
+    {
+        if (it->w >= width && it->h >= height && (best == mFree.end() || it->w * it->h < best->w * best->h))
+        {
+            best = it;
+        }
+    }
+    if (best != mFree.end())
+    {
+        tile.rect = *best;
+        mFree.erase(best);
+    }
+    else
+    {
+        if (mRowX + width > mWidth)
+        {
+            mRowX = 0;
+            mRowY += mRowHeight;
+            mRowHeight = 0;
+        }
+        if (width > mWidth || mRowY + height > mHeight)
+        {
+            return false;
+        }
+        tile.rect.x = mRowX;
+        tile.rect.y = mRowY;
+        mRowX += width;
+        mRowHeight = std::max(mRowHeight, height);
+    }
+    tile.rect.w = width;
+    tile.rect.h = height;
+
+    Remove(surface); // in case the trace reuses the handle without destroying it
+    mTiles[surface] = tile;
+    mOrder.push_back(surface);
+    return true;
+}
+
+void SurfaceAtlas::Remove(int surface)
+{
+    const auto it = mTiles.find(surface);
+    if (it == mTiles.end())
+    {
+        return;
+    }
+    mFree.push_back(it->second.rect);
+    mTiles.erase(it);
+    mOrder.erase(std::find(mOrder.begin(), mOrder.end(), surface));
+}
+
+const AtlasTile* SurfaceAtlas::Find(int surface) const
+{
+    const auto it = mTiles.find(surface);
+    return (it != mTiles.end()) ? &it->second : NULL;
+}
+
 StateMgr::StateMgr()
  : mThreadArr(PATRACE_THREAD_LIMIT)
  , mSingleSurface(0)
@@ -42,6 +153,7 @@ void StateMgr::Reset()
     mForceSingleWindow = false;
     mSingleSurface = 0;
     mEGLImageKHRMap.clear();
+    mSurfaceAtlas.Reset(); // its drawable is in mDrawableMap
 
     // Drawable and Context can occur multiple times in the mDrawableMap and mContextMap.
     // To prevent double deletion, which would have occured if we deleted all the values
@@ -1,6 +1,7 @@
 #ifndef _RETRACER_STATE_HPP_
 #define _RETRACER_STATE_HPP_
 
+#include <algorithm>
 #include <unordered_map>
 #include <vector>
 #include <string>
@@ -9,11 +10,13 @@
 #include <common/gl_utility.hpp>
 #include <retracer/value_map.hpp>
 #include <retracer/retrace_options.hpp> // enum Profile
+#include <retracer/state_shadow.hpp>
 #include "dispatch/eglimports.hpp"
 #include "graphic_buffer/GraphicBuffer.hpp"
 #include <map>
 #include <stdint.h>
 #include "dma_buffer/dma_buffer.hpp"
+#include "jsoncpp/include/json/value.h"
 
 class OffscreenManager;
 
@@ -45,6 +48,24 @@ struct Rectangle
         return tmp;
     }
 
+    inline Rectangle Offset(int dX, int dY) const {
+        Rectangle tmp = *this;
+        tmp.x += dX;
+        tmp.y += dY;
+        return tmp;
+    }
+
+    inline Rectangle Intersect(const Rectangle& b) const {
+        Rectangle tmp;
+
+        tmp.x = std::max(x, b.x);
+        tmp.y = std::max(y, b.y);
+        tmp.w = std::max(0, std::min(x + w, b.x + b.w) - tmp.x);
+        tmp.h = std::max(0, std::min(y + h, b.y + b.h) - tmp.y);
+
+        return tmp;
+    }
+
     inline bool operator==(const Rectangle& b) const {
         return
             x == b.x &&
@@ -140,8 +161,14 @@ public:
         , _current_program(0)
         , _current_framebuffer(0)
         , _firstTimeMakeCurrent(true)
+        , _parallelShaderCompile(false)
+        , _debugOutput(false)
+        , _shadow(prof >= PROFILE_ES3)
         , _offscrMgr(0)
         , _shareContext(shareContext)
+        , _shareGroup(shareContext ? shareContext->_shareGroup : this)
+        , _uniformLocationsProgram(0)
+        , _uniformLocations(NULL)
     {
         _texture_map.LValue(0) = 0;
         _buffer_map.LValue(0) = 0;
@@ -183,7 +210,15 @@ public:
             delete this;
     }
 
+    /// Size the name maps for the names the tracer saw generated, stored as "nameRanges" in the
+    /// trace header, so that they do not grow during the measured frames. Maps shared with the
+    /// share context are left to it.
+    void reserveNames(const Json::Value& ranges);
+
     std::unordered_map<unsigned int, locationmap >& getUniformlocationMap();
+    /// Uniform locations of a program, with the last program looked up kept so that the
+    /// locations of the current program are found without hashing
+    locationmap& getUniformLocations(unsigned int program);
     hmap<unsigned int>& getTextureMap();
     hmap<unsigned int>& getTextureRevMap();
 
@@ -235,6 +270,9 @@ public:
     unsigned int      _current_program;
     unsigned int      _current_framebuffer;
     bool              _firstTimeMakeCurrent;
+    bool              _parallelShaderCompile; // KHR_parallel_shader_compile is enabled, see -parallelcompile
+    bool              _debugOutput; // KHR_debug reports the errors of -debug, so glGetError is not needed after every call
+    StateShadow       _shadow; // what features read instead of glGet*
     OffscreenManager* _offscrMgr;
 #ifdef ANDROID
     std::vector<GraphicBuffer *> mGraphicBuffers;
@@ -246,40 +284,56 @@ public:
 
     inline const std::string& getShaderSource(GLuint shader)
     {
-        if (_shareContext) return _shareContext->getShaderSource(shader);
-        else return mShaderSources.at(shader);
+        return _shareGroup->mShaderSources.at(shader);
     }
     inline void setShaderSource(GLuint shader, const std::string& source)
     {
-        if (_shareContext) _shareContext->setShaderSource(shader, source);
-        else mShaderSources[shader] = source;
+        _shareGroup->mShaderSources[shader] = source;
     }
     inline void deleteShader(GLuint shader)
     {
-        if (_shareContext) _shareContext->deleteShader(shader);
-        else mShaderSources.erase(shader);
+        _shareGroup->mShaderSources.erase(shader);
     }
 
     inline const std::vector<GLuint>& getShaderIDs(GLuint program)
     {
-        if (_shareContext) return _shareContext->getShaderIDs(program);
-        else return mProgramShaders.at(program);
+        return _shareGroup->mProgramShaders.at(program);
     }
     inline void addShaderID(GLuint program, GLuint shader)
     {
-        if (_shareContext) _shareContext->addShaderID(program, shader);
-        else mProgramShaders[program].push_back(shader);
+        _shareGroup->mProgramShaders[program].push_back(shader);
     }
     inline void deleteShaderIDs(GLuint program)
     {
-        if (_shareContext) _shareContext->deleteShaderIDs(program);
-        else mProgramShaders.erase(program);
+        _shareGroup->mProgramShaders.erase(program);
+    }
+
+    /// A program whose link status has not been checked yet, see -parallelcompile
+    struct PendingLink
+    {
+        GLuint originalName;
+        int status;
+        unsigned callNo;
+    };
+    inline std::unordered_map<GLuint, PendingLink>& getPendingLinks()
+    {
+        return _shareGroup->mPendingLinks;
+    }
+
+    // The context that owns the objects shared with this one, the same for every context in a share group
+    inline const Context* getShareGroup() const
+    {
+        return _shareGroup;
     }
 
 private:
     Context* _shareContext;
+    Context* _shareGroup; // owns the objects marked shared below, this context unless it has a share context
     std::unordered_map<GLuint, std::string> mShaderSources; // shader id to string; shared
     std::unordered_map<GLuint, std::vector<GLuint>> mProgramShaders; // program id to list of shader ids; shared
+    std::unordered_map<GLuint, PendingLink> mPendingLinks; // program id to link to check; shared
+    unsigned int _uniformLocationsProgram;
+    locationmap* _uniformLocations; // in the uniform location map, whose entries are never removed
     int refcnt;
     hmap<unsigned int> _texture_map; // shared
     hmap<unsigned int> _buffer_map; // shared
@@ -301,232 +355,165 @@ private:
 
 inline std::unordered_map<unsigned int, locationmap >& Context::getUniformlocationMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getUniformlocationMap();
-    }
-    else
+    return _shareGroup->_uniformLocation_map;
+}
+
+inline locationmap& Context::getUniformLocations(unsigned int program)
+{
+    if (program != _uniformLocationsProgram || !_uniformLocations)
     {
-        return _uniformLocation_map;
+        _uniformLocations = &getUniformlocationMap()[program];
+        _uniformLocationsProgram = program;
     }
+    return *_uniformLocations;
 }
 
 inline hmap<unsigned int>& Context::getTextureMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getTextureMap();
-    }
-    else
-    {
-        return _texture_map;
-    }
+    return _shareGroup->_texture_map;
 }
 
 inline hmap<unsigned int>& Context::getTextureRevMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getTextureRevMap();
-    }
-    else
-    {
-        return _texture_rev_map;
-    }
+    return _shareGroup->_texture_rev_map;
 }
 
 inline hmap<unsigned int>& Context::getBufferMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getBufferMap();
-    }
-    else
-    {
-        return _buffer_map;
-    }
+    return _shareGroup->_buffer_map;
 }
 
 inline hmap<unsigned int>& Context::getBufferRevMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getBufferRevMap();
-    }
-    else
-    {
-        return _buffer_rev_map;
-    }
+    return _shareGroup->_buffer_rev_map;
 }
 
 inline hmap<unsigned int>& Context::getProgramMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getProgramMap();
-    }
-    else
-    {
-        return _program_map;
-    }
+    return _shareGroup->_program_map;
 }
 
 inline hmap<unsigned int>& Context::getProgramRevMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getProgramRevMap();
-    }
-    else
-    {
-        return _program_rev_map;
-    }
+    return _shareGroup->_program_rev_map;
 }
 
 inline hmap<unsigned int>& Context::getShaderMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getShaderMap();
-    }
-    else
-    {
-        return _shader_map;
-    }
+    return _shareGroup->_shader_map;
 }
 
 inline hmap<unsigned int>& Context::getShaderRevMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getShaderRevMap();
-    }
-    else
-    {
-        return _shader_rev_map;
-    }
+    return _shareGroup->_shader_rev_map;
 }
 
 inline hmap<unsigned int>& Context::getRenderbufferMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getRenderbufferMap();
-    }
-    else
-    {
-        return _renderbuffer_map;
-    }
+    return _shareGroup->_renderbuffer_map;
 }
 
 inline hmap<unsigned int>& Context::getRenderbufferRevMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getRenderbufferRevMap();
-    }
-    else
-    {
-        return _renderbuffer_rev_map;
-    }
+    return _shareGroup->_renderbuffer_rev_map;
 }
 
 inline hmap<unsigned int>& Context::getFramebufferMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getFramebufferMap();
-    }
-    else
-    {
-        return _framebuffer_map;
-    }
+    return _shareGroup->_framebuffer_map;
 }
 
 inline hmap<unsigned int>& Context::getFramebufferRevMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getFramebufferRevMap();
-    }
-    else
-    {
-        return _framebuffer_rev_map;
-    }
+    return _shareGroup->_framebuffer_rev_map;
 }
 
 inline hmap<unsigned int>& Context::getSamplerMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getSamplerMap();
-    }
-    else
-    {
-        return _sampler_map;
-    }
+    return _shareGroup->_sampler_map;
 }
 
 inline hmap<unsigned int>& Context::getSamplerRevMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getSamplerRevMap();
-    }
-    else
-    {
-        return _sampler_rev_map;
-    }
+    return _shareGroup->_sampler_rev_map;
 }
 
 inline hmap<unsigned int>& Context::getGraphicBufferMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getGraphicBufferMap();
-    }
-    else
-    {
-        return _graphicbuffer_map;
-    }
+    return _shareGroup->_graphicbuffer_map;
 }
 
 inline stdmap<unsigned long long, GLsync>& Context::getSyncMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getSyncMap();
-    }
-    else
-    {
-        return _sync_map;
-    }
+    return _shareGroup->_sync_map;
 }
 
 inline stdmap<unsigned long long, EGLSyncKHR>& Context::getEGLSyncMap()
 {
-    if (_shareContext)
-    {
-        return _shareContext->getEGLSyncMap();
-    }
-    else
-    {
-        return _eglsync_map;
-    }
+    return _shareGroup->_eglsync_map;
 }
 
+/// Where a window surface is drawn with -surfaceatlas: its part of the window that all of them
+/// share, and the size of the window it was traced with, which is scaled to fit it
+struct AtlasTile
+{
+    Rectangle rect = {0, 0, 0, 0};
+    int winWidth = 0;
+    int winHeight = 0;
+    float ratioW = 1.0f;
+    float ratioH = 1.0f;
+};
+
+/// Packs the window surfaces of a trace into one window for -surfaceatlas, each into a tile of
+/// it, so that switching between them does not switch the real surface, and the window is
+/// presented once a frame instead of once for every surface. Tiles are placed in rows from the
+/// bottom left corner, and the ones of destroyed surfaces are reused for surfaces that fit in them.
+class SurfaceAtlas
+{
+public:
+    void Reset();
+
+    /// Place surface of the given size, which it was traced with a window of winWidth by
+    /// winHeight for. Returns false if it does not fit.
+    bool Place(int surface, int width, int height, int winWidth, int winHeight);
+    void Remove(int surface);
+
+    /// The tile of surface, or NULL if it has a window of its own
+    const AtlasTile* Find(int surface) const;
+
+    /// Whether swapping surface presents the atlas, which the oldest surface in it does
+    bool Presents(int surface) const { return !mOrder.empty() && mOrder.front() == surface; }
+
+    Drawable* mDrawable = NULL; ///< the window they share, created with the first of them
+    int mWidth = 0;
+    int mHeight = 0;
+
+private:
+    std::unordered_map<int, AtlasTile> mTiles;
+    std::vector<int> mOrder; ///< of the surfaces in the atlas, oldest first
+    std::vector<Rectangle> mFree; ///< tiles of destroyed surfaces
+    int mRowX = 0;
+    int mRowY = 0;
+    int mRowHeight = 0;
+};
+
 class GLESThread
 {
 public:
     void                *mpJavaEnv;
 
-    // for override resolution
+    // for override resolution and the surface atlas
     Rectangle           mCurAppVP; // viewport
     Rectangle           mCurAppSR; // scissor rect
 
     Rectangle           mCurDrvVP; // override viewport
     Rectangle           mCurDrvSR; // override scissor
 
+    // for the surface atlas, which keeps the scissor test on while drawing to a tile
+    bool                mCurAppScissorTest = false;
+    int                 mCurDrvScissorTest = -1; // -1 when not known
+    AtlasTile           mAtlasTile; // of the current surface, with no size if it is not in the atlas
+
     GLESThread():
         mpJavaEnv(NULL),
         mpCurrentContext(NULL),
@@ -537,6 +524,9 @@ public:
         mpJavaEnv = NULL;
         mpCurrentContext = NULL;
         mpCurrentDrawable = NULL;
+        mCurAppScissorTest = false;
+        mCurDrvScissorTest = -1;
+        mAtlasTile = AtlasTile();
     }
 
     void setContext(Context *ctx)
@@ -609,9 +599,13 @@ public:
     void        InsertDrawableToWinMap(int drawableVal, int winVal);
     int         GetWin(int draableVal);
 
+    size_t      ContextCount() const { return mContextMap.size(); }
+    size_t      DrawableCount() const { return mDrawableMap.size(); }
+
     std::vector<GLESThread> mThreadArr;
     Drawable* mSingleSurface;
     bool mForceSingleWindow;
+    SurfaceAtlas mSurfaceAtlas;
     EGLDisplay mEglDisplay;
 
 private:
@@ -0,0 +1,125 @@
+#include "retracer/state_filter.hpp"
+
+#include <string.h>
+
+namespace retracer {
+
+bool StateFilter::redundant(const char* func, bool same)
+{
+    mCalls++;
+    if (same)
+    {
+        mSkipped[func]++;
+    }
+    return same;
+}
+
+bool StateFilter::activeTexture(GLenum texture)
+{
+    const bool same = (texture == mActiveTexture);
+    mActiveTexture = texture;
+    return redundant("glActiveTexture", same);
+}
+
+bool StateFilter::bindTexture(GLenum target, GLuint texture)
+{
+    if (mActiveTexture == 0)
+    {
+        return redundant("glBindTexture", false); // do not know which unit it is bound to
+    }
+    const uint64_t key = ((uint64_t)mActiveTexture << 32) | target;
+    const auto it = mTextures.find(key);
+    const bool same = (it != mTextures.end() && it->second == texture);
+    mTextures[key] = texture;
+    return redundant("glBindTexture", same);
+}
+
+bool StateFilter::useProgram(GLuint program)
+{
+    const bool same = mProgramKnown && program == mProgram;
+    mProgramKnown = true;
+    mProgram = program;
+    return redundant("glUseProgram", same);
+}
+
+bool StateFilter::enable(GLenum cap, bool enabled)
+{
+    const auto it = mEnabled.find(cap);
+    const bool same = (it != mEnabled.end() && it->second == enabled);
+    mEnabled[cap] = enabled;
+    return redundant(enabled ? "glEnable" : "glDisable", same);
+}
+
+bool StateFilter::uniform(const char* func, GLuint program, GLint location, const void* values, size_t size, GLboolean transpose)
+{
+    if (program == 0 || location < 0 || !values)
+    {
+        return redundant(func, false); // program pipelines are not followed, and -1 is ignored by GL anyway
+    }
+    Uniform& u = mUniforms[program][location];
+    // The name is compared as a pointer, which is safe: a mismatch only keeps the call
+    const bool same = u.func == func && u.transpose == transpose && u.values.size() == size &&
+                      memcmp(u.values.data(), values, size) == 0;
+    if (!same)
+    {
+        u.func = func;
+        u.transpose = transpose;
+        u.values.assign(static_cast<const char*>(values), static_cast<const char*>(values) + size);
+    }
+    return redundant(func, same);
+}
+
+void StateFilter::enablei(GLenum cap)
+{
+    mEnabled.erase(cap);
+}
+
+void StateFilter::deleteTextures()
+{
+    mTextures.clear(); // deleted textures bound in this context are unbound
+}
+
+void StateFilter::linkProgram(GLuint program)
+{
+    mUniforms.erase(program); // uniforms are back to their initial values
+}
+
+void StateFilter::deleteProgram(GLuint program)
+{
+    mUniforms.erase(program);
+    if (mProgramKnown && program == mProgram)
+    {
+        mProgramKnown = false;
+    }
+}
+
+void StateFilter::reset()
+{
+    mActiveTexture = 0;
+    mProgramKnown = false;
+    mTextures.clear();
+    mEnabled.clear();
+    mUniforms.clear();
+}
+
+void StateFilter::store(Json::Value& result) const
+{
+    if (mCalls == 0)
+    {
+        return;
+    }
+    Json::Value v;
+    Json::Value skipped = Json::objectValue;
+    uint64_t total = 0;
+    for (const auto& pair : mSkipped)
+    {
+        skipped[pair.first] = (Json::Value::UInt64)pair.second;
+        total += pair.second;
+    }
+    v["calls"] = (Json::Value::UInt64)mCalls;
+    v["skipped"] = (Json::Value::UInt64)total;
+    v["skipped_calls"] = skipped;
+    result["state_filter"] = v;
+}
+
+}
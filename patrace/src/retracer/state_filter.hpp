@@ -0,0 +1,65 @@
+#ifndef _RETRACER_STATE_FILTER_HPP_
+#define _RETRACER_STATE_FILTER_HPP_
+
+#include "dispatch/eglimports.hpp"
+#include "jsoncpp/include/json/value.h"
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace retracer {
+
+/// Skips GL calls that would not change any state for -filterstate, to tell how much of a
+/// CPU bound trace is spent on redundant calls without making a new trace. It shadows the
+/// active texture unit, texture bindings, current program, capabilities and uniform values
+/// set through the calls it filters. It starts out knowing nothing, so the first call to set
+/// something after a reset always goes through.
+///
+/// The retracer changes some of this state itself, when it takes snapshots and at swaps, so
+/// reset() must be called there, and whenever the current context or surface changes.
+class StateFilter
+{
+public:
+    /// These return true when the call would not change anything and can be skipped
+    bool activeTexture(GLenum texture);
+    bool bindTexture(GLenum target, GLuint texture);
+    bool useProgram(GLuint program);
+    bool enable(GLenum cap, bool enabled);
+    /// Values of a glUniform* or glProgramUniform* call, func being the name of the call
+    bool uniform(const char* func, GLuint program, GLint location, const void* values, size_t size, GLboolean transpose = GL_FALSE);
+
+    /// Forget what the given calls may have changed
+    void enablei(GLenum cap);
+    void deleteTextures();
+    void linkProgram(GLuint program);
+    void deleteProgram(GLuint program);
+    void reset();
+
+    /// Add the number of skipped calls of each kind as "state_filter" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    struct Uniform
+    {
+        const char* func;
+        GLboolean transpose;
+        std::vector<char> values;
+    };
+
+    bool redundant(const char* func, bool same);
+
+    GLenum mActiveTexture = 0; ///< zero when not known
+    bool mProgramKnown = false;
+    GLuint mProgram = 0;
+    std::unordered_map<uint64_t, GLuint> mTextures; ///< by texture unit and target
+    std::unordered_map<GLenum, bool> mEnabled;
+    std::unordered_map<GLuint, std::unordered_map<GLint, Uniform>> mUniforms; ///< by program and location
+
+    uint64_t mCalls = 0;
+    std::unordered_map<const char*, uint64_t> mSkipped; ///< by call name
+};
+
+}
+
+#endif
@@ -0,0 +1,209 @@
+#include "retracer/state_shadow.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include <algorithm>
+
+namespace retracer {
+
+/// Capabilities whose glIsEnabled value is shadowed, by bit in mCapsKnown and mCapsEnabled
+static const GLenum shadowedCaps[] = {
+    GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST, GL_DITHER, GL_POLYGON_OFFSET_FILL,
+    GL_PRIMITIVE_RESTART_FIXED_INDEX, GL_RASTERIZER_DISCARD, GL_SAMPLE_ALPHA_TO_COVERAGE,
+    GL_SAMPLE_COVERAGE, GL_SAMPLE_MASK, GL_SCISSOR_TEST, GL_STENCIL_TEST,
+};
+
+int StateShadow::capIndex(GLenum cap)
+{
+    for (unsigned i = 0; i < sizeof(shadowedCaps) / sizeof(shadowedCaps[0]); i++)
+    {
+        if (shadowedCaps[i] == cap)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void StateShadow::bindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    if (target == GL_FRAMEBUFFER || !mES3)
+    {
+        mDrawFramebuffer = mReadFramebuffer = framebuffer;
+        mFramebuffersKnown = true;
+        return;
+    }
+    if (!mFramebuffersKnown)
+    {
+        queryFramebuffers(); // for the one not bound here
+    }
+    if (target == GL_DRAW_FRAMEBUFFER)
+    {
+        mDrawFramebuffer = framebuffer;
+    }
+    else if (target == GL_READ_FRAMEBUFFER)
+    {
+        mReadFramebuffer = framebuffer;
+    }
+}
+
+void StateShadow::deleteFramebuffer(GLuint framebuffer)
+{
+    // deleting a bound framebuffer binds the default one in its place
+    if (mFramebuffersKnown && mDrawFramebuffer == framebuffer)
+    {
+        mDrawFramebuffer = 0;
+    }
+    if (mFramebuffersKnown && mReadFramebuffer == framebuffer)
+    {
+        mReadFramebuffer = 0;
+    }
+    mDrawBuffers.erase(framebuffer); // the name may be generated again
+}
+
+void StateShadow::drawBuffers(GLsizei n, const GLenum* buffers)
+{
+    if (!mFramebuffersKnown)
+    {
+        mDrawBuffers.clear(); // not known which framebuffer they are for
+        return;
+    }
+    DrawBuffers& d = mDrawBuffers[mDrawFramebuffer];
+    for (int i = 0; i < MAX_DRAW_BUFFERS; i++)
+    {
+        d.buffers[i] = (i < n && buffers) ? buffers[i] : GL_NONE;
+    }
+}
+
+void StateShadow::enable(GLenum cap, bool enabled)
+{
+    const int i = capIndex(cap);
+    if (i >= 0)
+    {
+        mCapsKnown |= 1u << i;
+        mCapsEnabled = enabled ? (mCapsEnabled | (1u << i)) : (mCapsEnabled & ~(1u << i));
+    }
+}
+
+void StateShadow::enablei(GLenum cap)
+{
+    const int i = capIndex(cap);
+    if (i >= 0)
+    {
+        mCapsKnown &= ~(1u << i);
+    }
+}
+
+GLuint StateShadow::drawFramebuffer()
+{
+    if (!mFramebuffersKnown)
+    {
+        queryFramebuffers();
+    }
+    return mDrawFramebuffer;
+}
+
+GLuint StateShadow::readFramebuffer()
+{
+    if (!mFramebuffersKnown)
+    {
+        queryFramebuffers();
+    }
+    return mReadFramebuffer;
+}
+
+GLenum StateShadow::drawBuffer(GLint i)
+{
+    if (!mES3)
+    {
+        return i == 0 ? GL_COLOR_ATTACHMENT0 : GL_NONE;
+    }
+    if (i < 0 || i >= std::min<GLint>(maxDrawBuffers(), MAX_DRAW_BUFFERS))
+    {
+        return GL_NONE;
+    }
+    const GLuint framebuffer = drawFramebuffer();
+    auto it = mDrawBuffers.find(framebuffer);
+    if (it == mDrawBuffers.end())
+    {
+        DrawBuffers d;
+        for (int j = 0; j < MAX_DRAW_BUFFERS; j++)
+        {
+            GLint buffer = GL_NONE;
+            if (j < mMaxDrawBuffers)
+            {
+                _glGetIntegerv(GL_DRAW_BUFFER0 + j, &buffer);
+            }
+            d.buffers[j] = buffer;
+        }
+        it = mDrawBuffers.emplace(framebuffer, d).first;
+    }
+    return it->second.buffers[i];
+}
+
+bool StateShadow::isEnabled(GLenum cap)
+{
+    const int i = capIndex(cap);
+    if (i < 0)
+    {
+        return _glIsEnabled(cap);
+    }
+    if (!(mCapsKnown & (1u << i)))
+    {
+        enable(cap, _glIsEnabled(cap));
+    }
+    return mCapsEnabled & (1u << i);
+}
+
+GLint StateShadow::maxColorAttachments()
+{
+    queryLimits();
+    return mMaxColorAttachments;
+}
+
+GLint StateShadow::maxDrawBuffers()
+{
+    queryLimits();
+    return mMaxDrawBuffers;
+}
+
+void StateShadow::invalidate()
+{
+    mFramebuffersKnown = false;
+    mDrawBuffers.clear();
+    mCapsKnown = 0;
+}
+
+void StateShadow::queryFramebuffers()
+{
+    GLint draw = 0, read = 0;
+    if (mES3)
+    {
+        _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw);
+        _glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read);
+    }
+    else
+    {
+        _glGetIntegerv(GL_FRAMEBUFFER_BINDING, &draw);
+        read = draw;
+    }
+    mDrawFramebuffer = draw;
+    mReadFramebuffer = read;
+    mFramebuffersKnown = true;
+}
+
+void StateShadow::queryLimits()
+{
+    if (mLimitsKnown)
+    {
+        return;
+    }
+    if (mES3)
+    {
+        _glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &mMaxColorAttachments);
+        _glGetIntegerv(GL_MAX_DRAW_BUFFERS, &mMaxDrawBuffers);
+    }
+    mLimitsKnown = true;
+}
+
+}
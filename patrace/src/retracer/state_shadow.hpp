@@ -0,0 +1,74 @@
+#ifndef _RETRACER_STATE_SHADOW_HPP_
+#define _RETRACER_STATE_SHADOW_HPP_
+
+#include "dispatch/eglimports.hpp"
+
+#include <stdint.h>
+#include <unordered_map>
+
+namespace retracer {
+
+/// The GL state of a context that the retracer's own features read, kept without asking the
+/// driver, so that snapshots, state logging and the like do not add glGet* stalls to the replay.
+/// The retrace_* functions tell it the framebuffers they bind, their draw buffers and the
+/// capabilities they enable, and the implementation limits are queried once per context.
+///
+/// What is not known yet is queried the first time it is asked for, so it must only be used
+/// while its context is current. Code that binds framebuffers or enables capabilities itself
+/// must put them back as they were, tell the shadow what it bound, or call invalidate().
+class StateShadow
+{
+public:
+    /// Draw and read framebuffer bindings are separate from ES3 on
+    explicit StateShadow(bool es3) : mES3(es3) {}
+
+    /// Names are the driver's, not those of the trace
+    void bindFramebuffer(GLenum target, GLuint framebuffer);
+    void deleteFramebuffer(GLuint framebuffer);
+    /// For the draw framebuffer bound now
+    void drawBuffers(GLsizei n, const GLenum* buffers);
+    void enable(GLenum cap, bool enabled);
+    /// glEnablei and glDisablei leave the value glIsEnabled returns unknown
+    void enablei(GLenum cap);
+
+    GLuint drawFramebuffer();
+    GLuint readFramebuffer();
+    /// Value of GL_DRAW_BUFFERi of the draw framebuffer bound now, GL_NONE past the last one
+    GLenum drawBuffer(GLint i);
+    bool isEnabled(GLenum cap);
+
+    GLint maxColorAttachments();
+    GLint maxDrawBuffers();
+
+    /// Forget the bindings, draw buffers and capabilities, but not the limits
+    void invalidate();
+
+private:
+    enum { MAX_DRAW_BUFFERS = 16 };
+
+    struct DrawBuffers
+    {
+        GLenum buffers[MAX_DRAW_BUFFERS];
+    };
+
+    void queryFramebuffers();
+    void queryLimits();
+    static int capIndex(GLenum cap);
+
+    const bool mES3;
+    bool mFramebuffersKnown = false;
+    GLuint mDrawFramebuffer = 0;
+    GLuint mReadFramebuffer = 0;
+    std::unordered_map<GLuint, DrawBuffers> mDrawBuffers; ///< by framebuffer, once set or queried
+
+    uint32_t mCapsKnown = 0; ///< a bit for each of the capabilities capIndex() knows
+    uint32_t mCapsEnabled = 0;
+
+    bool mLimitsKnown = false;
+    GLint mMaxColorAttachments = 1;
+    GLint mMaxDrawBuffers = 1;
+};
+
+}
+
+#endif
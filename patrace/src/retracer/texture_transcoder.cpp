@@ -0,0 +1,274 @@
+#include "retracer/texture_transcoder.hpp"
+
+#include "retracer/retracer.hpp"
+#include "dispatch/eglproc_auto.hpp"
+#include "common/memory.hpp"
+#include "common/os.hpp"
+
+#include <fstream>
+#include <sstream>
+
+#ifdef ENABLE_TEXTURE_TRANSCODE
+#include "image/image.hpp"
+#include "image/image_compression.hpp"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace retracer {
+
+#ifdef ENABLE_TEXTURE_TRANSCODE
+
+static const uint32_t TEXELS_MAGIC = 0x58544150; // "PATX"
+
+/// Header of a file of decoded texels, which follow it
+struct TexelsHeader
+{
+    uint32_t magic;
+    uint32_t format;
+    uint32_t type;
+    uint32_t size;
+};
+
+/// Unpacks tightly packed texels from client memory until it is destroyed, which puts back
+/// the unpack state that the trace set
+class TightUnpack
+{
+public:
+    explicit TightUnpack(bool es3)
+    {
+        set(GL_UNPACK_ALIGNMENT, 1);
+        if (es3)
+        {
+            set(GL_UNPACK_ROW_LENGTH, 0);
+            set(GL_UNPACK_SKIP_ROWS, 0);
+            set(GL_UNPACK_SKIP_PIXELS, 0);
+            GLint buffer = 0;
+            _glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &buffer);
+            mBuffer = buffer;
+            if (mBuffer != 0)
+            {
+                _glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+        }
+    }
+
+    ~TightUnpack()
+    {
+        for (int i = 0; i < mCount; i++)
+        {
+            _glPixelStorei(mSaved[i].pname, mSaved[i].value);
+        }
+        if (mBuffer != 0)
+        {
+            _glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer);
+        }
+    }
+
+private:
+    void set(GLenum pname, GLint value)
+    {
+        GLint old = value;
+        _glGetIntegerv(pname, &old);
+        if (old != value)
+        {
+            _glPixelStorei(pname, value);
+            mSaved[mCount].pname = pname;
+            mSaved[mCount].value = old;
+            mCount++;
+        }
+    }
+
+    struct Saved
+    {
+        GLenum pname;
+        GLint value;
+    };
+    Saved mSaved[4];
+    int mCount = 0;
+    GLuint mBuffer = 0;
+};
+
+static bool isES3()
+{
+    return gRetracer.getCurrentContext()._profile >= PROFILE_ES3;
+}
+
+bool TextureTranscoder::open(const std::string& cacheDir)
+{
+    if (mkdir(cacheDir.c_str(), 0777) != 0 && errno != EEXIST)
+    {
+        DBG_LOG("Failed to create the directory for decoded textures %s: %s\n", cacheDir.c_str(), strerror(errno));
+        return false;
+    }
+    if (!pat::SupportASTCUncompression())
+    {
+        DBG_LOG("ASTC textures cannot be decoded, astcenc is not on $PATH\n");
+    }
+    mCacheDir = cacheDir;
+    mFormatsKnown = false;
+    mSupported.clear();
+    return true;
+}
+
+bool TextureTranscoder::unsupported(GLenum format)
+{
+    if (!pat::IsETC1Compression(format) && !(pat::IsASTCCompression(format) && pat::SupportASTCUncompression()))
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mFormatsKnown)
+    {
+        GLint count = 0;
+        _glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+        std::vector<GLint> formats(count);
+        if (count > 0)
+        {
+            _glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+        }
+        mSupported.insert(formats.begin(), formats.end());
+        mFormatsKnown = true;
+    }
+    return mSupported.count(format) == 0;
+}
+
+GLenum TextureTranscoder::decodedFormat(GLenum format)
+{
+    if (pat::IsETC1Compression(format))
+    {
+        return GL_RGB8;
+    }
+    if (format >= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR && format <= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12_KHR)
+    {
+        return GL_SRGB8_ALPHA8;
+    }
+    return GL_RGBA8;
+}
+
+bool TextureTranscoder::load(const std::string& path, Texels& texels) const
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    TexelsHeader header;
+    if (!in.is_open() || !in.read((char*)&header, sizeof(header)) || header.magic != TEXELS_MAGIC)
+    {
+        return false;
+    }
+    texels.format = header.format;
+    texels.type = header.type;
+    texels.pixels.resize(header.size);
+    return (bool)in.read((char*)texels.pixels.data(), header.size);
+}
+
+bool TextureTranscoder::save(const std::string& path, const Texels& texels) const
+{
+    // Written under another name first, so that replays sharing the directory never read half a file
+    std::stringstream temp;
+    temp << path << "." << getpid();
+    std::ofstream out(temp.str().c_str(), std::ios::binary);
+    const TexelsHeader header = { TEXELS_MAGIC, texels.format, texels.type, (uint32_t)texels.pixels.size() };
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)texels.pixels.data(), texels.pixels.size());
+    out.close();
+    if (!out.good() || rename(temp.str().c_str(), path.c_str()) != 0)
+    {
+        remove(temp.str().c_str());
+        return false;
+    }
+    return true;
+}
+
+bool TextureTranscoder::decode(GLenum format, GLsizei width, GLsizei height, GLsizei imageSize, const void* data, Texels& texels)
+{
+    std::stringstream path;
+    path << mCacheDir << "/" << common::MD5Digest(data, imageSize).text_lower() << "_" << std::hex << format
+         << std::dec << "_" << width << "x" << height << ".texels";
+    if (load(path.str(), texels))
+    {
+        mDecoded++;
+        mCached++;
+        return true;
+    }
+
+    pat::Image input(width, height, format, GL_UNSIGNED_BYTE, imageSize, (UInt8*)data, false, false);
+    pat::Image output;
+    if (!pat::Uncompress(input, output) || output.Data() == NULL)
+    {
+        DBG_LOG("Failed to decode a %dx%d texture of format 0x%04x\n", width, height, format);
+        return false;
+    }
+    texels.format = output.Format();
+    texels.type = output.Type();
+    texels.pixels.assign(output.Data(), output.Data() + output.DataSize());
+    if (!save(path.str(), texels))
+    {
+        DBG_LOG("Failed to save decoded texels to %s\n", path.str().c_str());
+    }
+    mDecoded++;
+    return true;
+}
+
+bool TextureTranscoder::compressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height,
+                                             GLint border, GLsizei imageSize, const void* data)
+{
+    Texels texels;
+    if (!data || !unsupported(internalformat) || !decode(internalformat, width, height, imageSize, data, texels))
+    {
+        return false;
+    }
+    TightUnpack unpack(isES3());
+    _glTexImage2D(target, level, decodedFormat(internalformat), width, height, border, texels.format, texels.type, texels.pixels.data());
+    return true;
+}
+
+bool TextureTranscoder::compressedTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+                                                GLenum format, GLsizei imageSize, const void* data)
+{
+    Texels texels;
+    if (!data || !unsupported(format) || !decode(format, width, height, imageSize, data, texels))
+    {
+        return false;
+    }
+    TightUnpack unpack(isES3());
+    _glTexSubImage2D(target, level, xoffset, yoffset, width, height, texels.format, texels.type, texels.pixels.data());
+    return true;
+}
+
+bool TextureTranscoder::texStorage2D(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height)
+{
+    if (!unsupported(internalformat))
+    {
+        return false;
+    }
+    _glTexStorage2D(target, levels, decodedFormat(internalformat), width, height);
+    return true;
+}
+
+#else
+
+bool TextureTranscoder::open(const std::string& cacheDir)
+{
+    DBG_LOG("This build cannot decode compressed textures, it was built without ENABLE_TEXTURE_TRANSCODE\n");
+    return false;
+}
+
+bool TextureTranscoder::compressedTexImage2D(GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei, const void*)
+{
+    return false;
+}
+
+bool TextureTranscoder::compressedTexSubImage2D(GLenum, GLint, GLint, GLint, GLsizei, GLsizei, GLenum, GLsizei, const void*)
+{
+    return false;
+}
+
+bool TextureTranscoder::texStorage2D(GLenum, GLsizei, GLenum, GLsizei, GLsizei)
+{
+    return false;
+}
+
+#endif
+
+}
@@ -0,0 +1,69 @@
+#ifndef _RETRACER_TEXTURE_TRANSCODER_HPP_
+#define _RETRACER_TEXTURE_TRANSCODER_HPP_
+
+#include "dispatch/eglimports.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace retracer {
+
+/// Uploads compressed textures in formats that the driver does not support, such as ASTC on
+/// desktop GPUs, as the texels they decode to. Decoding goes through the image library of the
+/// tools, which decodes ETC1 itself and ASTC with astcenc, so astcenc must be on $PATH.
+///
+/// The decoded texels of every upload are kept in a directory, in a file named by the MD5 of
+/// the compressed data, so that only the first replay of a trace pays for decoding.
+class TextureTranscoder
+{
+public:
+    /// Keep decoded texels in this directory, which is created if it does not exist. Fails in
+    /// builds without the image library, which lack ENABLE_TEXTURE_TRANSCODE.
+    bool open(const std::string& cacheDir);
+    bool isOpen() const { return !mCacheDir.empty(); }
+    void close() { mCacheDir.clear(); }
+
+    /// Each returns false if it did nothing, and the call should go to the driver as it is. The
+    /// data of compressed uploads from a pixel unpack buffer, which is NULL here, is not decoded.
+    bool compressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height,
+                              GLint border, GLsizei imageSize, const void* data);
+    bool compressedTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+                                 GLenum format, GLsizei imageSize, const void* data);
+    /// Storage for compressed formats that are decoded is allocated uncompressed
+    bool texStorage2D(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+
+    /// Number of uploads decoded, and of those whose texels were found in the cache
+    unsigned decoded() const { return mDecoded; }
+    unsigned cached() const { return mCached; }
+
+private:
+    struct Texels
+    {
+        GLenum format;
+        GLenum type;
+        std::vector<unsigned char> pixels;
+    };
+
+    /// Whether the driver lacks the compressed format and it can be decoded
+    bool unsupported(GLenum format);
+    /// From the cache, or decoded and added to it
+    bool decode(GLenum format, GLsizei width, GLsizei height, GLsizei imageSize, const void* data, Texels& texels);
+    bool load(const std::string& path, Texels& texels) const;
+    bool save(const std::string& path, const Texels& texels) const;
+    /// Sized uncompressed format that a compressed one decodes to
+    static GLenum decodedFormat(GLenum format);
+
+    std::string mCacheDir;
+    std::mutex mMutex; ///< for the formats, as contexts on several threads can ask at once
+    bool mFormatsKnown = false;
+    std::unordered_set<GLenum> mSupported; ///< compressed formats of the driver
+    std::atomic<unsigned> mDecoded{0};
+    std::atomic<unsigned> mCached{0};
+};
+
+}
+
+#endif
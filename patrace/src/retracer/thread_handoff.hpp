@@ -0,0 +1,76 @@
+#ifndef _RETRACER_THREAD_HANDOFF_HPP_
+#define _RETRACER_THREAD_HANDOFF_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#ifdef _MSC_VER
+#include <windows.h>
+#endif
+
+namespace retracer {
+
+/// Parking spot of one replay thread. Control is passed between replay threads through a
+/// shared atomic (Retracer::latest_call_tid), so a thread waiting for its turn first spins on
+/// that for a short while, and only parks on its own condition variable if the other thread
+/// keeps going. Quick ping-pong between threads then never enters the kernel, and parked
+/// threads do not share a lock.
+class ThreadHandoff
+{
+public:
+    /// Roughly tens of microseconds, about what it costs to park and be woken up again. There
+    /// is no point in spinning on a single core, the other thread cannot run meanwhile.
+    static const int SPIN_COUNT = 4000;
+
+    /// Wait until ready() holds. ready() must only use sequentially consistent loads, see
+    /// wake(). Returns false if the turn came while spinning, true if the thread had to park.
+    template <class Ready>
+    bool wait(Ready ready)
+    {
+        static const int spinCount = std::thread::hardware_concurrency() > 1 ? SPIN_COUNT : 0;
+        for (int i = 0; i < spinCount; i++)
+        {
+            if (ready()) return false;
+            cpuRelax();
+        }
+        if (spinCount == 0 && ready()) return false;
+        std::unique_lock<std::mutex> lk(mMutex);
+        mParked.store(true);
+        mCondition.wait(lk, ready);
+        mParked.store(false, std::memory_order_relaxed);
+        return true;
+    }
+
+    /// Wake up the thread if it is parked. Call after making its ready() true with a
+    /// sequentially consistent store: then either the waiting thread sees that store, or
+    /// this sees it parked.
+    void wake()
+    {
+        if (mParked.load())
+        {
+            std::lock_guard<std::mutex> lk(mMutex);
+            mCondition.notify_one();
+        }
+    }
+
+private:
+    static inline void cpuRelax()
+    {
+#if defined(_MSC_VER)
+        YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::atomic<bool> mParked{false};
+};
+
+}
+
+#endif
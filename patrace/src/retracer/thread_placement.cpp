@@ -0,0 +1,192 @@
+#include "retracer/thread_placement.hpp"
+
+#include "common/os.hpp"
+#include "common/thread_pool.hpp"
+
+#include <errno.h>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+
+namespace retracer {
+
+static const char* roleNames[ThreadPlacement::ROLE_COUNT] = { "main", "replay", "decode", "prefetch", "collector" };
+
+bool parseCpuMask(const std::string& descr, cpu_set_t& mask)
+{
+    CPU_ZERO(&mask);
+    for (unsigned i = 0; i < descr.size(); i++)
+    {
+        if (descr.at(i) == '1')
+        {
+            CPU_SET(i, &mask);
+        }
+        else if (descr.at(i) != '0')
+        {
+            return false;
+        }
+    }
+    return CPU_COUNT(&mask) > 0;
+}
+
+std::string cpuMaskToString(const cpu_set_t& mask)
+{
+    std::string descr;
+    for (unsigned i = 0; i < CPU_SETSIZE; i++)
+    {
+        descr += CPU_ISSET(i, &mask) ? "1" : "0";
+    }
+    while (!descr.empty() && descr.back() == '0') descr.pop_back(); // on Android, string will be very long otherwise
+    return descr;
+}
+
+bool ThreadPlacement::autoPlace()
+{
+    cpu_set_t available;
+    if (sched_getaffinity(0, sizeof(available), &available) != 0)
+    {
+        DBG_LOG("Failed to get CPU mask: %s\n", strerror(errno));
+        return false;
+    }
+    std::map<unsigned long, cpu_set_t, std::greater<unsigned long>> clusters; // biggest first
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &available))
+        {
+            continue;
+        }
+        const unsigned long size = common::coreSize(cpu);
+        if (size == 0)
+        {
+            DBG_LOG("Size of CPU %u is not known, leaving thread placement to the scheduler\n", cpu);
+            return true;
+        }
+        if (clusters.count(size) == 0)
+        {
+            CPU_ZERO(&clusters[size]);
+        }
+        CPU_SET(cpu, &clusters[size]);
+    }
+    if (clusters.size() < 2)
+    {
+        DBG_LOG("All cores are alike, leaving thread placement to the scheduler\n");
+        return true;
+    }
+    const cpu_set_t& big = clusters.begin()->second;
+    const cpu_set_t& next = std::next(clusters.begin())->second;
+    const cpu_set_t& little = clusters.rbegin()->second;
+    mMasks[MAIN] = mMasks[REPLAY] = big;
+    mMasks[DECODE] = mMasks[PREFETCH] = next;
+    mMasks[COLLECTOR] = little;
+    for (bool& placed : mPlaced)
+    {
+        placed = true;
+    }
+    return true;
+}
+
+void ThreadPlacement::clear()
+{
+    for (bool& placed : mPlaced)
+    {
+        placed = false;
+    }
+    mTidMasks.clear();
+}
+
+bool ThreadPlacement::configure(const std::string& spec)
+{
+    clear();
+    if (spec == "auto")
+    {
+        return autoPlace();
+    }
+
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        const size_t eq = item.find('=');
+        cpu_set_t mask;
+        if (eq == std::string::npos || !parseCpuMask(item.substr(eq + 1), mask))
+        {
+            DBG_LOG("Invalid thread affinity %s, expected role=mask with a string of ones and zeroes\n", item.c_str());
+            clear();
+            return false;
+        }
+        const std::string role = item.substr(0, eq);
+        int r = 0;
+        while (r < ROLE_COUNT && role != roleNames[r]) r++;
+        if (r < ROLE_COUNT)
+        {
+            mPlaced[r] = true;
+            mMasks[r] = mask;
+        }
+        else if (role.compare(0, 3, "tid") == 0 && role.size() > 3 && role.find_first_not_of("0123456789", 3) == std::string::npos)
+        {
+            mTidMasks[atoi(role.c_str() + 3)] = mask;
+        }
+        else
+        {
+            DBG_LOG("Unknown thread role %s, expected main, replay, tidN, decode, prefetch or collector\n", role.c_str());
+            clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void ThreadPlacement::apply(Role role, int tid) const
+{
+    const auto it = (role == REPLAY) ? mTidMasks.find(tid) : mTidMasks.end();
+    const cpu_set_t* mask = (it != mTidMasks.end()) ? &it->second : (mPlaced[role] ? &mMasks[role] : nullptr);
+    if (!mask)
+    {
+        return;
+    }
+    if (sched_setaffinity(0, sizeof(*mask), mask) != 0)
+    {
+        DBG_LOG("Failed to place %s thread on CPU mask %s: %s\n", roleNames[role], cpuMaskToString(*mask).c_str(), strerror(errno));
+    }
+}
+
+ThreadPlacement::Inherit::Inherit(const ThreadPlacement& placement, Role role)
+{
+    if (placement.mPlaced[role] && sched_getaffinity(0, sizeof(mOld), &mOld) == 0)
+    {
+        placement.apply(role);
+        mChanged = true;
+    }
+}
+
+ThreadPlacement::Inherit::~Inherit()
+{
+    if (mChanged)
+    {
+        sched_setaffinity(0, sizeof(mOld), &mOld);
+    }
+}
+
+void ThreadPlacement::store(Json::Value& result) const
+{
+    Json::Value v = Json::objectValue;
+    for (int r = 0; r < ROLE_COUNT; r++)
+    {
+        if (mPlaced[r])
+        {
+            v[roleNames[r]] = cpuMaskToString(mMasks[r]);
+        }
+    }
+    for (const auto& pair : mTidMasks)
+    {
+        v["tid" + std::to_string(pair.first)] = cpuMaskToString(pair.second);
+    }
+    if (!v.empty())
+    {
+        result["thread_affinity"] = v;
+    }
+}
+
+}
@@ -0,0 +1,65 @@
+#ifndef _RETRACER_THREAD_PLACEMENT_HPP_
+#define _RETRACER_THREAD_PLACEMENT_HPP_
+
+#include "jsoncpp/include/json/value.h"
+
+#include <sched.h>
+#include <string>
+#include <unordered_map>
+
+namespace retracer {
+
+/// Parse a CPU mask written as a string of ones and zeroes, one for each core
+bool parseCpuMask(const std::string& descr, cpu_set_t& mask);
+std::string cpuMaskToString(const cpu_set_t& mask);
+
+/// Puts each kind of thread on its own set of cores for -threadaffinity, so the scheduler
+/// cannot move the GL thread between clusters from one run to the next. The spec is either
+/// "auto" or a comma separated list of role=mask, with the roles main (the thread making the
+/// calls of the retraced thread id), replay (the other -multithread replay threads, or tidN
+/// for the one replaying trace thread id N), decode, prefetch and collector. Roles not given
+/// keep the mask of the thread that creates them.
+///
+/// With "auto", cores are grouped by their capacity, or their highest frequency where the
+/// kernel does not tell the capacity. The replay threads go on the biggest cores, the decode
+/// and prefetch threads on the next biggest, and the collectors on the smallest. When all
+/// cores are alike, nothing is placed.
+class ThreadPlacement
+{
+public:
+    enum Role { MAIN, REPLAY, DECODE, PREFETCH, COLLECTOR, ROLE_COUNT };
+
+    /// Returns false if the spec is not valid, in which case nothing is placed
+    bool configure(const std::string& spec);
+
+    /// Set the mask of the role on the calling thread, if there is one. tid is the trace thread
+    /// id of a replay thread.
+    void apply(Role role, int tid = -1) const;
+
+    /// Gives the calling thread the mask of a role while it creates threads of that role, which
+    /// inherit it, for threads that are not started by the retracer itself
+    class Inherit
+    {
+    public:
+        Inherit(const ThreadPlacement& placement, Role role);
+        ~Inherit();
+    private:
+        cpu_set_t mOld;
+        bool mChanged = false;
+    };
+
+    /// Add the mask of each placed role as "thread_affinity" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    void clear();
+    bool autoPlace();
+
+    bool mPlaced[ROLE_COUNT] = {};
+    cpu_set_t mMasks[ROLE_COUNT];
+    std::unordered_map<int, cpu_set_t> mTidMasks;
+};
+
+}
+
+#endif
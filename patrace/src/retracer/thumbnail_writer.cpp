@@ -0,0 +1,361 @@
+#include "retracer/thumbnail_writer.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "retracer/glstate.hpp"
+#include "retracer/retracer.hpp"
+#include "retracer/timeline.hpp"
+
+#include "common/image.hpp"
+#include "common/os.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace retracer {
+
+static const char THUMBNAIL_MAGIC[8] = { 'P', 'A', 'T', 'T', 'H', 'U', 'M', 'B' };
+
+static void putLE32(unsigned char* dst, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        dst[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+ThumbnailWriter::~ThumbnailWriter()
+{
+    close(); // GL objects went with their context
+}
+
+bool ThumbnailWriter::open(const std::string& fileName, unsigned width)
+{
+    close();
+    mFile = fopen(fileName.c_str(), "wb");
+    if (!mFile)
+    {
+        DBG_LOG("Failed to open %s for thumbnails: %s\n", fileName.c_str(), strerror(errno));
+        return false;
+    }
+    if (fwrite(THUMBNAIL_MAGIC, sizeof(THUMBNAIL_MAGIC), 1, mFile) != 1)
+    {
+        DBG_LOG("Failed to write %s\n", fileName.c_str());
+        fclose(mFile);
+        mFile = nullptr;
+        return false;
+    }
+    mFileName = fileName;
+    mWidth = std::max(1u, width);
+    mWritten = 0;
+    mStop = false;
+    mWorker = std::thread(&ThumbnailWriter::run, this);
+    return true;
+}
+
+bool ThumbnailWriter::read(GLenum attachment, unsigned frameNo, unsigned callNo)
+{
+    Context* context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    if (!mFile || !context || context->_profile < PROFILE_ES3)
+    {
+        return false;
+    }
+    if (context != mContext)
+    {
+        if (mContext)
+        {
+            DBG_LOG("Thumbnail buffers of another context are still in use, dropping them\n");
+            mRing.assign(RING_SIZE, Readback());
+            mPending = 0;
+            mFramebuffer = mRenderbuffer = mResolveFramebuffer = mResolveRenderbuffer = 0;
+            mThumbWidth = mThumbHeight = 0;
+            mResolveWidth = mResolveHeight = 0;
+        }
+        mContext = context;
+    }
+
+    GLint readFramebuffer = 0;
+    GLint drawFramebuffer = 0;
+    _glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+    _glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+    // attachments are looked up through the draw binding
+    _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, readFramebuffer);
+    int width = 0;
+    int height = 0;
+    int channels = 4;
+    const bool readable = glstate::getColorAttachmentSize(attachment, width, height, channels);
+    GLint samples = 0;
+    _glGetIntegerv(GL_SAMPLES, &samples);
+    if (!readable)
+    {
+        _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+        return false;
+    }
+    const unsigned thumbWidth = std::min<unsigned>(mWidth, width);
+    const unsigned thumbHeight = std::max(1u, (unsigned)((uint64_t)height * thumbWidth / width));
+
+    Readback& readback = mRing[mNext];
+    if (mPending == RING_SIZE)
+    {
+        complete(readback, true); // the ring is full, this is where replay has to wait
+    }
+    if (!prepare(thumbWidth, thumbHeight, width, height, samples > 0))
+    {
+        _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+        return false;
+    }
+
+    while (_glGetError() != GL_NO_ERROR) {}
+    GLint oldReadBuffer = GL_BACK;
+    _glGetIntegerv(GL_READ_BUFFER, &oldReadBuffer);
+    if (readFramebuffer != 0)
+    {
+        _glReadBuffer(attachment);
+    }
+    const bool scissor = mContext->_shadow.isEnabled(GL_SCISSOR_TEST);
+    if (scissor) _glDisable(GL_SCISSOR_TEST);
+    if (samples > 0) // cannot be scaled and resolved at once
+    {
+        _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mResolveFramebuffer);
+        _glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        _glBindFramebuffer(GL_READ_FRAMEBUFFER, mResolveFramebuffer);
+    }
+    _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFramebuffer);
+    _glBlitFramebuffer(0, 0, width, height, 0, 0, thumbWidth, thumbHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    if (scissor) _glEnable(GL_SCISSOR_TEST);
+
+    if (readback.pbo == 0)
+    {
+        _glGenBuffers(1, &readback.pbo);
+    }
+    const GLsizeiptr size = (GLsizeiptr)thumbWidth * thumbHeight * 4;
+    GLint oldPackBuffer = 0;
+    _glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &oldPackBuffer);
+    _glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+    GLint pboSize = 0;
+    _glGetBufferParameteriv(GL_PIXEL_PACK_BUFFER, GL_BUFFER_SIZE, &pboSize);
+    if (pboSize < size)
+    {
+        _glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    }
+    _glBindFramebuffer(GL_READ_FRAMEBUFFER, mFramebuffer);
+    _glReadPixels(0, 0, thumbWidth, thumbHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    _glBindBuffer(GL_PIXEL_PACK_BUFFER, oldPackBuffer);
+    _glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+    _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+    _glReadBuffer(oldReadBuffer);
+
+    const GLenum error = _glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        DBG_LOG("warning: 0x%x while scaling down a thumbnail\n", error);
+        while (_glGetError() != GL_NO_ERROR) {}
+        return false;
+    }
+    readback.fence = _glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.width = thumbWidth;
+    readback.height = thumbHeight;
+    readback.frameNo = frameNo;
+    readback.callNo = callNo;
+    mNext = (mNext + 1) % RING_SIZE;
+    mPending++;
+    return true;
+}
+
+bool ThumbnailWriter::prepare(unsigned width, unsigned height, int sourceWidth, int sourceHeight, bool resolve)
+{
+    GLint oldRenderbuffer = 0;
+    _glGetIntegerv(GL_RENDERBUFFER_BINDING, &oldRenderbuffer);
+    bool ready = true;
+    if (mFramebuffer == 0)
+    {
+        _glGenFramebuffers(1, &mFramebuffer);
+        _glGenRenderbuffers(1, &mRenderbuffer);
+    }
+    if (width != mThumbWidth || height != mThumbHeight)
+    {
+        _glBindRenderbuffer(GL_RENDERBUFFER, mRenderbuffer);
+        _glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFramebuffer);
+        _glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mRenderbuffer);
+        ready = _glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        mThumbWidth = ready ? width : 0;
+        mThumbHeight = ready ? height : 0;
+    }
+    if (ready && resolve)
+    {
+        if (mResolveFramebuffer == 0)
+        {
+            _glGenFramebuffers(1, &mResolveFramebuffer);
+            _glGenRenderbuffers(1, &mResolveRenderbuffer);
+        }
+        if (sourceWidth != mResolveWidth || sourceHeight != mResolveHeight)
+        {
+            _glBindRenderbuffer(GL_RENDERBUFFER, mResolveRenderbuffer);
+            _glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, sourceWidth, sourceHeight);
+            _glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mResolveFramebuffer);
+            _glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mResolveRenderbuffer);
+            ready = _glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+            mResolveWidth = ready ? sourceWidth : 0;
+            mResolveHeight = ready ? sourceHeight : 0;
+        }
+    }
+    _glBindRenderbuffer(GL_RENDERBUFFER, oldRenderbuffer);
+    if (!ready)
+    {
+        DBG_LOG("Cannot render to a renderbuffer to scale thumbnails into\n");
+    }
+    return ready;
+}
+
+bool ThumbnailWriter::complete(Readback& readback, bool wait)
+{
+    GLenum result = _glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (result == GL_TIMEOUT_EXPIRED && !wait)
+    {
+        return false;
+    }
+    while (result == GL_TIMEOUT_EXPIRED)
+    {
+        result = _glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100 * 1000 * 1000);
+    }
+    _glDeleteSync(readback.fence);
+    readback.fence = 0;
+    mPending--;
+
+    image::Image* image = new image::Image(readback.width, readback.height, 4, true);
+    GLint oldPackBuffer = 0;
+    _glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &oldPackBuffer);
+    _glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+    const void* pixels = (result != GL_WAIT_FAILED) ? _glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, image->size(), GL_MAP_READ_BIT) : nullptr;
+    if (pixels)
+    {
+        memcpy(image->pixels, pixels, image->size());
+        _glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    _glBindBuffer(GL_PIXEL_PACK_BUFFER, oldPackBuffer);
+    if (!pixels)
+    {
+        DBG_LOG("Failed to take thumbnail for call no: %u\n", readback.callNo);
+        delete image;
+        return true;
+    }
+
+    Job job = { image, readback.frameNo, readback.callNo };
+    enqueue(job);
+    return true;
+}
+
+void ThumbnailWriter::flush()
+{
+    while (mPending > 0)
+    {
+        complete(oldest(), true);
+    }
+    release();
+    mContext = nullptr;
+}
+
+void ThumbnailWriter::release()
+{
+    for (Readback& readback : mRing)
+    {
+        if (readback.pbo) _glDeleteBuffers(1, &readback.pbo);
+        readback.pbo = 0;
+    }
+    if (mFramebuffer) _glDeleteFramebuffers(1, &mFramebuffer);
+    if (mRenderbuffer) _glDeleteRenderbuffers(1, &mRenderbuffer);
+    if (mResolveFramebuffer) _glDeleteFramebuffers(1, &mResolveFramebuffer);
+    if (mResolveRenderbuffer) _glDeleteRenderbuffers(1, &mResolveRenderbuffer);
+    mFramebuffer = mRenderbuffer = mResolveFramebuffer = mResolveRenderbuffer = 0;
+    mThumbWidth = mThumbHeight = 0;
+    mResolveWidth = mResolveHeight = 0;
+}
+
+void ThumbnailWriter::close()
+{
+    if (!mFile)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mMutex);
+        mStop = true;
+    }
+    mQueueChanged.notify_all();
+    mWorker.join(); // after writing everything queued
+    if (fclose(mFile) != 0)
+    {
+        DBG_LOG("Failed to write %s\n", mFileName.c_str());
+    }
+    else
+    {
+        DBG_LOG("Wrote %u thumbnails to %s\n", mWritten, mFileName.c_str());
+    }
+    mFile = nullptr;
+}
+
+void ThumbnailWriter::enqueue(const Job& job)
+{
+    std::unique_lock<std::mutex> lk(mMutex);
+    mQueueChanged.wait(lk, [&]{ return mJobs.size() < MAX_QUEUED; });
+    mJobs.push_back(job);
+    lk.unlock();
+    mQueueChanged.notify_all();
+}
+
+void ThumbnailWriter::run()
+{
+    gTimeline.nameThread("thumbnail writer");
+    std::unique_lock<std::mutex> lk(mMutex);
+    while (true)
+    {
+        mQueueChanged.wait(lk, [&]{ return mStop || !mJobs.empty(); });
+        if (mJobs.empty())
+        {
+            return; // stopped
+        }
+        const Job job = mJobs.front();
+        mJobs.pop_front();
+        lk.unlock();
+        mQueueChanged.notify_all();
+
+        TimelineScope scope("snapshot", "encode thumbnail", job.callNo);
+        // alpha is dropped, it would show the thumbnail through in most viewers
+        image::Image* image = job.image;
+        const size_t pixelCount = (size_t)image->width * image->height;
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            memmove(image->pixels + i * 3, image->pixels + i * 4, 3);
+        }
+        char* png = nullptr;
+        int size = 0;
+        bool written = image::writePixelsToBuffer(image->pixels, image->width, image->height, 3, true, &png, &size);
+        if (written)
+        {
+            unsigned char record[20];
+            putLE32(record, job.frameNo);
+            putLE32(record + 4, job.callNo);
+            putLE32(record + 8, image->width);
+            putLE32(record + 12, image->height);
+            putLE32(record + 16, size);
+            written = fwrite(record, sizeof(record), 1, mFile) == 1 && fwrite(png, size, 1, mFile) == 1;
+        }
+        free(png);
+        delete image;
+        if (written)
+        {
+            mWritten++;
+        }
+        else
+        {
+            DBG_LOG("Failed to write thumbnail of frame %u to %s\n", job.frameNo, mFileName.c_str());
+        }
+
+        lk.lock();
+    }
+}
+
+}
@@ -0,0 +1,118 @@
+#ifndef _RETRACER_THUMBNAIL_WRITER_HPP_
+#define _RETRACER_THUMBNAIL_WRITER_HPP_
+
+#include "dispatch/eglimports.hpp"
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace image {
+    class Image;
+}
+
+namespace retracer {
+
+class Context;
+
+/// Takes small images of the framebuffer in place of full snapshots, for review dashboards that
+/// keep a thumbnail of every frame. The framebuffer is scaled down on the GPU, by a blit into a
+/// renderbuffer of the thumbnail size, which is read into one of a ring of pixel pack buffers with
+/// a fence behind it, as in SnapshotQueue. Once the GPU is done with it, a worker thread encodes
+/// the thumbnail as PNG and appends it to a single file for the whole run.
+///
+/// The file starts with the magic "PATTHUMB", followed by a record for every thumbnail: its frame
+/// number, call number, width, height and the size of its PNG, each a little endian 32 bit value,
+/// and then the PNG.
+///
+/// Like SnapshotQueue, everything but the writing must be done on the thread and context that took
+/// the thumbnails, so flush() must be called before that context stops being current.
+class ThumbnailWriter
+{
+public:
+    static const unsigned RING_SIZE = 3;
+    static const unsigned MAX_QUEUED = 16; ///< thumbnails waiting to be encoded
+
+    ThumbnailWriter() : mRing(RING_SIZE) {}
+    ~ThumbnailWriter();
+
+    /// Write thumbnails of at most width pixels across to fileName
+    bool open(const std::string& fileName, unsigned width);
+    bool isOpen() const { return mFile != nullptr; }
+
+    /// Start reading a thumbnail of the given color attachment of the read framebuffer. Returns
+    /// false if it cannot be scaled down, such as for attachments that are not 8 bit RGB or RGBA.
+    bool read(GLenum attachment, unsigned frameNo, unsigned callNo);
+
+    /// Pass on the thumbnails that the GPU is done with, without waiting
+    void poll() { while (mPending > 0 && complete(oldest(), false)) {} }
+
+    /// Pass on all thumbnails and free the GL objects, while their context is still current
+    void flush();
+
+    /// Wait until all thumbnails passed on have been written, and close the file
+    void close();
+
+    unsigned written() const { return mWritten; }
+
+private:
+    struct Readback
+    {
+        GLuint pbo = 0;
+        GLsync fence = 0;
+        unsigned width = 0;
+        unsigned height = 0;
+        unsigned frameNo = 0;
+        unsigned callNo = 0;
+    };
+
+    struct Job
+    {
+        image::Image* image;
+        unsigned frameNo;
+        unsigned callNo;
+    };
+
+    Readback& oldest() { return mRing[(mNext + RING_SIZE - mPending) % RING_SIZE]; }
+    /// Map the oldest readback and queue it for encoding. Returns false if wait is false and the
+    /// GPU is not done with it yet.
+    bool complete(Readback& readback, bool wait);
+    /// Make the renderbuffers to scale into, and to resolve into for multisampled framebuffers
+    bool prepare(unsigned width, unsigned height, int sourceWidth, int sourceHeight, bool resolve);
+    void release();
+    void enqueue(const Job& job);
+    void run();
+
+    std::vector<Readback> mRing;
+    unsigned mNext = 0; ///< slot of the next readback
+    unsigned mPending = 0; ///< readbacks in the ring, ending before mNext
+    Context* mContext = nullptr; ///< owner of the GL objects
+    GLuint mFramebuffer = 0; ///< with mRenderbuffer attached, to scale into
+    GLuint mRenderbuffer = 0;
+    unsigned mThumbWidth = 0; ///< of mRenderbuffer
+    unsigned mThumbHeight = 0;
+    GLuint mResolveFramebuffer = 0; ///< with mResolveRenderbuffer attached, multisampled framebuffers are resolved into it first
+    GLuint mResolveRenderbuffer = 0;
+    int mResolveWidth = 0;
+    int mResolveHeight = 0;
+    unsigned mWidth = 256;
+
+    FILE* mFile = nullptr;
+    std::string mFileName;
+    unsigned mWritten = 0;
+
+    std::mutex mMutex;
+    std::condition_variable mQueueChanged;
+    std::deque<Job> mJobs;
+    bool mStop = false;
+    std::thread mWorker;
+};
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include "retracer/timeline.hpp"
+
+#include "common/os.hpp"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace retracer {
+
+Timeline gTimeline;
+
+void Timeline::enable(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    mEvents.resize(size);
+    mMask = size - 1;
+    mNext.store(0);
+    mEnabled = true;
+}
+
+void Timeline::nameThread(const std::string& name)
+{
+    if (!mEnabled) return;
+    const unsigned id = thread();
+    std::lock_guard<std::mutex> lk(mNameMutex);
+    mThreadNames.push_back(std::make_pair(id, name));
+}
+
+bool Timeline::write(const std::string& filename)
+{
+    FILE* fp = fopen(filename.c_str(), "w");
+    if (!fp)
+    {
+        DBG_LOG("Failed to open timeline file %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    const int pid = getpid();
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"paretrace\"}}", pid);
+    {
+        std::lock_guard<std::mutex> lk(mNameMutex);
+        for (const auto& pair : mThreadNames)
+        {
+            fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", pid, pair.first, pair.second.c_str());
+        }
+    }
+    const uint64_t next = mNext.load();
+    const uint64_t first = (next > mEvents.size()) ? next - mEvents.size() : 0;
+    for (uint64_t i = first; i < next; i++)
+    {
+        const Event& e = mEvents[i & mMask];
+        fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"call\":%u}}",
+                e.name, e.category, pid, e.thread, e.begin / 1000.0, (e.end - e.begin) / 1000.0, e.callNo);
+    }
+    fprintf(fp, "\n]}\n");
+    const bool ok = (fclose(fp) == 0);
+    if (ok)
+    {
+        DBG_LOG("Wrote %" PRIu64 " timeline events to %s%s\n", next - first, filename.c_str(), first ? " (older events were dropped)" : "");
+    }
+    else
+    {
+        DBG_LOG("Failed to write timeline file %s: %s\n", filename.c_str(), strerror(errno));
+    }
+    return ok;
+}
+
+}
@@ -0,0 +1,104 @@
+#ifndef _RETRACER_TIMELINE_HPP_
+#define _RETRACER_TIMELINE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace retracer {
+
+/// What each thread of the replay spends its time on, for -timeline. Events go into a ring
+/// shared by all threads, so only the most recent ones are kept, and are written out at the end
+/// as a Chrome JSON trace, which Perfetto and chrome://tracing can open. Time stamps are from
+/// the monotonic clock, the same as in systrace captures.
+class Timeline
+{
+public:
+    static const size_t DEFAULT_CAPACITY = 1 << 20; ///< events
+
+    /// Start recording. capacity is rounded up to a power of two.
+    void enable(size_t capacity = DEFAULT_CAPACITY);
+    inline bool enabled() const { return mEnabled; }
+
+    static inline uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /// Add an event that went from begin to end. Strings must outlive the timeline.
+    inline void add(const char* category, const char* name, uint64_t begin, uint64_t end, unsigned callNo = 0)
+    {
+        Event& event = mEvents[mNext.fetch_add(1, std::memory_order_relaxed) & mMask];
+        event.category = category;
+        event.name = name;
+        event.begin = begin;
+        event.end = end;
+        event.callNo = callNo;
+        event.thread = thread();
+    }
+
+    /// Name the track of the calling thread
+    void nameThread(const std::string& name);
+
+    /// Write the events as a Chrome JSON trace
+    bool write(const std::string& filename);
+
+private:
+    struct Event
+    {
+        const char* category;
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+        unsigned callNo;
+        unsigned thread;
+    };
+
+    /// Small number for the calling thread, given out in the order threads first add an event
+    inline unsigned thread()
+    {
+        static thread_local unsigned sThread = 0;
+        if (sThread == 0) sThread = mThreads.fetch_add(1, std::memory_order_relaxed) + 1;
+        return sThread;
+    }
+
+    bool mEnabled = false;
+    std::vector<Event> mEvents;
+    size_t mMask = 0;
+    std::atomic<uint64_t> mNext{0};
+    std::atomic<unsigned> mThreads{0};
+    std::mutex mNameMutex;
+    std::vector<std::pair<unsigned, std::string>> mThreadNames;
+};
+
+extern Timeline gTimeline;
+
+/// Adds its scope to gTimeline, if that is enabled
+class TimelineScope
+{
+public:
+    TimelineScope(const char* category, const char* name, unsigned callNo = 0)
+        : mCategory(category)
+        , mName(name)
+        , mCallNo(callNo)
+        , mBegin(gTimeline.enabled() ? Timeline::now() : 0)
+    {}
+
+    ~TimelineScope()
+    {
+        if (mBegin) gTimeline.add(mCategory, mName, mBegin, Timeline::now(), mCallNo);
+    }
+
+private:
+    const char* mCategory;
+    const char* mName;
+    unsigned mCallNo;
+    uint64_t mBegin;
+};
+
+}
+
+#endif
@@ -19,6 +19,7 @@
 
 #include "libcollector/interface.hpp"
 
+#include <algorithm>
 #include <sstream>
 #include <vector>
 #include <sys/stat.h>
@@ -50,7 +51,7 @@ ProgramInfoList_t TraceExecutor::mProgramInfoList;
 
 using namespace retracer;
 
-void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
+void TraceExecutor::overrideDefaultsWithJson(const Json::Value &value)
 {
     retracer::RetraceOptions& options = gRetracer.mOptions;
 
@@ -63,12 +64,41 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
     {
         options.mLoopSeconds = value["loopSeconds"].asInt();
     }
+    options.mLoopWarmup = value.get("loopWarmup", options.mLoopWarmup).asInt();
+    options.mLoopReset = value.get("loopReset", options.mLoopReset).asBool();
+    if (value.isMember("pace"))
+    {
+        options.mPaceCapture = value["pace"].isString() && value["pace"].asString() == "capture";
+        options.mPaceFps = value["pace"].isNumeric() ? value["pace"].asInt() : 0;
+    }
+    options.mPresentVsync = value.get("presentVsync", options.mPresentVsync).asBool();
+    options.mPresentTimes = value.get("presentTimes", options.mPresentTimes).asBool() || options.mPresentVsync;
+    options.mPresentFeedback = value.get("presentFeedback", options.mPresentFeedback).asBool();
     options.mCallStats = value.get("callStats", options.mCallStats).asBool();
+    options.mDrawTime = value.get("drawTime", options.mDrawTime).asBool();
+    options.mCounterPasses = value.get("counterPasses", options.mCounterPasses).asBool();
+    options.mCollectorStream = value.get("collectorStream", options.mCollectorStream).asString();
+    if (value.isMember("counterCallset"))
+    {
+        options.mCounterCallSet.reset(new common::CallSet(value["counterCallset"].asCString()));
+    }
+    options.mStageUploads = value.get("stageUploads", options.mStageUploads).asInt();
+    options.mFilterState = value.get("filterState", options.mFilterState).asBool();
+    options.mBatchUniforms = value.get("batchUniforms", options.mBatchUniforms).asBool();
+    options.mBufferPool = value.get("bufferPool", options.mBufferPool).asBool();
+    options.mSnapshotHardwareBuffers = value.get("snapshotHardwareBuffers", options.mSnapshotHardwareBuffers).asBool();
+    options.mThumbnailFile = value.get("thumbnails", options.mThumbnailFile).asString();
+    options.mThumbnailWidth = value.get("thumbnailWidth", options.mThumbnailWidth).asUInt();
+    options.mTranscodeDir = value.get("transcode", options.mTranscodeDir).asString();
+    options.mMemoryTimeline = value.get("memoryTimeline", options.mMemoryTimeline).asBool();
+    options.mTimelineFile = value.get("timeline", options.mTimelineFile).asString();
     if (options.mCallStats)
     {
         DBG_LOG("Callstats output enabled\n");
     }
 
+    options.mFramesInFlight = value.get("framesInFlight", options.mFramesInFlight).asUInt();
+    options.mShaderStats = value.get("shaderStats", options.mShaderStats).asBool();
     if (value.get("finishBeforeSwap", false).asBool())
     {
         options.mFinishBeforeSwap = true;
@@ -123,15 +153,23 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
     {
         options.mCpuMask = value.get("cpumask", "").asString();
     }
+    options.mThreadAffinity = value.get("threadAffinity", options.mThreadAffinity).asString();
 
     options.mForceSingleWindow = value.get("forceSingleWindow", options.mForceSingleWindow).asBool();
     options.mForceOffscreen = value.get("offscreen", options.mForceOffscreen).asBool();
     options.mPbufferRendering = value.get("noscreen", options.mPbufferRendering).asBool();
+    options.mHeadless = value.get("headless", options.mHeadless).asBool();
+    options.mEglDevice = value.get("device", options.mEglDevice).asInt();
+    options.mContextPriority = value.get("contextPriority", options.mContextPriority).asString();
     options.mSingleSurface = value.get("singlesurface", options.mSingleSurface).asInt();
+    options.mSurfaceAtlasWidth = value.get("surfaceAtlasWidth", options.mSurfaceAtlasWidth).asInt();
+    options.mSurfaceAtlasHeight = value.get("surfaceAtlasHeight", options.mSurfaceAtlasHeight).asInt();
     if (value.isMember("skipWork"))
     {
         options.mSkipWork = value.get("skipWork", -1).asInt();
     }
+    options.mFastSeek = value.get("fastSeek", options.mFastSeek).asBool();
+    options.mInvalidateFile = value.get("invalidate", options.mInvalidateFile).asString();
 
     options.mOverrideConfig = eglConfig;
     options.mMeasurePerFrame = value.get("measurePerFrame", false).asBool();
@@ -154,6 +192,14 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
     }
 
     options.mPreload = value.get("preload", false).asBool();
+    options.mPreloadBudget = (uint64_t)value.get("preloadBudgetMB", 0).asUInt() * 1024 * 1024;
+    options.mPreloadHugepages = value.get("preloadHugepages", false).asBool();
+    options.mCallTape = value.get("callTape", false).asBool();
+    options.mPrefetchChunks = value.get("prefetchChunks", options.mPrefetchChunks).asInt();
+    options.mPrefetchThreads = std::max(1, value.get("prefetchThreads", options.mPrefetchThreads).asInt());
+    options.mPrefetchBlobCalls = value.get("prefetchBlobs", 0).asUInt();
+    options.mPrefetchBlobSize = (uint64_t)value.get("prefetchBlobSizeKB", 64).asUInt() * 1024;
+    options.mStreamWindow = (uint64_t)value.get("streamWindowMB", 0).asUInt() * 1024 * 1024;
 
     // Values needed by CLI and GUI
     options.mSnapshotPrefix = value.get("snapshotPrefix", "").asString();
@@ -186,15 +232,37 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
     // Whether or not to upload taken snapshots.
     options.mUploadSnapshots = value.get("snapshotUpload", false).asBool();
 
+    options.mSnapshotPNG.level = value.get("snapshotLevel", options.mSnapshotPNG.level).asInt();
+    if (value.isMember("snapshotFilter") && !image::parsePNGFilter(value["snapshotFilter"].asCString(), options.mSnapshotPNG.filter))
+    {
+        gRetracer.reportAndAbort("Unknown snapshotFilter %s", value["snapshotFilter"].asCString());
+    }
+    options.mSnapshotPNG.threads = std::max(1, value.get("snapshotThreads", 1).asInt());
+    options.mSnapshotQOI = value.get("snapshotQOI", false).asBool();
+    options.mSnapshotCompare = value.get("snapshotCompare", "").asString();
+    const int tolerance = value.get("snapshotTolerance", 0).asInt();
+    if (tolerance < 0 || tolerance > 255)
+    {
+        gRetracer.reportAndAbort("Invalid snapshotTolerance %d", tolerance);
+    }
+    options.mSnapshotTolerance = tolerance;
+    options.mSnapshotHash = value.get("snapshotHash", "").asString();
+    options.mSnapshotHashReference = value.get("snapshotHashReference", "").asString();
+    options.mSnapshotHashDistance = std::max(0, value.get("snapshotHashDistance", 0).asInt());
+
     if (value.isMember("snapshotCallset")) {
         DBG_LOG("snapshotCallset = %s\n", value.get("snapshotCallset", "").asCString());
-        delete options.mSnapshotCallSet;
-        options.mSnapshotCallSet = new common::CallSet( value.get("snapshotCallset", "").asCString() );
+        options.mSnapshotCallSet.reset(new common::CallSet( value.get("snapshotCallset", "").asCString() ));
     }
 
     options.mStateLogging = value.get("statelog", false).asBool();
     stateLoggingEnabled = value.get("drawlog", false).asBool();
     options.mDebug = (int)value.get("debug", false).asBool();
+    options.mDebugSync = value.get("debugSync", false).asBool();
+    if (options.mDebugSync && !options.mDebug)
+    {
+        options.mDebug = 1;
+    }
     if (options.mDebug)
     {
         DBG_LOG("Debug mode enabled.\n");
@@ -218,11 +286,17 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
         options.mOnscrSampleNumX = 1;
         options.mOnscrSampleNumY = 1;
     }
+    options.mOffscreenRing = value.get("offscreenRing", options.mOffscreenRing).asInt();
 
     if (value.get("multithread", false).asBool())
     {
         options.mMultiThread = true;
     }
+    if (value.get("collapseThreads", false).asBool())
+    {
+        options.mMultiThread = true;
+        options.mCollapseThreads = true;
+    }
 
     if (value.isMember("instrumentation"))
     {
@@ -233,12 +307,14 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
             Json::Value emptyDict;
             legacy[v.asString()] = emptyDict;
         }
+        delete gRetracer.mCollectors; // from the previous trace of a batch
         gRetracer.mCollectors = new Collection(legacy);
         gRetracer.mCollectors->initialize();
     }
 
     if (value.isMember("collectors"))
     {
+        delete gRetracer.mCollectors;
         gRetracer.mCollectors = new Collection(value["collectors"]);
         gRetracer.mCollectors->initialize();
         DBG_LOG("libcollector instrumentation enabled through JSON.\n");
@@ -262,6 +338,14 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
     {
         options.mShaderCacheRequired = value.get("strictShaderCache", false).asBool();
     }
+    if (value.isMember("embeddedProgramBinaries"))
+    {
+        options.mEmbeddedProgramBinaries = value.get("embeddedProgramBinaries", true).asBool();
+    }
+    if (value.isMember("parallelShaderCompile"))
+    {
+        options.mParallelShaderCompile = value.get("parallelShaderCompile", false).asBool();
+    }
 
     DBG_LOG("Thread: %d - override: %s (%d, %d)\n",
             options.mRetraceTid, options.mDoOverrideResolution ? "Yes" : "No", options.mOverrideResW, options.mOverrideResH);
@@ -294,6 +378,16 @@ void TraceExecutor::initFromJson(const std::string& json_data, const std::string
     {
         gRetracer.reportAndAbort("JSON parse error: %s\n", reader.getFormattedErrorMessages().c_str());
     }
+    initFromJson(value, trace_dir, result_file);
+}
+
+/**
+ Inits the global retracer object from parameters that have already been parsed, such as an
+ entry of a -jsonBatch list.
+ */
+void TraceExecutor::initFromJson(const Json::Value& value, const std::string& trace_dir, const std::string& result_file)
+{
+    mResultFile = result_file;
 
     // A path is absolute if
     // -on Unix, it begins with a slash
@@ -427,9 +521,10 @@ void TraceExecutor::clearError()
     mErrorList.clear();
 }
 
-bool TraceExecutor::writeData(Json::Value result_data_value, int frames, float duration)
+bool TraceExecutor::writeData(Json::Value result_data_value, int frames, float duration, const common::JsonColumns* columns)
 {
     Json::Value result_value;
+    bool hasResult = false;
     if (!mErrorList.empty())
     {
         Json::Value error_list_value;
@@ -446,7 +541,7 @@ bool TraceExecutor::writeData(Json::Value result_data_value, int frames, float d
     }
     else if (frames > 0 || duration > 0.0f)
     {
-        Json::Value result_list_value;
+        hasResult = true;
         if (gRetracer.mCollectors)
         {
             result_data_value["frame_data"] = gRetracer.mCollectors->results();
@@ -555,15 +650,8 @@ bool TraceExecutor::writeData(Json::Value result_data_value, int frames, float d
             fb_config["stencilBits"] = info.stencil;
         }
         result_data_value["fb_config"] = fb_config;
-
-        // Add to result list
-        result_list_value.append(result_data_value);
-        result_value["result"] = result_list_value;
     }
 
-    Json::StyledWriter writer;
-    std::string data = writer.write(result_value);
-
 #ifdef ANDROID
     std::string outputfile = "/sdcard/results.json";
 #else
@@ -579,17 +667,25 @@ bool TraceExecutor::writeData(Json::Value result_data_value, int frames, float d
         DBG_LOG("Failed to open output JSON %s: %s\n", outputfile.c_str(), strerror(errno));
         return false;
     }
-    size_t written;
-    int err = 0;
-    do
+    // Streamed to the file rather than made into one string first, since per-frame and per-draw
+    // results can be hundreds of megabytes
+    common::JsonStream stream(fp);
+    if (hasResult)
     {
-        clearerr(fp);
-        written = fwrite(data.c_str(), data.size(), 1, fp);
-        err = ferror(fp);
-    } while (!written && (err == EAGAIN || err == EWOULDBLOCK || err == EINTR));
-    if (err)
+        stream.beginObject();
+        stream.key("result");
+        stream.beginArray();
+        stream.value(result_data_value, columns);
+        stream.endArray();
+        stream.endObject();
+    }
+    else
+    {
+        stream.value(result_value);
+    }
+    if (!stream.flush())
     {
-        DBG_LOG("Failed to write output JSON: %s\n", strerror(err));
+        DBG_LOG("Failed to write output JSON: %s\n", strerror(errno));
     }
     fsync(fileno(fp));
     fclose(fp);
@@ -1,6 +1,7 @@
 #ifndef _TRACE_EXECUTOR_HPP_
 #define _TRACE_EXECUTOR_HPP_
 
+#include "common/json_stream.hpp"
 #include "jsoncpp/include/json/value.h"
 #include "helper/states.h"
 
@@ -79,9 +80,11 @@ class TraceExecutor{
 
     public:
         static void initFromJson(const std::string& json_data, const std::string& trace_dir, const std::string& result_file);
+        static void initFromJson(const Json::Value& value, const std::string& trace_dir, const std::string& result_file);
         static void addError(TraceExecutorErrorCode code, const std::string &error_description = std::string());
         static void writeError(TraceExecutorErrorCode code, const std::string &error_description = std::string());
-        static bool writeData(Json::Value result_data_value, int frames, float duration);
+        /// Write the result file, with result_data_value as the result and the given columns in it
+        static bool writeData(Json::Value result_data_value, int frames, float duration, const common::JsonColumns* columns = nullptr);
         static void clearResult();
         static void clearError();
         static bool isSetup();
@@ -113,7 +116,7 @@ class TraceExecutor{
 
         static ProgramInfoList_t mProgramInfoList;
 
-        static void overrideDefaultsWithJson(Json::Value &value);
+        static void overrideDefaultsWithJson(const Json::Value &value);
 };
 
 #endif
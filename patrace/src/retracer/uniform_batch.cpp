@@ -0,0 +1,135 @@
+#include "retracer/uniform_batch.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "common/os_time.hpp"
+
+#include <string.h>
+
+namespace retracer {
+
+void UniformBatch::add(Kind kind, GLuint program, GLint location, GLsizei count, GLboolean transpose, const void* values, size_t size)
+{
+    mCalls++;
+    if (!values || size == 0)
+    {
+        return; // nothing to set
+    }
+    mOverlapping = mOverlapping || count > 1;
+    const uint64_t key = ((uint64_t)program << 32) | (uint32_t)location;
+    if (!mOverlapping)
+    {
+        const auto it = mLatest.find(key);
+        if (it != mLatest.end())
+        {
+            Entry& e = mEntries[it->second];
+            if (e.kind == kind && e.size == size)
+            {
+                e.transpose = transpose;
+                memcpy(mData.data() + e.offset, values, size);
+                return;
+            }
+        }
+    }
+    mLatest[key] = mEntries.size();
+    mEntries.push_back({ kind, program, location, count, transpose, (uint32_t)mData.size(), (uint32_t)size });
+    mData.insert(mData.end(), static_cast<const char*>(values), static_cast<const char*>(values) + size);
+}
+
+void UniformBatch::flush()
+{
+    if (mEntries.empty())
+    {
+        return;
+    }
+    const int64_t begin = os::getTime();
+    for (const Entry& e : mEntries)
+    {
+        const void* v = mData.data() + e.offset;
+        const GLfloat* f = static_cast<const GLfloat*>(v);
+        const GLint* i = static_cast<const GLint*>(v);
+        const GLuint* u = static_cast<const GLuint*>(v);
+        if (e.program == 0)
+        {
+            switch (e.kind)
+            {
+            case FLOAT1: _glUniform1fv(e.location, e.count, f); break;
+            case FLOAT2: _glUniform2fv(e.location, e.count, f); break;
+            case FLOAT3: _glUniform3fv(e.location, e.count, f); break;
+            case FLOAT4: _glUniform4fv(e.location, e.count, f); break;
+            case INT1: _glUniform1iv(e.location, e.count, i); break;
+            case INT2: _glUniform2iv(e.location, e.count, i); break;
+            case INT3: _glUniform3iv(e.location, e.count, i); break;
+            case INT4: _glUniform4iv(e.location, e.count, i); break;
+            case UINT1: _glUniform1uiv(e.location, e.count, u); break;
+            case UINT2: _glUniform2uiv(e.location, e.count, u); break;
+            case UINT3: _glUniform3uiv(e.location, e.count, u); break;
+            case UINT4: _glUniform4uiv(e.location, e.count, u); break;
+            case MAT2: _glUniformMatrix2fv(e.location, e.count, e.transpose, f); break;
+            case MAT3: _glUniformMatrix3fv(e.location, e.count, e.transpose, f); break;
+            case MAT4: _glUniformMatrix4fv(e.location, e.count, e.transpose, f); break;
+            case MAT2X3: _glUniformMatrix2x3fv(e.location, e.count, e.transpose, f); break;
+            case MAT3X2: _glUniformMatrix3x2fv(e.location, e.count, e.transpose, f); break;
+            case MAT2X4: _glUniformMatrix2x4fv(e.location, e.count, e.transpose, f); break;
+            case MAT4X2: _glUniformMatrix4x2fv(e.location, e.count, e.transpose, f); break;
+            case MAT3X4: _glUniformMatrix3x4fv(e.location, e.count, e.transpose, f); break;
+            case MAT4X3: _glUniformMatrix4x3fv(e.location, e.count, e.transpose, f); break;
+            }
+        }
+        else
+        {
+            switch (e.kind)
+            {
+            case FLOAT1: _glProgramUniform1fv(e.program, e.location, e.count, f); break;
+            case FLOAT2: _glProgramUniform2fv(e.program, e.location, e.count, f); break;
+            case FLOAT3: _glProgramUniform3fv(e.program, e.location, e.count, f); break;
+            case FLOAT4: _glProgramUniform4fv(e.program, e.location, e.count, f); break;
+            case INT1: _glProgramUniform1iv(e.program, e.location, e.count, i); break;
+            case INT2: _glProgramUniform2iv(e.program, e.location, e.count, i); break;
+            case INT3: _glProgramUniform3iv(e.program, e.location, e.count, i); break;
+            case INT4: _glProgramUniform4iv(e.program, e.location, e.count, i); break;
+            case UINT1: _glProgramUniform1uiv(e.program, e.location, e.count, u); break;
+            case UINT2: _glProgramUniform2uiv(e.program, e.location, e.count, u); break;
+            case UINT3: _glProgramUniform3uiv(e.program, e.location, e.count, u); break;
+            case UINT4: _glProgramUniform4uiv(e.program, e.location, e.count, u); break;
+            case MAT2: _glProgramUniformMatrix2fv(e.program, e.location, e.count, e.transpose, f); break;
+            case MAT3: _glProgramUniformMatrix3fv(e.program, e.location, e.count, e.transpose, f); break;
+            case MAT4: _glProgramUniformMatrix4fv(e.program, e.location, e.count, e.transpose, f); break;
+            case MAT2X3: _glProgramUniformMatrix2x3fv(e.program, e.location, e.count, e.transpose, f); break;
+            case MAT3X2: _glProgramUniformMatrix3x2fv(e.program, e.location, e.count, e.transpose, f); break;
+            case MAT2X4: _glProgramUniformMatrix2x4fv(e.program, e.location, e.count, e.transpose, f); break;
+            case MAT4X2: _glProgramUniformMatrix4x2fv(e.program, e.location, e.count, e.transpose, f); break;
+            case MAT3X4: _glProgramUniformMatrix3x4fv(e.program, e.location, e.count, e.transpose, f); break;
+            case MAT4X3: _glProgramUniformMatrix4x3fv(e.program, e.location, e.count, e.transpose, f); break;
+            }
+        }
+    }
+    mTime += os::getTime() - begin;
+    mApplied += mEntries.size();
+    mRuns++;
+    clear();
+}
+
+void UniformBatch::clear()
+{
+    mEntries.clear();
+    mData.clear();
+    mLatest.clear();
+    mOverlapping = false;
+}
+
+void UniformBatch::store(Json::Value& result) const
+{
+    if (mCalls == 0)
+    {
+        return;
+    }
+    Json::Value v;
+    v["calls"] = (Json::Value::UInt64)mCalls;
+    v["applied"] = (Json::Value::UInt64)mApplied;
+    v["runs"] = (Json::Value::UInt64)mRuns;
+    v["apply_time"] = (double)mTime / os::timeFrequency;
+    result["uniform_batch"] = v;
+}
+
+}
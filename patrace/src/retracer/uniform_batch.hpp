@@ -0,0 +1,72 @@
+#ifndef _RETRACER_UNIFORM_BATCH_HPP_
+#define _RETRACER_UNIFORM_BATCH_HPP_
+
+#include "dispatch/eglimports.hpp"
+#include "jsoncpp/include/json/value.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace retracer {
+
+/// Collects the glUniform* and glProgramUniform* calls between other calls for -batchuniforms,
+/// and applies each run of them at once before the next other call, such as the draw they are
+/// for. The values are copied into one array as they come, a later call for the same location
+/// replaces an earlier one, and the run is then dispatched in a single loop, always through the
+/// vector form of the call. Comparing a run with and without it tells how much of a CPU bound
+/// frame goes to uniform calls.
+///
+/// Calls with count > 1 may overlap the locations of other calls, so a run that has any of them
+/// keeps every call in order.
+class UniformBatch
+{
+public:
+    enum Kind
+    {
+        FLOAT1, FLOAT2, FLOAT3, FLOAT4,
+        INT1, INT2, INT3, INT4,
+        UINT1, UINT2, UINT3, UINT4,
+        MAT2, MAT3, MAT4, MAT2X3, MAT3X2, MAT2X4, MAT4X2, MAT3X4, MAT4X3,
+    };
+
+    /// A uniform call, program being 0 for glUniform* calls, which set the current program.
+    /// Locations are those of the replay.
+    void add(Kind kind, GLuint program, GLint location, GLsizei count, GLboolean transpose, const void* values, size_t size);
+    /// Apply the calls added since the last flush
+    void flush();
+    bool empty() const { return mEntries.empty(); }
+    /// Drop the calls added since the last flush, when there is nothing left to apply them to
+    void clear();
+
+    /// Add the number of calls, the number applied and the time spent applying them as
+    /// "uniform_batch" to the result JSON
+    void store(Json::Value& result) const;
+
+private:
+    struct Entry
+    {
+        Kind kind;
+        GLuint program;
+        GLint location;
+        GLsizei count;
+        GLboolean transpose;
+        uint32_t offset; ///< of the values in mData
+        uint32_t size;
+    };
+
+    std::vector<Entry> mEntries;
+    std::vector<char> mData;
+    std::unordered_map<uint64_t, size_t> mLatest; ///< entry by program and location
+    bool mOverlapping = false; ///< an entry has count > 1
+
+    uint64_t mCalls = 0;
+    uint64_t mApplied = 0;
+    uint64_t mRuns = 0;
+    int64_t mTime = 0; ///< spent applying them, in os::getTime() units
+};
+
+}
+
+#endif
@@ -0,0 +1,221 @@
+#include "retracer/upload_ring.hpp"
+
+#include "dispatch/eglproc_auto.hpp"
+
+#include "retracer/retracer.hpp"
+
+#include "common/gl_extension_supported.hpp"
+#include "common/os.hpp"
+
+#include <string.h>
+
+namespace retracer {
+
+void UploadRing::setCapacity(GLsizeiptr capacity)
+{
+    mCapacity = capacity - capacity % ALIGNMENT;
+}
+
+bool UploadRing::ready()
+{
+    Context* context = gRetracer.mState.mThreadArr[gRetracer.getCurTid()].getContext();
+    if (mCapacity == 0 || !context)
+    {
+        return false;
+    }
+    if (context == mContext)
+    {
+        return mSupported;
+    }
+    if (mContext)
+    {
+        DBG_LOG("Upload ring of another context is still in use, dropping it\n");
+        mRegions.clear();
+        mBuffer = 0;
+        mMapped = nullptr;
+    }
+    mContext = context;
+    mHead = 0;
+    mSupported = (gRetracer.mOptions.mApiVersion >= PROFILE_ES3); // for glCopyBufferSubData and unpack buffers
+    if (!mSupported)
+    {
+        DBG_LOG("Uploads are only staged in GLES3 contexts\n");
+        return false;
+    }
+
+    GLint oldBuffer = 0;
+    _glGetIntegerv(GL_COPY_READ_BUFFER_BINDING, &oldBuffer);
+    _glGenBuffers(1, &mBuffer);
+    _glBindBuffer(GL_COPY_READ_BUFFER, mBuffer);
+    if (isGlesExtensionSupported("GL_EXT_buffer_storage"))
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+        _glBufferStorageEXT(GL_COPY_READ_BUFFER, mCapacity, NULL, flags);
+        mMapped = static_cast<char*>(_glMapBufferRange(GL_COPY_READ_BUFFER, 0, mCapacity, flags));
+        if (!mMapped)
+        {
+            DBG_LOG("Failed to map the upload ring persistently, mapping it for each upload instead\n");
+            _glDeleteBuffers(1, &mBuffer); // its storage cannot be changed
+            _glGenBuffers(1, &mBuffer);
+            _glBindBuffer(GL_COPY_READ_BUFFER, mBuffer);
+        }
+    }
+    if (!mMapped)
+    {
+        _glBufferData(GL_COPY_READ_BUFFER, mCapacity, NULL, GL_STREAM_DRAW);
+    }
+    _glBindBuffer(GL_COPY_READ_BUFFER, oldBuffer);
+    DBG_LOG("Staging uploads of %ld bytes or more through a %ld MB ring%s\n", (long)MIN_SIZE, (long)(mCapacity >> 20), mMapped ? ", persistently mapped" : "");
+    return true;
+}
+
+bool UploadRing::write(GLenum target, const GLvoid* data, GLsizeiptr size, GLintptr& offset)
+{
+    if (size > mCapacity / 2)
+    {
+        return false;
+    }
+    uint64_t begin = (mHead + ALIGNMENT - 1) & ~(uint64_t)(ALIGNMENT - 1);
+    if (begin % mCapacity + size > (uint64_t)mCapacity)
+    {
+        begin += mCapacity - begin % mCapacity; // does not fit before the end, start over at the beginning
+    }
+    const uint64_t end = begin + size;
+
+    // Uploads still in the part of the ring this one goes into must be done first
+    bool waited = false;
+    while (!mRegions.empty() && mRegions.front().begin + mCapacity < end)
+    {
+        GLsync fence = mRegions.front().fence;
+        GLenum result = _glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        waited = waited || (result == GL_TIMEOUT_EXPIRED);
+        while (result == GL_TIMEOUT_EXPIRED)
+        {
+            result = _glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100 * 1000 * 1000);
+        }
+        _glDeleteSync(fence);
+        mRegions.pop_front();
+    }
+    mWaits += waited;
+
+    offset = begin % mCapacity;
+    if (mMapped)
+    {
+        memcpy(mMapped + offset, data, size);
+    }
+    else
+    {
+        void* ptr = _glMapBufferRange(target, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!ptr)
+        {
+            return false;
+        }
+        memcpy(ptr, data, size);
+        _glUnmapBuffer(target);
+    }
+    const Region region = { begin, end, 0 };
+    mRegions.push_back(region);
+    mHead = end;
+    mUploads++;
+    mBytes += size;
+    return true;
+}
+
+void UploadRing::fence()
+{
+    mRegions.back().fence = _glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool UploadRing::bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage)
+{
+    if (!data || size < MIN_SIZE || target == GL_COPY_READ_BUFFER || !ready())
+    {
+        return false;
+    }
+    GLint oldBuffer = 0;
+    _glGetIntegerv(GL_COPY_READ_BUFFER_BINDING, &oldBuffer);
+    _glBindBuffer(GL_COPY_READ_BUFFER, mBuffer);
+    GLintptr offset = 0;
+    const bool staged = write(GL_COPY_READ_BUFFER, data, size, offset);
+    if (staged)
+    {
+        _glBufferData(target, size, NULL, usage);
+        _glCopyBufferSubData(GL_COPY_READ_BUFFER, target, offset, 0, size);
+        fence();
+    }
+    _glBindBuffer(GL_COPY_READ_BUFFER, oldBuffer);
+    return staged;
+}
+
+bool UploadRing::bufferSubData(GLenum target, GLintptr dstOffset, GLsizeiptr size, const GLvoid* data)
+{
+    if (!data || size < MIN_SIZE || target == GL_COPY_READ_BUFFER || !ready())
+    {
+        return false;
+    }
+    GLint oldBuffer = 0;
+    _glGetIntegerv(GL_COPY_READ_BUFFER_BINDING, &oldBuffer);
+    _glBindBuffer(GL_COPY_READ_BUFFER, mBuffer);
+    GLintptr offset = 0;
+    const bool staged = write(GL_COPY_READ_BUFFER, data, size, offset);
+    if (staged)
+    {
+        _glCopyBufferSubData(GL_COPY_READ_BUFFER, target, offset, dstOffset, size);
+        fence();
+    }
+    _glBindBuffer(GL_COPY_READ_BUFFER, oldBuffer);
+    return staged;
+}
+
+const GLvoid* UploadRing::beginPixels(const GLvoid* pixels, GLsizeiptr size)
+{
+    if (!pixels || size < MIN_SIZE || !ready())
+    {
+        return pixels;
+    }
+    // The pixels come from the trace only when no unpack buffer was bound when it was made
+    _glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer);
+    GLintptr offset = 0;
+    if (!write(GL_PIXEL_UNPACK_BUFFER, pixels, size, offset))
+    {
+        _glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return pixels;
+    }
+    return reinterpret_cast<const GLvoid*>(static_cast<uintptr_t>(offset));
+}
+
+void UploadRing::endPixels()
+{
+    fence();
+    _glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void UploadRing::flush()
+{
+    if (!mContext)
+    {
+        return;
+    }
+    for (const Region& region : mRegions)
+    {
+        _glDeleteSync(region.fence); // deleting does not wait, but nothing will read the ring anymore
+    }
+    mRegions.clear();
+    if (mBuffer)
+    {
+        _glDeleteBuffers(1, &mBuffer); // unmaps it as well
+    }
+    if (mUploads)
+    {
+        DBG_LOG("Staged %u uploads, %.1f MB, %u of them waited for the GPU to free ring space\n", mUploads, mBytes / (1024.0 * 1024.0), mWaits);
+    }
+    mBuffer = 0;
+    mMapped = nullptr;
+    mContext = nullptr;
+    mHead = 0;
+    mUploads = 0;
+    mBytes = 0;
+    mWaits = 0;
+}
+
+}
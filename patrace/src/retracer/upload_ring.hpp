@@ -0,0 +1,74 @@
+#ifndef _RETRACER_UPLOAD_RING_HPP_
+#define _RETRACER_UPLOAD_RING_HPP_
+
+#include "dispatch/eglimports.hpp"
+
+#include <deque>
+#include <stdint.h>
+
+namespace retracer {
+
+class Context;
+
+/// Stages large buffer and texture uploads for -stageuploads, so the driver does not have to
+/// copy them out of the trace data before the call returns. The data is written into a ring
+/// buffer, persistently mapped with GL_EXT_buffer_storage where it is available and mapped
+/// unsynchronized for each upload otherwise, and then copied on the GPU with
+/// glCopyBufferSubData, or read from the ring as a pixel unpack buffer. A fence behind each
+/// upload tells when its part of the ring can be written again.
+///
+/// The ring is not shared between contexts, so flush() must be called before the current
+/// context changes.
+class UploadRing
+{
+public:
+    static const GLsizeiptr MIN_SIZE = 64 * 1024; ///< smaller uploads are not worth staging
+    static const GLsizeiptr ALIGNMENT = 256;
+
+    /// Size of the ring in bytes, where zero turns staging off
+    void setCapacity(GLsizeiptr capacity);
+
+    /// Stage glBufferData and glBufferSubData. They return false when the call has to be made
+    /// as usual.
+    bool bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage);
+    bool bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data);
+
+    /// Stage the pixels of a texture upload of size bytes, and bind the ring as the pixel
+    /// unpack buffer. Returns the offset to pass in place of the pixels, or the pixels themselves
+    /// if they are not staged. If they are, endPixels() must follow the call.
+    const GLvoid* beginPixels(const GLvoid* pixels, GLsizeiptr size);
+    void endPixels();
+
+    /// Wait for all uploads and free the ring, while its context is still current
+    void flush();
+
+private:
+    struct Region
+    {
+        uint64_t begin; ///< counting from when the ring was created, not wrapping around
+        uint64_t end;
+        GLsync fence;
+    };
+
+    /// Write data into the ring, which is bound to target, and return its offset there
+    bool write(GLenum target, const GLvoid* data, GLsizeiptr size, GLintptr& offset);
+    /// Behind the call that reads the data just written
+    void fence();
+    bool ready();
+
+    GLsizeiptr mCapacity = 0;
+    Context* mContext = nullptr;
+    bool mSupported = false;
+    GLuint mBuffer = 0;
+    char* mMapped = nullptr; ///< persistent mapping, if there is one
+    uint64_t mHead = 0;
+    std::deque<Region> mRegions;
+
+    unsigned mUploads = 0;
+    uint64_t mBytes = 0;
+    unsigned mWaits = 0; ///< uploads that had to wait for the GPU to be done with the ring
+};
+
+}
+
+#endif
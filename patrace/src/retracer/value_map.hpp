@@ -5,7 +5,11 @@
 #ifndef _WIN32
 #include <unistd.h>
 #endif
+#include <algorithm>
+#include <stdint.h>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace retracer {
 
@@ -20,12 +24,7 @@ public:
 
     inline V& LValue(const K& key)
     {
-        const auto it = mMap.find(key);
-        if (it == mMap.end())
-        {
-            mMap.insert(std::pair<K, V>(key, mNull));
-        }
-        return mMap.at(key);
+        return mMap.emplace(key, mNull).first->second;
     }
 
     inline V& RValue(const K& key)
@@ -46,6 +45,112 @@ private:
     V mNull;
 };
 
+// Open addressing map from and to unsigned integers, with linear probing. There are no
+// removals, and key 0 marks a free slot so it cannot be stored.
+template <class T>
+class flatmap {
+public:
+    flatmap() : mCount(0), mShift(64) {}
+
+    inline T& LValue(const T& key)
+    {
+        if ((mCount + 1) * 2 > mSlots.size())
+            grow();
+        Slot& slot = mSlots[find(key)];
+        if (slot.key == 0)
+        {
+            slot.key = key;
+            mCount++;
+        }
+        return slot.value;
+    }
+
+    /// NULL if the key is not in the map
+    inline T* Find(const T& key)
+    {
+        if (mSlots.empty())
+            return NULL;
+        Slot& slot = mSlots[find(key)];
+        return slot.key == key ? &slot.value : NULL;
+    }
+
+    template <class F>
+    void ForEach(F f) const
+    {
+        for (const Slot& slot : mSlots)
+        {
+            if (slot.key != 0)
+                f(slot.key, slot.value);
+        }
+    }
+
+    /// For walking the slots in order without a callback; free slots have key 0
+    size_t SlotCount() const { return mSlots.size(); }
+    std::pair<T, T> SlotAt(size_t i) const { return std::make_pair(mSlots[i].key, mSlots[i].value); }
+
+    /// Make room for the given number of keys, so they can be added without growing the map
+    void Reserve(size_t count)
+    {
+        size_t size = 64;
+        while ((count + 1) * 2 > size)
+            size *= 2;
+        if (size > mSlots.size())
+            rehash(size);
+    }
+
+    /// Number of keys with a non-zero value
+    size_t Count() const
+    {
+        size_t count = 0;
+        for (const Slot& slot : mSlots)
+        {
+            if (slot.key != 0 && slot.value != 0)
+                count++;
+        }
+        return count;
+    }
+
+private:
+    struct Slot
+    {
+        T key;
+        T value;
+    };
+
+    inline size_t find(const T& key) const
+    {
+        // Fibonacci hashing, which spreads both sequential and strided names over the slots
+        const size_t mask = mSlots.size() - 1;
+        size_t i = (size_t)(((uint64_t)key * 0x9e3779b97f4a7c15ull) >> mShift);
+        while (mSlots[i].key != 0 && mSlots[i].key != key)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void grow()
+    {
+        rehash(std::max<size_t>(64, mSlots.size() * 2));
+    }
+
+    void rehash(size_t size)
+    {
+        std::vector<Slot> old(size, Slot{0, 0});
+        old.swap(mSlots);
+        mShift = 64;
+        for (size_t size = mSlots.size(); size > 1; size >>= 1)
+            mShift--;
+        for (const Slot& slot : old)
+        {
+            if (slot.key != 0)
+                mSlots[find(slot.key)] = slot;
+        }
+    }
+
+    std::vector<Slot> mSlots;
+    size_t mCount;
+    int mShift; // 64 - log2(slots)
+};
+
 template <class T>
 class hmap {
 private:
@@ -53,10 +158,12 @@ private:
     // map for small keys (< KEY_LIMIT)
     T *mpData;
     // map for large keys (>= KEY_LIMIT)
-    std::unordered_map<T, T> mMap;
+    flatmap<T> mMap;
 
     unsigned int mSize;
     T mNull;
+    // a bit for each small key that LValue() was called for, so iterating skips the others
+    std::vector<uint64_t> mWritten;
 
 public:
     hmap():mpData(NULL), mSize(0)
@@ -70,19 +177,48 @@ public:
         delete [] mpData;
     }
 
-    std::unordered_map<T, T> GetCopy()
+    /// Iterates the keys with a non-zero value as (key, value) pairs, without copying the map.
+    /// Values may be changed through RValue() while iterating, but no keys may be added.
+    class const_iterator
     {
-        std::unordered_map<T, T> newMap = mMap;
-
-        for(size_t i = 0; i < mSize; i++)
+    public:
+        std::pair<T, T> operator*() const
         {
-            if (mpData[i] != 0)
-            {
-                newMap[i] = mpData[i];
-            }
+            if (mPos < mOwner->mSize)
+                return std::make_pair((T)mPos, mOwner->mpData[mPos]);
+            return mOwner->mMap.SlotAt(mPos - mOwner->mSize);
         }
+        const_iterator& operator++() { mPos = mOwner->next(mPos + 1); return *this; }
+        bool operator==(const const_iterator& other) const { return mPos == other.mPos; }
+        bool operator!=(const const_iterator& other) const { return mPos != other.mPos; }
+
+    private:
+        friend class hmap;
+        const_iterator(const hmap* owner, size_t pos) : mOwner(owner), mPos(pos) {}
+
+        const hmap* mOwner;
+        size_t mPos; // small key, or mSize plus the slot of a large key
+    };
+
+    const_iterator begin() const { return const_iterator(this, next(0)); }
+    const_iterator end() const { return const_iterator(this, mSize + mMap.SlotCount()); }
+
+    /// Number of keys with a non-zero value, which are the live names since deleting zeroes them
+    size_t Count() const
+    {
+        size_t count = 0;
+        for (const_iterator it = begin(); it != end(); ++it)
+            count++;
+        return count;
+    }
 
-        return newMap;
+    /// Make room for keys up to maxKey, count of them in all, so that adding them does not
+    /// reallocate the array or grow the map for large keys
+    void Reserve(unsigned int maxKey, size_t count)
+    {
+        resize(std::min(maxKey, KEY_LIMIT - 1));
+        if (maxKey >= KEY_LIMIT)
+            mMap.Reserve(count);
     }
 
     inline T& LValue(const T& key)
@@ -90,34 +226,29 @@ public:
         if (key < KEY_LIMIT) {
             if (((unsigned int)key) >= mSize)
                 resize(key);
+            mWritten[key >> 6] |= 1ull << (key & 63);
             return mpData[key];
         }
         //DBG_LOG("Map index (%u) larger than KEY_LIMIT, using map instead of array.\n", (unsigned)key);
-        const auto it = mMap.find(key);
-        if (it == mMap.end())
-        {
-            mMap.insert(std::pair<T, T>(key, mNull));
-        }
-        return mMap.at(key);
+        return mMap.LValue(key);
     }
 
+    /// Inlined into every generated retrace function for the small names that almost all
+    /// lookups are for, with the rest out of line
     inline T& RValue(const T& key)
     {
-        if (key < KEY_LIMIT) {
-            if (((unsigned int)key) >= mSize)
-                return mNull;
+        if (likely(key < KEY_LIMIT && ((unsigned int)key) < mSize))
             return mpData[key];
-        }
-        //DBG_LOG("Map index (%u) larger than KEY_LIMIT, using map instead of array.\n", (unsigned)key);
-        const auto it = mMap.find(key);
-        if (it == mMap.end())
-        {
+        return RValueSlow(key);
+    }
+
+    __attribute__ ((noinline)) T& RValueSlow(const T& key)
+    {
+        if (key < KEY_LIMIT)
             return mNull;
-        }
-        else
-        {
-            return it->second;
-        }
+        //DBG_LOG("Map index (%u) larger than KEY_LIMIT, using map instead of array.\n", (unsigned)key);
+        T* value = mMap.Find(key);
+        return value ? *value : mNull;
     }
 
     void resize(unsigned int sz)
@@ -139,6 +270,33 @@ public:
         delete [] mpData;
         mpData = newData;
         mSize = newSz;
+        mWritten.resize(mSize / 64, 0);
+    }
+
+private:
+    /// Position of the first live entry at or after pos, see const_iterator
+    size_t next(size_t pos) const
+    {
+        // Only small keys that were ever written can be non-zero, so words of the bitmap
+        // without any are skipped whole
+        for (size_t word = pos / 64; pos < mSize; word++, pos = word * 64)
+        {
+            uint64_t bits = mWritten[word] & (~0ull << (pos & 63));
+            while (bits)
+            {
+                const size_t key = word * 64 + __builtin_ctzll(bits);
+                if (mpData[key] != 0)
+                    return key;
+                bits &= bits - 1;
+            }
+        }
+        for (size_t slot = pos - mSize; slot < mMap.SlotCount(); slot++)
+        {
+            const std::pair<T, T> entry = mMap.SlotAt(slot);
+            if (entry.first != 0 && entry.second != 0)
+                return mSize + slot;
+        }
+        return mSize + mMap.SlotCount();
     }
 };
 
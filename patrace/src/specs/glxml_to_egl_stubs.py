@@ -63,6 +63,62 @@ def GlFunction(*args, **kwargs):
     kwargs.setdefault('call', 'GL_APIENTRY')
     return gltypes.Function(*args, **kwargs)
 
+# Like the GLES stubs, these answer like a driver that succeeds at everything, with one
+# config and dummy handles, so that paretrace gets through its EGL setup.
+special_bodies = {
+    'eglGetDisplay': '''
+    return (EGLDisplay)1;''',
+    'eglGetPlatformDisplay': '''
+    return (EGLDisplay)1;''',
+    'eglInitialize': '''
+    if (major) *major = 1;
+    if (minor) *minor = 5;
+    return EGL_TRUE;''',
+    'eglGetConfigs': '''
+    if (configs && config_size > 0) configs[0] = (EGLConfig)1;
+    if (num_config) *num_config = 1;
+    return EGL_TRUE;''',
+    'eglChooseConfig': '''
+    if (configs && config_size > 0) configs[0] = (EGLConfig)1;
+    if (num_config) *num_config = 1;
+    return EGL_TRUE;''',
+    'eglGetConfigAttrib': '''
+    switch (attribute)
+    {
+    case EGL_RED_SIZE: case EGL_GREEN_SIZE: case EGL_BLUE_SIZE: case EGL_ALPHA_SIZE: case EGL_STENCIL_SIZE: *value = 8; break;
+    case EGL_DEPTH_SIZE: *value = 24; break;
+    case EGL_CONFIG_ID: *value = 1; break;
+    case EGL_SURFACE_TYPE: *value = EGL_WINDOW_BIT | EGL_PBUFFER_BIT; break;
+    case EGL_RENDERABLE_TYPE: *value = EGL_OPENGL_ES2_BIT | 0x40; break; // EGL_OPENGL_ES3_BIT
+    default: *value = 0; break;
+    }
+    return EGL_TRUE;''',
+    'eglQuerySurface': '''
+    *value = (attribute == EGL_WIDTH || attribute == EGL_HEIGHT) ? 64 : 0;
+    return EGL_TRUE;''',
+    'eglQueryString': '''
+    return name == EGL_VERSION ? "1.5 egl_stub" : "";''',
+    'eglGetError': '''
+    return EGL_SUCCESS;''',
+    'eglClientWaitSync': '''
+    return EGL_CONDITION_SATISFIED;''',
+}
+
+def gen_body(command):
+    name = command['function_name']
+    ret = command['return_type_str']
+    if name in special_bodies:
+        return special_bodies[name]
+    if ret == 'EGLBoolean':
+        return '''
+    return EGL_TRUE;'''
+    # contexts, surfaces, images and syncs get a dummy handle
+    if name.startswith('eglCreate') or name.startswith('eglGetCurrent'):
+        return '''
+    return (%s)1;''' % ret
+    return '''
+    return (%s)0;''' % ret
+
 def print_gl_functions():
     # Sort alphabetical on function name
     sorted_commands = [command for name, command in all_commands.iteritems()]
@@ -78,12 +134,12 @@ def print_gl_functions():
         command['param_string'] = ', '.join(param)
         command['call_list'] = ', '.join(call_list)
         command['function_name_upper'] = command['function_name'].upper()
+        command['body'] = gen_body(command)
         function_template = \
 '''
 EXPORT {return_type_str} {function_name}({param_string});
 {return_type_str} {function_name}({param_string})
-{{
-    return ({return_type_str})0;
+{{{body}
 }}
 '''
         print(function_template.format(**command))
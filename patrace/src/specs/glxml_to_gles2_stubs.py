@@ -68,6 +68,71 @@ def GlFunction(*args, **kwargs):
     kwargs.setdefault('call', 'GL_APIENTRY')
     return gltypes.Function(*args, **kwargs)
 
+# The retracer checks a few return values and out parameters, so these stubs answer like a
+# driver that succeeds at everything instead of returning zero. This lets paretrace replay
+# real traces against the stub to measure its own overhead.
+special_bodies = {
+    'glGetString': '''
+    switch (name)
+    {
+    case GL_VENDOR: return (const GLubyte *)"patrace";
+    case GL_RENDERER: return (const GLubyte *)"gles2_stub";
+    case GL_VERSION: return (const GLubyte *)"OpenGL ES 3.2 gles2_stub";
+    case GL_SHADING_LANGUAGE_VERSION: return (const GLubyte *)"OpenGL ES GLSL ES 3.20";
+    default: return (const GLubyte *)"";
+    }''',
+    'glGetStringi': '''
+    return (const GLubyte *)"";''',
+    'glGetIntegerv': '''
+    switch (pname)
+    {
+    case GL_MAJOR_VERSION: *data = 3; break;
+    case GL_MINOR_VERSION: *data = 2; break;
+    case GL_MAX_TEXTURE_SIZE: *data = 16384; break;
+    case GL_MAX_VERTEX_ATTRIBS: *data = 16; break;
+    case GL_MAX_DRAW_BUFFERS: *data = 8; break;
+    case GL_MAX_COLOR_ATTACHMENTS: *data = 8; break;
+    case GL_MAX_SAMPLES: *data = 4; break;
+    case GL_MAX_TEXTURE_IMAGE_UNITS: *data = 16; break;
+    case GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS: *data = 96; break;
+    default: *data = 0; break;
+    }''',
+    'glGetShaderiv': '''
+    *params = (pname == GL_COMPILE_STATUS) ? GL_TRUE : 0;''',
+    'glGetProgramiv': '''
+    *params = (pname == GL_LINK_STATUS || pname == GL_VALIDATE_STATUS) ? GL_TRUE : 0;''',
+    'glCheckFramebufferStatus': '''
+    return GL_FRAMEBUFFER_COMPLETE;''',
+    'glCreateShader': '''
+    return ++next_name;''',
+    'glCreateProgram': '''
+    return ++next_name;''',
+    'glCreateShaderProgramv': '''
+    return ++next_name;''',
+    'glMapBufferRange': '''
+    static thread_local std::vector<char> mapped;
+    if (mapped.size() < (size_t)length) mapped.resize(length);
+    return mapped.data();''',
+    'glUnmapBuffer': '''
+    return GL_TRUE;''',
+    'glFenceSync': '''
+    return (GLsync)(uintptr_t)++next_name;''',
+    'glClientWaitSync': '''
+    return GL_ALREADY_SIGNALED;''',
+}
+
+def gen_body(command):
+    name = command['function_name']
+    if name in special_bodies:
+        return special_bodies[name]
+    params = command['parameters']
+    # glGen*(GLsizei n, GLuint *names) hands out fresh names
+    if name.startswith('glGen') and len(params) == 2 and params[1]['strlist'][:2] == ['GLuint', '*']:
+        return '''
+    for (GLsizei i = 0; i < %s; i++) %s[i] = ++next_name;''' % (params[0]['strlist'][-1], params[1]['strlist'][-1])
+    return '''
+    return (%s)0;''' % command['return_type_str']
+
 def print_gl_functions():
     # Sort alphabetical on function name
     sorted_commands = [command for name, command in all_commands.iteritems()]
@@ -79,18 +144,25 @@ def print_gl_functions():
     print 'typedef void (*GLDEBUGPROCKHR)(GLenum source,GLenum type,GLuint id,GLenum severity,GLsizei length,const GLchar *message,const void *userParam);'
     print '#define EXPORT extern "C" __attribute__ ((visibility ("default")))'
     print
+    print '#include <atomic>'
+    print '#include <stddef.h>'
+    print '#include <stdint.h>'
+    print '#include <vector>'
+    print
+    print 'static std::atomic<GLuint> next_name(0);'
+    print
     for command in sorted_commands:
         param = [' '.join(p['strlist']) for p in command['parameters']]
         call_list = [p['strlist'][-1] for p in command['parameters']]
         command['param_string'] = ', '.join(param)
         command['call_list'] = ', '.join(call_list)
         command['function_name_upper'] = command['function_name'].upper()
+        command['body'] = gen_body(command)
         function_template = \
 '''
 EXPORT {return_type_str} {function_name}({param_string});
 {return_type_str} {function_name}({param_string})
-{{
-    return ({return_type_str})0;
+{{{body}
 }}
 '''
         print(function_template.format(**command))
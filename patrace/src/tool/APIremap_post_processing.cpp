@@ -6,6 +6,7 @@
 #include "common/os.hpp"
 #include "tool/config.hpp"
 #include "base/base.hpp"
+#include "tool/call_patcher.hpp"
 
 static void printHelp()
 {
@@ -23,38 +24,9 @@ static void printVersion()
     std::cout << PATRACE_VERSION << std::endl;
 }
 
-static common::FrameTM* _curFrame = NULL;
-static unsigned _curFrameIndex = 0;
-static unsigned _curCallIndexInFrame = 0;
 std::map<unsigned int, unsigned int> curBufferIdx;
 std::map<unsigned int, unsigned int> bufferLength;
 
-static void writeout(common::OutFile &outputFile, common::CallTM *call)
-{
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
-}
-
-static common::CallTM* next_call(common::TraceFileTM &_fileTM)
-{
-    if (_curCallIndexInFrame >= _curFrame->GetLoadedCallCount())
-    {
-        _curFrameIndex++;
-        if (_curFrameIndex >= _fileTM.mFrames.size())
-            return NULL;
-        if (_curFrame) _curFrame->UnloadCalls();
-        _curFrame = _fileTM.mFrames[_curFrameIndex];
-        _curFrame->LoadCalls(_fileTM.mpInFileRA);
-        _curCallIndexInFrame = 0;
-    }
-    common::CallTM *call = _curFrame->mCalls[_curCallIndexInFrame];
-    _curCallIndexInFrame++;
-    return call;
-}
-
 int main(int argc, char **argv)
 {
     int argIndex = 1;
@@ -92,50 +64,19 @@ int main(int argc, char **argv)
     const char* source_trace_filename = argv[argIndex++];
     const char* target_trace_filename = argv[argIndex++];
 
-    common::TraceFileTM inputFile;
     common::gApiInfo.RegisterEntries(common::parse_callbacks);
-    if (!inputFile.Open(source_trace_filename))
-    {
-        PAT_DEBUG_LOG("Failed to open for reading: %s\n", source_trace_filename);
-        return 1;
-    }
-    _curFrame = inputFile.mFrames[0];
-    _curFrame->LoadCalls(inputFile.mpInFileRA);
-
-    common::OutFile outputFile;
-    if (!outputFile.Open(target_trace_filename))
-    {
-        PAT_DEBUG_LOG("Failed to open for writing: %s\n", target_trace_filename);
-        return 1;
-    }
 
-    Json::Value header = inputFile.mpInFileRA->getJSONHeader();
-
-    Json::FastWriter writer;
-    const std::string json_header = writer.write(header);
-    outputFile.mHeader.jsonLength = json_header.size();
-    outputFile.WriteHeader(json_header.c_str(), json_header.size());
-    common::CallTM *call = NULL;
-
-    while ((call = next_call(inputFile)))
+    // Only the calls that track buffer sizes and the mappings are decoded, the rest is copied
+    CallPatcher patcher;
+    const bool scanned = patcher.scan(source_trace_filename, { "glBindBuffer", "glBufferData", "glMapBufferOES", "glUnmapBufferOES" },
+                                      [&](std::unique_ptr<common::CallTM>& call, CallPatcher::Calls& patch)
     {
-
-        bool skip = false;
-
         if(call->mCallName == "glBindBuffer")
         {
             unsigned int bufferType = call->mArgs[0]->GetAsUInt();
             unsigned int bufferIdx = call->mArgs[1]->GetAsUInt();
-
-            std::map<unsigned int, unsigned int>::iterator it0 = curBufferIdx.find(bufferType);
-            if(it0== curBufferIdx.end())
-            {
-                curBufferIdx.insert(std::pair<unsigned int, unsigned int>(bufferType, bufferIdx));
-            }
-            else
-            {
-                it0->second = bufferIdx;
-            }
+            curBufferIdx[bufferType] = bufferIdx;
+            return false;
         }
 
         if(call->mCallName == "glBufferData")
@@ -147,17 +88,8 @@ int main(int argc, char **argv)
                 printf("No glBindBuffer before glBufferData\n");
                 exit(1);
             }
-
-            std::map<unsigned int, unsigned int>::iterator it2 = bufferLength.find(it1->second);
-            unsigned int length = call->mArgs[1]->GetAsUInt();
-            if(it2==bufferLength.end())
-            {
-                bufferLength.insert(std::pair<unsigned int, unsigned int>(it1->second, length));
-            }
-            else
-            {
-                it2->second = length;
-            }
+            bufferLength[it1->second] = call->mArgs[1]->GetAsUInt();
+            return false;
         }
 
         if(call->mCallName == "glMapBufferOES")
@@ -177,39 +109,30 @@ int main(int argc, char **argv)
                 exit(1);
             }
 
-            common::CallTM glMapBufferRange("glMapBufferRange");
-            glMapBufferRange.mArgs.push_back(new common::ValueTM(call->mArgs[0]->GetAsUInt()));//target
-            glMapBufferRange.mArgs.push_back(new common::ValueTM(0));//offset
-            glMapBufferRange.mArgs.push_back(new common::ValueTM(it4->second));//length
-            glMapBufferRange.mArgs.push_back(new common::ValueTM(2));//access= GL_MAP_WRITE_BIT
-            glMapBufferRange.mRet = common::ValueTM(call->mRet.mOpaqueIns->GetAsUInt());
-            glMapBufferRange.mTid = call->mTid;
-            writeout(outputFile, &glMapBufferRange);
-
-            skip = true;
+            common::CallTM* glMapBufferRange = new common::CallTM("glMapBufferRange");
+            glMapBufferRange->mArgs.push_back(new common::ValueTM(call->mArgs[0]->GetAsUInt()));//target
+            glMapBufferRange->mArgs.push_back(new common::ValueTM(0));//offset
+            glMapBufferRange->mArgs.push_back(new common::ValueTM(it4->second));//length
+            glMapBufferRange->mArgs.push_back(new common::ValueTM(2));//access= GL_MAP_WRITE_BIT
+            glMapBufferRange->mRet = common::ValueTM(call->mRet.mOpaqueIns->GetAsUInt());
+            glMapBufferRange->mTid = call->mTid;
+            patch.emplace_back(glMapBufferRange);
+            return true;
         }
 
-        if(call->mCallName == "glUnmapBufferOES")
-        {
-            common::CallTM glUnmapBuffer("glUnmapBuffer");
-            glUnmapBuffer.mArgs.push_back(new common::ValueTM(call->mArgs[0]->GetAsUInt()));
-            glUnmapBuffer.mRet = common::ValueTM(call->mRet.GetAsUByte());
-            glUnmapBuffer.mTid = call->mTid;
-            writeout(outputFile, &glUnmapBuffer);
-
-            skip = true;
-        }
-
-        if(skip == false)
-        {
-            writeout(outputFile, call);
-        }
+        // glUnmapBufferOES
+        common::CallTM* glUnmapBuffer = new common::CallTM("glUnmapBuffer");
+        glUnmapBuffer->mArgs.push_back(new common::ValueTM(call->mArgs[0]->GetAsUInt()));
+        glUnmapBuffer->mRet = common::ValueTM(call->mRet.GetAsUByte());
+        glUnmapBuffer->mTid = call->mTid;
+        patch.emplace_back(glUnmapBuffer);
+        return true;
+    });
+    if (!scanned || !patcher.write(target_trace_filename, patcher.header()))
+    {
+        return 1;
     }
 
-
-    inputFile.Close();
-    outputFile.Close();
-
     return 0;
 }
 
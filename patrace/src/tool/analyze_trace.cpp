@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cctype>
 #include <numeric>
 #include <set>
 #include <vector>
@@ -7,16 +8,23 @@
 #include <set>
 #include <algorithm>
 #include <utility>
+#include <tuple>
 #include <algorithm>
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
 #include <GLES3/gl31.h>
 #include <GLES3/gl32.h>
+#include <errno.h>
 #include <limits.h>
+#include <string.h>
 #include <iomanip>
 #include <sstream>
+#include <fstream>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "tool/parse_interface_retracing.hpp"
+#include "tool/cost_model.hpp"
 
 #include "jsoncpp/include/json/writer.h"
 #include "common/in_file.hpp"
@@ -26,6 +34,7 @@
 #include "common/parse_api.hpp"
 #include "common/trace_model.hpp"
 #include "common/gl_utility.hpp"
+#include "common/json_stream.hpp"
 #include "common/os.hpp"
 #include "eglstate/context.hpp"
 #include "tool/config.hpp"
@@ -40,11 +49,34 @@ static bool dump_to_text = false;
 static std::string dump_csv_filename;
 static std::set<int> renderpassframes;
 static bool complexity_only_mode = false;
+static bool invalidation_mode = false;
 static bool dumpCallTime = false;
 static bool bareLog = false;
 static bool report_unused_shaders = false;
 static bool write_used_shaders = false;
 static std::map<int, double> heavinesses;
+static std::string part_suffix; // added to the names of the whole trace outputs of a -P worker
+static std::string cost_model_filename; // or "default" for the built-in weights
+static std::string calibration_filename; // paretrace result to calibrate the cost model with
+
+/// Write a JSON report as it is walked, rather than making it into one string first, since the
+/// reports of long traces get large
+static void write_json(const std::string& filename, const Json::Value& v)
+{
+    FILE* fp = fopen(filename.c_str(), "w");
+    if (!fp)
+    {
+        DBG_LOG("Failed to open %s: %s\n", filename.c_str(), strerror(errno));
+        return;
+    }
+    common::JsonStream stream(fp);
+    stream.value(v);
+    if (!stream.flush())
+    {
+        DBG_LOG("Failed to write %s: %s\n", filename.c_str(), strerror(errno));
+    }
+    fclose(fp);
+}
 
 /// Helper to prune empty lists from a JSON object
 static void prune(Json::Value& v)
@@ -198,14 +230,26 @@ static void printHelp()
         "  -o <basename> Dump metrics in CSV and JSON format to given base filename\n"
         "  -r <frames>   Dump renderpass metrics for given comma-separated list of frames (no spaces in the list!)\n"
         "  -C            Only report complexity metric on stdout\n"
+        "  -M            Only report the memory that textures, renderbuffers and buffers take in each\n"
+        "                frame, and its peak, into <basename>_memory.csv and <basename>_memory.json,\n"
+        "                without replaying the trace\n"
         "  -S            Show visual output\n"
         "  -s            Report also on shaders that are not in use\n"
         "  -n            Do not save screenshots\n"
         "  -z            Show CPU cycles\n"
         "  -b            Bare call logging - useful for making diffs between traces\n"
+        "  -P <n>        Analyze the frame interval in n processes in parallel and merge their output\n"
+        "  -m <model>    Predict frame and renderpass times with a cost model written by -c, or with\n"
+        "                built-in weights if it is 'default', into <basename>_cost.json\n"
+        "  -c <result>   Calibrate the cost model to the frame times in a paretrace result file, run\n"
+        "                with -drawtime or -perframe on the device, into <basename>_costmodel.json\n"
+        "  -I            Find render pass attachments that are stored or loaded for nothing for want of\n"
+        "                glInvalidateFramebuffer, into <basename>_invalidate.json, which paretrace\n"
+        "                -invalidate can replay with the missing invalidates added\n"
         "Options for per frame output:\n"
         "  -Z            Write out used shaders to disk\n"
-        "  -j            Write out renderpass JSON data for selected frames\n"
+        "  -j            Write out renderpass JSON data for selected frames. Buffers and shaders are\n"
+        "                written once to <output>_blobs and hard linked into the renderpasses\n"
         ;
 }
 
@@ -241,6 +285,10 @@ static std::map<std::string, PerUnit> createPerDraw()
     v["spatial_locality"].csv_description = "Spatial Locality %";
     v["temporal_locality"].csv_description = "Temporal Locality %";
     v["vec4_locality"].csv_description = "Block of 4 Locality %";
+    v["vertices.shaded"].csv_description = "Shaded Vertices";
+    v["acmr"].csv_description = "ACMR x100";
+    v["atvr"].csv_description = "ATVR x100";
+    v["vertex_fetch_bytes"].csv_description = "Estimated Vertex Fetch Bytes";
     v["instancing"].csv_description = "Instancing";
     v["uniforms"].csv_description = "Uniform calls";
     v["uniform_values"].csv_description = "Uniform values";
@@ -279,6 +327,8 @@ static std::map<std::string, PerUnit> createPerFrame()
     v["vertices"].csv_description = "Vertices";
     v["vertices.indexed"].csv_description = "Indexed Vertices";
     v["vertices.unique"].csv_description = "Unique Indexed Vertices";
+    v["vertices.shaded"].csv_description = "Shaded Vertices";
+    v["vertex_fetch_bytes"].csv_description = "Estimated Vertex Fetch Bytes";
     v["primitives"].csv_description = "Primitives";
     v["instancing"].csv_description = "Instancing";
     v["clears"].csv_description = "Clears";
@@ -415,6 +465,70 @@ static std::vector<const char*> featurenames = { "VA", "VBO", "DrawIndirect", "S
 static std::vector<double> complexity_feature_value = { 0.02, 0.04, 0.2, 0.07, 0.06, 0.1, 0.2, 0.08, 0.08, 0.5, 0.15, 0.15, 0.05, 0.05, 0.3,
                                                         0.4, 0.3, 0.2, 0.2, 0.2, 0.15, 0.5, 0.6, 0.2, 0.3, 0.4, 0.6 };
 
+static double attachment_bytes_per_pixel(GLenum format)
+{
+    switch (format)
+    {
+    case GL_R8: case GL_UNSIGNED_BYTE: case GL_STENCIL_INDEX8: return 1;
+    case GL_RG8: case GL_R16F: case GL_RGB565: case GL_RGBA4: case GL_RGB5_A1: case GL_DEPTH_COMPONENT16: case GL_UNSIGNED_SHORT: return 2;
+    case GL_RGBA16F: case GL_RG32F: case GL_DEPTH32F_STENCIL8: return 8;
+    case GL_RGBA32F: return 16;
+    default: return 4; // RGBA8, RGB10_A2, R11F_G11F_B10F, DEPTH24_STENCIL8, and the like
+    }
+}
+
+/// Finds what tile-based GPUs load and store of render pass attachments for nothing, for want of
+/// glInvalidateFramebuffer: attachments that are stored and then cleared, invalidated or swapped
+/// away before anything reads them, and attachments that are loaded while their contents are
+/// undefined. Attachments are told apart by the texture or renderbuffer attached, and window
+/// surfaces by context. A store is read when the next render pass into it loads it, when its
+/// texture is sampled by a draw or dispatch or has its mipmaps generated, or by a blit, copy or
+/// glReadPixels from the framebuffer it is attached to. Textures may be uploaded to as well, so
+/// only renderbuffers and window surfaces are known to be undefined, the latter after each swap.
+class InvalidationAnalysis
+{
+public:
+    bool enabled = false;
+
+    /// Catch up with the render passes that the parser completed in the current context, and
+    /// with what the call reads
+    void update(ParseInterfaceBase& input, common::CallTM *call);
+    /// Write out the waste found in the frame interval, and the invalidates to inject into the
+    /// replay with -invalidate to avoid it
+    void write(const std::string& filename) const;
+
+private:
+    struct Target // what an attachment renders into
+    {
+        GLenum kind; // GL_TEXTURE, GL_RENDERBUFFER or GL_BACK for window surfaces
+        int index; // of the texture or renderbuffer, or of the context of the window surface
+        GLenum buffer; // GL_COLOR, GL_DEPTH or GL_STENCIL for window surfaces, else GL_NONE
+        bool operator<(const Target& o) const { return std::tie(kind, index, buffer) < std::tie(o.kind, o.index, o.buffer); }
+    };
+    struct Waste
+    {
+        int frame;
+        int renderpass; // index in its frame
+        int context;
+        unsigned framebuffer; // by ID
+        std::vector<GLenum> attachments; // to invalidate
+        bool load; // else a store
+        const char* reason;
+        double bytes;
+        unsigned call; // to invalidate before, for stores, or after, for loads
+    };
+
+    void completed(const StateTracker::Context& c, const StateTracker::RenderPass& rp);
+    void readFramebuffer(const StateTracker::Context& c, unsigned id, bool read);
+    void waste(const Waste& w, const char* reason);
+
+    std::map<Target, Waste> mStored; // stored and not read yet
+    std::set<Target> mDefined; // renderbuffers and window surfaces that were rendered into
+    std::vector<Waste> mWastes;
+    std::vector<size_t> mDone; // completed render passes looked at, by context
+    std::vector<size_t> mMipmaps; // mipmap generations looked at, by context
+};
+
 class AnalyzeTrace
 {
 public:
@@ -485,6 +599,7 @@ public:
     std::map<std::string, Json::Value::Int64> tex_formats;
     std::map<std::string, Json::Value::Int64> tex_sizes;
     std::map<std::string, Json::Value::Int64> scissor_sizes;
+    InvalidationAnalysis invalidation;
 
     AnalyzeTrace() : features(FEATURE_MAX) {}
 
@@ -498,6 +613,7 @@ public:
     double calculate_heaviness(const ParseInterfaceBase& input, int frame);
     double calculate_dump_heaviness(const ParseInterfaceBase& input, int frame);
     double calculate_complexity(const ParseInterfaceBase& input);
+    void write_cost(const ParseInterfaceBase& input, const std::string& basename);
     bool in_renderpass_frame = false;
 };
 
@@ -558,11 +674,198 @@ void AnalyzeTrace::buffer_bound(GLenum target)
     }
 }
 
+void InvalidationAnalysis::waste(const Waste& w, const char* reason)
+{
+    if (!relevant(w.frame)) return;
+    mWastes.push_back(w);
+    mWastes.back().reason = reason;
+}
+
+void InvalidationAnalysis::completed(const StateTracker::Context& c, const StateTracker::RenderPass& rp)
+{
+    if (!rp.active) return; // nothing drawn
+    const double pixels = (double)rp.width * rp.height * std::max(rp.depth, 1);
+    for (const auto& a : rp.attachments)
+    {
+        if (a.slot == GL_NONE) continue; // unused part of the backbuffer
+        Target t = { GL_BACK, c.index, GL_NONE };
+        Waste w = { rp.frame, rp.index, c.index, rp.drawframebuffer, {}, false, "", pixels * attachment_bytes_per_pixel(a.format), (unsigned)rp.last_call };
+        if (rp.drawframebuffer == 0)
+        {
+            t.buffer = (a.type == GL_DEPTH_STENCIL) ? GL_DEPTH : a.type;
+            w.attachments.push_back(t.buffer);
+            if (a.type == GL_DEPTH_STENCIL) w.attachments.push_back(GL_STENCIL);
+        }
+        else if (a.index != UNBOUND)
+        {
+            t.kind = (a.type == GL_RENDERBUFFER) ? GL_RENDERBUFFER : GL_TEXTURE;
+            t.index = a.index;
+            w.attachments.push_back(a.slot);
+            if (t.kind == GL_RENDERBUFFER && c.renderbuffers.at(a.index).samples > 1) w.bytes *= c.renderbuffers.at(a.index).samples;
+        }
+        else continue; // nothing attached
+
+        const auto stored = mStored.find(t);
+        if (stored != mStored.end() && (a.load_op == StateTracker::RenderPass::LOAD_OP_CLEAR || a.load_op == StateTracker::RenderPass::LOAD_OP_DONT_CARE))
+        {
+            waste(stored->second, "overwritten");
+        }
+        else if (a.load_op == StateTracker::RenderPass::LOAD_OP_LOAD && t.kind != GL_TEXTURE && mDefined.count(t) == 0)
+        {
+            Waste load = w;
+            load.load = true;
+            load.call = rp.first_call; // the call that started the render pass
+            waste(load, "undefined");
+        }
+        if (stored != mStored.end()) mStored.erase(stored); // loaded or overwritten
+        if (a.store_op == StateTracker::RenderPass::STORE_OP_DONT_CARE)
+        {
+            mDefined.erase(t);
+        }
+        else
+        {
+            mDefined.insert(t);
+            mStored[t] = w;
+        }
+    }
+}
+
+void InvalidationAnalysis::readFramebuffer(const StateTracker::Context& c, unsigned id, bool read)
+{
+    if (!c.framebuffers.contains(id)) return;
+    for (const auto& pair : c.framebuffers.at(c.framebuffers.remap(id)).attachments)
+    {
+        Target t = { GL_BACK, c.index, pair.second.type };
+        if (id != 0)
+        {
+            if (pair.second.index == UNBOUND) continue;
+            t.kind = (pair.second.type == GL_RENDERBUFFER) ? GL_RENDERBUFFER : GL_TEXTURE;
+            t.index = pair.second.index;
+            t.buffer = GL_NONE;
+        }
+        if (read) mStored.erase(t);
+        else mDefined.insert(t); // blitted into
+    }
+}
+
+void InvalidationAnalysis::update(ParseInterfaceBase& input, common::CallTM *call)
+{
+    const int context_index = input.context_index;
+    if (context_index == UNBOUND) return;
+    const StateTracker::Context& c = input.contexts.at(context_index);
+    if ((int)mDone.size() <= context_index)
+    {
+        mDone.resize(context_index + 1, 0);
+        mMipmaps.resize(context_index + 1, 0);
+    }
+    for (; mDone[context_index] + 1 < c.render_passes.size(); mDone[context_index]++) // the last one is still going on
+    {
+        completed(c, c.render_passes[mDone[context_index]]);
+    }
+    for (; mMipmaps[context_index] < c.mipmaps.size(); mMipmaps[context_index]++)
+    {
+        const Target t = { GL_TEXTURE, c.mipmaps[mMipmaps[context_index]].texture_index, GL_NONE };
+        mStored.erase(t);
+    }
+
+    if (call->mCallName.compare(0, 6, "glDraw") == 0 || call->mCallName.compare(0, 10, "glDispatch") == 0)
+    {
+        if (call->mCallName == "glDrawBuffers" || c.program_index == UNBOUND) return;
+        for (const auto& pair : c.programs.at(c.program_index).texture_bindings)
+        {
+            const GLenum binding = samplerTypeToBindingType(pair.second.type);
+            const auto unit = c.textureUnits.find(pair.second.value);
+            if (binding == GL_NONE || unit == c.textureUnits.end() || unit->second.count(binding) == 0) continue;
+            const GLuint texture_id = unit->second.at(binding);
+            if (texture_id == 0 || !c.textures.contains(texture_id)) continue;
+            const Target t = { GL_TEXTURE, c.textures.remap(texture_id), GL_NONE };
+            mStored.erase(t);
+        }
+    }
+    else if (call->mCallName == "glBlitFramebuffer" || call->mCallName == "glReadPixels" || call->mCallName == "glReadnPixels"
+             || call->mCallName.compare(0, 9, "glCopyTex") == 0)
+    {
+        readFramebuffer(c, c.readframebuffer, true);
+        if (call->mCallName == "glBlitFramebuffer") readFramebuffer(c, c.drawframebuffer, false);
+    }
+    else if (call->mCallName.compare(0, 14, "eglSwapBuffers") == 0)
+    {
+        // The color buffer is shown, and nothing of the window surface is kept for the next frame
+        for (const GLenum buffer : { GL_COLOR, GL_DEPTH, GL_STENCIL })
+        {
+            const Target t = { GL_BACK, context_index, buffer };
+            const auto stored = mStored.find(t);
+            if (stored != mStored.end())
+            {
+                if (buffer != GL_COLOR) waste(stored->second, "swapped");
+                mStored.erase(stored);
+            }
+            mDefined.erase(t);
+        }
+    }
+}
+
+void InvalidationAnalysis::write(const std::string& filename) const
+{
+    Json::Value result;
+    double stores = 0.0, loads = 0.0;
+    std::map<int, std::pair<double, double>> frames; // stores and loads of each frame
+    std::map<std::tuple<unsigned, bool, unsigned>, std::set<GLenum>> invalidates; // call, after it, framebuffer : attachments
+    result["attachments"] = Json::arrayValue;
+    for (const Waste& w : mWastes)
+    {
+        Json::Value v;
+        v["frame"] = w.frame;
+        v["renderpass"] = w.renderpass;
+        v["context"] = w.context;
+        v["framebuffer"] = w.framebuffer;
+        v["op"] = w.load ? "load" : "store";
+        v["reason"] = w.reason;
+        v["bytes"] = w.bytes;
+        v["attachments"] = Json::arrayValue;
+        for (const GLenum a : w.attachments) v["attachments"].append(texEnum(a));
+        result["attachments"].append(v);
+        (w.load ? loads : stores) += w.bytes;
+        (w.load ? frames[w.frame].second : frames[w.frame].first) += w.bytes;
+        invalidates[std::make_tuple(w.call, w.load, w.framebuffer)].insert(w.attachments.begin(), w.attachments.end());
+    }
+    result["wasted_store_bytes"] = stores;
+    result["wasted_load_bytes"] = loads;
+    result["frames"] = Json::arrayValue;
+    for (const auto& pair : frames)
+    {
+        Json::Value v;
+        v["frame"] = pair.first;
+        v["wasted_store_bytes"] = pair.second.first;
+        v["wasted_load_bytes"] = pair.second.second;
+        result["frames"].append(v);
+    }
+    result["invalidate"] = Json::arrayValue;
+    for (const auto& pair : invalidates)
+    {
+        Json::Value v;
+        v["call"] = std::get<0>(pair.first);
+        v["after"] = std::get<1>(pair.first);
+        v["framebuffer"] = std::get<2>(pair.first);
+        v["attachments"] = Json::arrayValue;
+        for (const GLenum a : pair.second) v["attachments"].append(a);
+        result["invalidate"].append(v);
+    }
+    write_json(filename, result);
+    DBG_LOG("Found %.1f MB stored and %.1f MB loaded for nothing, in %u attachments of render passes\n", stores / (1024.0 * 1024.0),
+            loads / (1024.0 * 1024.0), (unsigned)mWastes.size());
+}
+
 static bool callback(ParseInterfaceBase& input, common::CallTM *call, void *custom)
 {
     AnalyzeTrace* az = (AnalyzeTrace*)custom;
     const int context_index = input.context_index;
 
+    if (az->invalidation.enabled)
+    {
+        az->invalidation.update(input, call);
+    }
+
     dumpstream << "[t" << call->mTid << ":c" << ((context_index != UNBOUND) ? std::to_string(context_index) : std::string("-"))
                << ":s" << ((input.surface_index != UNBOUND) ? std::to_string(input.surface_index) : std::string("-"));
     if (dumpCallTime)
@@ -651,7 +954,8 @@ static bool callback(ParseInterfaceBase& input, common::CallTM *call, void *cust
             }
             c.textureIdUsed.clear();
         }
-        if (relevant(input.frames))
+        // also after the last frame of the interval, since write_CSV() drops the last row
+        if (relevant(input.frames) || input.frames == lastframe + 1)
         {
             startNewRows(az->perframe);
         }
@@ -1217,6 +1521,10 @@ static bool callback(ParseInterfaceBase& input, common::CallTM *call, void *cust
             az->perdraw["spatial_locality"].values.back() = params.spatial_locality * 100.0;
             az->perdraw["temporal_locality"].values.back() = params.temporal_locality * 100.0;
             az->perdraw["vec4_locality"].values.back() = params.vec4_locality * 100.0;
+            az->perdraw["vertices.shaded"].values.back() = params.shaded_vertices;
+            az->perdraw["acmr"].values.back() = params.acmr * 100.0;
+            az->perdraw["atvr"].values.back() = params.atvr * 100.0;
+            az->perdraw["vertex_fetch_bytes"].values.back() = params.vertex_fetch_bytes;
             az->perdraw["instancing"].values.back() = params.instances;
             startNewRows(az->perdraw);
         }
@@ -1224,6 +1532,8 @@ static bool callback(ParseInterfaceBase& input, common::CallTM *call, void *cust
         az->perframe["vertices"].values.back() += params.vertices;
         az->perframe["instancing"].values.back() += params.instances;
         az->perframe["primitives"].values.back() += params.primitives;
+        az->perframe["vertices.shaded"].values.back() += params.shaded_vertices;
+        az->perframe["vertex_fetch_bytes"].values.back() += params.vertex_fetch_bytes;
 
         if (call->mCallName.find("Elements") != std::string::npos)
         {
@@ -1385,22 +1695,24 @@ void AnalyzeTrace::analyze(ParseInterfaceBase& input)
         Json::Value result = frame_json(input, frame);
         std::string filename = dump_csv_filename.empty() ? "frame_info" : dump_csv_filename;
         filename += "_f" + std::to_string(frame) + ".json";
-        std::fstream fs;
-        fs.open(filename, std::fstream::out |  std::fstream::trunc);
-        fs << result.toStyledString();
-        fs.close();
+        write_json(filename, result);
     }
     // JSON
     Json::Value result = trace_json(input);
-    std::fstream fs;
-    std::string filename = dump_csv_filename.empty() ? "trace" : dump_csv_filename;
-    fs.open(filename + ".json", std::fstream::out |  std::fstream::trunc);
-    fs << result.toStyledString();
-    fs.close();
+    std::string filename = (dump_csv_filename.empty() ? "trace" : dump_csv_filename) + part_suffix;
+    write_json(filename + ".json", result);
     // CSV
-    write_CSV(dump_csv_filename.empty() ? "trace" : dump_csv_filename, perframe, true);
+    write_CSV(filename, perframe, true);
     // Dump out callstats
-    write_callstats(input, dump_csv_filename.empty() ? "trace" : dump_csv_filename);
+    write_callstats(input, filename);
+    if (!cost_model_filename.empty() || !calibration_filename.empty())
+    {
+        write_cost(input, filename);
+    }
+    if (invalidation.enabled)
+    {
+        invalidation.write(filename + "_invalidate.json");
+    }
 }
 
 static double ratio_with_cap(long limit, long value)
@@ -1497,6 +1809,156 @@ double AnalyzeTrace::calculate_complexity(const ParseInterfaceBase& input)
     return std::accumulate(weights.begin(), weights.end(), 0.0) / static_cast<double>(weights.size());
 }
 
+// Rough estimates of the work of a shader: its statements and texture lookups
+static void shader_cost(const StateTracker::Context& c, const StateTracker::Program& p, GLenum type, double& statements, double& lookups)
+{
+    statements = 0.0;
+    lookups = 0.0;
+    if (p.shaders.count(type) == 0) return;
+    const StateTracker::Shader& shader = c.shaders.at(p.shaders.at(type));
+    const std::string& text = shader.source_preprocessed.empty() ? shader.source_code : shader.source_preprocessed;
+    statements = std::count(text.begin(), text.end(), ';');
+    for (size_t pos = 0; pos < text.size(); pos++)
+    {
+        if ((pos > 0 && (isalnum(text[pos - 1]) || text[pos - 1] == '_')) || (text.compare(pos, 7, "texture") != 0 && text.compare(pos, 5, "texel") != 0))
+        {
+            continue;
+        }
+        size_t end = pos;
+        while (end < text.size() && (isalnum(text[end]) || text[end] == '_')) end++;
+        const std::string name = text.substr(pos, end - pos);
+        while (end < text.size() && isspace(text[end])) end++;
+        if (end < text.size() && text[end] == '(' && name != "textureSize" && name != "textureQueryLevels")
+        {
+            lookups++;
+        }
+        pos = end;
+    }
+}
+
+static CostFeatures renderpass_cost(const StateTracker::Context& c, const StateTracker::RenderPass& rp)
+{
+    CostFeatures f;
+    f[COST_DRAWS] = rp.draw_calls;
+    f[COST_VERTICES] = rp.vertices;
+    f[COST_PRIMITIVES] = rp.primitives;
+    const double pixels = (double)rp.width * rp.height * std::max(rp.depth, 1);
+    f[COST_PIXELS] = pixels;
+    for (const auto& a : rp.attachments)
+    {
+        if (a.slot == GL_NONE) continue; // unused part of the backbuffer
+        const double bytes = pixels * attachment_bytes_per_pixel(a.format);
+        if (a.load_op == StateTracker::RenderPass::LOAD_OP_LOAD) f[COST_ATTACHMENT_BYTES] += bytes;
+        if (a.store_op != StateTracker::RenderPass::STORE_OP_DONT_CARE) f[COST_ATTACHMENT_BYTES] += bytes;
+    }
+    // Which draw used which program is not kept, so take the average of the programs used
+    double vs = 0.0, fs = 0.0, lookups = 0.0;
+    for (const int idx : rp.used_programs)
+    {
+        const StateTracker::Program& p = c.programs.at(idx);
+        double statements, samples;
+        shader_cost(c, p, GL_VERTEX_SHADER, statements, samples);
+        vs += statements;
+        shader_cost(c, p, GL_FRAGMENT_SHADER, statements, samples);
+        fs += statements;
+        lookups += samples;
+    }
+    if (!rp.used_programs.empty())
+    {
+        const double programs = rp.used_programs.size();
+        f[COST_VERTEX_SHADING] = rp.vertices * vs / programs;
+        f[COST_FRAGMENT_SHADING] = pixels * fs / programs;
+        f[COST_TEXTURE_SAMPLES] = pixels * lookups / programs;
+    }
+    return f;
+}
+
+void AnalyzeTrace::write_cost(const ParseInterfaceBase& input, const std::string& basename)
+{
+    CostModel model;
+    if (!cost_model_filename.empty() && cost_model_filename != "default" && !model.load(cost_model_filename))
+    {
+        return;
+    }
+
+    std::vector<int> frames;
+    std::vector<CostFeatures> frame_features;
+    std::vector<std::vector<std::pair<int, CostFeatures>>> renderpasses; // context index and features
+    for (int frame = 0; frame < (int)calls_per_frame.size() && frame < input.frames; frame++)
+    {
+        if (!relevant(frame)) continue;
+        CostFeatures f;
+        f[COST_CALLS] = calls_per_frame.at(frame);
+        renderpasses.emplace_back();
+        for (const auto& c : input.contexts)
+        {
+            for (const auto& rp : c.render_passes)
+            {
+                if (rp.frame != frame) continue;
+                renderpasses.back().emplace_back(c.index, renderpass_cost(c, rp));
+                f += renderpasses.back().back().second;
+            }
+        }
+        frames.push_back(frame);
+        frame_features.push_back(f);
+    }
+
+    std::map<int, double> measured;
+    if (!calibration_filename.empty() && loadMeasuredFrameTimes(calibration_filename, measured))
+    {
+        std::vector<CostFeatures> rows;
+        std::vector<double> seconds;
+        for (unsigned i = 0; i < frames.size(); i++)
+        {
+            if (measured.count(frames[i]) == 0) continue;
+            rows.push_back(frame_features[i]);
+            seconds.push_back(measured.at(frames[i]));
+        }
+        if (model.calibrate(rows, seconds))
+        {
+            model.save(basename + "_costmodel.json");
+        }
+    }
+
+    Json::Value result;
+    result["model"] = model.toJson();
+    result["frames"] = Json::arrayValue;
+    std::vector<double> predicted;
+    for (unsigned i = 0; i < frames.size(); i++)
+    {
+        Json::Value v;
+        v["frame"] = frames[i];
+        v["predicted_time"] = model.predict(frame_features[i]);
+        if (measured.count(frames[i])) v["measured_time"] = measured.at(frames[i]);
+        v["features"] = frame_features[i].toJson();
+        v["renderpasses"] = Json::arrayValue;
+        for (const auto& rp : renderpasses[i])
+        {
+            Json::Value r;
+            r["context"] = rp.first;
+            r["predicted_time"] = model.predict(rp.second);
+            r["features"] = rp.second.toJson();
+            v["renderpasses"].append(r);
+        }
+        predicted.push_back(v["predicted_time"].asDouble());
+        result["frames"].append(v);
+    }
+    result["representative_frames"] = Json::arrayValue;
+    for (const unsigned window : { 10u, 100u })
+    {
+        if (window > predicted.size()) break;
+        unsigned first;
+        double mean;
+        representativeFrames(predicted, window, first, mean);
+        Json::Value v;
+        v["first"] = frames.at(first);
+        v["last"] = frames.at(first + window - 1);
+        v["predicted_mean"] = mean;
+        result["representative_frames"].append(v);
+    }
+    write_json(basename + "_cost.json", result);
+}
+
 static Json::Value json_base(const StateTracker::Resource& base)
 {
     Json::Value json;
@@ -2228,6 +2690,312 @@ Json::Value AnalyzeTrace::frame_json(ParseInterfaceBase& input, int frame)
     return result;
 }
 
+/// How the -P workers each count a feature, and so how their counts are merged
+enum FeatureMerge
+{
+    MERGE_SUM, ///< counted within the frame range
+    MERGE_MAX, ///< set within the frame range
+    MERGE_LAST, ///< counted from the start of the trace, so the last worker has the total
+};
+
+static FeatureMerge feature_merge(int feature)
+{
+    switch (feature)
+    {
+    case FEATURE_EGLCREATEIMAGE: case FEATURE_EGL_IMAGE: case FEATURE_CONTEXT_SHARING:
+    case FEATURE_OCCLUSION_QUERIES: case FEATURE_OCCLUSION_QUERIES_CONSERVATIVE:
+    case FEATURE_DISCARD_FBO: case FEATURE_INVALIDATE_FBO: case FEATURE_SEPARATE_SHADER_OBJECTS:
+    case FEATURE_VERTEX_ATTR_BINDING: case FEATURE_GEOMETRY_SHADER: case FEATURE_TESSELLATION:
+    case FEATURE_COMPUTE_SHADER:
+        return MERGE_LAST;
+    case FEATURE_VERTEX_BUFFER_BINDING: case FEATURE_SSBO: case FEATURE_UBO: case FEATURE_TF:
+    case FEATURE_PRIMRESTART: case FEATURE_ANISOTROPY:
+        return MERGE_MAX;
+    default:
+        return MERGE_SUM;
+    }
+}
+
+static std::string part_name(const std::string& basename, int part)
+{
+    return basename + "_part" + std::to_string(part);
+}
+
+static bool read_lines(const std::string& filename, std::vector<std::string>& lines)
+{
+    std::ifstream fs(filename);
+    if (!fs)
+    {
+        DBG_LOG("Could not open %s for reading\n", filename.c_str());
+        return false;
+    }
+    std::string line;
+    while (std::getline(fs, line))
+    {
+        lines.push_back(line);
+    }
+    return true;
+}
+
+// The rows of the legacy CSV are the metrics and its columns the frames, while the rows of the
+// normal one are the frames, so the parts are joined sideways in the first and below each other
+// in the second.
+static bool merge_CSV(const std::string& basename, int parts)
+{
+    std::vector<std::string> legacy;
+    std::vector<std::string> normal;
+    for (int part = 0; part < parts; part++)
+    {
+        std::vector<std::string> lines;
+        if (!read_lines(part_name(basename, part) + ".csv", lines))
+        {
+            return false;
+        }
+        for (unsigned i = 0; i < lines.size(); i++)
+        {
+            const size_t comma = lines[i].find(',');
+            const std::string values = comma == std::string::npos ? std::string() : lines[i].substr(comma);
+            if (part == 0) legacy.push_back(lines[i]);
+            else if (i < legacy.size()) legacy[i] += values;
+        }
+        lines.clear();
+        if (!read_lines(part_name(basename, part) + ".std.csv", lines))
+        {
+            return false;
+        }
+        for (unsigned i = 0; i < lines.size(); i++)
+        {
+            const size_t comma = lines[i].find(',');
+            if (i == 0 && part == 0) normal.push_back(lines[i]);
+            else if (i > 0 && comma != std::string::npos) normal.push_back(std::to_string(normal.size() - 1) + lines[i].substr(comma));
+        }
+    }
+
+    std::fstream fs;
+    fs.open(basename + ".csv", std::fstream::out |  std::fstream::trunc);
+    for (const auto& line : legacy)
+    {
+        fs << line << std::endl;
+    }
+    fs.close();
+    fs.open(basename + ".std.csv", std::fstream::out |  std::fstream::trunc);
+    for (const auto& line : normal)
+    {
+        fs << line << std::endl;
+    }
+    fs.close();
+    return true;
+}
+
+// Add every number in from to the same number in into
+static void add_numbers(Json::Value& into, const Json::Value& from)
+{
+    for (const auto& key : from.getMemberNames())
+    {
+        const Json::Value& v = from[key];
+        if (v.isObject())
+        {
+            add_numbers(into[key], v);
+        }
+        else if (v.isIntegral())
+        {
+            into[key] = (Json::Value::Int64)(into.get(key, 0).asInt64() + v.asInt64());
+        }
+        else if (v.isDouble())
+        {
+            into[key] = into.get(key, 0.0).asDouble() + v.asDouble();
+        }
+    }
+}
+
+// Add the counts of a histogram as written by addMapToJson()
+static void add_counts(Json::Value& into, const Json::Value& from, const char* key)
+{
+    for (const auto& v : from)
+    {
+        bool found = false;
+        for (auto& w : into)
+        {
+            if (w[key] == v[key])
+            {
+                w["count"] = (Json::Value::Int64)(w["count"].asInt64() + v["count"].asInt64());
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+        {
+            into.append(v);
+        }
+    }
+}
+
+// The frame range statistics of the workers are added up. The rest of trace.json is state that
+// every worker tracks from the start of the trace, so it is taken from the last worker, which
+// got the furthest, except for the histograms that are only counted within the frame range.
+static Json::Value merge_trace_json(const std::vector<Json::Value>& parts)
+{
+    Json::Value result = parts.back();
+    Json::Value& range = result["framerange"];
+    std::vector<int> features(FEATURE_MAX, 0);
+    for (unsigned part = 0; part < parts.size(); part++)
+    {
+        const Json::Value& r = parts[part]["framerange"];
+        for (const auto& v : r["features"])
+        {
+            auto it = std::find(featurenames.begin(), featurenames.end(), v["name"].asString());
+            if (it == featurenames.end())
+            {
+                continue;
+            }
+            const int i = it - featurenames.begin();
+            const int count = v.get("count", 1).asInt();
+            switch (feature_merge(i))
+            {
+            case MERGE_SUM: features[i] += count; break;
+            case MERGE_MAX: features[i] = std::max(features[i], count); break;
+            case MERGE_LAST: if (part == parts.size() - 1) features[i] = count; break;
+            }
+        }
+        if (part == parts.size() - 1)
+        {
+            break;
+        }
+        add_numbers(range["absolute"], r["absolute"]);
+        range["client_side_buffers"]["count"] = std::max(range["client_side_buffers"]["count"].asInt(), r["client_side_buffers"]["count"].asInt());
+        range["client_side_buffers"]["total_size"] = (Json::Value::Int64)(range["client_side_buffers"]["total_size"].asInt64() + r["client_side_buffers"]["total_size"].asInt64());
+        range["texture_units"] = std::max(range["texture_units"].asUInt(), r["texture_units"].asUInt());
+        range["color_attachments"] = std::max(range["color_attachments"].asUInt(), r["color_attachments"].asUInt());
+        add_counts(result["scissor_sizes"], parts[part]["scissor_sizes"], "name");
+        add_counts(result["blend_modes"], parts[part]["blend_modes"], "mode");
+        for (const char* key : { "texture_type_filters", "texture_type_sizes" })
+        {
+            for (const auto& type : parts[part][key].getMemberNames())
+            {
+                add_counts(result[key][type], parts[part][key][type], "name");
+            }
+        }
+    }
+    range["start"] = parts.front()["framerange"]["start"];
+    Json::Value& modes = range["absolute"]["draw_modes"];
+    for (const auto& mode : modes.getMemberNames())
+    {
+        modes[mode]["primitives/calls"] = modes[mode]["primitives"].asDouble() / modes[mode]["calls"].asDouble();
+    }
+    range["features"] = Json::arrayValue;
+    for (unsigned i = 0; i < features.size(); i++)
+    {
+        if (features[i] > 0)
+        {
+            Json::Value v;
+            v["name"] = featurenames.at(i);
+            if (features[i] > 1)
+            {
+                v["count"] = features[i];
+            }
+            range["features"].append(v);
+        }
+    }
+    return result;
+}
+
+// Every worker writes the outputs of single frames under their final names, and those of the
+// whole trace with part_suffix added, which are merged here and then removed.
+static bool merge_parts(const std::string& basename, int parts)
+{
+    std::vector<Json::Value> results(parts);
+    for (int part = 0; part < parts; part++)
+    {
+        std::ifstream fs(part_name(basename, part) + ".json");
+        Json::Reader reader;
+        if (!reader.parse(fs, results[part]))
+        {
+            DBG_LOG("Failed to parse %s.json: %s\n", part_name(basename, part).c_str(), reader.getFormattedErrorMessages().c_str());
+            return false;
+        }
+    }
+    write_json(basename + ".json", merge_trace_json(results));
+    if (!merge_CSV(basename, parts))
+    {
+        return false;
+    }
+    // the call statistics cover every call from the start of the trace
+    if (rename((part_name(basename, parts - 1) + "_callstats.csv").c_str(), (basename + "_callstats.csv").c_str()) != 0)
+    {
+        DBG_LOG("Failed to rename the call statistics of the last part: %s\n", strerror(errno));
+        return false;
+    }
+    for (int part = 0; part < parts; part++)
+    {
+        for (const char* ext : { ".json", ".csv", ".std.csv", "_callstats.csv" })
+        {
+            remove((part_name(basename, part) + ext).c_str());
+        }
+    }
+    return true;
+}
+
+static Json::Value json_memory(const int64_t bytes[MemoryFootprint::CATEGORIES])
+{
+    Json::Value v;
+    int64_t total = 0;
+    for (int c = 0; c < MemoryFootprint::CATEGORIES; c++)
+    {
+        v[MemoryFootprint::name((MemoryFootprint::Category)c)] = (Json::Value::Int64)bytes[c];
+        total += bytes[c];
+    }
+    v["total"] = (Json::Value::Int64)total;
+    return v;
+}
+
+/// -M: only follow the creation, sizes and deletion of textures, renderbuffers and buffers,
+/// without replaying anything, and write out how much memory they take in each frame
+static bool memory_timeline(const std::string& source_trace_filename)
+{
+    ParseInterface input;
+    input.setBorrowBlobs(true);
+    if (!input.open(source_trace_filename))
+    {
+        std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
+        return false;
+    }
+    while (input.next_call() && input.frames <= lastframe) {}
+    input.memory.endFrame(); // the calls after the last swap
+    input.close();
+
+    const MemoryFootprint& memory = input.memory;
+    const std::string basename = dump_csv_filename.empty() ? "trace" : dump_csv_filename;
+    std::fstream fs;
+    fs.open(basename + "_memory.csv", std::fstream::out | std::fstream::trunc);
+    fs << "frame";
+    for (int c = 0; c < MemoryFootprint::CATEGORIES; c++) fs << "," << MemoryFootprint::name((MemoryFootprint::Category)c);
+    fs << ",total,peak" << std::endl;
+    for (unsigned frame = 0; frame < memory.frames.size(); frame++)
+    {
+        if (!relevant(frame)) continue;
+        const MemoryFootprint::Frame& f = memory.frames[frame];
+        int64_t total = 0;
+        fs << frame;
+        for (int c = 0; c < MemoryFootprint::CATEGORIES; c++)
+        {
+            fs << "," << f.bytes[c];
+            total += f.bytes[c];
+        }
+        fs << "," << total << "," << f.peak << std::endl;
+    }
+    fs.close();
+
+    Json::Value result;
+    result["frames"] = (unsigned)memory.frames.size();
+    result["peak"] = json_memory(memory.peakBytes);
+    result["peak"]["frame"] = memory.peakFrame;
+    result["peak"]["call"] = memory.peakCall;
+    result["final"] = json_memory(memory.live);
+    write_json(basename + "_memory.json", result);
+    DBG_LOG("Peak memory of %.1f MB at call %u in frame %d\n", memory.peak / (1024.0 * 1024.0), memory.peakCall, memory.peakFrame);
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     assert(complexity_feature_value.size() == featurenames.size());
@@ -2236,6 +3004,8 @@ int main(int argc, char **argv)
     bool display_mode = false;
     bool no_screenshots = false;
     bool renderpassjson = false;
+    bool memory_only_mode = false;
+    int parts = 1;
     int argIndex = 1;
     for (; argIndex < argc; ++argIndex)
     {
@@ -2279,6 +3049,14 @@ int main(int argc, char **argv)
         {
             complexity_only_mode = true;
         }
+        else if (arg == "-M")
+        {
+            memory_only_mode = true;
+        }
+        else if (arg == "-I")
+        {
+            invalidation_mode = true;
+        }
         else if (arg == "-z")
         {
             dumpCallTime = true;
@@ -2320,6 +3098,21 @@ int main(int argc, char **argv)
             dump_csv_filename = argv[argIndex + 1];
             argIndex++;
         }
+        else if (arg == "-m" && argIndex + 1 < argc)
+        {
+            cost_model_filename = argv[argIndex + 1];
+            argIndex++;
+        }
+        else if (arg == "-c" && argIndex + 1 < argc)
+        {
+            calibration_filename = argv[argIndex + 1];
+            argIndex++;
+        }
+        else if (arg == "-P" && argIndex + 1 < argc)
+        {
+            parts = std::max(atoi(argv[argIndex + 1]), 1);
+            argIndex++;
+        }
         else
         {
             std::cerr << "Error: Unknown option " << arg << std::endl;
@@ -2334,6 +3127,88 @@ int main(int argc, char **argv)
         return 1;
     }
     std::string source_trace_filename = argv[argIndex++];
+
+    if (memory_only_mode)
+    {
+        if (parts > 1)
+        {
+            std::cerr << "Error: -P cannot be combined with -M" << std::endl;
+            return 1;
+        }
+        return memory_timeline(source_trace_filename) ? 0 : 1;
+    }
+
+    if (parts > 1)
+    {
+        if (complexity_only_mode || dump_to_text || display_mode || !cost_model_filename.empty() || !calibration_filename.empty() || invalidation_mode)
+        {
+            std::cerr << "Error: -P cannot be combined with -C, -d, -S, -m, -c or -I" << std::endl;
+            return 1;
+        }
+        if (lastframe == INT_MAX)
+        {
+            common::InFile header;
+            if (!header.Open(source_trace_filename.c_str(), true))
+            {
+                std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
+                return 1;
+            }
+            lastframe = header.getJSONHeader().get("frameCnt", 0).asInt() - 1;
+            header.Close();
+            if (lastframe < startframe)
+            {
+                std::cerr << "Error: The trace header has no frame count, give the frame interval with -f" << std::endl;
+                return 1;
+            }
+        }
+
+        // Every worker replays the trace from the start, to have the GL state at its first
+        // frame, but only analyzes its own part of the frame interval
+        const int first = startframe;
+        const int frames = lastframe - startframe + 1;
+        parts = std::min(parts, frames);
+        const std::set<int> allrenderpassframes = renderpassframes;
+        std::vector<pid_t> workers;
+        for (int part = 0; part < parts; part++)
+        {
+            const pid_t pid = fork();
+            if (pid == -1)
+            {
+                DBG_LOG("Failed to fork: %s\n", strerror(errno));
+                return 1;
+            }
+            else if (pid == 0)
+            {
+                startframe = first + (long)frames * part / parts;
+                lastframe = first + (long)frames * (part + 1) / parts - 1;
+                part_suffix = "_part" + std::to_string(part);
+                renderpassframes.clear();
+                for (int frame : allrenderpassframes)
+                {
+                    if (relevant(frame)) renderpassframes.insert(frame);
+                }
+                break;
+            }
+            workers.push_back(pid);
+        }
+        if (part_suffix.empty()) // the parent
+        {
+            bool success = true;
+            for (pid_t pid : workers)
+            {
+                int status = 0;
+                waitpid(pid, &status, 0);
+                success &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            }
+            if (!success)
+            {
+                std::cerr << "Failed to analyze part of the frame interval" << std::endl;
+                return 1;
+            }
+            return merge_parts(dump_csv_filename.empty() ? "trace" : dump_csv_filename, parts) ? 0 : 1;
+        }
+    }
+
     ParseInterfaceRetracing inputFile;
     inputFile.setDisplayMode(display_mode);
     inputFile.setQuickMode(true);
@@ -2342,12 +3217,14 @@ int main(int argc, char **argv)
     inputFile.setOutputName(dump_csv_filename);
     inputFile.setRenderpassJSON(renderpassjson);
     inputFile.setDebug(debug);
+    inputFile.setBorrowBlobs(true);
     if (!inputFile.open(source_trace_filename))
     {
         std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
         return 1;
     }
     AnalyzeTrace antr;
+    antr.invalidation.enabled = invalidation_mode;
     antr.analyze(inputFile);
     inputFile.close();
     return 0;
@@ -0,0 +1,162 @@
+#include "tool/call_patcher.hpp"
+
+#include "common/in_file.hpp"
+#include "common/in_file_ra.hpp"
+#include "common/out_file.hpp"
+#include "common/os.hpp"
+
+#include <algorithm>
+
+bool CallPatcher::scan(const std::string& source, const std::vector<std::string>& names, const Visitor& visitor)
+{
+    common::InFile input;
+    if (!input.Open(source.c_str()))
+    {
+        DBG_LOG("Failed to open for reading: %s\n", source.c_str());
+        return false;
+    }
+    mSource = source;
+    mHeader = input.getJSONHeader();
+    mPatches.clear();
+
+    std::vector<bool> wanted(input.getMaxSigId() + 1, false);
+    for (const std::string& name : names)
+    {
+        const unsigned short id = input.NameToExId(name.c_str());
+        if (id != 0)
+        {
+            wanted[id] = true;
+        }
+    }
+
+    void *fptr = nullptr;
+    char *src = nullptr;
+    common::BCall_vlen bcall;
+    unsigned callNo = 0;
+    for (; input.GetNextCall(fptr, bcall, src); callNo++)
+    {
+        if (!wanted[bcall.funcId])
+        {
+            continue;
+        }
+        std::unique_ptr<common::CallTM> call(new common::CallTM(input, callNo, bcall));
+        Calls patch;
+        if (visitor(call, patch))
+        {
+            mPatches[callNo] = std::move(patch);
+        }
+    }
+    DBG_LOG("Scanned %u calls, %zu to patch\n", callNo, mPatches.size());
+    input.Close();
+    return true;
+}
+
+bool CallPatcher::scanCalls(const std::string& source, const std::vector<unsigned>& callNos, const Visitor& visitor)
+{
+    common::TraceFileTM input;
+    if (!input.Open(source.c_str()))
+    {
+        DBG_LOG("Failed to open for reading: %s\n", source.c_str());
+        return false;
+    }
+    mSource = source;
+    mHeader = input.mpInFileRA->getJSONHeader();
+    mPatches.clear();
+
+    std::vector<unsigned> sorted = callNos;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    for (unsigned callNo : sorted)
+    {
+        std::unique_ptr<common::CallTM> call(input.LoadCall(callNo));
+        if (!call)
+        {
+            DBG_LOG("Call %u is not in %s\n", callNo, source.c_str());
+            return false;
+        }
+        Calls patch;
+        if (visitor(call, patch))
+        {
+            mPatches[callNo] = std::move(patch);
+        }
+    }
+    DBG_LOG("Read %zu calls, %zu to patch\n", sorted.size(), mPatches.size());
+    input.Close();
+    return true;
+}
+
+bool CallPatcher::write(const std::string& target, const Json::Value& header)
+{
+    common::TraceFileTM input;
+    if (!input.Open(mSource.c_str()))
+    {
+        DBG_LOG("Failed to open for reading: %s\n", mSource.c_str());
+        return false;
+    }
+
+    // The calls are copied as they are, so they keep the function ids of the source trace,
+    // and functions that only the patches call are added
+    std::vector<std::string> sigbook;
+    input.mpInFileRA->copySigBook(sigbook);
+    std::map<std::string, int> ids;
+    for (const auto& patch : mPatches)
+    {
+        for (const auto& call : patch.second)
+        {
+            if (ids.count(call->mCallName) == 0)
+            {
+                int id = input.mpInFileRA->NameToExId(call->mCallName.c_str());
+                if (id == 0)
+                {
+                    sigbook.push_back(call->mCallName);
+                    id = sigbook.size() - 1;
+                }
+                ids[call->mCallName] = id;
+            }
+        }
+    }
+    common::OutFile output;
+    if (!output.Open(target.c_str(), true, &sigbook))
+    {
+        DBG_LOG("Failed to open for writing: %s\n", target.c_str());
+        return false;
+    }
+
+    Json::FastWriter writer;
+    const std::string json_header = writer.write(header);
+    output.mHeader.jsonLength = json_header.size();
+    output.WriteHeader(json_header.c_str(), json_header.size());
+
+    const common::FrameTM* lastFrame = input.mFrames.empty() ? NULL : input.mFrames.back();
+    const unsigned int callCount = lastFrame ? lastFrame->mFirstCallOfThisFrame + lastFrame->GetCallCount() : 0;
+
+    int copied = 0;
+    unsigned next = 0;
+    for (const auto& patch : mPatches)
+    {
+        const int chunks = input.CopyCalls(next, patch.first, output);
+        if (chunks < 0)
+        {
+            DBG_LOG("Failed to read the calls of %s\n", mSource.c_str());
+            return false;
+        }
+        copied += chunks;
+        for (const auto& call : patch.second)
+        {
+            call->Serialize(output, ids[call->mCallName]);
+        }
+        next = patch.first + 1;
+    }
+    const int chunks = input.CopyCalls(next, callCount, output);
+    if (chunks < 0)
+    {
+        DBG_LOG("Failed to read the calls of %s\n", mSource.c_str());
+        return false;
+    }
+    copied += chunks;
+
+    DBG_LOG("Patched %zu calls, copied %d chunks without recompressing them\n", mPatches.size(), copied);
+    input.Close();
+    output.Close();
+    return true;
+}
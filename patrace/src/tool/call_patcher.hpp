@@ -0,0 +1,47 @@
+#ifndef CALL_PATCHER_HPP
+#define CALL_PATCHER_HPP
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/trace_model.hpp"
+
+/// Rewrites a trace where only a few of its calls change, such as the viewports for resize.
+/// The source trace is scanned first, decoding only the calls to the functions asked for, and
+/// then copied to the target with the calls that were patched replaced, and the compressed
+/// chunks between them copied as they are. Most of the trace is neither decoded, encoded nor
+/// compressed again, which is what made rewriting a trace call by call slow.
+class CallPatcher
+{
+public:
+    typedef std::vector<std::unique_ptr<common::CallTM>> Calls;
+
+    /// Called in order for each call that scan() decodes. Returns whether the call is patched,
+    /// in which case the calls in patch are written instead of it, or none to remove it. The
+    /// call can be changed and moved into patch itself.
+    typedef std::function<bool(std::unique_ptr<common::CallTM>& call, Calls& patch)> Visitor;
+
+    /// Decode the calls of source to the functions in names and pass them to visitor
+    bool scan(const std::string& source, const std::vector<std::string>& names, const Visitor& visitor);
+
+    /// Decode only the given calls of source and pass them to visitor, such as calls found in an
+    /// index of the trace. Each is read from the start of its frame without parsing the calls
+    /// before it, so the rest of the trace is not decoded at all.
+    bool scanCalls(const std::string& source, const std::vector<unsigned>& callNos, const Visitor& visitor);
+
+    /// Copy the source that was scanned to target with the patches, under the given header
+    bool write(const std::string& target, const Json::Value& header);
+
+    /// The header of the source that was scanned
+    const Json::Value& header() const { return mHeader; }
+
+private:
+    std::string mSource;
+    Json::Value mHeader;
+    std::map<unsigned, Calls> mPatches; // by call number
+};
+
+#endif
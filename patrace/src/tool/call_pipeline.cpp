@@ -0,0 +1,595 @@
+#include "tool/call_pipeline.hpp"
+
+#include <tuple>
+#include <unordered_map>
+#include <GLES3/gl32.h>
+
+#include "tool/utils.hpp"
+
+bool CallStage::emit(common::CallTM* call)
+{
+    return mNext ? mNext->process(call) : mPipeline->write(call);
+}
+
+bool CallStage::isSourceCall(const common::CallTM* call) const
+{
+    return call == mPipeline->mInput->mCall;
+}
+
+ParseInterface& CallStage::input() const
+{
+    return *mPipeline->mInput;
+}
+
+CallPipeline::~CallPipeline()
+{
+    for (CallStage* stage : mStages)
+    {
+        delete stage;
+    }
+    delete mInput;
+}
+
+void CallPipeline::add(CallStage* stage)
+{
+    stage->mPipeline = this;
+    if (!mStages.empty())
+    {
+        mStages.back()->mNext = stage;
+    }
+    mStages.push_back(stage);
+}
+
+bool CallPipeline::write(common::CallTM* call)
+{
+    mInput->writeout(mOutput, call);
+    mWritten++;
+    return true;
+}
+
+bool CallPipeline::run(const std::string& source, const std::string& target)
+{
+    bool analysis = false;
+    for (CallStage* stage : mStages)
+    {
+        analysis = analysis || stage->needsAnalysis();
+    }
+    if (analysis)
+    {
+        ParseInterface input(true);
+        input.setQuickMode(true);
+        input.setScreenshots(false);
+        input.setBorrowBlobs(true);
+        if (!input.open(source))
+        {
+            return false;
+        }
+        while (input.next_call()) {}
+        for (CallStage* stage : mStages)
+        {
+            if (stage->needsAnalysis())
+            {
+                stage->prepare(input);
+            }
+        }
+        input.close();
+    }
+
+    delete mInput;
+    mInput = new ParseInterface(true);
+    mInput->setQuickMode(true);
+    mInput->setScreenshots(false);
+    mInput->setBorrowBlobs(true); // stages do not change blobs in place
+    if (!mInput->open(source))
+    {
+        return false;
+    }
+    if (!mOutput.Open(target.c_str()))
+    {
+        DBG_LOG("Failed to open for writing: %s\n", target.c_str());
+        return false;
+    }
+
+    Json::Value header = mInput->header;
+    for (CallStage* stage : mStages)
+    {
+        stage->header(header, source);
+    }
+    Json::FastWriter writer;
+    const std::string json_header = writer.write(header);
+    mOutput.mHeader.jsonLength = json_header.size();
+    mOutput.WriteHeader(json_header.c_str(), json_header.size());
+
+    long calls = 0;
+    common::CallTM *call = nullptr;
+    while ((call = mInput->next_call()))
+    {
+        calls++;
+        if (!(mStages.empty() ? write(call) : mStages.front()->process(call)))
+        {
+            break;
+        }
+    }
+    for (CallStage* stage : mStages)
+    {
+        stage->finish();
+    }
+    DBG_LOG("Read %ld calls, wrote %ld calls\n", calls, mWritten);
+    mInput->close();
+    mOutput.Close();
+    return true;
+}
+
+void StripStage::header(Json::Value& header, const std::string& source)
+{
+    Json::Value info;
+    info["thread_removed"] = mTid;
+    addConversionEntry(header, "strip", source, info);
+}
+
+bool StripStage::process(common::CallTM* call)
+{
+    if ((int)call->mTid == mTid)
+    {
+        mRemoved++;
+        return true;
+    }
+    return emit(call);
+}
+
+void StripStage::finish()
+{
+    DBG_LOG("Removed %d calls of thread %d\n", mRemoved, mTid);
+}
+
+void TrimStage::header(Json::Value& header, const std::string& source)
+{
+    Json::Value info;
+    info["first"] = mFirst;
+    info["last"] = mLast;
+    addConversionEntry(header, "trim", source, info);
+}
+
+bool TrimStage::process(common::CallTM* call)
+{
+    if (isSourceCall(call) && call->mCallNo >= mFirst && call->mCallNo <= mLast)
+    {
+        mRemoved++;
+        return true;
+    }
+    return emit(call);
+}
+
+void TrimStage::finish()
+{
+    DBG_LOG("Removed %d calls from %u to %u\n", mRemoved, mFirst, mLast);
+}
+
+void ResizeStage::header(Json::Value& header, const std::string& source)
+{
+    Json::Value info;
+    info["width"] = mWidth;
+    info["height"] = mHeight;
+    addConversionEntry(header, "resize", source, info);
+
+    Json::Value& threadArray = header["threads"];
+    for (unsigned i = 0; i < threadArray.size(); i++)
+    {
+        DBG_LOG("Trace header resolution override for thread[%d] from %d x %d -> %d x %d\n", threadArray[i]["id"].asInt(),
+                threadArray[i]["winW"].asInt(), threadArray[i]["winH"].asInt(), mWidth, mHeight);
+        threadArray[i]["winW"] = mWidth;
+        threadArray[i]["winH"] = mHeight;
+    }
+}
+
+bool ResizeStage::process(common::CallTM* call)
+{
+    if (call->mCallName == "glViewport")
+    {
+        call->ClearArguments();
+        call->mArgs.push_back(new common::ValueTM(0));
+        call->mArgs.push_back(new common::ValueTM(0));
+        call->mArgs.push_back(new common::ValueTM(mWidth));
+        call->mArgs.push_back(new common::ValueTM(mHeight));
+        mViewports++;
+    }
+    return emit(call);
+}
+
+void ResizeStage::finish()
+{
+    DBG_LOG("Resized %d viewports to %d x %d\n", mViewports, mWidth, mHeight);
+}
+
+void RenameStage::header(Json::Value& header, const std::string& source)
+{
+    Json::Value info;
+    info["renamed_from"] = mFrom;
+    info["renamed_to"] = mTo;
+    addConversionEntry(header, "rename_call", source, info);
+}
+
+bool RenameStage::process(common::CallTM* call)
+{
+    if (call->mCallName == mFrom)
+    {
+        call->mCallId = common::gApiInfo.NameToId(mTo.c_str());
+        call->mCallName = mTo;
+        mRenamed++;
+    }
+    return emit(call);
+}
+
+void RenameStage::finish()
+{
+    DBG_LOG("Renamed %d calls\n", mRenamed);
+}
+
+struct DeduplicateStage::State
+{
+    std::unordered_map<GLenum, GLuint> buffers;
+    std::unordered_map<GLuint, GLfloat> uniform1f;
+    std::unordered_map<GLuint, std::tuple<GLfloat, GLfloat>> uniform2f;
+    std::unordered_map<GLuint, std::tuple<GLfloat, GLfloat, GLfloat>> uniform3f;
+    std::unordered_map<GLenum, GLuint> textures;
+    std::unordered_map<GLenum, GLuint> samplers;
+    std::tuple<GLint, GLint, GLsizei, GLsizei> scissors = std::make_tuple(-1, -1, -1, -1);
+    std::tuple<GLenum, GLenum> blendfunc = std::make_tuple(GL_NONE, GL_NONE);
+    GLenum depthfunc = GL_NONE;
+    std::unordered_map<GLenum, bool> enabled;
+    std::tuple<GLfloat, GLfloat, GLfloat, GLfloat> blendcolor = std::make_tuple(0.0f, 0.0f, 0.0f, 0.0f);
+    std::unordered_map<GLuint, std::tuple<GLuint, GLint, GLenum, GLboolean, GLsizei, uint64_t>> vertexattrib;
+    std::unordered_map<GLuint, bool> enablevertex;
+    std::unordered_map<GLuint, GLuint> vertexdivisor;
+    GLuint current_program_id = 0;
+
+    long dedups = 0;
+    int vertexattrs = 0;
+    int bindbuffers = 0;
+    int enables = 0; // includes disables
+    int scissordupes = 0;
+    int blendcols = 0;
+    int bindtexs = 0;
+    int bindsamps = 0;
+    int uniforms = 0;
+    int depthfuncs = 0;
+    int blendfuncs = 0;
+    int useprograms = 0;
+};
+
+DeduplicateStage::DeduplicateStage(int flags, int endframe, bool replace)
+    : mFlags(flags), mEndFrame(endframe), mReplace(replace), mState(new State)
+{
+}
+
+DeduplicateStage::~DeduplicateStage()
+{
+    delete mState;
+}
+
+void DeduplicateStage::header(Json::Value& header, const std::string& source)
+{
+    mTid = header["defaultTid"].asUInt();
+    Json::Value info;
+    addConversionEntry(header, "deduplicate", source, info);
+}
+
+void DeduplicateStage::dedup(int& stat)
+{
+    if (mReplace)
+    {
+        common::CallTM enable("glEnable");
+        enable.mArgs.push_back(new common::ValueTM((GLenum)GL_INVALID_INDEX));
+        enable.mTid = mTid;
+        emit(&enable);
+    }
+    mState->dedups++;
+    stat++;
+}
+
+bool DeduplicateStage::process(common::CallTM* call)
+{
+    if (call->mTid != mTid)
+    {
+        return emit(call);
+    }
+
+    State& s = *mState;
+    if (call->mCallName == "glUseProgram")
+    {
+        const GLenum id = call->mArgs[0]->GetAsUInt();
+        if (id != s.current_program_id || id == 0)
+        {
+            s.uniform2f.clear();
+            s.uniform3f.clear();
+            s.vertexattrib.clear();
+            s.enablevertex.clear();
+            s.current_program_id = id;
+        }
+        else
+        {
+            dedup(s.useprograms);
+            return true; // skip
+        }
+    }
+    else if (call->mCallName == "eglMakeCurrent")
+    {
+        s.uniform2f.clear();
+        s.uniform3f.clear();
+        s.buffers.clear();
+        s.textures.clear();
+        s.samplers.clear();
+        s.vertexattrib.clear();
+        s.scissors = std::make_tuple(-1, -1, -1, -1);
+        s.blendfunc = std::make_tuple(GL_NONE, GL_NONE);
+        s.depthfunc = GL_NONE;
+        s.enabled.clear();
+        s.blendcolor = std::make_tuple(0.0f, 0.0f, 0.0f, 0.0f);
+        s.enablevertex.clear();
+        s.current_program_id = 0;
+    }
+
+    if (call->mCallName == "glBindBuffer" && (mFlags & DEDUP_BUFFERS))
+    {
+        const GLenum target = call->mArgs[0]->GetAsUInt();
+        const GLuint id = call->mArgs[1]->GetAsUInt();
+        if (s.buffers.count(target) == 0 || s.buffers.at(target) != id)
+        {
+            s.buffers[target] = id;
+            return emit(call);
+        }
+        dedup(s.bindbuffers);
+    }
+    else if (call->mCallName == "glVertexAttribDivisor" && (mFlags & DEDUP_VERTEXATTRIB))
+    {
+        const GLuint target = call->mArgs[0]->GetAsUInt();
+        const GLuint divisor = call->mArgs[1]->GetAsUInt();
+        const bool dupe = s.vertexdivisor.count(target) > 0 && s.vertexdivisor[target] == divisor;
+        s.vertexdivisor[target] = divisor;
+        if (!dupe) return emit(call);
+        dedup(s.enables);
+    }
+    else if (call->mCallName == "glEnableVertexAttribArray" && (mFlags & DEDUP_VERTEXATTRIB))
+    {
+        const GLenum target = call->mArgs[0]->GetAsUInt();
+        const bool dupe = s.enablevertex.count(target) > 0 && s.enablevertex[target];
+        s.enablevertex[target] = true;
+        if (!dupe) return emit(call);
+        dedup(s.enables);
+    }
+    else if (call->mCallName == "glDisableVertexAttribArray" && (mFlags & DEDUP_VERTEXATTRIB))
+    {
+        const GLenum target = call->mArgs[0]->GetAsUInt();
+        const bool dupe = s.enablevertex.count(target) > 0 && !s.enablevertex[target];
+        s.enablevertex[target] = false;
+        if (!dupe) return emit(call);
+        dedup(s.enables);
+    }
+    else if (call->mCallName == "glEnable" && (mFlags & DEDUP_ENABLE))
+    {
+        const GLenum key = call->mArgs[0]->GetAsUInt();
+        if (s.enabled.count(key) == 0 || !s.enabled.at(key))
+        {
+            s.enabled[key] = true;
+            return emit(call);
+        }
+        dedup(s.enables);
+    }
+    else if (call->mCallName == "glDisable" && (mFlags & DEDUP_ENABLE))
+    {
+        const GLenum key = call->mArgs[0]->GetAsUInt();
+        if (s.enabled.count(key) == 0 || s.enabled.at(key))
+        {
+            s.enabled[key] = false;
+            return emit(call);
+        }
+        dedup(s.enables);
+    }
+    else if (call->mCallName == "glScissor" && (mFlags & DEDUP_SCISSORS))
+    {
+        const GLint x = call->mArgs[0]->GetAsInt();
+        const GLint y = call->mArgs[1]->GetAsInt();
+        const GLsizei width = call->mArgs[2]->GetAsInt();
+        const GLsizei height = call->mArgs[3]->GetAsInt();
+        auto val = std::make_tuple(x, y, width, height);
+        if (s.scissors != val)
+        {
+            s.scissors = val;
+            return emit(call);
+        }
+        dedup(s.scissordupes);
+    }
+    else if (call->mCallName == "glDepthFunc" && (mFlags & DEDUP_DEPTHFUNC))
+    {
+        const GLenum func = call->mArgs[0]->GetAsUInt();
+        if (s.depthfunc != func)
+        {
+            s.depthfunc = func;
+            return emit(call);
+        }
+        dedup(s.depthfuncs);
+    }
+    else if (call->mCallName == "glBlendFunc" && (mFlags & DEDUP_BLENDFUNC))
+    {
+        const GLenum sfactor = call->mArgs[0]->GetAsUInt();
+        const GLenum dfactor = call->mArgs[1]->GetAsUInt();
+        auto val = std::make_tuple(sfactor, dfactor);
+        if (s.blendfunc != val)
+        {
+            s.blendfunc = val;
+            return emit(call);
+        }
+        dedup(s.blendfuncs);
+    }
+    else if (call->mCallName == "glVertexAttribPointer" && (mFlags & DEDUP_VERTEXATTRIB))
+    {
+        const GLuint index = call->mArgs[0]->GetAsUInt();
+        const GLint size = call->mArgs[1]->GetAsInt();
+        const GLenum type = call->mArgs[2]->GetAsUInt();
+        const GLboolean normalized = (GLboolean)call->mArgs[3]->GetAsUInt();
+        const GLsizei stride = call->mArgs[4]->GetAsInt();
+        const uint64_t pointer = call->mArgs[5]->GetAsUInt64();
+        auto val = std::make_tuple(index, size, type, normalized, stride, pointer);
+        if (s.vertexattrib.count(index) == 0 || s.vertexattrib[index] != val)
+        {
+            s.vertexattrib[index] = val;
+            return emit(call);
+        }
+        dedup(s.vertexattrs);
+    }
+    else if (call->mCallName == "glBlendColor" && (mFlags & DEDUP_BLENDFUNC))
+    {
+        const GLfloat r = call->mArgs[0]->GetAsFloat();
+        const GLfloat g = call->mArgs[1]->GetAsFloat();
+        const GLfloat b = call->mArgs[2]->GetAsFloat();
+        const GLfloat a = call->mArgs[3]->GetAsFloat();
+        auto val = std::make_tuple(r, g, b, a);
+        if (s.blendcolor != val)
+        {
+            s.blendcolor = val;
+            return emit(call);
+        }
+        dedup(s.blendcols);
+    }
+    else if (call->mCallName == "glBindTexture" && (mFlags & DEDUP_TEXTURES))
+    {
+        const GLenum target = call->mArgs[0]->GetAsUInt();
+        const GLuint id = call->mArgs[1]->GetAsUInt();
+        if (s.textures.count(target) == 0 || s.textures.at(target) != id)
+        {
+            s.textures[target] = id;
+            s.samplers.clear();
+            return emit(call);
+        }
+        dedup(s.bindtexs);
+    }
+    else if (call->mCallName == "glBindSampler" && (mFlags & DEDUP_TEXTURES))
+    {
+        const GLenum target = call->mArgs[0]->GetAsUInt();
+        const GLuint id = call->mArgs[1]->GetAsUInt();
+        if (s.samplers.count(target) == 0 || s.samplers.at(target) != id)
+        {
+            s.samplers[target] = id;
+            return emit(call);
+        }
+        dedup(s.bindsamps);
+    }
+    else if ((call->mCallName == "glUniform1f" || call->mCallName == "glUniform1fv") && (mFlags & DEDUP_UNIFORMS))
+    {
+        const GLuint location = call->mArgs[0]->GetAsUInt();
+        const GLsizei count = (call->mCallName == "glUniform1f") ? 1 : call->mArgs[1]->GetAsUInt();
+        const GLfloat v1 = (call->mCallName == "glUniform1f") ? call->mArgs[1]->GetAsFloat() : call->mArgs[2]->mArray[0].GetAsFloat();
+        if (count != 1 || s.uniform1f.count(location) == 0 || s.uniform1f.at(location) != v1)
+        {
+            s.uniform1f[location] = v1;
+            return emit(call);
+        }
+        dedup(s.uniforms);
+    }
+    else if ((call->mCallName == "glUniform2f" || call->mCallName == "glUniform2fv") && (mFlags & DEDUP_UNIFORMS))
+    {
+        const bool vector = call->mCallName == "glUniform2fv";
+        const GLuint location = call->mArgs[0]->GetAsUInt();
+        const GLsizei count = vector ? call->mArgs[1]->GetAsUInt() : 1;
+        const GLfloat v1 = vector ? call->mArgs[2]->mArray[0].GetAsFloat() : call->mArgs[1]->GetAsFloat();
+        const GLfloat v2 = vector ? call->mArgs[2]->mArray[1].GetAsFloat() : call->mArgs[2]->GetAsFloat();
+        if (count != 1 || s.uniform2f.count(location) == 0 || s.uniform2f.at(location) != std::make_tuple(v1, v2))
+        {
+            s.uniform2f[location] = std::make_tuple(v1, v2);
+            return emit(call);
+        }
+        dedup(s.uniforms);
+    }
+    else if ((call->mCallName == "glUniform3f" || call->mCallName == "glUniform3fv") && (mFlags & DEDUP_UNIFORMS))
+    {
+        const bool vector = call->mCallName == "glUniform3fv";
+        const GLuint location = call->mArgs[0]->GetAsUInt();
+        const GLsizei count = vector ? call->mArgs[1]->GetAsUInt() : 1;
+        const GLfloat v1 = vector ? call->mArgs[2]->mArray[0].GetAsFloat() : call->mArgs[1]->GetAsFloat();
+        const GLfloat v2 = vector ? call->mArgs[2]->mArray[1].GetAsFloat() : call->mArgs[2]->GetAsFloat();
+        const GLfloat v3 = vector ? call->mArgs[2]->mArray[2].GetAsFloat() : call->mArgs[3]->GetAsFloat();
+        if (count != 1 || s.uniform3f.count(location) == 0 || s.uniform3f.at(location) != std::make_tuple(v1, v2, v3))
+        {
+            s.uniform3f[location] = std::make_tuple(v1, v2, v3);
+            return emit(call);
+        }
+        dedup(s.uniforms);
+    }
+    else if (call->mCallName == "eglSwapBuffers" && isSourceCall(call) && input().frames != mEndFrame) // log (slow) progress
+    {
+        DBG_LOG("Frame %d / %d\n", input().frames, mEndFrame);
+        return emit(call);
+    }
+    else if (call->mCallName == "eglSwapBuffers" && isSourceCall(call) && input().frames == mEndFrame) // terminate here?
+    {
+        emit(call);
+        DBG_LOG("Ending!\n");
+        return false;
+    }
+    else
+    {
+        return emit(call);
+    }
+    return true;
+}
+
+void DeduplicateStage::finish()
+{
+    const State& s = *mState;
+    DBG_LOG("Removed %ld calls\n", s.dedups);
+    if (s.useprograms) DBG_LOG("Removed %d glUseProgram calls\n", s.useprograms);
+    if (s.vertexattrs) DBG_LOG("Removed %d vertex attr calls\n", s.vertexattrs);
+    if (s.bindbuffers) DBG_LOG("Removed %d bindbuffer calls\n", s.bindbuffers);
+    if (s.enables) DBG_LOG("Removed %d enable/disable calls\n", s.enables);
+    if (s.scissordupes) DBG_LOG("Removed %d scissor calls\n", s.scissordupes);
+    if (s.blendcols) DBG_LOG("Removed %d blendcol calls\n", s.blendcols);
+    if (s.bindtexs) DBG_LOG("Removed %d bindtexture calls\n", s.bindtexs);
+    if (s.bindsamps) DBG_LOG("Removed %d bindsampler calls\n", s.bindsamps);
+    if (s.uniforms) DBG_LOG("Removed %d uniform calls\n", s.uniforms);
+    if (s.depthfuncs) DBG_LOG("Removed %d depth func calls\n", s.depthfuncs);
+    if (s.blendfuncs) DBG_LOG("Removed %d blend func calls\n", s.blendfuncs);
+}
+
+void ClientSideTrimStage::header(Json::Value& header, const std::string& source)
+{
+    Json::Value info;
+    addConversionEntry(header, "inject_client_side_delete", source, info);
+}
+
+void ClientSideTrimStage::prepare(ParseInterface& input)
+{
+    for (unsigned tid = 0; tid < input.client_side_last_use.size(); tid++)
+    {
+        int count = 0;
+        input.client_side_last_use[tid].for_each([&](unsigned name, int call)
+        {
+            mLastUse.emplace(call, name);
+            count++;
+        });
+        if (count) DBG_LOG("Thread %u has %d cs:call pairs\n", tid, count);
+    }
+}
+
+bool ClientSideTrimStage::process(common::CallTM* call)
+{
+    const bool keepGoing = emit(call);
+    if (!isSourceCall(call))
+    {
+        return keepGoing;
+    }
+    const auto range = mLastUse.equal_range(call->mCallNo);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        common::CallTM deletion("glDeleteClientSideBuffer");
+        deletion.mArgs.push_back(new common::ValueTM(it->second));
+        deletion.mTid = call->mTid;
+        emit(&deletion);
+        mInjected++;
+    }
+    return keepGoing;
+}
+
+void ClientSideTrimStage::finish()
+{
+    DBG_LOG("Injected %d deletion calls\n", mInjected);
+}
@@ -0,0 +1,179 @@
+#ifndef CALL_PIPELINE_HPP
+#define CALL_PIPELINE_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tool/parse_interface.h"
+
+#define DEDUP_BUFFERS 1
+#define DEDUP_UNIFORMS 2
+#define DEDUP_TEXTURES 4
+#define DEDUP_SCISSORS 8
+#define DEDUP_BLENDFUNC 16
+#define DEDUP_ENABLE 32
+#define DEDUP_DEPTHFUNC 64
+#define DEDUP_VERTEXATTRIB 64
+
+class CallPipeline;
+
+/// A transform of a CallPipeline. Each call of the source trace is handed by pointer from
+/// stage to stage, and a stage passes on to the next one the calls it keeps, changes or adds
+/// by calling emit(). A call that is not emitted is removed from the output.
+class CallStage
+{
+public:
+    virtual ~CallStage() {}
+
+    /// Change the JSON header of the output, and add a conversion entry for the stage
+    virtual void header(Json::Value& header, const std::string& source) = 0;
+
+    /// Return false to end the output trace here
+    virtual bool process(common::CallTM* call) = 0;
+
+    /// Stages that need to see the whole source trace before the first call is processed
+    /// get a decode-only pass over it first, after which prepare() is called
+    virtual bool needsAnalysis() const { return false; }
+    virtual void prepare(ParseInterface& input) {}
+
+    /// Log what the stage did
+    virtual void finish() {}
+
+protected:
+    bool emit(common::CallTM* call);
+    /// Whether the call was decoded from the source, and not added by an earlier stage
+    bool isSourceCall(const common::CallTM* call) const;
+    ParseInterface& input() const;
+
+private:
+    friend class CallPipeline;
+    CallStage* mNext = nullptr;
+    CallPipeline* mPipeline = nullptr;
+};
+
+/// Applies any number of stages to a trace in a single decode and encode pass, instead of
+/// decoding, serializing and compressing the whole trace again for each transform.
+class CallPipeline
+{
+public:
+    ~CallPipeline();
+
+    /// Append a stage, which the pipeline takes ownership of
+    void add(CallStage* stage);
+    bool empty() const { return mStages.empty(); }
+
+    bool run(const std::string& source, const std::string& target);
+
+private:
+    friend class CallStage;
+    bool write(common::CallTM* call);
+
+    std::vector<CallStage*> mStages;
+    ParseInterface* mInput = nullptr;
+    common::OutFile mOutput;
+    long mWritten = 0;
+};
+
+/// Removes the calls of a thread
+class StripStage : public CallStage
+{
+public:
+    StripStage(int tid) : mTid(tid) {}
+    virtual void header(Json::Value& header, const std::string& source) override;
+    virtual bool process(common::CallTM* call) override;
+    virtual void finish() override;
+
+private:
+    int mTid;
+    int mRemoved = 0;
+};
+
+/// Removes the source calls from first to last, inclusive
+class TrimStage : public CallStage
+{
+public:
+    TrimStage(unsigned first, unsigned last) : mFirst(first), mLast(last) {}
+    virtual void header(Json::Value& header, const std::string& source) override;
+    virtual bool process(common::CallTM* call) override;
+    virtual void finish() override;
+
+private:
+    unsigned mFirst;
+    unsigned mLast;
+    int mRemoved = 0;
+};
+
+/// Changes the window size in the header and the size of every glViewport
+class ResizeStage : public CallStage
+{
+public:
+    ResizeStage(int width, int height) : mWidth(width), mHeight(height) {}
+    virtual void header(Json::Value& header, const std::string& source) override;
+    virtual bool process(common::CallTM* call) override;
+    virtual void finish() override;
+
+private:
+    int mWidth;
+    int mHeight;
+    int mViewports = 0;
+};
+
+/// Renames every call to a function
+class RenameStage : public CallStage
+{
+public:
+    RenameStage(const std::string& from, const std::string& to) : mFrom(from), mTo(to) {}
+    virtual void header(Json::Value& header, const std::string& source) override;
+    virtual bool process(common::CallTM* call) override;
+    virtual void finish() override;
+
+private:
+    std::string mFrom;
+    std::string mTo;
+    int mRenamed = 0;
+};
+
+/// Removes state changes of the default thread that set what is already set, for the kinds
+/// of state in flags (DEDUP_*). Calls of other threads are passed through untouched.
+class DeduplicateStage : public CallStage
+{
+public:
+    /// With replace the removed calls are replaced with glEnable(GL_INVALID_INDEX). The trace
+    /// ends at the swap of endframe, unless that is negative.
+    DeduplicateStage(int flags, int endframe = -1, bool replace = false);
+    virtual ~DeduplicateStage();
+    virtual void header(Json::Value& header, const std::string& source) override;
+    virtual bool process(common::CallTM* call) override;
+    virtual void finish() override;
+
+private:
+    struct State;
+    void dedup(int& stat);
+
+    int mFlags;
+    int mEndFrame;
+    bool mReplace;
+    unsigned mTid = 0;
+    State* mState;
+};
+
+/// Adds a glDeleteClientSideBuffer after the last use of each client side buffer. Where the
+/// last uses are is found by a pass over the source trace, before any stage changes it.
+class ClientSideTrimStage : public CallStage
+{
+public:
+    virtual void header(Json::Value& header, const std::string& source) override;
+    virtual bool process(common::CallTM* call) override;
+    virtual bool needsAnalysis() const override { return true; }
+    virtual void prepare(ParseInterface& input) override;
+    virtual void finish() override;
+
+private:
+    /// Client side buffers by the call number of their last use, the thread is that of the call.
+    /// A draw can be the last use of several.
+    std::multimap<int, unsigned> mLastUse;
+    int mInjected = 0;
+};
+
+#endif
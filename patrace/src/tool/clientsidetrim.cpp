@@ -1,38 +1,32 @@
-// Warning: This tool is a huge hack, use with care!
+// Deletes each client side buffer after its last use. The source trace is scanned once,
+// decoding only the calls that can use a client side buffer, and then copied with the
+// deletions added, the compressed chunks between them as they are.
 
-#include <utility>
-#include <EGL/egl.h>
-#include <GLES2/gl2.h>
-#include <GLES3/gl31.h>
-#include <GLES3/gl32.h>
-#include <limits.h>
-#include <unordered_map>
-
-#include "tool/parse_interface.h"
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <vector>
 
 #include "common/in_file.hpp"
 #include "common/file_format.hpp"
+#include "common/out_file.hpp"
 #include "common/api_info.hpp"
 #include "common/parse_api.hpp"
 #include "common/trace_model.hpp"
-#include "common/gl_utility.hpp"
 #include "common/os.hpp"
-#include "eglstate/context.hpp"
 #include "tool/config.hpp"
-#include "base/base.hpp"
 #include "tool/utils.hpp"
 
-static bool debug = false;
-#define DEBUG_LOG(...) if (debug) DBG_LOG(__VA_ARGS__)
-
 static void printHelp()
 {
     std::cout <<
-        "Usage : deduplicator [OPTIONS] trace_file.pat new_file.pat\n"
+        "Usage : clientsidetrim [OPTIONS] trace_file.pat new_file.pat\n"
+        "Adds a glDeleteClientSideBuffer after the last use of each client side buffer.\n"
         "Options:\n"
         "  -h            Print help\n"
         "  -v            Print version\n"
         "  -d            Print debug info\n"
+        "  -drop         Also remove the uploads to client side buffers that are never read after them\n"
         ;
 }
 
@@ -41,17 +35,272 @@ static void printVersion()
     std::cout << PATRACE_VERSION << std::endl;
 }
 
-static void writeout(common::OutFile &outputFile, common::CallTM *call)
+/// What a call can do to client side buffers, by function id of the source trace
+enum CallKind
+{
+    KIND_NONE,
+    KIND_MAKE_CURRENT,
+    KIND_BIND_VERTEX_ARRAY,
+    KIND_ATTRIB_POINTER,
+    KIND_ENABLE_ATTRIB,
+    KIND_DISABLE_ATTRIB,
+    KIND_COPY,
+    KIND_DATA,
+    KIND_DELETE,
+    KIND_DRAW
+};
+
+static CallKind callKind(const std::string& name)
+{
+    if (name == "eglMakeCurrent") return KIND_MAKE_CURRENT;
+    if (name == "glBindVertexArray" || name == "glBindVertexArrayOES") return KIND_BIND_VERTEX_ARRAY;
+    if (name == "glVertexAttribPointer" || name == "glVertexAttribIPointer") return KIND_ATTRIB_POINTER;
+    if (name == "glEnableVertexAttribArray") return KIND_ENABLE_ATTRIB;
+    if (name == "glDisableVertexAttribArray") return KIND_DISABLE_ATTRIB;
+    if (name == "glCopyClientSideBuffer") return KIND_COPY;
+    if (name == "glClientSideBufferData" || name == "glClientSideBufferSubData") return KIND_DATA;
+    if (name == "glDeleteClientSideBuffer") return KIND_DELETE;
+    if ((name.compare(0, 6, "glDraw") == 0 && name.compare(0, 13, "glDrawBuffers") != 0) || name.compare(0, 11, "glMultiDraw") == 0) return KIND_DRAW;
+    return KIND_NONE;
+}
+
+static bool isClientSideReference(const common::ValueTM* value)
+{
+    return value->mType == common::Opaque_Type && value->mOpaqueType == common::ClientSideBufferObjectReferenceType && value->mOpaqueIns;
+}
+
+/// One client side buffer, from its first use until it is deleted
+struct ClientSideBuffer
+{
+    int lastRead = -1; ///< call number
+    int lastUse = -1; ///< call number of the last read or upload
+    unsigned short lastReadFunc = 0; ///< function ids of those calls, for debugging
+    unsigned short lastUseFunc = 0;
+    std::vector<int> unreadUploads; ///< call numbers of the uploads since the last read
+};
+
+/// Client side buffers of a thread, by name. The tracer hands out names from a counter, so
+/// they index a vector. Names that flatten_threads moved far apart for other threads are
+/// kept in a map instead.
+struct ThreadBuffers
+{
+    enum { DENSE_LIMIT = 1 << 20 };
+    std::vector<ClientSideBuffer> dense;
+    std::map<unsigned, ClientSideBuffer> sparse;
+
+    ClientSideBuffer& get(unsigned name)
+    {
+        if (name >= DENSE_LIMIT) return sparse[name];
+        if (name >= dense.size()) dense.resize(std::max<size_t>(name + 1, dense.size() * 2));
+        return dense[name];
+    }
+};
+
+/// The client side buffers that the vertex attributes of a vertex array object point into
+struct VertexArray
+{
+    std::vector<int> buffers; ///< by attribute index, -1 if not a client side buffer
+    std::vector<bool> enabled;
+
+    void resize(unsigned index)
+    {
+        if (index >= buffers.size())
+        {
+            buffers.resize(index + 1, -1);
+            enabled.resize(index + 1, false);
+        }
+    }
+};
+
+struct Edit
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
+    int call;
+    bool drop; ///< remove the call, or else add a deletion after it
+    unsigned char tid;
+    unsigned name;
+
+    bool operator<(const Edit& other) const { return call < other.call; }
+};
+
+class Scanner
+{
+public:
+    Scanner(bool drop, bool debug) : mDrop(drop), mDebug(debug) {}
+
+    bool scan(const char* filename);
+
+    std::vector<Edit> edits;
+
+private:
+    void read(unsigned char tid, unsigned name, int callNo, unsigned short func);
+    void upload(unsigned char tid, unsigned name, int callNo, unsigned short func);
+    /// The buffer is deleted by the trace itself, or else at the end of the trace
+    void retire(unsigned char tid, unsigned name, ClientSideBuffer& buffer, bool deleted);
+    VertexArray& vertexArray(unsigned char tid);
+
+    bool mDrop;
+    bool mDebug;
+    common::InFile mInput;
+    std::vector<ThreadBuffers> mBuffers; // by thread
+    std::map<std::tuple<unsigned char, int, int>, VertexArray> mVertexArrays; // by thread, context and name
+    std::map<unsigned char, std::pair<int, int>> mCurrent; // thread -> context and vertex array object
+};
+
+VertexArray& Scanner::vertexArray(unsigned char tid)
+{
+    const std::pair<int, int>& current = mCurrent[tid];
+    return mVertexArrays[std::make_tuple(tid, current.first, current.second)];
+}
+
+void Scanner::read(unsigned char tid, unsigned name, int callNo, unsigned short func)
+{
+    if (tid >= mBuffers.size()) mBuffers.resize(tid + 1);
+    ClientSideBuffer& buffer = mBuffers[tid].get(name);
+    buffer.lastRead = buffer.lastUse = callNo;
+    buffer.lastReadFunc = buffer.lastUseFunc = func;
+    buffer.unreadUploads.clear();
+}
+
+void Scanner::upload(unsigned char tid, unsigned name, int callNo, unsigned short func)
+{
+    if (tid >= mBuffers.size()) mBuffers.resize(tid + 1);
+    ClientSideBuffer& buffer = mBuffers[tid].get(name);
+    buffer.lastUse = callNo;
+    buffer.lastUseFunc = func;
+    if (mDrop) buffer.unreadUploads.push_back(callNo);
+}
+
+void Scanner::retire(unsigned char tid, unsigned name, ClientSideBuffer& buffer, bool deleted)
+{
+    if (buffer.lastUse < 0)
+    {
+        return;
+    }
+    for (int callNo : buffer.unreadUploads)
+    {
+        edits.push_back({ callNo, true, tid, name });
+    }
+    // Without dropping, the uploads after the last read are uses as well
+    const int last = mDrop ? buffer.lastRead : buffer.lastUse;
+    if (!deleted && last >= 0)
+    {
+        edits.push_back({ last, false, tid, name });
+        if (mDebug)
+        {
+            DBG_LOG("t%u cs%u last used by call %d %s\n", tid, name, last, mInput.ExIdToName(mDrop ? buffer.lastReadFunc : buffer.lastUseFunc));
+        }
+    }
+    buffer = ClientSideBuffer();
+}
+
+bool Scanner::scan(const char* filename)
+{
+    if (!mInput.Open(filename))
+    {
+        DBG_LOG("Failed to open for reading: %s\n", filename);
+        return false;
+    }
+
+    std::vector<CallKind> kinds(mInput.getMaxSigId() + 1, KIND_NONE);
+    for (int id = 1; id <= mInput.getMaxSigId(); id++)
+    {
+        kinds[id] = callKind(mInput.ExIdToName(id));
+    }
+
+    common::CallTM call;
+    void *fptr = nullptr;
+    char *src = nullptr;
+    common::BCall_vlen bcall;
+    int callNo = 0;
+    for (; mInput.GetNextCall(fptr, bcall, src); callNo++)
+    {
+        const CallKind kind = kinds[bcall.funcId];
+        if (kind == KIND_NONE)
+        {
+            continue;
+        }
+        // blobs can point into the chunk, since nothing of the call is kept
+        call.Reload(mInput, callNo, bcall, true);
+        const unsigned char tid = call.mTid;
+        switch (kind)
+        {
+        case KIND_MAKE_CURRENT:
+            mCurrent[tid] = std::make_pair(call.mArgs[3]->GetAsInt(), 0);
+            break;
+        case KIND_BIND_VERTEX_ARRAY:
+            mCurrent[tid].second = call.mArgs[0]->GetAsInt();
+            break;
+        case KIND_ATTRIB_POINTER:
+        {
+            const unsigned index = call.mArgs[0]->GetAsUInt();
+            const common::ValueTM* pointer = call.mArgs.back();
+            VertexArray& vao = vertexArray(tid);
+            vao.resize(index);
+            vao.buffers[index] = isClientSideReference(pointer) ? (int)pointer->mOpaqueIns->mClientSideBufferName : -1;
+            if (vao.buffers[index] >= 0) read(tid, vao.buffers[index], callNo, bcall.funcId);
+            break;
+        }
+        case KIND_ENABLE_ATTRIB:
+        case KIND_DISABLE_ATTRIB:
+        {
+            const unsigned index = call.mArgs[0]->GetAsUInt();
+            VertexArray& vao = vertexArray(tid);
+            vao.resize(index);
+            vao.enabled[index] = (kind == KIND_ENABLE_ATTRIB);
+            break;
+        }
+        case KIND_COPY:
+            read(tid, call.mArgs[1]->GetAsUInt(), callNo, bcall.funcId);
+            break;
+        case KIND_DATA:
+            upload(tid, call.mArgs[0]->GetAsUInt(), callNo, bcall.funcId);
+            break;
+        case KIND_DELETE:
+        {
+            const unsigned name = call.mArgs[0]->GetAsUInt();
+            if (tid < mBuffers.size()) retire(tid, name, mBuffers[tid].get(name), true);
+            break;
+        }
+        case KIND_DRAW:
+        {
+            // assume any enabled arrays are accessed
+            const VertexArray& vao = vertexArray(tid);
+            for (unsigned i = 0; i < vao.buffers.size(); i++)
+            {
+                if (vao.enabled[i] && vao.buffers[i] >= 0) read(tid, vao.buffers[i], callNo, bcall.funcId);
+            }
+            for (const common::ValueTM* arg : call.mArgs)
+            {
+                if (isClientSideReference(arg)) read(tid, arg->mOpaqueIns->mClientSideBufferName, callNo, bcall.funcId);
+            }
+            break;
+        }
+        case KIND_NONE:
+            break;
+        }
+    }
+
+    for (unsigned tid = 0; tid < mBuffers.size(); tid++)
+    {
+        for (unsigned name = 0; name < mBuffers[tid].dense.size(); name++)
+        {
+            retire(tid, name, mBuffers[tid].dense[name], false);
+        }
+        for (auto& pair : mBuffers[tid].sparse)
+        {
+            retire(tid, pair.first, pair.second, false);
+        }
+    }
+    std::stable_sort(edits.begin(), edits.end());
+    DBG_LOG("Scanned %d calls\n", callNo);
+    mInput.Close();
+    return true;
 }
 
 int main(int argc, char **argv)
 {
+    bool debug = false;
+    bool drop = false;
     int argIndex = 1;
     for (; argIndex < argc; ++argIndex)
     {
@@ -70,6 +319,10 @@ int main(int argc, char **argv)
         {
             debug = true;
         }
+        else if (arg == "-drop")
+        {
+            drop = true;
+        }
         else if (arg == "-v")
         {
             printVersion();
@@ -88,69 +341,90 @@ int main(int argc, char **argv)
         printHelp();
         return 1;
     }
-    std::string source_trace_filename = argv[argIndex++];
-    ParseInterface *inputFile = new ParseInterface(true);
-    inputFile->setQuickMode(true);
-    inputFile->setScreenshots(false);
-    if (!inputFile->open(source_trace_filename))
+    const char* source_trace_filename = argv[argIndex++];
+    const char* target_trace_filename = argv[argIndex++];
+
+    common::gApiInfo.RegisterEntries(common::parse_callbacks);
+    Scanner scanner(drop, debug);
+    if (!scanner.scan(source_trace_filename))
     {
-        std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
         return 1;
     }
 
+    common::TraceFileTM inputFile;
+    if (!inputFile.Open(source_trace_filename))
+    {
+        DBG_LOG("Failed to open for reading: %s\n", source_trace_filename);
+        return 1;
+    }
+
+    // The calls are copied as they are, so they keep the function ids of the source trace
+    std::vector<std::string> sigbook;
+    inputFile.mpInFileRA->copySigBook(sigbook);
+    int deletionId = inputFile.mpInFileRA->NameToExId("glDeleteClientSideBuffer");
+    if (deletionId == 0)
+    {
+        sigbook.push_back("glDeleteClientSideBuffer");
+        deletionId = sigbook.size() - 1;
+    }
     common::OutFile outputFile;
-    std::string target_trace_filename = argv[argIndex++];
-    if (!outputFile.Open(target_trace_filename.c_str()))
+    if (!outputFile.Open(target_trace_filename, true, &sigbook))
     {
-        std::cerr << "Failed to open for writing: " << target_trace_filename << std::endl;
+        DBG_LOG("Failed to open for writing: %s\n", target_trace_filename);
         return 1;
     }
-    Json::Value header = inputFile->header;
+
+    Json::Value header = inputFile.mpInFileRA->getJSONHeader();
     Json::Value info;
+    info["drop"] = drop;
     addConversionEntry(header, "inject_client_side_delete", source_trace_filename, info);
     Json::FastWriter writer;
     const std::string json_header = writer.write(header);
     outputFile.mHeader.jsonLength = json_header.size();
     outputFile.WriteHeader(json_header.c_str(), json_header.size());
 
-    common::CallTM *call = nullptr;
-    while ((call = inputFile->next_call())) {}
-    const auto client_side_last_use = inputFile->client_side_last_use;
-    const auto client_side_last_use_reason = inputFile->client_side_last_use_reason;
-    inputFile->close();
-    delete inputFile;
-    inputFile = new ParseInterface(true);
-    if (!inputFile->open(source_trace_filename))
-    {
-        std::cerr << "Failed to open for reading again: " << source_trace_filename << std::endl;
-        return 1;
-    }
-    std::map<int, int> callno_to_client_side_last_use; // call no, client id; thread id implicit
-    for (const auto& thread : client_side_last_use) // pair of thread : (pair of cs id, call number)
+    const common::FrameTM* lastFrame = inputFile.mFrames.empty() ? NULL : inputFile.mFrames.back();
+    const unsigned int callCount = lastFrame ? lastFrame->mFirstCallOfThisFrame + lastFrame->GetCallCount() : 0;
+
+    // Copy up to each edit, which either skips the call or writes a deletion after it
+    int injected = 0;
+    int dropped = 0;
+    int copied = 0;
+    unsigned int next = 0;
+    for (const Edit& edit : scanner.edits)
     {
-        printf("Thread %d has %d cs:call pairs\n", thread.first, (int)thread.second.size());
-        for (const auto& pair : thread.second)
+        const unsigned int end = edit.drop ? edit.call : edit.call + 1;
+        const int chunks = (next < end) ? inputFile.CopyCalls(next, end, outputFile) : 0;
+        if (chunks < 0)
         {
-            callno_to_client_side_last_use[pair.second] = pair.first;
-            DBG_LOG("\tt%d cs%d call%d endpoint=%s\n", thread.first, pair.first, pair.second, client_side_last_use_reason.at(thread.first).at(pair.first).c_str());
+            DBG_LOG("Failed to read the calls of %s\n", source_trace_filename);
+            return 1;
         }
-    }
-    int count = 0;
-    while ((call = inputFile->next_call()))
-    {
-        writeout(outputFile, call);
-        if (callno_to_client_side_last_use.count(call->mCallNo) > 0)
+        copied += chunks;
+        next = std::max(next, end);
+        if (edit.drop)
         {
-            common::CallTM deletion("glDeleteClientSideBuffer");
-            deletion.mArgs.push_back(new common::ValueTM(callno_to_client_side_last_use[call->mCallNo]));
-            deletion.mTid = call->mTid;
-            writeout(outputFile, &deletion);
-            count++;
+            next = edit.call + 1;
+            dropped++;
+            continue;
         }
+        common::CallTM deletion("glDeleteClientSideBuffer");
+        deletion.mArgs.push_back(new common::ValueTM(edit.name));
+        deletion.mTid = edit.tid;
+        deletion.Serialize(outputFile, deletionId);
+        injected++;
+    }
+    const int chunks = inputFile.CopyCalls(next, callCount, outputFile);
+    if (chunks < 0)
+    {
+        DBG_LOG("Failed to read the calls of %s\n", source_trace_filename);
+        return 1;
     }
-    inputFile->close();
+    copied += chunks;
 
+    DBG_LOG("Injected %d deletion calls, removed %d unread uploads, copied %d chunks without recompressing them\n", injected, dropped, copied);
+    inputFile.Close();
     outputFile.Close();
-    printf("Injected %d deletion calls\n", count);
+
     return 0;
 }
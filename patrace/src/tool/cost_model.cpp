@@ -0,0 +1,228 @@
+#include "tool/cost_model.hpp"
+
+#include <math.h>
+#include <algorithm>
+#include <fstream>
+
+#include "jsoncpp/include/json/reader.h"
+#include "jsoncpp/include/json/writer.h"
+#include "common/os.hpp"
+
+static const char* featureNames[COST_FEATURE_COUNT] = { "calls", "draws", "vertices", "primitives", "pixels", "attachment_bytes",
+                                                        "vertex_shading", "fragment_shading", "texture_samples" };
+
+// Seconds per unit before calibration, somewhere around a mid range mobile GPU
+static const double defaultWeights[COST_FEATURE_COUNT] = { 1e-6, 5e-6, 2e-9, 1e-9, 1e-9, 1e-10, 2e-10, 1e-10, 5e-10 };
+
+CostFeatures& CostFeatures::operator+=(const CostFeatures& rhs)
+{
+    for (int i = 0; i < COST_FEATURE_COUNT; i++)
+    {
+        values[i] += rhs.values[i];
+    }
+    return *this;
+}
+
+Json::Value CostFeatures::toJson() const
+{
+    Json::Value v;
+    for (int i = 0; i < COST_FEATURE_COUNT; i++)
+    {
+        v[featureNames[i]] = values[i];
+    }
+    return v;
+}
+
+CostModel::CostModel()
+{
+    std::copy(defaultWeights, defaultWeights + COST_FEATURE_COUNT, mWeights);
+}
+
+double CostModel::predict(const CostFeatures& features) const
+{
+    double seconds = mBias;
+    for (int i = 0; i < COST_FEATURE_COUNT; i++)
+    {
+        seconds += mWeights[i] * features[i];
+    }
+    return seconds;
+}
+
+bool CostModel::calibrate(const std::vector<CostFeatures>& frames, const std::vector<double>& seconds)
+{
+    const size_t rows = std::min(frames.size(), seconds.size());
+    const int columns = COST_FEATURE_COUNT + 1; // the last one is the bias
+    if (rows < (size_t)columns)
+    {
+        DBG_LOG("Too few frames to calibrate the cost model: %u\n", (unsigned)rows);
+        return false;
+    }
+
+    // Non-negative least squares by coordinate descent, with the columns scaled to unit norm so
+    // that features of very different magnitudes converge alike
+    std::vector<std::vector<double>> x(columns, std::vector<double>(rows));
+    std::vector<double> norms(columns, 0.0);
+    for (int j = 0; j < columns; j++)
+    {
+        for (size_t i = 0; i < rows; i++)
+        {
+            x[j][i] = (j < COST_FEATURE_COUNT) ? frames[i][j] : 1.0;
+            norms[j] += x[j][i] * x[j][i];
+        }
+        norms[j] = sqrt(norms[j]);
+        for (size_t i = 0; i < rows && norms[j] > 0.0; i++)
+        {
+            x[j][i] /= norms[j];
+        }
+    }
+    std::vector<double> w(columns, 0.0);
+    std::vector<double> residual(seconds.begin(), seconds.begin() + rows);
+    for (int sweep = 0; sweep < 1000; sweep++)
+    {
+        double change = 0.0;
+        for (int j = 0; j < columns; j++)
+        {
+            if (norms[j] == 0.0) continue; // the feature never occurs
+            double dot = 0.0;
+            for (size_t i = 0; i < rows; i++)
+            {
+                dot += x[j][i] * residual[i];
+            }
+            const double updated = std::max(0.0, w[j] + dot);
+            const double delta = updated - w[j];
+            for (size_t i = 0; i < rows; i++)
+            {
+                residual[i] -= delta * x[j][i];
+            }
+            w[j] = updated;
+            change = std::max(change, fabs(delta));
+        }
+        if (change < 1e-12) break;
+    }
+
+    for (int j = 0; j < COST_FEATURE_COUNT; j++)
+    {
+        mWeights[j] = norms[j] > 0.0 ? w[j] / norms[j] : 0.0;
+    }
+    mBias = w[COST_FEATURE_COUNT] / norms[COST_FEATURE_COUNT];
+    mCalibrated = true;
+    mCalibrationFrames = rows;
+    mMeanError = 0.0;
+    for (size_t i = 0; i < rows; i++)
+    {
+        if (seconds[i] > 0.0) mMeanError += fabs(predict(frames[i]) - seconds[i]) / seconds[i];
+    }
+    mMeanError /= rows;
+    return true;
+}
+
+Json::Value CostModel::toJson() const
+{
+    Json::Value v;
+    for (int i = 0; i < COST_FEATURE_COUNT; i++)
+    {
+        v["weights"][featureNames[i]] = mWeights[i];
+    }
+    v["bias"] = mBias;
+    v["calibrated"] = mCalibrated;
+    if (mCalibrated)
+    {
+        v["calibration_frames"] = mCalibrationFrames;
+        v["mean_relative_error"] = mMeanError;
+    }
+    return v;
+}
+
+bool CostModel::load(const std::string& filename)
+{
+    std::ifstream fs(filename);
+    Json::Value v;
+    Json::Reader reader;
+    if (!fs || !reader.parse(fs, v) || !v.isMember("weights"))
+    {
+        DBG_LOG("Failed to read a cost model from %s\n", filename.c_str());
+        return false;
+    }
+    for (int i = 0; i < COST_FEATURE_COUNT; i++)
+    {
+        mWeights[i] = v["weights"].get(featureNames[i], 0.0).asDouble();
+    }
+    mBias = v.get("bias", 0.0).asDouble();
+    mCalibrated = v.get("calibrated", false).asBool();
+    mCalibrationFrames = v.get("calibration_frames", 0).asUInt();
+    mMeanError = v.get("mean_relative_error", 0.0).asDouble();
+    return true;
+}
+
+bool CostModel::save(const std::string& filename) const
+{
+    std::ofstream fs(filename, std::fstream::out | std::fstream::trunc);
+    fs << toJson().toStyledString();
+    return (bool)fs;
+}
+
+bool loadMeasuredFrameTimes(const std::string& filename, std::map<int, double>& seconds)
+{
+    std::ifstream fs(filename);
+    Json::Value root;
+    Json::Reader reader;
+    if (!fs || !reader.parse(fs, root))
+    {
+        DBG_LOG("Failed to read the results in %s\n", filename.c_str());
+        return false;
+    }
+    // Result files hold a list of results, one per run
+    const Json::Value& result = (root.isMember("result") && root["result"].size() > 0) ? root["result"][0] : root;
+    if (result.isMember("gpu_timing"))
+    {
+        for (const Json::Value& pass : result["gpu_timing"]["renderpasses"])
+        {
+            if (pass.isMember("time")) seconds[pass["frame"].asInt()] += pass["time"].asDouble();
+        }
+    }
+    else if (result.isMember("frame_phases"))
+    {
+        const Json::Value& phases = result["frame_phases"];
+        const Json::Value& frames = phases["frame"];
+        for (const std::string& name : phases.getMemberNames())
+        {
+            if (name == "frame") continue;
+            for (unsigned i = 0; i < phases[name].size() && i < frames.size(); i++)
+            {
+                seconds[frames[i].asInt()] += phases[name][i].asDouble();
+            }
+        }
+    }
+    if (seconds.empty())
+    {
+        DBG_LOG("%s has no frame times, run paretrace with -drawtime or -perframe\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+void representativeFrames(const std::vector<double>& predicted, unsigned window, unsigned& first, double& mean)
+{
+    first = 0;
+    mean = 0.0;
+    if (predicted.empty()) return;
+    window = std::min<unsigned>(std::max(window, 1u), predicted.size());
+    double total = 0.0;
+    for (const double t : predicted) total += t;
+    const double target = total / predicted.size();
+    double sum = 0.0;
+    double best = -1.0;
+    for (unsigned i = 0; i < predicted.size(); i++)
+    {
+        sum += predicted[i];
+        if (i >= window) sum -= predicted[i - window];
+        if (i + 1 < window) continue;
+        const double distance = fabs(sum / window - target);
+        if (best < 0.0 || distance < best)
+        {
+            best = distance;
+            first = i + 1 - window;
+            mean = sum / window;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef COST_MODEL_HPP
+#define COST_MODEL_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "jsoncpp/include/json/value.h"
+
+/// What a renderpass or frame is made of, as far as the state tracking of analyze_trace can tell
+enum CostFeature
+{
+    COST_CALLS, ///< API calls, for the driver overhead
+    COST_DRAWS,
+    COST_VERTICES,
+    COST_PRIMITIVES,
+    COST_PIXELS, ///< renderpass area, as an upper bound of fragment coverage
+    COST_ATTACHMENT_BYTES, ///< attachments loaded and stored, by their formats
+    COST_VERTEX_SHADING, ///< vertices times the statements of the vertex shaders
+    COST_FRAGMENT_SHADING, ///< pixels times the statements of the fragment shaders
+    COST_TEXTURE_SAMPLES, ///< pixels times the texture lookups of the fragment shaders
+    COST_FEATURE_COUNT
+};
+
+struct CostFeatures
+{
+    double values[COST_FEATURE_COUNT] = {};
+
+    double& operator[](int feature) { return values[feature]; }
+    double operator[](int feature) const { return values[feature]; }
+    CostFeatures& operator+=(const CostFeatures& rhs);
+    Json::Value toJson() const;
+};
+
+/// Linear model of the time a frame or renderpass takes on a device, in seconds, to pick
+/// representative frame ranges without replaying them everywhere. The built-in weights are
+/// rough guesses; calibrate() fits them to the frame times that paretrace measured on the
+/// device, and the result can be saved and loaded for later traces.
+class CostModel
+{
+public:
+    CostModel();
+
+    double predict(const CostFeatures& features) const;
+
+    /// Fit the weights to the measured seconds of each frame, with none of them negative.
+    /// Returns false if there are too few frames.
+    bool calibrate(const std::vector<CostFeatures>& frames, const std::vector<double>& seconds);
+
+    bool load(const std::string& filename);
+    bool save(const std::string& filename) const;
+    Json::Value toJson() const;
+
+private:
+    double mWeights[COST_FEATURE_COUNT];
+    double mBias = 0.0; ///< seconds of every frame
+    bool mCalibrated = false;
+    unsigned mCalibrationFrames = 0;
+    double mMeanError = 0.0; ///< mean relative error of the fit
+};
+
+/// Frame times of a paretrace result file, by frame: the GPU time of the renderpasses if it
+/// was run with GPU timing, or else the sum of the frame phases. Returns false if it has neither.
+bool loadMeasuredFrameTimes(const std::string& filename, std::map<int, double>& seconds);
+
+/// The window of frames whose mean predicted time is closest to that of all frames
+void representativeFrames(const std::vector<double>& predicted, unsigned window, unsigned& first, double& mean);
+
+#endif
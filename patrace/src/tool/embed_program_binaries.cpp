@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/in_file.hpp"
+#include "common/file_format.hpp"
+#include "common/out_file.hpp"
+#include "common/api_info.hpp"
+#include "common/parse_api.hpp"
+#include "common/trace_model.hpp"
+#include "common/os.hpp"
+#include "retracer/shader_cache.hpp"
+#include "tool/config.hpp"
+#include "tool/utils.hpp"
+
+static void printHelp()
+{
+    std::cout <<
+        "Usage : embed_program_binaries [OPTIONS] <source trace> <target trace>\n"
+        "Embeds program binaries in a trace, so that paretrace loads them instead of compiling the shaders\n"
+        "when it runs on the driver that built them. Build them by replaying the trace on the device with\n"
+        "paretrace -shadercache <name>, and give the cache files written there to -cache. Binaries already\n"
+        "embedded in the source trace are kept, unless another cache has them for the same driver.\n"
+        "Options:\n"
+        "  -cache <name>  Shader cache of a replay, <name>.bin and <name>.idx. Can be given several times,\n"
+        "                 such as for several devices\n"
+        "  -replace       Leave out the binaries already embedded in the source trace\n"
+        "  -h             print help\n"
+        "  -v             print version\n"
+        ;
+}
+
+static void printVersion()
+{
+    std::cout << PATRACE_VERSION << std::endl;
+}
+
+struct ProgramBinary
+{
+    std::string md5;
+    std::string driver;
+    uint32_t format;
+    std::vector<char> data;
+};
+typedef std::map<std::string, ProgramBinary> ProgramBinaries; // md5 + driver to binary
+
+static bool addBinaries(retracer::ShaderCache& cache, ProgramBinaries& binaries)
+{
+    return cache.forEach([&](const std::string& md5, const std::string& driver, uint32_t format, const char* data, uint32_t size)
+    {
+        ProgramBinary& binary = binaries[md5 + driver];
+        binary.md5 = md5;
+        binary.driver = driver;
+        binary.format = format;
+        binary.data.assign(data, data + size);
+    });
+}
+
+static void copyKey(char* dest, size_t size, const std::string& key)
+{
+    memset(dest, 0, size);
+    memcpy(dest, key.data(), std::min(key.size(), size));
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> caches;
+    bool replace = false;
+    int argIndex = 1;
+    for (; argIndex < argc; ++argIndex)
+    {
+        const char *arg = argv[argIndex];
+
+        if (arg[0] != '-')
+            break;
+
+        if (!strcmp(arg, "-h"))
+        {
+            printHelp();
+            return 1;
+        }
+        else if (!strcmp(arg, "-v"))
+        {
+            printVersion();
+            return 0;
+        }
+        else if (!strcmp(arg, "-cache") && argIndex + 1 < argc)
+        {
+            caches.push_back(argv[++argIndex]);
+        }
+        else if (!strcmp(arg, "-replace"))
+        {
+            replace = true;
+        }
+        else
+        {
+            printf("Error: Unknow option %s\n", arg);
+            printHelp();
+            return 1;
+        }
+    }
+
+    if (argIndex + 2 > argc || caches.empty())
+    {
+        printHelp();
+        return 1;
+    }
+    const char* source_trace_filename = argv[argIndex++];
+    const char* target_trace_filename = argv[argIndex++];
+
+    common::TraceFileTM inputFile;
+    common::gApiInfo.RegisterEntries(common::parse_callbacks);
+    if (!inputFile.Open(source_trace_filename))
+    {
+        DBG_LOG("Failed to open for reading: %s\n", source_trace_filename);
+        return 1;
+    }
+
+    ProgramBinaries binaries;
+    std::vector<char> section;
+    if (!replace && inputFile.mpInFileRA->readSection("programBinaries", section))
+    {
+        retracer::ShaderCache embedded;
+        if (embedded.openEmbedded(source_trace_filename, section))
+        {
+            addBinaries(embedded, binaries);
+        }
+        DBG_LOG("Kept %u program binaries embedded in %s\n", (unsigned)binaries.size(), source_trace_filename);
+    }
+    for (const std::string& name : caches)
+    {
+        // opening creates name.bin, so check for the index first
+        struct stat st;
+        retracer::ShaderCache cache;
+        if (stat((name + ".idx").c_str(), &st) != 0 || !cache.open(name) || !addBinaries(cache, binaries))
+        {
+            DBG_LOG("Failed to read the shader cache %s{.idx|.bin}\n", name.c_str());
+            return 1;
+        }
+    }
+
+    // The section is written after the calls, then the header is written again to point at it
+    common::BProgramBinariesHeader header;
+    header.magic = PROGRAM_BINARIES_MAGIC;
+    header.count = binaries.size();
+    section.assign((const char*)&header, (const char*)(&header + 1));
+    std::map<std::string, unsigned> drivers;
+    for (const auto& pair : binaries)
+    {
+        const ProgramBinary& binary = pair.second;
+        common::BProgramBinary entry;
+        copyKey(entry.md5, sizeof(entry.md5), binary.md5);
+        copyKey(entry.driver, sizeof(entry.driver), binary.driver);
+        entry.format = binary.format;
+        entry.size = binary.data.size();
+        section.insert(section.end(), (const char*)&entry, (const char*)(&entry + 1));
+        section.insert(section.end(), binary.data.begin(), binary.data.end());
+        drivers[binary.driver]++;
+    }
+
+    // The calls are copied as they are, so they keep the function ids of the source trace
+    std::vector<std::string> sigbook;
+    inputFile.mpInFileRA->copySigBook(sigbook);
+    common::OutFile outputFile;
+    if (!outputFile.Open(target_trace_filename, true, &sigbook))
+    {
+        DBG_LOG("Failed to open for writing: %s\n", target_trace_filename);
+        return 1;
+    }
+
+    Json::Value json = inputFile.mpInFileRA->getJSONHeader();
+    json.removeMember("programBinaries");
+    Json::Value info;
+    for (const std::string& name : caches)
+    {
+        info["caches"].append(name);
+    }
+    info["replace"] = replace;
+    info["programs"] = (unsigned)binaries.size();
+    addConversionEntry(json, "embed_program_binaries", source_trace_filename, info);
+    Json::FastWriter writer;
+    std::string json_header = writer.write(json);
+    outputFile.mHeader.jsonLength = json_header.size();
+    outputFile.WriteHeader(json_header.c_str(), json_header.size());
+
+    const common::FrameTM* lastFrame = inputFile.mFrames.empty() ? NULL : inputFile.mFrames.back();
+    const unsigned int callCount = lastFrame ? lastFrame->mFirstCallOfThisFrame + lastFrame->GetCallCount() : 0;
+    const int chunks = inputFile.CopyCalls(0, callCount, outputFile);
+    if (chunks < 0)
+    {
+        DBG_LOG("Failed to read the calls of %s\n", source_trace_filename);
+        return 1;
+    }
+
+    const uint64_t offset = outputFile.WriteSection(section.data(), section.size());
+    Json::Value& member = json["programBinaries"];
+    member["offset"] = (Json::UInt64)offset;
+    member["size"] = (Json::UInt64)section.size();
+    member["count"] = (unsigned)binaries.size();
+    for (const auto& pair : drivers)
+    {
+        member["drivers"][pair.first] = pair.second;
+    }
+    json_header = writer.write(json);
+    outputFile.mHeader.jsonLength = json_header.size();
+    outputFile.WriteHeader(json_header.c_str(), json_header.size());
+
+    DBG_LOG("Embedded %u program binaries of %u drivers, %u bytes, copied %d chunks without recompressing them\n",
+            (unsigned)binaries.size(), (unsigned)drivers.size(), (unsigned)section.size(), chunks);
+    inputFile.Close();
+    outputFile.Close();
+
+    return 0;
+}
@@ -1,5 +1,4 @@
 #include <vector>
-#include <list>
 #include <map>
 #include <unordered_set>
 #include <EGL/egl.h>
@@ -15,8 +14,8 @@
 #include "eglstate/context.hpp"
 #include "tool/config.hpp"
 #include "base/base.hpp"
+#include "tool/thread_section.hpp"
 #include "tool/utils.hpp"
-#include <common/trace_model.hpp>
 
 const unsigned int CSB_THREAD_REMAP_BASE = 10000000;
 const unsigned int MAX_THREAD_IDX = 428;
@@ -33,6 +32,8 @@ static void printHelp()
         "  -t THREADS    flatten only given comma separated list of threads (by default flatten all threads)\n"
         "  -w            add forceSingleWindow to trace header\n"
         "  -f FIRST LAST your existing frame range, returns -1 if synchronization has to be added inside it\n"
+        "  -m MB         write out the held back calls before the end of the frame once they take more than\n"
+        "                this many megabytes (default 256)\n"
         ;
 }
 
@@ -54,38 +55,34 @@ struct thread_state
     thread_state() : display(-1), draw(-1), read(-1), context(-1) {}
 };
 
-typedef std::list<common::CallTM *> call_list;
-
-static common::FrameTM* _curFrame = NULL;
 static unsigned _curFrameIndex = 0;
-static unsigned _curCallIndexInFrame = 0;
 static bool debug = false;
 static bool no_reindex = false;
 
 static void writeout(common::OutFile &outputFile, common::CallTM *call)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile);
 }
 
-static common::CallTM* next_call(common::TraceFileTM &_fileTM)
+/// Decode the next call of the source, reusing the previous one. The source is read one call at
+/// a time, so only the calls held back in the thread sections take up memory.
+static bool next_call(common::InFile &inputFile, common::CallTM &call, unsigned callNo)
 {
-    if (_curCallIndexInFrame >= _curFrame->GetLoadedCallCount())
-    {
-        _curFrameIndex++;
-        if (_curFrameIndex >= _fileTM.mFrames.size())
-            return NULL;
-        if (_curFrame) _curFrame->UnloadCalls();
-        _curFrame = _fileTM.mFrames[_curFrameIndex];
-        _curFrame->LoadCalls(_fileTM.mpInFileRA);
-        _curCallIndexInFrame = 0;
+    void *fptr = nullptr;
+    char *src = nullptr;
+    common::BCall_vlen bcall;
+    if (!inputFile.GetNextCall(fptr, bcall, src))
+    {
+        return false;
     }
-    common::CallTM *call = _curFrame->mCalls[_curCallIndexInFrame];
-    _curCallIndexInFrame++;
-    return call;
+    // blobs can point into the chunk, since each call is serialized before the next is read
+    call.Reload(inputFile, callNo, bcall, true);
+    return true;
+}
+
+static bool is_swap(const common::CallTM &call, unsigned defaultTid)
+{
+    return call.mTid == defaultTid && (call.mCallName == "eglSwapBuffers" || call.mCallName == "eglSwapBuffersWithDamageKHR");
 }
 
 std::vector<int> extract_ints(std::string const& input_str)
@@ -144,6 +141,7 @@ int main(int argc, char **argv)
     int last_frame = -1;
     int prev_injected = -1;
     std::vector<std::pair<int, int>> non_injected_ranges;
+    size_t max_pending = 256 * 1024 * 1024;
 
     for (; argIndex < argc; ++argIndex)
     {
@@ -190,6 +188,11 @@ int main(int argc, char **argv)
             last_frame = atoi(argv[argIndex]);
             info["framerange"] = std::to_string(first_frame) + "-" + std::to_string(last_frame);
         }
+        else if (!strcmp(arg, "-m") && argIndex + 1 < argc)
+        {
+            argIndex++;
+            max_pending = (size_t)strtoul(argv[argIndex], nullptr, 10) * 1024 * 1024;
+        }
         else if (!strcmp(arg, "-insequence"))
         {
             // -insequence means keeping the order of the calls in the original pat file.
@@ -215,15 +218,13 @@ int main(int argc, char **argv)
     const char* source_trace_filename = argv[argIndex++];
     const char* target_trace_filename = argv[argIndex++];
 
-    common::TraceFileTM inputFile;
+    common::InFile inputFile;
     common::gApiInfo.RegisterEntries(common::parse_callbacks);
     if (!inputFile.Open(source_trace_filename))
     {
         PAT_DEBUG_LOG("Failed to open for reading: %s\n", source_trace_filename);
         return 1;
     }
-    _curFrame = inputFile.mFrames[0];
-    _curFrame->LoadCalls(inputFile.mpInFileRA);
 
     common::OutFile outputFile;
     if (!outputFile.Open(target_trace_filename))
@@ -232,7 +233,7 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    Json::Value header = inputFile.mpInFileRA->getJSONHeader();
+    Json::Value header = inputFile.getJSONHeader();
     Json::Value threadArray = header["threads"];
 
     unsigned numThreads = threadArray.size();
@@ -241,7 +242,8 @@ int main(int argc, char **argv)
         DBG_LOG("Bad number of threads: %d\n", numThreads);
         return 1;
     }
-    std::vector<call_list> calls(numThreads);
+    std::vector<ThreadSection> calls(numThreads);
+    size_t pending = 0; // bytes held back in calls
     std::map<unsigned, thread_state> contexts;
     std::map<unsigned, unsigned> tid_remapping; // because thread IDs may be discontinuous
     int display = -1;
@@ -263,19 +265,76 @@ int main(int argc, char **argv)
             newThreadArray.append(a);
         }
     }
+    const unsigned defaultTid = inputFile.getDefaultThreadID();
     header["defaultTid"] = 0;
     if (addforcesinglewindow)
     {
         header["forceSingleWindow"] = true;
     }
     header["threads"] = newThreadArray;
-    common::CallTM *call = NULL;
+    common::CallTM decoded;
+    common::CallTM *call = &decoded;
     std::map<unsigned, thread_state> initial_contexts = contexts;
     unsigned int previous_tid = 9999;
     bool injected = false;
-    for (int callNo = 0 ;(call = next_call(inputFile)); ++callNo)
+    int callNo = 0;
+    // Write out the calls held back for each thread, one thread after the other
+    auto flush = [&](bool frame_end)
+    {
+        if (debug) DBG_LOG("-- writeout frame %u%s! %u threads --\n", _curFrameIndex, frame_end ? "" : " (part)", (unsigned)calls.size());
+        bool any_injected = false;
+        for (auto &thread : calls)
+        {
+            if (thread.empty())
+            {
+                continue;
+            }
+            const unsigned curTid = thread.tid;
+            const auto &context = initial_contexts.at(curTid);
+            // Inject an eglMakeCurrent to set context and display for each
+            // flattened thread section, to reproduce original behaviour.
+            // However, do not put it in front of EGL calls, since they do
+            // not need it (and may break, eg eglInitialize).
+            common::CallTM makeCurrent("eglMakeCurrent");
+            makeCurrent.mArgs.push_back(new common::ValueTM(context.display));
+            makeCurrent.mArgs.push_back(new common::ValueTM(context.draw));
+            makeCurrent.mArgs.push_back(new common::ValueTM(context.read));
+            makeCurrent.mArgs.push_back(new common::ValueTM(context.context));
+            makeCurrent.mRet = common::ValueTM((int)EGL_TRUE);
+            if (debug) DBG_LOG("  writing (%u calls)[s=%d,c=%d] tid=%u\n", (unsigned)thread.calls(), context.read, context.context, curTid);
+            if (thread.needsMakeCurrent() && context.display == -1)
+            {
+                DBG_LOG("  Warning: eglMakeCurrent(%d,%d,%d,%d) at %u(%u) - invalid display\n",
+                        context.display, context.draw, context.read, context.context, call->mCallNo, callNo);
+            }
+            if (thread.write(outputFile, &makeCurrent))
+            {
+                countInjected++;
+                any_injected = true;
+            }
+        }
+        pending = 0;
+        // We need to remember the context of the latest eglMakeCurrent not in the current frame.
+        // This is because we need to know the 'default' context state to set at the start of each
+        // frame+thread, valid until we hit another, app-supplied eglMakeCurrent.
+        initial_contexts = contexts;
+
+        // Keep track of non-injected franges. If we had a number of frames without injections, track those.
+        // Ignore such ranges with less than 100 frames.
+        if (any_injected && prev_injected != -1 && static_cast<int>(_curFrameIndex) - prev_injected > 100)
+        {
+            non_injected_ranges.push_back(std::make_pair(prev_injected, static_cast<int>(_curFrameIndex) - 1));
+        }
+        if (any_injected)
+        {
+            prev_injected = _curFrameIndex;
+        }
+    };
+
+    for (; next_call(inputFile, decoded, callNo); ++callNo)
     {
         const unsigned tid = call->mTid;
+        const bool frame_end = is_swap(decoded, defaultTid);
 
         if (callNo == 0)
         {
@@ -302,6 +361,7 @@ int main(int argc, char **argv)
         assert(idx < numThreads);
         if (flatten_only.size() > 0 && flatten_only.count(tid) == 0 && call->mCallName != "eglInitialize")
         {
+            if (frame_end) _curFrameIndex++;
             continue;
         }
 
@@ -355,12 +415,6 @@ int main(int argc, char **argv)
             if (debug) DBG_LOG("[%u] Destroying surface %d at %u\n", tid, call->mArgs[1]->GetAsInt(), call->mCallNo);
         }
 
-        if (call->mCallName != "eglTerminate") // make sure eglTerminate gets called last
-        {
-            assert(calls.at(idx).size() == 0 || calls.at(idx).front()->mTid == call->mTid);
-            calls[idx].push_back(call);
-        }
-
         if (insequence)
         {
             if (!injected && call->mCallName == "eglMakeCurrent")
@@ -395,74 +449,28 @@ int main(int argc, char **argv)
             writeout(outputFile, call);
         }
         else {      // !insequence
-            if (_curCallIndexInFrame >= _curFrame->GetLoadedCallCount()) // flush calls
+            if (call->mCallName != "eglTerminate") // make sure eglTerminate gets called last
             {
-                if (debug) DBG_LOG("-- writeout frame %u! %u threads --\n", _curFrameIndex, (unsigned)calls.size());
-                bool any_injected = false;
-                for (auto &thread : calls)
-                {
-                    if (thread.size() == 0)
-                    {
-                        continue;
-                    }
-                    const unsigned curTid = thread.front()->mTid;
-                    const auto &context = initial_contexts.at(curTid);
-                    // Inject an eglMakeCurrent to set context and display for each
-                    // flattened thread section, to reproduce original behaviour.
-                    // However, do not put it in front of EGL calls, since they do
-                    // not need it (and may break, eg eglInitialize).
-                    common::CallTM makeCurrent("eglMakeCurrent");
-                    makeCurrent.mArgs.push_back(new common::ValueTM(context.display));
-                    makeCurrent.mArgs.push_back(new common::ValueTM(context.draw));
-                    makeCurrent.mArgs.push_back(new common::ValueTM(context.read));
-                    makeCurrent.mArgs.push_back(new common::ValueTM(context.context));
-                    makeCurrent.mRet = common::ValueTM((int)EGL_TRUE);
-                    if (debug) DBG_LOG("  writing (%u calls)[s=%d,c=%d] tid=%u\n", (unsigned)thread.size(), context.read, context.context, curTid);
-                    bool injected = false;
-                    for (auto &out : thread)
-                    {
-                        assert(curTid == out->mTid);
-                        if (!injected && out->mCallName == "eglMakeCurrent")
-                        {
-                            // Special case. The app supplied eglMakeCurrent takes priority.
-                            injected = true;
-                        }
-                        else if (NeedsContext::judge(out->mCallName) && !injected)
-                        {
-                            if (context.display == -1)
-                            {
-                                DBG_LOG("  Warning: eglMakeCurrent(%d,%d,%d,%d) at %u(%u) - invalid display\n",
-                                        context.display, context.draw, context.read, context.context, call->mCallNo, callNo);
-                            }
-
-                            writeout(outputFile, &makeCurrent);
-                            injected = true;
-                            countInjected++;
-                            any_injected = true;
-                        }
-                        out->mTid = 0;
-                        writeout(outputFile, out);
-                    }
-                    thread.clear();
-                }
-                // We need to remember the context of the latest eglMakeCurrent not in the current frame.
-                // This is because we need to know the 'default' context state to set at the start of each
-                // frame+thread, valid until we hit another, app-supplied eglMakeCurrent.
-                initial_contexts = contexts;
-
-                // Keep track of non-injected franges. If we had a number of frames without injections, track those.
-                // Ignore such ranges with less than 100 frames.
-                if (any_injected && prev_injected != -1 && static_cast<int>(_curFrameIndex) - prev_injected > 100)
-                {
-                    non_injected_ranges.push_back(std::make_pair(prev_injected, static_cast<int>(_curFrameIndex) - 1));
-                }
-                if (any_injected)
-                {
-                    prev_injected = _curFrameIndex;
-                }
+                const size_t before = calls[idx].bytes();
+                calls[idx].append(call, NeedsContext::judge(call->mCallName));
+                pending += calls[idx].bytes() - before;
             }
+            // Flush at the end of each frame, and earlier if the frame is too large to hold back
+            // altogether. A flush in the middle of a frame only costs some more eglMakeCurrent calls.
+            if (frame_end || pending > max_pending)
+            {
+                flush(frame_end);
+            }
+        }
+        if (frame_end)
+        {
+            _curFrameIndex++;
         }
     }
+    if (!insequence)
+    {
+        flush(true);
+    }
 
     common::CallTM eglTerminate("eglTerminate");
     eglTerminate.mArgs.push_back(new common::ValueTM(display));
@@ -0,0 +1,199 @@
+#include "glsl_cache.h"
+#include "glsl_parser.h"
+#include "glsl_utils.h"
+
+#include "common/memory.hpp"
+#include "common/os.hpp"
+
+#include "jsoncpp/include/json/reader.h"
+#include "jsoncpp/include/json/writer.h"
+
+#include <GLES2/gl2.h>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// bump when GLSLAnalysis or the parser changes, so that older files are analyzed again
+static const int CACHE_FORMAT = 1;
+
+GLSLCache& GLSLCache::instance()
+{
+    static GLSLCache cache;
+    return cache;
+}
+
+GLSLCache::GLSLCache()
+{
+    const char* dir = getenv("PATRACE_SHADER_CACHE");
+    if (dir)
+    {
+        mDirectory = dir;
+    }
+}
+
+void GLSLCache::setDirectory(const std::string& dir)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mDirectory = dir;
+}
+
+std::shared_ptr<const GLSLAnalysis> GLSLCache::analyze(const std::string& source, int shaderType)
+{
+    const std::string key = common::MD5Digest(std::vector<std::string>{ std::to_string(shaderType) + ":", source }).text_lower();
+    std::promise<std::shared_ptr<const GLSLAnalysis>> promise;
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto it = mEntries.find(key);
+    if (it != mEntries.end())
+    {
+        Entry entry = it->second;
+        lock.unlock();
+        return entry.get(); // waits if another thread is analyzing it
+    }
+    mEntries.emplace(key, promise.get_future().share());
+    lock.unlock();
+
+    std::shared_ptr<GLSLAnalysis> analysis = std::make_shared<GLSLAnalysis>();
+    const bool loaded = load(key, *analysis);
+    if (!loaded)
+    {
+        analysis = run(source, shaderType);
+        save(key, *analysis);
+    }
+    lock.lock();
+    (loaded ? mLoaded : mAnalyzed)++;
+    lock.unlock();
+    promise.set_value(analysis);
+    return analysis;
+}
+
+std::shared_ptr<GLSLAnalysis> GLSLCache::run(const std::string& source, int shaderType)
+{
+    std::shared_ptr<GLSLAnalysis> a = std::make_shared<GLSLAnalysis>();
+    GLSLParser parser;
+    std::string stripped = parser.strip_comments(source);
+    GLSLShader sh = parser.preprocessor(stripped, shaderType);
+    a->version = sh.version;
+    a->compressed = parser.compressed(sh);
+    a->preprocessed = sh.code;
+    a->extensions = sh.extensions;
+    a->contains_optimize_off_pragma = sh.contains_optimize_off_pragma;
+    a->contains_debug_on_pragma = sh.contains_debug_on_pragma;
+    a->contains_invariant_all_pragma = sh.contains_invariant_all_pragma;
+    GLSLRepresentation repr = parser.parse(sh);
+    a->contains_invariants = repr.contains_invariants;
+    for (const auto& var : repr.global.members)
+    {
+        if (lookup_is_sampler(var.type))
+        {
+            GLSLAnalysis::Sampler s;
+            s.name = var.name;
+            s.precision = var.precision;
+            s.binding = var.binding;
+            s.type = lookup_get_gles_type(var.type);
+            a->samplers.push_back(s);
+        }
+    }
+    if (shaderType == GL_FRAGMENT_SHADER)
+    {
+        a->varying_locations_used = count_varying_locations_used(repr);
+        a->lowp_varyings = count_varyings_by_precision(repr, Keyword::Lowp);
+        a->mediump_varyings = count_varyings_by_precision(repr, Keyword::Mediump);
+        a->highp_varyings = count_varyings_by_precision(repr, Keyword::Highp);
+    }
+    return a;
+}
+
+bool GLSLCache::load(const std::string& key, GLSLAnalysis& a) const
+{
+    if (mDirectory.empty())
+    {
+        return false;
+    }
+    std::ifstream in((mDirectory + "/" + key + ".json").c_str());
+    Json::Value v;
+    Json::Reader reader;
+    if (!in.is_open() || !reader.parse(in, v) || v.get("format", 0).asInt() != CACHE_FORMAT)
+    {
+        return false;
+    }
+    a.version = v["version"].asInt();
+    a.compressed = v["compressed"].asString();
+    a.preprocessed = v["preprocessed"].asString();
+    for (const auto& e : v["extensions"])
+    {
+        a.extensions.push_back(e.asString());
+    }
+    a.contains_invariants = v["invariants"].asBool();
+    a.contains_optimize_off_pragma = v["optimize_off"].asBool();
+    a.contains_debug_on_pragma = v["debug_on"].asBool();
+    a.contains_invariant_all_pragma = v["invariant_all"].asBool();
+    for (const auto& s : v["samplers"])
+    {
+        GLSLAnalysis::Sampler sampler;
+        sampler.name = s["name"].asString();
+        sampler.precision = (Keyword)s["precision"].asInt();
+        sampler.binding = s["binding"].asInt();
+        sampler.type = s["type"].asUInt();
+        a.samplers.push_back(sampler);
+    }
+    a.varying_locations_used = v["varying_locations"].asInt();
+    a.lowp_varyings = v["lowp_varyings"].asInt();
+    a.mediump_varyings = v["mediump_varyings"].asInt();
+    a.highp_varyings = v["highp_varyings"].asInt();
+    return true;
+}
+
+void GLSLCache::save(const std::string& key, const GLSLAnalysis& a) const
+{
+    if (mDirectory.empty())
+    {
+        return;
+    }
+    Json::Value v;
+    v["format"] = CACHE_FORMAT;
+    v["version"] = a.version;
+    v["compressed"] = a.compressed;
+    v["preprocessed"] = a.preprocessed;
+    v["extensions"] = Json::arrayValue;
+    for (const std::string& e : a.extensions)
+    {
+        v["extensions"].append(e);
+    }
+    v["invariants"] = a.contains_invariants;
+    v["optimize_off"] = a.contains_optimize_off_pragma;
+    v["debug_on"] = a.contains_debug_on_pragma;
+    v["invariant_all"] = a.contains_invariant_all_pragma;
+    v["samplers"] = Json::arrayValue;
+    for (const GLSLAnalysis::Sampler& s : a.samplers)
+    {
+        Json::Value sampler;
+        sampler["name"] = s.name;
+        sampler["precision"] = (int)s.precision;
+        sampler["binding"] = s.binding;
+        sampler["type"] = s.type;
+        v["samplers"].append(sampler);
+    }
+    v["varying_locations"] = a.varying_locations_used;
+    v["lowp_varyings"] = a.lowp_varyings;
+    v["mediump_varyings"] = a.mediump_varyings;
+    v["highp_varyings"] = a.highp_varyings;
+
+    // write to the side and rename, so that another process never reads half a file
+    const std::string path = mDirectory + "/" + key + ".json";
+    const std::string tmp = path + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream out(tmp.c_str());
+        if (!out.is_open())
+        {
+            DBG_LOG("Could not write to the shader cache in %s\n", mDirectory.c_str());
+            return;
+        }
+        Json::FastWriter writer;
+        out << writer.write(v);
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp.c_str());
+    }
+}
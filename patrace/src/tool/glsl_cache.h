@@ -0,0 +1,68 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "glsl_lookup.h"
+
+/// The results of preprocessing and parsing a shader that the tools keep
+struct GLSLAnalysis
+{
+    struct Sampler
+    {
+        std::string name;
+        Keyword precision = Keyword::None;
+        int binding = -1;
+        unsigned type = 0; // GLenum
+    };
+
+    int version = 100;
+    std::string compressed;
+    std::string preprocessed;
+    std::vector<std::string> extensions;
+    bool contains_invariants = false;
+    bool contains_optimize_off_pragma = false;
+    bool contains_debug_on_pragma = false;
+    bool contains_invariant_all_pragma = false;
+    std::vector<Sampler> samplers;
+    int varying_locations_used = 0; // the varying counts are only made for fragment shaders
+    int lowp_varyings = 0;
+    int mediump_varyings = 0;
+    int highp_varyings = 0;
+};
+
+/// Analyzes each distinct shader only once. Content uploads the same shaders many times,
+/// and a suite of traces of a game shares most of them, so analyses are kept by the MD5 of
+/// the shader type and source. With a directory set they are also stored there, one file per
+/// shader, for later runs and for other processes. Can be used from several threads at once;
+/// a shader asked for by two threads while it is being analyzed is only analyzed once.
+class GLSLCache
+{
+public:
+    /// The cache of the process, which uses the directory in PATRACE_SHADER_CACHE if it is set
+    static GLSLCache& instance();
+
+    void setDirectory(const std::string& dir);
+
+    std::shared_ptr<const GLSLAnalysis> analyze(const std::string& source, int shaderType);
+
+    unsigned analyzed() const { return mAnalyzed; }
+    unsigned loaded() const { return mLoaded; }
+
+private:
+    typedef std::shared_future<std::shared_ptr<const GLSLAnalysis>> Entry;
+
+    GLSLCache();
+    std::shared_ptr<GLSLAnalysis> run(const std::string& source, int shaderType);
+    bool load(const std::string& key, GLSLAnalysis& analysis) const;
+    void save(const std::string& key, const GLSLAnalysis& analysis) const;
+
+    std::mutex mMutex;
+    std::unordered_map<std::string, Entry> mEntries; // by MD5 digest
+    std::string mDirectory;
+    unsigned mAnalyzed = 0;
+    unsigned mLoaded = 0;
+};
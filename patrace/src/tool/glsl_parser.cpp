@@ -54,7 +54,7 @@ static void special_test()
     assert(is_special('>','=', ' ') == 2);
 }
 
-struct Token
+struct GLSLToken
 {
     std::string str;
     enum tokentype
@@ -64,18 +64,21 @@ struct Token
     Keyword keyword;
     KeywordType keywordType;
     std::string whitespace;
-    Token(const std::string& s, tokentype t, KeywordDefinition k, const std::string& w) : str(s), type(t), keyword(k.keyword), keywordType(k.type), whitespace(w) {}
-    Token() {}
+    GLSLToken(const std::string& s, tokentype t, KeywordDefinition k, const std::string& w) : str(s), type(t), keyword(k.keyword), keywordType(k.type), whitespace(w) {}
+    GLSLToken() {}
 };
+typedef GLSLToken Token;
 
-static Token scan_token(std::string& line, unsigned start = 0)
+// Scan the token at pos of src and move pos past it. The source is not copied, so a whole
+// shader can be tokenized in linear time.
+static Token scan_token_at(const std::string& line, size_t& pos)
 {
     std::string whitespace;
     Token::tokentype type = Token::IDENTIFIER;
     const size_t length = line.size();
+    size_t start = pos;
     if (length == 0)
     {
-        line = "";
         return { "", Token::EMPTY, { Keyword::None, KeywordType::None }, "" };
     }
     while (start < length && line[start] != '\0' && (line[start] == '\t' || line[start] == ' '))
@@ -86,7 +89,9 @@ static Token scan_token(std::string& line, unsigned start = 0)
     size_t end = start;
     while (end < length && line[end] != '\0' && line[end] != '\t' && line[end] != ' ')
     {
-        const int special = is_special(line[end], (length - end > 0) ? line[end + 1] : ' ', (length - end > 1) ? line[end + 2] : ' ');
+        const char next = end + 1 < length ? line[end + 1] : '\0';
+        const char next2 = (length - end > 1) ? (end + 2 < length ? line[end + 2] : '\0') : ' ';
+        const int special = is_special(line[end], next, next2);
         if (special && end == start) {
             end += special;    // got something
             type = Token::OPERATOR;
@@ -103,10 +108,32 @@ static Token scan_token(std::string& line, unsigned start = 0)
     {
         type = Token::KEYWORD;
     }
-    line = line.substr(end);
+    pos = std::min(end, length);
     return { ret, type, k, whitespace };
 }
 
+static Token scan_token(std::string& line, unsigned start = 0)
+{
+    size_t pos = start;
+    Token t = scan_token_at(line, pos);
+    line = line.substr(pos);
+    return t;
+}
+
+const std::vector<Token>& GLSLParser::tokens(const std::string& code)
+{
+    if (!mTokens || mTokensSource != code)
+    {
+        mTokens = std::make_shared<std::vector<Token>>();
+        for (size_t pos = 0; pos < code.size(); )
+        {
+            mTokens->push_back(scan_token_at(code, pos));
+        }
+        mTokensSource = code;
+    }
+    return *mTokens;
+}
+
 static std::string scan_rest(std::string& line, unsigned start = 0)
 {
     if (start >= line.size()) return std::string();
@@ -989,18 +1016,17 @@ void GLSLParser::self_test()
     mDebug = was_debug;
 }
 
-std::string GLSLParser::compressed(GLSLShader shader)
+std::string GLSLParser::compressed(const GLSLShader& shader)
 {
     std::string r;
-    std::string feed = shader.code;
-    Token prev;
+    r.reserve(shader.code.size());
+    const Token* prev = nullptr;
     int line = 0;
-    while (feed.size())
+    for (const Token& curr : tokens(shader.code))
     {
-        Token curr = scan_token(feed);
         if ((curr.type == Token::IDENTIFIER || curr.type == Token::KEYWORD)
-                && curr.str != "=" && prev.str != "=" && curr.str != "."
-                && (prev.type == Token::IDENTIFIER || prev.type == Token::KEYWORD)) r += " "; // mandatory space
+                && curr.str != "=" && prev && prev->str != "=" && curr.str != "."
+                && (prev->type == Token::IDENTIFIER || prev->type == Token::KEYWORD)) r += " "; // mandatory space
         if (curr.str == "\n")
         {
             if (line++ > 0)
@@ -1008,7 +1034,7 @@ std::string GLSLParser::compressed(GLSLShader shader)
                 continue;
             }
         }
-        prev = curr;
+        prev = &curr;
         r += curr.str;
     }
     return r;
@@ -1018,7 +1044,10 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
 {
     GLSLRepresentation ret;
     mLineNo = 1;
-    std::string feed = shader.code;
+    const std::vector<Token>& feed = tokens(shader.code);
+    size_t next = 0;
+    const Token empty;
+    auto scan = [&]() -> const Token& { return next < feed.size() ? feed[next++] : empty; };
     int block_depth = 0;
     /// Keep track of structure type definitions. Structures without a type name are immediately parsed
     std::unordered_map<std::string, GLSLRepresentation::Variable> structs; // type name : struct definitions
@@ -1055,9 +1084,9 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
     enum class Termination { None, StructScope, InterfaceScope, StructMember };
     Termination do_terminate = Termination::None;
     std::string struct_name; // definitions never nested
-    while (feed.size())
+    while (next < feed.size())
     {
-        Token curr = scan_token(feed);
+        Token curr = scan();
         if (curr.str == "\n")
         {
             mLineNo++;
@@ -1102,7 +1131,7 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
                 {
                     structs[struct_name] = nesting.back();
                 }
-                curr = scan_token(feed); // we will get either a name or a ';'
+                curr = scan(); // we will get either a name or a ';'
 
                 if (curr.str != ";") // delay termination (could be an array eg)
                 {
@@ -1126,7 +1155,7 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
             }
             else
             {
-                ASSERT(block_depth > 0, feed.c_str(), "Too many scopes ending!");
+                ASSERT(block_depth > 0, curr.str.c_str(), "Too many scopes ending!");
                 block_depth--;
             }
         }
@@ -1237,7 +1266,7 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
             {
             case Keyword::Struct:
             {
-                Token type_name = scan_token(feed); // either name or {
+                const Token& type_name = scan(); // either name or {
                 in_struct = true;
                 if (type_name.str != "{") // named struct
                 {
@@ -1282,9 +1311,9 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
                 break;
             case Keyword::Precision: // changing default precision on global scope
             {
-                Token precision = scan_token(feed);
-                Token type = scan_token(feed);
-                Token semicolon = scan_token(feed);
+                const Token& precision = scan();
+                const Token& type = scan();
+                const Token& semicolon = scan();
                 ASSERT(semicolon.str == ";", semicolon.str.c_str(), "Semicolon expected in default precision");
                 default_precision[type.keyword] = precision.keyword;
                 break;
@@ -1295,9 +1324,9 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
                 var.layout = curr.str;
                 while (curr.str != ")")
                 {
-                    curr = scan_token(feed);
+                    curr = scan();
                     var.layout += curr.str;
-                    ASSERT(curr.type != Token::EMPTY, feed.c_str(), "Layout qualifier not terminated with right parenthesis!");
+                    ASSERT(curr.type != Token::EMPTY, var.layout.c_str(), "Layout qualifier not terminated with right parenthesis!");
                 }
                 break;
             }
@@ -1345,10 +1374,9 @@ void GLSLShader::upgrade_to_glsl310()
 {
     std::string target;
     bool must_add_fragout = false;
-    std::string s = code;
-    while (s.size())
+    for (size_t pos = 0; pos < code.size(); )
     {
-        Token t = scan_token(s);
+        const Token t = scan_token_at(code, pos);
         if (t.str == "varying")
         {
             target += t.whitespace;
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include "glsl_lookup.h"
 
+struct GLSLToken;
+
 /// Contains preprocessed shader (output after GLSL spec step 9)
 struct GLSLShader
 {
@@ -55,7 +58,7 @@ public:
     GLSLRepresentation parse(const GLSLShader& shader);
     GLSLShader preprocessor(std::string shader, int shaderType);
     std::string strip_comments(const std::string& s);
-    std::string compressed(GLSLShader shader);
+    std::string compressed(const GLSLShader& shader);
     std::string inline_includes(const std::string& s);
 
     void self_test();
@@ -63,6 +66,10 @@ public:
 
 private:
     bool resolve_conditionals(const std::unordered_map<std::string, Define>& defines, const std::string& expr, int shaderType);
+    /// The tokens of preprocessed code, scanned once and shared by compressed() and parse()
+    const std::vector<GLSLToken>& tokens(const std::string& code);
+    std::shared_ptr<std::vector<GLSLToken>> mTokens;
+    std::string mTokensSource;
     int mLineNo = 0;
     std::string mShaderName;
     bool mDebug = false;
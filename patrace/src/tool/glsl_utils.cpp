@@ -168,7 +168,7 @@ static int count_items(Keyword type)
 }
 
 // TBD - should also count used built-ins, as they count toward the max limit.
-int count_varying_locations_used(GLSLRepresentation r)
+int count_varying_locations_used(const GLSLRepresentation& r)
 {
     int locs = 0;
     for (const GLSLRepresentation::Variable& v : r.global.members)
@@ -185,7 +185,7 @@ int count_varying_locations_used(GLSLRepresentation r)
 }
 
 /// Count actually used items
-int count_varyings_by_precision(GLSLRepresentation r, Keyword p)
+int count_varyings_by_precision(const GLSLRepresentation& r, Keyword p)
 {
     int locs = 0;
     for (const GLSLRepresentation::Variable& v : r.global.members)
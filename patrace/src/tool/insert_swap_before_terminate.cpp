@@ -37,11 +37,7 @@ static unsigned _curCallIndexInFrame = 0;
 
 static void writeout(common::OutFile &outputFile, common::CallTM *call)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile);
 }
 
 static common::CallTM* next_call(common::TraceFileTM &_fileTM)
@@ -0,0 +1,268 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "common/in_file.hpp"
+#include "common/file_format.hpp"
+#include "common/out_file.hpp"
+#include "common/api_info.hpp"
+#include "common/parse_api.hpp"
+#include "common/trace_model.hpp"
+#include "common/memory.hpp"
+#include "common/os.hpp"
+#include "tool/config.hpp"
+#include "tool/utils.hpp"
+
+static void printHelp()
+{
+    std::cout <<
+        "Usage : pack_trace [OPTIONS] <source trace> <target trace>\n"
+        "Moves the large blobs of a trace, such as texture and buffer data, into a blob store that is shared\n"
+        "by all traces packed into it, leaving a thin trace that refers to them by their MD5.\n"
+        "Options:\n"
+        "  -store <dir>  Blob store to pack blobs into, or with -inline to take them from instead of the one\n"
+        "                named in the trace or by PATRACE_BLOB_STORE\n"
+        "  -min <bytes>  Pack blobs of at least this many bytes (default 4096)\n"
+        "  -inline       Write the blobs of a thin trace into the target trace again, for export\n"
+        "  -h            print help\n"
+        "  -v            print version\n"
+        ;
+}
+
+static void printVersion()
+{
+    std::cout << PATRACE_VERSION << std::endl;
+}
+
+static common::FrameTM* _curFrame = NULL;
+static unsigned _curFrameIndex = 0;
+static unsigned _curCallIndexInFrame = 0;
+
+static common::CallTM* next_call(common::TraceFileTM &_fileTM)
+{
+    if (_curCallIndexInFrame >= _curFrame->GetLoadedCallCount())
+    {
+        _curFrameIndex++;
+        if (_curFrameIndex >= _fileTM.mFrames.size())
+            return NULL;
+        if (_curFrame) _curFrame->UnloadCalls();
+        _curFrame = _fileTM.mFrames[_curFrameIndex];
+        _curFrame->LoadCalls(_fileTM.mpInFileRA);
+        _curCallIndexInFrame = 0;
+    }
+    common::CallTM *call = _curFrame->mCalls[_curCallIndexInFrame];
+    _curCallIndexInFrame++;
+    return call;
+}
+
+static bool makeDir(const std::string& dir)
+{
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        DBG_LOG("Failed to create %s: %s\n", dir.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+struct PackStats
+{
+    unsigned long long packed = 0; ///< blobs referred to in the store
+    unsigned long long packedBytes = 0;
+    unsigned long long added = 0; ///< blobs new to the store
+    unsigned long long addedBytes = 0;
+};
+
+// Write the blob to the store unless it has it already. It is written under another name first,
+// so that other packers and readers of the store never see half of it.
+static bool storeBlob(const std::string& store, const common::MD5Digest& md5, const common::ValueTM& blob, PackStats& stats)
+{
+    const std::string path = common::BlobStore::externalPath(store, md5);
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && (size_t)st.st_size == blob.mBlobLen)
+    {
+        return true;
+    }
+    if (!makeDir(path.substr(0, path.rfind('/'))))
+    {
+        return false;
+    }
+    const std::string tmp = path + "." + std::to_string(getpid()) + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+    {
+        DBG_LOG("Failed to open %s for writing: %s\n", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    const bool written = fwrite(blob.mBlob, 1, blob.mBlobLen, fp) == blob.mBlobLen;
+    if (fclose(fp) != 0 || !written || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        DBG_LOG("Failed to write %s: %s\n", path.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+    stats.added++;
+    stats.addedBytes += blob.mBlobLen;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char* store = NULL;
+    unsigned minSize = 4096;
+    bool inlineBlobs = false;
+    int argIndex = 1;
+    for (; argIndex < argc; ++argIndex)
+    {
+        const char *arg = argv[argIndex];
+
+        if (arg[0] != '-')
+            break;
+
+        if (!strcmp(arg, "-h"))
+        {
+            printHelp();
+            return 1;
+        }
+        else if (!strcmp(arg, "-v"))
+        {
+            printVersion();
+            return 0;
+        }
+        else if (!strcmp(arg, "-store") && argIndex + 1 < argc)
+        {
+            store = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-min") && argIndex + 1 < argc)
+        {
+            minSize = std::max(1, atoi(argv[++argIndex]));
+        }
+        else if (!strcmp(arg, "-inline"))
+        {
+            inlineBlobs = true;
+        }
+        else
+        {
+            printf("Error: Unknow option %s\n", arg);
+            printHelp();
+            return 1;
+        }
+    }
+
+    if (argIndex + 2 > argc || (!store && !inlineBlobs))
+    {
+        printHelp();
+        return 1;
+    }
+    const char* source_trace_filename = argv[argIndex++];
+    const char* target_trace_filename = argv[argIndex++];
+
+    // The header names the store as a full path, since the thin trace may be moved without it
+    std::string storePath;
+    if (store && !inlineBlobs)
+    {
+        char resolved[PATH_MAX];
+        if (!makeDir(store) || !realpath(store, resolved))
+        {
+            DBG_LOG("Failed to use %s as blob store\n", store);
+            return 1;
+        }
+        storePath = resolved;
+    }
+
+    common::TraceFileTM inputFile;
+    common::gApiInfo.RegisterEntries(common::parse_callbacks);
+    if (!inputFile.Open(source_trace_filename))
+    {
+        DBG_LOG("Failed to open for reading: %s\n", source_trace_filename);
+        return 1;
+    }
+    if (store && inlineBlobs)
+    {
+        inputFile.mpInFileRA->blobStore().setExternalDir(store);
+    }
+    _curFrame = inputFile.mFrames[0];
+    _curFrame->LoadCalls(inputFile.mpInFileRA);
+
+    common::OutFile outputFile;
+    if (!outputFile.Open(target_trace_filename))
+    {
+        DBG_LOG("Failed to open for writing: %s\n", target_trace_filename);
+        return 1;
+    }
+
+    Json::Value header = inputFile.mpInFileRA->getJSONHeader();
+    Json::Value info;
+    if (inlineBlobs)
+    {
+        info["inlined_from"] = inputFile.mpInFileRA->blobStore().externalDir();
+        header.removeMember("blobStore");
+    }
+    else
+    {
+        info["blob_store"] = storePath;
+        info["min_size"] = minSize;
+        header["blobStore"] = storePath;
+    }
+    addConversionEntry(header, "pack_trace", source_trace_filename, info);
+    Json::FastWriter writer;
+    const std::string json_header = writer.write(header);
+    outputFile.mHeader.jsonLength = json_header.size();
+    outputFile.WriteHeader(json_header.c_str(), json_header.size());
+
+    PackStats stats;
+    unsigned long long inlined = 0;
+    std::vector<common::MD5Digest> digests; // of the blobs of a call, until it is written
+    common::CallTM *call = NULL;
+    while ((call = next_call(inputFile)))
+    {
+        digests.clear();
+        digests.reserve(call->mArgs.size());
+        for (common::ValueTM* arg : call->mArgs)
+        {
+            common::ValueTM* blob = (arg->mType == common::Opaque_Type && arg->mOpaqueType == common::BlobType) ? arg->mOpaqueIns : arg;
+            if (!blob || blob->mType != common::Blob_Type || !blob->mBlob)
+            {
+                continue;
+            }
+            if (inlineBlobs)
+            {
+                inlined += blob->mBlobLen;
+                continue;
+            }
+            if (blob->mBlobLen < minSize)
+            {
+                continue;
+            }
+            digests.push_back(common::MD5Digest(blob->mBlob, blob->mBlobLen));
+            if (!storeBlob(storePath, digests.back(), *blob, stats))
+            {
+                return 1;
+            }
+            blob->mBlobExternal = digests.back();
+            stats.packed++;
+            stats.packedBytes += blob->mBlobLen;
+        }
+        call->Serialize(outputFile);
+    }
+
+    if (inlineBlobs)
+    {
+        DBG_LOG("Wrote %llu bytes of blobs into %s\n", inlined, target_trace_filename);
+    }
+    else
+    {
+        DBG_LOG("Packed %llu blobs of %llu bytes into %s, of which %llu blobs of %llu bytes were new to it\n",
+                stats.packed, stats.packedBytes, storePath.c_str(), stats.added, stats.addedBytes);
+    }
+    inputFile.Close();
+    outputFile.Close();
+
+    return 0;
+}
@@ -1,10 +1,13 @@
+#include <algorithm>
 #include <cassert>
+#include "common/gl_utility.hpp"
 #include "common/memory.hpp"
 
 #include "parse_interface.h"
 #include "specs/pa_func_to_version.h"
 #include "glsl_parser.h"
 #include "glsl_utils.h"
+#include "glsl_cache.h"
 
 #pragma GCC diagnostic ignored "-Wunused-variable"
 
@@ -28,40 +31,40 @@ DrawParams ParseInterfaceBase::getDrawCallCount(common::CallTM *call)
 
     ret.index_buffer = nullptr; // clientsidebuffer contents currently not available without running replayer
     int ptr_idx = -1;
-    if (call->mCallName == "glDrawElements" || call->mCallName == "glDrawElementsInstanced" || call->mCallName == "glDrawElementsBaseVertex"
-        || call->mCallName == "glDrawElementsInstancedBaseVertex")
+    using common::ApiInfo;
+    switch (ApiInfo::NameHash(call->mCallName.c_str()))
     {
+    case ApiInfo::NameHash("glDrawElementsInstanced"):
+    case ApiInfo::NameHash("glDrawElementsInstancedBaseVertex"):
+        ret.instances = call->mArgs[4]->GetAsUInt();
+        // fall through
+    case ApiInfo::NameHash("glDrawElements"):
+    case ApiInfo::NameHash("glDrawElementsBaseVertex"):
         ret.count = ret.vertices = call->mArgs[1]->GetAsUInt();
         ret.value_type = call->mArgs[2]->GetAsUInt();
         ptr_idx = 3;
-    }
-    else if (call->mCallName == "glDrawArrays" || call->mCallName == "glDrawArraysInstanced")
-    {
+        break;
+    case ApiInfo::NameHash("glDrawArraysInstanced"):
+        ret.instances = call->mArgs[3]->GetAsUInt();
+        // fall through
+    case ApiInfo::NameHash("glDrawArrays"):
         ret.first_index = call->mArgs[1]->GetAsUInt();
         ret.count = ret.vertices = call->mArgs[2]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawRangeElements" || call->mCallName == "glDrawRangeElementsBaseVertex")
-    {
+        break;
+    case ApiInfo::NameHash("glDrawRangeElements"):
+    case ApiInfo::NameHash("glDrawRangeElementsBaseVertex"):
         ret.count = ret.vertices = call->mArgs[3]->GetAsUInt();
         ret.value_type = call->mArgs[4]->GetAsUInt();
         ptr_idx = 5;
-    }
-    else if (call->mCallName == "glDrawArraysIndirect")
-    {
+        break;
+    case ApiInfo::NameHash("glDrawArraysIndirect"):
         ptr_idx = 1;
-    }
-    else if (call->mCallName == "glDrawElementsIndirect")
-    {
+        break;
+    case ApiInfo::NameHash("glDrawElementsIndirect"):
         ptr_idx = 2;
-    }
-
-    if ((call->mCallName == "glDrawElementsInstanced" || call->mCallName == "glDrawElementsInstancedBaseVertex"))
-    {
-        ret.instances = call->mArgs[4]->GetAsUInt();
-    }
-    else if (call->mCallName == "glDrawArraysInstanced")
-    {
-        ret.instances = call->mArgs[3]->GetAsUInt();
+        break;
+    default:
+        break;
     }
     assert(ret.instances >= 0);
 
@@ -162,11 +165,7 @@ bool ParseInterface::open(const std::string& input, const std::string& output)
 
 void ParseInterface::writeout(common::OutFile &outputFile, common::CallTM *call)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile);
 }
 
 static void unbind_renderbuffers_if(StateTracker::Context& context, const int fb_index, bool renderBuffer, GLuint id)
@@ -192,8 +191,11 @@ common::CallTM* ParseInterface::next_call()
     {
         return nullptr;
     }
-    delete mCall;
-    mCall = new common::CallTM(inputFile, mCallNo, call);
+    if (!mCall)
+    {
+        mCall = new common::CallTM;
+    }
+    mCall->Reload(inputFile, mCallNo, call, mBorrowBlobs);
     context_index = current_context[mCall->mTid];
     if (!only_default || mCall->mTid == defaultTid)
     {
@@ -282,11 +284,155 @@ static void adjust_sampler_state(common::CallTM* call, GLenum pname, StateTracke
     }
 }
 
+void ClientSideLastUse::set(unsigned name, int call)
+{
+    if (name < DENSE_LIMIT)
+    {
+        if (name >= mDense.size()) mDense.resize(std::max<size_t>(name + 1, mDense.size() * 2), UNBOUND);
+        mDense[name] = call;
+    }
+    else mSparse[name] = call;
+}
+
+void ClientSideLastUse::erase(unsigned name)
+{
+    if (name < mDense.size()) mDense[name] = UNBOUND;
+    else mSparse.erase(name);
+}
+
+const char* MemoryFootprint::name(Category c)
+{
+    static const char* names[CATEGORIES] = { "textures", "compressed_textures", "renderbuffers", "buffers" };
+    return names[c];
+}
+
+void MemoryFootprint::change(Category c, int64_t delta, unsigned call, int frame)
+{
+    if (delta == 0) return;
+    live[c] += delta;
+    const int64_t now = total();
+    mFramePeak = std::max(mFramePeak, now);
+    if (now > peak)
+    {
+        peak = now;
+        std::copy(live, live + CATEGORIES, peakBytes);
+        peakCall = call;
+        peakFrame = frame;
+    }
+}
+
+void MemoryFootprint::endFrame()
+{
+    Frame f;
+    std::copy(live, live + CATEGORIES, f.bytes);
+    f.peak = std::max(mFramePeak, total());
+    frames.push_back(f);
+    mFramePeak = total();
+}
+
+int64_t MemoryFootprint::total() const
+{
+    int64_t sum = 0;
+    for (const int64_t bytes : live) sum += bytes;
+    return sum;
+}
+
+// Count the memory of the images specified by a glTexStorage*, glTexImage* or glCompressedTexImage* call
+void ParseInterfaceBase::texture_memory(StateTracker::Texture& tex, const common::CallTM *call)
+{
+    const std::string& name = call->mCallName;
+    const GLenum target = call->mArgs[0]->GetAsUInt();
+    const GLenum internalformat = call->mArgs[2]->GetAsUInt();
+    const int dims = name.find("3D") != std::string::npos ? 3 : name.find("2D") != std::string::npos ? 2 : 1;
+    const GLsizei width = call->mArgs[3]->GetAsInt();
+    const GLsizei height = dims >= 2 ? call->mArgs[4]->GetAsInt() : 1;
+    const GLsizei depth = dims == 3 ? call->mArgs[5]->GetAsInt() : 1;
+    if (name.find("Multisample") != std::string::npos)
+    {
+        tex.images.clear();
+        tex.images[-1] = call->mArgs[1]->GetAsUInt() * textureImageBytes(internalformat, GL_NONE, GL_NONE, width, height, 1);
+    }
+    else if (name.find("TexStorage") != std::string::npos)
+    {
+        // all the levels at once, and only those of 3D textures get smaller in depth
+        const int levels = call->mArgs[1]->GetAsInt();
+        const unsigned faces = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+        uint64_t bytes = 0;
+        for (int level = 0; level < levels; level++)
+        {
+            bytes += faces * textureImageBytes(internalformat, GL_NONE, GL_NONE, width >> level, height >> level,
+                                               target == GL_TEXTURE_3D ? depth >> level : depth);
+        }
+        tex.images.clear();
+        tex.images[-1] = bytes;
+    }
+    else
+    {
+        // one level of one face, replacing what was specified for it before
+        const int64_t image = ((int64_t)target << 8) | call->mArgs[1]->GetAsUInt();
+        if (name.compare(0, 12, "glCompressed") == 0)
+        {
+            tex.images[image] = call->mArgs[dims + 4]->GetAsUInt(); // imageSize, after the border
+        }
+        else
+        {
+            const GLenum format = call->mArgs[dims + 4]->GetAsUInt();
+            const GLenum type = call->mArgs[dims + 5]->GetAsUInt();
+            tex.images[image] = textureImageBytes(internalformat, format, type, width, height, depth);
+        }
+    }
+    count_texture_memory(tex, isCompressedFormat(internalformat) || internalformat == GL_ETC1_RGB8_OES, call);
+}
+
+// glGenerateMipmap gives a mutable texture all the levels below the ones specified at level 0,
+// each a quarter of the size of the one above, or an eighth for 3D textures
+void ParseInterfaceBase::mipmap_memory(StateTracker::Texture& tex, const common::CallTM *call)
+{
+    const int shift = tex.binding_point == GL_TEXTURE_3D ? 3 : 2;
+    const std::map<int64_t, uint64_t> images = tex.images;
+    for (const auto& pair : images)
+    {
+        if ((pair.first & 0xff) != 0) continue;
+        for (int level = 1; (pair.second >> (shift * level)) > 0; level++)
+        {
+            tex.images[pair.first | level] = pair.second >> (shift * level);
+        }
+    }
+    count_texture_memory(tex, tex.compressed, call);
+}
+
+void ParseInterfaceBase::count_texture_memory(StateTracker::Texture& tex, bool compressed, const common::CallTM *call)
+{
+    uint64_t bytes = 0;
+    for (const auto& pair : tex.images) bytes += pair.second;
+    memory.change(tex.compressed ? MemoryFootprint::COMPRESSED_TEXTURES : MemoryFootprint::TEXTURES, -(int64_t)tex.memory, call->mCallNo, frames);
+    tex.compressed = compressed;
+    tex.memory = bytes;
+    memory.change(tex.compressed ? MemoryFootprint::COMPRESSED_TEXTURES : MemoryFootprint::TEXTURES, bytes, call->mCallNo, frames);
+}
+
+void ParseInterfaceBase::client_side_use(const common::CallTM *call, int cs_id)
+{
+    if (cs_id == UNBOUND) return; // attribute not from a client side buffer
+    if (call->mTid >= client_side_last_use.size()) client_side_last_use.resize(call->mTid + 1);
+    client_side_last_use[call->mTid].set(cs_id, call->mCallNo);
+}
+
 void ParseInterfaceBase::new_renderpass(common::CallTM *call, StateTracker::Context& ctx, bool newframe)
 {
     // First update existing renderpass info
     const int fb_index = contexts[context_index].framebuffers.remap(contexts[context_index].drawframebuffer);
     StateTracker::RenderPass &rp = ctx.render_passes.back();
+    // Attachments invalidated since the last draw need not be stored
+    unsigned i = 0;
+    for (const auto& rb : contexts[context_index].framebuffers[fb_index].attachments)
+    {
+        if (rp.attachments.size() > i && rp.attachments.at(i).store_op == StateTracker::RenderPass::STORE_OP_UNKNOWN && rb.second.invalidated)
+        {
+            rp.attachments[i].store_op = StateTracker::RenderPass::STORE_OP_DONT_CARE;
+        }
+        i++;
+    }
     update_renderpass(call, ctx, rp, fb_index);
     // Create new (empty) renderpass
     ctx.render_passes.back().last_call = call->mCallNo;
@@ -568,7 +714,11 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         const int surface = call->mArgs[1]->GetAsInt();
         const int target_surface_index = surface_remapping.at(surface);
         surfaces[target_surface_index].swap_calls.push_back(call->mCallNo);
-        if (call->mTid == defaultTid) frames++;
+        if (call->mTid == defaultTid)
+        {
+            memory.endFrame();
+            frames++;
+        }
         contexts[context_index].renderpasses_per_frame[frames] = 0;
         if (context_index != UNBOUND)
         {
@@ -709,8 +859,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
             const int cs_id = std::get<5>(vao.boundVertexAttribs.at(index));
             if (cs_id != UNBOUND)
             {
-                client_side_last_use[call->mTid][cs_id] = call->mCallNo;
-                client_side_last_use_reason[call->mTid][cs_id] = call->mCallName;
+                client_side_use(call, cs_id);
             }
         }
         // Update state
@@ -763,19 +912,6 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         GLuint fb = call->mArgs[1]->GetAsUInt();
         const bool readtarget = (target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER);
         const bool writetarget = (target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER);
-        if (writetarget && contexts[context_index].drawframebuffer != 0 && fb != contexts[context_index].drawframebuffer)
-        {
-            const int fb_index = contexts[context_index].framebuffers.remap(contexts[context_index].drawframebuffer);
-            StateTracker::RenderPass &rp = contexts[context_index].render_passes.back();
-            unsigned i = 0;
-            for (auto& rb : contexts[context_index].framebuffers[fb_index].attachments)
-            {
-                if (rp.attachments.size() > i && rp.attachments.at(i).store_op == StateTracker::RenderPass::STORE_OP_UNKNOWN && rb.second.invalidated)
-                {
-                    rp.attachments[i].store_op = StateTracker::RenderPass::STORE_OP_DONT_CARE;
-                }
-            }
-        }
         if (writetarget && contexts[context_index].drawframebuffer != fb && contexts[context_index].render_passes.back().active)
         {
             new_renderpass(call, contexts[context_index], false);
@@ -884,6 +1020,10 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         const GLuint tex_id = contexts[context_index].textureUnits[unit][target];
         const int target_texture_index = contexts[context_index].textures.remap(tex_id);
         contexts[context_index].mipmaps.push_back({ call->mCallNo, frames, target_texture_index });
+        if (target_texture_index >= 0 && !contexts[context_index].textures[target_texture_index].immutable)
+        {
+            mipmap_memory(contexts[context_index].textures[target_texture_index], call);
+        }
     }
     else if (call->mCallName == "glGenRenderbuffers" || call->mCallName == "glGenRenderbuffersOES")
     {
@@ -906,6 +1046,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
             const unsigned id = call->mArgs[1]->mArray[i].GetAsUInt();
             if (id != 0 && contexts[context_index].renderbuffers.contains(id))
             {
+                memory.change(MemoryFootprint::RENDERBUFFERS, -(int64_t)contexts[context_index].renderbuffers.id(id).memory, call->mCallNo, frames);
                 contexts[context_index].renderbuffers.remove(id, call->mCallNo, frames);
                 // "If a renderbuffer object is attached to one or more attachment points in the currently
                 // bound framebuffer, then it as if glFramebufferRenderbuffer had been called, with a renderbuffer
@@ -997,9 +1138,13 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         const int renderbuffer_index = contexts[context_index].renderbuffer_index;
         if (renderbuffer_index != UNBOUND)
         {
-            contexts[context_index].renderbuffers[renderbuffer_index].internalformat = call->mArgs[1]->GetAsUInt();
-            contexts[context_index].renderbuffers[renderbuffer_index].width = call->mArgs[2]->GetAsInt();
-            contexts[context_index].renderbuffers[renderbuffer_index].height = call->mArgs[3]->GetAsInt();
+            StateTracker::Renderbuffer& rb = contexts[context_index].renderbuffers[renderbuffer_index];
+            rb.internalformat = call->mArgs[1]->GetAsUInt();
+            rb.width = call->mArgs[2]->GetAsInt();
+            rb.height = call->mArgs[3]->GetAsInt();
+            const uint64_t bytes = textureImageBytes(rb.internalformat, GL_NONE, GL_NONE, rb.width, rb.height, 1);
+            memory.change(MemoryFootprint::RENDERBUFFERS, (int64_t)bytes - (int64_t)rb.memory, call->mCallNo, frames);
+            rb.memory = bytes;
         }
         else
         {
@@ -1014,10 +1159,14 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         const int renderbuffer_index = contexts[context_index].renderbuffer_index;
         if (renderbuffer_index != UNBOUND)
         {
-            contexts[context_index].renderbuffers[renderbuffer_index].samples = call->mArgs[1]->GetAsInt();
-            contexts[context_index].renderbuffers[renderbuffer_index].internalformat = call->mArgs[2]->GetAsUInt();
-            contexts[context_index].renderbuffers[renderbuffer_index].width = call->mArgs[3]->GetAsInt();
-            contexts[context_index].renderbuffers[renderbuffer_index].height = call->mArgs[4]->GetAsInt();
+            StateTracker::Renderbuffer& rb = contexts[context_index].renderbuffers[renderbuffer_index];
+            rb.samples = call->mArgs[1]->GetAsInt();
+            rb.internalformat = call->mArgs[2]->GetAsUInt();
+            rb.width = call->mArgs[3]->GetAsInt();
+            rb.height = call->mArgs[4]->GetAsInt();
+            const uint64_t bytes = std::max(rb.samples, 1) * textureImageBytes(rb.internalformat, GL_NONE, GL_NONE, rb.width, rb.height, 1);
+            memory.change(MemoryFootprint::RENDERBUFFERS, (int64_t)bytes - (int64_t)rb.memory, call->mCallNo, frames);
+            rb.memory = bytes;
         }
         else
         {
@@ -1187,6 +1336,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
             const unsigned id = call->mArgs[1]->mArray[i].GetAsUInt();
             if (id != 0 && contexts[context_index].buffers.contains(id))
             {
+                memory.change(MemoryFootprint::BUFFERS, -(int64_t)contexts[context_index].buffers.id(id).size, call->mCallNo, frames);
                 contexts[context_index].buffers.remove(id, call->mCallNo, frames);
             }
         }
@@ -1206,6 +1356,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
             const GLsizeiptr size = call->mArgs[1]->GetAsUInt();
             StateTracker::Buffer &buffer = contexts[context_index].buffers[index];
             buffer.usages.insert(call->mArgs[3]->GetAsUInt());
+            memory.change(MemoryFootprint::BUFFERS, (int64_t)size - buffer.size, call->mCallNo, frames);
             buffer.size = size;
         }
     }
@@ -1226,23 +1377,20 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         assert(contexts[context_index].buffers.contains(buffer_id));
         const int buffer_index = contexts[context_index].buffers.remap(buffer_id);
         contexts[context_index].buffers[buffer_index].clientsidebuffer = cs_id;
-        client_side_last_use[call->mTid][cs_id] = call->mCallNo;
-        client_side_last_use_reason[call->mTid][cs_id] = call->mCallName;
+        client_side_use(call, cs_id);
     }
     else if (call->mCallName == "glClientSideBufferData")
     {
         const GLuint cs_id = call->mArgs[0]->GetAsUInt();
         const GLsizei size = call->mArgs[1]->GetAsUInt();
-        client_side_last_use[call->mTid][cs_id] = call->mCallNo;
-        client_side_last_use_reason[call->mTid][cs_id] = call->mCallName;
+        client_side_use(call, cs_id);
     }
     else if (call->mCallName == "glClientSideBufferSubData")
     {
         const GLuint cs_id = call->mArgs[0]->GetAsUInt();
         const GLsizei offset = call->mArgs[1]->GetAsUInt();
         const GLsizei size = call->mArgs[2]->GetAsUInt();
-        client_side_last_use[call->mTid][cs_id] = call->mCallNo;
-        client_side_last_use_reason[call->mTid][cs_id] = call->mCallName;
+        client_side_use(call, cs_id);
     }
     else if (call->mCallName == "glPatchClientSideBuffer")
     {
@@ -1252,13 +1400,12 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         const GLuint buffer_id = vao.boundBufferIds[target][0].buffer;
         const int buffer_index = contexts[context_index].buffers.remap(buffer_id);
         const GLuint cs_id = contexts[context_index].buffers[buffer_index].clientsidebuffer;
-        client_side_last_use[call->mTid][cs_id] = call->mCallNo;
-        client_side_last_use_reason[call->mTid][cs_id] = call->mCallName;
+        client_side_use(call, cs_id);
     }
     else if (call->mCallName == "glDeleteClientSideBuffer")
     {
         const GLuint cs_id = call->mArgs[0]->GetAsUInt();
-        client_side_last_use[call->mTid].erase(cs_id);
+        if (call->mTid < client_side_last_use.size()) client_side_last_use[call->mTid].erase(cs_id);
     }
     else if (call->mCallName == "glBindBuffer")
     {
@@ -1356,8 +1503,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
                 const int old_cs_id = std::get<5>(vao.boundVertexAttribs.at(index));
                 if (old_cs_id != UNBOUND)
                 {
-                    client_side_last_use[call->mTid][old_cs_id] = call->mCallNo;
-                    client_side_last_use_reason[call->mTid][old_cs_id] = call->mCallName + " (overwrite)";
+                    client_side_use(call, old_cs_id);
                 }
             }
             // Update current state
@@ -1373,8 +1519,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         }
         if (clientsidebuffer)
         {
-            client_side_last_use[call->mTid][cs_id] = call->mCallNo;
-            client_side_last_use_reason[call->mTid][cs_id] = call->mCallName;
+            client_side_use(call, cs_id);
         }
     }
     else if (call->mCallName == "glGenTextures")
@@ -1398,6 +1543,8 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
             const unsigned id = call->mArgs[1]->mArray[i].GetAsUInt();
             if (id != 0 && contexts[context_index].textures.contains(id))
             {
+                const StateTracker::Texture& tex = contexts[context_index].textures.id(id);
+                memory.change(tex.compressed ? MemoryFootprint::COMPRESSED_TEXTURES : MemoryFootprint::TEXTURES, -(int64_t)tex.memory, call->mCallNo, frames);
                 contexts[context_index].textures.remove(id, call->mCallNo, frames);
                 // "When a buffer, texture, or renderbuffer object is deleted, it is unbound from any
                 // bind points it is bound to in the current context, and detached from any attachments
@@ -1454,6 +1601,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
                 tex.height = call->mArgs[4]->GetAsInt();
                 tex.depth = call->mArgs[5]->GetAsInt();
             }
+            texture_memory(tex, call);
         }
         else
         {
@@ -1475,6 +1623,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         tex.width = call->mArgs[3]->GetAsInt();
         tex.height = call->mArgs[4]->GetAsInt();
         tex.levels = 0;
+        texture_memory(tex, call);
     }
     else if (call->mCallName == "glBindTexture")
     {
@@ -1660,40 +1809,35 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         StateTracker::Shader& s = contexts[context_index].shaders[target_shader_index];
         s.source_code = code; // original shader
         s.call = call->mCallNo;
-        GLSLParser parser;
-        std::string stripped = parser.strip_comments(code);
-        GLSLShader sh = parser.preprocessor(stripped, s.shader_type);
-        if (sh.version / 10 > highest_gles_version && highest_gles_version > 10)
-        {
-            DBG_LOG("The use of shader in call %d increases GLES version from %d to %d\n", (int)call->mCallNo, (int)highest_gles_version, (int)sh.version / 10);
-            highest_gles_version = sh.version / 10;
-        }
-        s.source_compressed = parser.compressed(sh);
-        s.source_preprocessed = sh.code;
-        GLSLRepresentation repr = parser.parse(sh);
-        s.contains_invariants = repr.contains_invariants;
-        s.contains_optimize_off_pragma = sh.contains_optimize_off_pragma;
-        s.contains_debug_on_pragma = sh.contains_debug_on_pragma;
-        s.contains_invariant_all_pragma = sh.contains_invariant_all_pragma;
-        for (const auto& var : repr.global.members)
-        {
-            if (lookup_is_sampler(var.type))
-            {
-                StateTracker::GLSLPrecision precision = StateTracker::HIGHP;
-                if (var.precision == Keyword::Mediump) precision = StateTracker::MEDIUMP;
-                else if (var.precision == Keyword::Lowp) precision = StateTracker::LOWP;
-                s.samplers.emplace(var.name, StateTracker::GLSLSampler{ precision, var.binding, lookup_get_gles_type(var.type) });
-            }
+        // the same shaders come again and again, so they are only analyzed once
+        const std::shared_ptr<const GLSLAnalysis> a = GLSLCache::instance().analyze(code, s.shader_type);
+        if (a->version / 10 > highest_gles_version && highest_gles_version > 10)
+        {
+            DBG_LOG("The use of shader in call %d increases GLES version from %d to %d\n", (int)call->mCallNo, (int)highest_gles_version, (int)a->version / 10);
+            highest_gles_version = a->version / 10;
+        }
+        s.source_compressed = a->compressed;
+        s.source_preprocessed = a->preprocessed;
+        s.contains_invariants = a->contains_invariants;
+        s.contains_optimize_off_pragma = a->contains_optimize_off_pragma;
+        s.contains_debug_on_pragma = a->contains_debug_on_pragma;
+        s.contains_invariant_all_pragma = a->contains_invariant_all_pragma;
+        for (const GLSLAnalysis::Sampler& var : a->samplers)
+        {
+            StateTracker::GLSLPrecision precision = StateTracker::HIGHP;
+            if (var.precision == Keyword::Mediump) precision = StateTracker::MEDIUMP;
+            else if (var.precision == Keyword::Lowp) precision = StateTracker::LOWP;
+            s.samplers.emplace(var.name, StateTracker::GLSLSampler{ precision, var.binding, var.type });
         }
         if (s.shader_type == GL_FRAGMENT_SHADER)
         {
-            s.varying_locations_used = count_varying_locations_used(repr);
-            s.lowp_varyings = count_varyings_by_precision(repr, Keyword::Lowp);
-            s.mediump_varyings = count_varyings_by_precision(repr, Keyword::Mediump);
-            s.highp_varyings = count_varyings_by_precision(repr, Keyword::Highp);
+            s.varying_locations_used = a->varying_locations_used;
+            s.lowp_varyings = a->lowp_varyings;
+            s.mediump_varyings = a->mediump_varyings;
+            s.highp_varyings = a->highp_varyings;
         }
-        s.extensions = sh.extensions;
-        for (const std::string& e : sh.extensions)
+        s.extensions = a->extensions;
+        for (const std::string& e : a->extensions)
         {
             used_extensions.insert(e);
         }
@@ -2456,8 +2600,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         DrawParams params = getDrawCallCount(call);
         if (params.client_side_buffer_name != UNBOUND)
         {
-            client_side_last_use[call->mTid][params.client_side_buffer_name] = call->mCallNo;
-            client_side_last_use_reason[call->mTid][params.client_side_buffer_name] = call->mCallName;
+            client_side_use(call, params.client_side_buffer_name);
         }
         if (vao.boundVertexAttribs.count(GL_ARRAY_BUFFER) > 0)
         {
@@ -2465,8 +2608,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
             {
                 if (vao.array_enabled.count(pair.first))
                 {
-                    client_side_last_use[call->mTid][std::get<5>(pair.second)] = call->mCallNo;
-                    client_side_last_use_reason[call->mTid][std::get<5>(pair.second)] = call->mCallName;
+                    client_side_use(call, std::get<5>(pair.second));
                 }
             }
         }
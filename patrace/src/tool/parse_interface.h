@@ -52,6 +52,11 @@ struct DrawParams
     double vec4_locality = 0.0;
     double temporal_locality = 0.0;
     double spatial_locality = 0.0;
+    // from simulating the post-transform vertex cache and the cache that vertex attributes are fetched through
+    int shaded_vertices = 0; // misses in the vertex cache
+    double acmr = 0.0; // average cache miss ratio, shaded vertices per primitive
+    double atvr = 0.0; // average transformed vertex ratio, shaded vertices per unique vertex
+    int64_t vertex_fetch_bytes = 0; // estimated memory read for vertex attributes
 
     void* index_buffer = nullptr;
 
@@ -248,6 +253,9 @@ struct Texture : public Resource
     GLenum internal_format;
     GLenum binding_point;
     SamplerState state;
+    std::map<int64_t, uint64_t> images; // bytes of each image specified, by target and level, see MemoryFootprint
+    uint64_t memory = 0; // sum of the above
+    bool compressed = false; // memory is counted as compressed
     Texture(int _id, int _index, unsigned _call_created, unsigned _frame_created) : Resource(_id, _index, _call_created, _frame_created),
             internal_format(GL_NONE), binding_point(GL_NONE) {}
 
@@ -262,6 +270,7 @@ struct Renderbuffer : public Resource
     GLenum internalformat;
     GLsizei width;
     GLsizei height;
+    uint64_t memory = 0; // see MemoryFootprint
     Renderbuffer(int _id, int _index, unsigned _call_created, unsigned _frame_created) : Resource(_id, _index, _call_created, _frame_created),
                  samples(0), internalformat(GL_NONE), width(0), height(0) {}
 };
@@ -650,6 +659,61 @@ struct EglConfig
 
 }; // end interface
 
+/// Call number of the last use of each client side buffer of a thread, by name. The tracer
+/// hands out names from a counter, so they index a vector. Names that flatten_threads moved
+/// far apart for other threads are kept in a map instead.
+class ClientSideLastUse
+{
+public:
+    void set(unsigned name, int call);
+    void erase(unsigned name);
+    /// Calls f(name, call) for each buffer that is in use, in order of name
+    template<typename F> void for_each(F f) const
+    {
+        for (unsigned name = 0; name < mDense.size(); name++)
+        {
+            if (mDense[name] != UNBOUND) f(name, mDense[name]);
+        }
+        for (const auto& pair : mSparse) f(pair.first, pair.second);
+    }
+
+private:
+    enum { DENSE_LIMIT = 1 << 20 };
+    std::vector<int> mDense;
+    std::map<unsigned, int> mSparse;
+};
+
+/// GPU memory that the live textures, renderbuffers and buffers of all contexts take, as far as
+/// their sizes and formats tell, with mip chains, cube faces, samples and compressed blocks, for
+/// every frame. Driver overhead, padding, framebuffer compression and the window surfaces are not
+/// counted, and objects are counted until deleted, even after their context is destroyed.
+class MemoryFootprint
+{
+public:
+    enum Category { TEXTURES, COMPRESSED_TEXTURES, RENDERBUFFERS, BUFFERS, CATEGORIES };
+    static const char* name(Category c);
+
+    struct Frame
+    {
+        int64_t bytes[CATEGORIES]; // at the end of the frame
+        int64_t peak; // highest total during the frame
+    };
+
+    void change(Category c, int64_t delta, unsigned call, int frame);
+    void endFrame();
+    int64_t total() const;
+
+    int64_t live[CATEGORIES] = {};
+    std::vector<Frame> frames; // ended so far
+    int64_t peak = 0; // highest total of the whole trace
+    int64_t peakBytes[CATEGORIES] = {}; // when it was reached
+    unsigned peakCall = 0;
+    int peakFrame = 0;
+
+private:
+    int64_t mFramePeak = 0;
+};
+
 class ParseInterfaceBase
 {
 public:
@@ -675,6 +739,9 @@ public:
     void setOutputName(const std::string& name) { mOutputName = name; }
     void setRenderpassJSON(bool value) { mRenderpassJSON = value; }
     void setDebug(bool debug) { mDebug = debug; }
+    /// Let the blobs of the current call point into the chunk memory of the input instead of
+    /// copying them, for tools that neither keep nor change them, see CallTM::Reload()
+    void setBorrowBlobs(bool value) { mBorrowBlobs = value; }
     void interpret_call(common::CallTM *call);
 
     std::deque<StateTracker::Context> contexts; // using deque to avoid moving contents around in memory, invalidating pointers
@@ -684,8 +751,7 @@ public:
     std::map<int, int> current_context; // map threads to contexts
     std::map<int, int> current_surface; // map threads to surfaces
 
-    std::map<int, std::map<int, int>> client_side_last_use; // thread -> (client id, call no)
-    std::map<int, std::map<int, std::string>> client_side_last_use_reason; // thread -> (client id, reason), for debugging!!
+    std::vector<ClientSideLastUse> client_side_last_use; // by thread
 
     std::string filename;
     unsigned numThreads = 0;
@@ -709,11 +775,17 @@ public:
     };
     std::map<std::string, callstat> callstats;
 
+    MemoryFootprint memory;
+
 private:
     bool find_duplicate_clears(const StateTracker::FillState& f, const StateTracker::Attachment& at, GLenum type, StateTracker::Framebuffer& fbo, const std::string& call);
     void setEglConfig(StateTracker::EglConfig& config, int attribute, int value);
     void new_renderpass(common::CallTM *call, StateTracker::Context& ctx, bool newframe);
     void update_renderpass(common::CallTM *call, StateTracker::Context& ctx, StateTracker::RenderPass &rp, const int fb_index);
+    void client_side_use(const common::CallTM *call, int cs_id);
+    void texture_memory(StateTracker::Texture& tex, const common::CallTM *call);
+    void mipmap_memory(StateTracker::Texture& tex, const common::CallTM *call);
+    void count_texture_memory(StateTracker::Texture& tex, bool compressed, const common::CallTM *call);
 
 protected:
     virtual void completed_drawcall(int frame, const DrawParams& params, const StateTracker::RenderPass &rp) {}
@@ -728,6 +800,7 @@ protected:
     bool mDumpRenderpassJson = false;
     bool mRenderpassJSON = false;
     bool mDebug = false;
+    bool mBorrowBlobs = false;
 };
 
 class ParseInterface : public ParseInterfaceBase
@@ -744,7 +817,7 @@ public:
     virtual void writeout(common::OutFile &outputFile, common::CallTM *call);
 
     common::InFile inputFile;
-    common::OutFile outputFile = "trace";
+    common::OutFile outputFile{"trace"};
     common::CallTM *mCall = nullptr;
 
 private:
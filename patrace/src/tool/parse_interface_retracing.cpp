@@ -2,14 +2,19 @@
 
 #include "common/gl_utility.hpp"
 #include "common/memory.hpp"
+#include "common/thread_pool.hpp"
 #include "helper/eglsize.hpp"
 #include "tool/utils.hpp"
 #include "helper/eglstring.hpp"
 
 #include <sys/stat.h>
 #include <assert.h>
-#include <set>
+#include <algorithm>
+#include <fstream>
 #include <limits>
+#include <memory>
+#include <set>
+#include <unordered_map>
 
 #include <errno.h>
 #include <stdlib.h>
@@ -26,24 +31,182 @@
 using namespace retracer;
 
 const int cache_size = 512;
+const unsigned vertex_cache_size = 32; // entries of the simulated post-transform cache
+const unsigned fetch_cache_size = 16 * 1024; // bytes of the simulated cache that vertex attributes are read through
+const unsigned fetch_line_size = 64;
 static int mPerfFD = -1;
 static bool perf_initialized = false;
 
-static std::string write_or_reuse(const std::string& dirname, const std::string& filename, const std::string& blob, cache_type& cache)
+static bool write_file(const std::string& filename, const char* data, size_t size)
+{
+    FILE *fp = fopen(filename.c_str(), "wb");
+    if (!fp)
+    {
+        DBG_LOG("Failed to open \"%s\": %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    const bool written = (size == 0 || fwrite(data, size, 1, fp) == 1);
+    if (fclose(fp) != 0 || !written)
+    {
+        DBG_LOG("Failed to write \"%s\": %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Hard link source to target, or copy it where the file system has no hard links
+static bool link_or_copy(const std::string& source, const std::string& target)
+{
+    unlink(target.c_str()); // left by an earlier run
+    if (link(source.c_str(), target.c_str()) == 0)
+    {
+        return true;
+    }
+    FILE *fp = fopen(source.c_str(), "rb");
+    if (!fp)
+    {
+        DBG_LOG("Failed to open \"%s\": %s\n", source.c_str(), strerror(errno));
+        return false;
+    }
+    std::vector<char> data;
+    char buffer[64 * 1024];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    {
+        data.insert(data.end(), buffer, buffer + size);
+    }
+    fclose(fp);
+    return write_file(target, data.data(), data.size());
+}
+
+RenderpassBlobWriter::~RenderpassBlobWriter()
+{
+    {
+        std::lock_guard<std::mutex> lk(mMutex);
+        mStop = true;
+    }
+    mQueueChanged.notify_all();
+    for (std::thread& t : mWorkers)
+    {
+        t.join();
+    }
+}
+
+void RenderpassBlobWriter::write(const std::string& dirname, const std::string& filename, std::string&& blob, const std::string& path)
+{
+    std::shared_ptr<std::promise<std::string>> md5 = std::make_shared<std::promise<std::string>>();
+    Pending pending = { path, dirname, filename, md5->get_future().share() };
+    mPending.push_back(pending);
+    const size_t bytes = blob.size();
+    std::shared_ptr<std::string> data = std::make_shared<std::string>(std::move(blob));
+    enqueue([this, data, md5]() { md5->set_value(store(*data)); }, bytes);
+}
+
+void RenderpassBlobWriter::finish(const std::string& filename, Json::Value&& data)
+{
+    // Tasks are taken in order, so the blobs of this renderpass are stored or being stored
+    // by other workers by the time this runs
+    std::shared_ptr<std::vector<Pending>> pending = std::make_shared<std::vector<Pending>>();
+    pending->swap(mPending);
+    std::shared_ptr<Json::Value> json = std::make_shared<Json::Value>();
+    json->swap(data);
+    const std::string store = mStore;
+    enqueue([pending, json, filename, store]() {
+        std::unordered_map<std::string, std::string> names; // first file name of each MD5
+        for (const Pending& p : *pending)
+        {
+            const std::string md5 = p.md5.get();
+            auto it = names.find(md5);
+            if (it == names.end())
+            {
+                it = names.emplace(md5, p.filename).first;
+                link_or_copy(store + "/" + md5 + ".bin", p.dirname + "/" + p.filename);
+            }
+            Json::Path(p.path).make(*json) = it->second;
+        }
+        std::fstream fs;
+        fs.open(filename, std::fstream::out | std::fstream::trunc);
+        fs << json->toStyledString();
+        fs.close();
+    }, 0);
+}
+
+void RenderpassBlobWriter::flush()
+{
+    std::unique_lock<std::mutex> lk(mMutex);
+    mQueueChanged.wait(lk, [&]{ return mTasks.empty() && mBusy == 0; });
+}
+
+void RenderpassBlobWriter::enqueue(std::function<void()>&& task, size_t bytes)
+{
+    std::unique_lock<std::mutex> lk(mMutex);
+    if (mWorkers.empty())
+    {
+        const unsigned threads = common::concurrencyBudget();
+        for (unsigned i = 0; i < threads; i++)
+        {
+            mWorkers.emplace_back(&RenderpassBlobWriter::run, this);
+        }
+    }
+    mQueueChanged.wait(lk, [&]{ return mQueuedBytes == 0 || mQueuedBytes + bytes <= MAX_QUEUED_BYTES; });
+    mTasks.emplace_back(std::move(task), bytes);
+    mQueuedBytes += bytes;
+    lk.unlock();
+    mQueueChanged.notify_all();
+}
+
+void RenderpassBlobWriter::run()
+{
+    std::unique_lock<std::mutex> lk(mMutex);
+    while (true)
+    {
+        mQueueChanged.wait(lk, [&]{ return mStop || !mTasks.empty(); });
+        if (mTasks.empty())
+        {
+            return; // stopped
+        }
+        std::pair<std::function<void()>, size_t> task = std::move(mTasks.front());
+        mTasks.pop_front();
+        mBusy++;
+        lk.unlock();
+
+        task.first();
+
+        lk.lock();
+        mBusy--;
+        mQueuedBytes -= task.second;
+        mQueueChanged.notify_all();
+    }
+}
+
+std::string RenderpassBlobWriter::store(const std::string& blob)
 {
     const std::string md5 = common::MD5Digest(blob).text();
-    if (cache.count(md5) > 0)
+    std::promise<bool> written;
+    std::shared_future<bool> stored;
+    bool ours = false;
     {
-        return cache.at(md5);
+        std::lock_guard<std::mutex> lk(mStoreMutex);
+        auto it = mStored.find(md5);
+        if (it == mStored.end())
+        {
+            stored = written.get_future().share();
+            mStored.emplace(md5, stored);
+            ours = true;
+        }
+        else
+        {
+            stored = it->second;
+        }
     }
-    else
+    if (ours)
     {
-        FILE *fp = fopen(std::string(dirname + "/" + filename).c_str(), "w");
-        fwrite(blob.c_str(), blob.size(), 1, fp);
-        fclose(fp);
-        cache[md5] = filename;
-        return filename;
+        // Written under another name first, so that a crash never leaves a partial file in the store
+        const std::string filename = mStore + "/" + md5 + ".bin";
+        written.set_value(write_file(filename + ".tmp", blob.data(), blob.size()) && rename((filename + ".tmp").c_str(), filename.c_str()) == 0);
     }
+    stored.wait(); // others link to it once it is complete
+    return md5;
 }
 
 static std::string shader_filename(const StateTracker::Shader &shader, int context_index, int program_index)
@@ -121,42 +284,89 @@ static int64_t perf_stop()
     return count;
 }
 
+/// Where the enabled vertex attributes of a draw are read from
+struct AttribFetch
+{
+    uint64_t base; // buffer in the high bits, so that buffers do not share cache lines
+    unsigned stride;
+    unsigned size;
+};
+
+static std::vector<AttribFetch> enabledAttribs(const StateTracker::VertexArrayObject& vao)
+{
+    std::vector<AttribFetch> attribs;
+    for (const auto& pair : vao.boundVertexAttribs)
+    {
+        if (vao.array_enabled.count(pair.first))
+        {
+            AttribFetch a;
+            a.size = _gl_type_size(std::get<0>(pair.second), std::get<1>(pair.second));
+            a.stride = std::get<2>(pair.second) ? std::get<2>(pair.second) : a.size;
+            a.base = ((uint64_t)std::get<4>(pair.second) << 40) + std::get<3>(pair.second);
+            attribs.push_back(a);
+        }
+    }
+    return attribs;
+}
+
+static void fetchVertex(TileCacheSim& fetch, const std::vector<AttribFetch>& attribs, uint64_t vertex)
+{
+    for (const AttribFetch& a : attribs)
+    {
+        const uint64_t first = a.base + vertex * a.stride;
+        for (uint64_t addr = first & ~(uint64_t)(fetch_line_size - 1); addr < first + a.size; addr += fetch_line_size)
+        {
+            fetch.access(addr);
+        }
+    }
+}
+
 template<class T>
-static void analyzeIndexBuffer(const void *ptr, intptr_t offset, DrawParams& ret)
+static void analyzeIndexBuffer(const void *ptr, intptr_t offset, const std::vector<AttribFetch>& attribs, DrawParams& ret)
 {
     GLboolean primitive_restart = 0;
     _glGetBooleanv(GL_PRIMITIVE_RESTART_FIXED_INDEX, &primitive_restart);
-    std::map<T, long> cache;
+    std::unordered_map<T, long> cache;
+    cache.reserve(ret.count);
     long timestamp = 0;
     const unsigned stride = (unsigned)sizeof(T);
     const T* buffer = (const T*)ptr;
     offset /= stride;
     std::set<T> seen;
     int sum_age = 0;
+    VertexCacheSim vertex_cache(vertex_cache_size);
+    TileCacheSim fetch(fetch_cache_size, fetch_line_size);
     for (int idx = offset; idx < ret.count + offset; idx++)
     {
         const T element = buffer[idx];
-        long age;
+        long age = cache_size;
 
-        if (cache.count(element) > 0)
+        auto it = cache.find(element);
+        if (it != cache.end())
         {
-            age = std::min<long>(timestamp - cache[element], cache_size);
+            age = std::min<long>(timestamp - it->second, cache_size);
+            it->second = timestamp;
         }
         else
         {
-            age = cache_size;
+            cache.emplace(element, timestamp);
         }
 
         if (primitive_restart && element == std::numeric_limits<T>::max())
         {
             ret.primitives++;
         }
+        else if (!vertex_cache.access(element))
+        {
+            fetchVertex(fetch, attribs, (int64_t)element + ret.base_vertex);
+        }
         seen.insert(element);
-        cache[element] = timestamp;
         timestamp++;
         sum_age += age;
     }
     ret.temporal_locality = 1.0 - (double)(sum_age / ret.vertices) / (double)cache_size;
+    ret.shaded_vertices = vertex_cache.misses();
+    ret.vertex_fetch_bytes = fetch.fetchedBytes();
     ret.unique_vertices = seen.size();
     ret.min_value = *seen.begin();
     ret.max_value = *seen.rbegin();
@@ -247,6 +457,9 @@ DrawParams ParseInterfaceRetracing::getDrawCallCount(common::CallTM *call)
 
     // Peek at indices
     ret.unique_vertices = ret.vertices; // for non-indexed case
+    ret.shaded_vertices = ret.vertices;
+    const StateTracker::Context& ctx = contexts[context_index];
+    const std::vector<AttribFetch> attribs = enabledAttribs(ctx.vaos.at(ctx.vao_index));
     if (call->mCallName.find("Elements") != std::string::npos && !mQuickMode)
     {
         GLvoid *indices = drawCallIndexPtr(call);
@@ -287,13 +500,13 @@ DrawParams ParseInterfaceRetracing::getDrawCallCount(common::CallTM *call)
         switch (ret.value_type)
         {
         case GL_UNSIGNED_BYTE:
-            analyzeIndexBuffer<GLubyte>(ptr, reinterpret_cast<intptr_t>(indices), ret);
+            analyzeIndexBuffer<GLubyte>(ptr, reinterpret_cast<intptr_t>(indices), attribs, ret);
             break;
         case GL_UNSIGNED_SHORT:
-            analyzeIndexBuffer<GLushort>(ptr, reinterpret_cast<intptr_t>(indices), ret);
+            analyzeIndexBuffer<GLushort>(ptr, reinterpret_cast<intptr_t>(indices), attribs, ret);
             break;
         case GL_UNSIGNED_INT:
-            analyzeIndexBuffer<GLuint>(ptr, reinterpret_cast<intptr_t>(indices), ret);
+            analyzeIndexBuffer<GLuint>(ptr, reinterpret_cast<intptr_t>(indices), attribs, ret);
             break;
         default:
             DBG_LOG("Unknown index value type: %04x\n", (unsigned)ret.value_type);
@@ -306,11 +519,31 @@ DrawParams ParseInterfaceRetracing::getDrawCallCount(common::CallTM *call)
         }
     }
 
+    else if (call->mCallName.find("Elements") == std::string::npos)
+    {
+        TileCacheSim fetch(fetch_cache_size, fetch_line_size);
+        for (int v = 0; v < ret.count; v++)
+        {
+            fetchVertex(fetch, attribs, (uint64_t)ret.first_index + v);
+        }
+        ret.vertex_fetch_bytes = fetch.fetchedBytes();
+    }
+    if (ret.primitives > 0)
+    {
+        ret.acmr = (double)ret.shaded_vertices / ret.primitives;
+    }
+    if (ret.unique_vertices > 0)
+    {
+        ret.atvr = (double)ret.shaded_vertices / ret.unique_vertices;
+    }
+
     if (ret.instances > 0)
     {
         ret.vertices *= ret.instances;
         ret.unique_vertices *= ret.instances;
         ret.primitives *= ret.instances;
+        ret.shaded_vertices *= ret.instances;
+        ret.vertex_fetch_bytes *= ret.instances;
     }
 
     return ret;
@@ -362,14 +595,18 @@ bool ParseInterfaceRetracing::open(const std::string& input, const std::string&
 
 void ParseInterfaceRetracing::close()
 {
+    mBlobs.flush();
     GLWS::instance().Cleanup();
 }
 
 common::CallTM* ParseInterfaceRetracing::next_call()
 {
     // Get function
-    delete mCall;
-    mCall = new common::CallTM(gRetracer.mFile, gRetracer.GetCurCallId(), gRetracer.mCurCall);
+    if (!mCall)
+    {
+        mCall = new common::CallTM;
+    }
+    mCall->Reload(gRetracer.mFile, gRetracer.GetCurCallId(), gRetracer.mCurCall, mBorrowBlobs);
     // Verification checks (check that previous state is correct before overwriting)
     if (mCall->mCallName == "glEnable" || mCall->mCallName == "glDisable")
     {
@@ -517,15 +754,9 @@ void ParseInterfaceRetracing::completed_renderpass(const StateTracker::RenderPas
     }
     if (mScreenshots) mRenderpass.data["renderpass"]["snapshot"] = rp.snapshot_filename;
 
-    std::fstream fs;
-    fs.open(mRenderpass.filename, std::fstream::out |  std::fstream::trunc);
-    fs << mRenderpass.data.toStyledString();
-    fs.close();
+    mBlobs.finish(mRenderpass.filename, std::move(mRenderpass.data));
 
     mRenderpass.started = false;
-    mRenderpass.shader_cache.clear();
-    mRenderpass.index_cache.clear();
-    mRenderpass.vertex_cache.clear();
     mRenderpass.stored_programs.clear();
     mRenderpass.data = Json::Value();
 }
@@ -690,7 +921,7 @@ static int json_reuse_or_add(Json::Value& data, const std::string& key, const Js
     return idx;
 }
 
-static Json::Value write_index_buffer(const std::string& dirname, const std::string& filename, int geomidx, const DrawParams& params, const common::CallTM* call, cache_type& index_cache)
+static Json::Value write_index_buffer(const std::string& dirname, const std::string& filename, int geomidx, const DrawParams& params, const common::CallTM* call, RenderpassBlobWriter& blobs, const std::string& path)
 {
     Json::Value geometry;
     int width = 1;
@@ -734,7 +965,7 @@ static Json::Value write_index_buffer(const std::string& dirname, const std::str
             return Json::Value();
         }
     }
-    geometry["filename"] = write_or_reuse(dirname, filename, std::string(ptr, bufferSize), index_cache);
+    blobs.write(dirname, filename, std::string(ptr, bufferSize), path + ".filename");
     if (bufferId != 0)
     {
         _glUnmapBuffer(GL_COPY_READ_BUFFER);
@@ -762,7 +993,7 @@ static std::string gl_to_json_type(GLenum type)
     }
 }
 
-static Json::Value get_vertex_attributes(GLuint program, const std::string& dirname, const std::string& filename, int geomidx, const DrawParams& params, GLint index, cache_type& vertex_cache)
+static Json::Value get_vertex_attributes(GLuint program, const std::string& dirname, const std::string& filename, int geomidx, const DrawParams& params, GLint index, RenderpassBlobWriter& blobs, const std::string& path)
 {
     GLsizei length = 0;
     GLint size2 = 0;
@@ -815,7 +1046,7 @@ static Json::Value get_vertex_attributes(GLuint program, const std::string& dirn
 
     if (ptr && size)
     {
-        v["filename"] = write_or_reuse(dirname, filename, std::string(ptr, size), vertex_cache);
+        blobs.write(dirname, filename, std::string(ptr, size), path + ".filename");
     }
     else v["broken"] = true;
 
@@ -837,14 +1068,14 @@ static Json::Value get_vertex_attributes(GLuint program, const std::string& dirn
     return v;
 }
 
-static void add_shader(Json::Value& v, GLenum type, const std::string& key, const StateTracker::Context& context, const StateTracker::Program& program, const std::string& dirname, int context_index, int rp_index, cache_type& cache)
+static void add_shader(Json::Value& v, GLenum type, const std::string& key, const StateTracker::Context& context, const StateTracker::Program& program, const std::string& dirname, int context_index, int rp_index, RenderpassBlobWriter& blobs, const std::string& path)
 {
     if (program.shaders.count(type) > 0)
     {
         const StateTracker::Shader& shader = context.shaders.at(program.shaders.at(type));
         const std::string filename = shader_filename(shader, context_index, rp_index);
-        v[key] = write_or_reuse(dirname, filename, shader.source_code, cache);
-        v[key + "_preprocessed"] = write_or_reuse(dirname, "preprocessed_" + filename, shader.source_preprocessed, cache);
+        blobs.write(dirname, filename, std::string(shader.source_code), path + "." + key);
+        blobs.write(dirname, "preprocessed_" + filename, std::string(shader.source_preprocessed), path + "." + key + "_preprocessed");
         if (shader.contains_invariants) v["contains_invariants"] = true;
         v["varying_count"] = shader.varying_locations_used;
     }
@@ -894,12 +1125,16 @@ void ParseInterfaceRetracing::completed_drawcall(int frame, const DrawParams& pa
         mRenderpass.dirname = mOutputName + "_f" + std::to_string(frame) + "_rp" + std::to_string(rp.index);
         mRenderpass.filename = mRenderpass.dirname + "/renderpass.json";
         mRenderpass.started = true;
-        int result = mkdir(mRenderpass.dirname.c_str(), 0777);
-        if (result != 0 && errno != EEXIST)
+        for (const std::string& dirname : { mRenderpass.dirname, mOutputName + "_blobs" })
         {
-            DBG_LOG("Failed to create directory \"%s\": %s\n", mRenderpass.dirname.c_str(), strerror(errno));
-            abort();
+            int result = mkdir(dirname.c_str(), 0777);
+            if (result != 0 && errno != EEXIST)
+            {
+                DBG_LOG("Failed to create directory \"%s\": %s\n", dirname.c_str(), strerror(errno));
+                abort();
+            }
         }
+        mBlobs.setStore(mOutputName + "_blobs");
     }
 
     Json::Value command;
@@ -913,11 +1148,12 @@ void ParseInterfaceRetracing::completed_drawcall(int frame, const DrawParams& pa
         mRenderpass.stored_programs.insert(program_index);
         programidx = mRenderpass.data["resources"]["programs"].size();
         Json::Value s;
-        add_shader(s, GL_VERTEX_SHADER, "vertex_glsl", contexts[context_index], program, mRenderpass.dirname, context_index, rp.index, mRenderpass.shader_cache);
-        add_shader(s, GL_FRAGMENT_SHADER, "fragment_glsl", contexts[context_index], program, mRenderpass.dirname, context_index, rp.index, mRenderpass.shader_cache);
-        add_shader(s, GL_GEOMETRY_SHADER, "geometry_glsl", contexts[context_index], program, mRenderpass.dirname, context_index, rp.index, mRenderpass.shader_cache);
-        add_shader(s, GL_TESS_CONTROL_SHADER, "tess_control_glsl", contexts[context_index], program, mRenderpass.dirname, context_index, rp.index, mRenderpass.shader_cache);
-        add_shader(s, GL_TESS_EVALUATION_SHADER, "tess_evaluation_glsl", contexts[context_index], program, mRenderpass.dirname, context_index, rp.index, mRenderpass.shader_cache);
+        const std::string shaders = ".resources.programs[" + std::to_string(programidx) + "].shaders";
+        add_shader(s, GL_VERTEX_SHADER, "vertex_glsl", contexts[context_index], program, mRenderpass.dirname, context_index, rp.index, mBlobs, shaders);
+        add_shader(s, GL_FRAGMENT_SHADER, "fragment_glsl", contexts[context_index], program, mRenderpass.dirname, context_index, rp.index, mBlobs, shaders);
+        add_shader(s, GL_GEOMETRY_SHADER, "geometry_glsl", contexts[context_index], program, mRenderpass.dirname, context_index, rp.index, mBlobs, shaders);
+        add_shader(s, GL_TESS_CONTROL_SHADER, "tess_control_glsl", contexts[context_index], program, mRenderpass.dirname, context_index, rp.index, mBlobs, shaders);
+        add_shader(s, GL_TESS_EVALUATION_SHADER, "tess_evaluation_glsl", contexts[context_index], program, mRenderpass.dirname, context_index, rp.index, mBlobs, shaders);
         Json::Value p;
         p["shaders"] = s;
         mRenderpass.data["resources"]["programs"].append(p);
@@ -953,6 +1189,7 @@ void ParseInterfaceRetracing::completed_drawcall(int frame, const DrawParams& pa
     // -- Geometry --
     const int geomidx = mRenderpass.data["resources"]["geometry"].size(); // always add another
     command["geometry"] = geomidx;
+    const std::string geometry_path = ".resources.geometry[" + std::to_string(geomidx) + "]";
     Json::Value geometry;
     GLint activeUniforms = 0;
     GLuint program_id = contexts[context_index].programs.at(program_index).id;
@@ -969,7 +1206,7 @@ void ParseInterfaceRetracing::completed_drawcall(int frame, const DrawParams& pa
         command["draw_params"]["average_index_hole"] = params.avg_sparseness - 1;
         command["draw_params"]["max_index_value"] = params.max_value;
         command["draw_params"]["min_index_value"] = params.min_value;
-        geometry["index_buffer"] = write_index_buffer(mRenderpass.dirname, filename, geomidx, params, mCall, mRenderpass.index_cache);
+        geometry["index_buffer"] = write_index_buffer(mRenderpass.dirname, filename, geomidx, params, mCall, mBlobs, geometry_path + ".index_buffer");
     }
     // For each enabled vertex attribute binding
     GLint max_vertex_attribs = 0;
@@ -980,7 +1217,8 @@ void ParseInterfaceRetracing::completed_drawcall(int frame, const DrawParams& pa
         _glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &enabled);
         if (!enabled) continue;
         const std::string vfilename = "vertex_buffer_g" + std::to_string(geomidx) + "_b" + std::to_string(index) + ".bin";
-        Json::Value v = get_vertex_attributes(program_id, mRenderpass.dirname, vfilename, geomidx, params, index, mRenderpass.vertex_cache);
+        const std::string vpath = geometry_path + ".vertex_buffers[" + std::to_string(geometry["vertex_buffers"].size()) + "]";
+        Json::Value v = get_vertex_attributes(program_id, mRenderpass.dirname, vfilename, geomidx, params, index, mBlobs, vpath);
         geometry["vertex_buffers"].append(v);
     }
     mRenderpass.data["resources"]["geometry"].append(geometry);
@@ -1013,16 +1251,17 @@ void ParseInterfaceRetracing::completed_drawcall(int frame, const DrawParams& pa
 
 void ParseInterfaceRetracing::thread(const int threadidx, const int our_tid, Callback c, void *data)
 {
-    std::unique_lock<std::mutex> lk(gRetracer.mConditionMutex);
     thread_result r;
     r.our_tid = our_tid;
+    const auto ourTurn = [&]{ return our_tid == gRetracer.latest_call_tid.load() || gRetracer.mFinish.load(); };
+    gRetracer.handoffs.at(threadidx).wait(ourTurn); // new threads are created before they are handed over to
     while (!gRetracer.mFinish)
     {
         mCall = next_call();
         if (!mCall || !c(*this, mCall, data))
         {
             gRetracer.mFinish = true;
-            for (auto &cv : gRetracer.conditions) cv.notify_one(); // Wake up all other threads
+            for (auto &h : gRetracer.handoffs) h.wake(); // Wake up all other threads
             break;
         }
 
@@ -1033,7 +1272,7 @@ skip_call:
         if (!gRetracer.mFile.GetNextCall(gRetracer.fptr, gRetracer.mCurCall, gRetracer.src))
         {
             gRetracer.mFinish = true;
-            for (auto &cv : gRetracer.conditions) cv.notify_one(); // Wake up all other threads
+            for (auto &h : gRetracer.handoffs) h.wake(); // Wake up all other threads
             break;
         }
         // Skip call because it is on an ignored thread?
@@ -1044,26 +1283,18 @@ skip_call:
         // Need to switch active thread?
         if (our_tid != gRetracer.mCurCall.tid)
         {
-            gRetracer.latest_call_tid = gRetracer.mCurCall.tid; // need to use an atomic member copy of this here
             // Do we need to make this thread?
             if (gRetracer.thread_remapping.count(gRetracer.mCurCall.tid) == 0)
             {
                 gRetracer.thread_remapping[gRetracer.mCurCall.tid] = gRetracer.threads.size();
                 int newthreadidx = gRetracer.threads.size();
-                gRetracer.conditions.emplace_back();
+                gRetracer.handoffs.emplace_back();
                 gRetracer.threads.emplace_back(&ParseInterfaceRetracing::thread, this, (int)newthreadidx, (int)gRetracer.mCurCall.tid, c, data);
             }
-            else // Wake up existing thread
-            {
-                const int otheridx = gRetracer.thread_remapping.at(gRetracer.mCurCall.tid);
-                gRetracer.conditions.at(otheridx).notify_one();
-            }
-            // Now we go to sleep. However, there is a race condition, since the thread we woke up above might already have told us
-            // to wake up again, so keep waking up to check if that is indeed the case.
-            bool success = false;
-            do {
-                success = gRetracer.conditions.at(threadidx).wait_for(lk, std::chrono::milliseconds(50), [&]{ return our_tid == gRetracer.latest_call_tid || gRetracer.mFinish; });
-            } while (!success);
+            ThreadHandoff& other = gRetracer.handoffs.at(gRetracer.thread_remapping.at(gRetracer.mCurCall.tid));
+            gRetracer.latest_call_tid.store(gRetracer.mCurCall.tid); // the other thread may run from here on
+            other.wake();
+            gRetracer.handoffs.at(threadidx).wait(ourTurn);
             // Set internal tracking variables correctly
             if (current_surface.count(our_tid) > 0) surface_index = current_surface.at(our_tid);
             if (current_context.count(our_tid) > 0) context_index = current_context.at(our_tid);
@@ -1079,7 +1310,8 @@ void ParseInterfaceRetracing::loop(Callback c, void *data)
     }
     mCall = next_call();
     gRetracer.threads.resize(1);
-    gRetracer.conditions.resize(1);
+    gRetracer.handoffs.resize(1);
+    gRetracer.latest_call_tid = gRetracer.mCurCall.tid;
     thread(0, gRetracer.mCurCall.tid, c, data);
     for (std::thread &t : gRetracer.threads)
     {
@@ -5,10 +5,67 @@
 #include "retracer/retrace_api.hpp"
 #include "tool/parse_interface.h"
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
 #include <unordered_set>
 #include <unordered_map>
+#include <vector>
 
-typedef std::unordered_map<std::string, std::string> cache_type;
+/// Writes the files of renderpass dumps on worker threads, so that the GL thread only copies
+/// the data. Files are content addressed: each distinct blob is hashed and written once into a
+/// store directory under its MD5, and hard linked into every renderpass directory that uses it,
+/// so identical buffers of different draws and renderpasses cost a single write. Within a
+/// renderpass, blobs with the same contents share the name of the first one, as before.
+class RenderpassBlobWriter
+{
+public:
+    static const size_t MAX_QUEUED_BYTES = 256 * 1024 * 1024; ///< callers wait when this much is not written yet
+
+    ~RenderpassBlobWriter();
+
+    /// Directory of the content store, shared by all renderpasses
+    void setStore(const std::string& dirname) { mStore = dirname; }
+
+    /// Queue blob to be written as filename in dirname. The name that the JSON should refer to
+    /// is set at path (see Json::Path) of the renderpass JSON by finish().
+    void write(const std::string& dirname, const std::string& filename, std::string&& blob, const std::string& path);
+    /// Queue writing the JSON of a renderpass to filename, once the names of its blobs are known
+    void finish(const std::string& filename, Json::Value&& data);
+    /// Wait until everything queued is written
+    void flush();
+
+private:
+    struct Pending
+    {
+        std::string path;
+        std::string dirname;
+        std::string filename;
+        std::shared_future<std::string> md5;
+    };
+
+    void enqueue(std::function<void()>&& task, size_t bytes);
+    void run();
+    /// Put blob in the store, unless it is there already, and return its MD5
+    std::string store(const std::string& blob);
+
+    std::string mStore;
+    std::vector<Pending> mPending; ///< blobs of the current renderpass
+
+    std::mutex mMutex;
+    std::condition_variable mQueueChanged;
+    std::deque<std::pair<std::function<void()>, size_t>> mTasks;
+    size_t mQueuedBytes = 0;
+    unsigned mBusy = 0; ///< tasks being run
+    bool mStop = false;
+    std::vector<std::thread> mWorkers;
+
+    std::mutex mStoreMutex;
+    std::unordered_map<std::string, std::shared_future<bool>> mStored; ///< MD5 to whether it was stored
+};
 
 struct RenderpassJson
 {
@@ -17,10 +74,6 @@ struct RenderpassJson
     std::string dirname;
     std::unordered_set<int> stored_programs;
     bool started = false;
-
-    cache_type shader_cache;
-    cache_type index_cache;
-    cache_type vertex_cache;
 };
 
 class ParseInterfaceRetracing : public ParseInterfaceBase
@@ -44,6 +97,7 @@ private:
     void thread(const int threadidx, const int our_tid, Callback c, void *data);
 
     RenderpassJson mRenderpass;
+    RenderpassBlobWriter mBlobs;
     int64_t mCpuCycles = 0;
     common::CallTM* mCall;
 };
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -338,13 +339,15 @@ int pat_extract(const string &source_name, const string &target_name_, int begin
     cout << "Extract: " << source_name << " -> " << target_name << "\n" << endl;
     Json::Value header = source_file.mpInFileRA->getJSONHeader();
     unsigned defaultTid = header["defaultTid"].asInt();
-    int callNo = 0, frameNo = 0;
-    common::CallTM *call = NULL;
-    for (callNo = 0; (call = source_file.NextCall()); ++callNo) {
-        if (call->mTid == defaultTid && call->mCallName.substr(0, 14) == "eglSwapBuffers") {
-            ++frameNo;
-        }
+    // The frame index already knows how many calls and frames there are
+    const int frameCount = source_file.mFrames.size();
+    int callNo = 0, frameNo = frameCount;
+    if (frameCount > 0) {
+        const common::FrameTM *last = source_file.mFrames.back();
+        callNo = last->mFirstCallOfThisFrame + last->GetCallCount();
     }
+    begin_call = std::max(begin_call, 0);
+    end_call = std::min(end_call, callNo - 1);
     cout << "callNo = " << callNo << ", frameNo = " << frameNo << endl;
     int temp_callNo = callNo;
     callNo_width = 0;
@@ -381,14 +384,18 @@ int pat_extract(const string &source_name, const string &target_name_, int begin
     fout.clear();
 
     makeProgress(0, callNo, true);
-    bool finished = false, file_beginning = true, no_frame_file_opened = true;
+    bool finished = false, done = false, file_beginning = true, no_frame_file_opened = true;
+    // The calls outside the range are copied as they are stored, so the files around it
+    // have to use the signature book of the source
+    std::vector<std::string> sigbook;
+    source_file.mpInFileRA->copySigBook(sigbook);
     common::OutFile outputFileBefore, outputFileAfter;
-    if (!outputFileBefore.Open((target_name + "/not_interested_in/before.pat").c_str()))
+    if (!outputFileBefore.Open((target_name + "/not_interested_in/before.pat").c_str(), true, &sigbook))
     {
         PAT_DEBUG_LOG("Failed to open file %s for writing extracting result!\n", (target_name + "/not_interested_in/before.pat").c_str());
         return 1;
     }
-    if (!outputFileAfter.Open((target_name + "/not_interested_in/after.pat").c_str()))
+    if (!outputFileAfter.Open((target_name + "/not_interested_in/after.pat").c_str(), true, &sigbook))
     {
         PAT_DEBUG_LOG("Failed to open file %s for writing extracting result!\n", (target_name + "/not_interested_in/after.pat").c_str());
         return 1;
@@ -397,25 +404,31 @@ int pat_extract(const string &source_name, const string &target_name_, int begin
     outputFileBefore.WriteHeader(strWrite.c_str(), strWrite.size());
     outputFileAfter.mHeader.jsonLength = strWrite.size();
     outputFileAfter.WriteHeader(strWrite.c_str(), strWrite.size());
-    file_counter = 0;
-    for (callId = 0; (call = source_file.NextCall()); ++callId)
+    // the calls before and after the ones user interested in
+    if (source_file.CopyCalls(0, std::min(begin_call, callNo), outputFileBefore) < 0 ||
+        source_file.CopyCalls(std::max(end_call + 1, begin_call), callNo, outputFileAfter) < 0)
     {
-        if (callId < begin_call)           // the call before user interested in
-        {
-            writeout(outputFileBefore, call);
-            if (call->mTid == defaultTid && call->mCallName.substr(0, 14) == "eglSwapBuffers") {
-                file_counter++;
-            }
-        }
-        else if (callId > end_call)        // the call after user interested in
+        PAT_DEBUG_LOG("Failed to copy the calls outside %d - %d of %s\n", begin_call, end_call, source_name.c_str());
+        return 1;
+    }
+    makeProgress(callNo - std::max(end_call - begin_call + 1, 0), callNo);
+
+    // Every frame before the one of begin_call ends with a swap
+    const int firstFrame = begin_call < callNo ? source_file.GetFrameIdx(begin_call) : -1;
+    file_counter = firstFrame >= 0 ? firstFrame : frameCount;
+    for (int fr = std::max(firstFrame, 0); firstFrame >= 0 && fr < frameCount && !done; ++fr)
+    {
+        common::FrameTM *frame = source_file.mFrames[fr];
+        frame->LoadCalls(source_file.mpInFileRA);
+        for (common::CallTM *call : frame->mCalls)
         {
-            writeout(outputFileAfter, call);
-            if (call->mTid == defaultTid && call->mCallName.substr(0, 14) == "eglSwapBuffers") {
-                file_counter++;
+            callId = call->mCallNo;
+            if (callId < begin_call)
+                continue;
+            if (callId > end_call) {
+                done = true;
+                break;
             }
-        }
-        else
-        {
             if (open_frame_file(fout, no_frame_file_opened, frameNo_width))
                 no_frame_file_opened = false;
             else
@@ -524,8 +537,9 @@ int pat_extract(const string &source_name, const string &target_name_, int begin
                 }
             }
             function_value.clear();
+            makeProgress(callNo - end_call + callId, callNo);
         }
-        makeProgress(callId + 1, callNo);
+        frame->UnloadCalls();
     }
     if (!finished) {
         fout << "\n]";
@@ -4,7 +4,8 @@
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow)
+    ui(new Ui::MainWindow),
+    labelCache(200000)
 {
     ui->setupUi(this);
     ui->statusBar->showMessage("Arm");
@@ -111,6 +112,11 @@ MainWindow::~MainWindow()
         o_objThread->quit();
         o_objThread->wait();
     }
+    if (searchThread)
+    {
+        searchThread->quit();
+        searchThread->wait();
+    }
 }
 
 void MainWindow::showhelp()
@@ -159,6 +165,23 @@ void MainWindow::startPercentThread()
     percentThread->start();
 }
 
+void MainWindow::startSearchThread()
+{
+    if (searchThread)
+    {
+        return;
+    }
+    qRegisterMetaType<QList<int>>("QList<int>");
+    searchThread = new QThread();
+    searchObj = new SearchThread();
+    searchObj->moveToThread(searchThread);
+    connect(searchThread, &QThread::finished, searchThread, &QObject::deleteLater);
+    connect(searchThread, &QThread::finished, searchObj, &QObject::deleteLater);
+    connect(this, &MainWindow::deliversearch, searchObj, &SearchThread::search);
+    connect(searchObj, &SearchThread::searchFinished, this, &MainWindow::showSearchResult);
+    searchThread->start();
+}
+
 int Qstringcompare(QString arr1, QString arr2)
 {
     QString tmp1, tmp2;
@@ -801,26 +824,7 @@ void MainWindow::on_treeJsonFile_itemSelectionChanged()
 
     if (parent == NULL)
     {
-        int childrencount = item->childCount();
-        for (int i =0; i< childrencount; i++)
-        {
-            QTreeWidgetItem *child = item->takeChild(0);
-            delete child;
-        }
-        int num = ui->treeJsonFile->indexOfTopLevelItem(item);
-        for (int i = frame_start[num]; i<=frame_end[num]; i++)
-        {
-            QJsonDocument eachFunction = QJsonDocument::fromJson(resave_string[i].toUtf8());
-            QJsonObject eachFunction_obj = eachFunction.object();
-            QJsonValue callno = eachFunction_obj.value(QString("0 call_no"));
-            QString callnum = QString::number(callno.toInt(), 10);
-            QJsonValue functionname = eachFunction_obj.value(QString("2 func_name"));
-            QString functionname_str = functionname.toString();
-            QString abbreviation = "(" + callnum + ")" + functionname_str;
-            QTreeWidgetItem *item1=new QTreeWidgetItem;
-            item1->setText(0, abbreviation);
-            item->addChild(item1);
-        }
+        populateFrame(item);
     }
     else{
         ui->ItemInformation->clear();
@@ -969,16 +973,33 @@ void MainWindow::on_treeJsonFile_itemSelectionChanged()
     emit itemOpened();
 }
 
-void MainWindow::doSearching()
+// Fill in the calls of a frame. The children are built in one go, since adding them one at a
+// time costs more than building them on frames with 100k+ calls, and only the rows in view
+// are ever painted.
+void MainWindow::populateFrame(QTreeWidgetItem *item)
 {
-    if (list.size()>0)
+    qDeleteAll(item->takeChildren());
+    int num = ui->treeJsonFile->indexOfTopLevelItem(item);
+    QList<QTreeWidgetItem *> children;
+    children.reserve(frame_end[num] - frame_start[num] + 1);
+    for (int i = frame_start[num]; i<=frame_end[num]; i++)
     {
-        for (int i = 0; i<nCount; i++)
+        QString *label = labelCache.object(resave_string[i]);
+        if (!label)
         {
-            list[i]->setBackground(0, QColor(0, 0, 0, 0));
+            label = new QString(callLabel(resave_string[i]));
+            labelCache.insert(resave_string[i], label);
         }
-        list.clear();
+        QTreeWidgetItem *item1=new QTreeWidgetItem;
+        item1->setText(0, *label);
+        children.append(item1);
     }
+    item->addChildren(children);
+}
+
+void MainWindow::doSearching()
+{
+    matches.clear();
     findnum = 0;
     strTemplate = ui->Filter->text();
     if (strTemplate.isEmpty())
@@ -986,24 +1007,52 @@ void MainWindow::doSearching()
         return;
     }
 
-    list = ui->treeJsonFile->findItems(strTemplate, Qt::MatchContains | Qt::MatchRecursive, 0);
+    // search every call of the opened files on the worker, whether its frame is expanded or not
+    if (!searchThread)
+    {
+        startSearchThread();
+    }
+    ui->statusBar->showMessage("Searching......");
+    emit deliversearch(strTemplate, resave_string);
+}
 
-    nCount = list.count();
-    if (nCount < 1)
+void MainWindow::showSearchResult(const QString &pattern, const QList<int> &rows)
+{
+    if (pattern != strTemplate)
+    {
+        return; // a newer search is on its way
+    }
+    matches = rows;
+    ui->statusBar->showMessage(QString::number(matches.size()) + " matching");
+    if (matches.size() < 1)
     {
         QMessageBox::information(this, tr("Results"), tr("No matching"));
         return;
     }
+    showMatch();
+}
 
-    for (int i = 0; i<nCount; i++)
+void MainWindow::showMatch()
+{
+    const int callpos = matches[findnum];
+    int frame = 0;
+    while (frame < int(frame_end.size()) && frame_end[frame] < callpos)
     {
-        list[i]->setBackground(0, QColor(0, 0, 255, 31));
+        frame++;
     }
-
-    ui->treeJsonFile->setCurrentItem(list[findnum]);
-    ui->treeJsonFile->scrollToItem(list[findnum]);
+    if (frame == int(frame_end.size()))
+    {
+        return; // calls were deleted since the search
+    }
+    QTreeWidgetItem *parent = ui->treeJsonFile->topLevelItem(frame);
+    if (parent->childCount() != frame_end[frame] - frame_start[frame] + 1)
+    {
+        populateFrame(parent);
+    }
+    QTreeWidgetItem *item = parent->child(callpos - frame_start[frame]);
+    ui->treeJsonFile->setCurrentItem(item);
+    ui->treeJsonFile->scrollToItem(item);
     ui->treeJsonFile->setFocus();
-
 }
 
 void MainWindow::on_FindNext_clicked()
@@ -1013,16 +1062,14 @@ void MainWindow::on_FindNext_clicked()
         QMessageBox::information(this, tr("Results"), tr("Keywords changed"));
         return;
     }
-    else{
-        if (findnum == nCount - 1){
+    else if (matches.size() > 0) {
+        if (findnum == matches.size() - 1){
             findnum = 0;
         }
         else{
             ++findnum;
         }
-        ui->treeJsonFile->setCurrentItem(list[findnum]);
-        ui->treeJsonFile->scrollToItem(list[findnum]);
-        ui->treeJsonFile->setFocus();
+        showMatch();
     }
 }
 
@@ -1033,16 +1080,14 @@ void MainWindow::on_FindPrevious_clicked()
         QMessageBox::information(this, tr("Results"), tr("Keywords changed"));
         return;
     }
-    else {
+    else if (matches.size() > 0) {
         if (findnum == 0) {
-            findnum = nCount - 1;
+            findnum = matches.size() - 1;
         }
         else {
             --findnum;
         }
-        ui->treeJsonFile->setCurrentItem(list[findnum]);
-        ui->treeJsonFile->scrollToItem(list[findnum]);
-        ui->treeJsonFile->setFocus();
+        showMatch();
     }
 }
 
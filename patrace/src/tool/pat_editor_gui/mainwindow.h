@@ -16,6 +16,7 @@
 #include <QTextBlock>
 #include <QWidget>
 #include <QHeaderView>
+#include <QCache>
 #include <fstream>
 #include <string>
 #include "dialog.h"
@@ -25,6 +26,7 @@
 #include <QObject>
 #include "open_thread.h"
 #include "percentage_thread.h"
+#include "search_thread.h"
 
 namespace Ui {
     class MainWindow;
@@ -60,6 +62,7 @@ private slots:
     void record_itemChange();
     void flagChanged(int, int);
     void showhelp();
+    void showSearchResult(const QString &pattern, const QList<int> &rows);
 signals:
     void deliverfilename(const QStringList &);
     void deliverpatinf(const QString &,const QString &);
@@ -67,9 +70,13 @@ signals:
     void GUIupdate();
     void GUIupdate_saving();
     void itemOpened();
+    void deliversearch(const QString &, const QStringList &);
 private:
     void startOpenThread();
     void startPercentThread();
+    void startSearchThread();
+    void populateFrame(QTreeWidgetItem *item);
+    void showMatch();
 private:
     Ui::MainWindow *ui;
     Dialog *new_Dialog;
@@ -80,6 +87,9 @@ private:
     PercentageThread *percentObj = NULL;
     QThread *percentThread = NULL;
 
+    SearchThread *searchObj = NULL;
+    QThread *searchThread = NULL;
+
     QStringList resave_string;//save all json content
     std::vector<int> frame_start;//save the start location of each json file
     std::vector<int> frame_end;//save the end location of each json file
@@ -90,9 +100,9 @@ private:
     bool PatOpened = false;
 
     QString strTemplate;
-    QList<QTreeWidgetItem *> list;
+    QList<int> matches;// positions in resave_string of the calls found by the search
     int findnum;
-    int nCount;
+    QCache<QString, QString> labelCache;// labels of the calls in the frame tree, by their JSON
 
     QTreeWidgetItem *newitemlocation;
     bool itemchanged = false;
@@ -0,0 +1,65 @@
+#include "search_thread.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+
+// The value that follows the key, with the separating colon and white space skipped
+static int valueStart(const QString &json, const QString &key)
+{
+    int pos = json.indexOf(key);
+    if (pos < 0)
+    {
+        return -1;
+    }
+    pos = json.indexOf(':', pos + key.size());
+    if (pos < 0)
+    {
+        return -1;
+    }
+    for (++pos; pos < json.size() && json[pos].isSpace(); ++pos)
+        ;
+    return pos;
+}
+
+QString callLabel(const QString &json)
+{
+    const int callno = valueStart(json, "\"0 call_no\"");
+    const int name = valueStart(json, "\"2 func_name\"");
+    if (callno >= 0 && name >= 0 && name < json.size() && json[name] == '"')
+    {
+        int callno_end = callno;
+        while (callno_end < json.size() && (json[callno_end].isDigit() || json[callno_end] == '-'))
+        {
+            ++callno_end;
+        }
+        const int name_end = json.indexOf('"', name + 1);
+        if (callno_end > callno && name_end > name)
+        {
+            return "(" + json.mid(callno, callno_end - callno) + ")" + json.mid(name + 1, name_end - name - 1);
+        }
+    }
+
+    // not laid out as expected, so parse it
+    QJsonObject object = QJsonDocument::fromJson(json.toUtf8()).object();
+    QString callnum = QString::number(object.value(QString("0 call_no")).toInt(), 10);
+    return "(" + callnum + ")" + object.value(QString("2 func_name")).toString();
+}
+
+SearchThread::SearchThread(QObject *parent):
+    QObject(parent)
+{}
+
+SearchThread::~SearchThread()
+{}
+
+void SearchThread::search(const QString &pattern, const QStringList &calls)
+{
+    QList<int> rows;
+    for (int i = 0; i < calls.size(); i++)
+    {
+        if (callLabel(calls[i]).contains(pattern))
+        {
+            rows.append(i);
+        }
+    }
+    emit searchFinished(pattern, rows);
+}
@@ -0,0 +1,29 @@
+#ifndef SEARCH_THREAD_H
+#define SEARCH_THREAD_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QObject>
+
+// The "(call_no)func_name" label of a call in the frame tree, read straight out of the JSON
+// text of the call, which is much faster than parsing it
+QString callLabel(const QString &json);
+
+class SearchThread : public QObject
+{
+    Q_OBJECT
+
+public:
+    SearchThread(QObject* parent = NULL);
+    ~SearchThread();
+
+public slots:
+    // Find the calls whose label contains the pattern, among all calls of all opened files
+    void search(const QString &pattern, const QStringList &calls);
+
+signals:
+    void searchFinished(const QString &pattern, const QList<int> &rows);
+};
+
+#endif // SEARCH_THREAD_H
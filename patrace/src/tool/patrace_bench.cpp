@@ -0,0 +1,682 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <common/chunk_codec.hpp>
+#include <common/file_format.hpp>
+#include <common/in_file_mt.hpp>
+#include <common/in_file_ra.hpp>
+#include <common/os.hpp>
+#include <common/parse_api.hpp>
+#include <common/trace_model.hpp>
+#include <retracer/value_map.hpp>
+#include <tool/config.hpp>
+
+#include "jsoncpp/include/json/writer.h"
+
+using namespace common;
+
+// Microbenchmarks of the trace decode path: chunk decompression, walking the calls, decoding
+// their arguments the way the generated retracer code does, and remapping names. They run
+// on a synthetic call stream, so that there is always something to compare, and on a
+// recorded trace if one is given. Each benchmark is run several times and the fastest run
+// is reported, as JSON, so that the numbers can be tracked from build to build.
+
+namespace {
+
+/// What one run of a benchmark did, and how long it took
+struct Run
+{
+    double seconds = 0.0;
+    uint64_t items = 0;
+    uint64_t bytes = 0;
+};
+
+/// Kinds of calls with the argument layouts of common GLES calls
+enum CallKind
+{
+    KIND_NONE,
+    KIND_ENABLE, ///< one enum, as glEnable
+    KIND_BIND, ///< an enum and a name, as glBindTexture
+    KIND_UNIFORM, ///< location, count and an array, as glUniform4fv
+    KIND_DRAW, ///< mode, count, type and an opaque pointer, as glDrawElements
+    KIND_BUFFER, ///< target, size, a blob and usage, as glBufferData
+    KIND_COUNT
+};
+
+// Keeps the decoded values alive, so that decoding is not optimized away
+static volatile uint64_t gSink = 0;
+
+class Bench
+{
+public:
+    explicit Bench(unsigned repetitions) : mRepetitions(repetitions) {}
+
+    /// Run f(Run&) repetitions times and keep the fastest run. f fills in items and bytes.
+    template<typename F> void run(const std::string& name, F f, Json::Value extra = Json::Value())
+    {
+        Run best;
+        for (unsigned i = 0; i < mRepetitions; i++)
+        {
+            Run r;
+            const auto start = std::chrono::steady_clock::now();
+            f(r);
+            r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (i == 0 || r.seconds < best.seconds)
+            {
+                best = r;
+            }
+        }
+        report(name, best, extra);
+    }
+
+    /// Add a measurement taken elsewhere
+    void report(const std::string& name, const Run& r, Json::Value extra = Json::Value())
+    {
+        Json::Value v = extra.isObject() ? extra : Json::Value(Json::objectValue);
+        v["name"] = name;
+        v["seconds"] = r.seconds;
+        v["items"] = (Json::Value::UInt64)r.items;
+        v["bytes"] = (Json::Value::UInt64)r.bytes;
+        if (r.seconds > 0.0)
+        {
+            v["items_per_second"] = r.items / r.seconds;
+            v["mb_per_second"] = r.bytes / r.seconds / (1024.0 * 1024.0);
+        }
+        if (r.items > 0)
+        {
+            v["ns_per_item"] = r.seconds * 1e9 / r.items;
+        }
+        DBG_LOG("%-40s %10.3f ms %12llu items %10.1f ns/item %10.1f MB/s\n", name.c_str(), r.seconds * 1000.0,
+                (unsigned long long)r.items, r.items ? r.seconds * 1e9 / r.items : 0.0,
+                r.seconds > 0.0 ? r.bytes / r.seconds / (1024.0 * 1024.0) : 0.0);
+        mResults.append(v);
+    }
+
+    const Json::Value& results() const { return mResults; }
+
+private:
+    unsigned mRepetitions;
+    Json::Value mResults = Json::arrayValue;
+};
+
+// Decode the arguments of a call as the generated retracer code does. Returns a value made of
+// them, and the names of bind calls through name.
+static uint64_t decodeCall(CallKind kind, char* src, unsigned& name)
+{
+    switch (kind)
+    {
+    case KIND_ENABLE:
+    {
+        int cap;
+        src = ReadFixed(src, cap);
+        return cap;
+    }
+    case KIND_BIND:
+    {
+        int target;
+        src = ReadFixed(src, target);
+        src = ReadFixed<unsigned int>(src, name);
+        return target + name;
+    }
+    case KIND_UNIFORM:
+    {
+        int location;
+        int count;
+        Array<float> value;
+        src = ReadFixed<int>(src, location);
+        src = ReadFixed<int>(src, count);
+        src = Read1DArray(src, value);
+        return location + count + value.cnt + (value.cnt ? (uint64_t)value.v[0] : 0);
+    }
+    case KIND_DRAW:
+    {
+        int mode;
+        int count;
+        int type;
+        src = ReadFixed(src, mode);
+        src = ReadFixed<int>(src, count);
+        src = ReadFixed(src, type);
+        uint64_t indices = 0;
+        unsigned int opaqueType = 0;
+        src = ReadFixed(src, opaqueType);
+        if (opaqueType == BufferObjectReferenceType)
+        {
+            unsigned int raw;
+            src = ReadFixed<unsigned int>(src, raw);
+            indices = raw;
+        }
+        else if (opaqueType == BlobType)
+        {
+            Array<float> blob;
+            src = Read1DArray(src, blob);
+            indices = blob.cnt;
+        }
+        else if (opaqueType == ClientSideBufferObjectReferenceType)
+        {
+            unsigned int csbName = 0;
+            unsigned int offset = 0;
+            src = ReadFixed<unsigned int>(src, csbName);
+            src = ReadFixed<unsigned int>(src, offset);
+            indices = csbName + offset;
+        }
+        return mode + count + type + indices;
+    }
+    case KIND_BUFFER:
+    {
+        int target;
+        long long size;
+        Array<char> data;
+        int usage;
+        src = ReadFixed(src, target);
+        src = ReadFixed<long long>(src, size);
+        src = Read1DArray(src, data);
+        src = ReadFixed(src, usage);
+        return target + size + data.cnt + usage;
+    }
+    default:
+        return 0;
+    }
+}
+
+// ---------- synthetic call stream ----------
+
+/// Length of the fixed length kinds, header included, or 0 for those stored with toNext
+static const unsigned kSyntheticLength[KIND_COUNT] = { 0, 8, 12, 0, 0, 0 };
+
+/// A call stream of about the given size, with roughly the mix of calls of a game frame
+static void buildSyntheticStream(std::vector<char>& stream, size_t size)
+{
+    std::mt19937 rng(12345);
+    // vertex data, which varies slowly and so compresses somewhat
+    std::vector<uint16_t> blob(8 * 1024);
+    uint16_t value = 0;
+    for (size_t i = 0; i < blob.size(); i++)
+    {
+        value += rng() % 64;
+        blob[i] = value;
+    }
+    std::vector<float> floats(64);
+    stream.resize(size + 128 * 1024);
+    char* dest = stream.data();
+    char* const end = stream.data() + size;
+    while (dest < end)
+    {
+        const unsigned r = rng() % 100;
+        const CallKind kind = r < 10 ? KIND_ENABLE : r < 45 ? KIND_BIND : r < 80 ? KIND_UNIFORM : r < 98 ? KIND_DRAW : KIND_BUFFER;
+        BCall_vlen* call = (BCall_vlen*)dest;
+        call->funcId = kind;
+        call->tid = 0;
+        call->errNo = 0;
+        call->reserved = 0;
+        char* args = dest + (kSyntheticLength[kind] ? sizeof(BCall) : sizeof(BCall_vlen));
+        switch (kind)
+        {
+        case KIND_ENABLE:
+            args = WriteFixed<int>(args, 0x0B71 + rng() % 4);
+            break;
+        case KIND_BIND:
+            args = WriteFixed<int>(args, 0x0DE1);
+            args = WriteFixed<unsigned int>(args, 1 + rng() % 512);
+            break;
+        case KIND_UNIFORM:
+        {
+            const unsigned count = 1 + rng() % 4;
+            for (unsigned i = 0; i < count * 4; i++)
+            {
+                floats[i] = (rng() % 1000) / 1000.0f;
+            }
+            args = WriteFixed<int>(args, rng() % 32);
+            args = WriteFixed<int>(args, count);
+            args = Write1DArray<float>(args, count * 4, floats.data());
+            break;
+        }
+        case KIND_DRAW:
+            args = WriteFixed<int>(args, 0x0004);
+            args = WriteFixed<int>(args, 3 * (1 + rng() % 2000));
+            args = WriteFixed<int>(args, 0x1403);
+            args = WriteFixed<unsigned int>(args, BufferObjectReferenceType);
+            args = WriteFixed<unsigned int>(args, (rng() % 1024) * 4);
+            break;
+        case KIND_BUFFER:
+        {
+            const unsigned len = 4 * (1 + rng() % (blob.size() / 2));
+            args = WriteFixed<int>(args, 0x8892);
+            args = WriteFixed<long long>(args, len);
+            args = Write1DArray<char>(args, len, (const char*)blob.data());
+            args = WriteFixed<int>(args, 0x88E4);
+            break;
+        }
+        default:
+            break;
+        }
+        if (!kSyntheticLength[kind])
+        {
+            call->toNext = args - dest;
+        }
+        dest = args;
+    }
+    stream.resize(dest - stream.data());
+}
+
+/// Walk the synthetic stream by the call headers, decoding the arguments if decode
+static void walkSynthetic(const std::vector<char>& stream, bool decode, Run& r)
+{
+    char* ptr = const_cast<char*>(stream.data());
+    char* const end = ptr + stream.size();
+    uint64_t sum = 0;
+    unsigned name = 0;
+    while (ptr < end)
+    {
+        const BCall* call = (const BCall*)ptr;
+        const CallKind kind = (CallKind)call->funcId;
+        unsigned len = kSyntheticLength[kind];
+        char* args = ptr + sizeof(BCall);
+        if (!len)
+        {
+            len = ((const BCall_vlen*)ptr)->toNext;
+            args = ptr + sizeof(BCall_vlen);
+        }
+        if (decode)
+        {
+            sum += decodeCall(kind, args, name);
+        }
+        ptr += len;
+        r.items++;
+    }
+    r.bytes = stream.size();
+    gSink = gSink + sum;
+}
+
+/// Split the stream into chunks as the tracer does, compressed with the codec
+static void compressChunks(ChunkCodec codec, const std::vector<char>& stream, std::vector<std::vector<char>>& chunks)
+{
+    chunks.clear();
+    for (size_t pos = 0; pos < stream.size(); pos += CHUNK_BUFFER_MIN_CAPACITY)
+    {
+        const size_t len = std::min<size_t>(CHUNK_BUFFER_MIN_CAPACITY, stream.size() - pos);
+        std::vector<char> chunk(chunkMaxCompressedLength(codec, len));
+        chunk.resize(chunkCompress(codec, stream.data() + pos, len, chunk.data()));
+        chunks.push_back(chunk);
+    }
+}
+
+struct CompressedChunk
+{
+    ChunkCodec codec;
+    const char* data;
+    size_t size;
+};
+
+/// Decompress every chunk into the same buffer, as the trace readers do
+static bool decompressChunks(const std::vector<CompressedChunk>& chunks, ChunkBuffer& buf, Run& r)
+{
+    for (const CompressedChunk& c : chunks)
+    {
+        size_t length = 0;
+        if (!chunkUncompressedLength(c.codec, c.data, c.size, &length))
+        {
+            return false;
+        }
+        buf.resize(length);
+        if (!chunkUncompress(c.codec, c.data, c.size, buf.data()))
+        {
+            return false;
+        }
+        r.items++;
+        r.bytes += length;
+    }
+    return true;
+}
+
+// ---------- name remapping ----------
+
+/// The traced names are looked up in the order given, after they have all been added as glGen*
+/// calls would. Maps to what the retracer would have got for them.
+template<typename Map> static void remap(const std::vector<unsigned>& names, const std::vector<unsigned>& lookups, Run& r)
+{
+    Map map;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        map.LValue(names[i]) = i + 1;
+    }
+    uint64_t sum = 0;
+    for (unsigned name : lookups)
+    {
+        sum += map.RValue(name);
+    }
+    gSink = gSink + sum;
+    r.items = names.size() + lookups.size();
+}
+
+static void benchRemap(Bench& bench, const std::string& prefix, const std::vector<unsigned>& lookups)
+{
+    if (lookups.empty())
+    {
+        return;
+    }
+    std::vector<unsigned> names(lookups);
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    Json::Value extra;
+    extra["names"] = (Json::Value::UInt64)names.size();
+    bench.run(prefix + "/hmap", [&](Run& r) { remap<retracer::hmap<unsigned>>(names, lookups, r); }, extra);
+    bench.run(prefix + "/stdmap", [&](Run& r) { remap<retracer::stdmap<unsigned, unsigned>>(names, lookups, r); }, extra);
+}
+
+static void benchSynthetic(Bench& bench, size_t size)
+{
+    std::vector<char> stream;
+    buildSyntheticStream(stream, size);
+
+    for (int c = 0; c < CHUNK_CODEC_COUNT; c++)
+    {
+        const ChunkCodec codec = (ChunkCodec)c;
+        if (!chunkCodecAvailable(codec))
+        {
+            continue;
+        }
+        std::vector<std::vector<char>> compressed;
+        compressChunks(codec, stream, compressed);
+        std::vector<CompressedChunk> chunks;
+        uint64_t compressedSize = 0;
+        for (const std::vector<char>& chunk : compressed)
+        {
+            chunks.push_back(CompressedChunk{ codec, chunk.data(), chunk.size() });
+            compressedSize += chunk.size();
+        }
+        Json::Value extra;
+        extra["compressed_bytes"] = (Json::Value::UInt64)compressedSize;
+        ChunkBuffer buf;
+        bench.run(std::string("synthetic/decompress/") + chunkCodecName(codec), [&](Run& r) { decompressChunks(chunks, buf, r); }, extra);
+    }
+
+    bench.run("synthetic/walk", [&](Run& r) { walkSynthetic(stream, false, r); });
+    bench.run("synthetic/decode", [&](Run& r) { walkSynthetic(stream, true, r); });
+
+    // names as glGen* hands them out, and the large ones some drivers use
+    std::mt19937 rng(54321);
+    std::vector<unsigned> small, large;
+    for (unsigned i = 0; i < 1000000; i++)
+    {
+        const unsigned n = rng() % 4096;
+        small.push_back(1 + n);
+        large.push_back(0x10000 + n * 0x1000);
+    }
+    benchRemap(bench, "synthetic/remap/small", small);
+    benchRemap(bench, "synthetic/remap/large", large);
+}
+
+// ---------- recorded trace ----------
+
+static bool benchTrace(Bench& bench, const char* filename)
+{
+    // opening reads the header and the signature book
+    Run open;
+    Run sigbook;
+    {
+        InFile in;
+        const auto start = std::chrono::steady_clock::now();
+        if (!in.Open(filename))
+        {
+            DBG_LOG("Error: Failed to open %s\n", filename);
+            return false;
+        }
+        open.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        open.items = 1;
+        sigbook.seconds = (double)in.getSigBookTime() / os::timeFrequency;
+        sigbook.items = in.getMaxSigId();
+    }
+    bench.report("trace/open", open);
+    bench.report("trace/sigbook", sigbook);
+
+    InFileRA ra;
+    if (ra.Open(filename))
+    {
+        std::vector<CompressedChunk> chunks;
+        uint64_t compressedSize = 0;
+        std::streamoff pos = ra.GetDataBegin();
+        std::streamoff begin = 0;
+        std::streamoff end = 0;
+        const char* data = nullptr;
+        size_t size = 0;
+        while (ra.GetRawChunk(pos, begin, end, data, size) && end > pos)
+        {
+            const uint32_t prefix = *(const uint32_t*)data;
+            chunks.push_back(CompressedChunk{ chunkPrefixCodec(prefix), data + 4, size - 4 });
+            compressedSize += size;
+            pos = end;
+        }
+        if (!chunks.empty())
+        {
+            Json::Value extra;
+            extra["compressed_bytes"] = (Json::Value::UInt64)compressedSize;
+            ChunkBuffer buf;
+            bool ok = true;
+            bench.run("trace/decompress", [&](Run& r) { ok = decompressChunks(chunks, buf, r) && ok; }, extra);
+            if (!ok)
+            {
+                DBG_LOG("Error: Failed to decompress the chunks of %s\n", filename);
+                return false;
+            }
+        }
+    }
+
+    // Walking needs a freshly opened reader each time, which is not timed
+    std::vector<CallKind> kinds;
+    std::vector<unsigned> names;
+    auto walk = [&](bool decode, Run& r)
+    {
+        InFile in;
+        if (!in.Open(filename))
+        {
+            return;
+        }
+        if (kinds.empty())
+        {
+            static const struct { const char* name; CallKind kind; } known[] = {
+                { "glEnable", KIND_ENABLE }, { "glDisable", KIND_ENABLE },
+                { "glBindBuffer", KIND_BIND }, { "glBindTexture", KIND_BIND },
+                { "glBindFramebuffer", KIND_BIND }, { "glBindRenderbuffer", KIND_BIND },
+                { "glUniform1fv", KIND_UNIFORM }, { "glUniform2fv", KIND_UNIFORM },
+                { "glUniform3fv", KIND_UNIFORM }, { "glUniform4fv", KIND_UNIFORM },
+                { "glUniform1iv", KIND_UNIFORM },
+                { "glDrawElements", KIND_DRAW },
+            };
+            kinds.assign(in.getMaxSigId() + 1, KIND_NONE);
+            for (const auto& k : known)
+            {
+                const unsigned short id = in.NameToExId(k.name);
+                if (id)
+                {
+                    kinds[id] = k.kind;
+                }
+            }
+        }
+        const bool collect = decode && names.empty();
+        const auto start = std::chrono::steady_clock::now();
+        void* fptr = nullptr;
+        BCall_vlen call;
+        char* src = nullptr;
+        uint64_t sum = 0;
+        unsigned name = 0;
+        while (in.GetNextCall(fptr, call, src))
+        {
+            r.items++;
+            const int len = in.ExIdToLen(call.funcId);
+            r.bytes += len ? len : call.toNext;
+            if (decode && kinds[call.funcId] != KIND_NONE)
+            {
+                name = 0;
+                sum += decodeCall(kinds[call.funcId], src, name);
+                if (collect && name)
+                {
+                    names.push_back(name);
+                }
+            }
+        }
+        gSink = gSink + sum;
+        r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    Run walked;
+    Run decoded;
+    // the runs time themselves, past Open()
+    for (int i = 0; i < 3; i++)
+    {
+        Run r;
+        walk(false, r);
+        if (i == 0 || r.seconds < walked.seconds) walked = r;
+        r = Run();
+        walk(true, r);
+        if (i == 0 || r.seconds < decoded.seconds) decoded = r;
+    }
+    bench.report("trace/walk", walked);
+    Json::Value extra;
+    extra["note"] = "walking and decoding the arguments of common calls";
+    bench.report("trace/decode", decoded, extra);
+
+    benchRemap(bench, "trace/remap", names);
+
+    // Formatting the calls as text, as trace_to_txt does, with a string made for each call and
+    // appended to a buffer that is reused. The calls are decoded up front and not timed.
+    std::vector<std::unique_ptr<CallTM>> calls;
+    {
+        InFile in;
+        if (in.Open(filename))
+        {
+            void* fptr = nullptr;
+            BCall_vlen call;
+            char* src = nullptr;
+            for (unsigned callNo = 0; calls.size() < 200000 && in.GetNextCall(fptr, call, src); callNo++)
+            {
+                calls.emplace_back(new CallTM(in, callNo, call));
+            }
+        }
+    }
+    if (!calls.empty())
+    {
+        bench.run("trace/format/string", [&](Run& r)
+        {
+            for (const auto& call : calls)
+            {
+                const std::string text = call->ToStr(false);
+                r.items++;
+                r.bytes += text.size();
+            }
+        });
+        std::string text;
+        bench.run("trace/format/append", [&](Run& r)
+        {
+            for (const auto& call : calls)
+            {
+                text.clear();
+                call->AppendStr(text, false);
+                r.items++;
+                r.bytes += text.size();
+            }
+        });
+    }
+    return true;
+}
+
+}
+
+static void usage(const char *argv0)
+{
+    DBG_LOG(
+        "Usage: %s [OPTION] [<path_to_trace_file>]\n"
+        "Version: " PATRACE_VERSION "\n"
+        "Benchmark chunk decompression, the call walk, argument decoding and name remapping on a\n"
+        "synthetic call stream, and on the given trace along with formatting its calls as text, and\n"
+        "print the results as JSON\n"
+        "\n"
+        "  -h          Display this message\n"
+        "  -r <n>      Run each benchmark this many times and keep the fastest, default 5\n"
+        "  -s <mb>     Size of the synthetic call stream, default 64 MB\n"
+        "  -o <file>   Write the JSON to this file instead of stdout\n"
+        "\n"
+        , argv0);
+}
+
+int main(int argc, const char* argv[])
+{
+    const char* filename = NULL;
+    const char* output = NULL;
+    unsigned repetitions = 5;
+    size_t size = 64;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (arg[0] != '-' && !filename)
+        {
+            filename = arg;
+        }
+        else if (!strcmp(arg, "-h") || !strcmp(arg, "-help"))
+        {
+            usage(argv[0]);
+            return 0;
+        }
+        else if (!strcmp(arg, "-r") && i + 1 < argc)
+        {
+            repetitions = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(arg, "-s") && i + 1 < argc)
+        {
+            size = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(arg, "-o") && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else
+        {
+            DBG_LOG("Error: Unknown option %s\n", arg);
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    common::gApiInfo.RegisterEntries(common::parse_callbacks);
+
+    Bench bench(repetitions);
+    benchSynthetic(bench, size * 1024 * 1024);
+    if (filename && !benchTrace(bench, filename))
+    {
+        return -1;
+    }
+
+    Json::Value result;
+    result["version"] = PATRACE_VERSION;
+    result["repetitions"] = repetitions;
+    result["synthetic_bytes"] = (Json::Value::UInt64)(size * 1024 * 1024);
+    if (filename)
+    {
+        result["trace"] = filename;
+    }
+    result["benchmarks"] = bench.results();
+    Json::StyledWriter writer;
+    const std::string json = writer.write(result);
+    if (output)
+    {
+        FILE* fp = fopen(output, "w");
+        if (!fp)
+        {
+            DBG_LOG("Error: Failed to open %s: %s\n", output, strerror(errno));
+            return -1;
+        }
+        fwrite(json.data(), 1, json.size(), fp);
+        fclose(fp);
+    }
+    else
+    {
+        printf("%s", json.c_str());
+    }
+    return 0;
+}
@@ -28,11 +28,7 @@ static void printHelp(const char *argv0)
 
 static void writeout(common::OutFile &outputFile, common::CallTM *call, int overrideFuncID)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-
-    char *dest = call->Serialize(buffer, overrideFuncID);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile, overrideFuncID);
 }
 
 map<int, string> AndroidImageCropAttribToNameMap;
@@ -1,4 +1,5 @@
 #include <map>
+#include <memory>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
@@ -14,6 +15,8 @@
 #include "eglstate/context.hpp"
 #include "tool/config.hpp"
 #include "base/base.hpp"
+#include "tool/call_patcher.hpp"
+#include "tool/shader_index.hpp"
 #include "tool/utils.hpp"
 
 static void printHelp()
@@ -28,6 +31,12 @@ static void printHelp()
         "  -h     print help\n"
         "  -v     print version\n"
         "  -d     dump existing shader to shader.txt in CWD\n"
+        "  -m     <callNo> is the MD5 of a shader source instead, and every\n"
+        "         glShaderSource-call with that source is replaced\n"
+        "\n"
+        "The glShaderSource-calls of the source trace are indexed in <source trace>.shaders\n"
+        "the first time it is needed, and only the calls that are replaced are decoded and\n"
+        "written again, the rest of the trace is copied as it is.\n"
         ;
 }
 
@@ -36,18 +45,10 @@ static void printVersion()
     std::cout << PATRACE_VERSION << std::endl;
 }
 
-static void writeout(common::OutFile &outputFile, common::CallTM *call)
-{
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-
-    char *dest = call->Serialize(buffer);
-    outputFile.Write(buffer, dest-buffer);
-}
-
 int main(int argc, char **argv)
 {
     bool dump = false;
+    bool byMd5 = false;
 
     int argIndex = 1;
     for (; argIndex < argc; ++argIndex)
@@ -71,6 +72,10 @@ int main(int argc, char **argv)
         {
             dump = true;
         }
+        else if (!strcmp(arg, "-m"))
+        {
+            byMd5 = true;
+        }
         else
         {
             printf("Error: Unknow option %s\n", arg);
@@ -87,78 +92,101 @@ int main(int argc, char **argv)
 
     std::string source_trace_filename = argv[argIndex++];
     std::string callNoStr = argv[argIndex++];
-    unsigned callNo = std::stoi(callNoStr);
     std::string target_trace_filename = argv[argIndex++];
 
     common::gApiInfo.RegisterEntries(common::parse_callbacks);
 
-    // Load input trace
-    common::TraceFileTM inputFile;
-    if (!inputFile.Open(source_trace_filename.c_str()))
+    std::vector<unsigned> callNos;
+    if (byMd5)
     {
-        DBG_LOG("Failed to open for reading: %s\n", source_trace_filename.c_str());
-        return 1;
+        ShaderIndex index;
+        if (!index.open(source_trace_filename))
+        {
+            return 1;
+        }
+        for (const ShaderIndex::Entry* e : index.find(callNoStr))
+        {
+            callNos.push_back(e->call);
+        }
+        if (callNos.empty())
+        {
+            DBG_LOG("Error: No glShaderSource call sets a shader with MD5 %s\n", callNoStr.c_str());
+            return 1;
+        }
     }
-
-    // Load output trace
-    common::OutFile tmpFile;
-    if (!tmpFile.Open(target_trace_filename.c_str()))
+    else
     {
-        PAT_DEBUG_LOG("Failed to open for writing: %s\n", target_trace_filename.c_str());
-        return 1;
+        callNos.push_back(std::stoi(callNoStr));
     }
 
-    // Iterate over all calls
-    common::CallTM *call = NULL;
-    while ((call = inputFile.NextCall()))
+    if (dump)
     {
-        if (call->mCallNo == callNo)
+        common::TraceFileTM inputFile;
+        if (!inputFile.Open(source_trace_filename.c_str()))
         {
-            if (call->mCallName != "glShaderSource")  {
-                DBG_LOG("Error: CallNo wasn't a call to glShaderSource\n");
-                exit(1);
-            }
-            if (dump) {
-                FILE *fp = fopen("shader.txt", "w");
-                if (!fp)
-                {
-                    std::cerr << "Failed to open output file: " << strerror(errno) << std::endl;
-                    exit(1);
-                }
-                for (unsigned i = 0; i < call->mArgs[2]->mArrayLen; i++)
-                {
-                    std::string source = call->mArgs[2]->mArray[i].GetAsString();
-                    fwrite(source.c_str(), source.size(), 1, fp);
-                }
-                fclose(fp);
-                exit(0);
-            } else {
-                std::ifstream t("shader.txt");
-                std::stringstream buffer;
-                buffer << t.rdbuf();
-
-                call->mArgs[2]->mArrayLen = 1;
-                call->mArgs[2]->mArray[0].SetAsString(buffer.str());
-                call->mArgs[3]->mArrayLen = 0;
-                DBG_LOG("Replaced shader!\n");
-            }
+            DBG_LOG("Failed to open for reading: %s\n", source_trace_filename.c_str());
+            return 1;
         }
+        std::unique_ptr<common::CallTM> call(inputFile.LoadCall(callNos[0]));
+        if (!call || call->mCallName != "glShaderSource")
+        {
+            DBG_LOG("Error: CallNo wasn't a call to glShaderSource\n");
+            return 1;
+        }
+        FILE *fp = fopen("shader.txt", "w");
+        if (!fp)
+        {
+            std::cerr << "Failed to open output file: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        for (unsigned i = 0; i < call->mArgs[2]->mArrayLen; i++)
+        {
+            std::string source = call->mArgs[2]->mArray[i].GetAsString();
+            fwrite(source.c_str(), source.size(), 1, fp);
+        }
+        fclose(fp);
+        return 0;
+    }
+
+    std::ifstream t("shader.txt");
+    std::stringstream buffer;
+    buffer << t.rdbuf();
 
-        writeout(tmpFile, call);
+    // Only the calls that are replaced are decoded, by seeking to them
+    bool wrongCall = false;
+    CallPatcher patcher;
+    const bool scanned = patcher.scanCalls(source_trace_filename, callNos, [&](std::unique_ptr<common::CallTM>& call, CallPatcher::Calls& patch)
+    {
+        if (call->mCallName != "glShaderSource")
+        {
+            wrongCall = true;
+            return false;
+        }
+        call->mArgs[2]->mArrayLen = 1;
+        call->mArgs[2]->mArray[0].SetAsString(buffer.str());
+        call->mArgs[3]->mArrayLen = 0;
+        DBG_LOG("Replaced shader at call %u!\n", call->mCallNo);
+        patch.push_back(std::move(call));
+        return true;
+    });
+    if (!scanned)
+    {
+        return 1;
+    }
+    if (wrongCall)
+    {
+        DBG_LOG("Error: CallNo wasn't a call to glShaderSource\n");
+        return 1;
     }
 
     // Write header
-    Json::Value header = inputFile.mpInFileRA->getJSONHeader();
+    Json::Value header = patcher.header();
     Json::Value info;
+    if (byMd5)
+    {
+        info["md5"] = callNoStr;
+    }
     addConversionEntry(header, "replace_shader", source_trace_filename, info);
 
-    Json::FastWriter writer;
-    const std::string json_header = writer.write(header);
-    tmpFile.mHeader.jsonLength = json_header.size();
-    tmpFile.WriteHeader(json_header.c_str(), json_header.size());
-
-    inputFile.Close();
-    tmpFile.Close();
-
-    return 0;
+    return patcher.write(target_trace_filename, header) ? 0 : 1;
 }
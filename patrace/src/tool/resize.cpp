@@ -14,6 +14,7 @@
 #include "eglstate/context.hpp"
 #include "tool/config.hpp"
 #include "base/base.hpp"
+#include "tool/call_patcher.hpp"
 #include "tool/utils.hpp"
 
 
@@ -32,36 +33,6 @@ static void printVersion()
     std::cout << PATRACE_VERSION << std::endl;
 }
 
-static common::FrameTM* _curFrame = NULL;
-static unsigned _curFrameIndex = 0;
-static unsigned _curCallIndexInFrame = 0;
-
-static void writeout(common::OutFile &outputFile, common::CallTM *call)
-{
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
-}
-
-static common::CallTM* next_call(common::TraceFileTM &_fileTM)
-{
-    if (_curCallIndexInFrame >= _curFrame->GetLoadedCallCount())
-    {
-        _curFrameIndex++;
-        if (_curFrameIndex >= _fileTM.mFrames.size())
-            return NULL;
-        if (_curFrame) _curFrame->UnloadCalls();
-        _curFrame = _fileTM.mFrames[_curFrameIndex];
-        _curFrame->LoadCalls(_fileTM.mpInFileRA);
-        _curCallIndexInFrame = 0;
-    }
-    common::CallTM *call = _curFrame->mCalls[_curCallIndexInFrame];
-    _curCallIndexInFrame++;
-    return call;
-}
-
 int main(int argc, char **argv)
 {
     int argIndex = 1;
@@ -101,24 +72,30 @@ int main(int argc, char **argv)
     const char* source_trace_filename = argv[argIndex++];
     const char* target_trace_filename = argv[argIndex++];
 
-    common::TraceFileTM inputFile;
     common::gApiInfo.RegisterEntries(common::parse_callbacks);
-    if (!inputFile.Open(source_trace_filename))
-    {
-        PAT_DEBUG_LOG("Failed to open for reading: %s\n", source_trace_filename);
-        return 1;
-    }
-    _curFrame = inputFile.mFrames[0];
-    _curFrame->LoadCalls(inputFile.mpInFileRA);
 
-    common::OutFile outputFile;
-    if (!outputFile.Open(target_trace_filename))
+    // Only the viewports change, so only they are decoded
+    CallPatcher patcher;
+    const bool scanned = patcher.scan(source_trace_filename, { "glViewport" }, [&](std::unique_ptr<common::CallTM>& call, CallPatcher::Calls& patch)
+    {
+        GLsizei w = call->mArgs[2]->GetAsInt();
+        GLsizei h = call->mArgs[3]->GetAsInt();
+
+        call->ClearArguments();
+        call->mArgs.push_back(new common::ValueTM(0));
+        call->mArgs.push_back(new common::ValueTM(0));
+        call->mArgs.push_back(new common::ValueTM(overrideResWidth));
+        call->mArgs.push_back(new common::ValueTM(overrideResHeight));
+        DBG_LOG("Viewport was resized from %d x %d to %d x %d\n", w, h, overrideResWidth, overrideResHeight);
+        patch.push_back(std::move(call));
+        return true;
+    });
+    if (!scanned)
     {
-        PAT_DEBUG_LOG("Failed to open for writing: %s\n", target_trace_filename);
         return 1;
     }
 
-    Json::Value header = inputFile.mpInFileRA->getJSONHeader();
+    Json::Value header = patcher.header();
 
     Json::Value resizeInfo;
     resizeInfo["width"] = overrideResWidth;
@@ -145,32 +122,10 @@ int main(int argc, char **argv)
     }
     header["threads"] = threadArray;
 
-    Json::FastWriter writer;
-    const std::string json_header = writer.write(header);
-    outputFile.mHeader.jsonLength = json_header.size();
-    outputFile.WriteHeader(json_header.c_str(), json_header.size());
-
-    common::CallTM *call = NULL;
-    while ((call = next_call(inputFile)))
+    if (!patcher.write(target_trace_filename, header))
     {
-        if (call->mCallName == "glViewport")
-        {
-            GLsizei w = call->mArgs[2]->GetAsInt();
-            GLsizei h = call->mArgs[3]->GetAsInt();
-
-            call->ClearArguments();
-            call->mArgs.push_back(new common::ValueTM(0));
-            call->mArgs.push_back(new common::ValueTM(0));
-            call->mArgs.push_back(new common::ValueTM(overrideResWidth));
-            call->mArgs.push_back(new common::ValueTM(overrideResHeight));
-            DBG_LOG("Viewport was resized from %d x %d to %d x %d\n", w, h, overrideResWidth, overrideResHeight);
-        }
-
-        writeout(outputFile, call);
+        return 1;
     }
 
-    inputFile.Close();
-    outputFile.Close();
-
     return 0;
 }
@@ -48,6 +48,7 @@
 #include "retracer/dma_buffer/dma_buffer.hpp"
 #include "eglstate/common.hpp"
 #include "common/image.hpp"
+#include "image/image_yuv.hpp"
 #include "tool/config.hpp"
 
 using namespace std;
@@ -76,20 +77,7 @@ static void printVersion()
 
 static void writeout(common::OutFile &outputFile, common::CallTM *call)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-
-    char *dest = call->Serialize(buffer);
-    outputFile.Write(buffer, dest-buffer);
-}
-
-int truncate(int num, int min = 0, int max = 255)
-{
-    if (num < min)
-        return min;
-    else if (num > max)
-        return max;
-    return num;
+    call->Serialize(outputFile);
 }
 
 enum Format
@@ -106,75 +94,12 @@ int NoConvert(unsigned char *rgba, unsigned char *yv12, int width, int height)
 
 int RGBAtoYV12(unsigned char *rgba, unsigned char *yv12, int width, int height)
 {
-    int y_stride = (width + 15) / 16 * 16;
-    int y_height= height;
-    int y_size = y_stride * y_height;
-    int c_stride = (y_stride / 2 + 15) / 16 * 16;
-    int c_size = c_stride * y_height / 2;
-    int yuv_size = y_size + c_size * 2;
-
-    // y =  0.299r + 0.587g + 0.114b;
-    // u = -0.169r - 0.331g + 0.500b + 128;
-    // v =  0.500r - 0.419g - 0.081b + 128;
-    for (int i = 0; i < y_stride * y_height; ++i) {
-        int y_x = i % y_stride;
-        if (y_x >= width)
-            continue;
-        int y_y = i / y_stride;
-
-        int r = rgba[(y_y * width + y_x) * 4];
-        int g = rgba[(y_y * width + y_x) * 4 + 1];
-        int b = rgba[(y_y * width + y_x) * 4 + 2];
-        int y = 0.299 * r + 0.587 * g + 0.114 * b;
-        yv12[y_y * y_stride + y_x] = truncate(y);
-        if (((y_x & 0x1) == 0) && ((y_y & 0x1) == 0)) {
-            int u = -0.169 * r - 0.331 * g + 0.500 * b + 128;
-            int v =  0.500 * r - 0.419 * g - 0.081 * b + 128;
-            int u_x = y_x / 2;
-            int u_y = y_y / 2;
-            yv12[y_size + u_y * c_stride + u_x] = truncate(v);
-            yv12[y_size + c_size + u_y * c_stride + u_x] = truncate(u);
-        }
-    }
-
-    return yuv_size;
+    return pat::RGBAToYV12(rgba, yv12, width, height);
 }
 
 int RGBAtoNV12(unsigned char *rgba, unsigned char *nv12, int width, int height)
 {
-    //int y_stride = width;
-    int y_stride = (width + 15) / 16 * 16;
-    int y_height= height;
-    int y_size = y_stride * y_height;
-    int c_stride = y_stride;
-    int c_size = c_stride * y_height / 2;
-    int yuv_size = y_size + c_size;
-
-    // y =  0.299r + 0.587g + 0.114b;
-    // u = -0.169r - 0.331g + 0.500b + 128;
-    // v =  0.500r - 0.419g - 0.081b + 128;
-    for (int i = 0; i < y_stride * y_height; ++i) {
-        int y_x = i % y_stride;
-        if (y_x >= width)
-            continue;
-        int y_y = i / y_stride;
-
-        int r = rgba[(y_y * width + y_x) * 4];
-        int g = rgba[(y_y * width + y_x) * 4 + 1];
-        int b = rgba[(y_y * width + y_x) * 4 + 2];
-        int y = 0.299 * r + 0.587 * g + 0.114 * b;
-        nv12[y_y * y_stride + y_x] = truncate(y);
-        if (((y_x & 0x1) == 0) && ((y_y & 0x1) == 0)) {
-            int u = -0.169 * r - 0.331 * g + 0.500 * b + 128;
-            int v =  0.500 * r - 0.419 * g - 0.081 * b + 128;
-            int u_x = y_x / 2;
-            int u_y = y_y / 2;
-            nv12[y_size + u_y * c_stride + u_x * 2] = truncate(u);
-            nv12[y_size + u_y * c_stride + u_x * 2 + 1] = truncate(v);
-        }
-    }
-
-    return yuv_size;
+    return pat::RGBAToNV12(rgba, nv12, width, height);
 }
 
 typedef int (*CONVERT_FUNCTION)(unsigned char *rgba, unsigned char *yuv, int width, int height);
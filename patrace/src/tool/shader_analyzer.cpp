@@ -4,6 +4,7 @@
 #include <GLES3/gl31.h>
 #include <GLES3/gl32.h>
 #include <limits.h>
+#include <chrono>
 
 #include "tool/parse_interface.h"
 #include "tool/glsl_parser.h"
@@ -12,7 +13,7 @@
 static void printHelp()
 {
     std::cout <<
-        "Usage : shader_analyzer [OPTIONS] shader.ext\n"
+        "Usage : shader_analyzer [OPTIONS] shader.ext [shader.ext ...]\n"
         "Options:\n"
         "  --compress    Remove comments, preprocess and remove unnecessary whitespace\n"
         "  --preprocess  Preprocess shader\n"
@@ -22,6 +23,8 @@ static void printHelp()
         "  --inline      Inline data from any (non-standard) #include directives\n"
         "  --selftest    Run internal self-tests\n"
         "  --test        Test parser on a shader, printing only file name and shader type\n"
+        "  --bench       Time each step of the analysis over all the shaders given, such as\n"
+        "                those that shader_repacker --split dumps out of traces\n"
         "  --upgrade     Upgrade shader to at least 310 ES version\n"
         "  --tf          Upgrade shader and convert vertex shader to use transform feedback\n"
         "  -h            Print help\n"
@@ -58,7 +61,65 @@ void printshader(const GLSLRepresentation::Variable& i, int pad = 1)
     }
 }
 
-enum Mode { NONE, COMPRESS, PREPROCESS, STRIP, ANALYZE, TEST };
+enum Mode { NONE, COMPRESS, PREPROCESS, STRIP, ANALYZE, TEST, BENCH };
+
+static bool readShader(const std::string& filename, std::string& data)
+{
+    FILE* fp = fopen(filename.c_str(), "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open \"%s\": %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    data.resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    size_t r = data.empty() ? 1 : fread(&data[0], data.size(), 1, fp);
+    fclose(fp);
+    if (r != 1)
+    {
+        fprintf(stderr, "Failed to read \"%s\"\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+/// Run the analysis that ParseInterface does on every shader over a corpus of shaders
+static int bench(char **files, int count)
+{
+    typedef std::chrono::steady_clock clock;
+    double strip = 0.0, preprocess = 0.0, compress = 0.0, parse = 0.0;
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++)
+    {
+        std::string data;
+        if (!readShader(files[i], data))
+        {
+            return -1;
+        }
+        bytes += data.size();
+        GLSLParser parser(files[i]);
+        const int shaderType = parser.shaderType(strrchr(files[i], '.'));
+        auto t0 = clock::now();
+        std::string pass1 = parser.strip_comments(data);
+        auto t1 = clock::now();
+        GLSLShader s = parser.preprocessor(pass1, shaderType);
+        auto t2 = clock::now();
+        std::string c = parser.compressed(s);
+        auto t3 = clock::now();
+        GLSLRepresentation r = parser.parse(s);
+        auto t4 = clock::now();
+        strip += std::chrono::duration<double>(t1 - t0).count();
+        preprocess += std::chrono::duration<double>(t2 - t1).count();
+        compress += std::chrono::duration<double>(t3 - t2).count();
+        parse += std::chrono::duration<double>(t4 - t3).count();
+    }
+    const double total = strip + preprocess + compress + parse;
+    printf("%d shaders, %.1f KB in %.3f s: %.1f shaders/s, %.2f MB/s\n", count, bytes / 1024.0, total,
+           total > 0.0 ? count / total : 0.0, total > 0.0 ? bytes / total / (1024.0 * 1024.0) : 0.0);
+    printf("\tstrip comments: %.3f s\n\tpreprocess: %.3f s\n\tcompress: %.3f s\n\tparse: %.3f s\n", strip, preprocess, compress, parse);
+    return 0;
+}
 
 int main(int argc, char **argv)
 {
@@ -103,6 +164,11 @@ int main(int argc, char **argv)
             if (mode != NONE) { fprintf(stderr, "Incompatible parameters"); return -1; }
             mode = TEST;
         }
+        else if (arg == "--bench")
+        {
+            if (mode != NONE) { fprintf(stderr, "Incompatible parameters"); return -1; }
+            mode = BENCH;
+        }
         else if (arg == "--compress")
         {
             if (mode != NONE) { fprintf(stderr, "Incompatible parameters"); return -1; }
@@ -148,24 +214,17 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    std::string filename = argv[argIndex++];
-    FILE* fp = fopen(filename.c_str(), "r");
-    if (!fp)
+    if (mode == BENCH)
     {
-        fprintf(stderr, "Failed to open \"%s\": %s\n", filename.c_str(), strerror(errno));
-        return -1;
+        return bench(argv + argIndex, argc - argIndex);
     }
+
+    std::string filename = argv[argIndex++];
     std::string data;
-    fseek(fp, 0, SEEK_END);
-    data.resize(ftell(fp));
-    fseek(fp, 0, SEEK_SET);
-    size_t r = fread(&data[0], data.size(), 1, fp);
-    if (r != 1)
+    if (!readShader(filename, data))
     {
-        fprintf(stderr, "Failed to read \"%s\"\n", filename.c_str());
-        return -2;
+        return -1;
     }
-    fclose(fp);
     GLSLParser parser(filename, debug);
     int shaderType = parser.shaderType(strrchr(filename.c_str(), '.'));
     if (mode == TEST)
@@ -4,8 +4,13 @@
 #include <GLES3/gl31.h>
 #include <GLES3/gl32.h>
 #include <limits.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 #include "tool/parse_interface.h"
+#include "tool/glsl_cache.h"
 
 #include "common/in_file.hpp"
 #include "common/file_format.hpp"
@@ -14,6 +19,7 @@
 #include "common/trace_model.hpp"
 #include "common/gl_utility.hpp"
 #include "common/os.hpp"
+#include "common/thread_pool.hpp"
 #include "eglstate/context.hpp"
 #include "tool/config.hpp"
 #include "base/base.hpp"
@@ -25,11 +31,13 @@ static bool debug = false;
 static void printHelp()
 {
     std::cout <<
-        "Usage : shader_grep [OPTIONS] keyword trace_file.pat\n"
+        "Usage : shader_grep [OPTIONS] keyword trace_file.pat [trace_file.pat ...]\n"
         "Options:\n"
         "  -h            Print help\n"
         "  -v            Print version\n"
-        "  -t TYPE       Restrict search to shader type [VERT|FRAG|COMP|GEOM|TESE|TESC]"
+        "  -t TYPE       Restrict search to shader type [VERT|FRAG|COMP|GEOM|TESE|TESC]\n"
+        "  -j N          Search N traces at a time, default one per core\n"
+        "  -c DIR        Keep shader analyses in DIR for later runs (default $PATRACE_SHADER_CACHE)\n"
         "  -D            Add debug information to stderr\n"
         ;
 }
@@ -39,7 +47,7 @@ static void printVersion()
     std::cout << PATRACE_VERSION << std::endl;
 }
 
-void grep_shader(ParseInterface& input, const std::string& trace_filename, const std::string& match, GLenum match_shader_type)
+void grep_shader(ParseInterface& input, const std::string& trace_filename, const std::string& match, GLenum match_shader_type, std::string& out)
 {
     common::CallTM *call = nullptr;
 
@@ -70,7 +78,9 @@ void grep_shader(ParseInterface& input, const std::string& trace_filename, const
                 {
                     if (line.find(match) != std::string::npos)
                     {
-                        fprintf(stdout, "%s : %s : %03u : %s\n", trace_filename.c_str(), stype, shader.id, line.c_str());
+                        char id[16];
+                        snprintf(id, sizeof(id), "%03u", shader.id);
+                        out += trace_filename + " : " + stype + " : " + id + " : " + line + "\n";
                     }
                 }
             }
@@ -81,6 +91,7 @@ void grep_shader(ParseInterface& input, const std::string& trace_filename, const
 int main(int argc, char **argv)
 {
     GLenum shader_type = GL_NONE;
+    unsigned jobs = common::concurrencyBudget();
     int argIndex = 1;
     for (; argIndex < argc; ++argIndex)
     {
@@ -104,6 +115,14 @@ int main(int argc, char **argv)
         {
             debug = true;
         }
+        else if (arg == "-j" && argIndex + 1 < argc)
+        {
+            jobs = std::max(1, atoi(argv[++argIndex]));
+        }
+        else if (arg == "-c" && argIndex + 1 < argc)
+        {
+            GLSLCache::instance().setDirectory(argv[++argIndex]);
+        }
         else if (arg == "-t" && argIndex + 1 < argc)
         {
             std::string arg = argv[argIndex + 1];
@@ -151,15 +170,60 @@ int main(int argc, char **argv)
         printHelp();
         return 1;
     }
-    std::string match = argv[argIndex++];
-    std::string source_trace_filename = argv[argIndex++];
-    ParseInterface inputFile;
-    if (!inputFile.open(source_trace_filename))
+    const std::string match = argv[argIndex++];
+    std::vector<std::string> traces(argv + argIndex, argv + argc);
+
+    // Each trace is searched on its own thread, while the results are printed in the order
+    // the traces were given. Shaders that several traces share are only analyzed once.
+    std::vector<std::string> results(traces.size());
+    std::vector<bool> done(traces.size(), false);
+    std::atomic<size_t> next(0);
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool failed = false;
+    auto work = [&]()
     {
-        std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
-        return 1;
+        for (size_t i = next++; i < traces.size(); i = next++)
+        {
+            ParseInterface inputFile;
+            bool ok;
+            {
+                std::lock_guard<std::mutex> lock(mutex); // opening registers the parsers
+                ok = inputFile.open(traces[i]);
+            }
+            std::string out;
+            if (ok)
+            {
+                grep_shader(inputFile, traces[i], match, shader_type, out);
+                inputFile.close();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!ok)
+            {
+                std::cerr << "Failed to open for reading: " << traces[i] << std::endl;
+                failed = true;
+            }
+            results[i].swap(out);
+            done[i] = true;
+            cond.notify_all();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < std::min<size_t>(jobs, traces.size()); i++)
+    {
+        workers.emplace_back(work);
+    }
+    for (size_t i = 0; i < traces.size(); i++)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]{ return done[i]; });
+        fwrite(results[i].data(), 1, results[i].size(), stdout);
+        std::string().swap(results[i]);
+    }
+    for (std::thread& t : workers)
+    {
+        t.join();
     }
-    grep_shader(inputFile, source_trace_filename, match, shader_type);
-    inputFile.close();
-    return 0;
+    DEBUG_LOG("%u shaders analyzed, %u loaded from the cache\n", GLSLCache::instance().analyzed(), GLSLCache::instance().loaded());
+    return failed ? 1 : 0;
 }
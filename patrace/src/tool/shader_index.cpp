@@ -0,0 +1,241 @@
+#include "tool/shader_index.hpp"
+
+#include "common/in_file.hpp"
+#include "common/memory.hpp"
+#include "common/os.hpp"
+#include "common/trace_index.hpp"
+#include "common/trace_model.hpp"
+#include "jsoncpp/include/json/reader.h"
+#include "jsoncpp/include/json/writer.h"
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <utility>
+
+static const int SHADER_INDEX_FORMAT = 1;
+
+static uint64_t fileSize(const std::string& name)
+{
+    std::ifstream in(name.c_str(), std::ios::binary | std::ios::ate);
+    if (!in.is_open()) return 0;
+    return (uint64_t)in.tellg();
+}
+
+std::string ShaderIndex::sourceMd5(const std::string& source)
+{
+    return common::MD5Digest(source).text_lower();
+}
+
+bool ShaderIndex::open(const std::string& traceName)
+{
+    if (load(traceName))
+    {
+        return true;
+    }
+    if (!build(traceName))
+    {
+        return false;
+    }
+    if (save(traceName))
+    {
+        DBG_LOG("Wrote shader index %s\n", pathFor(traceName).c_str());
+    }
+    return true;
+}
+
+bool ShaderIndex::build(const std::string& traceName)
+{
+    common::InFile input;
+    if (!input.Open(traceName.c_str()))
+    {
+        DBG_LOG("Failed to open for reading: %s\n", traceName.c_str());
+        return false;
+    }
+    mEntries.clear();
+
+    enum Kind { OTHER, CREATE_CONTEXT, MAKE_CURRENT, CREATE_SHADER, SHADER_SOURCE, ATTACH_SHADER };
+    std::vector<Kind> kinds(input.getMaxSigId() + 1, OTHER);
+    const std::pair<const char*, Kind> wanted[] = {
+        { "eglCreateContext", CREATE_CONTEXT }, { "eglMakeCurrent", MAKE_CURRENT },
+        { "glCreateShader", CREATE_SHADER }, { "glShaderSource", SHADER_SOURCE }, { "glAttachShader", ATTACH_SHADER },
+    };
+    for (const auto& w : wanted)
+    {
+        const unsigned short id = input.NameToExId(w.first);
+        if (id != 0)
+        {
+            kinds[id] = w.second;
+        }
+    }
+
+    // Shader names belong to the share group, which is known by the index of its first context
+    std::map<int64_t, int> contexts; // index by context handle
+    std::vector<int> shareRoots; // by context index
+    std::map<unsigned, int> current; // context index by thread
+    std::map<std::pair<int, unsigned>, GLenum> types; // by share group and shader
+    std::map<std::pair<int, unsigned>, std::vector<size_t>> sources; // entries, by share group and shader
+
+    void *fptr = nullptr;
+    char *src = nullptr;
+    common::BCall_vlen bcall;
+    unsigned callNo = 0;
+    for (; input.GetNextCall(fptr, bcall, src); callNo++)
+    {
+        const Kind kind = kinds[bcall.funcId];
+        if (kind == OTHER)
+        {
+            continue;
+        }
+        std::unique_ptr<common::CallTM> call(new common::CallTM(input, callNo, bcall));
+        if (kind == CREATE_CONTEXT)
+        {
+            const int index = shareRoots.size();
+            const int64_t share = call->mArgs[2]->GetAsInt();
+            contexts[call->mRet.GetAsInt()] = index;
+            shareRoots.push_back(contexts.count(share) ? shareRoots[contexts.at(share)] : index);
+            continue;
+        }
+        if (kind == MAKE_CURRENT)
+        {
+            const int64_t context = call->mArgs[3]->GetAsInt();
+            if (context == 0)
+            {
+                current[call->mTid] = -1;
+            }
+            else if (contexts.count(context))
+            {
+                current[call->mTid] = contexts.at(context);
+            }
+            continue;
+        }
+        const int context = current.count(call->mTid) ? current.at(call->mTid) : -1;
+        const int group = (context >= 0) ? shareRoots[context] : -1;
+        if (kind == CREATE_SHADER)
+        {
+            types[std::make_pair(group, call->mRet.GetAsUInt())] = call->mArgs[0]->GetAsUInt();
+        }
+        else if (kind == SHADER_SOURCE)
+        {
+            const auto key = std::make_pair(group, call->mArgs[0]->GetAsUInt());
+            std::string source;
+            for (unsigned i = 0; i < call->mArgs[2]->mArrayLen; i++)
+            {
+                source += call->mArgs[2]->mArray[i].GetAsString();
+            }
+            Entry e;
+            e.call = callNo;
+            e.context = context;
+            e.shader = key.second;
+            e.type = types.count(key) ? types.at(key) : GL_NONE;
+            e.md5 = sourceMd5(source);
+            sources[key].push_back(mEntries.size());
+            mEntries.push_back(e);
+        }
+        else if (kind == ATTACH_SHADER)
+        {
+            const auto key = std::make_pair(group, call->mArgs[1]->GetAsUInt());
+            for (size_t i : sources[key])
+            {
+                mEntries[i].programs.push_back(call->mArgs[0]->GetAsUInt());
+            }
+        }
+    }
+    input.Close();
+
+    mTraceSize = fileSize(traceName);
+    mTraceHash = common::TraceIndex::hashFile(traceName, mTraceSize);
+    DBG_LOG("Indexed %zu glShaderSource calls of %u calls\n", mEntries.size(), callNo);
+    return true;
+}
+
+bool ShaderIndex::load(const std::string& traceName)
+{
+    std::ifstream in(pathFor(traceName).c_str());
+    Json::Value v;
+    Json::Reader reader;
+    if (!in.is_open() || !reader.parse(in, v) || v.get("format", 0).asInt() != SHADER_INDEX_FORMAT)
+    {
+        return false;
+    }
+    mTraceSize = v["trace_size"].asUInt64();
+    mTraceHash = v["trace_hash"].asUInt64();
+    if (mTraceSize != fileSize(traceName) || mTraceHash != common::TraceIndex::hashFile(traceName, mTraceSize))
+    {
+        DBG_LOG("Ignoring stale shader index %s\n", pathFor(traceName).c_str());
+        return false;
+    }
+    mEntries.clear();
+    for (const auto& s : v["shaders"])
+    {
+        Entry e;
+        e.call = s["call"].asUInt();
+        e.context = s["context"].asInt();
+        e.shader = s["shader"].asUInt();
+        e.type = s["type"].asUInt();
+        e.md5 = s["md5"].asString();
+        for (const auto& p : s["programs"])
+        {
+            e.programs.push_back(p.asUInt());
+        }
+        mEntries.push_back(e);
+    }
+    return true;
+}
+
+bool ShaderIndex::save(const std::string& traceName) const
+{
+    Json::Value v;
+    v["format"] = SHADER_INDEX_FORMAT;
+    v["trace_size"] = (Json::UInt64)mTraceSize;
+    v["trace_hash"] = (Json::UInt64)mTraceHash;
+    Json::Value& shaders = v["shaders"] = Json::Value(Json::arrayValue);
+    for (const Entry& e : mEntries)
+    {
+        Json::Value s;
+        s["call"] = e.call;
+        s["context"] = e.context;
+        s["shader"] = e.shader;
+        s["type"] = e.type;
+        s["md5"] = e.md5;
+        s["programs"] = Json::Value(Json::arrayValue);
+        for (unsigned p : e.programs)
+        {
+            s["programs"].append(p);
+        }
+        shaders.append(s);
+    }
+    std::ofstream out(pathFor(traceName).c_str());
+    if (!out.is_open())
+    {
+        return false;
+    }
+    Json::StyledStreamWriter writer;
+    writer.write(out, v);
+    return out.good();
+}
+
+std::vector<const ShaderIndex::Entry*> ShaderIndex::find(const std::string& md5) const
+{
+    std::vector<const Entry*> found;
+    for (const Entry& e : mEntries)
+    {
+        if (e.md5 == md5)
+        {
+            found.push_back(&e);
+        }
+    }
+    return found;
+}
+
+const ShaderIndex::Entry* ShaderIndex::atCall(unsigned call) const
+{
+    for (const Entry& e : mEntries)
+    {
+        if (e.call == call)
+        {
+            return &e;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,52 @@
+#ifndef SHADER_INDEX_HPP
+#define SHADER_INDEX_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "dispatch/eglimports.hpp"
+
+/// Where the shaders of a trace are set, kept in a sidecar file next to the trace (see
+/// pathFor()) so that tools that replace shaders, which are run many times on the same
+/// trace, find the glShaderSource calls without scanning the trace every time.
+///
+/// It is built by walking the call headers and decoding only the calls that create contexts,
+/// make them current, create shaders, set their source and attach them to programs.
+class ShaderIndex
+{
+public:
+    struct Entry
+    {
+        unsigned call; ///< of glShaderSource
+        int context; ///< index of the current context, in the order they were created
+        unsigned shader;
+        GLenum type;
+        std::string md5; ///< of the source, its strings joined
+        std::vector<unsigned> programs; ///< the shader was attached to, anywhere in the trace
+    };
+
+    static std::string pathFor(const std::string& traceName) { return traceName + ".shaders"; }
+
+    /// Load the index of the trace, or build and save it if there is none that matches the trace
+    bool open(const std::string& traceName);
+    bool build(const std::string& traceName);
+    bool load(const std::string& traceName);
+    bool save(const std::string& traceName) const;
+
+    /// The entries of the glShaderSource calls with this source
+    std::vector<const Entry*> find(const std::string& md5) const;
+    /// The entry of this glShaderSource call, or nullptr
+    const Entry* atCall(unsigned call) const;
+
+    /// MD5 of the source set by a glShaderSource call, as stored in the entries
+    static std::string sourceMd5(const std::string& source);
+
+    std::vector<Entry> mEntries; ///< in call order
+
+private:
+    uint64_t mTraceSize = 0;
+    uint64_t mTraceHash = 0;
+};
+
+#endif
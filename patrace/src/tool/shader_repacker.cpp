@@ -1,3 +1,5 @@
+#include <map>
+#include <memory>
 #include <utility>
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
@@ -17,6 +19,8 @@
 #include "eglstate/context.hpp"
 #include "tool/config.hpp"
 #include "base/base.hpp"
+#include "tool/call_patcher.hpp"
+#include "tool/shader_index.hpp"
 #include "tool/utils.hpp"
 
 #define DEBUG_LOG(...) if (debug) DBG_LOG(__VA_ARGS__)
@@ -33,6 +37,9 @@ static void printHelp()
         "  --repack      Pack shaders back in again\n"
         "  -h            Print help\n"
         "  -v            Print version\n"
+        "\n"
+        "--repack finds the shaders through <trace_file.pat>.shaders, which is made the first\n"
+        "time it is needed, and writes again only the glShaderSource calls whose files changed.\n"
         ;
 }
 
@@ -41,66 +48,91 @@ static void printVersion()
     std::cout << PATRACE_VERSION << std::endl;
 }
 
-static void writeout(common::OutFile &outputFile, common::CallTM *call)
+static std::string shader_filename(unsigned shader_id, GLenum shader_type, int context_index, int program_index)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
+    return "shader_" + std::to_string(shader_id) + "_p" + std::to_string(program_index) + "_c" + std::to_string(context_index) + shader_extension(shader_type);
 }
 
 static std::string shader_filename(const StateTracker::Shader &shader, int context_index, int program_index)
 {
-    return "shader_" + std::to_string(shader.id) + "_p" + std::to_string(program_index) + "_c" + std::to_string(context_index) + shader_extension(shader.shader_type);
+    return shader_filename(shader.id, shader.shader_type, context_index, program_index);
 }
 
-void pack_shaders(ParseInterface& input, common::OutFile& outputFile, const std::string& keyword, GLenum match_shader_type)
+static bool read_file(const std::string& filename, std::string& data)
 {
-    common::CallTM *call = nullptr;
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (!fp)
+    {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    data.resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    const bool ok = data.empty() || fread(&data[0], data.size(), 1, fp) == 1;
+    fclose(fp);
+    return ok;
+}
 
-    // Go through entire trace file
-    while ((call = input.next_call()))
+/// Pack the shader files back into the glShaderSource calls they were split from. The calls are
+/// found in the shader index of the trace, and only those whose file differs from the source
+/// in the trace are decoded and written again, the rest of the trace is copied as it is.
+static bool repack_shaders(const std::string& source_trace_filename, const std::string& target_trace_filename, const std::string& keyword)
+{
+    ShaderIndex index;
+    if (!index.open(source_trace_filename))
     {
-        if (call->mCallName == "glShaderSource" && repack)
+        return false;
+    }
+    std::map<unsigned, std::string> changed; // new source, by call
+    for (const ShaderIndex::Entry& e : index.mEntries)
+    {
+        const std::string filename = keyword + shader_filename(e.shader, e.type, e.context, 0);
+        std::string data;
+        if (!read_file(filename, data))
         {
-            const StateTracker::Context& ctx = input.contexts.at(input.context_index);
-            const GLuint shader_id = call->mArgs[0]->GetAsUInt();
-            int shader_index = ctx.shaders.remap(shader_id);
-            const StateTracker::Shader& shader = ctx.shaders.at(shader_index);
-            std::string filename = keyword + shader_filename(shader, input.context_index, 0);
-            FILE *fp = fopen(filename.c_str(), "r");
-            if (!fp)
-            {
-                fprintf(stderr, "%s not found!\n", filename.c_str());
-            }
-            fseek(fp, 0, SEEK_END);
-            std::string data;
-            data.resize(ftell(fp));
-            fseek(fp, 0, SEEK_SET);
-            size_t r = fread(&data[0], data.size(), 1, fp);
-            if (r != 1)
-            {
-                fprintf(stderr, "Failed to read \"%s\"!\n", filename.c_str());
-            }
-            fclose(fp);
-            call->mArgs[1]->SetAsUInt(1);
-            call->mArgs[2]->mArrayLen = 1;
-            call->mArgs[2]->mArray[0].SetAsString(data);
-            call->mArgs[3]->mArray->mArrayLen = 0;
+            fprintf(stderr, "%s not found!\n", filename.c_str());
+            continue;
         }
-
-        if (repack)
+        if (ShaderIndex::sourceMd5(data) != e.md5)
         {
-            writeout(outputFile, call);
+            changed[e.call] = data;
         }
     }
-    if (!split)
+
+    std::vector<unsigned> calls;
+    for (const auto& c : changed)
+    {
+        calls.push_back(c.first);
+    }
+    CallPatcher patcher;
+    const bool scanned = patcher.scanCalls(source_trace_filename, calls, [&](std::unique_ptr<common::CallTM>& call, CallPatcher::Calls& patch)
+    {
+        call->mArgs[1]->SetAsUInt(1);
+        call->mArgs[2]->mArrayLen = 1;
+        call->mArgs[2]->mArray[0].SetAsString(changed.at(call->mCallNo));
+        call->mArgs[3]->mArrayLen = 0;
+        patch.push_back(std::move(call));
+        return true;
+    });
+    if (!scanned)
+    {
+        return false;
+    }
+
+    Json::Value header = patcher.header();
+    Json::Value info;
+    info["keyword"] = keyword;
+    addConversionEntry(header, "shader_repack", source_trace_filename, info);
+    return patcher.write(target_trace_filename, header);
+}
+
+static void split_shaders(ParseInterface& input, const std::string& keyword)
+{
+    // Go through entire trace file
+    while (input.next_call())
     {
-        return;
     }
 
-    // Check what we found
     for (const auto& context : input.contexts)
     {
         for (const auto& shader : context.shaders.all())
@@ -115,7 +147,6 @@ void pack_shaders(ParseInterface& input, common::OutFile& outputFile, const std:
 
 int main(int argc, char **argv)
 {
-    GLenum shader_type = GL_NONE;
     int argIndex = 1;
     for (; argIndex < argc; ++argIndex)
     {
@@ -158,36 +189,20 @@ int main(int argc, char **argv)
     }
     std::string keyword = argv[argIndex++];
     std::string source_trace_filename = argv[argIndex++];
+    if (repack)
+    {
+        common::gApiInfo.RegisterEntries(common::parse_callbacks);
+        std::string target_trace_filename = argv[argIndex++];
+        return repack_shaders(source_trace_filename, target_trace_filename, keyword) ? 0 : 1;
+    }
+
     ParseInterface inputFile;
     if (!inputFile.open(source_trace_filename))
     {
         std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
         return 1;
     }
-
-    common::OutFile outputFile;
-    if (repack)
-    {
-        std::string target_trace_filename = argv[argIndex++];
-        if (!outputFile.Open(target_trace_filename.c_str()))
-        {
-            std::cerr << "Failed to open for writing: " << target_trace_filename << std::endl;
-            return 1;
-        }
-        Json::Value header = inputFile.header;
-        Json::Value info;
-        info["keyword"] = keyword;
-        addConversionEntry(header, "shader_repack", source_trace_filename, info);
-        Json::FastWriter writer;
-        const std::string json_header = writer.write(header);
-        outputFile.mHeader.jsonLength = json_header.size();
-        outputFile.WriteHeader(json_header.c_str(), json_header.size());
-    }
-    pack_shaders(inputFile, outputFile, keyword, shader_type);
+    split_shaders(inputFile, keyword);
     inputFile.close();
-    if (repack)
-    {
-        outputFile.Close();
-    }
     return 0;
 }
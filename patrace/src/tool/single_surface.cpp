@@ -1,5 +1,4 @@
 #include <vector>
-#include <list>
 #include <map>
 #include <set>
 #include <utility>
@@ -17,6 +16,7 @@
 #include "eglstate/context.hpp"
 #include "tool/config.hpp"
 #include "base/base.hpp"
+#include "tool/thread_section.hpp"
 #include "tool/utils.hpp"
 
 /// Large negative index number to encourage crashing if used improperly.
@@ -39,6 +39,8 @@ static void printHelp()
         "  -v            print version\n"
         "  -d            dump lots of debug information\n"
         "  -D            dump call log\n"
+        "  -m MB         write out the held back calls before the end of the frame once they take more than\n"
+        "                this many megabytes (default 256)\n"
         ;
 }
 
@@ -63,41 +65,46 @@ struct thread_state
     thread_state() : display(-1), draw(-1), read(-1), context(-1), surface_index(-1), fb(0) {}
 };
 
-typedef std::list<common::CallTM *> call_list;
+/// What is held back for a thread until the next flush
+struct pending_thread
+{
+    ThreadSection section;
+    bool made_current = false; // whether the section has an app supplied eglMakeCurrent
+    int last_context = 0; // context of the last of them
+    std::vector<std::pair<unsigned, std::string>> dumped; // call number and text of each call, for -D
+};
 
-static common::FrameTM* _curFrame = NULL;
 static unsigned _curFrameIndex = 0;
-static unsigned _curCallIndexInFrame = 0;
 static bool debug = false;
 static bool no_reindex = false;
 
 static void writeout(common::OutFile &outputFile, common::CallTM *call)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile);
 }
 
-static common::CallTM* next_call(common::TraceFileTM &_fileTM)
+/// Decode the next call of the source, reusing the previous one. The source is read one call at
+/// a time, so only the calls held back in the thread sections take up memory.
+static bool next_call(common::InFile &inputFile, common::CallTM &call, unsigned callNo)
 {
-    if (_curCallIndexInFrame >= _curFrame->GetLoadedCallCount())
-    {
-        _curFrameIndex++;
-        if (_curFrameIndex >= _fileTM.mFrames.size())
-            return NULL;
-        if (_curFrame) _curFrame->UnloadCalls();
-        _curFrame = _fileTM.mFrames[_curFrameIndex];
-        _curFrame->LoadCalls(_fileTM.mpInFileRA);
-        _curCallIndexInFrame = 0;
-    }
-    common::CallTM *call = _curFrame->mCalls[_curCallIndexInFrame];
-    _curCallIndexInFrame++;
-    return call;
+    void *fptr = nullptr;
+    char *src = nullptr;
+    common::BCall_vlen bcall;
+    if (!inputFile.GetNextCall(fptr, bcall, src))
+    {
+        return false;
+    }
+    // blobs can point into the chunk, since each call is written or serialized before the next is read
+    call.Reload(inputFile, callNo, bcall, true);
+    return true;
 }
 
-static void list_surfaces(common::TraceFileTM &inputFile)
+static bool is_swap(const common::CallTM &call, unsigned defaultTid)
+{
+    return call.mTid == defaultTid && (call.mCallName == "eglSwapBuffers" || call.mCallName == "eglSwapBuffersWithDamageKHR");
+}
+
+static void list_surfaces(common::InFile &inputFile)
 {
     int frames = 0;
     int calls = 0;
@@ -147,11 +154,12 @@ static void list_surfaces(common::TraceFileTM &inputFile)
     std::map<int, int> context_remapping; // from id to index in the original file
     std::map<int, int> current_context; // for each thread
     std::map<int, int> surface_remapping; // from id to index
-    common::CallTM *call = NULL;
+    common::CallTM decoded;
+    common::CallTM *call = &decoded;
     const std::string uncomprtexfunc = "glTexImage";
     const std::string uncomprtexfunc2 = "glTexStorage";
     const std::string comprtexfunc = "glCompressedTexImage";
-    while ((call = next_call(inputFile)))
+    for (unsigned callNo = 0; next_call(inputFile, decoded, callNo); callNo++)
     {
         const int surface = threads[call->mTid];
         const int context_index = current_context[call->mTid];
@@ -315,6 +323,7 @@ int main(int argc, char **argv)
     int surface = -1; // default surface, means pick one by automation
     int argIndex = 1;
     bool do_list_surfaces = false;
+    size_t max_pending = 256 * 1024 * 1024;
     for (; argIndex < argc; ++argIndex)
     {
         const char *arg = argv[argIndex];
@@ -354,6 +363,11 @@ int main(int argc, char **argv)
             surface = atoi(argv[argIndex + 1]);
             argIndex++;
         }
+        else if (!strcmp(arg, "-m") && argIndex + 1 < argc)
+        {
+            max_pending = (size_t)strtoul(argv[argIndex + 1], nullptr, 10) * 1024 * 1024;
+            argIndex++;
+        }
         else
         {
             printf("Error: Unknow option %s\n", arg);
@@ -368,15 +382,13 @@ int main(int argc, char **argv)
         return 1;
     }
     const char* source_trace_filename = argv[argIndex++];
-    common::TraceFileTM inputFile;
+    common::InFile inputFile;
     common::gApiInfo.RegisterEntries(common::parse_callbacks);
     if (!inputFile.Open(source_trace_filename))
     {
         DBG_LOG("Failed to open for reading: %s\n", source_trace_filename);
         return 1;
     }
-    _curFrame = inputFile.mFrames[0];
-    _curFrame->LoadCalls(inputFile.mpInFileRA);
     if (do_list_surfaces)
     {
         list_surfaces(inputFile);
@@ -397,7 +409,7 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    Json::Value header = inputFile.mpInFileRA->getJSONHeader();
+    Json::Value header = inputFile.getJSONHeader();
     Json::Value threadArray = header["threads"];
 
     unsigned numThreads = threadArray.size();
@@ -406,7 +418,8 @@ int main(int argc, char **argv)
         DBG_LOG("Bad number of threads: %d\n", numThreads);
         return 1;
     }
-    std::vector<call_list> calls(numThreads);
+    std::vector<pending_thread> calls(numThreads);
+    size_t pending = 0; // bytes held back in calls
     std::map<unsigned, thread_state> contexts;
     std::map<unsigned, unsigned> tid_remapping; // because thread IDs may be discontinuous
     int display = -1;
@@ -438,10 +451,11 @@ int main(int argc, char **argv)
     std::vector<int> context_tracking; // from index to id
     typedef std::pair<int, int> surface_context_pair;
     std::set<surface_context_pair> used_contexts; // list of indexes used on the desired surface
-    common::CallTM *call = NULL;
+    common::CallTM decoded;
+    common::CallTM *call = &decoded;
     // Find the surface creation and initialize calls
     int newCallNo = 0;
-    while ((call = next_call(inputFile)))
+    for (unsigned callNo = 0; next_call(inputFile, decoded, callNo); callNo++)
     {
         if (call->mCallName == "eglInitialize") // need this first
         {
@@ -509,9 +523,6 @@ int main(int argc, char **argv)
         return 1;
     }
     _curFrameIndex = 0;
-    _curCallIndexInFrame = 0;
-    _curFrame = inputFile.mFrames[0];
-    _curFrame->LoadCalls(inputFile.mpInFileRA);
     surface_remapping.clear();
     surface_tracking.clear();
     context_remapping.clear();
@@ -520,16 +531,91 @@ int main(int argc, char **argv)
     std::vector<std::pair<int, int>> non_injected_ranges;
     int prev_injected = -1;
     int total_injected = 0;
-    while (!done && (call = next_call(inputFile)))
+    // We need to remember the context of the latest eglMakeCurrent not in the current frame.
+    // This is because we need to know the 'default' context state to set at the start of each
+    // frame+thread, valid until we hit another, app-supplied eglMakeCurrent.
+    std::map<unsigned, thread_state> initial_contexts = contexts;
+    // Write out the calls held back for each thread, one thread after the other
+    auto flush = [&]()
     {
-        // We need to remember the context of the latest eglMakeCurrent not in the current frame.
-        // This is because we need to know the 'default' context state to set at the start of each
-        // frame+thread, valid until we hit another, app-supplied eglMakeCurrent.
-        std::map<unsigned, thread_state> initial_contexts = contexts;
+        bool any_injected = false;
+        unsigned active_threads = 0; // count active threads this frame
+        for (auto &thread : calls)
+        {
+            if (!thread.section.empty())
+            {
+                active_threads++;
+            }
+        }
+        if (debug) DBG_LOG("-- writeout! %u / %u threads active --\n", active_threads, (unsigned)calls.size());
+        for (auto &thread : calls)
+        {
+            if (thread.section.empty())
+            {
+                continue;
+            }
+            auto &context = initial_contexts[thread.section.tid];
+            // If necessary, inject an eglMakeCurrent to set context and display for each
+            // flattened thread section, to reproduce original behaviour.
+            // However, do not put it in front of EGL calls, since they do
+            // not need it (and may break, eg eglInitialize).
+            common::CallTM makeCurrent("eglMakeCurrent");
+            makeCurrent.mArgs.push_back(new common::ValueTM(context.display));
+            makeCurrent.mArgs.push_back(new common::ValueTM(surface_id));
+            makeCurrent.mArgs.push_back(new common::ValueTM(surface_id));
+            makeCurrent.mArgs.push_back(new common::ValueTM(context.context));
+            makeCurrent.mRet = common::ValueTM((int)EGL_TRUE);
+            if (debug) DBG_LOG("  writing (%u calls)\n", (unsigned)thread.section.calls());
+            // skip injecting eglMakeCurrent for the case where only one thread is active - we
+            // don't need to inject anything then
+            const bool inject = !(active_threads <= 1 && current_output_context != 0);
+            const size_t injectAt = thread.section.injectionIndex();
+            const bool injected = thread.section.write(outputFile, inject ? &makeCurrent : nullptr);
+            if (injected)
+            {
+                any_injected = true;
+                total_injected++;
+            }
+            const std::string where = ":c" + ((context.context_index != UNBOUND) ? std::to_string(context.context_index) : std::string("-"))
+                                    + ":s" + ((context.surface_index != UNBOUND) ? std::to_string(context.surface_index) : std::string("-")) + "] ";
+            for (size_t i = 0; i < thread.dumped.size(); i++)
+            {
+                if (injected && i == injectAt)
+                {
+                    dumpstream << "INSERTED [f" << _curFrameIndex << "t0" << where << "{}->" << newCallNo << ": " << makeCurrent.ToStr(false) << std::endl;
+                    newCallNo++;
+                }
+                dumpstream << "[f" << _curFrameIndex << ":t" << thread.section.tid << where
+                           << thread.dumped[i].first << "->" << newCallNo << ": " << thread.dumped[i].second << std::endl;
+                newCallNo++;
+            }
+            thread.dumped.clear();
+            if (thread.made_current)
+            {
+                current_output_context = thread.last_context;
+                thread.made_current = false;
+            }
+        }
+        pending = 0;
+        initial_contexts = contexts;
+
+        // Keep track of non-injected franges. If we had a number of frames without injections, track those.
+        // Ignore such ranges with less than 100 frames.
+        if (any_injected && prev_injected != -1 && static_cast<int>(_curFrameIndex) - prev_injected > 100)
+        {
+            non_injected_ranges.push_back(std::make_pair(prev_injected, static_cast<int>(_curFrameIndex) - 1));
+        }
+        if (any_injected)
+        {
+            prev_injected = _curFrameIndex;
+        }
+    };
+    for (unsigned callNo = 0; !done && next_call(inputFile, decoded, callNo); callNo++)
+    {
+        const bool frame_end = is_swap(decoded, defaultTid);
         unsigned tid = call->mTid;
         unsigned idx = tid_remapping[tid];
         bool skip = false;
-        bool any_injected = false;
         if (idx >= numThreads)
         {
             DBG_LOG("Call has higher thread idx %u than max tid %u\n", idx, numThreads);
@@ -565,8 +651,8 @@ int main(int argc, char **argv)
             display = context.display;
             if (context.context != 0)
             {
-                call->mArgs[1] = new common::ValueTM(surface_id); // draw surface
-                call->mArgs[2] = new common::ValueTM(surface_id); // read surface
+                *call->mArgs[1] = common::ValueTM(surface_id); // draw surface
+                *call->mArgs[2] = common::ValueTM(surface_id); // read surface
             }
         }
         else if (call->mCallName[0] != 'e') // special case EGL calls below
@@ -627,7 +713,7 @@ int main(int argc, char **argv)
         {
             // these calls all have surface as their second argument, so swap it out with warning
             DBG_LOG("call %u : %s : might not be handled correctly!\n", call->mCallNo, call->mCallName.c_str());
-            call->mArgs[1] = new common::ValueTM(surface_id); // swapped surface
+            *call->mArgs[1] = common::ValueTM(surface_id); // swapped surface
         }
         else if (call->mCallName == "eglDestroySurface")
         {
@@ -667,7 +753,19 @@ int main(int argc, char **argv)
 
         if (!skip)
         {
-            calls[idx].push_back(call);
+            pending_thread &thread = calls[idx];
+            if (dump)
+            {
+                thread.dumped.push_back(std::make_pair(call->mCallNo, call->ToStr(false)));
+            }
+            if (call->mCallName == "eglMakeCurrent")
+            {
+                thread.made_current = true;
+                thread.last_context = call->mArgs[3]->GetAsInt();
+            }
+            const size_t before = thread.section.bytes();
+            thread.section.append(call, call->mCallName[0] != 'e');
+            pending += thread.section.bytes() - before;
         }
         else
         {
@@ -676,86 +774,18 @@ int main(int argc, char **argv)
                        << ":s" << ((context.surface_index != UNBOUND) ? std::to_string(context.surface_index) : std::string("-")) << "] "
                        << call->mCallNo << ": " << call->ToStr(false) << std::endl;
         }
-        if (done || _curCallIndexInFrame >= _curFrame->GetLoadedCallCount()) // flush out calls in orderly manner
-        {
-            unsigned active_threads = 0; // count active threads this frame
-            for (auto &thread : calls)
-            {
-                if (thread.size() > 0)
-                {
-                    active_threads++;
-                }
-            }
-            if (debug) DBG_LOG("-- writeout! %u / %u threads active --\n", active_threads, (unsigned)calls.size());
-            for (auto &thread : calls)
-            {
-                if (thread.size() == 0)
-                {
-                    continue;
-                }
-                auto &context = initial_contexts[thread.front()->mTid];
-                // If necessary, inject an eglMakeCurrent to set context and display for each
-                // flattened thread section, to reproduce original behaviour.
-                // However, do not put it in front of EGL calls, since they do
-                // not need it (and may break, eg eglInitialize).
-                common::CallTM makeCurrent("eglMakeCurrent");
-                makeCurrent.mArgs.push_back(new common::ValueTM(context.display));
-                makeCurrent.mArgs.push_back(new common::ValueTM(surface_id));
-                makeCurrent.mArgs.push_back(new common::ValueTM(surface_id));
-                makeCurrent.mArgs.push_back(new common::ValueTM(context.context));
-                makeCurrent.mRet = common::ValueTM((int)EGL_TRUE);
-                if (debug) DBG_LOG("  writing (%u calls)\n", (unsigned)thread.size());
-                bool injected = false;
-                if (active_threads <= 1 && current_output_context != 0)
-                {
-                    // set this to skip injecting eglMakeCurrent for the case where only one
-                    // thread is active - we don't need to inject anything then
-                    injected = true;
-                }
-                for (auto &out : thread)
-                {
-                    if (!injected && out->mCallName == "eglMakeCurrent") // special case
-                    {
-                        // Special case. The app supplied eglMakeCurrent takes priority.
-                        injected = true;
-                    }
-                    else if (out->mCallName[0] != 'e' && !injected)
-                    {
-                        dumpstream << "INSERTED [f" << _curFrameIndex << "t0:c" << ((context.context_index != UNBOUND) ? std::to_string(context.context_index) : std::string("-"))
-                                   << ":s" << ((context.surface_index != UNBOUND) ? std::to_string(context.surface_index) : std::string("-")) << "] "
-                                   << "{}->" << newCallNo << ": " << makeCurrent.ToStr(false) << std::endl;
-                        newCallNo++;
-                        writeout(outputFile, &makeCurrent);
-                        injected = true;
-                        any_injected = true;
-                        total_injected++;
-                    }
-                    dumpstream << "[f" << _curFrameIndex << ":t" << out->mTid << ":c" << ((context.context_index != UNBOUND) ? std::to_string(context.context_index) : std::string("-"))
-                               << ":s" << ((context.surface_index != UNBOUND) ? std::to_string(context.surface_index) : std::string("-")) << "] "
-                               << out->mCallNo << "->" << newCallNo << ": " << out->ToStr(false) << std::endl;
-                    newCallNo++;
-                    out->mTid = 0;
-                    if (out->mCallName == "eglMakeCurrent")
-                    {
-                        current_output_context = out->mArgs[3]->GetAsInt();
-                    }
-                    writeout(outputFile, out);
-                }
-                thread.clear();
-            }
-        }
-
-        // Keep track of non-injected franges. If we had a number of frames without injections, track those.
-        // Ignore such ranges with less than 100 frames.
-        if (any_injected && prev_injected != -1 && static_cast<int>(_curFrameIndex) - prev_injected > 100)
+        // flush out calls in orderly manner, at the end of each frame and whenever a frame is too
+        // large to hold back altogether
+        if (done || frame_end || pending > max_pending)
         {
-            non_injected_ranges.push_back(std::make_pair(prev_injected, static_cast<int>(_curFrameIndex) - 1));
+            flush();
         }
-        if (any_injected)
+        if (frame_end)
         {
-            prev_injected = _curFrameIndex;
+            _curFrameIndex++;
         }
     }
+    flush();
 
     prev_injected = std::max(0, prev_injected);
     if (static_cast<int>(_curFrameIndex) - prev_injected > 100)
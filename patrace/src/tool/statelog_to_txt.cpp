@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+
+#include <common/state_log.hpp>
+#include <common/os.hpp>
+#include <tool/config.hpp>
+
+static void usage(const char *argv0)
+{
+    DBG_LOG(
+        "Usage: %s [OPTION] <state_log> [output_file]\n"
+        "Version: " PATRACE_VERSION "\n"
+        "Print a state log written by the tracer (.tracelog) or by paretrace -statelog (.retracelog)\n"
+        "as text, to output_file or to stdout\n"
+        "\n"
+        "  -h          Display this message\n"
+        "\n"
+        , argv0);
+}
+
+int main(int argc, const char* argv[])
+{
+    const char* filename = NULL;
+    const char* outname = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "-h") || !strcmp(arg, "-help"))
+        {
+            usage(argv[0]);
+            return 0;
+        }
+        else if (arg[0] != '-' && !filename)
+        {
+            filename = arg;
+        }
+        else if (arg[0] != '-' && !outname)
+        {
+            outname = arg;
+        }
+        else
+        {
+            DBG_LOG("Error: Unknown option %s\n", arg);
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (!filename)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    std::ofstream outfile;
+    if (outname)
+    {
+        outfile.open(outname, std::ofstream::out | std::ofstream::trunc);
+        if (!outfile)
+        {
+            DBG_LOG("Error: Failed to open %s\n", outname);
+            return -1;
+        }
+    }
+    std::ostream& out = outname ? outfile : std::cout;
+    const bool ok = common::renderStateLog(filename, out);
+    out.flush();
+    return ok ? 0 : -1;
+}
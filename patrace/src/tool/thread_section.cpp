@@ -0,0 +1,60 @@
+#include "tool/thread_section.hpp"
+
+#include <string.h>
+
+void ThreadSection::append(common::CallTM* call, bool needsContext)
+{
+    if (!mDecided && call->mCallName == "eglMakeCurrent")
+    {
+        // The app supplied eglMakeCurrent takes priority
+        mDecided = true;
+    }
+    else if (!mDecided && needsContext)
+    {
+        mInjectAt = mEnds.size();
+        mDecided = true;
+    }
+
+    tid = call->mTid;
+    call->mTid = 0;
+    const size_t size = call->SerializedSize();
+    const size_t offset = mData.size();
+    mData.resize(offset + size);
+    char* end = nullptr;
+    if (offset % 4 == 0)
+    {
+        end = call->Serialize(mData.data() + offset);
+    }
+    else
+    {
+        // padding is relative to the start of the call, so go through an aligned buffer
+        std::vector<char> buffer(size);
+        end = call->Serialize(buffer.data());
+        memcpy(mData.data() + offset, buffer.data(), end - buffer.data());
+        end = mData.data() + offset + (end - buffer.data());
+    }
+    mData.resize(end - mData.data());
+    mEnds.push_back(mData.size());
+}
+
+bool ThreadSection::write(common::OutFile& out, common::CallTM* makeCurrent)
+{
+    bool injected = false;
+    size_t begin = 0;
+    for (size_t i = 0; i < mEnds.size(); i++)
+    {
+        if (i == mInjectAt && makeCurrent)
+        {
+            makeCurrent->Serialize(out);
+            injected = true;
+        }
+        // one Write() per call, so that no call is split between two chunks
+        out.Write(mData.data() + begin, mEnds[i] - begin);
+        begin = mEnds[i];
+    }
+    mData.clear();
+    mEnds.clear();
+    mInjectAt = NONE;
+    mDecided = false;
+    return injected;
+}
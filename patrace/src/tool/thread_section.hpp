@@ -0,0 +1,47 @@
+#ifndef THREAD_SECTION_HPP
+#define THREAD_SECTION_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#include "common/out_file.hpp"
+#include "common/trace_model.hpp"
+
+/// The calls of one thread that flatten_threads and single_surface hold back until they
+/// write out the calls of every thread one thread after the other. The calls are kept
+/// serialized with thread id 0 rather than decoded, so that the source can be read one call
+/// at a time, and what is held is no larger than the calls are in the output.
+class ThreadSection
+{
+public:
+    /// Serialize call onto the end of the section. needsContext tells whether the call
+    /// needs a current context, so that an eglMakeCurrent may have to be injected in front of
+    /// it, unless the thread makes its own eglMakeCurrent first.
+    void append(common::CallTM* call, bool needsContext);
+
+    /// Write the calls to out, with makeCurrent in front of the first one that needs it,
+    /// unless makeCurrent is null, and empty the section. Returns whether makeCurrent was
+    /// written.
+    bool write(common::OutFile& out, common::CallTM* makeCurrent);
+
+    bool empty() const { return mEnds.empty(); }
+    size_t calls() const { return mEnds.size(); }
+    size_t bytes() const { return mData.size(); }
+    /// Whether one of the calls needs an injected eglMakeCurrent
+    bool needsMakeCurrent() const { return mInjectAt != NONE; }
+    /// Index of the call that an injected eglMakeCurrent goes in front of
+    size_t injectionIndex() const { return mInjectAt; }
+
+    /// Source thread of the calls
+    unsigned tid = 0;
+
+private:
+    static const size_t NONE = (size_t)-1;
+
+    std::vector<char> mData;
+    std::vector<uint32_t> mEnds; ///< where each call ends in mData
+    size_t mInjectAt = NONE;
+    bool mDecided = false; ///< whether the injection has been placed, or made unnecessary
+};
+
+#endif
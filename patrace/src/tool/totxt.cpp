@@ -50,7 +50,10 @@ static bool callback(ParseInterfaceBase& input, common::CallTM *call, void *fpp)
     FILE *fp = (FILE*)fpp;
     if (input.frames >= start_frame && input.frames <= end_frame && (our_tid == -1 || our_tid == (int)call->mTid))
     {
-        fprintf(fp, "[t%d, f%d, c%d] %d : %s\n", call->mTid, input.frames, input.context_index, call->mCallNo, call->ToStr(false).c_str());
+        static std::string line; // reused for every call
+        line.clear();
+        call->AppendStr(line, false);
+        fprintf(fp, "[t%d, f%d, c%d] %d : %s\n", call->mTid, input.frames, input.context_index, call->mCallNo, line.c_str());
     }
     if (verbose)
     {
@@ -0,0 +1,904 @@
+// Compare two traces of the same content, such as captures of the same scene from two versions
+// of an app, by hashes of their calls instead of their text.
+//
+// Calls are normalized before they are hashed: object names are renumbered in the order they
+// appear in each frame, so that textures 3 and 7 of one trace match textures 12 and 15 of the
+// other, and pointers, which are addresses of the app, are left out. Frames are aligned across
+// the traces by the sequence of functions they call, anchored on frames that are unique in both,
+// and the calls of aligned frames that differ are aligned the same way by their hashes.
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <common/api_info.hpp>
+#include <common/parse_api.hpp>
+#include <common/thread_pool.hpp>
+#include <common/trace_model.hpp>
+#include <tool/config.hpp>
+
+#include "jsoncpp/include/json/writer.h"
+
+static void usage(const char *argv0)
+{
+    DBG_LOG(
+        "Usage: %s [OPTION] <trace_a> <trace_b>\n"
+        "Version: " PATRACE_VERSION "\n"
+        "compare two traces by the hashes of their calls, with object names renumbered and pointers left out\n"
+        "\n"
+        "  -help Display this message\n"
+        "  -f <f> <l> Define frame interval of both traces, inclusive\n"
+        "  -j <threads> Hash and compare on this many threads, 0 for one per core (default)\n"
+        "  -l <calls> List up to this many differing calls of each frame (default 0)\n"
+        "  -n <frames> Report this many of the frames that differ most (default 10)\n"
+        "  -o <file> Write the differences of every frame as JSON to this file\n"
+        "\n"
+        , argv0);
+}
+
+static int readValidValue(const char* v)
+{
+    char* endptr;
+    errno = 0;
+    int val = strtol(v, &endptr, 10);
+    if(errno) {
+        perror("strtol");
+        exit(1);
+    }
+    if(endptr == v || *endptr != '\0') {
+        fprintf(stderr, "Invalid parameter value: %s\n", v);
+        exit(1);
+    }
+
+    return val;
+}
+
+static bool fileExists(const char* filename)
+{
+    std::ifstream file(filename);
+    return file.good();
+}
+
+typedef unsigned long long Hash;
+
+static const Hash FNV_BASIS = 0xcbf29ce484222325ull;
+
+static inline Hash hashBytes(Hash hash, const void* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ p[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+template<typename T>
+static inline Hash hashValue(Hash hash, T value)
+{
+    return hashBytes(hash, &value, sizeof(value));
+}
+
+static inline Hash hashString(Hash hash, const std::string& s)
+{
+    return hashBytes(hashValue(hash, (unsigned)s.size()), s.data(), s.size());
+}
+
+// Kinds of objects whose names are renumbered, each counting on its own
+enum HandleKind
+{
+    HANDLE_NONE = -1,
+    HANDLE_PROGRAM,
+    HANDLE_SHADER,
+    HANDLE_TEXTURE,
+    HANDLE_BUFFER,
+    HANDLE_FRAMEBUFFER,
+    HANDLE_RENDERBUFFER,
+    HANDLE_SAMPLER,
+    HANDLE_QUERY,
+    HANDLE_VERTEX_ARRAY,
+    HANDLE_PIPELINE,
+    HANDLE_SYNC,
+    HANDLE_LOCATION,
+    HANDLE_CLIENT_SIDE_BUFFER,
+    HANDLE_DISPLAY,
+    HANDLE_CONTEXT,
+    HANDLE_SURFACE,
+    HANDLE_CONFIG,
+    HANDLE_IMAGE,
+    HANDLE_WINDOW,
+};
+
+// Object names are told by the names of the arguments they are passed in
+static HandleKind argumentHandleKind(const std::string& name)
+{
+    static const std::unordered_map<std::string, HandleKind> kinds = {
+        { "program", HANDLE_PROGRAM }, { "programs", HANDLE_PROGRAM },
+        { "shader", HANDLE_SHADER }, { "shaders", HANDLE_SHADER },
+        { "texture", HANDLE_TEXTURE }, { "textures", HANDLE_TEXTURE },
+        { "buffer", HANDLE_BUFFER }, { "buffers", HANDLE_BUFFER },
+        { "framebuffer", HANDLE_FRAMEBUFFER }, { "framebuffers", HANDLE_FRAMEBUFFER },
+        { "renderbuffer", HANDLE_RENDERBUFFER }, { "renderbuffers", HANDLE_RENDERBUFFER },
+        { "sampler", HANDLE_SAMPLER }, { "samplers", HANDLE_SAMPLER },
+        { "query", HANDLE_QUERY }, { "queries", HANDLE_QUERY }, { "id", HANDLE_QUERY }, { "ids", HANDLE_QUERY },
+        { "array", HANDLE_VERTEX_ARRAY }, { "arrays", HANDLE_VERTEX_ARRAY },
+        { "pipeline", HANDLE_PIPELINE }, { "pipelines", HANDLE_PIPELINE },
+        { "sync", HANDLE_SYNC },
+        { "location", HANDLE_LOCATION },
+        { "dpy", HANDLE_DISPLAY },
+        { "ctx", HANDLE_CONTEXT }, { "share_context", HANDLE_CONTEXT },
+        { "surface", HANDLE_SURFACE }, { "draw", HANDLE_SURFACE }, { "read", HANDLE_SURFACE },
+        { "config", HANDLE_CONFIG },
+        { "image", HANDLE_IMAGE },
+        { "win", HANDLE_WINDOW }, { "window", HANDLE_WINDOW },
+    };
+    auto it = kinds.find(name);
+    return it == kinds.end() ? HANDLE_NONE : it->second;
+}
+
+// The calls that return a new object name
+static HandleKind returnHandleKind(const std::string& call)
+{
+    if (call.compare(0, 8, "glCreate") != 0 && call.compare(0, 9, "eglCreate") != 0 && call != "glFenceSync"
+        && call != "eglGetDisplay" && call != "glGetUniformLocation")
+    {
+        return HANDLE_NONE;
+    }
+    static const std::pair<const char*, HandleKind> kinds[] = {
+        { "Program", HANDLE_PROGRAM }, { "Shader", HANDLE_SHADER }, { "Sync", HANDLE_SYNC },
+        { "Context", HANDLE_CONTEXT }, { "Surface", HANDLE_SURFACE }, { "Image", HANDLE_IMAGE },
+        { "Display", HANDLE_DISPLAY }, { "Location", HANDLE_LOCATION },
+    };
+    for (const auto& kind : kinds)
+    {
+        if (call.find(kind.first) != std::string::npos)
+        {
+            return kind.second;
+        }
+    }
+    return HANDLE_NONE;
+}
+
+static bool isIntegral(const common::ValueTM& v)
+{
+    switch (v.mType)
+    {
+    case common::Int8_Type: case common::Uint8_Type: case common::Int16_Type: case common::Uint16_Type:
+    case common::Int_Type: case common::Uint_Type: case common::Int64_Type: case common::Uint64_Type:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Hashes calls with the object names of a frame renumbered in the order they appear
+class CallHasher
+{
+public:
+    void reset()
+    {
+        mHandles.clear();
+    }
+
+    // The hash of all of call, and that of its function alone. Adds the bytes of the data that
+    // the call passes to the driver to payload.
+    Hash hash(common::CallTM& call, Hash& function, unsigned long long& payload)
+    {
+        function = hashString(FNV_BASIS, call.mCallName);
+        Hash h = function;
+        for (common::ValueTM* arg : call.mArgs)
+        {
+            h = hashArg(h, *arg, argumentHandleKind(arg->mName), payload);
+        }
+        if (call.mRet.mType != common::Void_Type)
+        {
+            h = hashArg(h, call.mRet, returnHandleKind(call.mCallName), payload);
+        }
+        return h;
+    }
+
+private:
+    Hash hashHandle(Hash h, HandleKind kind, unsigned long long name)
+    {
+        if (name == 0)
+        {
+            return hashValue(h, 0u); // the default object, or none
+        }
+        auto it = mHandles.insert(std::make_pair(std::make_pair((int)kind, name), (unsigned)mHandles.size() + 1)).first;
+        return hashValue(h, it->second);
+    }
+
+    Hash hashArg(Hash h, common::ValueTM& v, HandleKind kind, unsigned long long& payload)
+    {
+        h = hashValue(h, (int)v.mType);
+        switch (v.mType)
+        {
+        case common::Void_Type:
+            return h;
+        case common::Float_Type:
+            return hashValue(h, v.mFloat);
+        case common::Enum_Type:
+            return hashValue(h, v.mEnum);
+        case common::String_Type:
+            payload += v.mStr.size();
+            return hashString(h, v.mStr);
+        case common::Blob_Type:
+            payload += v.mBlobLen;
+            return hashBytes(hashValue(h, v.mBlobLen), v.mBlob, v.mBlobLen);
+        case common::Array_Type:
+            h = hashValue(h, v.mArrayLen);
+            for (unsigned i = 0; i < v.mArrayLen; i++)
+            {
+                h = hashArg(h, v.mArray[i], kind, payload);
+            }
+            return h;
+        case common::Opaque_Type:
+            h = hashValue(h, (int)v.mOpaqueType);
+            switch (v.mOpaqueType)
+            {
+            case common::BufferObjectReferenceType:
+                return hashValue(h, v.mOpaqueIns->GetAsUInt64()); // an offset into the bound buffer
+            case common::BlobType:
+                payload += v.mOpaqueIns->mBlobLen;
+                return hashBytes(hashValue(h, v.mOpaqueIns->mBlobLen), v.mOpaqueIns->mBlob, v.mOpaqueIns->mBlobLen);
+            case common::ClientSideBufferObjectReferenceType:
+                h = hashHandle(h, HANDLE_CLIENT_SIDE_BUFFER, v.mOpaqueIns->mClientSideBufferName);
+                return hashValue(h, v.mOpaqueIns->mClientSideBufferOffset);
+            case common::NoopType:
+                return h;
+            }
+            return h;
+        case common::Pointer_Type:
+        case common::Unused_Pointer_Type:
+        case common::MemRef_Type:
+            // addresses of the app, and what the driver wrote to them, differ from run to run
+            return h;
+        default:
+            break;
+        }
+        if (isIntegral(v))
+        {
+            if (kind != HANDLE_NONE)
+            {
+                return hashHandle(h, kind, v.GetAsUInt64());
+            }
+            return hashValue(h, v.GetAsUInt64());
+        }
+        return h;
+    }
+
+    std::map<std::pair<int, unsigned long long>, unsigned> mHandles;
+};
+
+// What a frame of a trace is made of
+struct FrameDigest
+{
+    Hash content = FNV_BASIS; ///< of all its calls, normalized
+    Hash functions = FNV_BASIS; ///< of the functions it calls, in order
+    unsigned calls = 0;
+    unsigned long long payload = 0;
+};
+
+// A call of a frame that is being compared
+struct CallDigest
+{
+    Hash content;
+    Hash function;
+    unsigned long long payload;
+    unsigned callNo;
+    std::streamoff readPos;
+    std::string name;
+};
+
+// Index pairs of the elements of a and b that match, in increasing order. Common ends are
+// matched first. What is left is matched by their longest common subsequence if that is small
+// enough to work out, and otherwise by the elements that occur once in each, as in patience
+// diff, with the longest increasing run of those as anchors to recurse between.
+static const size_t LCS_LIMIT = 4 * 1024 * 1024; // cells of the LCS table
+
+static void align(const std::vector<Hash>& a, size_t aBegin, size_t aEnd,
+                  const std::vector<Hash>& b, size_t bBegin, size_t bEnd,
+                  std::vector<std::pair<size_t, size_t>>& matches)
+{
+    while (aBegin < aEnd && bBegin < bEnd && a[aBegin] == b[bBegin])
+    {
+        matches.push_back(std::make_pair(aBegin++, bBegin++));
+    }
+    std::vector<std::pair<size_t, size_t>> tail;
+    while (aBegin < aEnd && bBegin < bEnd && a[aEnd - 1] == b[bEnd - 1])
+    {
+        tail.push_back(std::make_pair(--aEnd, --bEnd));
+    }
+
+    if (aBegin < aEnd && bBegin < bEnd && (aEnd - aBegin) * (bEnd - bBegin) <= LCS_LIMIT)
+    {
+        const size_t n = aEnd - aBegin, m = bEnd - bBegin;
+        std::vector<unsigned> length((n + 1) * (m + 1), 0); // of the LCS of the suffixes
+        for (size_t i = n; i-- > 0; )
+        {
+            for (size_t j = m; j-- > 0; )
+            {
+                length[i * (m + 1) + j] = (a[aBegin + i] == b[bBegin + j]) ? length[(i + 1) * (m + 1) + j + 1] + 1
+                                        : std::max(length[(i + 1) * (m + 1) + j], length[i * (m + 1) + j + 1]);
+            }
+        }
+        for (size_t i = 0, j = 0; i < n && j < m; )
+        {
+            if (a[aBegin + i] == b[bBegin + j])
+            {
+                matches.push_back(std::make_pair(aBegin + i++, bBegin + j++));
+            }
+            else if (length[(i + 1) * (m + 1) + j] >= length[i * (m + 1) + j + 1]) i++;
+            else j++;
+        }
+    }
+    else if (aBegin < aEnd && bBegin < bEnd)
+    {
+        // where an element occurs, or SIZE_MAX if more than once
+        std::unordered_map<Hash, std::pair<size_t, size_t>> unique;
+        for (size_t i = aBegin; i < aEnd; i++)
+        {
+            auto it = unique.insert(std::make_pair(a[i], std::make_pair(i, SIZE_MAX))).first;
+            if (it->second.first != i) it->second.first = SIZE_MAX;
+        }
+        std::vector<std::pair<size_t, size_t>> candidates;
+        for (size_t j = bBegin; j < bEnd; j++)
+        {
+            auto it = unique.find(b[j]);
+            if (it == unique.end() || it->second.first == SIZE_MAX) continue;
+            it->second.second = (it->second.second == SIZE_MAX) ? j : SIZE_MAX - 1;
+        }
+        for (size_t i = aBegin; i < aEnd; i++)
+        {
+            auto it = unique.find(a[i]);
+            if (it->second.first == i && it->second.second < SIZE_MAX - 1)
+            {
+                candidates.push_back(std::make_pair(i, it->second.second));
+            }
+        }
+
+        // longest run of candidates increasing in b, by patience sorting
+        std::vector<size_t> piles; // candidate at the top of each pile
+        std::vector<size_t> previous(candidates.size(), SIZE_MAX);
+        for (size_t c = 0; c < candidates.size(); c++)
+        {
+            auto pile = std::lower_bound(piles.begin(), piles.end(), candidates[c].second,
+                                         [&](size_t top, size_t j) { return candidates[top].second < j; });
+            if (pile != piles.begin()) previous[c] = *(pile - 1);
+            if (pile == piles.end()) piles.push_back(c);
+            else *pile = c;
+        }
+        std::vector<std::pair<size_t, size_t>> anchors;
+        for (size_t c = piles.empty() ? SIZE_MAX : piles.back(); c != SIZE_MAX; c = previous[c])
+        {
+            anchors.push_back(candidates[c]);
+        }
+        std::reverse(anchors.begin(), anchors.end());
+
+        // without any, what is left is too different to be worth matching
+        for (const auto& anchor : anchors)
+        {
+            align(a, aBegin, anchor.first, b, bBegin, anchor.second, matches);
+            matches.push_back(anchor);
+            aBegin = anchor.first + 1;
+            bBegin = anchor.second + 1;
+        }
+        if (!anchors.empty())
+        {
+            align(a, aBegin, aEnd, b, bBegin, bEnd, matches);
+        }
+    }
+    matches.insert(matches.end(), tail.rbegin(), tail.rend());
+}
+
+static void align(const std::vector<Hash>& a, const std::vector<Hash>& b, std::vector<std::pair<size_t, size_t>>& matches)
+{
+    align(a, 0, a.size(), b, 0, b.size(), matches);
+}
+
+// Runs task(i, worker) for i from 0 to count on threads, each with a worker of its own
+template<typename Worker>
+static bool parallelFor(size_t count, unsigned threads, const std::function<bool(size_t, Worker&)>& task,
+                        const std::function<bool(Worker&)>& init)
+{
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]() {
+            Worker worker;
+            if (!init(worker))
+            {
+                failed = true;
+                return;
+            }
+            for (size_t i = next++; i < count && !failed; i = next++)
+            {
+                if (!task(i, worker)) failed = true;
+            }
+        });
+    }
+    for (std::thread& t : workers)
+    {
+        t.join();
+    }
+    return !failed;
+}
+
+static const size_t BATCH_BYTES = 8 * 1024 * 1024; // of trace data that a worker hashes at a time
+
+struct Trace
+{
+    const char* filename;
+    common::TraceFileTM file;
+    unsigned first; ///< frames compared, inclusive
+    unsigned last;
+    std::vector<FrameDigest> frames; ///< from first on
+};
+
+struct HashWorker
+{
+    common::InFileRA in;
+    common::CallTM call;
+    CallHasher hasher;
+};
+
+static bool hashFrames(Trace& trace, unsigned threads)
+{
+    // frames are hashed in batches of about the same amount of trace data
+    std::vector<std::pair<unsigned, unsigned>> batches;
+    for (unsigned fr = trace.first; fr <= trace.last; )
+    {
+        const unsigned begin = fr;
+        size_t bytes = 0;
+        do
+        {
+            bytes += trace.file.mFrames[fr++]->mBytes;
+        } while (fr <= trace.last && bytes < BATCH_BYTES);
+        batches.push_back(std::make_pair(begin, fr));
+    }
+    trace.frames.resize(trace.last + 1 - trace.first);
+
+    return parallelFor<HashWorker>(batches.size(), threads, [&](size_t i, HashWorker& w) {
+        for (unsigned fr = batches[i].first; fr < batches[i].second; fr++)
+        {
+            const common::FrameTM& frame = *trace.file.mFrames[fr];
+            FrameDigest& digest = trace.frames[fr - trace.first];
+            w.in.SetReadPos(frame.mReadPos);
+            w.hasher.reset();
+            for (unsigned ca = 0; ca < frame.GetCallCount(); ca++)
+            {
+                if (!w.call.Load(&w.in))
+                {
+                    return false;
+                }
+                Hash function;
+                digest.content = hashValue(digest.content, w.hasher.hash(w.call, function, digest.payload));
+                digest.functions = hashValue(digest.functions, function);
+            }
+            digest.calls = frame.GetCallCount();
+        }
+        return true;
+    }, [&](HashWorker& w) {
+        if (!w.in.Open(trace.filename))
+        {
+            DBG_LOG("Error: Worker could not open %s\n", trace.filename);
+            return false;
+        }
+        return true;
+    });
+}
+
+// The differences of a pair of aligned frames
+struct FrameDiff
+{
+    unsigned frameA;
+    unsigned frameB;
+    unsigned inserted = 0; ///< calls only in b
+    unsigned removed = 0; ///< calls only in a
+    unsigned changed = 0; ///< calls of the same function with other arguments
+    long long payloadDelta = 0;
+    std::map<std::string, std::vector<long long>> functions; ///< inserted, removed, changed, payload delta
+    std::vector<std::string> listed; ///< the first differing calls, as text
+
+    unsigned total() const { return inserted + removed + changed; }
+};
+
+struct DiffWorker
+{
+    common::InFileRA in[2];
+    common::CallTM call;
+    CallHasher hasher;
+    std::vector<CallDigest> calls[2];
+};
+
+static bool loadCalls(common::InFileRA& in, common::CallTM& call, CallHasher& hasher, const common::FrameTM& frame, std::vector<CallDigest>& calls)
+{
+    calls.resize(frame.GetCallCount());
+    in.SetReadPos(frame.mReadPos);
+    hasher.reset();
+    for (unsigned ca = 0; ca < frame.GetCallCount(); ca++)
+    {
+        if (!call.Load(&in))
+        {
+            return false;
+        }
+        CallDigest& digest = calls[ca];
+        digest.payload = 0;
+        digest.content = hasher.hash(call, digest.function, digest.payload);
+        digest.callNo = frame.mFirstCallOfThisFrame + ca;
+        digest.readPos = call.mReadPos;
+        digest.name = call.mCallName;
+    }
+    return true;
+}
+
+static std::string callText(common::InFileRA& in, common::CallTM& call, const CallDigest& digest)
+{
+    in.SetReadPos(digest.readPos);
+    if (!call.Load(&in))
+    {
+        return digest.name;
+    }
+    return std::to_string(digest.callNo) + " : " + call.ToStr();
+}
+
+static bool diffFrames(Trace* traces, std::vector<FrameDiff>& diffs, unsigned threads, unsigned listLimit)
+{
+    return parallelFor<DiffWorker>(diffs.size(), threads, [&](size_t i, DiffWorker& w) {
+        FrameDiff& diff = diffs[i];
+        const unsigned frames[2] = { diff.frameA, diff.frameB };
+        std::vector<Hash> content[2], function[2];
+        for (int t = 0; t < 2; t++)
+        {
+            if (!loadCalls(w.in[t], w.call, w.hasher, *traces[t].file.mFrames[frames[t]], w.calls[t]))
+            {
+                return false;
+            }
+            for (const CallDigest& c : w.calls[t])
+            {
+                content[t].push_back(c.content);
+                function[t].push_back(c.function);
+            }
+        }
+        const std::vector<CallDigest>& a = w.calls[0];
+        const std::vector<CallDigest>& b = w.calls[1];
+
+        auto note = [&](int kind, const CallDigest* ca, const CallDigest* cb) {
+            const std::string& name = ca ? ca->name : cb->name;
+            std::vector<long long>& counts = diff.functions[name];
+            counts.resize(4, 0);
+            counts[kind]++;
+            const long long delta = (cb ? (long long)cb->payload : 0) - (ca ? (long long)ca->payload : 0);
+            counts[3] += delta;
+            diff.payloadDelta += delta;
+            if (diff.listed.size() < listLimit)
+            {
+                static const char* marks[] = { "+ ", "- ", "~ " };
+                std::string text = marks[kind];
+                if (ca) text += "a " + callText(w.in[0], w.call, *ca);
+                if (ca && cb) text += "\n  ";
+                if (cb) text += "b " + callText(w.in[1], w.call, *cb);
+                diff.listed.push_back(text);
+            }
+        };
+
+        // calls that are the same, and between them the calls of the same functions
+        std::vector<std::pair<size_t, size_t>> same;
+        align(content[0], content[1], same);
+        same.push_back(std::make_pair(a.size(), b.size()));
+        size_t ia = 0, ib = 0;
+        for (const auto& m : same)
+        {
+            std::vector<std::pair<size_t, size_t>> changed;
+            align(function[0], ia, m.first, function[1], ib, m.second, changed);
+            changed.push_back(m);
+            for (const auto& c : changed)
+            {
+                for (; ia < c.first; ia++) { diff.removed++; note(1, &a[ia], nullptr); }
+                for (; ib < c.second; ib++) { diff.inserted++; note(0, nullptr, &b[ib]); }
+                if (&c != &changed.back())
+                {
+                    diff.changed++;
+                    note(2, &a[ia++], &b[ib++]);
+                }
+            }
+            ia = m.first + 1;
+            ib = m.second + 1;
+        }
+        std::vector<CallDigest>().swap(w.calls[0]);
+        std::vector<CallDigest>().swap(w.calls[1]);
+        return true;
+    }, [&](DiffWorker& w) {
+        for (int t = 0; t < 2; t++)
+        {
+            if (!w.in[t].Open(traces[t].filename))
+            {
+                DBG_LOG("Error: Worker could not open %s\n", traces[t].filename);
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+int main(int argc, const char* argv[])
+{
+    const char* filenames[2] = { NULL, NULL };
+    const char* out = NULL;
+    int startFrame = -1;
+    int lastFrame = -1;
+    int threads = 0;
+    unsigned listLimit = 0;
+    unsigned reportFrames = 10;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (arg[0] != '-' && !filenames[0])
+        {
+            filenames[0] = arg;
+        }
+        else if (arg[0] != '-' && !filenames[1])
+        {
+            filenames[1] = arg;
+        }
+        else if (!strcmp(arg, "-help") || !strcmp(arg, "-h"))
+        {
+            usage(argv[0]);
+            return 0;
+        }
+        else if (!strcmp(arg, "-f") && i + 2 < argc)
+        {
+            startFrame = readValidValue(argv[++i]);
+            lastFrame = readValidValue(argv[++i]);
+            if (startFrame < 0 || lastFrame < startFrame)
+            {
+                DBG_LOG("Error: LastFrameNum is less than StartFrameNum.\n");
+                return -1;
+            }
+        }
+        else if (!strcmp(arg, "-j") && i + 1 < argc)
+        {
+            threads = readValidValue(argv[++i]);
+            if (threads < 0)
+            {
+                DBG_LOG("Error: the number of threads must not be negative.\n");
+                return -1;
+            }
+        }
+        else if (!strcmp(arg, "-l") && i + 1 < argc)
+        {
+            listLimit = std::max(0, readValidValue(argv[++i]));
+        }
+        else if (!strcmp(arg, "-n") && i + 1 < argc)
+        {
+            reportFrames = std::max(0, readValidValue(argv[++i]));
+        }
+        else if (!strcmp(arg, "-o") && i + 1 < argc)
+        {
+            out = argv[++i];
+        }
+        else
+        {
+            DBG_LOG("Error: Unknown option %s\n", arg);
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (!filenames[1])
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    if (threads == 0)
+    {
+        threads = common::concurrencyBudget();
+    }
+
+    common::gApiInfo.RegisterEntries(common::parse_callbacks);
+    Trace traces[2];
+    for (int t = 0; t < 2; t++)
+    {
+        Trace& trace = traces[t];
+        trace.filename = filenames[t];
+        if (!fileExists(trace.filename) || !trace.file.Open(trace.filename, false))
+        {
+            DBG_LOG("Error: Could not open %s\n", trace.filename);
+            return -1;
+        }
+        trace.file.WaitForIndex();
+        if (trace.file.mFrames.empty())
+        {
+            DBG_LOG("Error: %s has no frames\n", trace.filename);
+            return -1;
+        }
+        trace.first = std::max(startFrame, 0);
+        trace.last = std::min<unsigned>(lastFrame >= 0 ? lastFrame : UINT_MAX, trace.file.mFrames.size() - 1);
+        if (trace.first > trace.last)
+        {
+            DBG_LOG("Error: %s has no frames in the interval\n", trace.filename);
+            return -1;
+        }
+        if (!hashFrames(trace, threads))
+        {
+            DBG_LOG("Error: Failed to read %s\n", trace.filename);
+            return -1;
+        }
+    }
+
+    // Align frames by the functions they call, so that frames that only differ in their arguments
+    // still match. The frames between aligned ones are paired in order, as long as both traces
+    // have some, since a frame that calls one function more is more likely changed than new.
+    std::vector<Hash> functions[2];
+    for (int t = 0; t < 2; t++)
+    {
+        for (const FrameDigest& f : traces[t].frames)
+        {
+            functions[t].push_back(f.functions);
+        }
+    }
+    std::vector<std::pair<size_t, size_t>> matched;
+    align(functions[0], functions[1], matched);
+    matched.push_back(std::make_pair(traces[0].frames.size(), traces[1].frames.size()));
+
+    std::vector<std::pair<size_t, size_t>> pairs;
+    std::vector<unsigned> removedFrames, insertedFrames;
+    size_t fa = 0, fb = 0;
+    for (const auto& m : matched)
+    {
+        for (; fa < m.first && fb < m.second; fa++, fb++) pairs.push_back(std::make_pair(fa, fb));
+        for (; fa < m.first; fa++) removedFrames.push_back(traces[0].first + fa);
+        for (; fb < m.second; fb++) insertedFrames.push_back(traces[1].first + fb);
+        if (m.first < traces[0].frames.size()) pairs.push_back(m);
+        fa = m.first + 1;
+        fb = m.second + 1;
+    }
+
+    unsigned identical = 0;
+    std::vector<FrameDiff> diffs;
+    for (const auto& p : pairs)
+    {
+        if (traces[0].frames[p.first].content == traces[1].frames[p.second].content)
+        {
+            identical++;
+            continue;
+        }
+        FrameDiff diff;
+        diff.frameA = traces[0].first + p.first;
+        diff.frameB = traces[1].first + p.second;
+        diffs.push_back(diff);
+    }
+    if (!diffFrames(traces, diffs, threads, listLimit))
+    {
+        DBG_LOG("Error: Failed to compare the frames\n");
+        return -1;
+    }
+
+    // Totals
+    unsigned long long calls[2] = { 0, 0 }, payload[2] = { 0, 0 };
+    for (int t = 0; t < 2; t++)
+    {
+        for (const FrameDigest& f : traces[t].frames)
+        {
+            calls[t] += f.calls;
+            payload[t] += f.payload;
+        }
+    }
+    unsigned long long inserted = 0, removed = 0, changed = 0;
+    std::map<std::string, std::vector<long long>> functionTotals;
+    for (const FrameDiff& diff : diffs)
+    {
+        inserted += diff.inserted;
+        removed += diff.removed;
+        changed += diff.changed;
+        for (const auto& f : diff.functions)
+        {
+            std::vector<long long>& total = functionTotals[f.first];
+            total.resize(4, 0);
+            for (int k = 0; k < 4; k++) total[k] += f.second[k];
+        }
+    }
+
+    printf("a: %s, frames %u to %u, %llu calls, %llu bytes of data\n", traces[0].filename, traces[0].first, traces[0].last, calls[0], payload[0]);
+    printf("b: %s, frames %u to %u, %llu calls, %llu bytes of data\n", traces[1].filename, traces[1].first, traces[1].last, calls[1], payload[1]);
+    printf("Frames: %u identical, %u changed, %u only in a, %u only in b\n",
+           identical, (unsigned)diffs.size(), (unsigned)removedFrames.size(), (unsigned)insertedFrames.size());
+    printf("Calls of aligned frames: %llu inserted, %llu removed, %llu changed, data %+lld bytes\n",
+           inserted, removed, changed, (long long)payload[1] - (long long)payload[0]);
+
+    if (!functionTotals.empty())
+    {
+        std::vector<std::pair<std::string, std::vector<long long>>> byFunction(functionTotals.begin(), functionTotals.end());
+        std::stable_sort(byFunction.begin(), byFunction.end(), [](const std::pair<std::string, std::vector<long long>>& l,
+                                                                  const std::pair<std::string, std::vector<long long>>& r) {
+            return l.second[0] + l.second[1] + l.second[2] > r.second[0] + r.second[1] + r.second[2];
+        });
+        printf("\n%-40s %10s %10s %10s %14s\n", "Function", "Inserted", "Removed", "Changed", "Data delta");
+        for (const auto& f : byFunction)
+        {
+            printf("%-40s %10lld %10lld %10lld %+14lld\n", f.first.c_str(), f.second[0], f.second[1], f.second[2], f.second[3]);
+        }
+    }
+
+    std::vector<const FrameDiff*> worst;
+    for (const FrameDiff& diff : diffs)
+    {
+        worst.push_back(&diff);
+    }
+    std::stable_sort(worst.begin(), worst.end(), [](const FrameDiff* l, const FrameDiff* r) { return l->total() > r->total(); });
+    worst.resize(std::min<size_t>(worst.size(), reportFrames));
+    if (!worst.empty())
+    {
+        printf("\nFrames that differ most:\n");
+    }
+    for (const FrameDiff* diff : worst)
+    {
+        printf("  frame %u of a, %u of b: %u inserted, %u removed, %u changed, data %+lld bytes\n",
+               diff->frameA, diff->frameB, diff->inserted, diff->removed, diff->changed, diff->payloadDelta);
+        for (const std::string& text : diff->listed)
+        {
+            printf("    %s\n", text.c_str());
+        }
+    }
+
+    if (out)
+    {
+        Json::Value root;
+        for (int t = 0; t < 2; t++)
+        {
+            Json::Value& v = root[t == 0 ? "a" : "b"];
+            v["file"] = traces[t].filename;
+            v["first_frame"] = traces[t].first;
+            v["last_frame"] = traces[t].last;
+            v["calls"] = (Json::UInt64)calls[t];
+            v["payload"] = (Json::UInt64)payload[t];
+        }
+        root["identical_frames"] = identical;
+        root["removed_frames"] = Json::arrayValue;
+        for (unsigned f : removedFrames) root["removed_frames"].append(f);
+        root["inserted_frames"] = Json::arrayValue;
+        for (unsigned f : insertedFrames) root["inserted_frames"].append(f);
+        root["changed_frames"] = Json::arrayValue;
+        for (const FrameDiff& diff : diffs)
+        {
+            Json::Value v;
+            v["frame_a"] = diff.frameA;
+            v["frame_b"] = diff.frameB;
+            v["inserted"] = diff.inserted;
+            v["removed"] = diff.removed;
+            v["changed"] = diff.changed;
+            v["payload_delta"] = (Json::Int64)diff.payloadDelta;
+            for (const auto& f : diff.functions)
+            {
+                Json::Value& fv = v["functions"][f.first];
+                fv["inserted"] = (Json::Int64)f.second[0];
+                fv["removed"] = (Json::Int64)f.second[1];
+                fv["changed"] = (Json::Int64)f.second[2];
+                fv["payload_delta"] = (Json::Int64)f.second[3];
+            }
+            for (const std::string& text : diff.listed) v["calls"].append(text);
+            root["changed_frames"].append(v);
+        }
+        std::ofstream fs(out, std::fstream::out | std::fstream::trunc);
+        fs << root.toStyledString();
+        if (!fs)
+        {
+            DBG_LOG("Error: Could not write %s\n", out);
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,251 @@
+#include <retracer/config.hpp> //version info
+#include <common/file_writer.hpp>
+#include <common/os.hpp>
+#include <common/os_time.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using namespace common;
+
+static void
+usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [-port PORT] [-bind ADDRESS] [-keep] <output_trace_file>\n"
+        "Version: r%dp%d\n"
+        "Receive a trace that the tracer streams with TraceStream=tcp://HOST:PORT and write it\n"
+        "to output_trace_file. Listens on PORT, 5556 by default. To capture on an Android device\n"
+        "over USB, run 'adb reverse tcp:5556 tcp:5556' and use TraceStream=tcp://127.0.0.1:5556.\n"
+        "\n"
+        "  -bind  listen on ADDRESS instead of the loopback address, such as 0.0.0.0 to receive traces\n"
+        "         from devices on the network. Anyone who can connect can write the output file.\n"
+        "  -keep  receive a trace from every app that connects, as output_trace_file.1, .2 and so on\n"
+        "\n"
+        , argv0, PATRACE_VERSION_MAJOR, PATRACE_VERSION_MINOR);
+}
+
+static bool readFully(int fd, void* data, size_t size)
+{
+    char* ptr = (char*)data;
+    while (size > 0)
+    {
+        const ssize_t n = recv(fd, ptr, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const char* data, size_t size, uint64_t offset)
+{
+    while (size > 0)
+    {
+        const ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static int listenOn(const std::string& address, const std::string& port)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *result = nullptr;
+    const int err = getaddrinfo(address.c_str(), port.c_str(), &hints, &result);
+    if (err != 0)
+    {
+        DBG_LOG("Failed to resolve %s port %s: %s\n", address.c_str(), port.c_str(), gai_strerror(err));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai && fd == -1; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        const int reuse = 1;
+        if (fd != -1 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0
+                         || bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 1) != 0))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if (fd == -1)
+    {
+        DBG_LOG("Failed to listen on %s port %s: %s\n", address.c_str(), port.c_str(), strerror(errno));
+    }
+    return fd;
+}
+
+/// Write the trace streamed over the connection to fileName. Returns true once the tracer
+/// closed the stream and everything was written.
+static bool receive(int conn, const std::string& fileName)
+{
+    char magic[sizeof(SOCKET_STREAM_MAGIC) - 1];
+    if (!readFully(conn, magic, sizeof(magic)) || memcmp(magic, SOCKET_STREAM_MAGIC, sizeof(magic)) != 0)
+    {
+        DBG_LOG("Not a trace stream\n");
+        return false;
+    }
+    const int out = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        DBG_LOG("Failed to open %s: %s\n", fileName.c_str(), strerror(errno));
+        return false;
+    }
+    DBG_LOG("Receiving %s\n", fileName.c_str());
+
+    const long long begin = os::getTime();
+    std::vector<char> data;
+    uint64_t end = 0; // of the file
+    uint64_t received = 0;
+    bool written = true;
+    SocketMessage message;
+    while (readFully(conn, &message, sizeof(message)))
+    {
+        if (message.type == SocketMessage::CLOSE)
+        {
+            written = written && fsync(out) == 0;
+            written = (close(out) == 0) && written;
+            const char ok = written ? 1 : 0;
+            send(conn, &ok, 1, MSG_NOSIGNAL);
+            const double seconds = (double)(os::getTime() - begin) / os::timeFrequency;
+            DBG_LOG("Wrote %s, %llu MB in %.1f s (%.1f MB/s)\n", fileName.c_str(), (unsigned long long)(end >> 20), seconds,
+                    seconds > 0 ? (received >> 20) / seconds : 0.0);
+            return written;
+        }
+        // The tracer never sends more than SOCKET_MESSAGE_SIZE at once, and only overwrites
+        // what it appended before, the header and the chunk table
+        if (message.size > SOCKET_MESSAGE_SIZE)
+        {
+            DBG_LOG("Message of %u bytes in the trace stream, larger than a message can be\n", message.size);
+            break;
+        }
+        if (message.type == SocketMessage::WRITE_AT && (message.offset > end || message.size > end - message.offset))
+        {
+            DBG_LOG("Write of %u bytes at %llu in the trace stream, past the end of the file at %llu\n", message.size,
+                    (unsigned long long)message.offset, (unsigned long long)end);
+            break;
+        }
+        data.resize(message.size);
+        if (!readFully(conn, data.data(), data.size()))
+        {
+            break;
+        }
+        received += message.size;
+        if (message.type == SocketMessage::APPEND)
+        {
+            written = written && writeFully(out, data.data(), data.size(), end);
+            end += message.size;
+        }
+        else if (message.type == SocketMessage::WRITE_AT)
+        {
+            written = written && writeFully(out, data.data(), data.size(), message.offset);
+        }
+        else
+        {
+            DBG_LOG("Unknown message %u in the trace stream\n", message.type);
+            break;
+        }
+        if (!written)
+        {
+            DBG_LOG("Failed to write %s: %s\n", fileName.c_str(), strerror(errno));
+            break;
+        }
+    }
+    close(out);
+    DBG_LOG("The trace stream ended before the trace was complete, %s is truncated\n", fileName.c_str());
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    std::string port = "5556";
+    std::string address = "127.0.0.1";
+    bool keep = false;
+    std::string fileName;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "-port") && i + 1 < argc)
+        {
+            port = argv[++i];
+        }
+        else if (!strcmp(arg, "-bind") && i + 1 < argc)
+        {
+            address = argv[++i];
+        }
+        else if (!strcmp(arg, "-keep"))
+        {
+            keep = true;
+        }
+        else if (!strcmp(arg, "--help") || !strcmp(arg, "-h"))
+        {
+            usage(argv[0]);
+            return 0;
+        }
+        else if (arg[0] != '-' && fileName.empty())
+        {
+            fileName = arg;
+        }
+        else
+        {
+            DBG_LOG("error: unknown option %s\n", arg);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (fileName.empty())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const int fd = listenOn(address, port);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    DBG_LOG("Waiting for a trace on %s port %s\n", address.c_str(), port.c_str());
+    bool ok = true;
+    for (unsigned count = 1; ; count++)
+    {
+        const int conn = accept(fd, nullptr, nullptr);
+        if (conn < 0)
+        {
+            if (errno == EINTR) continue;
+            DBG_LOG("Failed to accept: %s\n", strerror(errno));
+            ok = false;
+            break;
+        }
+        ok = receive(conn, keep ? fileName + "." + std::to_string(count) : fileName);
+        close(conn);
+        if (!keep)
+        {
+            break;
+        }
+    }
+    close(fd);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#include <errno.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include <common/trace_stats.hpp>
+#include <common/os.hpp>
+#include <tool/config.hpp>
+
+#include "jsoncpp/include/json/writer.h"
+
+static void usage(const char *argv0)
+{
+    DBG_LOG(
+        "Usage: %s [OPTION] <path_to_trace_file>\n"
+        "Version: " PATRACE_VERSION "\n"
+        "Print call, thread and frame statistics of a trace as JSON, from the call headers alone\n"
+        "\n"
+        "  -h          Display this message\n"
+        "  -t <n>      Decompress on this many threads, default one per core\n"
+        "  -frames     Also list the calls and bytes of each frame\n"
+        "\n"
+        , argv0);
+}
+
+int main(int argc, const char* argv[])
+{
+    const char* filename = NULL;
+    unsigned threads = 0;
+    bool listFrames = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (arg[0] != '-' && !filename)
+        {
+            filename = arg;
+        }
+        else if (!strcmp(arg, "-h") || !strcmp(arg, "-help"))
+        {
+            usage(argv[0]);
+            return 0;
+        }
+        else if (!strcmp(arg, "-t") && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "-frames"))
+        {
+            listFrames = true;
+        }
+        else
+        {
+            DBG_LOG("Error: Unknown option %s\n", arg);
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (!filename)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    common::TraceStats stats;
+    if (!common::scanTraceStats(filename, stats, threads))
+    {
+        DBG_LOG("Error: Failed to read %s\n", filename);
+        return -1;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Json::Value result;
+    result["file_size"] = (Json::Value::UInt64)stats.fileSize;
+    result["chunks"] = (Json::Value::UInt64)stats.chunks;
+    result["calls"] = (Json::Value::UInt64)stats.calls;
+    result["bytes"] = (Json::Value::UInt64)stats.bytes;
+    result["default_tid"] = stats.defaultTid;
+    result["frames"] = (Json::Value::UInt64)stats.frames.size();
+    result["calls_after_last_frame"] = (Json::Value::UInt64)stats.tail.calls;
+    result["scan_seconds"] = seconds;
+    uint64_t maxCalls = 0, maxBytes = 0;
+    for (const common::TraceStats::Frame& frame : stats.frames)
+    {
+        maxCalls = std::max(maxCalls, frame.calls);
+        maxBytes = std::max(maxBytes, frame.bytes);
+    }
+    result["max_frame_calls"] = (Json::Value::UInt64)maxCalls;
+    result["max_frame_bytes"] = (Json::Value::UInt64)maxBytes;
+    for (const auto& pair : stats.functions)
+    {
+        result["functions"][pair.first] = (Json::Value::UInt64)pair.second;
+    }
+    for (const auto& pair : stats.threads)
+    {
+        result["threads"][std::to_string(pair.first)] = (Json::Value::UInt64)pair.second;
+    }
+    if (listFrames)
+    {
+        Json::Value& frames = result["frame_sizes"] = Json::arrayValue;
+        for (const common::TraceStats::Frame& frame : stats.frames)
+        {
+            Json::Value v;
+            v["calls"] = (Json::Value::UInt64)frame.calls;
+            v["bytes"] = (Json::Value::UInt64)frame.bytes;
+            frames.append(v);
+        }
+    }
+    Json::StyledWriter writer;
+    printf("%s", writer.write(result).c_str());
+    return 0;
+}
@@ -1,8 +1,16 @@
 #include <errno.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <common/api_info.hpp>
 #include <common/parse_api.hpp>
+#include <common/thread_pool.hpp>
 #include <common/trace_model.hpp>
 #include <tool/config.hpp>
 
@@ -25,6 +33,7 @@ void usage(const char *argv0)
         "  -r Print frame number\n"
         "  -f <f> <l> Define frame interval, inclusive\n"
         "  -tid <thread_id> The function calls invoked by thread <thread_id> will be printed\n"
+        "  -j <threads> Format the trace on this many threads, 0 for one per core\n"
         "\n"
         , argv0);
 }
@@ -59,6 +68,188 @@ bool isDrawCall(const std::string &funcName)
         return false;
 }
 
+// A range of frames that a worker formats into text, which is written out in frame order
+struct TextBatch
+{
+    unsigned int firstFrame;
+    unsigned int lastFrame; // inclusive
+    std::string text;
+    std::vector<size_t> drawMarks; // where in text the draw call numbers go, which only the writer knows
+    bool done = false;
+};
+
+static const size_t BATCH_BYTES = 8 * 1024 * 1024; // of trace data per batch
+
+class ParallelDump
+{
+public:
+    ParallelDump(const char* filename, common::TraceFileTM& trace, FILE* fp, int tid, bool printFrameNum, bool printDrawCallNum)
+        : mFileName(filename), mTrace(trace), mFp(fp), mTid(tid), mPrintFrameNum(printFrameNum), mPrintDrawCallNum(printDrawCallNum)
+    {}
+
+    bool run(int startFrame, int lastFrame, unsigned int threads)
+    {
+        mTrace.WaitForIndex();
+        const unsigned int first = startFrame >= 0 ? startFrame : 0;
+        const unsigned int last = (lastFrame >= 0 && lastFrame < (int)mTrace.mFrames.size()) ? lastFrame : mTrace.mFrames.size() - 1;
+        for (unsigned int fr = first; fr <= last && fr < mTrace.mFrames.size(); )
+        {
+            TextBatch batch;
+            batch.firstFrame = fr;
+            size_t bytes = 0;
+            do
+            {
+                bytes += mTrace.mFrames[fr++]->mBytes;
+            } while (fr <= last && bytes < BATCH_BYTES);
+            batch.lastFrame = fr - 1;
+            mBatches.push_back(std::move(batch));
+        }
+        // bound how far the workers may get ahead of the writer, and with it the memory use
+        mWindow = threads * 4;
+
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < threads; i++)
+        {
+            workers.emplace_back(&ParallelDump::work, this);
+        }
+        int drawCallNum = 0;
+        for (size_t i = 0; i < mBatches.size(); i++)
+        {
+            TextBatch& batch = mBatches[i];
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCond.wait(lock, [&]{ return batch.done || mFailed; });
+            if (mFailed)
+            {
+                break;
+            }
+            lock.unlock();
+
+            size_t from = 0;
+            for (size_t mark : batch.drawMarks)
+            {
+                fwrite(batch.text.data() + from, 1, mark - from, mFp);
+                fprintf(mFp, " [d:%d]", drawCallNum++);
+                from = mark;
+            }
+            fwrite(batch.text.data() + from, 1, batch.text.size() - from, mFp);
+
+            lock.lock();
+            // hand the buffer on to a later batch, with its memory
+            mSpare.push_back(std::string());
+            mSpare.back().swap(batch.text);
+            mSpare.back().clear();
+            std::vector<size_t>().swap(batch.drawMarks);
+            mWritten = i + 1;
+            mCond.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mWritten = mBatches.size(); // let the workers run out
+            mCond.notify_all();
+        }
+        for (std::thread& t : workers)
+        {
+            t.join();
+        }
+        return !mFailed;
+    }
+
+private:
+    void work()
+    {
+        common::InFileRA in;
+        if (!in.Open(mFileName))
+        {
+            DBG_LOG("Error: Worker could not open %s\n", mFileName);
+            std::lock_guard<std::mutex> lock(mMutex);
+            mFailed = true;
+            mCond.notify_all();
+            return;
+        }
+        common::CallTM call;
+        while (true)
+        {
+            const size_t i = mNext++;
+            if (i >= mBatches.size())
+            {
+                break;
+            }
+            TextBatch& batch = mBatches[i];
+            std::string text;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mCond.wait(lock, [&]{ return i < mWritten + mWindow || mFailed; });
+                if (mFailed)
+                {
+                    break;
+                }
+                if (!mSpare.empty())
+                {
+                    text.swap(mSpare.back());
+                    mSpare.pop_back();
+                }
+            }
+            const bool ok = format(in, call, batch, text);
+            std::lock_guard<std::mutex> lock(mMutex);
+            batch.text.swap(text);
+            batch.done = true;
+            mFailed = mFailed || !ok;
+            mCond.notify_all();
+        }
+    }
+
+    bool format(common::InFileRA& in, common::CallTM& call, TextBatch& batch, std::string& text)
+    {
+        char prefix[64];
+        for (unsigned int fr = batch.firstFrame; fr <= batch.lastFrame; fr++)
+        {
+            const common::FrameTM& frame = *mTrace.mFrames[fr];
+            in.SetReadPos(frame.mReadPos);
+            for (unsigned int ca = 0; ca < frame.GetCallCount(); ++ca)
+            {
+                if (!call.Load(&in))
+                {
+                    return false;
+                }
+                call.mCallNo = frame.mFirstCallOfThisFrame + ca;
+                if (mTid >= 0 && (int)call.mTid != mTid)
+                    continue;
+                int len = snprintf(prefix, sizeof(prefix), "[%d]", call.mTid);
+                if (mPrintFrameNum)
+                {
+                    len += snprintf(prefix + len, sizeof(prefix) - len, " [f:%d]", fr);
+                }
+                text.append(prefix, len);
+                if (mPrintDrawCallNum && isDrawCall(call.mCallName))
+                {
+                    batch.drawMarks.push_back(text.size());
+                }
+                len = snprintf(prefix, sizeof(prefix), " %d : ", call.mCallNo);
+                text.append(prefix, len);
+                call.AppendStr(text, false);
+                text += '\n';
+            }
+        }
+        return true;
+    }
+
+    const char* mFileName;
+    common::TraceFileTM& mTrace;
+    FILE* mFp;
+    int mTid;
+    bool mPrintFrameNum;
+    bool mPrintDrawCallNum;
+
+    std::vector<TextBatch> mBatches;
+    std::atomic<size_t> mNext{0};
+    size_t mWritten = 0;
+    size_t mWindow = 0;
+    bool mFailed = false;
+    std::vector<std::string> mSpare; // buffers of written batches
+    std::mutex mMutex;
+    std::condition_variable mCond;
+};
+
 int main(int argc, const char* argv[])
 {
     if (argc < 2)
@@ -73,6 +264,7 @@ int main(int argc, const char* argv[])
     bool printDrawCallNum = false;
     bool printFrameNum = false;
     int tid = -1;
+    int threads = 1;
     for (int i = 1; i < argc; ++i)
     {
         const char *arg = argv[i];
@@ -107,6 +299,19 @@ int main(int argc, const char* argv[])
         {
             printFrameNum = true;
         }
+        else if (!strcmp(arg, "-j"))
+        {
+            threads = readValidValue(argv[++i]);
+            if (threads < 0)
+            {
+                DBG_LOG("Error: the number of threads must not be negative.\n");
+                return -1;
+            }
+            if (threads == 0)
+            {
+                threads = common::concurrencyBudget();
+            }
+        }
         else if (!strcmp(arg, "-tid"))
         {
             tid = readValidValue(argv[++i]);
@@ -139,12 +344,27 @@ int main(int argc, const char* argv[])
     }
     common::gApiInfo.RegisterEntries(common::parse_callbacks);
     common::TraceFileTM inputFile;
+    if (threads > 1)
+    {
+        // the workers split the trace at frames, so it is indexed up front
+        if (!inputFile.Open(filename, false))
+        {
+            DBG_LOG("Error: Could not open %s\n", filename);
+            return -1;
+        }
+        ParallelDump dump(filename, inputFile, fp, tid, printFrameNum, printDrawCallNum);
+        const bool ok = dump.run(startDumpFrame, lastDumpFrame, threads);
+        fclose(fp);
+        return ok ? 0 : -1;
+    }
+    // start printing the first frames while the rest of the trace is still being indexed
+    inputFile.SetBackgroundIndexing(true);
     inputFile.Open(filename, false);
-    int beginFrame = 0;
-    int endFrame = inputFile.mFrames.size();
     int drawCallNum = 0;
+    std::string line; // reused for every call
 
-    for (int fr = beginFrame; fr != endFrame; ++fr)
+    common::FrameTM* frame;
+    for (int fr = 0; (frame = inputFile.GetFrame(fr)) != NULL; ++fr)
     {
         if (startDumpFrame >= 0 && lastDumpFrame >= 0 &&
             (startDumpFrame > fr || fr > lastDumpFrame))
@@ -152,7 +372,7 @@ int main(int argc, const char* argv[])
             // skip to dump this frame.
             continue;
         }
-        common::FrameTM& curFrame = *(inputFile.mFrames[fr]);
+        common::FrameTM& curFrame = *frame;
 
         unsigned int frameCallNum = curFrame.GetCallCount();
         int cycleNum = 0;
@@ -188,7 +408,9 @@ int main(int argc, const char* argv[])
             {
                 fprintf(fp, " [d:%d]", drawCallNum++);
             }
-            fprintf(fp, " %d : %s\n", curCall.mCallNo, curCall.ToStr(false).c_str());
+            line.clear();
+            curCall.AppendStr(line, false);
+            fprintf(fp, " %d : %s\n", curCall.mCallNo, line.c_str());
         }
         curFrame.UnloadCalls();
     }
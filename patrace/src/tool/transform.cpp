@@ -0,0 +1,160 @@
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "tool/call_pipeline.hpp"
+
+#include "tool/config.hpp"
+#include "base/base.hpp"
+
+static void printHelp()
+{
+    std::cout <<
+        "Usage : transform [STAGES] <source trace> <target trace>\n"
+        "Applies the stages, in the order given, in a single pass over the trace.\n"
+        "Stages:\n"
+        "  --strip TID            Remove the calls of thread TID\n"
+        "  --trim FIRST LAST      Remove the calls from FIRST to LAST of the source trace\n"
+        "  --resize W H           Change the window size and every viewport to W x H\n"
+        "  --rename FROM TO       Rename every call to FROM to TO\n"
+        "  --dedup KINDS          Remove redundant state changes of the default thread, KINDS is a\n"
+        "                         comma separated list of buffers, textures, uniforms, scissors,\n"
+        "                         blendfunc, depthfunc, enable, vertexattr or all\n"
+        "  --clientsidetrim       Delete each client side buffer after its last use in the source trace\n"
+        "Options:\n"
+        "  --end FRAME            End the trace at the swap of FRAME, along with the next --dedup\n"
+        "  --replace              Make the next --dedup replace calls with glEnable(GL_INVALID_INDEX)\n"
+        "  -h                     Print help\n"
+        "  -v                     Print version\n"
+        ;
+}
+
+static void printVersion()
+{
+    std::cout << PATRACE_VERSION << std::endl;
+}
+
+static bool parseDedupKinds(const std::string& list, int& flags)
+{
+    static const std::pair<const char*, int> kinds[] = {
+        { "buffers", DEDUP_BUFFERS }, { "textures", DEDUP_TEXTURES }, { "uniforms", DEDUP_UNIFORMS },
+        { "scissors", DEDUP_SCISSORS }, { "blendfunc", DEDUP_BLENDFUNC }, { "depthfunc", DEDUP_DEPTHFUNC },
+        { "enable", DEDUP_ENABLE }, { "vertexattr", DEDUP_VERTEXATTRIB }, { "all", INT32_MAX } };
+    std::stringstream ss(list);
+    std::string item;
+    flags = 0;
+    while (std::getline(ss, item, ','))
+    {
+        bool found = false;
+        for (const auto& kind : kinds)
+        {
+            if (item == kind.first)
+            {
+                flags |= kind.second;
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            std::cerr << "Error: Unknown kind of call to deduplicate " << item << std::endl;
+            return false;
+        }
+    }
+    return flags != 0;
+}
+
+int main(int argc, char **argv)
+{
+    CallPipeline pipeline;
+    int endframe = -1;
+    bool replace = false;
+    int argIndex = 1;
+    for (; argIndex < argc; ++argIndex)
+    {
+        const std::string arg = argv[argIndex];
+        // the number of values each option takes
+        const int values = (arg == "--trim" || arg == "--resize" || arg == "--rename") ? 2
+                         : (arg == "--strip" || arg == "--dedup" || arg == "--end") ? 1 : 0;
+        if (arg[0] != '-')
+        {
+            break;
+        }
+        else if (argIndex + values >= argc)
+        {
+            std::cerr << "Error: " << arg << " needs " << values << " value(s)" << std::endl;
+            printHelp();
+            return 1;
+        }
+        else if (arg == "-h")
+        {
+            printHelp();
+            return 1;
+        }
+        else if (arg == "-v")
+        {
+            printVersion();
+            return 0;
+        }
+        else if (arg == "--strip")
+        {
+            pipeline.add(new StripStage(atoi(argv[++argIndex])));
+        }
+        else if (arg == "--trim")
+        {
+            const unsigned first = strtoul(argv[++argIndex], nullptr, 10);
+            const unsigned last = strtoul(argv[++argIndex], nullptr, 10);
+            pipeline.add(new TrimStage(first, last));
+        }
+        else if (arg == "--resize")
+        {
+            const int width = atoi(argv[++argIndex]);
+            const int height = atoi(argv[++argIndex]);
+            pipeline.add(new ResizeStage(width, height));
+        }
+        else if (arg == "--rename")
+        {
+            const std::string from = argv[++argIndex];
+            const std::string to = argv[++argIndex];
+            pipeline.add(new RenameStage(from, to));
+        }
+        else if (arg == "--dedup")
+        {
+            int flags = 0;
+            if (!parseDedupKinds(argv[++argIndex], flags))
+            {
+                printHelp();
+                return 1;
+            }
+            pipeline.add(new DeduplicateStage(flags, endframe, replace));
+            endframe = -1;
+            replace = false;
+        }
+        else if (arg == "--clientsidetrim")
+        {
+            pipeline.add(new ClientSideTrimStage());
+        }
+        else if (arg == "--end")
+        {
+            endframe = atoi(argv[++argIndex]);
+        }
+        else if (arg == "--replace")
+        {
+            replace = true;
+        }
+        else
+        {
+            std::cerr << "Error: Unknown option " << arg << std::endl;
+            printHelp();
+            return 1;
+        }
+    }
+
+    if (argIndex + 2 > argc || pipeline.empty())
+    {
+        printHelp();
+        return 1;
+    }
+    const std::string source_trace_filename = argv[argIndex++];
+    const std::string target_trace_filename = argv[argIndex++];
+    return pipeline.run(source_trace_filename, target_trace_filename) ? 0 : 1;
+}
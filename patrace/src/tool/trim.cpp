@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 #include <list>
 #include <map>
@@ -31,36 +32,6 @@ static void printVersion()
     std::cout << PATRACE_VERSION << std::endl;
 }
 
-static common::FrameTM* _curFrame = NULL;
-static unsigned _curFrameIndex = 0;
-static unsigned _curCallIndexInFrame = 0;
-
-static void writeout(common::OutFile &outputFile, common::CallTM *call)
-{
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
-}
-
-static common::CallTM* next_call(common::TraceFileTM &_fileTM)
-{
-    if (_curCallIndexInFrame >= _curFrame->GetLoadedCallCount())
-    {
-        _curFrameIndex++;
-        if (_curFrameIndex >= _fileTM.mFrames.size())
-            return NULL;
-        if (_curFrame) _curFrame->UnloadCalls();
-        _curFrame = _fileTM.mFrames[_curFrameIndex];
-        _curFrame->LoadCalls(_fileTM.mpInFileRA);
-        _curCallIndexInFrame = 0;
-    }
-    common::CallTM *call = _curFrame->mCalls[_curCallIndexInFrame];
-    _curCallIndexInFrame++;
-    return call;
-}
-
 int main(int argc, char **argv)
 {
     int argIndex = 1;
@@ -106,11 +77,12 @@ int main(int argc, char **argv)
         PAT_DEBUG_LOG("Failed to open for reading: %s\n", source_trace_filename);
         return 1;
     }
-    _curFrame = inputFile.mFrames[0];
-    _curFrame->LoadCalls(inputFile.mpInFileRA);
 
+    // The calls are copied as they are, so they keep the function ids of the source trace
+    std::vector<std::string> sigbook;
+    inputFile.mpInFileRA->copySigBook(sigbook);
     common::OutFile outputFile;
-    if (!outputFile.Open(target_trace_filename))
+    if (!outputFile.Open(target_trace_filename, true, &sigbook))
     {
         PAT_DEBUG_LOG("Failed to open for writing: %s\n", target_trace_filename);
         return 1;
@@ -126,21 +98,21 @@ int main(int argc, char **argv)
     outputFile.mHeader.jsonLength = json_header.size();
     outputFile.WriteHeader(json_header.c_str(), json_header.size());
 
-    common::CallTM *call = NULL;
-    int removed = 0;
-    while ((call = next_call(inputFile)))
+    const common::FrameTM* lastFrame = inputFile.mFrames.empty() ? NULL : inputFile.mFrames.back();
+    const unsigned int callCount = lastFrame ? lastFrame->mFirstCallOfThisFrame + lastFrame->GetCallCount() : 0;
+    const unsigned int first = std::min<unsigned int>(std::max(start, 0), callCount);
+    const unsigned int last = std::max<unsigned int>(first, std::min<unsigned int>(std::max(end + 1, 0), callCount));
+
+    // Keep [0, first) and [last, callCount), copying the chunks inside those compressed
+    const int before = inputFile.CopyCalls(0, first, outputFile);
+    const int after = (before >= 0) ? inputFile.CopyCalls(last, callCount, outputFile) : -1;
+    if (before < 0 || after < 0)
     {
-        if ((int)call->mCallNo < start || (int)call->mCallNo > end)
-        {
-            writeout(outputFile, call);
-        }
-        else
-        {
-            removed++;
-        }
+        PAT_DEBUG_LOG("Failed to read the calls of %s\n", source_trace_filename);
+        return 1;
     }
 
-    DBG_LOG("Removed %d calls\n", removed);
+    DBG_LOG("Removed %u calls, copied %d chunks without recompressing them\n", last - first, before + after);
     inputFile.Close();
     outputFile.Close();
 
@@ -4,7 +4,7 @@
 // Makes trace files look like they have been created with a very old tracer by optimizing their sigbooks.
 //
 // To compile:
-// gcc -o update_dictionary patrace/src/tool/update_dictionary.cpp patrace/src/common/out_file.cpp -Wall -g -O3 -I thirdparty/snappy -std=c++11 builds/patrace/x11_x64/debug/snappy/libsnappy_bundled.a -lstdc++ -I patrace/src
+// gcc -o update_dictionary patrace/src/tool/update_dictionary.cpp patrace/src/common/out_file.cpp patrace/src/common/chunk_codec.cpp -Wall -g -O3 -I thirdparty/snappy -std=c++11 builds/patrace/x11_x64/debug/snappy/libsnappy_bundled.a -lstdc++ -I patrace/src
 //
 
 #include <assert.h>
@@ -16,8 +16,7 @@
 #include <map>
 #include <stdbool.h>
 
-#include <snappy.h>
-
+#include "common/chunk_codec.hpp"
 #include "common/out_file.hpp"
 
 #include "common/api_info_auto.cpp"
@@ -141,22 +140,22 @@ int main(int argc, char **argv)
 	}
 
 	// Find size of uncompressed data buffer -- parsing everything twice, which is wildly inefficient but don't care
-	uint32_t compressed_length = 0;
+	uint32_t prefix = 0;
 	size_t size = 0;
 	size_t start_pos = ftell(in);
 	size_t uncompressed_length = 0;
 	std::vector<char> buffer_compressed;
 	for (;;)
 	{
-		// Read chunk length
-		if (!read_compressed_length(&compressed_length, in))
+		// Read chunk length and codec
+		if (!read_compressed_length(&prefix, in) || prefix == CHUNK_TRAILER_PREFIX)
 		{
 			printf("Done reading first round\n");
 			break;
 		}
-		buffer_compressed.resize(compressed_length);
-		myread(buffer_compressed.data(), compressed_length, in, "reading chunk pass 1");
-		if (snappy::GetUncompressedLength(buffer_compressed.data(), buffer_compressed.size(), &size) == false)
+		buffer_compressed.resize(common::chunkPrefixLength(prefix));
+		myread(buffer_compressed.data(), buffer_compressed.size(), in, "reading chunk pass 1");
+		if (common::chunkUncompressedLength(common::chunkPrefixCodec(prefix), buffer_compressed.data(), buffer_compressed.size(), &size) == false)
 		{
 			printf("Error checking chunk size (pass 1)\n");
 			abort();
@@ -171,20 +170,22 @@ int main(int argc, char **argv)
 	size_t big_counter = 0;
 	for (;;)
 	{
-		// Read chunk length
-		if (!read_compressed_length(&compressed_length, in))
+		// Read chunk length and codec
+		if (!read_compressed_length(&prefix, in) || prefix == CHUNK_TRAILER_PREFIX)
 		{
 			printf("Done reading second round\n");
 			break;
 		}
-		buffer_compressed.resize(compressed_length);
-		myread(buffer_compressed.data(), compressed_length, in, "reading chunk pass 2");
-		if (snappy::GetUncompressedLength(buffer_compressed.data(), buffer_compressed.size(), &size) == false)
+		const common::ChunkCodec codec = common::chunkPrefixCodec(prefix);
+		buffer_compressed.resize(common::chunkPrefixLength(prefix));
+		myread(buffer_compressed.data(), buffer_compressed.size(), in, "reading chunk pass 2");
+		if (common::chunkUncompressedLength(codec, buffer_compressed.data(), buffer_compressed.size(), &size) == false)
 		{
 			printf("Error checking chunk size (pass 2)\n");
 			abort();
 		}
-		if (snappy::RawUncompress(buffer_compressed.data(), buffer_compressed.size(), &big_buffer.data()[big_counter]) == false)
+		// Columnar chunks would need the call sizes of the sigbook, which is only read below
+		if (common::chunkUncompress(codec, buffer_compressed.data(), buffer_compressed.size(), &big_buffer.data()[big_counter]) == false)
 		{
 			printf("Error decompressing chunk (pass 2)\n");
 			abort();
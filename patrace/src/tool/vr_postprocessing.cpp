@@ -19,6 +19,7 @@
 #include "eglstate/context.hpp"
 #include "tool/config.hpp"
 #include "base/base.hpp"
+#include "tool/call_patcher.hpp"
 #include "tool/utils.hpp"
 
 struct MakeCurrentInfo {
@@ -98,11 +99,7 @@ common::OutFile tmpFile;
 
 static void writeout(common::OutFile &outputFile, common::CallTM *call)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-
-    char *dest = call->Serialize(buffer);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile);
 }
 
 int parse_args(int argc, char **argv) {
@@ -379,26 +376,26 @@ void glMakeCurrent_common(common::CallTM *call) {
     }
 }
 
-void eglCreatePbufferSurface_common(common::CallTM *call, common::OutFile &outFile,uint32_t overrideResWidth, uint32_t overrideResHeight)
+common::CallTM* eglCreatePbufferSurface_common(common::CallTM *call, uint32_t overrideResWidth, uint32_t overrideResHeight)
 {
     int dpy = call->mArgs[0]->GetAsInt();
     int config = call->mArgs[1]->GetAsInt();
     int ret = call->mRet.GetAsInt();
     int attrib_list[1] = {1};
 
-    common::CallTM eglCreateWindowSurface2("eglCreateWindowSurface2");
-    eglCreateWindowSurface2.mArgs.push_back(new common::ValueTM(dpy));
-    eglCreateWindowSurface2.mArgs.push_back(new common::ValueTM(config));
-    eglCreateWindowSurface2.mArgs.push_back(new common::ValueTM(-1));
-    eglCreateWindowSurface2.mArgs.push_back(new common::ValueTM((const char *)attrib_list, 4));
-    eglCreateWindowSurface2.mArgs.push_back(new common::ValueTM(0));
-    eglCreateWindowSurface2.mArgs.push_back(new common::ValueTM(0));
-    eglCreateWindowSurface2.mArgs.push_back(new common::ValueTM(overrideResWidth));
-    eglCreateWindowSurface2.mArgs.push_back(new common::ValueTM(overrideResHeight));
-    eglCreateWindowSurface2.mRet = common::ValueTM(ret);
-    eglCreateWindowSurface2.mTid = call->mTid;
-
-    writeout(outFile, &eglCreateWindowSurface2);
+    common::CallTM* eglCreateWindowSurface2 = new common::CallTM("eglCreateWindowSurface2");
+    eglCreateWindowSurface2->mArgs.push_back(new common::ValueTM(dpy));
+    eglCreateWindowSurface2->mArgs.push_back(new common::ValueTM(config));
+    eglCreateWindowSurface2->mArgs.push_back(new common::ValueTM(-1));
+    eglCreateWindowSurface2->mArgs.push_back(new common::ValueTM((const char *)attrib_list, 4));
+    eglCreateWindowSurface2->mArgs.push_back(new common::ValueTM(0));
+    eglCreateWindowSurface2->mArgs.push_back(new common::ValueTM(0));
+    eglCreateWindowSurface2->mArgs.push_back(new common::ValueTM(overrideResWidth));
+    eglCreateWindowSurface2->mArgs.push_back(new common::ValueTM(overrideResHeight));
+    eglCreateWindowSurface2->mRet = common::ValueTM(ret);
+    eglCreateWindowSurface2->mTid = call->mTid;
+
+    return eglCreateWindowSurface2;
 }
 
 void glBindTexture_gearvr(common::CallTM *call) {
@@ -710,55 +707,32 @@ int write_trace_header(uint32_t &overrideResWidth, uint32_t &overrideResHeight)
 }
 
 int update_surface_resolutions(uint32_t overrideResWidth, uint32_t overrideResHeight) {
-    // Update resolution of surfaces
-    common::OutFile outFile;
-    if (!outFile.Open(target_trace_filename.c_str()))
-    {
-        PAT_DEBUG_LOG("Failed to open for writing: %s\n", target_trace_filename.c_str());
-        return 0;
-    }
-
-    common::TraceFileTM inputTmpFile;
-    if (!inputTmpFile.Open(tmp_trace_filename.c_str()))
-    {
-        PAT_DEBUG_LOG("Failed to open for reading: %s\n", tmp_trace_filename.c_str());
-        return 0;
-    }
-
-    // Iterate over all calls
-    common::CallTM *call = NULL;
-    while ((call = inputTmpFile.NextCall()))
+    // Update resolution of surfaces. Only the surface creation calls change, everything else
+    // is copied from the temporary trace as it is.
+    CallPatcher patcher;
+    const bool scanned = patcher.scan(tmp_trace_filename, { "eglCreateWindowSurface2", "eglCreatePbufferSurface" },
+                                      [&](std::unique_ptr<common::CallTM>& call, CallPatcher::Calls& patch)
     {
         // ret=-892076320 eglCreateWindowSurface2(dpy=-185888000, config=-767040784, win=-294846456, attrib_list={12344}, x=0, y=0, width=2560, height=1440)
-        bool skip = false;
         if (call->mCallName == "eglCreateWindowSurface2")
         {
             call->mArgs[6]->mUint = overrideResWidth;
             call->mArgs[7]->mUint = overrideResHeight;
+            patch.push_back(std::move(call));
+            return true;
         }
-        if(is_gearvr == true && call->mCallName == "eglCreatePbufferSurface")
+        if (is_gearvr == true && call->mCallName == "eglCreatePbufferSurface")
         {
-            eglCreatePbufferSurface_common(call, outFile, overrideResWidth, overrideResHeight);
-            skip = true;
-        }
-
-        if(skip == false)
-        {
-            writeout(outFile, call);
+            patch.emplace_back(eglCreatePbufferSurface_common(call.get(), overrideResWidth, overrideResHeight));
+            return true;
         }
+        return false;
+    });
+    if (!scanned || !patcher.write(target_trace_filename, patcher.header()))
+    {
+        return 0;
     }
 
-    Json::Value header = inputTmpFile.mpInFileRA->getJSONHeader();
-
-    Json::FastWriter writer;
-    const std::string json_header = writer.write(header);
-
-    outFile.mHeader.jsonLength = json_header.size();
-    outFile.WriteHeader(json_header.c_str(), json_header.size());
-
-    inputTmpFile.Close();
-    outFile.Close();
-
     return 1;
 }
 
@@ -15,6 +15,7 @@
 #include <common/trace_limits.hpp>
 #include <common/image.hpp>
 #include <common/gl_extension_supported.hpp>
+#include <common/base64.hpp>
 
 #include "jsoncpp/include/json/writer.h"
 #include "jsoncpp/include/json/reader.h"
@@ -22,8 +23,11 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fstream>
+#include <iterator>
 #include <string>
+#include <atomic>
 #include <unordered_map>
+#include <signal.h>
 #include <sys/stat.h>
 #include <libgen.h>
 #include <time.h>
@@ -59,9 +63,8 @@ static std::map<EGLContext, TraceContext*> gCtxMap;
 static std::map<EGLSurface, TraceSurface*> gSurfMap;
 static thread_local int thread_id = -1;
 static int threads = 0; // atomic protected by gcc/clang atomics, not c++11 atomics, since the latter cannot be default initialized
-static std::vector<std::unordered_map<int, int>> timesEGLConfigIdUsed;
 static std::unordered_map<int, MyEGLAttribs> configIdToConfigAttribsMap;
-std::vector<TraceThread> gTraceThread(PATRACE_THREAD_LIMIT);
+std::array<TraceThread, PATRACE_THREAD_LIMIT> gTraceThread;
 
 static std::vector<MyEGLSurface> surfaces;
 static std::vector<MyEGLContext> contexts;
@@ -76,7 +79,15 @@ struct MyEGLAttribArray
 
 static void callback(unsigned int source, unsigned int type, unsigned int id, unsigned int severity, int length, const char* message, const void* userParam)
 {
-    DBG_LOG("%s::%s::%s (call=%u): %s\n", cbsource(source), cbtype(type), cbseverity(severity), gTraceOut->callNo, message);
+    if (type == GL_DEBUG_TYPE_ERROR_KHR)
+    {
+        // synchronous output, so this is the thread making the call
+        gTraceThread.at(GetThreadId()).mDebugErrorPending = true;
+    }
+    if (!tracerParams.DisableErrorReporting)
+    {
+        DBG_LOG("%s::%s::%s (call=%u): %s\n", cbsource(source), cbtype(type), cbseverity(severity), gTraceOut->callNo, message);
+    }
 }
 
 static MyEGLAttribArray GetBestConfigPerThread()
@@ -86,13 +97,13 @@ static MyEGLAttribArray GetBestConfigPerThread()
     attribArray.defaultTid = 0;
 
     // 1. Find the Best (most used) EGL config for each thread
-    for (unsigned tid = 0; tid < timesEGLConfigIdUsed.size(); tid++)
+    for (unsigned tid = 0; tid < gTraceThread.size(); tid++)
     {
         EGLint highestUseCfgId = -1;
         int highestCnt = 0;
 
         // Find  most used for cfgId for this tid
-        for (auto it : timesEGLConfigIdUsed[tid])
+        for (auto it : gTraceThread[tid].timesConfigUsed())
         {
             if (it.second > highestCnt)
             {
@@ -127,27 +138,90 @@ static MyEGLAttribArray GetBestConfigPerThread()
     return attribArray;
 }
 
+static volatile sig_atomic_t flightRecorderSignalled = 0;
+
+static void flightRecorderSignalHandler(int)
+{
+    flightRecorderSignalled = 1;
+}
+
 BinAndMeta::BinAndMeta()
 {
+    startTime = os::getTime();
     Path path;
-    os::String binName = path.getTraceFilePath();
+    os::String binName = tracerParams.TraceStream.empty() ? path.getTraceFilePath() : os::String(tracerParams.TraceStream.c_str());
     DBG_LOG("The trace file name is : %s\n", binName.str());
 
     // Try to create dir
-    char *bn = strdup(binName.str()); // dirname() might modify the passed path
-    mkdir(dirname(bn), 0777);
-    free(bn);
+    if (!isSocketName(binName.str()))
+    {
+        char *bn = strdup(binName.str()); // dirname() might modify the passed path
+        mkdir(dirname(bn), 0777);
+        free(bn);
+    }
 
     traceFile = new OutFile;
-    traceFile->Open(binName.str());
+    ChunkCodec codec = CHUNK_CODEC_SNAPPY;
+    if (!chunkCodecFromName(tracerParams.ChunkCodec, codec))
+    {
+        DBG_LOG("Unknown ChunkCodec %s, using snappy\n", tracerParams.ChunkCodec.c_str());
+    }
+    traceFile->setCodec(codec);
+    traceFile->setColumnar(tracerParams.ColumnarChunks);
+    traceFile->setChecksums(tracerParams.ChunkChecksums);
+    traceFile->setHeaderPadding(std::max(tracerParams.HeaderPadding, 0));
+    FileWriterKind writer = FILE_WRITER_STDIO;
+    if (!fileWriterFromName(tracerParams.TraceFileWriter, writer))
+    {
+        DBG_LOG("Unknown TraceFileWriter %s, using stdio\n", tracerParams.TraceFileWriter.c_str());
+    }
+    traceFile->setWriter(writer);
+    traceFile->setStreamBuffer((size_t)std::max(tracerParams.TraceStreamBuffer, 1) << 20);
+    traceFile->setChunkSize(tracerParams.ChunkSize);
+    if (tracerParams.ChunkDictionary == "train")
+    {
+        traceFile->setDictionaryTraining(8 * 1024 * 1024);
+    }
+    else if (!tracerParams.ChunkDictionary.empty())
+    {
+        std::ifstream file(tracerParams.ChunkDictionary, std::ios::binary);
+        if (file)
+        {
+            traceFile->setDictionary(std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()));
+        }
+        else
+        {
+            DBG_LOG("Failed to read the chunk dictionary %s\n", tracerParams.ChunkDictionary.c_str());
+        }
+    }
+    traceFile->setCompressionThreads(tracerParams.CompressionThreads);
+    mFileName = binName.str();
+    if (tracerParams.FlightRecorderFrames > 0)
+    {
+        // the file is only opened once the recorder is triggered
+        mFlightRecorder.reset(new FlightRecorder(tracerParams.FlightRecorderFrames, chunkCodecAvailable(codec) ? codec : CHUNK_CODEC_SNAPPY));
+        signal(SIGUSR1, flightRecorderSignalHandler);
+        DBG_LOG("Flight recorder keeping the last %d frames in memory until SIGUSR1 or another trigger\n", tracerParams.FlightRecorderFrames);
+    }
+    else
+    {
+        traceFile->Open(binName.str());
+    }
 
     // Reset per thread counters
-    timesEGLConfigIdUsed.clear();
-    timesEGLConfigIdUsed.resize(PATRACE_THREAD_LIMIT);
+    for (TraceThread& thread : gTraceThread)
+    {
+        thread.clearTimesConfigUsed();
+    }
 }
 
 BinAndMeta::~BinAndMeta()
 {
+    if (mFlightRecorder)
+    {
+        DBG_LOG("Flight recorder was never triggered, nothing written to %s\n", mFileName.c_str());
+        return;
+    }
     writeHeader(true);
     traceFile->Close();
 }
@@ -166,7 +240,12 @@ static void addEGLConfigToJSON(Json::Value& v, const MyEGLAttribs& config)
 
 void BinAndMeta::writeHeader(bool cleanExit)
 {
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex); // need to lock against both file access and global EGL config access here
+    if (mFlightRecorder)
+    {
+        return; // no file yet
+    }
+    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex); // global EGL config access
+    std::lock_guard<std::recursive_mutex> writeGuard(gTraceOut->writeMutex); // file access
 
     MyEGLAttribArray perThreadEGLConfigs = GetBestConfigPerThread();
 
@@ -190,6 +269,22 @@ void BinAndMeta::writeHeader(bool cleanExit)
     }
     jsonRoot["tracer"] = PATRACE_VERSION;
     jsonRoot["tracer_extensions"] = tracerParams.SupportedExtensionsString;
+    if (traceFile->getCodec() != CHUNK_CODEC_SNAPPY)
+    {
+        jsonRoot["chunkCodec"] = chunkCodecName(traceFile->getCodec());
+    }
+    if (traceFile->getColumnar())
+    {
+        jsonRoot["chunkLayout"] = "columnar";
+    }
+    const std::string dictionary = traceFile->getDictionary();
+    if (!dictionary.empty())
+    {
+        size_t length = 0;
+        char* encoded = base64_encode(dictionary.data(), dictionary.size(), &length);
+        jsonRoot["chunkDictionary"] = std::string(encoded, length);
+        delete [] encoded;
+    }
 
     // add date of trace capture
     char tmpstr[40];
@@ -265,14 +360,104 @@ void BinAndMeta::writeHeader(bool cleanExit)
         jsonRoot["texCompress"].append(jsonTexCompressFormat);
     }
 
+    if (!nameRanges.empty())
+    {
+        jsonRoot["nameRanges"] = Json::Value(Json::objectValue);
+        for (const auto& pair : nameRanges)
+        {
+            Json::Value range;
+            range["count"] = pair.second.count;
+            range["max"] = pair.second.max;
+            jsonRoot["nameRanges"][pair.first] = range;
+        }
+    }
+
     jsonRoot["cleanExit"] = cleanExit;
+    if (captureStartFrame >= 0)
+    {
+        jsonRoot["captureStartFrame"] = captureStartFrame;
+    }
+    if (!frameIntervals.empty())
+    {
+        jsonRoot["frameIntervals"] = Json::Value(Json::arrayValue);
+        for (const unsigned us : frameIntervals)
+        {
+            jsonRoot["frameIntervals"].append(us);
+        }
+    }
+    if (!frameTimings.empty())
+    {
+        // Rows of a 64 bit end time and, with the CPU times, two 32 bit ones, little endian
+        std::vector<char> table;
+        for (const FrameTiming& frame : frameTimings)
+        {
+            table.insert(table.end(), (const char*)&frame.end, (const char*)&frame.end + sizeof(frame.end));
+            if (tracerParams.FrameTimingsCpu)
+            {
+                table.insert(table.end(), (const char*)&frame.gl, (const char*)&frame.gl + sizeof(frame.gl));
+                table.insert(table.end(), (const char*)&frame.driver, (const char*)&frame.driver + sizeof(frame.driver));
+            }
+        }
+        Json::Value timings;
+        timings["frames"] = (Json::UInt64)frameTimings.size();
+        timings["unit"] = "us";
+        timings["columns"].append("end");
+        if (tracerParams.FrameTimingsCpu)
+        {
+            timings["columns"].append("gl");
+            timings["columns"].append("driver");
+        }
+        size_t length = 0;
+        char* encoded = base64_encode(table.data(), table.size(), &length);
+        timings["data"] = std::string(encoded, length);
+        delete [] encoded;
+        jsonRoot["frameTimings"] = timings;
+    }
+    if (tracerParams.TracerOverheadStats)
+    {
+        gTracerOverhead.toJson(jsonRoot["tracerOverhead"]);
+    }
 
     Json::FastWriter writer;
     std::string jsonData = writer.write(jsonRoot);
 
+    // The optional tables can outgrow the space reserved for the header in long traces. Leave
+    // them out, the least useful first, rather than abort in WriteHeader(). The dictionary is
+    // needed to read the chunks, so it always stays.
+    static const char* const optional[][2] = {
+        { "tracerOverhead", "frameOverhead" },
+        { "frameIntervals", nullptr },
+        { "frameTimings", nullptr },
+        { "tracerOverhead", nullptr },
+    };
+    for (const auto& name : optional)
+    {
+        if (jsonData.length() <= traceFile->HeaderSpace())
+        {
+            break;
+        }
+        if (!jsonRoot.isMember(name[0]) || (name[1] && !jsonRoot[name[0]].isMember(name[1])))
+        {
+            continue;
+        }
+        DBG_LOG("The json header of %u bytes does not fit in %u, leaving out %s%s%s\n", (unsigned)jsonData.length(),
+                (unsigned)traceFile->HeaderSpace(), name[0], name[1] ? "." : "", name[1] ? name[1] : "");
+        if (name[1])
+        {
+            jsonRoot[name[0]].removeMember(name[1]);
+        }
+        else
+        {
+            jsonRoot.removeMember(name[0]);
+        }
+        jsonData = writer.write(jsonRoot);
+    }
+
     // Now that we have all header data written to JSON, write it to reserved header-area
     if (0 != jsonData.length())
     {
+        OverheadTimer timer(OVERHEAD_FILE_WRITE);
+        traceFile->SetFrameTableInfo(gTraceOut->callNo, perThreadEGLConfigs.defaultTid);
         traceFile->WriteHeader(jsonData.c_str(), jsonData.length(), !tracerParams.FlushTraceFileEveryFrame);
     }
     else
@@ -282,6 +467,47 @@ void BinAndMeta::writeHeader(bool cleanExit)
     }
 }
 
+void BinAndMeta::recordFrameInterval(unsigned frameNo)
+{
+    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
+    const long long now = os::getTime();
+    if (frameNo < MAX_FRAME_INTERVALS && frameNo >= frameIntervals.size())
+    {
+        frameIntervals.resize(frameNo, 0); // frames that ended without a swap, like at eglDestroySurface
+        frameIntervals.push_back(lastSwapTime ? (now - lastSwapTime) * 1000000 / os::timeFrequency : 0);
+    }
+    lastSwapTime = now;
+}
+
+void BinAndMeta::recordFrameTiming(unsigned frameNo, const std::vector<long long>& cpu)
+{
+    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
+    if (frameNo >= MAX_FRAME_TIMINGS || frameNo < frameTimings.size())
+    {
+        return;
+    }
+    FrameTiming frame = { 0, 0, 0 };
+    frameTimings.resize(frameNo, frame); // frames that ended without a swap
+    frame.end = (os::getTime() - startTime) * 1000000 / os::timeFrequency;
+    if (!cpu.empty())
+    {
+        frame.gl = cpu[OVERHEAD_WRAPPER] / 1000;
+        frame.driver = cpu[OVERHEAD_DRIVER] / 1000;
+    }
+    frameTimings.push_back(frame);
+}
+
+void BinAndMeta::recordNames(const char* type, int n, const GLuint* names)
+{
+    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
+    NameRange& range = nameRanges[type];
+    for (int i = 0; i < n; i++)
+    {
+        range.count++;
+        range.max = std::max(range.max, (unsigned)names[i]);
+    }
+}
+
 void BinAndMeta::updateWinSurfSize(EGLint width, EGLint height)
 {
     winSurWidth = (EGLint)winSurWidth < width ? width : winSurWidth;
@@ -355,17 +581,103 @@ void BinAndMeta::saveAllEGLConfigs(EGLDisplay dpy)
 
 std::string BinAndMeta::getFileName() const
 {
-    return traceFile->getFileName();
+    return mFileName;
+}
+
+void BinAndMeta::triggerFlightRecorder(const char* reason)
+{
+    std::lock_guard<std::recursive_mutex> writeGuard(gTraceOut->writeMutex);
+    if (!mFlightRecorderTrigger)
+    {
+        mFlightRecorderTrigger = reason;
+    }
+}
+
+void BinAndMeta::updateFlightRecorder(unsigned frameNo)
+{
+    if (!mFlightRecorder)
+    {
+        return;
+    }
+
+    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
+    std::lock_guard<std::recursive_mutex> writeGuard(gTraceOut->writeMutex);
+    if (tracerParams.FlightRecorderFrameTime > 0 && lastSwapTime > 0
+        && (os::getTime() - lastSwapTime) * 1000 / os::timeFrequency >= tracerParams.FlightRecorderFrameTime)
+    {
+        triggerFlightRecorder("a slow frame");
+    }
+    if (flightRecorderSignalled)
+    {
+        triggerFlightRecorder("SIGUSR1");
+    }
+    if (!mFlightRecorderTrigger)
+    {
+        return;
+    }
+
+    // frames are numbered as they are in the trace, since the checkpoint keeps the swaps
+    const unsigned frames = mFlightRecorder->framesInMemory();
+    DBG_LOG("Flight recorder triggered by %s at frame %u, writing the last %u frames (%u MB in memory) to %s\n",
+            mFlightRecorderTrigger, frameNo, frames, (unsigned)(mFlightRecorder->memoryUsed() >> 20), mFileName.c_str());
+    if (!traceFile->Open(mFileName.c_str()))
+    {
+        mFlightRecorder.reset();
+        return;
+    }
+    gTraceOut->callNo = mFlightRecorder->dump(*traceFile);
+    captureStartFrame = frameNo + 1 > frames ? frameNo + 1 - frames : 0;
+    mFlightRecorder.reset();
+    writeHeader(false);
 }
 
-TraceOut::TraceOut() : writebuf(new char[WRITE_BUF_LEN])
+TraceOut::TraceOut() : mThreadBufs(PATRACE_THREAD_LIMIT)
 {
 }
 
 TraceOut::~TraceOut()
 {
     Close();
-    delete [] writebuf;
+}
+
+static volatile sig_atomic_t captureSignalled = 0;
+
+static void captureSignalHandler(int)
+{
+    captureSignalled = 1;
+}
+
+void TraceOut::ArmCapture()
+{
+    if (tracerParams.CaptureStartFrame <= 0 && !tracerParams.CaptureOnSignal)
+    {
+        return;
+    }
+    if (tracerParams.CaptureOnSignal)
+    {
+        signal(SIGUSR2, captureSignalHandler);
+        DBG_LOG("Not recording rendering calls until SIGUSR2\n");
+    }
+    if (tracerParams.CaptureStartFrame > 0)
+    {
+        DBG_LOG("Not recording rendering calls until frame %d\n", tracerParams.CaptureStartFrame);
+    }
+    mCaptureArmed = true;
+}
+
+void TraceOut::updateCaptureArmed()
+{
+    if (!captureArmed())
+    {
+        return;
+    }
+    const bool frameReached = tracerParams.CaptureStartFrame > 0 && frameNo >= (unsigned)tracerParams.CaptureStartFrame;
+    if (frameReached || captureSignalled)
+    {
+        mCaptureArmed = false;
+        mpBinAndMeta->captureStartFrame = frameNo;
+        DBG_LOG("Recording rendering calls from frame %u (call %u)\n", frameNo, callNo);
+    }
 }
 
 unsigned char GetThreadId()
@@ -380,11 +692,45 @@ unsigned char GetThreadId()
 // This function is called from each traced EGL/GL call, see trace.py and its output egltrace_auto.cpp
 void UpdateTimesEGLConfigUsed(int threadid)
 {
-    const TraceSurface *traceSurf = GetCurTraceSurface(threadid);
+    TraceThread& thread = gTraceThread.at(threadid);
+    const TraceSurface *traceSurf = thread.mCurSurf;
     if (traceSurf && traceSurf->mEGLSurf)
     {
-        timesEGLConfigIdUsed[threadid][traceSurf->mEGLConfigId]++;
+        // Only this thread changes mCountedConfigId, so it may read it without the lock
+        if (unlikely(traceSurf->mEGLConfigId != thread.mCountedConfigId))
+        {
+            std::lock_guard<std::mutex> lock(thread.mConfigMutex);
+            const int calls = thread.mCountedCalls.load(std::memory_order_relaxed);
+            if (calls > 0)
+            {
+                thread.mTimesConfigUsed[thread.mCountedConfigId] += calls;
+            }
+            thread.mCountedConfigId = traceSurf->mEGLConfigId;
+            thread.mCountedCalls.store(0, std::memory_order_relaxed);
+        }
+        // A load and a store rather than an atomic increment, which would cost every call a locked instruction
+        thread.mCountedCalls.store(thread.mCountedCalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+std::unordered_map<int, int> TraceThread::timesConfigUsed() const
+{
+    // Read by the thread that writes the header while this one may still be counting
+    std::lock_guard<std::mutex> lock(mConfigMutex);
+    std::unordered_map<int, int> times = mTimesConfigUsed;
+    const int calls = mCountedCalls.load(std::memory_order_relaxed);
+    if (calls > 0)
+    {
+        times[mCountedConfigId] += calls;
     }
+    return times;
+}
+
+void TraceThread::clearTimesConfigUsed()
+{
+    std::lock_guard<std::mutex> lock(mConfigMutex);
+    mTimesConfigUsed.clear();
+    mCountedCalls.store(0, std::memory_order_relaxed);
 }
 
 TraceContext* GetCurTraceContext(unsigned char tid)
@@ -418,6 +764,63 @@ TraceSurface* GetCurTraceSurface(unsigned char tid)
     return gTraceThread.at(tid).mCurSurf;
 }
 
+// Serialize a texture or buffer upload. A large blob is written normally the first time it is
+// seen, since most are never repeated and the retracer would otherwise have to keep them all.
+// The second time it is stored under an id, and after that only the id is written. Each thread
+// keeps its own index, because its calls are the only ones known to reach the trace file in
+// the order they are serialized.
+char* WriteStoredBlob(char* dest, unsigned char tid, unsigned int len, const char* blob, common::BlobCodec codec)
+{
+    if (!blob)
+    {
+        codec = common::BLOB_CODEC_NONE;
+    }
+    if (tracerParams.BlobStoreMinSize <= 0 || !blob || len < (unsigned int)tracerParams.BlobStoreMinSize)
+    {
+        if (codec != common::BLOB_CODEC_NONE)
+        {
+            return gTraceOut->WriteEncodedBlobDeferred(tid, dest, len, blob, codec);
+        }
+        return gTraceOut->Write1DArrayDeferred<char>(tid, dest, len, blob);
+    }
+
+    static std::atomic<unsigned int> nextBlobId(1);
+    auto result = gTraceThread.at(tid).mBlobIndex.emplace(BlobKey(len, blob), 0);
+    unsigned int& id = result.first->second;
+    if (result.second || id == 0)
+    {
+        if (!result.second)
+        {
+            id = nextBlobId++;
+            dest = WriteFixed<unsigned int>(dest, BLOB_STORE_DEFINE);
+            dest = WriteFixed<unsigned int>(dest, id);
+        }
+        if (codec != common::BLOB_CODEC_NONE)
+        {
+            return gTraceOut->WriteEncodedBlobDeferred(tid, dest, len, blob, codec);
+        }
+        return gTraceOut->Write1DArrayDeferred<char>(tid, dest, len, blob);
+    }
+    return WriteBlobReference(dest, id);
+}
+
+common::BlobCodec TextureBlobCodec(GLenum format, GLenum type, unsigned int len)
+{
+    if (tracerParams.TextureCompressMinSize <= 0 || len < (unsigned int)tracerParams.TextureCompressMinSize)
+    {
+        return common::BLOB_CODEC_NONE;
+    }
+    if (type == GL_UNSIGNED_BYTE && format == GL_RGBA)
+    {
+        return common::BLOB_CODEC_QOI_RGBA;
+    }
+    if (type == GL_UNSIGNED_BYTE && format == GL_RGB)
+    {
+        return common::BLOB_CODEC_QOI_RGB;
+    }
+    return common::BLOB_CODEC_LZ4;
+}
+
 TraceSurface::TraceSurface(EGLSurface surf, EGLint configId): mEGLSurf(surf), mEGLConfigId(configId)
 {
     if (gSurfMap.find(mEGLSurf) != gSurfMap.end())
@@ -499,6 +902,9 @@ void after_glBindAttribLocation(unsigned char tid, GLuint program, GLuint index)
     it->second |= (0x1 << index);
 }
 
+static const unsigned int CSB_PATCH_MIN_BUFFER_SIZE = 0x8000; // 32kB
+static const float CSB_PATCH_UP_THRESHOLD = 0.8;
+
 void after_glMapBufferRange(GLenum target, GLsizeiptr length, GLbitfield access, GLvoid* base)
 {
     BufferRangeData data;
@@ -513,16 +919,27 @@ void after_glMapBufferRange(GLenum target, GLsizeiptr length, GLbitfield access,
         DBG_LOG("No buffer currently bound to target %s for glMapBufferRange!\n", bufferName(target));
     }
 
-    GetCurTraceContext(tid)->bufferToClientPointerMap[currentlyBoundBuffer] = data;
+    BufferRangeData& mapped = GetCurTraceContext(tid)->bufferToClientPointerMap[currentlyBoundBuffer];
+    if (mapped.tracked)
+    {
+        gWriteTracker.untrack(mapped.base);
+    }
+    mapped = data;
 
     if (data.access == GL_WRITE_ONLY)
     {
-        std::vector<unsigned char>& contents = GetCurTraceContext(tid)->bufferToClientPointerMap[currentlyBoundBuffer].contents;
+        std::vector<unsigned char>& contents = mapped.contents;
         BufferInitializedSet_t &bufInitSet = GetCurTraceContext(tid)->bufferInitializedSet;
         if (bufInitSet.find(currentlyBoundBuffer) != bufInitSet.end())
         {
-            unsigned char* bufdata = static_cast<unsigned char*>(base);
-            contents.assign(bufdata, bufdata + length);
+            // or only the pages the application writes to, see WriteTracker
+            mapped.tracked = tracerParams.TrackMappedWrites && (unsigned)length >= CSB_PATCH_MIN_BUFFER_SIZE
+                             && gWriteTracker.track(base, length);
+            if (!mapped.tracked)
+            {
+                unsigned char* bufdata = static_cast<unsigned char*>(base);
+                contents.assign(bufdata, bufdata + length);
+            }
         }
         else
         {
@@ -541,6 +958,7 @@ void after_glMapBufferRange(GLenum target, GLsizeiptr length, GLbitfield access,
 
 void pre_glFlushMappedBufferRange(GLenum target, GLintptr offset, GLsizeiptr length)
 {
+    OverheadTimer timer(OVERHEAD_CLIENT_SIDE_BUFFER);
     unsigned char tid = GetThreadId();
     BufferToClientPointerMap_t& map = GetCurTraceContext(tid)->bufferToClientPointerMap;
 
@@ -564,17 +982,10 @@ void pre_glFlushMappedBufferRange(GLenum target, GLintptr offset, GLsizeiptr len
     }
 }
 
-static const unsigned int CSB_PATCH_MIN_BUFFER_SIZE = 0x8000; // 32kB
-static const unsigned int CSB_PATCH_PAGE_SIZE = 0x400; // 1kB
-static const float CSB_PATCH_UP_THRESHOLD = 0.8;
-static bool genCSBPatchList(GLenum target, const void* old_data, const void* new_data, unsigned int length)
+static bool genCSBPatchList(GLenum target, const BufferRangeData& data)
 {
-    const unsigned char* old_ptr = static_cast<const unsigned char*>(old_data);
-    const unsigned char* new_ptr = static_cast<const unsigned char*>(new_data);
-    unsigned int page_num = 0;
-    unsigned int remain_data_length = length;
-    std::vector<unsigned int> dirty_page_list;
-
+    OverheadTimer timer(OVERHEAD_PATCH_LIST);
+    const unsigned int length = data.length;
     if (length < CSB_PATCH_MIN_BUFFER_SIZE)
     {
         // skip for small buffers
@@ -582,60 +993,24 @@ static bool genCSBPatchList(GLenum target, const void* old_data, const void* new
         return false;
     }
 
-    while(remain_data_length > 0)
-    {
-        unsigned int cmp_size = remain_data_length > CSB_PATCH_PAGE_SIZE ? CSB_PATCH_PAGE_SIZE : remain_data_length;
-        if (memcmp(old_ptr, new_ptr, cmp_size))
-        {
-            dirty_page_list.push_back(page_num);
-        }
-        remain_data_length -= cmp_size;
-        page_num++;
-        old_ptr += cmp_size;
-        new_ptr += cmp_size;
-    }
-
-    if ((dirty_page_list.size() * CSB_PATCH_PAGE_SIZE) > (length * CSB_PATCH_UP_THRESHOLD))
+    static thread_local std::vector<CSBPatch> patches; // reused between unmaps
+    patches.clear();
+    const bool found = data.tracked ? gWriteTracker.dirtySpans(data.base, length * CSB_PATCH_UP_THRESHOLD, patches)
+                                    : findDirtySpans(data.contents.data(), data.base, length, length * CSB_PATCH_UP_THRESHOLD, patches);
+    if (!found)
     {
         // too many dirty area so fall back on full copy
-        //DBG_LOG("INFO: %d dirty area are found for buffer length %d, that is too many dirty area for patch so skip it\n", dirty_area_count, length);
+        //DBG_LOG("INFO: too many dirty areas are found for buffer length %d, skip patching\n", length);
         return false;
     }
 
-    //DBG_LOG("INFO: PatchCSB is enabled with buffer size %d, dirty area count %d!\n", length, dirty_area_count);
-
-    // calc patch list buffer size
-    unsigned int patch_buf_size = sizeof(CSBPatchList) + (sizeof(CSBPatch) + CSB_PATCH_PAGE_SIZE) * dirty_page_list.size();
-    unsigned char* patch_buf = new unsigned char[patch_buf_size];
-    unsigned char* patch_buf_ptr = patch_buf;
-    CSBPatchList pl;
-
-    pl.count = dirty_page_list.size();
-    memcpy(patch_buf_ptr, &pl, sizeof(pl));
-
-    patch_buf_ptr += sizeof(pl);
-
-    for (size_t i = 0; i < dirty_page_list.size(); i++)
-    {
-        CSBPatch patch;
-        patch.offset = CSB_PATCH_PAGE_SIZE * dirty_page_list[i];
-        patch.length = (patch.offset + CSB_PATCH_PAGE_SIZE) > length ? (length - patch.offset) : (CSB_PATCH_PAGE_SIZE);
-
-        memcpy(patch_buf_ptr, &patch, sizeof(patch));
-        patch_buf_ptr += sizeof(patch);
-        memcpy(patch_buf_ptr, ((unsigned char*)new_data + patch.offset), patch.length);
-        patch_buf_ptr += patch.length;
-    }
-
-    _glPatchClientSideBuffer(target, patch_buf_size, patch_buf);
-
-    delete[] patch_buf;
-
+    _glPatchClientSideBuffer(target, data.base, patches);
     return true;
 }
 
 void pre_glUnmapBuffer(GLenum target)
 {
+    OverheadTimer timer(OVERHEAD_CLIENT_SIDE_BUFFER);
     unsigned char tid = GetThreadId();
     BufferToClientPointerMap_t& map = GetCurTraceContext(tid)->bufferToClientPointerMap;
 
@@ -653,7 +1028,7 @@ void pre_glUnmapBuffer(GLenum target)
             BufferInitializedSet_t &bufInitSet = GetCurTraceContext(tid)->bufferInitializedSet;
             if (data.access == GL_WRITE_ONLY && bufInitSet.find(currentlyBoundBuffer) != bufInitSet.end())
             {
-                hasPatch = genCSBPatchList(target, data.contents.data(), data.base, data.length);
+                hasPatch = genCSBPatchList(target, data);
             }
 
             if (!hasPatch)
@@ -670,6 +1045,11 @@ void pre_glUnmapBuffer(GLenum target)
                 _glCopyClientSideBuffer(target, name);
             }
         }
+        if (data.tracked)
+        {
+            gWriteTracker.untrack(data.base); // before the driver unmaps it
+            data.tracked = false;
+        }
     }
     if (GetCurTraceContext(tid)->isFullMapping)
     {
@@ -752,7 +1132,19 @@ bool pre_glLinkProgram(unsigned char tid, unsigned int program)
     }
 
     // 1. link the 'program' in order to figure out its active vertex attributes
-    _glLinkProgram(program);
+    ShaderList shaders;
+    const std::string md5 = attachedShaderSources(program, shaders);
+    if (gProgramBinaryCache.isOpen() && !md5.empty())
+    {
+        gProgramBinaryCache.link(program, md5, shaders);
+    }
+    else
+    {
+        _glLinkProgram(program);
+    }
+    TraceContext* ctx = GetCurTraceContext(tid);
+    ctx->programReflection.erase(program);
+    ctx->programAttribMask.erase(program);
     GLint success = GL_TRUE;
     _glGetProgramiv(program, GL_LINK_STATUS, &success);
     if (success == GL_FALSE)
@@ -769,22 +1161,19 @@ bool pre_glLinkProgram(unsigned char tid, unsigned int program)
         else DBG_LOG("Link failure program %u - no error log available\n", program);
     }
 
-    // 2. figure out the number of the active vertex attributes
-    GLint attribCnt = 0;
-    _glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &attribCnt);
+    // 2. figure out the active vertex attributes, unless a program of the same sources was linked before
+    std::shared_ptr<const ProgramReflection> reflection = gProgramReflectionCache.get(program, md5);
+    ctx->programReflection[program] = reflection;
 
     GLint maxVertexAttribs = 0;
     _glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &maxVertexAttribs);
 
     // 3. Go through each active vertex attributes, to see if it has already been explicitly given an index by the
     //    application. Otherwise, we'll assign one index for it explicitly!
-    for (int itAttrib = 0; itAttrib < attribCnt; ++itAttrib)
+    unsigned int attribMask = 0;
+    for (const ProgramReflection::Variable& attrib : reflection->attributes)
     {
-        GLchar  attribName[128];
-        GLint   attribSize = 0;
-        GLenum  attribType = 0;
-        _glGetActiveAttrib(program, itAttrib, 128, 0, &attribSize, &attribType, attribName);
-        GLint attribLoc = _glGetAttribLocation(program, attribName);
+        GLint attribLoc = _glGetAttribLocation(program, attrib.name.c_str());
 
         // glGetAttribLocation returns locations >= maxVertexAttribs for built-in
         // attributes, such that gl_VertexID. According to spec they should be -1.
@@ -792,9 +1181,14 @@ bool pre_glLinkProgram(unsigned char tid, unsigned int program)
         // That is why we need to check that attribLocation < maxVertexAttribs
         if (attribLoc >= 0 && attribLoc < maxVertexAttribs)
         {
-            glBindAttribLocation(program, attribLoc, attribName);
+            glBindAttribLocation(program, attribLoc, attrib.name.c_str());
+        }
+        if (attribLoc >= 0 && attribLoc < 32)
+        {
+            attribMask |= (numBits(numLocations(attrib.type)) << attribLoc);
         }
     }
+    ctx->programAttribMask[program] = attribMask;
     return true;
 }
 
@@ -813,6 +1207,8 @@ void after_glDeleteProgram(unsigned char tid, GLuint program)
     else {
          mapPrgToBoundAttribs.erase(it);
     }
+    GetCurTraceContext(tid)->programReflection.erase(program);
+    GetCurTraceContext(tid)->programAttribMask.erase(program);
 }
 
 static bool TakeSnapshot(int frNoOverride = -1)
@@ -862,70 +1258,57 @@ void after_glDraw()
 
 void after_glLinkProgram(unsigned int program)
 {
-    ProgramInfo pi(program);
     unsigned char tid = GetThreadId();
+    std::shared_ptr<const ProgramReflection> reflection;
+    auto found = GetCurTraceContext(tid)->programReflection.find(program);
+    if (found != GetCurTraceContext(tid)->programReflection.end())
+    {
+        reflection = found->second;
+    }
+    else
+    {
+        reflection = gProgramReflectionCache.get(program, std::string()); // not linked by pre_glLinkProgram()
+    }
     StringListList_t& aa = gTraceThread.at(tid).mActiveAttributes;
 
     // 1. Add empty list
     aa.push_back(StringList_t());
     // 2. Get its reference
     StringList_t& aaList = aa.back();
-    for (int i = 0; i < pi.activeAttributes; ++i)
+    for (const ProgramReflection::Variable& attrib : reflection->attributes)
     {
-        VertexArrayInfo vai = pi.getActiveAttribute(i);
         // 3. Add stuff to it
-        aaList.push_back(vai.name);
+        aaList.push_back(attrib.name.empty() ? "<built-in>" : attrib.name);
     }
 
     // Inject glGetUniformBlockIndex calls to be sure we can intercept and remap block indices on retrace
-    GLint linkStatus = GL_FALSE;
-    _glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus == GL_FALSE)
+    if (!reflection->linked)
     {
         return; // skip rest
     }
-    GLint activeUniformBlocks = 0;
-    _glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &activeUniformBlocks);
-    for (int i = 0; i < activeUniformBlocks; ++i)
+    for (const std::string& block : reflection->uniformBlocks)
     {
-        char cname[128];
-        _glGetActiveUniformBlockName(program, i, sizeof(cname), NULL, cname);
-        GLuint retval = glGetUniformBlockIndex(program, cname); // injected call
+        GLuint retval = glGetUniformBlockIndex(program, block.c_str()); // injected call
         if (retval == GL_INVALID_INDEX)
         {
-            DBG_LOG("INVALID INDEX injecting block lookup for %s in program %u!\n", cname, program);
+            DBG_LOG("INVALID INDEX injecting block lookup for %s in program %u!\n", block.c_str(), program);
         }
     }
 
     // Inject glGetUniformLocation calls to be sure we can intercept and remap uniform indices on retrace
-    GLint activeUniforms = 0;
-    _glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &activeUniforms);
-    for (GLuint i = 0; activeUniforms > 0 && i < static_cast<GLuint>(activeUniforms); ++i)
+    for (const ProgramReflection::Variable& uniform : reflection->uniforms)
     {
-        char cname[128];
-        GLint size = 0;
-        GLenum type = 0;
-        GLint block = 0;
-        _glGetActiveUniformsiv(program, 1, &i, GL_UNIFORM_BLOCK_INDEX, &block);
-        if (block != -1)
-        {
-            continue; // is inside uniform block, handled above
-        }
-        _glGetActiveUniform(program, i, sizeof(cname), NULL, &size, &type, cname);
-        if (type == GL_UNSIGNED_INT_ATOMIC_COUNTER)
-        {
-            continue; // is atomic counter, cannot be location'ed since it must be explicitly bound
-        }
+        const char* cname = uniform.name.c_str();
         GLint retval = glGetUniformLocation(program, cname); // injected call
         if (retval == -1)
         {
             DBG_LOG("Error injecting location lookup for %s in program %u!\n", cname, program);
         }
-        if (size > 1) { // This is an array, we need to inject glGetUniformLocation calls for all its elements
+        if (uniform.size > 1) { // This is an array, we need to inject glGetUniformLocation calls for all its elements
             string s(cname);
             int first_digit_id = s.find_first_of('[');
             s = s.substr(0, first_digit_id + 1);
-            for (int i = 1; i < size; ++i) {
+            for (int i = 1; i < uniform.size; ++i) {
                 stringstream istring;
                 istring << i;
                 GLint retval = glGetUniformLocation(program, (s + istring.str() + ']').c_str()); // injected call
@@ -942,6 +1325,18 @@ void after_eglInitialize(EGLDisplay dpy)
 {
     gTraceOut->mpBinAndMeta->saveAllEGLConfigs(dpy);
     gTraceOut->mpBinAndMeta->writeHeader(false);
+    if (!tracerParams.ProgramBinaryCache.empty() && !gProgramBinaryCache.isOpen())
+    {
+        gProgramBinaryCache.open(tracerParams.ProgramBinaryCache);
+    }
+    if (!tracerParams.ProgramReflectionCache.empty() && !gProgramReflectionCache.isOpen())
+    {
+        gProgramReflectionCache.open(tracerParams.ProgramReflectionCache);
+    }
+    if (tracerParams.TrackMappedWrites)
+    {
+        gWriteTracker.init();
+    }
 }
 
 void after_eglCreateWindowSurface(EGLDisplay dpy, EGLConfig config, EGLSurface surf, EGLint x, EGLint y, EGLint width, EGLint height)
@@ -1035,13 +1430,26 @@ void after_eglMakeCurrent(EGLDisplay dpy, EGLSurface drawSurf, EGLContext ctx)
     SetGLESVersion(traceCtx->profile);
     gTraceOut->mpBinAndMeta->saveExtensions();
 
-    if (!tracerParams.DisableErrorReporting)
+    const bool debugErrorCheck = tracerParams.EnableErrorCheck && tracerParams.ErrorCheckDebugCallback;
+    if (!tracerParams.DisableErrorReporting || debugErrorCheck)
     {
         _glDebugMessageCallback(callback, 0);
         _glEnable(GL_DEBUG_OUTPUT_KHR);
         // disable notifications -- they generate too much spam on some systems
         _glDebugMessageControlKHR(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION_KHR, 0, NULL, GL_FALSE);
     }
+    if (debugErrorCheck)
+    {
+        // errors must be reported from within the call that raised them
+        _glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
+        gTraceThread.at(tid).mDebugCallbackActive = _glIsEnabled(GL_DEBUG_OUTPUT_KHR) && _glIsEnabled(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
+        gTraceThread.at(tid).mDebugErrorPending = false;
+        if (!gTraceThread.at(tid).mDebugCallbackActive)
+        {
+            _glGetError(); // from the failed glEnable
+            DBG_LOG("No synchronous KHR_debug output, falling back to ErrorCheckInterval\n");
+        }
+    }
 
     int gles_version_major = gGlesFeatures.glesVersion() / 100;
     if (gles_version_major >= 2)
@@ -1098,6 +1506,12 @@ void pre_eglSwapBuffers()
             // Always return from snap all frames
             return;
 
+        } else if (cmd.cmd == DUMP_FLIGHT_RECORDER) {
+            if (gTraceOut->frameNo >= cmd.frameNo && gTraceOut->mpBinAndMeta) {
+                gTraceOut->mpBinAndMeta->triggerFlightRecorder("tracercmd.cfg");
+            }
+            return;
+
         } else {
             DBG_LOG("Cmd:%s, fr:%d\n", cmd.nameCString, cmd.frameNo);
             // Check if its time to apply command
@@ -1120,9 +1534,8 @@ void pre_eglSwapBuffers()
     }
 }
 
-void insert_glBindTexture(GLenum target, GLuint texture, int tid)
+static char* insert_glBindTexture(char* dest, GLenum target, GLuint texture, int tid)
 {
-    char* dest = gTraceOut->writebuf;
     BCall *pCall = (BCall*)dest;
     pCall->funcId = glBindTexture_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1131,13 +1544,13 @@ void insert_glBindTexture(GLenum target, GLuint texture, int tid)
     dest = WriteFixed<int>(dest, target); // enum
     dest = WriteFixed<unsigned int>(dest, texture); // literal
     pCall->errNo = GetCallErrorNo("glBindTexture", tid);
-    gTraceOut->WriteBuf(dest);
-    gTraceOut->callNo++;
+    return dest;
 }
 
-void insert_glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid * pixels, int tid)
+static char* insert_glTexImage2D(char* dest, GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid * pixels, int tid)
 {
-    char* dest = gTraceOut->writebuf;
+    char* const starting_point = dest;
+    const size_t starting_deferred = gTraceOut->deferredBytes(tid);
     BCall_vlen *pCall2 = (BCall_vlen*)dest;
     pCall2->funcId = glTexImage2D_id;
     pCall2->tid = tid; pCall2->reserved = 0;
@@ -1152,11 +1565,10 @@ void insert_glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsiz
     dest = WriteFixed<int>(dest, format); // enum
     dest = WriteFixed<int>(dest, type); // enum
     dest = WriteFixed<unsigned int>(dest, BlobType);
-    dest = Write1DArray<char>(dest, (unsigned int)_glTexImage2D_size(format, type, width, height), (const char*)pixels);
+    dest = gTraceOut->Write1DArrayDeferred<char>(tid, dest, (unsigned int)_glTexImage2D_size(format, type, width, height), (const char*)pixels);
     pCall2->errNo = GetCallErrorNo("glTexImage2D", tid);
-    pCall2->toNext = dest-gTraceOut->writebuf;
-    gTraceOut->WriteBuf(dest);
-    gTraceOut->callNo++;
+    pCall2->toNext = dest - starting_point + gTraceOut->deferredBytes(tid) - starting_deferred;
+    return dest;
 }
 
 GLuint pre_eglCreateImageKHR(EGLImageKHR image, EGLenum target, EGLClientBuffer buffer, const EGLint *attrib_list)
@@ -1216,12 +1628,12 @@ GLuint pre_eglCreateImageKHR(EGLImageKHR image, EGLenum target, EGLClientBuffer
     glGenTextures(1, &textureId);
 
     unsigned char tid = GetThreadId();
-    gTraceOut->callMutex.lock();
-
-    insert_glBindTexture(GL_TEXTURE_2D, textureId, tid);
-    insert_glTexImage2D(GL_TEXTURE_2D, level, internalformat, width, height, border, format, type, pixels, tid);
-    insert_glBindTexture(GL_TEXTURE_2D, oldBoundTexture, tid);
-    gTraceOut->callMutex.unlock();
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
+    dest = insert_glBindTexture(dest, GL_TEXTURE_2D, textureId, tid);
+    dest = insert_glTexImage2D(dest, GL_TEXTURE_2D, level, internalformat, width, height, border, format, type, pixels, tid);
+    dest = insert_glBindTexture(dest, GL_TEXTURE_2D, oldBoundTexture, tid);
+    gTraceOut->WriteBuf(writebuf, dest, 3);
 
     // Delete image data
     _EGLImageKHR_free_image_info(info);
@@ -1291,11 +1703,12 @@ GLuint pre_glEGLImageTargetTexture2DOES(EGLImageKHR image, EGLint *&attrib_list)
     else {
         textureId = iter->second;
     }
-    gTraceOut->callMutex.lock();
-    insert_glBindTexture(GL_TEXTURE_2D, textureId, tid);
-    insert_glTexImage2D(GL_TEXTURE_2D, level, internalformat, width, height, border, format, type, pixels, tid);
-    insert_glBindTexture(GL_TEXTURE_2D, oldBoundTexture, tid);
-    gTraceOut->callMutex.unlock();
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
+    dest = insert_glBindTexture(dest, GL_TEXTURE_2D, textureId, tid);
+    dest = insert_glTexImage2D(dest, GL_TEXTURE_2D, level, internalformat, width, height, border, format, type, pixels, tid);
+    dest = insert_glBindTexture(dest, GL_TEXTURE_2D, oldBoundTexture, tid);
+    gTraceOut->WriteBuf(writebuf, dest, 3);
 
     // Delete image data
     _EGLImageKHR_free_image_info(info);
@@ -1331,11 +1744,22 @@ void updateUsage(GLenum target)
 
 void after_eglSwapBuffers()
 {
+    const std::vector<long long> cpu = gTracerOverhead.endFrame();
+    if (gTraceOut->mpBinAndMeta)
+    {
+        gTraceOut->mpBinAndMeta->updateFlightRecorder(gTraceOut->frameNo);
+        gTraceOut->mpBinAndMeta->recordFrameInterval(gTraceOut->frameNo);
+        if (tracerParams.FrameTimings)
+        {
+            gTraceOut->mpBinAndMeta->recordFrameTiming(gTraceOut->frameNo, cpu);
+        }
+    }
     if (tracerParams.FlushTraceFileEveryFrame)
     {
         gTraceOut->mpBinAndMeta->writeHeader(true);
     }
     gTraceOut->frameNo++;
+    gTraceOut->updateCaptureArmed();
 }
 
 void after_eglDestroySurface(EGLSurface surf)
@@ -1369,8 +1793,8 @@ void after_eglDestroySurface(EGLSurface surf)
 void _glVertexPointer_fake(GLint size, GLenum type, GLsizei stride, const GLvoid * pointer, unsigned int _size)
 {
     unsigned char tid = GetThreadId();
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall_vlen *pCall = (BCall_vlen*)dest;
     pCall->funcId = glVertexPointer_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1381,18 +1805,17 @@ void _glVertexPointer_fake(GLint size, GLenum type, GLsizei stride, const GLvoid
     dest = WriteFixed<int>(dest, type); // enum
     dest = WriteFixed<int>(dest, stride); // literal
     dest = WriteFixed<unsigned int>(dest, 1); // IS *BLOB*
-    dest = Write1DArray<char>(dest, _size, (char*)pointer); // opaque -> blob
+    dest = gTraceOut->Write1DArrayDeferred<char>(tid, dest, _size, (char*)pointer); // opaque -> blob
     pCall->errNo = GetCallErrorNo("glVertexPointer", tid);
-    pCall->toNext = dest-gTraceOut->writebuf;
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    pCall->toNext = dest - writebuf + gTraceOut->deferredBytes(tid);
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 
 void _glNormalPointer_fake(GLenum type, GLsizei stride, const GLvoid * pointer, unsigned int _size)
 {
     unsigned char tid = GetThreadId();
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall_vlen *pCall = (BCall_vlen*)dest;
     pCall->funcId = glNormalPointer_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1402,18 +1825,17 @@ void _glNormalPointer_fake(GLenum type, GLsizei stride, const GLvoid * pointer,
     dest = WriteFixed<int>(dest, type); // enum
     dest = WriteFixed<int>(dest, stride); // literal
     dest = WriteFixed<unsigned int>(dest, 1); // IS *BLOB*
-    dest = Write1DArray<char>(dest, _size, (char*)pointer); // opaque -> blob
+    dest = gTraceOut->Write1DArrayDeferred<char>(tid, dest, _size, (char*)pointer); // opaque -> blob
     pCall->errNo = GetCallErrorNo("glNormalPointer", tid);
-    pCall->toNext = dest-gTraceOut->writebuf;
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    pCall->toNext = dest - writebuf + gTraceOut->deferredBytes(tid);
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 
 void _glColorPointer_fake(GLint size, GLenum type, GLsizei stride, const GLvoid * pointer, unsigned int _size)
 {
     unsigned char tid = GetThreadId();
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall_vlen *pCall = (BCall_vlen*)dest;
     pCall->funcId = glColorPointer_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1424,17 +1846,16 @@ void _glColorPointer_fake(GLint size, GLenum type, GLsizei stride, const GLvoid
     dest = WriteFixed<int>(dest, type); // enum
     dest = WriteFixed<int>(dest, stride); // literal
     dest = WriteFixed<unsigned int>(dest, 1); // IS *BLOB*
-    dest = Write1DArray<char>(dest, _size, (char*)pointer); // opaque -> blob
+    dest = gTraceOut->Write1DArrayDeferred<char>(tid, dest, _size, (char*)pointer); // opaque -> blob
     pCall->errNo = GetCallErrorNo("glColorPointer", tid);
-    pCall->toNext = dest-gTraceOut->writebuf;
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    pCall->toNext = dest - writebuf + gTraceOut->deferredBytes(tid);
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 
 void _glTexCoordPointer_fake(GLint size, GLenum type, GLsizei stride, const GLvoid * pointer, unsigned int _size){
     unsigned char tid = GetThreadId();
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall_vlen *pCall = (BCall_vlen*)dest;
     pCall->funcId = glTexCoordPointer_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1445,19 +1866,18 @@ void _glTexCoordPointer_fake(GLint size, GLenum type, GLsizei stride, const GLvo
     dest = WriteFixed<int>(dest, type); // enum
     dest = WriteFixed<int>(dest, stride); // literal
     dest = WriteFixed<unsigned int>(dest, 1); // IS *BLOB*
-    dest = Write1DArray<char>(dest, _size, (char*)pointer); // opaque -> blob
+    dest = gTraceOut->Write1DArrayDeferred<char>(tid, dest, _size, (char*)pointer); // opaque -> blob
     pCall->errNo = GetCallErrorNo("glTexCoordPointer", tid);
-    pCall->toNext = dest-gTraceOut->writebuf;
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    pCall->toNext = dest - writebuf + gTraceOut->deferredBytes(tid);
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 
 #if ENABLE_CLIENT_SIDE_BUFFER
 void _glVertexAttribPointer_fake(const VertexAttributeMemoryMerger::AttributeInfo *ai, unsigned int name)
 {
     unsigned char tid = GetThreadId();
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall_vlen *pCall = (BCall_vlen*)dest;
     pCall->funcId = glVertexAttribPointer_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1473,17 +1893,16 @@ void _glVertexAttribPointer_fake(const VertexAttributeMemoryMerger::AttributeInf
     dest = WriteFixed<unsigned int>(dest, (unsigned int)(name));
     dest = WriteFixed<unsigned int>(dest, (unsigned int)(ai->offset));
     pCall->errNo = GetCallErrorNo("glVertexAttribPointer", tid);
-    pCall->toNext = dest-gTraceOut->writebuf;
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    pCall->toNext = dest-writebuf;
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 #else
 void _glVertexAttribPointer_fake(GLuint index, GLint size, GLenum type, GLboolean normalized,
     GLsizei stride, const GLvoid *pointer, GLint _size)
 {
     unsigned char tid = GetThreadId();
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall_vlen *pCall = (BCall_vlen*)dest;
     pCall->funcId = glVertexAttribPointer_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1495,18 +1914,17 @@ void _glVertexAttribPointer_fake(GLuint index, GLint size, GLenum type, GLboolea
     dest = WriteFixed<int>(dest, type); // enum
     dest = WriteFixed<int>(dest, normalized); // enum
     dest = WriteFixed<int>(dest, stride); // literal
-    dest = Write1DArray<char>(dest, (unsigned int)_size, (const char*)pointer); // blob
+    dest = gTraceOut->Write1DArrayDeferred<char>(tid, dest, (unsigned int)_size, (const char*)pointer); // blob
     pCall->errNo = GetCallErrorNo("glVertexAttribPointer", tid);
-    pCall->toNext = dest-gTraceOut->writebuf;
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    pCall->toNext = dest - writebuf + gTraceOut->deferredBytes(tid);
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 #endif
 
 void _glClientActiveTexture_fake(GLenum texture){
     unsigned char tid = GetThreadId();
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall *pCall = (BCall*)dest;
     pCall->funcId = glClientActiveTexture_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1515,8 +1933,7 @@ void _glClientActiveTexture_fake(GLenum texture){
     // _glClientActiveTexture(texture);
     dest = WriteFixed<int>(dest, texture); // enum
     pCall->errNo = GetCallErrorNo("glClientActiveTexture", tid);
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 
 #if ENABLE_CLIENT_SIDE_BUFFER
@@ -1526,8 +1943,8 @@ ClientSideBufferObjectName _glCreateClientSideBuffer()
     const unsigned char tid = GetThreadId();
     const ClientSideBufferObjectName name = gTraceOut->mCSBufferSet.create_object(tid);
 
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall *pCall = (BCall*)dest;
     pCall->funcId = glCreateClientSideBuffer_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1535,8 +1952,7 @@ ClientSideBufferObjectName _glCreateClientSideBuffer()
 
     dest = WriteFixed<unsigned int>(dest, name); // literal
     pCall->errNo = GetCallErrorNo("glCreateClientSideBuffer", tid);
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    gTraceOut->WriteBuf(writebuf, dest);
     return name;
 }
 
@@ -1545,8 +1961,8 @@ void _glDeleteClientSideBuffer(ClientSideBufferObjectName name)
     const unsigned char tid = GetThreadId();
     gTraceOut->mCSBufferSet.delete_object(tid, name);
 
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall *pCall = (BCall*)dest;
     pCall->funcId = glDeleteClientSideBuffer_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1554,16 +1970,15 @@ void _glDeleteClientSideBuffer(ClientSideBufferObjectName name)
 
     dest = WriteFixed<unsigned int>(dest, name); // literal
     pCall->errNo = GetCallErrorNo("glDeleteClientSideBuffer", tid);
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 
 void _glCopyClientSideBuffer(GLenum target, ClientSideBufferObjectName name)
 {
     const unsigned char tid = GetThreadId();
 
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall *pCall = (BCall*)dest;
     pCall->funcId = glCopyClientSideBuffer_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1572,16 +1987,21 @@ void _glCopyClientSideBuffer(GLenum target, ClientSideBufferObjectName name)
     dest = WriteFixed<int>(dest, target); // enum
     dest = WriteFixed<unsigned int>(dest, name); // literal
     pCall->errNo = GetCallErrorNo("glCopyClientSideBuffer", tid);
-    gTraceOut->Write(gTraceOut->writebuf, dest - gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 
-void _glPatchClientSideBuffer(GLenum target, int length, const void *data)
+void _glPatchClientSideBuffer(GLenum target, const void *data, const std::vector<CSBPatch>& patches)
 {
     const unsigned char tid = GetThreadId();
 
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    unsigned int length = sizeof(CSBPatchList);
+    for (const CSBPatch& patch : patches)
+    {
+        length += sizeof(CSBPatch) + patch.length;
+    }
+
+    char* const writebuf = gTraceOut->threadBuffer(tid, length);
+    char* dest = writebuf;
     BCall_vlen *pCall = (BCall_vlen*)dest;
     pCall->funcId = glPatchClientSideBuffer_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1589,11 +2009,23 @@ void _glPatchClientSideBuffer(GLenum target, int length, const void *data)
 
     dest = WriteFixed<int>(dest, target); // enum
     dest = WriteFixed<int>(dest, length); // literal
-    dest = Write1DArray<GLubyte>(dest, (unsigned int)(length), (const GLubyte *)(data)); // array
+    // the patch list is written straight into the call as a byte array, see Write1DArray()
+    dest = WriteFixed<unsigned int>(dest, length);
+    CSBPatchList pl;
+    pl.count = patches.size();
+    memcpy(dest, &pl, sizeof(pl));
+    dest += sizeof(pl);
+    for (const CSBPatch& patch : patches)
+    {
+        memcpy(dest, &patch, sizeof(patch));
+        dest += sizeof(patch);
+        memcpy(dest, static_cast<const unsigned char*>(data) + patch.offset, patch.length);
+        dest += patch.length;
+    }
+    dest = padwrite(dest);
     pCall->errNo = GetCallErrorNo("glPatchClientSideBuffer", tid);
-    pCall->toNext = dest-gTraceOut->writebuf;
-    gTraceOut->Write(gTraceOut->writebuf, dest - gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    pCall->toNext = dest-writebuf;
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 
 void _glClientSideBufferData(ClientSideBufferObjectName name,
@@ -1602,8 +2034,8 @@ void _glClientSideBufferData(ClientSideBufferObjectName name,
     const unsigned char tid = GetThreadId();
     gTraceOut->mCSBufferSet.object_data(tid, name, length, data);
 
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall_vlen *pCall = (BCall_vlen*)dest;
     pCall->funcId = glClientSideBufferData_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1611,11 +2043,10 @@ void _glClientSideBufferData(ClientSideBufferObjectName name,
 
     dest = WriteFixed<unsigned int>(dest, name); // literal
     dest = WriteFixed<int>(dest, length); // literal
-    dest = Write1DArray<GLubyte>(dest, (unsigned int)(length), (const GLubyte *)(data)); // array
+    dest = gTraceOut->Write1DArrayDeferred<GLubyte>(tid, dest, (unsigned int)(length), (const GLubyte *)(data)); // array
     pCall->errNo = GetCallErrorNo("glClientSideBufferData", tid);
-    pCall->toNext = dest-gTraceOut->writebuf;
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    pCall->toNext = dest - writebuf + gTraceOut->deferredBytes(tid);
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 
 void _glClientSideBufferSubData(ClientSideBufferObjectName name,
@@ -1624,8 +2055,8 @@ void _glClientSideBufferSubData(ClientSideBufferObjectName name,
     const unsigned char tid = GetThreadId();
     gTraceOut->mCSBufferSet.object_subdata(tid, name, offset, length, data);
 
-    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
-    char* dest = gTraceOut->writebuf;
+    char* const writebuf = gTraceOut->threadBuffer(tid);
+    char* dest = writebuf;
     BCall_vlen *pCall = (BCall_vlen*)dest;
     pCall->funcId = glClientSideBufferSubData_id;
     pCall->tid = tid; pCall->reserved = 0;
@@ -1634,11 +2065,10 @@ void _glClientSideBufferSubData(ClientSideBufferObjectName name,
     dest = WriteFixed<unsigned int>(dest, name); // literal
     dest = WriteFixed<int>(dest, offset); // literal
     dest = WriteFixed<int>(dest, length); // literal
-    dest = Write1DArray<GLubyte>(dest, (unsigned int)(length), (const GLubyte *)(data)); // array
+    dest = gTraceOut->Write1DArrayDeferred<GLubyte>(tid, dest, (unsigned int)(length), (const GLubyte *)(data)); // array
     pCall->errNo = GetCallErrorNo("glClientSideBufferSubData", tid);
-    pCall->toNext = dest-gTraceOut->writebuf;
-    gTraceOut->Write(gTraceOut->writebuf, dest-gTraceOut->writebuf);
-    gTraceOut->callNo++;
+    pCall->toNext = dest - writebuf + gTraceOut->deferredBytes(tid);
+    gTraceOut->WriteBuf(writebuf, dest);
 }
 
 ClientSideBufferObjectName _getOrCreateClientSideBuffer(const ClientSideBufferObject& obj, bool& created)
@@ -1685,11 +2115,78 @@ ClientSideBufferObjectName _glClientSideBufferData(const void *p, ptrdiff_t size
 
 #endif
 
+// Client-side index arrays are mostly the same few arrays drawn over and over, so the largest
+// index of each is remembered by the digest that looking up its client-side buffer needs anyway.
+struct IndexScanKey
+{
+    ContentDigest digest;
+    ptrdiff_t size;
+    GLenum type;
+    bool restart;
+
+    bool operator==(const IndexScanKey &other) const
+    {
+        return size == other.size && type == other.type && restart == other.restart && digest == other.digest;
+    }
+};
+
+struct IndexScanKeyHash
+{
+    size_t operator()(const IndexScanKey &key) const
+    {
+        // the digest is already well mixed
+        size_t hash;
+        memcpy(&hash, static_cast<const unsigned char*>(key.digest), sizeof(hash));
+        return hash ^ static_cast<size_t>(key.size) ^ (static_cast<size_t>(key.type) << 1) ^ key.restart;
+    }
+};
+
+// more distinct index arrays than this and the cache starts over
+static const size_t INDEX_SCAN_CACHE_SIZE = 4096;
+
+GLuint _client_side_index_count(const ClientSideBufferObject &indices, GLsizei count, GLenum type, GLint basevertex)
+{
+    if (!count)
+    {
+        return 0;
+    }
+    if (!indices.base_address)
+    {
+        DBG_LOG("ERROR: No index buffer bound, and no index pointer set for draw call!\n");
+        return 0;
+    }
+
+    const bool restart = _glIsEnabled(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+    while ((_glGetError() == GL_INVALID_ENUM)) ;
+
+    static thread_local std::unordered_map<IndexScanKey, GLuint, IndexScanKeyHash> cache;
+    const IndexScanKey key = { indices.digest(), indices.size, type, restart };
+    auto it = cache.find(key);
+    if (it == cache.end())
+    {
+        if (cache.size() >= INDEX_SCAN_CACHE_SIZE)
+        {
+            cache.clear();
+        }
+        it = cache.emplace(key, _max_index(type, indices.base_address, count, restart)).first;
+    }
+    return it->second + basevertex + 1;
+}
+
 void GetActiveAttribIdx(GLint prg, unsigned int &flagArray)
 {
     const int MAX_VERTEX_ATTRIB_COUNT = 32;
     flagArray = 0x00000000;
 
+    // known since the program was linked, unless that was in another context
+    const TraceContext* ctx = GetCurTraceContext(GetThreadId());
+    auto it = ctx->programAttribMask.find(prg);
+    if (it != ctx->programAttribMask.end())
+    {
+        flagArray = it->second;
+        return;
+    }
+
     GLint attribCnt = 0;
     _glGetProgramiv(prg, GL_ACTIVE_ATTRIBUTES, &attribCnt);
 
@@ -1787,6 +2284,7 @@ bool _need_user_arrays()
 
 void _trace_user_arrays(int count, int instancecount)
 {
+    OverheadTimer timer(OVERHEAD_CLIENT_SIDE_BUFFER);
     unsigned char tid = GetThreadId();
 
     if (GetCurTraceContext(tid)->profile == 1) {
@@ -1893,7 +2391,8 @@ void _trace_user_arrays(int count, int instancecount)
     }
 
 #if ENABLE_CLIENT_SIDE_BUFFER
-    VertexAttributeMemoryMerger mbc;
+    static thread_local VertexAttributeMemoryMerger mbc; // reused, so that its storage is too
+    mbc.clear();
 #endif
     GLint _max_vertex_attribs = 0;
     _glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &_max_vertex_attribs);
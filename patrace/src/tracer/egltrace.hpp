@@ -3,6 +3,10 @@
 
 #include <tracer/tracerparams.hpp>
 #include "tracer/path.hpp"
+#include "tracer/overhead.hpp"
+#include "tracer/flight_recorder.hpp"
+#include "tracer/program_cache.hpp"
+#include "tracer/write_tracker.hpp"
 
 #include <dispatch/eglproc_auto.hpp>
 
@@ -13,6 +17,9 @@
 #include "common/memory.hpp"
 #include "helper/states.h"
 
+#include <array>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <map>
 #include <unordered_map>
@@ -34,9 +41,40 @@ public:
 
     inline void write(const void* buf, unsigned int len)
     {
-        traceFile->Write(buf, len);
+        if (mFlightRecorder)
+            mFlightRecorder->write(buf, len);
+        else
+            traceFile->Write(buf, len);
     }
 
+    /// Keep the next len bytes written together, see OutFile::Reserve()
+    inline void reserve(unsigned int len)
+    {
+        if (!mFlightRecorder)
+            traceFile->Reserve(len);
+    }
+
+    /// The next len bytes written are a blob to be encoded, see OutFile::EncodeNext(). The
+    /// flight recorder keeps them as they are.
+    inline void encodeNext(unsigned int len, common::BlobCodec codec)
+    {
+        if (!mFlightRecorder)
+            traceFile->EncodeNext(len, codec);
+    }
+
+    /// The calls written so far end a frame of thread tid, see OutFile::MarkFrame()
+    inline void markFrame(unsigned char tid, unsigned callCount)
+    {
+        traceFile->MarkFrame(tid, callCount);
+    }
+
+    /// Whatever is recording calls in flight recorder mode until it is triggered, or NULL
+    FlightRecorder* flightRecorder() { return mFlightRecorder.get(); }
+    /// Have the flight recorder write out its frames at the end of the current frame
+    void triggerFlightRecorder(const char* reason);
+    /// Check the flight recorder triggers at the end of a frame, before recordFrameInterval()
+    void updateFlightRecorder(unsigned frameNo);
+
     void saveExtensions();
     void saveAllEGLConfigs(EGLDisplay dpy);
     void updateWinSurfSize(EGLint width, EGLint height);
@@ -52,6 +90,37 @@ public:
 
     unsigned callCnt = 0;
     unsigned frameCnt = 0;
+    int captureStartFrame = -1; // frame that recording of rendering calls started at, if it was armed
+
+    /// Frames that get their interval recorded, to keep the header well within its size limit
+    static const unsigned MAX_FRAME_INTERVALS = 16384;
+    /// Record the time since the last swap as the interval of the given frame
+    void recordFrameInterval(unsigned frameNo);
+    std::vector<unsigned> frameIntervals; // microseconds from the previous swap to the swap ending each frame
+    long long lastSwapTime = 0;
+
+    /// Frames that get their timing recorded with FrameTimings, for the table to fit in the header
+    static const unsigned MAX_FRAME_TIMINGS = 8192;
+    /// Record when the given frame ended, and with FrameTimingsCpu the CPU time spent in GL and
+    /// EGL calls in it, from the totals of the OverheadCounters for the frame
+    void recordFrameTiming(unsigned frameNo, const std::vector<long long>& cpu);
+    struct FrameTiming
+    {
+        uint64_t end; // microseconds since the tracer started writing the trace
+        uint32_t gl; // microseconds in traced calls, on all threads
+        uint32_t driver; // of that, in the driver
+    };
+    std::vector<FrameTiming> frameTimings;
+    long long startTime = 0;
+
+    /// Record names generated for a kind of GL object, so the retracer can size its name maps up front
+    void recordNames(const char* type, int n, const GLuint* names);
+    struct NameRange
+    {
+        unsigned count = 0; // names generated, including ones generated again after being deleted
+        unsigned max = 0;
+    };
+    std::map<std::string, NameRange> nameRanges;
 
     struct CaptureInfo {
         std::string extensions;
@@ -67,6 +136,9 @@ public:
 private:
     // The binary trace file
     common::OutFile*        traceFile;
+    std::string             mFileName;
+    std::unique_ptr<FlightRecorder> mFlightRecorder;
+    const char*             mFlightRecorderTrigger = nullptr;
 };
 
 class TraceOut {
@@ -74,10 +146,17 @@ public:
     BinAndMeta* mpBinAndMeta = nullptr;
     common::ClientSideBufferObjectSet mCSBufferSet;
 
-    // The buffer and mutex used during capturing
-    const static int WRITE_BUF_LEN = (150*1024*1024);
-    char* writebuf = nullptr;
+    // Calls are serialized into a buffer owned by the calling thread (see threadBuffer()), so
+    // threads only contend on writeMutex for the copy into the trace file. callMutex guards
+    // the global tracer state that is shared between threads.
+    //
+    // Large arrays and blobs are not copied into that buffer, see Write1DArrayDeferred(), so
+    // it only has to hold the rest of a call. Calls that copy more than that into it, such as
+    // long shader sources, ask threadBuffer() for the extra space.
+    const static int WRITE_BUF_LEN = (4*1024*1024);
+    const static unsigned int WRITE_BUF_DEFER_SIZE = (64*1024);
     std::recursive_mutex callMutex;
+    std::recursive_mutex writeMutex;
 
     unsigned callNo = 0;
     unsigned frameNo = 0;
@@ -86,29 +165,141 @@ public:
     TraceOut();
     ~TraceOut();
 
-    inline void Write(const void* buf, unsigned int len)
+    /// Until CaptureStartFrame or SIGUSR2 with CaptureOnSignal, the tracer is armed: rendering
+    /// calls (draws, dispatches, clears and blits) are run but not recorded. Everything that
+    /// creates or changes resources and state is still recorded, so the trace can be retraced
+    /// from the start up to the first recorded frame quickly, like a fastforwarded trace.
+    inline bool captureArmed() const { return mCaptureArmed.load(std::memory_order_relaxed); }
+    /// Check the triggers at the end of a frame
+    void updateCaptureArmed();
+
+    /// Serialization buffer of the given thread (see GetThreadId()) with room for at least
+    /// WRITE_BUF_LEN + reserve bytes, for serializing the next calls. Allocated on first use.
+    inline char* threadBuffer(unsigned char tid, size_t reserve = 0)
     {
-        if (mpBinAndMeta == NULL)
+        ThreadBuffer& tb = mThreadBufs[tid];
+        if (tb.capacity < WRITE_BUF_LEN + reserve)
         {
-            mpBinAndMeta = new BinAndMeta();
-            mStateLogger.open(mpBinAndMeta->getFileName() + ".tracelog");
+            tb.capacity = WRITE_BUF_LEN + reserve;
+            tb.data.reset(new char[tb.capacity]);
         }
-        mpBinAndMeta->write(buf, len);
+        tb.deferred.clear();
+        tb.deferredBytes = 0;
+        return tb.data.get();
     }
 
-    inline void WriteBuf(const char *endPointer)
+    /// Write1DArray() into the thread's buffer, except that a large array is not copied. Only
+    /// its length goes into the buffer, and WriteBuf() writes the contents straight from the
+    /// array, which must stay valid until then.
+    template <class T>
+    inline char* Write1DArrayDeferred(unsigned char tid, char* dest, unsigned int len, const T* array)
     {
-        const int size = endPointer - writebuf;
-        if (size > WRITE_BUF_LEN)
+        const unsigned int byLen = array ? len * sizeof(T) : 0;
+        if (byLen < WRITE_BUF_DEFER_SIZE)
         {
-            DBG_LOG("Write buffer overflow (%d > %d)\n", size, WRITE_BUF_LEN);
+            return common::Write1DArray<T>(dest, len, array);
+        }
+        ThreadBuffer& tb = mThreadBufs[tid];
+        dest = common::WriteFixed<unsigned int>(dest, byLen);
+        tb.deferred.push_back({ (size_t)(dest - tb.data.get()), (const char*)array, byLen, common::BLOB_CODEC_NONE });
+        tb.deferredBytes += (byLen + 3) & ~3u;
+        return dest;
+    }
+
+    /// As Write1DArrayDeferred() for a blob, whatever its size, behind a BLOB_ENCODED header for
+    /// the compression threads to encode it with codec (see OutFile::EncodeNext()), so that the
+    /// thread making the call only copies it into the trace
+    inline char* WriteEncodedBlobDeferred(unsigned char tid, char* dest, unsigned int len, const char* blob, common::BlobCodec codec)
+    {
+        ThreadBuffer& tb = mThreadBufs[tid];
+        dest = common::WriteBlobEncodedHeader(dest, len);
+        tb.deferred.push_back({ (size_t)(dest - tb.data.get()), blob, len, codec });
+        tb.deferredBytes += (len + 3) & ~3u;
+        return dest;
+    }
+
+    /// Size of the contents deferred since threadBuffer(), which the toNext of a call has to
+    /// include on top of what it takes in the buffer
+    inline size_t deferredBytes(unsigned char tid) const { return mThreadBufs[tid].deferredBytes; }
+
+    /// Append the calls serialized in [buf, endPointer) to the trace. The calls get the next
+    /// callCount call numbers, in the order the threads get here. endsFrame marks the calls
+    /// as the end of a frame of this thread in the frame table.
+    inline void WriteBuf(const char *buf, const char *endPointer, unsigned callCount = 1, bool endsFrame = false)
+    {
+        const unsigned char tid = GetThreadId();
+        ThreadBuffer& tb = mThreadBufs[tid];
+        const size_t size = endPointer - buf;
+        if (size > tb.capacity)
+        {
+            DBG_LOG("Write buffer overflow (%u > %u)\n", (unsigned)size, (unsigned)tb.capacity);
             abort(); // we've already overwritten memory, no way to recover
         }
-        Write(writebuf, size);
+        std::lock_guard<std::recursive_mutex> guard(writeMutex);
+        if (mpBinAndMeta == NULL)
+        {
+            mpBinAndMeta = new BinAndMeta();
+            mStateLogger.open(mpBinAndMeta->getFileName() + ".tracelog");
+            ArmCapture();
+        }
+        FlightRecorder* recorder = mpBinAndMeta->flightRecorder();
+        if (recorder)
+        {
+            recorder->beginCalls(((const common::BCall*)buf)->funcId);
+        }
+        {
+            OverheadTimer timer(OVERHEAD_FILE_WRITE);
+            if (tb.deferred.empty())
+            {
+                mpBinAndMeta->write(buf, size);
+            }
+            else
+            {
+                // a call must not be split between chunks
+                static const char padding[4] = { 0, 0, 0, 0 };
+                mpBinAndMeta->reserve(size + tb.deferredBytes);
+                const char* done = buf;
+                for (const DeferredArray& d : tb.deferred)
+                {
+                    mpBinAndMeta->write(done, buf + d.offset - done);
+                    if (d.codec != common::BLOB_CODEC_NONE)
+                    {
+                        mpBinAndMeta->encodeNext(d.length, d.codec);
+                    }
+                    mpBinAndMeta->write(d.data, d.length);
+                    mpBinAndMeta->write(padding, ((d.length + 3) & ~3u) - d.length);
+                    done = buf + d.offset;
+                }
+                mpBinAndMeta->write(done, endPointer - done);
+                tb.deferred.clear();
+                tb.deferredBytes = 0;
+            }
+        }
+        callNo += callCount;
+        if (recorder)
+        {
+            recorder->endCalls(callCount, endsFrame, tid);
+            if (tracerParams.FlightRecorderOnError && ((const common::BCall*)buf)->errNo != common::CALL_GL_NO_ERROR)
+            {
+                mpBinAndMeta->triggerFlightRecorder("a GL error");
+            }
+        }
+        else if (endsFrame)
+        {
+            mpBinAndMeta->markFrame(tid, callNo);
+        }
+        if (tb.capacity > WRITE_BUF_LEN)
+        {
+            // don't hold on to the memory of an unusually large call
+            tb.data.reset();
+            tb.capacity = 0;
+        }
     }
 
     void Close()
     {
+        std::lock_guard<std::recursive_mutex> callGuard(callMutex);
+        std::lock_guard<std::recursive_mutex> writeGuard(writeMutex);
         if (mpBinAndMeta)
         {
             mpBinAndMeta->callCnt = callNo;
@@ -125,8 +316,28 @@ public:
     StateLogger& getStateLogger() { return mStateLogger; }
 
 private:
+    void ArmCapture();
+
+    struct DeferredArray
+    {
+        size_t offset; ///< where the contents go in the thread's buffer
+        const char* data;
+        unsigned int length;
+        common::BlobCodec codec; ///< to be encoded with, see WriteEncodedBlobDeferred()
+    };
+
+    struct ThreadBuffer
+    {
+        std::unique_ptr<char[]> data;
+        size_t capacity = 0;
+        std::vector<DeferredArray> deferred;
+        size_t deferredBytes = 0; ///< including padding
+    };
+
     Path mPath;
     StateLogger mStateLogger;
+    std::vector<ThreadBuffer> mThreadBufs;
+    std::atomic<bool> mCaptureArmed{false};
 };
 
 extern TraceOut* gTraceOut;
@@ -138,6 +349,7 @@ struct BufferRangeData
     void* base;
     GLbitfield access;
     std::vector<unsigned char> contents;
+    bool tracked = false; ///< by gWriteTracker instead of contents
 };
 
 typedef std::unordered_map<GLuint, BufferRangeData> BufferToClientPointerMap_t;
@@ -150,6 +362,10 @@ struct TraceContext
     /// GLES version set for this context
     int profile = 0;
     std::map<unsigned int, unsigned int> mapPrgToBoundAttribs;
+    /// Of the programs linked in this context, see pre_glLinkProgram()
+    std::unordered_map<GLuint, std::shared_ptr<const ProgramReflection>> programReflection;
+    /// Locations taken by the active attributes of those programs, see GetActiveAttribIdx()
+    std::unordered_map<GLuint, unsigned int> programAttribMask;
     BufferToClientPointerMap_t bufferToClientPointerMap;
     BufferInitializedSet_t bufferInitializedSet;
     /// Register a pending/lazy deletion of context
@@ -194,29 +410,84 @@ struct SizeTargetAndAttrib {
     }
 };
 typedef std::unordered_map<EGLImageKHR, SizeTargetAndAttrib> EGLImageInfoMap_t;
-struct TraceThread {
+
+// Large blobs a thread has serialized, identified by size and digest. The value is the id
+// the blob is stored under in the trace, or 0 while it has only been seen once.
+struct BlobKey {
+    BlobKey(unsigned int s, const char* data) : size(s), digest(data, s) {}
+    bool operator==(const BlobKey& other) const { return size == other.size && digest == other.digest; }
+
+    unsigned int size;
+    common::ContentDigest digest;
+};
+struct BlobKeyHash {
+    size_t operator()(const BlobKey& key) const
+    {
+        size_t hash;
+        memcpy(&hash, static_cast<const unsigned char*>(key.digest), sizeof(hash));
+        return hash ^ key.size;
+    }
+};
+typedef std::unordered_map<BlobKey, unsigned int, BlobKeyHash> BlobIndex_t;
+
+// Every wrapper writes to the state of its thread, so each is kept on cache lines of its own
+// for the threads not to invalidate each other's.
+struct alignas(64) TraceThread {
     TraceThread()
         : mCurCtx(NULL)
         , mCurSurf(NULL)
         , mCallDepth(0)
         , mActiveAttributes()
         , mEglImageToTextureIdMap()
+        , mCallsSinceErrorCheck(0)
+        , mErrorCheckBurst(0)
+        , mDebugCallbackActive(false)
+        , mDebugErrorPending(false)
+        , mCountedConfigId(0)
+        , mCountedCalls(0)
     {}
 
+    /// Number of calls made on each EGL config, see UpdateTimesEGLConfigUsed()
+    std::unordered_map<int, int> timesConfigUsed() const;
+    void clearTimesConfigUsed();
+
     TraceContext *mCurCtx;
     TraceSurface *mCurSurf;
     int mCallDepth;
     StringListList_t mActiveAttributes;
     EGLImageToTextureIdMap_t mEglImageToTextureIdMap;
     EGLImageInfoMap_t mEglImageInfoMap;
+    BlobIndex_t mBlobIndex;
+
+    // State of the cheaper error checking modes, see GetCallErrorNo()
+    int mCallsSinceErrorCheck;
+    int mErrorCheckBurst; // calls left to check one by one after a sampled check found an error
+    bool mDebugCallbackActive; // synchronous KHR_debug output works on the current context
+    bool mDebugErrorPending; // KHR_debug reported an error for the current call
+
+    // Calls on the config of the current surface are counted in mCountedCalls, and only added to
+    // mTimesConfigUsed when the config changes, to keep the map out of every call. The thread that
+    // writes the header reads them while this one counts, so the map and the config ID are only
+    // touched with mConfigMutex held, and the counter is atomic, but only ever stored by this thread.
+    mutable std::mutex mConfigMutex;
+    std::unordered_map<int, int> mTimesConfigUsed;
+    EGLint mCountedConfigId;
+    std::atomic<int> mCountedCalls;
 };
 
-extern std::vector<TraceThread> gTraceThread;
+// A static array, since a vector would not align the threads to cache lines
+extern std::array<TraceThread, PATRACE_THREAD_LIMIT> gTraceThread;
 
 unsigned char GetThreadId();
 void UpdateTimesEGLConfigUsed(int threadid);
 TraceContext* GetCurTraceContext(unsigned char tid);
 TraceSurface* GetCurTraceSurface(unsigned char tid);
+/// Write a blob of an upload, once only if it is repeated and BlobStoreMinSize is set. Texture
+/// uploads name the codec to encode it with (see TextureBlobCodec()).
+char* WriteStoredBlob(char* dest, unsigned char tid, unsigned int len, const char* blob, common::BlobCodec codec = common::BLOB_CODEC_NONE);
+/// How the compression threads should encode the pixels of an uncompressed texture upload of
+/// len bytes, none unless TextureCompressMinSize is set and it is at least that large
+common::BlobCodec TextureBlobCodec(GLenum format, GLenum type, unsigned int len);
 
 void after_glBindAttribLocation(unsigned char tid, GLuint program, GLuint index);
 void after_glMapBufferRange(GLenum target, GLsizeiptr length, GLbitfield access, void* base);
@@ -247,14 +518,53 @@ void after_eglDestroyImageKHR(EGLDisplay dpy, EGLImageKHR image);
 // version inside functions.
 void updateUsage(GLenum target);
 
+// glGetError() can stall the pipeline, so besides checking after every call, there are two
+// cheaper modes. With ErrorCheckDebugCallback, KHR_debug tells us which calls raised an error
+// and only those are checked. With an ErrorCheckInterval above 1, only every Nth call is
+// checked. The error found is then recorded on that call even if an earlier one in the
+// interval raised it, and the calls that follow are checked one by one, so that errors which
+// repeat (most do, once per frame) get recorded on the right call.
 static inline common::CALL_ERROR_NO GetCallErrorNo(const char *funcname, unsigned char tid)
 {
     if (!tracerParams.EnableErrorCheck)
         return common::CALL_GL_NO_ERROR;
 
+    TraceThread& thread = gTraceThread.at(tid);
+    bool sampled = false;
+    if (tracerParams.ErrorCheckDebugCallback && thread.mDebugCallbackActive)
+    {
+        if (!thread.mDebugErrorPending)
+            return common::CALL_GL_NO_ERROR;
+        thread.mDebugErrorPending = false;
+    }
+    else if (tracerParams.ErrorCheckInterval > 1)
+    {
+        if (thread.mErrorCheckBurst > 0)
+        {
+            thread.mErrorCheckBurst--;
+        }
+        else if (++thread.mCallsSinceErrorCheck < tracerParams.ErrorCheckInterval)
+        {
+            return common::CALL_GL_NO_ERROR;
+        }
+        else
+        {
+            sampled = true;
+        }
+        thread.mCallsSinceErrorCheck = 0;
+    }
+
+    OverheadTimer timer(OVERHEAD_ERROR_CHECK);
+
     GLenum glErr = _glGetError();
     GetCurTraceContext(tid)->lastGlError = glErr;
 
+    if (sampled && glErr != GL_NO_ERROR)
+    {
+        DBG_LOG("GLError 0x%x found after %s, raised by it or one of the %d calls before it\n", glErr, funcname, tracerParams.ErrorCheckInterval - 1);
+        thread.mErrorCheckBurst = tracerParams.ErrorCheckInterval;
+    }
+
 #if defined(REPORT_GL_ERRORS)
     if (glErr != GL_NO_ERROR)
     {
@@ -284,13 +594,17 @@ __eglMustCastToProperFunctionPointerType _wrapProcAddress(
     const char * procName, __eglMustCastToProperFunctionPointerType procPtr);
 bool _need_user_arrays();
 void _trace_user_arrays(int maxindex, int instancecount = 0);
+/// What _glDrawElementsBaseVertex_count() returns for indices in client memory, without
+/// scanning indices it has seen before on this thread
+GLuint _client_side_index_count(const common::ClientSideBufferObject &indices, GLsizei count, GLenum type, GLint basevertex);
 #if ENABLE_CLIENT_SIDE_BUFFER
 common::ClientSideBufferObjectName _getOrCreateClientSideBuffer(const common::ClientSideBufferObject& obj, bool& created);
 common::ClientSideBufferObjectName _getOrCreateClientSideBuffer(const void *p, ptrdiff_t size, bool& created);
+common::ClientSideBufferObjectName _glClientSideBufferData(const common::ClientSideBufferObject *obj);
 unsigned int _glClientSideBufferData(const void *p, ptrdiff_t size);
 void _glClientSideBufferData(common::ClientSideBufferObjectName name, int length, const void *data);
 void _glCopyClientSideBuffer(GLenum target, common::ClientSideBufferObjectName name);
-void _glPatchClientSideBuffer(GLenum target, int length, const void *data);
+void _glPatchClientSideBuffer(GLenum target, const void *data, const std::vector<common::CSBPatch>& patches);
 common::ClientSideBufferObjectName _glCreateClientSideBuffer();
 void _glDeleteClientSideBuffer(common::ClientSideBufferObjectName name);
 #endif
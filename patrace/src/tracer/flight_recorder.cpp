@@ -0,0 +1,140 @@
+#include <tracer/flight_recorder.hpp>
+#include <tracer/sig_enum.hpp>
+
+#include <string.h>
+
+using namespace common;
+
+FlightRecorder::FlightRecorder(unsigned frames, ChunkCodec codec)
+    : mMaxFrames(frames > 0 ? frames : 1)
+    , mCodec(codec)
+    , mFrames(1)
+{
+}
+
+void FlightRecorder::beginCalls(unsigned short funcId)
+{
+    mBatchBegin = mFrames.back().calls.size();
+    mRendering = isRenderingCall(funcId);
+}
+
+void FlightRecorder::endCalls(unsigned callCount, bool endsFrame, unsigned char tid)
+{
+    Frame& frame = mFrames.back();
+    if (frame.calls.size() > mBatchBegin)
+    {
+        frame.batches.push_back({ (uint32_t)frame.calls.size(), (uint16_t)callCount, mRendering });
+    }
+    if (endsFrame)
+    {
+        frame.ended = true;
+        frame.tid = tid;
+        if (mFrames.size() > mMaxFrames)
+        {
+            evictFrame();
+        }
+        else
+        {
+            mFrames.emplace_back();
+        }
+    }
+}
+
+void FlightRecorder::evictFrame()
+{
+    Frame frame = std::move(mFrames.front());
+    mFrames.pop_front();
+
+    size_t begin = 0;
+    for (const Batch& batch : frame.batches)
+    {
+        if (!batch.rendering)
+        {
+            mPending.insert(mPending.end(), frame.calls.begin() + begin, frame.calls.begin() + batch.end);
+            mCheckpointCalls += batch.callCount;
+        }
+        begin = batch.end;
+    }
+    mPendingMarks.push_back({ mPending.size(), mCheckpointCalls, frame.tid });
+    if (mPending.size() >= CHUNK_BUFFER_MIN_CAPACITY)
+    {
+        compressCheckpoint();
+    }
+
+    frame.calls.clear();
+    frame.batches.clear();
+    frame.ended = false;
+    mFrames.push_back(std::move(frame));
+}
+
+void FlightRecorder::compressCheckpoint()
+{
+    if (mPending.empty())
+        return;
+
+    Chunk chunk;
+    ChunkCodec codec = mCodec;
+    chunk.data.resize(4 + chunkMaxCompressedLength(codec, mPending.size()));
+    size_t length = chunkCompress(codec, mPending.data(), mPending.size(), chunk.data.data() + 4);
+    if (length == 0)
+    {
+        codec = CHUNK_CODEC_SNAPPY;
+        chunk.data.resize(4 + chunkMaxCompressedLength(codec, mPending.size()));
+        length = chunkCompress(codec, mPending.data(), mPending.size(), chunk.data.data() + 4);
+    }
+    const uint32_t prefix = chunkPrefix(codec, length);
+    memcpy(chunk.data.data(), &prefix, sizeof(prefix));
+    chunk.data.resize(4 + length);
+    chunk.data.shrink_to_fit();
+    chunk.marks.swap(mPendingMarks);
+    mCheckpointBytes += chunk.data.size();
+    mChunks.push_back(std::move(chunk));
+    mPending.clear();
+}
+
+size_t FlightRecorder::memoryUsed() const
+{
+    size_t bytes = mCheckpointBytes + mPending.capacity();
+    for (const Frame& frame : mFrames)
+    {
+        bytes += frame.calls.capacity() + frame.batches.capacity() * sizeof(Batch);
+    }
+    return bytes;
+}
+
+unsigned FlightRecorder::dump(OutFile& file)
+{
+    compressCheckpoint();
+    for (const Chunk& chunk : mChunks)
+    {
+        const uint64_t begin = file.GetStreamPos();
+        file.WriteRawChunk(chunk.data.data(), chunk.data.size());
+        for (const FrameMark& mark : chunk.marks)
+        {
+            file.MarkFrameAt(mark.tid, mark.callCount, begin + mark.end);
+        }
+    }
+
+    unsigned calls = mCheckpointCalls;
+    for (const Frame& frame : mFrames)
+    {
+        size_t begin = 0;
+        for (const Batch& batch : frame.batches)
+        {
+            file.Write(frame.calls.data() + begin, batch.end - begin);
+            calls += batch.callCount;
+            begin = batch.end;
+        }
+        if (frame.ended)
+        {
+            file.MarkFrame(frame.tid, calls);
+        }
+    }
+
+    mFrames.clear();
+    mFrames.emplace_back();
+    mChunks.clear();
+    mCheckpointCalls = 0;
+    mCheckpointBytes = 0;
+    return calls;
+}
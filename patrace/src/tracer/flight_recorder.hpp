@@ -0,0 +1,91 @@
+#if !defined(_FLIGHT_RECORDER_HPP_)
+#define _FLIGHT_RECORDER_HPP_
+
+#include <common/chunk_codec.hpp>
+#include <common/out_file.hpp>
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+/// Flight recorder mode of the tracer, enabled with the FlightRecorderFrames parameter. Nothing
+/// is written to disk until a trigger; the calls of the last frames are kept in memory instead.
+/// Of the frames before those, only what the armed tracer records is kept (see
+/// TraceOut::captureArmed()): every call but the rendering ones, compressed into chunks. That
+/// checkpoint grows with the resources and state the application creates, not with the frames
+/// it renders. A trigger writes both out as a trace that starts recording rendering calls at
+/// the oldest frame in memory, and the tracer then goes on recording as usual.
+///
+/// Calls arrive the way TraceOut::WriteBuf() writes them: between beginCalls() and endCalls(),
+/// under the write mutex of the tracer.
+class FlightRecorder
+{
+public:
+    FlightRecorder(unsigned frames, common::ChunkCodec codec);
+
+    /// Start of the calls of one WriteBuf(), of which the first is a call of funcId
+    void beginCalls(unsigned short funcId);
+    inline void write(const void* buf, size_t len)
+    {
+        std::vector<char>& calls = mFrames.back().calls;
+        calls.insert(calls.end(), (const char*)buf, (const char*)buf + len);
+    }
+    /// End of those callCount calls, which end a frame of thread tid if endsFrame is set
+    void endCalls(unsigned callCount, bool endsFrame, unsigned char tid);
+
+    /// Frames that ended since the oldest one in memory began
+    unsigned framesInMemory() const { return mFrames.size() - 1; }
+    /// Bytes of calls held
+    size_t memoryUsed() const;
+
+    /// Write the checkpoint and the frames in memory to file, which must have just been opened
+    /// with the signature book of this process, and forget them. Returns the number of calls written.
+    unsigned dump(common::OutFile& file);
+
+private:
+    struct Batch
+    {
+        uint32_t end; ///< offset in the calls of the frame
+        uint16_t callCount;
+        bool rendering;
+    };
+
+    struct Frame
+    {
+        std::vector<char> calls;
+        std::vector<Batch> batches;
+        bool ended = false;
+        unsigned char tid = 0; ///< whose frame it ended
+    };
+
+    struct FrameMark
+    {
+        uint64_t end; ///< offset in the calls of the chunk
+        unsigned callCount; ///< in the checkpoint, up to the end of the frame
+        unsigned char tid;
+    };
+
+    struct Chunk
+    {
+        std::vector<char> data; ///< length prefix included, as in a trace file
+        std::vector<FrameMark> marks;
+    };
+
+    /// Add the state calls of the oldest frame to the checkpoint and reuse its storage for a new frame
+    void evictFrame();
+    void compressCheckpoint();
+
+    unsigned mMaxFrames;
+    common::ChunkCodec mCodec;
+    std::deque<Frame> mFrames; ///< the last one is being recorded
+    size_t mBatchBegin = 0;
+    bool mRendering = false;
+
+    std::vector<Chunk> mChunks;
+    std::vector<char> mPending; ///< calls of the checkpoint not compressed yet
+    std::vector<FrameMark> mPendingMarks;
+    unsigned mCheckpointCalls = 0;
+    size_t mCheckpointBytes = 0;
+};
+
+#endif
@@ -32,7 +32,8 @@ const char* InteractiveCmd::names[] = {
     "TO_FRAME",        // run until we hit a given frame
     "SNAP_FRAME",      // capture the final framebuffer image
     "SNAP_DRAW_FRAME", // capture all draw calls for a frame
-    "SNAP_ALL_FRAMES_NOWAIT" // snap every N frames
+    "SNAP_ALL_FRAMES_NOWAIT", // snap every N frames
+    "DUMP_FLIGHT_RECORDER" // trigger the flight recorder at a given frame
 };
 
 
@@ -90,6 +91,10 @@ InteractiveCmd GetInteractiveCmd()
                     ret.cmd = SNAP_DRAW_FRAME;
                     ret.nameCString = ret.names[SNAP_DRAW_FRAME];
                     ret.frameNo = atoi(strFrNo.c_str());
+                } else if (strCmd.compare("dumpRing") == 0) {
+                    ret.cmd = DUMP_FLIGHT_RECORDER;
+                    ret.nameCString = ret.names[DUMP_FLIGHT_RECORDER];
+                    ret.frameNo = atoi(strFrNo.c_str());
                 }
             }
 
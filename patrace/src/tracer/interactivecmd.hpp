@@ -6,7 +6,8 @@ enum INTERATIVE_CMD {
     TO_FRAME,        // run until we hit a given frame
     SNAP_FRAME,      // capture the final framebuffer image
     SNAP_DRAW_FRAME, // capture all draw calls for a frame
-    SNAP_ALL_FRAMES_NOWAIT // snap every N frames
+    SNAP_ALL_FRAMES_NOWAIT, // snap every N frames
+    DUMP_FLIGHT_RECORDER // trigger the flight recorder at a given frame
 };
 
 struct InteractiveCmd {
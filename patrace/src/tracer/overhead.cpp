@@ -0,0 +1,87 @@
+#include "overhead.hpp"
+
+#include "jsoncpp/include/json/value.h"
+
+#include <algorithm>
+
+// Per frame values are only listed for this many frames, to keep the header within its size limit
+static const size_t OVERHEAD_MAX_JSON_FRAMES = 10000;
+
+static const char* counterNames[OVERHEAD_COUNTER_COUNT] =
+{
+    "wrapper", "driver", "errorCheck", "clientSideBuffer", "patchList", "fileWrite"
+};
+
+thread_local int OverheadTimer::sDepth[OVERHEAD_COUNTER_COUNT];
+
+TracerOverhead gTracerOverhead;
+
+TracerOverhead::TracerOverhead()
+{
+    for (auto& thread : mCounters)
+    {
+        for (auto& counter : thread)
+        {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+std::vector<long long> TracerOverhead::endFrame()
+{
+    if (!tracerParams.TracerOverheadStats && !tracerParams.FrameTimingsCpu)
+        return std::vector<long long>();
+
+    std::vector<long long> frame(OVERHEAD_COUNTER_COUNT, 0);
+    for (auto& thread : mCounters)
+    {
+        for (int i = 0; i < OVERHEAD_COUNTER_COUNT; i++)
+        {
+            frame[i] += thread[i].exchange(0, std::memory_order_relaxed);
+        }
+    }
+
+    if (tracerParams.TracerOverheadStats)
+    {
+        std::lock_guard<std::mutex> guard(mFrameMutex);
+        mFrames.push_back(frame);
+    }
+    return frame;
+}
+
+void TracerOverhead::toJson(Json::Value& value)
+{
+    std::lock_guard<std::mutex> guard(mFrameMutex);
+
+    value["frames"] = (Json::UInt64)mFrames.size();
+    value["unit"] = "us";
+    for (int i = 0; i < OVERHEAD_COUNTER_COUNT; i++)
+    {
+        long long total = 0, max = 0;
+        size_t maxFrame = 0;
+        for (size_t frame = 0; frame < mFrames.size(); frame++)
+        {
+            total += mFrames[frame][i];
+            if (mFrames[frame][i] > max)
+            {
+                max = mFrames[frame][i];
+                maxFrame = frame;
+            }
+        }
+        Json::Value counter;
+        counter["total"] = (Json::Int64)(total / 1000);
+        counter["mean"] = mFrames.empty() ? 0.0 : total / 1000.0 / mFrames.size();
+        counter["max"] = (Json::Int64)(max / 1000);
+        counter["maxFrame"] = (Json::UInt64)maxFrame;
+        value[counterNames[i]] = counter;
+    }
+
+    // What the tracer added to each frame, on top of the driver
+    Json::Value perFrame(Json::arrayValue);
+    const size_t frames = std::min(mFrames.size(), OVERHEAD_MAX_JSON_FRAMES);
+    for (size_t frame = 0; frame < frames; frame++)
+    {
+        perFrame.append((Json::Int64)((mFrames[frame][OVERHEAD_WRAPPER] - mFrames[frame][OVERHEAD_DRIVER]) / 1000));
+    }
+    value["frameOverhead"] = perFrame;
+}
@@ -0,0 +1,94 @@
+#if !defined(_OVERHEAD_HPP_)
+#define _OVERHEAD_HPP_
+
+#include <tracer/tracerparams.hpp>
+#include "common/trace_limits.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace Json { class Value; }
+
+/// Where the tracer spends its time. The wrapper time covers everything else; the remaining
+/// counters are parts of it.
+enum OverheadCounter
+{
+    OVERHEAD_WRAPPER,            ///< whole traced call, driver call included
+    OVERHEAD_DRIVER,             ///< the real GLES/EGL call
+    OVERHEAD_ERROR_CHECK,        ///< GetCallErrorNo()
+    OVERHEAD_CLIENT_SIDE_BUFFER, ///< client side arrays and mapped buffers
+    OVERHEAD_PATCH_LIST,         ///< genCSBPatchList()
+    OVERHEAD_FILE_WRITE,         ///< handing calls and headers to the OutFile
+    OVERHEAD_COUNTER_COUNT
+};
+
+/// Per frame totals of the OverheadCounters, enabled with the TracerOverheadStats parameter, or
+/// only the wrapper and driver time with FrameTimingsCpu.
+/// Threads add to their own counters; endFrame() collects them from all threads.
+class TracerOverhead
+{
+public:
+    TracerOverhead();
+
+    inline void add(unsigned char tid, OverheadCounter counter, long long ns)
+    {
+        mCounters[tid][counter].fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    /// Close the current frame. Returns its totals in nanoseconds by counter, or nothing if
+    /// neither TracerOverheadStats nor FrameTimingsCpu is set.
+    std::vector<long long> endFrame();
+
+    /// Summary for the trace header
+    void toJson(Json::Value& value);
+
+private:
+    std::atomic<long long> mCounters[PATRACE_THREAD_LIMIT][OVERHEAD_COUNTER_COUNT];
+    std::mutex mFrameMutex;
+    std::vector<std::vector<long long>> mFrames; ///< nanoseconds per counter per frame
+};
+
+extern TracerOverhead gTracerOverhead;
+
+unsigned char GetThreadId();
+
+/// Adds the time of its scope to a counter. Nested scopes of the same counter on a thread are
+/// only counted once, by the outermost one.
+class OverheadTimer
+{
+public:
+    explicit OverheadTimer(OverheadCounter counter)
+        : mCounter(counter)
+        , mEnabled(tracerParams.TracerOverheadStats || (tracerParams.FrameTimingsCpu && counter <= OVERHEAD_DRIVER))
+    {
+        if (mEnabled && sDepth[counter]++ == 0)
+        {
+            mStart = std::chrono::steady_clock::now();
+            mOutermost = true;
+        }
+    }
+
+    ~OverheadTimer()
+    {
+        if (!mEnabled)
+            return;
+
+        if (mOutermost)
+        {
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mStart).count();
+            gTracerOverhead.add(GetThreadId(), mCounter, ns);
+        }
+        sDepth[mCounter]--;
+    }
+
+private:
+    OverheadCounter mCounter;
+    bool mEnabled;
+    bool mOutermost = false;
+    std::chrono::steady_clock::time_point mStart;
+    static thread_local int sDepth[OVERHEAD_COUNTER_COUNT];
+};
+
+#endif // !defined(_OVERHEAD_HPP_)
@@ -0,0 +1,421 @@
+#include <tracer/program_cache.hpp>
+
+#include <common/gl_extension_supported.hpp>
+#include <common/memory.hpp>
+#include <common/os.hpp>
+
+#include "jsoncpp/include/json/reader.h"
+#include "jsoncpp/include/json/writer.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <fstream>
+
+ProgramBinaryCache gProgramBinaryCache;
+ProgramReflectionCache gProgramReflectionCache;
+
+const std::string& driverDigest()
+{
+    // the same as paretrace tags its shader cache entries with
+    static const std::string driver = []()
+    {
+        std::vector<std::string> strings;
+        for (const GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        {
+            const char* str = (const char*)_glGetString(name);
+            strings.push_back(str ? str : "");
+        }
+        return common::MD5Digest(strings).text();
+    }();
+    return driver;
+}
+
+std::string attachedShaderSources(GLuint program, ShaderList& shaders)
+{
+    GLint count = 0;
+    _glGetProgramiv(program, GL_ATTACHED_SHADERS, &count);
+    std::vector<GLuint> names(count);
+    if (count > 0)
+    {
+        _glGetAttachedShaders(program, count, &count, names.data());
+    }
+    std::vector<std::string> sources;
+    for (GLint i = 0; i < count; i++)
+    {
+        GLint type = GL_NONE;
+        GLint length = 0;
+        _glGetShaderiv(names[i], GL_SHADER_TYPE, &type);
+        _glGetShaderiv(names[i], GL_SHADER_SOURCE_LENGTH, &length);
+        std::vector<GLchar> source(length + 1, '\0');
+        if (length > 0)
+        {
+            _glGetShaderSource(names[i], length + 1, nullptr, source.data());
+        }
+        shaders.emplace_back((GLenum)type, std::string(source.data()));
+        sources.push_back(shaders.back().second);
+    }
+    return sources.empty() ? std::string() : common::MD5Digest(sources).text();
+}
+
+bool ProgramBinaryCache::open(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mCache.open(name))
+    {
+        return false;
+    }
+    // name.src of all drivers, as binaries are looked up by their own MD5 only
+    std::ifstream in(name + ".src");
+    std::string line;
+    Json::Reader reader;
+    while (std::getline(in, line))
+    {
+        Json::Value entry;
+        if (!reader.parse(line, entry) || !entry.isMember("binary"))
+        {
+            continue; // a line cut short by a session that crashed
+        }
+        ShaderList& shaders = mSources[entry["binary"].asString()];
+        shaders.clear();
+        for (const Json::Value& shader : entry["shaders"])
+        {
+            shaders.emplace_back((GLenum)shader["type"].asUInt(), shader["source"].asString());
+        }
+    }
+    DBG_LOG("Using program binary cache %s, with the sources of %u binaries\n", name.c_str(), (unsigned)mSources.size());
+    return true;
+}
+
+void ProgramBinaryCache::link(GLuint program, const std::string& md5, const ShaderList& shaders)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    uint32_t format = GL_NONE;
+    const char* binary = nullptr;
+    uint32_t size = 0;
+    if (mCache.find(md5, driverDigest(), format, binary, size))
+    {
+        _glProgramBinary(program, format, binary, size);
+        GLint linked = GL_FALSE;
+        _glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (linked)
+        {
+            mHits++;
+            return;
+        }
+        // refused by a driver update that kept its strings, so linked and saved again
+        _glGetError();
+        DBG_LOG("Cached program binary %s was refused by the driver\n", md5.c_str());
+    }
+    lock.unlock();
+
+    _glLinkProgram(program);
+    GLint linked = GL_FALSE;
+    _glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked)
+    {
+        save(program, md5, shaders);
+    }
+}
+
+void ProgramBinaryCache::save(GLuint program, const std::string& md5, const ShaderList& shaders)
+{
+    GLint length = 0;
+    _glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    std::vector<char> binary(length);
+    GLenum format = GL_NONE;
+    if (length > 0)
+    {
+        _glGetProgramBinary(program, length, nullptr, &format, binary.data());
+    }
+    if (length <= 0 || format == GL_NONE)
+    {
+        return; // the driver has no binaries to give
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mMisses++;
+    if (!mCache.save(md5, driverDigest(), format, binary.data(), length))
+    {
+        DBG_LOG("Failed to save program %u to the program binary cache %s\n", program, mCache.name().c_str());
+        return;
+    }
+    const std::string binaryMd5 = common::MD5Digest(binary.data(), length).text();
+    mSources[binaryMd5] = shaders;
+
+    Json::Value entry;
+    entry["md5"] = md5;
+    entry["binary"] = binaryMd5;
+    entry["shaders"] = Json::arrayValue;
+    for (const auto& shader : shaders)
+    {
+        Json::Value v;
+        v["type"] = shader.first;
+        v["source"] = shader.second;
+        entry["shaders"].append(v);
+    }
+    // one write of a whole line, under the same kind of lock as the binaries, so that sessions
+    // sharing the cache do not interleave their lines
+    const std::string line = Json::FastWriter().write(entry);
+    const int fd = ::open((mCache.name() + ".src").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        DBG_LOG("Failed to open %s.src, the sources of program %u are not kept\n", mCache.name().c_str(), program);
+        return;
+    }
+    flock(fd, LOCK_EX);
+    if (write(fd, line.data(), line.size()) != (ssize_t)line.size())
+    {
+        DBG_LOG("Failed to write the sources of program %u to %s.src\n", program, mCache.name().c_str());
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (mMisses % 100 == 0)
+    {
+        DBG_LOG("Program binary cache: %u programs loaded, %u linked and saved\n", mHits, mMisses);
+    }
+}
+
+bool ProgramBinaryCache::findSources(const void* binary, GLsizei length, ShaderList& shaders)
+{
+    if (!binary || length <= 0)
+    {
+        return false;
+    }
+    const std::string binaryMd5 = common::MD5Digest(binary, length).text();
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mSources.find(binaryMd5);
+    if (it == mSources.end())
+    {
+        return false;
+    }
+    shaders = it->second;
+    return true;
+}
+
+bool replace_glProgramBinary(GLuint program, const void* binary, GLsizei length)
+{
+    ShaderList shaders;
+    if (!gProgramBinaryCache.isOpen() || !gProgramBinaryCache.findSources(binary, length, shaders))
+    {
+        return false;
+    }
+    // Injected calls, which are recorded. The link loads the same binary again from the cache.
+    std::vector<GLuint> names;
+    for (const auto& shader : shaders)
+    {
+        const GLuint name = glCreateShader(shader.first);
+        const GLchar* source = shader.second.c_str();
+        glShaderSource(name, 1, &source, nullptr);
+        glCompileShader(name);
+        glAttachShader(program, name);
+        names.push_back(name);
+    }
+    glLinkProgram(program);
+    for (const GLuint name : names)
+    {
+        glDetachShader(program, name);
+        glDeleteShader(name);
+    }
+    DBG_LOG("Program %u was given a binary of known sources, recorded as built from those\n", program);
+    return true;
+}
+
+void ProgramReflection::query(GLuint program)
+{
+    GLint linkStatus = GL_FALSE;
+    _glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+    linked = (linkStatus != GL_FALSE);
+    if (!linked)
+    {
+        return;
+    }
+
+    char name[128];
+    GLint count = 0;
+    _glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        Variable v = { "", 0, GL_NONE };
+        GLsizei length = 0;
+        _glGetActiveAttrib(program, i, sizeof(name), &length, &v.size, &v.type, name);
+        v.name.assign(name, length);
+        attributes.push_back(v);
+    }
+
+    count = 0;
+    _glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        GLsizei length = 0;
+        _glGetActiveUniformBlockName(program, i, sizeof(name), &length, name);
+        uniformBlocks.push_back(std::string(name, length));
+    }
+
+    count = 0;
+    _glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    for (GLuint i = 0; count > 0 && i < static_cast<GLuint>(count); ++i)
+    {
+        GLint block = 0;
+        _glGetActiveUniformsiv(program, 1, &i, GL_UNIFORM_BLOCK_INDEX, &block);
+        if (block != -1)
+        {
+            continue; // is inside uniform block, looked up by the block
+        }
+        Variable v = { "", 0, GL_NONE };
+        GLsizei length = 0;
+        _glGetActiveUniform(program, i, sizeof(name), &length, &v.size, &v.type, name);
+        if (v.type == GL_UNSIGNED_INT_ATOMIC_COUNTER)
+        {
+            continue; // is atomic counter, cannot be location'ed since it must be explicitly bound
+        }
+        v.name.assign(name, length);
+        uniforms.push_back(v);
+    }
+}
+
+namespace {
+
+Json::Value variablesToJson(const std::vector<ProgramReflection::Variable>& variables)
+{
+    Json::Value list = Json::arrayValue;
+    for (const auto& variable : variables)
+    {
+        Json::Value v;
+        v["name"] = variable.name;
+        v["size"] = variable.size;
+        v["type"] = variable.type;
+        list.append(v);
+    }
+    return list;
+}
+
+void variablesFromJson(const Json::Value& list, std::vector<ProgramReflection::Variable>& variables)
+{
+    for (const Json::Value& v : list)
+    {
+        variables.push_back({ v["name"].asString(), v["size"].asInt(), (GLenum)v["type"].asUInt() });
+    }
+}
+
+}
+
+bool ProgramReflectionCache::open(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    const int fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        DBG_LOG("Failed to open the program reflection cache %s\n", name.c_str());
+        return false;
+    }
+    close(fd);
+    mName = name;
+
+    std::ifstream in(name);
+    std::string line;
+    Json::Reader reader;
+    while (std::getline(in, line))
+    {
+        Json::Value entry;
+        if (!reader.parse(line, entry) || !entry.isMember("md5"))
+        {
+            continue; // a line cut short by a session that crashed
+        }
+        auto reflection = std::make_shared<ProgramReflection>();
+        reflection->linked = true;
+        variablesFromJson(entry["attributes"], reflection->attributes);
+        for (const Json::Value& block : entry["uniformBlocks"])
+        {
+            reflection->uniformBlocks.push_back(block.asString());
+        }
+        variablesFromJson(entry["uniforms"], reflection->uniforms);
+        mCache[entry["md5"].asString() + entry["driver"].asString() + (entry["separable"].asBool() ? "separable" : "")] = reflection;
+    }
+    DBG_LOG("Using program reflection cache %s, with %u programs\n", name.c_str(), (unsigned)mCache.size());
+    return true;
+}
+
+std::shared_ptr<const ProgramReflection> ProgramReflectionCache::get(GLuint program, const std::string& md5)
+{
+    // Besides the sources, transform feedback and separable programs keep variables active
+    // that would otherwise be optimized out. The former are rare enough to not cache at all.
+    std::string key;
+    if (!md5.empty())
+    {
+        GLint varyings = 0;
+        GLint separable = GL_FALSE;
+        if (gGlesFeatures.glesVersion() >= 300)
+        {
+            _glGetProgramiv(program, GL_TRANSFORM_FEEDBACK_VARYINGS, &varyings);
+        }
+        if (gGlesFeatures.isProgramInterfaceSupported())
+        {
+            _glGetProgramiv(program, GL_PROGRAM_SEPARABLE, &separable);
+        }
+        if (varyings == 0)
+        {
+            key = md5 + driverDigest() + (separable ? "separable" : "");
+        }
+    }
+    if (!key.empty())
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mCache.find(key);
+        if (it != mCache.end())
+        {
+            mHits++;
+            return it->second;
+        }
+    }
+
+    auto reflection = std::make_shared<ProgramReflection>();
+    reflection->query(program);
+    if (key.empty() || !reflection->linked)
+    {
+        return reflection;
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mQueries++;
+    mCache[key] = reflection;
+    if (!mName.empty())
+    {
+        save(md5, key.size() > md5.size() + driverDigest().size(), *reflection);
+    }
+    if (mQueries % 100 == 0)
+    {
+        DBG_LOG("Program reflection cache: %u programs queried, %u reused\n", mQueries, mHits);
+    }
+    return reflection;
+}
+
+void ProgramReflectionCache::save(const std::string& md5, bool separable, const ProgramReflection& reflection)
+{
+    Json::Value entry;
+    entry["md5"] = md5;
+    entry["driver"] = driverDigest();
+    entry["separable"] = separable;
+    entry["attributes"] = variablesToJson(reflection.attributes);
+    entry["uniformBlocks"] = Json::arrayValue;
+    for (const std::string& block : reflection.uniformBlocks)
+    {
+        entry["uniformBlocks"].append(block);
+    }
+    entry["uniforms"] = variablesToJson(reflection.uniforms);
+
+    const std::string line = Json::FastWriter().write(entry);
+    const int fd = ::open(mName.c_str(), O_WRONLY | O_APPEND);
+    if (fd < 0)
+    {
+        return;
+    }
+    flock(fd, LOCK_EX);
+    if (write(fd, line.data(), line.size()) != (ssize_t)line.size())
+    {
+        DBG_LOG("Failed to write to the program reflection cache %s\n", mName.c_str());
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+}
@@ -0,0 +1,118 @@
+#if !defined(_PROGRAM_CACHE_HPP_)
+#define _PROGRAM_CACHE_HPP_
+
+#include <retracer/shader_cache.hpp>
+
+#include <dispatch/eglproc_auto.hpp>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// Type and source of each shader attached to a program
+typedef std::vector<std::pair<GLenum, std::string>> ShaderList;
+
+/// The MD5 of the sources of the shaders attached to program, in the order the driver lists them,
+/// as the program caches and paretrace -shadercache key programs with. Empty if none are attached.
+std::string attachedShaderSources(GLuint program, ShaderList& shaders);
+
+/// The MD5 of the vendor, renderer and version strings of the driver of the current context
+const std::string& driverDigest();
+
+/// Program binaries built while tracing, kept between capture sessions of an application, enabled
+/// with the ProgramBinaryCache parameter. Applications that compile many shaders at startup spend
+/// most of the capture setup linking them, again in every session. With the cache, a program whose
+/// attached shaders were linked before with the same driver is loaded from its binary instead, and
+/// the trace still has the sources and the link, as it always does.
+///
+/// The binaries are a ShaderCache keyed by the MD5 of the shader sources, the same as the one that
+/// paretrace -shadercache uses. Next to it, name.src has a line of JSON for each of them with its
+/// sources and the MD5 of the binary. With that, the program binaries that an application uploads
+/// itself can be verified to be ones the cache built from known sources. While binary shaders are
+/// refused (see ErrorOutOnBinaryShaders), those are built from their sources instead, which is
+/// recorded, and the ones that are not known fail as before.
+class ProgramBinaryCache
+{
+public:
+    /// Use name from now on. Returns false if it cannot be opened.
+    bool open(const std::string& name);
+    bool isOpen() const { return mCache.isOpen(); }
+
+    /// Link program, from the cache if its attached shaders were linked before, and add its
+    /// binary to the cache if not. md5 is that of their sources. Needs its context to be current.
+    void link(GLuint program, const std::string& md5, const ShaderList& shaders);
+
+    /// Find the shaders that the program binary was built from
+    bool findSources(const void* binary, GLsizei length, ShaderList& shaders);
+
+private:
+    void save(GLuint program, const std::string& md5, const ShaderList& shaders);
+
+    std::mutex mMutex;
+    retracer::ShaderCache mCache;
+    std::unordered_map<std::string, ShaderList> mSources; ///< by the MD5 of the binary
+    unsigned mHits = 0;
+    unsigned mMisses = 0;
+};
+
+extern ProgramBinaryCache gProgramBinaryCache;
+
+/// What the tracer queries of a program after linking it: its active attributes, for which
+/// locations are recorded and client side arrays are kept, and its uniform blocks and uniforms,
+/// for which lookups are recorded so that the retracer can remap them. That only depends on the
+/// shader sources and the driver.
+struct ProgramReflection
+{
+    struct Variable
+    {
+        std::string name;
+        GLint size;
+        GLenum type;
+    };
+
+    bool linked = false;
+    std::vector<Variable> attributes;
+    std::vector<std::string> uniformBlocks;
+    std::vector<Variable> uniforms; ///< outside uniform blocks, without atomic counters
+
+    /// Query all of it from program, of which only the link status if it did not link
+    void query(GLuint program);
+};
+
+/// Reflections of the programs linked while tracing, by the MD5 of their shader sources, so that
+/// applications that link the same shaders again and again, such as for variants of a material,
+/// only have them queried once. They are kept in memory for the session, and between sessions
+/// when ProgramReflectionCache names a file for them, a line of JSON each.
+class ProgramReflectionCache
+{
+public:
+    /// Also keep them in name from now on, and use the ones in it. Returns false if it cannot be
+    /// written.
+    bool open(const std::string& name);
+    bool isOpen() const { return !mName.empty(); }
+
+    /// The reflection of program, which has just been linked from shaders of the given source
+    /// MD5. Queried if no program of those sources was linked before, and never cached if md5
+    /// is empty, the program did not link or has transform feedback varyings.
+    std::shared_ptr<const ProgramReflection> get(GLuint program, const std::string& md5);
+
+private:
+    void save(const std::string& md5, bool separable, const ProgramReflection& reflection);
+
+    std::mutex mMutex;
+    std::string mName; ///< empty if only kept in memory
+    std::unordered_map<std::string, std::shared_ptr<const ProgramReflection>> mCache; ///< by source MD5, driver and separable
+    unsigned mHits = 0;
+    unsigned mQueries = 0;
+};
+
+extern ProgramReflectionCache gProgramReflectionCache;
+
+/// glProgramBinary of a binary the cache knows the sources of: build program from them instead,
+/// recording that. Returns false if the sources are not known.
+bool replace_glProgramBinary(GLuint program, const void* binary, GLsizei length);
+
+#endif
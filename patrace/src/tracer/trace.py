@@ -112,6 +112,12 @@ array_pointer_function_names = set((
     "glVertexAttribLPointerEXT",
 ))
 
+# Uploads whose data is written with WriteStoredBlob(), so that repeated uploads are stored once
+blob_store_function_names = stdapi.texture_function_names | set((
+    'glBufferData',
+    'glBufferSubData',
+))
+
 # We do not want the application to call these, we want control over them
 ignore_functions = [
     'glDebugMessageCallback',
@@ -158,16 +164,18 @@ class SerializeVisitor(stdapi.Visitor):
             print '        dest = Write1DArray<%s>(dest, 0, (%s*)%s); // array size is 0' % (eleSerialType, eleSerialType, name)
             print '    }'
         else:
-            print '    dest = Write1DArray<%s>(dest, %s, (%s*)%s); // array' % (eleSerialType, array.length, eleSerialType, name)
+            print '    dest = gTraceOut->Write1DArrayDeferred<%s>(tid, dest, %s, (%s*)%s); // array' % (eleSerialType, array.length, eleSerialType, name)
     def visitBlob(self, blob, name, func):
         if func.name == 'glGetProgramBinary':
             print '    if (%s) {' % blob.size
-            print '        dest = Write1DArray<char>(dest, (unsigned int)*%s, (const char*)%s); // blob' % (blob.size, name)
+            print '        dest = gTraceOut->Write1DArrayDeferred<char>(tid, dest, (unsigned int)*%s, (const char*)%s); // blob' % (blob.size, name)
             print '    } else {'
             print '        dest = Write1DArray<char>(dest, 0, (const char*)%s); // blob size is 0' % (name)
             print '    }'
+        elif func.name in blob_store_function_names:
+            print '    dest = WriteStoredBlob(dest, tid, (unsigned int)%s, (const char*)%s); // blob' % (blob.size, name)
         else:
-            print '    dest = Write1DArray<char>(dest, (unsigned int)%s, (const char*)%s); // blob' % (blob.size, name)
+            print '    dest = gTraceOut->Write1DArrayDeferred<char>(tid, dest, (unsigned int)%s, (const char*)%s); // blob' % (blob.size, name)
     def visitEnum(self, enum, name, func):
         print '    dest = WriteFixed<int>(dest, %s); // enum' % (name)
     def visitBitmask(self, bitmask, name, func):
@@ -205,13 +213,17 @@ class SerializeVisitor(stdapi.Visitor):
             print '        dest = WriteFixed<unsigned int>(dest, clientSideBufferObjName);'
             print '        dest = WriteFixed<unsigned int>(dest, 0);'
             print '#else'
-            print '        dest = Write1DArray<char>(dest, (unsigned int)(count*_gl_type_size(type)), (const char*)indices);'
+            print '        dest = gTraceOut->Write1DArrayDeferred<char>(tid, dest, (unsigned int)(count*_gl_type_size(type)), (const char*)indices);'
             print '#endif'
             print '    } else {'
             print "        dest = WriteFixed<unsigned int>(dest, BufferObjectReferenceType); // ISN'T *BLOB*"
             print '        dest = WriteFixed<unsigned int>(dest, (uintptr_t)%s); // opaque -> ptr '% (name)
             print '    }'
         elif func.name in stdapi.texture_function_names:
+            # Uncompressed 2D uploads may be encoded by the compression threads, see TextureBlobCodec()
+            codec = ''
+            if func.name in ('glTexImage2D', 'glTexSubImage2D'):
+                codec = ', TextureBlobCodec(format, type, (unsigned int)%s)' % opaque.size
             print '    if (isUsingPBO)'
             print '    {'
             print '        GLint _unpack_buffer = 0;'
@@ -219,7 +231,7 @@ class SerializeVisitor(stdapi.Visitor):
             print '        if (!_unpack_buffer)'
             print '        {'
             print '            dest = WriteFixed<unsigned int>(dest, BlobType);'
-            print '            dest = Write1DArray<char>(dest, (unsigned int)%s, (const char*)%s);' % (opaque.size, name)
+            print '            dest = WriteStoredBlob(dest, tid, (unsigned int)%s, (const char*)%s%s);' % (opaque.size, name, codec)
             print '        }'
             print '        else'
             print '        {'
@@ -230,7 +242,7 @@ class SerializeVisitor(stdapi.Visitor):
             print '    else'
             print '    {'
             print '        dest = WriteFixed<unsigned int>(dest, BlobType);'
-            print '        dest = Write1DArray<char>(dest, (unsigned int)%s, (const char*)%s);' % (opaque.size, name)
+            print '        dest = WriteStoredBlob(dest, tid, (unsigned int)%s, (const char*)%s%s);' % (opaque.size, name, codec)
             print '    }'
         elif func.name == "glReadPixels" or func.name == 'glReadnPixels' or func.name == 'glReadnPixelsEXT' or func.name == 'glReadnPixelsKHR':
             print '    if (isUsingPBO)'
@@ -259,6 +271,14 @@ class SerializeVisitor(stdapi.Visitor):
     def visitPolymorphic(self, polymorphic, name, func):
         print '    #error'
 
+class ReserveVisitor(stdapi.Traverser):
+    """String arrays are copied into the serialization buffer, so make room for them."""
+    def __init__(self):
+        self.sizes = []
+    def visitArray(self, array, name):
+        if stdapi.isString(array.type):
+            self.sizes.append('StringArraySize(%s, %s)' % (array.length, name))
+
 class TypeGetter(stdapi.Visitor):
     '''Determine which glGet*v function that matches the specified type.'''
 
@@ -345,8 +365,17 @@ class Tracer:
         print func.prototype('patrace_' + func.name) + '{'
 
         print '    unsigned char tid = GetThreadId();'
+        print '    OverheadTimer _wrapperTimer(OVERHEAD_WRAPPER);'
         print '    UpdateTimesEGLConfigUsed(tid);'
 
+        if func.name in stdapi.all_rendering_names:
+            print '    if (unlikely(gTraceOut->captureArmed()))'
+            print '    {'
+            print '        // not recording rendering calls yet'
+            self.invokeFunction(func, indent=' ' * 8)
+            print '        return;'
+            print '    }'
+
         if func.type is not stdapi.Void:
             print '    %s _result;' % func.type
 
@@ -429,8 +458,14 @@ class Tracer:
             print
 
         print '    // save parameters'
-        print '    gTraceOut->callMutex.lock();'
-        print '    char* dest = gTraceOut->writebuf;'
+        reserve = ReserveVisitor()
+        for arg in func.args:
+            reserve.visit(arg.type, arg.name)
+        if reserve.sizes:
+            print '    char* const writebuf = gTraceOut->threadBuffer(tid, %s);' % ' + '.join(reserve.sizes)
+        else:
+            print '    char* const writebuf = gTraceOut->threadBuffer(tid);'
+        print '    char* dest = writebuf;'
         if func.name == 'glEGLImageTargetTexture2DOES':
             print
             print '    // Firstly, insert an eglDestroyImageKHR'
@@ -442,7 +477,6 @@ class Tracer:
             print '    dest = WriteFixed<int>(dest, (intptr_t)dpy); // int pointer'
             print '    dest = WriteFixed<int>(dest, (intptr_t)image); // int pointer'
             print '    dest = WriteFixed<int>(dest, EGL_TRUE); // enum'
-            print '    gTraceOut->callNo++;'
             print
             print '    // Secondly, save an eglCreateImageKHR'
             print '    char *starting_point2 = dest;'
@@ -458,7 +492,6 @@ class Tracer:
             print '    dest = Write1DArray<unsigned int>(dest, _AttribPairList_size(attrib_list, EGL_NONE), (unsigned int*)attrib_list); // array'
             print '    dest = WriteFixed<int>(dest, (intptr_t)image); // int pointer'
             print '    pCall1->toNext = dest-starting_point2;'
-            print '    gTraceOut->callNo++;'
             print
             print '    // finally, save glEGLImageTargetTexture2DOES'
 
@@ -495,7 +528,7 @@ class Tracer:
         if func.name.startswith('gl') and func.name != 'glGetError':
             print '    pCall->errNo = GetCallErrorNo("%s", tid);' % func.name
         if gIdToLength[func.id] == '0':
-            print '    pCall->toNext = dest-gTraceOut->writebuf;'
+            print '    pCall->toNext = dest - writebuf + gTraceOut->deferredBytes(tid);'
             print '#ifdef DEBUG'
             print '    if (pCall->toNext == 0)'
             print '    {'
@@ -504,9 +537,12 @@ class Tracer:
             print '    }'
             print '#endif'
 
-        print '    gTraceOut->WriteBuf(dest);'
-        print '    gTraceOut->callNo++;'
-        print '    gTraceOut->callMutex.unlock();'
+        if func.name == 'glEGLImageTargetTexture2DOES':
+            print '    gTraceOut->WriteBuf(writebuf, dest, 3);'
+        elif func.name in ['eglSwapBuffers', 'eglSwapBuffersWithDamageKHR']:
+            print '    gTraceOut->WriteBuf(writebuf, dest, 1, true);'
+        else:
+            print '    gTraceOut->WriteBuf(writebuf, dest);'
 
     def invokeFunction(self, func, prefix='_', suffix='', indent='    '):
         if func.name in ignore_functions:
@@ -540,6 +576,9 @@ class Tracer:
             print '    if (tracerParams.EnableErrorCheck) {'
             print '        _result = GetCurTraceContext(tid)->lastGlError;'
             print '        GetCurTraceContext(tid)->lastGlError = GL_NO_ERROR;'
+            print '        // calls that were not checked may have left an error behind'
+            print '        if (_result == GL_NO_ERROR && (tracerParams.ErrorCheckInterval > 1 || tracerParams.ErrorCheckDebugCallback))'
+            print '            _result = _glGetError();'
             print '    }'
             print '    else {'
             print '        _result = _glGetError();'
@@ -626,6 +665,10 @@ class Tracer:
 
         # Force glProgramBinary to fail.  Per ARB_get_program_binary this should signal the app that it needs to recompile.
         if func.name in ('glProgramBinary', 'glProgramBinaryOES'):
+            print '%sif (tracerParams.ErrorOutOnBinaryShaders && replace_glProgramBinary(program, binary, length))' % indent
+            print '%s{' % indent
+            print '%s    return; // recorded as built from its sources instead' % indent
+            print '%s}' % indent
             print '%sif (tracerParams.ErrorOutOnBinaryShaders)' % indent
             print '%s{' % indent
             print '%s    binaryFormat = 0xDEADDEAD;' % indent
@@ -644,7 +687,10 @@ class Tracer:
 
         print
         print '%s++gTraceThread.at(tid).mCallDepth;' % indent
-        print '%s%s%s(%s);' % (indent, result, dispatch, params)
+        print '%s{' % indent
+        print '%s    OverheadTimer _driverTimer(OVERHEAD_DRIVER);' % indent
+        print '%s    %s%s(%s);' % (indent, result, dispatch, params)
+        print '%s}' % indent
         print '%s--gTraceThread.at(tid).mCallDepth;' % indent
         print
 
@@ -801,10 +847,27 @@ class Tracer:
 
         instance_count = 'instancecount' if func.name in stdapi.draw_instanced_function_names else '0'
 
+        # draws whose vertex count comes from scanning the indices
+        scans_indices = (func.name in stdapi.draw_elements_function_names and
+                         func.name not in stdapi.draw_indirect_function_names and
+                         'Range' not in func.name and 'Multi' not in func.name)
+        if scans_indices:
+            # indices in client memory are hashed once, for both the cached index scan and
+            # the client-side buffer they are stored in
+            print '    GLint _element_array_buffer = 0;'
+            print '    _glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &_element_array_buffer);'
+            print '    common::ClientSideBufferObject _indices;'
+            print '    if (!_element_array_buffer) {'
+            print '        _indices.set_data(indices, count*_gl_type_size(type));'
+            print '    }'
         if func.name in stdapi.draw_function_names and not func.name in stdapi.draw_indirect_function_names:
             print '    if (count && _need_user_arrays()) {'
             arg_names = ', '.join([arg.name for arg in func.args[1:]])
-            print '        GLuint _count = _%s_count(%s);' % (func.name, arg_names)
+            if scans_indices:
+                basevertex = 'basevertex' if 'basevertex' in [arg.name for arg in func.args] else '0'
+                print '        GLuint _count = _element_array_buffer ? _%s_count(%s) : _client_side_index_count(_indices, count, type, %s);' % (func.name, arg_names, basevertex)
+            else:
+                print '        GLuint _count = _%s_count(%s);' % (func.name, arg_names)
             print '        _trace_user_arrays(_count, %s);' % instance_count
             print '    }'
         if func.name in stdapi.draw_function_names or func.name == 'glDispatchCompute':
@@ -823,13 +886,17 @@ class Tracer:
             else:
                 print '        gTraceOut->getStateLogger().logState(tid);'
             print '    }'
-            print '    GLint _element_array_buffer = 0;'
-            print '    _glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &_element_array_buffer);'
+            if not scans_indices:
+                print '    GLint _element_array_buffer = 0;'
+                print '    _glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &_element_array_buffer);'
             if func.name not in stdapi.draw_indirect_function_names:
                 print '    GLuint clientSideBufferObjName = 0;'
                 print '#if ENABLE_CLIENT_SIDE_BUFFER'
                 print '    if (!_element_array_buffer) {'
-                print '        clientSideBufferObjName = _glClientSideBufferData(indices, count*_gl_type_size(type));'
+                if scans_indices:
+                    print '        clientSideBufferObjName = _glClientSideBufferData(&_indices);'
+                else:
+                    print '        clientSideBufferObjName = _glClientSideBufferData(indices, count*_gl_type_size(type));'
                 print '    }'
                 print '#endif'
         elif func.name == 'glDispatchCompute':
@@ -926,6 +993,11 @@ class Tracer:
             print '    _result = _wrapProcAddress(procname, _result);'
         if func.name in ['glCreateProgram', 'glCreateShaderProgramv', 'glCreateShaderProgramvEXT']:
             print '    after_glCreateProgram(tid, _result);'
+        if isinstance(func.type, stdapi.Handle) and func.type.name in ['program', 'shader']:
+            print '    if (_result != 0) gTraceOut->mpBinAndMeta->recordNames("%s", 1, (const GLuint*)&_result);' % func.type.name
+        for arg in func.args:
+            if arg.output and isinstance(arg.type, stdapi.Array) and isinstance(arg.type.type, stdapi.Handle) and func.name.startswith('glGen'):
+                print '    gTraceOut->mpBinAndMeta->recordNames("%s", %s, %s);' % (arg.type.type.name, arg.type.length, arg.name)
         if func.name == 'glDeleteProgram':
             print '    after_glDeleteProgram(tid, program);'
         if func.name == 'glBindAttribLocation':
@@ -1021,6 +1093,21 @@ def sigEnum(functions):
         print '    %s_id = %d,' % (func.name, func.id)
     print '};'
 
+def renderingCalls(functions):
+    print '// Calls that only render, which the armed tracer skips and the flight recorder drops'
+    print 'static inline bool isRenderingCall(unsigned short id)'
+    print '{'
+    print '    switch (id)'
+    print '    {'
+    for func in functions:
+        if func.name in stdapi.all_rendering_names:
+            print '    case %s_id:' % func.name
+    print '        return true;'
+    print '    default:'
+    print '        return false;'
+    print '    }'
+    print '}'
+
 if __name__ == '__main__':
 
     tracer = Tracer()
@@ -1040,6 +1127,7 @@ if __name__ == '__main__':
         print '#define _TRACER_SIG_ENUM_HPP_'
         print '// this file was generated by trace.py'
         sigEnum(api.functions)
+        renderingCalls(api.functions)
         print '#endif'
         sys.stdout = orig_stdout
 
@@ -1053,6 +1141,7 @@ if __name__ == '__main__':
         print
         print '#include <tracer/sig_enum.hpp>'
         print '#include <tracer/tracerparams.hpp>'
+        print '#include <tracer/program_cache.hpp>'
         print '#include <dispatch/eglproc_auto.hpp>'
         print '#include <helper/eglsize.hpp>'
         print '#include "helper/states.h"'
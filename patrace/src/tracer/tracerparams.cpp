@@ -23,14 +23,38 @@ TracerParams::TracerParams()
     {
         LoadParams();
         DBG_LOG("ErrorOutOnBinaryShaders: %s\n", ErrorOutOnBinaryShaders ? "true" : "false");
+        if (!ProgramBinaryCache.empty()) DBG_LOG("ProgramBinaryCache: %s\n", ProgramBinaryCache.c_str());
+        if (!ProgramReflectionCache.empty()) DBG_LOG("ProgramReflectionCache: %s\n", ProgramReflectionCache.c_str());
         DBG_LOG("MaximumAnisotropicFiltering: %d\n", MaximumAnisotropicFiltering);
         DBG_LOG("EnableErrorCheck: %s\n", EnableErrorCheck ? "true" : "false");
+        if (ErrorCheckInterval > 1) DBG_LOG("ErrorCheckInterval: %d\n", ErrorCheckInterval);
+        if (ErrorCheckDebugCallback) DBG_LOG("ErrorCheckDebugCallback: true\n");
         DBG_LOG("EnableActiveAttribCheck: %s\n", EnableActiveAttribCheck ? "true" : "false");
         DBG_LOG("InteractiveIntercept: %s\n", InteractiveIntercept ? "true" : "false");
         DBG_LOG("FlushTraceFileEveryFrame: %s\n", FlushTraceFileEveryFrame ? "true" : "false");
         DBG_LOG("DisableBufferStorage: %s\n", DisableBufferStorage ? "true" : "false");
         DBG_LOG("RendererName: %s\n", RendererName.c_str());
+        DBG_LOG("ChunkCodec: %s\n", ChunkCodec.c_str());
+        if (!ChunkDictionary.empty()) DBG_LOG("ChunkDictionary: %s\n", ChunkDictionary.c_str());
+        if (ChunkSize > 0) DBG_LOG("ChunkSize: %d\n", ChunkSize);
+        if (ColumnarChunks) DBG_LOG("ColumnarChunks: true\n");
+        if (ChunkChecksums) DBG_LOG("ChunkChecksums: true\n");
+        if (HeaderPadding > 0) DBG_LOG("HeaderPadding: %d\n", HeaderPadding);
+        if (TraceFileWriter != "stdio") DBG_LOG("TraceFileWriter: %s\n", TraceFileWriter.c_str());
+        if (!TraceStream.empty()) DBG_LOG("TraceStream: %s (%d MB buffer)\n", TraceStream.c_str(), TraceStreamBuffer);
+        DBG_LOG("CompressionThreads: %d\n", CompressionThreads);
         if (DisableErrorReporting) DBG_LOG("DisableErrorReporting: true\n");
+        if (TracerOverheadStats) DBG_LOG("TracerOverheadStats: true\n");
+        if (FrameTimings) DBG_LOG("FrameTimings: true\n");
+        if (FrameTimingsCpu) DBG_LOG("FrameTimingsCpu: true\n");
+        if (CaptureStartFrame > 0) DBG_LOG("CaptureStartFrame: %d\n", CaptureStartFrame);
+        if (CaptureOnSignal) DBG_LOG("CaptureOnSignal: true\n");
+        if (FlightRecorderFrames > 0) DBG_LOG("FlightRecorderFrames: %d\n", FlightRecorderFrames);
+        if (FlightRecorderFrameTime > 0) DBG_LOG("FlightRecorderFrameTime: %d\n", FlightRecorderFrameTime);
+        if (FlightRecorderOnError) DBG_LOG("FlightRecorderOnError: true\n");
+        if (BlobStoreMinSize > 0) DBG_LOG("BlobStoreMinSize: %d\n", BlobStoreMinSize);
+        if (TrackMappedWrites) DBG_LOG("TrackMappedWrites: true\n");
+        if (TextureCompressMinSize > 0) DBG_LOG("TextureCompressMinSize: %d\n", TextureCompressMinSize);
         if (StateDumpAfterSnapshot) DBG_LOG("StateDumpAfterSnapshot: true\n");
         if (StateDumpAfterDrawCall) DBG_LOG("StateDumpAfterDrawCall: true\n");
         if (FilterSupportedExtension) {
@@ -100,6 +124,10 @@ void TracerParams::LoadParams()
 
         if (strParamName.compare("EnableErrorCheck") == 0) {
             EnableErrorCheck = (strParamValue.compare("true") == 0);
+        } else if (strParamName.compare("ErrorCheckInterval") == 0) {
+            ErrorCheckInterval = atoi(strParamValue.c_str());
+        } else if (strParamName.compare("ErrorCheckDebugCallback") == 0) {
+            ErrorCheckDebugCallback = (strParamValue.compare("true") == 0);
         } else if (strParamName.compare("UniformBufferOffsetAlignment") == 0) {
             UniformBufferOffsetAlignment = atoi(strParamValue.c_str()); // can't use std::stoi on android :(
         } else if (strParamName.compare("ShaderStorageBufferOffsetAlignment") == 0) {
@@ -108,6 +136,10 @@ void TracerParams::LoadParams()
             MaximumAnisotropicFiltering = atoi(strParamValue.c_str());
         } else if (strParamName.compare("ErrorOutOnBinaryShaders") == 0) {
             ErrorOutOnBinaryShaders = (strParamValue.compare("true") == 0);
+        } else if (strParamName.compare("ProgramBinaryCache") == 0) {
+            ProgramBinaryCache = strParamValue;
+        } else if (strParamName.compare("ProgramReflectionCache") == 0) {
+            ProgramReflectionCache = strParamValue;
         } else if (strParamName.compare("EnableActiveAttribCheck") == 0) {
             EnableActiveAttribCheck = (strParamValue.compare("true") == 0);
         } else if (strParamName.compare("InteractiveIntercept") == 0) {
@@ -127,6 +159,48 @@ void TracerParams::LoadParams()
             DisableBufferStorage = (strParamValue.compare("true") == 0);
         } else if (strParamName.compare("RendererName") == 0) {
             RendererName = strParamValue;
+        } else if (strParamName.compare("ChunkCodec") == 0) {
+            ChunkCodec = strParamValue;
+        } else if (strParamName.compare("ChunkDictionary") == 0) {
+            ChunkDictionary = strParamValue;
+        } else if (strParamName.compare("ChunkSize") == 0) {
+            ChunkSize = atoi(strParamValue.c_str());
+        } else if (strParamName.compare("ColumnarChunks") == 0) {
+            ColumnarChunks = (strParamValue.compare("true") == 0);
+        } else if (strParamName.compare("ChunkChecksums") == 0) {
+            ChunkChecksums = (strParamValue.compare("true") == 0);
+        } else if (strParamName.compare("HeaderPadding") == 0) {
+            HeaderPadding = atoi(strParamValue.c_str());
+        } else if (strParamName.compare("TraceFileWriter") == 0) {
+            TraceFileWriter = strParamValue;
+        } else if (strParamName.compare("TraceStream") == 0) {
+            TraceStream = strParamValue;
+        } else if (strParamName.compare("TraceStreamBuffer") == 0) {
+            TraceStreamBuffer = atoi(strParamValue.c_str());
+        } else if (strParamName.compare("TracerOverheadStats") == 0) {
+            TracerOverheadStats = (strParamValue.compare("true") == 0);
+        } else if (strParamName.compare("FrameTimings") == 0) {
+            FrameTimings = (strParamValue.compare("true") == 0);
+        } else if (strParamName.compare("FrameTimingsCpu") == 0) {
+            FrameTimingsCpu = (strParamValue.compare("true") == 0);
+        } else if (strParamName.compare("CompressionThreads") == 0) {
+            CompressionThreads = atoi(strParamValue.c_str());
+        } else if (strParamName.compare("CaptureStartFrame") == 0) {
+            CaptureStartFrame = atoi(strParamValue.c_str());
+        } else if (strParamName.compare("CaptureOnSignal") == 0) {
+            CaptureOnSignal = (strParamValue.compare("true") == 0);
+        } else if (strParamName.compare("FlightRecorderFrames") == 0) {
+            FlightRecorderFrames = atoi(strParamValue.c_str());
+        } else if (strParamName.compare("FlightRecorderFrameTime") == 0) {
+            FlightRecorderFrameTime = atoi(strParamValue.c_str());
+        } else if (strParamName.compare("FlightRecorderOnError") == 0) {
+            FlightRecorderOnError = (strParamValue.compare("true") == 0);
+        } else if (strParamName.compare("BlobStoreMinSize") == 0) {
+            BlobStoreMinSize = atoi(strParamValue.c_str());
+        } else if (strParamName.compare("TrackMappedWrites") == 0) {
+            TrackMappedWrites = (strParamValue.compare("true") == 0);
+        } else if (strParamName.compare("TextureCompressMinSize") == 0) {
+            TextureCompressMinSize = atoi(strParamValue.c_str());
         } else if (strParamName.compare("SupportedExtension") == 0) {
             SupportedExtensions.push_back(strParamValue);
             if (SupportedExtensionsString.length() != 0)
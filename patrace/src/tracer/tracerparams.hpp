@@ -9,6 +9,8 @@ class TracerParams
 {
 public:
     bool EnableErrorCheck = false;                  // Enable error checking that is stored in trace file after each GLES call
+    int ErrorCheckInterval = 1;                     // Only check for errors after every Nth call, then after every call for a while once one is found
+    bool ErrorCheckDebugCallback = false;           // Only check for errors after calls that KHR_debug reports an error for
     bool EnableActiveAttribCheck = true;            // Only query actually used active attributes. Fixes performance issues on Qcom
     bool InteractiveIntercept = false;              // Debugging tool
     bool FilterSupportedExtension = false;          // Respond with given list of extensions instead of what the driver says
@@ -23,7 +25,30 @@ public:
     int ShaderStorageBufferOffsetAlignment = 256;   // As above
     int MaximumAnisotropicFiltering = 0;            // Anisotropic support. Must also add GL_EXT_texture_filter_anisotropic to SupportedExtensions
     bool ErrorOutOnBinaryShaders = true;            // Return an error if a program attempts to upload a binary shader
+    std::string ProgramBinaryCache = "";            // Keep program binaries between captures in these files, see ProgramBinaryCache
+    std::string ProgramReflectionCache = "";        // Keep the active variables of programs between captures in this file
     bool DisableErrorReporting = false;             // Disable GLES error reporting callbacks
+    std::string ChunkCodec = "snappy";              // Compression of the trace file: snappy, lz4 or zstd
+    std::string ChunkDictionary = "";               // zstd dictionary for the chunks: "train" or the path of a dictionary file
+    int ChunkSize = 0;                              // Bytes of calls per chunk, 0 for the default of 1 MB
+    bool ColumnarChunks = false;                    // Split the calls of each chunk into separately compressed streams
+    bool ChunkChecksums = false;                    // Store a CRC32C of each chunk, for paretrace -verify
+    int HeaderPadding = 0;                          // Bytes reserved for the json header beyond the usual 512 KB, for header_patcher to grow it in place
+    std::string TraceFileWriter = "stdio";          // How the trace file is written: stdio, uring, uring-direct or mmap
+    std::string TraceStream = "";                   // tcp://HOST:PORT of a trace_receiver to stream the trace to instead of writing it
+    int TraceStreamBuffer = 64;                     // Megabytes of the trace queued for TraceStream before the app waits for the network
+    int CompressionThreads = 0;                     // Threads compressing the trace file, 0 for one per core
+    bool TracerOverheadStats = false;               // Measure the time spent in the tracer and store it in the trace header
+    bool FrameTimings = false;                      // Record when each frame ended in a table in the trace header
+    bool FrameTimingsCpu = false;                   // With FrameTimings, also record the CPU time spent in GL and EGL calls in each frame
+    int CaptureStartFrame = 0;                      // Only record rendering calls from this frame on, see TraceOut::captureArmed()
+    bool CaptureOnSignal = false;                   // Only record rendering calls once the process gets SIGUSR2
+    int FlightRecorderFrames = 0;                   // Keep only the last N frames in memory until a trigger writes them out, see FlightRecorder
+    int FlightRecorderFrameTime = 0;                // Flight recorder trigger: a frame taking at least this many milliseconds, 0 to disable
+    bool FlightRecorderOnError = false;             // Flight recorder trigger: a GL error, found with EnableErrorCheck
+    int BlobStoreMinSize = 0;                       // Store repeated texture and buffer uploads of at least this many bytes only once, 0 to disable
+    bool TrackMappedWrites = false;                 // Only copy the pages of mapped buffers that get written to, see WriteTracker
+    int TextureCompressMinSize = 0;                 // Compress uncompressed 2D texture uploads of at least this many bytes on their own, 0 to disable
 
     std::string _tmp_extensions;
 
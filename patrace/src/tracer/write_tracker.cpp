@@ -0,0 +1,204 @@
+#include <tracer/write_tracker.hpp>
+
+#include <common/os.hpp>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+WriteTracker gWriteTracker;
+
+static struct sigaction gPreviousAction;
+
+static void writeFaultHandler(int sig, siginfo_t* info, void* context)
+{
+    if (gWriteTracker.handleFault(info->si_addr))
+    {
+        return; // the write is retried, now that the page is writable
+    }
+    if (gPreviousAction.sa_flags & SA_SIGINFO)
+    {
+        gPreviousAction.sa_sigaction(sig, info, context);
+    }
+    else if (gPreviousAction.sa_handler != SIG_DFL && gPreviousAction.sa_handler != SIG_IGN)
+    {
+        gPreviousAction.sa_handler(sig);
+    }
+    else
+    {
+        // not ours: fault again with the default action
+        sigaction(SIGSEGV, &gPreviousAction, NULL);
+    }
+}
+
+bool WriteTracker::init()
+{
+    if (mPageSize > 0)
+    {
+        return true;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = writeFaultHandler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &gPreviousAction) != 0)
+    {
+        DBG_LOG("Failed to install the SIGSEGV handler for TrackMappedWrites: %s\n", strerror(errno));
+        return false;
+    }
+    mPageSize = sysconf(_SC_PAGESIZE);
+    return true;
+}
+
+WriteTracker::Mapping* WriteTracker::find(const void* base)
+{
+    for (Mapping& mapping : mMappings)
+    {
+        if (mapping.base == base)
+        {
+            return &mapping;
+        }
+    }
+    return nullptr;
+}
+
+bool WriteTracker::track(void* base, size_t length)
+{
+    if (mPageSize == 0 || !base)
+    {
+        return false;
+    }
+    unsigned char* const p = static_cast<unsigned char*>(base);
+    unsigned char* const begin = (unsigned char*)(((uintptr_t)p + mPageSize - 1) & ~(uintptr_t)(mPageSize - 1));
+    unsigned char* const end = (unsigned char*)(((uintptr_t)p + length) & ~(uintptr_t)(mPageSize - 1));
+    if (end <= begin)
+    {
+        return false; // not a single whole page
+    }
+
+    // Left uninitialized, so that only the pages written are ever touched
+    std::unique_ptr<unsigned char[]> original(new unsigned char[length]);
+    const size_t pages = (end - begin) / mPageSize;
+    std::unique_ptr<std::atomic<bool>[]> written(new std::atomic<bool>[pages]);
+    for (size_t i = 0; i < pages; i++)
+    {
+        written[i] = false;
+    }
+    memcpy(original.get(), p, begin - p);
+    memcpy(original.get() + (end - p), end, p + length - end);
+
+    lock();
+    Mapping* mapping = find(nullptr);
+    if (!mapping || mprotect(begin, end - begin, PROT_READ) != 0)
+    {
+        unlock();
+        DBG_LOG("Failed to track writes to the mapping at %p: %s\n", base, mapping ? strerror(errno) : "too many mappings");
+        return false;
+    }
+    mapping->length = length;
+    mapping->begin = begin;
+    mapping->end = end;
+    mapping->original = std::move(original);
+    mapping->written = std::move(written);
+    mapping->base = p; // last, it is what find() goes by
+    unlock();
+    return true;
+}
+
+bool WriteTracker::handleFault(void* addr)
+{
+    unsigned char* const p = static_cast<unsigned char*>(addr);
+    bool handled = false;
+    lock();
+    for (Mapping& mapping : mMappings)
+    {
+        if (!mapping.base || p < mapping.begin || p >= mapping.end)
+        {
+            continue;
+        }
+        const size_t page = (p - mapping.begin) / mPageSize;
+        unsigned char* const pageBegin = mapping.begin + page * mPageSize;
+        // unless another thread got here first, and it is writable already
+        if (!mapping.written[page])
+        {
+            memcpy(mapping.original.get() + (pageBegin - mapping.base), pageBegin, mPageSize);
+            mprotect(pageBegin, mPageSize, PROT_READ | PROT_WRITE);
+            mapping.written[page] = true;
+        }
+        handled = true;
+        break;
+    }
+    unlock();
+    return handled;
+}
+
+bool WriteTracker::dirtySpans(const void* base, unsigned int maxDirtyBytes, std::vector<common::CSBPatch>& patches)
+{
+    lock();
+    Mapping* mapping = find(base);
+    unlock();
+    if (!mapping)
+    {
+        return false;
+    }
+
+    unsigned int dirtyBytes = 0;
+    auto compare = [&](size_t offset, size_t length) {
+        const size_t first = patches.size();
+        if (!common::findDirtySpans(mapping->original.get() + offset, mapping->base + offset, length, maxDirtyBytes - dirtyBytes, patches))
+        {
+            return false;
+        }
+        for (size_t i = first; i < patches.size(); i++)
+        {
+            patches[i].offset += offset;
+            dirtyBytes += patches[i].length;
+        }
+        return true;
+    };
+
+    const size_t begin = mapping->begin - mapping->base;
+    const size_t end = mapping->end - mapping->base;
+    if (begin > 0 && !compare(0, begin))
+    {
+        return false;
+    }
+    const size_t pages = (end - begin) / mPageSize;
+    for (size_t page = 0; page < pages; )
+    {
+        if (!mapping->written[page])
+        {
+            page++;
+            continue;
+        }
+        size_t last = page + 1;
+        while (last < pages && mapping->written[last])
+        {
+            last++;
+        }
+        if (!compare(begin + page * mPageSize, (last - page) * mPageSize))
+        {
+            return false;
+        }
+        page = last;
+    }
+    return end >= mapping->length || compare(end, mapping->length - end);
+}
+
+void WriteTracker::untrack(const void* base)
+{
+    lock();
+    Mapping* mapping = find(base);
+    if (mapping)
+    {
+        mprotect(mapping->begin, mapping->end - mapping->begin, PROT_READ | PROT_WRITE);
+        mapping->base = nullptr;
+        mapping->original.reset();
+        mapping->written.reset();
+    }
+    unlock();
+}
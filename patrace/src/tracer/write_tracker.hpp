@@ -0,0 +1,67 @@
+#if !defined(_WRITE_TRACKER_HPP_)
+#define _WRITE_TRACKER_HPP_
+
+#include <common/memory.hpp>
+
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/// Finds the pages of a mapped buffer that the application writes to, enabled with the
+/// TrackMappedWrites parameter. Without it, a buffer mapped with glMapBuffer is copied when it is
+/// mapped, for the copy to be compared with it when it is unmapped, however little of it the
+/// application writes. With it, the pages of the mapping are write protected instead, and the
+/// first write to each of them is caught with SIGSEGV, which copies the page before letting
+/// the write through. Only those pages are compared when the buffer is unmapped.
+///
+/// Only whole pages are protected; the bytes of a mapping on pages it shares with other memory
+/// are copied when it is tracked. Writes by system calls into a protected page, such as read(),
+/// fail with EFAULT rather than being caught.
+class WriteTracker
+{
+public:
+    /// Install the SIGSEGV handler, chaining to the one that was installed before for faults
+    /// outside of the mappings tracked. Returns false if it cannot be.
+    bool init();
+
+    /// Start tracking writes to the length bytes at base. Returns false if too many mappings are
+    /// tracked already or it cannot be protected, which leaves it as it was.
+    bool track(void* base, size_t length);
+
+    /// Append the spans of the mapping at base that changed since track() to patches, in
+    /// CSB_PATCH_BLOCK_SIZE blocks like findDirtySpans(). Returns false as soon as more than
+    /// maxDirtyBytes did.
+    bool dirtySpans(const void* base, unsigned int maxDirtyBytes, std::vector<common::CSBPatch>& patches);
+
+    /// Stop tracking the mapping at base, making it all writable again
+    void untrack(const void* base);
+
+    /// Called from the SIGSEGV handler. Returns false if addr is not in a page that is tracked.
+    bool handleFault(void* addr);
+
+private:
+    struct Mapping
+    {
+        unsigned char* base = nullptr;
+        size_t length = 0;
+        unsigned char* begin = nullptr; ///< of the pages that are protected
+        unsigned char* end = nullptr;
+        std::unique_ptr<unsigned char[]> original; ///< length bytes, filled as the pages are written
+        std::unique_ptr<std::atomic<bool>[]> written; ///< by page from begin
+    };
+
+    /// The mapping tracked at base, or a free one for nullptr
+    Mapping* find(const void* base);
+    void lock() { while (mLock.test_and_set(std::memory_order_acquire)) {} }
+    void unlock() { mLock.clear(std::memory_order_release); }
+
+    static const int MAX_MAPPINGS = 64;
+    Mapping mMappings[MAX_MAPPINGS];
+    std::atomic_flag mLock = ATOMIC_FLAG_INIT; ///< a spin lock, since it is taken in the signal handler
+    size_t mPageSize = 0;
+};
+
+extern WriteTracker gWriteTracker;
+
+#endif
@@ -1,3 +1,6 @@
+#include <cmath>
+#include <cstdlib>
+#include <vector>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
@@ -7,6 +10,8 @@
 #include "image/image_compression.hpp"
 #include "image/image.hpp"
 #include "image/image_io.hpp"
+#include "image/image_yuv.hpp"
+#include "image/image_convert.hpp"
 
 using namespace pat;
 
@@ -167,6 +172,208 @@ void ImageTest::testETC1()
     CPPUNIT_ASSERT(input.DataSize() == 24);
 }
 
+void ImageTest::testETC1Decode()
+{
+    // Blocks on the edges are decoded apart from those inside the image, so a smaller image
+    // made of the same blocks has to decode to the top left of the larger one
+    std::vector<UInt8> blocks(2 * 2 * 8);
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        blocks[i] = (i * 89 + 13) & 0xFF;
+    }
+    Image full(8, 8, GL_ETC1_RGB8_OES, GL_NONE, blocks.size(), blocks.data());
+    Image cropped(6, 5, GL_ETC1_RGB8_OES, GL_NONE, blocks.size(), blocks.data());
+    Image fullOutput, croppedOutput;
+    CPPUNIT_ASSERT(UncompressFromETC1(full, fullOutput));
+    CPPUNIT_ASSERT(UncompressFromETC1(cropped, croppedOutput));
+    CPPUNIT_ASSERT(croppedOutput.DataSize() == 6 * 5 * 3);
+    for (int y = 0; y < 5; ++y)
+    {
+        CPPUNIT_ASSERT(memcmp(croppedOutput.Data() + y * 6 * 3, fullOutput.Data() + y * 8 * 3, 6 * 3) == 0);
+    }
+
+    // Decoding on several threads gives the same image as on one
+    const UInt32 width = 1031, height = 517;
+    blocks.resize(((width + 3) / 4) * ((height + 3) / 4) * 8);
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        blocks[i] = (i * 2654435761u) >> 24;
+    }
+    Image large(width, height, GL_ETC1_RGB8_OES, GL_NONE, blocks.size(), blocks.data());
+    Image single, threaded;
+    CPPUNIT_ASSERT(UncompressFromETC1(large, single, 1));
+    CPPUNIT_ASSERT(UncompressFromETC1(large, threaded, 4));
+    CPPUNIT_ASSERT(single.DataSize() == width * height * 3);
+    CPPUNIT_ASSERT(memcmp(single.Data(), threaded.Data(), single.DataSize()) == 0);
+}
+
+void ImageTest::testYUV()
+{
+    // Within one step of the floating point BT.601 conversion
+    const UInt8 rgba[] = {
+        255, 255, 255, 255,   0, 0, 0, 255,   200, 30, 90, 255,   12, 250, 131, 0,
+        255, 0, 0, 255,       0, 255, 0, 255, 0, 0, 255, 255,     128, 128, 128, 255,
+    };
+    std::vector<UInt8> yv12(YV12Size(4, 2), 0xAA);
+    CPPUNIT_ASSERT(RGBAToYV12(rgba, yv12.data(), 4, 2) == yv12.size());
+    const UInt32 yStride = 16, cStride = 16;
+    for (int i = 0; i < 8; ++i)
+    {
+        const int r = rgba[i * 4], g = rgba[i * 4 + 1], b = rgba[i * 4 + 2];
+        const int x = i % 4, y = i / 4;
+        CPPUNIT_ASSERT(abs(yv12[y * yStride + x] - (int)(0.299 * r + 0.587 * g + 0.114 * b)) <= 1);
+        if (y == 0 && x % 2 == 0)
+        {
+            const UInt8 v = yv12[yStride * 2 + x / 2];
+            const UInt8 u = yv12[yStride * 2 + cStride + x / 2];
+            CPPUNIT_ASSERT(abs(u - (int)(-0.169 * r - 0.331 * g + 0.500 * b + 128)) <= 1);
+            CPPUNIT_ASSERT(abs(v - (int)(0.500 * r - 0.419 * g - 0.081 * b + 128)) <= 1);
+        }
+    }
+    // Padding is zeroed
+    CPPUNIT_ASSERT(yv12[4] == 0 && yv12[yStride * 2 + 2] == 0);
+
+    // The SIMD rows and the scalar ends of rows, on one thread or several, give the same
+    // bytes, with NV12 holding the chroma of YV12 interleaved
+    const UInt32 width = 1283, height = 722;
+    std::vector<UInt8> large(width * height * 4);
+    for (size_t i = 0; i < large.size(); ++i)
+    {
+        large[i] = (i * 2654435761u) >> 24;
+    }
+    std::vector<UInt8> single(YV12Size(width, height)), threaded(YV12Size(width, height));
+    RGBAToYV12(large.data(), single.data(), width, height, 1);
+    RGBAToYV12(large.data(), threaded.data(), width, height, 4);
+    CPPUNIT_ASSERT(single == threaded);
+    std::vector<UInt8> nv12(NV12Size(width, height));
+    CPPUNIT_ASSERT(RGBAToNV12(large.data(), nv12.data(), width, height, 3) == nv12.size());
+    const UInt32 largeStride = 1296, largeCStride = 656;
+    CPPUNIT_ASSERT(memcmp(nv12.data(), single.data(), largeStride * height) == 0);
+    for (UInt32 y = 0; y < height / 2; ++y)
+    {
+        for (UInt32 x = 0; x < (width + 1) / 2; ++x)
+        {
+            const UInt8 *uv = &nv12[largeStride * height + y * largeStride + x * 2];
+            CPPUNIT_ASSERT(uv[0] == single[largeStride * height + largeCStride * height / 2 + y * largeCStride + x]);
+            CPPUNIT_ASSERT(uv[1] == single[largeStride * height + y * largeCStride + x]);
+        }
+    }
+}
+
+void ImageTest::testConvert()
+{
+    // Every length, so that both the SIMD part and the rest of a row are checked against
+    // the widening by bit replication
+    for (UInt32 count = 0; count < 40; ++count)
+    {
+        std::vector<UInt16> packed(count);
+        std::vector<UInt8> gray(count), rgba(count * 4);
+        for (UInt32 i = 0; i < count; ++i)
+        {
+            packed[i] = (i * 2654435761u) >> 16;
+            gray[i] = i * 7;
+        }
+        for (UInt32 i = 0; i < count * 4; ++i)
+        {
+            rgba[i] = (i * 2654435761u) >> 24;
+        }
+        std::vector<UInt8> rgb8(count * 3), rgba8(count * 4);
+        RGB565ToRGB8(packed.data(), rgb8.data(), count);
+        for (UInt32 i = 0; i < count; ++i)
+        {
+            const UInt32 r = packed[i] >> 11, g = (packed[i] >> 5) & 0x3f, b = packed[i] & 0x1f;
+            CPPUNIT_ASSERT(rgb8[i * 3] == ((r << 3) | (r >> 2)));
+            CPPUNIT_ASSERT(rgb8[i * 3 + 1] == ((g << 2) | (g >> 4)));
+            CPPUNIT_ASSERT(rgb8[i * 3 + 2] == ((b << 3) | (b >> 2)));
+        }
+        RGBA4444ToRGBA8(packed.data(), rgba8.data(), count);
+        for (UInt32 i = 0; i < count; ++i)
+        {
+            for (UInt32 c = 0; c < 4; ++c)
+            {
+                CPPUNIT_ASSERT(rgba8[i * 4 + c] == ((packed[i] >> (12 - c * 4)) & 0xf) * 17);
+            }
+        }
+        RGBA5551ToRGBA8(packed.data(), rgba8.data(), count);
+        for (UInt32 i = 0; i < count; ++i)
+        {
+            CPPUNIT_ASSERT(rgba8[i * 4 + 3] == (packed[i] & 1) * 255);
+        }
+        GrayToRGB8(gray.data(), rgb8.data(), count);
+        for (UInt32 i = 0; i < count * 3; ++i)
+        {
+            CPPUNIT_ASSERT(rgb8[i] == gray[i / 3]);
+        }
+        RGBA8ToRGB8(rgba.data(), rgb8.data(), count);
+        for (UInt32 i = 0; i < count * 3; ++i)
+        {
+            CPPUNIT_ASSERT(rgb8[i] == rgba[i / 3 * 4 + i % 3]);
+        }
+        SwapRedBlue8(rgba.data(), rgba8.data(), count);
+        for (UInt32 i = 0; i < count; ++i)
+        {
+            CPPUNIT_ASSERT(rgba8[i * 4] == rgba[i * 4 + 2] && rgba8[i * 4 + 2] == rgba[i * 4]);
+            CPPUNIT_ASSERT(rgba8[i * 4 + 1] == rgba[i * 4 + 1] && rgba8[i * 4 + 3] == rgba[i * 4 + 3]);
+        }
+    }
+
+    // Every half, against its value worked out from the fields
+    std::vector<UInt16> halves(65536);
+    for (UInt32 i = 0; i < halves.size(); ++i)
+    {
+        halves[i] = i;
+    }
+    std::vector<float> floats(halves.size());
+    HalfToFloat(halves.data(), floats.data(), halves.size());
+    for (UInt32 i = 0; i < halves.size(); ++i)
+    {
+        const int exponent = (i >> 10) & 0x1f, mantissa = i & 0x3ff;
+        float expected;
+        if (exponent == 0x1f)
+            expected = mantissa ? NAN : INFINITY;
+        else if (exponent == 0)
+            expected = ldexpf(mantissa, -24);
+        else
+            expected = ldexpf(mantissa + 1024, exponent - 25);
+        if (i & 0x8000)
+            expected = -expected;
+        CPPUNIT_ASSERT(floats[i] == expected || (std::isnan(floats[i]) && std::isnan(expected)));
+    }
+
+    const float values[] = { 0.0f, 1.0f, 0.5f, -1.0f, 2.0f, NAN, INFINITY, -INFINITY, 0.25f, 0.75f, 0.1f, 0.9f, 0.01f, 0.99f, 0.3f, 0.6f, 0.2f };
+    const UInt8 expected[] = { 0, 255, 128, 0, 255, 0, 255, 0, 64, 191, 26, 230, 3, 252, 77, 153, 51 };
+    UInt8 unorm[17];
+    FloatToUNorm8(values, unorm, 17);
+    CPPUNIT_ASSERT(memcmp(unorm, expected, sizeof(expected)) == 0);
+
+    const UInt32 depth[] = { 0xffffff00, 0x00000001, 0x80000000 };
+    UInt8 grey[3];
+    Depth32ToGray8(depth, grey, 3);
+    CPPUNIT_ASSERT(grey[0] == 255 && grey[1] == 0 && grey[2] == 128);
+
+    UInt8 srgb[4] = { 0, 255, 188, 77 };
+    SRGB8ToLinear8(srgb, srgb, 4, true);
+    CPPUNIT_ASSERT(srgb[0] == 0 && srgb[1] == 255 && srgb[2] == 128 && srgb[3] == 77);
+    Linear8ToSRGB8(srgb, srgb, 3, false);
+    CPPUNIT_ASSERT(srgb[0] == 0 && srgb[1] == 255 && srgb[2] == 188);
+
+    // Whole images, flipped
+    UInt16 pixels[] = { 0xf800, 0x07e0, 0x001f, 0xffff, 0x0000, 0x0000 };
+    Image input(3, 2, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, sizeof(pixels), (UInt8 *)pixels);
+    Image output;
+    CPPUNIT_ASSERT(ConvertToUByte(input, output, true));
+    const UInt8 flipped[] = { 255, 255, 255, 0, 0, 0, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255 };
+    CPPUNIT_ASSERT(output.Format() == GL_RGB && output.Type() == GL_UNSIGNED_BYTE);
+    CPPUNIT_ASSERT(output.DataSize() == sizeof(flipped) && memcmp(output.Data(), flipped, sizeof(flipped)) == 0);
+    CPPUNIT_ASSERT(CanConvertToUByte(GL_DEPTH_STENCIL_OES, GL_UNSIGNED_INT_24_8_OES));
+    CPPUNIT_ASSERT(!CanConvertToUByte(GL_BGRA_EXT, GL_FLOAT));
+
+    UInt8 rows[] = { 1, 2, 3, 4, 5, 6 };
+    FlipRows(rows, 2, 3);
+    const UInt8 flippedRows[] = { 5, 6, 3, 4, 1, 2 };
+    CPPUNIT_ASSERT(memcmp(rows, flippedRows, sizeof(rows)) == 0);
+}
+
 void ImageTest::testETC2()
 {
     CPPUNIT_ASSERT(IsValidCompressionOption("ETC2_A1"));
@@ -12,6 +12,9 @@ class ImageTest : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testCompressionCommon);
     CPPUNIT_TEST(testBTC);
     CPPUNIT_TEST(testETC1);
+    CPPUNIT_TEST(testETC1Decode);
+    CPPUNIT_TEST(testYUV);
+    CPPUNIT_TEST(testConvert);
     CPPUNIT_TEST(testETC2);
     CPPUNIT_TEST(testASTC);
     CPPUNIT_TEST(testMipmap);
@@ -29,6 +32,9 @@ public:
     void testCompressionCommon();
     void testBTC();
     void testETC1();
+    void testETC1Decode();
+    void testYUV();
+    void testConvert();
     void testETC2();
     void testASTC();
     void testMipmap();
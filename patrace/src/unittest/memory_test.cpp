@@ -44,11 +44,53 @@ void MemoryTest::testMD5()
     // and with a strided memory
     CPPUNIT_ASSERT(memcmp(digest1, digest2, 16) == 0);
 
+    // and with the strided constructor
+    MD5Digest digest3((void*)(orig_data + 2), 4, 2, 3);
+    CPPUNIT_ASSERT(digest3 == digest1);
+
     ClientSideBufferObject mb(ele_data, sizeof(ele_data));
     CPPUNIT_ASSERT(mb.base_address == ele_data);
     CPPUNIT_ASSERT(mb.size == sizeof(ele_data));
-    MD5Digest digest = mb.md5_digest();
-    CPPUNIT_ASSERT(memcmp(digest, digest2, 16) == 0);
+    CPPUNIT_ASSERT(mb.digest() == ContentDigest(ele_data, sizeof(ele_data)));
+}
+
+void MemoryTest::testContentDigest()
+{
+    // MurmurHash3 x64 128 with seed 0
+    CPPUNIT_ASSERT(ContentDigest("foo", 3).text_lower() == "6145f501578671e2877dba2be487af7e");
+    CPPUNIT_ASSERT(ContentDigest(NULL, 0) == ContentDigest());
+
+    std::vector<unsigned char> data(10000);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = (unsigned char)(i * 131 + (i >> 5));
+    }
+
+    // appending in pieces that do not line up with the blocks gives the same digest
+    FastHasher hasher;
+    hasher.init();
+    for (size_t i = 0; i < data.size(); i += 7)
+    {
+        hasher.append(&data[i], std::min<size_t>(7, data.size() - i));
+    }
+    ContentDigest pieces;
+    hasher.finish(pieces);
+    CPPUNIT_ASSERT(pieces == ContentDigest(&data[0], data.size()));
+
+    // strided elements, with and without gathering them into blocks, hash as if contiguous
+    const int sizes[] = { 3, 12, 40, 3000 };
+    for (int size : sizes)
+    {
+        const int stride = size + 5;
+        const int count = data.size() / stride;
+        std::vector<unsigned char> elements;
+        for (int i = 0; i < count; ++i)
+        {
+            elements.insert(elements.end(), &data[i * stride], &data[i * stride] + size);
+        }
+        CPPUNIT_ASSERT(ContentDigest(&data[0], stride, size, count) == ContentDigest(&elements[0], elements.size()));
+        CPPUNIT_ASSERT(MD5Digest(&data[0], stride, size, count) == MD5Digest(&elements[0], elements.size()));
+    }
 }
 
 void MemoryTest::testMemoryBase()
@@ -62,7 +104,7 @@ void MemoryTest::testMemoryBase()
     ClientSideBufferObject mb;
     CPPUNIT_ASSERT(mb.base_address == NULL);
     CPPUNIT_ASSERT(mb.size == 0);
-    CPPUNIT_ASSERT(mb.md5_digest() == MD5Digest());
+    CPPUNIT_ASSERT(mb.digest() == ContentDigest());
 
     // Initialized with address and length, without copy
     mb = ClientSideBufferObject(PTR_MOVE(orig_data, 0x04), 0x10, false);
@@ -94,13 +136,13 @@ void MemoryTest::testMemoryBase()
     CPPUNIT_ASSERT(mb.base_address != BUFFER1);
     CPPUNIT_ASSERT(mb.size == 8);
     CPPUNIT_ASSERT(memcmp(mb.base_address, BUFFER1, 8) == 0);
-    CPPUNIT_ASSERT(mb.md5_digest() == MD5Digest(BUFFER1, 8));
+    CPPUNIT_ASSERT(mb.digest() == ContentDigest(BUFFER1, 8));
 
     // Set sub-data
     mb.set_subdata(BUFFER3, 2, 2);
     CPPUNIT_ASSERT(mb.size == 8);
     CPPUNIT_ASSERT(memcmp(mb.base_address, BUFFER2, 8) == 0);
-    CPPUNIT_ASSERT(mb.md5_digest() == MD5Digest(BUFFER2, 8));
+    CPPUNIT_ASSERT(mb.digest() == ContentDigest(BUFFER2, 8));
 }
 
 void MemoryTest::testDataInitialization()
@@ -225,4 +267,13 @@ void MemoryTest::testClientSideBufferObjectSet()
 
     memcpy(BUFFER0, BUFFER1, 16);
     CPPUNIT_ASSERT(mbs.find(0, ClientSideBufferObject(BUFFER0, 16), name) == false);
+
+    // A referenced memory range is used in place, and copied before sub-data is set
+    mbs.object_reference(0, 0, 16, BUFFER1);
+    CPPUNIT_ASSERT(mbs.translate_address(0, 0, 0) == BUFFER1);
+    mbs.object_subdata(0, 0, 15, 1, buffer0);
+    CPPUNIT_ASSERT(mbs.translate_address(0, 0, 0) != BUFFER1);
+    CPPUNIT_ASSERT(BUFFER1[15] == 0x0D);
+    CPPUNIT_ASSERT(static_cast<const unsigned char*>(mbs.translate_address(0, 0, 0))[15] == buffer0[0]);
+    CPPUNIT_ASSERT(memcmp(mbs.translate_address(0, 0, 0), BUFFER1, 15) == 0);
 }
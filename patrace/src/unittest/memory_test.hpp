@@ -9,6 +9,7 @@ class MemoryTest : public CPPUNIT_NS::TestFixture
 
     CPPUNIT_TEST(testMemoryBase);
     CPPUNIT_TEST(testMD5); 
+    CPPUNIT_TEST(testContentDigest);
     CPPUNIT_TEST(testDataInitialization);
     CPPUNIT_TEST(testClientSideBufferObjectSet);
 
@@ -22,6 +23,7 @@ public:
 
     void testMemoryBase();
     void testMD5();
+    void testContentDigest();
     void testDataInitialization();
     void testClientSideBufferObjectSet();
 };
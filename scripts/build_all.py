@@ -32,6 +32,8 @@ linux_platforms = [
     'wayland_arm_hardfloat',
     'wayland_aarch64',
     'wayland_x64',
+    'surfaceless_aarch64',
+    'surfaceless_x64',
     'rhe6_x32',
     'rhe6_x64',
 ]
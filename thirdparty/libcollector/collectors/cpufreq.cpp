@@ -22,6 +22,7 @@ bool CPUFreqCollector::init()
         std::string filename_tis = "/sys/devices/system/cpu/cpu" + _to_string(core) + "/cpufreq/stats/time_in_state";
         FILE *tis = fopen(filename_tis.c_str(), "r");
         mCores.emplace_back(tis, cf, core, "cpu_" + _to_string(core));
+        mCores.back().metric = metric(mCores.back().corename);
         while (tis && fscanf(tis, "%ld %ld\n", &freq, &times) == 2)
         {
             mCores.back().frequencies.push_back(freq);
@@ -31,6 +32,7 @@ bool CPUFreqCollector::init()
         std::string filename_cf = "/sys/devices/system/cpu/cpu" + _to_string(core) + "/cpufreq/scaling_cur_freq";
         cf = fopen(filename_cf.c_str(), "r");
     }
+    mHighestAvg = metric("highest_avg");
     return core > 0;
 }
 
@@ -55,6 +57,7 @@ bool CPUFreqCollector::start()
     {
         long freq = 0;
         long times = 0;
+        c.sampled = false;
         if (c.time_in_state)
         {
             rewind(c.time_in_state);
@@ -100,7 +103,7 @@ bool CPUFreqCollector::collect(int64_t /* now */)
         }
         if (sum == 0) // this can happen - time_in_state updates relatively slowly - so reuse previous result
         {
-            if (mResults[c.corename].size() == 0) // no previous result?
+            if (!c.sampled) // no previous result?
             {
                 // Just read the current frequency
                 rewind(c.freq_file);
@@ -110,15 +113,17 @@ bool CPUFreqCollector::collect(int64_t /* now */)
             }
             else
             {
-                sum = mResults[c.corename].data().back().i64; // reuse
+                sum = c.last; // reuse
             }
             values = 1;
         }
         const int64_t avg = sum / values;
-        add(c.corename, avg);
+        c.last = avg;
+        c.sampled = true;
+        add(c.metric, avg);
         highest_avg = avg > highest_avg ? avg : highest_avg;
     }
-    add("highest_avg", highest_avg);
+    add(mHighestAvg, highest_avg);
     return true;
 }
 
@@ -13,6 +13,9 @@ struct Core
     std::string corename;
     std::vector<int> frequencies; // states
     std::vector<int64_t> times; // times in state
+    int metric = -1; // handle of corename
+    bool sampled = false; // whether last is set
+    int64_t last = 0; // previous result
 
     Core(FILE* tis, FILE* cf, int c, const std::string& n)
         : time_in_state(tis), freq_file(cf), core(c), corename(n) {}
@@ -37,4 +40,5 @@ public:
 
 private:
     std::list<Core> mCores;
+    int mHighestAvg = -1;
 };
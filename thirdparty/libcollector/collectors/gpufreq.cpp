@@ -21,7 +21,7 @@ static const std::vector<std::string> options =
 };
 
 GPUFreqCollector::GPUFreqCollector(const Json::Value& config, const std::string& name)
-    : SysfsCollector(config, name, options)
+    : SysfsCollector(config, name, options), mFreq(metric("gpufreq"))
 {
     if (mConfig.isMember("path"))
     {
@@ -58,7 +58,7 @@ bool GPUFreqCollector::parse(const char* buffer)
             freq /= ONE_MILLION;
         }
     }
-    add("gpufreq", freq * 1000);
+    add(mFreq, freq * 1000);
 
     return true;
 }
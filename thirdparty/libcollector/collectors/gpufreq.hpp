@@ -11,4 +11,7 @@ public:
 
 protected:
     virtual bool parse(const char* buffer) override;
+
+private:
+    int mFreq;
 };
@@ -315,6 +315,15 @@ enum {
 
 };
 
+/* The events that make the reader write a buffer, in kbase_hwcnt_reader_metadata::event_id */
+enum
+{
+    BASE_HWCNT_READER_EVENT_MANUAL,
+    BASE_HWCNT_READER_EVENT_PERIODIC,
+    BASE_HWCNT_READER_EVENT_PREJOB,
+    BASE_HWCNT_READER_EVENT_POSTJOB
+};
+
 enum
 {
     PIPE_DESCRIPTOR_IN,   /**< The index of a pipe's input descriptor. */
@@ -482,6 +482,7 @@ bool MaliHWCReader::wait_next_event()
 
 		memcpy(counter_buffer.data(), sample_data + buffer_size * meta.buffer_idx, buffer_size);
 		timestamp = meta.timestamp;
+		event_id = meta.event_id;
 
 		if (ioctl(hwc_fd, KBASE_HWCNT_READER_PUT_BUFFER, &meta) != 0)
 		{
@@ -499,4 +500,24 @@ bool MaliHWCReader::wait_next_event()
 	else
 		return false;
 }
+
+bool MaliHWCReader::dump()
+{
+	if (ioctl(hwc_fd, KBASE_HWCNT_READER_DUMP, 0) != 0)
+	{
+		DBG_LOG("Failed READER_DUMP.\n");
+		return false;
+	}
+
+	do
+	{
+		if (!wait_next_event())
+		{
+			return false;
+		}
+	}
+	while (event_id != BASE_HWCNT_READER_EVENT_MANUAL);
+
+	return true;
+}
 }
@@ -66,6 +66,10 @@ public:
 	// Waits until next HWC data has been received and reads the data.
 	bool wait_next_event();
 
+	// Dumps the counters now and reads them, skipping any periodic data received before.
+	// The counters count from zero again after each dump.
+	bool dump();
+
 	// Remap a virtual core ID [0, 1, ..., N] to physical core ID (might have holes on some platforms).
 	unsigned remap_core_index(unsigned index) const;
 
@@ -86,6 +90,7 @@ private:
 	uint8_t *sample_data = nullptr;
 
 	uint64_t timestamp = 0;
+	uint32_t event_id = 0;
 	std::vector<uint32_t> counter_buffer;
 	const char * const *names_lut = nullptr;
 	bool alive = false;
@@ -60,6 +60,10 @@ bool MaliCounterCollector::init(){
 
     num_counters = header.size();
     counter_buffer.resize(num_counters);
+    metrics.clear();
+    for (const std::string& name : header){
+        metrics.push_back(metric(name));
+    }
 
     return true;
 }
@@ -140,12 +144,17 @@ bool MaliCounterCollector::collect(int64_t /* now */){
 
     float total_sum = 0;
 
+    // counts since the previous collect() or start()
+    if (!counter_reader.dump()){
+        return false;
+    }
+
     //TODO: We can optimize here if we need to
     for (size_t index = 0; index < num_counters; ++index){
         int core_index = core_indices[index];
         if (core_index == -1){
             add(
-                header[index],
+                metrics[index],
                 counter_reader.get_counters(
                     indices[index].first
                 )[indices[index].second]
@@ -157,7 +166,7 @@ bool MaliCounterCollector::collect(int64_t /* now */){
         }
         else{
             add(
-                header[index],
+                metrics[index],
                 counter_reader.get_counters(
                     indices[index].first,
                     core_index
@@ -28,12 +28,14 @@ public:
     bool start() override;
     bool collect(int64_t) override;
     bool available() override;
+    bool countsSinceLast() const override { return true; }
 
 private:
 	InfoCapsule infoc;
 	mali_userspace::MaliHWCReader counter_reader;
 
 	std::vector<std::string> header;
+	std::vector<int> metrics; // handles of header
 	std::vector<std::pair<mali_userspace::MaliCounterBlockName, int>> indices;
 	std::vector<int> core_indices;
 
@@ -59,6 +59,9 @@ static size_t getFreeSystemMemory()
 bool MemoryCollector::init()
 {
     initialAvailableRAM = getFreeSystemMemory();
+    mMaxRSS = metric("memory_max_rss");
+    mCurRSS = metric("memory_cur_rss");
+    mUsed = metric("memory_used");
     return true;
 }
 
@@ -96,9 +99,9 @@ bool MemoryCollector::collect(int64_t /* now */)
     int64_t availableNow = getFreeSystemMemory();
     int64_t diff = initialAvailableRAM - availableNow;
 
-    add("memory_max_rss", usage.ru_maxrss);
-    add("memory_cur_rss", getCurrentRSS() / 1024);
-    add("memory_used", diff / 1024);
+    add(mMaxRSS, usage.ru_maxrss);
+    add(mCurRSS, getCurrentRSS() / 1024);
+    add(mUsed, diff / 1024);
 
     return true;
 }
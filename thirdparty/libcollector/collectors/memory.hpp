@@ -20,4 +20,7 @@ public:
 
 private:
     int64_t initialAvailableRAM = 0;
+    int mMaxRSS = -1;
+    int mCurRSS = -1;
+    int mUsed = -1;
 };
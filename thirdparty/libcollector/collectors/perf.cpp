@@ -123,6 +123,11 @@ bool PerfCollector::init()
         mCounters["CPUBranchMispredictions"] = add_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, group);
     }
     for (const auto pair : mCounters) if (pair.second == -1) { DBG_LOG("libcollector perf: Failed to init counter %s\n", pair.first.c_str()); return false; }
+    mEvents.clear();
+    for (const auto& pair : mCounters)
+    {
+        mEvents.emplace_back(pair.second, metric(pair.first));
+    }
     return true;
 }
 
@@ -132,6 +137,7 @@ bool PerfCollector::deinit()
         if (pair.second != -1)
             close(pair.second);
     mCounters.clear();
+    mEvents.clear();
     return true;
 }
 
@@ -188,21 +194,21 @@ bool PerfCollector::collect(int64_t /* now */)
     if (!mCollecting)
         return false;
 
-    for (const auto pair : mCounters)
+    for (const auto& event : mEvents)
     {
-        if (pair.second == -1) continue;
-        if (read(pair.second, &count, sizeof(long long)) == -1)
+        if (event.first == -1) continue;
+        if (read(event.first, &count, sizeof(long long)) == -1)
         {
             perror("read");
             return false;
         }
 
-        if (ioctl(pair.second, PERF_EVENT_IOC_RESET, 0) == -1)
+        if (ioctl(event.first, PERF_EVENT_IOC_RESET, 0) == -1)
         {
             perror("ioctl PERF_EVENT_IOC_RESET");
             return false;
         }
-        add(pair.first, count);
+        add(event.second, count);
     }
 
     return true;
@@ -14,8 +14,10 @@ public:
     virtual bool stop() override;
     virtual bool collect(int64_t) override;
     virtual bool available() override;
+    virtual bool countsSinceLast() const override { return true; }
 
 private:
     std::map<std::string, int> mCounters;
+    std::vector<std::pair<int, int>> mEvents; ///< counter fd and metric handle, in the order of mCounters
     int mSet = 0;
 };
@@ -22,6 +22,9 @@ typedef double float64;
 
 #define TOTAL_POWER_TRUNC_COEFFICIENT 1000000.0
 
+// the daemon samples every rail at 10 kHz
+#define SAMPLE_MICROSECONDS 100
+
 // assume 8-bit char
 struct Rail
 {
@@ -235,7 +238,7 @@ bool PowerDaemon::start(const Json::Value& config_root)
     return simpleSync('R', 'T', 'O', 'K', 15000);
 }
 
-bool PowerDaemon::stop(const std::vector<int64_t>& timing, CollectorValueResults &results)
+bool PowerDaemon::stop(const std::vector<int64_t>& timing, CollectorValueResults &results, std::vector<double>& energy)
 {
     // check if the daemon has an error to report
     char recvbuf[2];
@@ -298,14 +301,6 @@ bool PowerDaemon::stop(const std::vector<int64_t>& timing, CollectorValueResults
     DBG_LOG("Got %u bytes of data (%u samples or %3.3f s) from the daemon.\n", numBytes,
             totalSamples, (float)totalSamples / (10000 * 2 * numRails));
 
-    std::vector<int64_t> frameDurations;
-    int64_t prev = 0;
-    for (const auto i : timing)
-    {
-        frameDurations.push_back(i - prev);
-        prev = i;
-    }
-
     unsigned int currentTime = 0; // unit = one sample (100 us)
 
     long long accountedv[numRails];
@@ -316,18 +311,25 @@ bool PowerDaemon::stop(const std::vector<int64_t>& timing, CollectorValueResults
     memset(accountedp, 0x00, sizeof(accountedp));
     unsigned int accountedSamples = 0;
 
-    double nextFrameEndTime = 0;
-    for (const auto i : frameDurations)
+    // the frames are given by their durations in microseconds, and each gets the samples taken
+    // until its end, with the energy of every sample being its power for one sample period
+    int64_t nextFrameEndTime = 0;
+    for (const auto i : timing)
     {
         nextFrameEndTime += i;
-        unsigned int nextFrameEndTimeInSamples = (unsigned int)(nextFrameEndTime * 10000);
+        unsigned int nextFrameEndTimeInSamples = (unsigned int)(nextFrameEndTime / SAMPLE_MICROSECONDS);
         unsigned int samples = 0;
         int64_t framev[numRails];
         int64_t framei[numRails];
         int64_t framep[numRails];
+        double framee[numRails]; // joules
         memset(framev, 0x00, sizeof(framev));
         memset(framei, 0x00, sizeof(framei));
         memset(framep, 0x00, sizeof(framep));
+        for (unsigned int i = 0; i < numRails; i++)
+        {
+            framee[i] = 0.0;
+        }
 
         while (currentTime < nextFrameEndTimeInSamples)
         {
@@ -346,11 +348,20 @@ bool PowerDaemon::stop(const std::vector<int64_t>& timing, CollectorValueResults
                 framev[i] += (int64_t)(voltage * TOTAL_POWER_TRUNC_COEFFICIENT);
                 framei[i] += (int64_t)(shuntVoltage * railResistorCoefficients[i] * TOTAL_POWER_TRUNC_COEFFICIENT);
                 framep[i] += (int64_t)(power * TOTAL_POWER_TRUNC_COEFFICIENT);
+                framee[i] += power * SAMPLE_MICROSECONDS / 1000000.0;
             }
             currentTime++;
             samples++;
         }
 
+        // every frame, so that they line up with the frames of the other collectors
+        double frameEnergy = 0.0;
+        for (unsigned int i = 0; i < numRails; i++)
+        {
+            frameEnergy += framee[i];
+        }
+        energy.push_back(frameEnergy);
+
         if (samples)
         {
             results["num_samples"].push_back(samples);
@@ -363,6 +374,7 @@ bool PowerDaemon::stop(const std::vector<int64_t>& timing, CollectorValueResults
                 results[railName + "_voltage"].push_back(avgv * 1000.0);
                 results[railName + "_current"].push_back(avgi * 1000.0);
                 results[railName + "_power"].push_back(avgp * 1000.0);
+                results[railName + "_energy"].push_back(framee[i] * 1000.0);
                 accountedv[i] += framev[i];
                 accountedi[i] += framei[i];
                 accountedp[i] += framep[i];
@@ -671,7 +683,7 @@ bool PowerDataCollector::start()
 
 bool PowerDataCollector::postprocess(const std::vector<int64_t>& timing)
 {
-    if (!mPD.stop(timing, mResults))
+    if (!mPD.stop(timing, mResults, mEnergy))
     {
         DBG_LOG("Power data collector: could not stop measurement.\n");
     }
@@ -14,7 +14,9 @@ public:
     bool connectToDaemon(const std::string& ip, int port, int timeout);
     bool handshake(int timeoutInSeconds);
     bool start(const Json::Value& config);
-    bool stop(const std::vector<int64_t>& timing, CollectorValueResults &results);
+    /// Take the samples of frames of the given durations, in microseconds, as averages and as
+    /// the joules used per frame
+    bool stop(const std::vector<int64_t>& timing, CollectorValueResults &results, std::vector<double>& energy);
 
     bool disconnect();
     void setRawCollection(bool v);
@@ -17,7 +17,9 @@ static std::vector<std::string> getStatPaths()
 ProcFSStatCollector::ProcFSStatCollector(const Json::Value& config, const std::string& name)
     : SysfsCollector(config, name, getStatPaths()),
       mTicks(sysconf(_SC_CLK_TCK)),
-      mLastSampleTime(0)
+      mLastSampleTime(0),
+      mCPUTime(metric("cpu_time")),
+      mThreads(metric("threads"))
 {
     if (!mTicks)
     {
@@ -64,14 +66,14 @@ bool ProcFSStatCollector::parse(const char* buffer)
     if (mLastSampleTime == 0)
     {
         mLastSampleTime = tot_time;
-        add("cpu_time", 0.0f);
+        add(mCPUTime, 0.0f);
     }
     else
     {
-        add("cpu_time", double(tot_time - mLastSampleTime) / double(mTicks));
+        add(mCPUTime, double(tot_time - mLastSampleTime) / double(mTicks));
         mLastSampleTime = tot_time;
     }
-    add("threads", num_threads);
+    add(mThreads, num_threads);
 
     return true;
 }
@@ -14,4 +14,6 @@ protected:
 private:
     long mTicks;
     unsigned long mLastSampleTime;
+    int mCPUTime;
+    int mThreads;
 };
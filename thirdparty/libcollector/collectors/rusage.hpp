@@ -19,4 +19,12 @@ public:
 
 private:
     struct rusage prev;
+    int mKernelCPUTime = -1;
+    int mUserCPUTime = -1;
+    int mPageFaultsNoIO = -1;
+    int mPageFaultsWithIO = -1;
+    int mIOBlockOnInput = -1;
+    int mIOBlockOnOutput = -1;
+    int mVoluntaryContextSwitches = -1;
+    int mInvoluntaryContextSwitches = -1;
 };
@@ -46,8 +46,11 @@ void Collector::loop()
     while (!finished)
     {
         int64_t t1 = getTime();
+        mSampleTime = t1;
         collect( t1 );
         int64_t t2 = getTime();
+        mThreadTime.fetch_add(t2 - t1, std::memory_order_relaxed);
+        mThreadSamples.fetch_add(1, std::memory_order_relaxed);
 
         auto duration = std::chrono::microseconds( t2 - t1 );
 
@@ -58,37 +61,201 @@ void Collector::loop()
     }
 }
 
-// This post-processing assumes that the sampling done in a threaded collector is
-// fairly uniform. If it is not, we will need to collect timestamps from it as well,
-// in order to do the matching, which has its own costs.
-bool Collector::postprocess(const std::vector<int64_t>& timing)
+int Collector::metric(const std::string& key)
 {
-    if (mIsThreaded && !mIsSummarized) // remix values based on frame times
+    for (unsigned i = 0; i < mMetrics.size(); i++)
     {
-        double duration = 0;
-        for (const int64_t v : timing)
+        if (mMetrics[i].key == key)
         {
-            duration += v;
+            return i;
         }
-        CollectorValueResults tmp;
-        for (const auto& kv : mResults)
+    }
+    const auto it = mResults.find(key);
+    mMetrics.emplace_back();
+    mMetrics.back().key = key;
+    mMetrics.back().values = (it != mResults.end()) ? &it->second : nullptr;
+    return mMetrics.size() - 1;
+}
+
+void Collector::reserve(size_t samples)
+{
+    mReserved = samples;
+    for (auto& pair : mResults)
+    {
+        pair.second.reserve(samples);
+    }
+}
+
+void Collector::startThread(int64_t epoch)
+{
+    if (mRing.empty())
+    {
+        // enough for a few frames at the highest sample rate, as it is drained every frame
+        mRing.resize(mConfig.get("ring_size", 4096).asUInt());
+    }
+    mRing.clear();
+    mDropped = 0;
+    for (CollectorMetric* m : mSampled)
+    {
+        m->held = false;
+        m->pending.clear();
+    }
+    mAligned = epoch;
+    mThreadTime = 0;
+    mThreadSamples = 0;
+    finished = false;
+    thread = std::thread(&Collector::loop, this);
+}
+
+void Collector::drain()
+{
+    CollectorSample s;
+    while (mRing.pop(s))
+    {
+        CollectorMetric* m = s.metric;
+        if (!m->sampled)
+        {
+            m->sampled = true;
+            m->type = s.type;
+            mSampled.push_back(m);
+        }
+        m->pending.push_back(s);
+    }
+}
+
+void Collector::align(const std::vector<int64_t>& timing)
+{
+    drain();
+    const bool residency = mConfig.get("residency", false).asBool();
+    for (CollectorMetric* m : mSampled)
+    {
+        CollectorValueList& list = mResults[m->key];
+        list.type = m->type;
+        const bool resident = residency && m->type != CollectorValueList::TYPE_FP64;
+        size_t next = 0;
+        int64_t end = mAligned;
+        for (const int64_t duration : timing)
         {
-            if (kv.second.size() == 0)
+            const int64_t begin = end;
+            end += duration;
+            // the value at the start of the frame, or the first one sampled if none was before
+            bool known = m->held || next < m->pending.size();
+            CollectorValue current = m->held ? m->last : known ? m->pending[next].value : CollectorValue();
+            int64_t from = begin;
+            std::map<int64_t, int64_t> times;
+            while (next < m->pending.size() && m->pending[next].time <= end)
+            {
+                const CollectorSample& s = m->pending[next++];
+                if (resident && s.time > from)
+                {
+                    times[current.i64] += s.time - from;
+                    from = s.time;
+                }
+                current = s.value;
+                m->last = s.value;
+                m->held = true;
+            }
+            if (resident)
+            {
+                if (known && end > from)
+                {
+                    times[current.i64] += end - from;
+                }
+                list.residency.push_back(times);
+            }
+            if (m->held)
             {
-                return false;
+                list.push_back(m->last);
             }
-            const double samples = kv.second.size();
-            int64_t cur_time = 0;
-            tmp[kv.first].type = kv.second.type;
-            for (unsigned i = 0; i < timing.size(); i++)
+            else if (next < m->pending.size())
             {
-                // find closest match
-                const int index = trunc((double)cur_time / duration * samples);
-                cur_time += timing.at(i);
-                tmp[kv.first].push_back(kv.second.at(index));
+                list.push_back(m->pending[next].value);
             }
         }
-        mResults = tmp;
+        m->pending.erase(m->pending.begin(), m->pending.begin() + next);
+    }
+    for (const int64_t duration : timing)
+    {
+        mAligned += duration;
+    }
+}
+
+Json::Value Collector::collectSpan(int64_t now)
+{
+    std::vector<std::pair<const CollectorValueList*, size_t>> before; // in key order
+    for (const auto& pair : mResults)
+    {
+        before.emplace_back(&pair.second, pair.second.list.size());
+    }
+    collect(now);
+
+    Json::Value values = Json::objectValue;
+    size_t i = 0;
+    for (auto& pair : mResults)
+    {
+        CollectorValueList& list = pair.second;
+        size_t size = 0; // unless it had values before
+        if (i < before.size() && before[i].first == &list)
+        {
+            size = before[i++].second;
+        }
+        if (list.list.size() <= size)
+        {
+            continue;
+        }
+        const CollectorValue v = list.list.back();
+        list.list.pop_back();
+        if (!list.carried)
+        {
+            list.carry.u64 = 0; // all zero bits are 0.0 too
+            list.carried = true;
+            mSpanned = true;
+        }
+        switch (list.type)
+        {
+        case CollectorValueList::TYPE_FP64: values[pair.first] = v.fp64; list.carry.fp64 += v.fp64; break;
+        case CollectorValueList::TYPE_U64: values[pair.first] = static_cast<Json::UInt64>(v.u64); list.carry.u64 += v.u64; break;
+        case CollectorValueList::TYPE_I64: values[pair.first] = static_cast<Json::Int64>(v.i64); list.carry.i64 += v.i64; break;
+        case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
+        }
+    }
+    return values;
+}
+
+void Collector::foldSpans()
+{
+    if (!mSpanned)
+    {
+        return;
+    }
+    for (auto& pair : mResults)
+    {
+        CollectorValueList& list = pair.second;
+        if (!list.carried || list.list.empty())
+        {
+            continue;
+        }
+        CollectorValue& v = list.list.back();
+        switch (list.type)
+        {
+        case CollectorValueList::TYPE_FP64: v.fp64 += list.carry.fp64; break;
+        case CollectorValueList::TYPE_U64: v.u64 += list.carry.u64; break;
+        case CollectorValueList::TYPE_I64: v.i64 += list.carry.i64; break;
+        case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
+        }
+        list.carried = false;
+    }
+    mSpanned = false;
+}
+
+bool Collector::postprocess(const std::vector<int64_t>& timing)
+{
+    if (mIsThreaded)
+    {
+        if (mDropped > 0)
+        {
+            DBG_LOG("%s: Dropped %u samples, as the frames took too long to take them. Set a larger ring_size or a lower sample_rate.\n", mName.c_str(), mDropped);
+        }
     }
     return true;
 }
@@ -96,7 +263,7 @@ bool Collector::postprocess(const std::vector<int64_t>& timing)
 // ---------- SYSFS COLLECTOR ----------
 
 SysfsCollector::SysfsCollector(const Json::Value& config, const std::string& name, const std::vector<std::string>& sysfsfiles, bool accumulative)
-    : Collector(config, name), mOptions(sysfsfiles), mAccumulative(accumulative)
+    : Collector(config, name), mOptions(sysfsfiles), mAccumulative(accumulative), mValue(metric(name))
 {
     (void)mAccumulative; // TBD - use me
 }
@@ -111,11 +278,11 @@ bool SysfsCollector::parse(const char* buffer)
     }
     if (std::isnan(mFactor))
     {
-        add(mName, temp);
+        add(mValue, temp);
     }
     else
     {
-        add(mName, temp * mFactor);
+        add(mValue, temp * mFactor);
     }
     return true;
 }
@@ -187,10 +354,76 @@ SysfsCollector::~SysfsCollector()
     mCollecting = false;
 }
 
+// ---------- STREAM ----------
+
+bool CollectorStream::open(const std::string& filename)
+{
+    close();
+    mFile = fopen(filename.c_str(), "w");
+    if (!mFile)
+    {
+        DBG_LOG("Failed to open collector stream %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    mDone = false;
+    mThread = std::thread(&CollectorStream::loop, this);
+    return true;
+}
+
+void CollectorStream::close()
+{
+    if (!mFile)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mMutex);
+        mDone = true;
+    }
+    mCond.notify_one();
+    mThread.join();
+    fclose(mFile);
+    mFile = nullptr;
+}
+
+void CollectorStream::write(const std::string& line)
+{
+    {
+        std::lock_guard<std::mutex> lk(mMutex);
+        mQueue.push_back(line);
+    }
+    mCond.notify_one();
+}
+
+void CollectorStream::loop()
+{
+    std::vector<std::string> lines;
+    bool done = false;
+    while (!done)
+    {
+        {
+            std::unique_lock<std::mutex> lk(mMutex);
+            mCond.wait(lk, [this]{ return mDone || !mQueue.empty(); });
+            lines.swap(mQueue);
+            done = mDone;
+        }
+        for (const std::string& line : lines)
+        {
+            fwrite(line.data(), 1, line.size(), mFile);
+            fputc('\n', mFile);
+        }
+        fflush(mFile); // so that what was collected survives a crash
+        lines.clear();
+    }
+}
+
 // ---------- COLLECTION ----------
 
 Collection::Collection(const Json::Value& config) : mConfig(config)
 {
+    mOverheadBudget = config.get("overhead_budget", 0).asInt64();
+    mStreamFile = config.get("stream_file", "").asString();
+    mStreamWindow = config.get("stream_window", 600).asUInt();
 #ifndef __APPLE__
     mCollectors.push_back(new PerfCollector(config, "perf"));
     mCollectors.push_back(new SysfsCollector(config, "battery_temperature",
@@ -334,21 +567,50 @@ Collector* Collection::collector(const std::string& name)
 void Collection::start(const std::vector<std::string>& headers)
 {
     mTiming.clear();
+    mRunTiming.clear();
+    mLoopEnds.clear();
     mCustom.clear();
     mCustomHeaders.clear();
+    mCollectorTime.clear();
+    mCollectorTimeSummarized.clear();
+    mDisabled.clear();
+    mBudgetFrames = 0;
+    mAlignedFrames = 0;
+    mFrames = 0;
+    if (!mStreamFile.empty())
+    {
+        mStream.open(mStreamFile);
+    }
+    unsigned reserved = mExpectedFrames;
+    if (mStream.isOpen() && mStreamWindow > 0 && (reserved == 0 || reserved > mStreamWindow))
+    {
+        reserved = mStreamWindow; // all that is kept before summarizing
+    }
     mStartTime = getTime();
     mPreviousTime = mStartTime;
     mCustomHeaders = headers;
     mCustom.resize(headers.size());
     mCustomSummarized.resize(headers.size());
+    mTiming.reserve(reserved);
+    mRunTiming.reserve(mExpectedFrames);
+    mCollectorTime.reserve(reserved);
+    for (auto& custom : mCustom)
+    {
+        custom.reserve(reserved);
+    }
     for (Collector* c : mRunning)
     {
         c->clear();
+        c->overhead = CollectorOverhead();
+        if (!c->isThreaded())
+        {
+            c->reserve(reserved);
+            c->overhead.collect.reserve(reserved);
+        }
         c->start();
         if (c->isThreaded())
         {
-            c->finished = false;
-            c->thread = std::thread(&Collector::loop, c);
+            c->startThread(mStartTime);
             int failure = pthread_setname_np(
                 c->thread.native_handle(),
                 c->name().c_str());
@@ -372,35 +634,151 @@ void Collection::stop()
             c->finished = true;
         }
     }
-    // Then stop all collectors (this can take some time)
-    std::vector<Collector*> tmp;
+    // Then wait for them, and match their timestamped samples with the frames
     for (Collector* c : mRunning)
     {
         if (c->isThreaded())
         {
             c->thread.join();
+            if (c->threadSamples() > 0)
+            {
+                DBG_LOG("%s: Took %lld us per sample on its thread, sampling every %d ms\n", c->name().c_str(),
+                        (long long)(c->threadTime() / c->threadSamples()), c->sampleRate());
+            }
         }
+    }
+    alignThreaded();
+    // Then stop all collectors (this can take some time)
+    std::vector<Collector*> tmp;
+    for (Collector* c : mRunning)
+    {
         c->stop();
-        if (c->postprocess(mTiming))
+        if (c->overhead.disabled)
+        {
+            continue; // its results stop part way
+        }
+        if (c->postprocess(mRunTiming))
         {
             tmp.push_back(c); // is valid result
         }
     }
     mRunning = tmp;
+    if (mStream.isOpen())
+    {
+        summarizeFrames(); // what is left since the last window
+        mStream.close();
+    }
 
     running = false;
 }
 
+void Collection::alignThreaded()
+{
+    if (mAlignedFrames == mTiming.size())
+    {
+        return;
+    }
+    const std::vector<int64_t> timing(mTiming.begin() + mAlignedFrames, mTiming.end());
+    for (Collector* c : mRunning)
+    {
+        if (c->isThreaded())
+        {
+            c->align(timing);
+        }
+    }
+    mAlignedFrames = mTiming.size();
+}
+
+static void appendValue(std::string& line, CollectorValueList::vtype type, CollectorValue v)
+{
+    char buf[32];
+    switch (type)
+    {
+    case CollectorValueList::TYPE_FP64:
+        if (std::isfinite(v.fp64)) snprintf(buf, sizeof(buf), "%.9g", v.fp64);
+        else snprintf(buf, sizeof(buf), "null");
+        break;
+    case CollectorValueList::TYPE_U64: snprintf(buf, sizeof(buf), "%llu", (unsigned long long)v.u64); break;
+    case CollectorValueList::TYPE_I64: snprintf(buf, sizeof(buf), "%lld", (long long)v.i64); break;
+    case CollectorValueList::TYPE_UNASSIGNED: assert(false); buf[0] = '\0'; break;
+    }
+    line += buf;
+}
+
+void Collection::streamFrame()
+{
+    // Formatted here and written out on the stream's own thread. Names are taken to need no
+    // JSON escaping.
+    std::string& line = mStreamLine;
+    char buf[96];
+    snprintf(buf, sizeof(buf), "{\"frame\":%u,\"time\":%lld,\"collector_time\":%lld", mFrames,
+             (long long)mTiming.back(), (long long)mCollectorTime.back());
+    line = buf;
+    if (!mCustomHeaders.empty())
+    {
+        line += ",\"custom\":{";
+        for (unsigned i = 0; i < mCustomHeaders.size(); i++)
+        {
+            snprintf(buf, sizeof(buf), "%s\"%s\":%lld", i ? "," : "", mCustomHeaders[i].c_str(), (long long)mCustom[i].back());
+            line += buf;
+        }
+        line += "}";
+    }
+    for (Collector* c : mRunning)
+    {
+        if (c->overhead.disabled || c->results().empty())
+        {
+            continue;
+        }
+        line += ",\"";
+        line += c->name();
+        line += "\":{";
+        bool first = true;
+        for (const auto& pair : c->results())
+        {
+            if (pair.second.size() == 0)
+            {
+                continue;
+            }
+            line += first ? "\"" : ",\"";
+            line += pair.first;
+            line += "\":";
+            appendValue(line, pair.second.type, pair.second.list.back());
+            first = false;
+        }
+        line += "}";
+    }
+    line += "}";
+    mStream.write(line);
+}
+
 void Collection::collect(std::vector<int64_t> custom)
 {
     const int64_t now = getTime();
     mTiming.push_back(now - mPreviousTime);
+    mRunTiming.push_back(mTiming.back());
     mPreviousTime = now;
+    int64_t spent = 0;
     for (Collector* c : mRunning)
     {
         if (!c->isThreaded())
         {
+            if (c->overhead.disabled)
+            {
+                c->overhead.collect.push_back(0);
+                continue;
+            }
+            const int64_t before = getTime();
             c->collect( now );
+            c->foldSpans();
+            const int64_t duration = getTime() - before;
+            c->overhead.collect.push_back(duration);
+            c->overhead.window += duration;
+            spent += duration;
+        }
+        else
+        {
+            c->drain();
         }
     }
     assert(custom.size() == mCustomHeaders.size());
@@ -408,6 +786,89 @@ void Collection::collect(std::vector<int64_t> custom)
     {
         mCustom[i].push_back(custom[i]);
     }
+    if (mStream.isOpen())
+    {
+        const int64_t before = getTime();
+        alignThreaded(); // with what was sampled so far, so that the frame is complete
+        mCollectorTime.push_back(spent); // without the streaming, which has to wait
+        streamFrame();
+        mCollectorTime.back() += getTime() - before;
+    }
+    else
+    {
+        // what the collectors took, for comparing frame times with a run without them
+        mCollectorTime.push_back(spent);
+    }
+    mFrames++;
+    if (mOverheadBudget > 0 && ++mBudgetFrames >= 60)
+    {
+        checkOverheadBudget();
+    }
+    if (mStream.isOpen() && mStreamWindow > 0 && mTiming.size() >= mStreamWindow)
+    {
+        summarizeFrames(); // keeps memory bounded, as every frame is in the stream
+    }
+}
+
+void Collection::checkOverheadBudget()
+{
+    int64_t total = 0;
+    int64_t worst = 0;
+    Collector* costliest = nullptr;
+    for (Collector* c : mRunning)
+    {
+        if (c->overhead.disabled)
+        {
+            continue;
+        }
+        int64_t spent = c->overhead.window;
+        if (c->isThreaded()) // not on the frames' thread, but it competes with them for the CPU
+        {
+            const int64_t now = c->threadTime();
+            spent = now - c->overhead.threadBase;
+            c->overhead.threadBase = now;
+        }
+        c->overhead.window = 0;
+        total += spent;
+        if (spent > worst)
+        {
+            worst = spent;
+            costliest = c;
+        }
+    }
+    const int64_t perFrame = total / mBudgetFrames;
+    mBudgetFrames = 0;
+    if (!costliest || perFrame <= mOverheadBudget)
+    {
+        return;
+    }
+    if (costliest->isThreaded())
+    {
+        costliest->lowerSampleRate();
+        DBG_LOG("Collectors took %lld us per frame, over the budget of %lld us. Sampling %s every %d ms.\n",
+                (long long)perFrame, (long long)mOverheadBudget, costliest->name().c_str(), costliest->sampleRate());
+    }
+    else
+    {
+        costliest->overhead.disabled = true;
+        mDisabled.push_back(costliest->name());
+        DBG_LOG("Collectors took %lld us per frame, over the budget of %lld us. Disabled %s.\n",
+                (long long)perFrame, (long long)mOverheadBudget, costliest->name().c_str());
+    }
+}
+
+Json::Value Collection::collectSpan()
+{
+    const int64_t now = getTime();
+    Json::Value values = Json::objectValue;
+    for (Collector* c : mRunning)
+    {
+        if (!c->isThreaded() && c->countsSinceLast() && !c->overhead.disabled)
+        {
+            values[c->name()] = c->collectSpan(now);
+        }
+    }
+    return values;
 }
 
 Json::Value Collection::results()
@@ -435,9 +896,28 @@ Json::Value Collection::results()
                 case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
                 }
             }
+            if (!pair.second.residencyData().empty())
+            {
+                Json::Value& frames = v["residency"][pair.first];
+                frames = Json::arrayValue;
+                for (const auto& times : pair.second.residencyData())
+                {
+                    Json::Value frame = Json::objectValue;
+                    for (const auto& time : times)
+                    {
+                        frame[std::to_string(time.first)] = static_cast<Json::Int64>(time.second);
+                    }
+                    frames.append(frame);
+                }
+            }
         }
         results[c->name()] = v;
     }
+    Json::Value energy = energyResults();
+    if (!energy.isNull())
+    {
+        results["energy"] = energy;
+    }
     Json::Value v;
     v["time"] = Json::arrayValue;
     results["timing"] = v;
@@ -452,6 +932,45 @@ Json::Value Collection::results()
     {
         results["timing"]["time"].append(static_cast<Json::Value::Int64>(t));
     }
+    // time spent in the collectors, per frame or summary, to make up for when comparing the frame
+    // times with those of a run without them
+    const std::vector<int64_t>& collectorTime = mCollectorTimeSummarized.empty() ? mCollectorTime : mCollectorTimeSummarized;
+    results["timing"]["collector_time"] = Json::arrayValue;
+    for (int64_t t : collectorTime)
+    {
+        results["timing"]["collector_time"].append(static_cast<Json::Value::Int64>(t));
+    }
+    for (Collector* c : mRunning)
+    {
+        if (c->isThreaded())
+        {
+            continue;
+        }
+        const std::vector<int64_t>& collect = c->overhead.collectSummarized.empty() ? c->overhead.collect : c->overhead.collectSummarized;
+        Json::Value& v = results["timing"]["collect:" + c->name()];
+        v = Json::arrayValue;
+        for (int64_t t : collect)
+        {
+            v.append(static_cast<Json::Value::Int64>(t));
+        }
+    }
+    for (Collector* c : mRunning)
+    {
+        if (c->overhead.summarize.empty())
+        {
+            continue;
+        }
+        Json::Value& v = results["timing"]["summarize:" + c->name()];
+        v = Json::arrayValue;
+        for (int64_t t : c->overhead.summarize)
+        {
+            v.append(static_cast<Json::Value::Int64>(t));
+        }
+    }
+    for (const std::string& name : mDisabled)
+    {
+        results["overhead_disabled"].append(name);
+    }
     for (unsigned i = 0; i < mCustomHeaders.size(); i++)
     {
         results["custom"][mCustomHeaders[i]] = Json::arrayValue;
@@ -475,6 +994,50 @@ Json::Value Collection::results()
     return results;
 }
 
+Json::Value Collection::energyResults() const
+{
+    // summed over the collectors that measure power, which may cover fewer frames than were run
+    std::vector<double> frames;
+    for (const Collector* c : mRunning)
+    {
+        const std::vector<double>& energy = c->energy();
+        if (energy.size() > frames.size())
+        {
+            frames.resize(energy.size(), 0.0);
+        }
+        for (size_t i = 0; i < energy.size(); i++)
+        {
+            frames[i] += energy[i];
+        }
+    }
+    if (frames.empty())
+    {
+        return Json::Value();
+    }
+
+    Json::Value result;
+    result["frame_joules"] = Json::arrayValue;
+    result["loop_joules"] = Json::arrayValue;
+    double total = 0.0;
+    double loop = 0.0;
+    size_t loopIndex = 0;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        result["frame_joules"].append(frames[i]);
+        total += frames[i];
+        loop += frames[i];
+        if ((loopIndex < mLoopEnds.size() && i + 1 == mLoopEnds[loopIndex]) || i + 1 == frames.size())
+        {
+            result["loop_joules"].append(loop);
+            loop = 0.0;
+            loopIndex++;
+        }
+    }
+    result["total_joules"] = total;
+    result["joules_per_frame"] = total / frames.size();
+    return result;
+}
+
 bool Collection::writeCSV_MTV(const std::string& filename)
 {
     FILE *fp = fopen(filename.c_str(), "w");
@@ -519,11 +1082,49 @@ bool Collection::writeCSV_MTV(const std::string& filename)
 
 void Collection::summarize()
 {
-    for (auto c : mCollectors) c->summarize();
+    if (mLoopEnds.empty() || mLoopEnds.back() < mRunTiming.size())
+    {
+        mLoopEnds.push_back(mRunTiming.size());
+    }
+    summarizeFrames();
+}
+
+void Collection::summarizeFrames()
+{
+    if (mTiming.empty())
+    {
+        return; // no frames since the last summary
+    }
+    alignThreaded(); // before the frames are summarized away
+    mAlignedFrames = 0;
+    for (auto c : mRunning)
+    {
+        if (c->overhead.disabled)
+        {
+            continue; // has no values for the later frames
+        }
+        const int64_t before = getTime();
+        c->summarize();
+        c->overhead.summarize.push_back(getTime() - before);
+        if (!c->overhead.collect.empty())
+        {
+            int64_t sum = 0;
+            for (auto t : c->overhead.collect) sum += t;
+            c->overhead.collectSummarized.push_back(sum / (int64_t)c->overhead.collect.size());
+            c->overhead.collect.clear();
+        }
+    }
     int64_t sum = 0;
     for (auto c : mTiming) sum += c;
     mTimingSummarized.push_back(sum / (int64_t)mTiming.size());
     mTiming.clear();
+    if (!mCollectorTime.empty())
+    {
+        sum = 0;
+        for (auto c : mCollectorTime) sum += c;
+        mCollectorTimeSummarized.push_back(sum / (int64_t)mCollectorTime.size());
+        mCollectorTime.clear();
+    }
     for (unsigned i = 0; i < mCustom.size(); i++)
     {
         int64_t sum = 0;
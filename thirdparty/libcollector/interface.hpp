@@ -5,12 +5,16 @@
 #include <string>
 #include <cmath>
 #include <map>
+#include <deque>
 #include <stdint.h>
 #include <stdlib.h>
 #include <atomic>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <pthread.h>
 #include <chrono>
+#include <stdio.h>
 
 #include <jsoncpp/json/value.h>
 
@@ -44,6 +48,12 @@ struct CollectorValueList
     enum vtype type = TYPE_UNASSIGNED;
     std::vector<CollectorValue> list;
     std::vector<CollectorValue> summaries;
+    CollectorValue carry; ///< counted in spans, to add to the next value
+    bool carried = false;
+    /// Microseconds spent at each value, per frame, for metrics of threaded collectors asked
+    /// for their "residency", such as the time at each frequency
+    std::vector<std::map<int64_t, int64_t>> residency;
+    std::vector<std::map<int64_t, int64_t>> residencySummaries;
 
     void push_back(double val) { assert(type == TYPE_UNASSIGNED || type == TYPE_FP64); type = TYPE_FP64; CollectorValue fp64; fp64.fp64 = val; list.push_back(fp64); }
     void push_back(float val) { assert(type == TYPE_UNASSIGNED || type == TYPE_FP64); type = TYPE_FP64; CollectorValue fp64; fp64.fp64 = val; list.push_back(fp64); }
@@ -63,15 +73,104 @@ struct CollectorValueList
         case TYPE_U64: { uint64_t s = 0; for (const auto v : list) s += v.u64; CollectorValue c; c.u64 = s / (uint64_t)list.size(); summaries.push_back(c); list.clear(); } break;
         case TYPE_UNASSIGNED: assert(false); break;
         }
+        if (!residency.empty())
+        {
+            std::map<int64_t, int64_t> total;
+            for (const auto& frame : residency) for (const auto& pair : frame) total[pair.first] += pair.second;
+            residencySummaries.push_back(total);
+            residency.clear();
+        }
     }
-    void clear() { list.clear(); }
+    void clear() { list.clear(); residency.clear(); carried = false; }
+    void reserve(size_t samples) { list.reserve(samples); }
     size_t size() const { return list.size(); }
     CollectorValue at(int index) const { return list.at(index); }
     const std::vector<CollectorValue>& data() const { if (summaries.size() > 0) return summaries; else return list; }
+    const std::vector<std::map<int64_t, int64_t>>& residencyData() const { if (residencySummaries.size() > 0) return residencySummaries; else return residency; }
 };
 
 typedef std::map<std::string, CollectorValueList> CollectorValueResults;
 
+struct CollectorMetric;
+
+// Value taken on the thread of a threaded collector, and when
+struct CollectorSample
+{
+    int64_t time;
+    CollectorMetric* metric;
+    CollectorValue value;
+    CollectorValueList::vtype type;
+};
+
+// Lock-free ring for handing samples from one producer thread to one consumer thread
+class CollectorSampleRing
+{
+public:
+    /// Room for at least capacity samples. Not while either thread uses the ring.
+    void resize(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) size *= 2;
+        mSlots.resize(size);
+        mMask = size - 1;
+        clear();
+    }
+    void clear() { mHead.store(0); mTail.store(0); }
+    bool empty() const { return mSlots.empty(); }
+
+    /// Producer only. False, dropping the sample, if the ring is full.
+    bool push(const CollectorSample& sample)
+    {
+        const size_t head = mHead.load(std::memory_order_relaxed);
+        if (head - mTail.load(std::memory_order_acquire) >= mSlots.size()) return false;
+        mSlots[head & mMask] = sample;
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer only
+    bool pop(CollectorSample& sample)
+    {
+        const size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mHead.load(std::memory_order_acquire)) return false;
+        sample = mSlots[tail & mMask];
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<CollectorSample> mSlots;
+    size_t mMask = 0;
+    std::atomic<size_t> mHead{0};
+    char mPadding[64]; // keep the two ends off the same cache line
+    std::atomic<size_t> mTail{0};
+};
+
+// Metric registered with Collector::metric()
+struct CollectorMetric
+{
+    std::string key;
+    CollectorValueList* values = nullptr; ///< into the results, once the metric has its first value
+
+    // Used by the collection thread only, for samples of a threaded collector
+    CollectorValueList::vtype type = CollectorValueList::TYPE_UNASSIGNED;
+    bool sampled = false; ///< whether in Collector::mSampled
+    bool held = false; ///< whether last is set
+    CollectorValue last; ///< latest sample aligned with a frame
+    std::vector<CollectorSample> pending; ///< samples not yet aligned with a frame, in time order
+};
+
+// Time spent inside a collector, kept by the Collection to report what collecting costs
+struct CollectorOverhead
+{
+    std::vector<int64_t> collect; ///< in collect() on the collection thread, per frame, in microseconds
+    std::vector<int64_t> collectSummarized; ///< averages of collect, per summary
+    std::vector<int64_t> summarize; ///< in summarize(), per summary
+    int64_t window = 0; ///< in collect() on the collection thread since the last budget check
+    int64_t threadBase = 0; ///< threadTime() at the last budget check
+    bool disabled = false; ///< by the overhead budget, for the rest of the run
+};
+
 // General collector class
 class Collector
 {
@@ -86,6 +185,7 @@ public:
 
     virtual bool start() { mCollecting = true; return true; }
     virtual bool stop() { mCollecting = false; return true; }
+    /// Once stopped, with the samples of a threaded collector already aligned with the frames
     virtual bool postprocess(const std::vector<int64_t>& timing);
     virtual bool collect( int64_t ) = 0;
     virtual bool collecting() const { return mCollecting; }
@@ -93,12 +193,27 @@ public:
     virtual bool available() = 0;
 
     virtual const CollectorValueResults& results() const final { return mResults; }
+    /// Joules used in each frame since start(), by a collector that measures power, once it
+    /// has been postprocessed
+    virtual const std::vector<double>& energy() const final { return mEnergy; }
     virtual const Json::Value customResults() const final { return mCustomResult; }
     virtual void doubleTransform(double factor) final { mFactor = factor; }
     virtual void useThreading(int sampleRate) final;
     virtual bool isThreaded() const final { return mIsThreaded; }
     virtual bool isSummarized() const final { return mIsSummarized; }
 
+    /// Whether what collect() adds are counts since it was last called, so that a frame can be
+    /// split into spans with collectSpan().
+    virtual bool countsSinceLast() const { return false; }
+
+    /// Collect at a point inside a frame, for a collector whose countsSinceLast(). Returns the
+    /// values counted since the previous span or frame, by metric, and keeps them to add to
+    /// the value of the frame, so that frames still get their full counts.
+    virtual Json::Value collectSpan(int64_t now) final;
+
+    /// Add what was counted in spans to the value just collected for the frame
+    virtual void foldSpans() final;
+
     virtual void summarize()
     {
         for (auto& pair : mResults)
@@ -115,23 +230,68 @@ public:
         {
             pair.second.clear();
         }
+        mEnergy.clear();
     }
 
-    virtual void add(const std::string& key, double value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, float value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, int value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, long value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, long long value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, unsigned value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, unsigned long value) final { mResults[key].push_back(value); }
+    /// On the collector thread of a threaded collector, add() hands the value with the time of
+    /// the sample to the collection thread, and the values are matched with frames later.
+    virtual void add(const std::string& key, double value) final { if (mIsThreaded) sample(metric(key), value); else mResults[key].push_back(value); }
+    virtual void add(const std::string& key, float value) final { if (mIsThreaded) sample(metric(key), value); else mResults[key].push_back(value); }
+    virtual void add(const std::string& key, int value) final { if (mIsThreaded) sample(metric(key), value); else mResults[key].push_back(value); }
+    virtual void add(const std::string& key, long value) final { if (mIsThreaded) sample(metric(key), value); else mResults[key].push_back(value); }
+    virtual void add(const std::string& key, long long value) final { if (mIsThreaded) sample(metric(key), value); else mResults[key].push_back(value); }
+    virtual void add(const std::string& key, unsigned value) final { if (mIsThreaded) sample(metric(key), value); else mResults[key].push_back(value); }
+    virtual void add(const std::string& key, unsigned long value) final { if (mIsThreaded) sample(metric(key), value); else mResults[key].push_back(value); }
+
+    /// Register a metric by name once, typically in init(), and pass the returned handle to add()
+    /// instead of the name, so that a sample costs no lookup by string. Registering a name
+    /// again returns the same handle. A metric only appears in the results once it has a value.
+    virtual int metric(const std::string& key) final;
+
+    virtual void add(int handle, double value) final { if (mIsThreaded) sample(handle, value); else values(handle).push_back(value); }
+    virtual void add(int handle, float value) final { if (mIsThreaded) sample(handle, value); else values(handle).push_back(value); }
+    virtual void add(int handle, int value) final { if (mIsThreaded) sample(handle, value); else values(handle).push_back(value); }
+    virtual void add(int handle, long value) final { if (mIsThreaded) sample(handle, value); else values(handle).push_back(value); }
+    virtual void add(int handle, long long value) final { if (mIsThreaded) sample(handle, value); else values(handle).push_back(value); }
+    virtual void add(int handle, unsigned value) final { if (mIsThreaded) sample(handle, value); else values(handle).push_back(value); }
+    virtual void add(int handle, unsigned long value) final { if (mIsThreaded) sample(handle, value); else values(handle).push_back(value); }
+
+    /// Preallocate room for this many samples of every metric, so that adding them does not
+    /// allocate while frames are measured.
+    virtual void reserve(size_t samples) final;
 
     /// For multi-threaded operation, this loop is called instead of owning class calling collect() directly.
     virtual void loop() final;
 
+    /// Start the collector thread, for frames timed from epoch
+    virtual void startThread(int64_t epoch) final;
+
+    /// Take the samples the collector thread has handed over so far. Called by the collection
+    /// thread every frame, so that the ring does not fill up.
+    virtual void drain() final;
+
+    /// Turn the samples of a threaded collector into one value per frame, for frames of the
+    /// given durations that follow those already aligned. Each frame gets the latest value
+    /// sampled by its end, or the first one if none were sampled until then. With "residency"
+    /// in its configuration, the frames of integer metrics also get the time spent at each
+    /// value, taking every sample to hold until the next one.
+    virtual void align(const std::vector<int64_t>& timing) final;
+
+    /// Time the collector thread has spent in collect() since it was started, in microseconds
+    virtual int64_t threadTime() const final { return mThreadTime.load(std::memory_order_relaxed); }
+    /// Samples the collector thread has taken since it was started
+    virtual unsigned threadSamples() const final { return mThreadSamples.load(std::memory_order_relaxed); }
+
+    /// Sample half as often, to cut the cost of a threaded collector
+    virtual void lowerSampleRate() final { mSampleRate = mSampleRate * 2; }
+    virtual int sampleRate() const final { return mSampleRate; }
+
     /// If threaded, this holds the thread information
     std::thread thread;
     /// Set this to true in order to stop collecting data
     std::atomic<bool> finished;
+    /// Kept by the Collection
+    CollectorOverhead overhead;
 
     virtual void setDebug(bool debug) final { mDebug = debug; }
 
@@ -142,8 +302,9 @@ protected:
     bool mIsThreaded = false;
     /// Is this collector being summarized?
     bool mIsSummarized = false;
-    /// Ideal sample rate in milliseconds
-    int mSampleRate;
+    /// Ideal sample rate in milliseconds. Atomic, as the overhead budget may lower it while the
+    /// collector thread runs.
+    std::atomic<int> mSampleRate;
     /// Are we collecting?
     bool mCollecting;
     /// Data for each sampling point
@@ -156,6 +317,62 @@ protected:
     double mFactor;
     /// Custom results (replaces sampling points)
     Json::Value mCustomResult;
+    /// Joules per frame, see energy()
+    std::vector<double> mEnergy;
+
+private:
+    CollectorValueList& values(int handle)
+    {
+        CollectorMetric& m = mMetrics[handle];
+        if (!m.values)
+        {
+            m.values = &mResults[m.key];
+            m.values->reserve(mReserved);
+        }
+        return *m.values;
+    }
+
+    static CollectorValue value(double v, CollectorValueList::vtype& type) { CollectorValue c; c.fp64 = v; type = CollectorValueList::TYPE_FP64; return c; }
+    static CollectorValue value(float v, CollectorValueList::vtype& type) { CollectorValue c; c.fp64 = v; type = CollectorValueList::TYPE_FP64; return c; }
+    static CollectorValue value(int v, CollectorValueList::vtype& type) { CollectorValue c; c.i64 = v; type = CollectorValueList::TYPE_I64; return c; }
+    static CollectorValue value(long v, CollectorValueList::vtype& type) { CollectorValue c; c.i64 = v; type = CollectorValueList::TYPE_I64; return c; }
+    static CollectorValue value(long long v, CollectorValueList::vtype& type) { CollectorValue c; c.i64 = v; type = CollectorValueList::TYPE_I64; return c; }
+    static CollectorValue value(unsigned v, CollectorValueList::vtype& type) { CollectorValue c; c.u64 = v; type = CollectorValueList::TYPE_U64; return c; }
+    static CollectorValue value(unsigned long v, CollectorValueList::vtype& type) { CollectorValue c; c.u64 = v; type = CollectorValueList::TYPE_U64; return c; }
+
+    template<typename T> void sample(int handle, T v)
+    {
+        CollectorSample s;
+        s.time = mSampleTime;
+        s.metric = &mMetrics[handle];
+        s.value = value(v, s.type);
+        if (!mRing.push(s))
+        {
+            mDropped++;
+        }
+    }
+
+    /// Registered metrics, by handle. A deque, so that while its collector thread registers
+    /// more, the collection thread can still use the samples that point at earlier ones.
+    std::deque<CollectorMetric> mMetrics;
+    /// Samples per metric to preallocate
+    size_t mReserved = 0;
+    /// Whether any list has a carry from collectSpan()
+    bool mSpanned = false;
+
+    /// Collector thread to collection thread handoff
+    CollectorSampleRing mRing;
+    /// Time of the sample being taken on the collector thread
+    int64_t mSampleTime = 0;
+    /// Samples dropped as the ring was full, counted on the collector thread
+    unsigned mDropped = 0;
+    /// Metrics the collection thread has samples of
+    std::vector<CollectorMetric*> mSampled;
+    /// End of the frames aligned so far
+    int64_t mAligned = 0;
+    /// Spent in collect() on the collector thread, and the samples taken there
+    std::atomic<int64_t> mThreadTime{0};
+    std::atomic<unsigned> mThreadSamples{0};
 };
 
 // Specialized collector class for handling /sys filesystem polling
@@ -177,6 +394,32 @@ protected:
 private:
     int mFD = -2;
     bool mAccumulative = false;
+    int mValue; ///< metric handle of mName
+};
+
+// Appends lines to a file on a background thread, flushing them as they come, so that the
+// thread handing them over does not wait for the disk, and a crash loses little
+class CollectorStream
+{
+public:
+    ~CollectorStream() { close(); }
+
+    bool open(const std::string& filename);
+    void close();
+    bool isOpen() const { return mFile != nullptr; }
+
+    /// Queue one line, without its newline
+    void write(const std::string& line);
+
+private:
+    void loop();
+
+    FILE* mFile = nullptr;
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::vector<std::string> mQueue;
+    bool mDone = false;
 };
 
 // Manager class
@@ -208,10 +451,11 @@ public:
     /// Return reference to a named collector.
     Collector* collector(const std::string& name);
 
-    /// Add custom collector
+    /// Add custom collector, which can then be initialized by name
     void addCollector(Collector* collector)
     {
         mCollectors.push_back(collector);
+        mCollectorMap[collector->name()] = collector;
     }
 
     /// Add generic sysfs collector
@@ -235,10 +479,34 @@ public:
     /// Stop collecting data
     void stop();
 
-    /// Summarize existing data as an average. Useful for looping tests. Once this has been
-    /// called once, what you get out with results() later will be these averages.
+    /// Collect at a point inside the current frame, from the collectors that are not threaded
+    /// and count since they were last collected, such as perf and malicounters. Returns what
+    /// they counted since the previous span or frame, by collector and metric. The frames
+    /// still get their full counts, so this can split frames into render passes or draws.
+    Json::Value collectSpan();
+
+    /// Expected number of calls to collect(), for which start() preallocates the results of the
+    /// collectors that are not threaded, the timing and the custom data. Zero if not known.
+    void reserve(unsigned frames) { mExpectedFrames = frames; }
+
+    /// Summarize existing data as an average. Useful for looping tests, where it marks the end
+    /// of a loop. Once this has been called once, what you get out with results() later will be
+    /// these averages, apart from the energy of every frame.
     void summarize();
 
+    /// Per-frame budget, in microseconds, for the time collectors may take away from the frames.
+    /// Every few frames the collector that took the most is made cheaper: a threaded one samples
+    /// half as often, and one that is not threaded is disabled for the rest of the run. Zero, the
+    /// default, or "overhead_budget" in the JSON, for no budget.
+    void setOverheadBudget(int64_t budget) { mOverheadBudget = budget; }
+
+    /// Stream the results of every frame to a file as they are collected, one JSON object per
+    /// line, from the next start() on. To keep memory bounded in long runs, the results are
+    /// then summarized every window frames, as well as by summarize(), and once more by stop(),
+    /// so that results() only has averages. An empty filename, the default, or "stream_file" and
+    /// "stream_window" in the JSON, for no streaming.
+    void setStream(const std::string& filename, unsigned window = 600) { mStreamFile = filename; mStreamWindow = window; }
+
     /// Check if any collector is running
     bool is_running() const { return running; }
 
@@ -252,6 +520,17 @@ public:
     const Json::Value& config() { return mConfig; }
 
 private:
+    /// Make the costliest collector cheaper, if they took more than the budget in the last frames
+    void checkOverheadBudget();
+    /// Give the threaded collectors their values for the frames that do not have them yet
+    void alignThreaded();
+    /// Average the frames since the last summary
+    void summarizeFrames();
+    /// Joules per frame, per loop and in total from the collectors that measure power
+    Json::Value energyResults() const;
+    /// Append the values of the frame just collected to the stream
+    void streamFrame();
+
     bool running = false;
     Json::Value mConfig;
     std::vector<Collector*> mCollectors;
@@ -259,10 +538,24 @@ private:
     std::map<std::string, Collector*> mCollectorMap;
     std::vector<int64_t> mTiming;
     std::vector<int64_t> mTimingSummarized;
+    std::vector<int64_t> mRunTiming; // every frame since start(), kept through summaries for postprocess()
+    std::vector<size_t> mLoopEnds; // frames of mRunTiming at the end of each loop
     std::vector<std::vector<int64_t>> mCustom; // custom results
     std::vector<std::vector<int64_t>> mCustomSummarized; // custom results
     std::vector<std::string> mCustomHeaders;
+    std::vector<int64_t> mCollectorTime; // in collect() of all collectors, per frame
+    std::vector<int64_t> mCollectorTimeSummarized;
+    std::vector<std::string> mDisabled; // by the overhead budget
+    int64_t mOverheadBudget = 0;
+    unsigned mBudgetFrames = 0; // since the last budget check
+    size_t mAlignedFrames = 0; // of mTiming, for the threaded collectors
+    std::string mStreamFile;
+    unsigned mStreamWindow = 600;
+    CollectorStream mStream;
+    unsigned mFrames = 0; // collected since start(), as numbered in the stream
+    std::string mStreamLine; // reused, to keep its capacity
     int64_t mStartTime = 0;
     int64_t mPreviousTime = 0;
+    unsigned mExpectedFrames = 0;
     bool mDebug = false;
 };
@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <stdio.h>
 #include <jsoncpp/json/writer.h>
+#include <jsoncpp/json/reader.h>
+#include <fstream>
 #include <unistd.h>
 
 #ifndef DEBUG
@@ -261,6 +263,302 @@ static void test7()
 	c.writeCSV("excel.csv");
 }
 
+static void test8()
+{
+	printf("Trying collectors with preallocated results, twice, one of them threaded (should work)...\n");
+	Json::Value j;
+	Json::Value v;
+	v["threaded"] = true;
+	v["sample_rate"] = 5;
+	j["procfs"] = v;
+	Collection c(j);
+	bool result = c.initialize({"rusage", "memory"});
+	assert(result);
+	c.reserve(5);
+	for (int run = 0; run < 2; run++)
+	{
+		c.start({"result1"});
+		for (int i = 0; i < 8; i++) // more than expected
+		{
+			c.collect({i});
+			usleep(1000 + random() % 1000);
+		}
+		c.stop();
+		Json::Value results = c.results();
+		for (const std::string& s : results.getMemberNames()) // verify that we get exactly 8 results
+		{
+			Json::Value collector = results[s];
+			assert(collector.isObject());
+			for (const std::string& k : collector.getMemberNames())
+			{
+				assert(results[s][k].isArray());
+				assert(results[s][k].size() == 8);
+			}
+		}
+		assert(results["rusage"].isMember("UserCPUTime"));
+		assert(results["memory"].isMember("memory_used"));
+		assert(results["procfs"].isMember("threads"));
+	}
+}
+
+static void test9()
+{
+	printf("Trying threaded collectors at 1 kHz, with and without summaries (should work)...\n");
+	Json::Value j;
+	Json::Value v;
+	v["threaded"] = true;
+	v["sample_rate"] = 1;
+	j["procfs"] = v;
+	j["rusage"] = v;
+	Collection c(j);
+	bool result = c.initialize();
+	assert(result);
+	c.start();
+	for (int i = 0; i < 50; i++)
+	{
+		usleep(500 + random() % 3000);
+		c.collect();
+	}
+	c.stop();
+	Json::Value results = c.results();
+	assert(results["rusage"]["UserCPUTime"].size() == 50);
+	assert(results["procfs"]["threads"].size() == 50);
+	c.start();
+	for (int loop = 0; loop < 3; loop++)
+	{
+		for (int i = 0; i < 20; i++)
+		{
+			usleep(500 + random() % 3000);
+			c.collect();
+		}
+		c.summarize();
+	}
+	c.stop();
+	results = c.results();
+	Json::StyledWriter writer;
+	std::string data = writer.write(results);
+	printf("Results:\n%s", data.c_str());
+	assert(results["rusage"]["UserCPUTime"].size() == 3);
+	assert(results["procfs"]["cpu_time"].size() == 3);
+}
+
+// counts the calls to collect() since the previous one
+class CallCountCollector : public Collector
+{
+public:
+	CallCountCollector(const Json::Value& config) : Collector(config, "callcount") {}
+	bool collect(int64_t) override { add(mCalls, 1u); return true; }
+	bool available() override { return true; }
+	bool countsSinceLast() const override { return true; }
+private:
+	int mCalls = metric("calls");
+};
+
+static void test10()
+{
+	printf("Trying spans inside frames (should work)...\n");
+	Json::Value j;
+	Collection c(j);
+	c.addCollector(new CallCountCollector(j));
+	bool result = c.initialize({"rusage"});
+	assert(result);
+	c.initialize_collector("callcount");
+	c.start();
+	for (int i = 0; i < 4; i++)
+	{
+		for (int span = 0; span < i; span++)
+		{
+			Json::Value values = c.collectSpan();
+			assert(values["callcount"]["calls"].asUInt() == 1);
+			assert(!values.isMember("rusage"));
+		}
+		c.collect();
+	}
+	c.stop();
+	Json::Value results = c.results();
+	assert(results["callcount"]["calls"].size() == 4);
+	for (unsigned i = 0; i < 4; i++)
+	{
+		assert(results["callcount"]["calls"][i].asUInt() == i + 1); // the spans and the rest of the frame
+	}
+}
+
+// takes its time over every sample
+class SlowCollector : public Collector
+{
+public:
+	SlowCollector(const Json::Value& config, const std::string& name, unsigned delay) : Collector(config, name), mDelay(delay) {}
+	bool collect(int64_t) override { usleep(mDelay); add(mValue, 1); return true; }
+	bool available() override { return true; }
+private:
+	unsigned mDelay;
+	int mValue = metric("value");
+};
+
+static void test11()
+{
+	printf("Trying an overhead budget that slow collectors go over (should work)...\n");
+	Json::Value j;
+	Json::Value v;
+	v["threaded"] = true;
+	v["sample_rate"] = 1;
+	j["slowthread"] = v;
+	j["overhead_budget"] = 100;
+	Collection c(j);
+	c.addCollector(new SlowCollector(j, "slow", 2000));
+	c.addCollector(new SlowCollector(j, "slowthread", 200));
+	bool result = c.initialize({"rusage", "slow"});
+	assert(result);
+	c.start();
+	for (int i = 0; i < 120; i++)
+	{
+		usleep(1000);
+		c.collect();
+	}
+	c.stop();
+	Json::Value results = c.results();
+	Json::StyledWriter writer;
+	std::string data = writer.write(results);
+	printf("Results:\n%s", data.c_str());
+	// slow went first, being the costlier, and the collector thread was left to sample less often
+	assert(results["overhead_disabled"].size() == 1);
+	assert(results["overhead_disabled"][0].asString() == "slow");
+	assert(!results.isMember("slow"));
+	assert(c.collector("slowthread")->sampleRate() > 1);
+	assert(results["slowthread"]["value"].size() == 120);
+	assert(results["timing"]["collector_time"].size() == 120);
+	assert(results["timing"]["collect:rusage"].size() == 120);
+	assert(results["timing"]["collector_time"][0].asInt64() >= 2000); // slow, before it was disabled
+	assert(results["timing"]["collector_time"][119].asInt64() < 2000);
+}
+
+static void test12()
+{
+	printf("Trying to stream results to a file, summarizing every 10 frames (should work)...\n");
+	Json::Value j;
+	Json::Value v;
+	v["threaded"] = true;
+	v["sample_rate"] = 1;
+	j["procfs"] = v;
+	j["rusage"] = Json::objectValue;
+	j["stream_file"] = "stream.ndjson";
+	j["stream_window"] = 10;
+	Collection c(j);
+	bool result = c.initialize();
+	assert(result);
+	c.start({"index"});
+	for (int i = 0; i < 25; i++)
+	{
+		usleep(1000 + random() % 2000);
+		c.collect({i});
+	}
+	c.stop();
+	Json::Value results = c.results();
+	assert(results["timing"]["time"].size() == 3); // 10, 10 and 5 frames
+	assert(results["rusage"]["UserCPUTime"].size() == 3);
+	assert(results["procfs"]["threads"].size() == 3);
+	assert(results["custom"]["index"][2].asInt() == 22);
+	std::ifstream stream("stream.ndjson");
+	std::string line;
+	int frames = 0;
+	while (std::getline(stream, line))
+	{
+		Json::Value frame;
+		Json::Reader reader;
+		result = reader.parse(line, frame);
+		assert(result);
+		assert(frame["frame"].asInt() == frames);
+		assert(frame["custom"]["index"].asInt() == frames);
+		assert(frame["time"].asInt64() > 0);
+		assert(frame["rusage"].isMember("UserCPUTime"));
+		assert(frames == 0 || frame["procfs"].isMember("threads"));
+		frames++;
+	}
+	assert(frames == 25);
+}
+
+// switches between two frequencies on every sample
+class FlipFreqCollector : public Collector
+{
+public:
+	FlipFreqCollector(const Json::Value& config) : Collector(config, "flipfreq") {}
+	bool collect(int64_t) override { mHigh = !mHigh; add(mFreq, mHigh ? 2000000 : 1000000); return true; }
+	bool available() override { return true; }
+private:
+	bool mHigh = false;
+	int mFreq = metric("freq");
+};
+
+// uses a joule in every frame
+class JouleCollector : public Collector
+{
+public:
+	JouleCollector(const Json::Value& config) : Collector(config, "joule") {}
+	bool collect(int64_t) override { return true; }
+	bool available() override { return true; }
+	bool postprocess(const std::vector<int64_t>& timing) override { mEnergy.assign(timing.size(), 1.0); return true; }
+};
+
+static void test13()
+{
+	printf("Trying energy per frame and loop, and frequency residency per frame (should work)...\n");
+	Json::Value j;
+	Json::Value v;
+	v["threaded"] = true;
+	v["sample_rate"] = 1;
+	v["residency"] = true;
+	j["flipfreq"] = v;
+	Collection c(j);
+	c.addCollector(new FlipFreqCollector(j));
+	c.addCollector(new JouleCollector(j));
+	bool result = c.initialize({"flipfreq", "joule"});
+	assert(result);
+	c.start();
+	for (int i = 0; i < 20; i++)
+	{
+		usleep(3000 + random() % 3000);
+		c.collect();
+	}
+	c.stop();
+	Json::Value results = c.results();
+	Json::StyledWriter writer;
+	std::string data = writer.write(results);
+	printf("Results:\n%s", data.c_str());
+	const Json::Value& residency = results["flipfreq"]["residency"]["freq"];
+	assert(residency.size() == 20);
+	for (unsigned i = 1; i < 20; i++) // the first frame may start before the first sample
+	{
+		int64_t total = 0;
+		for (const std::string& freq : residency[i].getMemberNames())
+		{
+			assert(freq == "1000000" || freq == "2000000");
+			total += residency[i][freq].asInt64();
+		}
+		assert(total == results["timing"]["time"][i].asInt64());
+	}
+	assert(results["energy"]["frame_joules"].size() == 20);
+	assert(results["energy"]["loop_joules"].size() == 1);
+	assert(results["energy"]["total_joules"].asDouble() == 20.0);
+
+	c.start();
+	for (int loop = 0; loop < 3; loop++)
+	{
+		for (int i = 0; i < 5 + loop; i++)
+		{
+			usleep(2000);
+			c.collect();
+		}
+		c.summarize();
+	}
+	c.stop();
+	results = c.results();
+	assert(results["energy"]["frame_joules"].size() == 18); // not summarized
+	assert(results["energy"]["loop_joules"].size() == 3);
+	assert(results["energy"]["loop_joules"][2].asDouble() == 7.0);
+	assert(results["energy"]["joules_per_frame"].asDouble() == 1.0);
+	assert(results["flipfreq"]["residency"]["freq"].size() == 3);
+}
+
 int main()
 {
 	srandom(time(NULL));
@@ -272,6 +570,12 @@ int main()
 	test5();
 	test6();
 	test7(); // summarized results
+	test8();
+	test9();
+	test10();
+	test11();
+	test12();
+	test13();
 	printf("ALL DONE!\n");
 	return 0;
 }